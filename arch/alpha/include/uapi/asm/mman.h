@@ -71,6 +71,9 @@
 #define MADV_COLD	20		/* deactivate these pages */
 #define MADV_PAGEOUT	21		/* reclaim these pages */
 
+#define MADV_COLLAPSE	25		/* Synchronous hugepage collapse */
+#define MADV_STRIDED	26		/* expect strided page references */
+
 /* compatibility flags */
 #define MAP_FILE	0
 
@@ -50,6 +50,8 @@
 
 #define MADV_COLD	20		/* deactivate these pages */
 #define MADV_PAGEOUT	21		/* reclaim these pages */
+#define MADV_COLLAPSE	25		/* Synchronous hugepage collapse */
+#define MADV_STRIDED	26		/* expect strided page references */
 
 #define MADV_MERGEABLE   65		/* KSM may merge identical pages */
 #define MADV_UNMERGEABLE 66		/* KSM may not merge identical pages */
@@ -12,7 +12,9 @@
 #include <linux/pci.h>
 #include <linux/ptrace.h>
 #include <linux/syscore_ops.h>
+#include <linux/moduleparam.h>
 #include <linux/sched/clock.h>
+#include <linux/sched/numa_balancing.h>
 
 #include <asm/apic.h>
 
@@ -30,6 +32,47 @@ static u32 ibs_caps;
 #define IBS_FETCH_CONFIG_MASK	(IBS_FETCH_RAND_EN | IBS_FETCH_MAX_CNT)
 #define IBS_OP_CONFIG_MASK	IBS_OP_MAX_CNT
 
+/*
+ * IBS op config1, filters applied in the NMI handler before a sample or
+ * AUX record is written, and AUX output selection:
+ *
+ *  ldlat:  only keep loads that missed the data cache with a miss latency
+ *          of at least this many cycles
+ *  dram:   only keep ops whose data was sourced from DRAM
+ *  remote: only keep ops whose data was sourced from a remote node
+ *  aux:    write raw IBS register snapshots to the AUX area instead of
+ *          generating samples
+ */
+#define IBS_OP_CONFIG1_LDLAT	0x000000000000ffffULL
+#define IBS_OP_CONFIG1_DRAM	BIT_ULL(16)
+#define IBS_OP_CONFIG1_REMOTE	BIT_ULL(17)
+#define IBS_OP_CONFIG1_AUX	BIT_ULL(63)
+#define IBS_OP_CONFIG1_FILTER	(IBS_OP_CONFIG1_LDLAT | IBS_OP_CONFIG1_DRAM | \
+				 IBS_OP_CONFIG1_REMOTE)
+#define IBS_OP_CONFIG1_MASK	(IBS_OP_CONFIG1_FILTER | IBS_OP_CONFIG1_AUX)
+
+/* IbsOpData2 */
+#define IBS_OP_DATA2_DATA_SRC		0x7ULL
+#define IBS_OP_DATA2_DATA_SRC_DRAM	0x3ULL
+#define IBS_OP_DATA2_RMT_NODE		BIT_ULL(4)
+
+/* IbsOpData3 */
+#define IBS_OP_DATA3_LD_OP		BIT_ULL(0)
+#define IBS_OP_DATA3_DC_MISS		BIT_ULL(7)
+#define IBS_OP_DATA3_DC_LIN_ADDR_VALID	BIT_ULL(17)
+#define IBS_OP_DATA3_DC_PHY_ADDR_VALID	BIT_ULL(18)
+#define IBS_OP_DATA3_DC_MISS_LAT_SHIFT	32
+#define IBS_OP_DATA3_DC_MISS_LAT	(0xffffULL << IBS_OP_DATA3_DC_MISS_LAT_SHIFT)
+
+/* IbsDcPhysAd */
+#define IBS_DC_PHYS_ADDR_MASK		GENMASK_ULL(51, 0)
+
+/* Index of the IBS op registers in perf_ibs_data::regs */
+#define IBS_OP_REG_DATA2	3
+#define IBS_OP_REG_DATA3	4
+#define IBS_OP_REG_DC_LINADDR	5
+#define IBS_OP_REG_DC_PHYSADDR	6
+
 
 /*
  * IBS states:
@@ -77,6 +120,7 @@ enum ibs_states {
 struct cpu_perf_ibs {
 	struct perf_event	*event;
 	unsigned long		state[BITS_TO_LONGS(IBS_MAX_STATES)];
+	struct perf_output_handle handle;	/* AUX output */
 };
 
 struct perf_ibs {
@@ -107,6 +151,34 @@ struct perf_ibs_data {
 	u64		regs[MSR_AMD64_IBS_REG_COUNT_MAX];
 };
 
+/*
+ * AUX area buffer for raw IBS op records. The records are written by
+ * the NMI handler, each one is:
+ *
+ *	struct perf_ibs_aux_record {
+ *		u32	size;		// record size in bytes
+ *		u32	caps;		// IBS capabilities, CPUID Fn8000_001B_EAX
+ *		u64	tsc;		// time stamp counter at the NMI
+ *		u64	regs[];		// IbsOpCtl, IbsOpRip, IbsOpData, ...
+ *	};
+ *
+ * in the same register order as PERF_SAMPLE_RAW data. Records are made
+ * visible to userspace through user_page::aux_head as they are written,
+ * no PERF_RECORD_AUX is generated per record.
+ */
+struct perf_ibs_aux_record {
+	u32		size;
+	u32		caps;
+	u64		tsc;
+	u64		regs[];
+};
+
+struct perf_ibs_aux_buf {
+	unsigned long	size;
+	int		nr_pages;
+	void		*data_pages[];
+};
+
 static int
 perf_event_set_period(struct hw_perf_event *hwc, u64 min, u64 max, u64 *hw_period)
 {
@@ -276,6 +348,10 @@ static int perf_ibs_init(struct perf_event *event)
 	if (config & ~perf_ibs->config_mask)
 		return -EINVAL;
 
+	if (perf_ibs == &perf_ibs_op &&
+	    (event->attr.config1 & ~IBS_OP_CONFIG1_MASK))
+		return -EINVAL;
+
 	if (hwc->sample_period) {
 		if (config & perf_ibs->cnt_mask)
 			/* raw max_cnt may not be set */
@@ -383,6 +459,135 @@ static inline void perf_ibs_disable_event(struct perf_ibs *perf_ibs,
 	wrmsrl(hwc->config_base, config);
 }
 
+static inline bool perf_ibs_aux_event(struct perf_event *event)
+{
+	return event->pmu == &perf_ibs_op.pmu &&
+	       (event->attr.config1 & IBS_OP_CONFIG1_AUX);
+}
+
+static void *
+perf_ibs_setup_aux(struct perf_event *event, void **pages, int nr_pages,
+		   bool overwrite)
+{
+	struct perf_ibs_aux_buf *buf;
+	int node = event->cpu == -1 ? -1 : cpu_to_node(event->cpu);
+
+	/* Records are appended, there is no way to find them in a snapshot */
+	if (overwrite || !perf_ibs_aux_event(event))
+		return NULL;
+
+	buf = kzalloc_node(struct_size(buf, data_pages, nr_pages), GFP_KERNEL,
+			   node);
+	if (!buf)
+		return NULL;
+
+	memcpy(buf->data_pages, pages, nr_pages * sizeof(void *));
+	buf->nr_pages = nr_pages;
+	buf->size     = (unsigned long)nr_pages << PAGE_SHIFT;
+
+	return buf;
+}
+
+static void perf_ibs_free_aux(void *data)
+{
+	kfree(data);
+}
+
+/* Copy @len bytes to the AUX area at @head, the area size is a power of 2 */
+static void perf_ibs_aux_copy(struct perf_ibs_aux_buf *buf, unsigned long head,
+			      const void *src, unsigned int len)
+{
+	while (len) {
+		unsigned long offset = head & (buf->size - 1);
+		unsigned int chunk = min_t(unsigned long, len,
+					   PAGE_SIZE - offset_in_page(offset));
+
+		memcpy(buf->data_pages[offset >> PAGE_SHIFT] +
+		       offset_in_page(offset), src, chunk);
+
+		head += chunk;
+		src  += chunk;
+		len  -= chunk;
+	}
+}
+
+/*
+ * Write a raw record to the AUX area. The space of a transaction is the
+ * space that was free when it began, so if the record does not fit, the
+ * transaction is ended and a new one begun, which also sees the space
+ * userspace has freed since. Only if that is still too small is the new
+ * transaction ended as truncated, which makes the core disable the event
+ * until userspace has made room, like the other AUX PMUs.
+ */
+static void perf_ibs_aux_output(struct perf_event *event,
+				struct cpu_perf_ibs *pcpu,
+				struct perf_ibs_data *ibs_data)
+{
+	struct perf_output_handle *handle = &pcpu->handle;
+	struct perf_ibs_aux_record rec;
+	struct perf_ibs_aux_buf *buf;
+
+	buf = perf_get_aux(handle);
+	if (!buf)
+		return;
+
+	rec.size = sizeof(rec) + ibs_data->size;
+	rec.caps = ibs_data->caps;
+	rec.tsc  = rdtsc();
+
+	if (rec.size > handle->size) {
+		perf_aux_output_end(handle, 0);
+		buf = perf_aux_output_begin(handle, event);
+		if (!buf)
+			return;
+
+		if (rec.size > handle->size) {
+			perf_aux_output_flag(handle, PERF_AUX_FLAG_TRUNCATED);
+			perf_aux_output_end(handle, 0);
+			return;
+		}
+	}
+
+	perf_ibs_aux_copy(buf, handle->head, &rec, sizeof(rec));
+	perf_ibs_aux_copy(buf, handle->head + sizeof(rec), ibs_data->regs,
+			  ibs_data->size);
+
+	/* Make the record visible before aux_head moves past it */
+	smp_wmb();
+	perf_aux_output_skip(handle, rec.size);
+}
+
+/*
+ * Apply the config1 filters of an IBS op event, returns true if the
+ * sample is to be dropped.
+ */
+static bool perf_ibs_op_filter(struct perf_event *event, u64 *regs)
+{
+	u64 config1 = event->attr.config1;
+	u64 data2 = regs[IBS_OP_REG_DATA2];
+	u64 data3 = regs[IBS_OP_REG_DATA3];
+
+	if (config1 & IBS_OP_CONFIG1_LDLAT) {
+		u64 lat = (data3 & IBS_OP_DATA3_DC_MISS_LAT) >>
+			  IBS_OP_DATA3_DC_MISS_LAT_SHIFT;
+
+		if (!(data3 & IBS_OP_DATA3_LD_OP) ||
+		    !(data3 & IBS_OP_DATA3_DC_MISS) ||
+		    lat < (config1 & IBS_OP_CONFIG1_LDLAT))
+			return true;
+	}
+
+	if ((config1 & IBS_OP_CONFIG1_DRAM) &&
+	    (data2 & IBS_OP_DATA2_DATA_SRC) != IBS_OP_DATA2_DATA_SRC_DRAM)
+		return true;
+
+	if ((config1 & IBS_OP_CONFIG1_REMOTE) &&
+	    !(data2 & IBS_OP_DATA2_RMT_NODE))
+		return true;
+
+	return false;
+}
+
 /*
  * We cannot restore the ibs pmu state, so we always needs to update
  * the event while stopping it and then reset the state when starting
@@ -400,6 +605,12 @@ static void perf_ibs_start(struct perf_event *event, int flags)
 		return;
 
 	WARN_ON_ONCE(!(hwc->state & PERF_HES_UPTODATE));
+
+	/* Stay stopped until there is space in the AUX area */
+	if (perf_ibs_aux_event(event) &&
+	    !perf_aux_output_begin(&pcpu->handle, event))
+		return;
+
 	hwc->state = 0;
 
 	perf_ibs_set_period(perf_ibs, hwc, &period);
@@ -453,6 +664,9 @@ static void perf_ibs_stop(struct perf_event *event, int flags)
 		clear_bit(IBS_STARTED, pcpu->state);
 		WARN_ON_ONCE(hwc->state & PERF_HES_STOPPED);
 		hwc->state |= PERF_HES_STOPPED;
+
+		if (pcpu->handle.event)
+			perf_aux_output_end(&pcpu->handle, 0);
 	}
 
 	if (hwc->state & PERF_HES_UPTODATE)
@@ -505,6 +719,10 @@ static void perf_ibs_read(struct perf_event *event) { }
 
 PMU_FORMAT_ATTR(rand_en,	"config:57");
 PMU_FORMAT_ATTR(cnt_ctl,	"config:19");
+PMU_FORMAT_ATTR(ldlat,		"config1:0-15");
+PMU_FORMAT_ATTR(dram,		"config1:16");
+PMU_FORMAT_ATTR(remote,		"config1:17");
+PMU_FORMAT_ATTR(aux,		"config1:63");
 
 static struct attribute *ibs_fetch_format_attrs[] = {
 	&format_attr_rand_en.attr,
@@ -512,6 +730,10 @@ static struct attribute *ibs_fetch_format_attrs[] = {
 };
 
 static struct attribute *ibs_op_format_attrs[] = {
+	&format_attr_ldlat.attr,
+	&format_attr_dram.attr,
+	&format_attr_remote.attr,
+	&format_attr_aux.attr,
 	NULL,	/* &format_attr_cnt_ctl.attr if IBS_CAPS_OPCNT */
 	NULL,
 };
@@ -551,6 +773,8 @@ static struct perf_ibs perf_ibs_op = {
 		.start		= perf_ibs_start,
 		.stop		= perf_ibs_stop,
 		.read		= perf_ibs_read,
+		.setup_aux	= perf_ibs_setup_aux,
+		.free_aux	= perf_ibs_free_aux,
 	},
 	.msr			= MSR_AMD64_IBSOPCTL,
 	.config_mask		= IBS_OP_CONFIG_MASK,
@@ -576,6 +800,7 @@ static int perf_ibs_handle_irq(struct perf_ibs *perf_ibs, struct pt_regs *iregs)
 	struct pt_regs regs;
 	struct perf_ibs_data ibs_data;
 	int offset, size, check_rip, offset_max, throttle = 0;
+	bool aux, filter;
 	unsigned int msr;
 	u64 *buf, *config, period;
 
@@ -613,8 +838,13 @@ fail:
 	size = 1;
 	offset = 1;
 	check_rip = (perf_ibs == &perf_ibs_op && (ibs_caps & IBS_CAPS_RIPINVALIDCHK));
-	if (event->attr.sample_type & PERF_SAMPLE_RAW)
+	aux = perf_ibs_aux_event(event);
+	filter = (perf_ibs == &perf_ibs_op &&
+		  (event->attr.config1 & IBS_OP_CONFIG1_FILTER));
+	if (aux || (event->attr.sample_type & PERF_SAMPLE_RAW))
 		offset_max = perf_ibs->offset_max;
+	else if (filter)
+		offset_max = IBS_OP_REG_DATA3 + 1;
 	else if (check_rip)
 		offset_max = 3;
 	else
@@ -626,7 +856,11 @@ fail:
 				       perf_ibs->offset_max,
 				       offset + 1);
 	} while (offset < offset_max);
-	if (event->attr.sample_type & PERF_SAMPLE_RAW) {
+
+	if (filter && perf_ibs_op_filter(event, ibs_data.regs))
+		goto out;
+
+	if (aux || (event->attr.sample_type & PERF_SAMPLE_RAW)) {
 		/*
 		 * Read IbsBrTarget and IbsOpData4 separately
 		 * depending on their availability.
@@ -643,6 +877,13 @@ fail:
 	}
 	ibs_data.size = sizeof(u64) * size;
 
+	/* Raw records only, skip building a sample */
+	if (aux) {
+		perf_ibs_aux_output(event, pcpu, &ibs_data);
+		throttle = perf_event_account_interrupt(event);
+		goto out;
+	}
+
 	regs = *iregs;
 	if (check_rip && (ibs_data.regs[2] & IBS_RIP_INVALID)) {
 		regs.flags &= ~PERF_EFLAGS_EXACT;
@@ -735,6 +976,8 @@ static __init void perf_event_ibs_init(void)
 
 	perf_ibs_pmu_init(&perf_ibs_fetch, "ibs_fetch");
 
+	while (*attr)
+		attr++;
 	if (ibs_caps & IBS_CAPS_OPCNT) {
 		perf_ibs_op.config_mask |= IBS_OP_CNT_CTL;
 		*attr++ = &format_attr_cnt_ctl.attr;
@@ -745,6 +988,99 @@ static __init void perf_event_ibs_init(void)
 	pr_info("perf: AMD IBS detected (0x%08x)\n", ibs_caps);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+
+/*
+ * IBS op samples as the memory access source for NUMA balancing, see
+ * task_numa_sample(). While any process uses it, a kernel counter on every
+ * online CPU samples ops; only ops whose data was sourced from DRAM, local
+ * or remote, are passed on as those are the ones saying where the memory
+ * lives. The counters share the per CPU op sampler with perf users.
+ */
+static unsigned long ibs_numa_period = 0x80000;
+module_param_named(numa_period, ibs_numa_period, ulong, 0644);
+MODULE_PARM_DESC(numa_period, "IBS op sample period used for NUMA balancing");
+
+static DEFINE_PER_CPU(struct perf_event *, ibs_numa_event);
+static enum cpuhp_state ibs_numa_hp_state;
+
+static void ibs_numa_overflow(struct perf_event *event,
+			      struct perf_sample_data *data,
+			      struct pt_regs *regs)
+{
+	struct perf_ibs_data *ibs_data;
+	u64 data3;
+
+	ibs_data = container_of(data->raw->frag.data, struct perf_ibs_data,
+				data);
+	data3 = ibs_data->regs[IBS_OP_REG_DATA3];
+	if (!(data3 & IBS_OP_DATA3_DC_LIN_ADDR_VALID) ||
+	    !(data3 & IBS_OP_DATA3_DC_PHY_ADDR_VALID))
+		return;
+
+	task_numa_sample(ibs_data->regs[IBS_OP_REG_DC_LINADDR],
+			 ibs_data->regs[IBS_OP_REG_DC_PHYSADDR] &
+			 IBS_DC_PHYS_ADDR_MASK);
+}
+
+static int ibs_numa_online(unsigned int cpu)
+{
+	struct perf_event_attr attr = {
+		.type		= perf_ibs_op.pmu.type,
+		.size		= sizeof(attr),
+		.sample_period	= ibs_numa_period & ~0x0fUL,
+		.sample_type	= PERF_SAMPLE_RAW,
+		.config1	= IBS_OP_CONFIG1_DRAM,
+	};
+	struct perf_event *event;
+
+	event = perf_event_create_kernel_counter(&attr, cpu, NULL,
+						 ibs_numa_overflow, NULL);
+	if (IS_ERR(event))
+		return PTR_ERR(event);
+
+	per_cpu(ibs_numa_event, cpu) = event;
+
+	return 0;
+}
+
+static int ibs_numa_offline(unsigned int cpu)
+{
+	struct perf_event *event = per_cpu(ibs_numa_event, cpu);
+
+	if (event) {
+		perf_event_release_kernel(event);
+		per_cpu(ibs_numa_event, cpu) = NULL;
+	}
+
+	return 0;
+}
+
+int arch_numa_sampling_start(void)
+{
+	int ret;
+
+	if (!(ibs_caps & IBS_CAPS_OPSAM) || !perf_ibs_op.pcpu)
+		return -EOPNOTSUPP;
+
+	ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN,
+				"perf/x86/amd/ibs_numa:online",
+				ibs_numa_online, ibs_numa_offline);
+	if (ret < 0)
+		return ret;
+
+	ibs_numa_hp_state = ret;
+
+	return 0;
+}
+
+void arch_numa_sampling_stop(void)
+{
+	cpuhp_remove_state(ibs_numa_hp_state);
+}
+
+#endif /* CONFIG_NUMA_BALANCING */
+
 #else /* defined(CONFIG_PERF_EVENTS) && defined(CONFIG_CPU_SUP_AMD) */
 
 static __init void perf_event_ibs_init(void) { }
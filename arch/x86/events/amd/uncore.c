@@ -12,6 +12,7 @@
 #include <linux/init.h>
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
+#include <linux/hrtimer.h>
 
 #include <asm/cpufeature.h>
 #include <asm/perf_event.h>
@@ -28,12 +29,28 @@
 
 #define COUNTER_SHIFT		16
 
+/*
+ * config1 flags:
+ *
+ * SNAPSHOT:	the counter is read periodically on the owning CPU and the
+ *		count is published through the event's mmap()ed user page,
+ *		so readers on other CPUs need neither a syscall nor an IPI.
+ * ALLTHREADS:	L3 only, count for all threads sharing the L3 instead of
+ *		only the thread of the CPU the event was opened on.
+ */
+#define AMD_UNCORE_SNAPSHOT	BIT_ULL(0)
+#define AMD_UNCORE_ALLTHREADS	BIT_ULL(1)
+#define AMD_UNCORE_CONFIG1_MASK	(AMD_UNCORE_SNAPSHOT | AMD_UNCORE_ALLTHREADS)
+
+#define AMD_UNCORE_SNAPSHOT_MS	10
+
 #undef pr_fmt
 #define pr_fmt(fmt)	"amd_uncore: " fmt
 
 static int num_counters_llc;
 static int num_counters_nb;
 static bool l3_mask;
+static unsigned int snapshot_interval_ms = AMD_UNCORE_SNAPSHOT_MS;
 
 static HLIST_HEAD(uncore_unused_list);
 
@@ -48,6 +65,8 @@ struct amd_uncore {
 	struct pmu *pmu;
 	struct perf_event *events[MAX_COUNTERS];
 	struct hlist_node node;
+	int nr_snapshot;
+	struct hrtimer hrtimer;
 };
 
 static struct amd_uncore * __percpu *amd_uncore_nb;
@@ -98,6 +117,44 @@ static void amd_uncore_read(struct perf_event *event)
 	local64_add(delta, &event->count);
 }
 
+static bool is_snapshot_event(struct perf_event *event)
+{
+	return event->attr.config1 & AMD_UNCORE_SNAPSHOT;
+}
+
+/*
+ * Read all snapshot counters of the uncore on its owning CPU and update
+ * perf_event_mmap_page::offset, which holds the count since the counters
+ * do not support RDPMC from userspace (index is 0).
+ */
+static enum hrtimer_restart amd_uncore_hrtimer(struct hrtimer *hrtimer)
+{
+	struct amd_uncore *uncore = container_of(hrtimer, struct amd_uncore,
+						 hrtimer);
+	struct perf_event *event;
+	unsigned long flags;
+	int i;
+
+	if (!uncore->nr_snapshot || uncore->cpu != smp_processor_id())
+		return HRTIMER_NORESTART;
+
+	local_irq_save(flags);
+	for (i = 0; i < uncore->num_counters; i++) {
+		event = uncore->events[i];
+		if (!event || !is_snapshot_event(event) ||
+		    (event->hw.state & PERF_HES_STOPPED))
+			continue;
+
+		amd_uncore_read(event);
+		perf_event_update_userpage(event);
+	}
+	local_irq_restore(flags);
+
+	hrtimer_forward_now(hrtimer, ms_to_ktime(READ_ONCE(snapshot_interval_ms)));
+
+	return HRTIMER_RESTART;
+}
+
 static void amd_uncore_start(struct perf_event *event, int flags)
 {
 	struct hw_perf_event *hwc = &event->hw;
@@ -158,6 +215,11 @@ out:
 	hwc->event_base_rdpmc = uncore->rdpmc_base + hwc->idx;
 	hwc->state = PERF_HES_UPTODATE | PERF_HES_STOPPED;
 
+	if (is_snapshot_event(event) && !uncore->nr_snapshot++)
+		hrtimer_start(&uncore->hrtimer,
+			      ms_to_ktime(READ_ONCE(snapshot_interval_ms)),
+			      HRTIMER_MODE_REL_PINNED);
+
 	if (flags & PERF_EF_START)
 		amd_uncore_start(event, PERF_EF_RELOAD);
 
@@ -177,6 +239,9 @@ static void amd_uncore_del(struct perf_event *event, int flags)
 			break;
 	}
 
+	if (is_snapshot_event(event) && !--uncore->nr_snapshot)
+		hrtimer_cancel(&uncore->hrtimer);
+
 	hwc->idx = -1;
 }
 
@@ -205,6 +270,18 @@ static u64 l3_thread_slice_mask(int cpu)
 	return AMD64_L3_EN_ALL_SLICES | core | thread_mask;
 }
 
+/*
+ * L3 PMC Config SliceMask and ThreadMask selecting all threads and slices
+ */
+static u64 l3_all_thread_slice_mask(void)
+{
+	if (boot_cpu_data.x86 <= 0x18)
+		return AMD64_L3_SLICE_MASK | AMD64_L3_THREAD_MASK;
+
+	return AMD64_L3_EN_ALL_SLICES | AMD64_L3_EN_ALL_CORES |
+	       AMD64_L3_F19H_THREAD_MASK;
+}
+
 static int amd_uncore_event_init(struct perf_event *event)
 {
 	struct amd_uncore *uncore;
@@ -227,12 +304,23 @@ static int amd_uncore_event_init(struct perf_event *event)
 	if (event->cpu < 0)
 		return -EINVAL;
 
+	if (event->attr.config1 & ~AMD_UNCORE_CONFIG1_MASK)
+		return -EINVAL;
+
+	if ((event->attr.config1 & AMD_UNCORE_ALLTHREADS) &&
+	    !(l3_mask && is_llc_event(event)))
+		return -EINVAL;
+
 	/*
 	 * SliceMask and ThreadMask need to be set for certain L3 events.
 	 * For other events, the two fields do not affect the count.
 	 */
-	if (l3_mask && is_llc_event(event))
-		hwc->config |= l3_thread_slice_mask(event->cpu);
+	if (l3_mask && is_llc_event(event)) {
+		if (event->attr.config1 & AMD_UNCORE_ALLTHREADS)
+			hwc->config |= l3_all_thread_slice_mask();
+		else
+			hwc->config |= l3_thread_slice_mask(event->cpu);
+	}
 
 	uncore = event_to_amd_uncore(event);
 	if (!uncore)
@@ -265,8 +353,36 @@ static ssize_t amd_uncore_attr_show_cpumask(struct device *dev,
 }
 static DEVICE_ATTR(cpumask, S_IRUGO, amd_uncore_attr_show_cpumask, NULL);
 
+static ssize_t snapshot_interval_ms_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(snapshot_interval_ms));
+}
+
+static ssize_t snapshot_interval_ms_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (!val)
+		return -EINVAL;
+
+	WRITE_ONCE(snapshot_interval_ms, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(snapshot_interval_ms);
+
 static struct attribute *amd_uncore_attrs[] = {
 	&dev_attr_cpumask.attr,
+	&dev_attr_snapshot_interval_ms.attr,
 	NULL,
 };
 
@@ -294,6 +410,8 @@ static struct device_attribute format_attr_##_dev##_name = __ATTR_RO(_dev);
 static struct attribute *amd_uncore_format_attr_##_name[] = {		     \
 	&format_attr_event_##_name.attr,				     \
 	&format_attr_umask.attr,					     \
+	&format_attr_snapshot.attr,					     \
+	NULL,	/* &format_attr_allthreads.attr for L3 */		     \
 	NULL,								     \
 };									     \
 static struct attribute_group amd_uncore_format_group_##_name = {	     \
@@ -310,6 +428,8 @@ AMD_FORMAT_ATTR(event, , "config:0-7,32-35");
 AMD_FORMAT_ATTR(umask, , "config:8-15");
 AMD_FORMAT_ATTR(event, _df, "config:0-7,32-35,59-60");
 AMD_FORMAT_ATTR(event, _l3, "config:0-7");
+AMD_FORMAT_ATTR(snapshot, , "config1:0");
+AMD_FORMAT_ATTR(allthreads, , "config1:1");
 AMD_ATTRIBUTE(df);
 AMD_ATTRIBUTE(l3);
 
@@ -337,8 +457,17 @@ static struct pmu amd_llc_pmu = {
 
 static struct amd_uncore *amd_uncore_alloc(unsigned int cpu)
 {
-	return kzalloc_node(sizeof(struct amd_uncore), GFP_KERNEL,
-			cpu_to_node(cpu));
+	struct amd_uncore *uncore;
+
+	uncore = kzalloc_node(sizeof(struct amd_uncore), GFP_KERNEL,
+			      cpu_to_node(cpu));
+	if (!uncore)
+		return NULL;
+
+	hrtimer_init(&uncore->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	uncore->hrtimer.function = amd_uncore_hrtimer;
+
+	return uncore;
 }
 
 static int amd_uncore_cpu_up_prepare(unsigned int cpu)
@@ -552,6 +681,7 @@ static int __init amd_uncore_init(void)
 		format_attr_event_df.show = &event_show_df;
 		format_attr_event_l3.show = &event_show_l3;
 		l3_mask			  = true;
+		amd_uncore_format_attr_l3[3] = &format_attr_allthreads.attr;
 	} else {
 		num_counters_nb		  = NUM_COUNTERS_NB;
 		num_counters_llc	  = NUM_COUNTERS_L2;
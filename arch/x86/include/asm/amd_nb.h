@@ -3,6 +3,7 @@
 #define _ASM_X86_AMD_NB_H
 
 #include <linux/ioport.h>
+#include <linux/mutex.h>
 #include <linux/pci.h>
 #include <linux/refcount.h>
 
@@ -66,6 +67,9 @@ struct amd_northbridge {
 	struct pci_dev *link;
 	struct amd_l3_cache l3_cache;
 	struct threshold_bank *bank4;
+
+	/* Protects the SMN and DF indirect access register pairs */
+	struct mutex smn_lock;
 };
 
 struct amd_northbridge_info {
@@ -12,6 +12,7 @@
 #include <asm/mpspec.h>
 #include <asm/msr.h>
 #include <asm/hardirq.h>
+#include <asm/sev-es.h>
 
 #define ARCH_APICTIMER_STOPS_ON_C3	1
 
@@ -104,6 +105,10 @@ static inline void native_apic_mem_write(u32 reg, u32 v)
 {
 	volatile u32 *addr = (volatile u32 *)(APIC_BASE + reg);
 
+	/* Avoid a #VC and instruction decode for every APIC write */
+	if (sev_es_mmio_write(mp_lapic_addr + reg, &v, sizeof(v)))
+		return;
+
 	alternative_io("movl %0, %P1", "xchgl %0, %P1", X86_BUG_11AP,
 		       ASM_OUTPUT2("=r" (v), "=m" (*addr)),
 		       ASM_OUTPUT2("0" (v), "m" (*addr)));
@@ -111,6 +116,11 @@ static inline void native_apic_mem_write(u32 reg, u32 v)
 
 static inline u32 native_apic_mem_read(u32 reg)
 {
+	u32 v;
+
+	if (sev_es_mmio_read(mp_lapic_addr + reg, &v, sizeof(v)))
+		return v;
+
 	return *((volatile u32 *)(APIC_BASE + reg));
 }
 
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _ASM_X86_INVLPGB
+#define _ASM_X86_INVLPGB
+
+#include <linux/bits.h>
+#include <linux/types.h>
+
+/*
+ * INVLPGB invalidates TLB entries on all CPUs in the system. A field whose
+ * valid flag is clear matches everything, so without INVLPGB_FLAG_PCID all
+ * PCIDs are invalidated. TLBSYNC waits for the INVLPGBs issued by this CPU
+ * to complete everywhere; both must be done without migrating in between.
+ */
+#define INVLPGB_FLAG_VA			BIT(0)
+#define INVLPGB_FLAG_PCID		BIT(1)
+#define INVLPGB_FLAG_ASID		BIT(2)
+#define INVLPGB_FLAG_INCLUDE_GLOBAL	BIT(3)
+#define INVLPGB_FLAG_FINAL_ONLY		BIT(4)
+
+/* Maximum number of pages one INVLPGB can invalidate, from CPUID */
+extern unsigned int invlpgb_count_max;
+
+static inline void __invlpgb(unsigned long pcid, unsigned long addr, u16 nr,
+			     bool pmd_stride, u8 flags)
+{
+	u32 edx = pcid << 16;
+	u32 ecx = ((u32)pmd_stride << 31) | (nr - 1);
+	u64 rax = addr | flags;
+
+	/* INVLPGB; the memory clobber orders it as for __invpcid() */
+	asm volatile(".byte 0x0f, 0x01, 0xfe"
+		     :: "a" (rax), "c" (ecx), "d" (edx) : "memory");
+}
+
+static inline void __tlbsync(void)
+{
+	/* TLBSYNC */
+	asm volatile(".byte 0x0f, 0x01, 0xff" ::: "memory");
+}
+
+/* Flush @nr pages at @addr, including globals, for all PCIDs. */
+static inline void invlpgb_flush_addr_nosync(unsigned long addr, u16 nr)
+{
+	__invlpgb(0, addr, nr, false,
+		  INVLPGB_FLAG_VA | INVLPGB_FLAG_INCLUDE_GLOBAL);
+}
+
+/* Flush all mappings, including globals, for all PCIDs. */
+static inline void invlpgb_flush_all(void)
+{
+	__invlpgb(0, 0, 1, false, INVLPGB_FLAG_INCLUDE_GLOBAL);
+	__tlbsync();
+}
+
+#endif /* _ASM_X86_INVLPGB */
@@ -519,6 +519,18 @@ struct kvm_vcpu_hv {
 	cpumask_t tlb_flush;
 };
 
+/* Slots of the per-vCPU table of MSR exits, and probes within the table */
+#define KVM_MSR_EXIT_STATS	32
+#define KVM_MSR_EXIT_PROBES	4
+
+struct kvm_msr_exit_stat {
+	u32 index;
+	u64 reads;
+	u64 writes;
+	/* Writes handled by handle_fastpath_set_msr_irqoff() */
+	u64 fastpath;
+};
+
 struct kvm_vcpu_arch {
 	/*
 	 * rip and regs accesses must go through
@@ -788,6 +800,10 @@ struct kvm_vcpu_arch {
 
 	/* AMD MSRC001_0015 Hardware Configuration */
 	u64 msr_hwcr;
+
+	/* MSR accesses that exited, see kvm_account_msr_exit() */
+	struct kvm_msr_exit_stat msr_exits[KVM_MSR_EXIT_STATS];
+	u64 msr_exits_other;
 };
 
 struct kvm_lpage_info {
@@ -914,6 +930,15 @@ struct kvm_arch {
 	bool pause_in_guest;
 	bool cstate_in_guest;
 
+	/*
+	 * Set by KVM_CAP_X86_MSR_PASSTHROUGH: the MSRs in msr_passthrough are
+	 * passed through as soon as the guest CPUID allows it, the others are
+	 * always intercepted.  Without the capability, the MSRs are passed
+	 * through on their first write.
+	 */
+	bool msr_passthrough_policy;
+	u32 msr_passthrough;
+
 	unsigned long irq_sources_bitmap;
 	s64 kvmclock_offset;
 	raw_spinlock_t tsc_write_lock;
@@ -963,6 +988,21 @@ struct kvm_arch {
 
 	struct kvm_pmu_event_filter *pmu_event_filter;
 	struct task_struct *nx_lpage_recovery_thread;
+
+	/*
+	 * Whether the TDP MMU is enabled for this VM.  This is a snapshot of
+	 * the tdp_mmu module parameter taken when the VM is created, and does
+	 * not change for the life of the VM.
+	 */
+	bool tdp_mmu_enabled;
+
+	/*
+	 * Root pages of the TDP MMU, protected by mmu_lock held for write.
+	 * The TDP MMU keeps no rmaps and does not put its pages on the
+	 * active_mmu_pages list; everything below a root is reached by
+	 * walking the paging structure.
+	 */
+	struct list_head tdp_mmu_roots;
 };
 
 struct kvm_vm_stat {
@@ -1000,6 +1040,7 @@ struct kvm_vcpu_stat {
 	u64 halt_wakeup;
 	u64 request_irq_exits;
 	u64 irq_exits;
+	u64 host_tick_exits;
 	u64 host_state_reload;
 	u64 fpu_reload;
 	u64 insn_emulation;
@@ -1010,6 +1051,14 @@ struct kvm_vcpu_stat {
 	u64 req_event;
 	u64 halt_poll_success_ns;
 	u64 halt_poll_fail_ns;
+	u64 avic_ipi_invalid_int_type;
+	u64 avic_ipi_target_not_running;
+	u64 avic_ipi_invalid_target;
+	u64 avic_ipi_invalid_backing_page;
+	u64 avic_ipi_fast_path;
+	u64 pmu_reprogram;
+	u64 pmu_event_create;
+	u64 pmu_event_reuse;
 };
 
 struct x86_instruction_info;
@@ -1179,6 +1228,8 @@ struct kvm_x86_ops {
 	void (*enable_log_dirty_pt_masked)(struct kvm *kvm,
 					   struct kvm_memory_slot *slot,
 					   gfn_t offset, unsigned long mask);
+	/* Entries the hardware may log before the vcpu exits, e.g. PML */
+	int cpu_dirty_log_size;
 
 	/* pmu operations of sub-arch */
 	const struct kvm_pmu_ops *pmu_ops;
@@ -1298,6 +1349,8 @@ void kvm_mmu_reset_context(struct kvm_vcpu *vcpu);
 void kvm_mmu_slot_remove_write_access(struct kvm *kvm,
 				      struct kvm_memory_slot *memslot,
 				      int start_level);
+void kvm_mmu_slot_try_split_huge_pages(struct kvm *kvm,
+				       const struct kvm_memory_slot *memslot);
 void kvm_mmu_zap_collapsible_sptes(struct kvm *kvm,
 				   const struct kvm_memory_slot *memslot);
 void kvm_mmu_slot_leaf_clear_dirty(struct kvm *kvm,
@@ -1567,6 +1620,8 @@ enum {
 #define __KVM_VCPU_MULTIPLE_ADDRESS_SPACE
 #define KVM_ADDRESS_SPACE_NUM 2
 
+#define KVM_HAVE_MMU_RWLOCK
+
 #define kvm_arch_vcpu_memslots_id(vcpu) ((vcpu)->arch.hflags & HF_SMM_MASK ? 1 : 0)
 #define kvm_memslots_for_spte_role(kvm, role) __kvm_memslots(kvm, (role).smm)
 
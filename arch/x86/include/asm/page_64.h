@@ -54,6 +54,10 @@ static inline void clear_page(void *page)
 			   : "cc", "memory", "rax", "rcx");
 }
 
+/* Non-temporal stores, ordered by an sfence before returning */
+void clear_page_nocache(void *page);
+#define __HAVE_ARCH_CLEAR_PAGE_NOCACHE
+
 void copy_page(void *to, void *from);
 
 #endif	/* !__ASSEMBLY__ */
@@ -36,6 +36,20 @@ DECLARE_PER_CPU(struct resctrl_pqr_state, pqr_state);
 DECLARE_STATIC_KEY_FALSE(rdt_enable_key);
 DECLARE_STATIC_KEY_FALSE(rdt_alloc_enable_key);
 DECLARE_STATIC_KEY_FALSE(rdt_mon_enable_key);
+DECLARE_STATIC_KEY_FALSE(rdt_mbm_mux_key);
+
+/*
+ * When MBM RMID multiplexing is enabled, monitor groups that could not
+ * get a hardware RMID are given a virtual one starting at
+ * resctrl_mux_rmid_base. resctrl_mux_rmid_map[] translates it to the
+ * hardware RMID the group currently holds, or to a sink RMID that is never
+ * reported while it has none, so the traffic does not land on RMID 0 of
+ * the default group.
+ */
+#define RESCTRL_MUX_MAX_GROUPS	1024
+
+extern u32 resctrl_mux_rmid_base;
+extern u32 resctrl_mux_rmid_map[RESCTRL_MUX_MAX_GROUPS];
 
 /*
  * __resctrl_sched_in() - Writes the task's CLOSid/RMID to IA32_PQR_MSR
@@ -49,6 +63,9 @@ DECLARE_STATIC_KEY_FALSE(rdt_mon_enable_key);
  *   when a task with a different CLOSid/RMID is scheduled in.
  * - We allocate RMIDs/CLOSids globally in order to keep this as
  *   simple as possible.
+ * - Virtual RMIDs of multiplexed monitor groups are translated to the
+ *   hardware RMID they currently hold. This is skipped unless the
+ *   multiplexing mode was requested at mount time.
  * Must be called with preemption disabled.
  */
 static void __resctrl_sched_in(void)
@@ -69,6 +86,10 @@ static void __resctrl_sched_in(void)
 	if (static_branch_likely(&rdt_mon_enable_key)) {
 		if (current->rmid)
 			rmid = current->rmid;
+
+		if (static_branch_unlikely(&rdt_mbm_mux_key) &&
+		    rmid >= resctrl_mux_rmid_base)
+			rmid = READ_ONCE(resctrl_mux_rmid_map[rmid - resctrl_mux_rmid_base]);
 	}
 
 	if (closid != state->cur_closid || rmid != state->cur_rmid) {
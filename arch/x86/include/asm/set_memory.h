@@ -54,6 +54,9 @@ int set_pages_array_uc(struct page **pages, int addrinarray);
 int set_pages_array_wc(struct page **pages, int addrinarray);
 int set_pages_array_wt(struct page **pages, int addrinarray);
 int set_pages_array_wb(struct page **pages, int addrinarray);
+int set_pages_array_encrypted(struct page **pages, int numpages);
+int set_pages_array_decrypted(struct page **pages, int numpages);
+#define set_pages_array_decrypted set_pages_array_decrypted
 
 /*
  * For legacy compatibility with the old APIs, a few functions
@@ -102,12 +102,36 @@ static __always_inline void sev_es_nmi_complete(void)
 		__sev_es_nmi_complete();
 }
 extern int __init sev_es_efi_map_ghcbs(pgd_t *pgd);
+extern bool __sev_es_mmio_access(phys_addr_t paddr, void *buf,
+				 unsigned int bytes, bool read);
+/*
+ * Pre-decoded MMIO for hot paths, returns false if the caller must do the
+ * access itself.
+ */
+static __always_inline bool sev_es_mmio_read(phys_addr_t paddr, void *buf,
+					     unsigned int bytes)
+{
+	if (static_branch_unlikely(&sev_es_enable_key))
+		return __sev_es_mmio_access(paddr, buf, bytes, true);
+	return false;
+}
+static __always_inline bool sev_es_mmio_write(phys_addr_t paddr, void *buf,
+					      unsigned int bytes)
+{
+	if (static_branch_unlikely(&sev_es_enable_key))
+		return __sev_es_mmio_access(paddr, buf, bytes, false);
+	return false;
+}
 #else
 static inline void sev_es_ist_enter(struct pt_regs *regs) { }
 static inline void sev_es_ist_exit(void) { }
 static inline int sev_es_setup_ap_jump_table(struct real_mode_header *rmh) { return 0; }
 static inline void sev_es_nmi_complete(void) { }
 static inline int sev_es_efi_map_ghcbs(pgd_t *pgd) { return 0; }
+static inline bool sev_es_mmio_read(phys_addr_t paddr, void *buf,
+				    unsigned int bytes) { return false; }
+static inline bool sev_es_mmio_write(phys_addr_t paddr, void *buf,
+				     unsigned int bytes) { return false; }
 #endif
 
 #endif
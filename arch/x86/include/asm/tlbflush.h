@@ -10,6 +10,7 @@
 #include <asm/special_insns.h>
 #include <asm/smp.h>
 #include <asm/invpcid.h>
+#include <asm/invlpgb.h>
 #include <asm/pti.h>
 #include <asm/processor-flags.h>
 
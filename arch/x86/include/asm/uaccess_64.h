@@ -84,6 +84,36 @@ unsigned long raw_copy_in_user(void __user *dst, const void __user *src, unsigne
 extern long __copy_user_nocache(void *dst, const void __user *src,
 				unsigned size, int zerorest);
 
+#define ARCH_HAS_STREAM_UACCESS 1
+
+/* Copies shorter than this always go through copy_user_generic() */
+#define COPY_USER_TUNED_MIN	256
+
+unsigned long copy_user_tuned(void *to, const void *from, unsigned int len,
+			      unsigned long stream);
+
+/* For test_user_copy: the routines copy_user_tuned() picks from */
+#define COPY_USER_NR_ROUTINES	4
+
+const char *copy_user_routine_name(unsigned int r);
+unsigned long copy_user_routine(unsigned int r, void *to, const void *from,
+				unsigned int len);
+
+/*
+ * Copy @size bytes which are part of a @stream bytes long transfer, such as
+ * one page of a large read().  Long copies use the routine tuned at boot for
+ * their size, or non-temporal stores if @stream is large compared to the LLC.
+ */
+static __always_inline __must_check unsigned long
+raw_copy_to_user_stream(void __user *dst, const void *src, unsigned long size,
+			unsigned long stream)
+{
+	if (size < COPY_USER_TUNED_MIN)
+		return copy_user_generic((__force void *)dst, src, size);
+
+	return copy_user_tuned((__force void *)dst, src, size, stream);
+}
+
 extern long __copy_user_flushcache(void *dst, const void __user *src, unsigned size);
 extern void memcpy_page_flushcache(char *to, struct page *page, size_t offset,
 			   size_t len);
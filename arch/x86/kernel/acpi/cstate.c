@@ -79,6 +79,17 @@ void acpi_processor_power_init_bm_check(struct acpi_processor_flags *flags,
 		 */
 		flags->bm_control = 0;
 	}
+
+	if (c->x86_vendor == X86_VENDOR_AMD && c->x86 >= 0x17) {
+		/*
+		 * On AMD Zen and later, caches are coherent across C-states
+		 * and must not be flushed by software before entering C3.
+		 * ARB_DIS is not used by the current AMD C-state
+		 * implementation either.
+		 */
+		flags->bm_check = 1;
+		flags->bm_control = 0;
+	}
 }
 EXPORT_SYMBOL(acpi_processor_power_init_bm_check);
 
@@ -114,8 +125,12 @@ static long acpi_processor_ffh_cstate_probe_cpu(void *_cx)
 	num_cstate_subtype = edx_part & MWAIT_SUBSTATE_MASK;
 
 	retval = 0;
-	/* If the HW does not support any sub-states in this C-state */
-	if (num_cstate_subtype == 0) {
+	/*
+	 * If the HW does not support any sub-states in this C-state.  AMD does
+	 * not enumerate MWAIT sub-states in CPUID, so trust the _CST hint there.
+	 */
+	if (num_cstate_subtype == 0 &&
+	    boot_cpu_data.x86_vendor != X86_VENDOR_AMD) {
 		pr_warn(FW_BUG "ACPI MWAIT C-state 0x%x not supported by HW (0x%x)\n",
 				cx->address, edx_part);
 		retval = -1;
@@ -741,6 +741,14 @@ void __init alternative_instructions(void)
 	}
 #endif
 
+#ifdef CONFIG_NUMA_AWARE_SPINLOCKS
+	/*
+	 * Pick the spinlock slowpath before the paravirt call sites get
+	 * patched to call it directly.
+	 */
+	cna_configure_spin_lock_slowpath();
+#endif
+
 	apply_paravirt(__parainstructions, __parainstructions_end);
 
 	restart_nmi();
@@ -26,9 +26,6 @@
 #define PCI_DEVICE_ID_AMD_17H_M70H_DF_F4 0x1444
 #define PCI_DEVICE_ID_AMD_19H_DF_F4	0x1654
 
-/* Protect the PCI config register pairs used for SMN and DF indirect access. */
-static DEFINE_MUTEX(smn_mutex);
-
 static u32 *flush_words;
 
 static const struct pci_device_id amd_root_ids[] = {
@@ -129,36 +126,56 @@ static struct pci_dev *next_northbridge(struct pci_dev *dev,
 	return dev;
 }
 
-static int __amd_smn_rw(u16 node, u32 address, u32 *value, bool write)
+static int __amd_smn_rw_locked(struct amd_northbridge *nb, u32 address,
+			       u32 *value, bool write)
 {
-	struct pci_dev *root;
-	int err = -ENODEV;
+	int err;
 
-	if (node >= amd_northbridges.num)
-		goto out;
+	lockdep_assert_held(&nb->smn_lock);
 
-	root = node_to_amd_nb(node)->root;
-	if (!root)
-		goto out;
-
-	mutex_lock(&smn_mutex);
-
-	err = pci_write_config_dword(root, 0x60, address);
+	err = pci_write_config_dword(nb->root, 0x60, address);
 	if (err) {
 		pr_warn("Error programming SMN address 0x%x.\n", address);
-		goto out_unlock;
+		return err;
 	}
 
-	err = (write ? pci_write_config_dword(root, 0x64, *value)
-		     : pci_read_config_dword(root, 0x64, value));
-	if (err)
+	err = (write ? pci_write_config_dword(nb->root, 0x64, *value)
+		     : pci_read_config_dword(nb->root, 0x64, value));
+	if (err) {
 		pr_warn("Error %s SMN address 0x%x.\n",
 			(write ? "writing to" : "reading from"), address);
+		return err;
+	}
 
-out_unlock:
-	mutex_unlock(&smn_mutex);
+	return 0;
+}
+
+static struct amd_northbridge *smn_node_to_nb(u16 node)
+{
+	struct amd_northbridge *nb;
+
+	if (node >= amd_northbridges.num)
+		return NULL;
+
+	nb = node_to_amd_nb(node);
+	if (!nb->root)
+		return NULL;
+
+	return nb;
+}
+
+static int __amd_smn_rw(u16 node, u32 address, u32 *value, bool write)
+{
+	struct amd_northbridge *nb = smn_node_to_nb(node);
+	int err;
+
+	if (!nb)
+		return -ENODEV;
+
+	mutex_lock(&nb->smn_lock);
+	err = __amd_smn_rw_locked(nb, address, value, write);
+	mutex_unlock(&nb->smn_lock);
 
-out:
 	return err;
 }
 
@@ -202,7 +219,7 @@ int amd_df_indirect_read(u16 node, u8 func, u16 reg, u8 instance_id, u32 *lo)
 	ficaa |= (func & 0x7) << 11;
 	ficaa |= instance_id << 16;
 
-	mutex_lock(&smn_mutex);
+	mutex_lock(&node_to_amd_nb(node)->smn_lock);
 
 	err = pci_write_config_dword(F4, 0x5C, ficaa);
 	if (err) {
@@ -215,7 +232,7 @@ int amd_df_indirect_read(u16 node, u8 func, u16 reg, u8 instance_id, u32 *lo)
 		pr_warn("Error reading DF Indirect FICAD LO, FICAA=0x%x.\n", ficaa);
 
 out_unlock:
-	mutex_unlock(&smn_mutex);
+	mutex_unlock(&node_to_amd_nb(node)->smn_lock);
 
 out:
 	return err;
@@ -282,6 +299,7 @@ int amd_cache_northbridges(void)
 			next_northbridge(misc, misc_ids);
 		node_to_amd_nb(i)->link = link =
 			next_northbridge(link, link_ids);
+		mutex_init(&node_to_amd_nb(i)->smn_lock);
 
 		/*
 		 * If there are more PCI root devices than data fabric/
@@ -19,6 +19,8 @@
 #include <linux/cpu.h>
 #include <linux/smp.h>
 #include <linux/string.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
 
 #include <asm/amd_nb.h>
 #include <asm/traps.h>
@@ -57,6 +59,64 @@
 
 static bool thresholding_irq_en;
 
+#undef MODULE_PARAM_PREFIX
+#define MODULE_PARAM_PREFIX "mce_amd."
+
+/*
+ * When set, the deferred error interrupt handler only takes a snapshot of
+ * the error registers. The errors are logged from a per-CPU work item, with
+ * at most deferred_storm_threshold errors per bank and second.
+ */
+static bool deferred_work;
+module_param(deferred_work, bool, 0644);
+MODULE_PARM_DESC(deferred_work, "Log deferred errors from process context");
+
+static unsigned int deferred_storm_threshold = 16;
+module_param(deferred_storm_threshold, uint, 0644);
+MODULE_PARM_DESC(deferred_storm_threshold, "Deferred errors per bank and second logged during a storm");
+
+#define DEFERRED_RING_SIZE	32	/* must be a power of 2 */
+#define DEFERRED_STORM_INTERVAL	HZ
+
+struct deferred_rec {
+	u64 status;
+	u64 addr;
+	u64 ipid;
+	u64 synd;
+	u64 tsc;
+	unsigned int bank;
+};
+
+struct deferred_bank_state {
+	/* Written by the interrupt handler */
+	unsigned long window;
+	unsigned int count;
+	bool storm;
+	unsigned long suppressed;
+
+	/* Written by the work */
+	bool storm_reported;
+	unsigned long suppressed_reported;
+};
+
+/*
+ * Single producer, single consumer ring: the interrupt handler adds at
+ * @head, the work of the same CPU removes at @tail.
+ */
+struct deferred_ring {
+	struct deferred_rec rec[DEFERRED_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	unsigned long dropped;
+	unsigned long dropped_reported;
+	bool kick;
+	unsigned int cpu;
+	struct work_struct work;
+	struct deferred_bank_state banks[MAX_NR_BANKS];
+};
+
+static DEFINE_PER_CPU(struct deferred_ring, deferred_ring);
+
 static const char * const th_names[] = {
 	"load_store",
 	"insn_fetch",
@@ -204,6 +264,7 @@ static DEFINE_PER_CPU(u32, smca_misc_banks_map);
 
 static void amd_threshold_interrupt(void);
 static void amd_deferred_error_interrupt(void);
+static void deferred_log_work(struct work_struct *work);
 
 static void default_deferred_error_interrupt(void)
 {
@@ -671,8 +732,16 @@ void mce_amd_feature_init(struct cpuinfo_x86 *c)
 		}
 	}
 
-	if (mce_flags.succor)
+	if (mce_flags.succor) {
+		struct deferred_ring *r = this_cpu_ptr(&deferred_ring);
+
+		if (!r->work.func) {
+			INIT_WORK(&r->work, deferred_log_work);
+			r->cpu = cpu;
+		}
+
 		deferred_error_interrupt_enable(c);
+	}
 }
 
 int umc_normaddr_to_sysaddr(u64 norm_addr, u16 nid, u8 umc, u64 *sys_addr)
@@ -886,30 +955,36 @@ bool amd_mce_is_memory_error(struct mce *m)
 	return m->bank == 4 && xec == 0x8;
 }
 
-static void __log_error(unsigned int bank, u64 status, u64 addr, u64 misc)
+static void __fill_error(struct mce *m, unsigned int bank, u64 status,
+			 u64 addr, u64 misc)
 {
-	struct mce m;
+	m->status = status;
+	m->misc   = misc;
+	m->bank   = bank;
 
-	mce_setup(&m);
-
-	m.status = status;
-	m.misc   = misc;
-	m.bank   = bank;
-	m.tsc	 = rdtsc();
-
-	if (m.status & MCI_STATUS_ADDRV) {
-		m.addr = addr;
+	if (m->status & MCI_STATUS_ADDRV) {
+		m->addr = addr;
 
 		/*
 		 * Extract [55:<lsb>] where lsb is the least significant
 		 * *valid* bit of the address bits.
 		 */
 		if (mce_flags.smca) {
-			u8 lsb = (m.addr >> 56) & 0x3f;
+			u8 lsb = (m->addr >> 56) & 0x3f;
 
-			m.addr &= GENMASK_ULL(55, lsb);
+			m->addr &= GENMASK_ULL(55, lsb);
 		}
 	}
+}
+
+static void __log_error(unsigned int bank, u64 status, u64 addr, u64 misc)
+{
+	struct mce m;
+
+	mce_setup(&m);
+
+	m.tsc = rdtsc();
+	__fill_error(&m, bank, status, addr, misc);
 
 	if (mce_flags.smca) {
 		rdmsrl(MSR_AMD64_SMCA_MCx_IPID(bank), m.ipid);
@@ -921,6 +996,123 @@ static void __log_error(unsigned int bank, u64 status, u64 addr, u64 misc)
 	mce_log(&m);
 }
 
+/* Returns true if the error is to be logged, false if it is rate limited. */
+static bool deferred_ratelimit(struct deferred_bank_state *b)
+{
+	unsigned int threshold = READ_ONCE(deferred_storm_threshold);
+	unsigned long now = jiffies;
+
+	if (time_after_eq(now, b->window + DEFERRED_STORM_INTERVAL)) {
+		/* A full interval below the threshold ends a storm */
+		if (b->count <= threshold ||
+		    time_after_eq(now, b->window + 2 * DEFERRED_STORM_INTERVAL))
+			WRITE_ONCE(b->storm, false);
+
+		b->window = now;
+		b->count = 0;
+	}
+
+	if (++b->count <= threshold)
+		return true;
+
+	WRITE_ONCE(b->storm, true);
+	WRITE_ONCE(b->suppressed, b->suppressed + 1);
+
+	return false;
+}
+
+/* Snapshot an error for deferred_log_work(), called from the interrupt. */
+static void deferred_queue_error(struct deferred_ring *r, unsigned int bank,
+				 u64 status, u64 addr)
+{
+	struct deferred_rec *rec;
+	unsigned int head = r->head;
+
+	r->kick = true;
+
+	if (!deferred_ratelimit(&r->banks[bank]))
+		return;
+
+	if (head - smp_load_acquire(&r->tail) >= DEFERRED_RING_SIZE) {
+		WRITE_ONCE(r->dropped, r->dropped + 1);
+		return;
+	}
+
+	rec = &r->rec[head & (DEFERRED_RING_SIZE - 1)];
+	rec->bank   = bank;
+	rec->status = status;
+	rec->addr   = addr;
+	rec->tsc    = rdtsc();
+	rec->ipid   = 0;
+	rec->synd   = 0;
+
+	if (mce_flags.smca) {
+		rdmsrl(MSR_AMD64_SMCA_MCx_IPID(bank), rec->ipid);
+
+		if (status & MCI_STATUS_SYNDV)
+			rdmsrl(MSR_AMD64_SMCA_MCx_SYND(bank), rec->synd);
+	}
+
+	smp_store_release(&r->head, head + 1);
+}
+
+static void deferred_log_work(struct work_struct *work)
+{
+	struct deferred_ring *r = container_of(work, struct deferred_ring, work);
+	unsigned int head = smp_load_acquire(&r->head);
+	unsigned int tail = r->tail;
+	unsigned long dropped, suppressed;
+	unsigned int bank;
+	bool storm;
+
+	for (; tail != head; tail++) {
+		struct deferred_rec *rec = &r->rec[tail & (DEFERRED_RING_SIZE - 1)];
+		struct mce m;
+
+		/* The work normally runs on r->cpu, but not after hotplug */
+		mce_setup(&m);
+		m.cpu = m.extcpu = r->cpu;
+		m.socketid = cpu_data(r->cpu).phys_proc_id;
+		m.apicid   = cpu_data(r->cpu).initial_apicid;
+
+		m.tsc  = rec->tsc;
+		m.ipid = rec->ipid;
+		m.synd = rec->synd;
+		__fill_error(&m, rec->bank, rec->status, rec->addr, 0);
+
+		smp_store_release(&r->tail, tail + 1);
+
+		mce_log(&m);
+	}
+
+	for (bank = 0; bank < MAX_NR_BANKS; bank++) {
+		struct deferred_bank_state *b = &r->banks[bank];
+
+		storm = READ_ONCE(b->storm);
+		if (storm == b->storm_reported)
+			continue;
+
+		b->storm_reported = storm;
+		if (storm) {
+			pr_warn("CPU%u bank %u: deferred error storm, rate limiting\n",
+				r->cpu, bank);
+			continue;
+		}
+
+		suppressed = READ_ONCE(b->suppressed);
+		pr_notice("CPU%u bank %u: deferred error storm ended, %lu errors not logged\n",
+			  r->cpu, bank, suppressed - b->suppressed_reported);
+		b->suppressed_reported = suppressed;
+	}
+
+	dropped = READ_ONCE(r->dropped);
+	if (dropped != r->dropped_reported) {
+		pr_warn("CPU%u: %lu deferred errors lost, buffer full\n",
+			r->cpu, dropped - r->dropped_reported);
+		r->dropped_reported = dropped;
+	}
+}
+
 DEFINE_IDTENTRY_SYSVEC(sysvec_deferred_error)
 {
 	trace_deferred_error_apic_entry(DEFERRED_ERROR_VECTOR);
@@ -932,9 +1124,12 @@ DEFINE_IDTENTRY_SYSVEC(sysvec_deferred_error)
 
 /*
  * Returns true if the logged error is deferred. False, otherwise.
+ *
+ * If @r is not NULL, the error is queued on it instead of being logged.
  */
 static inline bool
-_log_error_bank(unsigned int bank, u32 msr_stat, u32 msr_addr, u64 misc)
+_log_error_bank(unsigned int bank, u32 msr_stat, u32 msr_addr, u64 misc,
+		struct deferred_ring *r)
 {
 	u64 status, addr = 0;
 
@@ -945,7 +1140,10 @@ _log_error_bank(unsigned int bank, u32 msr_stat, u32 msr_addr, u64 misc)
 	if (status & MCI_STATUS_ADDRV)
 		rdmsrl(msr_addr, addr);
 
-	__log_error(bank, status, addr, misc);
+	if (r)
+		deferred_queue_error(r, bank, status, addr);
+	else
+		__log_error(bank, status, addr, misc);
 
 	wrmsrl(msr_stat, 0);
 
@@ -961,12 +1159,12 @@ _log_error_bank(unsigned int bank, u32 msr_stat, u32 msr_addr, u64 misc)
  * 3) SMCA systems check MCA_DESTAT, if error was not found in MCA_STATUS, and
  *    log it.
  */
-static void log_error_deferred(unsigned int bank)
+static void log_error_deferred(unsigned int bank, struct deferred_ring *r)
 {
 	bool defrd;
 
 	defrd = _log_error_bank(bank, msr_ops.status(bank),
-					msr_ops.addr(bank), 0);
+					msr_ops.addr(bank), 0, r);
 
 	if (!mce_flags.smca)
 		return;
@@ -982,21 +1180,31 @@ static void log_error_deferred(unsigned int bank)
 	 * for a valid error.
 	 */
 	_log_error_bank(bank, MSR_AMD64_SMCA_MCx_DESTAT(bank),
-			      MSR_AMD64_SMCA_MCx_DEADDR(bank), 0);
+			      MSR_AMD64_SMCA_MCx_DEADDR(bank), 0, r);
 }
 
 /* APIC interrupt handler for deferred errors */
 static void amd_deferred_error_interrupt(void)
 {
+	struct deferred_ring *r = this_cpu_ptr(&deferred_ring);
 	unsigned int bank;
 
+	if (!READ_ONCE(deferred_work) || !r->work.func)
+		r = NULL;
+
 	for (bank = 0; bank < this_cpu_read(mce_num_banks); ++bank)
-		log_error_deferred(bank);
+		log_error_deferred(bank, r);
+
+	if (r && r->kick) {
+		r->kick = false;
+		schedule_work_on(smp_processor_id(), &r->work);
+	}
 }
 
 static void log_error_thresholding(unsigned int bank, u64 misc)
 {
-	_log_error_bank(bank, msr_ops.status(bank), msr_ops.addr(bank), misc);
+	_log_error_bank(bank, msr_ops.status(bank), msr_ops.addr(bank), misc,
+			NULL);
 }
 
 static void log_and_reset_block(struct threshold_block *block)
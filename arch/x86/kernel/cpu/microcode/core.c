@@ -518,10 +518,31 @@ static int check_online_cpus(void)
 
 static atomic_t late_cpus_in;
 static atomic_t late_cpus_out;
+/* Number of CPUs taking part in the current rendezvous */
+static int late_nr_cpus;
+
+/*
+ * On AMD, the microcode engine is only shared between the SMT siblings of a
+ * core and there is no requirement for the other cores to be quiescent while
+ * one of them is updated.  The late load therefore rolls through the cores
+ * in batches of late_batch_cores, stopping only the CPUs of one batch at a
+ * time and waiting late_batch_delay_ms between batches, instead of holding
+ * every CPU in stop_machine() for the whole update.  A batch size of 0
+ * selects the stop_machine() path.
+ */
+static unsigned int late_batch_cores = 4;
+static unsigned int late_batch_delay_ms;
+
+/* Pause statistics of the last rolling late load */
+static struct {
+	unsigned int	batches;
+	u64		max_ns;
+	u64		total_ns;
+} late_stats;
 
 static int __wait_for_cpus(atomic_t *t, long long timeout)
 {
-	int all_cpus = num_online_cpus();
+	int all_cpus = late_nr_cpus;
 
 	atomic_inc(t);
 
@@ -593,18 +614,97 @@ wait_for_siblings:
 	return ret;
 }
 
+static int microcode_reload_batch(const struct cpumask *cpus)
+{
+	atomic_set(&late_cpus_in,  0);
+	atomic_set(&late_cpus_out, 0);
+	late_nr_cpus = cpumask_weight(cpus);
+
+	return stop_cpus_cpuslocked(cpus, __reload_late, NULL);
+}
+
+/*
+ * Reload microcode late one batch of cores at a time, only the SMT siblings
+ * of the cores in the batch gather together.
+ */
+static int microcode_reload_rolling(void)
+{
+	cpumask_var_t batch, done;
+	unsigned int cpu, nr_cores = 0;
+	u64 start, pause;
+	int ret = 0;
+
+	if (!zalloc_cpumask_var(&batch, GFP_KERNEL))
+		return -ENOMEM;
+	if (!zalloc_cpumask_var(&done, GFP_KERNEL)) {
+		free_cpumask_var(batch);
+		return -ENOMEM;
+	}
+
+	memset(&late_stats, 0, sizeof(late_stats));
+
+	for_each_online_cpu(cpu) {
+		if (cpumask_test_cpu(cpu, done))
+			continue;
+
+		cpumask_or(done, done, topology_sibling_cpumask(cpu));
+		cpumask_or(batch, batch, topology_sibling_cpumask(cpu));
+		if (++nr_cores < late_batch_cores &&
+		    !cpumask_equal(done, cpu_online_mask))
+			continue;
+
+		cpumask_and(batch, batch, cpu_online_mask);
+
+		start = ktime_get_ns();
+		ret = microcode_reload_batch(batch);
+		pause = ktime_get_ns() - start;
+
+		late_stats.batches++;
+		late_stats.total_ns += pause;
+		late_stats.max_ns = max(late_stats.max_ns, pause);
+		pr_debug("Batch %u: CPUs %*pbl paused for %llu us\n",
+			 late_stats.batches, cpumask_pr_args(batch),
+			 div_u64(pause, NSEC_PER_USEC));
+
+		if (ret)
+			break;
+
+		cpumask_clear(batch);
+		nr_cores = 0;
+
+		if (late_batch_delay_ms)
+			msleep(late_batch_delay_ms);
+		else
+			cond_resched();
+	}
+
+	pr_info("Rolling reload: %u batches, max pause %llu us, total pause %llu us\n",
+		late_stats.batches, div_u64(late_stats.max_ns, NSEC_PER_USEC),
+		div_u64(late_stats.total_ns, NSEC_PER_USEC));
+
+	free_cpumask_var(done);
+	free_cpumask_var(batch);
+
+	return ret;
+}
+
 /*
  * Reload microcode late on all CPUs. Wait for a sec until they
- * all gather together.
+ * all gather together, or on AMD, until the CPUs of each batch do.
  */
 static int microcode_reload_late(void)
 {
 	int ret;
 
-	atomic_set(&late_cpus_in,  0);
-	atomic_set(&late_cpus_out, 0);
+	if (boot_cpu_data.x86_vendor == X86_VENDOR_AMD && late_batch_cores) {
+		ret = microcode_reload_rolling();
+	} else {
+		atomic_set(&late_cpus_in,  0);
+		atomic_set(&late_cpus_out, 0);
+		late_nr_cpus = num_online_cpus();
 
-	ret = stop_machine_cpuslocked(__reload_late, NULL, cpu_online_mask);
+		ret = stop_machine_cpuslocked(__reload_late, NULL, cpu_online_mask);
+	}
 	if (ret == 0)
 		microcode_check();
 
@@ -652,6 +752,72 @@ put:
 	return ret;
 }
 
+static ssize_t rolling_batch_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", late_batch_cores);
+}
+
+static ssize_t rolling_batch_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t size)
+{
+	unsigned int val;
+	ssize_t ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&microcode_mutex);
+	late_batch_cores = val;
+	mutex_unlock(&microcode_mutex);
+
+	return size;
+}
+
+static ssize_t rolling_delay_ms_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", late_batch_delay_ms);
+}
+
+static ssize_t rolling_delay_ms_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t size)
+{
+	unsigned int val;
+	ssize_t ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	if (val > MSEC_PER_SEC)
+		return -EINVAL;
+
+	mutex_lock(&microcode_mutex);
+	late_batch_delay_ms = val;
+	mutex_unlock(&microcode_mutex);
+
+	return size;
+}
+
+static ssize_t rolling_stats_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&microcode_mutex);
+	ret = sprintf(buf, "batches %u\nmax_pause_us %llu\ntotal_pause_us %llu\n",
+		      late_stats.batches,
+		      div_u64(late_stats.max_ns, NSEC_PER_USEC),
+		      div_u64(late_stats.total_ns, NSEC_PER_USEC));
+	mutex_unlock(&microcode_mutex);
+
+	return ret;
+}
+
 static ssize_t version_show(struct device *dev,
 			struct device_attribute *attr, char *buf)
 {
@@ -669,6 +835,9 @@ static ssize_t pf_show(struct device *dev,
 }
 
 static DEVICE_ATTR_WO(reload);
+static DEVICE_ATTR_RW(rolling_batch);
+static DEVICE_ATTR_RW(rolling_delay_ms);
+static DEVICE_ATTR_RO(rolling_stats);
 static DEVICE_ATTR(version, 0444, version_show, NULL);
 static DEVICE_ATTR(processor_flags, 0444, pf_show, NULL);
 
@@ -822,6 +991,9 @@ static int mc_cpu_down_prep(unsigned int cpu)
 
 static struct attribute *cpu_root_microcode_attrs[] = {
 	&dev_attr_reload.attr,
+	&dev_attr_rolling_batch.attr,
+	&dev_attr_rolling_delay_ms.attr,
+	&dev_attr_rolling_stats.attr,
 	NULL
 };
 
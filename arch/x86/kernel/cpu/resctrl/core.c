@@ -295,6 +295,8 @@ static bool __rdt_get_mem_config_amd(struct rdt_resource *r)
 
 	r->membw.min_bw = 0;
 	r->membw.bw_gran = 1;
+	/* Limits are in 1/8 GBps, which the mba_sc controller can use directly */
+	r->membw.mbps_unit = MBA_AMD_UNIT_MBPS;
 	/* Max value is 2048, Data width should be 4 in decimal */
 	r->data_width = 4;
 
@@ -486,6 +488,16 @@ static int domain_setup_ctrlval(struct rdt_resource *r, struct rdt_domain *d)
 		return -ENOMEM;
 	}
 
+	if (r->rid == RDT_RESOURCE_MBA) {
+		d->mba_sc = kcalloc(r->num_closid, sizeof(*d->mba_sc),
+				    GFP_KERNEL);
+		if (!d->mba_sc) {
+			kfree(dm);
+			kfree(dc);
+			return -ENOMEM;
+		}
+	}
+
 	d->ctrl_val = dc;
 	d->mbps_val = dm;
 	setup_default_ctrlval(r, dc, dm);
@@ -523,6 +535,12 @@ static int domain_setup_mon_state(struct rdt_resource *r, struct rdt_domain *d)
 			return -ENOMEM;
 		}
 	}
+	if (mbm_mux_domain_init(d)) {
+		bitmap_free(d->rmid_busy_llc);
+		kfree(d->mbm_total);
+		kfree(d->mbm_local);
+		return -ENOMEM;
+	}
 
 	if (is_mbm_enabled()) {
 		INIT_DELAYED_WORK(&d->mbm_over, mbm_handle_overflow);
@@ -635,9 +653,11 @@ static void domain_remove_cpu(int cpu, struct rdt_resource *r)
 
 		kfree(d->ctrl_val);
 		kfree(d->mbps_val);
+		kfree(d->mba_sc);
 		bitmap_free(d->rmid_busy_llc);
 		kfree(d->mbm_total);
 		kfree(d->mbm_local);
+		kfree(d->mbm_mux);
 		kfree(d);
 		return;
 	}
@@ -441,6 +441,7 @@ void mon_event_read(struct rmid_read *rr, struct rdt_resource *r,
 	rr->r = r;
 	rr->d = d;
 	rr->val = 0;
+	rr->coverage = 100;
 	rr->first = first;
 
 	smp_call_function_any(&d->cpu_mask, mon_event_count, rr, 1);
@@ -481,6 +482,8 @@ int rdtgroup_mondata_show(struct seq_file *m, void *arg)
 		seq_puts(m, "Error\n");
 	else if (rr.val & RMID_VAL_UNAVAIL)
 		seq_puts(m, "Unavailable\n");
+	else if (is_mbm_mux())
+		seq_printf(m, "%llu %u%%\n", rr.val * r->mon_scale, rr.coverage);
 	else
 		seq_printf(m, "%llu\n", rr.val * r->mon_scale);
 
@@ -7,6 +7,8 @@
 #include <linux/fs_context.h>
 #include <linux/jump_label.h>
 
+#include <asm/resctrl.h>
+
 #define MSR_IA32_L3_QOS_CFG		0xc81
 #define MSR_IA32_L2_QOS_CFG		0xc82
 #define MSR_IA32_L3_CBM_BASE		0xc90
@@ -33,10 +35,15 @@
 
 #define MBM_CNTR_WIDTH_BASE		24
 #define MBM_OVERFLOW_INTERVAL		1000
+#define MBM_MUX_INTERVAL_DEFAULT	100
+#define MBM_MUX_INTERVAL_MIN		10
+#define MBM_MUX_MAX_RMIDS		32
 #define MAX_MBA_BW			100u
 #define MBA_IS_LINEAR			0x4
 #define MBA_MAX_MBPS			U32_MAX
 #define MAX_MBA_BW_AMD			0x800
+#define MBA_AMD_UNIT_MBPS		128
+#define MBA_SC_STABLE_PERIODS		3
 #define MBM_CNTR_WIDTH_OFFSET_AMD	20
 
 #define RMID_VAL_ERROR			BIT_ULL(63)
@@ -54,6 +61,7 @@ struct rdt_fs_context {
 	bool				enable_cdpl2;
 	bool				enable_cdpl3;
 	bool				enable_mba_mbps;
+	bool				enable_mbm_mux;
 };
 
 static inline struct rdt_fs_context *rdt_fc2context(struct fs_context *fc)
@@ -99,9 +107,11 @@ struct rmid_read {
 	int			evtid;
 	bool			first;
 	u64			val;
+	u32			coverage;
 };
 
 extern unsigned int resctrl_cqm_threshold;
+extern unsigned int mbm_mux_interval_ms;
 extern bool rdt_alloc_capable;
 extern bool rdt_mon_capable;
 extern unsigned int rdt_mon_features;
@@ -297,6 +307,31 @@ struct mbm_state {
 	bool	delta_comp;
 };
 
+/**
+ * struct mbm_mux_domain - per domain state of the RMID multiplexing mode
+ * @primed:	@prev_msr holds valid counter values
+ * @prev_msr:	last total/local counter value read for each pool RMID
+ * @chunks:	total/local chunks accumulated for each multiplexed group
+ *		while it held a pool RMID
+ */
+struct mbm_mux_domain {
+	bool	primed;
+	u64	prev_msr[MBM_MUX_MAX_RMIDS][2];
+	u64	chunks[RESCTRL_MUX_MAX_GROUPS][2];
+};
+
+/**
+ * struct mba_sc_state - MBA software controller state of a CLOSID
+ * @cur_bw:	bandwidth measured in the last period, in MBps
+ * @stable:	consecutive periods without a throttle adjustment
+ * @adjusts:	number of throttle adjustments made
+ */
+struct mba_sc_state {
+	u32	cur_bw;
+	u32	stable;
+	u32	adjusts;
+};
+
 /**
  * struct rdt_domain - group of cpus sharing an RDT resource
  * @list:	all instances of this resource
@@ -306,6 +341,7 @@ struct mbm_state {
  *		bitmap of which limbo RMIDs are above threshold
  * @mbm_total:	saved state for MBM total bandwidth
  * @mbm_local:	saved state for MBM local bandwidth
+ * @mbm_mux:	saved state for RMID multiplexing, if enabled
  * @mbm_over:	worker to periodically read MBM h/w counters
  * @cqm_limbo:	worker to periodically read CQM h/w counters
  * @mbm_work_cpu:
@@ -314,6 +350,8 @@ struct mbm_state {
  *		worker cpu for CQM h/w counters
  * @ctrl_val:	array of cache or mem ctrl values (indexed by CLOSID)
  * @mbps_val:	When mba_sc is enabled, this holds the bandwidth in MBps
+ * @mba_sc:	When mba_sc is enabled, this holds the controller state
+ *		(MBA resource only, indexed by CLOSID)
  * @new_ctrl:	new ctrl value to be loaded
  * @have_new_ctrl: did user provide new_ctrl for this domain
  * @plr:	pseudo-locked region (if any) associated with domain
@@ -325,12 +363,14 @@ struct rdt_domain {
 	unsigned long			*rmid_busy_llc;
 	struct mbm_state		*mbm_total;
 	struct mbm_state		*mbm_local;
+	struct mbm_mux_domain		*mbm_mux;
 	struct delayed_work		mbm_over;
 	struct delayed_work		cqm_limbo;
 	int				mbm_work_cpu;
 	int				cqm_work_cpu;
 	u32				*ctrl_val;
 	u32				*mbps_val;
+	struct mba_sc_state		*mba_sc;
 	u32				new_ctrl;
 	bool				have_new_ctrl;
 	struct pseudo_lock_region	*plr;
@@ -376,6 +416,8 @@ struct rdt_cache {
  * @min_bw:		Minimum memory bandwidth percentage user can request
  * @bw_gran:		Granularity at which the memory bandwidth is allocated
  * @delay_linear:	True if memory B/W delay is in linear scale
+ * @mbps_unit:		MBps per control unit if the control is an absolute
+ *			bandwidth rather than a percentage, 0 otherwise
  * @arch_needs_linear:	True if we can't configure non-linear resources
  * @mba_sc:		True if MBA software controller(mba_sc) is enabled
  * @mb_map:		Mapping of memory B/W percentage to memory B/W delay
@@ -384,6 +426,7 @@ struct rdt_membw {
 	u32		min_bw;
 	u32		bw_gran;
 	u32		delay_linear;
+	u32		mbps_unit;
 	bool		arch_needs_linear;
 	bool		mba_sc;
 	u32		*mb_map;
@@ -599,6 +642,11 @@ void mon_event_read(struct rmid_read *rr, struct rdt_resource *r,
 void mbm_setup_overflow_handler(struct rdt_domain *dom,
 				unsigned long delay_ms);
 void mbm_handle_overflow(struct work_struct *work);
+int mbm_mux_enable(void);
+void mbm_mux_disable(void);
+int mbm_mux_domain_init(struct rdt_domain *d);
+bool is_mbm_mux(void);
+void update_closid_rmid(const struct cpumask *cpu_mask, struct rdtgroup *r);
 bool is_mba_sc(struct rdt_resource *r);
 void setup_default_ctrlval(struct rdt_resource *r, u32 *dc, u32 *dm);
 u32 delay_bw_map(unsigned long bw, struct rdt_resource *r);
@@ -17,6 +17,7 @@
 
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/math64.h>
 #include <asm/cpu_device_id.h>
 #include "internal.h"
 
@@ -64,6 +65,72 @@ unsigned int rdt_mon_features;
  */
 unsigned int resctrl_cqm_threshold;
 
+/*
+ * RMID multiplexing for MBM.
+ *
+ * When the resctrl file system is mounted with "mbm_mux", a small pool
+ * of hardware RMIDs is reserved and rotated across the monitor groups
+ * that could not get a hardware RMID of their own. Such groups are
+ * handed a virtual RMID (resctrl_mux_rmid_base + id) which is stored in
+ * the tasks and translated to the currently held hardware RMID at
+ * context switch time, so a rotation only needs to update
+ * resctrl_mux_rmid_map[] and IPI the CPUs.
+ *
+ * The bandwidth a group consumed while it held a pool RMID is
+ * extrapolated to the lifetime of the group. The fraction of its
+ * lifetime that was actually measured is reported as coverage. While a
+ * group waits for a pool RMID its tasks run with a reserved sink RMID,
+ * which is never read, so their traffic is not charged to anybody else.
+ *
+ * All state except resctrl_mux_rmid_map[] is protected by
+ * rdtgroup_mutex.
+ */
+DEFINE_STATIC_KEY_FALSE(rdt_mbm_mux_key);
+u32 resctrl_mux_rmid_base;
+u32 resctrl_mux_rmid_map[RESCTRL_MUX_MAX_GROUPS];
+
+unsigned int mbm_mux_interval_ms = MBM_MUX_INTERVAL_DEFAULT;
+
+/**
+ * struct mbm_mux_slot - a hardware RMID of the multiplexing pool
+ * @rmid:	the hardware RMID
+ * @holder:	id of the group currently holding it, or -1
+ * @start_ns:	time @holder got the RMID
+ */
+struct mbm_mux_slot {
+	u32	rmid;
+	int	holder;
+	u64	start_ns;
+};
+
+/**
+ * struct mbm_mux_group - state of a multiplexed monitor group
+ * @created_ns:	time the group was created
+ * @covered_ns:	time the group held a pool RMID, excluding the current slot
+ * @slot:	index of the pool RMID held, or -1
+ */
+struct mbm_mux_group {
+	u64	created_ns;
+	u64	covered_ns;
+	int	slot;
+};
+
+static bool mbm_mux_enabled;
+static u32 mbm_mux_sink_rmid;
+static unsigned int mbm_mux_nr_slots;
+static unsigned int mbm_mux_cursor;
+static struct mbm_mux_slot mbm_mux_slots[MBM_MUX_MAX_RMIDS];
+static struct mbm_mux_group *mbm_mux_groups;
+static DECLARE_BITMAP(mbm_mux_used, RESCTRL_MUX_MAX_GROUPS);
+
+static void mbm_mux_rotate(struct work_struct *work);
+static DECLARE_DELAYED_WORK(mbm_mux_work, mbm_mux_rotate);
+
+static const u32 mbm_mux_evtids[2] = {
+	QOS_L3_MBM_TOTAL_EVENT_ID,
+	QOS_L3_MBM_LOCAL_EVENT_ID,
+};
+
 static inline struct rmid_entry *__rmid_entry(u32 rmid)
 {
 	struct rmid_entry *entry;
@@ -141,6 +208,61 @@ bool has_busy_rmid(struct rdt_resource *r, struct rdt_domain *d)
 	return find_first_bit(d->rmid_busy_llc, r->num_rmid) != r->num_rmid;
 }
 
+static inline bool is_mbm_mux_rmid(u32 rmid)
+{
+	return mbm_mux_enabled && rmid >= resctrl_mux_rmid_base;
+}
+
+bool is_mbm_mux(void)
+{
+	return mbm_mux_enabled;
+}
+
+static int mbm_mux_alloc(void)
+{
+	struct rdt_resource *r = &rdt_resources_all[RDT_RESOURCE_L3];
+	struct rdt_domain *d;
+	unsigned int id;
+
+	id = find_first_zero_bit(mbm_mux_used, RESCTRL_MUX_MAX_GROUPS);
+	if (id >= RESCTRL_MUX_MAX_GROUPS)
+		return -ENOSPC;
+
+	list_for_each_entry(d, &r->domains, list) {
+		if (d->mbm_mux)
+			memset(d->mbm_mux->chunks[id], 0,
+			       sizeof(d->mbm_mux->chunks[id]));
+	}
+
+	mbm_mux_groups[id].created_ns = ktime_get_ns();
+	mbm_mux_groups[id].covered_ns = 0;
+	mbm_mux_groups[id].slot = -1;
+	WRITE_ONCE(resctrl_mux_rmid_map[id], mbm_mux_sink_rmid);
+	set_bit(id, mbm_mux_used);
+
+	/* Get the new group a pool RMID at the next rotation */
+	schedule_delayed_work(&mbm_mux_work,
+			      msecs_to_jiffies(mbm_mux_interval_ms));
+
+	return resctrl_mux_rmid_base + id;
+}
+
+/*
+ * The tasks and CPUs of the group have already been moved away, so the
+ * pool RMID it held just idles until the next rotation.
+ */
+static void mbm_mux_free(u32 rmid)
+{
+	unsigned int id = rmid - resctrl_mux_rmid_base;
+	struct mbm_mux_group *g = &mbm_mux_groups[id];
+
+	if (g->slot >= 0)
+		mbm_mux_slots[g->slot].holder = -1;
+	g->slot = -1;
+	WRITE_ONCE(resctrl_mux_rmid_map[id], mbm_mux_sink_rmid);
+	clear_bit(id, mbm_mux_used);
+}
+
 /*
  * As of now the RMIDs allocation is global.
  * However we keep track of which packages the RMIDs
@@ -152,8 +274,11 @@ int alloc_rmid(void)
 
 	lockdep_assert_held(&rdtgroup_mutex);
 
-	if (list_empty(&rmid_free_lru))
+	if (list_empty(&rmid_free_lru)) {
+		if (mbm_mux_enabled)
+			return mbm_mux_alloc();
 		return rmid_limbo_count ? -EBUSY : -ENOSPC;
+	}
 
 	entry = list_first_entry(&rmid_free_lru,
 				 struct rmid_entry, list);
@@ -206,6 +331,11 @@ void free_rmid(u32 rmid)
 
 	lockdep_assert_held(&rdtgroup_mutex);
 
+	if (is_mbm_mux_rmid(rmid)) {
+		mbm_mux_free(rmid);
+		return;
+	}
+
 	entry = __rmid_entry(rmid);
 
 	if (is_llc_occupancy_enabled())
@@ -222,11 +352,291 @@ static u64 mbm_overflow_count(u64 prev_msr, u64 cur_msr, unsigned int width)
 	return chunks >>= shift;
 }
 
+/*
+ * Report the bandwidth of a multiplexed group extrapolated to its whole
+ * lifetime. Called on a CPU of rr->d.
+ */
+static int mbm_mux_count(u32 rmid, struct rmid_read *rr)
+{
+	unsigned int id = rmid - resctrl_mux_rmid_base;
+	struct mbm_mux_domain *m = rr->d->mbm_mux;
+	struct mbm_mux_group *g = &mbm_mux_groups[id];
+	u64 now, chunks, covered_ns, total_ns, tval;
+	struct mbm_mux_slot *slot;
+	int e;
+
+	switch (rr->evtid) {
+	case QOS_L3_MBM_TOTAL_EVENT_ID:
+		e = 0;
+		break;
+	case QOS_L3_MBM_LOCAL_EVENT_ID:
+		e = 1;
+		break;
+	default:
+		/* Occupancy cannot be carried over when an RMID is handed on */
+		rr->val = RMID_VAL_UNAVAIL;
+		return -EINVAL;
+	}
+
+	if (rr->first)
+		return 0;
+
+	if (!m) {
+		rr->val = RMID_VAL_UNAVAIL;
+		return -EINVAL;
+	}
+
+	now = ktime_get_ns();
+	chunks = m->chunks[id][e];
+	covered_ns = g->covered_ns;
+	if (g->slot >= 0) {
+		slot = &mbm_mux_slots[g->slot];
+		covered_ns += now - slot->start_ns;
+		tval = __rmid_read(slot->rmid, rr->evtid);
+		if (m->primed && !(tval & (RMID_VAL_ERROR | RMID_VAL_UNAVAIL)))
+			chunks += mbm_overflow_count(m->prev_msr[g->slot][e],
+						     tval, rr->r->mbm_width);
+	}
+
+	total_ns = now - g->created_ns;
+	if (covered_ns)
+		rr->val += mul_u64_u64_div_u64(chunks, total_ns, covered_ns);
+	if (total_ns)
+		rr->coverage = min_t(u32, rr->coverage,
+				     div64_u64(covered_ns * 100, total_ns));
+
+	return 0;
+}
+
+/*
+ * Accumulate the counts of the pool RMIDs to their holders. Called via
+ * IPI on a CPU of the domain.
+ */
+static void mbm_mux_sample(void *info)
+{
+	struct rdt_resource *r = &rdt_resources_all[RDT_RESOURCE_L3];
+	struct rdt_domain *d = info;
+	struct mbm_mux_domain *m = d->mbm_mux;
+	struct mbm_mux_slot *slot;
+	unsigned int i, e;
+	u64 tval;
+
+	for (i = 0; i < mbm_mux_nr_slots; i++) {
+		slot = &mbm_mux_slots[i];
+		for (e = 0; e < ARRAY_SIZE(mbm_mux_evtids); e++) {
+			if (!(rdt_mon_features & (1 << mbm_mux_evtids[e])))
+				continue;
+
+			tval = __rmid_read(slot->rmid, mbm_mux_evtids[e]);
+			if (tval & (RMID_VAL_ERROR | RMID_VAL_UNAVAIL))
+				continue;
+
+			if (m->primed && slot->holder >= 0)
+				m->chunks[slot->holder][e] +=
+					mbm_overflow_count(m->prev_msr[i][e],
+							   tval, r->mbm_width);
+			m->prev_msr[i][e] = tval;
+		}
+	}
+	m->primed = true;
+}
+
+/*
+ * Sample the pool RMIDs on all domains and hand them on to the next
+ * groups in line. The interval is capped at MBM_OVERFLOW_INTERVAL so
+ * this also keeps the pool RMIDs from overflowing unnoticed.
+ */
+static void mbm_mux_rotate(struct work_struct *work)
+{
+	struct rdt_resource *r = &rdt_resources_all[RDT_RESOURCE_L3];
+	unsigned int i, id, waiting = 0;
+	struct mbm_mux_group *g;
+	struct rdt_domain *d;
+	u64 now;
+
+	mutex_lock(&rdtgroup_mutex);
+
+	if (!mbm_mux_enabled)
+		goto out_unlock;
+
+	list_for_each_entry(d, &r->domains, list) {
+		if (d->mbm_mux)
+			smp_call_function_any(&d->cpu_mask, mbm_mux_sample,
+					      d, 1);
+	}
+
+	for_each_set_bit(id, mbm_mux_used, RESCTRL_MUX_MAX_GROUPS) {
+		if (mbm_mux_groups[id].slot < 0)
+			waiting++;
+	}
+
+	/* Everybody is measured already, nothing to rotate */
+	if (!waiting)
+		goto out_resched;
+
+	now = ktime_get_ns();
+	for (i = 0; i < mbm_mux_nr_slots; i++) {
+		if (mbm_mux_slots[i].holder < 0)
+			continue;
+
+		g = &mbm_mux_groups[mbm_mux_slots[i].holder];
+		g->covered_ns += now - mbm_mux_slots[i].start_ns;
+		g->slot = -1;
+		WRITE_ONCE(resctrl_mux_rmid_map[mbm_mux_slots[i].holder],
+			   mbm_mux_sink_rmid);
+		mbm_mux_slots[i].holder = -1;
+	}
+
+	id = mbm_mux_cursor;
+	for (i = 0; i < mbm_mux_nr_slots; i++) {
+		id = find_next_bit(mbm_mux_used, RESCTRL_MUX_MAX_GROUPS, id);
+		if (id >= RESCTRL_MUX_MAX_GROUPS)
+			id = find_first_bit(mbm_mux_used,
+					    RESCTRL_MUX_MAX_GROUPS);
+		/* Fewer groups than pool RMIDs */
+		if (id >= RESCTRL_MUX_MAX_GROUPS || mbm_mux_groups[id].slot >= 0)
+			break;
+
+		mbm_mux_slots[i].holder = id;
+		mbm_mux_slots[i].start_ns = now;
+		mbm_mux_groups[id].slot = i;
+		WRITE_ONCE(resctrl_mux_rmid_map[id], mbm_mux_slots[i].rmid);
+		id++;
+	}
+	mbm_mux_cursor = id;
+
+	update_closid_rmid(cpu_online_mask, NULL);
+
+out_resched:
+	if (!bitmap_empty(mbm_mux_used, RESCTRL_MUX_MAX_GROUPS))
+		schedule_delayed_work(&mbm_mux_work,
+				      msecs_to_jiffies(mbm_mux_interval_ms));
+out_unlock:
+	mutex_unlock(&rdtgroup_mutex);
+}
+
+int mbm_mux_domain_init(struct rdt_domain *d)
+{
+	if (!mbm_mux_enabled)
+		return 0;
+
+	d->mbm_mux = kzalloc(sizeof(*d->mbm_mux), GFP_KERNEL);
+	if (!d->mbm_mux)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Release the pool RMIDs. All multiplexed groups must have been freed
+ * already. The rotation work may still be pending; it notices that
+ * the mode is disabled and does not rearm.
+ */
+void mbm_mux_disable(void)
+{
+	struct rdt_resource *r = &rdt_resources_all[RDT_RESOURCE_L3];
+	struct rdt_domain *d;
+	unsigned int i;
+
+	lockdep_assert_held(&rdtgroup_mutex);
+
+	if (!mbm_mux_enabled)
+		return;
+
+	static_branch_disable_cpuslocked(&rdt_mbm_mux_key);
+	mbm_mux_enabled = false;
+	cancel_delayed_work(&mbm_mux_work);
+
+	for (i = 0; i < mbm_mux_nr_slots; i++)
+		free_rmid(mbm_mux_slots[i].rmid);
+	mbm_mux_nr_slots = 0;
+	free_rmid(mbm_mux_sink_rmid);
+	mbm_mux_sink_rmid = 0;
+
+	list_for_each_entry(d, &r->domains, list) {
+		kfree(d->mbm_mux);
+		d->mbm_mux = NULL;
+	}
+
+	bitmap_zero(mbm_mux_used, RESCTRL_MUX_MAX_GROUPS);
+	memset(resctrl_mux_rmid_map, 0, sizeof(resctrl_mux_rmid_map));
+	kfree(mbm_mux_groups);
+	mbm_mux_groups = NULL;
+}
+
+/*
+ * Reserve the pool RMIDs. Called at mount time before any group other
+ * than the default one exists.
+ */
+int mbm_mux_enable(void)
+{
+	struct rdt_resource *r = &rdt_resources_all[RDT_RESOURCE_L3];
+	struct rdt_domain *d;
+	unsigned int i;
+	int rmid;
+
+	lockdep_assert_held(&rdtgroup_mutex);
+
+	if (!is_mbm_enabled())
+		return -EINVAL;
+
+	mbm_mux_groups = kcalloc(RESCTRL_MUX_MAX_GROUPS,
+				 sizeof(*mbm_mux_groups), GFP_KERNEL);
+	if (!mbm_mux_groups)
+		return -ENOMEM;
+
+	/* Waiting groups must not fall back to the default group's RMID 0 */
+	rmid = alloc_rmid();
+	if (rmid < 0)
+		goto out_free;
+	mbm_mux_sink_rmid = rmid;
+
+	mbm_mux_nr_slots = clamp_t(unsigned int, r->num_rmid / 4, 1,
+				   MBM_MUX_MAX_RMIDS);
+	for (i = 0; i < mbm_mux_nr_slots; i++) {
+		rmid = alloc_rmid();
+		if (rmid < 0) {
+			mbm_mux_nr_slots = i;
+			break;
+		}
+		mbm_mux_slots[i].rmid = rmid;
+		mbm_mux_slots[i].holder = -1;
+	}
+	if (!mbm_mux_nr_slots)
+		goto out_free;
+
+	/* Set before allocating the domain state, see mbm_mux_domain_init() */
+	resctrl_mux_rmid_base = r->num_rmid;
+	mbm_mux_enabled = true;
+	list_for_each_entry(d, &r->domains, list) {
+		if (mbm_mux_domain_init(d))
+			goto out_disable;
+	}
+
+	mbm_mux_cursor = 0;
+	static_branch_enable_cpuslocked(&rdt_mbm_mux_key);
+
+	return 0;
+
+out_disable:
+	mbm_mux_disable();
+	return -ENOMEM;
+out_free:
+	free_rmid(mbm_mux_sink_rmid);
+	mbm_mux_sink_rmid = 0;
+	kfree(mbm_mux_groups);
+	mbm_mux_groups = NULL;
+	return -ENOSPC;
+}
+
 static int __mon_event_count(u32 rmid, struct rmid_read *rr)
 {
 	struct mbm_state *m;
 	u64 chunks, tval;
 
+	if (is_mbm_mux_rmid(rmid))
+		return mbm_mux_count(rmid, rr);
+
 	tval = __rmid_read(rmid, rr->evtid);
 	if (tval & (RMID_VAL_ERROR | RMID_VAL_UNAVAIL)) {
 		rr->val = tval;
@@ -348,7 +758,35 @@ void mon_event_count(void *info)
  * In this case we may restrict the rdtgroup's L2 <-> L3 traffic as its
  * throttle MSRs already have low percentage values.  To avoid
  * unnecessarily restricting such rdtgroups, we also increase the bandwidth.
+ *
+ * Where the throttle value is itself a bandwidth (AMD, in units of
+ * membw.mbps_unit) the error can be translated into throttle units
+ * directly, see mba_sc_abs_step().
  */
+
+/*
+ * Correct half of the error each period so that the noise in the MBM
+ * readings does not make the throttle value oscillate. Errors below one
+ * unit are left alone.
+ */
+static u32 mba_sc_abs_step(struct rdt_resource *r_mba, u32 cur_msr_val,
+			   u32 cur_bw, u32 user_bw)
+{
+	u32 unit = r_mba->membw.mbps_unit;
+	s64 err = (s64)user_bw - cur_bw;
+	s64 new_msr_val;
+
+	if (abs(err) < unit)
+		return cur_msr_val;
+
+	new_msr_val = cur_msr_val + div_s64(err, 2 * unit);
+	if (new_msr_val == cur_msr_val)
+		new_msr_val += err > 0 ? 1 : -1;
+
+	return clamp_t(s64, new_msr_val, max(r_mba->membw.min_bw, 1U),
+		       r_mba->default_ctrl);
+}
+
 static void update_mba_bw(struct rdtgroup *rgrp, struct rdt_domain *dom_mbm)
 {
 	u32 closid, rmid, cur_msr, cur_msr_val, new_msr_val;
@@ -356,6 +794,7 @@ static void update_mba_bw(struct rdtgroup *rgrp, struct rdt_domain *dom_mbm)
 	u32 cur_bw, delta_bw, user_bw;
 	struct rdt_resource *r_mba;
 	struct rdt_domain *dom_mba;
+	struct mba_sc_state *sc;
 	struct list_head *head;
 	struct rdtgroup *entry;
 
@@ -388,6 +827,9 @@ static void update_mba_bw(struct rdtgroup *rgrp, struct rdt_domain *dom_mbm)
 		delta_bw += cmbm_data->delta_bw;
 	}
 
+	sc = &dom_mba->mba_sc[closid];
+	sc->cur_bw = cur_bw;
+
 	/*
 	 * Scale up/down the bandwidth linearly for the ctrl group.  The
 	 * bandwidth step is the bandwidth granularity specified by the
@@ -402,17 +844,31 @@ static void update_mba_bw(struct rdtgroup *rgrp, struct rdt_domain *dom_mbm)
 	 * switching between 90 and 110 continuously if we only check
 	 * cur_bw < user_bw.
 	 */
-	if (cur_msr_val > r_mba->membw.min_bw && user_bw < cur_bw) {
+	if (r_mba->membw.mbps_unit) {
+		new_msr_val = mba_sc_abs_step(r_mba, cur_msr_val, cur_bw,
+					      user_bw);
+	} else if (cur_msr_val > r_mba->membw.min_bw && user_bw < cur_bw) {
 		new_msr_val = cur_msr_val - r_mba->membw.bw_gran;
 	} else if (cur_msr_val < MAX_MBA_BW &&
 		   (user_bw > (cur_bw + delta_bw))) {
 		new_msr_val = cur_msr_val + r_mba->membw.bw_gran;
 	} else {
+		new_msr_val = cur_msr_val;
+	}
+
+	if (new_msr_val == cur_msr_val) {
+		if (sc->stable < U32_MAX)
+			sc->stable++;
 		return;
 	}
+	sc->stable = 0;
+	sc->adjusts++;
 
 	cur_msr = r_mba->msr_base + closid;
-	wrmsrl(cur_msr, delay_bw_map(new_msr_val, r_mba));
+	if (r_mba->membw.delay_linear)
+		wrmsrl(cur_msr, delay_bw_map(new_msr_val, r_mba));
+	else
+		wrmsrl(cur_msr, new_msr_val);
 	dom_mba->ctrl_val[closid] = new_msr_val;
 
 	/*
@@ -436,6 +892,10 @@ static void mbm_update(struct rdt_resource *r, struct rdt_domain *d, int rmid)
 {
 	struct rmid_read rr;
 
+	/* Multiplexed groups are sampled by mbm_mux_rotate() */
+	if (is_mbm_mux_rmid(rmid))
+		return;
+
 	rr.first = false;
 	rr.r = r;
 	rr.d = d;
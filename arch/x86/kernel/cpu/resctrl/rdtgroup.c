@@ -319,7 +319,7 @@ static void update_cpu_closid_rmid(void *info)
  *
  * Per task closids/rmids must have been set up before calling this function.
  */
-static void
+void
 update_closid_rmid(const struct cpumask *cpu_mask, struct rdtgroup *r)
 {
 	int cpu = get_cpu();
@@ -1017,6 +1017,54 @@ static int rdt_delay_linear_show(struct kernfs_open_file *of,
 	return 0;
 }
 
+/*
+ * Show the state of the MBA software controller for each CLOSID in use:
+ * the target and the measured bandwidth in MBps, the current throttle
+ * value, and whether it has settled.
+ */
+static int rdt_mba_sc_state_show(struct kernfs_open_file *of,
+				 struct seq_file *seq, void *v)
+{
+	struct rdt_resource *r = of->kn->parent->priv;
+	struct mba_sc_state *sc;
+	struct rdt_domain *d;
+	unsigned int closid;
+
+	mutex_lock(&rdtgroup_mutex);
+
+	if (!is_mba_sc(r)) {
+		seq_puts(seq, "disabled\n");
+		goto out_unlock;
+	}
+
+	for (closid = 0; closid < closids_supported(); closid++) {
+		if (!closid_allocated(closid))
+			continue;
+
+		list_for_each_entry(d, &r->domains, list) {
+			sc = &d->mba_sc[closid];
+			seq_printf(seq, "%u:%d target=%u cur=%u ctrl=%u adjusts=%u %s\n",
+				   closid, d->id, d->mbps_val[closid],
+				   sc->cur_bw, d->ctrl_val[closid], sc->adjusts,
+				   sc->stable >= MBA_SC_STABLE_PERIODS ?
+				   "converged" : "adjusting");
+		}
+	}
+
+out_unlock:
+	mutex_unlock(&rdtgroup_mutex);
+	return 0;
+}
+
+static int rdt_mbps_unit_show(struct kernfs_open_file *of,
+			      struct seq_file *seq, void *v)
+{
+	struct rdt_resource *r = of->kn->parent->priv;
+
+	seq_printf(seq, "%u\n", r->membw.mbps_unit);
+	return 0;
+}
+
 static int max_threshold_occ_show(struct kernfs_open_file *of,
 				  struct seq_file *seq, void *v)
 {
@@ -1046,6 +1094,33 @@ static ssize_t max_threshold_occ_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+static int mbm_mux_interval_show(struct kernfs_open_file *of,
+				 struct seq_file *seq, void *v)
+{
+	seq_printf(seq, "%u\n", mbm_mux_interval_ms);
+
+	return 0;
+}
+
+static ssize_t mbm_mux_interval_write(struct kernfs_open_file *of,
+				      char *buf, size_t nbytes, loff_t off)
+{
+	unsigned int ms;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &ms);
+	if (ret)
+		return ret;
+
+	/* Pool RMIDs are only read at rotation, don't let them overflow */
+	if (ms < MBM_MUX_INTERVAL_MIN || ms > MBM_OVERFLOW_INTERVAL)
+		return -EINVAL;
+
+	mbm_mux_interval_ms = ms;
+
+	return nbytes;
+}
+
 /*
  * rdtgroup_mode_show - Display mode of this resource group
  */
@@ -1523,6 +1598,20 @@ static struct rftype res_common_files[] = {
 		.seq_show	= rdt_delay_linear_show,
 		.fflags		= RF_CTRL_INFO | RFTYPE_RES_MB,
 	},
+	{
+		.name		= "bandwidth_unit_mbps",
+		.mode		= 0444,
+		.kf_ops		= &rdtgroup_kf_single_ops,
+		.seq_show	= rdt_mbps_unit_show,
+		.fflags		= RF_CTRL_INFO | RFTYPE_RES_MB,
+	},
+	{
+		.name		= "mba_sc_state",
+		.mode		= 0444,
+		.kf_ops		= &rdtgroup_kf_single_ops,
+		.seq_show	= rdt_mba_sc_state_show,
+		.fflags		= RF_CTRL_INFO | RFTYPE_RES_MB,
+	},
 	{
 		.name		= "max_threshold_occupancy",
 		.mode		= 0644,
@@ -1531,6 +1620,14 @@ static struct rftype res_common_files[] = {
 		.seq_show	= max_threshold_occ_show,
 		.fflags		= RF_MON_INFO | RFTYPE_RES_CACHE,
 	},
+	{
+		.name		= "mbm_mux_interval_ms",
+		.mode		= 0644,
+		.kf_ops		= &rdtgroup_kf_single_ops,
+		.write		= mbm_mux_interval_write,
+		.seq_show	= mbm_mux_interval_show,
+		.fflags		= RF_MON_INFO | RFTYPE_RES_CACHE,
+	},
 	{
 		.name		= "cpus",
 		.mode		= 0644,
@@ -1887,20 +1984,23 @@ void rdt_domain_reconfigure_cdp(struct rdt_resource *r)
  * Enable or disable the MBA software controller
  * which helps user specify bandwidth in MBps.
  * MBA software controller is supported only if
- * MBM is supported and MBA is in linear scale.
+ * MBM is supported and MBA is in linear scale or
+ * takes an absolute bandwidth.
  */
 static int set_mba_sc(bool mba_sc)
 {
 	struct rdt_resource *r = &rdt_resources_all[RDT_RESOURCE_MBA];
 	struct rdt_domain *d;
 
-	if (!is_mbm_enabled() || !is_mba_linear() ||
+	if (!is_mbm_enabled() || !(is_mba_linear() || r->membw.mbps_unit) ||
 	    mba_sc == is_mba_sc(r))
 		return -EINVAL;
 
 	r->membw.mba_sc = mba_sc;
-	list_for_each_entry(d, &r->domains, list)
+	list_for_each_entry(d, &r->domains, list) {
 		setup_default_ctrlval(r, d->ctrl_val, d->mbps_val);
+		memset(d->mba_sc, 0, r->num_closid * sizeof(*d->mba_sc));
+	}
 
 	return 0;
 }
@@ -2052,6 +2152,13 @@ static int rdt_enable_ctx(struct rdt_fs_context *ctx)
 	if (!ret && ctx->enable_mba_mbps)
 		ret = set_mba_sc(true);
 
+	/*
+	 * The MBA software controller needs exact per group bandwidth
+	 * every second, which multiplexed groups cannot provide.
+	 */
+	if (!ret && ctx->enable_mbm_mux)
+		ret = ctx->enable_mba_mbps ? -EINVAL : mbm_mux_enable();
+
 	return ret;
 }
 
@@ -2133,6 +2240,7 @@ out_mongrp:
 out_info:
 	kernfs_remove(kn_info);
 out_mba:
+	mbm_mux_disable();
 	if (ctx->enable_mba_mbps)
 		set_mba_sc(false);
 out_cdp:
@@ -2148,6 +2256,7 @@ enum rdt_param {
 	Opt_cdp,
 	Opt_cdpl2,
 	Opt_mba_mbps,
+	Opt_mbm_mux,
 	nr__rdt_params
 };
 
@@ -2155,6 +2264,7 @@ static const struct fs_parameter_spec rdt_fs_parameters[] = {
 	fsparam_flag("cdp",		Opt_cdp),
 	fsparam_flag("cdpl2",		Opt_cdpl2),
 	fsparam_flag("mba_MBps",	Opt_mba_mbps),
+	fsparam_flag("mbm_mux",		Opt_mbm_mux),
 	{}
 };
 
@@ -2176,10 +2286,14 @@ static int rdt_parse_param(struct fs_context *fc, struct fs_parameter *param)
 		ctx->enable_cdpl2 = true;
 		return 0;
 	case Opt_mba_mbps:
-		if (boot_cpu_data.x86_vendor != X86_VENDOR_INTEL)
+		if (boot_cpu_data.x86_vendor != X86_VENDOR_INTEL &&
+		    boot_cpu_data.x86_vendor != X86_VENDOR_AMD)
 			return -EINVAL;
 		ctx->enable_mba_mbps = true;
 		return 0;
+	case Opt_mbm_mux:
+		ctx->enable_mbm_mux = true;
+		return 0;
 	}
 
 	return -EINVAL;
@@ -2372,6 +2486,7 @@ static void rdt_kill_sb(struct super_block *sb)
 		reset_all_ctrls(r);
 	cdp_disable_all();
 	rmdir_all_sub();
+	mbm_mux_disable();
 	rdt_pseudo_lock_release();
 	rdtgroup_default.mode = RDT_MODE_SHAREABLE;
 	static_branch_disable_cpuslocked(&rdt_alloc_enable_key);
@@ -3116,6 +3231,9 @@ static int rdtgroup_show_options(struct seq_file *seq, struct kernfs_root *kf)
 	if (is_mba_sc(&rdt_resources_all[RDT_RESOURCE_MBA]))
 		seq_puts(seq, ",mba_MBps");
 
+	if (is_mbm_mux())
+		seq_puts(seq, ",mbm_mux");
+
 	return 0;
 }
 
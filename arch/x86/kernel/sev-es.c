@@ -18,7 +18,11 @@
 #include <linux/set_memory.h>
 #include <linux/memblock.h>
 #include <linux/kernel.h>
+#include <linux/hash.h>
 #include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 
 #include <asm/cpu_entry_area.h>
 #include <asm/stacktrace.h>
@@ -43,6 +47,22 @@ static struct ghcb boot_ghcb_page __bss_decrypted __aligned(PAGE_SIZE);
  */
 static struct ghcb __initdata *boot_ghcb;
 
+/*
+ * Small direct-mapped cache of decoded kernel instructions, keyed by RIP.
+ * Hot MMIO sites trap over and over again from the same few instructions, so
+ * this saves the instruction decoder on most #VC exceptions. The cached bytes
+ * are compared against the current instruction before an entry is used, so
+ * text patching or module reloads can never return a stale decode.
+ */
+#define VC_INSN_CACHE_BITS	4
+#define VC_INSN_CACHE_SIZE	(1 << VC_INSN_CACHE_BITS)
+
+struct vc_insn_cache_entry {
+	unsigned long ip;
+	struct insn insn;
+	unsigned char bytes[MAX_INSN_SIZE];
+};
+
 /* #VC handler runtime per-cpu data */
 struct sev_es_runtime_data {
 	struct ghcb ghcb_page;
@@ -88,6 +108,14 @@ struct sev_es_runtime_data {
 	 * is currently unsupported in SEV-ES guests.
 	 */
 	unsigned long dr7;
+
+	/*
+	 * Set while the instruction cache is accessed, a nested #VC (from an
+	 * NMI handler for example) bypasses the cache instead of reading a
+	 * half-written entry.
+	 */
+	bool insn_cache_active;
+	struct vc_insn_cache_entry insn_cache[VC_INSN_CACHE_SIZE];
 };
 
 struct ghcb_state {
@@ -96,6 +124,31 @@ struct ghcb_state {
 
 static DEFINE_PER_CPU(struct sev_es_runtime_data*, runtime_data);
 
+/*
+ * #VC exits by exit-code. All intercepts which raise a #VC are below
+ * VC_EXIT_STAT_NPF, NPF (MMIO) gets its own slot and everything else is
+ * counted as unknown.
+ */
+#define VC_EXIT_STAT_NPF	(SVM_EXIT_MWAIT_COND + 1)
+#define VC_EXIT_STAT_OTHER	(VC_EXIT_STAT_NPF + 1)
+#define VC_EXIT_STAT_NR		(VC_EXIT_STAT_OTHER + 1)
+
+static DEFINE_PER_CPU(unsigned long [VC_EXIT_STAT_NR], vc_exit_stats);
+
+static __always_inline void vc_count_exit(unsigned long exit_code)
+{
+	unsigned int idx;
+
+	if (exit_code < VC_EXIT_STAT_NPF)
+		idx = exit_code;
+	else if (exit_code == SVM_EXIT_NPF)
+		idx = VC_EXIT_STAT_NPF;
+	else
+		idx = VC_EXIT_STAT_OTHER;
+
+	this_cpu_inc(vc_exit_stats[idx]);
+}
+
 DEFINE_STATIC_KEY_FALSE(sev_es_enable_key);
 EXPORT_SYMBOL_GPL(sev_es_enable_key);
 
@@ -247,6 +300,53 @@ static int vc_fetch_insn_kernel(struct es_em_ctxt *ctxt,
 	return copy_from_kernel_nofault(buffer, (unsigned char *)ctxt->regs->ip, MAX_INSN_SIZE);
 }
 
+static bool vc_insn_cache_get(struct es_em_ctxt *ctxt, const char *buffer)
+{
+	struct sev_es_runtime_data *data = this_cpu_read(runtime_data);
+	unsigned long ip = ctxt->regs->ip;
+	struct vc_insn_cache_entry *e;
+	bool hit = false;
+
+	/* No runtime data yet while the boot GHCB is in use */
+	if (!data || data->insn_cache_active)
+		return false;
+
+	data->insn_cache_active = true;
+
+	e = &data->insn_cache[hash_long(ip, VC_INSN_CACHE_BITS)];
+	if (e->ip == ip && e->insn.length &&
+	    !memcmp(e->bytes, buffer, e->insn.length)) {
+		ctxt->insn = e->insn;
+		hit = true;
+	}
+
+	data->insn_cache_active = false;
+
+	return hit;
+}
+
+static void vc_insn_cache_put(struct es_em_ctxt *ctxt, const char *buffer)
+{
+	struct sev_es_runtime_data *data = this_cpu_read(runtime_data);
+	unsigned long ip = ctxt->regs->ip;
+	struct vc_insn_cache_entry *e;
+
+	if (!data || data->insn_cache_active)
+		return;
+
+	data->insn_cache_active = true;
+
+	e = &data->insn_cache[hash_long(ip, VC_INSN_CACHE_BITS)];
+	e->ip   = ip;
+	e->insn = ctxt->insn;
+	memcpy(e->bytes, buffer, ctxt->insn.length);
+
+	/* The decode buffer lives on the stack of the first user */
+	e->insn.kaddr = e->insn.end_kaddr = e->insn.next_byte = NULL;
+
+	data->insn_cache_active = false;
+}
+
 static enum es_result vc_decode_insn(struct es_em_ctxt *ctxt)
 {
 	char buffer[MAX_INSN_SIZE];
@@ -273,8 +373,14 @@ static enum es_result vc_decode_insn(struct es_em_ctxt *ctxt)
 			return ES_EXCEPTION;
 		}
 
+		if (vc_insn_cache_get(ctxt, buffer))
+			return ES_OK;
+
 		insn_init(&ctxt->insn, buffer, MAX_INSN_SIZE - res, 1);
 		insn_get_length(&ctxt->insn);
+
+		if (ctxt->insn.immediate.got)
+			vc_insn_cache_put(ctxt, buffer);
 	}
 
 	ret = ctxt->insn.immediate.got ? ES_OK : ES_DECODE_FAILED;
@@ -686,6 +792,44 @@ void __init sev_es_init_vc_handling(void)
 	sev_es_setup_play_dead();
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int vc_exit_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long sum;
+	int cpu, i;
+
+	for (i = 0; i < VC_EXIT_STAT_NR; i++) {
+		sum = 0;
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(vc_exit_stats[i], cpu);
+
+		if (!sum)
+			continue;
+
+		if (i == VC_EXIT_STAT_NPF)
+			seq_printf(m, "%#05x %lu\n", SVM_EXIT_NPF, sum);
+		else if (i == VC_EXIT_STAT_OTHER)
+			seq_printf(m, "other %lu\n", sum);
+		else
+			seq_printf(m, "%#05x %lu\n", i, sum);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(vc_exit_stats);
+
+static int __init sev_es_debugfs_init(void)
+{
+	if (!sev_es_active())
+		return 0;
+
+	debugfs_create_file("sev_es_vc_exits", 0400, arch_debugfs_dir, NULL,
+			    &vc_exit_stats_fops);
+	return 0;
+}
+late_initcall(sev_es_debugfs_init);
+#endif
+
 static void __init vc_early_forward_exception(struct es_em_ctxt *ctxt)
 {
 	int trapnr = ctxt->fi.vector;
@@ -757,6 +901,59 @@ static enum es_result vc_do_mmio(struct ghcb *ghcb, struct es_em_ctxt *ctxt,
 	return sev_es_ghcb_hv_call(ghcb, ctxt, exit_code, exit_info_1, exit_info_2);
 }
 
+/*
+ * MMIO access on behalf of hot-path callers which already know the physical
+ * address and size of the access, like the LAPIC. This goes straight to the
+ * hypervisor through the GHCB and skips the #VC exception as well as the
+ * instruction emulation.
+ *
+ * Returns false when the access could not be done this way, in which case the
+ * caller has to fall back to a normal MMIO access.
+ */
+bool __sev_es_mmio_access(phys_addr_t paddr, void *buf, unsigned int bytes,
+			  bool read)
+{
+	struct ghcb_state state;
+	struct es_em_ctxt ctxt;
+	enum es_result ret;
+	unsigned long flags;
+	struct ghcb *ghcb;
+
+	if (WARN_ON_ONCE(!bytes || bytes > 8))
+		return false;
+
+	/* Same rules as in the #VC handler, see sev_es_get_ghcb() */
+	local_irq_save(flags);
+
+	ghcb = sev_es_get_ghcb(&state);
+	if (!ghcb) {
+		local_irq_restore(flags);
+		return false;
+	}
+
+	vc_ghcb_invalidate(ghcb);
+
+	if (!read)
+		memcpy(ghcb->shared_buffer, buf, bytes);
+
+	ghcb->save.sw_scratch = __pa(ghcb) + offsetof(struct ghcb, shared_buffer);
+
+	memset(&ctxt, 0, sizeof(ctxt));
+	ret = sev_es_ghcb_hv_call(ghcb, &ctxt,
+				  read ? SVM_VMGEXIT_MMIO_READ : SVM_VMGEXIT_MMIO_WRITE,
+				  paddr, bytes);
+
+	if (ret == ES_OK && read)
+		memcpy(buf, ghcb->shared_buffer, bytes);
+
+	sev_es_put_ghcb(&state);
+
+	local_irq_restore(flags);
+
+	return ret == ES_OK;
+}
+EXPORT_SYMBOL_GPL(__sev_es_mmio_access);
+
 static enum es_result vc_handle_mmio_twobyte_ops(struct ghcb *ghcb,
 						 struct es_em_ctxt *ctxt)
 {
@@ -827,34 +1024,171 @@ static enum es_result vc_handle_mmio_twobyte_ops(struct ghcb *ghcb,
 	return ret;
 }
 
+/* Largest REP MOVS chunk moved with a single GHCB MMIO exit */
+#define VC_MOVS_BULK_MAX	sizeof_field(struct ghcb, shared_buffer)
+
+static bool vc_virt_to_phys_enc(unsigned long va, phys_addr_t *pa, bool *enc)
+{
+	unsigned int level;
+	pgd_t *pgd;
+	pte_t *pte;
+
+	pgd = __va(read_cr3_pa());
+	pgd = &pgd[pgd_index(va)];
+	pte = lookup_address_in_pgd(pgd, va, &level);
+	if (!pte || !pte_present(*pte))
+		return false;
+
+	*pa  = (phys_addr_t)pte_pfn(*pte) << PAGE_SHIFT;
+	*pa |= va & ~page_level_mask(level);
+	*enc = !!(pte_val(*pte) & _PAGE_ENC);
+
+	return true;
+}
+
+static enum es_result vc_copy_from(struct es_em_ctxt *ctxt, void *dst,
+				   unsigned long src, unsigned long len)
+{
+	bool fault;
+
+	if (user_mode(ctxt->regs)) {
+		/* IRQs are disabled in the #VC handler, faults must not sleep */
+		pagefault_disable();
+		fault = !access_ok((void __user *)src, len) ||
+			__copy_from_user_inatomic(dst, (void __user *)src, len);
+		pagefault_enable();
+	} else
+		fault = copy_from_kernel_nofault(dst, (void *)src, len);
+
+	if (!fault)
+		return ES_OK;
+
+	ctxt->fi.vector     = X86_TRAP_PF;
+	ctxt->fi.error_code = X86_PF_PROT;
+	ctxt->fi.cr2        = src;
+	if (user_mode(ctxt->regs))
+		ctxt->fi.error_code |= X86_PF_USER;
+
+	return ES_EXCEPTION;
+}
+
+static enum es_result vc_copy_to(struct es_em_ctxt *ctxt, unsigned long dst,
+				 void *src, unsigned long len)
+{
+	bool fault;
+
+	if (user_mode(ctxt->regs)) {
+		pagefault_disable();
+		fault = !access_ok((void __user *)dst, len) ||
+			__copy_to_user_inatomic((void __user *)dst, src, len);
+		pagefault_enable();
+	} else
+		fault = copy_to_kernel_nofault((void *)dst, src, len);
+
+	if (!fault)
+		return ES_OK;
+
+	ctxt->fi.vector     = X86_TRAP_PF;
+	ctxt->fi.error_code = X86_PF_PROT | X86_PF_WRITE;
+	ctxt->fi.cr2        = dst;
+	if (user_mode(ctxt->regs))
+		ctxt->fi.error_code |= X86_PF_USER;
+
+	return ES_EXCEPTION;
+}
+
+/*
+ * Move as many elements of a forward REP MOVS as fit into the GHCB shared
+ * buffer with a single MMIO exit. MMIO is always mapped decrypted while
+ * normal memory is mapped encrypted, so the encryption bit of the two
+ * operands tells which one is the MMIO side. When that is ambiguous or the
+ * chunk would only be a single element, *done is left at 0 and the caller
+ * falls back to the element-wise emulation.
+ */
+static enum es_result vc_handle_mmio_movs_bulk(struct ghcb *ghcb,
+					       struct es_em_ctxt *ctxt,
+					       unsigned long src,
+					       unsigned long dst,
+					       unsigned int bytes,
+					       unsigned long *done)
+{
+	unsigned long ghcb_pa = __pa(ghcb);
+	phys_addr_t src_pa, dst_pa;
+	bool src_enc, dst_enc;
+	enum es_result ret;
+	unsigned long len;
+
+	*done = 0;
+
+	if (!vc_virt_to_phys_enc(src, &src_pa, &src_enc) ||
+	    !vc_virt_to_phys_enc(dst, &dst_pa, &dst_enc) ||
+	    src_enc == dst_enc)
+		return ES_OK;
+
+	/* Physical contiguity is only known up to the end of each page */
+	len = min_t(unsigned long, ctxt->regs->cx * bytes, VC_MOVS_BULK_MAX);
+	len = min(len, PAGE_SIZE - offset_in_page(src));
+	len = min(len, PAGE_SIZE - offset_in_page(dst));
+	len = rounddown(len, bytes);
+	if (len <= bytes)
+		return ES_OK;
+
+	ghcb->save.sw_scratch = ghcb_pa + offsetof(struct ghcb, shared_buffer);
+
+	if (!src_enc) {
+		/* MMIO read */
+		ret = sev_es_ghcb_hv_call(ghcb, ctxt, SVM_VMGEXIT_MMIO_READ,
+					  src_pa, len);
+		if (ret != ES_OK)
+			return ret;
+
+		ret = vc_copy_to(ctxt, dst, ghcb->shared_buffer, len);
+	} else {
+		/* MMIO write */
+		ret = vc_copy_from(ctxt, ghcb->shared_buffer, src, len);
+		if (ret != ES_OK)
+			return ret;
+
+		ret = sev_es_ghcb_hv_call(ghcb, ctxt, SVM_VMGEXIT_MMIO_WRITE,
+					  dst_pa, len);
+	}
+
+	if (ret == ES_OK)
+		*done = len / bytes;
+
+	return ret;
+}
+
 /*
  * The MOVS instruction has two memory operands, which raises the
  * problem that it is not known whether the access to the source or the
  * destination caused the #VC exception (and hence whether an MMIO read
  * or write operation needs to be emulated).
  *
- * Instead of playing games with walking page-tables and trying to guess
- * whether the source or destination is an MMIO range, split the move
- * into two operations, a read and a write with only one memory operand.
- * This will cause a nested #VC exception on the MMIO address which can
- * then be handled.
+ * Forward REP MOVS is moved in chunks of up to the size of the GHCB shared
+ * buffer when the MMIO side can be told from the page-tables, see
+ * vc_handle_mmio_movs_bulk().
+ *
+ * Otherwise, instead of playing games with walking page-tables and trying
+ * to guess whether the source or destination is an MMIO range, split the
+ * move into two operations, a read and a write with only one memory
+ * operand. This will cause a nested #VC exception on the MMIO address which
+ * can then be handled.
  *
  * This implementation has the benefit that it also supports MOVS where
  * source _and_ destination are MMIO regions.
- *
- * It will slow MOVS on MMIO down a lot, but in SEV-ES guests it is a
- * rare operation. If it turns out to be a performance problem the split
- * operations can be moved to memcpy_fromio() and memcpy_toio().
  */
-static enum es_result vc_handle_mmio_movs(struct es_em_ctxt *ctxt,
+static enum es_result vc_handle_mmio_movs(struct ghcb *ghcb,
+					  struct es_em_ctxt *ctxt,
 					  unsigned int bytes)
 {
 	unsigned long ds_base, es_base;
 	unsigned char *src, *dst;
 	unsigned char buffer[8];
+	unsigned long count = 0;
 	enum es_result ret;
 	bool rep;
-	int off;
+	long off;
 
 	ds_base = insn_get_seg_base(ctxt->regs, INAT_SEG_REG_DS);
 	es_base = insn_get_seg_base(ctxt->regs, INAT_SEG_REG_ES);
@@ -868,25 +1202,37 @@ static enum es_result vc_handle_mmio_movs(struct es_em_ctxt *ctxt,
 	src = ds_base + (unsigned char *)ctxt->regs->si;
 	dst = es_base + (unsigned char *)ctxt->regs->di;
 
-	ret = vc_read_mem(ctxt, src, buffer, bytes);
-	if (ret != ES_OK)
-		return ret;
+	rep = insn_has_rep_prefix(&ctxt->insn);
 
-	ret = vc_write_mem(ctxt, dst, buffer, bytes);
-	if (ret != ES_OK)
-		return ret;
+	if (rep && ctxt->regs->cx > 1 && !(ctxt->regs->flags & X86_EFLAGS_DF)) {
+		ret = vc_handle_mmio_movs_bulk(ghcb, ctxt, (unsigned long)src,
+					       (unsigned long)dst, bytes, &count);
+		if (ret != ES_OK)
+			return ret;
+	}
+
+	if (!count) {
+		ret = vc_read_mem(ctxt, src, buffer, bytes);
+		if (ret != ES_OK)
+			return ret;
+
+		ret = vc_write_mem(ctxt, dst, buffer, bytes);
+		if (ret != ES_OK)
+			return ret;
+
+		count = 1;
+	}
 
 	if (ctxt->regs->flags & X86_EFLAGS_DF)
-		off = -bytes;
+		off = -(long)(count * bytes);
 	else
-		off =  bytes;
+		off =  count * bytes;
 
 	ctxt->regs->si += off;
 	ctxt->regs->di += off;
 
-	rep = insn_has_rep_prefix(&ctxt->insn);
 	if (rep)
-		ctxt->regs->cx -= 1;
+		ctxt->regs->cx -= count;
 
 	if (!rep || ctxt->regs->cx == 0)
 		return ES_OK;
@@ -962,7 +1308,7 @@ static enum es_result vc_handle_mmio(struct ghcb *ghcb,
 		if (!bytes)
 			bytes = insn->opnd_bytes;
 
-		ret = vc_handle_mmio_movs(ctxt, bytes);
+		ret = vc_handle_mmio_movs(ghcb, ctxt, bytes);
 		break;
 		/* Two-Byte Opcodes */
 	case 0x0f:
@@ -1247,6 +1593,8 @@ DEFINE_IDTENTRY_VC_SAFE_STACK(exc_vmm_communication)
 
 	instrumentation_begin();
 
+	vc_count_exit(error_code);
+
 	/*
 	 * This is invoked through an interrupt gate, so IRQs are disabled. The
 	 * code below might walk page-tables for user or kernel addresses, so
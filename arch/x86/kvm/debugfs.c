@@ -6,6 +6,7 @@
  */
 #include <linux/kvm_host.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "lapic.h"
 
 static int vcpu_get_timer_advance_ns(void *data, u64 *val)
@@ -43,11 +44,34 @@ static int vcpu_get_tsc_scaling_frac_bits(void *data, u64 *val)
 
 DEFINE_SIMPLE_ATTRIBUTE(vcpu_tsc_scaling_frac_fops, vcpu_get_tsc_scaling_frac_bits, NULL, "%llu\n");
 
+static int vcpu_msr_exits_show(struct seq_file *m, void *v)
+{
+	struct kvm_vcpu *vcpu = m->private;
+	struct kvm_msr_exit_stat *stat;
+	int i;
+
+	seq_puts(m, "msr        reads                writes               fastpath\n");
+	for (i = 0; i < KVM_MSR_EXIT_STATS; i++) {
+		stat = &vcpu->arch.msr_exits[i];
+		if (!stat->reads && !stat->writes)
+			continue;
+		seq_printf(m, "0x%08x %-20llu %-20llu %llu\n", stat->index,
+			   stat->reads, stat->writes, stat->fastpath);
+	}
+	seq_printf(m, "other      %llu\n", vcpu->arch.msr_exits_other);
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(vcpu_msr_exits);
+
 void kvm_arch_create_vcpu_debugfs(struct kvm_vcpu *vcpu, struct dentry *debugfs_dentry)
 {
 	debugfs_create_file("tsc-offset", 0444, debugfs_dentry, vcpu,
 			    &vcpu_tsc_offset_fops);
 
+	debugfs_create_file("msr_exits", 0444, debugfs_dentry, vcpu,
+			    &vcpu_msr_exits_fops);
+
 	if (lapic_in_kernel(vcpu))
 		debugfs_create_file("lapic_timer_advance_ns", 0444,
 				    debugfs_dentry, vcpu,
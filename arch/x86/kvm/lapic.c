@@ -1241,6 +1241,28 @@ static int apic_set_eoi(struct kvm_lapic *apic)
 	return vector;
 }
 
+/*
+ * EOI through the x2APIC MSR, from the wrmsr fast path with interrupts
+ * disabled.  Only vectors that neither the IOAPIC nor the SynIC have to hear
+ * about are handled here; for the others 1 is returned and the write goes
+ * through kvm_x2apic_msr_write() as usual.
+ */
+int kvm_x2apic_fastpath_eoi(struct kvm_vcpu *vcpu)
+{
+	struct kvm_lapic *apic = vcpu->arch.apic;
+	int vector = apic_find_highest_isr(apic);
+
+	if (vector == -1 || kvm_ioapic_handles_vector(apic, vector) ||
+	    test_bit(vector, vcpu_to_synic(vcpu)->vec_bitmap))
+		return 1;
+
+	trace_kvm_eoi(apic, vector);
+	apic_clear_isr(vector, apic);
+	apic_update_ppr(apic);
+	kvm_make_request(KVM_REQ_EVENT, vcpu);
+	return 0;
+}
+
 /*
  * this interface assumes a trap-like exit, which has already finished
  * desired side effect including vISR and vPPR update.
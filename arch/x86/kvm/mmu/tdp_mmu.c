@@ -0,0 +1,1304 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include "mmu.h"
+#include "mmu_internal.h"
+#include "spte.h"
+#include "tdp_iter.h"
+#include "tdp_mmu.h"
+
+#include <asm/cmpxchg.h>
+
+/*
+ * The TDP MMU walks and builds the two-dimensional paging structures
+ * directly, without rmaps or the shadow page hash: the root of each address
+ * space is found on kvm->arch.tdp_mmu_roots, and everything below it is
+ * reached by walking the page tables themselves.  Page faults run with
+ * mmu_lock held for read and install SPTEs with cmpxchg, so that vCPUs
+ * faulting in their memory do not serialize on the MMU lock.
+ */
+static bool __read_mostly tdp_mmu_enabled = false;
+module_param_named(tdp_mmu, tdp_mmu_enabled, bool, 0644);
+
+/* Initializes the TDP MMU for the VM, if enabled. */
+void kvm_mmu_init_tdp_mmu(struct kvm *kvm)
+{
+	if (!tdp_enabled || !READ_ONCE(tdp_mmu_enabled))
+		return;
+
+	/* This should not be changed for the lifetime of the VM. */
+	kvm->arch.tdp_mmu_enabled = true;
+
+	INIT_LIST_HEAD(&kvm->arch.tdp_mmu_roots);
+}
+
+void kvm_mmu_uninit_tdp_mmu(struct kvm *kvm)
+{
+	if (!kvm->arch.tdp_mmu_enabled)
+		return;
+
+	WARN_ON(!list_empty(&kvm->arch.tdp_mmu_roots));
+}
+
+#define for_each_tdp_mmu_root(_kvm, _root)			    \
+	list_for_each_entry(_root, &_kvm->arch.tdp_mmu_roots, link)
+
+static void tdp_mmu_free_sp(struct kvm_mmu_page *sp)
+{
+	free_page((unsigned long)sp->spt);
+	kmem_cache_free(mmu_page_header_cache, sp);
+}
+
+/*
+ * Page table memory of the TDP MMU is only accessed within RCU read-side
+ * critical sections, so pages unlinked from the paging structure are freed
+ * through call_rcu(), once no walker can still be looking at them.
+ */
+static void tdp_mmu_free_sp_rcu_callback(struct rcu_head *head)
+{
+	struct kvm_mmu_page *sp = container_of(head, struct kvm_mmu_page,
+					       rcu_head);
+
+	tdp_mmu_free_sp(sp);
+}
+
+static void tdp_mmu_get_root(struct kvm *kvm, struct kvm_mmu_page *root)
+{
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	++root->root_count;
+}
+
+static bool zap_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+			  gfn_t start, gfn_t end, bool can_yield);
+
+void kvm_tdp_mmu_put_root(struct kvm *kvm, struct kvm_mmu_page *root)
+{
+	gfn_t max_gfn = 1ULL << (boot_cpu_data.x86_phys_bits - PAGE_SHIFT);
+
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	if (--root->root_count)
+		return;
+
+	WARN_ON(!root->tdp_mmu_page);
+
+	list_del(&root->link);
+
+	zap_gfn_range(kvm, root, 0, max_gfn, false);
+
+	call_rcu(&root->rcu_head, tdp_mmu_free_sp_rcu_callback);
+}
+
+/*
+ * Returns the next root after @prev_root, or the first root if @prev_root is
+ * NULL, with a reference held on it; the reference on @prev_root is dropped.
+ * A reference is what keeps the current root on the list while mmu_lock is
+ * dropped to yield, so that the walk can carry on from it afterwards.
+ */
+static struct kvm_mmu_page *tdp_mmu_next_root(struct kvm *kvm,
+					      struct kvm_mmu_page *prev_root)
+{
+	struct kvm_mmu_page *next_root;
+
+	if (prev_root)
+		next_root = list_next_entry(prev_root, link);
+	else
+		next_root = list_first_entry(&kvm->arch.tdp_mmu_roots,
+					     typeof(*next_root), link);
+
+	if (&next_root->link == &kvm->arch.tdp_mmu_roots)
+		next_root = NULL;
+	else
+		tdp_mmu_get_root(kvm, next_root);
+
+	if (prev_root)
+		kvm_tdp_mmu_put_root(kvm, prev_root);
+
+	return next_root;
+}
+
+/*
+ * Note: this iterator gets and puts references to the roots it iterates over.
+ * This makes it safe to release the MMU lock and yield within the loop, but
+ * if exiting the loop early, the caller must drop the reference to the most
+ * recent root. (Unless keeping a live reference is desirable.)
+ */
+#define for_each_tdp_mmu_root_yield_safe(_kvm, _root)		\
+	for (_root = tdp_mmu_next_root(_kvm, NULL);		\
+	     _root;						\
+	     _root = tdp_mmu_next_root(_kvm, _root))
+
+static union kvm_mmu_page_role page_role_for_level(struct kvm_vcpu *vcpu,
+						   int level)
+{
+	union kvm_mmu_page_role role;
+
+	role = vcpu->arch.mmu->mmu_role.base;
+	role.level = level;
+	role.direct = true;
+	role.gpte_is_8_bytes = true;
+	role.access = ACC_ALL;
+
+	return role;
+}
+
+static struct kvm_mmu_page *alloc_tdp_mmu_page(struct kvm_vcpu *vcpu, gfn_t gfn,
+					       int level)
+{
+	struct kvm_mmu_page *sp;
+
+	sp = kvm_mmu_memory_cache_alloc(&vcpu->arch.mmu_page_header_cache);
+	sp->spt = kvm_mmu_memory_cache_alloc(&vcpu->arch.mmu_shadow_page_cache);
+	set_page_private(virt_to_page(sp->spt), (unsigned long)sp);
+
+	sp->role.word = page_role_for_level(vcpu, level).word;
+	sp->gfn = gfn;
+	sp->tdp_mmu_page = true;
+
+	return sp;
+}
+
+hpa_t kvm_tdp_mmu_get_vcpu_root_hpa(struct kvm_vcpu *vcpu)
+{
+	union kvm_mmu_page_role role;
+	struct kvm *kvm = vcpu->kvm;
+	struct kvm_mmu_page *root;
+
+	role = page_role_for_level(vcpu, vcpu->arch.mmu->shadow_root_level);
+
+	write_lock(&kvm->mmu_lock);
+
+	/* Check for an existing root before allocating a new one. */
+	for_each_tdp_mmu_root(kvm, root) {
+		if (root->role.word == role.word) {
+			tdp_mmu_get_root(kvm, root);
+			goto out;
+		}
+	}
+
+	root = alloc_tdp_mmu_page(vcpu, 0, vcpu->arch.mmu->shadow_root_level);
+	root->root_count = 1;
+
+	list_add(&root->link, &kvm->arch.tdp_mmu_roots);
+
+out:
+	write_unlock(&kvm->mmu_lock);
+
+	return __pa(root->spt);
+}
+
+static void handle_changed_spte(struct kvm *kvm, gfn_t gfn, u64 old_spte,
+				u64 new_spte, int level, bool record_acc_track);
+
+/**
+ * handle_removed_tdp_mmu_page - handle a pt removed from the TDP structure
+ *
+ * @kvm: kvm instance
+ * @parent_pt: the page table that was unlinked
+ *
+ * The page table is no longer reachable from the root, but the hardware may
+ * still walk it until the TLBs are flushed, so each present entry is cleared
+ * atomically to collect the accessed and dirty bits set in the meantime.
+ * The page table and those below it are freed after an RCU grace period.
+ *
+ * Must be called with mmu_lock held for write, in an RCU read-side critical
+ * section.
+ */
+static void handle_removed_tdp_mmu_page(struct kvm *kvm, tdp_ptep_t parent_pt)
+{
+	u64 *pt = rcu_dereference(parent_pt);
+	struct kvm_mmu_page *sp = sptep_to_sp(pt);
+	int level = sp->role.level;
+	gfn_t gfn = sp->gfn;
+	u64 old_child_spte;
+	int i;
+
+	for (i = 0; i < PT64_ENT_PER_PAGE; i++) {
+		if (!is_shadow_present_pte(READ_ONCE(pt[i])))
+			continue;
+
+		old_child_spte = xchg(&pt[i], 0);
+		handle_changed_spte(kvm, gfn + i * KVM_PAGES_PER_HPAGE(level),
+				    old_child_spte, 0, level, true);
+	}
+
+	call_rcu(&sp->rcu_head, tdp_mmu_free_sp_rcu_callback);
+}
+
+/**
+ * handle_changed_spte - handle bookkeeping associated with an SPTE change
+ * @kvm: kvm instance
+ * @gfn: the base GFN that was mapped by the SPTE
+ * @old_spte: The value of the SPTE before the change
+ * @new_spte: The value of the SPTE after the change
+ * @level: the level of the PT the SPTE is part of in the paging structure
+ * @record_acc_track: Notify the MM subsystem of changes to the accessed state
+ *		      of the page.
+ *
+ * Handle bookkeeping that might result from the modification of a SPTE:
+ * the dirty and accessed state of the old mapping are passed on to the
+ * primary MMU, and page tables removed from the paging structure are torn
+ * down.
+ */
+static void handle_changed_spte(struct kvm *kvm, gfn_t gfn, u64 old_spte,
+				u64 new_spte, int level, bool record_acc_track)
+{
+	bool was_present = is_shadow_present_pte(old_spte);
+	bool is_present = is_shadow_present_pte(new_spte);
+	bool was_leaf = was_present && is_last_spte(old_spte, level);
+	bool is_leaf = is_present && is_last_spte(new_spte, level);
+	bool pfn_changed = spte_to_pfn(old_spte) != spte_to_pfn(new_spte);
+
+	WARN_ON(level > PT64_ROOT_MAX_LEVEL);
+	WARN_ON(level < PG_LEVEL_4K);
+	WARN_ON(gfn & (KVM_PAGES_PER_HPAGE(level) - 1));
+
+	if (old_spte == new_spte)
+		return;
+
+	if (was_leaf) {
+		bool gone = !is_leaf || pfn_changed;
+
+		if (is_dirty_spte(old_spte) &&
+		    (gone || !is_dirty_spte(new_spte)))
+			kvm_set_pfn_dirty(spte_to_pfn(old_spte));
+
+		if (record_acc_track && is_accessed_spte(old_spte) &&
+		    (gone || !is_accessed_spte(new_spte)))
+			kvm_set_pfn_accessed(spte_to_pfn(old_spte));
+	}
+
+	/*
+	 * Recursively handle child PTs if the change removed a subtree from
+	 * the paging structure.
+	 */
+	if (was_present && !was_leaf && (pfn_changed || !is_present))
+		handle_removed_tdp_mmu_page(kvm,
+				spte_to_child_pt(old_spte, level));
+}
+
+/**
+ * tdp_mmu_set_spte_atomic - Set a TDP MMU SPTE atomically and handle the
+ * associated bookkeeping
+ *
+ * @kvm: kvm instance
+ * @iter: a tdp_iter instance currently on the SPTE that should be set
+ * @new_spte: The value the SPTE should be set to
+ *
+ * Used with mmu_lock held for read, where other vCPUs may be setting the
+ * same SPTE.  Returns false, without touching the SPTE, if it no longer holds
+ * iter->old_spte.  Removing a page table needs exclusive access to the paging
+ * structure and is not allowed here.
+ */
+static bool tdp_mmu_set_spte_atomic(struct kvm *kvm, struct tdp_iter *iter,
+				    u64 new_spte)
+{
+	u64 *sptep = rcu_dereference(iter->sptep);
+
+	lockdep_assert_held_read(&kvm->mmu_lock);
+
+	WARN_ON_ONCE(is_shadow_present_pte(iter->old_spte) &&
+		     !is_last_spte(iter->old_spte, iter->level));
+
+	if (cmpxchg64(sptep, iter->old_spte, new_spte) != iter->old_spte)
+		return false;
+
+	handle_changed_spte(kvm, iter->gfn, iter->old_spte, new_spte,
+			    iter->level, true);
+	iter->old_spte = new_spte;
+
+	return true;
+}
+
+/*
+ * __tdp_mmu_set_spte - Set a TDP MMU SPTE and handle the associated bookkeeping
+ * @kvm: kvm instance
+ * @iter: a tdp_iter instance currently on the SPTE that should be set
+ * @new_spte: The value the SPTE should be set to
+ * @record_acc_track: Notify the MM subsystem of changes to the accessed state
+ *		      of the page. Should be set unless handling an MMU
+ *		      notifier for access tracking. Leaving record_acc_track
+ *		      unset in that case prevents page accesses from being
+ *		      double counted.
+ *
+ * Must be called with mmu_lock held for write.  The old value is exchanged
+ * atomically so that accessed and dirty bits set by the hardware in the
+ * meantime are not lost.
+ */
+static void __tdp_mmu_set_spte(struct kvm *kvm, struct tdp_iter *iter,
+			       u64 new_spte, bool record_acc_track)
+{
+	u64 *sptep = rcu_dereference(iter->sptep);
+	u64 old_spte;
+
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	old_spte = xchg(sptep, new_spte);
+	iter->old_spte = new_spte;
+
+	handle_changed_spte(kvm, iter->gfn, old_spte, new_spte, iter->level,
+			    record_acc_track);
+}
+
+static inline void tdp_mmu_set_spte(struct kvm *kvm, struct tdp_iter *iter,
+				    u64 new_spte)
+{
+	__tdp_mmu_set_spte(kvm, iter, new_spte, true);
+}
+
+static inline void tdp_mmu_set_spte_no_acc_track(struct kvm *kvm,
+						 struct tdp_iter *iter,
+						 u64 new_spte)
+{
+	__tdp_mmu_set_spte(kvm, iter, new_spte, false);
+}
+
+#define tdp_root_for_each_pte(_iter, _root, _start, _end) \
+	for_each_tdp_pte(_iter, _root->spt, _root->role.level, _start, _end)
+
+#define tdp_root_for_each_leaf_pte(_iter, _root, _start, _end)	\
+	tdp_root_for_each_pte(_iter, _root, _start, _end)		\
+		if (!is_shadow_present_pte(_iter.old_spte) ||		\
+		    !is_last_spte(_iter.old_spte, _iter.level))		\
+			continue;					\
+		else
+
+#define tdp_mmu_for_each_pte(_iter, _mmu, _start, _end)		\
+	for_each_tdp_pte(_iter, __va(_mmu->root_hpa),		\
+			 _mmu->shadow_root_level, _start, _end)
+
+/*
+ * Yield if the MMU lock is contended or this thread needs to return control
+ * to the scheduler.
+ *
+ * If this function should yield and flush is set, it will perform a remote
+ * TLB flush before yielding.  The flush has to happen before leaving the RCU
+ * read-side critical section too, because the page tables zapped so far may
+ * be freed as soon as the grace period ends.
+ *
+ * If this function yields, it will also reset the tdp_iter's walk over the
+ * paging structure and the calling function should skip to the next
+ * iteration to allow the iterator to continue its traversal from the
+ * paging structure root.
+ *
+ * Return true if this function yielded and the iterator's traversal was reset.
+ * Return false if a yield was not needed.
+ */
+static bool tdp_mmu_iter_cond_resched(struct kvm *kvm, struct tdp_iter *iter,
+				      bool flush)
+{
+	/* Ensure forward progress has been made before yielding. */
+	if (iter->next_last_level_gfn == iter->yielded_gfn)
+		return false;
+
+	if (need_resched() || rwlock_needbreak(&kvm->mmu_lock)) {
+		if (flush)
+			kvm_flush_remote_tlbs(kvm);
+
+		rcu_read_unlock();
+		cond_resched_rwlock_write(&kvm->mmu_lock);
+		rcu_read_lock();
+
+		WARN_ON(iter->gfn > iter->next_last_level_gfn);
+
+		tdp_iter_restart(iter);
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Tears down the mappings for the range of gfns, [start, end), and frees the
+ * non-root pages mapping GFNs strictly within that range.  The TLBs are
+ * flushed before returning if anything was zapped.
+ *
+ * If can_yield is true, will release the MMU lock and reschedule if the
+ * scheduler needs the CPU or there is contention on the MMU lock. If this
+ * function cannot yield, it will not release the MMU lock or reschedule and
+ * the caller must ensure it does not supply too large a GFN range, or the
+ * operation can cause a soft lockup.
+ *
+ * Returns true if any SPTE was zapped.
+ */
+static bool zap_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+			  gfn_t start, gfn_t end, bool can_yield)
+{
+	struct tdp_iter iter;
+	bool flush_needed = false;
+	bool zapped = false;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_pte(iter, root, start, end) {
+		if (can_yield &&
+		    tdp_mmu_iter_cond_resched(kvm, &iter, flush_needed)) {
+			flush_needed = false;
+			continue;
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte))
+			continue;
+
+		/*
+		 * If this is a non-last-level SPTE that covers a larger range
+		 * than should be zapped, continue, and zap the mappings at a
+		 * lower level.
+		 */
+		if ((iter.gfn < start ||
+		     iter.gfn + KVM_PAGES_PER_HPAGE(iter.level) > end) &&
+		    !is_last_spte(iter.old_spte, iter.level))
+			continue;
+
+		tdp_mmu_set_spte(kvm, &iter, 0);
+		flush_needed = true;
+		zapped = true;
+	}
+
+	if (flush_needed)
+		kvm_flush_remote_tlbs(kvm);
+
+	rcu_read_unlock();
+
+	return zapped;
+}
+
+/*
+ * Tears down the mappings for the range of gfns, [start, end), and frees the
+ * non-root pages mapping GFNs strictly within that range, in all the
+ * address spaces.
+ */
+void kvm_tdp_mmu_zap_gfn_range(struct kvm *kvm, gfn_t start, gfn_t end)
+{
+	struct kvm_mmu_page *root;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root)
+		zap_gfn_range(kvm, root, start, end, true);
+}
+
+void kvm_tdp_mmu_zap_all(struct kvm *kvm)
+{
+	gfn_t max_gfn = 1ULL << (boot_cpu_data.x86_phys_bits - PAGE_SHIFT);
+
+	kvm_tdp_mmu_zap_gfn_range(kvm, 0, max_gfn);
+}
+
+/*
+ * Installs a last-level SPTE to handle a TDP page fault.
+ * (NPT/EPT violation/misconfiguration)
+ */
+static int tdp_mmu_map_handle_target_level(struct kvm_vcpu *vcpu, int write,
+					   int map_writable,
+					   struct tdp_iter *iter,
+					   kvm_pfn_t pfn, bool prefault,
+					   bool shared)
+{
+	struct kvm_mmu_page *sp = sptep_to_sp(rcu_dereference(iter->sptep));
+	bool was_present = is_shadow_present_pte(iter->old_spte);
+	struct kvm *kvm = vcpu->kvm;
+	int make_spte_ret = 0;
+	bool replace, flush;
+	u64 new_spte;
+	int ret = RET_PF_RETRY;
+
+	if (unlikely(is_noslot_pfn(pfn)))
+		new_spte = make_mmio_spte(vcpu, iter->gfn, ACC_ALL);
+	else
+		make_spte_ret = make_spte(vcpu, ACC_ALL, iter->level, iter->gfn,
+					  pfn, iter->old_spte, prefault, true,
+					  map_writable, sp_ad_disabled(sp),
+					  &new_spte);
+
+	/* Another vCPU has handled the same fault already. */
+	if (new_spte == iter->old_spte)
+		return RET_PF_RETRY;
+
+	/*
+	 * Replacing a present mapping with an unrelated one (or a page table
+	 * with a huge page) requires exclusive access to the paging structure,
+	 * only filling in a non-present SPTE or an update of the permissions
+	 * and accessed/dirty state of the same page is allowed in parallel.
+	 */
+	replace = was_present && (!is_shadow_present_pte(new_spte) ||
+				  spte_to_pfn(iter->old_spte) !=
+				  spte_to_pfn(new_spte));
+	if (replace && shared)
+		return RET_PF_EXCLUSIVE;
+
+	flush = replace || (was_present && is_writable_pte(iter->old_spte) &&
+			    !is_writable_pte(new_spte));
+
+	if (!shared)
+		tdp_mmu_set_spte(kvm, iter, new_spte);
+	else if (!tdp_mmu_set_spte_atomic(kvm, iter, new_spte))
+		return RET_PF_RETRY;
+
+	if (flush)
+		kvm_flush_remote_tlbs(kvm);
+
+	/*
+	 * If the page fault was caused by a write but the page is write
+	 * protected, emulation is needed. If the emulation was skipped,
+	 * the vCPU would have the same fault again.
+	 */
+	if (make_spte_ret & SET_SPTE_WRITE_PROTECTED_PT) {
+		if (write)
+			ret = RET_PF_EMULATE;
+		kvm_make_request(KVM_REQ_TLB_FLUSH_CURRENT, vcpu);
+	}
+
+	/* If a MMIO SPTE is installed, the MMIO will need to be emulated. */
+	if (unlikely(is_mmio_spte(new_spte)))
+		ret = RET_PF_EMULATE;
+
+	++vcpu->stat.pf_fixed;
+
+	return ret;
+}
+
+/*
+ * Handle a TDP page fault (NPT/EPT violation/misconfiguration) by installing
+ * page tables and SPTEs to translate the faulting guest physical address.
+ *
+ * With @shared set, mmu_lock is held for read and other vCPUs may be
+ * handling faults in the same paging structure at the same time: page
+ * tables are only ever added to it, with cmpxchg, and a fault that needs to
+ * zap a present mapping returns RET_PF_EXCLUSIVE so that the caller can
+ * retry it with mmu_lock held for write.
+ */
+int kvm_tdp_mmu_map(struct kvm_vcpu *vcpu, gpa_t gpa, u32 error_code,
+		    int map_writable, int max_level, kvm_pfn_t pfn,
+		    bool prefault, bool shared)
+{
+	bool write = error_code & PFERR_WRITE_MASK;
+	struct kvm_mmu *mmu = vcpu->arch.mmu;
+	struct kvm *kvm = vcpu->kvm;
+	gfn_t gfn = gpa >> PAGE_SHIFT;
+	struct kvm_mmu_page *sp;
+	struct tdp_iter iter;
+	u64 new_spte;
+	int level;
+	int ret = RET_PF_RETRY;
+
+	if (WARN_ON(!is_tdp_mmu_root(kvm, mmu->root_hpa)))
+		return RET_PF_RETRY;
+
+	/*
+	 * Making a gfn writable may have to unsync the shadow pages of a
+	 * nested guest, which are only ever changed under the write lock.
+	 */
+	if (shared && kvm->arch.indirect_shadow_pages)
+		return RET_PF_EXCLUSIVE;
+
+	level = kvm_mmu_hugepage_adjust(vcpu, gfn, max_level, &pfn);
+
+	rcu_read_lock();
+
+	tdp_mmu_for_each_pte(iter, mmu, gfn, gfn + 1) {
+		/*
+		 * With NX huge pages, a page table under the goal level was
+		 * most likely created for an executable small page, so keep
+		 * it instead of flipping between a huge page and a page
+		 * table on each kind of access.
+		 */
+		if (iter.level == level && level > PG_LEVEL_4K &&
+		    is_nx_huge_page_enabled() &&
+		    is_shadow_present_pte(iter.old_spte) &&
+		    !is_large_pte(iter.old_spte)) {
+			pfn |= gfn & (KVM_PAGES_PER_HPAGE(level) -
+				      KVM_PAGES_PER_HPAGE(level - 1));
+			level--;
+		}
+
+		if (iter.level == level)
+			break;
+
+		/*
+		 * If there is an SPTE mapping a large page at a higher level
+		 * than the target, that SPTE must be cleared and replaced
+		 * with a non-leaf SPTE.
+		 */
+		if (is_shadow_present_pte(iter.old_spte) &&
+		    is_large_pte(iter.old_spte)) {
+			if (shared) {
+				ret = RET_PF_EXCLUSIVE;
+				goto out;
+			}
+
+			tdp_mmu_set_spte(kvm, &iter, 0);
+			kvm_flush_remote_tlbs(kvm);
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte)) {
+			sp = alloc_tdp_mmu_page(vcpu, iter.gfn, iter.level - 1);
+			new_spte = make_nonleaf_spte(sp->spt, sp_ad_disabled(sp));
+
+			if (!shared) {
+				tdp_mmu_set_spte(kvm, &iter, new_spte);
+			} else if (!tdp_mmu_set_spte_atomic(kvm, &iter,
+							    new_spte)) {
+				/* Lost the race against another vCPU. */
+				tdp_mmu_free_sp(sp);
+				goto out;
+			}
+		}
+	}
+
+	if (WARN_ON(!iter.valid || iter.level != level))
+		goto out;
+
+	ret = tdp_mmu_map_handle_target_level(vcpu, write, map_writable, &iter,
+					      pfn, prefault, shared);
+
+out:
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static int kvm_tdp_mmu_handle_hva_range(struct kvm *kvm, unsigned long start,
+		unsigned long end, unsigned long data,
+		int (*handler)(struct kvm *kvm, struct kvm_memory_slot *slot,
+			       struct kvm_mmu_page *root, gfn_t start,
+			       gfn_t end, unsigned long data))
+{
+	struct kvm_memslots *slots;
+	struct kvm_memory_slot *memslot;
+	struct kvm_mmu_page *root;
+	int ret = 0;
+
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root(kvm, root) {
+		slots = __kvm_memslots(kvm, kvm_mmu_page_as_id(root));
+
+		kvm_for_each_memslot(memslot, slots) {
+			unsigned long hva_start, hva_end;
+			gfn_t gfn_start, gfn_end;
+
+			hva_start = max(start, memslot->userspace_addr);
+			hva_end = min(end, memslot->userspace_addr +
+				      (memslot->npages << PAGE_SHIFT));
+			if (hva_start >= hva_end)
+				continue;
+			/*
+			 * {gfn(page) | page intersects with [hva_start, hva_end)} =
+			 * {gfn_start, gfn_start+1, ..., gfn_end-1}.
+			 */
+			gfn_start = hva_to_gfn_memslot(hva_start, memslot);
+			gfn_end = hva_to_gfn_memslot(hva_end + PAGE_SIZE - 1, memslot);
+
+			ret |= handler(kvm, memslot, root, gfn_start,
+				       gfn_end, data);
+		}
+	}
+
+	return ret;
+}
+
+static int zap_gfn_range_hva_wrapper(struct kvm *kvm,
+				     struct kvm_memory_slot *slot,
+				     struct kvm_mmu_page *root, gfn_t start,
+				     gfn_t end, unsigned long unused)
+{
+	zap_gfn_range(kvm, root, start, end, false);
+
+	/* zap_gfn_range() has flushed the TLBs already. */
+	return 0;
+}
+
+int kvm_tdp_mmu_zap_hva_range(struct kvm *kvm, unsigned long start,
+			      unsigned long end)
+{
+	return kvm_tdp_mmu_handle_hva_range(kvm, start, end, 0,
+					    zap_gfn_range_hva_wrapper);
+}
+
+/*
+ * Mark the SPTEs range of GFNs [start, end) unaccessed and return non-zero
+ * if any of the GFNs in the range have been accessed.
+ */
+static int age_gfn_range(struct kvm *kvm, struct kvm_memory_slot *slot,
+			 struct kvm_mmu_page *root, gfn_t start, gfn_t end,
+			 unsigned long unused)
+{
+	struct tdp_iter iter;
+	int young = 0;
+	u64 new_spte;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_leaf_pte(iter, root, start, end) {
+		/*
+		 * If we have a non-accessed entry we don't need to change the
+		 * pte.
+		 */
+		if (!is_accessed_spte(iter.old_spte))
+			continue;
+
+		/*
+		 * Without A/D bits the SPTE is made non-present for access
+		 * tracking; its dirty state is passed on to the primary MMU
+		 * by handle_changed_spte() as the SPTE stops being writable.
+		 */
+		if (spte_ad_enabled(iter.old_spte))
+			new_spte = iter.old_spte & ~shadow_accessed_mask;
+		else
+			new_spte = mark_spte_for_access_track(iter.old_spte);
+
+		tdp_mmu_set_spte_no_acc_track(kvm, &iter, new_spte);
+		young = 1;
+	}
+
+	rcu_read_unlock();
+
+	return young;
+}
+
+int kvm_tdp_mmu_age_hva_range(struct kvm *kvm, unsigned long start,
+			      unsigned long end)
+{
+	return kvm_tdp_mmu_handle_hva_range(kvm, start, end, 0,
+					    age_gfn_range);
+}
+
+static int test_age_gfn(struct kvm *kvm, struct kvm_memory_slot *slot,
+			struct kvm_mmu_page *root, gfn_t gfn, gfn_t unused,
+			unsigned long unused2)
+{
+	struct tdp_iter iter;
+	int young = 0;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_leaf_pte(iter, root, gfn, gfn + 1) {
+		if (is_accessed_spte(iter.old_spte)) {
+			young = 1;
+			break;
+		}
+	}
+
+	rcu_read_unlock();
+
+	return young;
+}
+
+int kvm_tdp_mmu_test_age_hva(struct kvm *kvm, unsigned long hva)
+{
+	return kvm_tdp_mmu_handle_hva_range(kvm, hva, hva + 1, 0,
+					    test_age_gfn);
+}
+
+/*
+ * Handle the change_pte MMU notifier for the TDP MMU: the mapping of the
+ * old page is dropped and the next access faults in the new one.  The TLBs
+ * have been flushed already when this returns.
+ */
+int kvm_tdp_mmu_set_spte_hva(struct kvm *kvm, unsigned long address)
+{
+	return kvm_tdp_mmu_zap_hva_range(kvm, address, address + 1);
+}
+
+/*
+ * Remove write access from all the leaf SPTEs mapping GFNs [start, end)
+ * at min_level or above.  Returns true if an SPTE has been changed and the
+ * TLBs need to be flushed.
+ */
+static bool wrprot_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+			     gfn_t start, gfn_t end, int min_level)
+{
+	struct tdp_iter iter;
+	bool spte_set = false;
+	u64 new_spte;
+
+	BUG_ON(min_level > KVM_MAX_HUGEPAGE_LEVEL);
+
+	rcu_read_lock();
+
+	for_each_tdp_pte_min_level(iter, root->spt, root->role.level,
+				   min_level, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, false))
+			continue;
+
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_last_spte(iter.old_spte, iter.level) ||
+		    !is_writable_pte(iter.old_spte))
+			continue;
+
+		new_spte = iter.old_spte & ~PT_WRITABLE_MASK;
+
+		tdp_mmu_set_spte(kvm, &iter, new_spte);
+		spte_set = true;
+	}
+
+	rcu_read_unlock();
+
+	return spte_set;
+}
+
+/*
+ * Remove write access from all the SPTEs mapping GFNs in the memslot.  Will
+ * only affect leaf SPTEs down to min_level.  Returns true if an SPTE has been
+ * changed and the TLBs need to be flushed.
+ */
+bool kvm_tdp_mmu_wrprot_slot(struct kvm *kvm, struct kvm_memory_slot *slot,
+			     int min_level)
+{
+	struct kvm_mmu_page *root;
+	bool spte_set = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		spte_set |= wrprot_gfn_range(kvm, root, slot->base_gfn,
+					     slot->base_gfn + slot->npages,
+					     min_level);
+	}
+
+	return spte_set;
+}
+
+/*
+ * Clear the dirty state of the leaf SPTE: clear the D bit if A/D bits are
+ * in use, or write-protect the SPTE otherwise, so that the next write is
+ * logged.  Returns false if there was nothing to do.
+ */
+static bool clear_dirty_spte(u64 old_spte, bool wrprot, u64 *new_spte)
+{
+	if (wrprot || spte_ad_need_write_protect(old_spte)) {
+		if (!is_writable_pte(old_spte))
+			return false;
+		*new_spte = old_spte & ~PT_WRITABLE_MASK;
+	} else {
+		if (!(old_spte & shadow_dirty_mask))
+			return false;
+		*new_spte = old_spte & ~shadow_dirty_mask;
+	}
+
+	return true;
+}
+
+/*
+ * Clear the dirty status of all the 4K SPTEs mapping GFNs in the range
+ * [start, end).  Returns true if an SPTE has been changed and the TLBs need
+ * to be flushed.
+ */
+static bool clear_dirty_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+				  gfn_t start, gfn_t end)
+{
+	struct tdp_iter iter;
+	bool spte_set = false;
+	u64 new_spte;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_leaf_pte(iter, root, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, false))
+			continue;
+
+		if (iter.level > PG_LEVEL_4K ||
+		    !clear_dirty_spte(iter.old_spte, false, &new_spte))
+			continue;
+
+		tdp_mmu_set_spte(kvm, &iter, new_spte);
+		spte_set = true;
+	}
+
+	rcu_read_unlock();
+
+	return spte_set;
+}
+
+/*
+ * Clear the dirty status of all the SPTEs mapping GFNs in the memslot. If
+ * AD bits are enabled, this will involve clearing the dirty bit on each SPTE.
+ * If AD bits are not enabled, this will require clearing the writable bit on
+ * each SPTE. Returns true if an SPTE has been changed and the TLBs need to
+ * be flushed.
+ */
+bool kvm_tdp_mmu_clear_dirty_slot(struct kvm *kvm, struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+	bool spte_set = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		spte_set |= clear_dirty_gfn_range(kvm, root, slot->base_gfn,
+						  slot->base_gfn + slot->npages);
+	}
+
+	return spte_set;
+}
+
+/*
+ * Clears the dirty status of all the 4K SPTEs mapping GFNs for which a bit is
+ * set in mask, starting at gfn. The given memslot is expected to contain all
+ * the GFNs represented by set bits in the mask. If AD bits are enabled,
+ * clearing the dirty status will involve clearing the dirty bit on each SPTE
+ * or, if AD bits are not enabled, clearing the writable bit on each SPTE.
+ */
+static void clear_dirty_pt_masked(struct kvm *kvm, struct kvm_mmu_page *root,
+				  gfn_t gfn, unsigned long mask, bool wrprot)
+{
+	struct tdp_iter iter;
+	u64 new_spte;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_leaf_pte(iter, root, gfn + __ffs(mask),
+				   gfn + BITS_PER_LONG) {
+		if (!mask)
+			break;
+
+		if (iter.level > PG_LEVEL_4K ||
+		    !(mask & (1UL << (iter.gfn - gfn))))
+			continue;
+
+		mask &= ~(1UL << (iter.gfn - gfn));
+
+		if (!clear_dirty_spte(iter.old_spte, wrprot, &new_spte))
+			continue;
+
+		tdp_mmu_set_spte(kvm, &iter, new_spte);
+	}
+
+	rcu_read_unlock();
+}
+
+/*
+ * Clears the dirty status of all the 4K SPTEs mapping GFNs for which a bit is
+ * set in mask, starting at gfn. The given memslot is expected to contain all
+ * the GFNs represented by set bits in the mask.  With wrprot set, or if A/D
+ * bits are not in use, the SPTEs are write-protected instead.
+ */
+void kvm_tdp_mmu_clear_dirty_pt_masked(struct kvm *kvm,
+				       struct kvm_memory_slot *slot,
+				       gfn_t gfn, unsigned long mask,
+				       bool wrprot)
+{
+	struct kvm_mmu_page *root;
+
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root(kvm, root) {
+		if (kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		clear_dirty_pt_masked(kvm, root, gfn, mask, wrprot);
+	}
+}
+
+/*
+ * Set the dirty status of all the SPTEs mapping GFNs in the range
+ * [start, end), if A/D bits are in use for them.  Returns true if an SPTE
+ * has been changed and the TLBs need to be flushed.
+ */
+static bool set_dirty_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+				gfn_t start, gfn_t end)
+{
+	struct tdp_iter iter;
+	bool spte_set = false;
+	u64 new_spte;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_leaf_pte(iter, root, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, false))
+			continue;
+
+		if (!spte_ad_enabled(iter.old_spte) ||
+		    (iter.old_spte & shadow_dirty_mask))
+			continue;
+
+		new_spte = iter.old_spte | shadow_dirty_mask;
+
+		tdp_mmu_set_spte(kvm, &iter, new_spte);
+		spte_set = true;
+	}
+
+	rcu_read_unlock();
+
+	return spte_set;
+}
+
+/*
+ * Set the dirty status of all the SPTEs mapping GFNs in the memslot. Only
+ * affects SPTEs with A/D bits enabled.  Returns true if an SPTE has been
+ * changed and the TLBs need to be flushed.
+ */
+bool kvm_tdp_mmu_slot_set_dirty(struct kvm *kvm, struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+	bool spte_set = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		spte_set |= set_dirty_gfn_range(kvm, root, slot->base_gfn,
+						slot->base_gfn + slot->npages);
+	}
+
+	return spte_set;
+}
+
+/*
+ * Clear the leaf SPTEs which could be replaced by large mappings, for GFNs
+ * within the slot.  The next fault maps the huge page and frees the page
+ * table left behind.
+ */
+static void zap_collapsible_spte_range(struct kvm *kvm,
+				       struct kvm_mmu_page *root,
+				       gfn_t start, gfn_t end)
+{
+	struct tdp_iter iter;
+	bool spte_set = false;
+	kvm_pfn_t pfn;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_pte(iter, root, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, spte_set)) {
+			spte_set = false;
+			continue;
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_last_spte(iter.old_spte, iter.level) ||
+		    iter.level > PG_LEVEL_4K)
+			continue;
+
+		pfn = spte_to_pfn(iter.old_spte);
+		if (kvm_is_reserved_pfn(pfn) ||
+		    (!PageCompound(pfn_to_page(pfn)) &&
+		     !kvm_is_zone_device_pfn(pfn)))
+			continue;
+
+		tdp_mmu_set_spte(kvm, &iter, 0);
+		spte_set = true;
+	}
+
+	if (spte_set)
+		kvm_flush_remote_tlbs(kvm);
+
+	rcu_read_unlock();
+}
+
+/*
+ * Clear non-leaf entries (and free associated page tables) which could
+ * be replaced by large mappings, for GFNs within the slot.
+ */
+void kvm_tdp_mmu_zap_collapsible_sptes(struct kvm *kvm,
+				       const struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		zap_collapsible_spte_range(kvm, root, slot->base_gfn,
+					   slot->base_gfn + slot->npages);
+	}
+}
+
+static struct kvm_mmu_page *__tdp_mmu_alloc_sp_for_split(gfp_t gfp)
+{
+	struct kvm_mmu_page *sp;
+
+	gfp |= __GFP_ZERO;
+
+	sp = kmem_cache_alloc(mmu_page_header_cache, gfp);
+	if (!sp)
+		return NULL;
+
+	sp->spt = (void *)__get_free_page(gfp);
+	if (!sp->spt) {
+		kmem_cache_free(mmu_page_header_cache, sp);
+		return NULL;
+	}
+
+	return sp;
+}
+
+/*
+ * Allocate a page table to split a huge page with.  There is no vCPU, and
+ * thus no memory cache, when splitting for dirty logging, so the page is
+ * allocated under mmu_lock without reclaim, which could recurse into the
+ * MMU notifiers.  If that fails, mmu_lock is dropped around an allocation
+ * that may sleep and *dropped is set: the caller must restart its walk.
+ */
+static struct kvm_mmu_page *tdp_mmu_alloc_sp_for_split(struct kvm *kvm,
+						       bool *dropped)
+{
+	struct kvm_mmu_page *sp;
+
+	sp = __tdp_mmu_alloc_sp_for_split(GFP_NOWAIT | __GFP_ACCOUNT);
+	if (sp)
+		return sp;
+
+	rcu_read_unlock();
+	write_unlock(&kvm->mmu_lock);
+
+	sp = __tdp_mmu_alloc_sp_for_split(GFP_KERNEL_ACCOUNT);
+
+	write_lock(&kvm->mmu_lock);
+	rcu_read_lock();
+
+	*dropped = true;
+	return sp;
+}
+
+/*
+ * Replace the huge SPTE at @iter with a link to @sp, filled in with SPTEs
+ * mapping the same memory one level down.  Both map it with the same
+ * permissions, so no TLB flush is needed until the SPTEs are changed.
+ */
+static void tdp_mmu_split_huge_page(struct kvm *kvm, struct tdp_iter *iter,
+				    struct kvm_mmu_page *sp)
+{
+	struct kvm_mmu_page *parent_sp = sptep_to_sp(rcu_dereference(iter->sptep));
+	int i;
+
+	set_page_private(virt_to_page(sp->spt), (unsigned long)sp);
+	sp->role = parent_sp->role;
+	sp->role.level = iter->level - 1;
+	sp->gfn = iter->gfn;
+	sp->tdp_mmu_page = true;
+
+	/* The page table is not reachable yet, so no atomics are needed. */
+	for (i = 0; i < PT64_ENT_PER_PAGE; i++)
+		sp->spt[i] = make_huge_page_split_spte(iter->old_spte,
+						       iter->level, i);
+
+	tdp_mmu_set_spte(kvm, iter, make_nonleaf_spte(sp->spt,
+						      sp_ad_disabled(sp)));
+}
+
+static int split_huge_pages_range(struct kvm *kvm, struct kvm_mmu_page *root,
+				  gfn_t start, gfn_t end)
+{
+	struct kvm_mmu_page *sp = NULL;
+	struct tdp_iter iter;
+	bool dropped;
+	int ret = 0;
+
+	rcu_read_lock();
+
+	/*
+	 * The walk is pre-order, so a 1G page is split into 2M pages that are
+	 * then visited, and split, in turn.
+	 */
+	for_each_tdp_pte_min_level(iter, root->spt, root->role.level,
+				   PG_LEVEL_2M, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, false))
+			continue;
+
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_large_pte(iter.old_spte))
+			continue;
+
+		if (!sp) {
+			dropped = false;
+			sp = tdp_mmu_alloc_sp_for_split(kvm, &dropped);
+			if (!sp) {
+				ret = -ENOMEM;
+				break;
+			}
+			if (dropped) {
+				tdp_iter_restart(&iter);
+				continue;
+			}
+		}
+
+		tdp_mmu_split_huge_page(kvm, &iter, sp);
+		sp = NULL;
+	}
+
+	rcu_read_unlock();
+
+	if (sp)
+		tdp_mmu_free_sp(sp);
+
+	return ret;
+}
+
+/*
+ * Split all the huge pages mapping GFNs in the memslot down to 4K.  Stops
+ * early if memory runs out; the huge pages left are split on the first
+ * write once they are write protected.
+ */
+void kvm_tdp_mmu_try_split_huge_pages(struct kvm *kvm,
+				      const struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+	int r = 0;
+
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (r || kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		r = split_huge_pages_range(kvm, root, slot->base_gfn,
+					   slot->base_gfn + slot->npages);
+	}
+}
+
+/*
+ * Removes write access on the last level SPTE mapping this GFN and unsets the
+ * SPTE_MMU_WRITEABLE bit to ensure future writes continue to be intercepted.
+ * Returns true if an SPTE was set and a TLB flush is needed.
+ */
+static bool write_protect_gfn(struct kvm *kvm, struct kvm_mmu_page *root,
+			      gfn_t gfn)
+{
+	struct tdp_iter iter;
+	bool spte_set = false;
+	u64 new_spte;
+
+	rcu_read_lock();
+
+	tdp_root_for_each_leaf_pte(iter, root, gfn, gfn + 1) {
+		if (!is_writable_pte(iter.old_spte) &&
+		    !spte_can_locklessly_be_made_writable(iter.old_spte))
+			continue;
+
+		new_spte = iter.old_spte &
+			~(PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE);
+
+		tdp_mmu_set_spte(kvm, &iter, new_spte);
+		spte_set = true;
+	}
+
+	rcu_read_unlock();
+
+	return spte_set;
+}
+
+/*
+ * Removes write access on the last level SPTE mapping this GFN and unsets the
+ * SPTE_MMU_WRITEABLE bit to ensure future writes continue to be intercepted.
+ * Returns true if an SPTE was set and a TLB flush is needed.
+ */
+bool kvm_tdp_mmu_write_protect_gfn(struct kvm *kvm,
+				   struct kvm_memory_slot *slot, gfn_t gfn)
+{
+	struct kvm_mmu_page *root;
+	bool spte_set = false;
+
+	lockdep_assert_held_write(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root(kvm, root) {
+		if (kvm_mmu_page_as_id(root) != slot->as_id)
+			continue;
+
+		spte_set |= write_protect_gfn(kvm, root, gfn);
+	}
+
+	return spte_set;
+}
@@ -136,6 +136,7 @@ static void pmc_reprogram_counter(struct kvm_pmc *pmc, u32 type,
 
 	pmc->perf_event = event;
 	pmc_to_pmu(pmc)->event_count++;
+	++pmc->vcpu->stat.pmu_event_create;
 	clear_bit(pmc->idx, pmc_to_pmu(pmc)->reprogram_pmi);
 }
 
@@ -163,6 +164,7 @@ static bool pmc_resume_counter(struct kvm_pmc *pmc)
 
 	/* reuse perf_event to serve as pmc_reprogram_counter() does*/
 	perf_event_enable(pmc->perf_event);
+	++pmc->vcpu->stat.pmu_event_reuse;
 
 	clear_bit(pmc->idx, (unsigned long *)&pmc_to_pmu(pmc)->reprogram_pmi);
 	return true;
@@ -295,14 +297,20 @@ void kvm_pmu_handle_event(struct kvm_vcpu *vcpu)
 	struct kvm_pmu *pmu = vcpu_to_pmu(vcpu);
 	int bit;
 
+	/*
+	 * Besides overflowed counters, this picks up the counters whose MSRs
+	 * were written since the last VM-entry (see
+	 * kvm_pmu_request_counter_reprogram()), which may not have a
+	 * perf_event yet.
+	 */
 	for_each_set_bit(bit, pmu->reprogram_pmi, X86_PMC_IDX_MAX) {
 		struct kvm_pmc *pmc = kvm_x86_ops.pmu_ops->pmc_idx_to_pmc(pmu, bit);
 
-		if (unlikely(!pmc || !pmc->perf_event)) {
-			clear_bit(bit, pmu->reprogram_pmi);
+		clear_bit(bit, pmu->reprogram_pmi);
+		if (unlikely(!pmc))
 			continue;
-		}
 
+		++vcpu->stat.pmu_reprogram;
 		reprogram_counter(pmu, bit);
 	}
 
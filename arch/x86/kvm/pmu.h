@@ -60,6 +60,20 @@ static inline u64 pmc_read_counter(struct kvm_pmc *pmc)
 	return counter & pmc_bitmask(pmc);
 }
 
+/*
+ * Reprogram the counter at the next VM-entry instead of right away, so that
+ * a guest writing the event selector and counter of several PMCs in a row
+ * pays for a single perf_event update per PMC.  The perf_event only counts
+ * in guest mode, so nothing is lost by deferring it until then.  An overflow
+ * of the old event that races with the write is ignored, as the counter is
+ * about to be reprogrammed anyway.
+ */
+static inline void kvm_pmu_request_counter_reprogram(struct kvm_pmc *pmc)
+{
+	set_bit(pmc->idx, pmc_to_pmu(pmc)->reprogram_pmi);
+	kvm_make_request(KVM_REQ_PMU, pmc->vcpu);
+}
+
 static inline void pmc_release_perf_event(struct kvm_pmc *pmc)
 {
 	if (pmc->perf_event) {
@@ -37,12 +37,6 @@ module_param(avic, int, S_IRUGO);
 
 #define AVIC_HPA_MASK	~((0xFFFULL << 52) | 0xFFF)
 
-/*
- * 0xff is broadcast, so the max index allowed for physical APIC ID
- * table is 0xfe.  APIC IDs above 0xff are reserved.
- */
-#define AVIC_MAX_PHYSICAL_ID_COUNT	255
-
 #define AVIC_UNACCEL_ACCESS_WRITE_MASK		1
 #define AVIC_UNACCEL_ACCESS_OFFSET_MASK		0xFF0
 #define AVIC_UNACCEL_ACCESS_VECTOR_MASK		0xFFFFFFFF
@@ -293,10 +287,44 @@ static int avic_init_backing_page(struct kvm_vcpu *vcpu)
 	WRITE_ONCE(*entry, new_entry);
 
 	svm->avic_physical_id_cache = entry;
+	WRITE_ONCE(to_kvm_svm(vcpu->kvm)->avic_physical_id_vcpus[id], vcpu);
 
 	return 0;
 }
 
+/*
+ * Fast path for a fixed, physically addressed unicast IPI to a vCPU which is
+ * not running: the AVIC hardware has already set the IRR bit in the target's
+ * backing page, so all that is left is to wake the target up.  The target is
+ * found through the per-VM physical APIC ID shadow instead of matching the
+ * destination against every vCPU.
+ */
+static bool avic_kick_target_vcpu_fast(struct vcpu_svm *svm, u32 icrl, u32 icrh)
+{
+	struct kvm_svm *kvm_svm = to_kvm_svm(svm->vcpu.kvm);
+	struct kvm_vcpu *target;
+	u32 dest;
+
+	if ((icrl & (APIC_SHORT_MASK | APIC_DEST_MASK)) ||
+	    apic_x2apic_mode(svm->vcpu.arch.apic))
+		return false;
+
+	dest = GET_APIC_DEST_FIELD(icrh);
+	if (dest >= AVIC_MAX_PHYSICAL_ID_COUNT)
+		return false;
+
+	target = READ_ONCE(kvm_svm->avic_physical_id_vcpus[dest]);
+	if (!target || kvm_xapic_id(target->arch.apic) != dest)
+		return false;
+
+	if (!avic_vcpu_is_running(target))
+		kvm_vcpu_wake_up(target);
+
+	++svm->vcpu.stat.avic_ipi_fast_path;
+
+	return true;
+}
+
 int avic_incomplete_ipi_interception(struct vcpu_svm *svm)
 {
 	u32 icrh = svm->vmcb->control.exit_info_1 >> 32;
@@ -309,6 +337,7 @@ int avic_incomplete_ipi_interception(struct vcpu_svm *svm)
 
 	switch (id) {
 	case AVIC_IPI_FAILURE_INVALID_INT_TYPE:
+		++svm->vcpu.stat.avic_ipi_invalid_int_type;
 		/*
 		 * AVIC hardware handles the generation of
 		 * IPIs when the specified Message Type is Fixed
@@ -329,11 +358,16 @@ int avic_incomplete_ipi_interception(struct vcpu_svm *svm)
 		struct kvm *kvm = svm->vcpu.kvm;
 		struct kvm_lapic *apic = svm->vcpu.arch.apic;
 
+		++svm->vcpu.stat.avic_ipi_target_not_running;
+
 		/*
 		 * At this point, we expect that the AVIC HW has already
 		 * set the appropriate IRR bits on the valid target
 		 * vcpus. So, we just need to kick the appropriate vcpu.
 		 */
+		if (avic_kick_target_vcpu_fast(svm, icrl, icrh))
+			break;
+
 		kvm_for_each_vcpu(i, vcpu, kvm) {
 			bool m = kvm_apic_match_dest(vcpu, apic,
 						     icrl & APIC_SHORT_MASK,
@@ -346,10 +380,12 @@ int avic_incomplete_ipi_interception(struct vcpu_svm *svm)
 		break;
 	}
 	case AVIC_IPI_FAILURE_INVALID_TARGET:
+		++svm->vcpu.stat.avic_ipi_invalid_target;
 		WARN_ONCE(1, "Invalid IPI target: index=%u, vcpu=%d, icr=%#0x:%#0x\n",
 			  index, svm->vcpu.vcpu_id, icrh, icrl);
 		break;
 	case AVIC_IPI_FAILURE_INVALID_BACKING_PAGE:
+		++svm->vcpu.stat.avic_ipi_invalid_backing_page;
 		WARN_ONCE(1, "Invalid backing page\n");
 		break;
 	default:
@@ -440,6 +476,7 @@ static int avic_handle_ldr_update(struct kvm_vcpu *vcpu)
 
 static int avic_handle_apic_id_update(struct kvm_vcpu *vcpu)
 {
+	struct kvm_svm *kvm_svm;
 	u64 *old, *new;
 	struct vcpu_svm *svm = to_svm(vcpu);
 	u32 id = kvm_xapic_id(vcpu->arch.apic);
@@ -457,6 +494,12 @@ static int avic_handle_apic_id_update(struct kvm_vcpu *vcpu)
 	*old = 0ULL;
 	to_svm(vcpu)->avic_physical_id_cache = new;
 
+	/* ... and the shadow used by the incomplete IPI fast path */
+	kvm_svm = to_kvm_svm(vcpu->kvm);
+	if (kvm_svm->avic_physical_id_vcpus[vcpu->vcpu_id] == vcpu)
+		WRITE_ONCE(kvm_svm->avic_physical_id_vcpus[vcpu->vcpu_id], NULL);
+	WRITE_ONCE(kvm_svm->avic_physical_id_vcpus[id], vcpu);
+
 	/*
 	 * Also update the guest physical APIC ID in the logical
 	 * APIC ID table entry if already setup the LDR.
@@ -333,6 +333,62 @@ static inline bool nested_npt_enabled(struct vcpu_svm *svm)
 	return svm->nested.ctl.nested_ctl & SVM_NESTED_CTL_NP_ENABLE;
 }
 
+/*
+ * L1 and L2 run with different ASIDs, so that neither has to flush the
+ * TLB entries of the other on a nested VMRUN or #VMEXIT.  The ASID of the
+ * level that is not running waits in svm->nested, and pre_svm_run() picks
+ * a new one for it if its generation went stale in the meanwhile.  SEV
+ * guests have a single ASID, so for them every transition flushes it.
+ *
+ * Must be called before any state of the new level is loaded, so that
+ * flushes requested for the old level are not applied to the new one.
+ */
+static void nested_svm_switch_asid(struct vcpu_svm *svm)
+{
+	struct kvm_vcpu *vcpu = &svm->vcpu;
+
+	if (sev_guest(vcpu->kvm))
+		return;
+
+	if (kvm_check_request(KVM_REQ_TLB_FLUSH_CURRENT, vcpu) ||
+	    svm->vmcb->control.tlb_ctl == TLB_CONTROL_FLUSH_ASID) {
+		svm->vmcb->control.tlb_ctl = TLB_CONTROL_DO_NOTHING;
+		svm->asid_generation = 0;
+	}
+
+	swap(svm->asid_generation, svm->nested.asid_generation);
+	swap(svm->vmcb->control.asid, svm->nested.asid);
+	vmcb_mark_dirty(svm->vmcb, VMCB_ASID);
+}
+
+/*
+ * With nested NPT, the TLB entries in L2's ASID come from the shadow of
+ * the nested page tables at nCR3.  As on hardware, VMRUN only has to flush
+ * them when L1 asks for it in tlb_ctl, which is also when L1 expects its
+ * changes to unsynced nested page tables to become visible.  A different
+ * ASID or nCR3 of L1 means a different nested guest, and gets a flush too.
+ * Without nested NPT, nested_svm_load_cr3() flushes unconditionally.
+ */
+static void nested_svm_vmrun_tlb_flush(struct vcpu_svm *svm)
+{
+	struct vmcb_control_area *ctl = &svm->nested.ctl;
+	struct kvm_vcpu *vcpu = &svm->vcpu;
+
+	if (ctl->tlb_ctl == TLB_CONTROL_FLUSH_ALL_ASID)
+		svm->nested.asid_generation = 0;
+
+	if (sev_guest(vcpu->kvm) || !nested_npt_enabled(svm) ||
+	    ctl->tlb_ctl != TLB_CONTROL_DO_NOTHING ||
+	    ctl->asid != svm->nested.last_asid ||
+	    ctl->nested_cr3 != svm->nested.last_nested_cr3) {
+		kvm_make_request(KVM_REQ_MMU_SYNC, vcpu);
+		kvm_make_request(KVM_REQ_TLB_FLUSH_CURRENT, vcpu);
+	}
+
+	svm->nested.last_asid = ctl->asid;
+	svm->nested.last_nested_cr3 = ctl->nested_cr3;
+}
+
 /*
  * Load guest's/host's cr3 on nested vmentry or vmexit. @nested_npt is true
  * if we are emulating VM-Entry into a guest with NPT enabled.
@@ -340,6 +396,8 @@ static inline bool nested_npt_enabled(struct vcpu_svm *svm)
 static int nested_svm_load_cr3(struct kvm_vcpu *vcpu, unsigned long cr3,
 			       bool nested_npt)
 {
+	bool skip_flush;
+
 	if (cr3 & rsvd_bits(cpuid_maxphyaddr(vcpu), 63))
 		return -EINVAL;
 
@@ -350,11 +408,16 @@ static int nested_svm_load_cr3(struct kvm_vcpu *vcpu, unsigned long cr3,
 	}
 
 	/*
-	 * TODO: optimize unconditional TLB flush/MMU sync here and in
-	 * kvm_init_shadow_npt_mmu().
+	 * With NPT, L1's ASID was left alone while L2 ran, so its TLB is
+	 * still good on #VMEXIT; nested VMRUN flushes in
+	 * nested_svm_vmrun_tlb_flush().  Entering L2 without nested NPT,
+	 * and any switch with shadow paging, always flushes and syncs: L1's
+	 * tlb_ctl is not used to elide those flushes.
 	 */
+	skip_flush = npt_enabled && !is_guest_mode(vcpu) &&
+		     !sev_guest(vcpu->kvm);
 	if (!nested_npt)
-		kvm_mmu_new_pgd(vcpu, cr3, false, false);
+		kvm_mmu_new_pgd(vcpu, cr3, skip_flush, skip_flush);
 
 	vcpu->arch.cr3 = cr3;
 	kvm_register_mark_available(vcpu, VCPU_EXREG_CR3);
@@ -414,6 +477,8 @@ static void nested_prepare_vmcb_control(struct vcpu_svm *svm)
 	svm->vmcb->control.pause_filter_count  = svm->nested.ctl.pause_filter_count;
 	svm->vmcb->control.pause_filter_thresh = svm->nested.ctl.pause_filter_thresh;
 
+	nested_svm_vmrun_tlb_flush(svm);
+
 	/* Enter Guest-Mode */
 	enter_guest_mode(&svm->vcpu);
 
@@ -431,6 +496,8 @@ int enter_svm_guest_mode(struct vcpu_svm *svm, u64 vmcb_gpa,
 {
 	int ret;
 
+	nested_svm_switch_asid(svm);
+
 	svm->nested.vmcb = vmcb_gpa;
 	load_nested_vmcb_control(svm, &nested_vmcb->control);
 	nested_prepare_vmcb_save(svm, nested_vmcb);
@@ -582,6 +649,8 @@ int nested_svm_vmexit(struct vcpu_svm *svm)
 	svm->nested.vmcb = 0;
 	WARN_ON_ONCE(svm->nested.nested_run_pending);
 
+	nested_svm_switch_asid(svm);
+
 	/* in case we halted in L2 */
 	svm->vcpu.arch.mp_state = KVM_MP_STATE_RUNNABLE;
 
@@ -697,6 +766,7 @@ void svm_leave_nested(struct vcpu_svm *svm)
 
 		svm->nested.nested_run_pending = 0;
 		leave_guest_mode(&svm->vcpu);
+		nested_svm_switch_asid(svm);
 		copy_vmcb_control_area(&vmcb->control, &hsave->control);
 		nested_svm_uninit_mmu_context(&svm->vcpu);
 	}
@@ -1141,6 +1211,10 @@ static int svm_set_nested_state(struct kvm_vcpu *vcpu,
 	copy_vmcb_control_area(&hsave->control, &svm->vmcb->control);
 	hsave->save = *save;
 
+	if (!is_guest_mode(vcpu))
+		nested_svm_switch_asid(svm);
+	svm->nested.last_asid = 0;
+
 	svm->nested.vmcb = kvm_state->hdr.svm.vmcb_pa;
 	load_nested_vmcb_control(svm, ctl);
 	nested_prepare_vmcb_control(svm);
@@ -248,6 +248,9 @@ static int amd_pmu_set_msr(struct kvm_vcpu *vcpu, struct msr_data *msr_info)
 	pmc = get_gp_pmc_amd(pmu, msr, PMU_TYPE_COUNTER);
 	if (pmc) {
 		pmc->counter += data - pmc_read_counter(pmc);
+		/* The sample period of the perf_event depends on the counter */
+		if (pmc->perf_event)
+			kvm_pmu_request_counter_reprogram(pmc);
 		return 0;
 	}
 	/* MSR_EVNTSELn */
@@ -256,7 +259,8 @@ static int amd_pmu_set_msr(struct kvm_vcpu *vcpu, struct msr_data *msr_info)
 		if (data == pmc->eventsel)
 			return 0;
 		if (!(data & pmu->reserved_bits)) {
-			reprogram_gp_counter(pmc, data);
+			pmc->eventsel = data;
+			kvm_pmu_request_counter_reprogram(pmc);
 			return 0;
 		}
 	}
@@ -14,17 +14,41 @@
 #include <linux/psp-sev.h>
 #include <linux/pagemap.h>
 #include <linux/swap.h>
+#include <linux/debugfs.h>
+#include <linux/workqueue.h>
 
 #include "x86.h"
 #include "svm.h"
 
+/*
+ * Number of retired ASIDs that triggers a background DF_FLUSH.  Batching the
+ * flush ahead of demand keeps sev_asid_new() off the sev_deactivate_lock in
+ * the common case.  Zero disables the background reclaimer and ASIDs are
+ * only recycled once the free pool runs dry.
+ */
+static unsigned int sev_asid_reclaim_batch = 16;
+module_param(sev_asid_reclaim_batch, uint, 0644);
+
 static int sev_flush_asids(void);
+static void sev_asid_reclaim_fn(struct work_struct *work);
 static DECLARE_RWSEM(sev_deactivate_lock);
 static DEFINE_MUTEX(sev_bitmap_lock);
+static DECLARE_WORK(sev_asid_reclaim_work, sev_asid_reclaim_fn);
 unsigned int max_sev_asid;
 static unsigned int min_sev_asid;
 static unsigned long *sev_asid_bitmap;
 static unsigned long *sev_reclaim_asid_bitmap;
+static unsigned int sev_nr_reclaim_asids;
+
+static struct {
+	u64 flushes;		/* DF_FLUSH commands issued for recycling */
+	u64 bg_flushes;		/* ... of which issued by the reclaimer */
+	u64 flush_ns;		/* total time spent in WBINVD + DF_FLUSH */
+	u64 flush_max_ns;	/* longest single flush */
+	u64 alloc_stalls;	/* sev_asid_new() calls that had to flush */
+} sev_asid_stats;
+
+static struct dentry *sev_debugfs_dir;
 #define __sme_page_pa(x) __sme_set(page_to_pfn(x) << PAGE_SHIFT)
 
 struct enc_region {
@@ -57,51 +81,89 @@ static int sev_flush_asids(void)
 }
 
 /* Must be called with the sev_bitmap_lock held */
-static bool __sev_recycle_asids(void)
+static bool __sev_recycle_asids(bool background)
 {
+	u64 start, delta;
 	int pos;
 
+	lockdep_assert_held(&sev_bitmap_lock);
+
 	/* Check if there are any ASIDs to reclaim before performing a flush */
 	pos = find_next_bit(sev_reclaim_asid_bitmap,
 			    max_sev_asid, min_sev_asid - 1);
 	if (pos >= max_sev_asid)
 		return false;
 
+	start = ktime_get_ns();
 	if (sev_flush_asids())
 		return false;
+	delta = ktime_get_ns() - start;
+
+	sev_asid_stats.flushes++;
+	if (background)
+		sev_asid_stats.bg_flushes++;
+	sev_asid_stats.flush_ns += delta;
+	if (delta > sev_asid_stats.flush_max_ns)
+		sev_asid_stats.flush_max_ns = delta;
 
-	bitmap_xor(sev_asid_bitmap, sev_asid_bitmap, sev_reclaim_asid_bitmap,
-		   max_sev_asid);
+	/*
+	 * sev_asid_new() allocates from sev_asid_bitmap without holding
+	 * sev_bitmap_lock, so the reclaimed ASIDs must be released with
+	 * atomic bitops rather than a bitmap_xor().
+	 */
+	for_each_set_bit(pos, sev_reclaim_asid_bitmap, max_sev_asid)
+		clear_bit(pos, sev_asid_bitmap);
 	bitmap_zero(sev_reclaim_asid_bitmap, max_sev_asid);
+	sev_nr_reclaim_asids = 0;
 
 	return true;
 }
 
-static int sev_asid_new(void)
+static void sev_asid_reclaim_fn(struct work_struct *work)
 {
-	bool retry = true;
-	int pos;
-
 	mutex_lock(&sev_bitmap_lock);
+	__sev_recycle_asids(true);
+	mutex_unlock(&sev_bitmap_lock);
+}
+
+static int __sev_asid_alloc(void)
+{
+	int pos;
 
 	/*
 	 * SEV-enabled guest must use asid from min_sev_asid to max_sev_asid.
 	 */
-again:
-	pos = find_next_zero_bit(sev_asid_bitmap, max_sev_asid, min_sev_asid - 1);
-	if (pos >= max_sev_asid) {
-		if (retry && __sev_recycle_asids()) {
-			retry = false;
-			goto again;
-		}
-		mutex_unlock(&sev_bitmap_lock);
-		return -EBUSY;
-	}
+	do {
+		pos = find_next_zero_bit(sev_asid_bitmap, max_sev_asid,
+					 min_sev_asid - 1);
+		if (pos >= max_sev_asid)
+			return -EBUSY;
+	} while (test_and_set_bit(pos, sev_asid_bitmap));
+
+	return pos;
+}
+
+static int sev_asid_new(void)
+{
+	int pos;
 
-	__set_bit(pos, sev_asid_bitmap);
+	pos = __sev_asid_alloc();
+	if (pos >= 0)
+		return pos + 1;
 
+	/*
+	 * The free pool is exhausted, recycle the retired ASIDs synchronously
+	 * rather than waiting for the reclaimer.
+	 */
+	mutex_lock(&sev_bitmap_lock);
+	sev_asid_stats.alloc_stalls++;
+	__sev_recycle_asids(false);
 	mutex_unlock(&sev_bitmap_lock);
 
+	pos = __sev_asid_alloc();
+	if (pos < 0)
+		return pos;
+
 	return pos + 1;
 }
 
@@ -127,6 +189,10 @@ static void sev_asid_free(int asid)
 		sd->sev_vmcbs[pos] = NULL;
 	}
 
+	if (sev_asid_reclaim_batch &&
+	    ++sev_nr_reclaim_asids >= sev_asid_reclaim_batch)
+		queue_work(system_unbound_wq, &sev_asid_reclaim_work);
+
 	mutex_unlock(&sev_bitmap_lock);
 }
 
@@ -232,6 +298,29 @@ static int sev_issue_cmd(struct kvm *kvm, int id, void *data, int *error)
 	return __sev_issue_cmd(sev->fd, id, data, error);
 }
 
+/*
+ * Queue a command without waiting for the PSP, @data and @acmd must stay
+ * valid until sev_async_cmd_wait() returns.
+ */
+static int sev_issue_cmd_async(struct kvm *kvm, int id, void *data,
+			       struct sev_async_cmd *acmd)
+{
+	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
+	struct fd f;
+	int ret;
+
+	f = fdget(sev->fd);
+	if (!f.file)
+		return -EBADF;
+
+	acmd->cmd = id;
+	acmd->data = data;
+	ret = sev_issue_cmd_external_user_async(f.file, acmd);
+
+	fdput(f);
+	return ret;
+}
+
 static int sev_launch_start(struct kvm *kvm, struct kvm_sev_cmd *argp)
 {
 	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
@@ -421,8 +510,9 @@ static int sev_launch_update_data(struct kvm *kvm, struct kvm_sev_cmd *argp)
 	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
 	struct kvm_sev_launch_update_data params;
 	struct sev_data_launch_update_data *data;
+	struct sev_async_cmd acmd[2], *prev = NULL;
 	struct page **inpages;
-	int ret;
+	int ret, idx = 0;
 
 	if (!sev_guest(kvm))
 		return -ENOTTY;
@@ -430,7 +520,7 @@ static int sev_launch_update_data(struct kvm *kvm, struct kvm_sev_cmd *argp)
 	if (copy_from_user(&params, (void __user *)(uintptr_t)argp->data, sizeof(params)))
 		return -EFAULT;
 
-	data = kzalloc(sizeof(*data), GFP_KERNEL_ACCOUNT);
+	data = kcalloc(2, sizeof(*data), GFP_KERNEL_ACCOUNT);
 	if (!data)
 		return -ENOMEM;
 
@@ -445,14 +535,6 @@ static int sev_launch_update_data(struct kvm *kvm, struct kvm_sev_cmd *argp)
 		goto e_free;
 	}
 
-	/*
-	 * The LAUNCH_UPDATE command will perform in-place encryption of the
-	 * memory content (i.e it will write the same memory region with C=1).
-	 * It's possible that the cache may contain the data with C=0, i.e.,
-	 * unencrypted so invalidate it first.
-	 */
-	sev_clflush_pages(inpages, npages);
-
 	for (i = 0; vaddr < vaddr_end; vaddr = next_vaddr, i += pages) {
 		int offset, len;
 
@@ -467,17 +549,40 @@ static int sev_launch_update_data(struct kvm *kvm, struct kvm_sev_cmd *argp)
 
 		len = min_t(size_t, ((pages * PAGE_SIZE) - offset), size);
 
-		data->handle = sev->handle;
-		data->len = len;
-		data->address = __sme_page_pa(inpages[i]) + offset;
-		ret = sev_issue_cmd(kvm, SEV_CMD_LAUNCH_UPDATE_DATA, data, &argp->error);
+		/*
+		 * The LAUNCH_UPDATE command will perform in-place encryption
+		 * of the memory content (i.e it will write the same memory
+		 * region with C=1). It's possible that the cache may contain
+		 * the data with C=0, i.e., unencrypted so invalidate it first.
+		 * This is done while the PSP works on the previous command.
+		 */
+		sev_clflush_pages(&inpages[i], pages);
+
+		if (prev) {
+			ret = sev_async_cmd_wait(prev, &argp->error);
+			prev = NULL;
+			if (ret)
+				goto e_unpin;
+		}
+
+		data[idx].handle = sev->handle;
+		data[idx].len = len;
+		data[idx].address = __sme_page_pa(inpages[i]) + offset;
+		ret = sev_issue_cmd_async(kvm, SEV_CMD_LAUNCH_UPDATE_DATA,
+					  &data[idx], &acmd[idx]);
 		if (ret)
 			goto e_unpin;
 
+		prev = &acmd[idx];
+		idx ^= 1;
+
 		size -= len;
 		next_vaddr = vaddr + len;
 	}
 
+	if (prev)
+		ret = sev_async_cmd_wait(prev, &argp->error);
+
 e_unpin:
 	/* content of memory is updated, mark pages dirty */
 	for (i = 0; i < npages; i++) {
@@ -491,6 +596,225 @@ e_free:
 	return ret;
 }
 
+/* Default pipeline stage size, a multiple of the largest hugepage size */
+#define SEV_LAUNCH_CHUNK_DEFAULT	SZ_256M
+#define SEV_LAUNCH_CHUNK_MIN		PMD_SIZE
+
+/* One LAUNCH_UPDATE_DATA of a chunk, queued on the PSP */
+struct sev_launch_cmd {
+	struct sev_async_cmd acmd;
+	struct sev_data_launch_update_data data;
+};
+
+struct sev_launch_chunk {
+	struct page **pages;
+	unsigned long npages;
+	struct sev_launch_cmd **cmds;
+	u32 nr_cmds;
+	u64 queued_ns;
+};
+
+/*
+ * Queue the commands encrypting one pinned and flushed chunk on the PSP and
+ * return without waiting for them, so that the caller can prepare the next
+ * chunk meanwhile.  Commands queued before an error must still be waited for
+ * with sev_launch_chunk_complete().
+ */
+static int sev_launch_chunk_queue(struct kvm *kvm, struct sev_launch_chunk *c,
+				  unsigned long vaddr, unsigned long size)
+{
+	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
+	unsigned long vaddr_end = vaddr + size, next_vaddr, pages, i, n = 0;
+	struct sev_launch_cmd *cmd;
+	int ret = 0;
+
+	c->queued_ns = ktime_get_ns();
+
+	for (i = 0; i < c->npages; i += get_num_contig_pages(i, c->pages, c->npages))
+		n++;
+
+	c->cmds = kvcalloc(n, sizeof(*c->cmds), GFP_KERNEL_ACCOUNT);
+	if (!c->cmds)
+		return -ENOMEM;
+
+	for (i = 0; vaddr < vaddr_end; vaddr = next_vaddr, i += pages) {
+		int offset;
+		u32 len;
+
+		offset = vaddr & (PAGE_SIZE - 1);
+		pages = get_num_contig_pages(i, c->pages, c->npages);
+		len = min_t(unsigned long, (pages * PAGE_SIZE) - offset, size);
+
+		/* The PSP reads the command buffer by physical address */
+		cmd = kzalloc(sizeof(*cmd), GFP_KERNEL_ACCOUNT);
+		if (!cmd) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		cmd->data.handle = sev->handle;
+		cmd->data.len = len;
+		cmd->data.address = __sme_page_pa(c->pages[i]) + offset;
+		ret = sev_issue_cmd_async(kvm, SEV_CMD_LAUNCH_UPDATE_DATA,
+					  &cmd->data, &cmd->acmd);
+		if (ret) {
+			kfree(cmd);
+			break;
+		}
+
+		c->cmds[c->nr_cmds++] = cmd;
+		size -= len;
+		next_vaddr = vaddr + len;
+	}
+
+	return ret;
+}
+
+static void sev_launch_chunk_release(struct kvm *kvm,
+				     struct sev_launch_chunk *c)
+{
+	unsigned long i;
+
+	if (!c->pages)
+		return;
+
+	for (i = 0; i < c->npages; i++) {
+		set_page_dirty_lock(c->pages[i]);
+		mark_page_accessed(c->pages[i]);
+	}
+	sev_unpin_memory(kvm, c->pages, c->npages);
+	c->pages = NULL;
+}
+
+/*
+ * Wait for the commands queued for @c, fold them into @params and release
+ * the pages of @c.  Returns the result of the first failed command, which is
+ * also reported in @argp.
+ */
+static int sev_launch_chunk_complete(struct kvm *kvm, struct kvm_sev_cmd *argp,
+				     struct sev_launch_chunk *c,
+				     struct kvm_sev_launch_update_data_pipelined *params)
+{
+	u64 start = ktime_get_ns(), now;
+	int ret = 0, r, error;
+	u32 i;
+
+	for (i = 0; i < c->nr_cmds; i++) {
+		r = sev_async_cmd_wait(&c->cmds[i]->acmd, &error);
+		if (r && !ret) {
+			ret = r;
+			argp->error = error;
+		}
+		kfree(c->cmds[i]);
+	}
+
+	now = ktime_get_ns();
+	params->wait_ns += now - start;
+	params->psp_ns += now - c->queued_ns;
+	params->nr_cmds += c->nr_cmds;
+
+	kvfree(c->cmds);
+	c->cmds = NULL;
+	c->nr_cmds = 0;
+
+	sev_launch_chunk_release(kvm, c);
+
+	return ret;
+}
+
+static int sev_launch_update_data_pipelined(struct kvm *kvm,
+					    struct kvm_sev_cmd *argp)
+{
+	void __user *uparams = (void __user *)(uintptr_t)argp->data;
+	struct kvm_sev_launch_update_data_pipelined params;
+	struct sev_launch_chunk chunks[2] = {}, *cur, *prev = NULL;
+	unsigned long vaddr, vaddr_end, chunk_size;
+	u64 start;
+	int ret = 0, idx = 0;
+
+	if (!sev_guest(kvm))
+		return -ENOTTY;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+
+	if (params.flags || !params.len || params.uaddr + params.len < params.uaddr)
+		return -EINVAL;
+
+	chunk_size = params.chunk_size ? : SEV_LAUNCH_CHUNK_DEFAULT;
+	chunk_size = max_t(unsigned long, rounddown(chunk_size, SEV_LAUNCH_CHUNK_MIN),
+			   SEV_LAUNCH_CHUNK_MIN);
+
+	params.pin_ns = params.flush_ns = params.psp_ns = params.wait_ns = 0;
+	params.nr_chunks = params.nr_cmds = 0;
+
+	vaddr = params.uaddr;
+	vaddr_end = vaddr + params.len;
+
+	while (vaddr < vaddr_end) {
+		unsigned long next;
+
+		/*
+		 * Chunk boundaries are kept aligned to chunk_size in the user
+		 * address space so that a hugepage is never split between two
+		 * chunks and its pages can still be merged into one command.
+		 */
+		next = min(rounddown(vaddr, chunk_size) + chunk_size, vaddr_end);
+
+		cur = &chunks[idx];
+		idx ^= 1;
+		memset(cur, 0, sizeof(*cur));
+
+		start = ktime_get_ns();
+		cur->pages = sev_pin_memory(kvm, vaddr, next - vaddr, &cur->npages, 1);
+		params.pin_ns += ktime_get_ns() - start;
+		if (IS_ERR(cur->pages)) {
+			ret = PTR_ERR(cur->pages);
+			cur->pages = NULL;
+			break;
+		}
+
+		/* See sev_launch_update_data() */
+		start = ktime_get_ns();
+		sev_clflush_pages(cur->pages, cur->npages);
+		params.flush_ns += ktime_get_ns() - start;
+
+		/*
+		 * The PSP works through the queue in order, but chunk N-1 is
+		 * waited for before N is queued so that a failure stops the
+		 * launch at the chunk it happened in.
+		 */
+		if (prev) {
+			ret = sev_launch_chunk_complete(kvm, argp, prev, &params);
+			prev = NULL;
+			if (ret) {
+				sev_launch_chunk_release(kvm, cur);
+				break;
+			}
+		}
+
+		ret = sev_launch_chunk_queue(kvm, cur, vaddr, next - vaddr);
+		params.nr_chunks++;
+		prev = cur;
+		if (ret)
+			break;
+
+		vaddr = next;
+	}
+
+	if (prev) {
+		int r = sev_launch_chunk_complete(kvm, argp, prev, &params);
+
+		if (!ret)
+			ret = r;
+	}
+
+	if (copy_to_user(uparams, &params, sizeof(params)))
+		ret = ret ? : -EFAULT;
+
+	return ret;
+}
+
 static int sev_launch_measure(struct kvm *kvm, struct kvm_sev_cmd *argp)
 {
 	void __user *measure = (void __user *)(uintptr_t)argp->data;
@@ -849,6 +1173,223 @@ err:
 	return ret;
 }
 
+/* Largest bounce buffer used by the vectored debug commands */
+#define SEV_DBG_BOUNCE_ORDER	6
+
+static int sev_dbg_bounce_get(struct kvm_sev_info *sev)
+{
+	struct page *page;
+	int order;
+
+	if (sev->dbg_bounce)
+		return 0;
+
+	/* The buffer is kept for the life of the VM, don't try too hard */
+	for (order = SEV_DBG_BOUNCE_ORDER; ; order--) {
+		page = alloc_pages(GFP_KERNEL_ACCOUNT | (order ?
+				   __GFP_NORETRY | __GFP_NOWARN : 0), order);
+		if (page || !order)
+			break;
+	}
+	if (!page)
+		return -ENOMEM;
+
+	sev->dbg_bounce = page;
+	sev->dbg_bounce_order = order;
+
+	return 0;
+}
+
+/*
+ * {De,En}crypt [gpa, gpa + len) through the bounce buffer with a single PSP
+ * command.  @pages are the physically contiguous guest pages backing it.
+ */
+static int sev_dbg_vec_run(struct kvm *kvm, struct sev_data_dbg *data,
+			   struct page **pages, unsigned long npages,
+			   u64 gpa, u32 len, unsigned long uaddr, bool dec,
+			   int *error)
+{
+	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
+	void *bounce = page_address(sev->dbg_bounce);
+	unsigned int offset = gpa & ~PAGE_MASK;
+	int ret;
+
+	/* See sev_dbg_crypt() */
+	sev_clflush_pages(pages, npages);
+
+	data->handle = sev->handle;
+
+	if (dec) {
+		/*
+		 * Reading up to 15 bytes on either side stays within the
+		 * pinned pages, and thus within the bounce buffer.
+		 */
+		data->src_addr = __sme_page_pa(pages[0]) + round_down(offset, 16);
+		data->dst_addr = __sme_page_pa(sev->dbg_bounce);
+		data->len = round_up(len + (offset & 15), 16);
+		clflush_cache_range(bounce, data->len);
+
+		ret = sev_issue_cmd(kvm, SEV_CMD_DBG_DECRYPT, data, error);
+		if (ret)
+			return ret;
+
+		if (copy_to_user((void __user *)uaddr, bounce + (offset & 15), len))
+			return -EFAULT;
+
+		return 0;
+	}
+
+	if (copy_from_user(bounce, (void __user *)uaddr, len))
+		return -EFAULT;
+	clflush_cache_range(bounce, len);
+
+	data->src_addr = __sme_page_pa(sev->dbg_bounce);
+	data->dst_addr = __sme_page_pa(pages[0]) + offset;
+	data->len = len;
+
+	return sev_issue_cmd(kvm, SEV_CMD_DBG_ENCRYPT, data, error);
+}
+
+static int sev_dbg_vec_range(struct kvm *kvm, struct kvm_sev_dbg_range *range,
+			     struct sev_data_dbg *data, struct page **pages,
+			     bool dec, u32 *nr_cmds, int *error)
+{
+	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
+	unsigned long max_pages = 1UL << sev->dbg_bounce_order;
+	u64 gpa = range->gpa, end = range->gpa + range->len;
+	unsigned long uaddr = range->uaddr;
+	unsigned long npages, i;
+	struct page *page;
+	u32 len;
+	int ret;
+
+	if (!range->len || end < gpa)
+		return -EINVAL;
+
+	/* Writes smaller than a 16 byte block need KVM_SEV_DBG_ENCRYPT */
+	if (!dec && (!IS_ALIGNED(gpa, 16) || !IS_ALIGNED(range->len, 16)))
+		return -EINVAL;
+
+	while (gpa < end) {
+		gfn_t gfn = gpa_to_gfn(gpa);
+
+		/*
+		 * Collect the longest physically contiguous run of pages that
+		 * fits in the bounce buffer, it takes a single PSP command.
+		 */
+		ret = 0;
+		for (npages = 0; npages < max_pages &&
+		     gfn_to_gpa(gfn + npages) < end; npages++) {
+			page = gfn_to_page(kvm, gfn + npages);
+			if (is_error_page(page)) {
+				ret = -EFAULT;
+				break;
+			}
+
+			if (npages &&
+			    page_to_pfn(page) != page_to_pfn(pages[npages - 1]) + 1) {
+				kvm_release_page_clean(page);
+				break;
+			}
+
+			pages[npages] = page;
+		}
+
+		if (!npages)
+			return ret;
+
+		len = min(end, gfn_to_gpa(gfn + npages)) - gpa;
+
+		ret = sev_dbg_vec_run(kvm, data, pages, npages, gpa, len,
+				      uaddr, dec, error);
+
+		for (i = 0; i < npages; i++) {
+			if (dec)
+				kvm_release_page_clean(pages[i]);
+			else
+				kvm_release_page_dirty(pages[i]);
+		}
+
+		if (ret)
+			return ret;
+
+		(*nr_cmds)++;
+		gpa += len;
+		uaddr += len;
+
+		if (fatal_signal_pending(current))
+			return -EINTR;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static int sev_dbg_crypt_vec(struct kvm *kvm, struct kvm_sev_cmd *argp,
+			     bool dec)
+{
+	void __user *uparams = (void __user *)(uintptr_t)argp->data;
+	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
+	struct kvm_sev_dbg_range __user *uranges;
+	struct kvm_sev_dbg_range range;
+	struct kvm_sev_dbg_vec params;
+	struct sev_data_dbg *data;
+	struct page **pages;
+	int ret, idx;
+	u32 i;
+
+	if (!sev_guest(kvm))
+		return -ENOTTY;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+
+	if (params.flags)
+		return -EINVAL;
+
+	ret = sev_dbg_bounce_get(sev);
+	if (ret)
+		return ret;
+
+	pages = kcalloc(1UL << sev->dbg_bounce_order, sizeof(*pages),
+			GFP_KERNEL_ACCOUNT);
+	if (!pages)
+		return -ENOMEM;
+
+	data = kzalloc(sizeof(*data), GFP_KERNEL_ACCOUNT);
+	if (!data) {
+		ret = -ENOMEM;
+		goto e_free_pages;
+	}
+
+	uranges = u64_to_user_ptr(params.ranges_uaddr);
+	params.nr_done = params.nr_cmds = 0;
+
+	idx = srcu_read_lock(&kvm->srcu);
+	for (i = 0; i < params.nr_ranges; i++) {
+		if (copy_from_user(&range, &uranges[i], sizeof(range))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = sev_dbg_vec_range(kvm, &range, data, pages, dec,
+					&params.nr_cmds, &argp->error);
+		if (ret)
+			break;
+
+		params.nr_done++;
+	}
+	srcu_read_unlock(&kvm->srcu, idx);
+
+	if (copy_to_user(uparams, &params, sizeof(params)))
+		ret = ret ? : -EFAULT;
+
+	kfree(data);
+e_free_pages:
+	kfree(pages);
+	return ret;
+}
+
 static int sev_launch_secret(struct kvm *kvm, struct kvm_sev_cmd *argp)
 {
 	struct kvm_sev_info *sev = &to_kvm_svm(kvm)->sev_info;
@@ -944,6 +1485,9 @@ int svm_mem_enc_op(struct kvm *kvm, void __user *argp)
 	case KVM_SEV_LAUNCH_UPDATE_DATA:
 		r = sev_launch_update_data(kvm, &sev_cmd);
 		break;
+	case KVM_SEV_LAUNCH_UPDATE_DATA_PIPELINED:
+		r = sev_launch_update_data_pipelined(kvm, &sev_cmd);
+		break;
 	case KVM_SEV_LAUNCH_MEASURE:
 		r = sev_launch_measure(kvm, &sev_cmd);
 		break;
@@ -959,6 +1503,12 @@ int svm_mem_enc_op(struct kvm *kvm, void __user *argp)
 	case KVM_SEV_DBG_ENCRYPT:
 		r = sev_dbg_crypt(kvm, &sev_cmd, false);
 		break;
+	case KVM_SEV_DBG_DECRYPT_VEC:
+		r = sev_dbg_crypt_vec(kvm, &sev_cmd, true);
+		break;
+	case KVM_SEV_DBG_ENCRYPT_VEC:
+		r = sev_dbg_crypt_vec(kvm, &sev_cmd, false);
+		break;
 	case KVM_SEV_LAUNCH_SECRET:
 		r = sev_launch_secret(kvm, &sev_cmd);
 		break;
@@ -1111,6 +1661,9 @@ void sev_vm_destroy(struct kvm *kvm)
 
 	mutex_unlock(&kvm->lock);
 
+	if (sev->dbg_bounce)
+		__free_pages(sev->dbg_bounce, sev->dbg_bounce_order);
+
 	sev_unbind_asid(kvm, sev->handle);
 	sev_asid_free(sev->asid);
 }
@@ -1165,12 +1718,33 @@ void sev_hardware_teardown(void)
 	if (!svm_sev_enabled())
 		return;
 
+	/* sev_debugfs_dir is removed along with kvm_debugfs_dir */
+	cancel_work_sync(&sev_asid_reclaim_work);
+
 	bitmap_free(sev_asid_bitmap);
 	bitmap_free(sev_reclaim_asid_bitmap);
 
 	sev_flush_asids();
 }
 
+void sev_debugfs_init(void)
+{
+	if (!svm_sev_enabled())
+		return;
+
+	sev_debugfs_dir = debugfs_create_dir("sev_asid", kvm_debugfs_dir);
+	debugfs_create_u64("flushes", 0444, sev_debugfs_dir,
+			   &sev_asid_stats.flushes);
+	debugfs_create_u64("background_flushes", 0444, sev_debugfs_dir,
+			   &sev_asid_stats.bg_flushes);
+	debugfs_create_u64("flush_ns", 0444, sev_debugfs_dir,
+			   &sev_asid_stats.flush_ns);
+	debugfs_create_u64("flush_max_ns", 0444, sev_debugfs_dir,
+			   &sev_asid_stats.flush_max_ns);
+	debugfs_create_u64("alloc_stalls", 0444, sev_debugfs_dir,
+			   &sev_asid_stats.alloc_stalls);
+}
+
 void pre_sev_run(struct vcpu_svm *svm, int cpu)
 {
 	struct svm_cpu_data *sd = per_cpu(svm_data, cpu);
@@ -25,6 +25,7 @@
 #include <linux/pagemap.h>
 #include <linux/swap.h>
 #include <linux/rwsem.h>
+#include <linux/lat_hist.h>
 
 #include <asm/apic.h>
 #include <asm/perf_event.h>
@@ -838,6 +839,10 @@ static __init int svm_hardware_setup(void)
 	if (boot_cpu_has(X86_FEATURE_NX))
 		kvm_enable_efer_bits(EFER_NX);
 
+	kvm_msr_passthrough_supported = KVM_X86_MSR_PASSTHROUGH_SPEC_CTRL;
+	if (boot_cpu_has(X86_FEATURE_AMD_IBPB))
+		kvm_msr_passthrough_supported |= KVM_X86_MSR_PASSTHROUGH_PRED_CMD;
+
 	if (boot_cpu_has(X86_FEATURE_FXSR_OPT))
 		kvm_enable_efer_bits(EFER_FFXSR);
 
@@ -1101,6 +1106,8 @@ static void init_vmcb(struct vcpu_svm *svm)
 		save->cr4 = 0;
 	}
 	svm->asid_generation = 0;
+	svm->nested.asid_generation = 0;
+	svm->nested.last_asid = 0;
 
 	svm->nested.vmcb = 0;
 	svm->vcpu.arch.hflags = 0;
@@ -1272,6 +1279,7 @@ static void svm_vcpu_load(struct kvm_vcpu *vcpu, int cpu)
 
 	if (unlikely(cpu != vcpu->cpu)) {
 		svm->asid_generation = 0;
+		svm->nested.asid_generation = 0;
 		vmcb_mark_all_dirty(svm->vmcb);
 	}
 
@@ -1600,7 +1608,7 @@ int svm_set_cr4(struct kvm_vcpu *vcpu, unsigned long cr4)
 		return 1;
 
 	if (npt_enabled && ((old_cr4 ^ cr4) & X86_CR4_PGE))
-		svm_flush_tlb(vcpu);
+		svm_flush_tlb_current(vcpu);
 
 	vcpu->arch.cr4 = cr4;
 	if (!npt_enabled)
@@ -2070,6 +2078,10 @@ static int invlpga_interception(struct vcpu_svm *svm)
 	/* Let's treat INVLPGA the same as INVLPG (can be optimized!) */
 	kvm_mmu_invlpg(vcpu, kvm_rax_read(&svm->vcpu));
 
+	/* A nonzero ASID is L2's, which runs with an ASID of its own */
+	if (kvm_rcx_read(vcpu) && !is_guest_mode(vcpu))
+		svm->nested.asid_generation = 0;
+
 	return kvm_skip_emulated_instruction(&svm->vcpu);
 }
 
@@ -2516,6 +2528,18 @@ static int svm_set_vm_cr(struct kvm_vcpu *vcpu, u64 data)
 	return 0;
 }
 
+/*
+ * Whether an MSR that is passed through on its first write may be passed
+ * through at all, i.e. userspace did not set a KVM_CAP_X86_MSR_PASSTHROUGH
+ * policy that leaves it out.
+ */
+static bool svm_msr_passthrough_allowed(struct kvm_vcpu *vcpu, u32 flag)
+{
+	struct kvm_arch *ka = &vcpu->kvm->arch;
+
+	return !ka->msr_passthrough_policy || (ka->msr_passthrough & flag);
+}
+
 static int svm_set_msr(struct kvm_vcpu *vcpu, struct msr_data *msr)
 {
 	struct vcpu_svm *svm = to_svm(vcpu);
@@ -2556,7 +2580,8 @@ static int svm_set_msr(struct kvm_vcpu *vcpu, struct msr_data *msr)
 		 * We update the L1 MSR bit as well since it will end up
 		 * touching the MSR anyway now.
 		 */
-		set_msr_interception(svm->msrpm, MSR_IA32_SPEC_CTRL, 1, 1);
+		if (svm_msr_passthrough_allowed(vcpu, KVM_X86_MSR_PASSTHROUGH_SPEC_CTRL))
+			set_msr_interception(svm->msrpm, MSR_IA32_SPEC_CTRL, 1, 1);
 		break;
 	case MSR_IA32_PRED_CMD:
 		if (!msr->host_initiated &&
@@ -2571,7 +2596,8 @@ static int svm_set_msr(struct kvm_vcpu *vcpu, struct msr_data *msr)
 			break;
 
 		wrmsrl(MSR_IA32_PRED_CMD, PRED_CMD_IBPB);
-		set_msr_interception(svm->msrpm, MSR_IA32_PRED_CMD, 0, 1);
+		if (svm_msr_passthrough_allowed(vcpu, KVM_X86_MSR_PASSTHROUGH_PRED_CMD))
+			set_msr_interception(svm->msrpm, MSR_IA32_PRED_CMD, 0, 1);
 		break;
 	case MSR_AMD64_VIRT_SPEC_CTRL:
 		if (!msr->host_initiated &&
@@ -2925,11 +2951,33 @@ static void svm_get_exit_info(struct kvm_vcpu *vcpu, u64 *info1, u64 *info2)
 	*info2 = control->exit_info_2;
 }
 
+/* Time spent in the exit handlers, in tracing/latency_hist/svm_exit */
+DEFINE_LAT_HIST(svm_exit);
+
+static int svm_invoke_exit_handler(struct vcpu_svm *svm, u32 exit_code)
+{
+#ifdef CONFIG_RETPOLINE
+	if (exit_code == SVM_EXIT_MSR)
+		return msr_interception(svm);
+	else if (exit_code == SVM_EXIT_VINTR)
+		return interrupt_window_interception(svm);
+	else if (exit_code == SVM_EXIT_INTR)
+		return intr_interception(svm);
+	else if (exit_code == SVM_EXIT_HLT)
+		return halt_interception(svm);
+	else if (exit_code == SVM_EXIT_NPF)
+		return npf_interception(svm);
+#endif
+	return svm_exit_handlers[exit_code](svm);
+}
+
 static int handle_exit(struct kvm_vcpu *vcpu, fastpath_t exit_fastpath)
 {
 	struct vcpu_svm *svm = to_svm(vcpu);
 	struct kvm_run *kvm_run = vcpu->run;
 	u32 exit_code = svm->vmcb->control.exit_code;
+	u64 start;
+	int ret;
 
 	trace_kvm_exit(exit_code, vcpu, KVM_ISA_SVM);
 
@@ -2993,19 +3041,11 @@ static int handle_exit(struct kvm_vcpu *vcpu, fastpath_t exit_fastpath)
 		return 0;
 	}
 
-#ifdef CONFIG_RETPOLINE
-	if (exit_code == SVM_EXIT_MSR)
-		return msr_interception(svm);
-	else if (exit_code == SVM_EXIT_VINTR)
-		return interrupt_window_interception(svm);
-	else if (exit_code == SVM_EXIT_INTR)
-		return intr_interception(svm);
-	else if (exit_code == SVM_EXIT_HLT)
-		return halt_interception(svm);
-	else if (exit_code == SVM_EXIT_NPF)
-		return npf_interception(svm);
-#endif
-	return svm_exit_handlers[exit_code](svm);
+	start = lat_hist_start(&lat_hist_svm_exit);
+	ret = svm_invoke_exit_handler(svm, exit_code);
+	lat_hist_end(&lat_hist_svm_exit, start);
+
+	return ret;
 }
 
 static void reload_tss(struct kvm_vcpu *vcpu)
@@ -3217,23 +3257,29 @@ static int svm_set_identity_map_addr(struct kvm *kvm, u64 ident_addr)
 	return 0;
 }
 
-void svm_flush_tlb(struct kvm_vcpu *vcpu)
+static void svm_flush_tlb_current(struct kvm_vcpu *vcpu)
 {
 	struct vcpu_svm *svm = to_svm(vcpu);
 
-	/*
-	 * Flush only the current ASID even if the TLB flush was invoked via
-	 * kvm_flush_remote_tlbs().  Although flushing remote TLBs requires all
-	 * ASIDs to be flushed, KVM uses a single ASID for L1 and L2, and
-	 * unconditionally does a TLB flush on both nested VM-Enter and nested
-	 * VM-Exit (via kvm_mmu_reset_context()).
-	 */
 	if (static_cpu_has(X86_FEATURE_FLUSHBYASID))
 		svm->vmcb->control.tlb_ctl = TLB_CONTROL_FLUSH_ASID;
 	else
 		svm->asid_generation--;
 }
 
+void svm_flush_tlb(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_svm *svm = to_svm(vcpu);
+
+	/*
+	 * L1 and L2 have different ASIDs.  Flush the current one, and
+	 * have the other one replaced by a fresh ASID when its level
+	 * runs again.
+	 */
+	svm_flush_tlb_current(vcpu);
+	svm->nested.asid_generation = 0;
+}
+
 static void svm_flush_tlb_gva(struct kvm_vcpu *vcpu, gva_t gva)
 {
 	struct vcpu_svm *svm = to_svm(vcpu);
@@ -3624,6 +3670,17 @@ static void svm_vcpu_after_set_cpuid(struct kvm_vcpu *vcpu)
 	svm->nrips_enabled = kvm_cpu_cap_has(X86_FEATURE_NRIPS) &&
 			     guest_cpuid_has(&svm->vcpu, X86_FEATURE_NRIPS);
 
+	/* Userspace asked for these to be passed through from the start */
+	if (vcpu->kvm->arch.msr_passthrough & KVM_X86_MSR_PASSTHROUGH_SPEC_CTRL &&
+	    (guest_cpuid_has(vcpu, X86_FEATURE_SPEC_CTRL) ||
+	     guest_cpuid_has(vcpu, X86_FEATURE_AMD_STIBP) ||
+	     guest_cpuid_has(vcpu, X86_FEATURE_AMD_IBRS) ||
+	     guest_cpuid_has(vcpu, X86_FEATURE_AMD_SSBD)))
+		set_msr_interception(svm->msrpm, MSR_IA32_SPEC_CTRL, 1, 1);
+	if (vcpu->kvm->arch.msr_passthrough & KVM_X86_MSR_PASSTHROUGH_PRED_CMD &&
+	    guest_cpuid_has(vcpu, X86_FEATURE_AMD_IBPB))
+		set_msr_interception(svm->msrpm, MSR_IA32_PRED_CMD, 0, 1);
+
 	if (!kvm_vcpu_apicv_active(vcpu))
 		return;
 
@@ -4078,7 +4135,7 @@ static struct kvm_x86_ops svm_x86_ops __initdata = {
 	.set_rflags = svm_set_rflags,
 
 	.tlb_flush_all = svm_flush_tlb,
-	.tlb_flush_current = svm_flush_tlb,
+	.tlb_flush_current = svm_flush_tlb_current,
 	.tlb_flush_gva = svm_flush_tlb_gva,
 	.tlb_flush_guest = svm_flush_tlb,
 
@@ -4164,14 +4221,28 @@ static struct kvm_x86_init_ops svm_init_ops __initdata = {
 
 static int __init svm_init(void)
 {
+	int r;
+
 	__unused_size_checks();
 
-	return kvm_init(&svm_init_ops, sizeof(struct vcpu_svm),
-			__alignof__(struct vcpu_svm), THIS_MODULE);
+	r = kvm_init(&svm_init_ops, sizeof(struct vcpu_svm),
+		     __alignof__(struct vcpu_svm), THIS_MODULE);
+	if (r)
+		return r;
+
+	/* kvm_debugfs_dir only exists once kvm_init() has succeeded */
+	if (sev)
+		sev_debugfs_init();
+
+	if (lat_hist_register(&lat_hist_svm_exit))
+		pr_warn("kvm: failed to register latency histogram\n");
+
+	return 0;
 }
 
 static void __exit svm_exit(void)
 {
+	lat_hist_unregister(&lat_hist_svm_exit);
 	kvm_exit();
 }
 
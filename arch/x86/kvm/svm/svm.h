@@ -65,8 +65,16 @@ struct kvm_sev_info {
 	int fd;			/* SEV device fd */
 	unsigned long pages_locked; /* Number of pages locked */
 	struct list_head regions_list;  /* List of registered regions */
+	struct page *dbg_bounce; /* Bounce buffer for the vectored DBG commands */
+	unsigned int dbg_bounce_order;
 };
 
+/*
+ * 0xff is broadcast, so the max index allowed for physical APIC ID
+ * table is 0xfe.  APIC IDs above 0xff are reserved.
+ */
+#define AVIC_MAX_PHYSICAL_ID_COUNT	255
+
 struct kvm_svm {
 	struct kvm kvm;
 
@@ -74,6 +82,8 @@ struct kvm_svm {
 	u32 avic_vm_id;
 	struct page *avic_logical_id_table_page;
 	struct page *avic_physical_id_table_page;
+	/* vCPU for each physical APIC ID, shadows the physical ID table */
+	struct kvm_vcpu *avic_physical_id_vcpus[AVIC_MAX_PHYSICAL_ID_COUNT];
 	struct hlist_node hnode;
 
 	struct kvm_sev_info sev_info;
@@ -97,6 +107,17 @@ struct svm_nested_state {
 
 	/* cache for control fields of the guest */
 	struct vmcb_control_area ctl;
+
+	/*
+	 * ASID of the level that is not running: L2's while in L1, L1's
+	 * while in guest mode.  The two levels never share TLB entries.
+	 */
+	u32 asid;
+	u64 asid_generation;
+
+	/* ASID and nCR3 of the nested guest at the last VMRUN */
+	u32 last_asid;
+	u64 last_nested_cr3;
 };
 
 struct vcpu_svm {
@@ -488,5 +509,6 @@ int svm_unregister_enc_region(struct kvm *kvm,
 void pre_sev_run(struct vcpu_svm *svm, int cpu);
 int __init sev_hardware_setup(void);
 void sev_hardware_teardown(void);
+void sev_debugfs_init(void);
 
 #endif
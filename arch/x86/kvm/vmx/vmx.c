@@ -26,6 +26,7 @@
 #include <linux/sched/smt.h>
 #include <linux/slab.h>
 #include <linux/tboot.h>
+#include <linux/tick.h>
 #include <linux/trace_events.h>
 #include <linux/entry-kvm.h>
 
@@ -6443,6 +6444,10 @@ static void handle_external_interrupt_irqoff(struct kvm_vcpu *vcpu)
 
 	vector = intr_info & INTR_INFO_VECTOR_MASK;
 	desc = (gate_desc *)host_idt_base + vector;
+
+	/* Account VM exits caused by the host tick, see tick_nohz_guest_enter(). */
+	if (vector == LOCAL_TIMER_VECTOR && !tick_nohz_tick_stopped())
+		++vcpu->stat.host_tick_exits;
 	entry = gate_offset(desc);
 
 	kvm_before_interrupt(vcpu);
@@ -7981,6 +7986,7 @@ static struct kvm_x86_ops vmx_x86_ops __initdata = {
 	.slot_disable_log_dirty = vmx_slot_disable_log_dirty,
 	.flush_log_dirty = vmx_flush_log_dirty,
 	.enable_log_dirty_pt_masked = vmx_enable_log_dirty_pt_masked,
+	.cpu_dirty_log_size = PML_ENTITY_NUM,
 
 	.pre_block = vmx_pre_block,
 	.post_block = vmx_post_block,
@@ -8122,6 +8128,7 @@ static __init int hardware_setup(void)
 		vmx_x86_ops.slot_disable_log_dirty = NULL;
 		vmx_x86_ops.flush_log_dirty = NULL;
 		vmx_x86_ops.enable_log_dirty_pt_masked = NULL;
+		vmx_x86_ops.cpu_dirty_log_size = 0;
 	}
 
 	if (!cpu_has_vmx_preemption_timer())
@@ -195,6 +195,10 @@ static u64 __read_mostly host_xss;
 u64 __read_mostly supported_xss;
 EXPORT_SYMBOL_GPL(supported_xss);
 
+/* KVM_X86_MSR_PASSTHROUGH_* flags the vendor module can honor */
+u32 __read_mostly kvm_msr_passthrough_supported;
+EXPORT_SYMBOL_GPL(kvm_msr_passthrough_supported);
+
 struct kvm_stats_debugfs_item debugfs_entries[] = {
 	VCPU_STAT("pf_fixed", pf_fixed),
 	VCPU_STAT("pf_guest", pf_guest),
@@ -214,6 +218,7 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	VCPU_STAT("hypercalls", hypercalls),
 	VCPU_STAT("request_irq", request_irq_exits),
 	VCPU_STAT("irq_exits", irq_exits),
+	VCPU_STAT("host_tick_exits", host_tick_exits),
 	VCPU_STAT("host_state_reload", host_state_reload),
 	VCPU_STAT("fpu_reload", fpu_reload),
 	VCPU_STAT("insn_emulation", insn_emulation),
@@ -222,8 +227,18 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	VCPU_STAT("nmi_injections", nmi_injections),
 	VCPU_STAT("req_event", req_event),
 	VCPU_STAT("l1d_flush", l1d_flush),
-	VCPU_STAT("halt_poll_success_ns", halt_poll_success_ns),
-	VCPU_STAT("halt_poll_fail_ns", halt_poll_fail_ns),
+	VCPU_STAT("halt_poll_success_ns", halt_poll_success_ns,
+		  .stats_flags = KVM_STATS_UNIT_SECONDS, .stats_exponent = -9),
+	VCPU_STAT("halt_poll_fail_ns", halt_poll_fail_ns,
+		  .stats_flags = KVM_STATS_UNIT_SECONDS, .stats_exponent = -9),
+	VCPU_STAT("avic_ipi_invalid_int_type", avic_ipi_invalid_int_type),
+	VCPU_STAT("avic_ipi_target_not_running", avic_ipi_target_not_running),
+	VCPU_STAT("avic_ipi_invalid_target", avic_ipi_invalid_target),
+	VCPU_STAT("avic_ipi_invalid_backing_page", avic_ipi_invalid_backing_page),
+	VCPU_STAT("avic_ipi_fast_path", avic_ipi_fast_path),
+	VCPU_STAT("pmu_reprogram", pmu_reprogram),
+	VCPU_STAT("pmu_event_create", pmu_event_create),
+	VCPU_STAT("pmu_event_reuse", pmu_event_reuse),
 	VM_STAT("mmu_shadow_zapped", mmu_shadow_zapped),
 	VM_STAT("mmu_pte_write", mmu_pte_write),
 	VM_STAT("mmu_pte_updated", mmu_pte_updated),
@@ -231,11 +246,14 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	VM_STAT("mmu_flooded", mmu_flooded),
 	VM_STAT("mmu_recycled", mmu_recycled),
 	VM_STAT("mmu_cache_miss", mmu_cache_miss),
-	VM_STAT("mmu_unsync", mmu_unsync),
+	VM_STAT("mmu_unsync", mmu_unsync, .stats_flags = KVM_STATS_TYPE_INSTANT),
 	VM_STAT("remote_tlb_flush", remote_tlb_flush),
-	VM_STAT("largepages", lpages, .mode = 0444),
-	VM_STAT("nx_largepages_splitted", nx_lpage_splits, .mode = 0444),
-	VM_STAT("max_mmu_page_hash_collisions", max_mmu_page_hash_collisions),
+	VM_STAT("largepages", lpages, .mode = 0444,
+		.stats_flags = KVM_STATS_TYPE_INSTANT),
+	VM_STAT("nx_largepages_splitted", nx_lpage_splits, .mode = 0444,
+		.stats_flags = KVM_STATS_TYPE_INSTANT),
+	VM_STAT("max_mmu_page_hash_collisions", max_mmu_page_hash_collisions,
+		.stats_flags = KVM_STATS_TYPE_PEAK),
 	{ NULL }
 };
 
@@ -1588,11 +1606,42 @@ int kvm_set_msr(struct kvm_vcpu *vcpu, u32 index, u64 data)
 }
 EXPORT_SYMBOL_GPL(kvm_set_msr);
 
+/*
+ * Count the MSR accesses that exited, per index, for the msr_exits debugfs
+ * file.  The table is only written by the vCPU thread; MSRs that do not find
+ * a slot within a few probes are counted together.
+ */
+static void kvm_account_msr_exit(struct kvm_vcpu *vcpu, u32 msr, bool write,
+				 bool fastpath)
+{
+	struct kvm_msr_exit_stat *stat;
+	u32 i, slot = hash_32(msr, ilog2(KVM_MSR_EXIT_STATS));
+
+	for (i = 0; i < KVM_MSR_EXIT_PROBES; i++) {
+		stat = &vcpu->arch.msr_exits[(slot + i) % KVM_MSR_EXIT_STATS];
+		if (stat->index != msr && (stat->reads || stat->writes))
+			continue;
+
+		stat->index = msr;
+		if (write)
+			stat->writes++;
+		else
+			stat->reads++;
+		if (fastpath)
+			stat->fastpath++;
+		return;
+	}
+
+	vcpu->arch.msr_exits_other++;
+}
+
 int kvm_emulate_rdmsr(struct kvm_vcpu *vcpu)
 {
 	u32 ecx = kvm_rcx_read(vcpu);
 	u64 data;
 
+	kvm_account_msr_exit(vcpu, ecx, false, false);
+
 	if (kvm_get_msr(vcpu, ecx, &data)) {
 		trace_kvm_msr_read_ex(ecx);
 		kvm_inject_gp(vcpu, 0);
@@ -1612,6 +1661,8 @@ int kvm_emulate_wrmsr(struct kvm_vcpu *vcpu)
 	u32 ecx = kvm_rcx_read(vcpu);
 	u64 data = kvm_read_edx_eax(vcpu);
 
+	kvm_account_msr_exit(vcpu, ecx, true, false);
+
 	if (kvm_set_msr(vcpu, ecx, data)) {
 		trace_kvm_msr_write_ex(ecx, data);
 		kvm_inject_gp(vcpu, 0);
@@ -1658,6 +1709,23 @@ static int handle_fastpath_set_x2apic_icr_irqoff(struct kvm_vcpu *vcpu, u64 data
 	return 1;
 }
 
+/*
+ * EOIs are as frequent as interrupts, and an x2APIC guest cannot avoid the
+ * exit without APICv.  Handle the common case of an edge-triggered vector
+ * that nobody else tracks straight from the exit.
+ */
+static int handle_fastpath_set_x2apic_eoi(struct kvm_vcpu *vcpu, u64 data)
+{
+	if (!lapic_in_kernel(vcpu) || !apic_x2apic_mode(vcpu->arch.apic))
+		return 1;
+
+	/* A non-zero EOI write is a #GP, leave it to the slow path */
+	if (data)
+		return 1;
+
+	return kvm_x2apic_fastpath_eoi(vcpu);
+}
+
 static int handle_fastpath_set_tscdeadline(struct kvm_vcpu *vcpu, u64 data)
 {
 	if (!kvm_can_use_hv_timer(vcpu))
@@ -1681,6 +1749,13 @@ fastpath_t handle_fastpath_set_msr_irqoff(struct kvm_vcpu *vcpu)
 			ret = EXIT_FASTPATH_EXIT_HANDLED;
 		}
 		break;
+	case APIC_BASE_MSR + (APIC_EOI >> 4):
+		data = kvm_read_edx_eax(vcpu);
+		if (!handle_fastpath_set_x2apic_eoi(vcpu, data)) {
+			kvm_skip_emulated_instruction(vcpu);
+			ret = EXIT_FASTPATH_EXIT_HANDLED;
+		}
+		break;
 	case MSR_IA32_TSCDEADLINE:
 		data = kvm_read_edx_eax(vcpu);
 		if (!handle_fastpath_set_tscdeadline(vcpu, data)) {
@@ -1692,8 +1767,10 @@ fastpath_t handle_fastpath_set_msr_irqoff(struct kvm_vcpu *vcpu)
 		break;
 	}
 
-	if (ret != EXIT_FASTPATH_NONE)
+	if (ret != EXIT_FASTPATH_NONE) {
+		kvm_account_msr_exit(vcpu, msr, true, true);
 		trace_kvm_msr_write(msr, data);
+	}
 
 	return ret;
 }
@@ -3530,6 +3607,9 @@ int kvm_vm_ioctl_check_extension(struct kvm *kvm, long ext)
 		if(kvm_can_mwait_in_guest())
 			r |= KVM_X86_DISABLE_EXITS_MWAIT;
 		break;
+	case KVM_CAP_X86_MSR_PASSTHROUGH:
+		r = kvm_msr_passthrough_supported;
+		break;
 	case KVM_CAP_X86_SMM:
 		/* SMBASE is usually relocated above 1M on modern chipsets,
 		 * and SMM handlers might indeed rely on 4G segment limits,
@@ -5033,6 +5113,20 @@ split_irqchip_unlock:
 		kvm->arch.exception_payload_enabled = cap->args[0];
 		r = 0;
 		break;
+	case KVM_CAP_X86_MSR_PASSTHROUGH:
+		r = -EINVAL;
+		if (cap->args[0] & ~kvm_msr_passthrough_supported)
+			break;
+
+		mutex_lock(&kvm->lock);
+		r = -EBUSY;
+		if (!kvm->created_vcpus) {
+			kvm->arch.msr_passthrough_policy = true;
+			kvm->arch.msr_passthrough = cap->args[0];
+			r = 0;
+		}
+		mutex_unlock(&kvm->lock);
+		break;
 	default:
 		r = -EINVAL;
 		break;
@@ -6696,9 +6790,9 @@ static bool reexecute_instruction(struct kvm_vcpu *vcpu, gpa_t cr2_or_gpa,
 	if (vcpu->arch.mmu->direct_map) {
 		unsigned int indirect_shadow_pages;
 
-		spin_lock(&vcpu->kvm->mmu_lock);
+		write_lock(&vcpu->kvm->mmu_lock);
 		indirect_shadow_pages = vcpu->kvm->arch.indirect_shadow_pages;
-		spin_unlock(&vcpu->kvm->mmu_lock);
+		write_unlock(&vcpu->kvm->mmu_lock);
 
 		if (indirect_shadow_pages)
 			kvm_mmu_unprotect_page(vcpu->kvm, gpa_to_gfn(gpa));
@@ -8364,6 +8458,14 @@ static int vcpu_enter_guest(struct kvm_vcpu *vcpu)
 
 	bool req_immediate_exit = false;
 
+	/* Forbid vmenter if vcpu dirty ring is soft-full */
+	if (unlikely(vcpu->kvm->dirty_ring_size &&
+		     kvm_dirty_ring_soft_full(&vcpu->dirty_ring))) {
+		vcpu->run->exit_reason = KVM_EXIT_DIRTY_RING_FULL;
+		r = 0;
+		goto out;
+	}
+
 	if (kvm_request_pending(vcpu)) {
 		if (kvm_check_request(KVM_REQ_GET_VMCS12_PAGES, vcpu)) {
 			if (unlikely(!kvm_x86_ops.nested_ops->get_vmcs12_pages(vcpu))) {
@@ -9804,6 +9906,7 @@ int kvm_arch_hardware_setup(void *opaque)
 	if (boot_cpu_has(X86_FEATURE_XSAVES))
 		rdmsrl(MSR_IA32_XSS, host_xss);
 
+	kvm_msr_passthrough_supported = 0;
 	r = ops->hardware_setup();
 	if (r != 0)
 		return r;
@@ -10228,6 +10331,15 @@ static void kvm_mmu_slot_apply_flags(struct kvm *kvm,
 	 * is enabled the D-bit or the W-bit will be cleared.
 	 */
 	if (new->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+		/*
+		 * Split huge pages upfront rather than on the first write of
+		 * each, which would stall the vCPUs for the whole first pass
+		 * of a migration.  With initial-all-set the split is left to
+		 * the first write, like the write protection of small pages.
+		 */
+		if (!kvm_dirty_log_manual_protect_and_init_set(kvm))
+			kvm_mmu_slot_try_split_huge_pages(kvm, new);
+
 		if (kvm_x86_ops.slot_enable_log_dirty) {
 			kvm_x86_ops.slot_enable_log_dirty(kvm, new);
 		} else {
@@ -10334,6 +10446,11 @@ int kvm_arch_vcpu_runnable(struct kvm_vcpu *vcpu)
 	return kvm_vcpu_running(vcpu) || kvm_vcpu_has_events(vcpu);
 }
 
+int kvm_cpu_dirty_log_size(void)
+{
+	return kvm_x86_ops.cpu_dirty_log_size;
+}
+
 bool kvm_arch_dy_runnable(struct kvm_vcpu *vcpu)
 {
 	if (READ_ONCE(vcpu->arch.pv.pv_unhalted))
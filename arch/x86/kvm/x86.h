@@ -280,6 +280,7 @@ fastpath_t handle_fastpath_set_msr_irqoff(struct kvm_vcpu *vcpu);
 extern u64 host_xcr0;
 extern u64 supported_xcr0;
 extern u64 supported_xss;
+extern u32 kvm_msr_passthrough_supported;
 
 static inline bool kvm_mpx_supported(void)
 {
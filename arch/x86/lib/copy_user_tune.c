@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Size-class dispatch for large user copies.
+ *
+ * copy_user_generic() picks one copy routine for all sizes at boot through
+ * alternatives.  That is the right thing for the short copies which make up
+ * most of the calls, but the best routine for longer copies depends on the
+ * CPU: on Zen without FSRM, rep movsb loses against rep movsq for copies of
+ * a few KB, and the unrolled loop can win in between.  Copies of at least
+ * COPY_USER_TUNED_MIN bytes made through raw_copy_to_user_stream() are
+ * instead dispatched through a small table indexed by size class.
+ *
+ * The table starts out with per-model defaults and is tuned at boot by
+ * timing each routine on kernel buffers.  When the whole transfer a copy
+ * belongs to exceeds a quarter of the LLC, non-temporal stores are used
+ * instead, so that streaming a large file to user space doesn't evict the
+ * working set of everything else sharing the cache.
+ */
+#include <linux/cacheinfo.h>
+#include <linux/export.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/sizes.h>
+#include <linux/timex.h>
+#include <linux/uaccess.h>
+
+enum copy_user_strategy {
+	COPY_USER_UNROLLED,
+	COPY_USER_STRING,
+	COPY_USER_ERMS,
+	NR_COPY_USER_STRATEGIES,
+};
+
+static const char * const copy_user_names[NR_COPY_USER_STRATEGIES] = {
+	[COPY_USER_UNROLLED]	= "unrolled",
+	[COPY_USER_STRING]	= "rep movsq",
+	[COPY_USER_ERMS]	= "rep movsb",
+};
+
+/* Size classes: [256, 1K), [1K, 4K), [4K, 16K) and 16K or more */
+#define COPY_USER_NR_CLASSES	4
+
+static u8 copy_user_dispatch[COPY_USER_NR_CLASSES] __ro_after_init;
+
+/* Transfers of at least this many bytes use non-temporal stores, 0 = never */
+static unsigned long copy_user_nocache_min __ro_after_init;
+
+static bool copy_user_tune_enabled __initdata = true;
+
+static int __init copy_user_tune_setup(char *str)
+{
+	copy_user_tune_enabled = false;
+	return 1;
+}
+__setup("nocopy_user_tune", copy_user_tune_setup);
+
+static __always_inline unsigned int copy_user_class(unsigned int len)
+{
+	return min_t(unsigned int, (ilog2(len) - ilog2(COPY_USER_TUNED_MIN)) / 2,
+		     COPY_USER_NR_CLASSES - 1);
+}
+
+static __always_inline unsigned long
+copy_user_strategy(enum copy_user_strategy s, void *to, const void *from,
+		   unsigned int len)
+{
+	switch (s) {
+	case COPY_USER_ERMS:
+		return copy_user_enhanced_fast_string(to, from, len);
+	case COPY_USER_STRING:
+		return copy_user_generic_string(to, from, len);
+	default:
+		return copy_user_generic_unrolled(to, from, len);
+	}
+}
+
+/**
+ * copy_user_tuned - copy a long user buffer with the tuned routine
+ * @to:		destination
+ * @from:	source
+ * @len:	number of bytes to copy, at least COPY_USER_TUNED_MIN
+ * @stream:	length of the whole transfer @len is part of
+ *
+ * Returns the number of bytes that could not be copied, like
+ * copy_user_generic().
+ */
+unsigned long copy_user_tuned(void *to, const void *from, unsigned int len,
+			      unsigned long stream)
+{
+	if (copy_user_nocache_min && stream >= copy_user_nocache_min)
+		return __copy_user_nocache(to, (__force const void __user *)from,
+					   len, 0);
+
+	return copy_user_strategy(copy_user_dispatch[copy_user_class(len)],
+				  to, from, len);
+}
+EXPORT_SYMBOL(copy_user_tuned);
+
+static bool copy_user_usable(enum copy_user_strategy s)
+{
+	switch (s) {
+	case COPY_USER_ERMS:
+		return boot_cpu_has(X86_FEATURE_ERMS);
+	case COPY_USER_STRING:
+		return boot_cpu_has(X86_FEATURE_REP_GOOD);
+	default:
+		return true;
+	}
+}
+
+#if IS_ENABLED(CONFIG_TEST_USER_COPY)
+/*
+ * test_user_copy runs each routine copy_user_tuned() can pick, the last
+ * one being __copy_user_nocache(), in both directions.
+ */
+const char *copy_user_routine_name(unsigned int r)
+{
+	BUILD_BUG_ON(COPY_USER_NR_ROUTINES != NR_COPY_USER_STRATEGIES + 1);
+
+	if (r == NR_COPY_USER_STRATEGIES)
+		return "nocache";
+	if (r > NR_COPY_USER_STRATEGIES || !copy_user_usable(r))
+		return NULL;
+	return copy_user_names[r];
+}
+EXPORT_SYMBOL_GPL(copy_user_routine_name);
+
+unsigned long copy_user_routine(unsigned int r, void *to, const void *from,
+				unsigned int len)
+{
+	if (r == NR_COPY_USER_STRATEGIES)
+		return __copy_user_nocache(to, (__force const void __user *)from,
+					   len, 0);
+
+	return copy_user_strategy(r, to, from, len);
+}
+EXPORT_SYMBOL_GPL(copy_user_routine);
+#endif
+
+/*
+ * Same choice as the alternatives in copy_user_generic(), except that on
+ * Zen without FSRM rep movsq is preferred below a page, where rep movsb has
+ * a high startup cost.
+ */
+static int __init copy_user_dispatch_init(void)
+{
+	enum copy_user_strategy s = COPY_USER_UNROLLED;
+	int i;
+
+	if (boot_cpu_has(X86_FEATURE_ERMS))
+		s = COPY_USER_ERMS;
+	else if (boot_cpu_has(X86_FEATURE_REP_GOOD))
+		s = COPY_USER_STRING;
+
+	for (i = 0; i < COPY_USER_NR_CLASSES; i++)
+		copy_user_dispatch[i] = s;
+
+	if (boot_cpu_has(X86_FEATURE_ZEN) && !boot_cpu_has(X86_FEATURE_FSRM) &&
+	    boot_cpu_has(X86_FEATURE_REP_GOOD)) {
+		for (i = 0; i < copy_user_class(PAGE_SIZE); i++)
+			copy_user_dispatch[i] = COPY_USER_STRING;
+	}
+
+	return 0;
+}
+early_initcall(copy_user_dispatch_init);
+
+static unsigned long __init copy_user_llc_size(void)
+{
+	struct cpu_cacheinfo *ci = get_cpu_cacheinfo(0);
+	unsigned int i, level = 0;
+	unsigned long size = 0;
+
+	for (i = 0; ci && i < ci->num_leaves; i++) {
+		struct cacheinfo *leaf = ci->info_list + i;
+
+		if (leaf->type != CACHE_TYPE_INST && leaf->level > level) {
+			level = leaf->level;
+			size = leaf->size;
+		}
+	}
+
+	return size ?: (unsigned long)boot_cpu_data.x86_cache_size * SZ_1K;
+}
+
+#define COPY_USER_TUNE_BYTES	SZ_1M
+#define COPY_USER_TUNE_RUNS	3
+
+/* Best time in cycles to copy COPY_USER_TUNE_BYTES in chunks of @len */
+static u64 __init copy_user_time(enum copy_user_strategy s, void *dst,
+				 void *src, unsigned int len)
+{
+	u64 best = U64_MAX;
+	int run, i;
+
+	for (run = 0; run < COPY_USER_TUNE_RUNS; run++) {
+		cycles_t start;
+
+		preempt_disable();
+		start = get_cycles();
+		for (i = 0; i < COPY_USER_TUNE_BYTES / len; i++)
+			copy_user_strategy(s, dst, src, len);
+		best = min_t(u64, best, get_cycles() - start);
+		preempt_enable();
+		cond_resched();
+	}
+
+	return best;
+}
+
+static int __init copy_user_tune(void)
+{
+	unsigned int len = COPY_USER_TUNED_MIN * 2;
+	void *src, *dst;
+	int order, i, s;
+
+	copy_user_nocache_min = copy_user_llc_size() / 4;
+
+	if (!copy_user_tune_enabled || !boot_cpu_has(X86_FEATURE_TSC))
+		return 0;
+
+	/* Largest chunk: the middle of the last, open-ended size class */
+	order = get_order(len << (2 * (COPY_USER_NR_CLASSES - 1)));
+	src = (void *)__get_free_pages(GFP_KERNEL, order);
+	dst = (void *)__get_free_pages(GFP_KERNEL, order);
+	if (!src || !dst)
+		goto out;
+
+	memset(src, 0x5a, PAGE_SIZE << order);
+
+	for (i = 0; i < COPY_USER_NR_CLASSES; i++, len <<= 2) {
+		u64 t, best = U64_MAX;
+
+		for (s = 0; s < NR_COPY_USER_STRATEGIES; s++) {
+			if (!copy_user_usable(s))
+				continue;
+
+			memset(dst, 0, len);
+			t = copy_user_time(s, dst, src, len);
+			if (WARN(memcmp(dst, src, len), "%s copy_user is broken\n",
+				 copy_user_names[s]))
+				continue;
+
+			pr_debug("copy_user: %u bytes, %s: %llu cycles\n", len,
+				 copy_user_names[s], t);
+			if (t < best) {
+				best = t;
+				copy_user_dispatch[i] = s;
+			}
+		}
+
+		pr_info("copy_user: using %s for %u byte copies\n",
+			copy_user_names[copy_user_dispatch[i]], len);
+	}
+
+out:
+	free_pages((unsigned long)dst, order);
+	free_pages((unsigned long)src, order);
+	return 0;
+}
+late_initcall(copy_user_tune);
@@ -1220,6 +1220,20 @@ void do_user_addr_fault(struct pt_regs *regs,
 	}
 #endif
 
+	/*
+	 * Faults on not-present pages from user space can often be handled
+	 * without mmap_lock. Protection key faults and write faults on
+	 * present pages always need the VMA to be stable.
+	 */
+	if ((flags & FAULT_FLAG_USER) &&
+	    !(hw_error_code & (X86_PF_PROT | X86_PF_PK))) {
+		fault = handle_speculative_fault(mm, address, flags, regs);
+		if (!(fault & VM_FAULT_RETRY)) {
+			check_v8086_mode(regs, address, tsk);
+			return;
+		}
+	}
+
 	/*
 	 * Kernel-mode access to the user address space should only occur
 	 * on well-defined single instructions listed in the exception
@@ -76,6 +76,8 @@ static inline pgprot_t cachemode2pgprot(enum page_cache_mode pcm)
 
 #ifdef CONFIG_PROC_FS
 static unsigned long direct_pages_count[PG_LEVEL_NUM];
+/* Large direct map pages split to change the encryption attribute */
+static unsigned long direct_pages_enc_splits[PG_LEVEL_NUM];
 
 void update_page_count(int level, unsigned long pages)
 {
@@ -85,13 +87,16 @@ void update_page_count(int level, unsigned long pages)
 	spin_unlock(&pgd_lock);
 }
 
-static void split_page_count(int level)
+static void split_page_count(struct cpa_data *cpa, int level)
 {
 	if (direct_pages_count[level] == 0)
 		return;
 
 	direct_pages_count[level]--;
 	direct_pages_count[level - 1] += PTRS_PER_PTE;
+
+	if ((pgprot_val(cpa->mask_set) | pgprot_val(cpa->mask_clr)) & _PAGE_ENC)
+		direct_pages_enc_splits[level]++;
 }
 
 void arch_report_meminfo(struct seq_file *m)
@@ -108,9 +113,16 @@ void arch_report_meminfo(struct seq_file *m)
 	if (direct_gbpages)
 		seq_printf(m, "DirectMap1G:    %8lu kB\n",
 			direct_pages_count[PG_LEVEL_1G] << 20);
+	if (mem_encrypt_active()) {
+		seq_printf(m, "DirectMapEncSplit2M: %8lu\n",
+			direct_pages_enc_splits[PG_LEVEL_2M]);
+		if (direct_gbpages)
+			seq_printf(m, "DirectMapEncSplit1G: %8lu\n",
+				direct_pages_enc_splits[PG_LEVEL_1G]);
+	}
 }
 #else
-static inline void split_page_count(int level) { }
+static inline void split_page_count(struct cpa_data *cpa, int level) { }
 #endif
 
 #ifdef CONFIG_X86_CPA_STATISTICS
@@ -1025,7 +1037,7 @@ __split_large_page(struct cpa_data *cpa, pte_t *kpte, unsigned long address,
 		unsigned long pfn = PFN_DOWN(__pa(address));
 
 		if (pfn_range_is_mapped(pfn, pfn + 1))
-			split_page_count(level);
+			split_page_count(cpa, level);
 	}
 
 	/*
@@ -1972,25 +1984,13 @@ int set_memory_global(unsigned long addr, int numpages)
 				    __pgprot(_PAGE_GLOBAL), 0);
 }
 
-static int __set_memory_enc_dec(unsigned long addr, int numpages, bool enc)
+static int __cpa_enc_dec(struct cpa_data *cpa, bool enc)
 {
-	struct cpa_data cpa;
 	int ret;
 
-	/* Nothing to do if memory encryption is not active */
-	if (!mem_encrypt_active())
-		return 0;
-
-	/* Should not be working on unaligned addresses */
-	if (WARN_ONCE(addr & ~PAGE_MASK, "misaligned address: %#lx\n", addr))
-		addr &= PAGE_MASK;
-
-	memset(&cpa, 0, sizeof(cpa));
-	cpa.vaddr = &addr;
-	cpa.numpages = numpages;
-	cpa.mask_set = enc ? __pgprot(_PAGE_ENC) : __pgprot(0);
-	cpa.mask_clr = enc ? __pgprot(0) : __pgprot(_PAGE_ENC);
-	cpa.pgd = init_mm.pgd;
+	cpa->mask_set = enc ? __pgprot(_PAGE_ENC) : __pgprot(0);
+	cpa->mask_clr = enc ? __pgprot(0) : __pgprot(_PAGE_ENC);
+	cpa->pgd = init_mm.pgd;
 
 	/* Must avoid aliasing mappings in the highmem code */
 	kmap_flush_unused();
@@ -1999,9 +1999,9 @@ static int __set_memory_enc_dec(unsigned long addr, int numpages, bool enc)
 	/*
 	 * Before changing the encryption attribute, we need to flush caches.
 	 */
-	cpa_flush(&cpa, 1);
+	cpa_flush(cpa, 1);
 
-	ret = __change_page_attr_set_clr(&cpa, 1);
+	ret = __change_page_attr_set_clr(cpa, 1);
 
 	/*
 	 * After changing the encryption attribute, we need to flush TLBs again
@@ -2010,11 +2010,51 @@ static int __set_memory_enc_dec(unsigned long addr, int numpages, bool enc)
 	 * flushing gets optimized in the cpa_flush() path use the same logic
 	 * as above.
 	 */
-	cpa_flush(&cpa, 0);
+	cpa_flush(cpa, 0);
 
 	return ret;
 }
 
+static int __set_memory_enc_dec(unsigned long addr, int numpages, bool enc)
+{
+	struct cpa_data cpa;
+
+	/* Nothing to do if memory encryption is not active */
+	if (!mem_encrypt_active())
+		return 0;
+
+	/* Should not be working on unaligned addresses */
+	if (WARN_ONCE(addr & ~PAGE_MASK, "misaligned address: %#lx\n", addr))
+		addr &= PAGE_MASK;
+
+	memset(&cpa, 0, sizeof(cpa));
+	cpa.vaddr = &addr;
+	cpa.numpages = numpages;
+
+	return __cpa_enc_dec(&cpa, enc);
+}
+
+/*
+ * Convert many, possibly discontiguous, pages with a single cache flush
+ * before and a single TLB flush after the conversion, instead of paying
+ * both for every page as separate set_memory_{en,de}crypted() calls would.
+ */
+static int __set_pages_array_enc_dec(struct page **pages, int numpages,
+				     bool enc)
+{
+	struct cpa_data cpa;
+
+	if (!mem_encrypt_active() || !numpages)
+		return 0;
+
+	memset(&cpa, 0, sizeof(cpa));
+	cpa.pages = pages;
+	cpa.numpages = numpages;
+	cpa.flags = CPA_PAGES_ARRAY;
+
+	return __cpa_enc_dec(&cpa, enc);
+}
+
 int set_memory_encrypted(unsigned long addr, int numpages)
 {
 	return __set_memory_enc_dec(addr, numpages, true);
@@ -2027,6 +2067,18 @@ int set_memory_decrypted(unsigned long addr, int numpages)
 }
 EXPORT_SYMBOL_GPL(set_memory_decrypted);
 
+int set_pages_array_encrypted(struct page **pages, int numpages)
+{
+	return __set_pages_array_enc_dec(pages, numpages, true);
+}
+EXPORT_SYMBOL_GPL(set_pages_array_encrypted);
+
+int set_pages_array_decrypted(struct page **pages, int numpages)
+{
+	return __set_pages_array_enc_dec(pages, numpages, false);
+}
+EXPORT_SYMBOL_GPL(set_pages_array_decrypted);
+
 int set_pages_uc(struct page *page, int numpages)
 {
 	unsigned long addr = (unsigned long)page_address(page);
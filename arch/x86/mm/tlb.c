@@ -856,6 +856,55 @@ void flush_tlb_others(const struct cpumask *cpumask,
 	__flush_tlb_others(cpumask, info);
 }
 
+unsigned int invlpgb_count_max __ro_after_init = 1;
+
+/*
+ * The PCID an mm uses differs between CPUs, so a broadcast flush of user
+ * addresses has to match all PCIDs. That is cheap for a flush of a few
+ * pages, but a full flush would wipe every process on every CPU, so those
+ * still go through IPIs to the CPUs in mm_cpumask.
+ */
+static bool tlb_broadcast_flush_ok(const struct flush_tlb_info *info)
+{
+	/* The PMD stride of INVLPGB is 2M */
+	if (!IS_ENABLED(CONFIG_X86_64) ||
+	    !cpu_feature_enabled(X86_FEATURE_INVLPGB))
+		return false;
+
+	if (info->end == TLB_FLUSH_ALL)
+		return false;
+
+	return info->stride_shift == PAGE_SHIFT ||
+	       info->stride_shift == PMD_SHIFT;
+}
+
+/*
+ * Flush the range of @info on all CPUs with INVLPGB, without interrupting
+ * any of them. The remote CPUs don't update their per-CPU tlb_gen, which
+ * at worst makes their next flush of this mm a full one.
+ */
+static void broadcast_flush_tlb_range(const struct flush_tlb_info *info)
+{
+	unsigned long stride = 1UL << info->stride_shift;
+	bool pmd = info->stride_shift == PMD_SHIFT;
+	u8 flags = INVLPGB_FLAG_VA;
+	unsigned long addr, nr;
+
+	/* Paging-structure caches only need flushing if tables were freed */
+	if (!info->freed_tables)
+		flags |= INVLPGB_FLAG_FINAL_ONLY;
+
+	count_vm_tlb_event(NR_TLB_REMOTE_FLUSH);
+
+	for (addr = round_down(info->start, stride); addr < info->end;
+	     addr += nr * stride) {
+		nr = (info->end - addr + stride - 1) >> info->stride_shift;
+		nr = clamp_val(nr, 1, invlpgb_count_max);
+		__invlpgb(0, addr, nr, pmd, flags);
+	}
+	__tlbsync();
+}
+
 /*
  * See Documentation/x86/tlb.rst for details.  We choose 33
  * because it is large enough to cover the vast majority (at
@@ -939,8 +988,12 @@ void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
 		local_irq_enable();
 	}
 
-	if (cpumask_any_but(mm_cpumask(mm), cpu) < nr_cpu_ids)
-		flush_tlb_others(mm_cpumask(mm), info);
+	if (cpumask_any_but(mm_cpumask(mm), cpu) < nr_cpu_ids) {
+		if (tlb_broadcast_flush_ok(info))
+			broadcast_flush_tlb_range(info);
+		else
+			flush_tlb_others(mm_cpumask(mm), info);
+	}
 
 	put_flush_tlb_info();
 	put_cpu();
@@ -969,11 +1022,36 @@ static void do_kernel_range_flush(void *info)
 		flush_tlb_one_kernel(addr);
 }
 
+static void invlpgb_kernel_range_flush(unsigned long start, unsigned long end)
+{
+	unsigned long addr, nr;
+
+	for (addr = start & PAGE_MASK; addr < end; addr += nr << PAGE_SHIFT) {
+		nr = (end - addr + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		nr = clamp_val(nr, 1, invlpgb_count_max);
+		invlpgb_flush_addr_nosync(addr, nr);
+	}
+	__tlbsync();
+}
+
 void flush_tlb_kernel_range(unsigned long start, unsigned long end)
 {
+	bool full = end == TLB_FLUSH_ALL ||
+		    (end - start) > tlb_single_page_flush_ceiling << PAGE_SHIFT;
+
+	if (cpu_feature_enabled(X86_FEATURE_INVLPGB)) {
+		/* INVLPGB and TLBSYNC have to be issued on the same CPU */
+		preempt_disable();
+		if (full)
+			invlpgb_flush_all();
+		else
+			invlpgb_kernel_range_flush(start, end);
+		preempt_enable();
+		return;
+	}
+
 	/* Balance as user space task's flush, a bit conservative */
-	if (end == TLB_FLUSH_ALL ||
-	    (end - start) > tlb_single_page_flush_ceiling << PAGE_SHIFT) {
+	if (full) {
 		on_each_cpu(do_flush_tlb_all, NULL, 1);
 	} else {
 		struct flush_tlb_info *info;
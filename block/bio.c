@@ -17,6 +17,7 @@
 #include <linux/cgroup.h>
 #include <linux/blk-cgroup.h>
 #include <linux/highmem.h>
+#include <linux/cpuhotplug.h>
 #include <linux/sched/sysctl.h>
 #include <linux/blk-crypto.h>
 
@@ -46,6 +47,18 @@ static struct biovec_slab bvec_slabs[BVEC_POOL_NR] __read_mostly = {
  * IO code that does not need private memory pools.
  */
 struct bio_set fs_bio_set;
+
+/*
+ * Freed bios of a %BIOSET_PERCPU_CACHE bio_set are kept here for reuse by
+ * bio_alloc_kiocb() on the same CPU, up to ALLOC_CACHE_MAX of them.
+ */
+#define ALLOC_CACHE_MAX		512
+#define ALLOC_CACHE_SLACK	64
+
+struct bio_alloc_cache {
+	struct bio_list		free_list;
+	unsigned int		nr;
+};
 EXPORT_SYMBOL(fs_bio_set);
 
 /*
@@ -529,6 +542,42 @@ err_free:
 }
 EXPORT_SYMBOL(bio_alloc_bioset);
 
+/**
+ * bio_alloc_kiocb - Allocate a bio from bio_set based on kiocb
+ * @kiocb:	kiocb describing the IO
+ * @nr_vecs:	number of iovecs to pre-allocate
+ * @bs:		bio_set to allocate from
+ *
+ * Description:
+ *    Like bio_alloc_bioset() with %GFP_KERNEL, but if the kiocb has
+ *    %IOCB_ALLOC_CACHE set and @bs was set up with %BIOSET_PERCPU_CACHE,
+ *    the bio is taken from the per-cpu cache of bios freed by polled
+ *    completions when one is available.
+ */
+struct bio *bio_alloc_kiocb(struct kiocb *kiocb, unsigned int nr_vecs,
+			    struct bio_set *bs)
+{
+	struct bio_alloc_cache *cache;
+	struct bio *bio;
+
+	if (!(kiocb->ki_flags & IOCB_ALLOC_CACHE) || !bs->cache ||
+	    nr_vecs > BIO_INLINE_VECS)
+		return bio_alloc_bioset(GFP_KERNEL, nr_vecs, bs);
+
+	cache = per_cpu_ptr(bs->cache, get_cpu());
+	bio = bio_list_pop(&cache->free_list);
+	if (bio) {
+		cache->nr--;
+		put_cpu();
+		bio_init(bio, nr_vecs ? bio->bi_inline_vecs : NULL, nr_vecs);
+		bio->bi_pool = bs;
+		return bio;
+	}
+	put_cpu();
+	return bio_alloc_bioset(GFP_KERNEL, nr_vecs, bs);
+}
+EXPORT_SYMBOL_GPL(bio_alloc_kiocb);
+
 void zero_fill_bio_iter(struct bio *bio, struct bvec_iter start)
 {
 	unsigned long flags;
@@ -644,19 +693,54 @@ void guard_bio_eod(struct bio *bio)
  *   Put a reference to a &struct bio, either one you have gotten with
  *   bio_alloc, bio_get or bio_clone_*. The last put of a bio will free it.
  **/
+static void bio_alloc_cache_prune(struct bio_set *bs,
+				  struct bio_alloc_cache *cache,
+				  unsigned int nr)
+{
+	struct bio *bio;
+
+	while (nr-- && (bio = bio_list_pop(&cache->free_list))) {
+		cache->nr--;
+		mempool_free((void *)bio - bs->front_pad, &bs->bio_pool);
+	}
+}
+
+/*
+ * Polled bios complete in task context, which lets them be recycled into
+ * the per-cpu cache without disabling interrupts.
+ */
+static bool bio_cache_put(struct bio *bio)
+{
+	struct bio_set *bs = bio->bi_pool;
+	struct bio_alloc_cache *cache;
+
+	if (!bs || !bs->cache || !(bio->bi_opf & REQ_HIPRI) ||
+	    BVEC_POOL_IDX(bio) || in_interrupt())
+		return false;
+
+	bio_uninit(bio);
+	cache = per_cpu_ptr(bs->cache, get_cpu());
+	bio_list_add_head(&cache->free_list, bio);
+	if (++cache->nr > ALLOC_CACHE_MAX + ALLOC_CACHE_SLACK)
+		bio_alloc_cache_prune(bs, cache, ALLOC_CACHE_SLACK);
+	put_cpu();
+	return true;
+}
+
 void bio_put(struct bio *bio)
 {
-	if (!bio_flagged(bio, BIO_REFFED))
-		bio_free(bio);
-	else {
+	if (bio_flagged(bio, BIO_REFFED)) {
 		BIO_BUG_ON(!atomic_read(&bio->__bi_cnt));
 
 		/*
 		 * last put frees it
 		 */
-		if (atomic_dec_and_test(&bio->__bi_cnt))
-			bio_free(bio);
+		if (!atomic_dec_and_test(&bio->__bi_cnt))
+			return;
 	}
+
+	if (!bio_cache_put(bio))
+		bio_free(bio);
 }
 EXPORT_SYMBOL(bio_put);
 
@@ -960,24 +1044,6 @@ void bio_release_pages(struct bio *bio, bool mark_dirty)
 }
 EXPORT_SYMBOL_GPL(bio_release_pages);
 
-static int __bio_iov_bvec_add_pages(struct bio *bio, struct iov_iter *iter)
-{
-	const struct bio_vec *bv = iter->bvec;
-	unsigned int len;
-	size_t size;
-
-	if (WARN_ON_ONCE(iter->iov_offset > bv->bv_len))
-		return -EINVAL;
-
-	len = min_t(size_t, bv->bv_len - iter->iov_offset, iter->count);
-	size = bio_add_page(bio, bv->bv_page, len,
-				bv->bv_offset + iter->iov_offset);
-	if (unlikely(size != len))
-		return -EINVAL;
-	iov_iter_advance(iter, size);
-	return 0;
-}
-
 #define PAGE_PTRS_PER_BVEC     (sizeof(struct bio_vec) / sizeof(struct page *))
 
 /**
@@ -986,47 +1052,40 @@ static int __bio_iov_bvec_add_pages(struct bio *bio, struct iov_iter *iter)
  * @iter: iov iterator describing the region to be mapped
  *
  * Pins pages from *iter and appends them to @bio's bvec array. The
- * pages will have to be released using put_page() when done.
- * For multi-segment *iter, this function only adds pages from the
- * next non-empty segment of the iov iterator.
+ * pages will have to be released using put_page() when done, unless *iter
+ * is a BVEC iterator, whose pages are added without taking a reference.
+ * Pages of several segments of the iov iterator are pinned at once.
  */
 static int __bio_iov_iter_get_pages(struct bio *bio, struct iov_iter *iter)
 {
-	unsigned short nr_pages = bio->bi_max_vecs - bio->bi_vcnt;
-	unsigned short entries_left = bio->bi_max_vecs - bio->bi_vcnt;
+	unsigned int nr_vecs = bio->bi_max_vecs - bio->bi_vcnt;
 	struct bio_vec *bv = bio->bi_io_vec + bio->bi_vcnt;
-	struct page **pages = (struct page **)bv;
+	const bool get_ref = !iov_iter_is_bvec(iter);
 	bool same_page = false;
-	ssize_t size, left;
-	unsigned len, i;
-	size_t offset;
+	ssize_t size;
+	unsigned int i;
 
 	/*
-	 * Move page array up in the allocated memory for the bio vecs as far as
-	 * possible so that we can start filling biovecs from the beginning
-	 * without overwriting the temporary page array.
-	*/
-	BUILD_BUG_ON(PAGE_PTRS_PER_BVEC < 2);
-	pages += entries_left * (PAGE_PTRS_PER_BVEC - 1);
-
-	size = iov_iter_get_pages(iter, pages, LONG_MAX, nr_pages, &offset);
+	 * The pages are returned in the unused part of the bvec array itself.
+	 * Adding them to the bio never writes past the entry being added, as
+	 * merging can only make the array shorter.
+	 */
+	size = iov_iter_get_pages_batch(iter, bv, &nr_vecs, LONG_MAX, get_ref);
 	if (unlikely(size <= 0))
 		return size ? size : -EFAULT;
 
-	for (left = size, i = 0; left > 0; left -= len, i++) {
-		struct page *page = pages[i];
-
-		len = min_t(size_t, PAGE_SIZE - offset, left);
+	for (i = 0; i < nr_vecs; i++) {
+		struct bio_vec v = bv[i];
 
-		if (__bio_try_merge_page(bio, page, len, offset, &same_page)) {
-			if (same_page)
-				put_page(page);
+		if (__bio_try_merge_page(bio, v.bv_page, v.bv_len, v.bv_offset,
+					 &same_page)) {
+			if (same_page && get_ref)
+				put_page(v.bv_page);
 		} else {
-			if (WARN_ON_ONCE(bio_full(bio, len)))
+			if (WARN_ON_ONCE(bio_full(bio, v.bv_len)))
                                 return -EINVAL;
-			__bio_add_page(bio, page, len, offset);
+			__bio_add_page(bio, v.bv_page, v.bv_len, v.bv_offset);
 		}
-		offset = 0;
 	}
 
 	iov_iter_advance(iter, size);
@@ -1111,10 +1170,7 @@ int bio_iov_iter_get_pages(struct bio *bio, struct iov_iter *iter)
 				return -EINVAL;
 			ret = __bio_iov_append_get_pages(bio, iter);
 		} else {
-			if (is_bvec)
-				ret = __bio_iov_bvec_add_pages(bio, iter);
-			else
-				ret = __bio_iov_iter_get_pages(bio, iter);
+			ret = __bio_iov_iter_get_pages(bio, iter);
 		}
 	} while (!ret && iov_iter_count(iter) && !bio_full(bio, 0));
 
@@ -1536,6 +1592,18 @@ int biovec_init_pool(mempool_t *pool, int pool_entries)
  */
 void bioset_exit(struct bio_set *bs)
 {
+	if (bs->cache) {
+		int cpu;
+
+		cpuhp_state_remove_instance_nocalls(CPUHP_BIO_DEAD,
+						    &bs->cpuhp_dead);
+		for_each_possible_cpu(cpu)
+			bio_alloc_cache_prune(bs, per_cpu_ptr(bs->cache, cpu),
+					      -1U);
+		free_percpu(bs->cache);
+		bs->cache = NULL;
+	}
+
 	if (bs->rescue_workqueue)
 		destroy_workqueue(bs->rescue_workqueue);
 	bs->rescue_workqueue = NULL;
@@ -1555,8 +1623,8 @@ EXPORT_SYMBOL(bioset_exit);
  * @bs:		pool to initialize
  * @pool_size:	Number of bio and bio_vecs to cache in the mempool
  * @front_pad:	Number of bytes to allocate in front of the returned bio
- * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS
- *              and %BIOSET_NEED_RESCUER
+ * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS,
+ *              %BIOSET_NEED_RESCUER and %BIOSET_PERCPU_CACHE
  *
  * Description:
  *    Set up a bio_set to be used with @bio_alloc_bioset. Allows the caller
@@ -1569,6 +1637,8 @@ EXPORT_SYMBOL(bioset_exit);
  *    for allocating iovecs.  This pool is not needed e.g. for bio_clone_fast().
  *    If %BIOSET_NEED_RESCUER is set, a workqueue is created which can be used to
  *    dispatch queued requests when the mempool runs out of space.
+ *    If %BIOSET_PERCPU_CACHE is set, bios freed by polled completions are
+ *    kept in per-cpu caches for bio_alloc_kiocb().
  *
  */
 int bioset_init(struct bio_set *bs,
@@ -1579,6 +1649,7 @@ int bioset_init(struct bio_set *bs,
 	unsigned int back_pad = BIO_INLINE_VECS * sizeof(struct bio_vec);
 
 	bs->front_pad = front_pad;
+	bs->cache = NULL;
 
 	spin_lock_init(&bs->rescue_lock);
 	bio_list_init(&bs->rescue_list);
@@ -1595,12 +1666,20 @@ int bioset_init(struct bio_set *bs,
 	    biovec_init_pool(&bs->bvec_pool, pool_size))
 		goto bad;
 
-	if (!(flags & BIOSET_NEED_RESCUER))
-		return 0;
+	if (flags & BIOSET_NEED_RESCUER) {
+		bs->rescue_workqueue = alloc_workqueue("bioset",
+						       WQ_MEM_RECLAIM, 0);
+		if (!bs->rescue_workqueue)
+			goto bad;
+	}
 
-	bs->rescue_workqueue = alloc_workqueue("bioset", WQ_MEM_RECLAIM, 0);
-	if (!bs->rescue_workqueue)
-		goto bad;
+	if (flags & BIOSET_PERCPU_CACHE) {
+		bs->cache = alloc_percpu(struct bio_alloc_cache);
+		if (!bs->cache)
+			goto bad;
+		cpuhp_state_add_instance_nocalls(CPUHP_BIO_DEAD,
+						 &bs->cpuhp_dead);
+	}
 
 	return 0;
 bad:
@@ -1622,6 +1701,8 @@ int bioset_init_from_src(struct bio_set *bs, struct bio_set *src)
 		flags |= BIOSET_NEED_BVECS;
 	if (src->rescue_workqueue)
 		flags |= BIOSET_NEED_RESCUER;
+	if (src->cache)
+		flags |= BIOSET_PERCPU_CACHE;
 
 	return bioset_init(bs, src->bio_pool.min_nr, src->front_pad, flags);
 }
@@ -1646,6 +1727,15 @@ static void __init biovec_init_slabs(void)
 	}
 }
 
+static int bio_cpu_dead(unsigned int cpu, struct hlist_node *node)
+{
+	struct bio_set *bs = hlist_entry_safe(node, struct bio_set,
+					      cpuhp_dead);
+
+	bio_alloc_cache_prune(bs, per_cpu_ptr(bs->cache, cpu), -1U);
+	return 0;
+}
+
 static int __init init_bio(void)
 {
 	bio_slab_max = 2;
@@ -1661,6 +1751,9 @@ static int __init init_bio(void)
 	bio_integrity_init();
 	biovec_init_slabs();
 
+	cpuhp_setup_state_multi(CPUHP_BIO_DEAD, "block/bio:dead", NULL,
+				bio_cpu_dead);
+
 	if (bioset_init(&fs_bio_set, BIO_POOL_SIZE, 0, BIOSET_NEED_BVECS))
 		panic("bio: can't allocate bios\n");
 
@@ -675,6 +675,7 @@ bool bio_attempt_back_merge(struct request *req, struct bio *bio,
 	blk_account_io_merge_bio(req);
 	return true;
 }
+EXPORT_SYMBOL_GPL(bio_attempt_back_merge);
 
 bool bio_attempt_front_merge(struct request *req, struct bio *bio,
 		unsigned int nr_segs)
@@ -701,6 +702,7 @@ bool bio_attempt_front_merge(struct request *req, struct bio *bio,
 	blk_account_io_merge_bio(req);
 	return true;
 }
+EXPORT_SYMBOL_GPL(bio_attempt_front_merge);
 
 bool bio_attempt_discard_merge(struct request_queue *q, struct request *req,
 		struct bio *bio)
@@ -1794,6 +1796,22 @@ EXPORT_SYMBOL(kblockd_mod_delayed_work_on);
  *   this kind of deadlock.
  */
 void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_start_plug_nr_ios - initialize blk_plug for a known number of I/Os
+ * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of I/Os the caller is about to submit
+ *
+ * Description:
+ *   Like blk_start_plug(), but lets the first request allocation of the
+ *   plug get tags for up to @nr_ios requests in one go.  The requests left
+ *   over when the plug finishes are freed.
+ */
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned int nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -1805,7 +1823,9 @@ void blk_start_plug(struct blk_plug *plug)
 
 	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
+	INIT_LIST_HEAD(&plug->cached_rqs);
 	plug->rq_count = 0;
+	plug->nr_ios = min_t(unsigned int, nr_ios, BLK_MAX_REQUEST_COUNT);
 	plug->multiple_queues = false;
 	plug->nowait = false;
 
@@ -1815,7 +1835,7 @@ void blk_start_plug(struct blk_plug *plug)
 	 */
 	tsk->plug = plug;
 }
-EXPORT_SYMBOL(blk_start_plug);
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
 
 static void flush_plug_callbacks(struct blk_plug *plug, bool from_schedule)
 {
@@ -1882,6 +1902,7 @@ void blk_finish_plug(struct blk_plug *plug)
 	if (plug != current->plug)
 		return;
 	blk_flush_plug_list(plug, false);
+	blk_mq_free_plug_rqs(plug);
 
 	current->plug = NULL;
 }
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Write latency tracking for latency based dirty throttling.
+ *
+ * Once a target is set in queue/dirty_lat_usec, the device latency of the
+ * writes completed in each window is folded into a running average in the
+ * queue's backing_dev_info.  balance_dirty_pages() then throttles the
+ * writers of that bdi by how far the average is over the target, instead
+ * of by the global dirty limits that writers to other devices push up.
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/backing-dev.h>
+
+#include "blk.h"
+#include "blk-stat.h"
+
+/* Length of a sampling window */
+#define DIRTY_LAT_WIN_MSECS	100
+
+static int dirty_lat_bucket(const struct request *rq)
+{
+	return op_is_write(req_op(rq)) ? 0 : -1;
+}
+
+static void dirty_lat_timer_fn(struct blk_stat_callback *cb)
+{
+	struct request_queue *q = cb->data;
+	struct backing_dev_info *bdi = q->backing_dev_info;
+	struct blk_rq_stat *stat = &cb->stat[0];
+	u64 lat = READ_ONCE(bdi->write_lat_nsec);
+
+	if (stat->nr_samples) {
+		lat = lat ? (lat * 3 + stat->mean) / 4 : stat->mean;
+	} else if (wb_stat(&bdi->wb, WB_WRITEBACK)) {
+		/* Nothing completed for a whole window with writes pending */
+		lat = max_t(u64, lat, DIRTY_LAT_WIN_MSECS * NSEC_PER_MSEC);
+	} else {
+		/* Idle, forget about past congestion */
+		lat /= 2;
+	}
+	WRITE_ONCE(bdi->write_lat_nsec, lat);
+
+	if (READ_ONCE(bdi->write_lat_target_nsec))
+		blk_stat_activate_msecs(cb, DIRTY_LAT_WIN_MSECS);
+}
+
+/**
+ * blk_dirty_lat_set - set the write latency target of a queue
+ * @q: the queue
+ * @target: target latency in nsecs, 0 to disable latency based throttling
+ *
+ * Called with @q->sysfs_lock held.
+ */
+int blk_dirty_lat_set(struct request_queue *q, u64 target)
+{
+	struct backing_dev_info *bdi = q->backing_dev_info;
+	struct blk_stat_callback *cb = q->dirty_lat_cb;
+
+	lockdep_assert_held(&q->sysfs_lock);
+
+	if (target && !cb) {
+		cb = blk_stat_alloc_callback(dirty_lat_timer_fn,
+					     dirty_lat_bucket, 1, q);
+		if (!cb)
+			return -ENOMEM;
+		WRITE_ONCE(bdi->write_lat_nsec, 0);
+		WRITE_ONCE(bdi->write_lat_target_nsec, target);
+		q->dirty_lat_cb = cb;
+		blk_stat_add_callback(q, cb);
+		blk_stat_activate_msecs(cb, DIRTY_LAT_WIN_MSECS);
+		return 0;
+	}
+
+	WRITE_ONCE(bdi->write_lat_target_nsec, target);
+	if (!target && cb)
+		blk_dirty_lat_exit(q);
+	return 0;
+}
+
+void blk_dirty_lat_exit(struct request_queue *q)
+{
+	struct blk_stat_callback *cb = q->dirty_lat_cb;
+
+	if (!cb)
+		return;
+
+	WRITE_ONCE(q->backing_dev_info->write_lat_target_nsec, 0);
+	blk_stat_remove_callback(q, cb);
+	blk_stat_free_callback(cb);
+	q->dirty_lat_cb = NULL;
+	WRITE_ONCE(q->backing_dev_info->write_lat_nsec, 0);
+}
@@ -167,7 +167,8 @@
  * - vrate	: Device virtual time rate against wall clock
  * - weight	: Surplus-adjusted and configured weights
  * - hweight	: Surplus-adjusted and configured hierarchical weights
- * - inflt	: The percentage of in-flight IO cost at the end of last period
+ * - inflt	: The percentage of in-flight IO cost at the end of last period,
+ *		  not counting vtime reserved by CPUs but not used yet
  * - del_ms	: Deferred issuer delay induction level and duration
  * - usages	: Usage history
  */
@@ -225,6 +226,14 @@ enum {
 	/* Have some play in waitq timer operations */
 	WAITQ_TIMER_MARGIN_PCT	= 5,
 
+	/*
+	 * Each CPU can reserve up to 2% of a period's worth of vtime of an
+	 * iocg for itself and issue out of that without touching the shared
+	 * vtime.  What's left is given back at the end of each period and
+	 * whenever an issuer has to wait.
+	 */
+	LOCAL_BUDGET_PCT	= 2,
+
 	/*
 	 * vtime can wrap well within a reasonable uptime when vrate is
 	 * consistently raised.  Don't trust recorded cgroup vtime if the
@@ -386,6 +395,12 @@ struct ioc_pcpu_stat {
 	u64				last_rq_wait_ns;
 };
 
+/* per iocg and cpu */
+struct iocg_pcpu {
+	atomic64_t			budget;		/* reserved vtime left */
+	u64				nr_local;	/* IOs issued out of it */
+};
+
 /* per device */
 struct ioc {
 	struct rq_qos			rqos;
@@ -470,6 +485,12 @@ struct ioc_gq {
 	u64				abs_vdebt;
 	u64				last_vtime;
 
+	/*
+	 * vtime already added to `vtime` by each CPU but not spent yet, see
+	 * iocg_charge_local().
+	 */
+	struct iocg_pcpu __percpu	*pcpu;
+
 	/*
 	 * The period this iocg was last active in.  Used for deactivation
 	 * and invalidating `vtime`.
@@ -673,6 +694,57 @@ static void iocg_commit_bio(struct ioc_gq *iocg, struct bio *bio, u64 cost)
 	atomic64_add(cost, &iocg->vtime);
 }
 
+/*
+ * Try to pay for @bio out of the vtime this CPU has reserved.  This skips
+ * reading the clock and doesn't dirty the iocg's shared vtime, so issuers
+ * on different CPUs don't contend as long as their reservations last.
+ */
+static bool iocg_charge_local(struct ioc_gq *iocg, struct bio *bio, u64 cost)
+{
+	struct iocg_pcpu *pcpu = raw_cpu_ptr(iocg->pcpu);
+	s64 left = atomic64_read(&pcpu->budget);
+
+	if (left < (s64)cost ||
+	    atomic64_cmpxchg(&pcpu->budget, left, left - cost) != left)
+		return false;
+
+	bio->bi_iocost_cost = cost;
+	this_cpu_inc(iocg->pcpu->nr_local);
+	return true;
+}
+
+/*
+ * Reserve a slice of the budget still available after @vtime for this CPU.
+ * The reservation is charged to the iocg's vtime right away, so it is never
+ * handed out twice.
+ */
+static void iocg_refill_local(struct ioc_gq *iocg, struct ioc_now *now,
+			      u64 vtime)
+{
+	struct ioc *ioc = iocg->ioc;
+	u64 slice = (u64)ioc->period_us * now->vrate * LOCAL_BUDGET_PCT / 100;
+
+	if (!time_before64(vtime, now->vnow))
+		return;
+
+	slice = min(slice, now->vnow - vtime);
+	atomic64_add(slice, &iocg->vtime);
+	atomic64_add(slice, &raw_cpu_ptr(iocg->pcpu)->budget);
+}
+
+/* give all unused reservations back to the iocg */
+static void iocg_flush_local(struct ioc_gq *iocg)
+{
+	s64 left = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		left += atomic64_xchg(&per_cpu_ptr(iocg->pcpu, cpu)->budget, 0);
+
+	if (left)
+		atomic64_sub(left, &iocg->vtime);
+}
+
 #define CREATE_TRACE_POINTS
 #include <trace/events/iocost.h>
 
@@ -1369,6 +1441,9 @@ static void ioc_timer_fn(struct timer_list *timer)
 	 * should have woken up in the last period and expire idle iocgs.
 	 */
 	list_for_each_entry_safe(iocg, tiocg, &ioc->active_iocgs, active_list) {
+		/* unused reservations shouldn't look like usage or in-flight */
+		iocg_flush_local(iocg);
+
 		if (!waitqueue_active(&iocg->waitq) && !iocg->abs_vdebt &&
 		    !iocg_is_idle(iocg))
 			continue;
@@ -1732,12 +1807,33 @@ static void ioc_rqos_throttle(struct rq_qos *rqos, struct bio *bio)
 	if (!ioc->enabled || !iocg->level)
 		return;
 
+	/* calculate the absolute vtime cost */
+	abs_cost = calc_vtime_cost(bio, iocg, false);
+
+	/*
+	 * If active and nobody's waiting or in debt, try the budget this CPU
+	 * reserved earlier.  The conditions are the same as for issuing
+	 * right away below and equally racy.
+	 */
+	if (abs_cost && !list_empty(&iocg->active_list) &&
+	    !waitqueue_active(&iocg->waitq) && !iocg->abs_vdebt) {
+		current_hweight(iocg, &hw_active, &hw_inuse);
+		cost = abs_cost_to_cost(abs_cost, hw_inuse);
+		if (iocg_charge_local(iocg, bio, cost)) {
+			u64 cur_period = atomic64_read(&ioc->cur_period);
+
+			/* tell the timer that we're still active */
+			if (atomic64_read(&iocg->active_period) != cur_period)
+				atomic64_set(&iocg->active_period, cur_period);
+			iocg->cursor = bio_end_sector(bio);
+			return;
+		}
+	}
+
 	/* always activate so that even 0 cost IOs get protected to some level */
 	if (!iocg_activate(iocg, &now))
 		return;
 
-	/* calculate the absolute vtime cost */
-	abs_cost = calc_vtime_cost(bio, iocg, false);
 	if (!abs_cost)
 		return;
 
@@ -1766,6 +1862,7 @@ static void ioc_rqos_throttle(struct rq_qos *rqos, struct bio *bio)
 	if (!waitqueue_active(&iocg->waitq) && !iocg->abs_vdebt &&
 	    time_before_eq64(vtime + cost, now.vnow)) {
 		iocg_commit_bio(iocg, bio, cost);
+		iocg_refill_local(iocg, &now, vtime + cost);
 		return;
 	}
 
@@ -1828,6 +1925,8 @@ static void ioc_rqos_throttle(struct rq_qos *rqos, struct bio *bio)
 	wait.abs_cost = abs_cost;
 	wait.committed = false;	/* will be set true by waker */
 
+	/* waiters go first, stop issuing from reserved budgets */
+	iocg_flush_local(iocg);
 	__add_wait_queue_entry_tail(&iocg->waitq, &wait.wait);
 	iocg_kick_waitq(iocg, &now);
 
@@ -2048,6 +2147,12 @@ static struct blkg_policy_data *ioc_pd_alloc(gfp_t gfp, struct request_queue *q,
 	if (!iocg)
 		return NULL;
 
+	iocg->pcpu = alloc_percpu_gfp(struct iocg_pcpu, gfp);
+	if (!iocg->pcpu) {
+		kfree(iocg);
+		return NULL;
+	}
+
 	return &iocg->pd;
 }
 
@@ -2104,6 +2209,7 @@ static void ioc_pd_free(struct blkg_policy_data *pd)
 		hrtimer_cancel(&iocg->waitq_timer);
 		hrtimer_cancel(&iocg->delay_timer);
 	}
+	free_percpu(iocg->pcpu);
 	kfree(iocg);
 }
 
@@ -217,6 +217,7 @@ static const char *const hctx_state_name[] = {
 	HCTX_STATE_NAME(TAG_ACTIVE),
 	HCTX_STATE_NAME(SCHED_RESTART),
 	HCTX_STATE_NAME(INACTIVE),
+	HCTX_STATE_NAME(POLL_IRQ),
 };
 #undef HCTX_STATE_NAME
 
@@ -535,6 +536,10 @@ static int hctx_io_poll_show(void *data, struct seq_file *m)
 	seq_printf(m, "considered=%lu\n", hctx->poll_considered);
 	seq_printf(m, "invoked=%lu\n", hctx->poll_invoked);
 	seq_printf(m, "success=%lu\n", hctx->poll_success);
+	seq_printf(m, "slept=%lu\n", hctx->poll_slept);
+	seq_printf(m, "irq_waits=%lu\n", hctx->poll_irq_waits);
+	seq_printf(m, "depth=%u.%03u\n", hctx->poll_depth / 1000,
+		   hctx->poll_depth % 1000);
 	return 0;
 }
 
@@ -544,9 +549,24 @@ static ssize_t hctx_io_poll_write(void *data, const char __user *buf,
 	struct blk_mq_hw_ctx *hctx = data;
 
 	hctx->poll_considered = hctx->poll_invoked = hctx->poll_success = 0;
+	hctx->poll_slept = hctx->poll_irq_waits = 0;
 	return count;
 }
 
+static int hctx_poll_lat_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	int bucket;
+
+	for (bucket = 0; bucket < (BLK_MQ_POLL_STATS_BKTS / 2); bucket++) {
+		seq_printf(m, "read  (%d Bytes): %llu\n", 1 << (9 + bucket),
+			   READ_ONCE(hctx->poll_lat[2 * bucket]));
+		seq_printf(m, "write (%d Bytes): %llu\n", 1 << (9 + bucket),
+			   READ_ONCE(hctx->poll_lat[2 * bucket + 1]));
+	}
+	return 0;
+}
+
 static int hctx_dispatched_show(void *data, struct seq_file *m)
 {
 	struct blk_mq_hw_ctx *hctx = data;
@@ -592,6 +612,27 @@ static ssize_t hctx_queued_write(void *data, const char __user *buf,
 	return count;
 }
 
+static int hctx_tag_batch_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+
+	seq_printf(m, "batches=%lu\n", hctx->tag_batches);
+	seq_printf(m, "tags=%lu\n", hctx->tags_batched);
+	seq_printf(m, "cached_used=%lu\n", hctx->cached_rqs_used);
+	seq_printf(m, "cached_freed=%lu\n", hctx->cached_rqs_freed);
+	return 0;
+}
+
+static ssize_t hctx_tag_batch_write(void *data, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+
+	hctx->tag_batches = hctx->tags_batched = 0;
+	hctx->cached_rqs_used = hctx->cached_rqs_freed = 0;
+	return count;
+}
+
 static int hctx_run_show(void *data, struct seq_file *m)
 {
 	struct blk_mq_hw_ctx *hctx = data;
@@ -778,6 +819,16 @@ static const struct file_operations blk_mq_debugfs_fops = {
 	.release	= blk_mq_debugfs_release,
 };
 
+static int hctx_driver_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	const struct blk_mq_ops *mq_ops = hctx->queue->mq_ops;
+
+	if (mq_ops->show_hctx)
+		mq_ops->show_hctx(m, hctx);
+	return 0;
+}
+
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"state", 0400, hctx_state_show},
 	{"flags", 0400, hctx_flags_show},
@@ -789,12 +840,15 @@ static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"sched_tags", 0400, hctx_sched_tags_show},
 	{"sched_tags_bitmap", 0400, hctx_sched_tags_bitmap_show},
 	{"io_poll", 0600, hctx_io_poll_show, hctx_io_poll_write},
+	{"poll_lat", 0400, hctx_poll_lat_show},
 	{"dispatched", 0600, hctx_dispatched_show, hctx_dispatched_write},
 	{"queued", 0600, hctx_queued_show, hctx_queued_write},
 	{"run", 0600, hctx_run_show, hctx_run_write},
+	{"tag_batch", 0600, hctx_tag_batch_show, hctx_tag_batch_write},
 	{"active", 0400, hctx_active_show},
 	{"dispatch_busy", 0400, hctx_dispatch_busy_show},
 	{"type", 0400, hctx_type_show},
+	{"driver", 0400, hctx_driver_show},
 	{},
 };
 
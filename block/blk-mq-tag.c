@@ -160,6 +160,38 @@ found_tag:
 	return tag + tag_offset;
 }
 
+/*
+ * Allocate up to @nr_tags normal tags with a single sbitmap operation. Never
+ * waits, the caller falls back to blk_mq_get_tag() if this returns 0.
+ */
+unsigned long blk_mq_get_tags(struct blk_mq_alloc_data *data, int nr_tags,
+			      unsigned int *offset)
+{
+	struct blk_mq_tags *tags = blk_mq_tags_from_data(data);
+	struct sbitmap_queue *bt = &tags->bitmap_tags;
+	unsigned long mask;
+	int i;
+
+	if (data->shallow_depth || (data->flags & BLK_MQ_REQ_RESERVED) ||
+	    (data->hctx->flags & BLK_MQ_F_TAG_SHARED))
+		return 0;
+
+	mask = __sbitmap_queue_get_batch(bt, nr_tags, offset);
+	if (!mask)
+		return 0;
+
+	if (unlikely(test_bit(BLK_MQ_S_INACTIVE, &data->hctx->state))) {
+		for (i = 0; mask; i++, mask >>= 1)
+			if (mask & 1)
+				sbitmap_queue_clear(bt, *offset + i,
+						    data->ctx->cpu);
+		return 0;
+	}
+
+	*offset += tags->nr_reserved_tags;
+	return mask;
+}
+
 void blk_mq_put_tag(struct blk_mq_tags *tags, struct blk_mq_ctx *ctx,
 		    unsigned int tag)
 {
@@ -174,6 +206,13 @@ void blk_mq_put_tag(struct blk_mq_tags *tags, struct blk_mq_ctx *ctx,
 	}
 }
 
+/* All of @tag_array must be normal, not reserved, tags */
+void blk_mq_put_tags(struct blk_mq_tags *tags, int *tag_array, int nr_tags)
+{
+	sbitmap_queue_clear_batch(&tags->bitmap_tags, tags->nr_reserved_tags,
+				  tag_array, nr_tags);
+}
+
 struct bt_iter_data {
 	struct blk_mq_hw_ctx *hctx;
 	busy_iter_fn *fn;
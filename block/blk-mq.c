@@ -43,7 +43,15 @@
 
 static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
 
+/* Length of a polling stats window */
+#define BLK_MQ_POLL_STATS_MSECS		100
+
+/* Poll queue depth thresholds in 1/1000ths, see blk_mq_poll_update_depth() */
+#define BLK_MQ_POLL_IRQ_DEPTH_LOW	500
+#define BLK_MQ_POLL_IRQ_DEPTH_HIGH	750
+
 static void blk_mq_poll_stats_start(struct request_queue *q);
+static void blk_mq_poll_stats_add(struct request *rq, u64 now);
 static void blk_mq_poll_stats_fn(struct blk_stat_callback *cb);
 
 static int blk_mq_poll_stats_bkt(const struct request *rq)
@@ -263,15 +271,6 @@ void blk_mq_wake_waiters(struct request_queue *q)
 			blk_mq_tag_wakeup_all(hctx->tags, true);
 }
 
-/*
- * Only need start/end time stamping if we have iostat or
- * blk stats enabled, or using an IO scheduler.
- */
-static inline bool blk_mq_need_time_stamp(struct request *rq)
-{
-	return (rq->rq_flags & (RQF_IO_STAT | RQF_STATS)) || rq->q->elevator;
-}
-
 static struct request *blk_mq_rq_ctx_init(struct blk_mq_alloc_data *data,
 		unsigned int tag, u64 alloc_time_ns)
 {
@@ -343,6 +342,38 @@ static struct request *blk_mq_rq_ctx_init(struct blk_mq_alloc_data *data,
 	return rq;
 }
 
+/*
+ * Set up as many of the data->nr_tags requests as one sbitmap operation
+ * could get tags for.  One is returned, the others are added to
+ * data->cached_rqs, each holding its own queue usage reference.
+ */
+static struct request *__blk_mq_alloc_requests_batch(struct blk_mq_alloc_data *data,
+		u64 alloc_time_ns)
+{
+	struct request *rq = NULL;
+	unsigned int tag_offset;
+	unsigned long tag_mask;
+	int i, nr = 0;
+
+	tag_mask = blk_mq_get_tags(data, data->nr_tags, &tag_offset);
+	if (unlikely(!tag_mask))
+		return NULL;
+
+	for (i = 0; tag_mask; i++, tag_mask >>= 1) {
+		if (!(tag_mask & 1))
+			continue;
+		if (rq)
+			list_add_tail(&rq->queuelist, data->cached_rqs);
+		rq = blk_mq_rq_ctx_init(data, tag_offset + i, alloc_time_ns);
+		nr++;
+	}
+
+	percpu_ref_get_many(&data->q->q_usage_counter, nr - 1);
+	data->hctx->tag_batches++;
+	data->hctx->tags_batched += nr;
+	return rq;
+}
+
 static struct request *__blk_mq_alloc_request(struct blk_mq_alloc_data *data)
 {
 	struct request_queue *q = data->q;
@@ -375,6 +406,14 @@ retry:
 	if (!e)
 		blk_mq_tag_busy(data->hctx);
 
+	if (data->nr_tags > 1 && !e && !op_is_flush(data->cmd_flags)) {
+		struct request *rq;
+
+		rq = __blk_mq_alloc_requests_batch(data, alloc_time_ns);
+		if (rq)
+			return rq;
+	}
+
 	/*
 	 * Waiting allocations only fail because of an inactive hctx.  In that
 	 * case just retry the hctx assignment and tag allocation as CPU hotplug
@@ -532,21 +571,28 @@ void blk_mq_free_request(struct request *rq)
 }
 EXPORT_SYMBOL_GPL(blk_mq_free_request);
 
-inline void __blk_mq_end_request(struct request *rq, blk_status_t error)
+static inline void __blk_mq_end_request_acct(struct request *rq, u64 now)
 {
-	u64 now = 0;
-
-	if (blk_mq_need_time_stamp(rq))
-		now = ktime_get_ns();
-
 	if (rq->rq_flags & RQF_STATS) {
 		blk_mq_poll_stats_start(rq->q);
 		blk_stat_add(rq, now);
+		if (rq->cmd_flags & REQ_HIPRI)
+			blk_mq_poll_stats_add(rq, now);
 	}
 
 	blk_mq_sched_completed_request(rq, now);
 
 	blk_account_io_done(rq, now);
+}
+
+inline void __blk_mq_end_request(struct request *rq, blk_status_t error)
+{
+	u64 now = 0;
+
+	if (blk_mq_need_time_stamp(rq))
+		now = ktime_get_ns();
+
+	__blk_mq_end_request_acct(rq, now);
 
 	if (rq->end_io) {
 		rq_qos_done(rq->q, rq);
@@ -565,6 +611,85 @@ void blk_mq_end_request(struct request *rq, blk_status_t error)
 }
 EXPORT_SYMBOL(blk_mq_end_request);
 
+#define TAG_COMP_BATCH		32
+
+static inline void blk_mq_flush_tag_batch(struct blk_mq_hw_ctx *hctx,
+					  int *tag_array, int nr_tags)
+{
+	struct request_queue *q = hctx->queue;
+
+	blk_mq_put_tags(hctx->tags, tag_array, nr_tags);
+	blk_mq_sched_restart(hctx);
+	percpu_ref_put_many(&q->q_usage_counter, nr_tags);
+}
+
+/**
+ * blk_mq_end_request_batch - end I/O on a batch of requests
+ * @iob:	requests added with blk_mq_add_to_batch()
+ *
+ * Description:
+ *	Like blk_mq_end_request() with %BLK_STS_OK for every request in @iob,
+ *	but reads the clock once and returns the tags of each hardware queue
+ *	to the tag map in bulk.
+ */
+void blk_mq_end_request_batch(struct io_comp_batch *iob)
+{
+	int tags[TAG_COMP_BATCH], nr_tags = 0;
+	struct blk_mq_hw_ctx *cur_hctx = NULL;
+	struct blk_mq_hw_ctx *hctx;
+	struct request *rq;
+	u64 now = 0;
+
+	if (iob->need_ts)
+		now = ktime_get_ns();
+
+	while ((rq = iob->req_list) != NULL) {
+		iob->req_list = rq->rq_next;
+		prefetch(rq->bio);
+		prefetch(rq->rq_next);
+
+		blk_update_request(rq, BLK_STS_OK, blk_rq_bytes(rq));
+		if (iob->need_ts)
+			__blk_mq_end_request_acct(rq, now);
+
+		hctx = rq->mq_hctx;
+		rq->mq_ctx->rq_completed[rq_is_sync(rq)]++;
+		if (rq->rq_flags & RQF_MQ_INFLIGHT)
+			atomic_dec(&hctx->nr_active);
+
+		if (unlikely(laptop_mode && !blk_rq_is_passthrough(rq)))
+			laptop_io_completion(rq->q->backing_dev_info);
+
+		rq_qos_done(rq->q, rq);
+
+		WRITE_ONCE(rq->state, MQ_RQ_IDLE);
+		if (!refcount_dec_and_test(&rq->ref))
+			continue;
+
+		if (rq->internal_tag != BLK_MQ_NO_TAG ||
+		    blk_mq_tag_is_reserved(hctx->tags, rq->tag)) {
+			__blk_mq_free_request(rq);
+			continue;
+		}
+
+		blk_crypto_free_request(rq);
+		blk_pm_mark_last_busy(rq);
+		rq->mq_hctx = NULL;
+
+		if (nr_tags == TAG_COMP_BATCH || cur_hctx != hctx) {
+			if (cur_hctx)
+				blk_mq_flush_tag_batch(cur_hctx, tags, nr_tags);
+			nr_tags = 0;
+			cur_hctx = hctx;
+		}
+		tags[nr_tags++] = rq->tag;
+	}
+
+	if (nr_tags)
+		blk_mq_flush_tag_batch(cur_hctx, tags, nr_tags);
+}
+EXPORT_SYMBOL_GPL(blk_mq_end_request_batch);
+
 /*
  * Softirq action handler - move entries to local list and loop over them
  * while passing them to the queue registered handler.
@@ -1890,6 +2015,35 @@ static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
 	return blk_rq_pos(rqa) > blk_rq_pos(rqb);
 }
 
+/*
+ * Hand a plug list that only holds requests for a single queue without an
+ * I/O scheduler to the driver in one go.  Whatever the driver could not
+ * queue is left on @list for the normal insertion path.
+ */
+static void blk_mq_plug_issue_list(struct request_queue *q,
+				   struct list_head *list)
+{
+	struct request *rq;
+
+	if (!q->mq_ops->queue_rqs || q->elevator || q->mq_ops->get_budget ||
+	    (q->tag_set->flags & BLK_MQ_F_BLOCKING))
+		return;
+
+	rcu_read_lock();
+	if (blk_queue_quiesced(q))
+		goto out;
+
+	list_for_each_entry(rq, list, queuelist) {
+		if (blk_mq_hctx_stopped(rq->mq_hctx) ||
+		    !blk_mq_get_driver_tag(rq))
+			goto out;
+	}
+
+	q->mq_ops->queue_rqs(list);
+out:
+	rcu_read_unlock();
+}
+
 void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 {
 	LIST_HEAD(list);
@@ -1901,6 +2055,17 @@ void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	if (plug->rq_count > 2 && plug->multiple_queues)
 		list_sort(NULL, &list, plug_rq_cmp);
 
+	if (!plug->multiple_queues && !from_schedule) {
+		struct request_queue *q = list_entry_rq(list.next)->q;
+
+		blk_mq_plug_issue_list(q, &list);
+		if (list_empty(&list)) {
+			trace_block_unplug(q, plug->rq_count, true);
+			plug->rq_count = 0;
+			return;
+		}
+	}
+
 	plug->rq_count = 0;
 
 	do {
@@ -2111,6 +2276,50 @@ static void blk_add_rq_to_plug(struct blk_plug *plug, struct request *rq)
 	}
 }
 
+/*
+ * Use a request allocated by an earlier batch of this plug, if it was set
+ * up for the same hardware queue the bio maps to.
+ */
+static struct request *blk_mq_get_cached_request(struct request_queue *q,
+		struct blk_plug *plug, struct blk_mq_alloc_data *data,
+		struct bio *bio)
+{
+	struct request *rq;
+
+	if (list_empty(&plug->cached_rqs))
+		return NULL;
+
+	rq = list_first_entry(&plug->cached_rqs, struct request, queuelist);
+	if (rq->q != q || op_is_flush(bio->bi_opf) ||
+	    blk_mq_map_queue(q, bio->bi_opf, rq->mq_ctx) != rq->mq_hctx)
+		return NULL;
+
+	list_del_init(&rq->queuelist);
+	rq->cmd_flags = bio->bi_opf;
+	if (blk_mq_need_time_stamp(rq))
+		rq->start_time_ns = ktime_get_ns();
+	data->ctx = rq->mq_ctx;
+	data->hctx = rq->mq_hctx;
+	data->hctx->cached_rqs_used++;
+
+	/* The cached request holds its own queue usage reference */
+	blk_queue_exit(q);
+	return rq;
+}
+
+void blk_mq_free_plug_rqs(struct blk_plug *plug)
+{
+	struct request *rq;
+
+	while (!list_empty(&plug->cached_rqs)) {
+		rq = list_first_entry(&plug->cached_rqs, struct request,
+				      queuelist);
+		list_del_init(&rq->queuelist);
+		rq->mq_hctx->cached_rqs_freed++;
+		blk_mq_free_request(rq);
+	}
+}
+
 /**
  * blk_mq_submit_bio - Create and send a request to block device.
  * @bio: Bio pointer.
@@ -2156,13 +2365,22 @@ blk_qc_t blk_mq_submit_bio(struct bio *bio)
 
 	rq_qos_throttle(q, bio);
 
-	data.cmd_flags = bio->bi_opf;
-	rq = __blk_mq_alloc_request(&data);
-	if (unlikely(!rq)) {
-		rq_qos_cleanup(q, bio);
-		if (bio->bi_opf & REQ_NOWAIT)
-			bio_wouldblock_error(bio);
-		goto queue_exit;
+	plug = blk_mq_plug(q, bio);
+	rq = plug ? blk_mq_get_cached_request(q, plug, &data, bio) : NULL;
+	if (!rq) {
+		data.cmd_flags = bio->bi_opf;
+		if (plug && plug->nr_ios > 1) {
+			data.nr_tags = plug->nr_ios;
+			data.cached_rqs = &plug->cached_rqs;
+			plug->nr_ios = 1;
+		}
+		rq = __blk_mq_alloc_request(&data);
+		if (unlikely(!rq)) {
+			rq_qos_cleanup(q, bio);
+			if (bio->bi_opf & REQ_NOWAIT)
+				bio_wouldblock_error(bio);
+			goto queue_exit;
+		}
 	}
 
 	trace_block_getrq(q, bio, bio->bi_opf);
@@ -2181,16 +2399,15 @@ blk_qc_t blk_mq_submit_bio(struct bio *bio)
 		return BLK_QC_T_NONE;
 	}
 
-	plug = blk_mq_plug(q, bio);
 	if (unlikely(is_flush_fua)) {
 		/* Bypass scheduler for flush requests */
 		blk_insert_flush(rq);
 		blk_mq_run_hw_queue(data.hctx, true);
 	} else if (plug && (q->nr_hw_queues == 1 || q->mq_ops->commit_rqs ||
-				!blk_queue_nonrot(q))) {
+				q->mq_ops->queue_rqs || !blk_queue_nonrot(q))) {
 		/*
-		 * Use plugging if we have a ->commit_rqs() hook as well, as
-		 * we know the driver uses bd->last in a smart fashion.
+		 * Use plugging if we have a ->commit_rqs() or ->queue_rqs()
+		 * hook as well, as we know the driver can batch the submission.
 		 *
 		 * Use normal plugging if this disk is slow HDD, as sequential
 		 * IO may benefit a lot from plug merging.
@@ -2772,6 +2989,7 @@ static void blk_mq_map_swqueue(struct request_queue *q)
 		cpumask_clear(hctx->cpumask);
 		hctx->nr_ctx = 0;
 		hctx->dispatch_from = NULL;
+		clear_bit(BLK_MQ_S_POLL_IRQ, &hctx->state);
 	}
 
 	/*
@@ -3669,24 +3887,75 @@ static void blk_mq_poll_stats_start(struct request_queue *q)
 	    blk_stat_is_active(q->poll_cb))
 		return;
 
-	blk_stat_activate_msecs(q->poll_cb, 100);
+	blk_stat_activate_msecs(q->poll_cb, BLK_MQ_POLL_STATS_MSECS);
+}
+
+/*
+ * Polled requests are accounted to the poll queue of their submission
+ * context, even while they are sent to an interrupt driven queue.
+ */
+static void blk_mq_poll_stats_add(struct request *rq, u64 now)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctxs[HCTX_TYPE_POLL];
+	int bucket = blk_mq_poll_stats_bkt(rq);
+	u64 lat, val;
+
+	if (bucket < 0 || now < rq->io_start_time_ns)
+		return;
+
+	val = now - rq->io_start_time_ns;
+	lat = READ_ONCE(hctx->poll_lat[bucket]);
+	WRITE_ONCE(hctx->poll_lat[bucket], lat ? (lat * 7 + val) >> 3 : val);
+	hctx->poll_time += val;
+}
+
+/*
+ * By Little's law the completion times summed over a window, divided by
+ * the window length, is the average number of requests in flight. Below
+ * one request in flight half of the time, a spinning poller mostly burns
+ * its CPU waiting for the device, so send the polled requests to the
+ * interrupt driven queues until the load picks up again. This is only
+ * done in adaptive hybrid mode, classic and fixed delay polling are
+ * explicit requests to poll.
+ */
+static void blk_mq_poll_update_depth(struct request_queue *q,
+				     struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int depth;
+
+	depth = div_u64(hctx->poll_time, BLK_MQ_POLL_STATS_MSECS * NSEC_PER_USEC);
+	hctx->poll_time = 0;
+	hctx->poll_depth = depth;
+
+	if (q->poll_nsec != 0 || depth > BLK_MQ_POLL_IRQ_DEPTH_HIGH)
+		clear_bit(BLK_MQ_S_POLL_IRQ, &hctx->state);
+	else if (depth < BLK_MQ_POLL_IRQ_DEPTH_LOW)
+		set_bit(BLK_MQ_S_POLL_IRQ, &hctx->state);
 }
 
 static void blk_mq_poll_stats_fn(struct blk_stat_callback *cb)
 {
 	struct request_queue *q = cb->data;
-	int bucket;
+	struct blk_mq_hw_ctx *hctx;
+	int bucket, i;
 
 	for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS; bucket++) {
 		if (cb->stat[bucket].nr_samples)
 			q->poll_stat[bucket] = cb->stat[bucket];
 	}
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (hctx->type == HCTX_TYPE_POLL)
+			blk_mq_poll_update_depth(q, hctx);
+	}
 }
 
 static unsigned long blk_mq_poll_nsecs(struct request_queue *q,
 				       struct request *rq)
 {
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctxs[HCTX_TYPE_POLL];
 	unsigned long ret = 0;
+	u64 lat;
 	int bucket;
 
 	/*
@@ -3709,19 +3978,49 @@ static unsigned long blk_mq_poll_nsecs(struct request_queue *q,
 	if (bucket < 0)
 		return ret;
 
-	if (q->poll_stat[bucket].nr_samples)
+	/*
+	 * Prefer the running average of the poll queue the request belongs
+	 * to, the queue wide stats mix in the other hardware queues, which
+	 * may see a different load.
+	 */
+	lat = READ_ONCE(hctx->poll_lat[bucket]);
+	if (lat)
+		ret = (lat + 1) / 2;
+	else if (q->poll_stat[bucket].nr_samples)
 		ret = (q->poll_stat[bucket].mean + 1) / 2;
 
 	return ret;
 }
 
-static bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
-				     struct request *rq)
+static void blk_mq_poll_sleep(struct request *rq, unsigned int nsecs)
 {
 	struct hrtimer_sleeper hs;
 	enum hrtimer_mode mode;
+	ktime_t kt = nsecs;
+
+	mode = HRTIMER_MODE_REL;
+	hrtimer_init_sleeper_on_stack(&hs, CLOCK_MONOTONIC, mode);
+	hrtimer_set_expires(&hs.timer, kt);
+
+	do {
+		if (blk_mq_rq_state(rq) == MQ_RQ_COMPLETE)
+			break;
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		hrtimer_sleeper_start_expires(&hs, mode);
+		if (hs.task)
+			io_schedule();
+		hrtimer_cancel(&hs.timer);
+		mode = HRTIMER_MODE_ABS;
+	} while (hs.task && !signal_pending(current));
+
+	__set_current_state(TASK_RUNNING);
+	destroy_hrtimer_on_stack(&hs.timer);
+}
+
+static bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
+				     struct request *rq)
+{
 	unsigned int nsecs;
-	ktime_t kt;
 
 	if (rq->rq_flags & RQF_MQ_POLL_SLEPT)
 		return false;
@@ -3741,41 +4040,17 @@ static bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
 		return false;
 
 	rq->rq_flags |= RQF_MQ_POLL_SLEPT;
+	rq->mq_hctx->poll_slept++;
 
-	/*
-	 * This will be replaced with the stats tracking code, using
-	 * 'avg_completion_time / 2' as the pre-sleep target.
-	 */
-	kt = nsecs;
-
-	mode = HRTIMER_MODE_REL;
-	hrtimer_init_sleeper_on_stack(&hs, CLOCK_MONOTONIC, mode);
-	hrtimer_set_expires(&hs.timer, kt);
-
-	do {
-		if (blk_mq_rq_state(rq) == MQ_RQ_COMPLETE)
-			break;
-		set_current_state(TASK_UNINTERRUPTIBLE);
-		hrtimer_sleeper_start_expires(&hs, mode);
-		if (hs.task)
-			io_schedule();
-		hrtimer_cancel(&hs.timer);
-		mode = HRTIMER_MODE_ABS;
-	} while (hs.task && !signal_pending(current));
-
-	__set_current_state(TASK_RUNNING);
-	destroy_hrtimer_on_stack(&hs.timer);
+	blk_mq_poll_sleep(rq, nsecs);
 	return true;
 }
 
-static bool blk_mq_poll_hybrid(struct request_queue *q,
-			       struct blk_mq_hw_ctx *hctx, blk_qc_t cookie)
+static struct request *blk_mq_poll_cookie_to_rq(struct blk_mq_hw_ctx *hctx,
+						blk_qc_t cookie)
 {
 	struct request *rq;
 
-	if (q->poll_nsec == BLK_MQ_POLL_CLASSIC)
-		return false;
-
 	if (!blk_qc_t_is_internal(cookie))
 		rq = blk_mq_tag_to_rq(hctx->tags, blk_qc_t_to_tag(cookie));
 	else {
@@ -3786,13 +4061,52 @@ static bool blk_mq_poll_hybrid(struct request_queue *q,
 		 * that happens. The request still remains valid, like always,
 		 * so we should be safe with just the NULL check.
 		 */
-		if (!rq)
-			return false;
 	}
 
+	return rq;
+}
+
+static bool blk_mq_poll_hybrid(struct request_queue *q,
+			       struct blk_mq_hw_ctx *hctx, blk_qc_t cookie)
+{
+	struct request *rq;
+
+	if (q->poll_nsec == BLK_MQ_POLL_CLASSIC)
+		return false;
+
+	rq = blk_mq_poll_cookie_to_rq(hctx, cookie);
+	if (!rq)
+		return false;
+
 	return blk_mq_poll_hybrid_sleep(q, rq);
 }
 
+/*
+ * The request was sent to an interrupt driven queue, which the driver
+ * may not be able to poll, see blk_mq_poll_update_depth(). Let a caller
+ * that is prepared to sleep wait for the interrupt, and otherwise sleep
+ * for half of the expected completion time before it checks again.
+ */
+static int blk_mq_poll_irq_wait(struct request_queue *q,
+				struct blk_mq_hw_ctx *hctx, blk_qc_t cookie)
+{
+	struct request *rq;
+	unsigned int nsecs;
+
+	hctx->poll_irq_waits++;
+
+	if (current->state != TASK_RUNNING)
+		return 0;
+
+	rq = blk_mq_poll_cookie_to_rq(hctx, cookie);
+	if (!rq)
+		return 1;
+
+	nsecs = blk_mq_poll_nsecs(q, rq);
+	blk_mq_poll_sleep(rq, max_t(unsigned int, nsecs, NSEC_PER_USEC));
+	return 1;
+}
+
 /**
  * blk_poll - poll for IO completions
  * @q:  the queue
@@ -3819,6 +4133,11 @@ int blk_poll(struct request_queue *q, blk_qc_t cookie, bool spin)
 
 	hctx = q->queue_hw_ctx[blk_qc_t_to_queue_num(cookie)];
 
+	if (hctx->type != HCTX_TYPE_POLL &&
+	    q->tag_set->nr_maps > HCTX_TYPE_POLL &&
+	    q->tag_set->map[HCTX_TYPE_POLL].nr_queues)
+		return blk_mq_poll_irq_wait(q, hctx, cookie);
+
 	/*
 	 * If we sleep, have the caller restart the poll loop to reset
 	 * the state. Like for the other success return cases, the
@@ -107,9 +107,12 @@ static inline struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
 	enum hctx_type type = HCTX_TYPE_DEFAULT;
 
 	/*
-	 * The caller ensure that if REQ_HIPRI, poll must be enabled.
+	 * The caller ensure that if REQ_HIPRI, poll must be enabled. While
+	 * the poll queue is mostly idle its requests are sent to the
+	 * interrupt driven queues instead, see blk_mq_poll_stats_fn().
 	 */
-	if (flags & REQ_HIPRI)
+	if ((flags & REQ_HIPRI) &&
+	    !test_bit(BLK_MQ_S_POLL_IRQ, &ctx->hctxs[HCTX_TYPE_POLL]->state))
 		type = HCTX_TYPE_POLL;
 	else if ((flags & REQ_OP_MASK) == REQ_OP_READ)
 		type = HCTX_TYPE_READ;
@@ -117,6 +120,8 @@ static inline struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
 	return ctx->hctxs[type];
 }
 
+void blk_mq_free_plug_rqs(struct blk_plug *plug);
+
 /*
  * sysfs helpers
  */
@@ -153,6 +158,10 @@ struct blk_mq_alloc_data {
 	unsigned int shallow_depth;
 	unsigned int cmd_flags;
 
+	/* allocate up to nr_tags requests, the extra ones go on cached_rqs */
+	unsigned int nr_tags;
+	struct list_head *cached_rqs;
+
 	/* input & output parameter */
 	struct blk_mq_ctx *ctx;
 	struct blk_mq_hw_ctx *hctx;
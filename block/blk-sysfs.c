@@ -507,6 +507,31 @@ static ssize_t queue_wb_lat_store(struct request_queue *q, const char *page,
 	return count;
 }
 
+static ssize_t queue_dirty_lat_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%llu\n",
+		div_u64(q->backing_dev_info->write_lat_target_nsec, 1000));
+}
+
+static ssize_t queue_dirty_lat_store(struct request_queue *q, const char *page,
+				     size_t count)
+{
+	ssize_t ret;
+	s64 val;
+
+	ret = queue_var_store64(&val, page);
+	if (ret < 0)
+		return ret;
+	if (val < 0)
+		return -EINVAL;
+
+	ret = blk_dirty_lat_set(q, val * 1000ULL);
+	if (ret)
+		return ret;
+
+	return count;
+}
+
 static ssize_t queue_wc_show(struct request_queue *q, char *page)
 {
 	if (test_bit(QUEUE_FLAG_WC, &q->queue_flags))
@@ -752,6 +777,12 @@ static struct queue_sysfs_entry queue_wb_lat_entry = {
 	.store = queue_wb_lat_store,
 };
 
+static struct queue_sysfs_entry queue_dirty_lat_entry = {
+	.attr = {.name = "dirty_lat_usec", .mode = 0644 },
+	.show = queue_dirty_lat_show,
+	.store = queue_dirty_lat_store,
+};
+
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 static struct queue_sysfs_entry throtl_sample_time_entry = {
 	.attr = {.name = "throttle_sample_time", .mode = 0644 },
@@ -797,6 +828,7 @@ static struct attribute *queue_attrs[] = {
 	&queue_fua_entry.attr,
 	&queue_dax_entry.attr,
 	&queue_wb_lat_entry.attr,
+	&queue_dirty_lat_entry.attr,
 	&queue_poll_delay_entry.attr,
 	&queue_io_timeout_entry.attr,
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
@@ -815,6 +847,10 @@ static umode_t queue_attr_visible(struct kobject *kobj, struct attribute *attr,
 		(!q->mq_ops || !q->mq_ops->timeout))
 			return 0;
 
+	/* Completion latencies are only sampled for blk-mq requests */
+	if (attr == &queue_dirty_lat_entry.attr && !queue_is_mq(q))
+		return 0;
+
 	if ((attr == &queue_max_open_zones_entry.attr ||
 	     attr == &queue_max_active_zones_entry.attr) &&
 	    !blk_queue_is_zoned(q))
@@ -932,6 +968,7 @@ static void blk_release_queue(struct kobject *kobj)
 		blk_stat_remove_callback(q, q->poll_cb);
 	blk_stat_free_callback(q->poll_cb);
 
+	blk_dirty_lat_exit(q);
 	blk_free_queue_stats(q->stats);
 
 	if (queue_is_mq(q))
@@ -236,6 +236,9 @@ enum elv_merge blk_try_merge(struct request *rq, struct bio *bio);
 
 int blk_dev_init(void);
 
+int blk_dirty_lat_set(struct request_queue *q, u64 target);
+void blk_dirty_lat_exit(struct request_queue *q);
+
 /*
  * Contribute to IO statistics IFF:
  *
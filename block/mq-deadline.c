@@ -33,10 +33,23 @@ static const int writes_starved = 2;    /* max times reads can starve a write */
 static const int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
 
-struct deadline_data {
-	/*
-	 * run time data
-	 */
+/*
+ * Schedule the requests of each hardware queue on their own on multi-queue
+ * devices, instead of sharing one set of lists and one lock between all of
+ * them.  Applies to queues switched to mq-deadline after it is set.
+ */
+static bool sharded;
+module_param(sharded, bool, 0644);
+MODULE_PARM_DESC(sharded, "Keep separate scheduling state per hardware queue");
+
+/*
+ * The scheduling state.  There is one for the whole queue, or one per
+ * hardware queue in sharded mode.  Each only ever holds requests of its
+ * own hardware queues, so the lock of one shard never needs to be held
+ * while dispatching from another.
+ */
+struct dd_shard {
+	spinlock_t lock;
 
 	/*
 	 * requests (deadline_rq s) are present on both sort_list and fifo_list
@@ -51,6 +64,10 @@ struct deadline_data {
 	unsigned int batching;		/* number of sequential requests made */
 	unsigned int starved;		/* times reads have starved writes */
 
+	struct list_head dispatch;
+} ____cacheline_aligned_in_smp;
+
+struct deadline_data {
 	/*
 	 * settings that change how the i/o scheduler behaves
 	 */
@@ -59,15 +76,31 @@ struct deadline_data {
 	int writes_starved;
 	int front_merges;
 
-	spinlock_t lock;
 	spinlock_t zone_lock;
-	struct list_head dispatch;
+
+	/*
+	 * run time data
+	 */
+	unsigned int nr_shards;
+	struct dd_shard shards[];
 };
 
+static inline struct dd_shard *
+dd_hctx_shard(struct deadline_data *dd, struct blk_mq_hw_ctx *hctx)
+{
+	return &dd->shards[dd->nr_shards > 1 ? hctx->queue_num : 0];
+}
+
+static inline struct dd_shard *
+dd_rq_shard(struct deadline_data *dd, struct request *rq)
+{
+	return dd_hctx_shard(dd, rq->mq_hctx);
+}
+
 static inline struct rb_root *
-deadline_rb_root(struct deadline_data *dd, struct request *rq)
+deadline_rb_root(struct dd_shard *ds, struct request *rq)
 {
-	return &dd->sort_list[rq_data_dir(rq)];
+	return &ds->sort_list[rq_data_dir(rq)];
 }
 
 /*
@@ -85,22 +118,22 @@ deadline_latter_request(struct request *rq)
 }
 
 static void
-deadline_add_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_add_rq_rb(struct dd_shard *ds, struct request *rq)
 {
-	struct rb_root *root = deadline_rb_root(dd, rq);
+	struct rb_root *root = deadline_rb_root(ds, rq);
 
 	elv_rb_add(root, rq);
 }
 
 static inline void
-deadline_del_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_del_rq_rb(struct dd_shard *ds, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	if (dd->next_rq[data_dir] == rq)
-		dd->next_rq[data_dir] = deadline_latter_request(rq);
+	if (ds->next_rq[data_dir] == rq)
+		ds->next_rq[data_dir] = deadline_latter_request(rq);
 
-	elv_rb_del(deadline_rb_root(dd, rq), rq);
+	elv_rb_del(deadline_rb_root(ds, rq), rq);
 }
 
 /*
@@ -116,7 +149,7 @@ static void deadline_remove_request(struct request_queue *q, struct request *rq)
 	 * We might not be on the rbtree, if we are doing an insert merge
 	 */
 	if (!RB_EMPTY_NODE(&rq->rb_node))
-		deadline_del_rq_rb(dd, rq);
+		deadline_del_rq_rb(dd_rq_shard(dd, rq), rq);
 
 	elv_rqhash_del(q, rq);
 	if (q->last_merge == rq)
@@ -132,8 +165,10 @@ static void dd_request_merged(struct request_queue *q, struct request *req,
 	 * if the merge was a front merge, we need to reposition request
 	 */
 	if (type == ELEVATOR_FRONT_MERGE) {
-		elv_rb_del(deadline_rb_root(dd, req), req);
-		deadline_add_rq_rb(dd, req);
+		struct dd_shard *ds = dd_rq_shard(dd, req);
+
+		elv_rb_del(deadline_rb_root(ds, req), req);
+		deadline_add_rq_rb(ds, req);
 	}
 }
 
@@ -162,13 +197,13 @@ static void dd_merged_requests(struct request_queue *q, struct request *req,
  * move an entry to dispatch queue
  */
 static void
-deadline_move_request(struct deadline_data *dd, struct request *rq)
+deadline_move_request(struct dd_shard *ds, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	dd->next_rq[READ] = NULL;
-	dd->next_rq[WRITE] = NULL;
-	dd->next_rq[data_dir] = deadline_latter_request(rq);
+	ds->next_rq[READ] = NULL;
+	ds->next_rq[WRITE] = NULL;
+	ds->next_rq[data_dir] = deadline_latter_request(rq);
 
 	/*
 	 * take it off the sort and fifo list
@@ -178,11 +213,11 @@ deadline_move_request(struct deadline_data *dd, struct request *rq)
 
 /*
  * deadline_check_fifo returns 0 if there are no expired requests on the fifo,
- * 1 otherwise. Requires !list_empty(&dd->fifo_list[data_dir])
+ * 1 otherwise. Requires !list_empty(&ds->fifo_list[data_dir])
  */
-static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
+static inline int deadline_check_fifo(struct dd_shard *ds, int ddir)
 {
-	struct request *rq = rq_entry_fifo(dd->fifo_list[ddir].next);
+	struct request *rq = rq_entry_fifo(ds->fifo_list[ddir].next);
 
 	/*
 	 * rq is expired!
@@ -198,7 +233,8 @@ static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
  * dispatch using arrival ordered lists.
  */
 static struct request *
-deadline_fifo_request(struct deadline_data *dd, int data_dir)
+deadline_fifo_request(struct deadline_data *dd, struct dd_shard *ds,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -206,10 +242,10 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	if (list_empty(&dd->fifo_list[data_dir]))
+	if (list_empty(&ds->fifo_list[data_dir]))
 		return NULL;
 
-	rq = rq_entry_fifo(dd->fifo_list[data_dir].next);
+	rq = rq_entry_fifo(ds->fifo_list[data_dir].next);
 	if (data_dir == READ || !blk_queue_is_zoned(rq->q))
 		return rq;
 
@@ -218,7 +254,7 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	 * an unlocked target zone.
 	 */
 	spin_lock_irqsave(&dd->zone_lock, flags);
-	list_for_each_entry(rq, &dd->fifo_list[WRITE], queuelist) {
+	list_for_each_entry(rq, &ds->fifo_list[WRITE], queuelist) {
 		if (blk_req_can_dispatch_to_zone(rq))
 			goto out;
 	}
@@ -234,7 +270,8 @@ out:
  * dispatch using sector position sorted lists.
  */
 static struct request *
-deadline_next_request(struct deadline_data *dd, int data_dir)
+deadline_next_request(struct deadline_data *dd, struct dd_shard *ds,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -242,7 +279,7 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	rq = dd->next_rq[data_dir];
+	rq = ds->next_rq[data_dir];
 	if (!rq)
 		return NULL;
 
@@ -268,29 +305,30 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
  * deadline_dispatch_requests selects the best request according to
  * read/write expire, fifo_batch, etc
  */
-static struct request *__dd_dispatch_request(struct deadline_data *dd)
+static struct request *__dd_dispatch_request(struct deadline_data *dd,
+					     struct dd_shard *ds)
 {
 	struct request *rq, *next_rq;
 	bool reads, writes;
 	int data_dir;
 
-	if (!list_empty(&dd->dispatch)) {
-		rq = list_first_entry(&dd->dispatch, struct request, queuelist);
+	if (!list_empty(&ds->dispatch)) {
+		rq = list_first_entry(&ds->dispatch, struct request, queuelist);
 		list_del_init(&rq->queuelist);
 		goto done;
 	}
 
-	reads = !list_empty(&dd->fifo_list[READ]);
-	writes = !list_empty(&dd->fifo_list[WRITE]);
+	reads = !list_empty(&ds->fifo_list[READ]);
+	writes = !list_empty(&ds->fifo_list[WRITE]);
 
 	/*
 	 * batches are currently reads XOR writes
 	 */
-	rq = deadline_next_request(dd, WRITE);
+	rq = deadline_next_request(dd, ds, WRITE);
 	if (!rq)
-		rq = deadline_next_request(dd, READ);
+		rq = deadline_next_request(dd, ds, READ);
 
-	if (rq && dd->batching < dd->fifo_batch)
+	if (rq && ds->batching < dd->fifo_batch)
 		/* we have a next request are still entitled to batch */
 		goto dispatch_request;
 
@@ -300,10 +338,10 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	 */
 
 	if (reads) {
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[READ]));
+		BUG_ON(RB_EMPTY_ROOT(&ds->sort_list[READ]));
 
-		if (deadline_fifo_request(dd, WRITE) &&
-		    (dd->starved++ >= dd->writes_starved))
+		if (deadline_fifo_request(dd, ds, WRITE) &&
+		    (ds->starved++ >= dd->writes_starved))
 			goto dispatch_writes;
 
 		data_dir = READ;
@@ -317,9 +355,9 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 
 	if (writes) {
 dispatch_writes:
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[WRITE]));
+		BUG_ON(RB_EMPTY_ROOT(&ds->sort_list[WRITE]));
 
-		dd->starved = 0;
+		ds->starved = 0;
 
 		data_dir = WRITE;
 
@@ -332,14 +370,14 @@ dispatch_find_request:
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
-	next_rq = deadline_next_request(dd, data_dir);
-	if (deadline_check_fifo(dd, data_dir) || !next_rq) {
+	next_rq = deadline_next_request(dd, ds, data_dir);
+	if (deadline_check_fifo(ds, data_dir) || !next_rq) {
 		/*
 		 * A deadline has expired, the last request was in the other
 		 * direction, or we have run out of higher-sectored requests.
 		 * Start again from the request with the earliest expiry time.
 		 */
-		rq = deadline_fifo_request(dd, data_dir);
+		rq = deadline_fifo_request(dd, ds, data_dir);
 	} else {
 		/*
 		 * The last req was the same dir and we have a next request in
@@ -355,14 +393,14 @@ dispatch_find_request:
 	if (!rq)
 		return NULL;
 
-	dd->batching = 0;
+	ds->batching = 0;
 
 dispatch_request:
 	/*
 	 * rq is the selected appropriate request.
 	 */
-	dd->batching++;
-	deadline_move_request(dd, rq);
+	ds->batching++;
+	deadline_move_request(ds, rq);
 done:
 	/*
 	 * If the request needs its target zone locked, do it.
@@ -377,15 +415,18 @@ done:
  * hardware queue, but we may return a request that is for a
  * different hardware queue. This is because mq-deadline has shared
  * state for all hardware queues, in terms of sorting, FIFOs, etc.
+ * Sharded mode is the exception, there each hardware queue only ever
+ * sees its own requests.
  */
 static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds = dd_hctx_shard(dd, hctx);
 	struct request *rq;
 
-	spin_lock(&dd->lock);
-	rq = __dd_dispatch_request(dd);
-	spin_unlock(&dd->lock);
+	spin_lock(&ds->lock);
+	rq = __dd_dispatch_request(dd, ds);
+	spin_unlock(&ds->lock);
 
 	return rq;
 }
@@ -393,9 +434,12 @@ static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 static void dd_exit_queue(struct elevator_queue *e)
 {
 	struct deadline_data *dd = e->elevator_data;
+	unsigned int i;
 
-	BUG_ON(!list_empty(&dd->fifo_list[READ]));
-	BUG_ON(!list_empty(&dd->fifo_list[WRITE]));
+	for (i = 0; i < dd->nr_shards; i++) {
+		BUG_ON(!list_empty(&dd->shards[i].fifo_list[READ]));
+		BUG_ON(!list_empty(&dd->shards[i].fifo_list[WRITE]));
+	}
 
 	kfree(dd);
 }
@@ -405,32 +449,47 @@ static void dd_exit_queue(struct elevator_queue *e)
  */
 static int dd_init_queue(struct request_queue *q, struct elevator_type *e)
 {
+	unsigned int nr_shards = 1, i;
 	struct deadline_data *dd;
 	struct elevator_queue *eq;
 
+	/*
+	 * Zoned writes have to be dispatched in order, which needs a single
+	 * view of all queued writes.
+	 */
+	if (READ_ONCE(sharded) && !blk_queue_is_zoned(q))
+		nr_shards = q->nr_hw_queues;
+
 	eq = elevator_alloc(q, e);
 	if (!eq)
 		return -ENOMEM;
 
-	dd = kzalloc_node(sizeof(*dd), GFP_KERNEL, q->node);
+	dd = kzalloc_node(struct_size(dd, shards, nr_shards), GFP_KERNEL,
+			  q->node);
 	if (!dd) {
 		kobject_put(&eq->kobj);
 		return -ENOMEM;
 	}
 	eq->elevator_data = dd;
 
-	INIT_LIST_HEAD(&dd->fifo_list[READ]);
-	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
-	dd->sort_list[READ] = RB_ROOT;
-	dd->sort_list[WRITE] = RB_ROOT;
 	dd->fifo_expire[READ] = read_expire;
 	dd->fifo_expire[WRITE] = write_expire;
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
-	spin_lock_init(&dd->lock);
 	spin_lock_init(&dd->zone_lock);
-	INIT_LIST_HEAD(&dd->dispatch);
+
+	dd->nr_shards = nr_shards;
+	for (i = 0; i < nr_shards; i++) {
+		struct dd_shard *ds = &dd->shards[i];
+
+		spin_lock_init(&ds->lock);
+		INIT_LIST_HEAD(&ds->fifo_list[READ]);
+		INIT_LIST_HEAD(&ds->fifo_list[WRITE]);
+		ds->sort_list[READ] = RB_ROOT;
+		ds->sort_list[WRITE] = RB_ROOT;
+		INIT_LIST_HEAD(&ds->dispatch);
+	}
 
 	q->elevator = eq;
 	return 0;
@@ -446,7 +505,8 @@ static int dd_request_merge(struct request_queue *q, struct request **rq,
 	if (!dd->front_merges)
 		return ELEVATOR_NO_MERGE;
 
-	__rq = elv_rb_find(&dd->sort_list[bio_data_dir(bio)], sector);
+	__rq = elv_rb_find(&dd->shards[0].sort_list[bio_data_dir(bio)],
+			   sector);
 	if (__rq) {
 		BUG_ON(sector != blk_rq_pos(__rq));
 
@@ -459,17 +519,83 @@ static int dd_request_merge(struct request_queue *q, struct request **rq,
 	return ELEVATOR_NO_MERGE;
 }
 
+/*
+ * Returns the queued request that ends right where @sector starts, if it is
+ * the closest one in front of @sector.
+ */
+static struct request *deadline_rb_find_back(struct rb_root *root,
+					     sector_t sector)
+{
+	struct rb_node *n = root->rb_node;
+	struct request *rq, *found = NULL;
+
+	while (n) {
+		rq = rb_entry_rq(n);
+		if (blk_rq_pos(rq) < sector) {
+			found = rq;
+			n = n->rb_right;
+		} else {
+			n = n->rb_left;
+		}
+	}
+
+	if (found && blk_rq_pos(found) + blk_rq_sectors(found) == sector)
+		return found;
+	return NULL;
+}
+
+/*
+ * The merge hash and q->last_merge are shared by the whole queue, so in
+ * sharded mode bios are merged by looking them up in the sort list of the
+ * shard instead.  Merged requests are not merged with their neighbours.
+ */
+static bool dd_shard_bio_merge(struct request_queue *q, struct dd_shard *ds,
+			       struct bio *bio, unsigned int nr_segs)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct rb_root *root = &ds->sort_list[bio_data_dir(bio)];
+	struct request *rq;
+
+	/* multi-range discard merges need the core's help */
+	if (bio_op(bio) == REQ_OP_DISCARD)
+		return false;
+
+	rq = deadline_rb_find_back(root, bio->bi_iter.bi_sector);
+	if (rq && elv_bio_merge_ok(rq, bio))
+		return blk_mq_sched_allow_merge(q, rq, bio) &&
+			bio_attempt_back_merge(rq, bio, nr_segs);
+
+	if (!dd->front_merges)
+		return false;
+
+	rq = elv_rb_find(root, bio_end_sector(bio));
+	if (rq && elv_bio_merge_ok(rq, bio)) {
+		if (!blk_mq_sched_allow_merge(q, rq, bio) ||
+		    !bio_attempt_front_merge(rq, bio, nr_segs))
+			return false;
+		elv_rb_del(root, rq);
+		deadline_add_rq_rb(ds, rq);
+		return true;
+	}
+
+	return false;
+}
+
 static bool dd_bio_merge(struct blk_mq_hw_ctx *hctx, struct bio *bio,
 		unsigned int nr_segs)
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_hctx_shard(dd, hctx);
 	struct request *free = NULL;
 	bool ret;
 
-	spin_lock(&dd->lock);
-	ret = blk_mq_sched_try_merge(q, bio, nr_segs, &free);
-	spin_unlock(&dd->lock);
+	spin_lock(&ds->lock);
+	if (dd->nr_shards > 1)
+		ret = dd_shard_bio_merge(q, ds, bio, nr_segs);
+	else
+		ret = blk_mq_sched_try_merge(q, bio, nr_segs, &free);
+	spin_unlock(&ds->lock);
 
 	if (free)
 		blk_mq_free_request(free);
@@ -485,6 +611,7 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_rq_shard(dd, rq);
 	const int data_dir = rq_data_dir(rq);
 
 	/*
@@ -493,20 +620,20 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 	 */
 	blk_req_zone_write_unlock(rq);
 
-	if (blk_mq_sched_try_insert_merge(q, rq))
+	if (dd->nr_shards == 1 && blk_mq_sched_try_insert_merge(q, rq))
 		return;
 
 	blk_mq_sched_request_inserted(rq);
 
 	if (at_head || blk_rq_is_passthrough(rq)) {
 		if (at_head)
-			list_add(&rq->queuelist, &dd->dispatch);
+			list_add(&rq->queuelist, &ds->dispatch);
 		else
-			list_add_tail(&rq->queuelist, &dd->dispatch);
+			list_add_tail(&rq->queuelist, &ds->dispatch);
 	} else {
-		deadline_add_rq_rb(dd, rq);
+		deadline_add_rq_rb(ds, rq);
 
-		if (rq_mergeable(rq)) {
+		if (dd->nr_shards == 1 && rq_mergeable(rq)) {
 			elv_rqhash_add(q, rq);
 			if (!q->last_merge)
 				q->last_merge = rq;
@@ -516,7 +643,7 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 		 * set expire time and add to fifo list
 		 */
 		rq->fifo_time = jiffies + dd->fifo_expire[data_dir];
-		list_add_tail(&rq->queuelist, &dd->fifo_list[data_dir]);
+		list_add_tail(&rq->queuelist, &ds->fifo_list[data_dir]);
 	}
 }
 
@@ -525,8 +652,9 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_hctx_shard(dd, hctx);
 
-	spin_lock(&dd->lock);
+	spin_lock(&ds->lock);
 	while (!list_empty(list)) {
 		struct request *rq;
 
@@ -534,7 +662,7 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 		list_del_init(&rq->queuelist);
 		dd_insert_request(hctx, rq, at_head);
 	}
-	spin_unlock(&dd->lock);
+	spin_unlock(&ds->lock);
 }
 
 /*
@@ -569,7 +697,7 @@ static void dd_finish_request(struct request *rq)
 
 		spin_lock_irqsave(&dd->zone_lock, flags);
 		blk_req_zone_write_unlock(rq);
-		if (!list_empty(&dd->fifo_list[WRITE]))
+		if (!list_empty(&dd->shards[0].fifo_list[WRITE]))
 			blk_mq_sched_mark_restart_hctx(rq->mq_hctx);
 		spin_unlock_irqrestore(&dd->zone_lock, flags);
 	}
@@ -578,10 +706,11 @@ static void dd_finish_request(struct request *rq)
 static bool dd_has_work(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds = dd_hctx_shard(dd, hctx);
 
-	return !list_empty_careful(&dd->dispatch) ||
-		!list_empty_careful(&dd->fifo_list[0]) ||
-		!list_empty_careful(&dd->fifo_list[1]);
+	return !list_empty_careful(&ds->dispatch) ||
+		!list_empty_careful(&ds->fifo_list[0]) ||
+		!list_empty_careful(&ds->fifo_list[1]);
 }
 
 /*
@@ -640,6 +769,13 @@ STORE_FUNCTION(deadline_front_merges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifo_batch_store, &dd->fifo_batch, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+static ssize_t deadline_nr_shards_show(struct elevator_queue *e, char *page)
+{
+	struct deadline_data *dd = e->elevator_data;
+
+	return deadline_var_show(dd->nr_shards, page);
+}
+
 #define DD_ATTR(name) \
 	__ATTR(name, 0644, deadline_##name##_show, deadline_##name##_store)
 
@@ -649,38 +785,50 @@ static struct elv_fs_entry deadline_attrs[] = {
 	DD_ATTR(writes_starved),
 	DD_ATTR(front_merges),
 	DD_ATTR(fifo_batch),
+	__ATTR(nr_shards, 0444, deadline_nr_shards_show, NULL),
 	__ATTR_NULL
 };
 
 #ifdef CONFIG_BLK_DEBUG_FS
+/*
+ * These show the state of the first shard, which is that of the whole queue
+ * unless running in sharded mode.
+ */
+static struct dd_shard *deadline_debugfs_shard(struct request_queue *q)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+
+	return &dd->shards[0];
+}
+
 #define DEADLINE_DEBUGFS_DDIR_ATTRS(ddir, name)				\
 static void *deadline_##name##_fifo_start(struct seq_file *m,		\
 					  loff_t *pos)			\
-	__acquires(&dd->lock)						\
+	__acquires(&ds->lock)						\
 {									\
 	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct dd_shard *ds = deadline_debugfs_shard(q);		\
 									\
-	spin_lock(&dd->lock);						\
-	return seq_list_start(&dd->fifo_list[ddir], *pos);		\
+	spin_lock(&ds->lock);						\
+	return seq_list_start(&ds->fifo_list[ddir], *pos);		\
 }									\
 									\
 static void *deadline_##name##_fifo_next(struct seq_file *m, void *v,	\
 					 loff_t *pos)			\
 {									\
 	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct dd_shard *ds = deadline_debugfs_shard(q);		\
 									\
-	return seq_list_next(v, &dd->fifo_list[ddir], pos);		\
+	return seq_list_next(v, &ds->fifo_list[ddir], pos);		\
 }									\
 									\
 static void deadline_##name##_fifo_stop(struct seq_file *m, void *v)	\
-	__releases(&dd->lock)						\
+	__releases(&ds->lock)						\
 {									\
 	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct dd_shard *ds = deadline_debugfs_shard(q);		\
 									\
-	spin_unlock(&dd->lock);						\
+	spin_unlock(&ds->lock);						\
 }									\
 									\
 static const struct seq_operations deadline_##name##_fifo_seq_ops = {	\
@@ -694,8 +842,8 @@ static int deadline_##name##_next_rq_show(void *data,			\
 					  struct seq_file *m)		\
 {									\
 	struct request_queue *q = data;					\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
-	struct request *rq = dd->next_rq[ddir];				\
+	struct dd_shard *ds = deadline_debugfs_shard(q);		\
+	struct request *rq = ds->next_rq[ddir];				\
 									\
 	if (rq)								\
 		__blk_mq_debugfs_rq_show(m, rq);			\
@@ -708,46 +856,46 @@ DEADLINE_DEBUGFS_DDIR_ATTRS(WRITE, write)
 static int deadline_batching_show(void *data, struct seq_file *m)
 {
 	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = deadline_debugfs_shard(q);
 
-	seq_printf(m, "%u\n", dd->batching);
+	seq_printf(m, "%u\n", ds->batching);
 	return 0;
 }
 
 static int deadline_starved_show(void *data, struct seq_file *m)
 {
 	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = deadline_debugfs_shard(q);
 
-	seq_printf(m, "%u\n", dd->starved);
+	seq_printf(m, "%u\n", ds->starved);
 	return 0;
 }
 
 static void *deadline_dispatch_start(struct seq_file *m, loff_t *pos)
-	__acquires(&dd->lock)
+	__acquires(&ds->lock)
 {
 	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = deadline_debugfs_shard(q);
 
-	spin_lock(&dd->lock);
-	return seq_list_start(&dd->dispatch, *pos);
+	spin_lock(&ds->lock);
+	return seq_list_start(&ds->dispatch, *pos);
 }
 
 static void *deadline_dispatch_next(struct seq_file *m, void *v, loff_t *pos)
 {
 	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = deadline_debugfs_shard(q);
 
-	return seq_list_next(v, &dd->dispatch, pos);
+	return seq_list_next(v, &ds->dispatch, pos);
 }
 
 static void deadline_dispatch_stop(struct seq_file *m, void *v)
-	__releases(&dd->lock)
+	__releases(&ds->lock)
 {
 	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = deadline_debugfs_shard(q);
 
-	spin_unlock(&dd->lock);
+	spin_unlock(&ds->lock);
 }
 
 static const struct seq_operations deadline_dispatch_seq_ops = {
@@ -15,12 +15,22 @@
 #include <linux/slab.h>
 #include <linux/kobject.h>
 #include <linux/cpu.h>
+#include <linux/topology.h>
 #include <crypto/pcrypt.h>
 
 static struct padata_instance *pencrypt;
 static struct padata_instance *pdecrypt;
 static struct kset           *pcrypt_kset;
 
+/*
+ * Give every tfm, e.g. every IPsec SA, its own padata shells on the CPUs of
+ * one LLC, so requests are only reordered against those of the same tfm and
+ * don't cross caches.  Applies to tfms allocated after it is set.
+ */
+static bool llc_scope;
+module_param(llc_scope, bool, 0644);
+MODULE_PARM_DESC(llc_scope, "Per-tfm reordering within one LLC");
+
 struct pcrypt_instance_ctx {
 	struct crypto_aead_spawn spawn;
 	struct padata_shell *psenc;
@@ -31,6 +41,9 @@ struct pcrypt_instance_ctx {
 struct pcrypt_aead_ctx {
 	struct crypto_aead *child;
 	unsigned int cb_cpu;
+	/* Per-tfm shells in llc_scope mode, else NULL */
+	struct padata_shell *psenc;
+	struct padata_shell *psdec;
 };
 
 static inline struct pcrypt_instance_ctx *pcrypt_tfm_ictx(
@@ -112,7 +125,7 @@ static int pcrypt_aead_encrypt(struct aead_request *req)
 			       req->cryptlen, req->iv);
 	aead_request_set_ad(creq, req->assoclen);
 
-	err = padata_do_parallel(ictx->psenc, padata, &ctx->cb_cpu);
+	err = padata_do_parallel(ctx->psenc ?: ictx->psenc, padata, &ctx->cb_cpu);
 	if (!err)
 		return -EINPROGRESS;
 
@@ -157,13 +170,85 @@ static int pcrypt_aead_decrypt(struct aead_request *req)
 			       req->cryptlen, req->iv);
 	aead_request_set_ad(creq, req->assoclen);
 
-	err = padata_do_parallel(ictx->psdec, padata, &ctx->cb_cpu);
+	err = padata_do_parallel(ctx->psdec ?: ictx->psdec, padata, &ctx->cb_cpu);
 	if (!err)
 		return -EINPROGRESS;
 
 	return err;
 }
 
+static const struct cpumask *pcrypt_llc_mask(int cpu)
+{
+#ifdef CONFIG_SCHED_MC
+	return cpu_coregroup_mask(cpu);
+#else
+	return cpumask_of_node(cpu_to_node(cpu));
+#endif
+}
+
+static bool pcrypt_llc_first(int cpu)
+{
+	return cpu == cpumask_first_and(pcrypt_llc_mask(cpu), cpu_online_mask);
+}
+
+/*
+ * Spread the tfms round robin over the LLCs, and over the CPUs of each LLC
+ * for their serial callbacks.  Returns the LLC's CPUs and sets ctx->cb_cpu.
+ */
+static const struct cpumask *pcrypt_llc_pick(struct pcrypt_aead_ctx *ctx,
+					     unsigned int index)
+{
+	const struct cpumask *mask = cpu_online_mask;
+	unsigned int nr_llcs = 0, i;
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		nr_llcs += pcrypt_llc_first(cpu);
+	nr_llcs = max(nr_llcs, 1U);
+
+	i = index % nr_llcs;
+	for_each_online_cpu(cpu) {
+		if (pcrypt_llc_first(cpu) && !i--) {
+			mask = pcrypt_llc_mask(cpu);
+			break;
+		}
+	}
+
+	i = 0;
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		i++;
+	i = (index / nr_llcs) % max(i, 1U);
+	for_each_cpu_and(cpu, mask, cpu_online_mask) {
+		ctx->cb_cpu = cpu;
+		if (!i--)
+			break;
+	}
+
+	return mask;
+}
+
+static int pcrypt_aead_init_llc(struct pcrypt_aead_ctx *ctx, unsigned int index)
+{
+	const struct cpumask *mask;
+
+	get_online_cpus();
+	mask = pcrypt_llc_pick(ctx, index);
+	put_online_cpus();
+
+	ctx->psenc = padata_alloc_shell_scoped(pencrypt, mask);
+	if (!ctx->psenc)
+		return -ENOMEM;
+
+	ctx->psdec = padata_alloc_shell_scoped(pdecrypt, mask);
+	if (!ctx->psdec) {
+		padata_free_shell(ctx->psenc);
+		ctx->psenc = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
 static int pcrypt_aead_init_tfm(struct crypto_aead *tfm)
 {
 	int cpu, cpu_index;
@@ -171,18 +256,29 @@ static int pcrypt_aead_init_tfm(struct crypto_aead *tfm)
 	struct pcrypt_instance_ctx *ictx = aead_instance_ctx(inst);
 	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(tfm);
 	struct crypto_aead *cipher;
+	unsigned int count;
+	int err;
 
-	cpu_index = (unsigned int)atomic_inc_return(&ictx->tfm_count) %
-		    cpumask_weight(cpu_online_mask);
+	count = (unsigned int)atomic_inc_return(&ictx->tfm_count);
+	cpu_index = count % cpumask_weight(cpu_online_mask);
 
 	ctx->cb_cpu = cpumask_first(cpu_online_mask);
 	for (cpu = 0; cpu < cpu_index; cpu++)
 		ctx->cb_cpu = cpumask_next(ctx->cb_cpu, cpu_online_mask);
 
+	if (READ_ONCE(llc_scope)) {
+		err = pcrypt_aead_init_llc(ctx, count);
+		if (err)
+			return err;
+	}
+
 	cipher = crypto_spawn_aead(&ictx->spawn);
 
-	if (IS_ERR(cipher))
+	if (IS_ERR(cipher)) {
+		padata_free_shell(ctx->psdec);
+		padata_free_shell(ctx->psenc);
 		return PTR_ERR(cipher);
+	}
 
 	ctx->child = cipher;
 	crypto_aead_set_reqsize(tfm, sizeof(struct pcrypt_request) +
@@ -197,6 +293,8 @@ static void pcrypt_aead_exit_tfm(struct crypto_aead *tfm)
 	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(tfm);
 
 	crypto_free_aead(ctx->child);
+	padata_free_shell(ctx->psdec);
+	padata_free_shell(ctx->psenc);
 }
 
 static void pcrypt_free(struct aead_instance *inst)
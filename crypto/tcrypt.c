@@ -31,6 +31,8 @@
 #include <linux/string.h>
 #include <linux/moduleparam.h>
 #include <linux/jiffies.h>
+#include <linux/kernel_stat.h>
+#include <linux/math64.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
 #include "tcrypt.h"
@@ -179,10 +181,33 @@ static int do_mult_aead_op(struct test_mb_aead_data *data, int enc,
 	return err;
 }
 
+/*
+ * CPU time spent outside idle on all CPUs, in ns.  Asynchronous
+ * implementations like pcrypt do most of the work on other CPUs than the
+ * one running the test, so this is what the throughput is divided by.
+ */
+static u64 mb_busy_ns(void)
+{
+	struct kernel_cpustat kcs;
+	u64 busy = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		kcpustat_cpu_fetch(&kcs, cpu);
+		busy += kcs.cpustat[CPUTIME_USER] + kcs.cpustat[CPUTIME_NICE] +
+			kcs.cpustat[CPUTIME_SYSTEM] + kcs.cpustat[CPUTIME_IRQ] +
+			kcs.cpustat[CPUTIME_SOFTIRQ];
+	}
+
+	return busy;
+}
+
 static int test_mb_aead_jiffies(struct test_mb_aead_data *data, int enc,
 				int blen, int secs, u32 num_mb)
 {
 	unsigned long start, end;
+	u64 bytes, busy, gbps, core_gbps;
+	u32 gbps_frac, core_gbps_frac;
 	int bcount;
 	int ret = 0;
 	int *rc;
@@ -191,6 +216,8 @@ static int test_mb_aead_jiffies(struct test_mb_aead_data *data, int enc,
 	if (!rc)
 		return -ENOMEM;
 
+	busy = mb_busy_ns();
+
 	for (start = jiffies, end = start + secs * HZ, bcount = 0;
 	     time_before(jiffies, end); bcount++) {
 		ret = do_mult_aead_op(data, enc, num_mb, rc);
@@ -198,8 +225,17 @@ static int test_mb_aead_jiffies(struct test_mb_aead_data *data, int enc,
 			goto out;
 	}
 
-	pr_cont("%d operations in %d seconds (%ld bytes)\n",
-		bcount * num_mb, secs, (long)bcount * blen * num_mb);
+	busy = mb_busy_ns() - busy;
+	bytes = (u64)bcount * blen * num_mb;
+	/* Gbps is bits per ns, these are in hundredths */
+	gbps = div64_u64(bytes * 800, (u64)secs * NSEC_PER_SEC);
+	core_gbps = busy ? div64_u64(bytes * 800, busy) : 0;
+	gbps = div_u64_rem(gbps, 100, &gbps_frac);
+	core_gbps = div_u64_rem(core_gbps, 100, &core_gbps_frac);
+
+	pr_cont("%d operations in %d seconds (%ld bytes), %llu.%02u Gbps, %llu.%02u Gbps per busy core\n",
+		bcount * num_mb, secs, (long)bytes, gbps, gbps_frac,
+		core_gbps, core_gbps_frac);
 
 out:
 	kfree(rc);
@@ -2343,6 +2379,15 @@ static int do_test(const char *alg, u32 type, u32 mask, int m, u32 num_mb)
 				NULL, 0, 16, 8, speed_template_16);
 		break;
 
+	case 222:
+		test_mb_aead_speed("pcrypt(rfc4106(gcm(aes)))", ENCRYPT, sec,
+				   NULL, 0, 16, 16, aead_speed_template_20,
+				   num_mb);
+		test_mb_aead_speed("pcrypt(rfc4106(gcm(aes)))", DECRYPT, sec,
+				   NULL, 0, 16, 16, aead_speed_template_20,
+				   num_mb);
+		break;
+
 	case 300:
 		if (alg) {
 			test_hash_speed(alg, sec, generic_hash_speed_template);
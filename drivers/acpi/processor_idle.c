@@ -502,6 +502,12 @@ static void wait_for_freeze(void)
 	/* No delay is needed if we are in guest */
 	if (boot_cpu_has(X86_FEATURE_HYPERVISOR))
 		return;
+	/*
+	 * Zen based processors do not need the dummy read to make the
+	 * C-state entry take effect.
+	 */
+	if (boot_cpu_has(X86_FEATURE_ZEN))
+		return;
 #endif
 	/* Dummy wait op - must do something useless after P_LVL2 read
 	   because chipsets cannot guarantee that STPCLK# signal
@@ -20,6 +20,8 @@ struct nullb_cmd {
 	blk_status_t error;
 	struct nullb_queue *nq;
 	struct hrtimer timer;
+	struct list_head list; /* on nq->poll_list until polled */
+	u64 deadline; /* time in ns after which a polled command completes */
 };
 
 struct nullb_queue {
@@ -28,6 +30,10 @@ struct nullb_queue {
 	unsigned int queue_depth;
 	struct nullb_device *dev;
 	unsigned int requeue_selection;
+	bool poll; /* a HCTX_TYPE_POLL queue */
+
+	spinlock_t poll_lock;
+	struct list_head poll_list;
 
 	struct nullb_cmd *cmds;
 };
@@ -52,6 +58,7 @@ struct nullb_device {
 	unsigned long zone_capacity; /* zone capacity in MB if device is zoned */
 	unsigned int zone_nr_conv; /* number of conventional zones */
 	unsigned int submit_queues; /* number of submission queues */
+	unsigned int poll_queues; /* number of IOPOLL submission queues */
 	unsigned int home_node; /* home node for the device */
 	unsigned int queue_mode; /* block interface */
 	unsigned int blocksize; /* block size */
@@ -59,6 +66,10 @@ struct nullb_device {
 	unsigned int hw_queue_depth; /* queue depth */
 	unsigned int index; /* index of the disk, only valid with a disk */
 	unsigned int mbps; /* Bandwidth throttle cap (in MB/s) */
+	unsigned int latency_model; /* distribution of completion latencies */
+	unsigned int latency_sigma; /* log-normal shape, in 1/1000 */
+	unsigned long latency_tail_nsec; /* latency of tail completions */
+	unsigned int latency_tail_ppm; /* tail completions per million */
 	bool blocking; /* blocking blk-mq device */
 	bool use_per_node_hctx; /* use per-node allocation for hardware context */
 	bool power; /* power on/off the device */
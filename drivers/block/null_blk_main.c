@@ -9,6 +9,7 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/prandom.h>
 #include "null_blk.h"
 
 #define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
@@ -84,6 +85,11 @@ enum {
 	NULL_Q_MQ		= 2,
 };
 
+enum {
+	NULL_LAT_FIXED		= 0,
+	NULL_LAT_LOGNORMAL	= 1,
+};
+
 static int g_no_sched;
 module_param_named(no_sched, g_no_sched, int, 0444);
 MODULE_PARM_DESC(no_sched, "No io scheduler");
@@ -92,6 +98,10 @@ static int g_submit_queues = 1;
 module_param_named(submit_queues, g_submit_queues, int, 0444);
 MODULE_PARM_DESC(submit_queues, "Number of submission queues");
 
+static int g_poll_queues;
+module_param_named(poll_queues, g_poll_queues, int, 0444);
+MODULE_PARM_DESC(poll_queues, "Number of IOPOLL submission queues");
+
 static int g_home_node = NUMA_NO_NODE;
 module_param_named(home_node, g_home_node, int, 0444);
 MODULE_PARM_DESC(home_node, "Home node for the device");
@@ -184,6 +194,22 @@ static unsigned long g_completion_nsec = 10000;
 module_param_named(completion_nsec, g_completion_nsec, ulong, 0444);
 MODULE_PARM_DESC(completion_nsec, "Time in ns to complete a request in hardware. Default: 10,000ns");
 
+static unsigned int g_latency_model = NULL_LAT_FIXED;
+module_param_named(latency_model, g_latency_model, uint, 0444);
+MODULE_PARM_DESC(latency_model, "Distribution of completion times with irqmode=2. 0-fixed completion_nsec, 1-log-normal with median completion_nsec");
+
+static unsigned int g_latency_sigma = 250;
+module_param_named(latency_sigma, g_latency_sigma, uint, 0444);
+MODULE_PARM_DESC(latency_sigma, "Shape of the log-normal latency model, in 1/1000. Default: 250");
+
+static unsigned long g_latency_tail_nsec;
+module_param_named(latency_tail_nsec, g_latency_tail_nsec, ulong, 0444);
+MODULE_PARM_DESC(latency_tail_nsec, "Completion time in ns of tail requests. Default: 0 (no tail)");
+
+static unsigned int g_latency_tail_ppm;
+module_param_named(latency_tail_ppm, g_latency_tail_ppm, uint, 0444);
+MODULE_PARM_DESC(latency_tail_ppm, "Tail requests per million requests. Default: 0");
+
 static int g_hw_queue_depth = 64;
 module_param_named(hw_queue_depth, g_hw_queue_depth, int, 0444);
 MODULE_PARM_DESC(hw_queue_depth, "Queue depth for each hardware queue. Default: 64");
@@ -323,9 +349,14 @@ static int nullb_apply_submit_queues(struct nullb_device *dev,
 	 */
 	if (submit_queues > nr_cpu_ids)
 		return -EINVAL;
+	if (submit_queues + dev->poll_queues > nr_cpu_ids)
+		return -EINVAL;
 	set = nullb->tag_set;
-	blk_mq_update_nr_hw_queues(set, submit_queues);
-	return set->nr_hw_queues == submit_queues ? 0 : -ENOMEM;
+	/* null_map_queues() looks at the new value */
+	dev->submit_queues = submit_queues;
+	blk_mq_update_nr_hw_queues(set, submit_queues + dev->poll_queues);
+	return set->nr_hw_queues == submit_queues + dev->poll_queues ?
+		0 : -ENOMEM;
 }
 
 NULLB_DEVICE_ATTR(size, ulong, NULL);
@@ -342,6 +373,11 @@ NULLB_DEVICE_ATTR(use_per_node_hctx, bool, NULL);
 NULLB_DEVICE_ATTR(memory_backed, bool, NULL);
 NULLB_DEVICE_ATTR(discard, bool, NULL);
 NULLB_DEVICE_ATTR(mbps, uint, NULL);
+NULLB_DEVICE_ATTR(poll_queues, uint, NULL);
+NULLB_DEVICE_ATTR(latency_model, uint, NULL);
+NULLB_DEVICE_ATTR(latency_sigma, uint, NULL);
+NULLB_DEVICE_ATTR(latency_tail_nsec, ulong, NULL);
+NULLB_DEVICE_ATTR(latency_tail_ppm, uint, NULL);
 NULLB_DEVICE_ATTR(cache_size, ulong, NULL);
 NULLB_DEVICE_ATTR(zoned, bool, NULL);
 NULLB_DEVICE_ATTR(zone_size, ulong, NULL);
@@ -458,6 +494,11 @@ static struct configfs_attribute *nullb_device_attrs[] = {
 	&nullb_device_attr_memory_backed,
 	&nullb_device_attr_discard,
 	&nullb_device_attr_mbps,
+	&nullb_device_attr_poll_queues,
+	&nullb_device_attr_latency_model,
+	&nullb_device_attr_latency_sigma,
+	&nullb_device_attr_latency_tail_nsec,
+	&nullb_device_attr_latency_tail_ppm,
 	&nullb_device_attr_cache_size,
 	&nullb_device_attr_badblocks,
 	&nullb_device_attr_zoned,
@@ -517,7 +558,7 @@ nullb_group_drop_item(struct config_group *group, struct config_item *item)
 static ssize_t memb_group_features_show(struct config_item *item, char *page)
 {
 	return snprintf(page, PAGE_SIZE,
-			"memory_backed,discard,bandwidth,cache,badblocks,zoned,zone_size,zone_capacity,zone_nr_conv\n");
+			"memory_backed,discard,bandwidth,cache,badblocks,zoned,zone_size,zone_capacity,zone_nr_conv,poll_queues,latency_model\n");
 }
 
 CONFIGFS_ATTR_RO(memb_group_, features);
@@ -569,11 +610,16 @@ static struct nullb_device *null_alloc_dev(void)
 	dev->size = g_gb * 1024;
 	dev->completion_nsec = g_completion_nsec;
 	dev->submit_queues = g_submit_queues;
+	dev->poll_queues = g_poll_queues;
 	dev->home_node = g_home_node;
 	dev->queue_mode = g_queue_mode;
 	dev->blocksize = g_bs;
 	dev->irqmode = g_irqmode;
 	dev->hw_queue_depth = g_hw_queue_depth;
+	dev->latency_model = g_latency_model;
+	dev->latency_sigma = g_latency_sigma;
+	dev->latency_tail_nsec = g_latency_tail_nsec;
+	dev->latency_tail_ppm = g_latency_tail_ppm;
 	dev->blocking = g_blocking;
 	dev->use_per_node_hctx = g_use_per_node_hctx;
 	dev->zoned = g_zoned;
@@ -689,13 +735,81 @@ static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+/* Fixed-point (16 bit fraction) approximation of a standard normal sample */
+static s64 null_normal_fp(void)
+{
+	s64 sum = 0;
+	int i;
+
+	/* Irwin-Hall: the sum of 12 uniform samples has variance 1 */
+	for (i = 0; i < 6; i++) {
+		u32 r = prandom_u32();
+
+		sum += (r & 0xffff) + (r >> 16);
+	}
+	return sum - (6LL << 16);
+}
+
+/* @nsec * e^(@x / 2^16) */
+static u64 null_scale_exp(u64 nsec, s64 x)
+{
+	/* e^x = 2^(x * log2(e)), log2(e) = 94548 / 2^16 */
+	s64 y = (x * 94548) >> 16;
+	s64 i = y >> 16;
+	u64 f = y & 0xffff, p;
+
+	/* 2^f for f in [0, 1), cubic fit */
+	p = (((((5184 * f) >> 16) + 14752) * f >> 16) + 45600) * f >> 16;
+	p += 65536;
+
+	nsec = (nsec * p) >> 16;
+	i = clamp_t(s64, i, -40, 10);
+	return i >= 0 ? nsec << i : nsec >> -i;
+}
+
+/*
+ * Completion time of the next command.  Tail requests complete after
+ * latency_tail_nsec, the others after completion_nsec or, for the
+ * log-normal model, after a time drawn from a log-normal distribution with
+ * median completion_nsec, which is what the latency of flash looks like
+ * outside of garbage collection and other tail events.
+ */
+static u64 null_cmd_latency(struct nullb_device *dev)
+{
+	u64 nsec = dev->completion_nsec;
+
+	if (dev->latency_tail_ppm &&
+	    prandom_u32_max(1000000) < dev->latency_tail_ppm)
+		return dev->latency_tail_nsec;
+
+	if (dev->latency_model == NULL_LAT_LOGNORMAL && dev->latency_sigma)
+		nsec = null_scale_exp(nsec, div_s64(null_normal_fp() *
+					dev->latency_sigma, 1000));
+
+	return nsec;
+}
+
 static void null_cmd_end_timer(struct nullb_cmd *cmd)
 {
-	ktime_t kt = cmd->nq->dev->completion_nsec;
+	ktime_t kt = null_cmd_latency(cmd->nq->dev);
 
 	hrtimer_start(&cmd->timer, kt, HRTIMER_MODE_REL);
 }
 
+/* Polled commands complete when null_poll() finds them past their deadline */
+static void null_cmd_end_poll(struct nullb_cmd *cmd)
+{
+	struct nullb_queue *nq = cmd->nq;
+
+	cmd->deadline = 0;
+	if (nq->dev->irqmode == NULL_IRQ_TIMER)
+		cmd->deadline = ktime_get_ns() + null_cmd_latency(nq->dev);
+
+	spin_lock(&nq->poll_lock);
+	list_add_tail(&cmd->list, &nq->poll_list);
+	spin_unlock(&nq->poll_lock);
+}
+
 static void null_complete_rq(struct request *rq)
 {
 	end_cmd(blk_mq_rq_to_pdu(rq));
@@ -1286,6 +1400,11 @@ static inline void nullb_complete_cmd(struct nullb_cmd *cmd)
 	if (IS_ENABLED(CONFIG_KMSAN))
 		nullb_zero_read_cmd_buffer(cmd);
 
+	if (cmd->nq->poll) {
+		null_cmd_end_poll(cmd);
+		return;
+	}
+
 	/* Complete IO by inline, softirq or timer */
 	switch (cmd->nq->dev->irqmode) {
 	case NULL_IRQ_SOFTIRQ:
@@ -1431,7 +1550,16 @@ static bool should_requeue_request(struct request *rq)
 
 static enum blk_eh_timer_return null_timeout_rq(struct request *rq, bool res)
 {
+	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	struct nullb_queue *nq = cmd->nq;
+
 	pr_info("rq %p timed out\n", rq);
+
+	if (nq->poll) {
+		spin_lock(&nq->poll_lock);
+		list_del_init(&cmd->list);
+		spin_unlock(&nq->poll_lock);
+	}
 	blk_mq_complete_request(rq);
 	return BLK_EH_DONE;
 }
@@ -1453,6 +1581,7 @@ static blk_status_t null_queue_rq(struct blk_mq_hw_ctx *hctx,
 	cmd->rq = bd->rq;
 	cmd->error = BLK_STS_OK;
 	cmd->nq = nq;
+	INIT_LIST_HEAD(&cmd->list);
 
 	blk_mq_start_request(bd->rq);
 
@@ -1475,6 +1604,30 @@ static blk_status_t null_queue_rq(struct blk_mq_hw_ctx *hctx,
 	return null_handle_cmd(cmd, sector, nr_sectors, req_op(bd->rq));
 }
 
+static int null_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct nullb_queue *nq = hctx->driver_data;
+	struct nullb_cmd *cmd, *next;
+	u64 now = ktime_get_ns();
+	LIST_HEAD(done);
+	int nr = 0;
+
+	spin_lock(&nq->poll_lock);
+	list_for_each_entry_safe(cmd, next, &nq->poll_list, list) {
+		if (cmd->deadline <= now)
+			list_move_tail(&cmd->list, &done);
+	}
+	spin_unlock(&nq->poll_lock);
+
+	list_for_each_entry_safe(cmd, next, &done, list) {
+		list_del_init(&cmd->list);
+		end_cmd(cmd);
+		nr++;
+	}
+
+	return nr;
+}
+
 static void cleanup_queue(struct nullb_queue *nq)
 {
 	kfree(nq->tag_map);
@@ -1504,6 +1657,9 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 	init_waitqueue_head(&nq->wait);
 	nq->queue_depth = nullb->queue_depth;
 	nq->dev = nullb->dev;
+	nq->poll = false;
+	spin_lock_init(&nq->poll_lock);
+	INIT_LIST_HEAD(&nq->poll_list);
 }
 
 static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *driver_data,
@@ -1520,15 +1676,54 @@ static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *driver_data,
 	nq = &nullb->queues[hctx_idx];
 	hctx->driver_data = nq;
 	null_init_queue(nullb, nq);
+	nq->poll = hctx->type == HCTX_TYPE_POLL;
 	nullb->nr_queues++;
 
 	return 0;
 }
 
+static int null_map_queues(struct blk_mq_tag_set *set)
+{
+	struct nullb *nullb = set->driver_data;
+	unsigned int submit_queues = g_submit_queues;
+	unsigned int poll_queues = g_poll_queues;
+	int i, qoff;
+
+	if (nullb) {
+		submit_queues = nullb->dev->submit_queues;
+		poll_queues = nullb->dev->poll_queues;
+	}
+
+	for (i = 0, qoff = 0; i < set->nr_maps; i++) {
+		struct blk_mq_queue_map *map = &set->map[i];
+
+		switch (i) {
+		case HCTX_TYPE_DEFAULT:
+			map->nr_queues = submit_queues;
+			break;
+		case HCTX_TYPE_POLL:
+			map->nr_queues = poll_queues;
+			break;
+		default:
+			/* reads share the default queues */
+			map->nr_queues = 0;
+			continue;
+		}
+
+		map->queue_offset = qoff;
+		qoff += map->nr_queues;
+		blk_mq_map_queues(map);
+	}
+
+	return 0;
+}
+
 static const struct blk_mq_ops null_mq_ops = {
 	.queue_rq       = null_queue_rq,
 	.complete	= null_complete_rq,
 	.timeout	= null_timeout_rq,
+	.poll		= null_poll,
+	.map_queues	= null_map_queues,
 	.init_hctx	= null_init_hctx,
 	.exit_hctx	= null_exit_hctx,
 };
@@ -1682,9 +1877,13 @@ static int null_gendisk_register(struct nullb *nullb)
 
 static int null_init_tag_set(struct nullb *nullb, struct blk_mq_tag_set *set)
 {
+	unsigned int poll_queues = nullb ? nullb->dev->poll_queues :
+						g_poll_queues;
+
 	set->ops = &null_mq_ops;
-	set->nr_hw_queues = nullb ? nullb->dev->submit_queues :
-						g_submit_queues;
+	set->nr_hw_queues = (nullb ? nullb->dev->submit_queues :
+						g_submit_queues) + poll_queues;
+	set->nr_maps = poll_queues ? HCTX_MAX_TYPES : 1;
 	set->queue_depth = nullb ? nullb->dev->hw_queue_depth :
 						g_hw_queue_depth;
 	set->numa_node = nullb ? nullb->dev->home_node : g_home_node;
@@ -1692,7 +1891,7 @@ static int null_init_tag_set(struct nullb *nullb, struct blk_mq_tag_set *set)
 	set->flags = BLK_MQ_F_SHOULD_MERGE;
 	if (g_no_sched)
 		set->flags |= BLK_MQ_F_NO_SCHED;
-	set->driver_data = NULL;
+	set->driver_data = nullb;
 
 	if ((nullb && nullb->dev->blocking) || g_blocking)
 		set->flags |= BLK_MQ_F_BLOCKING;
@@ -1715,6 +1914,16 @@ static int null_validate_conf(struct nullb_device *dev)
 
 	dev->queue_mode = min_t(unsigned int, dev->queue_mode, NULL_Q_MQ);
 	dev->irqmode = min_t(unsigned int, dev->irqmode, NULL_IRQ_TIMER);
+	dev->latency_model = min_t(unsigned int, dev->latency_model,
+				   NULL_LAT_LOGNORMAL);
+	dev->latency_tail_ppm = min_t(unsigned int, dev->latency_tail_ppm,
+				      1000000);
+
+	/* poll queues need blk-mq and share the per-device queue array */
+	if (dev->queue_mode != NULL_Q_MQ)
+		dev->poll_queues = 0;
+	dev->poll_queues = min_t(unsigned int, dev->poll_queues,
+				 nr_cpu_ids - dev->submit_queues);
 
 	/* Do memory allocation, so set blocking */
 	if (dev->memory_backed)
@@ -1909,6 +2118,11 @@ static int __init null_init(void)
 	else if (g_submit_queues <= 0)
 		g_submit_queues = 1;
 
+	if (g_queue_mode != NULL_Q_MQ || g_poll_queues < 0)
+		g_poll_queues = 0;
+	else if (g_poll_queues > nr_cpu_ids - g_submit_queues)
+		g_poll_queues = nr_cpu_ids - g_submit_queues;
+
 	if (g_queue_mode == NULL_Q_MQ && shared_tags) {
 		ret = null_init_tag_set(NULL, &tag_set);
 		if (ret)
@@ -14,6 +14,7 @@
 #include <linux/idr.h>
 #include <linux/blk-mq.h>
 #include <linux/blk-mq-virtio.h>
+#include <linux/dma-mapping.h>
 #include <linux/numa.h>
 #include <uapi/linux/virtio_ring.h>
 
@@ -26,9 +27,16 @@ static DEFINE_IDA(vd_index_ida);
 
 static struct workqueue_struct *virtblk_wq;
 
+static unsigned int poll_queues;
+module_param(poll_queues, uint, 0644);
+MODULE_PARM_DESC(poll_queues, "The number of dedicated virtqueues for polling I/O");
+
 struct virtio_blk_vq {
 	struct virtqueue *vq;
 	spinlock_t lock;
+	/* Device notifications and interrupts, protected by lock */
+	unsigned long kicks;
+	unsigned long irqs;
 	char name[VQ_NAME_LEN];
 } ____cacheline_aligned_in_smp;
 
@@ -68,18 +76,26 @@ struct virtio_blk {
 
 	/* num of vqs */
 	int num_vqs;
+	int io_queues[HCTX_MAX_TYPES];
 	struct virtio_blk_vq *vqs;
 };
 
-struct virtblk_req {
+struct virtblk_req_hdr {
 	struct virtio_blk_outhdr out_hdr;
 	u8 status;
+};
+
+struct virtblk_req {
+	/* Points to inline_hdr, or to memory already shared with the device */
+	struct virtblk_req_hdr *hdr;
+	struct virtblk_req_hdr inline_hdr;
+	unsigned int sg_num;
 	struct scatterlist sg[];
 };
 
 static inline blk_status_t virtblk_result(struct virtblk_req *vbr)
 {
-	switch (vbr->status) {
+	switch (vbr->hdr->status) {
 	case VIRTIO_BLK_S_OK:
 		return BLK_STS_OK;
 	case VIRTIO_BLK_S_UNSUPP:
@@ -95,17 +111,17 @@ static int virtblk_add_req(struct virtqueue *vq, struct virtblk_req *vbr,
 	struct scatterlist hdr, status, *sgs[3];
 	unsigned int num_out = 0, num_in = 0;
 
-	sg_init_one(&hdr, &vbr->out_hdr, sizeof(vbr->out_hdr));
+	sg_init_one(&hdr, &vbr->hdr->out_hdr, sizeof(vbr->hdr->out_hdr));
 	sgs[num_out++] = &hdr;
 
 	if (have_data) {
-		if (vbr->out_hdr.type & cpu_to_virtio32(vq->vdev, VIRTIO_BLK_T_OUT))
+		if (vbr->hdr->out_hdr.type & cpu_to_virtio32(vq->vdev, VIRTIO_BLK_T_OUT))
 			sgs[num_out++] = data_sg;
 		else
 			sgs[num_out + num_in++] = data_sg;
 	}
 
-	sg_init_one(&status, &vbr->status, sizeof(vbr->status));
+	sg_init_one(&status, &vbr->hdr->status, sizeof(vbr->hdr->status));
 	sgs[num_out + num_in++] = &status;
 
 	return virtqueue_add_sgs(vq, sgs, num_out, num_in, vbr, GFP_ATOMIC);
@@ -144,15 +160,20 @@ static int virtblk_setup_discard_write_zeroes(struct request *req, bool unmap)
 	return 0;
 }
 
-static inline void virtblk_request_done(struct request *req)
+static void virtblk_cleanup_cmd(struct request *req)
 {
-	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
-
 	if (req->rq_flags & RQF_SPECIAL_PAYLOAD) {
 		kfree(page_address(req->special_vec.bv_page) +
 		      req->special_vec.bv_offset);
+		req->rq_flags &= ~RQF_SPECIAL_PAYLOAD;
 	}
+}
 
+static inline void virtblk_request_done(struct request *req)
+{
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+
+	virtblk_cleanup_cmd(req);
 	blk_mq_end_request(req, virtblk_result(vbr));
 }
 
@@ -166,6 +187,7 @@ static void virtblk_done(struct virtqueue *vq)
 	unsigned int len;
 
 	spin_lock_irqsave(&vblk->vqs[qid].lock, flags);
+	vblk->vqs[qid].irqs++;
 	do {
 		virtqueue_disable_cb(vq);
 		while ((vbr = virtqueue_get_buf(vblk->vqs[qid].vq, &len)) != NULL) {
@@ -193,23 +215,23 @@ static void virtio_commit_rqs(struct blk_mq_hw_ctx *hctx)
 
 	spin_lock_irq(&vq->lock);
 	kick = virtqueue_kick_prepare(vq->vq);
+	if (kick)
+		vq->kicks++;
 	spin_unlock_irq(&vq->lock);
 
 	if (kick)
 		virtqueue_notify(vq->vq);
 }
 
-static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
-			   const struct blk_mq_queue_data *bd)
+/*
+ * Build the request header and map the data.  The request is only started
+ * once nothing can fail anymore, so that it can still be handed back to
+ * blk-mq untouched.
+ */
+static blk_status_t virtblk_prep_rq(struct virtio_blk *vblk,
+				    struct request *req)
 {
-	struct virtio_blk *vblk = hctx->queue->queuedata;
-	struct request *req = bd->rq;
 	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
-	unsigned long flags;
-	unsigned int num;
-	int qid = hctx->queue_num;
-	int err;
-	bool notify = false;
 	bool unmap = false;
 	u32 type;
 
@@ -238,31 +260,51 @@ static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 		return BLK_STS_IOERR;
 	}
 
-	vbr->out_hdr.type = cpu_to_virtio32(vblk->vdev, type);
-	vbr->out_hdr.sector = type ?
+	vbr->hdr->out_hdr.type = cpu_to_virtio32(vblk->vdev, type);
+	vbr->hdr->out_hdr.sector = type ?
 		0 : cpu_to_virtio64(vblk->vdev, blk_rq_pos(req));
-	vbr->out_hdr.ioprio = cpu_to_virtio32(vblk->vdev, req_get_ioprio(req));
-
-	blk_mq_start_request(req);
+	vbr->hdr->out_hdr.ioprio = cpu_to_virtio32(vblk->vdev, req_get_ioprio(req));
 
 	if (type == VIRTIO_BLK_T_DISCARD || type == VIRTIO_BLK_T_WRITE_ZEROES) {
-		err = virtblk_setup_discard_write_zeroes(req, unmap);
-		if (err)
+		if (virtblk_setup_discard_write_zeroes(req, unmap))
 			return BLK_STS_RESOURCE;
 	}
 
-	num = blk_rq_map_sg(hctx->queue, req, vbr->sg);
-	if (num) {
+	vbr->sg_num = blk_rq_map_sg(req->q, req, vbr->sg);
+	if (vbr->sg_num) {
 		if (rq_data_dir(req) == WRITE)
-			vbr->out_hdr.type |= cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_OUT);
+			vbr->hdr->out_hdr.type |= cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_OUT);
 		else
-			vbr->out_hdr.type |= cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_IN);
+			vbr->hdr->out_hdr.type |= cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_IN);
 	}
 
+	blk_mq_start_request(req);
+	return BLK_STS_OK;
+}
+
+static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
+			   const struct blk_mq_queue_data *bd)
+{
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	struct request *req = bd->rq;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+	unsigned long flags;
+	int qid = hctx->queue_num;
+	blk_status_t status;
+	int err;
+	bool notify = false;
+
+	status = virtblk_prep_rq(vblk, req);
+	if (status)
+		return status;
+
 	spin_lock_irqsave(&vblk->vqs[qid].lock, flags);
-	err = virtblk_add_req(vblk->vqs[qid].vq, vbr, vbr->sg, num);
+	err = virtblk_add_req(vblk->vqs[qid].vq, vbr, vbr->sg, vbr->sg_num);
 	if (err) {
 		virtqueue_kick(vblk->vqs[qid].vq);
+		vblk->vqs[qid].kicks++;
+		/* The request is issued again from scratch */
+		virtblk_cleanup_cmd(req);
 		/* Don't stop the queue if -ENOMEM: we may have failed to
 		 * bounce the buffer due to global resource outage.
 		 */
@@ -279,8 +321,10 @@ static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 		}
 	}
 
-	if (bd->last && virtqueue_kick_prepare(vblk->vqs[qid].vq))
+	if (bd->last && virtqueue_kick_prepare(vblk->vqs[qid].vq)) {
+		vblk->vqs[qid].kicks++;
 		notify = true;
+	}
 	spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
 
 	if (notify)
@@ -288,6 +332,66 @@ static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 	return BLK_STS_OK;
 }
 
+/*
+ * Add all requests of @list to the ring of @vq under one lock round trip and
+ * notify the device once.  Requests that don't fit are requeued rather than
+ * handed back, as they have been started already.
+ */
+static void virtblk_add_req_batch(struct virtio_blk_vq *vq,
+				  struct list_head *list)
+{
+	struct request *req, *next;
+	unsigned long flags;
+	bool kick;
+
+	if (list_empty(list))
+		return;
+
+	spin_lock_irqsave(&vq->lock, flags);
+	list_for_each_entry_safe(req, next, list, queuelist) {
+		struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+
+		list_del_init(&req->queuelist);
+		if (virtblk_add_req(vq->vq, vbr, vbr->sg, vbr->sg_num)) {
+			virtblk_cleanup_cmd(req);
+			blk_mq_requeue_request(req, true);
+		}
+	}
+
+	kick = virtqueue_kick_prepare(vq->vq);
+	if (kick)
+		vq->kicks++;
+	spin_unlock_irqrestore(&vq->lock, flags);
+
+	if (kick)
+		virtqueue_notify(vq->vq);
+}
+
+static void virtio_queue_rqs(struct list_head *rqlist)
+{
+	struct virtio_blk_vq *vq = NULL;
+	struct request *req, *next;
+	LIST_HEAD(submit);
+
+	list_for_each_entry_safe(req, next, rqlist, queuelist) {
+		struct virtio_blk *vblk = req->q->queuedata;
+		struct virtio_blk_vq *this_vq =
+			&vblk->vqs[req->mq_hctx->queue_num];
+
+		if (vq && this_vq != vq)
+			virtblk_add_req_batch(vq, &submit);
+		vq = this_vq;
+
+		/* Left on @rqlist for the one at a time path */
+		if (virtblk_prep_rq(vblk, req) != BLK_STS_OK)
+			continue;
+		list_move_tail(&req->queuelist, &submit);
+	}
+
+	if (vq)
+		virtblk_add_req_batch(vq, &submit);
+}
+
 /* return id (s/n) string for *disk to *id_str
  */
 static int virtblk_get_id(struct gendisk *disk, char *id_str)
@@ -481,6 +585,7 @@ static int init_vq(struct virtio_blk *vblk)
 	const char **names;
 	struct virtqueue **vqs;
 	unsigned short num_vqs;
+	unsigned int num_poll_vqs;
 	struct virtio_device *vdev = vblk->vdev;
 	struct irq_affinity desc = { 0, };
 
@@ -492,6 +597,13 @@ static int init_vq(struct virtio_blk *vblk)
 
 	num_vqs = min_t(unsigned int, nr_cpu_ids, num_vqs);
 
+	/* Keep at least one queue with interrupts for passthrough requests */
+	num_poll_vqs = min_t(unsigned int, poll_queues, num_vqs - 1);
+
+	vblk->io_queues[HCTX_TYPE_DEFAULT] = num_vqs - num_poll_vqs;
+	vblk->io_queues[HCTX_TYPE_READ] = 0;
+	vblk->io_queues[HCTX_TYPE_POLL] = num_poll_vqs;
+
 	vblk->vqs = kmalloc_array(num_vqs, sizeof(*vblk->vqs), GFP_KERNEL);
 	if (!vblk->vqs)
 		return -ENOMEM;
@@ -504,12 +616,19 @@ static int init_vq(struct virtio_blk *vblk)
 		goto out;
 	}
 
-	for (i = 0; i < num_vqs; i++) {
+	for (i = 0; i < num_vqs - num_poll_vqs; i++) {
 		callbacks[i] = virtblk_done;
 		snprintf(vblk->vqs[i].name, VQ_NAME_LEN, "req.%d", i);
 		names[i] = vblk->vqs[i].name;
 	}
 
+	/* Polled virtqueues have no callback and thus no interrupt vector */
+	for (; i < num_vqs; i++) {
+		callbacks[i] = NULL;
+		snprintf(vblk->vqs[i].name, VQ_NAME_LEN, "req_poll.%d", i);
+		names[i] = vblk->vqs[i].name;
+	}
+
 	/* Discover virtqueues and write information to configuration.  */
 	err = virtio_find_vqs(vdev, num_vqs, vqs, callbacks, names, &desc);
 	if (err)
@@ -518,6 +637,8 @@ static int init_vq(struct virtio_blk *vblk)
 	for (i = 0; i < num_vqs; i++) {
 		spin_lock_init(&vblk->vqs[i].lock);
 		vblk->vqs[i].vq = vqs[i];
+		vblk->vqs[i].kicks = 0;
+		vblk->vqs[i].irqs = 0;
 	}
 	vblk->num_vqs = num_vqs;
 
@@ -622,9 +743,31 @@ cache_type_show(struct device *dev, struct device_attribute *attr, char *buf)
 
 static DEVICE_ATTR_RW(cache_type);
 
+/* One line per virtqueue: name, device notifications, interrupts */
+static ssize_t
+vq_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gendisk *disk = dev_to_disk(dev);
+	struct virtio_blk *vblk = disk->private_data;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < vblk->num_vqs; i++) {
+		struct virtio_blk_vq *vq = &vblk->vqs[i];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %lu %lu\n",
+				 vq->name, READ_ONCE(vq->kicks),
+				 READ_ONCE(vq->irqs));
+	}
+	return len;
+}
+
+static DEVICE_ATTR_RO(vq_stats);
+
 static struct attribute *virtblk_attrs[] = {
 	&dev_attr_serial.attr,
 	&dev_attr_cache_type.attr,
+	&dev_attr_vq_stats.attr,
 	NULL,
 };
 
@@ -660,23 +803,103 @@ static int virtblk_init_request(struct blk_mq_tag_set *set, struct request *rq,
 	struct virtblk_req *vbr = blk_mq_rq_to_pdu(rq);
 
 	sg_init_table(vbr->sg, vblk->sg_elems);
+
+	/*
+	 * The header and status byte are mapped for every request; keep them
+	 * in shared memory when available so they are not bounced.
+	 */
+	vbr->hdr = dma_alloc_shared(sizeof(*vbr->hdr));
+	if (!vbr->hdr)
+		vbr->hdr = &vbr->inline_hdr;
 	return 0;
 }
 
+static void virtblk_exit_request(struct blk_mq_tag_set *set, struct request *rq,
+		unsigned int hctx_idx)
+{
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(rq);
+
+	if (vbr->hdr != &vbr->inline_hdr)
+		dma_free_shared(vbr->hdr, sizeof(*vbr->hdr));
+}
+
 static int virtblk_map_queues(struct blk_mq_tag_set *set)
 {
 	struct virtio_blk *vblk = set->driver_data;
+	int i, qoff;
+
+	for (i = 0, qoff = 0; i < set->nr_maps; i++) {
+		struct blk_mq_queue_map *map = &set->map[i];
+
+		map->nr_queues = vblk->io_queues[i];
+		map->queue_offset = qoff;
+		qoff += map->nr_queues;
+
+		if (map->nr_queues == 0)
+			continue;
+
+		/*
+		 * The interrupt driven queues follow the affinity of their
+		 * vectors, polled queues have none so spread them evenly.
+		 */
+		if (i == HCTX_TYPE_POLL)
+			blk_mq_map_queues(map);
+		else
+			blk_mq_virtio_map_queues(map, vblk->vdev, 0);
+	}
+
+	return 0;
+}
+
+static void virtblk_complete_batch(struct io_comp_batch *iob)
+{
+	struct request *req;
+
+	for (req = iob->req_list; req; req = req->rq_next)
+		virtblk_cleanup_cmd(req);
+	blk_mq_end_request_batch(iob);
+}
+
+static int virtblk_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	struct virtio_blk_vq *vq = &vblk->vqs[hctx->queue_num];
+	DEFINE_IO_COMP_BATCH(iob);
+	struct virtblk_req *vbr;
+	unsigned long flags;
+	unsigned int len;
+	int found = 0;
+
+	spin_lock_irqsave(&vq->lock, flags);
+	while ((vbr = virtqueue_get_buf(vq->vq, &len)) != NULL) {
+		struct request *req = blk_mq_rq_from_pdu(vbr);
+
+		found++;
+		if (!blk_mq_complete_request_remote(req) &&
+		    !blk_mq_add_to_batch(req, &iob, vbr->hdr->status,
+					 virtblk_complete_batch))
+			virtblk_request_done(req);
+	}
+
+	/* In case queue is stopped waiting for more buffers. */
+	if (found)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
+	spin_unlock_irqrestore(&vq->lock, flags);
 
-	return blk_mq_virtio_map_queues(&set->map[HCTX_TYPE_DEFAULT],
-					vblk->vdev, 0);
+	if (iob.req_list)
+		iob.complete(&iob);
+	return found;
 }
 
 static const struct blk_mq_ops virtio_mq_ops = {
 	.queue_rq	= virtio_queue_rq,
 	.commit_rqs	= virtio_commit_rqs,
+	.queue_rqs	= virtio_queue_rqs,
 	.complete	= virtblk_request_done,
 	.init_request	= virtblk_init_request,
+	.exit_request	= virtblk_exit_request,
 	.map_queues	= virtblk_map_queues,
+	.poll		= virtblk_poll,
 };
 
 static unsigned int virtblk_queue_depth;
@@ -759,6 +982,9 @@ static int virtblk_probe(struct virtio_device *vdev)
 		sizeof(struct scatterlist) * sg_elems;
 	vblk->tag_set.driver_data = vblk;
 	vblk->tag_set.nr_hw_queues = vblk->num_vqs;
+	vblk->tag_set.nr_maps = 1;
+	if (vblk->io_queues[HCTX_TYPE_POLL])
+		vblk->tag_set.nr_maps = 3;
 
 	err = blk_mq_alloc_tag_set(&vblk->tag_set);
 	if (err)
@@ -288,15 +288,42 @@ static ssize_t mem_used_max_store(struct device *dev,
 	return len;
 }
 
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+static bool zram_accessed_before(struct zram *zram, u32 index, ktime_t cutoff)
+{
+	return !cutoff || ktime_before(zram->table[index].ac_time, cutoff);
+}
+#else
+static bool zram_accessed_before(struct zram *zram, u32 index, ktime_t cutoff)
+{
+	return true;
+}
+#endif
+
+/*
+ * "all" marks every stored page idle.  With memory tracking a number of
+ * seconds marks only the pages that were not accessed for that long.
+ */
 static ssize_t idle_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
 	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	ktime_t cutoff = 0;
 	int index;
 
-	if (!sysfs_streq(buf, "all"))
+	if (!sysfs_streq(buf, "all")) {
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+		u64 age_sec;
+
+		if (kstrtoull(buf, 10, &age_sec) || !age_sec)
+			return -EINVAL;
+		cutoff = ktime_sub(ktime_get_boottime(),
+				   ns_to_ktime(age_sec * NSEC_PER_SEC));
+#else
 		return -EINVAL;
+#endif
+	}
 
 	down_read(&zram->init_lock);
 	if (!init_done(zram)) {
@@ -311,7 +338,8 @@ static ssize_t idle_store(struct device *dev,
 		 */
 		zram_slot_lock(zram, index);
 		if (zram_allocated(zram, index) &&
-				!zram_test_flag(zram, index, ZRAM_UNDER_WB))
+				!zram_test_flag(zram, index, ZRAM_UNDER_WB) &&
+				zram_accessed_before(zram, index, cutoff))
 			zram_set_flag(zram, index, ZRAM_IDLE);
 		zram_slot_unlock(zram, index);
 	}
@@ -553,19 +581,31 @@ out:
 	return err;
 }
 
-static unsigned long alloc_block_bdev(struct zram *zram)
+/*
+ * Allocate @nr consecutive blocks on the backing device, returns the first
+ * one or 0 if there is no free range that large.
+ */
+static unsigned long alloc_block_bdev(struct zram *zram, unsigned int nr)
 {
 	unsigned long blk_idx = 1;
+	unsigned int i;
 retry:
 	/* skip 0 bit to confuse zram.handle = 0 */
-	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
-	if (blk_idx == zram->nr_pages)
+	blk_idx = bitmap_find_next_zero_area(zram->bitmap, zram->nr_pages,
+					     blk_idx, nr, 0);
+	if (blk_idx + nr > zram->nr_pages)
 		return 0;
 
-	if (test_and_set_bit(blk_idx, zram->bitmap))
-		goto retry;
+	for (i = 0; i < nr; i++) {
+		if (test_and_set_bit(blk_idx + i, zram->bitmap)) {
+			while (i--)
+				clear_bit(blk_idx + i, zram->bitmap);
+			blk_idx++;
+			goto retry;
+		}
+	}
 
-	atomic64_inc(&zram->stats.bd_count);
+	atomic64_add(nr, &zram->stats.bd_count);
 	return blk_idx;
 }
 
@@ -621,18 +661,128 @@ static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
 #define HUGE_WRITEBACK 1
 #define IDLE_WRITEBACK 2
 
+/* Number of pages written back with one bio */
+#define ZRAM_WB_BATCH 32
+
+struct zram_wb_batch {
+	struct page *pages[ZRAM_WB_BATCH];
+	struct bio_vec bvecs[ZRAM_WB_BATCH];
+	u32 index[ZRAM_WB_BATCH];
+	unsigned int nr;
+};
+
+static void zram_wb_release(struct zram *zram, struct zram_wb_batch *wb,
+			    unsigned int first, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = first; i < first + nr; i++) {
+		zram_slot_lock(zram, wb->index[i]);
+		zram_clear_flag(zram, wb->index[i], ZRAM_UNDER_WB);
+		zram_clear_flag(zram, wb->index[i], ZRAM_IDLE);
+		zram_slot_unlock(zram, wb->index[i]);
+	}
+}
+
+/*
+ * Write @nr pages of the batch starting at @first to consecutive blocks of
+ * the backing device.  Falls back to smaller bios if the backing device is
+ * too fragmented for the whole range.
+ */
+static int zram_wb_write(struct zram *zram, struct zram_wb_batch *wb,
+			 unsigned int first, unsigned int nr)
+{
+	unsigned long blk_idx;
+	struct bio bio;
+	unsigned int i;
+	int ret;
+
+	blk_idx = alloc_block_bdev(zram, nr);
+	if (!blk_idx) {
+		unsigned int half = nr / 2;
+
+		if (!half) {
+			zram_wb_release(zram, wb, first, nr);
+			return -ENOSPC;
+		}
+		ret = zram_wb_write(zram, wb, first, half);
+		if (ret == -ENOSPC) {
+			zram_wb_release(zram, wb, first + half, nr - half);
+			return ret;
+		}
+		return zram_wb_write(zram, wb, first + half, nr - half) ?: ret;
+	}
+
+	bio_init(&bio, wb->bvecs, nr);
+	bio_set_dev(&bio, zram->bdev);
+	bio.bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
+	bio.bi_opf = REQ_OP_WRITE | REQ_SYNC;
+	for (i = first; i < first + nr; i++)
+		bio_add_page(&bio, wb->pages[i], PAGE_SIZE, 0);
+
+	ret = submit_bio_wait(&bio);
+	if (ret) {
+		for (i = 0; i < nr; i++)
+			free_block_bdev(zram, blk_idx + i);
+		zram_wb_release(zram, wb, first, nr);
+		return ret;
+	}
+
+	atomic64_add(nr, &zram->stats.bd_writes);
+	for (i = 0; i < nr; i++) {
+		u32 index = wb->index[first + i];
+
+		/*
+		 * We released zram_slot_lock so need to check if the slot was
+		 * changed. If there is freeing for the slot, we can catch it
+		 * easily by zram_allocated.
+		 * A subtle case is the slot is freed/reallocated/marked as
+		 * ZRAM_IDLE again. To close the race, idle_store doesn't
+		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
+		 * Thus, we could close the race by checking ZRAM_IDLE bit.
+		 */
+		zram_slot_lock(zram, index);
+		if (!zram_allocated(zram, index) ||
+			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+			free_block_bdev(zram, blk_idx + i);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_set_element(zram, index, blk_idx + i);
+		atomic64_inc(&zram->stats.pages_stored);
+		spin_lock(&zram->wb_limit_lock);
+		if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
+			zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
+		spin_unlock(&zram->wb_limit_lock);
+		zram_slot_unlock(zram, index);
+	}
+
+	return 0;
+}
+
+static int zram_wb_flush(struct zram *zram, struct zram_wb_batch *wb)
+{
+	int ret = zram_wb_write(zram, wb, 0, wb->nr);
+
+	wb->nr = 0;
+	return ret;
+}
+
 static ssize_t writeback_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
 	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
 	unsigned long index;
-	struct bio bio;
-	struct bio_vec bio_vec;
-	struct page *page;
+	struct zram_wb_batch *wb;
 	ssize_t ret = len;
-	int mode;
-	unsigned long blk_idx = 0;
+	int mode, err, i;
 
 	if (sysfs_streq(buf, "idle"))
 		mode = IDLE_WRITEBACK;
@@ -652,35 +802,36 @@ static ssize_t writeback_store(struct device *dev,
 		goto release_init_lock;
 	}
 
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb) {
 		ret = -ENOMEM;
 		goto release_init_lock;
 	}
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		wb->pages[i] = alloc_page(GFP_KERNEL);
+		if (!wb->pages[i]) {
+			ret = -ENOMEM;
+			goto free_batch;
+		}
+	}
 
 	for (index = 0; index < nr_pages; index++) {
 		struct bio_vec bvec;
 
-		bvec.bv_page = page;
+		bvec.bv_page = wb->pages[wb->nr];
 		bvec.bv_len = PAGE_SIZE;
 		bvec.bv_offset = 0;
 
+		/* leave room for the pages already in the batch */
 		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && !zram->bd_wb_limit) {
+		if (zram->wb_limit_enable && zram->bd_wb_limit <=
+				(u64)wb->nr << (PAGE_SHIFT - 12)) {
 			spin_unlock(&zram->wb_limit_lock);
 			ret = -EIO;
 			break;
 		}
 		spin_unlock(&zram->wb_limit_lock);
 
-		if (!blk_idx) {
-			blk_idx = alloc_block_bdev(zram);
-			if (!blk_idx) {
-				ret = -ENOSPC;
-				break;
-			}
-		}
-
 		zram_slot_lock(zram, index);
 		if (!zram_allocated(zram, index))
 			goto next;
@@ -712,61 +863,28 @@ static ssize_t writeback_store(struct device *dev,
 			continue;
 		}
 
-		bio_init(&bio, &bio_vec, 1);
-		bio_set_dev(&bio, zram->bdev);
-		bio.bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
-		bio.bi_opf = REQ_OP_WRITE | REQ_SYNC;
-
-		bio_add_page(&bio, bvec.bv_page, bvec.bv_len,
-				bvec.bv_offset);
-		/*
-		 * XXX: A single page IO would be inefficient for write
-		 * but it would be not bad as starter.
-		 */
-		ret = submit_bio_wait(&bio);
-		if (ret) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
-			continue;
-		}
-
-		atomic64_inc(&zram->stats.bd_writes);
-		/*
-		 * We released zram_slot_lock so need to check if the slot was
-		 * changed. If there is freeing for the slot, we can catch it
-		 * easily by zram_allocated.
-		 * A subtle case is the slot is freed/reallocated/marked as
-		 * ZRAM_IDLE again. To close the race, idle_store doesn't
-		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
-		 * Thus, we could close the race by checking ZRAM_IDLE bit.
-		 */
-		zram_slot_lock(zram, index);
-		if (!zram_allocated(zram, index) ||
-			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			goto next;
+		wb->index[wb->nr++] = index;
+		if (wb->nr == ZRAM_WB_BATCH) {
+			err = zram_wb_flush(zram, wb);
+			if (err)
+				ret = err;
+			if (err == -ENOSPC)
+				break;
 		}
-
-		zram_free_page(zram, index);
-		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-		zram_set_flag(zram, index, ZRAM_WB);
-		zram_set_element(zram, index, blk_idx);
-		blk_idx = 0;
-		atomic64_inc(&zram->stats.pages_stored);
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
-			zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
-		spin_unlock(&zram->wb_limit_lock);
+		continue;
 next:
 		zram_slot_unlock(zram, index);
 	}
 
-	if (blk_idx)
-		free_block_bdev(zram, blk_idx);
-	__free_page(page);
+	if (wb->nr) {
+		err = zram_wb_flush(zram, wb);
+		if (err)
+			ret = err;
+	}
+free_batch:
+	for (i = 0; i < ZRAM_WB_BATCH && wb->pages[i]; i++)
+		__free_page(wb->pages[i]);
+	kfree(wb);
 release_init_lock:
 	up_read(&zram->init_lock);
 
@@ -1013,6 +1131,197 @@ static ssize_t comp_algorithm_store(struct device *dev,
 	return len;
 }
 
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->recompressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char compressor[ARRAY_SIZE(zram->recompressor)];
+	size_t sz;
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	if (!zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+
+	strcpy(zram->recompressor, compressor);
+	up_write(&zram->init_lock);
+	return len;
+}
+
+/*
+ * Recompress the page at @index with the secondary algorithm and keep the
+ * result if it is smaller.  Called with the slot locked, @page is scratch
+ * space for the uncompressed data.
+ */
+static int zram_recompress(struct zram *zram, u32 index, struct page *page)
+{
+	unsigned long handle, new_handle;
+	unsigned int size, comp_len;
+	struct zcomp_strm *zstrm;
+	void *src, *dst;
+	int ret = 0;
+
+	handle = zram_get_handle(zram, index);
+	size = zram_get_obj_size(zram, index);
+
+	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	dst = kmap_atomic(page);
+	if (size == PAGE_SIZE) {
+		memcpy(dst, src, PAGE_SIZE);
+	} else {
+		zstrm = zcomp_stream_get(zram->comp);
+		ret = zcomp_decompress(zstrm, src, size, dst);
+		zcomp_stream_put(zram->comp);
+	}
+	kunmap_atomic(dst);
+	zs_unmap_object(zram->mem_pool, handle);
+	if (ret)
+		return ret;
+
+	zstrm = zcomp_stream_get(zram->recomp);
+	src = kmap_atomic(page);
+	ret = zcomp_compress(zstrm, src, &comp_len);
+	kunmap_atomic(src);
+	if (ret) {
+		zcomp_stream_put(zram->recomp);
+		return ret;
+	}
+
+	/* Not worth it, don't try this page again until it is rewritten */
+	if (comp_len >= size || comp_len >= huge_class_size) {
+		zcomp_stream_put(zram->recomp);
+		zram_set_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+		return 0;
+	}
+
+	/* The slot is locked, so don't enter direct reclaim */
+	new_handle = zs_malloc(zram->mem_pool, comp_len,
+			__GFP_KSWAPD_RECLAIM |
+			__GFP_NOWARN |
+			__GFP_HIGHMEM |
+			__GFP_MOVABLE);
+	if (!new_handle) {
+		zcomp_stream_put(zram->recomp);
+		return -ENOMEM;
+	}
+
+	dst = zs_map_object(zram->mem_pool, new_handle, ZS_MM_WO);
+	memcpy(dst, zstrm->buffer, comp_len);
+	zs_unmap_object(zram->mem_pool, new_handle);
+	zcomp_stream_put(zram->recomp);
+
+	zs_free(zram->mem_pool, handle);
+	atomic64_sub(size, &zram->stats.compr_data_size);
+	atomic64_add(comp_len, &zram->stats.compr_data_size);
+	if (zram_test_flag(zram, index, ZRAM_HUGE)) {
+		zram_clear_flag(zram, index, ZRAM_HUGE);
+		atomic64_dec(&zram->stats.huge_pages);
+	}
+
+	zram_set_handle(zram, index, new_handle);
+	zram_set_obj_size(zram, index, comp_len);
+	zram_set_flag(zram, index, ZRAM_RECOMP);
+	atomic64_inc(&zram->stats.recomp_pages);
+	atomic64_add(comp_len, &zram->stats.recomp_data_size);
+
+	return 0;
+}
+
+#define HUGE_RECOMPRESS 1
+#define IDLE_RECOMPRESS 2
+
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long index;
+	struct page *page;
+	ssize_t ret = len;
+	int mode;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = IDLE_RECOMPRESS;
+	else if (sysfs_streq(buf, "huge"))
+		mode = HUGE_RECOMPRESS;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram) || !zram->recomp) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		ret = -ENOMEM;
+		goto release_init_lock;
+	}
+
+	for (index = 0; index < nr_pages; index++) {
+		int err = 0;
+
+		zram_slot_lock(zram, index);
+		if (!zram_allocated(zram, index) ||
+				!zram_get_handle(zram, index))
+			goto next;
+
+		if (zram_test_flag(zram, index, ZRAM_WB) ||
+				zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+				zram_test_flag(zram, index, ZRAM_RECOMP) ||
+				zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE))
+			goto next;
+
+		if (mode == IDLE_RECOMPRESS &&
+			  !zram_test_flag(zram, index, ZRAM_IDLE))
+			goto next;
+		if (mode == HUGE_RECOMPRESS &&
+			  !zram_test_flag(zram, index, ZRAM_HUGE))
+			goto next;
+
+		err = zram_recompress(zram, index, page);
+next:
+		zram_slot_unlock(zram, index);
+		if (err) {
+			ret = err;
+			break;
+		}
+		cond_resched();
+	}
+
+	__free_page(page);
+release_init_lock:
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
@@ -1069,7 +1378,7 @@ static ssize_t mm_stat_show(struct device *dev,
 	max_used = atomic_long_read(&zram->stats.max_used_pages);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu\n",
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu %8llu\n",
 			orig_size << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.compr_data_size),
 			mem_used << PAGE_SHIFT,
@@ -1077,7 +1386,9 @@ static ssize_t mm_stat_show(struct device *dev,
 			max_used << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.same_pages),
 			pool_stats.pages_compacted,
-			(u64)atomic64_read(&zram->stats.huge_pages));
+			(u64)atomic64_read(&zram->stats.huge_pages),
+			(u64)atomic64_read(&zram->stats.recomp_pages),
+			(u64)atomic64_read(&zram->stats.recomp_data_size));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1181,6 +1492,16 @@ static void zram_free_page(struct zram *zram, size_t index)
 		atomic64_dec(&zram->stats.huge_pages);
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE))
+		zram_clear_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+
+	if (zram_test_flag(zram, index, ZRAM_RECOMP)) {
+		zram_clear_flag(zram, index, ZRAM_RECOMP);
+		atomic64_dec(&zram->stats.recomp_pages);
+		atomic64_sub(zram_get_obj_size(zram, index),
+				&zram->stats.recomp_data_size);
+	}
+
 	if (zram_test_flag(zram, index, ZRAM_WB)) {
 		zram_clear_flag(zram, index, ZRAM_WB);
 		free_block_bdev(zram, zram_get_element(zram, index));
@@ -1213,6 +1534,13 @@ out:
 		~(1UL << ZRAM_LOCK | 1UL << ZRAM_UNDER_WB));
 }
 
+static struct zcomp *zram_slot_comp(struct zram *zram, u32 index)
+{
+	if (zram_test_flag(zram, index, ZRAM_RECOMP))
+		return zram->recomp;
+	return zram->comp;
+}
+
 static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 				struct bio *bio, bool partial_io)
 {
@@ -1257,12 +1585,13 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		kunmap_atomic(dst);
 		ret = 0;
 	} else {
-		struct zcomp_strm *zstrm = zcomp_stream_get(zram->comp);
+		struct zcomp *comp = zram_slot_comp(zram, index);
+		struct zcomp_strm *zstrm = zcomp_stream_get(comp);
 
 		dst = kmap_atomic(page);
 		ret = zcomp_decompress(zstrm, src, size, dst);
 		kunmap_atomic(dst);
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(comp);
 	}
 	zs_unmap_object(zram->mem_pool, handle);
 	zram_slot_unlock(zram, index);
@@ -1675,7 +2004,7 @@ out:
 
 static void zram_reset_device(struct zram *zram)
 {
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp;
 	u64 disksize;
 
 	down_write(&zram->init_lock);
@@ -1688,6 +2017,8 @@ static void zram_reset_device(struct zram *zram)
 	}
 
 	comp = zram->comp;
+	recomp = zram->recomp;
+	zram->recomp = NULL;
 	disksize = zram->disksize;
 	zram->disksize = 0;
 
@@ -1699,6 +2030,8 @@ static void zram_reset_device(struct zram *zram)
 	zram_meta_free(zram, disksize);
 	memset(&zram->stats, 0, sizeof(zram->stats));
 	zcomp_destroy(comp);
+	if (recomp)
+		zcomp_destroy(recomp);
 	reset_bdev(zram);
 }
 
@@ -1706,7 +2039,7 @@ static ssize_t disksize_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	u64 disksize;
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp;
 	struct zram *zram = dev_to_zram(dev);
 	int err;
 
@@ -1735,6 +2068,17 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_free_meta;
 	}
 
+	if (zram->recompressor[0]) {
+		recomp = zcomp_create(zram->recompressor);
+		if (IS_ERR(recomp)) {
+			pr_err("Cannot initialise %s compressing backend\n",
+					zram->recompressor);
+			err = PTR_ERR(recomp);
+			goto out_free_comp;
+		}
+		zram->recomp = recomp;
+	}
+
 	zram->comp = comp;
 	zram->disksize = disksize;
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
@@ -1744,6 +2088,8 @@ static ssize_t disksize_store(struct device *dev,
 
 	return len;
 
+out_free_comp:
+	zcomp_destroy(comp);
 out_free_meta:
 	zram_meta_free(zram, disksize);
 out_unlock:
@@ -1828,6 +2174,8 @@ static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_WO(idle);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(recompress);
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
 static DEVICE_ATTR_WO(writeback);
@@ -1845,6 +2193,8 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_idle.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recompress.attr,
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
 	&dev_attr_writeback.attr,
@@ -759,6 +759,36 @@ static int credit_entropy_bits_safe(struct entropy_store *r, int nbits)
 
 #define CRNG_RESEED_INTERVAL (300*HZ)
 
+/*
+ * Once the crng is ready, get_random_bytes(), getrandom() and /dev/urandom
+ * are served by a ChaCha20 instance per CPU, keyed from the crng above and
+ * used without any lock, with interrupts disabled while the per-CPU state
+ * is touched.  Each use replaces the per-CPU key with the first half of the
+ * first block it produces ("fast key erasure"), which provides backtracking
+ * protection without a separate step.  A per-CPU key is replaced from the
+ * crng after the crng has been reseeded or RNDRESEEDCRNG was issued, both
+ * of which bump crng_generation, or when it is older than
+ * CRNG_RESEED_INTERVAL.
+ *
+ * Requests of up to CRNG_BATCH_MAX bytes are served from a per-CPU batch of
+ * output, which is wiped as it is handed out.
+ */
+#define CRNG_BATCH_SIZE (4 * CHACHA_BLOCK_SIZE)
+#define CRNG_BATCH_MAX CHACHA_BLOCK_SIZE
+
+struct crng_pcpu {
+	__u8		key[CHACHA_KEY_SIZE];
+	__u8		batch[CRNG_BATCH_SIZE];
+	unsigned int	batch_pos;
+	unsigned long	generation;
+	unsigned long	init_time;
+};
+
+static DEFINE_PER_CPU(struct crng_pcpu, crng_pcpu) = {
+	.batch_pos = CRNG_BATCH_SIZE,
+};
+static atomic_long_t crng_generation = ATOMIC_LONG_INIT(1);
+
 static DECLARE_WAIT_QUEUE_HEAD(crng_init_wait);
 
 #ifdef CONFIG_NUMA
@@ -974,6 +1004,8 @@ static void crng_reseed(struct crng_state *crng, struct entropy_store *r)
 	memzero_explicit(&buf, sizeof(buf));
 	crng->init_time = jiffies;
 	spin_unlock_irqrestore(&crng->lock, flags);
+	/* The per-CPU crngs rekey from the new state */
+	atomic_long_inc(&crng_generation);
 	if (crng == &primary_crng && crng_init < 2) {
 		invalidate_batched_entropy();
 		numa_crng_init();
@@ -1063,12 +1095,176 @@ static void crng_backtrack_protect(__u8 tmp[CHACHA_BLOCK_SIZE], int used)
 	_crng_backtrack_protect(crng, tmp, used);
 }
 
+/*
+ * Set up @chacha_state from @key and replace @key with the first half of the
+ * first block, the second half goes to @out.  The caller continues with
+ * the next blocks of @chacha_state, which nothing else can reproduce once
+ * @key is gone.
+ */
+static void crng_fast_key_erasure(__u8 key[CHACHA_KEY_SIZE],
+				  __u32 chacha_state[CHACHA_STATE_WORDS],
+				  __u8 *out, size_t len)
+{
+	__u8 first_block[CHACHA_BLOCK_SIZE];
+
+	BUG_ON(len > CHACHA_BLOCK_SIZE - CHACHA_KEY_SIZE);
+
+	memcpy(&chacha_state[0], "expand 32-byte k", 16);
+	memcpy(&chacha_state[4], key, CHACHA_KEY_SIZE);
+	memset(&chacha_state[12], 0, sizeof(__u32) * 4);
+	chacha20_block(chacha_state, first_block);
+
+	memcpy(key, first_block, CHACHA_KEY_SIZE);
+	memcpy(out, first_block + CHACHA_KEY_SIZE, len);
+	memzero_explicit(first_block, sizeof(first_block));
+}
+
+/* Called with interrupts disabled */
+static void crng_pcpu_maybe_rekey(struct crng_pcpu *pcpu)
+{
+	__u8 tmp[CHACHA_BLOCK_SIZE] __aligned(4);
+
+	if (likely(pcpu->generation == atomic_long_read(&crng_generation) &&
+		   time_before(jiffies, pcpu->init_time + CRNG_RESEED_INTERVAL)))
+		return;
+
+	extract_crng(tmp);
+	memcpy(pcpu->key, tmp, CHACHA_KEY_SIZE);
+	crng_backtrack_protect(tmp, CHACHA_KEY_SIZE);
+	memzero_explicit(tmp, sizeof(tmp));
+
+	/* Output of the old key is not handed out anymore */
+	memzero_explicit(pcpu->batch, sizeof(pcpu->batch));
+	pcpu->batch_pos = CRNG_BATCH_SIZE;
+	/*
+	 * Read after extract_crng(), which may have reseeded and bumped the
+	 * generation, so the new key is not replaced again right away.
+	 */
+	pcpu->generation = atomic_long_read(&crng_generation);
+	pcpu->init_time = jiffies;
+}
+
+static void crng_pcpu_make_state(__u32 chacha_state[CHACHA_STATE_WORDS],
+				 __u8 *out, size_t len)
+{
+	struct crng_pcpu *pcpu;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcpu = this_cpu_ptr(&crng_pcpu);
+	crng_pcpu_maybe_rekey(pcpu);
+	crng_fast_key_erasure(pcpu->key, chacha_state, out, len);
+	local_irq_restore(flags);
+}
+
+static void crng_pcpu_batch_bytes(__u8 *out, size_t len)
+{
+	__u32 chacha_state[CHACHA_STATE_WORDS];
+	struct crng_pcpu *pcpu;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+	pcpu = this_cpu_ptr(&crng_pcpu);
+	crng_pcpu_maybe_rekey(pcpu);
+	if (CRNG_BATCH_SIZE - pcpu->batch_pos < len) {
+		crng_fast_key_erasure(pcpu->key, chacha_state, pcpu->batch, 0);
+		for (i = 0; i < CRNG_BATCH_SIZE; i += CHACHA_BLOCK_SIZE)
+			chacha20_block(chacha_state, &pcpu->batch[i]);
+		memzero_explicit(chacha_state, sizeof(chacha_state));
+		pcpu->batch_pos = 0;
+	}
+	memcpy(out, &pcpu->batch[pcpu->batch_pos], len);
+	memzero_explicit(&pcpu->batch[pcpu->batch_pos], len);
+	pcpu->batch_pos += len;
+	local_irq_restore(flags);
+}
+
+/* Requires crng_ready() */
+static void crng_pcpu_bytes(__u8 *buf, size_t nbytes)
+{
+	__u32 chacha_state[CHACHA_STATE_WORDS];
+	__u8 tmp[CHACHA_BLOCK_SIZE] __aligned(4);
+	size_t len = CHACHA_BLOCK_SIZE - CHACHA_KEY_SIZE;
+
+	if (nbytes <= CRNG_BATCH_MAX) {
+		crng_pcpu_batch_bytes(buf, nbytes);
+		return;
+	}
+
+	crng_pcpu_make_state(chacha_state, buf, len);
+	buf += len;
+	nbytes -= len;
+
+	while (nbytes >= CHACHA_BLOCK_SIZE) {
+		chacha20_block(chacha_state, buf);
+		buf += CHACHA_BLOCK_SIZE;
+		nbytes -= CHACHA_BLOCK_SIZE;
+	}
+
+	if (nbytes) {
+		chacha20_block(chacha_state, tmp);
+		memcpy(buf, tmp, nbytes);
+		memzero_explicit(tmp, sizeof(tmp));
+	}
+	memzero_explicit(chacha_state, sizeof(chacha_state));
+}
+
+/* Requires crng_ready() */
+static ssize_t crng_pcpu_user(void __user *buf, size_t nbytes)
+{
+	__u32 chacha_state[CHACHA_STATE_WORDS];
+	__u8 tmp[CHACHA_BLOCK_SIZE] __aligned(4);
+	int large_request = (nbytes > 256);
+	ssize_t ret = 0;
+	size_t len;
+
+	if (nbytes <= CRNG_BATCH_MAX) {
+		crng_pcpu_batch_bytes(tmp, nbytes);
+		ret = copy_to_user(buf, tmp, nbytes) ? -EFAULT : nbytes;
+		memzero_explicit(tmp, nbytes);
+		return ret;
+	}
+
+	len = CHACHA_BLOCK_SIZE - CHACHA_KEY_SIZE;
+	crng_pcpu_make_state(chacha_state, tmp, len);
+
+	for (;;) {
+		if (copy_to_user(buf, tmp, len)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		nbytes -= len;
+		buf += len;
+		ret += len;
+		if (!nbytes)
+			break;
+
+		if (large_request && need_resched()) {
+			if (signal_pending(current))
+				break;
+			schedule();
+		}
+
+		chacha20_block(chacha_state, tmp);
+		len = min_t(size_t, nbytes, CHACHA_BLOCK_SIZE);
+	}
+
+	memzero_explicit(tmp, sizeof(tmp));
+	memzero_explicit(chacha_state, sizeof(chacha_state));
+	return ret;
+}
+
 static ssize_t extract_crng_user(void __user *buf, size_t nbytes)
 {
 	ssize_t ret = 0, i = CHACHA_BLOCK_SIZE;
 	__u8 tmp[CHACHA_BLOCK_SIZE] __aligned(4);
 	int large_request = (nbytes > 256);
 
+	if (crng_ready())
+		return crng_pcpu_user(buf, nbytes);
+
 	while (nbytes) {
 		if (large_request && need_resched()) {
 			if (signal_pending(current)) {
@@ -1553,6 +1749,12 @@ static void _get_random_bytes(void *buf, int nbytes)
 
 	trace_get_random_bytes(nbytes, _RET_IP_);
 
+	if (crng_ready()) {
+		if (nbytes > 0)
+			crng_pcpu_bytes(buf, nbytes);
+		return;
+	}
+
 	while (nbytes >= CHACHA_BLOCK_SIZE) {
 		extract_crng(buf);
 		buf += CHACHA_BLOCK_SIZE;
@@ -1975,6 +2177,12 @@ static long random_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 			return -ENODATA;
 		crng_reseed(&primary_crng, NULL);
 		crng_global_init_time = jiffies - 1;
+		/*
+		 * The node crngs reseed on their next use, make the per-CPU
+		 * crngs rekey from them after that.
+		 */
+		smp_mb__before_atomic();
+		atomic_long_inc(&crng_generation);
 		return 0;
 	default:
 		return -EINVAL;
@@ -2200,7 +2408,11 @@ u64 get_random_u64(void)
 	batch = raw_cpu_ptr(&batched_entropy_u64);
 	spin_lock_irqsave(&batch->batch_lock, flags);
 	if (batch->position % ARRAY_SIZE(batch->entropy_u64) == 0) {
-		extract_crng((u8 *)batch->entropy_u64);
+		if (crng_ready())
+			crng_pcpu_bytes((u8 *)batch->entropy_u64,
+					sizeof(batch->entropy_u64));
+		else
+			extract_crng((u8 *)batch->entropy_u64);
 		batch->position = 0;
 	}
 	ret = batch->entropy_u64[batch->position++];
@@ -2224,7 +2436,11 @@ u32 get_random_u32(void)
 	batch = raw_cpu_ptr(&batched_entropy_u32);
 	spin_lock_irqsave(&batch->batch_lock, flags);
 	if (batch->position % ARRAY_SIZE(batch->entropy_u32) == 0) {
-		extract_crng((u8 *)batch->entropy_u32);
+		if (crng_ready())
+			crng_pcpu_bytes((u8 *)batch->entropy_u32,
+					sizeof(batch->entropy_u32));
+		else
+			extract_crng((u8 *)batch->entropy_u32);
 		batch->position = 0;
 	}
 	ret = batch->entropy_u32[batch->position++];
@@ -0,0 +1,445 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * amd-pstate.c - AMD Processor P-state Frequency Driver
+ *
+ * Copyright (C) 2020 Advanced Micro Devices, Inc. All Rights Reserved.
+ *
+ * The CPPC MSR interface of AMD processors lets the OS request any
+ * performance level between the lowest and the highest perf of a core,
+ * rather than one of the three P-states described by ACPI _PSS. Requests
+ * are written to MSR_AMD_CPPC_REQ of each core, which makes frequency
+ * changes cheap enough to be done from the scheduler with fast switching.
+ *
+ * In the default mode the driver implements ->target() and ->fast_switch()
+ * for scaling governors such as schedutil. With amd_pstate.autonomous=1 it
+ * implements ->setpolicy() instead, and the hardware selects the
+ * performance level between the policy limits, guided by the energy
+ * performance preference.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/smp.h>
+#include <linux/sched.h>
+#include <linux/cpufreq.h>
+#include <linux/slab.h>
+#include <linux/acpi.h>
+
+#include <acpi/processor.h>
+#include <acpi/cppc_acpi.h>
+
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <asm/cpufeature.h>
+
+#define AMD_PSTATE_TRANSITION_LATENCY	20000	/* ns */
+#define AMD_PSTATE_TRANSITION_DELAY	1000	/* us */
+
+static bool autonomous;
+module_param(autonomous, bool, 0444);
+MODULE_PARM_DESC(autonomous, "Let the hardware select the performance level within the policy limits");
+
+/**
+ * struct amd_cpudata - per-CPU state of the driver
+ * @cpu: CPU number
+ * @cppc_req_cached: last value written to MSR_AMD_CPPC_REQ
+ * @highest_perf: highest performance the core can reach, including boost
+ * @nominal_perf: highest sustained performance
+ * @lowest_nonlinear_perf: lowest performance with non-linear power savings
+ * @lowest_perf: lowest performance
+ * @max_freq: frequency at @highest_perf, in kHz
+ * @min_freq: frequency at @lowest_perf, in kHz
+ * @nominal_freq: frequency at @nominal_perf, in kHz
+ * @lowest_nonlinear_freq: frequency at @lowest_nonlinear_perf, in kHz
+ * @epp_default: energy performance preference set by the firmware
+ */
+struct amd_cpudata {
+	int cpu;
+	u64 cppc_req_cached;
+
+	u32 highest_perf;
+	u32 nominal_perf;
+	u32 lowest_nonlinear_perf;
+	u32 lowest_perf;
+
+	u32 max_freq;
+	u32 min_freq;
+	u32 nominal_freq;
+	u32 lowest_nonlinear_freq;
+
+	u8 epp_default;
+};
+
+static const char * const energy_perf_strings[] = {
+	"default",
+	"performance",
+	"balance_performance",
+	"balance_power",
+	"power",
+};
+
+static const u8 epp_values[] = {
+	0,	/* "default" restores the firmware value */
+	0x00,
+	0x80,
+	0xbf,
+	0xff,
+};
+
+static u32 amd_pstate_freq_to_perf(struct amd_cpudata *cpudata,
+				   unsigned int freq)
+{
+	u32 perf = DIV_ROUND_UP_ULL((u64)freq * cpudata->highest_perf,
+				    cpudata->max_freq);
+
+	return clamp_t(u32, perf, cpudata->lowest_perf, cpudata->highest_perf);
+}
+
+static unsigned int amd_pstate_perf_to_freq(struct amd_cpudata *cpudata,
+					    u32 perf)
+{
+	return div_u64((u64)perf * cpudata->max_freq, cpudata->highest_perf);
+}
+
+/*
+ * Write the request if it changed.  @fast is set on the fast switch path,
+ * which always runs on the CPU being updated with interrupts disabled.
+ */
+static void amd_pstate_update(struct amd_cpudata *cpudata, u32 min_perf,
+			      u32 des_perf, u32 max_perf, bool fast)
+{
+	u64 prev = READ_ONCE(cpudata->cppc_req_cached);
+	u64 value = prev;
+
+	value &= ~(AMD_CPPC_MIN_PERF(~0ULL) | AMD_CPPC_DES_PERF(~0ULL) |
+		   AMD_CPPC_MAX_PERF(~0ULL));
+	value |= AMD_CPPC_MIN_PERF(min_perf) | AMD_CPPC_DES_PERF(des_perf) |
+		 AMD_CPPC_MAX_PERF(max_perf);
+
+	if (value == prev)
+		return;
+
+	WRITE_ONCE(cpudata->cppc_req_cached, value);
+
+	if (fast)
+		wrmsrl(MSR_AMD_CPPC_REQ, value);
+	else
+		wrmsrl_on_cpu(cpudata->cpu, MSR_AMD_CPPC_REQ, value);
+}
+
+static unsigned int amd_pstate_set_freq(struct cpufreq_policy *policy,
+					unsigned int target_freq, bool fast)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+	u32 min_perf, des_perf, max_perf;
+
+	min_perf = amd_pstate_freq_to_perf(cpudata, policy->min);
+	max_perf = amd_pstate_freq_to_perf(cpudata, policy->max);
+	des_perf = clamp_t(u32, amd_pstate_freq_to_perf(cpudata, target_freq),
+			   min_perf, max_perf);
+
+	amd_pstate_update(cpudata, min_perf, des_perf, max_perf, fast);
+
+	return amd_pstate_perf_to_freq(cpudata, des_perf);
+}
+
+static int amd_pstate_target(struct cpufreq_policy *policy,
+			     unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+
+	freqs.old = policy->cur;
+	freqs.new = target_freq;
+
+	cpufreq_freq_transition_begin(policy, &freqs);
+	freqs.new = amd_pstate_set_freq(policy, target_freq, false);
+	cpufreq_freq_transition_end(policy, &freqs, false);
+
+	return 0;
+}
+
+static unsigned int amd_pstate_fast_switch(struct cpufreq_policy *policy,
+					   unsigned int target_freq)
+{
+	return amd_pstate_set_freq(policy, target_freq, true);
+}
+
+static int amd_pstate_set_policy(struct cpufreq_policy *policy)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+	u32 min_perf, max_perf;
+
+	min_perf = amd_pstate_freq_to_perf(cpudata, policy->min);
+	max_perf = amd_pstate_freq_to_perf(cpudata, policy->max);
+
+	if (policy->policy == CPUFREQ_POLICY_PERFORMANCE)
+		min_perf = max_perf;
+
+	/* A desired perf of zero hands the selection to the hardware */
+	amd_pstate_update(cpudata, min_perf, 0, max_perf, false);
+
+	return 0;
+}
+
+static int amd_pstate_verify(struct cpufreq_policy_data *policy)
+{
+	cpufreq_verify_within_cpu_limits(policy);
+
+	return 0;
+}
+
+static int amd_pstate_init_perf(struct amd_cpudata *cpudata)
+{
+	struct cppc_perf_caps caps;
+	u64 cap1;
+	int ret;
+
+	ret = rdmsrl_safe_on_cpu(cpudata->cpu, MSR_AMD_CPPC_CAP1, &cap1);
+	if (ret)
+		return ret;
+
+	cpudata->highest_perf = AMD_CPPC_HIGHEST_PERF(cap1);
+	cpudata->nominal_perf = AMD_CPPC_NOMINAL_PERF(cap1);
+	cpudata->lowest_nonlinear_perf = AMD_CPPC_LOWNONLIN_PERF(cap1);
+	cpudata->lowest_perf = AMD_CPPC_LOWEST_PERF(cap1);
+
+	if (!cpudata->highest_perf || !cpudata->nominal_perf ||
+	    cpudata->lowest_perf > cpudata->nominal_perf)
+		return -ENODEV;
+
+	/* The MSRs only describe perf, the frequencies come from _CPC */
+	ret = cppc_get_perf_caps(cpudata->cpu, &caps);
+	if (ret)
+		return ret;
+
+	if (!caps.nominal_freq)
+		return -ENODEV;
+
+	cpudata->nominal_freq = caps.nominal_freq * 1000;
+	cpudata->max_freq = div_u64((u64)cpudata->nominal_freq *
+				    cpudata->highest_perf,
+				    cpudata->nominal_perf);
+	cpudata->lowest_nonlinear_freq =
+		amd_pstate_perf_to_freq(cpudata, cpudata->lowest_nonlinear_perf);
+	cpudata->min_freq = caps.lowest_freq ? caps.lowest_freq * 1000 :
+		amd_pstate_perf_to_freq(cpudata, cpudata->lowest_perf);
+
+	ret = rdmsrl_safe_on_cpu(cpudata->cpu, MSR_AMD_CPPC_REQ,
+				 &cpudata->cppc_req_cached);
+	if (ret)
+		return ret;
+
+	cpudata->epp_default = cpudata->cppc_req_cached >> 24;
+
+	return 0;
+}
+
+static int amd_pstate_cpu_init(struct cpufreq_policy *policy)
+{
+	struct amd_cpudata *cpudata;
+	int ret;
+
+	cpudata = kzalloc(sizeof(*cpudata), GFP_KERNEL);
+	if (!cpudata)
+		return -ENOMEM;
+
+	cpudata->cpu = policy->cpu;
+
+	ret = wrmsrl_safe_on_cpu(cpudata->cpu, MSR_AMD_CPPC_ENABLE, 1);
+	if (ret)
+		goto free_cpudata;
+
+	ret = amd_pstate_init_perf(cpudata);
+	if (ret)
+		goto free_cpudata;
+
+	policy->cpuinfo.min_freq = cpudata->min_freq;
+	policy->cpuinfo.max_freq = cpudata->max_freq;
+	policy->min = policy->cpuinfo.min_freq;
+	policy->max = policy->cpuinfo.max_freq;
+
+	policy->cpuinfo.transition_latency = AMD_PSTATE_TRANSITION_LATENCY;
+	policy->transition_delay_us = AMD_PSTATE_TRANSITION_DELAY;
+
+	/* Each core has its own request register */
+	policy->fast_switch_possible = true;
+	policy->cur = amd_pstate_perf_to_freq(cpudata,
+		(cpudata->cppc_req_cached >> 16) & 0xff ? :
+		cpudata->nominal_perf);
+
+	policy->driver_data = cpudata;
+
+	return 0;
+
+free_cpudata:
+	kfree(cpudata);
+	return ret;
+}
+
+static int amd_pstate_cpu_exit(struct cpufreq_policy *policy)
+{
+	kfree(policy->driver_data);
+	policy->driver_data = NULL;
+
+	return 0;
+}
+
+static ssize_t show_amd_pstate_highest_perf(struct cpufreq_policy *policy,
+					    char *buf)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+
+	return sprintf(buf, "%u\n", cpudata->highest_perf);
+}
+
+static ssize_t show_amd_pstate_lowest_nonlinear_freq(struct cpufreq_policy *policy,
+						     char *buf)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+
+	return sprintf(buf, "%u\n", cpudata->lowest_nonlinear_freq);
+}
+
+static ssize_t show_amd_pstate_perf_request(struct cpufreq_policy *policy,
+					    char *buf)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+	u64 value = READ_ONCE(cpudata->cppc_req_cached);
+
+	return sprintf(buf, "min=%llu desired=%llu max=%llu\n",
+		       (value >> 8) & 0xff, (value >> 16) & 0xff, value & 0xff);
+}
+
+static ssize_t
+show_energy_performance_available_preferences(struct cpufreq_policy *policy,
+					      char *buf)
+{
+	ssize_t ret = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(energy_perf_strings); i++)
+		ret += sprintf(&buf[ret], "%s ", energy_perf_strings[i]);
+
+	ret += sprintf(&buf[ret], "\n");
+
+	return ret;
+}
+
+static ssize_t show_energy_performance_preference(struct cpufreq_policy *policy,
+						  char *buf)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+	u8 epp = READ_ONCE(cpudata->cppc_req_cached) >> 24;
+	int i;
+
+	for (i = 1; i < ARRAY_SIZE(epp_values); i++) {
+		if (epp == epp_values[i])
+			return sprintf(buf, "%s\n", energy_perf_strings[i]);
+	}
+
+	return sprintf(buf, "%u\n", epp);
+}
+
+static ssize_t store_energy_performance_preference(struct cpufreq_policy *policy,
+						   const char *buf, size_t count)
+{
+	struct amd_cpudata *cpudata = policy->driver_data;
+	char str_preference[21];
+	u64 value;
+	int ret, i;
+	u8 epp;
+
+	ret = sscanf(buf, "%20s", str_preference);
+	if (ret != 1)
+		return -EINVAL;
+
+	i = match_string(energy_perf_strings, ARRAY_SIZE(energy_perf_strings),
+			 str_preference);
+	if (i == 0)
+		epp = cpudata->epp_default;
+	else if (i > 0)
+		epp = epp_values[i];
+	else if (kstrtou8(str_preference, 0, &epp))
+		return -EINVAL;
+
+	/*
+	 * This can race with a fast switch, which only updates the perf
+	 * fields. The hint is then written again by the next request.
+	 */
+	value = READ_ONCE(cpudata->cppc_req_cached);
+	value &= ~AMD_CPPC_ENERGY_PERF_PREF(~0ULL);
+	value |= AMD_CPPC_ENERGY_PERF_PREF(epp);
+	WRITE_ONCE(cpudata->cppc_req_cached, value);
+
+	ret = wrmsrl_on_cpu(cpudata->cpu, MSR_AMD_CPPC_REQ, value);
+
+	return ret ? ret : count;
+}
+
+cpufreq_freq_attr_ro(amd_pstate_highest_perf);
+cpufreq_freq_attr_ro(amd_pstate_lowest_nonlinear_freq);
+cpufreq_freq_attr_ro(amd_pstate_perf_request);
+cpufreq_freq_attr_ro(energy_performance_available_preferences);
+cpufreq_freq_attr_rw(energy_performance_preference);
+
+static struct freq_attr *amd_pstate_attr[] = {
+	&amd_pstate_highest_perf,
+	&amd_pstate_lowest_nonlinear_freq,
+	&amd_pstate_perf_request,
+	&energy_performance_available_preferences,
+	&energy_performance_preference,
+	NULL,
+};
+
+static struct cpufreq_driver amd_pstate_driver = {
+	.flags		= CPUFREQ_CONST_LOOPS,
+	.verify		= amd_pstate_verify,
+	.target		= amd_pstate_target,
+	.fast_switch	= amd_pstate_fast_switch,
+	.init		= amd_pstate_cpu_init,
+	.exit		= amd_pstate_cpu_exit,
+	.attr		= amd_pstate_attr,
+	.name		= "amd-pstate",
+};
+
+static struct cpufreq_driver amd_pstate_autonomous_driver = {
+	.flags		= CPUFREQ_CONST_LOOPS,
+	.verify		= amd_pstate_verify,
+	.setpolicy	= amd_pstate_set_policy,
+	.init		= amd_pstate_cpu_init,
+	.exit		= amd_pstate_cpu_exit,
+	.attr		= amd_pstate_attr,
+	.name		= "amd-pstate",
+};
+
+static int __init amd_pstate_init(void)
+{
+	int ret;
+
+	if (boot_cpu_data.x86_vendor != X86_VENDOR_AMD)
+		return -ENODEV;
+
+	if (!boot_cpu_has(X86_FEATURE_CPPC)) {
+		pr_debug("CPPC MSR interface not supported\n");
+		return -ENODEV;
+	}
+
+	if (cpufreq_get_current_driver())
+		return -EEXIST;
+
+	ret = cpufreq_register_driver(autonomous ?
+				      &amd_pstate_autonomous_driver :
+				      &amd_pstate_driver);
+	if (ret)
+		pr_err("failed to register driver: %d\n", ret);
+
+	return ret;
+}
+device_initcall(amd_pstate_init);
+
+MODULE_AUTHOR("Advanced Micro Devices, Inc.");
+MODULE_DESCRIPTION("AMD Processor P-state Frequency Driver");
+MODULE_LICENSE("GPL");
@@ -13,6 +13,7 @@
 #include <linux/mutex.h>
 #include <linux/module.h>
 #include <linux/pm_qos.h>
+#include <linux/sched/clock.h>
 
 #include "cpuidle.h"
 
@@ -22,6 +23,8 @@ LIST_HEAD(cpuidle_governors);
 struct cpuidle_governor *cpuidle_curr_governor;
 struct cpuidle_governor *cpuidle_prev_governor;
 
+static DEFINE_PER_CPU(u64, cpuidle_wakeup_deadline_ns);
+
 /**
  * cpuidle_find_governor - finds a governor of the specified name
  * @str: the name
@@ -118,3 +121,40 @@ s64 cpuidle_governor_latency_req(unsigned int cpu)
 
 	return (s64)device_req * NSEC_PER_USEC;
 }
+
+/**
+ * cpuidle_expect_wakeup - Hint that the local CPU is about to be woken up
+ * @delay_ns: Expected time till the wakeup.
+ *
+ * Code that knows a wakeup of the local CPU is imminent (for example, the
+ * completion of an I/O request it has just submitted) can call this to let
+ * governors that support it pick an idle state matching the expected delay.
+ * The hint is consumed by the first idle state selection after its deadline.
+ */
+void cpuidle_expect_wakeup(u64 delay_ns)
+{
+	__this_cpu_write(cpuidle_wakeup_deadline_ns, local_clock() + delay_ns);
+}
+EXPORT_SYMBOL_GPL(cpuidle_expect_wakeup);
+
+/**
+ * cpuidle_wakeup_hint - Get the time till the hinted wakeup of a CPU
+ * @cpu: Target CPU
+ *
+ * Returns U64_MAX if there is no pending hint for @cpu.
+ */
+u64 cpuidle_wakeup_hint(unsigned int cpu)
+{
+	u64 *deadline = per_cpu_ptr(&cpuidle_wakeup_deadline_ns, cpu);
+	u64 now = local_clock();
+
+	if (!*deadline)
+		return U64_MAX;
+
+	if (*deadline <= now) {
+		*deadline = 0;
+		return U64_MAX;
+	}
+
+	return *deadline - now;
+}
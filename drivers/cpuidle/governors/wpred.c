@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Wakeup prediction oriented CPU idle governor
+ *
+ * The timer events oriented governor assumes that timers are the dominant
+ * source of CPU wakeups, which is not the case for I/O heavy workloads where
+ * most of the wakeups come from device interrupts.  This governor combines a
+ * few independent sources of information about the next wakeup of the CPU
+ * and uses the earliest of them as the expected idle duration:
+ *
+ * - The time till the closest timer event (sleep length).
+ *
+ * - The average interval between interrupts on the CPU, computed from the
+ *   per-CPU interrupt statistics.
+ *
+ * - If there are tasks waiting for I/O on the CPU, the average duration of the
+ *   idle periods observed while I/O was pending.
+ *
+ * - An explicit hint provided with cpuidle_expect_wakeup().
+ *
+ * The deepest idle state whose target residency fits within the expected idle
+ * duration and whose exit latency meets the current latency constraint is
+ * selected.  After wakeup, the measured idle duration is compared with the
+ * prediction and the result is accounted in the "pred_hits", "pred_early" and
+ * "pred_late" counters of the idle state matching the prediction.
+ */
+
+#include <linux/cpuidle.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/kernel_stat.h>
+#include <linux/sched/clock.h>
+#include <linux/sched/stat.h>
+#include <linux/tick.h>
+
+/*
+ * Weight of the most recent sample in the running averages, as a right shift
+ * of the sample value (1/8).
+ */
+#define EWMA_SHIFT	3
+
+/**
+ * struct wpred_cpu - CPU data used by the wakeup prediction governor.
+ * @time_span_ns: Time between idle state selection and post-wakeup update.
+ * @sleep_length_ns: Time till the closest timer event (at the selection time).
+ * @pred_idx: Index of the idle state matching the predicted idle duration.
+ * @iowait: Whether or not I/O was pending at the selection time.
+ * @irq_stamp_ns: Time of the most recent interrupt rate sample.
+ * @irqs_sum: Interrupt count of the CPU at @irq_stamp_ns.
+ * @irq_interval_ns: Average interval between interrupts on the CPU.
+ * @iowait_ns: Average idle duration observed while I/O was pending.
+ */
+struct wpred_cpu {
+	u64 time_span_ns;
+	u64 sleep_length_ns;
+	int pred_idx;
+	bool iowait;
+	u64 irq_stamp_ns;
+	unsigned int irqs_sum;
+	u64 irq_interval_ns;
+	u64 iowait_ns;
+};
+
+static DEFINE_PER_CPU(struct wpred_cpu, wpred_cpus);
+
+static void wpred_ewma(u64 *avg, u64 sample)
+{
+	if (!*avg)
+		*avg = sample;
+	else
+		*avg = *avg - (*avg >> EWMA_SHIFT) + (sample >> EWMA_SHIFT);
+}
+
+/**
+ * wpred_find_state - Find the deepest enabled state fitting a duration.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ * @duration_ns: Idle duration value to match.
+ */
+static int wpred_find_state(struct cpuidle_driver *drv,
+			    struct cpuidle_device *dev, u64 duration_ns)
+{
+	int i, idx = -1;
+
+	for (i = 0; i < drv->state_count; i++) {
+		if (dev->states_usage[i].disable)
+			continue;
+
+		if (idx >= 0 && drv->states[i].target_residency_ns > duration_ns)
+			break;
+
+		idx = i;
+	}
+	return idx;
+}
+
+/**
+ * wpred_update - Update CPU data after wakeup.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ */
+static void wpred_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct wpred_cpu *cpu_data = per_cpu_ptr(&wpred_cpus, dev->cpu);
+	struct cpuidle_state_usage *usage;
+	u64 measured_ns, lat_ns;
+	int idx;
+
+	if (cpu_data->time_span_ns >= cpu_data->sleep_length_ns) {
+		/*
+		 * One of the safety nets has triggered or the CPU was woken up
+		 * by the closest timer, so it was idle for the entire sleep
+		 * length.
+		 */
+		measured_ns = cpu_data->sleep_length_ns;
+	} else {
+		/*
+		 * As in the TEO governor, take 1/2 of the exit latency as a
+		 * rough approximation of the average wakeup delay.
+		 */
+		lat_ns = drv->states[dev->last_state_idx].exit_latency_ns;
+		measured_ns = dev->last_residency_ns;
+		if (measured_ns >= lat_ns)
+			measured_ns -= lat_ns / 2;
+		else
+			measured_ns /= 2;
+	}
+
+	if (cpu_data->iowait)
+		wpred_ewma(&cpu_data->iowait_ns, measured_ns);
+
+	if (cpu_data->pred_idx < 0)
+		return;
+
+	usage = &dev->states_usage[cpu_data->pred_idx];
+	idx = wpred_find_state(drv, dev, measured_ns);
+	if (idx < cpu_data->pred_idx)
+		usage->pred_early++;
+	else if (idx > cpu_data->pred_idx)
+		usage->pred_late++;
+	else
+		usage->pred_hits++;
+}
+
+/**
+ * wpred_irq_interval - Update and return the average interrupt interval.
+ * @cpu_data: Governor data of the target CPU.
+ * @cpu: Target CPU.
+ * @now: Current time.
+ *
+ * Returns U64_MAX if the interrupt rate of the CPU is not known yet.
+ */
+static u64 wpred_irq_interval(struct wpred_cpu *cpu_data, int cpu, u64 now)
+{
+	unsigned int irqs = kstat_cpu_irqs_sum(cpu);
+	unsigned int delta = irqs - cpu_data->irqs_sum;
+	u64 elapsed = now - cpu_data->irq_stamp_ns;
+
+	if (!cpu_data->irq_stamp_ns) {
+		cpu_data->irq_stamp_ns = now;
+		cpu_data->irqs_sum = irqs;
+		return U64_MAX;
+	}
+
+	/*
+	 * Sample the interrupt rate when interrupts have arrived since the last
+	 * sample, or when none have arrived for longer than the current average
+	 * interval, so that the average grows when the CPU becomes quiet.
+	 */
+	if (delta) {
+		wpred_ewma(&cpu_data->irq_interval_ns, div_u64(elapsed, delta));
+	} else if (elapsed > cpu_data->irq_interval_ns) {
+		wpred_ewma(&cpu_data->irq_interval_ns, elapsed);
+	} else {
+		return cpu_data->irq_interval_ns ?: U64_MAX;
+	}
+
+	cpu_data->irq_stamp_ns = now;
+	cpu_data->irqs_sum = irqs;
+
+	return cpu_data->irq_interval_ns ?: U64_MAX;
+}
+
+/**
+ * wpred_select - Selects the next idle state to enter.
+ * @drv: cpuidle driver containing state data.
+ * @dev: Target CPU.
+ * @stop_tick: Indication on whether or not to stop the scheduler tick.
+ */
+static int wpred_select(struct cpuidle_driver *drv, struct cpuidle_device *dev,
+			bool *stop_tick)
+{
+	struct wpred_cpu *cpu_data = per_cpu_ptr(&wpred_cpus, dev->cpu);
+	s64 latency_req = cpuidle_governor_latency_req(dev->cpu);
+	u64 duration_ns;
+	ktime_t delta_tick;
+	int idx, i;
+
+	if (dev->last_state_idx >= 0) {
+		wpred_update(drv, dev);
+		dev->last_state_idx = -1;
+	}
+
+	cpu_data->time_span_ns = local_clock();
+
+	duration_ns = tick_nohz_get_sleep_length(&delta_tick);
+	cpu_data->sleep_length_ns = duration_ns;
+
+	duration_ns = min(duration_ns, wpred_irq_interval(cpu_data, dev->cpu,
+							  cpu_data->time_span_ns));
+	duration_ns = min(duration_ns, cpuidle_wakeup_hint(dev->cpu));
+
+	cpu_data->iowait = nr_iowait_cpu(dev->cpu) > 0;
+	if (cpu_data->iowait && cpu_data->iowait_ns)
+		duration_ns = min(duration_ns, cpu_data->iowait_ns);
+
+	idx = wpred_find_state(drv, dev, duration_ns);
+	cpu_data->pred_idx = idx;
+
+	/*
+	 * If there is a latency constraint, it may be necessary to use a
+	 * shallower idle state than the one matching the prediction.
+	 */
+	for (i = idx; i > 0; i--) {
+		if (dev->states_usage[i].disable)
+			continue;
+
+		idx = i;
+		if (drv->states[i].exit_latency_ns <= latency_req)
+			break;
+	}
+	if (i == 0)
+		idx = 0;
+
+	if (idx < 0)
+		return 0; /* No states enabled. Must use 0. */
+
+	/*
+	 * Don't stop the tick if the selected state is a polling one or if the
+	 * expected idle duration is shorter than the tick period length.
+	 */
+	if (((drv->states[idx].flags & CPUIDLE_FLAG_POLLING) ||
+	    duration_ns < TICK_NSEC) && !tick_nohz_tick_stopped()) {
+		*stop_tick = false;
+
+		/*
+		 * The tick is not going to be stopped, so if the target
+		 * residency of the state to be returned is not within the time
+		 * till the closest timer including the tick, try to correct
+		 * that.
+		 */
+		if (idx > 0 && drv->states[idx].target_residency_ns > delta_tick)
+			idx = min(idx, wpred_find_state(drv, dev, delta_tick));
+	}
+
+	return idx;
+}
+
+/**
+ * wpred_reflect - Note that governor data for the CPU need to be updated.
+ * @dev: Target CPU.
+ * @state: Entered state.
+ */
+static void wpred_reflect(struct cpuidle_device *dev, int state)
+{
+	struct wpred_cpu *cpu_data = per_cpu_ptr(&wpred_cpus, dev->cpu);
+
+	dev->last_state_idx = state;
+	/*
+	 * If the wakeup was not "natural", but triggered by one of the safety
+	 * nets, assume that the CPU might have been idle for the entire sleep
+	 * length time.
+	 */
+	if (dev->poll_time_limit ||
+	    (tick_nohz_idle_got_tick() && cpu_data->sleep_length_ns > TICK_NSEC)) {
+		dev->poll_time_limit = false;
+		cpu_data->time_span_ns = cpu_data->sleep_length_ns;
+	} else {
+		cpu_data->time_span_ns = local_clock() - cpu_data->time_span_ns;
+	}
+}
+
+/**
+ * wpred_enable_device - Initialize the governor's data for the target CPU.
+ * @drv: cpuidle driver (not used).
+ * @dev: Target CPU.
+ */
+static int wpred_enable_device(struct cpuidle_driver *drv,
+			       struct cpuidle_device *dev)
+{
+	struct wpred_cpu *cpu_data = per_cpu_ptr(&wpred_cpus, dev->cpu);
+
+	memset(cpu_data, 0, sizeof(*cpu_data));
+	cpu_data->pred_idx = -1;
+
+	return 0;
+}
+
+static struct cpuidle_governor wpred_governor = {
+	.name =		"wpred",
+	.rating =	18,
+	.enable =	wpred_enable_device,
+	.select =	wpred_select,
+	.reflect =	wpred_reflect,
+};
+
+static int __init wpred_governor_init(void)
+{
+	return cpuidle_register_governor(&wpred_governor);
+}
+
+postcore_initcall(wpred_governor_init);
@@ -260,6 +260,9 @@ define_show_state_str_function(name)
 define_show_state_str_function(desc)
 define_show_state_ull_function(above)
 define_show_state_ull_function(below)
+define_show_state_ull_function(pred_hits)
+define_show_state_ull_function(pred_early)
+define_show_state_ull_function(pred_late)
 
 static ssize_t show_state_time(struct cpuidle_state *state,
 			       struct cpuidle_state_usage *state_usage,
@@ -316,6 +319,9 @@ define_one_state_ro(time, show_state_time);
 define_one_state_rw(disable, show_state_disable, store_state_disable);
 define_one_state_ro(above, show_state_above);
 define_one_state_ro(below, show_state_below);
+define_one_state_ro(pred_hits, show_state_pred_hits);
+define_one_state_ro(pred_early, show_state_pred_early);
+define_one_state_ro(pred_late, show_state_pred_late);
 define_one_state_ro(default_status, show_state_default_status);
 
 static struct attribute *cpuidle_state_default_attrs[] = {
@@ -329,6 +335,9 @@ static struct attribute *cpuidle_state_default_attrs[] = {
 	&attr_disable.attr,
 	&attr_above.attr,
 	&attr_below.attr,
+	&attr_pred_hits.attr,
+	&attr_pred_early.attr,
+	&attr_pred_late.attr,
 	&attr_default_status.attr,
 	NULL
 };
@@ -104,6 +104,7 @@ static ssize_t ccp5_debugfs_stats_read(struct file *filp, char __user *ubuf,
 	unsigned long total_sha_ops = 0;
 	unsigned long total_rsa_ops = 0;
 	unsigned long total_ecc_ops = 0;
+	unsigned long total_doorbells = 0;
 	unsigned long total_pt_ops = 0;
 	unsigned long total_ops = 0;
 	unsigned int oboff = 0;
@@ -122,6 +123,7 @@ static ssize_t ccp5_debugfs_stats_read(struct file *filp, char __user *ubuf,
 		total_rsa_ops += cmd_q->total_rsa_ops;
 		total_pt_ops += cmd_q->total_pt_ops;
 		total_ecc_ops += cmd_q->total_ecc_ops;
+		total_doorbells += cmd_q->total_doorbells;
 	}
 
 	obuf = kmalloc(OBUFLEN, GFP_KERNEL);
@@ -146,6 +148,8 @@ static ssize_t ccp5_debugfs_stats_read(struct file *filp, char __user *ubuf,
 			    total_pt_ops);
 	oboff += OSCNPRINTF("                     ECC: %ld\n",
 			    total_ecc_ops);
+	oboff += OSCNPRINTF("         Doorbell Writes: %ld\n",
+			    total_doorbells);
 
 	ret = simple_read_from_buffer(ubuf, count, offp, obuf, oboff);
 	kfree(obuf);
@@ -165,6 +169,7 @@ static void ccp5_debugfs_reset_queue_stats(struct ccp_cmd_queue *cmd_q)
 	cmd_q->total_rsa_ops = 0L;
 	cmd_q->total_pt_ops = 0L;
 	cmd_q->total_ecc_ops = 0L;
+	cmd_q->total_doorbells = 0L;
 }
 
 /* A value was written to the stats variable, which
@@ -220,6 +225,8 @@ static ssize_t ccp5_debugfs_queue_read(struct file *filp, char __user *ubuf,
 			    cmd_q->total_pt_ops);
 	oboff += OSCNPRINTF("                     ECC: %ld\n",
 			    cmd_q->total_ecc_ops);
+	oboff += OSCNPRINTF("         Doorbell Writes: %ld\n",
+			    cmd_q->total_doorbells);
 
 	regval = ioread32(cmd_q->reg_int_enable);
 	oboff += OSCNPRINTF("      Enabled Interrupts:");
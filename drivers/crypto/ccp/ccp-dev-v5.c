@@ -12,6 +12,7 @@
 #include <linux/dma-mapping.h>
 #include <linux/interrupt.h>
 #include <linux/compiler.h>
+#include <linux/iopoll.h>
 #include <linux/ccp.h>
 
 #include "ccp-dev.h"
@@ -218,12 +219,56 @@ static unsigned int ccp5_get_free_slots(struct ccp_cmd_queue *cmd_q)
 	return n % COMMANDS_PER_QUEUE; /* Always one unused spot */
 }
 
+/*
+ * Only ask for a completion interrupt, and so wait, on the operations
+ * whose results are about to be looked at: the end of a message or an
+ * explicit stop on completion. The intermediate chunks of a message are
+ * executed in order by the queue and can be submitted back to back.
+ */
+static inline u32 ccp5_op_ioc(struct ccp_op *op)
+{
+	return op->soc || op->eom || op->ioc;
+}
+
+/*
+ * Spin until the queue has consumed everything up to @tail. Errors still
+ * raise an interrupt, which ccp5_irq_bh() records.
+ */
+static int ccp5_poll_cmd(struct ccp_cmd_queue *cmd_q, u32 tail)
+{
+	u32 head;
+
+	return read_poll_timeout(ioread32, head,
+				 head == tail || READ_ONCE(cmd_q->int_rcvd),
+				 0, CCP5_POLL_TIMEOUT_US, false,
+				 cmd_q->reg_head_lo);
+}
+
+static void ccp5_ring_doorbell(struct ccp_cmd_queue *cmd_q)
+{
+	u32 tail;
+
+	/* The data used by the queued commands must be flushed to memory */
+	wmb();
+
+	/* Write the new tail address back to the queue register */
+	tail = low_address(cmd_q->qdma_tail + cmd_q->qidx * Q_DESC_SIZE);
+	iowrite32(tail, cmd_q->reg_tail_lo);
+
+	/* Turn the queue back on using our cached control register */
+	iowrite32(cmd_q->qcontrol | CMD5_Q_RUN, cmd_q->reg_control);
+
+	cmd_q->pending = 0;
+	cmd_q->total_doorbells++;
+}
+
 static int ccp5_do_cmd(struct ccp5_desc *desc,
 		       struct ccp_cmd_queue *cmd_q)
 {
 	__le32 *mP;
 	u32 *dP;
 	u32 tail;
+	bool wait;
 	int	i;
 	int ret = 0;
 
@@ -235,28 +280,41 @@ static int ccp5_do_cmd(struct ccp5_desc *desc,
 	}
 	mutex_lock(&cmd_q->q_mutex);
 
+	/* If this takes the last free slot, wait for the queue to drain */
+	if (ccp5_get_free_slots(cmd_q) <= 1)
+		CCP5_CMD_IOC(desc) = 1;
+
+	/* When polling, the head pointer tells when the job is done */
+	wait = CCP5_CMD_IOC(desc);
+	if (cmd_q->poll)
+		CCP5_CMD_IOC(desc) = 0;
+
 	mP = (__le32 *)&cmd_q->qbase[cmd_q->qidx];
 	dP = (u32 *)desc;
 	for (i = 0; i < 8; i++)
 		mP[i] = cpu_to_le32(dP[i]); /* handle endianness */
 
 	cmd_q->qidx = (cmd_q->qidx + 1) % COMMANDS_PER_QUEUE;
-
-	/* The data used by this command must be flushed to memory */
-	wmb();
-
-	/* Write the new tail address back to the queue register */
+	cmd_q->pending++;
 	tail = low_address(cmd_q->qdma_tail + cmd_q->qidx * Q_DESC_SIZE);
-	iowrite32(tail, cmd_q->reg_tail_lo);
 
-	/* Turn the queue back on using our cached control register */
-	iowrite32(cmd_q->qcontrol | CMD5_Q_RUN, cmd_q->reg_control);
+	/*
+	 * Commands that aren't waited for are only written to the ring.
+	 * The doorbell is rung once for the whole batch when a command
+	 * that is waited for follows, or when the batch is full so the
+	 * engine doesn't sit idle.
+	 */
+	if (wait || cmd_q->pending >= CCP5_DOORBELL_BATCH)
+		ccp5_ring_doorbell(cmd_q);
 	mutex_unlock(&cmd_q->q_mutex);
 
-	if (CCP5_CMD_IOC(desc)) {
-		/* Wait for the job to complete */
-		ret = wait_event_interruptible(cmd_q->int_queue,
-					       cmd_q->int_rcvd);
+	if (wait) {
+		/* Wait for the job, and everything queued before it, to complete */
+		if (cmd_q->poll)
+			ret = ccp5_poll_cmd(cmd_q, tail);
+		else
+			ret = wait_event_interruptible(cmd_q->int_queue,
+						       cmd_q->int_rcvd);
 		if (ret || cmd_q->cmd_error) {
 			/* Log the error and flush the queue by
 			 * moving the head pointer
@@ -288,7 +346,7 @@ static int ccp5_perform_aes(struct ccp_op *op)
 	CCP5_CMD_ENGINE(&desc) = CCP_ENGINE_AES;
 
 	CCP5_CMD_SOC(&desc) = op->soc;
-	CCP5_CMD_IOC(&desc) = 1;
+	CCP5_CMD_IOC(&desc) = ccp5_op_ioc(op);
 	CCP5_CMD_INIT(&desc) = op->init;
 	CCP5_CMD_EOM(&desc) = op->eom;
 	CCP5_CMD_PROT(&desc) = 0;
@@ -333,7 +391,7 @@ static int ccp5_perform_xts_aes(struct ccp_op *op)
 	CCP5_CMD_ENGINE(&desc) = CCP_ENGINE_XTS_AES_128;
 
 	CCP5_CMD_SOC(&desc) = op->soc;
-	CCP5_CMD_IOC(&desc) = 1;
+	CCP5_CMD_IOC(&desc) = ccp5_op_ioc(op);
 	CCP5_CMD_INIT(&desc) = op->init;
 	CCP5_CMD_EOM(&desc) = op->eom;
 	CCP5_CMD_PROT(&desc) = 0;
@@ -375,7 +433,7 @@ static int ccp5_perform_sha(struct ccp_op *op)
 	CCP5_CMD_ENGINE(&desc) = CCP_ENGINE_SHA;
 
 	CCP5_CMD_SOC(&desc) = op->soc;
-	CCP5_CMD_IOC(&desc) = 1;
+	CCP5_CMD_IOC(&desc) = ccp5_op_ioc(op);
 	CCP5_CMD_INIT(&desc) = 1;
 	CCP5_CMD_EOM(&desc) = op->eom;
 	CCP5_CMD_PROT(&desc) = 0;
@@ -417,7 +475,7 @@ static int ccp5_perform_des3(struct ccp_op *op)
 	CCP5_CMD_ENGINE(&desc) = CCP_ENGINE_DES3;
 
 	CCP5_CMD_SOC(&desc) = op->soc;
-	CCP5_CMD_IOC(&desc) = 1;
+	CCP5_CMD_IOC(&desc) = ccp5_op_ioc(op);
 	CCP5_CMD_INIT(&desc) = op->init;
 	CCP5_CMD_EOM(&desc) = op->eom;
 	CCP5_CMD_PROT(&desc) = 0;
@@ -503,7 +561,7 @@ static int ccp5_perform_passthru(struct ccp_op *op)
 	CCP5_CMD_ENGINE(&desc) = CCP_ENGINE_PASSTHRU;
 
 	CCP5_CMD_SOC(&desc) = 0;
-	CCP5_CMD_IOC(&desc) = 1;
+	CCP5_CMD_IOC(&desc) = ccp5_op_ioc(op);
 	CCP5_CMD_INIT(&desc) = 0;
 	CCP5_CMD_EOM(&desc) = op->eom;
 	CCP5_CMD_PROT(&desc) = 0;
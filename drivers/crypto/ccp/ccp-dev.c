@@ -122,6 +122,14 @@ static LIST_HEAD(ccp_units);
 static DEFINE_SPINLOCK(ccp_rr_lock);
 static struct ccp_device *ccp_rr;
 
+static struct ccp_device *ccp_next_device(struct ccp_device *ccp)
+{
+	if (list_is_last(&ccp->entry, &ccp_units))
+		return list_first_entry(&ccp_units, struct ccp_device, entry);
+
+	return list_next_entry(ccp, entry);
+}
+
 /**
  * ccp_add_device - add a CCP device to the list
  *
@@ -165,11 +173,7 @@ void ccp_del_device(struct ccp_device *ccp)
 		 * will be suspended while we make changes to the
 		 * list and RR pointer.
 		 */
-		if (list_is_last(&ccp_rr->entry, &ccp_units))
-			ccp_rr = list_first_entry(&ccp_units, struct ccp_device,
-						  entry);
-		else
-			ccp_rr = list_next_entry(ccp_rr, entry);
+		ccp_rr = ccp_next_device(ccp_rr);
 	}
 	list_del(&ccp->entry);
 	if (list_empty(&ccp_units))
@@ -203,20 +207,27 @@ void ccp_unregister_rng(struct ccp_device *ccp)
 static struct ccp_device *ccp_get_device(void)
 {
 	unsigned long flags;
-	struct ccp_device *dp = NULL;
+	struct ccp_device *dp = NULL, *ccp;
+	unsigned int depth, best = UINT_MAX;
 
-	/* We round-robin through the unit list.
-	 * The (ccp_rr) pointer refers to the next unit to use.
+	/* Pick the unit with the fewest outstanding commands per queue.
+	 * The scan starts at the (ccp_rr) pointer, which refers to the
+	 * next unit to use, so equally loaded units are used in turn.
 	 */
 	read_lock_irqsave(&ccp_unit_lock, flags);
 	if (!list_empty(&ccp_units)) {
 		spin_lock(&ccp_rr_lock);
-		dp = ccp_rr;
-		if (list_is_last(&ccp_rr->entry, &ccp_units))
-			ccp_rr = list_first_entry(&ccp_units, struct ccp_device,
-						  entry);
-		else
-			ccp_rr = list_next_entry(ccp_rr, entry);
+		ccp = ccp_rr;
+		do {
+			depth = (READ_ONCE(ccp->cmd_count) << 8) /
+				max(ccp->cmd_q_count, 1U);
+			if (depth < best) {
+				best = depth;
+				dp = ccp;
+			}
+			ccp = ccp_next_device(ccp);
+		} while (ccp != ccp_rr && best);
+		ccp_rr = ccp_next_device(dp);
 		spin_unlock(&ccp_rr_lock);
 	}
 	read_unlock_irqrestore(&ccp_unit_lock, flags);
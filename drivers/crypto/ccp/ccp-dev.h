@@ -100,6 +100,8 @@
 #define CMD5_Q_SIZE			0x1F
 #define CMD5_Q_SHIFT			3
 #define COMMANDS_PER_QUEUE		16
+#define CCP5_DOORBELL_BATCH		(COMMANDS_PER_QUEUE / 2)
+#define CCP5_POLL_TIMEOUT_US		1000000
 #define QUEUE_SIZE_VAL			((ffs(COMMANDS_PER_QUEUE) - 2) & \
 					  CMD5_Q_SIZE)
 #define Q_PTR_MASK			(2 << (QUEUE_SIZE_VAL + 5) - 1)
@@ -223,10 +225,18 @@ struct ccp_device;
 struct ccp_cmd;
 struct ccp_fns;
 
+#define CCP_DMA_CMD_SEGS	32
+
 struct ccp_dma_cmd {
 	struct list_head entry;
 
 	struct ccp_cmd ccp_cmd;
+
+	/* Chained pass-through segments and the number of descriptors
+	 * after the owning one whose copies were merged into this command
+	 */
+	struct ccp_passthru_seg segs[CCP_DMA_CMD_SEGS];
+	unsigned int merged;
 };
 
 struct ccp_dma_desc {
@@ -272,6 +282,10 @@ struct ccp_cmd_queue {
 	/* Aligned queue start address (per requirement) */
 	struct mutex q_mutex ____cacheline_aligned;
 	unsigned int qidx;
+	/* Descriptors written to the ring but not yet submitted */
+	unsigned int pending;
+	/* Busy-poll for completion of the current command */
+	unsigned int poll;
 
 	/* Version 5 has different requirements for queue memory */
 	unsigned int qsize;
@@ -334,6 +348,7 @@ struct ccp_cmd_queue {
 	unsigned long total_rsa_ops;
 	unsigned long total_pt_ops;
 	unsigned long total_ecc_ops;
+	unsigned long total_doorbells;
 } ____cacheline_aligned;
 
 struct ccp_device {
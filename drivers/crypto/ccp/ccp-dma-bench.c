@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * AMD Cryptographic Coprocessor (CCP) DMA engine benchmark
+ *
+ * Times memcpy transfers through a CCP DMA channel, with and without a
+ * completion interrupt, and compares them with a CPU memcpy of the same
+ * buffers.
+ */
+
+#define pr_fmt(fmt)	"ccp-dma-bench: " fmt
+
+#include <linux/module.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
+#include <linux/sizes.h>
+#include <linux/string.h>
+
+static unsigned int loops = 100;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Transfers timed per size");
+
+static unsigned int max_size = SZ_4M;
+module_param(max_size, uint, 0444);
+MODULE_PARM_DESC(max_size, "Largest transfer size in bytes");
+
+static bool ccp_dma_bench_filter(struct dma_chan *chan, void *param)
+{
+	return strstr(dev_driver_string(chan->device->dev), "ccp");
+}
+
+static u64 ccp_dma_bench_mbps(size_t size, u64 ns)
+{
+	return ns ? div64_u64((u64)size * loops * NSEC_PER_SEC,
+			      ns * SZ_1M) : 0;
+}
+
+static int ccp_dma_bench_dma(struct dma_chan *chan, dma_addr_t dst,
+			     dma_addr_t src, size_t size, unsigned long flags,
+			     u64 *ns)
+{
+	struct dma_async_tx_descriptor *tx;
+	dma_cookie_t cookie;
+	unsigned int i;
+	u64 start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < loops; i++) {
+		tx = dmaengine_prep_dma_memcpy(chan, dst, src, size, flags);
+		if (!tx)
+			return -ENOMEM;
+
+		cookie = dmaengine_submit(tx);
+		if (dma_submit_error(cookie))
+			return -EIO;
+
+		if (dma_sync_wait(chan, cookie) != DMA_COMPLETE)
+			return -EIO;
+	}
+	*ns = ktime_get_ns() - start;
+
+	return 0;
+}
+
+static int ccp_dma_bench_size(struct dma_chan *chan, size_t size)
+{
+	struct device *dev = chan->device->dev;
+	dma_addr_t src_dma, dst_dma;
+	u64 irq_ns, poll_ns, cpu_ns;
+	void *src, *dst;
+	unsigned int i;
+	u64 start;
+	int ret;
+
+	src = dma_alloc_coherent(dev, size, &src_dma, GFP_KERNEL);
+	dst = dma_alloc_coherent(dev, size, &dst_dma, GFP_KERNEL);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	memset(src, 0xa5, size);
+
+	ret = ccp_dma_bench_dma(chan, dst_dma, src_dma, size,
+				DMA_PREP_INTERRUPT, &irq_ns);
+	if (ret)
+		goto out;
+
+	ret = ccp_dma_bench_dma(chan, dst_dma, src_dma, size, 0, &poll_ns);
+	if (ret)
+		goto out;
+
+	if (memcmp(src, dst, size)) {
+		pr_err("data mismatch at size %zu\n", size);
+		ret = -EIO;
+		goto out;
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < loops; i++)
+		memcpy(dst, src, size);
+	cpu_ns = ktime_get_ns() - start;
+
+	pr_info("%8zu bytes: irq %llu MB/s, no-irq %llu MB/s, cpu %llu MB/s\n",
+		size, ccp_dma_bench_mbps(size, irq_ns),
+		ccp_dma_bench_mbps(size, poll_ns),
+		ccp_dma_bench_mbps(size, cpu_ns));
+
+out:
+	if (dst)
+		dma_free_coherent(dev, size, dst, dst_dma);
+	if (src)
+		dma_free_coherent(dev, size, src, src_dma);
+
+	return ret;
+}
+
+static int __init ccp_dma_bench_init(void)
+{
+	struct dma_chan *chan;
+	dma_cap_mask_t mask;
+	size_t size;
+	int ret = 0;
+
+	if (!loops)
+		return -EINVAL;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+
+	chan = dma_request_channel(mask, ccp_dma_bench_filter, NULL);
+	if (!chan) {
+		pr_err("no CCP DMA channel available\n");
+		return -ENODEV;
+	}
+
+	pr_info("using %s, %u transfers per size\n", dma_chan_name(chan), loops);
+
+	for (size = SZ_4K; size <= max_size && !ret; size <<= 1)
+		ret = ccp_dma_bench_size(chan, size);
+
+	dma_release_channel(chan);
+
+	/* Nothing to keep loaded, the results are in the log */
+	return ret ? ret : -EAGAIN;
+}
+module_init(ccp_dma_bench_init);
+
+MODULE_AUTHOR("Advanced Micro Devices, Inc.");
+MODULE_DESCRIPTION("AMD CCP DMA engine memcpy benchmark");
+MODULE_LICENSE("GPL");
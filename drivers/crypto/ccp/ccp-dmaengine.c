@@ -40,6 +40,10 @@ static unsigned int dmaengine = 1;
 module_param(dmaengine, uint, 0444);
 MODULE_PARM_DESC(dmaengine, "Register services with the DMA subsystem (any non-zero value, default: 1)");
 
+static bool dma_poll;
+module_param(dma_poll, bool, 0644);
+MODULE_PARM_DESC(dma_poll, "Busy-poll for completion of descriptors prepared without DMA_PREP_INTERRUPT (default: false)");
+
 static unsigned int ccp_get_dma_chan_attr(struct ccp_device *ccp)
 {
 	switch (dma_chan_attr) {
@@ -136,14 +140,67 @@ static void ccp_do_cleanup(unsigned long data)
 	spin_unlock_irqrestore(&chan->lock, flags);
 }
 
+/*
+ * Append the copies of the descriptors queued behind @desc to its last
+ * command, so that a burst of memcpy requests goes to the ring as
+ * consecutive descriptors and completes with a single interrupt. Only
+ * descriptors consisting of a single command that fits are merged; they
+ * are completed by ccp_handle_active_desc() once they have no commands
+ * left.
+ */
+static void ccp_merge_next_descs(struct ccp_dma_chan *chan,
+				 struct ccp_dma_desc *desc,
+				 struct ccp_dma_cmd *cmd)
+{
+	struct ccp_passthru_nomap_engine *pt = &cmd->ccp_cmd.u.passthru_nomap;
+	struct ccp_passthru_nomap_engine *npt;
+	struct ccp_dma_desc *next;
+	struct ccp_dma_cmd *ncmd;
+	unsigned long flags;
+
+	if (!pt->segs || !list_empty(&desc->pending))
+		return;
+
+	spin_lock_irqsave(&chan->lock, flags);
+
+	next = desc;
+	list_for_each_entry_continue(next, &chan->active, entry) {
+		if (!list_is_singular(&next->pending))
+			break;
+
+		ncmd = list_first_entry(&next->pending, struct ccp_dma_cmd,
+					entry);
+		npt = &ncmd->ccp_cmd.u.passthru_nomap;
+		if (!npt->segs || ncmd->ccp_cmd.flags != cmd->ccp_cmd.flags ||
+		    pt->seg_count + npt->seg_count > CCP_DMA_CMD_SEGS)
+			break;
+
+		memcpy(&pt->segs[pt->seg_count], npt->segs,
+		       npt->seg_count * sizeof(*npt->segs));
+		pt->seg_count += npt->seg_count;
+		pt->src_len += npt->src_len;
+		cmd->merged++;
+
+		list_del(&ncmd->entry);
+		kmem_cache_free(chan->ccp->dma_cmd_cache, ncmd);
+	}
+
+	spin_unlock_irqrestore(&chan->lock, flags);
+}
+
 static int ccp_issue_next_cmd(struct ccp_dma_desc *desc)
 {
+	struct ccp_dma_chan *chan = container_of(desc->tx_desc.chan,
+						 struct ccp_dma_chan,
+						 dma_chan);
 	struct ccp_dma_cmd *cmd;
 	int ret;
 
 	cmd = list_first_entry(&desc->pending, struct ccp_dma_cmd, entry);
 	list_move(&cmd->entry, &desc->active);
 
+	ccp_merge_next_descs(chan, desc, cmd);
+
 	dev_dbg(desc->ccp->dev, "%s - tx %d, cmd=%p\n", __func__,
 		desc->tx_desc.cookie, cmd);
 
@@ -273,9 +330,28 @@ static void ccp_cmd_callback(void *data, int err)
 	dev_dbg(chan->ccp->dev, "%s - tx %d callback, err=%d\n",
 		__func__, desc->tx_desc.cookie, err);
 
-	if (err)
+	if (err) {
+		struct ccp_dma_desc *next = desc;
+		struct ccp_dma_cmd *cmd;
+		unsigned long flags;
+		unsigned int merged;
+
 		desc->status = DMA_ERROR;
 
+		/* The descriptors merged into the failed command failed too */
+		cmd = list_first_entry_or_null(&desc->active,
+					       struct ccp_dma_cmd, entry);
+		merged = cmd ? cmd->merged : 0;
+
+		spin_lock_irqsave(&chan->lock, flags);
+		list_for_each_entry_continue(next, &chan->active, entry) {
+			if (!merged--)
+				break;
+			next->status = DMA_ERROR;
+		}
+		spin_unlock_irqrestore(&chan->lock, flags);
+	}
+
 	while (true) {
 		/* Check for DMA descriptor completion */
 		desc = ccp_handle_active_desc(chan, desc);
@@ -361,9 +437,10 @@ static struct ccp_dma_desc *ccp_create_desc(struct dma_chan *dma_chan,
 						 dma_chan);
 	struct ccp_device *ccp = chan->ccp;
 	struct ccp_dma_desc *desc;
-	struct ccp_dma_cmd *cmd;
+	struct ccp_dma_cmd *cmd = NULL;
 	struct ccp_cmd *ccp_cmd;
-	struct ccp_passthru_nomap_engine *ccp_pt;
+	struct ccp_passthru_nomap_engine *ccp_pt = NULL;
+	struct ccp_passthru_seg *seg;
 	unsigned int src_offset, src_len;
 	unsigned int dst_offset, dst_len;
 	unsigned int len;
@@ -419,31 +496,40 @@ static struct ccp_dma_desc *ccp_create_desc(struct dma_chan *dma_chan,
 
 		len = min(dst_len, src_len);
 
-		cmd = ccp_alloc_dma_cmd(chan);
-		if (!cmd)
-			goto err;
-
-		ccp_cmd = &cmd->ccp_cmd;
-		ccp_cmd->ccp = chan->ccp;
-		ccp_pt = &ccp_cmd->u.passthru_nomap;
-		ccp_cmd->flags = CCP_CMD_MAY_BACKLOG;
-		ccp_cmd->flags |= CCP_CMD_PASSTHRU_NO_DMA_MAP;
-		ccp_cmd->engine = CCP_ENGINE_PASSTHRU;
-		ccp_pt->bit_mod = CCP_PASSTHRU_BITWISE_NOOP;
-		ccp_pt->byte_swap = CCP_PASSTHRU_BYTESWAP_NOOP;
-		ccp_pt->src_dma = sg_dma_address(src_sg) + src_offset;
-		ccp_pt->dst_dma = sg_dma_address(dst_sg) + dst_offset;
-		ccp_pt->src_len = len;
-		ccp_pt->final = 1;
-		ccp_cmd->callback = ccp_cmd_callback;
-		ccp_cmd->data = desc;
-
-		list_add_tail(&cmd->entry, &desc->pending);
+		/* Chain up to CCP_DMA_CMD_SEGS pieces into one command */
+		if (!cmd || ccp_pt->seg_count == CCP_DMA_CMD_SEGS) {
+			cmd = ccp_alloc_dma_cmd(chan);
+			if (!cmd)
+				goto err;
+
+			ccp_cmd = &cmd->ccp_cmd;
+			ccp_cmd->ccp = chan->ccp;
+			ccp_pt = &ccp_cmd->u.passthru_nomap;
+			ccp_cmd->flags = CCP_CMD_MAY_BACKLOG;
+			ccp_cmd->flags |= CCP_CMD_PASSTHRU_NO_DMA_MAP;
+			if (dma_poll && !(flags & DMA_PREP_INTERRUPT))
+				ccp_cmd->flags |= CCP_CMD_POLL;
+			ccp_cmd->engine = CCP_ENGINE_PASSTHRU;
+			ccp_pt->bit_mod = CCP_PASSTHRU_BITWISE_NOOP;
+			ccp_pt->byte_swap = CCP_PASSTHRU_BYTESWAP_NOOP;
+			ccp_pt->segs = cmd->segs;
+			ccp_pt->final = 1;
+			ccp_cmd->callback = ccp_cmd_callback;
+			ccp_cmd->data = desc;
+
+			list_add_tail(&cmd->entry, &desc->pending);
+		}
+
+		seg = &cmd->segs[ccp_pt->seg_count++];
+		seg->src_dma = sg_dma_address(src_sg) + src_offset;
+		seg->dst_dma = sg_dma_address(dst_sg) + dst_offset;
+		seg->len = len;
+		ccp_pt->src_len += len;
 
 		dev_dbg(ccp->dev,
-			"%s - cmd=%p, src=%pad, dst=%pad, len=%llu\n", __func__,
-			cmd, &ccp_pt->src_dma,
-			&ccp_pt->dst_dma, ccp_pt->src_len);
+			"%s - cmd=%p, seg=%u, src=%pad, dst=%pad, len=%u\n",
+			__func__, cmd, ccp_pt->seg_count - 1, &seg->src_dma,
+			&seg->dst_dma, seg->len);
 
 		total_len += len;
 
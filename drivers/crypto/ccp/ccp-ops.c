@@ -2096,13 +2096,21 @@ ccp_run_passthru_nomap_cmd(struct ccp_cmd_queue *cmd_q,
 	struct ccp_passthru_nomap_engine *pt = &cmd->u.passthru_nomap;
 	struct ccp_dm_workarea mask;
 	struct ccp_op op;
+	unsigned int i;
 	int ret;
 
 	if (!pt->final && (pt->src_len & (CCP_PASSTHRU_BLOCKSIZE - 1)))
 		return -EINVAL;
 
-	if (!pt->src_dma || !pt->dst_dma)
+	if (pt->segs) {
+		if (!pt->seg_count)
+			return -EINVAL;
+		for (i = 0; i < pt->seg_count; i++)
+			if (!pt->segs[i].src_dma || !pt->segs[i].dst_dma)
+				return -EINVAL;
+	} else if (!pt->src_dma || !pt->dst_dma) {
 		return -EINVAL;
+	}
 
 	if (pt->bit_mod != CCP_PASSTHRU_BITWISE_NOOP) {
 		if (pt->mask_len != CCP_PASSTHRU_MASKSIZE)
@@ -2134,22 +2142,45 @@ ccp_run_passthru_nomap_cmd(struct ccp_cmd_queue *cmd_q,
 	}
 
 	/* Send data to the CCP Passthru engine */
-	op.eom = 1;
-	op.soc = 1;
-
 	op.src.type = CCP_MEMTYPE_SYSTEM;
-	op.src.u.dma.address = pt->src_dma;
 	op.src.u.dma.offset = 0;
-	op.src.u.dma.length = pt->src_len;
 
 	op.dst.type = CCP_MEMTYPE_SYSTEM;
-	op.dst.u.dma.address = pt->dst_dma;
 	op.dst.u.dma.offset = 0;
-	op.dst.u.dma.length = pt->src_len;
 
-	ret = cmd_q->ccp->vdata->perform->passthru(&op);
-	if (ret)
-		cmd->engine_error = cmd_q->cmd_error;
+	if (!pt->segs) {
+		op.eom = 1;
+		op.soc = 1;
+
+		op.src.u.dma.address = pt->src_dma;
+		op.src.u.dma.length = pt->src_len;
+		op.dst.u.dma.address = pt->dst_dma;
+		op.dst.u.dma.length = pt->src_len;
+
+		ret = cmd_q->ccp->vdata->perform->passthru(&op);
+		if (ret)
+			cmd->engine_error = cmd_q->cmd_error;
+
+		return ret;
+	}
+
+	/* Chained segments go into consecutive descriptors, only the
+	 * last one ends the message and is waited for.
+	 */
+	for (i = 0; i < pt->seg_count; i++) {
+		op.eom = op.soc = (i == pt->seg_count - 1);
+
+		op.src.u.dma.address = pt->segs[i].src_dma;
+		op.src.u.dma.length = pt->segs[i].len;
+		op.dst.u.dma.address = pt->segs[i].dst_dma;
+		op.dst.u.dma.length = pt->segs[i].len;
+
+		ret = cmd_q->ccp->vdata->perform->passthru(&op);
+		if (ret) {
+			cmd->engine_error = cmd_q->cmd_error;
+			break;
+		}
+	}
 
 	return ret;
 }
@@ -2465,6 +2496,7 @@ int ccp_run_cmd(struct ccp_cmd_queue *cmd_q, struct ccp_cmd *cmd)
 	cmd->engine_error = 0;
 	cmd_q->cmd_error = 0;
 	cmd_q->int_rcvd = 0;
+	cmd_q->poll = !!(cmd->flags & CCP_CMD_POLL);
 	cmd_q->free_slots = cmd_q->ccp->vdata->perform->get_free_slots(cmd_q);
 
 	switch (cmd->engine) {
@@ -2506,5 +2538,17 @@ int ccp_run_cmd(struct ccp_cmd_queue *cmd_q, struct ccp_cmd *cmd)
 		ret = -EINVAL;
 	}
 
+	/* A command that failed part way may leave batched descriptors
+	 * that were never submitted. Drop them, the buffers they refer
+	 * to have been released.
+	 */
+	if (cmd_q->pending) {
+		mutex_lock(&cmd_q->q_mutex);
+		cmd_q->qidx = (cmd_q->qidx + COMMANDS_PER_QUEUE -
+			       cmd_q->pending) % COMMANDS_PER_QUEUE;
+		cmd_q->pending = 0;
+		mutex_unlock(&cmd_q->q_mutex);
+	}
+
 	return ret;
 }
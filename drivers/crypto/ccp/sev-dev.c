@@ -21,6 +21,10 @@
 #include <linux/ccp.h>
 #include <linux/firmware.h>
 #include <linux/gfp.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/lat_hist.h>
 
 #include <asm/smp.h>
 
@@ -134,12 +138,16 @@ static int sev_cmd_buffer_len(int cmd)
 	return 0;
 }
 
+/* Execution time of each PSP command, in tracing/latency_hist/sev_cmd */
+DEFINE_LAT_HIST(sev_cmd);
+
 static int __sev_do_cmd_locked(int cmd, void *data, int *psp_ret)
 {
 	struct psp_device *psp = psp_master;
 	struct sev_device *sev;
 	unsigned int phys_lsb, phys_msb;
 	unsigned int reg, ret = 0;
+	u64 start, ns;
 
 	if (!psp || !psp->sev_data)
 		return -ENODEV;
@@ -164,6 +172,8 @@ static int __sev_do_cmd_locked(int cmd, void *data, int *psp_ret)
 
 	sev->int_rcvd = 0;
 
+	start = ktime_get_ns();
+
 	reg = cmd;
 	reg <<= SEV_CMDRESP_CMD_SHIFT;
 	reg |= SEV_CMDRESP_IOC;
@@ -171,6 +181,14 @@ static int __sev_do_cmd_locked(int cmd, void *data, int *psp_ret)
 
 	/* wait for command completion */
 	ret = sev_wait_cmd_ioc(sev, &reg, psp_timeout);
+
+	ns = ktime_get_ns() - start;
+	sev->stats.cmds++;
+	sev->stats.exec_ns += ns;
+	if (ns > sev->stats.exec_max_ns)
+		sev->stats.exec_max_ns = ns;
+	lat_hist_record(&lat_hist_sev_cmd, ns);
+
 	if (ret) {
 		if (psp_ret)
 			*psp_ret = 0;
@@ -209,6 +227,104 @@ static int sev_do_cmd(int cmd, void *data, int *psp_ret)
 	return rc;
 }
 
+/*
+ * Run the commands queued by sev_issue_cmd_external_user_async() in order.
+ * sev_cmd_mutex is taken per command so that synchronous callers are not
+ * starved by a long queue.
+ */
+static void sev_cmd_work(struct work_struct *work)
+{
+	struct sev_device *sev = container_of(work, struct sev_device, cmd_work);
+	struct sev_async_cmd *acmd;
+	u64 ns;
+
+	for (;;) {
+		spin_lock(&sev->cmd_lock);
+		acmd = list_first_entry_or_null(&sev->cmd_queue,
+						struct sev_async_cmd, entry);
+		if (acmd) {
+			list_del(&acmd->entry);
+			sev->cmd_depth--;
+		}
+		spin_unlock(&sev->cmd_lock);
+
+		if (!acmd)
+			break;
+
+		mutex_lock(&sev_cmd_mutex);
+
+		ns = ktime_get_ns() - acmd->queued_ns;
+		sev->stats.async_cmds++;
+		sev->stats.queue_ns += ns;
+		if (ns > sev->stats.queue_max_ns)
+			sev->stats.queue_max_ns = ns;
+
+		acmd->ret = __sev_do_cmd_locked(acmd->cmd, acmd->data,
+						&acmd->psp_ret);
+		mutex_unlock(&sev_cmd_mutex);
+
+		/* @acmd may be freed as soon as it is completed */
+		complete(&acmd->done);
+	}
+}
+
+static int sev_queue_cmd(struct sev_async_cmd *acmd)
+{
+	struct psp_device *psp = psp_master;
+	struct sev_device *sev;
+
+	if (!psp || !psp->sev_data)
+		return -ENODEV;
+
+	if (psp_dead)
+		return -EBUSY;
+
+	sev = psp->sev_data;
+
+	init_completion(&acmd->done);
+	acmd->psp_ret = 0;
+	acmd->ret = 0;
+	acmd->queued_ns = ktime_get_ns();
+
+	spin_lock(&sev->cmd_lock);
+	list_add_tail(&acmd->entry, &sev->cmd_queue);
+	if (++sev->cmd_depth > sev->stats.depth_max)
+		sev->stats.depth_max = sev->cmd_depth;
+	spin_unlock(&sev->cmd_lock);
+
+	queue_work(system_unbound_wq, &sev->cmd_work);
+
+	return 0;
+}
+
+int sev_async_cmd_wait(struct sev_async_cmd *acmd, int *error)
+{
+	wait_for_completion(&acmd->done);
+
+	if (error)
+		*error = acmd->psp_ret;
+
+	return acmd->ret;
+}
+EXPORT_SYMBOL_GPL(sev_async_cmd_wait);
+
+static int cmd_stats_show(struct seq_file *m, void *unused)
+{
+	struct sev_device *sev = m->private;
+
+	seq_printf(m, "cmds %llu\n", READ_ONCE(sev->stats.cmds));
+	seq_printf(m, "exec_ns %llu\n", READ_ONCE(sev->stats.exec_ns));
+	seq_printf(m, "exec_max_ns %llu\n", READ_ONCE(sev->stats.exec_max_ns));
+	seq_printf(m, "async_cmds %llu\n", READ_ONCE(sev->stats.async_cmds));
+	seq_printf(m, "queue_ns %llu\n", READ_ONCE(sev->stats.queue_ns));
+	seq_printf(m, "queue_max_ns %llu\n", READ_ONCE(sev->stats.queue_max_ns));
+	seq_printf(m, "queue_depth %u\n", READ_ONCE(sev->cmd_depth));
+	seq_printf(m, "queue_depth_max %u\n", READ_ONCE(sev->stats.depth_max));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cmd_stats);
+
 static int __sev_platform_init_locked(int *error)
 {
 	struct psp_device *psp = psp_master;
@@ -982,6 +1098,10 @@ int sev_dev_init(struct psp_device *psp)
 
 	sev->io_regs = psp->io_regs;
 
+	spin_lock_init(&sev->cmd_lock);
+	INIT_LIST_HEAD(&sev->cmd_queue);
+	INIT_WORK(&sev->cmd_work, sev_cmd_work);
+
 	sev->vdata = (struct sev_vdata *)psp->vdata->sev;
 	if (!sev->vdata) {
 		ret = -ENODEV;
@@ -1016,6 +1136,8 @@ void sev_dev_destroy(struct psp_device *psp)
 	if (!sev)
 		return;
 
+	flush_work(&sev->cmd_work);
+
 	if (sev->misc)
 		kref_put(&misc_dev->refcount, sev_exit);
 
@@ -1032,6 +1154,16 @@ int sev_issue_cmd_external_user(struct file *filep, unsigned int cmd,
 }
 EXPORT_SYMBOL_GPL(sev_issue_cmd_external_user);
 
+int sev_issue_cmd_external_user_async(struct file *filep,
+				      struct sev_async_cmd *acmd)
+{
+	if (!filep || filep->f_op != &sev_fops)
+		return -EBADF;
+
+	return sev_queue_cmd(acmd);
+}
+EXPORT_SYMBOL_GPL(sev_issue_cmd_external_user_async);
+
 void sev_pci_init(void)
 {
 	struct sev_device *sev = psp_master->sev_data;
@@ -1097,6 +1229,13 @@ void sev_pci_init(void)
 	dev_info(sev->dev, "SEV API:%d.%d build:%d\n", sev->api_major,
 		 sev->api_minor, sev->build);
 
+	sev->debugfs = debugfs_create_dir("sev", NULL);
+	debugfs_create_file("cmd_stats", 0444, sev->debugfs, sev,
+			    &cmd_stats_fops);
+
+	if (lat_hist_register(&lat_hist_sev_cmd))
+		dev_warn(sev->dev, "SEV: failed to register latency histogram\n");
+
 	return;
 
 err:
@@ -1105,9 +1244,16 @@ err:
 
 void sev_pci_exit(void)
 {
-	if (!psp_master->sev_data)
+	struct sev_device *sev = psp_master->sev_data;
+
+	if (!sev)
 		return;
 
+	lat_hist_unregister(&lat_hist_sev_cmd);
+
+	debugfs_remove_recursive(sev->debugfs);
+	sev->debugfs = NULL;
+
 	sev_platform_shutdown(NULL);
 
 	if (sev_es_tmr) {
@@ -15,6 +15,7 @@
 #include <linux/mutex.h>
 #include <linux/list.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <linux/dmapool.h>
 #include <linux/hw_random.h>
 #include <linux/bitops.h>
@@ -29,6 +30,16 @@
 #define SEV_CMDRESP_CMD_SHIFT		16
 #define SEV_CMDRESP_IOC			BIT(0)
 
+struct sev_cmd_stats {
+	u64 cmds;
+	u64 async_cmds;
+	u64 exec_ns;
+	u64 exec_max_ns;
+	u64 queue_ns;
+	u64 queue_max_ns;
+	unsigned int depth_max;
+};
+
 struct sev_misc_dev {
 	struct kref refcount;
 	struct miscdevice misc;
@@ -49,6 +60,15 @@ struct sev_device {
 	struct sev_user_data_status status_cmd_buf;
 	struct sev_data_init init_cmd_buf;
 
+	/* Commands queued by sev_issue_cmd_external_user_async() */
+	spinlock_t cmd_lock;
+	struct list_head cmd_queue;
+	unsigned int cmd_depth;
+	struct work_struct cmd_work;
+
+	struct sev_cmd_stats stats;
+	struct dentry *debugfs;
+
 	u8 api_major;
 	u8 api_minor;
 	u8 build;
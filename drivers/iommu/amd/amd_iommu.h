@@ -29,6 +29,9 @@ void amd_iommu_debugfs_setup(struct amd_iommu *iommu);
 static inline void amd_iommu_debugfs_setup(struct amd_iommu *iommu) {}
 #endif
 
+/* Command buffer benchmark */
+extern int amd_iommu_cmd_bench(int index, unsigned int nr_cmds);
+
 /* Needed for interrupt remapping */
 extern int amd_iommu_prepare(void);
 extern int amd_iommu_enable(void);
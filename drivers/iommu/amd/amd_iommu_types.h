@@ -448,7 +448,7 @@ struct amd_iommu_fault {
 	u16 device_id;  /* Originating PCI device id */
 	u16 tag;        /* PPR tag */
 	u16 flags;      /* Fault flags */
-
+	u64 timestamp;  /* local_clock() when taken off the PPR log */
 };
 
 
@@ -467,6 +467,7 @@ struct protection_domain {
 	struct iommu_domain domain; /* generic domain handle used by
 				       iommu core code */
 	spinlock_t lock;	/* mostly used to lock the page table*/
+	spinlock_t pt_lock;	/* serializes PTE updates with coalescing */
 	u16 id;			/* the domain id written to the device table */
 	atomic64_t pt_root;	/* pgtable root and pgtable mode */
 	int glx;		/* Number of levels for GCR3 table */
@@ -476,6 +477,19 @@ struct protection_domain {
 	unsigned dev_iommu[MAX_IOMMUS]; /* per-IOMMU reference count */
 };
 
+/*
+ * A batch of pending IO/TLB invalidations for one protection domain. Ranges
+ * added to the batch are coalesced into as few range invalidations as
+ * possible and a single COMPLETION_WAIT per IOMMU is issued when the batch
+ * is finished.
+ */
+struct amd_iommu_flush_batch {
+	struct protection_domain *domain;
+	u64 start;		/* start of the pending range */
+	u64 end;		/* end of the pending range, exclusive */
+	unsigned int nr_ranges;	/* ranges added by the caller */
+};
+
 /* For decocded pt_root */
 struct domain_pgtable {
 	int mode;
@@ -492,9 +506,6 @@ struct amd_iommu {
 	/* Index within the IOMMU array */
 	int index;
 
-	/* locks the accesses to the hardware */
-	raw_spinlock_t lock;
-
 	/* Pointer to PCI device of this IOMMU */
 	struct pci_dev *dev;
 
@@ -542,8 +553,16 @@ struct amd_iommu {
 
 	/* command buffer virtual address */
 	u8 *cmd_buf;
+	/* last head read from the hardware */
 	u32 cmd_buf_head;
-	u32 cmd_buf_tail;
+	/*
+	 * Byte positions in the command buffer, they only ever grow and are
+	 * taken modulo CMD_BUFFER_SIZE to index the ring. Submitters reserve
+	 * slots by advancing cmd_buf_reserved and commit them to the hardware
+	 * in reservation order by advancing cmd_buf_committed.
+	 */
+	atomic64_t cmd_buf_reserved;
+	atomic64_t cmd_buf_committed;
 
 	/* event buffer virtual address */
 	u8 *evt_buf;
@@ -595,7 +614,14 @@ struct amd_iommu {
 #endif
 
 	u32 flags;
+	/* Written by COMPLETION_WAIT, waiters spin until it reaches their value */
 	volatile u64 __aligned(8) cmd_sem;
+	atomic64_t cmd_sem_val;
+
+	/* Command queue statistics */
+	u64 stat_cmds;		/* commands queued, updated on commit */
+	atomic64_t stat_waits;	/* COMPLETION_WAITs issued */
+	atomic64_t stat_wait_ns; /* time spent spinning on cmd_sem */
 
 #ifdef CONFIG_AMD_IOMMU_DEBUGFS
 	/* DebugFS Info */
@@ -751,6 +777,18 @@ extern bool amd_iommu_v2_present;
 
 extern bool amd_iommu_force_isolation;
 
+/*
+ * If true, page-table pages that map a naturally aligned, physically
+ * contiguous range with identical permissions are replaced by a single
+ * 2M or 1G PTE.
+ */
+extern bool amd_iommu_pgtable_coalesce;
+
+/* Page-table coalescing statistics */
+extern atomic64_t amd_iommu_stat_promote_2m;
+extern atomic64_t amd_iommu_stat_promote_1g;
+extern atomic64_t amd_iommu_stat_demote;
+
 /* Max levels of glxval supported */
 extern int amd_iommu_max_glx_val;
 
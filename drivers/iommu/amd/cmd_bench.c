@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * AMD IOMMU command buffer benchmark
+ *
+ * Submits INVALIDATE_IOMMU_PAGES commands for an unused domain id from an
+ * increasing number of CPUs and reports the achieved command rate.
+ */
+
+#define pr_fmt(fmt)     "AMD-Vi: cmd_bench: " fmt
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/sched/clock.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+
+#include "amd_iommu.h"
+
+static int iommu;
+module_param(iommu, int, 0444);
+MODULE_PARM_DESC(iommu, "Index of the IOMMU to benchmark");
+
+static unsigned int nr = 100000;
+module_param(nr, uint, 0444);
+MODULE_PARM_DESC(nr, "Invalidations submitted per thread");
+
+static unsigned int batch = 8;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "Invalidations per completion wait");
+
+static unsigned int threads;
+module_param(threads, uint, 0444);
+MODULE_PARM_DESC(threads, "Maximum number of threads, 0 for all online CPUs");
+
+struct cmd_bench_thread {
+	struct task_struct	*task;
+	struct completion	*start;
+	atomic_t		*running;
+	struct completion	*done;
+	int			ret;
+};
+
+static int cmd_bench_fn(void *data)
+{
+	struct cmd_bench_thread *t = data;
+	unsigned int i;
+
+	wait_for_completion(t->start);
+
+	for (i = 0; i < nr && !t->ret; i += batch) {
+		t->ret = amd_iommu_cmd_bench(iommu, min(batch, nr - i));
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(t->running))
+		complete(t->done);
+
+	return 0;
+}
+
+static int cmd_bench_run(unsigned int nr_threads)
+{
+	DECLARE_COMPLETION_ONSTACK(start);
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct cmd_bench_thread *t;
+	atomic_t running;
+	unsigned int i, cpu;
+	u64 ns, rate;
+	int ret = 0;
+
+	t = kcalloc(nr_threads, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	atomic_set(&running, nr_threads);
+
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == nr_threads)
+			break;
+
+		t[i].start   = &start;
+		t[i].running = &running;
+		t[i].done    = &done;
+		t[i].task    = kthread_create_on_node(cmd_bench_fn, &t[i],
+							cpu_to_node(cpu),
+							"amd_iommu_bench/%u", cpu);
+		if (IS_ERR(t[i].task)) {
+			ret = PTR_ERR(t[i].task);
+			break;
+		}
+
+		kthread_bind(t[i].task, cpu);
+		get_task_struct(t[i].task);
+		wake_up_process(t[i].task);
+		i++;
+	}
+
+	if (ret) {
+		/* Let the threads that did start run with an empty workload */
+		nr = 0;
+		atomic_sub(nr_threads - i, &running);
+		if (!i)
+			complete(&done);
+	}
+
+	ns = local_clock();
+	complete_all(&start);
+	wait_for_completion(&done);
+	ns = local_clock() - ns;
+
+	while (i--) {
+		if (t[i].ret && !ret)
+			ret = t[i].ret;
+		kthread_stop(t[i].task);
+		put_task_struct(t[i].task);
+	}
+
+	kfree(t);
+
+	if (ret)
+		return ret;
+
+	rate = div64_u64((u64)nr * nr_threads * NSEC_PER_SEC, ns ? : 1);
+	pr_info("%u threads: %llu invalidations/s\n", nr_threads, rate);
+
+	return 0;
+}
+
+static int __init cmd_bench_init(void)
+{
+	unsigned int max, n;
+	int ret;
+
+	/* An empty run validates the IOMMU index */
+	ret = amd_iommu_cmd_bench(iommu, 0);
+	if (ret)
+		return ret;
+
+	if (!batch)
+		batch = 1;
+
+	max = num_online_cpus();
+	if (threads && threads < max)
+		max = threads;
+
+	for (n = 1; n <= max; n <<= 1) {
+		ret = cmd_bench_run(n);
+		if (ret)
+			return ret;
+	}
+
+	if ((n >> 1) != max) {
+		ret = cmd_bench_run(max);
+		if (ret)
+			return ret;
+	}
+
+	/* Nothing to keep loaded */
+	return -EAGAIN;
+}
+module_init(cmd_bench_init);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("AMD IOMMU command buffer benchmark");
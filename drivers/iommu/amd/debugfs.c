@@ -9,6 +9,7 @@
 
 #include <linux/debugfs.h>
 #include <linux/pci.h>
+#include <linux/seq_file.h>
 
 #include "amd_iommu.h"
 
@@ -17,16 +18,48 @@ static DEFINE_MUTEX(amd_iommu_debugfs_lock);
 
 #define	MAX_NAME_LEN	20
 
+static int cmd_stats_show(struct seq_file *m, void *unused)
+{
+	struct amd_iommu *iommu = m->private;
+
+	seq_printf(m, "cmds_queued %llu\n", READ_ONCE(iommu->stat_cmds));
+	seq_printf(m, "completion_waits %lld\n",
+		   atomic64_read(&iommu->stat_waits));
+	seq_printf(m, "completion_wait_ns %lld\n",
+		   atomic64_read(&iommu->stat_wait_ns));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cmd_stats);
+
+static int pgtable_stats_show(struct seq_file *m, void *unused)
+{
+	seq_printf(m, "promote_2m %lld\n",
+		   atomic64_read(&amd_iommu_stat_promote_2m));
+	seq_printf(m, "promote_1g %lld\n",
+		   atomic64_read(&amd_iommu_stat_promote_1g));
+	seq_printf(m, "demote %lld\n", atomic64_read(&amd_iommu_stat_demote));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pgtable_stats);
+
 void amd_iommu_debugfs_setup(struct amd_iommu *iommu)
 {
 	char name[MAX_NAME_LEN + 1];
 
 	mutex_lock(&amd_iommu_debugfs_lock);
-	if (!amd_iommu_debugfs)
+	if (!amd_iommu_debugfs) {
 		amd_iommu_debugfs = debugfs_create_dir("amd",
 						       iommu_debugfs_dir);
+		debugfs_create_file("pgtable_stats", 0444, amd_iommu_debugfs,
+				    NULL, &pgtable_stats_fops);
+	}
 	mutex_unlock(&amd_iommu_debugfs_lock);
 
 	snprintf(name, MAX_NAME_LEN, "iommu%02d", iommu->index);
 	iommu->debugfs = debugfs_create_dir(name, amd_iommu_debugfs);
+
+	debugfs_create_file("cmd_stats", 0444, iommu->debugfs, iommu,
+			    &cmd_stats_fops);
 }
@@ -179,6 +179,12 @@ static bool amd_iommu_pc_present __read_mostly;
 
 bool amd_iommu_force_isolation __read_mostly;
 
+/*
+ * Promote fully populated page-table pages to 2M/1G PTEs. Off by default,
+ * as it serializes map and unmap of a domain on its pt_lock.
+ */
+bool amd_iommu_pgtable_coalesce __read_mostly;
+
 /*
  * Pointer to the device table which is shared by all AMD IOMMUs
  * it is indexed by the PCI device id or the HT unit id and contains
@@ -612,7 +618,8 @@ void amd_iommu_reset_cmd_buffer(struct amd_iommu *iommu)
 	writel(0x00, iommu->mmio_base + MMIO_CMD_HEAD_OFFSET);
 	writel(0x00, iommu->mmio_base + MMIO_CMD_TAIL_OFFSET);
 	iommu->cmd_buf_head = 0;
-	iommu->cmd_buf_tail = 0;
+	atomic64_set(&iommu->cmd_buf_reserved, 0);
+	atomic64_set(&iommu->cmd_buf_committed, 0);
 
 	iommu_feature_enable(iommu, CONTROL_CMDBUF_EN);
 }
@@ -1480,8 +1487,6 @@ static int __init init_iommu_one(struct amd_iommu *iommu, struct ivhd_header *h)
 {
 	int ret;
 
-	raw_spin_lock_init(&iommu->lock);
-
 	/* Add IOMMU to internal data structures */
 	list_add_tail(&iommu->list, &amd_iommu_list);
 	iommu->index = amd_iommus_present++;
@@ -1919,6 +1924,14 @@ static int iommu_setup_msi(struct amd_iommu *iommu)
 		return r;
 	}
 
+	/*
+	 * Keep event and PPR log processing on the node the IOMMU sits on,
+	 * the interrupt thread follows the affinity of the interrupt.
+	 */
+	if (dev_to_node(&iommu->dev->dev) != NUMA_NO_NODE)
+		irq_set_affinity_hint(iommu->dev->irq,
+				      cpumask_of_node(dev_to_node(&iommu->dev->dev)));
+
 	iommu->int_enabled = true;
 
 	return 0;
@@ -2948,6 +2961,11 @@ static int __init parse_amd_iommu_options(char *str)
 			amd_iommu_disabled = true;
 		if (strncmp(str, "force_isolation", 15) == 0)
 			amd_iommu_force_isolation = true;
+		/* Skip past the old "nocoalesce", it ends in "coalesce" */
+		if (strncmp(str, "nocoalesce", 10) == 0)
+			str += 9;
+		else if (strncmp(str, "coalesce", 8) == 0)
+			amd_iommu_pgtable_coalesce = true;
 	}
 
 	return 1;
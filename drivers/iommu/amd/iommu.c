@@ -32,6 +32,7 @@
 #include <linux/irqdomain.h>
 #include <linux/percpu.h>
 #include <linux/iova.h>
+#include <linux/lat_hist.h>
 #include <asm/irq_remapping.h>
 #include <asm/io_apic.h>
 #include <asm/apic.h>
@@ -607,7 +608,8 @@ static void iommu_poll_events(struct amd_iommu *iommu)
 	writel(head, iommu->mmio_base + MMIO_EVT_HEAD_OFFSET);
 }
 
-static void iommu_handle_ppr_entry(struct amd_iommu *iommu, u64 *raw)
+static void iommu_handle_ppr_entry(struct amd_iommu *iommu, u64 *raw,
+				   u64 timestamp)
 {
 	struct amd_iommu_fault fault;
 
@@ -621,13 +623,20 @@ static void iommu_handle_ppr_entry(struct amd_iommu *iommu, u64 *raw)
 	fault.device_id = PPR_DEVID(raw[0]);
 	fault.tag       = PPR_TAG(raw[0]);
 	fault.flags     = PPR_FLAGS(raw[0]);
+	fault.timestamp = timestamp;
 
 	atomic_notifier_call_chain(&ppr_notifier, 0, &fault);
 }
 
+/* Number of PPR log entries taken off the ring per head update */
+#define PPR_POLL_BATCH	16
+
 static void iommu_poll_ppr_log(struct amd_iommu *iommu)
 {
+	u64 entries[PPR_POLL_BATCH][2];
 	u32 head, tail;
+	u64 now;
+	int n, i;
 
 	if (iommu->ppr_log == NULL)
 		return;
@@ -636,39 +645,46 @@ static void iommu_poll_ppr_log(struct amd_iommu *iommu)
 	tail = readl(iommu->mmio_base + MMIO_PPR_TAIL_OFFSET);
 
 	while (head != tail) {
-		volatile u64 *raw;
-		u64 entry[2];
-		int i;
-
-		raw = (u64 *)(iommu->ppr_log + head);
-
 		/*
-		 * Hardware bug: Interrupt may arrive before the entry is
-		 * written to memory. If this happens we need to wait for the
-		 * entry to arrive.
+		 * Drain a batch of entries with a single head update, so the
+		 * IOMMU can log new requests while the batch is handled.
 		 */
-		for (i = 0; i < LOOP_TIMEOUT; ++i) {
-			if (PPR_REQ_TYPE(raw[0]) != 0)
-				break;
-			udelay(1);
-		}
+		for (n = 0; n < PPR_POLL_BATCH && head != tail; n++) {
+			volatile u64 *raw;
 
-		/* Avoid memcpy function-call overhead */
-		entry[0] = raw[0];
-		entry[1] = raw[1];
+			raw = (u64 *)(iommu->ppr_log + head);
 
-		/*
-		 * To detect the hardware bug we need to clear the entry
-		 * back to zero.
-		 */
-		raw[0] = raw[1] = 0UL;
+			/*
+			 * Hardware bug: Interrupt may arrive before the entry
+			 * is written to memory. If this happens we need to
+			 * wait for the entry to arrive.
+			 */
+			for (i = 0; i < LOOP_TIMEOUT; ++i) {
+				if (PPR_REQ_TYPE(raw[0]) != 0)
+					break;
+				udelay(1);
+			}
+
+			/* Avoid memcpy function-call overhead */
+			entries[n][0] = raw[0];
+			entries[n][1] = raw[1];
+
+			/*
+			 * To detect the hardware bug we need to clear the
+			 * entry back to zero.
+			 */
+			raw[0] = raw[1] = 0UL;
+
+			head = (head + PPR_ENTRY_SIZE) % PPR_LOG_SIZE;
+		}
 
 		/* Update head pointer of hardware ring-buffer */
-		head = (head + PPR_ENTRY_SIZE) % PPR_LOG_SIZE;
 		writel(head, iommu->mmio_base + MMIO_PPR_HEAD_OFFSET);
 
-		/* Handle PPR entry */
-		iommu_handle_ppr_entry(iommu, entry);
+		/* Handle PPR entries */
+		now = local_clock();
+		for (i = 0; i < n; i++)
+			iommu_handle_ppr_entry(iommu, entries[i], now);
 
 		/* Refresh ring-buffer information */
 		head = readl(iommu->mmio_base + MMIO_PPR_HEAD_OFFSET);
@@ -792,11 +808,14 @@ irqreturn_t amd_iommu_int_handler(int irq, void *data)
  *
  ****************************************************************************/
 
-static int wait_on_sem(volatile u64 *sem)
+/* Time spent in wait_on_sem(), in tracing/latency_hist/amd_iommu_wait */
+DEFINE_LAT_HIST(amd_iommu_wait);
+
+static int wait_on_sem(struct amd_iommu *iommu, u64 data)
 {
 	int i = 0;
 
-	while (*sem == 0 && i < LOOP_TIMEOUT) {
+	while (READ_ONCE(iommu->cmd_sem) < data && i < LOOP_TIMEOUT) {
 		udelay(1);
 		i += 1;
 	}
@@ -809,34 +828,16 @@ static int wait_on_sem(volatile u64 *sem)
 	return 0;
 }
 
-static void copy_cmd_to_buffer(struct amd_iommu *iommu,
-			       struct iommu_cmd *cmd)
-{
-	u8 *target;
-	u32 tail;
-
-	/* Copy command to buffer */
-	tail = iommu->cmd_buf_tail;
-	target = iommu->cmd_buf + tail;
-	memcpy(target, cmd, sizeof(*cmd));
-
-	tail = (tail + sizeof(*cmd)) % CMD_BUFFER_SIZE;
-	iommu->cmd_buf_tail = tail;
-
-	/* Tell the IOMMU about it */
-	writel(tail, iommu->mmio_base + MMIO_CMD_TAIL_OFFSET);
-}
-
-static void build_completion_wait(struct iommu_cmd *cmd, u64 address)
+static void build_completion_wait(struct iommu_cmd *cmd,
+				  struct amd_iommu *iommu, u64 data)
 {
-	u64 paddr = iommu_virt_to_phys((void *)address);
-
-	WARN_ON(address & 0x7ULL);
+	u64 paddr = iommu_virt_to_phys((void *)&iommu->cmd_sem);
 
 	memset(cmd, 0, sizeof(*cmd));
 	cmd->data[0] = lower_32_bits(paddr) | CMD_COMPL_WAIT_STORE_MASK;
 	cmd->data[1] = upper_32_bits(paddr);
-	cmd->data[2] = 1;
+	cmd->data[2] = lower_32_bits(data);
+	cmd->data[3] = upper_32_bits(data);
 	CMD_SET_TYPE(cmd, CMD_COMPL_WAIT);
 }
 
@@ -847,33 +848,51 @@ static void build_inv_dte(struct iommu_cmd *cmd, u16 devid)
 	CMD_SET_TYPE(cmd, CMD_INV_DEV_ENTRY);
 }
 
-static void build_inv_iommu_pages(struct iommu_cmd *cmd, u64 address,
-				  size_t size, u16 domid, int pde)
+/*
+ * Encode an invalidation of [address, address + size) for the INVALIDATE_*
+ * commands. With the size bit set the hardware invalidates the naturally
+ * aligned power-of-two range whose size is given by the lowest clear bit of
+ * the address, so round the range up to the smallest such range covering it.
+ */
+static u64 build_inv_address(u64 address, size_t size)
 {
-	u64 pages;
-	bool s;
+	u64 pages, end, msb_diff;
 
 	pages = iommu_num_pages(address, size, PAGE_SIZE);
-	s     = false;
 
-	if (pages > 1) {
-		/*
-		 * If we have to flush more than one page, flush all
-		 * TLB entries for this domain
-		 */
+	if (pages == 1)
+		return address & PAGE_MASK;
+
+	if (size == CMD_INV_IOMMU_ALL_PAGES_ADDRESS)
+		return CMD_INV_IOMMU_ALL_PAGES_ADDRESS | CMD_INV_IOMMU_PAGES_SIZE_MASK;
+
+	end = address + size - 1;
+
+	/* Index of the most significant bit that differs between start and end */
+	msb_diff = fls64(end ^ address) - 1;
+
+	/* Bits 63:52 are sign extended, fall back to a full flush */
+	if (unlikely(msb_diff > 51))
 		address = CMD_INV_IOMMU_ALL_PAGES_ADDRESS;
-		s = true;
-	}
+	else
+		address |= (1ULL << msb_diff) - 1;
 
 	address &= PAGE_MASK;
 
+	/* Size bit - we flush more than one 4kb page */
+	return address | CMD_INV_IOMMU_PAGES_SIZE_MASK;
+}
+
+static void build_inv_iommu_pages(struct iommu_cmd *cmd, u64 address,
+				  size_t size, u16 domid, int pde)
+{
+	u64 inv_address = build_inv_address(address, size);
+
 	memset(cmd, 0, sizeof(*cmd));
 	cmd->data[1] |= domid;
-	cmd->data[2]  = lower_32_bits(address);
-	cmd->data[3]  = upper_32_bits(address);
+	cmd->data[2]  = lower_32_bits(inv_address);
+	cmd->data[3]  = upper_32_bits(inv_address);
 	CMD_SET_TYPE(cmd, CMD_INV_IOMMU_PAGES);
-	if (s) /* size bit - we flush more than one 4kb page */
-		cmd->data[2] |= CMD_INV_IOMMU_PAGES_SIZE_MASK;
 	if (pde) /* PDE bit - we want to flush everything, not only the PTEs */
 		cmd->data[2] |= CMD_INV_IOMMU_PAGES_PDE_MASK;
 }
@@ -881,32 +900,15 @@ static void build_inv_iommu_pages(struct iommu_cmd *cmd, u64 address,
 static void build_inv_iotlb_pages(struct iommu_cmd *cmd, u16 devid, int qdep,
 				  u64 address, size_t size)
 {
-	u64 pages;
-	bool s;
-
-	pages = iommu_num_pages(address, size, PAGE_SIZE);
-	s     = false;
-
-	if (pages > 1) {
-		/*
-		 * If we have to flush more than one page, flush all
-		 * TLB entries for this domain
-		 */
-		address = CMD_INV_IOMMU_ALL_PAGES_ADDRESS;
-		s = true;
-	}
-
-	address &= PAGE_MASK;
+	u64 inv_address = build_inv_address(address, size);
 
 	memset(cmd, 0, sizeof(*cmd));
 	cmd->data[0]  = devid;
 	cmd->data[0] |= (qdep & 0xff) << 24;
 	cmd->data[1]  = devid;
-	cmd->data[2]  = lower_32_bits(address);
-	cmd->data[3]  = upper_32_bits(address);
+	cmd->data[2]  = lower_32_bits(inv_address);
+	cmd->data[3]  = upper_32_bits(inv_address);
 	CMD_SET_TYPE(cmd, CMD_INV_IOTLB_PAGES);
-	if (s)
-		cmd->data[2] |= CMD_INV_IOMMU_PAGES_SIZE_MASK;
 }
 
 static void build_inv_iommu_pasid(struct iommu_cmd *cmd, u16 domid, int pasid,
@@ -976,43 +978,110 @@ static void build_inv_irt(struct iommu_cmd *cmd, u16 devid)
 	CMD_SET_TYPE(cmd, CMD_INV_IRT);
 }
 
+/* Bytes of the command buffer in use, given a reservation and commit point */
+static u64 iommu_cmd_buf_used(struct amd_iommu *iommu, u64 reserved,
+			      u64 committed)
+{
+	u32 tail = committed % CMD_BUFFER_SIZE;
+	u32 head = READ_ONCE(iommu->cmd_buf_head);
+
+	return ((tail - head) % CMD_BUFFER_SIZE) + (reserved - committed);
+}
+
 /*
- * Writes the command to the IOMMUs command buffer and informs the
- * hardware about the new command.
+ * Writes the commands to the IOMMUs command buffer and informs the
+ * hardware about them.
+ *
+ * Submission does not take a lock. Space for all @nr commands is reserved
+ * at once with a cmpxchg on cmd_buf_reserved, so a multi-command submission
+ * is staged into the ring as one contiguous run, and the commands are copied
+ * in parallel with other CPUs. The tail register is only ever advanced over
+ * fully written commands: each submitter waits for the submitters before it
+ * to commit, which only covers their memcpy() and MMIO write since
+ * interrupts are disabled between reservation and commit.
+ *
+ * If @sem is set, the last command is a completion wait whose store value is
+ * assigned here, in commit order, and returned through @sem.
  */
-static int __iommu_queue_command_sync(struct amd_iommu *iommu,
-				      struct iommu_cmd *cmd,
-				      bool sync)
-{
-	unsigned int count = 0;
-	u32 left, next_tail;
-
-	next_tail = (iommu->cmd_buf_tail + sizeof(*cmd)) % CMD_BUFFER_SIZE;
-again:
-	left      = (iommu->cmd_buf_head - next_tail) % CMD_BUFFER_SIZE;
-
-	if (left <= 0x20) {
-		/* Skip udelay() the first time around */
-		if (count++) {
-			if (count == LOOP_TIMEOUT) {
-				pr_err("Command buffer timeout\n");
-				return -EIO;
+static int iommu_queue_cmds(struct amd_iommu *iommu, struct iommu_cmd *cmds,
+			    unsigned int nr, bool sync, u64 *sem)
+{
+	u64 len = nr * sizeof(*cmds), pos, committed;
+	unsigned int count = 0, i;
+	unsigned long flags;
+
+	if (WARN_ON_ONCE(len > CMD_BUFFER_SIZE / 2))
+		return -EINVAL;
+
+	local_irq_save(flags);
+
+	pos = atomic64_read(&iommu->cmd_buf_reserved);
+	for (;;) {
+		committed = atomic64_read(&iommu->cmd_buf_committed);
+		if ((s64)(pos - committed) < 0) {
+			pos = atomic64_read(&iommu->cmd_buf_reserved);
+			continue;
+		}
+
+		if (iommu_cmd_buf_used(iommu, pos, committed) + len + 0x20 >=
+		    CMD_BUFFER_SIZE) {
+			/* Skip udelay() the first time around */
+			if (count++) {
+				if (count == LOOP_TIMEOUT) {
+					local_irq_restore(flags);
+					pr_err("Command buffer timeout\n");
+					return -EIO;
+				}
+
+				udelay(1);
 			}
 
-			udelay(1);
+			/* Update head and recheck remaining space */
+			WRITE_ONCE(iommu->cmd_buf_head,
+				   readl(iommu->mmio_base + MMIO_CMD_HEAD_OFFSET));
+			pos = atomic64_read(&iommu->cmd_buf_reserved);
+			continue;
 		}
 
-		/* Update head and recheck remaining space */
-		iommu->cmd_buf_head = readl(iommu->mmio_base +
-					    MMIO_CMD_HEAD_OFFSET);
+		if (atomic64_try_cmpxchg(&iommu->cmd_buf_reserved, &pos, pos + len))
+			break;
+	}
+
+	/* Copy commands to buffer, a trailing completion wait goes in last */
+	for (i = 0; i < nr - !!sem; i++)
+		memcpy(iommu->cmd_buf + (pos + i * sizeof(*cmds)) % CMD_BUFFER_SIZE,
+		       &cmds[i], sizeof(*cmds));
+
+	/* Commit in reservation order */
+	while (atomic64_read(&iommu->cmd_buf_committed) != pos)
+		cpu_relax();
 
-		goto again;
+	/*
+	 * The IOMMU stores completion wait values in ring order, so they have
+	 * to be handed out in ring order too. Otherwise a later wait with a
+	 * smaller value can overwrite cmd_sem, and the earlier waiter spins
+	 * until it times out.
+	 */
+	if (sem) {
+		*sem = atomic64_inc_return(&iommu->cmd_sem_val);
+		cmds[i].data[2] = lower_32_bits(*sem);
+		cmds[i].data[3] = upper_32_bits(*sem);
+		memcpy(iommu->cmd_buf + (pos + i * sizeof(*cmds)) % CMD_BUFFER_SIZE,
+		       &cmds[i], sizeof(*cmds));
 	}
 
-	copy_cmd_to_buffer(iommu, cmd);
+	/* Tell the IOMMU about it */
+	writel((pos + len) % CMD_BUFFER_SIZE,
+	       iommu->mmio_base + MMIO_CMD_TAIL_OFFSET);
+
+	iommu->stat_cmds += nr;
 
 	/* Do we need to make sure all commands are processed? */
-	iommu->need_sync = sync;
+	WRITE_ONCE(iommu->need_sync, sync);
+
+	atomic64_set_release(&iommu->cmd_buf_committed, pos + len);
+
+	local_irq_restore(flags);
 
 	return 0;
 }
@@ -1021,14 +1090,7 @@ static int iommu_queue_command_sync(struct amd_iommu *iommu,
 				    struct iommu_cmd *cmd,
 				    bool sync)
 {
-	unsigned long flags;
-	int ret;
-
-	raw_spin_lock_irqsave(&iommu->lock, flags);
-	ret = __iommu_queue_command_sync(iommu, cmd, sync);
-	raw_spin_unlock_irqrestore(&iommu->lock, flags);
-
-	return ret;
+	return iommu_queue_cmds(iommu, cmd, 1, sync, NULL);
 }
 
 static int iommu_queue_command(struct amd_iommu *iommu, struct iommu_cmd *cmd)
@@ -1038,35 +1100,63 @@ static int iommu_queue_command(struct amd_iommu *iommu, struct iommu_cmd *cmd)
 
 /*
  * This function queues a completion wait command into the command
- * buffer of an IOMMU
+ * buffer of an IOMMU. Every waiter gets its own sequence number, assigned
+ * in ring order, which the IOMMU writes to cmd_sem once all commands before
+ * the wait are done.
  */
 static int iommu_completion_wait(struct amd_iommu *iommu)
 {
 	struct iommu_cmd cmd;
-	unsigned long flags;
+	u64 data, start, ns;
 	int ret;
 
-	if (!iommu->need_sync)
+	if (!READ_ONCE(iommu->need_sync))
 		return 0;
 
+	build_completion_wait(&cmd, iommu, 0);
 
-	build_completion_wait(&cmd, (u64)&iommu->cmd_sem);
+	ret = iommu_queue_cmds(iommu, &cmd, 1, false, &data);
+	if (ret)
+		return ret;
 
-	raw_spin_lock_irqsave(&iommu->lock, flags);
+	start = local_clock();
+	ret = wait_on_sem(iommu, data);
+	ns = local_clock() - start;
+	atomic64_add(ns, &iommu->stat_wait_ns);
+	atomic64_inc(&iommu->stat_waits);
+	lat_hist_record(&lat_hist_amd_iommu_wait, ns);
 
-	iommu->cmd_sem = 0;
+	return ret;
+}
 
-	ret = __iommu_queue_command_sync(iommu, &cmd, false);
-	if (ret)
-		goto out_unlock;
+#if IS_ENABLED(CONFIG_AMD_IOMMU_CMD_BENCH)
+/*
+ * Queue @nr_cmds invalidations of domain id 0, which is never handed out,
+ * followed by a completion wait. Used by the command buffer benchmark.
+ */
+int amd_iommu_cmd_bench(int index, unsigned int nr_cmds)
+{
+	struct amd_iommu *iommu;
+	struct iommu_cmd cmd;
+	unsigned int i;
+	int ret;
 
-	ret = wait_on_sem(&iommu->cmd_sem);
+	if (index < 0 || index >= amd_iommu_get_num_iommus())
+		return -ENODEV;
 
-out_unlock:
-	raw_spin_unlock_irqrestore(&iommu->lock, flags);
+	iommu = amd_iommus[index];
+	build_inv_iommu_pages(&cmd, 0, PAGE_SIZE, 0, 0);
 
-	return ret;
+	for (i = 0; i < nr_cmds; i++) {
+		ret = iommu_queue_command(iommu, &cmd);
+		if (ret)
+			return ret;
+	}
+
+	return iommu_completion_wait(iommu);
 }
+EXPORT_SYMBOL_GPL(amd_iommu_cmd_bench);
+#endif
 
 static int iommu_flush_dte(struct amd_iommu *iommu, u16 devid)
 {
@@ -1277,6 +1367,85 @@ static void domain_flush_complete(struct protection_domain *domain)
 	}
 }
 
+/*
+ * Batched IO/TLB invalidation. Callers add the ranges they unmapped with
+ * domain_flush_batch_add() and call domain_flush_batch_finish() once, which
+ * waits for completion on each IOMMU of the domain only once for the whole
+ * batch.
+ *
+ * Overlapping and adjacent ranges are always merged. Ranges with a gap
+ * between them are merged as long as the gap is not larger than the ranges
+ * themselves, over-invalidating a little is cheaper than another command
+ * per IOMMU and device.
+ */
+static void domain_flush_batch_init(struct amd_iommu_flush_batch *batch,
+				    struct protection_domain *domain)
+{
+	batch->domain	 = domain;
+	batch->start	 = U64_MAX;
+	batch->end	 = 0;
+	batch->nr_ranges = 0;
+}
+
+static void domain_flush_batch_queue(struct amd_iommu_flush_batch *batch)
+{
+	struct protection_domain *domain = batch->domain;
+	unsigned long flags;
+
+	if (batch->start >= batch->end)
+		return;
+
+	spin_lock_irqsave(&domain->lock, flags);
+	domain_flush_pages(domain, batch->start, batch->end - batch->start);
+	spin_unlock_irqrestore(&domain->lock, flags);
+
+	batch->start = U64_MAX;
+	batch->end   = 0;
+}
+
+static void domain_flush_batch_add(struct amd_iommu_flush_batch *batch,
+				   u64 address, size_t size)
+{
+	u64 end = address + size, gap;
+
+	if (!size)
+		return;
+
+	batch->nr_ranges++;
+
+	if (batch->start < batch->end) {
+		if (address > batch->end)
+			gap = address - batch->end;
+		else if (end < batch->start)
+			gap = batch->start - end;
+		else
+			gap = 0;
+
+		if (gap > max_t(u64, size, batch->end - batch->start))
+			domain_flush_batch_queue(batch);
+	}
+
+	batch->start = min(batch->start, address);
+	batch->end   = max(batch->end, end);
+}
+
+static void domain_flush_batch_finish(struct amd_iommu_flush_batch *batch)
+{
+	struct protection_domain *domain = batch->domain;
+	unsigned long flags;
+
+	if (!batch->nr_ranges)
+		return;
+
+	domain_flush_batch_queue(batch);
+
+	spin_lock_irqsave(&domain->lock, flags);
+	domain_flush_complete(domain);
+	spin_unlock_irqrestore(&domain->lock, flags);
+
+	batch->nr_ranges = 0;
+}
+
 /* Flush the not present cache if it exists */
 static void domain_flush_np_cache(struct protection_domain *domain,
 		dma_addr_t iova, size_t size)
@@ -1319,6 +1488,28 @@ static void free_page_list(struct page *freelist)
 	}
 }
 
+static void free_pt_page_rcu(struct rcu_head *head)
+{
+	struct page *p = container_of(head, struct page, rcu_head);
+
+	free_page((unsigned long)page_address(p));
+}
+
+/*
+ * Frees page-table pages that were taken out of a live page table.
+ * amd_iommu_iova_to_phys() walks it under rcu_read_lock() only, so the
+ * pages must outlive a grace period.
+ */
+static void free_page_list_rcu(struct page *freelist)
+{
+	while (freelist != NULL) {
+		struct page *p = freelist;
+
+		freelist = freelist->freelist;
+		call_rcu(&p->rcu_head, free_pt_page_rcu);
+	}
+}
+
 static struct page *free_pt_page(unsigned long pt, struct page *freelist)
 {
 	struct page *p = virt_to_page((void *)pt);
@@ -1612,6 +1803,154 @@ static u64 *fetch_pte(struct protection_domain *domain,
 	return pte;
 }
 
+atomic64_t amd_iommu_stat_promote_2m;
+atomic64_t amd_iommu_stat_promote_1g;
+atomic64_t amd_iommu_stat_demote;
+
+/*
+ * Returns a pointer to the entry at @level that translates @address, or
+ * NULL if the walk ends earlier in a non-present or large PTE.
+ */
+static u64 *fetch_pde(struct protection_domain *domain,
+		      unsigned long address, int level)
+{
+	struct domain_pgtable pgtable;
+	int lvl;
+	u64 *pte;
+
+	amd_iommu_domain_get_pgtable(domain, &pgtable);
+
+	if (level >= pgtable.mode || address > PM_LEVEL_SIZE(pgtable.mode))
+		return NULL;
+
+	lvl = pgtable.mode - 1;
+	pte = &pgtable.root[PM_LEVEL_INDEX(lvl, address)];
+
+	while (lvl > level) {
+		u64 __pte = READ_ONCE(*pte);
+
+		if (!IOMMU_PTE_PRESENT(__pte) || PM_PTE_LEVEL(__pte) != lvl)
+			return NULL;
+
+		lvl -= 1;
+		pte  = IOMMU_PTE_PAGE(__pte);
+		pte  = &pte[PM_LEVEL_INDEX(lvl, address)];
+	}
+
+	return pte;
+}
+
+/*
+ * Checks whether the 512 leaf PTEs of a page-table page, each mapping
+ * @size bytes, can be replaced by one PTE a level up: they all have to be
+ * present with the same permissions and map a naturally aligned run of
+ * physically contiguous memory.
+ */
+static bool pt_page_coalescable(u64 *pt, unsigned long size)
+{
+	u64 first = READ_ONCE(pt[0]);
+	u64 phys  = first & PM_ADDR_MASK;
+	int i;
+
+	if (!IOMMU_PTE_PRESENT(first) || PM_PTE_LEVEL(first) != 0 ||
+	    !IS_ALIGNED(__sme_clr(phys), size * 512))
+		return false;
+
+	/* Check the last entry first, ranges are mostly mapped in order */
+	if (READ_ONCE(pt[511]) != (first + 511 * size))
+		return false;
+
+	for (i = 1; i < 511; i++) {
+		if (READ_ONCE(pt[i]) != first + i * size)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Replaces the page-table pages below @address that were completed by a
+ * mapping at @level with 2M and 1G PTEs. The old page-table pages are put
+ * on @freelist and must only be freed after the IO/TLB has been flushed
+ * including PDEs. Returns true if the page table was changed.
+ *
+ * Called with dom->pt_lock held, which keeps iommu_map_page() and
+ * iommu_unmap_page() from writing to a page-table page while it is
+ * replaced.
+ */
+static bool coalesce_pt(struct protection_domain *dom, unsigned long address,
+			int level, struct page **freelist)
+{
+	bool updated = false;
+	int lvl;
+
+	if (!amd_iommu_pgtable_coalesce)
+		return false;
+
+	/* Only 2M (level 1) and 1G (level 2) PTEs are coalesced */
+	for (lvl = level + 1; lvl <= 2; lvl++) {
+		unsigned long size = PTE_LEVEL_PAGE_SIZE(lvl - 1);
+		u64 *pde, __pde, *pt;
+		struct page *p;
+
+		pde = fetch_pde(dom, address, lvl);
+		if (!pde)
+			break;
+
+		__pde = READ_ONCE(*pde);
+		if (!IOMMU_PTE_PRESENT(__pde) || PM_PTE_LEVEL(__pde) != lvl)
+			break;
+
+		pt = IOMMU_PTE_PAGE(__pde);
+		if (!pt_page_coalescable(pt, size))
+			break;
+
+		/* A large PTE has the same format as the smaller ones */
+		WRITE_ONCE(*pde, pt[0]);
+
+		p = virt_to_page(pt);
+		p->freelist = *freelist;
+		*freelist = p;
+		updated = true;
+
+		if (lvl == 1)
+			atomic64_inc(&amd_iommu_stat_promote_2m);
+		else
+			atomic64_inc(&amd_iommu_stat_promote_1g);
+	}
+
+	return updated;
+}
+
+/*
+ * Splits the large PTE at @pte, which is at @level, into a page-table page
+ * of PTEs one level down mapping the same memory, so part of it can be
+ * unmapped. Returns false if the PTE could not be split. Called with
+ * dom->pt_lock held if coalescing is enabled.
+ */
+static bool demote_pte(u64 *pte, int level)
+{
+	unsigned long size = PTE_LEVEL_PAGE_SIZE(level - 1);
+	u64 __pte = READ_ONCE(*pte), *pt;
+	int i;
+
+	pt = (u64 *)get_zeroed_page(GFP_ATOMIC);
+	if (!pt)
+		return false;
+
+	for (i = 0; i < 512; i++)
+		pt[i] = __pte + i * size;
+
+	if (cmpxchg64(pte, __pte, PM_LEVEL_PDE(level, iommu_virt_to_phys(pt))) != __pte) {
+		free_page((unsigned long)pt);
+		return false;
+	}
+
+	atomic64_inc(&amd_iommu_stat_demote);
+
+	return true;
+}
+
 static struct page *free_clear_pte(u64 *pte, u64 pteval, struct page *freelist)
 {
 	unsigned long pt;
@@ -1647,6 +1986,7 @@ static int iommu_map_page(struct protection_domain *dom,
 {
 	struct page *freelist = NULL;
 	bool updated = false;
+	unsigned long flags;
 	u64 __pte, *pte;
 	int ret, i, count;
 
@@ -1660,6 +2000,19 @@ static int iommu_map_page(struct protection_domain *dom,
 	count = PAGE_SIZE_PTE_COUNT(page_size);
 	pte   = alloc_pte(dom, bus_addr, page_size, NULL, gfp, &updated);
 
+	/*
+	 * With coalescing the page-table page holding @pte may be replaced
+	 * until pt_lock is held, walk the page table again under it. The
+	 * walk above allocated everything that is missing.
+	 */
+	if (pte && amd_iommu_pgtable_coalesce) {
+		spin_lock_irqsave(&dom->pt_lock, flags);
+		pte = alloc_pte(dom, bus_addr, page_size, NULL, GFP_ATOMIC,
+				&updated);
+		if (!pte)
+			spin_unlock_irqrestore(&dom->pt_lock, flags);
+	}
+
 	ret = -ENOMEM;
 	if (!pte)
 		goto out;
@@ -1684,12 +2037,18 @@ static int iommu_map_page(struct protection_domain *dom,
 	for (i = 0; i < count; ++i)
 		pte[i] = __pte;
 
+	if (amd_iommu_pgtable_coalesce) {
+		if (count == 1 && page_size < PTE_LEVEL_PAGE_SIZE(2) &&
+		    coalesce_pt(dom, bus_addr, PAGE_SIZE_LEVEL(page_size),
+				&freelist))
+			updated = true;
+		spin_unlock_irqrestore(&dom->pt_lock, flags);
+	}
+
 	ret = 0;
 
 out:
 	if (updated) {
-		unsigned long flags;
-
 		spin_lock_irqsave(&dom->lock, flags);
 		/*
 		 * Flush domain TLB(s) and wait for completion. Any Device-Table
@@ -1701,28 +2060,51 @@ out:
 		spin_unlock_irqrestore(&dom->lock, flags);
 	}
 
-	/* Everything flushed out, free pages now */
-	free_page_list(freelist);
+	/* Everything flushed out, free pages once lookups are done with them */
+	free_page_list_rcu(freelist);
 
 	return ret;
 }
 
 static unsigned long iommu_unmap_page(struct protection_domain *dom,
 				      unsigned long bus_addr,
-				      unsigned long page_size)
+				      unsigned long page_size,
+				      struct iommu_iotlb_gather *gather)
 {
 	unsigned long long unmapped;
 	unsigned long unmap_size;
+	unsigned long flags;
 	u64 *pte;
 
 	BUG_ON(!is_power_of_2(page_size));
 
 	unmapped = 0;
 
+	/* Keep coalesce_pt() from freeing the page-table pages under us */
+	if (amd_iommu_pgtable_coalesce)
+		spin_lock_irqsave(&dom->pt_lock, flags);
+
 	while (unmapped < page_size) {
 
 		pte = fetch_pte(dom, bus_addr, &unmap_size);
 
+		/*
+		 * Split a large PTE that is only partially unmapped. The
+		 * whole large page is flushed since the IO/TLB may still
+		 * hold its translation.
+		 */
+		if (pte && unmap_size > page_size - unmapped &&
+		    PM_PTE_LEVEL(*pte) == 0 &&
+		    demote_pte(pte, PAGE_SIZE_LEVEL(unmap_size))) {
+			if (gather) {
+				unsigned long start = PAGE_SIZE_ALIGN(bus_addr, unmap_size);
+
+				gather->start = min(gather->start, start);
+				gather->end   = max(gather->end, start + unmap_size);
+			}
+			continue;
+		}
+
 		if (pte) {
 			int i, count;
 
@@ -1735,8 +2117,18 @@ static unsigned long iommu_unmap_page(struct protection_domain *dom,
 		unmapped += unmap_size;
 	}
 
+	if (amd_iommu_pgtable_coalesce)
+		spin_unlock_irqrestore(&dom->pt_lock, flags);
+
 	BUG_ON(unmapped && !is_power_of_2(unmapped));
 
+	/* Record the range for amd_iommu_iotlb_sync() */
+	if (unmapped && gather) {
+		gather->start = min_t(unsigned long, gather->start,
+				      bus_addr - unmapped);
+		gather->end   = max_t(unsigned long, gather->end, bus_addr);
+	}
+
 	return unmapped;
 }
 
@@ -2275,6 +2667,9 @@ int __init amd_iommu_init_api(void)
 	if (err)
 		return err;
 
+	if (lat_hist_register(&lat_hist_amd_iommu_wait))
+		pr_warn("Failed to register latency histogram\n");
+
 	return 0;
 }
 
@@ -2342,6 +2737,7 @@ static int protection_domain_init(struct protection_domain *domain, int mode)
 	BUG_ON(mode < PAGE_MODE_NONE || mode > PAGE_MODE_6_LEVEL);
 
 	spin_lock_init(&domain->lock);
+	spin_lock_init(&domain->pt_lock);
 	domain->id = domain_id_alloc();
 	if (!domain->id)
 		return -ENOMEM;
@@ -2531,7 +2927,7 @@ static size_t amd_iommu_unmap(struct iommu_domain *dom, unsigned long iova,
 	if (pgtable.mode == PAGE_MODE_NONE)
 		return 0;
 
-	return iommu_unmap_page(domain, iova, page_size);
+	return iommu_unmap_page(domain, iova, page_size, gather);
 }
 
 static phys_addr_t amd_iommu_iova_to_phys(struct iommu_domain *dom,
@@ -2546,13 +2942,20 @@ static phys_addr_t amd_iommu_iova_to_phys(struct iommu_domain *dom,
 	if (pgtable.mode == PAGE_MODE_NONE)
 		return iova;
 
+	/*
+	 * Map and coalescing may replace page-table pages while we walk,
+	 * they are freed after a grace period.
+	 */
+	rcu_read_lock();
 	pte = fetch_pte(domain, iova, &pte_pgsize);
+	__pte = pte ? READ_ONCE(*pte) : 0;
+	rcu_read_unlock();
 
-	if (!pte || !IOMMU_PTE_PRESENT(*pte))
+	if (!IOMMU_PTE_PRESENT(__pte))
 		return 0;
 
 	offset_mask = pte_pgsize - 1;
-	__pte	    = __sme_clr(*pte & PM_ADDR_MASK);
+	__pte	    = __sme_clr(__pte & PM_ADDR_MASK);
 
 	return (__pte & ~offset_mask) | (iova & offset_mask);
 }
@@ -2648,7 +3051,17 @@ static void amd_iommu_flush_iotlb_all(struct iommu_domain *domain)
 static void amd_iommu_iotlb_sync(struct iommu_domain *domain,
 				 struct iommu_iotlb_gather *gather)
 {
-	amd_iommu_flush_iotlb_all(domain);
+	struct amd_iommu_flush_batch batch;
+
+	if (gather->start >= gather->end) {
+		amd_iommu_flush_iotlb_all(domain);
+		return;
+	}
+
+	domain_flush_batch_init(&batch, to_pdomain(domain));
+	domain_flush_batch_add(&batch, gather->start,
+			       gather->end - gather->start);
+	domain_flush_batch_finish(&batch);
 }
 
 static int amd_iommu_def_domain_type(struct device *dev)
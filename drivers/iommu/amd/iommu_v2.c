@@ -8,6 +8,9 @@
 
 #include <linux/mmu_notifier.h>
 #include <linux/amd-iommu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched/clock.h>
 #include <linux/mm_types.h>
 #include <linux/profile.h>
 #include <linux/module.h>
@@ -25,6 +28,9 @@ MODULE_AUTHOR("Joerg Roedel <jroedel@suse.de>");
 #define MAX_DEVICES		0x10000
 #define PRI_QUEUE_SIZE		512
 
+/* Fault latency histogram, bucket i counts faults taking < 2^i us */
+#define FAULT_LAT_BUCKETS	20
+
 struct pri_queue {
 	atomic_t inflight;
 	bool finish;
@@ -74,6 +80,7 @@ struct fault {
 	u16 tag;
 	u16 finish;
 	u16 flags;
+	u64 timestamp;
 };
 
 static LIST_HEAD(state_list);
@@ -81,6 +88,9 @@ static spinlock_t state_lock;
 
 static struct workqueue_struct *iommu_wq;
 
+static atomic64_t fault_lat_hist[FAULT_LAT_BUCKETS];
+static struct dentry *iommu_v2_debugfs;
+
 static void free_pasid_states(struct device_state *dev_state);
 
 static u16 device_id(struct pci_dev *pdev)
@@ -467,6 +477,28 @@ static bool access_error(struct vm_area_struct *vma, struct fault *fault)
 	return (requested & ~vma->vm_flags) != 0;
 }
 
+static void account_fault_latency(struct fault *fault)
+{
+	u64 us = div_u64(local_clock() - fault->timestamp, NSEC_PER_USEC);
+	int bucket = us ? fls64(us) : 0;
+
+	atomic64_inc(&fault_lat_hist[min(bucket, FAULT_LAT_BUCKETS - 1)]);
+}
+
+static int fault_latency_show(struct seq_file *m, void *unused)
+{
+	int i;
+
+	for (i = 0; i < FAULT_LAT_BUCKETS - 1; i++)
+		seq_printf(m, "<%8lluus %lld\n", 1ULL << i,
+			   atomic64_read(&fault_lat_hist[i]));
+	seq_printf(m, ">=%7lluus %lld\n", 1ULL << (i - 1),
+		   atomic64_read(&fault_lat_hist[i]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fault_latency);
+
 static void do_fault(struct work_struct *work)
 {
 	struct fault *fault = container_of(work, struct fault, work);
@@ -505,6 +537,8 @@ out:
 
 	finish_pri_tag(fault->dev_state, fault->state, fault->tag);
 
+	account_fault_latency(fault);
+
 	put_pasid_state(fault->state);
 
 	kfree(fault);
@@ -573,9 +607,14 @@ static int ppr_notifier(struct notifier_block *nb, unsigned long e, void *data)
 	fault->finish    = finish;
 	fault->pasid     = iommu_fault->pasid;
 	fault->flags     = iommu_fault->flags;
+	fault->timestamp = iommu_fault->timestamp;
 	INIT_WORK(&fault->work, do_fault);
 
-	queue_work(iommu_wq, &fault->work);
+	/*
+	 * Resolve faults in parallel on the node of the faulting device
+	 * rather than on the CPU running the PPR log handler.
+	 */
+	queue_work_node(dev_to_node(&pdev->dev), iommu_wq, &fault->work);
 
 	ret = NOTIFY_OK;
 
@@ -934,12 +973,18 @@ static int __init amd_iommu_v2_init(void)
 	spin_lock_init(&state_lock);
 
 	ret = -ENOMEM;
-	iommu_wq = alloc_workqueue("amd_iommu_v2", WQ_MEM_RECLAIM, 0);
+	iommu_wq = alloc_workqueue("amd_iommu_v2", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
 	if (iommu_wq == NULL)
 		goto out;
 
 	amd_iommu_register_ppr_notifier(&ppr_nb);
 
+#ifdef CONFIG_IOMMU_DEBUGFS
+	iommu_v2_debugfs = debugfs_create_dir("amd_iommu_v2", iommu_debugfs_dir);
+	debugfs_create_file("fault_latency", 0444, iommu_v2_debugfs, NULL,
+			    &fault_latency_fops);
+#endif
+
 	return 0;
 
 out:
@@ -954,6 +999,8 @@ static void __exit amd_iommu_v2_exit(void)
 	if (!amd_iommu_v2_supported())
 		return;
 
+	debugfs_remove_recursive(iommu_v2_debugfs);
+
 	amd_iommu_unregister_ppr_notifier(&ppr_nb);
 
 	flush_workqueue(iommu_wq);
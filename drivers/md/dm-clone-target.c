@@ -2146,6 +2146,26 @@ static void disable_hydration(struct clone *clone)
 	clear_bit(DM_CLONE_HYDRATION_ENABLED, &clone->flags);
 }
 
+/*
+ * Report the statistics of the kcopyd client doing the hydration:
+ *
+ * <jobs> <sub jobs> <read sectors> <write sectors> <offload sectors> <busy ns>
+ */
+static int clone_kcopyd_stats(struct clone *clone, char *result,
+			      unsigned int maxlen)
+{
+	struct dm_kcopyd_stats stats;
+	unsigned int sz = 0;
+
+	dm_kcopyd_client_stats(clone->kcopyd_client, &stats);
+
+	DMEMIT("%llu %llu %llu %llu %llu %llu\n",
+	       stats.jobs, stats.sub_jobs, stats.read_sectors,
+	       stats.write_sectors, stats.offload_sectors, stats.busy_ns);
+
+	return 1;
+}
+
 static int clone_message(struct dm_target *ti, unsigned int argc, char **argv,
 			 char *result, unsigned int maxlen)
 {
@@ -2155,6 +2175,9 @@ static int clone_message(struct dm_target *ti, unsigned int argc, char **argv,
 	if (!argc)
 		return -EINVAL;
 
+	if (!strcasecmp(argv[0], "kcopyd_stats") && argc == 1)
+		return clone_kcopyd_stats(clone, result, maxlen);
+
 	if (!strcasecmp(argv[0], "enable_hydration")) {
 		enable_hydration(clone);
 		return 0;
@@ -2192,7 +2215,7 @@ static int clone_message(struct dm_target *ti, unsigned int argc, char **argv,
 
 static struct target_type clone_target = {
 	.name = "clone",
-	.version = {1, 0, 0},
+	.version = {1, 1, 0},
 	.module = THIS_MODULE,
 	.ctr = clone_ctr,
 	.dtr =  clone_dtr,
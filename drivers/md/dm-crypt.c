@@ -130,7 +130,7 @@ struct iv_elephant_private {
 enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
 	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD,
 	     DM_CRYPT_NO_READ_WORKQUEUE, DM_CRYPT_NO_WRITE_WORKQUEUE,
-	     DM_CRYPT_WRITE_INLINE };
+	     DM_CRYPT_WRITE_INLINE, DM_CRYPT_NO_WRITE_SORT };
 
 enum cipher_flags {
 	CRYPT_MODE_INTEGRITY_AEAD,	/* Use authenticated mode for cihper */
@@ -1822,6 +1822,13 @@ static void kcryptd_io_write(struct dm_crypt_io *io)
 	submit_bio_noacct(clone);
 }
 
+static void kcryptd_io_write_work(struct work_struct *work)
+{
+	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
+
+	kcryptd_io_write(io);
+}
+
 #define crypt_io_from_node(node) rb_entry((node), struct dm_crypt_io, rb_node)
 
 static int dmcrypt_write(void *data)
@@ -1902,6 +1909,21 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 		return;
 	}
 
+	if (test_bit(DM_CRYPT_NO_WRITE_SORT, &cc->flags)) {
+		/*
+		 * Async crypto drivers may complete in interrupt context where
+		 * the clone cannot be submitted, punt it to the io workqueue
+		 * of this CPU instead of the write thread.
+		 */
+		if (async && (in_interrupt() || irqs_disabled())) {
+			INIT_WORK(&io->work, kcryptd_io_write_work);
+			queue_work(cc->io_queue, &io->work);
+			return;
+		}
+		submit_bio_noacct(clone);
+		return;
+	}
+
 	spin_lock_irqsave(&cc->write_thread_lock, flags);
 	if (RB_EMPTY_ROOT(&cc->write_tree))
 		wake_up_process(cc->write_thread);
@@ -2902,7 +2924,7 @@ static int crypt_ctr_optional(struct dm_target *ti, unsigned int argc, char **ar
 	struct crypt_config *cc = ti->private;
 	struct dm_arg_set as;
 	static const struct dm_arg _args[] = {
-		{0, 8, "Invalid number of feature args"},
+		{0, 9, "Invalid number of feature args"},
 	};
 	unsigned int opt_params, val;
 	const char *opt_string, *sval;
@@ -2936,6 +2958,8 @@ static int crypt_ctr_optional(struct dm_target *ti, unsigned int argc, char **ar
 			set_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags);
 		else if (!strcasecmp(opt_string, "no_write_workqueue"))
 			set_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
+		else if (!strcasecmp(opt_string, "no_write_sorting"))
+			set_bit(DM_CRYPT_NO_WRITE_SORT, &cc->flags);
 		else if (sscanf(opt_string, "integrity:%u:", &val) == 1) {
 			if (val == 0 || val > MAX_TAG_SIZE) {
 				ti->error = "Invalid integrity arguments";
@@ -3175,14 +3199,19 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	spin_lock_init(&cc->write_thread_lock);
 	cc->write_tree = RB_ROOT;
 
-	cc->write_thread = kthread_create(dmcrypt_write, cc, "dmcrypt_write/%s", devname);
-	if (IS_ERR(cc->write_thread)) {
-		ret = PTR_ERR(cc->write_thread);
-		cc->write_thread = NULL;
-		ti->error = "Couldn't spawn write thread";
-		goto bad;
+	/* Otherwise writes are submitted by the CPU that encrypted them */
+	if (!test_bit(DM_CRYPT_NO_WRITE_SORT, &cc->flags) &&
+	    !test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags)) {
+		cc->write_thread = kthread_create(dmcrypt_write, cc,
+						  "dmcrypt_write/%s", devname);
+		if (IS_ERR(cc->write_thread)) {
+			ret = PTR_ERR(cc->write_thread);
+			cc->write_thread = NULL;
+			ti->error = "Couldn't spawn write thread";
+			goto bad;
+		}
+		wake_up_process(cc->write_thread);
 	}
-	wake_up_process(cc->write_thread);
 
 	ti->num_flush_bios = 1;
 
@@ -3291,6 +3320,7 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		num_feature_args += test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
 		num_feature_args += test_bit(DM_CRYPT_NO_READ_WORKQUEUE, &cc->flags);
 		num_feature_args += test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags);
+		num_feature_args += test_bit(DM_CRYPT_NO_WRITE_SORT, &cc->flags);
 		num_feature_args += cc->sector_size != (1 << SECTOR_SHIFT);
 		num_feature_args += test_bit(CRYPT_IV_LARGE_SECTORS, &cc->cipher_flags);
 		if (cc->on_disk_tag_size)
@@ -3307,6 +3337,8 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 				DMEMIT(" no_read_workqueue");
 			if (test_bit(DM_CRYPT_NO_WRITE_WORKQUEUE, &cc->flags))
 				DMEMIT(" no_write_workqueue");
+			if (test_bit(DM_CRYPT_NO_WRITE_SORT, &cc->flags))
+				DMEMIT(" no_write_sorting");
 			if (cc->on_disk_tag_size)
 				DMEMIT(" integrity:%u:%s", cc->on_disk_tag_size, cc->cipher_auth);
 			if (cc->sector_size != (1 << SECTOR_SHIFT))
@@ -3419,7 +3451,7 @@ static void crypt_io_hints(struct dm_target *ti, struct queue_limits *limits)
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 22, 0},
+	.version = {1, 23, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
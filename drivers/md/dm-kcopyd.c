@@ -23,6 +23,7 @@
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <linux/device-mapper.h>
 #include <linux/dm-kcopyd.h>
 
@@ -34,11 +35,29 @@
 #define DEFAULT_SUB_JOB_SIZE_KB 512
 #define MAX_SUB_JOB_SIZE_KB     1024
 
+#define DEFAULT_MAX_SUB_JOB_SIZE_KB	4096
+#define MAX_MAX_SUB_JOB_SIZE_KB		16384
+
+#define DEFAULT_IO_WORKERS	4
+#define MAX_IO_WORKERS		16
+
 static unsigned kcopyd_subjob_size_kb = DEFAULT_SUB_JOB_SIZE_KB;
 
 module_param(kcopyd_subjob_size_kb, uint, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(kcopyd_subjob_size_kb, "Sub-job size for dm-kcopyd clients");
 
+static unsigned kcopyd_max_subjob_size_kb = DEFAULT_MAX_SUB_JOB_SIZE_KB;
+
+module_param(kcopyd_max_subjob_size_kb, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(kcopyd_max_subjob_size_kb,
+		 "Largest sub-job size large copies may grow to");
+
+static unsigned kcopyd_io_workers = DEFAULT_IO_WORKERS;
+
+module_param(kcopyd_io_workers, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(kcopyd_io_workers,
+		 "Number of workers issuing I/O for each dm-kcopyd client");
+
 static unsigned dm_get_kcopyd_subjob_size(void)
 {
 	unsigned sub_job_size_kb;
@@ -50,15 +69,47 @@ static unsigned dm_get_kcopyd_subjob_size(void)
 	return sub_job_size_kb << 1;
 }
 
+static unsigned dm_get_kcopyd_max_subjob_size(void)
+{
+	unsigned max_sub_job_size_kb;
+
+	max_sub_job_size_kb = __dm_get_module_param(&kcopyd_max_subjob_size_kb,
+						    DEFAULT_MAX_SUB_JOB_SIZE_KB,
+						    MAX_MAX_SUB_JOB_SIZE_KB);
+
+	return max_sub_job_size_kb << 1;
+}
+
+static unsigned dm_get_kcopyd_io_workers(void)
+{
+	return __dm_get_module_param(&kcopyd_io_workers, DEFAULT_IO_WORKERS,
+				     MAX_IO_WORKERS);
+}
+
+struct kcopyd_io_worker {
+	struct dm_kcopyd_client *kc;
+	struct work_struct work;
+};
+
 /*-----------------------------------------------------------------
  * Each kcopyd client has its own little pool of preallocated
  * pages for kcopyd io.
  *---------------------------------------------------------------*/
 struct dm_kcopyd_client {
+	spinlock_t pages_lock;
 	struct page_list *pages;
 	unsigned nr_reserved_pages;
 	unsigned nr_free_pages;
+
+	/*
+	 * Copies larger than sub_job_size are split into sub jobs of up to
+	 * max_sub_job_size, as far as the reserved pages cover them.  The
+	 * reserve grows with reserved_sub_job_size, under reserve_lock.
+	 */
 	unsigned sub_job_size;
+	unsigned max_sub_job_size;
+	unsigned reserved_sub_job_size;
+	struct mutex reserve_lock;
 
 	struct dm_io_client *io_client;
 
@@ -66,13 +117,34 @@ struct dm_kcopyd_client {
 
 	mempool_t job_pool;
 
+	/*
+	 * kcopyd_work runs all the job lists and is the only one to run
+	 * completions.  The io_workers only run the pages and io jobs, and
+	 * are kicked by kcopyd_work when there are some.  All of them are
+	 * queued on the NUMA node of the last destination copied to.
+	 */
 	struct workqueue_struct *kcopyd_wq;
 	struct work_struct kcopyd_work;
+	struct kcopyd_io_worker *io_workers;
+	unsigned nr_io_workers;
+	int node;
 
 	struct dm_kcopyd_throttle *throttle;
 
+	dm_kcopyd_offload_fn offload_fn;
+	void *offload_context;
+
 	atomic_t nr_jobs;
 
+	/* Statistics, see dm_kcopyd_client_stats() */
+	atomic64_t stat_jobs;
+	atomic64_t stat_sub_jobs;
+	atomic64_t stat_read_sectors;
+	atomic64_t stat_write_sectors;
+	atomic64_t stat_offload_sectors;
+	atomic64_t stat_busy_ns;
+	u64 busy_since;
+
 /*
  * We maintain four lists of jobs:
  *
@@ -205,7 +277,27 @@ skip_limit:
 
 static void wake(struct dm_kcopyd_client *kc)
 {
-	queue_work(kc->kcopyd_wq, &kc->kcopyd_work);
+	queue_work_node(READ_ONCE(kc->node), kc->kcopyd_wq, &kc->kcopyd_work);
+}
+
+/*
+ * Account for a job in nr_jobs, and for the time the client has jobs in
+ * stat_busy_ns.  The busy time is approximate when jobs start and finish
+ * concurrently.
+ */
+static void kcopyd_get_job(struct dm_kcopyd_client *kc)
+{
+	if (atomic_inc_return(&kc->nr_jobs) == 1)
+		WRITE_ONCE(kc->busy_since, ktime_get_ns());
+}
+
+static void kcopyd_put_job(struct dm_kcopyd_client *kc)
+{
+	if (atomic_dec_and_test(&kc->nr_jobs)) {
+		atomic64_add(ktime_get_ns() - READ_ONCE(kc->busy_since),
+			     &kc->stat_busy_ns);
+		wake_up(&kc->destroyq);
+	}
 }
 
 /*
@@ -242,6 +334,7 @@ static void kcopyd_put_pages(struct dm_kcopyd_client *kc, struct page_list *pl)
 {
 	struct page_list *next;
 
+	spin_lock(&kc->pages_lock);
 	do {
 		next = pl->next;
 
@@ -255,6 +348,7 @@ static void kcopyd_put_pages(struct dm_kcopyd_client *kc, struct page_list *pl)
 
 		pl = next;
 	} while (pl);
+	spin_unlock(&kc->pages_lock);
 }
 
 static int kcopyd_get_pages(struct dm_kcopyd_client *kc,
@@ -268,11 +362,15 @@ static int kcopyd_get_pages(struct dm_kcopyd_client *kc,
 		pl = alloc_pl(__GFP_NOWARN | __GFP_NORETRY | __GFP_KSWAPD_RECLAIM);
 		if (unlikely(!pl)) {
 			/* Use reserved pages */
+			spin_lock(&kc->pages_lock);
 			pl = kc->pages;
+			if (likely(pl)) {
+				kc->pages = pl->next;
+				kc->nr_free_pages--;
+			}
+			spin_unlock(&kc->pages_lock);
 			if (unlikely(!pl))
 				goto out_of_memory;
-			kc->pages = pl->next;
-			kc->nr_free_pages--;
 		}
 		pl->next = *pages;
 		*pages = pl;
@@ -325,6 +423,47 @@ static int client_reserve_pages(struct dm_kcopyd_client *kc, unsigned nr_pages)
 	return 0;
 }
 
+/*
+ * Grow the reserve so that a sub job of sub_job_size sectors can always make
+ * progress.  Called from the I/O path, so this only tries opportunistically
+ * and returns the sub job size the reserve covers afterwards.
+ */
+static unsigned client_grow_reserve(struct dm_kcopyd_client *kc,
+				    unsigned sub_job_size)
+{
+	struct page_list *pl = NULL, *next;
+	unsigned nr_pages, i;
+
+	mutex_lock(&kc->reserve_lock);
+
+	if (kc->reserved_sub_job_size >= sub_job_size)
+		goto out;
+
+	nr_pages = DIV_ROUND_UP(sub_job_size << SECTOR_SHIFT, PAGE_SIZE) -
+		   DIV_ROUND_UP(kc->reserved_sub_job_size << SECTOR_SHIFT, PAGE_SIZE);
+	for (i = 0; i < nr_pages; i++) {
+		next = alloc_pl(GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN);
+		if (!next) {
+			if (pl)
+				drop_pages(pl);
+			goto out;
+		}
+		next->next = pl;
+		pl = next;
+	}
+
+	spin_lock(&kc->pages_lock);
+	kc->nr_reserved_pages += nr_pages;
+	spin_unlock(&kc->pages_lock);
+	if (pl)
+		kcopyd_put_pages(kc, pl);
+
+	WRITE_ONCE(kc->reserved_sub_job_size, sub_job_size);
+out:
+	mutex_unlock(&kc->reserve_lock);
+	return READ_ONCE(kc->reserved_sub_job_size);
+}
+
 static void client_free_pages(struct dm_kcopyd_client *kc)
 {
 	BUG_ON(kc->nr_free_pages != kc->nr_reserved_pages);
@@ -378,6 +517,7 @@ struct kcopyd_job {
 	atomic_t sub_jobs;
 	sector_t progress;
 	sector_t write_offset;
+	unsigned sub_job_size;
 
 	struct kcopyd_job *master_job;
 };
@@ -409,13 +549,16 @@ void dm_kcopyd_exit(void)
  * list.
  */
 static struct kcopyd_job *pop_io_job(struct list_head *jobs,
-				     struct dm_kcopyd_client *kc)
+				     struct dm_kcopyd_client *kc,
+				     bool parallel)
 {
 	struct kcopyd_job *job;
 
 	/*
 	 * For I/O jobs, pop any read, any write without sequential write
 	 * constraint and sequential writes that are at the right position.
+	 * Sequential writes are left to kcopyd_work, the io_workers could
+	 * issue them out of order.
 	 */
 	list_for_each_entry(job, jobs, list) {
 		if (job->rw == READ || !test_bit(DM_KCOPYD_WRITE_SEQ, &job->flags)) {
@@ -423,7 +566,8 @@ static struct kcopyd_job *pop_io_job(struct list_head *jobs,
 			return job;
 		}
 
-		if (job->write_offset == job->master_job->write_offset) {
+		if (!parallel &&
+		    job->write_offset == job->master_job->write_offset) {
 			job->master_job->write_offset += job->source.count;
 			list_del(&job->list);
 			return job;
@@ -434,7 +578,7 @@ static struct kcopyd_job *pop_io_job(struct list_head *jobs,
 }
 
 static struct kcopyd_job *pop(struct list_head *jobs,
-			      struct dm_kcopyd_client *kc)
+			      struct dm_kcopyd_client *kc, bool parallel)
 {
 	struct kcopyd_job *job = NULL;
 	unsigned long flags;
@@ -443,7 +587,7 @@ static struct kcopyd_job *pop(struct list_head *jobs,
 
 	if (!list_empty(jobs)) {
 		if (jobs == &kc->io_jobs)
-			job = pop_io_job(jobs, kc);
+			job = pop_io_job(jobs, kc, parallel);
 		else {
 			job = list_entry(jobs->next, struct kcopyd_job, list);
 			list_del(&job->list);
@@ -504,8 +648,7 @@ static int run_complete_job(struct kcopyd_job *job)
 	}
 	fn(read_err, write_err, context);
 
-	if (atomic_dec_and_test(&kc->nr_jobs))
-		wake_up(&kc->destroyq);
+	kcopyd_put_job(kc);
 
 	cond_resched();
 
@@ -519,6 +662,12 @@ static void complete_io(unsigned long error, void *context)
 
 	io_job_finish(kc->throttle);
 
+	if (job->rw == READ)
+		atomic64_add(job->source.count, &kc->stat_read_sectors);
+	else
+		atomic64_add((u64)job->dests[0].count * job->num_dests,
+			     &kc->stat_write_sectors);
+
 	if (error) {
 		if (op_is_write(job->rw))
 			job->write_err |= error;
@@ -605,12 +754,12 @@ static int run_pages_job(struct kcopyd_job *job)
  * of successful jobs.
  */
 static int process_jobs(struct list_head *jobs, struct dm_kcopyd_client *kc,
-			int (*fn) (struct kcopyd_job *))
+			int (*fn) (struct kcopyd_job *), bool parallel)
 {
 	struct kcopyd_job *job;
 	int r, count = 0;
 
-	while ((job = pop(jobs, kc))) {
+	while ((job = pop(jobs, kc, parallel))) {
 
 		r = fn(job);
 
@@ -640,6 +789,18 @@ static int process_jobs(struct list_head *jobs, struct dm_kcopyd_client *kc,
 	return count;
 }
 
+static void kick_io_workers(struct dm_kcopyd_client *kc)
+{
+	int node = READ_ONCE(kc->node);
+	unsigned i;
+
+	if (list_empty(&kc->pages_jobs) && list_empty(&kc->io_jobs))
+		return;
+
+	for (i = 0; i < kc->nr_io_workers; i++)
+		queue_work_node(node, kc->kcopyd_wq, &kc->io_workers[i].work);
+}
+
 /*
  * kcopyd does this every time it's woken up.
  */
@@ -662,9 +823,27 @@ static void do_work(struct work_struct *work)
 	spin_unlock_irqrestore(&kc->job_lock, flags);
 
 	blk_start_plug(&plug);
-	process_jobs(&kc->complete_jobs, kc, run_complete_job);
-	process_jobs(&kc->pages_jobs, kc, run_pages_job);
-	process_jobs(&kc->io_jobs, kc, run_io_job);
+	process_jobs(&kc->complete_jobs, kc, run_complete_job, false);
+	kick_io_workers(kc);
+	process_jobs(&kc->pages_jobs, kc, run_pages_job, false);
+	process_jobs(&kc->io_jobs, kc, run_io_job, false);
+	blk_finish_plug(&plug);
+}
+
+/*
+ * The io_workers take pages and io jobs in parallel with kcopyd_work, so
+ * that the sub jobs of large copies are issued from several CPUs.
+ */
+static void do_io_work(struct work_struct *work)
+{
+	struct kcopyd_io_worker *w = container_of(work, struct kcopyd_io_worker,
+						  work);
+	struct dm_kcopyd_client *kc = w->kc;
+	struct blk_plug plug;
+
+	blk_start_plug(&plug);
+	process_jobs(&kc->pages_jobs, kc, run_pages_job, true);
+	process_jobs(&kc->io_jobs, kc, run_io_job, true);
 	blk_finish_plug(&plug);
 }
 
@@ -676,7 +855,7 @@ static void do_work(struct work_struct *work)
 static void dispatch_job(struct kcopyd_job *job)
 {
 	struct dm_kcopyd_client *kc = job->kc;
-	atomic_inc(&kc->nr_jobs);
+	kcopyd_get_job(kc);
 	if (unlikely(!job->source.count))
 		push(&kc->callback_jobs, job);
 	else if (job->pages == &zero_page_list)
@@ -714,8 +893,8 @@ static void segment_complete(int read_err, unsigned long write_err,
 		progress = job->progress;
 		count = job->source.count - progress;
 		if (count) {
-			if (count > kc->sub_job_size)
-				count = kc->sub_job_size;
+			if (count > job->sub_job_size)
+				count = job->sub_job_size;
 
 			job->progress += count;
 		}
@@ -737,6 +916,7 @@ static void segment_complete(int read_err, unsigned long write_err,
 
 		sub_job->fn = segment_complete;
 		sub_job->context = sub_job;
+		atomic64_inc(&kc->stat_sub_jobs);
 		dispatch_job(sub_job);
 
 	} else if (atomic_dec_and_test(&job->sub_jobs)) {
@@ -762,7 +942,7 @@ static void split_job(struct kcopyd_job *master_job)
 {
 	int i;
 
-	atomic_inc(&master_job->kc->nr_jobs);
+	kcopyd_get_job(master_job->kc);
 
 	atomic_set(&master_job->sub_jobs, SPLIT_COUNT);
 	for (i = 0; i < SPLIT_COUNT; i++) {
@@ -771,6 +951,47 @@ static void split_job(struct kcopyd_job *master_job)
 	}
 }
 
+/*
+ * Sub job size for a copy of count sectors: large enough that the SPLIT_COUNT
+ * sub jobs in flight cover the copy, within max_sub_job_size and the reserve.
+ */
+static unsigned kcopyd_sub_job_size(struct dm_kcopyd_client *kc,
+				    sector_t count)
+{
+	unsigned size = kc->sub_job_size;
+
+	while (size < kc->max_sub_job_size && (sector_t)size * SPLIT_COUNT < count)
+		size = min(size << 1, kc->max_sub_job_size);
+
+	if (size > READ_ONCE(kc->reserved_sub_job_size))
+		size = client_grow_reserve(kc, size);
+
+	return size;
+}
+
+/*
+ * Hand a copy to the client's offload hook.  Returns true if it took the
+ * copy, which then completes through dm_kcopyd_do_callback().
+ */
+static bool kcopyd_offload(struct kcopyd_job *job)
+{
+	struct dm_kcopyd_client *kc = job->kc;
+	dm_kcopyd_offload_fn offload_fn = READ_ONCE(kc->offload_fn);
+
+	if (!offload_fn || test_bit(DM_KCOPYD_WRITE_SEQ, &job->flags))
+		return false;
+
+	kcopyd_get_job(kc);
+	if (offload_fn(kc->offload_context, &job->source, job->num_dests,
+		       job->dests, job)) {
+		atomic_dec(&kc->nr_jobs);
+		return false;
+	}
+
+	atomic64_add(job->source.count, &kc->stat_offload_sectors);
+	return true;
+}
+
 void dm_kcopyd_copy(struct dm_kcopyd_client *kc, struct dm_io_region *from,
 		    unsigned int num_dests, struct dm_io_region *dests,
 		    unsigned int flags, dm_kcopyd_notify_fn fn, void *context)
@@ -842,10 +1063,17 @@ void dm_kcopyd_copy(struct dm_kcopyd_client *kc, struct dm_io_region *from,
 	job->master_job = job;
 	job->write_offset = 0;
 
+	WRITE_ONCE(kc->node, dests[0].bdev->bd_disk->node_id);
+	atomic64_inc(&kc->stat_jobs);
+
+	if (from && kcopyd_offload(job))
+		return;
+
 	if (job->source.count <= kc->sub_job_size)
 		dispatch_job(job);
 	else {
 		job->progress = 0;
+		job->sub_job_size = kcopyd_sub_job_size(kc, job->source.count);
 		split_job(job);
 	}
 }
@@ -872,7 +1100,7 @@ void *dm_kcopyd_prepare_callback(struct dm_kcopyd_client *kc,
 	job->context = context;
 	job->master_job = job;
 
-	atomic_inc(&kc->nr_jobs);
+	kcopyd_get_job(kc);
 
 	return job;
 }
@@ -891,6 +1119,28 @@ void dm_kcopyd_do_callback(void *j, int read_err, unsigned long write_err)
 }
 EXPORT_SYMBOL(dm_kcopyd_do_callback);
 
+void dm_kcopyd_set_offload(struct dm_kcopyd_client *kc,
+			   dm_kcopyd_offload_fn fn, void *context)
+{
+	kc->offload_context = context;
+	WRITE_ONCE(kc->offload_fn, fn);
+}
+EXPORT_SYMBOL(dm_kcopyd_set_offload);
+
+void dm_kcopyd_client_stats(struct dm_kcopyd_client *kc,
+			    struct dm_kcopyd_stats *stats)
+{
+	stats->jobs = atomic64_read(&kc->stat_jobs);
+	stats->sub_jobs = atomic64_read(&kc->stat_sub_jobs);
+	stats->read_sectors = atomic64_read(&kc->stat_read_sectors);
+	stats->write_sectors = atomic64_read(&kc->stat_write_sectors);
+	stats->offload_sectors = atomic64_read(&kc->stat_offload_sectors);
+	stats->busy_ns = atomic64_read(&kc->stat_busy_ns);
+	if (atomic_read(&kc->nr_jobs))
+		stats->busy_ns += ktime_get_ns() - READ_ONCE(kc->busy_since);
+}
+EXPORT_SYMBOL(dm_kcopyd_client_stats);
+
 /*
  * Cancels a kcopyd job, eg. someone might be deactivating a
  * mirror.
@@ -909,13 +1159,15 @@ int kcopyd_cancel(struct kcopyd_job *job, int block)
 struct dm_kcopyd_client *dm_kcopyd_client_create(struct dm_kcopyd_throttle *throttle)
 {
 	int r;
-	unsigned reserve_pages;
+	unsigned reserve_pages, i;
 	struct dm_kcopyd_client *kc;
 
 	kc = kzalloc(sizeof(*kc), GFP_KERNEL);
 	if (!kc)
 		return ERR_PTR(-ENOMEM);
 
+	spin_lock_init(&kc->pages_lock);
+	mutex_init(&kc->reserve_lock);
 	spin_lock_init(&kc->job_lock);
 	INIT_LIST_HEAD(&kc->callback_jobs);
 	INIT_LIST_HEAD(&kc->complete_jobs);
@@ -928,13 +1180,32 @@ struct dm_kcopyd_client *dm_kcopyd_client_create(struct dm_kcopyd_throttle *thro
 		goto bad_slab;
 
 	INIT_WORK(&kc->kcopyd_work, do_work);
-	kc->kcopyd_wq = alloc_workqueue("kcopyd", WQ_MEM_RECLAIM, 0);
+	kc->kcopyd_wq = alloc_workqueue("kcopyd", WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
 	if (!kc->kcopyd_wq) {
 		r = -ENOMEM;
 		goto bad_workqueue;
 	}
+	kc->node = NUMA_NO_NODE;
+
+	/* kcopyd_work issues I/O too, so it counts as one of the workers */
+	kc->nr_io_workers = dm_get_kcopyd_io_workers() - 1;
+	if (kc->nr_io_workers) {
+		kc->io_workers = kcalloc(kc->nr_io_workers,
+					 sizeof(*kc->io_workers), GFP_KERNEL);
+		if (!kc->io_workers) {
+			r = -ENOMEM;
+			goto bad_io_workers;
+		}
+		for (i = 0; i < kc->nr_io_workers; i++) {
+			kc->io_workers[i].kc = kc;
+			INIT_WORK(&kc->io_workers[i].work, do_io_work);
+		}
+	}
 
 	kc->sub_job_size = dm_get_kcopyd_subjob_size();
+	kc->max_sub_job_size = max(dm_get_kcopyd_max_subjob_size(),
+				   kc->sub_job_size);
+	kc->reserved_sub_job_size = kc->sub_job_size;
 	reserve_pages = DIV_ROUND_UP(kc->sub_job_size << SECTOR_SHIFT, PAGE_SIZE);
 
 	kc->pages = NULL;
@@ -957,6 +1228,8 @@ struct dm_kcopyd_client *dm_kcopyd_client_create(struct dm_kcopyd_throttle *thro
 bad_io_client:
 	client_free_pages(kc);
 bad_client_pages:
+	kfree(kc->io_workers);
+bad_io_workers:
 	destroy_workqueue(kc->kcopyd_wq);
 bad_workqueue:
 	mempool_exit(&kc->job_pool);
@@ -977,9 +1250,11 @@ void dm_kcopyd_client_destroy(struct dm_kcopyd_client *kc)
 	BUG_ON(!list_empty(&kc->io_jobs));
 	BUG_ON(!list_empty(&kc->pages_jobs));
 	destroy_workqueue(kc->kcopyd_wq);
+	kfree(kc->io_workers);
 	dm_io_client_destroy(kc->io_client);
 	client_free_pages(kc);
 	mempool_exit(&kc->job_pool);
+	mutex_destroy(&kc->reserve_lock);
 	kfree(kc);
 }
 EXPORT_SYMBOL(dm_kcopyd_client_destroy);
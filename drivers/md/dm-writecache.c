@@ -10,6 +10,7 @@
 #include <linux/init.h>
 #include <linux/vmalloc.h>
 #include <linux/kthread.h>
+#include <linux/list_sort.h>
 #include <linux/dm-io.h>
 #include <linux/dm-kcopyd.h>
 #include <linux/dax.h>
@@ -28,6 +29,7 @@
 #define AUTOCOMMIT_MSEC			1000
 #define MAX_AGE_DIV			16
 #define MAX_AGE_UNSPECIFIED		-1UL
+#define WC_SEQ_STREAMS			8
 
 #define BITMAP_GRANULARITY	65536
 #if BITMAP_GRANULARITY < PAGE_SIZE
@@ -106,6 +108,12 @@ struct wc_entry {
 #endif
 #define WC_MODE_SORT_FREELIST(wc)		(!WC_MODE_PMEM(wc))
 
+struct wc_seq_stream {
+	sector_t end;
+	sector_t size;
+	unsigned long last;
+};
+
 struct dm_writecache {
 	struct mutex lock;
 	struct list_head lru;
@@ -123,6 +131,7 @@ struct dm_writecache {
 	size_t freelist_high_watermark;
 	size_t freelist_low_watermark;
 	unsigned long max_age;
+	sector_t sequential_cutoff;
 
 	unsigned uncommitted_blocks;
 	unsigned autocommit_blocks;
@@ -167,6 +176,7 @@ struct dm_writecache {
 	bool writeback_fua_set:1;
 	bool flush_on_suspend:1;
 	bool cleaner:1;
+	bool origin_dirty:1;
 
 	unsigned writeback_all;
 	struct workqueue_struct *writeback_wq;
@@ -182,6 +192,8 @@ struct dm_writecache {
 	struct task_struct *flush_thread;
 	struct bio_list flush_list;
 
+	struct wc_seq_stream seq_streams[WC_SEQ_STREAMS];
+
 	struct dm_kcopyd_client *dm_kcopyd;
 	unsigned long *dirty_bitmap;
 	unsigned dirty_bitmap_size;
@@ -1246,10 +1258,19 @@ static int writecache_flush_thread(void *data)
 			bio_set_dev(bio, wc->dev->bdev);
 			submit_bio_noacct(bio);
 		} else {
+			bool flush_origin;
+
 			writecache_flush(wc);
+			flush_origin = wc->origin_dirty;
+			wc->origin_dirty = false;
 			wc_unlock(wc);
-			if (writecache_has_error(wc))
+			if (writecache_has_error(wc)) {
 				bio->bi_status = BLK_STS_IOERR;
+			} else if (flush_origin) {
+				bio_set_dev(bio, wc->dev->bdev);
+				submit_bio_noacct(bio);
+				continue;
+			}
 			bio_endio(bio);
 		}
 	}
@@ -1264,6 +1285,31 @@ static void writecache_offload_bio(struct dm_writecache *wc, struct bio *bio)
 	bio_list_add(&wc->flush_list, bio);
 }
 
+/*
+ * Track the most recent write streams.  Returns true if @bio continues one
+ * that has reached sequential_cutoff and should go straight to the origin.
+ */
+static bool writecache_bio_is_streaming(struct dm_writecache *wc, struct bio *bio)
+{
+	struct wc_seq_stream *s, *oldest = wc->seq_streams;
+	int i;
+
+	for (i = 0; i < WC_SEQ_STREAMS; i++) {
+		s = &wc->seq_streams[i];
+		if (s->end == bio->bi_iter.bi_sector)
+			goto found;
+		if (time_before(s->last, oldest->last))
+			oldest = s;
+	}
+	s = oldest;
+	s->size = 0;
+found:
+	s->size += bio_sectors(bio);
+	s->end = bio_end_sector(bio);
+	s->last = jiffies;
+	return s->size >= wc->sequential_cutoff;
+}
+
 static int writecache_map(struct dm_target *ti, struct bio *bio)
 {
 	struct wc_entry *e;
@@ -1280,6 +1326,10 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 			writecache_flush(wc);
 			if (writecache_has_error(wc))
 				goto unlock_error;
+			if (wc->origin_dirty) {
+				wc->origin_dirty = false;
+				goto unlock_remap_origin;
+			}
 			goto unlock_submit;
 		} else {
 			writecache_offload_bio(wc, bio);
@@ -1337,6 +1387,9 @@ read_next_block:
 			goto unlock_remap_origin;
 		}
 	} else {
+		bool bypass = wc->sequential_cutoff &&
+			      writecache_bio_is_streaming(wc, bio);
+
 		do {
 			bool found_entry = false;
 			if (writecache_has_error(wc))
@@ -1351,7 +1404,7 @@ read_next_block:
 				}
 				found_entry = true;
 			} else {
-				if (unlikely(wc->cleaner))
+				if (unlikely(wc->cleaner) || bypass)
 					goto direct_write;
 			}
 			e = writecache_pop_from_freelist(wc, (sector_t)-1);
@@ -1366,6 +1419,7 @@ direct_write:
 							dm_accept_partial_bio(bio, next_boundary);
 						}
 					}
+					wc->origin_dirty = true;
 					goto unlock_remap_origin;
 				}
 				writecache_wait_on_freelist(wc);
@@ -1748,6 +1802,16 @@ static void __writecache_writeback_ssd(struct dm_writecache *wc, struct writebac
 	}
 }
 
+static int writecache_writeback_cmp(void *data, struct list_head *a,
+				    struct list_head *b)
+{
+	struct dm_writecache *wc = data;
+	struct wc_entry *ea = container_of(a, struct wc_entry, lru);
+	struct wc_entry *eb = container_of(b, struct wc_entry, lru);
+
+	return read_original_sector(wc, ea) < read_original_sector(wc, eb);
+}
+
 static void writecache_writeback(struct work_struct *work)
 {
 	struct dm_writecache *wc = container_of(work, struct dm_writecache, writeback_work);
@@ -1883,6 +1947,13 @@ restart:
 
 	wc_unlock(wc);
 
+	/*
+	 * The entries were picked in LRU order, write them back in the order of
+	 * the origin so that adjacent runs are merged and rotating disks seek
+	 * less.  The submit functions take entries from the tail.
+	 */
+	list_sort(wc, &wbl.list, writecache_writeback_cmp);
+
 	blk_start_plug(&plug);
 
 	if (WC_MODE_PMEM(wc))
@@ -2031,7 +2102,7 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	struct wc_memory_superblock s;
 
 	static struct dm_arg _args[] = {
-		{0, 10, "Invalid number of feature args"},
+		{0, 12, "Invalid number of feature args"},
 	};
 
 	as.argc = argc;
@@ -2239,6 +2310,14 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 			if (max_age_msecs > 86400000)
 				goto invalid_optional;
 			wc->max_age = msecs_to_jiffies(max_age_msecs);
+		} else if (!strcasecmp(string, "sequential_cutoff") && opt_params >= 1) {
+			unsigned long long cutoff_bytes;
+			string = dm_shift_arg(&as), opt_params--;
+			if (sscanf(string, "%llu%c", &cutoff_bytes, &dummy) != 1)
+				goto invalid_optional;
+			wc->sequential_cutoff = cutoff_bytes >> SECTOR_SHIFT;
+			if (wc->sequential_cutoff != cutoff_bytes >> SECTOR_SHIFT)
+				goto invalid_optional;
 		} else if (!strcasecmp(string, "cleaner")) {
 			wc->cleaner = true;
 		} else if (!strcasecmp(string, "fua")) {
@@ -2468,6 +2547,8 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 			extra_args += 2;
 		if (wc->autocommit_time_set)
 			extra_args += 2;
+		if (wc->sequential_cutoff)
+			extra_args += 2;
 		if (wc->cleaner)
 			extra_args++;
 		if (wc->writeback_fua_set)
@@ -2496,6 +2577,9 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 			DMEMIT(" autocommit_time %u", jiffies_to_msecs(wc->autocommit_jiffies));
 		if (wc->max_age != MAX_AGE_UNSPECIFIED)
 			DMEMIT(" max_age %u", jiffies_to_msecs(wc->max_age));
+		if (wc->sequential_cutoff)
+			DMEMIT(" sequential_cutoff %llu",
+			       (unsigned long long)wc->sequential_cutoff << SECTOR_SHIFT);
 		if (wc->cleaner)
 			DMEMIT(" cleaner");
 		if (wc->writeback_fua_set)
@@ -2506,7 +2590,7 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 
 static struct target_type writecache_target = {
 	.name			= "writecache",
-	.version		= {1, 3, 0},
+	.version		= {1, 4, 0},
 	.module			= THIS_MODULE,
 	.ctr			= writecache_ctr,
 	.dtr			= writecache_dtr,
@@ -428,6 +428,26 @@ static inline void insert_hash(struct r5conf *conf, struct stripe_head *sh)
 	hlist_add_head(&sh->hash, hp);
 }
 
+/*
+ * Number of idle stripes looked at for one on the local node before settling
+ * for the least recently used one.
+ */
+#define STRIPE_NODE_SCAN	16
+
+static struct list_head *find_node_stripe(struct list_head *list)
+{
+	int node = numa_node_id(), scan = STRIPE_NODE_SCAN;
+	struct stripe_head *sh;
+
+	list_for_each_entry(sh, list, lru) {
+		if (sh->numa_node == node)
+			return &sh->lru;
+		if (!--scan)
+			break;
+	}
+	return list->next;
+}
+
 /* find an idle stripe, make sure it is unhashed, and return it. */
 static struct stripe_head *get_free_stripe(struct r5conf *conf, int hash)
 {
@@ -436,7 +456,10 @@ static struct stripe_head *get_free_stripe(struct r5conf *conf, int hash)
 
 	if (list_empty(conf->inactive_list + hash))
 		goto out;
-	first = (conf->inactive_list + hash)->next;
+	if (num_node_state(N_MEMORY) > 1)
+		first = find_node_stripe(conf->inactive_list + hash);
+	else
+		first = (conf->inactive_list + hash)->next;
 	sh = list_entry(first, struct stripe_head, lru);
 	list_del_init(first);
 	remove_hash(sh);
@@ -472,7 +495,7 @@ static int grow_buffers(struct stripe_head *sh, gfp_t gfp)
 	for (i = 0; i < num; i++) {
 		struct page *page;
 
-		if (!(page = alloc_page(gfp))) {
+		if (!(page = alloc_pages_node(sh->numa_node, gfp, 0))) {
 			return 1;
 		}
 		sh->dev[i].page = page;
@@ -686,6 +709,8 @@ raid5_get_active_stripe(struct r5conf *conf, sector_t sector,
 					sh->group->stripes_cnt--;
 					sh->group = NULL;
 				}
+				/* handle it on the node of the new user */
+				sh->cpu = smp_processor_id();
 			}
 			atomic_inc(&sh->count);
 			spin_unlock(&conf->device_lock);
@@ -2148,12 +2173,12 @@ static void free_stripe(struct kmem_cache *sc, struct stripe_head *sh)
 }
 
 static struct stripe_head *alloc_stripe(struct kmem_cache *sc, gfp_t gfp,
-	int disks, struct r5conf *conf)
+	int disks, struct r5conf *conf, int node)
 {
 	struct stripe_head *sh;
 	int i;
 
-	sh = kmem_cache_zalloc(sc, gfp);
+	sh = kmem_cache_alloc_node(sc, gfp | __GFP_ZERO, node);
 	if (sh) {
 		spin_lock_init(&sh->stripe_lock);
 		spin_lock_init(&sh->batch_lock);
@@ -2163,6 +2188,7 @@ static struct stripe_head *alloc_stripe(struct kmem_cache *sc, gfp_t gfp,
 		INIT_LIST_HEAD(&sh->log_list);
 		atomic_set(&sh->count, 1);
 		sh->raid_conf = conf;
+		sh->numa_node = node;
 		sh->log_start = MaxSector;
 		for (i = 0; i < disks; i++) {
 			struct r5dev *dev = &sh->dev[i];
@@ -2172,7 +2198,7 @@ static struct stripe_head *alloc_stripe(struct kmem_cache *sc, gfp_t gfp,
 		}
 
 		if (raid5_has_ppl(conf)) {
-			sh->ppl_page = alloc_page(gfp);
+			sh->ppl_page = alloc_pages_node(node, gfp, 0);
 			if (!sh->ppl_page) {
 				free_stripe(sc, sh);
 				sh = NULL;
@@ -2181,11 +2207,29 @@ static struct stripe_head *alloc_stripe(struct kmem_cache *sc, gfp_t gfp,
 	}
 	return sh;
 }
+
+/*
+ * Spread the stripe cache over the nodes with memory so that every hash list
+ * has stripes local to each node for get_free_stripe() to pick from.
+ */
+static int stripe_alloc_node(struct r5conf *conf)
+{
+	int nr = conf->max_nr_stripes / NR_STRIPE_HASH_LOCKS;
+	int node;
+
+	nr %= num_node_state(N_MEMORY);
+	for_each_node_state(node, N_MEMORY)
+		if (!nr--)
+			return node;
+	return NUMA_NO_NODE;
+}
+
 static int grow_one_stripe(struct r5conf *conf, gfp_t gfp)
 {
 	struct stripe_head *sh;
 
-	sh = alloc_stripe(conf->slab_cache, gfp, conf->pool_size, conf);
+	sh = alloc_stripe(conf->slab_cache, gfp, conf->pool_size, conf,
+			  stripe_alloc_node(conf));
 	if (!sh)
 		return 0;
 
@@ -2354,7 +2398,7 @@ static int resize_stripes(struct r5conf *conf, int newsize)
 	mutex_lock(&conf->cache_size_mutex);
 
 	for (i = conf->max_nr_stripes; i; i--) {
-		nsh = alloc_stripe(sc, GFP_KERNEL, newsize, conf);
+		nsh = alloc_stripe(sc, GFP_KERNEL, newsize, conf, NUMA_NO_NODE);
 		if (!nsh)
 			break;
 
@@ -2391,6 +2435,7 @@ static int resize_stripes(struct r5conf *conf, int newsize)
 			nsh->dev[i].orig_page = osh->dev[i].page;
 		}
 		nsh->hash_lock_index = hash;
+		nsh->numa_node = osh->numa_node;
 		free_stripe(conf->slab_cache, osh);
 		cnt++;
 		if (cnt >= conf->max_nr_stripes / NR_STRIPE_HASH_LOCKS +
@@ -2441,7 +2486,8 @@ static int resize_stripes(struct r5conf *conf, int newsize)
 
 		for (i=conf->raid_disks; i < newsize; i++)
 			if (nsh->dev[i].page == NULL) {
-				struct page *p = alloc_page(GFP_NOIO);
+				struct page *p = alloc_pages_node(nsh->numa_node,
+								 GFP_NOIO, 0);
 				nsh->dev[i].page = p;
 				nsh->dev[i].orig_page = p;
 				if (!p)
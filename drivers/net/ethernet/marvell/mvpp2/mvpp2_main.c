@@ -1655,6 +1655,9 @@ static void mvpp2_ethtool_get_strings(struct net_device *netdev, u32 sset,
 			ETH_GSTRING_LEN);
 		data += ETH_GSTRING_LEN;
 	}
+
+	if (port->priv->percpu_pools)
+		page_pool_ethtool_stats_get_strings(data);
 }
 
 static void
@@ -1780,6 +1783,27 @@ static void mvpp2_gather_hw_statistics(struct work_struct *work)
 	mutex_unlock(&port->gather_stats_lock);
 }
 
+/* The page pools are shared by all the ports of a controller, so the
+ * stats reported are those of the whole controller.
+ */
+static void mvpp2_get_page_pool_stats(struct mvpp2_port *port, u64 *data)
+{
+#ifdef CONFIG_PAGE_POOL_STATS
+	struct page_pool_stats stats = {};
+	struct mvpp2 *priv = port->priv;
+	int i;
+
+	if (!priv->percpu_pools)
+		return;
+
+	for (i = 0; i < mvpp2_get_nrxqs(priv) * 2; i++)
+		if (priv->page_pool[i])
+			page_pool_get_stats(priv->page_pool[i], &stats);
+
+	page_pool_ethtool_stats_get(data, &stats);
+#endif
+}
+
 static void mvpp2_ethtool_get_stats(struct net_device *dev,
 				    struct ethtool_stats *stats, u64 *data)
 {
@@ -1794,14 +1818,23 @@ static void mvpp2_ethtool_get_stats(struct net_device *dev,
 	memcpy(data, port->ethtool_stats,
 	       sizeof(u64) * MVPP2_N_ETHTOOL_STATS(port->ntxqs, port->nrxqs));
 	mutex_unlock(&port->gather_stats_lock);
+
+	mvpp2_get_page_pool_stats(port,
+				  data + MVPP2_N_ETHTOOL_STATS(port->ntxqs,
+							       port->nrxqs));
 }
 
 static int mvpp2_ethtool_get_sset_count(struct net_device *dev, int sset)
 {
 	struct mvpp2_port *port = netdev_priv(dev);
 
-	if (sset == ETH_SS_STATS)
-		return MVPP2_N_ETHTOOL_STATS(port->ntxqs, port->nrxqs);
+	if (sset == ETH_SS_STATS) {
+		int count = MVPP2_N_ETHTOOL_STATS(port->ntxqs, port->nrxqs);
+
+		if (port->priv->percpu_pools)
+			count += page_pool_ethtool_stats_get_count();
+		return count;
+	}
 
 	return -EOPNOTSUPP;
 }
@@ -19,8 +19,10 @@
 #include <linux/average.h>
 #include <linux/filter.h>
 #include <linux/kernel.h>
+#include <linux/mem_encrypt.h>
 #include <net/route.h>
 #include <net/xdp.h>
+#include <net/page_pool.h>
 #include <net/net_failover.h>
 
 static int napi_weight = NAPI_POLL_WEIGHT;
@@ -40,6 +42,9 @@ module_param(napi_tx, bool, 0644);
 /* Amount of XDP headroom to prepend to packets for use by xdp_adjust_head */
 #define VIRTIO_XDP_HEADROOM 256
 
+/* Used buffers reclaimed per virtqueue_get_buf_batch() call */
+#define VIRTNET_GET_BUF_BATCH	16
+
 /* Separating two types of XDP xmit */
 #define VIRTIO_XDP_TX		BIT(0)
 #define VIRTIO_XDP_REDIR	BIT(1)
@@ -150,6 +155,9 @@ struct receive_queue {
 	/* Page frag for packet buffer allocation. */
 	struct page_frag alloc_frag;
 
+	/* Page pool mergeable buffers are carved from, if any. */
+	struct page_pool *page_pool;
+
 	/* RX: fragments + linear part + virtio header */
 	struct scatterlist sg[MAX_SKB_FRAGS + 2];
 
@@ -366,6 +374,30 @@ static unsigned int mergeable_ctx_to_truesize(void *mrg_ctx)
 	return (unsigned long)mrg_ctx & ((1 << MRG_CTX_HEADER_SHIFT) - 1);
 }
 
+/* Return the page of a receive buffer that is not handed on, dropping
+ * its fragment if it comes from the page pool of the queue.
+ */
+static void virtnet_put_page(struct receive_queue *rq, struct page *page)
+{
+	if (rq->page_pool)
+		page_pool_put_full_page(rq->page_pool, page, true);
+	else
+		put_page(page);
+}
+
+/* The stack releases skb frags with put_page(), so a buffer of the page
+ * pool attached to an skb trades its fragment for a page reference.  The
+ * page leaves the pool when its last fragment is returned while skbs
+ * still hold it, and is recycled otherwise.
+ */
+static void virtnet_page_to_stack(struct receive_queue *rq, struct page *page)
+{
+	if (rq->page_pool) {
+		get_page(page);
+		page_pool_put_full_page(rq->page_pool, page, true);
+	}
+}
+
 /* Called from bottom half context */
 static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 				   struct receive_queue *rq,
@@ -415,10 +447,12 @@ static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 	offset += copy;
 
 	if (vi->mergeable_rx_bufs) {
-		if (len)
+		if (len) {
+			virtnet_page_to_stack(rq, page);
 			skb_add_rx_frag(skb, 0, page, offset, len, truesize);
-		else
-			put_page(page);
+		} else {
+			virtnet_put_page(rq, page);
+		}
 		return skb;
 	}
 
@@ -584,8 +618,18 @@ static struct page *xdp_linearize_page(struct receive_queue *rq,
 				       int page_off,
 				       unsigned int *len)
 {
-	struct page *page = alloc_page(GFP_ATOMIC);
+	struct page *page;
 
+	/* All pages of a queue with a page pool come from the pool, so
+	 * that XDP frames can always be returned to it.
+	 */
+	if (rq->page_pool) {
+		page = page_pool_dev_alloc_pages(rq->page_pool);
+		if (page)
+			page_pool_fragment_page(page, 1);
+	} else {
+		page = alloc_page(GFP_ATOMIC);
+	}
 	if (!page)
 		return NULL;
 
@@ -609,21 +653,21 @@ static struct page *xdp_linearize_page(struct receive_queue *rq,
 		 * is sending packet larger than the MTU.
 		 */
 		if ((page_off + buflen + tailroom) > PAGE_SIZE) {
-			put_page(p);
+			virtnet_put_page(rq, p);
 			goto err_buf;
 		}
 
 		memcpy(page_address(page) + page_off,
 		       page_address(p) + off, buflen);
 		page_off += buflen;
-		put_page(p);
+		virtnet_put_page(rq, p);
 	}
 
 	/* Headroom does not contribute to packet length */
 	*len = page_off - VIRTIO_XDP_HEADROOM;
 	return page;
 err_buf:
-	__free_pages(page, 0);
+	virtnet_put_page(rq, page);
 	return NULL;
 }
 
@@ -883,10 +927,12 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			/* We can only create skb based on xdp_page. */
 			if (unlikely(xdp_page != page)) {
 				rcu_read_unlock();
-				put_page(page);
+				virtnet_put_page(rq, page);
 				head_skb = page_to_skb(vi, rq, xdp_page, offset,
 						       len, PAGE_SIZE, false,
 						       metasize);
+				if (unlikely(!head_skb))
+					virtnet_put_page(rq, xdp_page);
 				return head_skb;
 			}
 			break;
@@ -899,12 +945,12 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			if (unlikely(err < 0)) {
 				trace_xdp_exception(vi->dev, xdp_prog, act);
 				if (unlikely(xdp_page != page))
-					put_page(xdp_page);
+					virtnet_put_page(rq, xdp_page);
 				goto err_xdp;
 			}
 			*xdp_xmit |= VIRTIO_XDP_TX;
 			if (unlikely(xdp_page != page))
-				put_page(page);
+				virtnet_put_page(rq, page);
 			rcu_read_unlock();
 			goto xdp_xmit;
 		case XDP_REDIRECT:
@@ -912,12 +958,12 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			err = xdp_do_redirect(dev, &xdp, xdp_prog);
 			if (err) {
 				if (unlikely(xdp_page != page))
-					put_page(xdp_page);
+					virtnet_put_page(rq, xdp_page);
 				goto err_xdp;
 			}
 			*xdp_xmit |= VIRTIO_XDP_REDIR;
 			if (unlikely(xdp_page != page))
-				put_page(page);
+				virtnet_put_page(rq, page);
 			rcu_read_unlock();
 			goto xdp_xmit;
 		default:
@@ -928,7 +974,7 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			/* fall through */
 		case XDP_DROP:
 			if (unlikely(xdp_page != page))
-				__free_pages(xdp_page, 0);
+				virtnet_put_page(rq, xdp_page);
 			goto err_xdp;
 		}
 	}
@@ -992,10 +1038,11 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 		}
 		offset = buf - page_address(page);
 		if (skb_can_coalesce(curr_skb, num_skb_frags, page, offset)) {
-			put_page(page);
+			virtnet_put_page(rq, page);
 			skb_coalesce_rx_frag(curr_skb, num_skb_frags - 1,
 					     len, truesize);
 		} else {
+			virtnet_page_to_stack(rq, page);
 			skb_add_rx_frag(curr_skb, num_skb_frags, page,
 					offset, len, truesize);
 		}
@@ -1008,7 +1055,7 @@ err_xdp:
 	rcu_read_unlock();
 	stats->xdp_drops++;
 err_skb:
-	put_page(page);
+	virtnet_put_page(rq, page);
 	while (num_buf-- > 1) {
 		buf = virtqueue_get_buf(rq->vq, &len);
 		if (unlikely(!buf)) {
@@ -1019,7 +1066,7 @@ err_skb:
 		}
 		stats->bytes += len;
 		page = virt_to_head_page(buf);
-		put_page(page);
+		virtnet_put_page(rq, page);
 	}
 err_buf:
 	stats->drops++;
@@ -1041,7 +1088,7 @@ static void receive_buf(struct virtnet_info *vi, struct receive_queue *rq,
 		pr_debug("%s: short packet %i\n", dev->name, len);
 		dev->stats.rx_length_errors++;
 		if (vi->mergeable_rx_bufs) {
-			put_page(virt_to_head_page(buf));
+			virtnet_put_page(rq, virt_to_head_page(buf));
 		} else if (vi->big_packets) {
 			give_pages(rq, buf);
 		} else {
@@ -1200,6 +1247,18 @@ static int add_recvbuf_mergeable(struct virtnet_info *vi,
 	 * disabled GSO for XDP, it won't be a big issue.
 	 */
 	len = get_mergeable_buf_len(rq, &rq->mrg_avg_pkt_len, room);
+	if (rq->page_pool) {
+		unsigned int offset;
+		struct page *page;
+
+		page = page_pool_alloc_frag(rq->page_pool, &offset,
+					    len + room, gfp);
+		if (unlikely(!page))
+			return -ENOMEM;
+		buf = (char *)page_address(page) + offset + headroom;
+		goto add;
+	}
+
 	if (unlikely(!skb_page_frag_refill(len + room, alloc_frag, gfp)))
 		return -ENOMEM;
 
@@ -1217,11 +1276,12 @@ static int add_recvbuf_mergeable(struct virtnet_info *vi,
 		alloc_frag->offset += hole;
 	}
 
+add:
 	sg_init_one(rq->sg, buf, len);
 	ctx = mergeable_len_to_ctx(len, headroom);
 	err = virtqueue_add_inbuf_ctx(rq->vq, rq->sg, 1, buf, ctx, gfp);
 	if (err < 0)
-		put_page(virt_to_head_page(buf));
+		virtnet_put_page(rq, virt_to_head_page(buf));
 
 	return err;
 }
@@ -1338,19 +1398,32 @@ static int virtnet_receive(struct receive_queue *rq, int budget,
 	void *buf;
 	int i;
 
-	if (!vi->big_packets || vi->mergeable_rx_bufs) {
+	if (vi->mergeable_rx_bufs) {
 		void *ctx;
 
+		/* receive_mergeable() gets the rest of a packet's buffers */
 		while (stats.packets < budget &&
 		       (buf = virtqueue_get_buf_ctx(rq->vq, &len, &ctx))) {
 			receive_buf(vi, rq, buf, len, ctx, xdp_xmit, &stats);
 			stats.packets++;
 		}
 	} else {
-		while (stats.packets < budget &&
-		       (buf = virtqueue_get_buf(rq->vq, &len)) != NULL) {
-			receive_buf(vi, rq, buf, len, NULL, xdp_xmit, &stats);
-			stats.packets++;
+		void *bufs[VIRTNET_GET_BUF_BATCH], *ctxs[VIRTNET_GET_BUF_BATCH];
+		unsigned int lens[VIRTNET_GET_BUF_BATCH], n;
+		/* Only small buffers carry a context */
+		void **ctxp = vi->big_packets ? NULL : ctxs;
+
+		while (stats.packets < budget) {
+			n = virtqueue_get_buf_batch(rq->vq, bufs, lens, ctxp,
+						    min_t(u64, budget - stats.packets,
+							  VIRTNET_GET_BUF_BATCH));
+			if (!n)
+				break;
+			for (i = 0; i < n; i++)
+				receive_buf(vi, rq, bufs[i], lens[i],
+					    ctxp ? ctxs[i] : NULL, xdp_xmit,
+					    &stats);
+			stats.packets += n;
 		}
 	}
 
@@ -1374,26 +1447,31 @@ static int virtnet_receive(struct receive_queue *rq, int budget,
 
 static void free_old_xmit_skbs(struct send_queue *sq, bool in_napi)
 {
-	unsigned int len;
+	void *bufs[VIRTNET_GET_BUF_BATCH];
 	unsigned int packets = 0;
 	unsigned int bytes = 0;
+	unsigned int i, n;
 	void *ptr;
 
-	while ((ptr = virtqueue_get_buf(sq->vq, &len)) != NULL) {
-		if (likely(!is_xdp_frame(ptr))) {
-			struct sk_buff *skb = ptr;
+	while ((n = virtqueue_get_buf_batch(sq->vq, bufs, NULL, NULL,
+					    VIRTNET_GET_BUF_BATCH))) {
+		for (i = 0; i < n; i++) {
+			ptr = bufs[i];
+			if (likely(!is_xdp_frame(ptr))) {
+				struct sk_buff *skb = ptr;
 
-			pr_debug("Sent skb %p\n", skb);
+				pr_debug("Sent skb %p\n", skb);
 
-			bytes += skb->len;
-			napi_consume_skb(skb, in_napi);
-		} else {
-			struct xdp_frame *frame = ptr_to_xdp(ptr);
+				bytes += skb->len;
+				napi_consume_skb(skb, in_napi);
+			} else {
+				struct xdp_frame *frame = ptr_to_xdp(ptr);
 
-			bytes += frame->len;
-			xdp_return_frame(frame);
+				bytes += frame->len;
+				xdp_return_frame(frame);
+			}
 		}
-		packets++;
+		packets += n;
 	}
 
 	/* Avoid overhead when no packets have been processed
@@ -1469,6 +1547,30 @@ static int virtnet_poll(struct napi_struct *napi, int budget)
 	return received;
 }
 
+/* XDP frames of a queue with a page pool are returned to the pool */
+static int virtnet_xdp_rxq_reg(struct virtnet_info *vi, int qp)
+{
+	struct receive_queue *rq = &vi->rq[qp];
+	int err;
+
+	err = xdp_rxq_info_reg(&rq->xdp_rxq, vi->dev, qp);
+	if (err < 0)
+		return err;
+	rq->xdp_rxq.napi_id = rq->napi.napi_id;
+
+	if (rq->page_pool)
+		err = xdp_rxq_info_reg_mem_model(&rq->xdp_rxq,
+						 MEM_TYPE_PAGE_POOL,
+						 rq->page_pool);
+	else
+		err = xdp_rxq_info_reg_mem_model(&rq->xdp_rxq,
+						 MEM_TYPE_PAGE_SHARED, NULL);
+	if (err < 0)
+		xdp_rxq_info_unreg(&rq->xdp_rxq);
+
+	return err;
+}
+
 static int virtnet_open(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -1480,17 +1582,10 @@ static int virtnet_open(struct net_device *dev)
 			if (!try_fill_recv(vi, &vi->rq[i], GFP_KERNEL))
 				schedule_delayed_work(&vi->refill, 0);
 
-		err = xdp_rxq_info_reg(&vi->rq[i].xdp_rxq, dev, i);
+		err = virtnet_xdp_rxq_reg(vi, i);
 		if (err < 0)
 			return err;
 
-		err = xdp_rxq_info_reg_mem_model(&vi->rq[i].xdp_rxq,
-						 MEM_TYPE_PAGE_SHARED, NULL);
-		if (err < 0) {
-			xdp_rxq_info_unreg(&vi->rq[i].xdp_rxq);
-			return err;
-		}
-
 		virtnet_napi_enable(vi->rq[i].vq, &vi->rq[i].napi);
 		virtnet_napi_tx_enable(vi, vi->sq[i].vq, &vi->sq[i].napi);
 	}
@@ -2307,6 +2402,8 @@ static void virtnet_freeze_down(struct virtio_device *vdev)
 
 	if (netif_running(vi->dev)) {
 		for (i = 0; i < vi->max_queue_pairs; i++) {
+			/* The page pool goes away with the queues */
+			xdp_rxq_info_unreg(&vi->rq[i].xdp_rxq);
 			napi_disable(&vi->rq[i].napi);
 			virtnet_napi_tx_disable(&vi->sq[i].napi);
 		}
@@ -2332,6 +2429,10 @@ static int virtnet_restore_up(struct virtio_device *vdev)
 				schedule_delayed_work(&vi->refill, 0);
 
 		for (i = 0; i < vi->max_queue_pairs; i++) {
+			err = virtnet_xdp_rxq_reg(vi, i);
+			if (err < 0)
+				return err;
+
 			virtnet_napi_enable(vi->rq[i].vq, &vi->rq[i].napi);
 			virtnet_napi_tx_enable(vi, vi->sq[i].vq,
 					       &vi->sq[i].napi);
@@ -2645,9 +2746,12 @@ static void free_receive_bufs(struct virtnet_info *vi)
 static void free_receive_page_frags(struct virtnet_info *vi)
 {
 	int i;
-	for (i = 0; i < vi->max_queue_pairs; i++)
+	for (i = 0; i < vi->max_queue_pairs; i++) {
 		if (vi->rq[i].alloc_frag.page)
 			put_page(vi->rq[i].alloc_frag.page);
+		page_pool_destroy(vi->rq[i].page_pool);
+		vi->rq[i].page_pool = NULL;
+	}
 }
 
 static void free_unused_bufs(struct virtnet_info *vi)
@@ -2670,7 +2774,8 @@ static void free_unused_bufs(struct virtnet_info *vi)
 
 		while ((buf = virtqueue_detach_unused_buf(vq)) != NULL) {
 			if (vi->mergeable_rx_bufs) {
-				put_page(virt_to_head_page(buf));
+				virtnet_put_page(&vi->rq[i],
+						 virt_to_head_page(buf));
 			} else if (vi->big_packets) {
 				give_pages(&vi->rq[i], buf);
 			} else {
@@ -2831,6 +2936,36 @@ err_ctrl:
 	return -ENOMEM;
 }
 
+/* Mergeable buffers are carved from a page pool per receive queue, which
+ * recycles the pages of dropped packets.  Queues fall back to page frags
+ * if the pool cannot be created.  With memory encryption the pool takes
+ * its pages from the shared DMA pool, so received data is not bounced.
+ */
+static void virtnet_create_page_pools(struct virtnet_info *vi)
+{
+	struct page_pool_params pp_params = {
+		.flags		= PP_FLAG_PAGE_FRAG,
+		.order		= 0,
+		.nid		= dev_to_node(&vi->vdev->dev),
+	};
+	struct receive_queue *rq;
+	int i;
+
+	if (!vi->mergeable_rx_bufs)
+		return;
+
+	if (mem_encrypt_active())
+		pp_params.flags |= PP_FLAG_DMA_SHARED;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		rq = &vi->rq[i];
+		pp_params.pool_size = virtqueue_get_vring_size(rq->vq);
+		rq->page_pool = page_pool_create(&pp_params);
+		if (IS_ERR(rq->page_pool))
+			rq->page_pool = NULL;
+	}
+}
+
 static int init_vqs(struct virtnet_info *vi)
 {
 	int ret;
@@ -2844,6 +2979,8 @@ static int init_vqs(struct virtnet_info *vi)
 	if (ret)
 		goto err_free;
 
+	virtnet_create_page_pools(vi);
+
 	get_online_cpus();
 	virtnet_set_affinity(vi);
 	put_online_cpus();
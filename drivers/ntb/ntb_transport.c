@@ -53,9 +53,11 @@
 #include <linux/dma-mapping.h>
 #include <linux/errno.h>
 #include <linux/export.h>
+#include <linux/hrtimer.h>
 #include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/types.h>
 #include <linux/uaccess.h>
@@ -93,6 +95,14 @@ static bool use_dma;
 module_param(use_dma, bool, 0644);
 MODULE_PARM_DESC(use_dma, "Use DMA engine to perform large data copy");
 
+static unsigned int db_coalesce_pkts = 1;
+module_param(db_coalesce_pkts, uint, 0644);
+MODULE_PARM_DESC(db_coalesce_pkts, "Ring the peer doorbell once per this many TX packets, 1 to ring it for every packet");
+
+static unsigned int db_coalesce_usecs = 20;
+module_param(db_coalesce_usecs, uint, 0644);
+MODULE_PARM_DESC(db_coalesce_usecs, "Maximum delay of a coalesced doorbell in usecs");
+
 static bool use_msi;
 #ifdef CONFIG_NTB_MSI
 module_param(use_msi, bool, 0644);
@@ -194,6 +204,13 @@ struct ntb_transport_qp {
 	u64 tx_err_no_buf;
 	u64 tx_memcpy;
 	u64 tx_async;
+	u64 tx_db;
+	u64 rx_db;
+	u64 stats_start_ns;
+
+	/* TX packets the peer has not been signalled for yet */
+	atomic_t tx_db_pending;
+	struct hrtimer tx_db_timer;
 
 	bool use_msi;
 	int msi_irq;
@@ -274,6 +291,7 @@ enum {
 #define NTB_LINK_DOWN_TIMEOUT	10
 
 static void ntb_transport_rxc_db(unsigned long data);
+static enum hrtimer_restart ntb_tx_db_timer(struct hrtimer *timer);
 static const struct ntb_ctx_ops ntb_transport_ops;
 static struct ntb_client ntb_transport_client;
 static int ntb_async_tx_submit(struct ntb_transport_qp *qp,
@@ -462,6 +480,35 @@ void ntb_transport_unregister_client(struct ntb_transport_client *drv)
 }
 EXPORT_SYMBOL_GPL(ntb_transport_unregister_client);
 
+static void ntb_qp_stats_reset(struct ntb_transport_qp *qp)
+{
+	qp->rx_bytes = 0;
+	qp->rx_pkts = 0;
+	qp->rx_ring_empty = 0;
+	qp->rx_err_no_buf = 0;
+	qp->rx_err_oflow = 0;
+	qp->rx_err_ver = 0;
+	qp->rx_memcpy = 0;
+	qp->rx_async = 0;
+	qp->tx_bytes = 0;
+	qp->tx_pkts = 0;
+	qp->tx_ring_full = 0;
+	qp->tx_err_no_buf = 0;
+	qp->tx_memcpy = 0;
+	qp->tx_async = 0;
+	qp->tx_db = 0;
+	qp->rx_db = 0;
+	qp->stats_start_ns = ktime_get_ns();
+}
+
+/* Average throughput in MB/s since the stats were last reset */
+static u64 ntb_qp_rate(struct ntb_transport_qp *qp, u64 bytes)
+{
+	u64 us = div_u64(ktime_get_ns() - qp->stats_start_ns, NSEC_PER_USEC);
+
+	return us ? div64_u64(bytes, us) : 0;
+}
+
 static ssize_t debugfs_read(struct file *filp, char __user *ubuf, size_t count,
 			    loff_t *offp)
 {
@@ -474,7 +521,7 @@ static ssize_t debugfs_read(struct file *filp, char __user *ubuf, size_t count,
 	if (!qp || !qp->link_is_up)
 		return 0;
 
-	out_count = 1000;
+	out_count = 1500;
 
 	buf = kmalloc(out_count, GFP_KERNEL);
 	if (!buf)
@@ -532,6 +579,22 @@ static ssize_t debugfs_read(struct file *filp, char __user *ubuf, size_t count,
 	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
 			       "free tx - \t%u\n",
 			       ntb_transport_tx_free_entry(qp));
+	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
+			       "tx_db - \t%llu\n", qp->tx_db);
+	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
+			       "tx_pkts/db - \t%llu\n",
+			       qp->tx_db ? div64_u64(qp->tx_pkts, qp->tx_db) : 0);
+	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
+			       "rx_db - \t%llu\n", qp->rx_db);
+	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
+			       "tx MB/s - \t%llu\n",
+			       ntb_qp_rate(qp, qp->tx_bytes));
+	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
+			       "rx MB/s - \t%llu\n",
+			       ntb_qp_rate(qp, qp->rx_bytes));
+	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
+			       "MW - \t\t%u\n",
+			       QP_TO_MW(qp->transport, qp->qp_num));
 
 	out_offset += scnprintf(buf + out_offset, out_count - out_offset,
 			       "\n");
@@ -555,12 +618,59 @@ static ssize_t debugfs_read(struct file *filp, char __user *ubuf, size_t count,
 	return ret;
 }
 
+/* Writing to the stats file resets the counters */
+static ssize_t debugfs_write(struct file *filp, const char __user *ubuf,
+			     size_t count, loff_t *offp)
+{
+	struct ntb_transport_qp *qp = filp->private_data;
+
+	if (!qp)
+		return -ENODEV;
+
+	ntb_qp_stats_reset(qp);
+
+	return count;
+}
+
 static const struct file_operations ntb_qp_debugfs_stats = {
 	.owner = THIS_MODULE,
 	.open = simple_open,
 	.read = debugfs_read,
+	.write = debugfs_write,
 };
 
+static int ntb_transport_stats_show(struct seq_file *s, void *v)
+{
+	struct ntb_transport_ctx *nt = s->private;
+	u64 tx_total = 0, rx_total = 0;
+	unsigned int i;
+
+	seq_printf(s, "%-4s %-4s %-4s %10s %10s %12s %12s\n", "qp", "mw",
+		   "dma", "tx MB/s", "rx MB/s", "tx pkts/db", "rx db");
+
+	for (i = 0; i < nt->qp_count; i++) {
+		struct ntb_transport_qp *qp = &nt->qp_vec[i];
+		u64 tx = ntb_qp_rate(qp, qp->tx_bytes);
+		u64 rx = ntb_qp_rate(qp, qp->rx_bytes);
+
+		if (!qp->link_is_up)
+			continue;
+
+		seq_printf(s, "%-4u %-4u %-4s %10llu %10llu %12llu %12llu\n",
+			   qp->qp_num, QP_TO_MW(nt, qp->qp_num),
+			   qp->tx_dma_chan ? "yes" : "no", tx, rx,
+			   qp->tx_db ? div64_u64(qp->tx_pkts, qp->tx_db) : 0,
+			   qp->rx_db);
+		tx_total += tx;
+		rx_total += rx;
+	}
+
+	seq_printf(s, "%-14s %10llu %10llu\n", "total", tx_total, rx_total);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ntb_transport_stats);
+
 static void ntb_list_add(spinlock_t *lock, struct list_head *entry,
 			 struct list_head *list)
 {
@@ -686,6 +796,7 @@ static irqreturn_t ntb_transport_isr(int irq, void *dev)
 {
 	struct ntb_transport_qp *qp = dev;
 
+	qp->rx_db++;
 	tasklet_schedule(&qp->rxc_db_work);
 
 	return IRQ_HANDLED;
@@ -918,20 +1029,8 @@ static void ntb_qp_link_down_reset(struct ntb_transport_qp *qp)
 
 	qp->tx_index = 0;
 	qp->rx_index = 0;
-	qp->rx_bytes = 0;
-	qp->rx_pkts = 0;
-	qp->rx_ring_empty = 0;
-	qp->rx_err_no_buf = 0;
-	qp->rx_err_oflow = 0;
-	qp->rx_err_ver = 0;
-	qp->rx_memcpy = 0;
-	qp->rx_async = 0;
-	qp->tx_bytes = 0;
-	qp->tx_pkts = 0;
-	qp->tx_ring_full = 0;
-	qp->tx_err_no_buf = 0;
-	qp->tx_memcpy = 0;
-	qp->tx_async = 0;
+	atomic_set(&qp->tx_db_pending, 0);
+	ntb_qp_stats_reset(qp);
 }
 
 static void ntb_qp_link_cleanup(struct ntb_transport_qp *qp)
@@ -1215,7 +1314,8 @@ static int ntb_transport_init_queue(struct ntb_transport_ctx *nt,
 		qp->debugfs_dir = debugfs_create_dir(debugfs_name,
 						     nt->debugfs_node_dir);
 
-		qp->debugfs_stats = debugfs_create_file("stats", S_IRUSR,
+		qp->debugfs_stats = debugfs_create_file("stats",
+							S_IRUSR | S_IWUSR,
 							qp->debugfs_dir, qp,
 							&ntb_qp_debugfs_stats);
 	} else {
@@ -1237,6 +1337,11 @@ static int ntb_transport_init_queue(struct ntb_transport_ctx *nt,
 	tasklet_init(&qp->rxc_db_work, ntb_transport_rxc_db,
 		     (unsigned long)qp);
 
+	atomic_set(&qp->tx_db_pending, 0);
+	hrtimer_init(&qp->tx_db_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	qp->tx_db_timer.function = ntb_tx_db_timer;
+	qp->stats_start_ns = ktime_get_ns();
+
 	return 0;
 }
 
@@ -1359,6 +1464,8 @@ static int ntb_transport_probe(struct ntb_client *self, struct ntb_dev *ndev)
 		nt->debugfs_node_dir =
 			debugfs_create_dir(pci_name(ndev->pdev),
 					   nt_debugfs_dir);
+		debugfs_create_file("stats", 0400, nt->debugfs_node_dir, nt,
+				    &ntb_transport_stats_fops);
 	}
 
 	for (i = 0; i < qp_count; i++) {
@@ -1420,6 +1527,7 @@ static void ntb_transport_free(struct ntb_client *self, struct ntb_dev *ndev)
 			ntb_transport_free_queue(qp);
 		debugfs_remove_recursive(qp->debugfs_dir);
 	}
+	debugfs_remove_recursive(nt->debugfs_node_dir);
 
 	ntb_link_disable(ndev);
 	ntb_clear_ctx(ndev);
@@ -1724,6 +1832,57 @@ static void ntb_transport_rxc_db(unsigned long data)
 	}
 }
 
+static void ntb_qp_ring_peer(struct ntb_transport_qp *qp)
+{
+	qp->tx_db++;
+
+	if (qp->use_msi)
+		ntb_msi_peer_trigger(qp->ndev, PIDX, &qp->peer_msi_desc);
+	else
+		ntb_peer_db_set(qp->ndev, BIT_ULL(qp->qp_num));
+}
+
+static enum hrtimer_restart ntb_tx_db_timer(struct hrtimer *timer)
+{
+	struct ntb_transport_qp *qp = container_of(timer,
+						   struct ntb_transport_qp,
+						   tx_db_timer);
+
+	if (atomic_xchg(&qp->tx_db_pending, 0))
+		ntb_qp_ring_peer(qp);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Tell the peer that a packet is ready.  With db_coalesce_pkts > 1 the
+ * doorbell is rung once every db_coalesce_pkts packets, or at the latest
+ * db_coalesce_usecs after the first packet that has not been signalled.
+ * The receiver processes every completed entry per doorbell, so a late
+ * doorbell only delays it.
+ */
+static void ntb_tx_signal(struct ntb_transport_qp *qp, bool now)
+{
+	unsigned int batch = READ_ONCE(db_coalesce_pkts);
+	int pending;
+
+	if (now || batch <= 1) {
+		atomic_set(&qp->tx_db_pending, 0);
+		ntb_qp_ring_peer(qp);
+		return;
+	}
+
+	pending = atomic_inc_return(&qp->tx_db_pending);
+	if (pending >= batch) {
+		if (atomic_xchg(&qp->tx_db_pending, 0))
+			ntb_qp_ring_peer(qp);
+	} else if (pending == 1) {
+		hrtimer_start(&qp->tx_db_timer,
+			      us_to_ktime(READ_ONCE(db_coalesce_usecs)),
+			      HRTIMER_MODE_REL);
+	}
+}
+
 static void ntb_tx_copy_callback(void *data,
 				 const struct dmaengine_result *res)
 {
@@ -1760,10 +1919,7 @@ static void ntb_tx_copy_callback(void *data,
 
 	iowrite32(entry->flags | DESC_DONE_FLAG, &hdr->flags);
 
-	if (qp->use_msi)
-		ntb_msi_peer_trigger(qp->ndev, PIDX, &qp->peer_msi_desc);
-	else
-		ntb_peer_db_set(qp->ndev, BIT_ULL(qp->qp_num));
+	ntb_tx_signal(qp, entry->flags & LINK_DOWN_FLAG);
 
 	/* The entry length can only be zero if the packet is intended to be a
 	 * "link down" or similar.  Since no payload is being sent in these
@@ -2153,6 +2309,8 @@ void ntb_transport_free_queue(struct ntb_transport_qp *qp)
 		dma_release_channel(chan);
 	}
 
+	hrtimer_cancel(&qp->tx_db_timer);
+
 	qp_bit = BIT_ULL(qp->qp_num);
 
 	ntb_db_set_mask(qp->ndev, qp_bit);
@@ -2443,8 +2601,10 @@ static void ntb_transport_doorbell_callback(void *data, int vector)
 		qp_num = __ffs(db_bits);
 		qp = &nt->qp_vec[qp_num];
 
-		if (qp->active)
+		if (qp->active) {
+			qp->rx_db++;
 			tasklet_schedule(&qp->rxc_db_work);
+		}
 
 		db_bits &= ~BIT_ULL(qp_num);
 	}
@@ -24,12 +24,38 @@
 #include <linux/dax.h>
 #include <linux/nd.h>
 #include <linux/backing-dev.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/workqueue.h>
+#include <linux/sizes.h>
 #include <linux/mm.h>
 #include <asm/cacheflush.h>
 #include "pmem.h"
 #include "pfn.h"
 #include "nd.h"
 
+static bool dma_offload;
+module_param(dma_offload, bool, 0444);
+MODULE_PARM_DESC(dma_offload, "offload large writes to a dmaengine memcpy channel");
+
+/* Default minimum size of a write bio to split across workers */
+#define PMEM_SPLIT_MIN_DEFAULT	SZ_1M
+/* Smallest piece a split write is cut into */
+#define PMEM_SPLIT_PIECE_MIN	SZ_128K
+#define PMEM_MAX_WRITE_THREADS	64
+/* Default minimum size of a write (piece) to offload to the DMA channel */
+#define PMEM_DMA_MIN_DEFAULT	SZ_256K
+#define PMEM_DMA_BATCH		16
+
+struct pmem_stats {
+	u64			ios[2];
+	u64			bytes[2];
+	u64			nsecs[2];
+	u64			max_nsecs[2];
+	u64			split_writes;
+	u64			dma_bytes;
+};
+
 static struct device *to_dev(struct pmem_device *pmem)
 {
 	/*
@@ -189,45 +215,330 @@ static blk_status_t pmem_do_write(struct pmem_device *pmem,
 	return rc;
 }
 
-static blk_qc_t pmem_submit_bio(struct bio *bio)
+static blk_status_t pmem_write_cpu(struct pmem_device *pmem, struct bio *bio,
+		struct bvec_iter start)
 {
-	int ret = 0;
-	blk_status_t rc = 0;
-	bool do_acct;
-	unsigned long start;
+	blk_status_t rc = BLK_STS_OK;
 	struct bio_vec bvec;
 	struct bvec_iter iter;
-	struct pmem_device *pmem = bio->bi_disk->private_data;
-	struct nd_region *nd_region = to_region(pmem);
 
-	if (bio->bi_opf & REQ_PREFLUSH)
-		ret = nvdimm_flush(nd_region, bio);
-
-	do_acct = blk_queue_io_stat(bio->bi_disk->queue);
-	if (do_acct)
-		start = bio_start_io_acct(bio);
-	bio_for_each_segment(bvec, bio, iter) {
-		if (op_is_write(bio_op(bio)))
-			rc = pmem_do_write(pmem, bvec.bv_page, bvec.bv_offset,
+	__bio_for_each_segment(bvec, bio, iter, start) {
+		rc = pmem_do_write(pmem, bvec.bv_page, bvec.bv_offset,
 				iter.bi_sector, bvec.bv_len);
-		else
-			rc = pmem_do_read(pmem, bvec.bv_page, bvec.bv_offset,
-				iter.bi_sector, bvec.bv_len);
-		if (rc) {
-			bio->bi_status = rc;
+		if (rc)
 			break;
+	}
+	return rc;
+}
+
+/* Descriptors submitted to the DMA channel and not yet waited for */
+struct pmem_dma_batch {
+	atomic_t		pending;
+	struct completion	done;
+	bool			error;
+	unsigned int		nr;
+	dma_addr_t		src[PMEM_DMA_BATCH];
+	unsigned int		len[PMEM_DMA_BATCH];
+};
+
+static void pmem_dma_done(void *arg, const struct dmaengine_result *result)
+{
+	struct pmem_dma_batch *batch = arg;
+
+	if (result && result->result != DMA_TRANS_NOERROR)
+		WRITE_ONCE(batch->error, true);
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/* Wait for all descriptors of @batch, false if any of them failed */
+static bool pmem_dma_wait(struct pmem_device *pmem,
+		struct pmem_dma_batch *batch)
+{
+	struct device *dev = pmem->dma_chan->device->dev;
+	unsigned int i;
+
+	dma_async_issue_pending(pmem->dma_chan);
+	if (!atomic_dec_and_test(&batch->pending))
+		wait_for_completion(&batch->done);
+
+	for (i = 0; i < batch->nr; i++)
+		dma_unmap_page(dev, batch->src[i], batch->len[i], DMA_TO_DEVICE);
+
+	batch->nr = 0;
+	atomic_set(&batch->pending, 1);
+	reinit_completion(&batch->done);
+
+	return !READ_ONCE(batch->error);
+}
+
+/* Queue a copy of @len bytes to the DMA channel, false if that failed */
+static bool pmem_dma_queue(struct pmem_device *pmem,
+		struct pmem_dma_batch *batch, struct page *page,
+		unsigned int off, phys_addr_t pmem_off, unsigned int len)
+{
+	struct dma_chan *chan = pmem->dma_chan;
+	struct device *dev = chan->device->dev;
+	struct dma_async_tx_descriptor *tx;
+	dma_addr_t src;
+
+	src = dma_map_page(dev, page, off, len, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, src))
+		return false;
+
+	tx = dmaengine_prep_dma_memcpy(chan, pmem->dma_base + pmem_off, src,
+			len, DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!tx)
+		goto unmap;
+
+	tx->callback_result = pmem_dma_done;
+	tx->callback_param = batch;
+	atomic_inc(&batch->pending);
+	if (dma_submit_error(dmaengine_submit(tx))) {
+		atomic_dec(&batch->pending);
+		goto unmap;
+	}
+
+	batch->src[batch->nr] = src;
+	batch->len[batch->nr++] = len;
+	return true;
+
+unmap:
+	dma_unmap_page(dev, src, len, DMA_TO_DEVICE);
+	return false;
+}
+
+/*
+ * Copy with the DMA channel one multi-page bvec at a time.  Ranges with
+ * known bad blocks, and anything the channel refuses, are written by the
+ * CPU.  If the channel reports an error, the whole range is rewritten by
+ * the CPU, the writes are idempotent.
+ */
+static blk_status_t pmem_write_dma(struct pmem_device *pmem, struct bio *bio,
+		struct bvec_iter start)
+{
+	struct pmem_dma_batch batch = { .pending = ATOMIC_INIT(1) };
+	blk_status_t rc = BLK_STS_OK;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	u64 dma_bytes = 0;
+	bool ok = true;
+
+	init_completion(&batch.done);
+
+	__bio_for_each_bvec(bvec, bio, iter, start) {
+		struct page *page = nth_page(bvec.bv_page,
+				bvec.bv_offset >> PAGE_SHIFT);
+		unsigned int off = offset_in_page(bvec.bv_offset);
+		phys_addr_t pmem_off = iter.bi_sector * 512 + pmem->data_offset;
+
+		if (batch.nr == PMEM_DMA_BATCH)
+			ok &= pmem_dma_wait(pmem, &batch);
+
+		if (!is_bad_pmem(&pmem->bb, iter.bi_sector, bvec.bv_len) &&
+		    pmem_dma_queue(pmem, &batch, page, off, pmem_off,
+				   bvec.bv_len)) {
+			dma_bytes += bvec.bv_len;
+			continue;
 		}
+
+		rc = pmem_do_write(pmem, page, off, iter.bi_sector, bvec.bv_len);
+		if (rc)
+			break;
 	}
-	if (do_acct)
-		bio_end_io_acct(bio, start);
+	ok &= pmem_dma_wait(pmem, &batch);
+
+	if (!ok) {
+		dev_warn_ratelimited(to_dev(pmem),
+				"DMA write failed, retrying with the CPU\n");
+		return pmem_write_cpu(pmem, bio, start);
+	}
+
+	this_cpu_add(pmem->stats->dma_bytes, dma_bytes);
+	return rc;
+}
+
+static blk_status_t pmem_write_iter(struct pmem_device *pmem, struct bio *bio,
+		struct bvec_iter start)
+{
+	unsigned int dma_min = READ_ONCE(pmem->write_dma_min);
+
+	if (pmem->dma_chan && dma_min && start.bi_size >= dma_min)
+		return pmem_write_dma(pmem, bio, start);
+	return pmem_write_cpu(pmem, bio, start);
+}
+
+static void pmem_account(struct pmem_device *pmem, int op, unsigned int bytes,
+		u64 nsecs)
+{
+	struct pmem_stats *stats = get_cpu_ptr(pmem->stats);
+
+	stats->ios[op]++;
+	stats->bytes[op] += bytes;
+	stats->nsecs[op] += nsecs;
+	if (nsecs > stats->max_nsecs[op])
+		stats->max_nsecs[op] = nsecs;
+	put_cpu_ptr(pmem->stats);
+}
+
+/* Completion state of a bio, shared by all pieces of a split write */
+struct pmem_bio_ctx {
+	struct pmem_device	*pmem;
+	struct bio		*bio;
+	unsigned long		acct_start;
+	u64			start_ns;
+	bool			do_acct;
+	int			flush_ret;
+};
+
+static void pmem_end_bio(struct pmem_bio_ctx *bc, blk_status_t rc)
+{
+	struct bio *bio = bc->bio;
+	unsigned int bytes = bio->bi_iter.bi_size;
+	int ret = bc->flush_ret;
+
+	if (rc)
+		bio->bi_status = rc;
+	if (bc->do_acct)
+		bio_end_io_acct(bio, bc->acct_start);
 
 	if (bio->bi_opf & REQ_FUA)
-		ret = nvdimm_flush(nd_region, bio);
+		ret = nvdimm_flush(to_region(bc->pmem), bio);
 
 	if (ret)
 		bio->bi_status = errno_to_blk_status(ret);
 
+	pmem_account(bc->pmem, op_is_write(bio_op(bio)), bytes,
+			ktime_get_ns() - bc->start_ns);
 	bio_endio(bio);
+}
+
+struct pmem_write_piece {
+	struct work_struct	work;
+	struct bvec_iter	iter;
+	struct pmem_split_write	*sw;
+};
+
+struct pmem_split_write {
+	struct pmem_bio_ctx	bc;
+	atomic_t		pending;
+	blk_status_t		status;
+	struct pmem_write_piece	piece[];
+};
+
+static void pmem_write_piece(struct pmem_write_piece *piece)
+{
+	struct pmem_split_write *sw = piece->sw;
+	blk_status_t rc;
+
+	rc = pmem_write_iter(sw->bc.pmem, sw->bc.bio, piece->iter);
+	if (rc)
+		WRITE_ONCE(sw->status, rc);
+
+	/* The last piece to finish completes the bio */
+	if (atomic_dec_and_test(&sw->pending)) {
+		pmem_end_bio(&sw->bc, READ_ONCE(sw->status));
+		kfree(sw);
+	}
+}
+
+static void pmem_write_piece_work(struct work_struct *work)
+{
+	pmem_write_piece(container_of(work, struct pmem_write_piece, work));
+}
+
+/*
+ * A single CPU doing memcpy_flushcache() can't saturate the store bandwidth
+ * of a PMEM namespace.  Cut large writes into pieces, hand all but the first
+ * one to workers on the namespace's node and write the first one from the
+ * submitting CPU.  The bio is completed by whichever piece finishes last.
+ * Returns false if the bio should be written synchronously instead.
+ */
+static bool pmem_write_split(struct pmem_bio_ctx *bc)
+{
+	struct pmem_device *pmem = bc->pmem;
+	struct bio *bio = bc->bio;
+	unsigned int threads = READ_ONCE(pmem->write_threads);
+	unsigned int size = bio->bi_iter.bi_size;
+	unsigned int piece_size, nr, i;
+	struct pmem_split_write *sw;
+	struct bvec_iter iter;
+
+	if (threads < 2 || size < READ_ONCE(pmem->write_split_min))
+		return false;
+
+	nr = min(threads, size / PMEM_SPLIT_PIECE_MIN);
+	if (nr < 2)
+		return false;
+	piece_size = round_up(DIV_ROUND_UP(size, nr), PAGE_SIZE);
+	nr = DIV_ROUND_UP(size, piece_size);
+
+	sw = kmalloc(struct_size(sw, piece, nr), GFP_NOWAIT | __GFP_NOWARN);
+	if (!sw)
+		return false;
+
+	sw->bc = *bc;
+	sw->status = BLK_STS_OK;
+	atomic_set(&sw->pending, nr);
+
+	iter = bio->bi_iter;
+	for (i = 0; i < nr; i++) {
+		struct pmem_write_piece *piece = &sw->piece[i];
+
+		piece->sw = sw;
+		piece->iter = iter;
+		piece->iter.bi_size = min(piece_size, iter.bi_size);
+		bio_advance_iter(bio, &iter, piece->iter.bi_size);
+		INIT_WORK(&piece->work, pmem_write_piece_work);
+	}
+
+	this_cpu_inc(pmem->stats->split_writes);
+
+	for (i = 1; i < nr; i++) {
+		if (pmem->node != NUMA_NO_NODE)
+			queue_work_node(pmem->node, pmem->write_wq,
+					&sw->piece[i].work);
+		else
+			queue_work(pmem->write_wq, &sw->piece[i].work);
+	}
+	pmem_write_piece(&sw->piece[0]);
+
+	return true;
+}
+
+static blk_qc_t pmem_submit_bio(struct bio *bio)
+{
+	blk_status_t rc = 0;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	struct pmem_device *pmem = bio->bi_disk->private_data;
+	struct pmem_bio_ctx bc = {
+		.pmem = pmem,
+		.bio = bio,
+		.start_ns = ktime_get_ns(),
+	};
+
+	if (bio->bi_opf & REQ_PREFLUSH)
+		bc.flush_ret = nvdimm_flush(to_region(pmem), bio);
+
+	bc.do_acct = blk_queue_io_stat(bio->bi_disk->queue);
+	if (bc.do_acct)
+		bc.acct_start = bio_start_io_acct(bio);
+
+	if (op_is_write(bio_op(bio))) {
+		if (pmem_write_split(&bc))
+			return BLK_QC_T_NONE;
+		rc = pmem_write_iter(pmem, bio, bio->bi_iter);
+	} else {
+		bio_for_each_segment(bvec, bio, iter) {
+			rc = pmem_do_read(pmem, bvec.bv_page, bvec.bv_offset,
+				iter.bi_sector, bvec.bv_len);
+			if (rc)
+				break;
+		}
+	}
+
+	pmem_end_bio(&bc, rc);
 	return BLK_QC_T_NONE;
 }
 
@@ -328,8 +639,176 @@ static const struct dax_operations pmem_dax_ops = {
 	.zero_page_range = pmem_dax_zero_page_range,
 };
 
+static struct pmem_device *dev_to_pmem(struct device *dev)
+{
+	return dev_to_disk(dev)->private_data;
+}
+
+static ssize_t write_threads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dev_to_pmem(dev)->write_threads);
+}
+
+static ssize_t write_threads_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc)
+		return rc;
+	if (val > PMEM_MAX_WRITE_THREADS)
+		return -EINVAL;
+
+	WRITE_ONCE(dev_to_pmem(dev)->write_threads, val);
+	return len;
+}
+static DEVICE_ATTR_RW(write_threads);
+
+static ssize_t write_split_kb_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dev_to_pmem(dev)->write_split_min / SZ_1K);
+}
+
+static ssize_t write_split_kb_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc)
+		return rc;
+	if (val > UINT_MAX / SZ_1K)
+		return -EINVAL;
+
+	WRITE_ONCE(dev_to_pmem(dev)->write_split_min, val * SZ_1K);
+	return len;
+}
+static DEVICE_ATTR_RW(write_split_kb);
+
+static ssize_t write_dma_kb_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dev_to_pmem(dev)->write_dma_min / SZ_1K);
+}
+
+static ssize_t write_dma_kb_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct pmem_device *pmem = dev_to_pmem(dev);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &val);
+	if (rc)
+		return rc;
+	if (val > UINT_MAX / SZ_1K)
+		return -EINVAL;
+	if (val && !pmem->dma_chan)
+		return -ENODEV;
+
+	WRITE_ONCE(pmem->write_dma_min, val * SZ_1K);
+	return len;
+}
+static DEVICE_ATTR_RW(write_dma_kb);
+
+static ssize_t dma_channel_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct pmem_device *pmem = dev_to_pmem(dev);
+
+	if (!pmem->dma_chan)
+		return sprintf(buf, "none\n");
+	return sprintf(buf, "%s\n", dma_chan_name(pmem->dma_chan));
+}
+static DEVICE_ATTR_RO(dma_channel);
+
+/*
+ * Throughput is averaged over the time since the statistics were last
+ * reset, latency is measured from submission to completion of each bio.
+ */
+static ssize_t stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	static const char * const names[] = { "read", "write" };
+	struct pmem_device *pmem = dev_to_pmem(dev);
+	struct pmem_stats sum = { };
+	u64 elapsed_us;
+	ssize_t rc = 0;
+	int cpu, op;
+
+	for_each_possible_cpu(cpu) {
+		struct pmem_stats *stats = per_cpu_ptr(pmem->stats, cpu);
+
+		for (op = 0; op < 2; op++) {
+			sum.ios[op] += stats->ios[op];
+			sum.bytes[op] += stats->bytes[op];
+			sum.nsecs[op] += stats->nsecs[op];
+			sum.max_nsecs[op] = max(sum.max_nsecs[op],
+						stats->max_nsecs[op]);
+		}
+		sum.split_writes += stats->split_writes;
+		sum.dma_bytes += stats->dma_bytes;
+	}
+
+	elapsed_us = max_t(u64, div_u64(ktime_get_ns() -
+				READ_ONCE(pmem->stats_since), NSEC_PER_USEC), 1);
+
+	for (op = 0; op < 2; op++) {
+		rc += sprintf(buf + rc, "%s_ios %llu\n", names[op], sum.ios[op]);
+		rc += sprintf(buf + rc, "%s_bytes %llu\n", names[op],
+				sum.bytes[op]);
+		rc += sprintf(buf + rc, "%s_mbps %llu\n", names[op],
+				div64_u64(sum.bytes[op], elapsed_us));
+		rc += sprintf(buf + rc, "%s_lat_avg_ns %llu\n", names[op],
+				sum.ios[op] ?
+				div64_u64(sum.nsecs[op], sum.ios[op]) : 0);
+		rc += sprintf(buf + rc, "%s_lat_max_ns %llu\n", names[op],
+				sum.max_nsecs[op]);
+	}
+	rc += sprintf(buf + rc, "split_writes %llu\n", sum.split_writes);
+	rc += sprintf(buf + rc, "dma_bytes %llu\n", sum.dma_bytes);
+
+	return rc;
+}
+
+/* Writing anything resets the statistics */
+static ssize_t stats_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct pmem_device *pmem = dev_to_pmem(dev);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(pmem->stats, cpu), 0,
+				sizeof(struct pmem_stats));
+	WRITE_ONCE(pmem->stats_since, ktime_get_ns());
+
+	return len;
+}
+static DEVICE_ATTR_RW(stats);
+
+static struct attribute *pmem_attributes[] = {
+	&dev_attr_write_threads.attr,
+	&dev_attr_write_split_kb.attr,
+	&dev_attr_write_dma_kb.attr,
+	&dev_attr_dma_channel.attr,
+	&dev_attr_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group pmem_attribute_group = {
+	.name		= "pmem",
+	.attrs		= pmem_attributes,
+};
+
 static const struct attribute_group *pmem_attribute_groups[] = {
 	&dax_attribute_group,
+	&pmem_attribute_group,
 	NULL,
 };
 
@@ -364,6 +843,85 @@ static void pmem_release_disk(void *__pmem)
 	put_disk(pmem->disk);
 }
 
+static bool pmem_dma_filter(struct dma_chan *chan, void *node)
+{
+	return dev_to_node(chan->device->dev) == (long)node;
+}
+
+/* Grab a memcpy channel, preferably one on the namespace's node */
+static void pmem_setup_dma(struct device *dev, struct pmem_device *pmem)
+{
+	struct dma_chan *chan = NULL;
+	dma_cap_mask_t mask;
+	dma_addr_t base;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+
+	if (pmem->node != NUMA_NO_NODE)
+		chan = dma_request_channel(mask, pmem_dma_filter,
+				(void *)(long)pmem->node);
+	if (!chan)
+		chan = dma_request_channel(mask, NULL, NULL);
+	if (!chan) {
+		dev_info(dev, "no DMA memcpy channel, not offloading writes\n");
+		return;
+	}
+
+	base = dma_map_resource(chan->device->dev, pmem->phys_addr, pmem->size,
+			DMA_FROM_DEVICE, 0);
+	if (dma_mapping_error(chan->device->dev, base)) {
+		dev_warn(dev, "failed to map for %s\n", dma_chan_name(chan));
+		dma_release_channel(chan);
+		return;
+	}
+
+	pmem->dma_chan = chan;
+	pmem->dma_base = base;
+	pmem->write_dma_min = PMEM_DMA_MIN_DEFAULT;
+	dev_info(dev, "offloading writes to %s\n", dma_chan_name(chan));
+}
+
+static void pmem_release_io(void *__pmem)
+{
+	struct pmem_device *pmem = __pmem;
+
+	if (pmem->dma_chan) {
+		dma_unmap_resource(pmem->dma_chan->device->dev, pmem->dma_base,
+				pmem->size, DMA_FROM_DEVICE, 0);
+		dma_release_channel(pmem->dma_chan);
+	}
+	destroy_workqueue(pmem->write_wq);
+	free_percpu(pmem->stats);
+}
+
+/*
+ * Set up the write workers, DMA channel and statistics.  This is released
+ * after the queue is cleaned up, so no bio can still be using it.
+ */
+static int pmem_setup_io(struct device *dev, struct pmem_device *pmem)
+{
+	pmem->node = dev_to_node(dev);
+	pmem->write_split_min = PMEM_SPLIT_MIN_DEFAULT;
+
+	pmem->stats = alloc_percpu(struct pmem_stats);
+	if (!pmem->stats)
+		return -ENOMEM;
+	pmem->stats_since = ktime_get_ns();
+
+	pmem->write_wq = alloc_workqueue("pmem_write/%s",
+			WQ_UNBOUND | WQ_MEM_RECLAIM, 0, dev_name(dev));
+	if (!pmem->write_wq) {
+		free_percpu(pmem->stats);
+		return -ENOMEM;
+	}
+
+	if (dma_offload)
+		pmem_setup_dma(dev, pmem);
+
+	return devm_add_action_or_reset(dev, pmem_release_io, pmem);
+}
+
 static const struct dev_pagemap_ops fsdax_pagemap_ops = {
 	.kill			= pmem_pagemap_kill,
 	.cleanup		= pmem_pagemap_cleanup,
@@ -422,6 +980,10 @@ static int pmem_attach_disk(struct device *dev,
 		return -EBUSY;
 	}
 
+	rc = pmem_setup_io(dev, pmem);
+	if (rc)
+		return rc;
+
 	q = blk_alloc_queue(dev_to_node(dev));
 	if (!q)
 		return -ENOMEM;
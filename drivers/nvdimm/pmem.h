@@ -24,6 +24,17 @@ struct pmem_device {
 	struct dax_device	*dax_dev;
 	struct gendisk		*disk;
 	struct dev_pagemap	pgmap;
+	int			node;
+	/* large writes split across workers, 0 or 1 thread = disabled */
+	unsigned int		write_threads;
+	unsigned int		write_split_min;
+	struct workqueue_struct	*write_wq;
+	/* optional dmaengine channel for writes of at least write_dma_min */
+	unsigned int		write_dma_min;
+	struct dma_chan		*dma_chan;
+	dma_addr_t		dma_base;
+	struct pmem_stats __percpu *stats;
+	u64			stats_since;
 };
 
 long __pmem_direct_access(struct pmem_device *pmem, pgoff_t pgoff,
@@ -10,6 +10,7 @@
 #include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/hdreg.h>
+#include <linux/io_uring.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/backing-dev.h>
@@ -268,6 +269,27 @@ static void nvme_retry_req(struct request *req)
 	blk_mq_delay_kick_requeue_list(req->q, delay);
 }
 
+/*
+ * The part of nvme_complete_rq() for a successful request that is then ended
+ * by blk_mq_end_request_batch() together with the rest of its batch.
+ */
+void nvme_complete_batch_req(struct request *req)
+{
+	trace_nvme_complete_rq(req);
+	nvme_cleanup_cmd(req);
+
+	if (nvme_req(req)->ctrl->kas)
+		nvme_req(req)->ctrl->comp_seen = true;
+
+	if (IS_ENABLED(CONFIG_BLK_DEV_ZONED) &&
+	    req_op(req) == REQ_OP_ZONE_APPEND)
+		req->__sector = nvme_lba_to_sect(req->q->queuedata,
+			le64_to_cpu(nvme_req(req)->result.u64));
+
+	nvme_trace_bio_complete(req, BLK_STS_OK);
+}
+EXPORT_SYMBOL_GPL(nvme_complete_batch_req);
+
 void nvme_complete_rq(struct request *req)
 {
 	blk_status_t status = nvme_error_status(nvme_req(req)->status);
@@ -480,10 +502,10 @@ static inline void nvme_clear_nvme_request(struct request *req)
 	}
 }
 
-struct request *nvme_alloc_request(struct request_queue *q,
-		struct nvme_command *cmd, blk_mq_req_flags_t flags, int qid)
+static struct request *__nvme_alloc_request(struct request_queue *q,
+		struct nvme_command *cmd, unsigned int op,
+		blk_mq_req_flags_t flags, int qid)
 {
-	unsigned op = nvme_is_write(cmd) ? REQ_OP_DRV_OUT : REQ_OP_DRV_IN;
 	struct request *req;
 
 	if (qid == NVME_QID_ANY) {
@@ -501,6 +523,14 @@ struct request *nvme_alloc_request(struct request_queue *q,
 
 	return req;
 }
+
+struct request *nvme_alloc_request(struct request_queue *q,
+		struct nvme_command *cmd, blk_mq_req_flags_t flags, int qid)
+{
+	unsigned op = nvme_is_write(cmd) ? REQ_OP_DRV_OUT : REQ_OP_DRV_IN;
+
+	return __nvme_alloc_request(q, cmd, op, flags, qid);
+}
 EXPORT_SYMBOL_GPL(nvme_alloc_request);
 
 static int nvme_toggle_streams(struct nvme_ctrl *ctrl, bool enable)
@@ -1545,6 +1575,23 @@ static int nvme_user_cmd(struct nvme_ctrl *ctrl, struct nvme_ns *ns,
 	return status;
 }
 
+static void nvme_init_user_cmd64(struct nvme_command *c,
+		struct nvme_passthru_cmd64 *cmd)
+{
+	memset(c, 0, sizeof(*c));
+	c->common.opcode = cmd->opcode;
+	c->common.flags = cmd->flags;
+	c->common.nsid = cpu_to_le32(cmd->nsid);
+	c->common.cdw2[0] = cpu_to_le32(cmd->cdw2);
+	c->common.cdw2[1] = cpu_to_le32(cmd->cdw3);
+	c->common.cdw10 = cpu_to_le32(cmd->cdw10);
+	c->common.cdw11 = cpu_to_le32(cmd->cdw11);
+	c->common.cdw12 = cpu_to_le32(cmd->cdw12);
+	c->common.cdw13 = cpu_to_le32(cmd->cdw13);
+	c->common.cdw14 = cpu_to_le32(cmd->cdw14);
+	c->common.cdw15 = cpu_to_le32(cmd->cdw15);
+}
+
 static int nvme_user_cmd64(struct nvme_ctrl *ctrl, struct nvme_ns *ns,
 			struct nvme_passthru_cmd64 __user *ucmd)
 {
@@ -1560,18 +1607,7 @@ static int nvme_user_cmd64(struct nvme_ctrl *ctrl, struct nvme_ns *ns,
 	if (cmd.flags)
 		return -EINVAL;
 
-	memset(&c, 0, sizeof(c));
-	c.common.opcode = cmd.opcode;
-	c.common.flags = cmd.flags;
-	c.common.nsid = cpu_to_le32(cmd.nsid);
-	c.common.cdw2[0] = cpu_to_le32(cmd.cdw2);
-	c.common.cdw2[1] = cpu_to_le32(cmd.cdw3);
-	c.common.cdw10 = cpu_to_le32(cmd.cdw10);
-	c.common.cdw11 = cpu_to_le32(cmd.cdw11);
-	c.common.cdw12 = cpu_to_le32(cmd.cdw12);
-	c.common.cdw13 = cpu_to_le32(cmd.cdw13);
-	c.common.cdw14 = cpu_to_le32(cmd.cdw14);
-	c.common.cdw15 = cpu_to_le32(cmd.cdw15);
+	nvme_init_user_cmd64(&c, &cmd);
 
 	if (cmd.timeout_ms)
 		timeout = msecs_to_jiffies(cmd.timeout_ms);
@@ -3273,11 +3309,188 @@ static long nvme_dev_ioctl(struct file *file, unsigned int cmd,
 	}
 }
 
+/*
+ * State of an NVME_URING_CMD_IO command in flight. The command itself must
+ * outlive the submission as the request may be requeued before it is sent.
+ */
+struct nvme_uring_data {
+	struct nvme_command	cmd;
+	struct bio		*bio;
+	void			*meta;
+	void __user		*meta_buffer;
+	unsigned int		meta_len;
+};
+
+/* lives in io_uring_cmd->pdu */
+struct nvme_uring_cmd_pdu {
+	struct request		*req;
+	struct nvme_uring_data	*data;
+};
+
+static inline struct nvme_uring_cmd_pdu *nvme_uring_cmd_pdu(
+		struct io_uring_cmd *ioucmd)
+{
+	return (struct nvme_uring_cmd_pdu *)&ioucmd->pdu;
+}
+
+static void nvme_uring_task_cb(struct io_uring_cmd *ioucmd)
+{
+	struct nvme_uring_cmd_pdu *pdu = nvme_uring_cmd_pdu(ioucmd);
+	struct nvme_passthru_cmd64 __user *ucmd = (void __user *)ioucmd->cmd;
+	struct nvme_uring_data *d = pdu->data;
+	struct request *req = pdu->req;
+	struct nvme_ns *ns = req->q->queuedata;
+	int status;
+
+	if (nvme_req(req)->flags & NVME_REQ_CANCELLED)
+		status = -EINTR;
+	else
+		status = nvme_req(req)->status;
+	if (status >= 0 &&
+	    put_user(le64_to_cpu(nvme_req(req)->result.u64), &ucmd->result))
+		status = -EFAULT;
+	if (d->meta && !status && !nvme_is_write(&d->cmd)) {
+		if (copy_to_user(d->meta_buffer, d->meta, d->meta_len))
+			status = -EFAULT;
+	}
+	kfree(d->meta);
+	if (d->bio)
+		blk_rq_unmap_user(d->bio);
+	blk_mq_free_request(req);
+	kfree(d);
+	nvme_put_ns(ns);
+
+	io_uring_cmd_done(ioucmd, status);
+}
+
+static void nvme_uring_cmd_end_io(struct request *req, blk_status_t err)
+{
+	struct io_uring_cmd *ioucmd = req->end_io_data;
+
+	/* unmapping and the result copy need the submitter's context */
+	io_uring_cmd_complete_in_task(ioucmd, nvme_uring_task_cb);
+}
+
+/*
+ * Asynchronous version of NVME_IOCTL_IO64_CMD on the namespace given by
+ * cmd.nsid. Only I/O commands are accepted, they never have effects that
+ * need the controller frozen around them, see nvme_command_effects().
+ */
+static int nvme_uring_cmd_io(struct nvme_ctrl *ctrl,
+		struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	struct nvme_uring_cmd_pdu *pdu = nvme_uring_cmd_pdu(ioucmd);
+	struct nvme_passthru_cmd64 cmd;
+	blk_mq_req_flags_t blk_flags = 0;
+	struct nvme_uring_data *d;
+	struct request *req;
+	struct nvme_ns *ns;
+	unsigned int op;
+	int ret;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+	if (ioucmd->cmd_len != sizeof(cmd))
+		return -EINVAL;
+	if (copy_from_user(&cmd, ioucmd->cmd, sizeof(cmd)))
+		return -EFAULT;
+	if (cmd.flags)
+		return -EINVAL;
+
+	ns = nvme_find_get_ns(ctrl, cmd.nsid);
+	if (!ns)
+		return -EINVAL;
+
+	ret = -ENOMEM;
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		goto out_put_ns;
+	nvme_init_user_cmd64(&d->cmd, &cmd);
+
+	op = nvme_is_write(&d->cmd) ? REQ_OP_DRV_OUT : REQ_OP_DRV_IN;
+	if (issue_flags & IO_URING_F_IOPOLL)
+		op |= REQ_HIPRI;
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		blk_flags |= BLK_MQ_REQ_NOWAIT;
+
+	req = __nvme_alloc_request(ns->queue, &d->cmd, op, blk_flags,
+			NVME_QID_ANY);
+	if (IS_ERR(req)) {
+		ret = PTR_ERR(req);
+		goto out_free;
+	}
+
+	req->timeout = cmd.timeout_ms ? msecs_to_jiffies(cmd.timeout_ms) :
+			ADMIN_TIMEOUT;
+	nvme_req(req)->flags |= NVME_REQ_USERCMD;
+
+	if (cmd.addr && cmd.data_len) {
+		ret = blk_rq_map_user(ns->queue, req, NULL,
+				nvme_to_user_ptr(cmd.addr), cmd.data_len,
+				GFP_KERNEL);
+		if (ret)
+			goto out_free_req;
+		d->bio = req->bio;
+		d->bio->bi_disk = ns->disk;
+		if (cmd.metadata && cmd.metadata_len) {
+			d->meta_buffer = nvme_to_user_ptr(cmd.metadata);
+			d->meta_len = cmd.metadata_len;
+			d->meta = nvme_add_user_metadata(d->bio, d->meta_buffer,
+					d->meta_len, 0, nvme_is_write(&d->cmd));
+			if (IS_ERR(d->meta)) {
+				ret = PTR_ERR(d->meta);
+				goto out_unmap;
+			}
+			req->cmd_flags |= REQ_INTEGRITY;
+		}
+	}
+
+	pdu->req = req;
+	pdu->data = d;
+	req->end_io_data = ioucmd;
+	blk_execute_rq_nowait(ns->queue, ns->disk, req, 0,
+			nvme_uring_cmd_end_io);
+	return -EIOCBQUEUED;
+
+out_unmap:
+	if (d->bio)
+		blk_rq_unmap_user(d->bio);
+out_free_req:
+	blk_mq_free_request(req);
+out_free:
+	kfree(d);
+out_put_ns:
+	nvme_put_ns(ns);
+	return ret;
+}
+
+static int nvme_dev_uring_cmd(struct io_uring_cmd *ioucmd,
+		unsigned int issue_flags)
+{
+	struct nvme_ctrl *ctrl = ioucmd->file->private_data;
+
+	switch (ioucmd->cmd_op) {
+	case NVME_URING_CMD_IO:
+		return nvme_uring_cmd_io(ctrl, ioucmd, issue_flags);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int nvme_dev_uring_cmd_iopoll(struct io_uring_cmd *ioucmd, bool spin)
+{
+	struct request *req = nvme_uring_cmd_pdu(ioucmd)->req;
+
+	return blk_poll(req->q, request_to_qc_t(req->mq_hctx, req), spin);
+}
+
 static const struct file_operations nvme_dev_fops = {
 	.owner		= THIS_MODULE,
 	.open		= nvme_dev_open,
 	.unlocked_ioctl	= nvme_dev_ioctl,
 	.compat_ioctl	= compat_ptr_ioctl,
+	.uring_cmd	= nvme_dev_uring_cmd,
+	.uring_cmd_iopoll = nvme_dev_uring_cmd_iopoll,
 };
 
 static ssize_t nvme_sysfs_reset(struct device *dev,
@@ -19,6 +19,7 @@
 #include <linux/mutex.h>
 #include <linux/once.h>
 #include <linux/pci.h>
+#include <linux/seq_file.h>
 #include <linux/suspend.h>
 #include <linux/t10-pi.h>
 #include <linux/types.h>
@@ -41,6 +42,18 @@
 #define NVME_MAX_KB_SZ	4096
 #define NVME_MAX_SEGS	127
 
+/* Descriptors cached per queue, see nvme_alloc_desc() */
+#define NVME_DESC_SMALL		0
+#define NVME_DESC_PAGE		1
+#define NVME_DESC_TYPES		2
+#define NVME_DESC_CACHE_MAX	64
+#define NVME_DESC_CACHE_PREFILL	16
+
+/* Interrupt coalescing, see nvme_coalesce_work() */
+#define NVME_COALESCE_PERIOD	HZ
+#define NVME_COALESCE_MIN_DEPTH	2
+#define NVME_IRQ_CONFIG_CD	(1 << 16)
+
 static int use_threaded_interrupts;
 module_param(use_threaded_interrupts, int, 0);
 
@@ -99,6 +112,11 @@ static bool noacpi;
 module_param(noacpi, bool, 0444);
 MODULE_PARM_DESC(noacpi, "disable acpi bios quirks");
 
+static unsigned char irq_coalesce_time;
+module_param(irq_coalesce_time, byte, 0444);
+MODULE_PARM_DESC(irq_coalesce_time,
+	"interrupt aggregation time for busy queues in 100us units, 0 to disable");
+
 struct nvme_dev;
 struct nvme_queue;
 
@@ -152,6 +170,10 @@ struct nvme_dev {
 	unsigned int nr_allocated_queues;
 	unsigned int nr_write_queues;
 	unsigned int nr_poll_queues;
+
+	/* interrupt coalescing support: */
+	struct delayed_work coalesce_work;
+	u32 coalesce_cdw11;
 };
 
 static int io_queue_depth_set(const char *val, const struct kernel_param *kp)
@@ -207,11 +229,33 @@ struct nvme_queue {
 #define NVMEQ_SQ_CMB		1
 #define NVMEQ_DELETE_ERROR	2
 #define NVMEQ_POLLED		3
+#define NVMEQ_NO_COALESCE	4
 	u32 *dbbuf_sq_db;
 	u32 *dbbuf_cq_db;
 	u32 *dbbuf_sq_ei;
 	u32 *dbbuf_cq_ei;
 	struct completion delete_done;
+
+	/* queue depth sampling, see nvme_coalesce_work(): */
+	u32 nr_submitted;
+	u32 nr_completed;
+	u64 depth_sum;
+	u32 last_submitted;
+	u64 last_depth_sum;
+	unsigned int avg_depth;
+
+	/* PRP list and SGL segment caches, see nvme_alloc_desc(): */
+	spinlock_t desc_lock;
+	struct nvme_desc_cache {
+		struct nvme_free_desc *head;
+		unsigned int nr;
+	} desc_cache[NVME_DESC_TYPES];
+};
+
+/* An unused descriptor in a queue's cache, stored in the descriptor itself */
+struct nvme_free_desc {
+	struct nvme_free_desc *next;
+	dma_addr_t dma;
 };
 
 /*
@@ -231,6 +275,11 @@ struct nvme_iod {
 	unsigned int dma_len;	/* length of single DMA segment mapping */
 	dma_addr_t meta_dma;
 	struct scatterlist *sg;
+	/* two segment mapping without a scatterlist, see nvme_setup_bvecs() */
+	int nr_bvecs;
+	dma_addr_t bv_dma[2];
+	unsigned int bv_len[2];
+	void *bv_desc;
 };
 
 static inline unsigned int nvme_dbbuf_size(struct nvme_dev *dev)
@@ -476,6 +525,8 @@ static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd,
 	       cmd, sizeof(*cmd));
 	if (++nvmeq->sq_tail == nvmeq->q_depth)
 		nvmeq->sq_tail = 0;
+	nvmeq->nr_submitted++;
+	nvmeq->depth_sum += nvmeq->nr_submitted - READ_ONCE(nvmeq->nr_completed);
 	if (write_sq)
 		nvme_write_sq_db(nvmeq);
 	spin_unlock(&nvmeq->sq_lock);
@@ -490,6 +541,95 @@ static void nvme_commit_rqs(struct blk_mq_hw_ctx *hctx)
 	spin_unlock(&nvmeq->sq_lock);
 }
 
+static struct dma_pool *nvme_desc_pool(struct nvme_dev *dev, int type)
+{
+	return type == NVME_DESC_SMALL ? dev->prp_small_pool : dev->prp_page_pool;
+}
+
+/*
+ * PRP lists and SGL segments come from dma pools shared by all queues of
+ * the device.  Keep a few freed descriptors per queue so that submission
+ * and completion only contend with the other CPUs mapped to the queue.
+ */
+static void *nvme_alloc_desc(struct nvme_queue *nvmeq, int type,
+		dma_addr_t *dma)
+{
+	struct nvme_desc_cache *cache = &nvmeq->desc_cache[type];
+	struct nvme_free_desc *desc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&nvmeq->desc_lock, flags);
+	desc = cache->head;
+	if (desc) {
+		cache->head = desc->next;
+		cache->nr--;
+	}
+	spin_unlock_irqrestore(&nvmeq->desc_lock, flags);
+
+	if (!desc)
+		return dma_pool_alloc(nvme_desc_pool(nvmeq->dev, type),
+				      GFP_ATOMIC, dma);
+	*dma = desc->dma;
+	return desc;
+}
+
+static void nvme_free_desc(struct nvme_queue *nvmeq, int type, void *addr,
+		dma_addr_t dma)
+{
+	struct nvme_desc_cache *cache = &nvmeq->desc_cache[type];
+	struct nvme_free_desc *desc = addr;
+	unsigned long flags;
+
+	spin_lock_irqsave(&nvmeq->desc_lock, flags);
+	if (cache->nr < NVME_DESC_CACHE_MAX) {
+		desc->dma = dma;
+		desc->next = cache->head;
+		cache->head = desc;
+		cache->nr++;
+		desc = NULL;
+	}
+	spin_unlock_irqrestore(&nvmeq->desc_lock, flags);
+
+	if (desc)
+		dma_pool_free(nvme_desc_pool(nvmeq->dev, type), addr, dma);
+}
+
+static void nvme_prefill_desc_cache(struct nvme_queue *nvmeq)
+{
+	struct nvme_dev *dev = nvmeq->dev;
+	dma_addr_t dma;
+	void *addr;
+	int type, i;
+
+	for (type = 0; type < NVME_DESC_TYPES; type++) {
+		for (i = 0; i < NVME_DESC_CACHE_PREFILL; i++) {
+			addr = dma_pool_alloc(nvme_desc_pool(dev, type),
+					      GFP_KERNEL, &dma);
+			if (!addr)
+				return;
+			nvme_free_desc(nvmeq, type, addr, dma);
+		}
+	}
+}
+
+static void nvme_drain_desc_cache(struct nvme_queue *nvmeq)
+{
+	struct nvme_dev *dev = nvmeq->dev;
+	struct nvme_free_desc *desc;
+	int type;
+
+	for (type = 0; type < NVME_DESC_TYPES; type++) {
+		struct nvme_desc_cache *cache = &nvmeq->desc_cache[type];
+
+		while ((desc = cache->head)) {
+			cache->head = desc->next;
+			dma_pool_free(nvme_desc_pool(dev, type), desc,
+				      desc->dma);
+		}
+		cache->nr = 0;
+	}
+}
+
 static void **nvme_pci_iod_list(struct request *req)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
@@ -526,6 +666,16 @@ static void nvme_unmap_data(struct nvme_dev *dev, struct request *req)
 		return;
 	}
 
+	if (iod->nr_bvecs) {
+		for (i = 0; i < iod->nr_bvecs; i++)
+			dma_unmap_page(dev->dev, iod->bv_dma[i], iod->bv_len[i],
+				       rq_dma_dir(req));
+		if (iod->bv_desc)
+			nvme_free_desc(iod->nvmeq, NVME_DESC_SMALL,
+				       iod->bv_desc, dma_addr);
+		return;
+	}
+
 	WARN_ON_ONCE(!iod->nents);
 
 	if (is_pci_p2pdma_page(sg_page(iod->sg)))
@@ -536,8 +686,8 @@ static void nvme_unmap_data(struct nvme_dev *dev, struct request *req)
 
 
 	if (iod->npages == 0)
-		dma_pool_free(dev->prp_small_pool, nvme_pci_iod_list(req)[0],
-			dma_addr);
+		nvme_free_desc(iod->nvmeq, NVME_DESC_SMALL,
+			       nvme_pci_iod_list(req)[0], dma_addr);
 
 	for (i = 0; i < iod->npages; i++) {
 		void *addr = nvme_pci_iod_list(req)[i];
@@ -553,7 +703,7 @@ static void nvme_unmap_data(struct nvme_dev *dev, struct request *req)
 			next_dma_addr = le64_to_cpu(prp_list[last_prp]);
 		}
 
-		dma_pool_free(dev->prp_page_pool, addr, dma_addr);
+		nvme_free_desc(iod->nvmeq, NVME_DESC_PAGE, addr, dma_addr);
 		dma_addr = next_dma_addr;
 	}
 
@@ -578,7 +728,6 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 		struct request *req, struct nvme_rw_command *cmnd)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
-	struct dma_pool *pool;
 	int length = blk_rq_payload_bytes(req);
 	struct scatterlist *sg = iod->sg;
 	int dma_len = sg_dma_len(sg);
@@ -587,7 +736,7 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 	__le64 *prp_list;
 	void **list = nvme_pci_iod_list(req);
 	dma_addr_t prp_dma;
-	int nprps, i;
+	int nprps, i, type;
 
 	length -= (NVME_CTRL_PAGE_SIZE - offset);
 	if (length <= 0) {
@@ -611,14 +760,14 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 
 	nprps = DIV_ROUND_UP(length, NVME_CTRL_PAGE_SIZE);
 	if (nprps <= (256 / 8)) {
-		pool = dev->prp_small_pool;
+		type = NVME_DESC_SMALL;
 		iod->npages = 0;
 	} else {
-		pool = dev->prp_page_pool;
+		type = NVME_DESC_PAGE;
 		iod->npages = 1;
 	}
 
-	prp_list = dma_pool_alloc(pool, GFP_ATOMIC, &prp_dma);
+	prp_list = nvme_alloc_desc(iod->nvmeq, type, &prp_dma);
 	if (!prp_list) {
 		iod->first_dma = dma_addr;
 		iod->npages = -1;
@@ -630,7 +779,7 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 	for (;;) {
 		if (i == NVME_CTRL_PAGE_SIZE >> 3) {
 			__le64 *old_prp_list = prp_list;
-			prp_list = dma_pool_alloc(pool, GFP_ATOMIC, &prp_dma);
+			prp_list = nvme_alloc_desc(iod->nvmeq, type, &prp_dma);
 			if (!prp_list)
 				return BLK_STS_RESOURCE;
 			list[iod->npages++] = prp_list;
@@ -691,11 +840,10 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 		struct request *req, struct nvme_rw_command *cmd, int entries)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
-	struct dma_pool *pool;
 	struct nvme_sgl_desc *sg_list;
 	struct scatterlist *sg = iod->sg;
 	dma_addr_t sgl_dma;
-	int i = 0;
+	int i = 0, type;
 
 	/* setting the transfer type as SGL */
 	cmd->flags = NVME_CMD_SGL_METABUF;
@@ -706,14 +854,14 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 	}
 
 	if (entries <= (256 / sizeof(struct nvme_sgl_desc))) {
-		pool = dev->prp_small_pool;
+		type = NVME_DESC_SMALL;
 		iod->npages = 0;
 	} else {
-		pool = dev->prp_page_pool;
+		type = NVME_DESC_PAGE;
 		iod->npages = 1;
 	}
 
-	sg_list = dma_pool_alloc(pool, GFP_ATOMIC, &sgl_dma);
+	sg_list = nvme_alloc_desc(iod->nvmeq, type, &sgl_dma);
 	if (!sg_list) {
 		iod->npages = -1;
 		return BLK_STS_RESOURCE;
@@ -729,7 +877,7 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 			struct nvme_sgl_desc *old_sg_desc = sg_list;
 			struct nvme_sgl_desc *link = &old_sg_desc[i - 1];
 
-			sg_list = dma_pool_alloc(pool, GFP_ATOMIC, &sgl_dma);
+			sg_list = nvme_alloc_desc(iod->nvmeq, type, &sgl_dma);
 			if (!sg_list)
 				return BLK_STS_RESOURCE;
 
@@ -783,6 +931,133 @@ static blk_status_t nvme_setup_sgl_simple(struct nvme_dev *dev,
 	return BLK_STS_OK;
 }
 
+static bool nvme_pci_get_bvecs(struct request *req, struct bio_vec *bv)
+{
+	struct req_iterator iter;
+	struct bio_vec bvec;
+	int n = 0;
+
+	rq_for_each_bvec(bvec, req, iter) {
+		if (n == 2 || is_pci_p2pdma_page(bvec.bv_page))
+			return false;
+		bv[n++] = bvec;
+	}
+	return n == 2;
+}
+
+/*
+ * Number of PRP entries for two bvecs, or 0 if they don't fit into the
+ * two PRP fields and a small PRP list.  The virt boundary keeps the gap
+ * between them page aligned, but don't rely on that here.
+ */
+static unsigned int nvme_pci_bvecs_nprps(struct bio_vec *bv)
+{
+	unsigned int offset = bv[0].bv_offset & (NVME_CTRL_PAGE_SIZE - 1);
+	unsigned int nprps;
+
+	if (((offset + bv[0].bv_len) & (NVME_CTRL_PAGE_SIZE - 1)) ||
+	    (bv[1].bv_offset & (NVME_CTRL_PAGE_SIZE - 1)))
+		return 0;
+
+	nprps = DIV_ROUND_UP(offset + bv[0].bv_len, NVME_CTRL_PAGE_SIZE) +
+		DIV_ROUND_UP(bv[1].bv_len, NVME_CTRL_PAGE_SIZE);
+	if (nprps > 1 + 256 / 8)
+		return 0;
+	return nprps;
+}
+
+static void nvme_pci_setup_prp_bvecs(struct nvme_iod *iod,
+		struct nvme_rw_command *cmnd, __le64 *prp_list)
+{
+	__le64 *prp = &cmnd->dptr.prp1;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		dma_addr_t addr = iod->bv_dma[i];
+		dma_addr_t end = addr + iod->bv_len[i];
+
+		do {
+			*prp = cpu_to_le64(addr);
+			if (prp == &cmnd->dptr.prp1 && prp_list)
+				prp = prp_list;
+			else
+				prp++;
+			addr = round_down(addr, NVME_CTRL_PAGE_SIZE) +
+				NVME_CTRL_PAGE_SIZE;
+		} while (addr < end);
+	}
+}
+
+static void nvme_pci_setup_sgl_bvecs(struct nvme_iod *iod,
+		struct nvme_rw_command *cmnd, struct nvme_sgl_desc *sg_list)
+{
+	int i;
+
+	cmnd->flags = NVME_CMD_SGL_METABUF;
+	nvme_pci_sgl_set_seg(&cmnd->dptr.sgl, iod->first_dma, 2);
+	for (i = 0; i < 2; i++) {
+		sg_list[i].addr = cpu_to_le64(iod->bv_dma[i]);
+		sg_list[i].length = cpu_to_le32(iod->bv_len[i]);
+		sg_list[i].type = NVME_SGL_FMT_DATA_DESC << 4;
+	}
+}
+
+/*
+ * Two segment requests are common for direct I/O that isn't page aligned
+ * and for small writeback.  Map the bvecs directly rather than building
+ * a scatterlist for them.  Returns BLK_STS_NOTSUPP if the request needs
+ * the scatterlist path.
+ */
+static blk_status_t nvme_setup_bvecs(struct nvme_dev *dev,
+		struct request *req, struct nvme_rw_command *cmnd)
+{
+	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
+	bool use_sgl = nvme_pci_use_sgls(dev, req);
+	unsigned int nprps = 0;
+	struct bio_vec bv[2];
+	int i;
+
+	if (!nvme_pci_get_bvecs(req, bv))
+		return BLK_STS_NOTSUPP;
+	if (!use_sgl) {
+		nprps = nvme_pci_bvecs_nprps(bv);
+		if (!nprps)
+			return BLK_STS_NOTSUPP;
+	}
+
+	iod->dma_len = 0;
+	iod->bv_desc = NULL;
+	for (i = 0; i < 2; i++) {
+		iod->bv_dma[i] = dma_map_bvec(dev->dev, &bv[i], rq_dma_dir(req),
+					      0);
+		if (dma_mapping_error(dev->dev, iod->bv_dma[i]))
+			goto unmap;
+		iod->bv_len[i] = bv[i].bv_len;
+		iod->nr_bvecs++;
+	}
+
+	if (use_sgl || nprps > 2) {
+		iod->bv_desc = nvme_alloc_desc(iod->nvmeq, NVME_DESC_SMALL,
+					       &iod->first_dma);
+		if (!iod->bv_desc)
+			goto unmap;
+	}
+
+	if (use_sgl) {
+		nvme_pci_setup_sgl_bvecs(iod, cmnd, iod->bv_desc);
+	} else {
+		nvme_pci_setup_prp_bvecs(iod, cmnd, iod->bv_desc);
+		if (iod->bv_desc)
+			cmnd->dptr.prp2 = cpu_to_le64(iod->first_dma);
+	}
+	return BLK_STS_OK;
+
+unmap:
+	if (iod->nr_bvecs)
+		nvme_unmap_data(dev, req);
+	return BLK_STS_RESOURCE;
+}
+
 static blk_status_t nvme_map_data(struct nvme_dev *dev, struct request *req,
 		struct nvme_command *cmnd)
 {
@@ -805,6 +1080,13 @@ static blk_status_t nvme_map_data(struct nvme_dev *dev, struct request *req,
 		}
 	}
 
+	if (blk_rq_nr_phys_segments(req) == 2) {
+		ret = nvme_setup_bvecs(dev, req, &cmnd->rw);
+		if (ret != BLK_STS_NOTSUPP)
+			return ret;
+		ret = BLK_STS_RESOURCE;
+	}
+
 	iod->dma_len = 0;
 	iod->sg = mempool_alloc(dev->iod_mempool, GFP_ATOMIC);
 	if (!iod->sg)
@@ -864,6 +1146,7 @@ static blk_status_t nvme_queue_rq(struct blk_mq_hw_ctx *hctx,
 	iod->aborted = 0;
 	iod->npages = -1;
 	iod->nents = 0;
+	iod->nr_bvecs = 0;
 
 	/*
 	 * We should not need to do this, but we're still using this to
@@ -898,7 +1181,7 @@ out_free_cmd:
 	return ret;
 }
 
-static void nvme_pci_complete_rq(struct request *req)
+static __always_inline void nvme_pci_unmap_rq(struct request *req)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
 	struct nvme_dev *dev = iod->nvmeq->dev;
@@ -908,9 +1191,25 @@ static void nvme_pci_complete_rq(struct request *req)
 			       rq_integrity_vec(req)->bv_len, rq_data_dir(req));
 	if (blk_rq_nr_phys_segments(req))
 		nvme_unmap_data(dev, req);
+}
+
+static void nvme_pci_complete_rq(struct request *req)
+{
+	nvme_pci_unmap_rq(req);
 	nvme_complete_rq(req);
 }
 
+static void nvme_pci_complete_batch(struct io_comp_batch *iob)
+{
+	struct request *req;
+
+	for (req = iob->req_list; req; req = req->rq_next) {
+		nvme_pci_unmap_rq(req);
+		nvme_complete_batch_req(req);
+	}
+	blk_mq_end_request_batch(iob);
+}
+
 /* We read the CQE phase first to check if the rest of the entry is valid */
 static inline bool nvme_cqe_pending(struct nvme_queue *nvmeq)
 {
@@ -935,7 +1234,8 @@ static inline struct blk_mq_tags *nvme_queue_tagset(struct nvme_queue *nvmeq)
 	return nvmeq->dev->tagset.tags[nvmeq->qid - 1];
 }
 
-static inline void nvme_handle_cqe(struct nvme_queue *nvmeq, u16 idx)
+static inline void nvme_handle_cqe(struct nvme_queue *nvmeq,
+				   struct io_comp_batch *iob, u16 idx)
 {
 	struct nvme_completion *cqe = &nvmeq->cqes[idx];
 	struct request *req;
@@ -961,7 +1261,9 @@ static inline void nvme_handle_cqe(struct nvme_queue *nvmeq, u16 idx)
 
 	req = blk_mq_tag_to_rq(nvme_queue_tagset(nvmeq), cqe->command_id);
 	trace_nvme_sq(req, cqe->sq_head, nvmeq->sq_tail);
-	if (!nvme_end_request(req, cqe->status, cqe->result))
+	if (!nvme_end_request(req, cqe->status, cqe->result) &&
+	    !blk_mq_add_to_batch(req, iob, nvme_req(req)->status,
+				 nvme_pci_complete_batch))
 		nvme_pci_complete_rq(req);
 }
 
@@ -979,6 +1281,7 @@ static inline void nvme_update_cq_head(struct nvme_queue *nvmeq)
 
 static inline int nvme_process_cq(struct nvme_queue *nvmeq)
 {
+	DEFINE_IO_COMP_BATCH(iob);
 	int found = 0;
 
 	while (nvme_cqe_pending(nvmeq)) {
@@ -988,12 +1291,18 @@ static inline int nvme_process_cq(struct nvme_queue *nvmeq)
 		 * the cqe requires a full read memory barrier
 		 */
 		dma_rmb();
-		nvme_handle_cqe(nvmeq, nvmeq->cq_head);
+		nvme_handle_cqe(nvmeq, &iob, nvmeq->cq_head);
 		nvme_update_cq_head(nvmeq);
 	}
 
-	if (found)
+	if (found) {
 		nvme_ring_cq_doorbell(nvmeq);
+		WRITE_ONCE(nvmeq->nr_completed, nvmeq->nr_completed + found);
+	}
+
+	/* End the reaped requests once the CQ entries are handed back */
+	if (iob.req_list)
+		iob.complete(&iob);
 	return found;
 }
 
@@ -1053,6 +1362,91 @@ static int nvme_poll(struct blk_mq_hw_ctx *hctx)
 	return found;
 }
 
+#ifdef CONFIG_BLK_DEBUG_FS
+static void nvme_show_hctx(struct seq_file *m, struct blk_mq_hw_ctx *hctx)
+{
+	struct nvme_queue *nvmeq = hctx->driver_data;
+
+	seq_printf(m, "qid=%u\n", nvmeq->qid);
+	seq_printf(m, "vector=%d\n", test_bit(NVMEQ_POLLED, &nvmeq->flags) ?
+		   -1 : nvmeq->cq_vector);
+	seq_printf(m, "submitted=%u\n", READ_ONCE(nvmeq->nr_submitted));
+	seq_printf(m, "completed=%u\n", READ_ONCE(nvmeq->nr_completed));
+	seq_printf(m, "avg_depth=%u\n", READ_ONCE(nvmeq->avg_depth));
+	seq_printf(m, "coalesce=%d\n", irq_coalesce_time &&
+		   !test_bit(NVMEQ_POLLED, &nvmeq->flags) &&
+		   !test_bit(NVMEQ_NO_COALESCE, &nvmeq->flags));
+	seq_printf(m, "coalesce_cdw11=0x%x\n",
+		   READ_ONCE(nvmeq->dev->coalesce_cdw11));
+	seq_printf(m, "desc_cache=%u %u\n",
+		   READ_ONCE(nvmeq->desc_cache[NVME_DESC_SMALL].nr),
+		   READ_ONCE(nvmeq->desc_cache[NVME_DESC_PAGE].nr));
+}
+#endif
+
+/*
+ * Interrupt coalescing is a controller wide setting: an aggregation
+ * threshold and time.  Pick the threshold from the deepest interrupt
+ * driven queue, and turn coalescing off for the vectors of the queues
+ * that run too shallow to ever reach a threshold, as they would only
+ * see the aggregation time added to each completion.
+ */
+static void nvme_coalesce_work(struct work_struct *work)
+{
+	struct nvme_dev *dev = container_of(to_delayed_work(work),
+					    struct nvme_dev, coalesce_work);
+	unsigned int i, max_depth = 0;
+	u32 cdw11 = 0;
+
+	if (dev->ctrl.state != NVME_CTRL_LIVE)
+		return;
+
+	for (i = 1; i < dev->online_queues; i++) {
+		struct nvme_queue *nvmeq = &dev->queues[i];
+		u32 submitted = READ_ONCE(nvmeq->nr_submitted);
+		u64 depth_sum = READ_ONCE(nvmeq->depth_sum);
+		bool coalesce;
+		u32 dword11;
+
+		if (test_bit(NVMEQ_POLLED, &nvmeq->flags))
+			continue;
+
+		nvmeq->avg_depth = 0;
+		if (submitted != nvmeq->last_submitted)
+			nvmeq->avg_depth = div_u64(depth_sum - nvmeq->last_depth_sum,
+						   submitted - nvmeq->last_submitted);
+		nvmeq->last_submitted = submitted;
+		nvmeq->last_depth_sum = depth_sum;
+
+		coalesce = nvmeq->avg_depth >= NVME_COALESCE_MIN_DEPTH;
+		if (coalesce)
+			max_depth = max(max_depth, nvmeq->avg_depth);
+
+		/* Vector 0 is shared with the admin queue, leave it alone */
+		if (!nvmeq->cq_vector ||
+		    coalesce != test_bit(NVMEQ_NO_COALESCE, &nvmeq->flags))
+			continue;
+
+		dword11 = nvmeq->cq_vector;
+		if (!coalesce)
+			dword11 |= NVME_IRQ_CONFIG_CD;
+		if (nvme_set_features(&dev->ctrl, NVME_FEAT_IRQ_CONFIG, dword11,
+				      NULL, 0, NULL))
+			continue;
+		change_bit(NVMEQ_NO_COALESCE, &nvmeq->flags);
+	}
+
+	/* The aggregation threshold is 0's based */
+	if (max_depth)
+		cdw11 = (min(max_depth / 2, 256U) - 1) | (irq_coalesce_time << 8);
+	if (cdw11 != dev->coalesce_cdw11 &&
+	    !nvme_set_features(&dev->ctrl, NVME_FEAT_IRQ_COALESCE, cdw11,
+			       NULL, 0, NULL))
+		WRITE_ONCE(dev->coalesce_cdw11, cdw11);
+
+	queue_delayed_work(nvme_wq, &dev->coalesce_work, NVME_COALESCE_PERIOD);
+}
+
 static void nvme_pci_submit_async_event(struct nvme_ctrl *ctrl)
 {
 	struct nvme_dev *dev = to_nvme_dev(ctrl);
@@ -1310,6 +1704,7 @@ static enum blk_eh_timer_return nvme_timeout(struct request *req, bool reserved)
 
 static void nvme_free_queue(struct nvme_queue *nvmeq)
 {
+	nvme_drain_desc_cache(nvmeq);
 	dma_free_coherent(nvmeq->dev->dev, CQ_SIZE(nvmeq),
 				(void *)nvmeq->cqes, nvmeq->cq_dma_addr);
 	if (!nvmeq->sq_cmds)
@@ -1462,6 +1857,9 @@ static int nvme_alloc_queue(struct nvme_dev *dev, int qid, int depth)
 	nvmeq->dev = dev;
 	spin_lock_init(&nvmeq->sq_lock);
 	spin_lock_init(&nvmeq->cq_poll_lock);
+	spin_lock_init(&nvmeq->desc_lock);
+	if (qid)
+		nvme_prefill_desc_cache(nvmeq);
 	nvmeq->cq_head = 0;
 	nvmeq->cq_phase = 1;
 	nvmeq->q_db = &dev->dbs[qid * 2 * dev->db_stride];
@@ -1500,6 +1898,8 @@ static void nvme_init_queue(struct nvme_queue *nvmeq, u16 qid)
 	nvmeq->cq_phase = 1;
 	nvmeq->q_db = &dev->dbs[qid * 2 * dev->db_stride];
 	memset((void *)nvmeq->cqes, 0, CQ_SIZE(nvmeq));
+	/* A reset turns coalescing back on for all vectors */
+	clear_bit(NVMEQ_NO_COALESCE, &nvmeq->flags);
 	nvme_dbbuf_init(dev, nvmeq, qid);
 	dev->online_queues++;
 	wmb(); /* ensure the first interrupt sees the initialization */
@@ -1569,6 +1969,9 @@ static const struct blk_mq_ops nvme_mq_ops = {
 	.map_queues	= nvme_pci_map_queues,
 	.timeout	= nvme_timeout,
 	.poll		= nvme_poll,
+#ifdef CONFIG_BLK_DEBUG_FS
+	.show_hctx	= nvme_show_hctx,
+#endif
 };
 
 static void nvme_dev_remove_admin(struct nvme_dev *dev)
@@ -2400,6 +2803,8 @@ static void nvme_dev_disable(struct nvme_dev *dev, bool shutdown)
 	bool dead = true, freeze = false;
 	struct pci_dev *pdev = to_pci_dev(dev->dev);
 
+	cancel_delayed_work(&dev->coalesce_work);
+
 	mutex_lock(&dev->shutdown_lock);
 	if (pci_is_enabled(pdev)) {
 		u32 csts = readl(dev->bar + NVME_REG_CSTS);
@@ -2535,6 +2940,8 @@ static void nvme_reset_work(struct work_struct *work)
 	if (dev->ctrl.ctrl_config & NVME_CC_ENABLE)
 		nvme_dev_disable(dev, false);
 	nvme_sync_queues(&dev->ctrl);
+	cancel_delayed_work_sync(&dev->coalesce_work);
+	dev->coalesce_cdw11 = 0;
 
 	mutex_lock(&dev->shutdown_lock);
 	result = nvme_pci_enable(dev);
@@ -2641,6 +3048,9 @@ static void nvme_reset_work(struct work_struct *work)
 	}
 
 	nvme_start_ctrl(&dev->ctrl);
+	if (irq_coalesce_time)
+		queue_delayed_work(nvme_wq, &dev->coalesce_work,
+				   NVME_COALESCE_PERIOD);
 	return;
 
  out_unlock:
@@ -2848,6 +3258,7 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	INIT_WORK(&dev->ctrl.reset_work, nvme_reset_work);
 	INIT_WORK(&dev->remove_work, nvme_remove_dead_ctrl_work);
+	INIT_DELAYED_WORK(&dev->coalesce_work, nvme_coalesce_work);
 	mutex_init(&dev->shutdown_lock);
 
 	result = nvme_setup_prp_pools(dev);
@@ -2955,6 +3366,7 @@ static void nvme_remove(struct pci_dev *pdev)
 	}
 
 	flush_work(&dev->ctrl.reset_work);
+	cancel_delayed_work_sync(&dev->coalesce_work);
 	nvme_stop_ctrl(&dev->ctrl);
 	nvme_remove_namespaces(&dev->ctrl);
 	nvme_dev_disable(dev, true);
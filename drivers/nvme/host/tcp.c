@@ -12,6 +12,7 @@
 #include <net/sock.h>
 #include <net/tcp.h>
 #include <linux/blk-mq.h>
+#include <linux/sched/topology.h>
 #include <crypto/hash.h>
 #include <net/busy_poll.h>
 
@@ -30,6 +31,9 @@ static int so_priority;
 module_param(so_priority, int, 0644);
 MODULE_PARM_DESC(so_priority, "nvme tcp socket optimize priority");
 
+/* Command PDUs without data that are gathered into a single sendmsg() */
+#define NVME_TCP_SEND_BATCH	16
+
 enum nvme_tcp_send_state {
 	NVME_TCP_SEND_CMD_PDU = 0,
 	NVME_TCP_SEND_H2C_PDU,
@@ -62,6 +66,7 @@ enum nvme_tcp_queue_flags {
 	NVME_TCP_Q_ALLOCATED	= 0,
 	NVME_TCP_Q_LIVE		= 1,
 	NVME_TCP_Q_POLLING	= 2,
+	NVME_TCP_Q_IO_CPU_SET	= 3,
 };
 
 enum nvme_tcp_recv_state {
@@ -133,6 +138,8 @@ struct nvme_tcp_ctrl {
 static LIST_HEAD(nvme_tcp_ctrl_list);
 static DEFINE_MUTEX(nvme_tcp_ctrl_mutex);
 static struct workqueue_struct *nvme_tcp_wq;
+/* Number of queues whose io_work runs on each CPU, over all controllers */
+static atomic_t nvme_tcp_cpu_queues[NR_CPUS];
 static const struct blk_mq_ops nvme_tcp_mq_ops;
 static const struct blk_mq_ops nvme_tcp_admin_mq_ops;
 static int nvme_tcp_try_send(struct nvme_tcp_queue *queue);
@@ -984,6 +991,79 @@ static int nvme_tcp_try_send_cmd_pdu(struct nvme_tcp_request *req)
 	return -EAGAIN;
 }
 
+/*
+ * Send the command PDU of the current request together with those of the
+ * requests queued behind it in one sendmsg(), as long as none of them
+ * carries inline data.  This is the common case with reads, where every
+ * request is just a command capsule.
+ */
+static int nvme_tcp_try_send_cmd_batch(struct nvme_tcp_queue *queue)
+{
+	struct nvme_tcp_request *reqs[NVME_TCP_SEND_BATCH];
+	struct kvec iov[NVME_TCP_SEND_BATCH];
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+	u8 hdgst = nvme_tcp_hdgst_len(queue);
+	int i, nr = 0, ret;
+	size_t len = 0;
+
+	reqs[nr++] = queue->request;
+	while (nr < NVME_TCP_SEND_BATCH) {
+		struct nvme_tcp_request *req = nvme_tcp_fetch_request(queue);
+
+		if (!req)
+			break;
+		if (req->state != NVME_TCP_SEND_CMD_PDU ||
+		    nvme_tcp_has_inline_data(req)) {
+			list_add(&req->entry, &queue->send_list);
+			break;
+		}
+		reqs[nr++] = req;
+	}
+
+	if (nr == 1)
+		return nvme_tcp_try_send_cmd_pdu(queue->request);
+
+	for (i = 0; i < nr; i++) {
+		struct nvme_tcp_request *req = reqs[i];
+
+		if (queue->hdr_digest && !req->offset)
+			nvme_tcp_hdgst(queue->snd_hash, req->pdu,
+					sizeof(struct nvme_tcp_cmd_pdu));
+		iov[i].iov_base = req->pdu + req->offset;
+		iov[i].iov_len = sizeof(struct nvme_tcp_cmd_pdu) + hdgst -
+				 req->offset;
+		len += iov[i].iov_len;
+	}
+
+	if (nvme_tcp_queue_more(queue))
+		msg.msg_flags |= MSG_MORE;
+	else
+		msg.msg_flags |= MSG_EOR;
+
+	ret = kernel_sendmsg(queue->sock, &msg, iov, nr, len);
+	if (unlikely(ret <= 0)) {
+		i = 0;
+		goto requeue;
+	}
+
+	for (i = 0; i < nr && ret >= iov[i].iov_len; i++)
+		ret -= iov[i].iov_len;
+
+	if (i == nr) {
+		nvme_tcp_done_send_req(queue);
+		return 1;
+	}
+
+	/* The first request not fully sent becomes the current one */
+	queue->request = reqs[i];
+	reqs[i]->offset += ret;
+	ret = i ? 1 : -EAGAIN;
+requeue:
+	while (--nr > i)
+		list_add(&reqs[nr]->entry, &queue->send_list);
+	return ret;
+}
+
 static int nvme_tcp_try_send_data_pdu(struct nvme_tcp_request *req)
 {
 	struct nvme_tcp_queue *queue = req->queue;
@@ -1056,11 +1136,13 @@ static int nvme_tcp_try_send(struct nvme_tcp_queue *queue)
 	req = queue->request;
 
 	if (req->state == NVME_TCP_SEND_CMD_PDU) {
+		if (!nvme_tcp_has_inline_data(req)) {
+			ret = nvme_tcp_try_send_cmd_batch(queue);
+			goto done;
+		}
 		ret = nvme_tcp_try_send_cmd_pdu(req);
 		if (ret <= 0)
 			goto done;
-		if (!nvme_tcp_has_inline_data(req))
-			return ret;
 	}
 
 	if (req->state == NVME_TCP_SEND_H2C_PDU) {
@@ -1348,20 +1430,66 @@ static bool nvme_tcp_poll_queue(struct nvme_tcp_queue *queue)
 			  ctrl->io_queues[HCTX_TYPE_POLL];
 }
 
+/*
+ * Run io_work on one of the CPUs blk-mq maps to the queue, so that requests
+ * are sent directly from the submitting context as often as possible, and
+ * spread the queues of all controllers evenly over those CPUs.  Between
+ * equally loaded CPUs, prefer one sharing the LLC with the CPU that the NIC
+ * steered the connection's receive traffic to.
+ */
 static void nvme_tcp_set_queue_io_cpu(struct nvme_tcp_queue *queue)
 {
 	struct nvme_tcp_ctrl *ctrl = queue->ctrl;
+	struct blk_mq_tag_set *set = &ctrl->tag_set;
+	int rx_cpu = READ_ONCE(queue->sock->sk->sk_incoming_cpu);
 	int qid = nvme_tcp_queue_id(queue);
+	int cpu, io_cpu = -1, min_queues = INT_MAX;
+	unsigned int *mq_map = NULL;
+	bool io_cpu_llc = false;
 	int n = 0;
 
-	if (nvme_tcp_default_queue(queue))
+	if (nvme_tcp_default_queue(queue)) {
 		n = qid - 1;
-	else if (nvme_tcp_read_queue(queue))
+		mq_map = set->map[HCTX_TYPE_DEFAULT].mq_map;
+	} else if (nvme_tcp_read_queue(queue)) {
 		n = qid - ctrl->io_queues[HCTX_TYPE_DEFAULT] - 1;
-	else if (nvme_tcp_poll_queue(queue))
+		mq_map = set->map[HCTX_TYPE_READ].mq_map;
+	} else if (nvme_tcp_poll_queue(queue)) {
 		n = qid - ctrl->io_queues[HCTX_TYPE_DEFAULT] -
 				ctrl->io_queues[HCTX_TYPE_READ] - 1;
-	queue->io_cpu = cpumask_next_wrap(n - 1, cpu_online_mask, -1, false);
+		mq_map = set->map[HCTX_TYPE_POLL].mq_map;
+	}
+
+	/* The mapping may be stale until a reconnect updated nr_hw_queues */
+	if (mq_map && ctrl->ctrl.tagset) {
+		for_each_online_cpu(cpu) {
+			int nr = atomic_read(&nvme_tcp_cpu_queues[cpu]);
+			bool llc = rx_cpu >= 0 && cpus_share_cache(cpu, rx_cpu);
+
+			if (mq_map[cpu] != qid - 1)
+				continue;
+			if (nr < min_queues ||
+			    (nr == min_queues && llc && !io_cpu_llc)) {
+				io_cpu = cpu;
+				min_queues = nr;
+				io_cpu_llc = llc;
+			}
+		}
+	}
+
+	if (io_cpu < 0)
+		io_cpu = cpumask_next_wrap(n - 1, cpu_online_mask, -1, false);
+
+	queue->io_cpu = io_cpu;
+	atomic_inc(&nvme_tcp_cpu_queues[io_cpu]);
+	set_bit(NVME_TCP_Q_IO_CPU_SET, &queue->flags);
+}
+
+static void nvme_tcp_clear_queue_io_cpu(struct nvme_tcp_queue *queue)
+{
+	if (test_and_clear_bit(NVME_TCP_Q_IO_CPU_SET, &queue->flags))
+		atomic_dec(&nvme_tcp_cpu_queues[queue->io_cpu]);
+	queue->io_cpu = WORK_CPU_UNBOUND;
 }
 
 static int nvme_tcp_alloc_queue(struct nvme_ctrl *nctrl,
@@ -1416,7 +1544,8 @@ static int nvme_tcp_alloc_queue(struct nvme_ctrl *nctrl,
 	queue->sock->sk->sk_rcvtimeo = 10 * HZ;
 
 	queue->sock->sk->sk_allocation = GFP_ATOMIC;
-	nvme_tcp_set_queue_io_cpu(queue);
+	/* Until the queue is started and mapped to a CPU */
+	queue->io_cpu = WORK_CPU_UNBOUND;
 	queue->request = NULL;
 	queue->data_remaining = 0;
 	queue->ddgst_remaining = 0;
@@ -1518,6 +1647,7 @@ static void __nvme_tcp_stop_queue(struct nvme_tcp_queue *queue)
 	kernel_sock_shutdown(queue->sock, SHUT_RDWR);
 	nvme_tcp_restore_sock_calls(queue);
 	cancel_work_sync(&queue->io_work);
+	nvme_tcp_clear_queue_io_cpu(queue);
 }
 
 static void nvme_tcp_stop_queue(struct nvme_ctrl *nctrl, int qid)
@@ -1536,6 +1666,8 @@ static int nvme_tcp_start_queue(struct nvme_ctrl *nctrl, int idx)
 	struct nvme_tcp_ctrl *ctrl = to_tcp_ctrl(nctrl);
 	int ret;
 
+	nvme_tcp_set_queue_io_cpu(&ctrl->queues[idx]);
+
 	if (idx)
 		ret = nvmf_connect_io_queue(nctrl, idx, false);
 	else
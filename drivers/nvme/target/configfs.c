@@ -570,6 +570,59 @@ static ssize_t nvmet_ns_buffered_io_store(struct config_item *item,
 
 CONFIGFS_ATTR(nvmet_ns_, buffered_io);
 
+static ssize_t nvmet_ns_poll_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", to_nvmet_ns(item)->use_poll);
+}
+
+static ssize_t nvmet_ns_poll_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_ns *ns = to_nvmet_ns(item);
+	bool val;
+
+	if (strtobool(page, &val))
+		return -EINVAL;
+
+	mutex_lock(&ns->subsys->lock);
+	if (ns->enabled) {
+		pr_err("disable ns before setting poll value.\n");
+		mutex_unlock(&ns->subsys->lock);
+		return -EINVAL;
+	}
+
+	ns->use_poll = val;
+	mutex_unlock(&ns->subsys->lock);
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_ns_, poll);
+
+static ssize_t nvmet_ns_latency_histogram_show(struct config_item *item,
+		char *page)
+{
+	struct nvmet_ns *ns = to_nvmet_ns(item);
+	ssize_t len = 0;
+	int cpu, i;
+
+	for (i = 0; i < NVMET_LAT_BUCKETS; i++) {
+		u64 sum = 0;
+
+		for_each_possible_cpu(cpu)
+			sum += per_cpu_ptr(ns->lat_hist, cpu)[i];
+
+		if (i < NVMET_LAT_BUCKETS - 1)
+			len += snprintf(page + len, PAGE_SIZE - len,
+					"<%lu %llu\n", 1UL << i, sum);
+		else
+			len += snprintf(page + len, PAGE_SIZE - len,
+					">=%lu %llu\n", 1UL << (i - 1), sum);
+	}
+	return len;
+}
+
+CONFIGFS_ATTR_RO(nvmet_ns_, latency_histogram);
+
 static ssize_t nvmet_ns_revalidate_size_store(struct config_item *item,
 		const char *page, size_t count)
 {
@@ -602,6 +655,8 @@ static struct configfs_attribute *nvmet_ns_attrs[] = {
 	&nvmet_ns_attr_ana_grpid,
 	&nvmet_ns_attr_enable,
 	&nvmet_ns_attr_buffered_io,
+	&nvmet_ns_attr_poll,
+	&nvmet_ns_attr_latency_histogram,
 	&nvmet_ns_attr_revalidate_size,
 #ifdef CONFIG_PCI_P2PDMA
 	&nvmet_ns_attr_p2pmem,
@@ -651,6 +651,7 @@ void nvmet_ns_free(struct nvmet_ns *ns)
 	nvmet_ana_group_enabled[ns->anagrpid]--;
 	up_write(&nvmet_ana_sem);
 
+	free_percpu(ns->lat_hist);
 	kfree(ns->device_path);
 	kfree(ns);
 }
@@ -663,6 +664,13 @@ struct nvmet_ns *nvmet_ns_alloc(struct nvmet_subsys *subsys, u32 nsid)
 	if (!ns)
 		return NULL;
 
+	ns->lat_hist = __alloc_percpu(sizeof(u64) * NVMET_LAT_BUCKETS,
+				      __alignof__(u64));
+	if (!ns->lat_hist) {
+		kfree(ns);
+		return NULL;
+	}
+
 	init_completion(&ns->disable_done);
 
 	ns->nsid = nsid;
@@ -722,6 +730,14 @@ static void nvmet_set_error(struct nvmet_req *req, u16 status)
 	req->cqe->status |= cpu_to_le16(1 << 14);
 }
 
+static void nvmet_ns_account_latency(struct nvmet_req *req)
+{
+	u64 usecs = div_u64(ktime_get_ns() - req->start_ns, NSEC_PER_USEC);
+	int bucket = min_t(int, fls64(usecs), NVMET_LAT_BUCKETS - 1);
+
+	this_cpu_inc(req->ns->lat_hist[bucket]);
+}
+
 static void __nvmet_req_complete(struct nvmet_req *req, u16 status)
 {
 	if (!req->sq->sqhd_disabled)
@@ -734,8 +750,11 @@ static void __nvmet_req_complete(struct nvmet_req *req, u16 status)
 
 	trace_nvmet_req_complete(req);
 
-	if (req->ns)
+	if (req->ns) {
+		if (req->sq->qid)
+			nvmet_ns_account_latency(req);
 		nvmet_put_namespace(req->ns);
+	}
 	req->ops->queue_response(req);
 }
 
@@ -784,6 +803,9 @@ void nvmet_sq_destroy(struct nvmet_sq *sq)
 		nvmet_async_events_failall(ctrl);
 	percpu_ref_kill_and_confirm(&sq->ref, nvmet_confirm_sq);
 	wait_for_completion(&sq->confirm_done);
+	/* The transport no longer polls, reap outstanding polled I/O here */
+	while (nvmet_sq_poll(sq))
+		cond_resched();
 	wait_for_completion(&sq->free_done);
 	percpu_ref_exit(&sq->ref);
 
@@ -812,11 +834,53 @@ int nvmet_sq_init(struct nvmet_sq *sq)
 	}
 	init_completion(&sq->free_done);
 	init_completion(&sq->confirm_done);
+	spin_lock_init(&sq->poll_lock);
+	INIT_LIST_HEAD(&sq->poll_list);
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(nvmet_sq_init);
 
+/**
+ * nvmet_sq_poll - reap polled I/O of a submission queue
+ * @sq: the submission queue
+ *
+ * Transports setting NVMF_POLLED_IO call this from the context their queue
+ * is processed in, which then also runs the completions of namespaces in
+ * polling mode.  The backing queues of all namespaces with outstanding
+ * polled I/O are polled in turn.
+ *
+ * Returns true as long as polled I/O is outstanding on @sq.
+ */
+bool nvmet_sq_poll(struct nvmet_sq *sq)
+{
+	blk_qc_t cookie = BLK_QC_T_NONE;
+	struct nvmet_ns *ns = NULL;
+	struct nvmet_req *req;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sq->poll_lock, flags);
+	req = list_first_entry_or_null(&sq->poll_list, struct nvmet_req,
+				       b.poll_entry);
+	if (req) {
+		ns = req->ns;
+		cookie = req->b.cookie;
+		/* keeps ns->bdev around once the request completed */
+		percpu_ref_get(&ns->ref);
+		list_rotate_left(&sq->poll_list);
+	}
+	spin_unlock_irqrestore(&sq->poll_lock, flags);
+
+	if (!req)
+		return false;
+
+	if (blk_qc_t_valid(cookie))
+		blk_poll(bdev_get_queue(ns->bdev), cookie, false);
+	nvmet_put_namespace(ns);
+	return true;
+}
+EXPORT_SYMBOL_GPL(nvmet_sq_poll);
+
 static inline u16 nvmet_check_ana_state(struct nvmet_port *port,
 		struct nvmet_ns *ns)
 {
@@ -900,6 +964,8 @@ bool nvmet_req_init(struct nvmet_req *req, struct nvmet_cq *cq,
 	req->ns = NULL;
 	req->error_loc = NVMET_NO_ERROR_LOC;
 	req->error_slba = 0;
+	if (sq->qid)
+		req->start_ns = ktime_get_ns();
 
 	trace_nvmet_req_init(req, req->cmd);
 
@@ -86,6 +86,11 @@ int nvmet_bdev_ns_enable(struct nvmet_ns *ns)
 	if (IS_ENABLED(CONFIG_BLK_DEV_INTEGRITY_T10))
 		nvmet_bdev_ns_enable_integrity(ns);
 
+	ns->poll = ns->use_poll &&
+		test_bit(QUEUE_FLAG_POLL, &bdev_get_queue(ns->bdev)->queue_flags);
+	if (ns->use_poll && !ns->poll)
+		pr_info("%s has no poll queues, not polling\n", ns->device_path);
+
 	return 0;
 }
 
@@ -160,10 +165,23 @@ static u16 blk_to_nvme_status(struct nvmet_req *req, blk_status_t blk_sts)
 	return status;
 }
 
+static void nvmet_bdev_poll_del(struct nvmet_req *req)
+{
+	struct nvmet_sq *sq = req->sq;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sq->poll_lock, flags);
+	list_del(&req->b.poll_entry);
+	req->b.polled = false;
+	spin_unlock_irqrestore(&sq->poll_lock, flags);
+}
+
 static void nvmet_bio_done(struct bio *bio)
 {
 	struct nvmet_req *req = bio->bi_private;
 
+	if (req->b.polled)
+		nvmet_bdev_poll_del(req);
 	nvmet_req_complete(req, blk_to_nvme_status(req, bio->bi_status));
 	if (bio != &req->b.inline_bio)
 		bio_put(bio);
@@ -234,6 +252,7 @@ static void nvmet_bdev_execute_rw(struct nvmet_req *req)
 	int op, i, rc;
 	struct sg_mapping_iter prot_miter;
 	unsigned int iter_flags;
+	blk_qc_t cookie;
 	unsigned int total_len = nvmet_rw_data_len(req) + req->metadata_len;
 
 	if (!nvmet_check_transfer_len(req, total_len))
@@ -257,6 +276,20 @@ static void nvmet_bdev_execute_rw(struct nvmet_req *req)
 	if (is_pci_p2pdma_page(sg_page(req->sg)))
 		op |= REQ_NOMERGE;
 
+	/*
+	 * Polled I/O goes to the poll queues of the backing device and is
+	 * reaped by the transport from the context owning the queue, so the
+	 * completion neither takes an interrupt nor bounces to a workqueue.
+	 */
+	req->b.polled = req->ns->poll && (req->ops->flags & NVMF_POLLED_IO);
+	if (req->b.polled) {
+		op |= REQ_HIPRI;
+		req->b.cookie = BLK_QC_T_NONE;
+		spin_lock_irq(&req->sq->poll_lock);
+		list_add_tail(&req->b.poll_entry, &req->sq->poll_list);
+		spin_unlock_irq(&req->sq->poll_lock);
+	}
+
 	sector = le64_to_cpu(req->cmd->rw.slba);
 	sector <<= (req->ns->blksize_shift - 9);
 
@@ -312,8 +345,16 @@ static void nvmet_bdev_execute_rw(struct nvmet_req *req)
 		}
 	}
 
-	submit_bio(bio);
+	cookie = submit_bio(bio);
 	blk_finish_plug(&plug);
+
+	if (req->b.polled) {
+		/* chained bios all went to the hctx of this CPU */
+		spin_lock_irq(&req->sq->poll_lock);
+		if (req->b.polled)
+			req->b.cookie = cookie;
+		spin_unlock_irq(&req->sq->poll_lock);
+	}
 }
 
 static void nvmet_bdev_execute_flush(struct nvmet_req *req)
@@ -435,6 +476,8 @@ u16 nvmet_bdev_parse_io_cmd(struct nvmet_req *req)
 {
 	struct nvme_command *cmd = req->cmd;
 
+	req->b.polled = false;
+
 	switch (cmd->common.opcode) {
 	case nvme_cmd_read:
 	case nvme_cmd_write:
@@ -28,6 +28,12 @@
 #define NVMET_NO_ERROR_LOC		((u16)-1)
 #define NVMET_DEFAULT_CTRL_MODEL	"Linux"
 
+/*
+ * Latency histogram buckets: bucket i counts I/O commands that completed
+ * in less than 2^i usecs, the last one everything slower.
+ */
+#define NVMET_LAT_BUCKETS		20
+
 /*
  * Supported optional AENs:
  */
@@ -81,6 +87,10 @@ struct nvmet_ns {
 	struct pci_dev		*p2p_dev;
 	int			pi_type;
 	int			metadata_size;
+
+	bool			use_poll;
+	bool			poll;
+	u64 __percpu		*lat_hist;
 };
 
 static inline struct nvmet_ns *to_nvmet_ns(struct config_item *item)
@@ -107,6 +117,10 @@ struct nvmet_sq {
 	bool			sqhd_disabled;
 	struct completion	free_done;
 	struct completion	confirm_done;
+
+	/* polled I/O waiting to be reaped by nvmet_sq_poll() */
+	spinlock_t		poll_lock;
+	struct list_head	poll_list;
 };
 
 struct nvmet_ana_group {
@@ -296,6 +310,7 @@ struct nvmet_fabrics_ops {
 	unsigned int flags;
 #define NVMF_KEYED_SGLS			(1 << 0)
 #define NVMF_METADATA_SUPPORTED		(1 << 1)
+#define NVMF_POLLED_IO			(1 << 2) /* calls nvmet_sq_poll() */
 	void (*queue_response)(struct nvmet_req *req);
 	int (*add_port)(struct nvmet_port *port);
 	void (*remove_port)(struct nvmet_port *port);
@@ -322,6 +337,9 @@ struct nvmet_req {
 	union {
 		struct {
 			struct bio      inline_bio;
+			struct list_head poll_entry;
+			blk_qc_t	cookie;
+			bool		polled;
 		} b;
 		struct {
 			bool			mpool_alloc;
@@ -350,6 +368,7 @@ struct nvmet_req {
 	struct device		*p2p_client;
 	u16			error_loc;
 	u64			error_slba;
+	u64			start_ns;
 };
 
 extern struct workqueue_struct *buffered_io_wq;
@@ -423,6 +442,7 @@ void nvmet_sq_setup(struct nvmet_ctrl *ctrl, struct nvmet_sq *sq, u16 qid,
 		u16 size);
 void nvmet_sq_destroy(struct nvmet_sq *sq);
 int nvmet_sq_init(struct nvmet_sq *sq);
+bool nvmet_sq_poll(struct nvmet_sq *sq);
 
 void nvmet_ctrl_fatal_error(struct nvmet_ctrl *ctrl);
 
@@ -13,7 +13,9 @@
 #include <net/tcp.h>
 #include <linux/inet.h>
 #include <linux/llist.h>
+#include <linux/sched/topology.h>
 #include <crypto/hash.h>
+#include <net/busy_poll.h>
 
 #include "nvmet.h"
 
@@ -29,10 +31,23 @@ static int so_priority;
 module_param(so_priority, int, 0644);
 MODULE_PARM_DESC(so_priority, "nvmet tcp socket optimize priority");
 
+/*
+ * Keep io_work polling a queue that saw traffic for this long after it went
+ * idle, busy polling the NIC's receive queue for the socket where supported,
+ * instead of waiting for the next data_ready callback.
+ */
+static int idle_poll_period_usecs;
+module_param(idle_poll_period_usecs, int, 0644);
+MODULE_PARM_DESC(idle_poll_period_usecs,
+		"nvmet tcp io_work poll till idle time period in usecs");
+
 #define NVMET_TCP_RECV_BUDGET		8
 #define NVMET_TCP_SEND_BUDGET		8
 #define NVMET_TCP_IO_WORK_BUDGET	64
 
+/* Every PDU accepted from the host has at least this long a header */
+#define NVMET_TCP_MIN_PDU_LEN		sizeof(struct nvme_tcp_data_pdu)
+
 enum nvmet_tcp_send_state {
 	NVMET_TCP_SEND_DATA_PDU,
 	NVMET_TCP_SEND_DATA,
@@ -95,6 +110,7 @@ struct nvmet_tcp_queue {
 	struct nvmet_tcp_port	*port;
 	struct work_struct	io_work;
 	int			cpu;
+	unsigned long		poll_end;
 	struct nvmet_cq		nvme_cq;
 	struct nvmet_sq		nvme_sq;
 
@@ -152,6 +168,9 @@ static DEFINE_IDA(nvmet_tcp_queue_ida);
 static LIST_HEAD(nvmet_tcp_queue_list);
 static DEFINE_MUTEX(nvmet_tcp_queue_mutex);
 
+/* Number of queues whose io_work runs on each CPU */
+static atomic_t nvmet_tcp_cpu_queues[NR_CPUS];
+
 static struct workqueue_struct *nvmet_tcp_wq;
 static const struct nvmet_fabrics_ops nvmet_tcp_ops;
 static void nvmet_tcp_free_cmd(struct nvmet_tcp_cmd *c);
@@ -608,6 +627,84 @@ static int nvmet_try_send_response(struct nvmet_tcp_cmd *cmd,
 	return 1;
 }
 
+/*
+ * Send the response of the current command together with those of the
+ * commands behind it that have nothing but a response to send, e.g. write
+ * completions, in a single sendmsg().
+ */
+static int nvmet_try_send_responses(struct nvmet_tcp_queue *queue,
+		bool last_in_batch)
+{
+	struct nvmet_tcp_cmd *cmds[NVMET_TCP_SEND_BUDGET];
+	struct kvec iov[NVMET_TCP_SEND_BUDGET];
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+	u8 hdgst = nvmet_tcp_hdgst_len(queue);
+	int i, nr = 0, ret;
+	size_t len = 0;
+
+	cmds[nr++] = queue->snd_cmd;
+	while (nr < NVMET_TCP_SEND_BUDGET) {
+		struct nvmet_tcp_cmd *cmd;
+
+		if (list_empty(&queue->resp_send_list))
+			nvmet_tcp_process_resp_list(queue);
+		cmd = list_first_entry_or_null(&queue->resp_send_list,
+				struct nvmet_tcp_cmd, entry);
+		if (!cmd || nvmet_tcp_need_data_out(cmd) ||
+		    nvmet_tcp_need_data_in(cmd))
+			break;
+
+		list_del_init(&cmd->entry);
+		queue->send_list_len--;
+		nvmet_setup_response_pdu(cmd);
+		cmds[nr++] = cmd;
+	}
+
+	if (nr == 1)
+		return nvmet_try_send_response(queue->snd_cmd, last_in_batch);
+
+	for (i = 0; i < nr; i++) {
+		iov[i].iov_base = (void *)cmds[i]->rsp_pdu + cmds[i]->offset;
+		iov[i].iov_len = sizeof(*cmds[i]->rsp_pdu) + hdgst -
+				 cmds[i]->offset;
+		len += iov[i].iov_len;
+	}
+
+	if (!last_in_batch && queue->send_list_len)
+		msg.msg_flags |= MSG_MORE;
+	else
+		msg.msg_flags |= MSG_EOR;
+
+	ret = kernel_sendmsg(queue->sock, &msg, iov, nr, len);
+	if (unlikely(ret <= 0)) {
+		i = 0;
+		goto requeue;
+	}
+
+	for (i = 0; i < nr && ret >= iov[i].iov_len; i++) {
+		ret -= iov[i].iov_len;
+		kfree(cmds[i]->iov);
+		sgl_free(cmds[i]->req.sg);
+		nvmet_tcp_put_cmd(cmds[i]);
+	}
+
+	if (i == nr) {
+		queue->snd_cmd = NULL;
+		return 1;
+	}
+
+	/* The first command not fully sent becomes the current one */
+	queue->snd_cmd = cmds[i];
+	cmds[i]->offset += ret;
+	ret = i ? 1 : -EAGAIN;
+requeue:
+	while (--nr > i) {
+		list_add(&cmds[nr]->entry, &queue->resp_send_list);
+		queue->send_list_len++;
+	}
+	return ret;
+}
+
 static int nvmet_try_send_r2t(struct nvmet_tcp_cmd *cmd, bool last_in_batch)
 {
 	u8 hdgst = nvmet_tcp_hdgst_len(cmd->queue);
@@ -701,7 +798,7 @@ static int nvmet_tcp_try_send_one(struct nvmet_tcp_queue *queue,
 	}
 
 	if (cmd->state == NVMET_TCP_SEND_RESPONSE)
-		ret = nvmet_try_send_response(cmd, last_in_batch);
+		ret = nvmet_try_send_responses(queue, last_in_batch);
 
 done_send:
 	if (ret < 0) {
@@ -735,7 +832,7 @@ done:
 static void nvmet_prepare_receive_pdu(struct nvmet_tcp_queue *queue)
 {
 	queue->offset = 0;
-	queue->left = sizeof(struct nvme_tcp_hdr);
+	queue->left = NVMET_TCP_MIN_PDU_LEN;
 	queue->cmd = NULL;
 	queue->rcv_state = NVMET_TCP_RECV_PDU;
 }
@@ -1011,7 +1108,8 @@ recv:
 	if (queue->left)
 		return -EAGAIN;
 
-	if (queue->offset == sizeof(struct nvme_tcp_hdr)) {
+	/* Read the shortest header first, it saves a call for H2C data PDUs */
+	if (queue->offset == NVMET_TCP_MIN_PDU_LEN) {
 		u8 hdgst = nvmet_tcp_hdgst_len(queue);
 
 		if (unlikely(!nvmet_tcp_pdu_valid(hdr->type))) {
@@ -1026,7 +1124,8 @@ recv:
 		}
 
 		queue->left = hdr->hlen - queue->offset + hdgst;
-		goto recv;
+		if (queue->left)
+			goto recv;
 	}
 
 	if (queue->hdr_digest &&
@@ -1187,6 +1286,19 @@ static void nvmet_tcp_schedule_release_queue(struct nvmet_tcp_queue *queue)
 	spin_unlock(&queue->state_lock);
 }
 
+static bool nvmet_tcp_check_queue_deadline(struct nvmet_tcp_queue *queue,
+		int ops)
+{
+	int period = READ_ONCE(idle_poll_period_usecs);
+
+	if (period <= 0)
+		return false;
+
+	if (ops)
+		queue->poll_end = jiffies + usecs_to_jiffies(period);
+	return !time_after(jiffies, queue->poll_end);
+}
+
 static void nvmet_tcp_io_work(struct work_struct *w)
 {
 	struct nvmet_tcp_queue *queue =
@@ -1209,12 +1321,19 @@ static void nvmet_tcp_io_work(struct work_struct *w)
 		else if (ret < 0)
 			return;
 
+		/* Reap polled namespace I/O, the responses go out next round */
+		if (nvmet_sq_poll(&queue->nvme_sq)) {
+			pending = true;
+			ops++;
+		}
+
 	} while (pending && ops < NVMET_TCP_IO_WORK_BUDGET);
 
 	/*
-	 * We exahusted our budget, requeue our selves
+	 * We exahusted our budget or are still within the idle poll period,
+	 * requeue our selves
 	 */
-	if (pending)
+	if (pending || nvmet_tcp_check_queue_deadline(queue, ops))
 		queue_work_on(queue->cpu, nvmet_tcp_wq, &queue->io_work);
 }
 
@@ -1359,6 +1478,7 @@ static void nvmet_tcp_release_queue_work(struct work_struct *w)
 	nvmet_tcp_uninit_data_in_cmds(queue);
 	nvmet_sq_destroy(&queue->nvme_sq);
 	cancel_work_sync(&queue->io_work);
+	atomic_dec(&nvmet_tcp_cpu_queues[queue->cpu]);
 	sock_release(queue->sock);
 	nvmet_tcp_free_cmds(queue);
 	if (queue->hdr_digest || queue->data_digest)
@@ -1456,6 +1576,12 @@ static int nvmet_tcp_set_queue_sock(struct nvmet_tcp_queue *queue)
 	if (inet->rcv_tos > 0)
 		ip_sock_set_tos(sock->sk, inet->rcv_tos);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* Non-blocking receives then poll the NIC queue of the socket once */
+	if (idle_poll_period_usecs > 0)
+		WRITE_ONCE(sock->sk->sk_ll_usec, 1);
+#endif
+
 	write_lock_bh(&sock->sk->sk_callback_lock);
 	sock->sk->sk_user_data = queue;
 	queue->data_ready = sock->sk->sk_data_ready;
@@ -1469,6 +1595,40 @@ static int nvmet_tcp_set_queue_sock(struct nvmet_tcp_queue *queue)
 	return 0;
 }
 
+/*
+ * Run io_work in the LLC the NIC delivers the connection's packets to, on
+ * the CPU there that serves the fewest queues, so that the receive softirq,
+ * io_work and the transmit path share a cache.  Without a known receive
+ * CPU, spread the queues of the port over all online CPUs.
+ */
+static void nvmet_tcp_set_queue_cpu(struct nvmet_tcp_queue *queue)
+{
+	struct nvmet_tcp_port *port = queue->port;
+	int rx_cpu = READ_ONCE(queue->sock->sk->sk_incoming_cpu);
+	int cpu, min_queues = INT_MAX;
+
+	queue->cpu = -1;
+	if (rx_cpu >= 0 && rx_cpu < nr_cpu_ids && cpu_online(rx_cpu)) {
+		for_each_online_cpu(cpu) {
+			int nr = atomic_read(&nvmet_tcp_cpu_queues[cpu]);
+
+			if (!cpus_share_cache(cpu, rx_cpu))
+				continue;
+			if (nr < min_queues) {
+				queue->cpu = cpu;
+				min_queues = nr;
+			}
+		}
+	}
+
+	if (queue->cpu < 0) {
+		port->last_cpu = cpumask_next_wrap(port->last_cpu,
+					cpu_online_mask, -1, false);
+		queue->cpu = port->last_cpu;
+	}
+	atomic_inc(&nvmet_tcp_cpu_queues[queue->cpu]);
+}
+
 static int nvmet_tcp_alloc_queue(struct nvmet_tcp_port *port,
 		struct socket *newsock)
 {
@@ -1504,9 +1664,7 @@ static int nvmet_tcp_alloc_queue(struct nvmet_tcp_port *port,
 	if (ret)
 		goto out_free_connect;
 
-	port->last_cpu = cpumask_next_wrap(port->last_cpu,
-				cpu_online_mask, -1, false);
-	queue->cpu = port->last_cpu;
+	nvmet_tcp_set_queue_cpu(queue);
 	nvmet_prepare_receive_pdu(queue);
 
 	mutex_lock(&nvmet_tcp_queue_mutex);
@@ -1524,6 +1682,7 @@ out_destroy_sq:
 	mutex_lock(&nvmet_tcp_queue_mutex);
 	list_del_init(&queue->queue_list);
 	mutex_unlock(&nvmet_tcp_queue_mutex);
+	atomic_dec(&nvmet_tcp_cpu_queues[queue->cpu]);
 	nvmet_sq_destroy(&queue->nvme_sq);
 out_free_connect:
 	nvmet_tcp_free_cmd(&queue->connect);
@@ -1711,6 +1870,7 @@ static const struct nvmet_fabrics_ops nvmet_tcp_ops = {
 	.owner			= THIS_MODULE,
 	.type			= NVMF_TRTYPE_TCP,
 	.msdbd			= 1,
+	.flags			= NVMF_POLLED_IO,
 	.add_port		= nvmet_tcp_add_port,
 	.remove_port		= nvmet_tcp_remove_port,
 	.queue_response		= nvmet_tcp_queue_response,
@@ -53,9 +53,44 @@ static void pci_msi_teardown_msi_irqs(struct pci_dev *dev)
 	else
 		arch_teardown_msi_irqs(dev);
 }
+
+static int pci_msi_setup_msi_irq(struct pci_dev *dev, struct msi_desc *desc)
+{
+	struct irq_domain *domain;
+
+	domain = dev_get_msi_domain(&dev->dev);
+	if (domain && irq_domain_is_hierarchy(domain))
+		return msi_domain_alloc_irq_desc(domain, &dev->dev, desc);
+
+	return arch_setup_msi_irq(dev, desc);
+}
+
+static void pci_msi_teardown_msi_irq(struct pci_dev *dev, struct msi_desc *desc)
+{
+	struct irq_domain *domain;
+
+	domain = dev_get_msi_domain(&dev->dev);
+	if (domain && irq_domain_is_hierarchy(domain)) {
+		msi_domain_free_irq_desc(domain, desc);
+	} else {
+		arch_teardown_msi_irq(desc->irq);
+		desc->irq = 0;
+	}
+}
 #else
 #define pci_msi_setup_msi_irqs		arch_setup_msi_irqs
 #define pci_msi_teardown_msi_irqs	arch_teardown_msi_irqs
+
+static int pci_msi_setup_msi_irq(struct pci_dev *dev, struct msi_desc *desc)
+{
+	return arch_setup_msi_irq(dev, desc);
+}
+
+static void pci_msi_teardown_msi_irq(struct pci_dev *dev, struct msi_desc *desc)
+{
+	arch_teardown_msi_irq(desc->irq);
+	desc->irq = 0;
+}
 #endif
 
 /* Arch hooks */
@@ -1280,6 +1315,110 @@ int pci_irq_vector(struct pci_dev *dev, unsigned int nr)
 }
 EXPORT_SYMBOL(pci_irq_vector);
 
+/**
+ * pci_msix_alloc_irq_at - Allocate an MSI-X vector after the initial allocation
+ * @dev:	PCI device with MSI-X enabled
+ * @index:	MSI-X table entry to use
+ * @affdesc:	Optional affinity descriptor for the new interrupt
+ *
+ * Lets drivers start with a small set of vectors from
+ * pci_alloc_irq_vectors() and add individual MSI-X entries as they bring up
+ * more queues.  The entry is inserted in table order, so pci_irq_vector()
+ * indices of entries above @index shift by one.  The new entry stays masked
+ * until the interrupt is requested.
+ *
+ * Calls must be serialized against each other and against
+ * pci_msix_free_irq() by the caller.
+ *
+ * Return: the Linux interrupt number on success, a negative error code
+ * otherwise.
+ */
+int pci_msix_alloc_irq_at(struct pci_dev *dev, unsigned int index,
+			  const struct irq_affinity_desc *affdesc)
+{
+	struct list_head *msi_list = dev_to_msi_list(&dev->dev);
+	struct msi_desc *entry, *pos;
+	void __iomem *desc_addr;
+	int ret;
+
+	if (!dev->msix_enabled || index >= pci_msix_vec_count(dev))
+		return -EINVAL;
+
+	for_each_pci_msi_entry(pos, dev) {
+		if (pos->msi_attrib.entry_nr == index)
+			return -EBUSY;
+	}
+
+	entry = alloc_msi_entry(&dev->dev, 1, affdesc);
+	if (!entry)
+		return -ENOMEM;
+
+	entry->msi_attrib.is_msix	= 1;
+	entry->msi_attrib.is_64		= 1;
+	entry->msi_attrib.is_dynamic	= 1;
+	entry->msi_attrib.entry_nr	= index;
+	entry->msi_attrib.default_irq	= dev->irq;
+	entry->mask_base		= first_pci_msi_entry(dev)->mask_base;
+
+	/* Keep the list in table order for pci_irq_vector() */
+	list_for_each_entry(pos, msi_list, list) {
+		if (pos->msi_attrib.entry_nr > index)
+			break;
+	}
+	list_add_tail(&entry->list, &pos->list);
+
+	ret = pci_msi_setup_msi_irq(dev, entry);
+	if (ret > 0)
+		ret = -ENOSPC;
+	if (ret)
+		goto out_free;
+
+	ret = msi_verify_entries(dev);
+	if (ret)
+		goto out_teardown;
+
+	desc_addr = pci_msix_desc_addr(entry);
+	if (desc_addr)
+		entry->masked = readl(desc_addr + PCI_MSIX_ENTRY_VECTOR_CTRL);
+	else
+		entry->masked = 0;
+	msix_mask_irq(entry, 1);
+
+	return entry->irq;
+
+out_teardown:
+	pci_msi_teardown_msi_irq(dev, entry);
+out_free:
+	list_del(&entry->list);
+	free_msi_entry(entry);
+	return ret;
+}
+
+/**
+ * pci_msix_free_irq - Free an MSI-X vector allocated by pci_msix_alloc_irq_at()
+ * @dev:	PCI device the vector belongs to
+ * @irq:	Linux interrupt number returned by pci_msix_alloc_irq_at()
+ *
+ * The interrupt must have been freed with free_irq() already.  Vectors from
+ * the initial allocation are released by pci_free_irq_vectors() only.
+ */
+void pci_msix_free_irq(struct pci_dev *dev, int irq)
+{
+	struct msi_desc *entry = irq_get_msi_desc(irq);
+
+	if (WARN_ON_ONCE(!entry || msi_desc_to_pci_dev(entry) != dev ||
+			 !entry->msi_attrib.is_dynamic))
+		return;
+
+	if (WARN_ON_ONCE(irq_has_action(irq)))
+		return;
+
+	msix_mask_irq(entry, 1);
+	pci_msi_teardown_msi_irq(dev, entry);
+	list_del(&entry->list);
+	free_msi_entry(entry);
+}
+
 /**
  * pci_irq_get_affinity - return the affinity of a particular MSI vector
  * @dev:	PCI device to operate on
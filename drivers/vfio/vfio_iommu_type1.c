@@ -28,6 +28,7 @@
 #include <linux/module.h>
 #include <linux/mm.h>
 #include <linux/kthread.h>
+#include <linux/padata.h>
 #include <linux/rbtree.h>
 #include <linux/sched/signal.h>
 #include <linux/sched/mm.h>
@@ -61,6 +62,11 @@ module_param_named(dma_entry_limit, dma_entry_limit, uint, 0644);
 MODULE_PARM_DESC(dma_entry_limit,
 		 "Maximum number of user DMA mappings per container (65535).");
 
+static unsigned int prefault_max_threads __read_mostly = 16;
+module_param_named(prefault_max_threads, prefault_max_threads, uint, 0644);
+MODULE_PARM_DESC(prefault_max_threads,
+		 "Maximum number of threads faulting in a large DMA mapping before it is pinned, 0 disables (16).");
+
 struct vfio_iommu {
 	struct list_head	domain_list;
 	struct list_head	iova_list;
@@ -120,6 +126,16 @@ struct vfio_pfn {
 	unsigned int		ref_count;
 };
 
+#define VFIO_BATCH_MAX_CAPACITY	(PAGE_SIZE / sizeof(struct page *))
+
+struct vfio_batch {
+	struct page		**pages;	/* for pin_user_pages_remote */
+	struct page		*fallback_page; /* if pages alloc fails */
+	int			capacity;	/* length of pages array */
+	int			size;		/* of batch currently */
+	int			offset;		/* of next entry in pages */
+};
+
 struct vfio_regions {
 	struct list_head list;
 	dma_addr_t iova;
@@ -415,6 +431,68 @@ static int put_pfn(unsigned long pfn, int prot)
 	return 0;
 }
 
+static void vfio_batch_init(struct vfio_batch *batch)
+{
+	batch->size = 0;
+	batch->offset = 0;
+
+	if (unlikely(disable_hugepages))
+		goto fallback;
+
+	batch->pages = (struct page **) __get_free_page(GFP_KERNEL);
+	if (!batch->pages)
+		goto fallback;
+
+	batch->capacity = VFIO_BATCH_MAX_CAPACITY;
+	return;
+
+fallback:
+	batch->pages = &batch->fallback_page;
+	batch->capacity = 1;
+}
+
+static void vfio_batch_unpin(struct vfio_batch *batch, struct vfio_dma *dma)
+{
+	while (batch->size) {
+		unsigned long pfn = page_to_pfn(batch->pages[batch->offset]);
+
+		put_pfn(pfn, dma->prot);
+		batch->offset++;
+		batch->size--;
+	}
+}
+
+static void vfio_batch_fini(struct vfio_batch *batch)
+{
+	if (batch->capacity == VFIO_BATCH_MAX_CAPACITY)
+		free_page((unsigned long)batch->pages);
+}
+
+/*
+ * Number of entries at the head of the batch that are consecutive subpages
+ * of one compound (hugetlb or THP) page.  These are physically contiguous
+ * and can be accounted in one step.
+ */
+static long vfio_batch_compound_run(struct vfio_batch *batch)
+{
+	struct page *page = batch->pages[batch->offset];
+	unsigned long pfn = page_to_pfn(page);
+	struct page *head;
+	long i, nr;
+
+	if (!PageCompound(page))
+		return 1;
+
+	head = compound_head(page);
+	nr = min_t(long, batch->size,
+		   compound_nr(head) - (pfn - page_to_pfn(head)));
+	for (i = 1; i < nr; i++)
+		if (page_to_pfn(batch->pages[batch->offset + i]) != pfn + i)
+			break;
+
+	return i;
+}
+
 static int follow_fault_pfn(struct vm_area_struct *vma, struct mm_struct *mm,
 			    unsigned long vaddr, unsigned long *pfn,
 			    bool write_fault)
@@ -441,23 +519,27 @@ static int follow_fault_pfn(struct vm_area_struct *vma, struct mm_struct *mm,
 	return ret;
 }
 
-static int vaddr_get_pfn(struct mm_struct *mm, unsigned long vaddr,
-			 int prot, unsigned long *pfn)
+/*
+ * Returns the positive number of pfns successfully obtained or a negative
+ * error code.  For a VM_PFNMAP vma only a single pfn is returned and the
+ * pages array is left untouched.
+ */
+static long vaddr_get_pfns(struct mm_struct *mm, unsigned long vaddr,
+			   long npages, int prot, unsigned long *pfn,
+			   struct page **pages)
 {
-	struct page *page[1];
 	struct vm_area_struct *vma;
 	unsigned int flags = 0;
-	int ret;
+	long ret;
 
 	if (prot & IOMMU_WRITE)
 		flags |= FOLL_WRITE;
 
 	mmap_read_lock(mm);
-	ret = pin_user_pages_remote(mm, vaddr, 1, flags | FOLL_LONGTERM,
-				    page, NULL, NULL);
-	if (ret == 1) {
-		*pfn = page_to_pfn(page[0]);
-		ret = 0;
+	ret = pin_user_pages_remote(mm, vaddr, npages, flags | FOLL_LONGTERM,
+				    pages, NULL, NULL);
+	if (ret > 0) {
+		*pfn = page_to_pfn(pages[0]);
 		goto done;
 	}
 
@@ -471,14 +553,77 @@ retry:
 		if (ret == -EAGAIN)
 			goto retry;
 
-		if (!ret && !is_invalid_reserved_pfn(*pfn))
-			ret = -EFAULT;
+		if (!ret)
+			ret = is_invalid_reserved_pfn(*pfn) ? 1 : -EFAULT;
 	}
 done:
 	mmap_read_unlock(mm);
 	return ret;
 }
 
+static int vaddr_get_pfn(struct mm_struct *mm, unsigned long vaddr,
+			 int prot, unsigned long *pfn)
+{
+	struct page *page;
+	long ret;
+
+	ret = vaddr_get_pfns(mm, vaddr, 1, prot, pfn, &page);
+	if (ret == 1)
+		return 0;
+
+	return ret ? ret : -EFAULT;
+}
+
+struct vfio_prefault_arg {
+	struct mm_struct	*mm;
+	unsigned long		vaddr;
+	unsigned int		gup_flags;
+};
+
+static void vfio_prefault_chunk(unsigned long start, unsigned long end,
+				void *arg)
+{
+	struct vfio_prefault_arg *pf = arg;
+
+	/* Best effort, the pinning path reports any failure */
+	mmap_read_lock(pf->mm);
+	get_user_pages_remote(pf->mm, pf->vaddr + (start << PAGE_SHIFT),
+			      end - start, pf->gup_flags, NULL, NULL, NULL);
+	mmap_read_unlock(pf->mm);
+}
+
+/*
+ * Faulting in the backing memory (allocating and zeroing it) dominates the
+ * cost of pinning a large, freshly created mapping.  Spread that work over
+ * several threads, the serial pinning pass then finds the pages present.
+ */
+static void vfio_prefault_dma(struct vfio_dma *dma, unsigned long vaddr,
+			      size_t size)
+{
+#ifdef CONFIG_PADATA
+	struct vfio_prefault_arg pf = {
+		.mm		= current->mm,
+		.vaddr		= vaddr,
+		.gup_flags	= (dma->prot & IOMMU_WRITE) ? FOLL_WRITE : 0,
+	};
+	struct padata_mt_job job = {
+		.thread_fn   = vfio_prefault_chunk,
+		.fn_arg      = &pf,
+		.start       = 0,
+		.size        = size >> PAGE_SHIFT,
+		.align       = PMD_SIZE >> PAGE_SHIFT,
+		.min_chunk   = SZ_256M >> PAGE_SHIFT,
+		.max_threads = prefault_max_threads,
+		.nid         = NUMA_NO_NODE,
+	};
+
+	if (!pf.mm || job.max_threads < 2 || size < 2 * SZ_256M)
+		return;
+
+	padata_do_multithreaded(&job);
+#endif
+}
+
 /*
  * Attempt to pin pages.  We really don't want to track all the pfns and
  * the iommu can only map chunks of consecutive pfns anyway, so get the
@@ -486,76 +631,121 @@ done:
  */
 static long vfio_pin_pages_remote(struct vfio_dma *dma, unsigned long vaddr,
 				  long npage, unsigned long *pfn_base,
-				  unsigned long limit)
+				  unsigned long limit, struct vfio_batch *batch)
 {
-	unsigned long pfn = 0;
+	unsigned long pfn;
+	struct mm_struct *mm = current->mm;
 	long ret, pinned = 0, lock_acct = 0;
 	bool rsvd;
 	dma_addr_t iova = vaddr - dma->vaddr + dma->iova;
 
 	/* This code path is only user initiated */
-	if (!current->mm)
+	if (!mm)
 		return -ENODEV;
 
-	ret = vaddr_get_pfn(current->mm, vaddr, dma->prot, pfn_base);
-	if (ret)
-		return ret;
+	if (batch->size) {
+		/* Leftover pages in batch from an earlier call. */
+		*pfn_base = page_to_pfn(batch->pages[batch->offset]);
+		pfn = *pfn_base;
+		rsvd = is_invalid_reserved_pfn(*pfn_base);
+	} else {
+		*pfn_base = 0;
+	}
 
-	pinned++;
-	rsvd = is_invalid_reserved_pfn(*pfn_base);
+	while (npage) {
+		if (!batch->size) {
+			/* Empty batch, so refill it. */
+			long req_pages = min_t(long, npage, batch->capacity);
 
-	/*
-	 * Reserved pages aren't counted against the user, externally pinned
-	 * pages are already counted against the user.
-	 */
-	if (!rsvd && !vfio_find_vpfn(dma, iova)) {
-		if (!dma->lock_cap && current->mm->locked_vm + 1 > limit) {
-			put_pfn(*pfn_base, dma->prot);
-			pr_warn("%s: RLIMIT_MEMLOCK (%ld) exceeded\n", __func__,
-					limit << PAGE_SHIFT);
-			return -ENOMEM;
+			ret = vaddr_get_pfns(mm, vaddr, req_pages, dma->prot,
+					     &pfn, batch->pages);
+			if (ret < 0)
+				goto unpin_out;
+
+			batch->size = ret;
+			batch->offset = 0;
+
+			if (!*pfn_base) {
+				*pfn_base = pfn;
+				rsvd = is_invalid_reserved_pfn(*pfn_base);
+			}
 		}
-		lock_acct++;
-	}
 
-	if (unlikely(disable_hugepages))
-		goto out;
+		/*
+		 * pfn is preset for the first iteration of this inner loop and
+		 * updated at the end to handle a VM_PFNMAP pfn.  In that case,
+		 * batch->pages isn't valid (there's no struct page), so allow
+		 * batch->pages to be touched only when there's more than one
+		 * pfn to check, which guarantees the pfns are from a
+		 * !VM_PFNMAP vma.
+		 */
+		while (true) {
+			long nr = 1, acct = 0;
 
-	/* Lock all the consecutive pages from pfn_base */
-	for (vaddr += PAGE_SIZE, iova += PAGE_SIZE; pinned < npage;
-	     pinned++, vaddr += PAGE_SIZE, iova += PAGE_SIZE) {
-		ret = vaddr_get_pfn(current->mm, vaddr, dma->prot, &pfn);
-		if (ret)
-			break;
+			if (pfn != *pfn_base + pinned ||
+			    rsvd != is_invalid_reserved_pfn(pfn))
+				goto out;
 
-		if (pfn != *pfn_base + pinned ||
-		    rsvd != is_invalid_reserved_pfn(pfn)) {
-			put_pfn(pfn, dma->prot);
-			break;
-		}
+			/*
+			 * Reserved pages aren't counted against the user,
+			 * externally pinned pages are already counted against
+			 * the user.  With no externally pinned pages the rest
+			 * of a hugetlb/THP page is taken in one step.
+			 */
+			if (!rsvd) {
+				if (RB_EMPTY_ROOT(&dma->pfn_list)) {
+					if (batch->size > 1)
+						nr = vfio_batch_compound_run(batch);
+					acct = nr;
+				} else if (!vfio_find_vpfn(dma, iova)) {
+					acct = 1;
+				}
+			}
 
-		if (!rsvd && !vfio_find_vpfn(dma, iova)) {
-			if (!dma->lock_cap &&
-			    current->mm->locked_vm + lock_acct + 1 > limit) {
-				put_pfn(pfn, dma->prot);
-				pr_warn("%s: RLIMIT_MEMLOCK (%ld) exceeded\n",
-					__func__, limit << PAGE_SHIFT);
-				ret = -ENOMEM;
-				goto unpin_out;
+			if (acct) {
+				if (!dma->lock_cap &&
+				    mm->locked_vm + lock_acct + acct > limit) {
+					pr_warn("%s: RLIMIT_MEMLOCK (%ld) exceeded\n",
+						__func__, limit << PAGE_SHIFT);
+					ret = -ENOMEM;
+					goto unpin_out;
+				}
+				lock_acct += acct;
 			}
-			lock_acct++;
+
+			pinned += nr;
+			npage -= nr;
+			vaddr += nr << PAGE_SHIFT;
+			iova += nr << PAGE_SHIFT;
+			batch->offset += nr;
+			batch->size -= nr;
+
+			if (!batch->size)
+				break;
+
+			pfn = page_to_pfn(batch->pages[batch->offset]);
 		}
+
+		if (unlikely(disable_hugepages))
+			break;
 	}
 
 out:
 	ret = vfio_lock_acct(dma, lock_acct, false);
 
 unpin_out:
-	if (ret) {
-		if (!rsvd) {
+	if (batch->size == 1 && !batch->offset) {
+		/* May be a VM_PFNMAP pfn, which the batch can't remember. */
+		put_pfn(pfn, dma->prot);
+		batch->size = 0;
+	}
+
+	if (ret < 0) {
+		if (pinned && !rsvd) {
 			for (pfn = *pfn_base ; pinned ; pfn++, pinned--)
 				put_pfn(pfn, dma->prot);
 		}
+		vfio_batch_unpin(batch, dma);
 
 		return ret;
 	}
@@ -1241,12 +1431,17 @@ static int vfio_pin_map_dma(struct vfio_iommu *iommu, struct vfio_dma *dma,
 	size_t size = map_size;
 	long npage;
 	unsigned long pfn, limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	struct vfio_batch batch;
 	int ret = 0;
 
+	vfio_prefault_dma(dma, vaddr, map_size);
+	vfio_batch_init(&batch);
+
 	while (size) {
 		/* Pin a contiguous chunk of memory */
 		npage = vfio_pin_pages_remote(dma, vaddr + dma->size,
-					      size >> PAGE_SHIFT, &pfn, limit);
+					      size >> PAGE_SHIFT, &pfn, limit,
+					      &batch);
 		if (npage <= 0) {
 			WARN_ON(!npage);
 			ret = (int)npage;
@@ -1259,6 +1454,7 @@ static int vfio_pin_map_dma(struct vfio_iommu *iommu, struct vfio_dma *dma,
 		if (ret) {
 			vfio_unpin_pages_remote(dma, iova + dma->size, pfn,
 						npage, true);
+			vfio_batch_unpin(&batch, dma);
 			break;
 		}
 
@@ -1271,6 +1467,7 @@ static int vfio_pin_map_dma(struct vfio_iommu *iommu, struct vfio_dma *dma,
 	if (ret)
 		vfio_remove_dma(iommu, dma);
 
+	vfio_batch_fini(&batch);
 	return ret;
 }
 
@@ -1424,6 +1621,7 @@ static int vfio_bus_type(struct device *dev, void *data)
 static int vfio_iommu_replay(struct vfio_iommu *iommu,
 			     struct vfio_domain *domain)
 {
+	struct vfio_batch batch;
 	struct vfio_domain *d = NULL;
 	struct rb_node *n;
 	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
@@ -1434,6 +1632,8 @@ static int vfio_iommu_replay(struct vfio_iommu *iommu,
 		d = list_first_entry(&iommu->domain_list,
 				     struct vfio_domain, next);
 
+	vfio_batch_init(&batch);
+
 	n = rb_first(&iommu->dma_list);
 
 	for (; n; n = rb_next(n)) {
@@ -1481,7 +1681,8 @@ static int vfio_iommu_replay(struct vfio_iommu *iommu,
 
 				npage = vfio_pin_pages_remote(dma, vaddr,
 							      n >> PAGE_SHIFT,
-							      &pfn, limit);
+							      &pfn, limit,
+							      &batch);
 				if (npage <= 0) {
 					WARN_ON(!npage);
 					ret = (int)npage;
@@ -1495,11 +1696,13 @@ static int vfio_iommu_replay(struct vfio_iommu *iommu,
 			ret = iommu_map(domain->domain, iova, phys,
 					size, dma->prot | domain->prot);
 			if (ret) {
-				if (!dma->iommu_mapped)
+				if (!dma->iommu_mapped) {
 					vfio_unpin_pages_remote(dma, iova,
 							phys >> PAGE_SHIFT,
 							size >> PAGE_SHIFT,
 							true);
+					vfio_batch_unpin(&batch, dma);
+				}
 				goto unwind;
 			}
 
@@ -1514,6 +1717,7 @@ static int vfio_iommu_replay(struct vfio_iommu *iommu,
 		dma->iommu_mapped = true;
 	}
 
+	vfio_batch_fini(&batch);
 	return 0;
 
 unwind:
@@ -1554,6 +1758,7 @@ unwind:
 		}
 	}
 
+	vfio_batch_fini(&batch);
 	return ret;
 }
 
@@ -5,6 +5,8 @@
  * virtio-net server in host kernel.
  */
 
+#include <linux/bvec.h>
+#include <linux/capability.h>
 #include <linux/compat.h>
 #include <linux/eventfd.h>
 #include <linux/vhost.h>
@@ -40,6 +42,11 @@ module_param(experimental_zcopytx, int, 0444);
 MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
 		                       " 1 -Enable; 0 - Disable");
 
+static unsigned int zcopytx_pin_pages;
+module_param(zcopytx_pin_pages, uint, 0644);
+MODULE_PARM_DESC(zcopytx_pin_pages, "Max guest pages each device keeps pinned"
+				    " for Zero Copy TX; 0 - Pin per packet");
+
 /* Max number of bytes transferred before requeueing the job.
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_NET_WEIGHT 0x80000
@@ -53,6 +60,12 @@ MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
 /* MAX number of TX used buffers for outstanding zerocopy */
 #define VHOST_MAX_PEND 128
 #define VHOST_GOODCOPY_LEN 256
+/* Below this, pinning the pages of each packet costs more than copying */
+#define VHOST_UNPINNED_GOODCOPY_LEN 1024
+/* Segments of a packet built from pinned pages: MAX_SKB_FRAGS plus the
+ * part the socket copies into the linear area.
+ */
+#define VHOST_NET_PINNED_SEGS (MAX_SKB_FRAGS + 2)
 
 /*
  * For transmit, used buffer len is unused; we override it to track buffer
@@ -140,6 +153,14 @@ struct vhost_net {
 	unsigned tx_zcopy_err;
 	/* Flush in progress. Protected by tx vq lock. */
 	bool tx_flush;
+	/* Guest pages pinned for zerocopy TX, indexed by user page number.
+	 * Protected by tx vq lock. */
+	struct xarray tx_pinned;
+	unsigned long tx_nr_pinned;
+	/* Owner's RLIMIT_MEMLOCK in pages, sampled at VHOST_SET_OWNER */
+	unsigned long tx_pin_memlock;
+	/* Packet being sent from pinned pages. Protected by tx vq lock. */
+	struct bio_vec tx_bvec[VHOST_NET_PINNED_SEGS];
 	/* Private page frag */
 	struct page_frag page_frag;
 	/* Refcount bias of page frag */
@@ -339,6 +360,101 @@ static bool vhost_net_tx_select_zcopy(struct vhost_net *net)
 		net->tx_packets / 64 >= net->tx_zcopy_err;
 }
 
+/* Return the pinned page backing @uaddr, pinning it if it isn't yet.
+ * The cache holds one pin on each page until the memory table changes or
+ * the owner goes away; the socket only takes page references on top.
+ */
+static struct page *vhost_net_pin_page(struct vhost_net *net,
+				       unsigned long uaddr)
+{
+	unsigned long index = uaddr >> PAGE_SHIFT;
+	struct mm_struct *mm = net->dev.mm;
+	struct page *page;
+
+	page = xa_load(&net->tx_pinned, index);
+	if (page)
+		return page;
+
+	if (net->tx_nr_pinned >= READ_ONCE(zcopytx_pin_pages))
+		return NULL;
+
+	if (atomic64_add_return(1, &mm->pinned_vm) > net->tx_pin_memlock)
+		goto err_unaccount;
+	if (pin_user_pages_fast(uaddr & PAGE_MASK, 1, FOLL_LONGTERM, &page) != 1)
+		goto err_unaccount;
+	if (xa_is_err(xa_store(&net->tx_pinned, index, page, GFP_KERNEL)))
+		goto err_unpin;
+
+	net->tx_nr_pinned++;
+	return page;
+
+err_unpin:
+	unpin_user_page(page);
+err_unaccount:
+	atomic64_dec(&mm->pinned_vm);
+	return NULL;
+}
+
+static void vhost_net_unpin_pages(struct vhost_net *net)
+{
+	struct page *page;
+	unsigned long index;
+
+	mutex_lock(&net->vqs[VHOST_NET_VQ_TX].vq.mutex);
+	xa_for_each(&net->tx_pinned, index, page)
+		unpin_user_page(page);
+	xa_destroy(&net->tx_pinned);
+	if (net->tx_nr_pinned)
+		atomic64_sub(net->tx_nr_pinned, &net->dev.mm->pinned_vm);
+	net->tx_nr_pinned = 0;
+	mutex_unlock(&net->vqs[VHOST_NET_VQ_TX].vq.mutex);
+}
+
+/* Switch the iovec iterator of @msg over to bvecs of pinned pages, so
+ * the socket doesn't have to pin the packet's pages itself.
+ */
+static bool vhost_net_tx_pinned_iter(struct vhost_net *net,
+				     struct msghdr *msg, size_t len)
+{
+	struct iov_iter *from = &msg->msg_iter;
+	const struct iovec *iov = from->iov;
+	struct bio_vec *bvec = net->tx_bvec;
+	size_t skip = from->iov_offset;
+	size_t left = len;
+	int nr = 0;
+
+	if (!READ_ONCE(zcopytx_pin_pages) || !iter_is_iovec(from))
+		return false;
+
+	for (; left; iov++, skip = 0) {
+		unsigned long base = (unsigned long)iov->iov_base + skip;
+		size_t seg = min(iov->iov_len - skip, left);
+
+		while (seg) {
+			size_t off = offset_in_page(base);
+			size_t n = min_t(size_t, PAGE_SIZE - off, seg);
+			struct page *page;
+
+			if (nr == VHOST_NET_PINNED_SEGS)
+				return false;
+			page = vhost_net_pin_page(net, base);
+			if (!page)
+				return false;
+
+			bvec[nr].bv_page = page;
+			bvec[nr].bv_offset = off;
+			bvec[nr].bv_len = n;
+			nr++;
+			base += n;
+			seg -= n;
+			left -= n;
+		}
+	}
+
+	iov_iter_bvec(from, WRITE, bvec, nr, len);
+	return true;
+}
+
 static bool vhost_sock_zcopy(struct socket *sock)
 {
 	return unlikely(experimental_zcopytx) &&
@@ -533,7 +649,7 @@ static void vhost_net_busy_poll(struct vhost_net *net,
 	endtime = busy_clock() + busyloop_timeout;
 
 	while (vhost_can_busy_poll(endtime)) {
-		if (vhost_has_work(&net->dev)) {
+		if (vhost_vq_has_work(vq)) {
 			*busyloop_intr = true;
 			break;
 		}
@@ -593,6 +709,16 @@ static bool vhost_exceeds_maxpend(struct vhost_net *net)
 	       min_t(unsigned int, VHOST_MAX_PEND, vq->num >> 2);
 }
 
+/* Enough zerocopy buffers are outstanding to return the done ones */
+static bool vhost_zerocopy_batch_ready(struct vhost_net *net)
+{
+	struct vhost_net_virtqueue *nvq = &net->vqs[VHOST_NET_VQ_TX];
+	struct vhost_virtqueue *vq = &nvq->vq;
+
+	return (nvq->upend_idx + UIO_MAXIOV - nvq->done_idx) % UIO_MAXIOV >=
+	       min_t(unsigned int, VHOST_NET_BATCH, vq->num >> 3);
+}
+
 static size_t init_iov_iter(struct vhost_virtqueue *vq, struct iov_iter *iter,
 			    size_t hdr_size, int out)
 {
@@ -869,8 +995,9 @@ static void handle_tx_zerocopy(struct vhost_net *net, struct socket *sock)
 	do {
 		bool busyloop_intr;
 
-		/* Release DMAs done buffers first */
-		vhost_zerocopy_signal_used(net, vq);
+		/* Release DMAs done buffers in batches */
+		if (vhost_zerocopy_batch_ready(net))
+			vhost_zerocopy_signal_used(net, vq);
 
 		busyloop_intr = false;
 		head = get_tx_bufs(net, nvq, &msg, &out, &in, &len,
@@ -892,6 +1019,8 @@ static void handle_tx_zerocopy(struct vhost_net *net, struct socket *sock)
 		zcopy_used = len >= VHOST_GOODCOPY_LEN
 			     && !vhost_exceeds_maxpend(net)
 			     && vhost_net_tx_select_zcopy(net);
+		if (zcopy_used && !vhost_net_tx_pinned_iter(net, &msg, len))
+			zcopy_used = len >= VHOST_UNPINNED_GOODCOPY_LEN;
 
 		/* use msg_control to pass vhost zerocopy ubuf info to skb */
 		if (zcopy_used) {
@@ -903,6 +1032,7 @@ static void handle_tx_zerocopy(struct vhost_net *net, struct socket *sock)
 			ubuf->callback = vhost_zerocopy_callback;
 			ubuf->ctx = nvq->ubufs;
 			ubuf->desc = nvq->upend_idx;
+			ubuf->flags = 0;
 			refcount_set(&ubuf->refcnt, 1);
 			msg.msg_control = &ctl;
 			ctl.type = TUN_MSG_UBUF;
@@ -940,10 +1070,10 @@ static void handle_tx_zerocopy(struct vhost_net *net, struct socket *sock)
 				 " len %d != %zd\n", err, len);
 		if (!zcopy_used)
 			vhost_add_used_and_signal(&net->dev, vq, head, 0);
-		else
-			vhost_zerocopy_signal_used(net, vq);
 		vhost_net_tx_packet(net);
 	} while (likely(!vhost_exceeds_weight(vq, ++sent_pkts, total_len)));
+
+	vhost_zerocopy_signal_used(net, vq);
 }
 
 /* Expects to be always run from workqueue - which acts as
@@ -1330,11 +1460,15 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 		       VHOST_NET_PKT_WEIGHT, VHOST_NET_WEIGHT, true,
 		       NULL);
 
-	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev);
-	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev,
+			vqs[VHOST_NET_VQ_TX]);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev,
+			vqs[VHOST_NET_VQ_RX]);
 
 	f->private_data = n;
 	n->page_frag.page = NULL;
+	xa_init(&n->tx_pinned);
+	n->tx_nr_pinned = 0;
 	n->refcnt_bias = 0;
 
 	return 0;
@@ -1396,6 +1530,7 @@ static int vhost_net_release(struct inode *inode, struct file *f)
 	vhost_net_stop(n, &tx_sock, &rx_sock);
 	vhost_net_flush(n);
 	vhost_dev_stop(&n->dev);
+	vhost_net_unpin_pages(n);
 	vhost_dev_cleanup(&n->dev);
 	vhost_net_vq_reset(n);
 	if (tx_sock)
@@ -1604,6 +1739,7 @@ static long vhost_net_reset_owner(struct vhost_net *n)
 	vhost_net_stop(n, &tx_sock, &rx_sock);
 	vhost_net_flush(n);
 	vhost_dev_stop(&n->dev);
+	vhost_net_unpin_pages(n);
 	vhost_dev_reset_owner(&n->dev, umem);
 	vhost_net_vq_reset(n);
 done:
@@ -1670,6 +1806,9 @@ static long vhost_net_set_owner(struct vhost_net *n)
 	r = vhost_net_set_ubuf_info(n);
 	if (r)
 		goto out;
+	/* Pages are pinned from the worker, which has no limits of its own */
+	n->tx_pin_memlock = capable(CAP_IPC_LOCK) ? ULONG_MAX :
+			    rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
 	r = vhost_dev_set_owner(&n->dev);
 	if (r)
 		vhost_net_clear_ubuf_info(n);
@@ -1728,6 +1867,9 @@ static long vhost_net_ioctl(struct file *f, unsigned int ioctl,
 			r = vhost_vring_ioctl(&n->dev, ioctl, argp);
 		else
 			vhost_net_flush(n);
+		/* Pinned pages may no longer back guest memory */
+		if (ioctl == VHOST_SET_MEM_TABLE && !r)
+			vhost_net_unpin_pages(n);
 		mutex_unlock(&n->dev.mutex);
 		return r;
 	}
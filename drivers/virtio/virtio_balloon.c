@@ -46,6 +46,21 @@
 static struct vfsmount *balloon_mnt;
 #endif
 
+static unsigned int page_reporting_order;
+module_param(page_reporting_order, uint, 0444);
+MODULE_PARM_DESC(page_reporting_order,
+		 "Minimum order of free pages reported to the host (0: pageblock order)");
+
+static unsigned int page_reporting_delay_ms;
+module_param(page_reporting_delay_ms, uint, 0444);
+MODULE_PARM_DESC(page_reporting_delay_ms,
+		 "Delay between free page reporting passes in ms (0: 2000)");
+
+static unsigned long page_reporting_rate;
+module_param(page_reporting_rate, ulong, 0444);
+MODULE_PARM_DESC(page_reporting_rate,
+		 "Maximum number of pages reported per second (0: unlimited)");
+
 enum virtio_balloon_vq {
 	VIRTIO_BALLOON_VQ_INFLATE,
 	VIRTIO_BALLOON_VQ_DEFLATE,
@@ -984,6 +999,9 @@ static int virtballoon_probe(struct virtio_device *vdev)
 	}
 
 	vb->pr_dev_info.report = virtballoon_free_page_report;
+	vb->pr_dev_info.order = page_reporting_order;
+	vb->pr_dev_info.delay_ms = page_reporting_delay_ms;
+	vb->pr_dev_info.rate = page_reporting_rate;
 	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_REPORTING)) {
 		unsigned int capacity;
 
@@ -20,6 +20,8 @@
 #include <linux/mutex.h>
 #include <linux/bitmap.h>
 #include <linux/lockdep.h>
+#include <linux/sort.h>
+#include <linux/ktime.h>
 
 #include <acpi/acpi_numa.h>
 
@@ -27,6 +29,16 @@ static bool unplug_online = true;
 module_param(unplug_online, bool, 0644);
 MODULE_PARM_DESC(unplug_online, "Try to unplug online memory");
 
+static bool online_movable = true;
+module_param(online_movable, bool, 0644);
+MODULE_PARM_DESC(online_movable,
+		 "Online fully plugged memory blocks to ZONE_MOVABLE");
+
+static unsigned int big_block_mbs = 8;
+module_param(big_block_mbs, uint, 0644);
+MODULE_PARM_DESC(big_block_mbs,
+		 "Maximum number of memory blocks plugged and added at once");
+
 enum virtio_mem_mb_state {
 	/* Unplugged, not added to Linux. Can be reused later. */
 	VIRTIO_MEM_MB_STATE_UNUSED = 0,
@@ -156,6 +168,19 @@ struct virtio_mem {
 	/* Memory notifier (online/offline events). */
 	struct notifier_block memory_notifier;
 
+	/* Statistics of the plug/unplug requests, see virtio_mem_stats_attrs. */
+	struct {
+		uint64_t plug_requests;
+		uint64_t unplug_requests;
+		uint64_t unplug_busy;
+		uint64_t plug_ns;
+		uint64_t unplug_ns;
+		uint64_t last_plug_ns;
+		uint64_t last_unplug_ns;
+		uint64_t plugged_bytes;
+		uint64_t unplugged_bytes;
+	} stats;
+
 	/* Next device in the list of virtio-mem devices. */
 	struct list_head next;
 };
@@ -403,17 +428,20 @@ static int virtio_mem_sb_bitmap_prepare_next_mb(struct virtio_mem *vm)
 }
 
 /*
- * Try to add a memory block to Linux. This will usually only fail
- * if out of memory.
+ * Try to add nb_mb consecutive memory blocks to Linux. This will usually only
+ * fail if out of memory. Fully plugged blocks are onlined to ZONE_MOVABLE
+ * if online_movable is set, so that they can be unplugged again as a whole.
  *
  * Must not be called with the vm->hotplug_mutex held (possible deadlock with
  * onlining code).
  *
- * Will not modify the state of the memory block.
+ * Will not modify the state of the memory blocks.
  */
-static int virtio_mem_mb_add(struct virtio_mem *vm, unsigned long mb_id)
+static int virtio_mem_mb_add(struct virtio_mem *vm, unsigned long mb_id,
+			     unsigned long nb_mb, bool fully_plugged)
 {
 	const uint64_t addr = virtio_mem_mb_id_to_phys(mb_id);
+	const uint64_t size = nb_mb * memory_block_size_bytes();
 	int nid = vm->nid;
 
 	if (nid == NUMA_NO_NODE)
@@ -430,9 +458,13 @@ static int virtio_mem_mb_add(struct virtio_mem *vm, unsigned long mb_id)
 			return -ENOMEM;
 	}
 
-	dev_dbg(&vm->vdev->dev, "adding memory block: %lu\n", mb_id);
-	return add_memory_driver_managed(nid, addr, memory_block_size_bytes(),
-					 vm->resource_name);
+	dev_dbg(&vm->vdev->dev, "adding memory blocks: %lu - %lu\n", mb_id,
+		mb_id + nb_mb - 1);
+	if (fully_plugged && online_movable)
+		return add_memory_driver_managed_online(nid, addr, size,
+							vm->resource_name,
+							MMOP_ONLINE_MOVABLE);
+	return add_memory_driver_managed(nid, addr, size, vm->resource_name);
 }
 
 /*
@@ -1135,7 +1167,7 @@ static int virtio_mem_mb_plug_and_add(struct virtio_mem *vm,
 					VIRTIO_MEM_MB_STATE_OFFLINE_PARTIAL);
 
 	/* Add the memory block to linux - if that fails, try to unplug. */
-	rc = virtio_mem_mb_add(vm, mb_id);
+	rc = virtio_mem_mb_add(vm, mb_id, 1, count == vm->nb_sb_per_mb);
 	if (rc) {
 		enum virtio_mem_mb_state new_state = VIRTIO_MEM_MB_STATE_UNUSED;
 
@@ -1157,6 +1189,65 @@ static int virtio_mem_mb_plug_and_add(struct virtio_mem *vm,
 	return 0;
 }
 
+/*
+ * Prepare, fully plug and add up to big_block_mbs new memory blocks with a
+ * single add_memory_driver_managed_online() call, which saves taking the
+ * device hotplug lock and registering a resource for each of them.
+ *
+ * Will modify the state of the memory blocks.
+ */
+static int virtio_mem_mbs_plug_and_add(struct virtio_mem *vm, uint64_t *nb_sb)
+{
+	unsigned long nb_offline, first_mb_id = 0, mb_id, nb_mb, max_mb, i;
+	int rc = 0, rc2;
+
+	nb_offline = vm->nb_mb_state[VIRTIO_MEM_MB_STATE_OFFLINE] +
+		     vm->nb_mb_state[VIRTIO_MEM_MB_STATE_OFFLINE_PARTIAL];
+	max_mb = min_t(uint64_t, *nb_sb / vm->nb_sb_per_mb,
+		       max(big_block_mbs, 1U));
+	max_mb = min(max_mb, VIRTIO_MEM_NB_OFFLINE_THRESHOLD - nb_offline);
+
+	for (nb_mb = 0; nb_mb < max_mb; nb_mb++) {
+		rc = virtio_mem_prepare_next_mb(vm, &mb_id);
+		if (rc)
+			break;
+		if (!nb_mb)
+			first_mb_id = mb_id;
+
+		/*
+		 * Plug the block before adding it to Linux, marked offline
+		 * so the memory notifiers will find it in the right state.
+		 */
+		rc = virtio_mem_mb_plug_sb(vm, mb_id, 0, vm->nb_sb_per_mb);
+		if (rc)
+			break;
+		virtio_mem_mb_set_state(vm, mb_id, VIRTIO_MEM_MB_STATE_OFFLINE);
+	}
+
+	if (!nb_mb)
+		return rc;
+
+	rc2 = virtio_mem_mb_add(vm, first_mb_id, nb_mb, true);
+	if (rc2) {
+		dev_err(&vm->vdev->dev,
+			"adding memory blocks %lu - %lu failed with %d\n",
+			first_mb_id, first_mb_id + nb_mb - 1, rc2);
+		for (i = 0; i < nb_mb; i++) {
+			mb_id = first_mb_id + i;
+			if (virtio_mem_mb_unplug(vm, mb_id))
+				virtio_mem_mb_set_state(vm, mb_id,
+						VIRTIO_MEM_MB_STATE_PLUGGED);
+			else
+				virtio_mem_mb_set_state(vm, mb_id,
+						VIRTIO_MEM_MB_STATE_UNUSED);
+		}
+		return rc2;
+	}
+
+	*nb_sb -= nb_mb * vm->nb_sb_per_mb;
+	return rc;
+}
+
 /*
  * Try to plug the desired number of subblocks of a memory block that
  * is already added to Linux.
@@ -1267,6 +1358,15 @@ static int virtio_mem_plug_request(struct virtio_mem *vm, uint64_t diff)
 		if (virtio_mem_too_many_mb_offline(vm))
 			return -ENOSPC;
 
+		/* Fully plugged blocks are added several at a time */
+		if (nb_sb >= vm->nb_sb_per_mb) {
+			rc = virtio_mem_mbs_plug_and_add(vm, &nb_sb);
+			if (rc)
+				return rc;
+			cond_resched();
+			continue;
+		}
+
 		rc = virtio_mem_prepare_next_mb(vm, &mb_id);
 		if (rc)
 			return rc;
@@ -1427,6 +1527,153 @@ unplugged:
 	return 0;
 }
 
+/*
+ * Unplug a fully plugged memory block onlined to ZONE_MOVABLE. Parts of such
+ * a block must not be unplugged, so it is offlined and removed as a whole,
+ * which migrates away whatever is still in use, and then unplugged.
+ *
+ * Will modify the state of the memory block. Temporarily drops the
+ * hotplug_mutex.
+ *
+ * Note: Returns 0 if the block is busy and could not get offlined.
+ */
+static int virtio_mem_mb_unplug_movable(struct virtio_mem *vm,
+					unsigned long mb_id, uint64_t *nb_sb)
+{
+	int rc;
+
+	if (*nb_sb < vm->nb_sb_per_mb)
+		return 0;
+
+	mutex_unlock(&vm->hotplug_mutex);
+	rc = virtio_mem_mb_offline_and_remove(vm, mb_id);
+	mutex_lock(&vm->hotplug_mutex);
+	if (rc)
+		return 0;
+
+	/* Removed from Linux, unplug it now or later as a pending block */
+	rc = virtio_mem_mb_unplug(vm, mb_id);
+	if (rc) {
+		virtio_mem_mb_set_state(vm, mb_id, VIRTIO_MEM_MB_STATE_PLUGGED);
+		return rc;
+	}
+
+	virtio_mem_mb_set_state(vm, mb_id, VIRTIO_MEM_MB_STATE_UNUSED);
+	*nb_sb -= vm->nb_sb_per_mb;
+	return 0;
+}
+
+/*
+ * Number of pages in use in the plugged subblocks of an online memory block.
+ * Read without any locking, this only decides the order of unplugging.
+ */
+static unsigned long virtio_mem_mb_nr_used_pages(struct virtio_mem *vm,
+						 unsigned long mb_id)
+{
+	const unsigned long nr_pages = PFN_DOWN(vm->subblock_size);
+	unsigned long pfn, i, used = 0;
+	int sb_id;
+
+	for (sb_id = 0; sb_id < vm->nb_sb_per_mb; sb_id++) {
+		if (!virtio_mem_mb_test_sb_plugged(vm, mb_id, sb_id, 1))
+			continue;
+		pfn = PFN_DOWN(virtio_mem_mb_id_to_phys(mb_id) +
+			       sb_id * vm->subblock_size);
+		for (i = 0; i < nr_pages; i++)
+			if (page_count(pfn_to_page(pfn + i)))
+				used++;
+		cond_resched();
+	}
+
+	return used;
+}
+
+struct virtio_mem_unplug_candidate {
+	unsigned long mb_id;
+	unsigned long used;
+};
+
+static int virtio_mem_unplug_candidate_cmp(const void *a, const void *b)
+{
+	const struct virtio_mem_unplug_candidate *ca = a, *cb = b;
+
+	if (ca->used != cb->used)
+		return ca->used < cb->used ? -1 : 1;
+	/* Prefer the highest memory blocks, as before */
+	return ca->mb_id < cb->mb_id ? 1 : -1;
+}
+
+static bool virtio_mem_mb_state_online(enum virtio_mem_mb_state state)
+{
+	return state == VIRTIO_MEM_MB_STATE_ONLINE ||
+	       state == VIRTIO_MEM_MB_STATE_ONLINE_PARTIAL ||
+	       state == VIRTIO_MEM_MB_STATE_ONLINE_MOVABLE;
+}
+
+/*
+ * Unplug the desired number of plugged subblocks of online memory blocks,
+ * starting with the blocks that are cheapest to free - the ones with the
+ * fewest pages in use, fully free blocks first.
+ *
+ * Called and returns with the hotplug_mutex held, drops it temporarily.
+ */
+static int virtio_mem_unplug_online(struct virtio_mem *vm, uint64_t *nb_sb)
+{
+	struct virtio_mem_unplug_candidate *cand;
+	unsigned long mb_id, nb_cand, i;
+	int rc = 0;
+
+	nb_cand = vm->nb_mb_state[VIRTIO_MEM_MB_STATE_ONLINE] +
+		  vm->nb_mb_state[VIRTIO_MEM_MB_STATE_ONLINE_PARTIAL] +
+		  vm->nb_mb_state[VIRTIO_MEM_MB_STATE_ONLINE_MOVABLE];
+	if (!nb_cand)
+		return 0;
+
+	cand = kvmalloc_array(nb_cand, sizeof(*cand), GFP_KERNEL);
+	if (!cand)
+		return -ENOMEM;
+
+	i = 0;
+	for (mb_id = vm->first_mb_id; mb_id < vm->next_mb_id && i < nb_cand;
+	     mb_id++) {
+		if (!virtio_mem_mb_state_online(virtio_mem_mb_get_state(vm,
+									 mb_id)))
+			continue;
+		cand[i].mb_id = mb_id;
+		cand[i].used = virtio_mem_mb_nr_used_pages(vm, mb_id);
+		i++;
+	}
+	nb_cand = i;
+	sort(cand, nb_cand, sizeof(*cand), virtio_mem_unplug_candidate_cmp,
+	     NULL);
+
+	for (i = 0; i < nb_cand && *nb_sb; i++) {
+		mb_id = cand[i].mb_id;
+
+		/* The state might have changed while we dropped the mutex */
+		switch (virtio_mem_mb_get_state(vm, mb_id)) {
+		case VIRTIO_MEM_MB_STATE_ONLINE:
+		case VIRTIO_MEM_MB_STATE_ONLINE_PARTIAL:
+			rc = virtio_mem_mb_unplug_any_sb_online(vm, mb_id,
+								nb_sb);
+			break;
+		case VIRTIO_MEM_MB_STATE_ONLINE_MOVABLE:
+			rc = virtio_mem_mb_unplug_movable(vm, mb_id, nb_sb);
+			break;
+		default:
+			continue;
+		}
+		if (rc)
+			break;
+		mutex_unlock(&vm->hotplug_mutex);
+		cond_resched();
+		mutex_lock(&vm->hotplug_mutex);
+	}
+
+	kvfree(cand);
+	return rc;
+}
+
 /*
  * Try to unplug the requested amount of memory.
  */
@@ -1471,29 +1718,10 @@ static int virtio_mem_unplug_request(struct virtio_mem *vm, uint64_t diff)
 		return 0;
 	}
 
-	/* Try to unplug subblocks of partially plugged online blocks. */
-	virtio_mem_for_each_mb_state_rev(vm, mb_id,
-					 VIRTIO_MEM_MB_STATE_ONLINE_PARTIAL) {
-		rc = virtio_mem_mb_unplug_any_sb_online(vm, mb_id,
-							&nb_sb);
-		if (rc || !nb_sb)
-			goto out_unlock;
-		mutex_unlock(&vm->hotplug_mutex);
-		cond_resched();
-		mutex_lock(&vm->hotplug_mutex);
-	}
-
-	/* Try to unplug subblocks of plugged online blocks. */
-	virtio_mem_for_each_mb_state_rev(vm, mb_id,
-					 VIRTIO_MEM_MB_STATE_ONLINE) {
-		rc = virtio_mem_mb_unplug_any_sb_online(vm, mb_id,
-							&nb_sb);
-		if (rc || !nb_sb)
-			goto out_unlock;
-		mutex_unlock(&vm->hotplug_mutex);
-		cond_resched();
-		mutex_lock(&vm->hotplug_mutex);
-	}
+	/* Try to unplug subblocks of online blocks, cheapest first. */
+	rc = virtio_mem_unplug_online(vm, &nb_sb);
+	if (rc)
+		goto out_unlock;
 
 	mutex_unlock(&vm->hotplug_mutex);
 	return nb_sb ? -EBUSY : 0;
@@ -1581,12 +1809,33 @@ retry:
 		rc = virtio_mem_unplug_pending_mb(vm);
 
 	if (!rc && vm->requested_size != vm->plugged_size) {
+		const uint64_t plugged_size = vm->plugged_size;
+		uint64_t ns = ktime_get_ns();
+
 		if (vm->requested_size > vm->plugged_size) {
 			diff = vm->requested_size - vm->plugged_size;
 			rc = virtio_mem_plug_request(vm, diff);
+
+			ns = ktime_get_ns() - ns;
+			vm->stats.plug_requests++;
+			vm->stats.plug_ns += ns;
+			vm->stats.last_plug_ns = ns;
+			if (vm->plugged_size > plugged_size)
+				vm->stats.plugged_bytes +=
+					vm->plugged_size - plugged_size;
 		} else {
 			diff = vm->plugged_size - vm->requested_size;
 			rc = virtio_mem_unplug_request(vm, diff);
+
+			ns = ktime_get_ns() - ns;
+			vm->stats.unplug_requests++;
+			vm->stats.unplug_ns += ns;
+			vm->stats.last_unplug_ns = ns;
+			if (vm->plugged_size < plugged_size)
+				vm->stats.unplugged_bytes +=
+					plugged_size - vm->plugged_size;
+			if (rc == -EBUSY)
+				vm->stats.unplug_busy++;
 		}
 	}
 
@@ -1637,6 +1886,56 @@ static enum hrtimer_restart virtio_mem_timer_expired(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+/*
+ * Statistics in /sys/bus/virtio/devices/virtioX/virtio_mem/. Written only by
+ * the workqueue, so they are read without locking.
+ */
+#define VIRTIO_MEM_STAT_ATTR(_name, _expr)				\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct virtio_mem *vm = dev_to_virtio(dev)->priv;		\
+									\
+	return sprintf(buf, "%llu\n", (unsigned long long)(_expr));	\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+VIRTIO_MEM_STAT_ATTR(plug_requests, READ_ONCE(vm->stats.plug_requests));
+VIRTIO_MEM_STAT_ATTR(unplug_requests, READ_ONCE(vm->stats.unplug_requests));
+VIRTIO_MEM_STAT_ATTR(unplug_busy, READ_ONCE(vm->stats.unplug_busy));
+VIRTIO_MEM_STAT_ATTR(plug_ms, div_u64(READ_ONCE(vm->stats.plug_ns),
+				      NSEC_PER_MSEC));
+VIRTIO_MEM_STAT_ATTR(unplug_ms, div_u64(READ_ONCE(vm->stats.unplug_ns),
+					NSEC_PER_MSEC));
+VIRTIO_MEM_STAT_ATTR(last_plug_ms, div_u64(READ_ONCE(vm->stats.last_plug_ns),
+					   NSEC_PER_MSEC));
+VIRTIO_MEM_STAT_ATTR(last_unplug_ms,
+		     div_u64(READ_ONCE(vm->stats.last_unplug_ns),
+			     NSEC_PER_MSEC));
+VIRTIO_MEM_STAT_ATTR(plugged_bytes, READ_ONCE(vm->stats.plugged_bytes));
+VIRTIO_MEM_STAT_ATTR(unplugged_bytes, READ_ONCE(vm->stats.unplugged_bytes));
+VIRTIO_MEM_STAT_ATTR(online_movable_blocks,
+		     READ_ONCE(vm->nb_mb_state[VIRTIO_MEM_MB_STATE_ONLINE_MOVABLE]));
+
+static struct attribute *virtio_mem_stats_attrs[] = {
+	&dev_attr_plug_requests.attr,
+	&dev_attr_unplug_requests.attr,
+	&dev_attr_unplug_busy.attr,
+	&dev_attr_plug_ms.attr,
+	&dev_attr_unplug_ms.attr,
+	&dev_attr_last_plug_ms.attr,
+	&dev_attr_last_unplug_ms.attr,
+	&dev_attr_plugged_bytes.attr,
+	&dev_attr_unplugged_bytes.attr,
+	&dev_attr_online_movable_blocks.attr,
+	NULL,
+};
+
+static const struct attribute_group virtio_mem_stats_group = {
+	.name = "virtio_mem",
+	.attrs = virtio_mem_stats_attrs,
+};
+
 static void virtio_mem_handle_response(struct virtqueue *vq)
 {
 	struct virtio_mem *vm = vq->vdev->priv;
@@ -1838,6 +2137,10 @@ static int virtio_mem_probe(struct virtio_device *vdev)
 	if (rc)
 		goto out_unreg_mem;
 
+	rc = sysfs_create_group(&vdev->dev.kobj, &virtio_mem_stats_group);
+	if (rc)
+		goto out_unreg_dev;
+
 	virtio_device_ready(vdev);
 
 	/* trigger a config update to start processing the requested_size */
@@ -1845,6 +2148,8 @@ static int virtio_mem_probe(struct virtio_device *vdev)
 	queue_work(system_freezable_wq, &vm->wq);
 
 	return 0;
+out_unreg_dev:
+	unregister_virtio_mem_device(vm);
 out_unreg_mem:
 	unregister_memory_notifier(&vm->memory_notifier);
 out_del_resource:
@@ -1897,6 +2202,7 @@ static void virtio_mem_remove(struct virtio_device *vdev)
 	/* unregister callbacks */
 	unregister_virtio_mem_device(vm);
 	unregister_memory_notifier(&vm->memory_notifier);
+	sysfs_remove_group(&vdev->dev.kobj, &virtio_mem_stats_group);
 
 	/*
 	 * There is no way we could reliably remove all memory we have added to
@@ -105,6 +105,9 @@ struct vring_virtqueue {
 	/* Host publishes avail event idx */
 	bool event;
 
+	/* Host uses buffers in the order they were made available */
+	bool in_order;
+
 	/* Head of free buffer list. */
 	unsigned int free_head;
 	/* Number we've added since last sync. */
@@ -158,6 +161,14 @@ struct vring_virtqueue {
 			/* Index of the next avail descriptor. */
 			u16 next_avail_idx;
 
+			/*
+			 * In order: id of the last buffer of the batch being
+			 * reclaimed, vring.num if there is none, and the
+			 * length the device wrote for it.
+			 */
+			u16 batch_last;
+			u32 batch_len;
+
 			/*
 			 * Last written value to driver->flags in
 			 * guest byte order.
@@ -389,6 +400,34 @@ static void vring_unmap_one_split(const struct vring_virtqueue *vq,
 	}
 }
 
+/*
+ * Indirect tables are mapped for every buffer that is added.  When the
+ * device can only reach memory that is shared with the hypervisor (e.g.
+ * encrypted guests), take them from the persistent shared pool so that
+ * mapping them does not bounce through swiotlb.
+ */
+static void *vring_alloc_indirect(const struct vring_virtqueue *vq,
+				  size_t size, gfp_t gfp)
+{
+	void *desc = NULL;
+
+	if (vq->use_dma_api)
+		desc = dma_alloc_shared(size);
+	if (!desc)
+		desc = kmalloc(size, gfp);
+	return desc;
+}
+
+static void vring_free_indirect(const struct vring_virtqueue *vq,
+				void *desc, size_t size)
+{
+	if (vq->use_dma_api && desc &&
+	    dma_is_shared(virt_to_phys(desc), size))
+		dma_free_shared(desc, size);
+	else
+		kfree(desc);
+}
+
 static struct vring_desc *alloc_indirect_split(struct virtqueue *_vq,
 					       unsigned int total_sg,
 					       gfp_t gfp)
@@ -403,7 +442,9 @@ static struct vring_desc *alloc_indirect_split(struct virtqueue *_vq,
 	 */
 	gfp &= ~__GFP_HIGHMEM;
 
-	desc = kmalloc_array(total_sg, sizeof(struct vring_desc), gfp);
+	desc = vring_alloc_indirect(to_vvq(_vq),
+				    array_size(total_sg, sizeof(struct vring_desc)),
+				    gfp);
 	if (!desc)
 		return NULL;
 
@@ -473,7 +514,8 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 		if (out_sgs)
 			vq->notify(&vq->vq);
 		if (indirect)
-			kfree(desc);
+			vring_free_indirect(vq, desc,
+					    total_sg * sizeof(struct vring_desc));
 		END_USE(vq);
 		return -ENOSPC;
 	}
@@ -580,7 +622,8 @@ unmap_release:
 	}
 
 	if (indirect)
-		kfree(desc);
+		vring_free_indirect(vq, desc,
+				    total_sg * sizeof(struct vring_desc));
 
 	END_USE(vq);
 	return -ENOMEM;
@@ -662,7 +705,7 @@ static void detach_buf_split(struct vring_virtqueue *vq, unsigned int head,
 		for (j = 0; j < len / sizeof(struct vring_desc); j++)
 			vring_unmap_one_split(vq, &indir_desc[j]);
 
-		kfree(indir_desc);
+		vring_free_indirect(vq, indir_desc, len);
 		vq->split.desc_state[head].indir_desc = NULL;
 	} else if (ctx) {
 		*ctx = vq->split.desc_state[head].indir_desc;
@@ -959,7 +1002,8 @@ static void vring_unmap_desc_packed(const struct vring_virtqueue *vq,
 	}
 }
 
-static struct vring_packed_desc *alloc_indirect_packed(unsigned int total_sg,
+static struct vring_packed_desc *alloc_indirect_packed(struct vring_virtqueue *vq,
+						       unsigned int total_sg,
 						       gfp_t gfp)
 {
 	struct vring_packed_desc *desc;
@@ -971,7 +1015,9 @@ static struct vring_packed_desc *alloc_indirect_packed(unsigned int total_sg,
 	 */
 	gfp &= ~__GFP_HIGHMEM;
 
-	desc = kmalloc_array(total_sg, sizeof(struct vring_packed_desc), gfp);
+	desc = vring_alloc_indirect(vq,
+			array_size(total_sg, sizeof(struct vring_packed_desc)),
+			gfp);
 
 	return desc;
 }
@@ -991,11 +1037,12 @@ static int virtqueue_add_indirect_packed(struct vring_virtqueue *vq,
 	dma_addr_t addr;
 
 	head = vq->packed.next_avail_idx;
-	desc = alloc_indirect_packed(total_sg, gfp);
+	desc = alloc_indirect_packed(vq, total_sg, gfp);
 
 	if (unlikely(vq->vq.num_free < 1)) {
 		pr_debug("Can't add buf len 1 - avail = 0\n");
-		kfree(desc);
+		vring_free_indirect(vq, desc,
+				    total_sg * sizeof(struct vring_packed_desc));
 		END_USE(vq);
 		return -ENOSPC;
 	}
@@ -1082,7 +1129,8 @@ unmap_release:
 	for (i = 0; i < err_idx; i++)
 		vring_unmap_desc_packed(vq, &desc[i]);
 
-	kfree(desc);
+	vring_free_indirect(vq, desc,
+			    total_sg * sizeof(struct vring_packed_desc));
 
 	END_USE(vq);
 	return -ENOMEM;
@@ -1290,8 +1338,14 @@ static void detach_buf_packed(struct vring_virtqueue *vq,
 	/* Clear data ptr. */
 	state->data = NULL;
 
-	vq->packed.desc_state[state->last].next = vq->free_head;
-	vq->free_head = id;
+	/*
+	 * In order, ids are the ring positions of the heads and the free
+	 * list stays in ring order: there is nothing to relink.
+	 */
+	if (!vq->in_order) {
+		vq->packed.desc_state[state->last].next = vq->free_head;
+		vq->free_head = id;
+	}
 	vq->vq.num_free += state->num;
 
 	if (unlikely(vq->use_dma_api)) {
@@ -1304,7 +1358,7 @@ static void detach_buf_packed(struct vring_virtqueue *vq,
 	}
 
 	if (vq->indirect) {
-		u32 len;
+		u32 len = 0;
 
 		/* Free the indirect table, if any, now that it's unmapped. */
 		desc = state->indir_desc;
@@ -1317,7 +1371,8 @@ static void detach_buf_packed(struct vring_virtqueue *vq,
 					i++)
 				vring_unmap_desc_packed(vq, &desc[i]);
 		}
-		kfree(desc);
+		/* len is only known (and only needed) with the DMA API. */
+		vring_free_indirect(vq, desc, len);
 		state->indir_desc = NULL;
 	} else if (ctx) {
 		*ctx = state->indir_desc;
@@ -1337,12 +1392,92 @@ static inline bool is_used_desc_packed(const struct vring_virtqueue *vq,
 	return avail == used && used == used_wrap_counter;
 }
 
+static inline bool in_order_batch_packed(const struct vring_virtqueue *vq)
+{
+	return vq->in_order && vq->packed.batch_last != vq->packed.vring.num;
+}
+
 static inline bool more_used_packed(const struct vring_virtqueue *vq)
 {
-	return is_used_desc_packed(vq, vq->last_used_idx,
+	return in_order_batch_packed(vq) ||
+	       is_used_desc_packed(vq, vq->last_used_idx,
 			vq->packed.used_wrap_counter);
 }
 
+/*
+ * In order, the next buffer to be used is always the one whose head is at
+ * last_used_idx. The device may write a single used descriptor for a batch
+ * of buffers, with the id of the last one; the other buffers of the batch
+ * are then reported with a length of 0.
+ */
+static void *detach_buf_in_order_packed(struct vring_virtqueue *vq,
+					unsigned int *len, void **ctx)
+{
+	u16 num = vq->packed.vring.num;
+	u16 last_used = vq->last_used_idx;
+	u16 id;
+	void *ret;
+
+	if (!in_order_batch_packed(vq)) {
+		if (!is_used_desc_packed(vq, last_used,
+					 vq->packed.used_wrap_counter))
+			return NULL;
+
+		/* Only get used elements after they have been exposed by host. */
+		virtio_rmb(vq->weak_barriers);
+
+		id = le16_to_cpu(vq->packed.vring.desc[last_used].id);
+		if (unlikely(id >= num ||
+			     (id + num - last_used) % num >=
+			     num - vq->vq.num_free ||
+			     !vq->packed.desc_state[id].data)) {
+			BAD_RING(vq, "id %u is not in use\n", id);
+			return NULL;
+		}
+		vq->packed.batch_last = id;
+		vq->packed.batch_len =
+			le32_to_cpu(vq->packed.vring.desc[last_used].len);
+	}
+
+	ret = vq->packed.desc_state[last_used].data;
+	if (unlikely(!ret)) {
+		BAD_RING(vq, "id %u is not a head!\n", last_used);
+		return NULL;
+	}
+
+	if (last_used == vq->packed.batch_last) {
+		*len = vq->packed.batch_len;
+		vq->packed.batch_last = num;
+	} else {
+		*len = 0;
+	}
+
+	detach_buf_packed(vq, last_used, ctx);
+
+	vq->last_used_idx += vq->packed.desc_state[last_used].num;
+	if (unlikely(vq->last_used_idx >= num)) {
+		vq->last_used_idx -= num;
+		vq->packed.used_wrap_counter ^= 1;
+	}
+
+	return ret;
+}
+
+static void update_used_event_packed(struct vring_virtqueue *vq)
+{
+	/*
+	 * If we expect an interrupt for the next entry, tell host
+	 * by writing event index and flush out the write before
+	 * the read in the next get_buf call.
+	 */
+	if (vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC)
+		virtio_store_mb(vq->weak_barriers,
+				&vq->packed.vring.driver->off_wrap,
+				cpu_to_le16(vq->last_used_idx |
+					(vq->packed.used_wrap_counter <<
+					 VRING_PACKED_EVENT_F_WRAP_CTR)));
+}
+
 static void *virtqueue_get_buf_ctx_packed(struct virtqueue *_vq,
 					  unsigned int *len,
 					  void **ctx)
@@ -1358,6 +1493,16 @@ static void *virtqueue_get_buf_ctx_packed(struct virtqueue *_vq,
 		return NULL;
 	}
 
+	if (vq->in_order) {
+		ret = detach_buf_in_order_packed(vq, len, ctx);
+		if (ret) {
+			update_used_event_packed(vq);
+			LAST_ADD_TIME_INVALID(vq);
+		}
+		END_USE(vq);
+		return ret;
+	}
+
 	if (!more_used_packed(vq)) {
 		pr_debug("No more buffers in queue\n");
 		END_USE(vq);
@@ -1390,17 +1535,7 @@ static void *virtqueue_get_buf_ctx_packed(struct virtqueue *_vq,
 		vq->packed.used_wrap_counter ^= 1;
 	}
 
-	/*
-	 * If we expect an interrupt for the next entry, tell host
-	 * by writing event index and flush out the write before
-	 * the read in the next get_buf call.
-	 */
-	if (vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC)
-		virtio_store_mb(vq->weak_barriers,
-				&vq->packed.vring.driver->off_wrap,
-				cpu_to_le16(vq->last_used_idx |
-					(vq->packed.used_wrap_counter <<
-					 VRING_PACKED_EVENT_F_WRAP_CTR)));
+	update_used_event_packed(vq);
 
 	LAST_ADD_TIME_INVALID(vq);
 
@@ -1408,6 +1543,40 @@ static void *virtqueue_get_buf_ctx_packed(struct virtqueue *_vq,
 	return ret;
 }
 
+static unsigned int virtqueue_get_buf_batch_packed(struct virtqueue *_vq,
+						   void **bufs,
+						   unsigned int *lens,
+						   void **ctxs,
+						   unsigned int max)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int n, len;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return 0;
+	}
+
+	for (n = 0; n < max; n++) {
+		bufs[n] = detach_buf_in_order_packed(vq, &len,
+						     ctxs ? &ctxs[n] : NULL);
+		if (!bufs[n])
+			break;
+		if (lens)
+			lens[n] = len;
+	}
+
+	if (n) {
+		update_used_event_packed(vq);
+		LAST_ADD_TIME_INVALID(vq);
+	}
+
+	END_USE(vq);
+	return n;
+}
+
 static void virtqueue_disable_cb_packed(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
@@ -1461,6 +1630,10 @@ static bool virtqueue_poll_packed(struct virtqueue *_vq, u16 off_wrap)
 	bool wrap_counter;
 	u16 used_idx;
 
+	/* The rest of a batch is used without the device marking it */
+	if (in_order_batch_packed(vq))
+		return true;
+
 	wrap_counter = off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR;
 	used_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
 
@@ -1515,9 +1688,7 @@ static bool virtqueue_enable_cb_delayed_packed(struct virtqueue *_vq)
 	 */
 	virtio_mb(vq->weak_barriers);
 
-	if (is_used_desc_packed(vq,
-				vq->last_used_idx,
-				vq->packed.used_wrap_counter)) {
+	if (more_used_packed(vq)) {
 		END_USE(vq);
 		return false;
 	}
@@ -1617,6 +1788,7 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
 		!context;
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = virtio_has_feature(vdev, VIRTIO_F_IN_ORDER);
 
 	if (virtio_has_feature(vdev, VIRTIO_F_ORDER_PLATFORM))
 		vq->weak_barriers = false;
@@ -1634,6 +1806,7 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	vq->packed.vring.device = device;
 
 	vq->packed.next_avail_idx = 0;
+	vq->packed.batch_last = num;
 	vq->packed.avail_wrap_counter = 1;
 	vq->packed.used_wrap_counter = 1;
 	vq->packed.event_flags_shadow = 0;
@@ -1648,7 +1821,10 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	memset(vq->packed.desc_state, 0,
 		num * sizeof(struct vring_desc_state_packed));
 
-	/* Put everything in free lists. */
+	/*
+	 * Put everything in free lists. The last entry wraps to the first,
+	 * so that in order the list is the ring itself.
+	 */
 	vq->free_head = 0;
 	for (i = 0; i < num-1; i++)
 		vq->packed.desc_state[i].next = i + 1;
@@ -1906,6 +2082,48 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	return virtqueue_get_buf_ctx(_vq, len, NULL);
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_buf);
+
+/**
+ * virtqueue_get_buf_batch - get the next used buffers
+ * @_vq: the struct virtqueue we're talking about.
+ * @bufs: where to put the "data" tokens handed to virtqueue_add_*().
+ * @lens: where to put the lengths written by the other side, or NULL.
+ * @ctxs: where to put the contexts handed to virtqueue_add_inbuf_ctx(),
+ *	or NULL.
+ * @max: the maximum number of buffers to get.
+ *
+ * Works like calling virtqueue_get_buf_ctx() up to @max times, but when
+ * the device uses buffers in order they are reclaimed in ring order without
+ * any free list handling and the used event is only written once.
+ *
+ * Caller must ensure we don't call this with other virtqueue
+ * operations at the same time (except where noted).
+ *
+ * Returns the number of buffers put in @bufs.
+ */
+unsigned int virtqueue_get_buf_batch(struct virtqueue *_vq, void **bufs,
+				     unsigned int *lens, void **ctxs,
+				     unsigned int max)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int n, len;
+
+	if (vq->packed_ring && vq->in_order)
+		return virtqueue_get_buf_batch_packed(_vq, bufs, lens, ctxs,
+						      max);
+
+	for (n = 0; n < max; n++) {
+		bufs[n] = virtqueue_get_buf_ctx(_vq, &len,
+						ctxs ? &ctxs[n] : NULL);
+		if (!bufs[n])
+			break;
+		if (lens)
+			lens[n] = len;
+	}
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(virtqueue_get_buf_batch);
 /**
  * virtqueue_disable_cb - disable callbacks
  * @_vq: the struct virtqueue we're talking about.
@@ -2232,6 +2450,11 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_F_RING_PACKED:
 			break;
+		case VIRTIO_F_IN_ORDER:
+			/* Only the packed ring implements it */
+			if (!__virtio_test_bit(vdev, VIRTIO_F_RING_PACKED))
+				__virtio_clear_bit(vdev, i);
+			break;
 		case VIRTIO_F_ORDER_PLATFORM:
 			break;
 		default:
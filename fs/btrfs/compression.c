@@ -1137,6 +1137,21 @@ static void put_workspace(int type, struct list_head *ws)
 	}
 }
 
+static void count_decompress(struct btrfs_fs_info *fs_info, int type,
+			     size_t in, size_t out, int ret)
+{
+	struct btrfs_compress_stats *stats;
+
+	stats = get_cpu_ptr(fs_info->compress_stats);
+	stats[type].decompress_calls++;
+	stats[type].decompress_in += in;
+	if (ret)
+		stats[type].decompress_fails++;
+	else
+		stats[type].decompress_out += out;
+	put_cpu_ptr(stats);
+}
+
 /*
  * Adjust @level according to the limits of the compression algorithm or
  * fallback to default
@@ -1187,11 +1202,22 @@ int btrfs_compress_pages(unsigned int type_level, struct address_space *mapping,
 	struct list_head *workspace;
 	int ret;
 
+	struct btrfs_compress_stats *stats;
+
 	level = btrfs_compress_set_level(type, level);
 	workspace = get_workspace(type, level);
 	ret = compression_compress_pages(type, workspace, mapping, start, pages,
 					 out_pages, total_in, total_out);
 	put_workspace(type, workspace);
+
+	stats = get_cpu_ptr(btrfs_sb(mapping->host->i_sb)->compress_stats);
+	stats[type].compress_calls++;
+	stats[type].compress_in += *total_in;
+	if (ret)
+		stats[type].compress_fails++;
+	else
+		stats[type].compress_out += *total_out;
+	put_cpu_ptr(stats);
 	return ret;
 }
 
@@ -1219,6 +1245,8 @@ static int btrfs_decompress_bio(struct compressed_bio *cb)
 	ret = compression_decompress_bio(type, workspace, cb);
 	put_workspace(type, workspace);
 
+	count_decompress(btrfs_sb(cb->inode->i_sb), type, cb->compressed_len,
+			 cb->len, ret);
 	return ret;
 }
 
@@ -1238,9 +1266,54 @@ int btrfs_decompress(int type, unsigned char *data_in, struct page *dest_page,
 				     start_byte, srclen, destlen);
 	put_workspace(type, workspace);
 
+	count_decompress(btrfs_sb(dest_page->mapping->host->i_sb), type, srclen,
+			 destlen, ret);
 	return ret;
 }
 
+int btrfs_alloc_compress_stats(struct btrfs_fs_info *fs_info)
+{
+	fs_info->compress_stats = __alloc_percpu(
+			sizeof(struct btrfs_compress_stats) *
+			BTRFS_NR_COMPRESS_TYPES,
+			__alignof__(struct btrfs_compress_stats));
+	if (!fs_info->compress_stats)
+		return -ENOMEM;
+	return 0;
+}
+
+void btrfs_free_compress_stats(struct btrfs_fs_info *fs_info)
+{
+	free_percpu(fs_info->compress_stats);
+	fs_info->compress_stats = NULL;
+}
+
+/*
+ * Sum up the per-cpu compression statistics of compression @type into @sum.
+ * The counters are updated without synchronization so the result is only
+ * approximate while compression is running.
+ */
+void btrfs_sum_compress_stats(struct btrfs_fs_info *fs_info, int type,
+			      struct btrfs_compress_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct btrfs_compress_stats *stats =
+			per_cpu_ptr(fs_info->compress_stats, cpu) + type;
+
+		sum->compress_calls += stats->compress_calls;
+		sum->compress_fails += stats->compress_fails;
+		sum->compress_in += stats->compress_in;
+		sum->compress_out += stats->compress_out;
+		sum->decompress_calls += stats->decompress_calls;
+		sum->decompress_fails += stats->decompress_fails;
+		sum->decompress_in += stats->decompress_in;
+		sum->decompress_out += stats->decompress_out;
+	}
+}
+
 void __init btrfs_init_compress(void)
 {
 	btrfs_init_workspace_manager(BTRFS_COMPRESS_NONE);
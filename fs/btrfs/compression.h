@@ -9,6 +9,7 @@
 #include <linux/sizes.h>
 
 struct btrfs_inode;
+struct btrfs_fs_info;
 
 /*
  * We want to make sure that amount of RAM required to uncompress an extent is
@@ -110,6 +111,30 @@ enum btrfs_compression_type {
 	BTRFS_NR_COMPRESS_TYPES = 4,
 };
 
+/*
+ * Per-mount compression statistics, one set per compression type, kept per
+ * cpu and summed up when read from sysfs.
+ */
+struct btrfs_compress_stats {
+	/* Calls to the compressor, and how many of them failed */
+	u64 compress_calls;
+	u64 compress_fails;
+	/* Bytes fed to the compressor and compressed bytes it produced */
+	u64 compress_in;
+	u64 compress_out;
+	/* Calls to the decompressor, and how many of them failed */
+	u64 decompress_calls;
+	u64 decompress_fails;
+	/* Compressed bytes read and the uncompressed bytes they expanded to */
+	u64 decompress_in;
+	u64 decompress_out;
+};
+
+int btrfs_alloc_compress_stats(struct btrfs_fs_info *fs_info);
+void btrfs_free_compress_stats(struct btrfs_fs_info *fs_info);
+void btrfs_sum_compress_stats(struct btrfs_fs_info *fs_info, int type,
+			      struct btrfs_compress_stats *sum);
+
 struct workspace_manager {
 	struct list_head idle_ws;
 	spinlock_t ws_lock;
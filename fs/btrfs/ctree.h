@@ -48,6 +48,8 @@ extern struct kmem_cache *btrfs_free_space_cachep;
 extern struct kmem_cache *btrfs_free_space_bitmap_cachep;
 struct btrfs_ordered_sum;
 struct btrfs_ref;
+struct btrfs_io_bio;
+struct btrfs_compress_stats;
 
 #define BTRFS_MAGIC 0x4D5F53665248425FULL /* ascii _BHRfS_M, no null */
 
@@ -761,6 +763,12 @@ struct btrfs_fs_info {
 	struct btrfs_workqueue *caching_workers;
 	struct btrfs_workqueue *readahead_workers;
 
+	/*
+	 * Checksum verification of large data reads is spread over this
+	 * queue, on the NUMA node of the CPU that completed the read.
+	 */
+	struct workqueue_struct *csum_verify_workers;
+
 	/*
 	 * fixup workers take dirty pages that didn't properly go through
 	 * the cow mechanism and make them safe to write.  It happens
@@ -853,6 +861,9 @@ struct btrfs_fs_info {
 
 	struct btrfs_discard_ctl discard_ctl;
 
+	/* Per-cpu array of BTRFS_NR_COMPRESS_TYPES compression counters */
+	struct btrfs_compress_stats __percpu *compress_stats;
+
 #ifdef CONFIG_BTRFS_FS_CHECK_INTEGRITY
 	u32 check_integrity_print_mask;
 #endif
@@ -2977,6 +2988,7 @@ int btrfs_bio_fits_in_stripe(struct page *page, size_t size, struct bio *bio,
 void btrfs_set_range_writeback(struct extent_io_tree *tree, u64 start, u64 end);
 vm_fault_t btrfs_page_mkwrite(struct vm_fault *vmf);
 int btrfs_readpage(struct file *file, struct page *page);
+void btrfs_verify_bio_csums(struct inode *inode, struct btrfs_io_bio *io_bio);
 void btrfs_evict_inode(struct inode *inode);
 int btrfs_write_inode(struct inode *inode, struct writeback_control *wbc);
 struct inode *btrfs_alloc_inode(struct super_block *sb);
@@ -2815,6 +2815,18 @@ static void end_bio_extent_readpage(struct bio *bio)
 	struct bvec_iter_all iter_all;
 
 	ASSERT(!bio_flagged(bio, BIO_CLONED));
+
+	/*
+	 * Large data reads get their checksums verified in parallel first, the
+	 * readpage_end_io_hook below then only has to look the results up.
+	 */
+	if (likely(uptodate)) {
+		struct inode *inode = bio_first_page_all(bio)->mapping->host;
+
+		if (btrfs_ino(BTRFS_I(inode)) != BTRFS_BTREE_INODE_OBJECTID)
+			btrfs_verify_bio_csums(inode, io_bio);
+	}
+
 	bio_for_each_segment_all(bvec, bio, iter_all) {
 		struct page *page = bvec->bv_page;
 		struct inode *inode = page->mapping->host;
@@ -2860,10 +2860,146 @@ static int btrfs_readpage_end_io_hook(struct btrfs_io_bio *io_bio,
 	}
 
 	phy_offset >>= inode->i_sb->s_blocksize_bits;
+	if (io_bio->csum_ok && test_bit(phy_offset, io_bio->csum_ok))
+		return 0;
 	return check_data_csum(inode, io_bio, phy_offset, page, offset, start,
 			       (size_t)(end - start + 1));
 }
 
+/*
+ * Data reads of at least this many sectors get their checksums verified in
+ * chunks of BTRFS_CSUM_VERIFY_CHUNK sectors by several workers.
+ */
+#define BTRFS_CSUM_VERIFY_MIN_SECTORS	64
+#define BTRFS_CSUM_VERIFY_CHUNK		16
+
+struct btrfs_csum_verify {
+	struct btrfs_fs_info *fs_info;
+	struct btrfs_io_bio *io_bio;
+	struct page **pages;
+	atomic_t pending;
+	struct completion done;
+};
+
+struct btrfs_csum_verify_work {
+	struct work_struct work;
+	struct btrfs_csum_verify *cv;
+	unsigned int first;
+	unsigned int nr;
+};
+
+static void csum_verify_chunk(struct btrfs_csum_verify *cv, unsigned int first,
+			      unsigned int nr)
+{
+	struct btrfs_fs_info *fs_info = cv->fs_info;
+	SHASH_DESC_ON_STACK(shash, fs_info->csum_shash);
+	u16 csum_size = btrfs_super_csum_size(fs_info->super_copy);
+	u8 csum[BTRFS_CSUM_SIZE];
+	unsigned int i;
+	char *kaddr;
+
+	shash->tfm = fs_info->csum_shash;
+	for (i = first; i < first + nr; i++) {
+		kaddr = kmap_atomic(cv->pages[i]);
+		crypto_shash_digest(shash, kaddr, PAGE_SIZE, csum);
+		kunmap_atomic(kaddr);
+
+		if (!memcmp(csum, cv->io_bio->csum + i * csum_size, csum_size))
+			set_bit(i, cv->io_bio->csum_ok);
+	}
+
+	if (atomic_dec_and_test(&cv->pending))
+		complete(&cv->done);
+}
+
+static void csum_verify_work_fn(struct work_struct *work)
+{
+	struct btrfs_csum_verify_work *w =
+		container_of(work, struct btrfs_csum_verify_work, work);
+
+	csum_verify_chunk(w->cv, w->first, w->nr);
+}
+
+/*
+ * btrfs_verify_bio_csums - verify the checksums of a large data read upfront
+ *
+ * @inode:  the inode the read bio belongs to
+ * @io_bio: the completed read bio
+ *
+ * Completing a read bio checksums its pages one after another in the end_io
+ * worker, which limits a single large read to the speed of one CPU. Split the
+ * verification of large reads over csum_verify_workers on the local NUMA node
+ * instead, and record the sectors that matched in io_bio->csum_ok. The
+ * readpage end_io hook skips those, and does the usual verification and
+ * error handling for the rest, so the workers don't touch anything but the
+ * bitmap.
+ *
+ * Best effort: if the bio doesn't qualify or we fail to allocate, the end_io
+ * hook verifies every sector as usual.
+ */
+void btrfs_verify_bio_csums(struct inode *inode, struct btrfs_io_bio *io_bio)
+{
+	struct btrfs_fs_info *fs_info = btrfs_sb(inode->i_sb);
+	struct btrfs_csum_verify_work *works;
+	struct btrfs_csum_verify cv;
+	struct bio *bio = &io_bio->bio;
+	struct bvec_iter_all iter_all;
+	struct bio_vec *bvec;
+	unsigned int nr_sectors = 0;
+	unsigned int nr_works;
+	int node = numa_node_id();
+	int i;
+
+	if (!in_task() || !io_bio->csum || io_bio->csum_ok ||
+	    (BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM) ||
+	    fs_info->sectorsize != PAGE_SIZE)
+		return;
+
+	bio_for_each_segment_all(bvec, bio, iter_all) {
+		if (bvec->bv_offset || bvec->bv_len != PAGE_SIZE)
+			return;
+		nr_sectors++;
+	}
+	if (nr_sectors < BTRFS_CSUM_VERIFY_MIN_SECTORS)
+		return;
+
+	nr_works = DIV_ROUND_UP(nr_sectors, BTRFS_CSUM_VERIFY_CHUNK);
+	cv.pages = kmalloc_array(nr_sectors, sizeof(*cv.pages), GFP_NOFS);
+	works = kmalloc_array(nr_works, sizeof(*works), GFP_NOFS);
+	io_bio->csum_ok = bitmap_zalloc(nr_sectors, GFP_NOFS);
+	if (!cv.pages || !works || !io_bio->csum_ok) {
+		bitmap_free(io_bio->csum_ok);
+		io_bio->csum_ok = NULL;
+		goto out;
+	}
+
+	i = 0;
+	bio_for_each_segment_all(bvec, bio, iter_all)
+		cv.pages[i++] = bvec->bv_page;
+
+	cv.fs_info = fs_info;
+	cv.io_bio = io_bio;
+	atomic_set(&cv.pending, nr_works);
+	init_completion(&cv.done);
+
+	/* Hand out all but the first chunk, which we do ourselves */
+	for (i = 1; i < nr_works; i++) {
+		works[i].cv = &cv;
+		works[i].first = i * BTRFS_CSUM_VERIFY_CHUNK;
+		works[i].nr = min_t(unsigned int, BTRFS_CSUM_VERIFY_CHUNK,
+				    nr_sectors - works[i].first);
+		INIT_WORK(&works[i].work, csum_verify_work_fn);
+		queue_work_node(node, fs_info->csum_verify_workers,
+				&works[i].work);
+	}
+	csum_verify_chunk(&cv, 0, min_t(unsigned int, BTRFS_CSUM_VERIFY_CHUNK,
+					nr_sectors));
+	wait_for_completion(&cv.done);
+out:
+	kfree(works);
+	kfree(cv.pages);
+}
+
 /*
  * btrfs_add_delayed_iput - perform a delayed iput on @inode
  *
@@ -20,6 +20,7 @@
 #include "space-info.h"
 #include "block-group.h"
 #include "qgroup.h"
+#include "compression.h"
 
 struct btrfs_feature_attr {
 	struct kobj_attribute kobj_attr;
@@ -809,6 +810,36 @@ static ssize_t btrfs_checksum_show(struct kobject *kobj,
 
 BTRFS_ATTR(, checksum, btrfs_checksum_show);
 
+static ssize_t btrfs_compression_stats_show(struct kobject *kobj,
+					    struct kobj_attribute *a, char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj);
+	struct btrfs_compress_stats stats;
+	ssize_t len = 0;
+	int type;
+
+	for (type = BTRFS_COMPRESS_ZLIB; type < BTRFS_NR_COMPRESS_TYPES;
+	     type++) {
+		const char *name = btrfs_compress_type2str(type);
+
+		btrfs_sum_compress_stats(fs_info, type, &stats);
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+			"%s_compress_calls %llu\n%s_compress_fails %llu\n"
+			"%s_compress_in %llu\n%s_compress_out %llu\n"
+			"%s_decompress_calls %llu\n%s_decompress_fails %llu\n"
+			"%s_decompress_in %llu\n%s_decompress_out %llu\n",
+			name, stats.compress_calls, name, stats.compress_fails,
+			name, stats.compress_in, name, stats.compress_out,
+			name, stats.decompress_calls,
+			name, stats.decompress_fails,
+			name, stats.decompress_in, name, stats.decompress_out);
+	}
+
+	return len;
+}
+
+BTRFS_ATTR(, compression_stats, btrfs_compression_stats_show);
+
 static const struct attribute *btrfs_attrs[] = {
 	BTRFS_ATTR_PTR(, label),
 	BTRFS_ATTR_PTR(, nodesize),
@@ -817,6 +848,7 @@ static const struct attribute *btrfs_attrs[] = {
 	BTRFS_ATTR_PTR(, quota_override),
 	BTRFS_ATTR_PTR(, metadata_uuid),
 	BTRFS_ATTR_PTR(, checksum),
+	BTRFS_ATTR_PTR(, compression_stats),
 	NULL,
 };
 
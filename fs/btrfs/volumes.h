@@ -292,6 +292,8 @@ struct btrfs_io_bio {
 	u64 logical;
 	u8 *csum;
 	u8 csum_inline[BTRFS_BIO_INLINE_CSUM_SIZE];
+	/* Sectors with verified csums, see btrfs_verify_bio_csums() */
+	unsigned long *csum_ok;
 	struct bvec_iter iter;
 	/*
 	 * This member must come last, bio_alloc_bioset will allocate enough
@@ -311,6 +313,8 @@ static inline void btrfs_io_bio_free_csum(struct btrfs_io_bio *io_bio)
 		kfree(io_bio->csum);
 		io_bio->csum = NULL;
 	}
+	bitmap_free(io_bio->csum_ok);
+	io_bio->csum_ok = NULL;
 }
 
 struct btrfs_bio_stripe {
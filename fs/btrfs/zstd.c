@@ -70,6 +70,15 @@ struct workspace {
  * A timer is used to reclaim workspaces if they have not been used for
  * ZSTD_BTRFS_RECLAIM_JIFFIES.  This helps keep only active workspaces around.
  * The upper bound is provided by the workqueue limit which is 2 (percpu limit).
+ *
+ * In front of all that each cpu caches one idle workspace.  Putting a
+ * workspace parks it in the slot of the current cpu, and the next get on that
+ * cpu takes it back, so back to back compressions on a cpu don't touch the
+ * shared lock.  The slot is accessed with xchg() as we may be preempted or
+ * the reclaim timer may empty it from another cpu; it is only a cache, so it
+ * doesn't matter which cpu's slot we end up using.  A cached workspace is on
+ * none of the lists.  The max level workspace is never cached as allocation
+ * failures wait for it to be put back.
  */
 
 struct zstd_workspace_manager {
@@ -84,6 +93,8 @@ struct zstd_workspace_manager {
 
 static struct zstd_workspace_manager wsm;
 
+static DEFINE_PER_CPU(struct workspace *, zstd_pcp_ws);
+
 static size_t zstd_ws_mem_sizes[ZSTD_BTRFS_MAX_LEVEL];
 
 static inline struct workspace *list_to_workspace(struct list_head *list)
@@ -93,6 +104,37 @@ static inline struct workspace *list_to_workspace(struct list_head *list)
 
 void zstd_free_workspace(struct list_head *ws);
 struct list_head *zstd_alloc_workspace(unsigned int level);
+static void __zstd_put_workspace(struct workspace *workspace);
+
+/*
+ * zstd_pcp_reclaim - reclaim idle per-cpu cached workspaces
+ * @reclaim_threshold: free workspaces last used before this time
+ *
+ * Returns true if there are still workspaces cached per cpu.
+ */
+static bool zstd_pcp_reclaim(unsigned long reclaim_threshold)
+{
+	struct workspace *workspace;
+	bool cached = false;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct workspace **slot = per_cpu_ptr(&zstd_pcp_ws, cpu);
+
+		workspace = READ_ONCE(*slot);
+		if (!workspace)
+			continue;
+		if (time_after(workspace->last_used, reclaim_threshold) ||
+		    cmpxchg(slot, workspace, NULL) != workspace) {
+			cached = true;
+			continue;
+		}
+		zstd_free_workspace(&workspace->list);
+	}
+
+	return cached;
+}
+
 /*
  * zstd_reclaim_timer_fn - reclaim timer
  * @t: timer
@@ -104,10 +146,20 @@ static void zstd_reclaim_timer_fn(struct timer_list *timer)
 {
 	unsigned long reclaim_threshold = jiffies - ZSTD_BTRFS_RECLAIM_JIFFIES;
 	struct list_head *pos, *next;
+	bool pcp_cached;
+
+	/*
+	 * Nobody but us frees workspaces, so a cached one can be looked at even
+	 * if it is taken from the slot meanwhile.
+	 */
+	pcp_cached = zstd_pcp_reclaim(reclaim_threshold);
 
 	spin_lock_bh(&wsm.lock);
 
 	if (list_empty(&wsm.lru_list)) {
+		if (pcp_cached)
+			mod_timer(&wsm.timer,
+				  jiffies + ZSTD_BTRFS_RECLAIM_JIFFIES);
 		spin_unlock_bh(&wsm.lock);
 		return;
 	}
@@ -134,7 +186,7 @@ static void zstd_reclaim_timer_fn(struct timer_list *timer)
 
 	}
 
-	if (!list_empty(&wsm.lru_list))
+	if (!list_empty(&wsm.lru_list) || pcp_cached)
 		mod_timer(&wsm.timer, jiffies + ZSTD_BTRFS_RECLAIM_JIFFIES);
 
 	spin_unlock_bh(&wsm.lock);
@@ -198,6 +250,12 @@ void zstd_cleanup_workspace_manager(void)
 	struct workspace *workspace;
 	int i;
 
+	for_each_possible_cpu(i) {
+		workspace = xchg(per_cpu_ptr(&zstd_pcp_ws, i), NULL);
+		if (workspace)
+			zstd_free_workspace(&workspace->list);
+	}
+
 	spin_lock_bh(&wsm.lock);
 	for (i = 0; i < ZSTD_BTRFS_MAX_LEVEL; i++) {
 		while (!list_empty(&wsm.idle_ws[i])) {
@@ -251,6 +309,29 @@ static struct list_head *zstd_find_workspace(unsigned int level)
 	return NULL;
 }
 
+/*
+ * zstd_pcp_drain - move all per-cpu cached workspaces to the shared lists
+ *
+ * Returns true if any workspace was moved.
+ */
+static bool zstd_pcp_drain(void)
+{
+	struct workspace *workspace;
+	bool drained = false;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		workspace = xchg(per_cpu_ptr(&zstd_pcp_ws, cpu), NULL);
+		if (!workspace)
+			continue;
+		workspace->req_level = workspace->level;
+		__zstd_put_workspace(workspace);
+		drained = true;
+	}
+
+	return drained;
+}
+
 /*
  * zstd_get_workspace - zstd's get_workspace
  * @level: compression level
@@ -262,9 +343,19 @@ static struct list_head *zstd_find_workspace(unsigned int level)
  */
 struct list_head *zstd_get_workspace(unsigned int level)
 {
+	struct workspace *workspace;
 	struct list_head *ws;
 	unsigned int nofs_flag;
 
+	workspace = xchg(raw_cpu_ptr(&zstd_pcp_ws), NULL);
+	if (workspace) {
+		workspace->req_level = workspace->level;
+		/* level == 0 means we can use any workspace */
+		if (!level || level == workspace->level)
+			return &workspace->list;
+		__zstd_put_workspace(workspace);
+	}
+
 	/* level == 0 means we can use any workspace */
 	if (!level)
 		level = 1;
@@ -278,6 +369,10 @@ again:
 	ws = zstd_alloc_workspace(level);
 	memalloc_nofs_restore(nofs_flag);
 
+	/* Workspaces cached on other cpus are better than waiting */
+	if (IS_ERR(ws) && zstd_pcp_drain())
+		goto again;
+
 	if (IS_ERR(ws)) {
 		DEFINE_WAIT(wait);
 
@@ -295,16 +390,43 @@ again:
  * zstd_put_workspace - zstd put_workspace
  * @ws: list_head for the workspace
  *
+ * Workspaces of the requested level are off the lru, and are cached in the
+ * slot of the current cpu, anything they displace from there goes back to the
+ * shared lists.  The max level workspace and workspaces used for a lower level
+ * go back to the shared lists directly.
+ */
+void zstd_put_workspace(struct list_head *ws)
+{
+	struct workspace *workspace = list_to_workspace(ws);
+
+	if (workspace->req_level == workspace->level &&
+	    workspace->level != ZSTD_BTRFS_MAX_LEVEL) {
+		workspace->last_used = jiffies;
+		workspace = xchg(raw_cpu_ptr(&zstd_pcp_ws), workspace);
+		if (!timer_pending(&wsm.timer))
+			mod_timer(&wsm.timer,
+				  jiffies + ZSTD_BTRFS_RECLAIM_JIFFIES);
+		if (!workspace)
+			return;
+		/* Cached workspaces are off the lru like freshly found ones */
+		workspace->req_level = workspace->level;
+	}
+
+	__zstd_put_workspace(workspace);
+}
+
+/*
+ * __zstd_put_workspace - put a workspace back on the shared lists
+ * @workspace: the workspace
+ *
  * When putting back a workspace, we only need to update the LRU if we are of
  * the requested compression level.  Here is where we continue to protect the
  * max level workspace or update last_used accordingly.  If the reclaim timer
  * isn't set, it is also set here.  Only the max level workspace tries and wakes
  * up waiting workspaces.
  */
-void zstd_put_workspace(struct list_head *ws)
+static void __zstd_put_workspace(struct workspace *workspace)
 {
-	struct workspace *workspace = list_to_workspace(ws);
-
 	spin_lock_bh(&wsm.lock);
 
 	/* A node is only taken off the lru if we are the corresponding level */
@@ -123,6 +123,16 @@ static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
 static DEFINE_PER_CPU(long, nr_dentry_negative);
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
 /*
@@ -155,16 +165,6 @@ static long get_nr_dentry_unused(void)
 	return sum < 0 ? 0 : sum;
 }
 
-static long get_nr_dentry_negative(void)
-{
-	int i;
-	long sum = 0;
-
-	for_each_possible_cpu(i)
-		sum += per_cpu(nr_dentry_negative, i);
-	return sum < 0 ? 0 : sum;
-}
-
 int proc_nr_dentry(struct ctl_table *table, int write, void *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
@@ -374,6 +374,34 @@ static void dentry_unlink_inode(struct dentry * dentry)
 		iput(inode);
 }
 
+/*
+ * Unused negative dentries above sysctl_negative_dentry_limit are trimmed
+ * off the superblock LRUs by a worker, oldest first, before they pile up
+ * for memory reclaim to deal with.  The limit is checked at most every
+ * NEGATIVE_DENTRY_CHECK_INTERVAL when one more goes on an LRU list.
+ */
+#define NEGATIVE_DENTRY_CHECK_INTERVAL	(HZ / 10)
+
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+
+static unsigned long negative_dentry_next_check;
+static void prune_negative_dentries(struct work_struct *work);
+static DECLARE_WORK(negative_dentry_work, prune_negative_dentries);
+
+static void check_negative_dentry_limit(void)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+
+	if (!limit ||
+	    time_before(jiffies, READ_ONCE(negative_dentry_next_check)))
+		return;
+
+	WRITE_ONCE(negative_dentry_next_check,
+		   jiffies + NEGATIVE_DENTRY_CHECK_INTERVAL);
+	if (get_nr_dentry_negative() > limit)
+		schedule_work(&negative_dentry_work);
+}
+
 /*
  * The DCACHE_LRU_LIST bit is set whenever the 'd_lru' entry
  * is in use - which includes both the "real" per-superblock
@@ -399,8 +427,10 @@ static void d_lru_add(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
-	if (d_is_negative(dentry))
+	if (d_is_negative(dentry)) {
 		this_cpu_inc(nr_dentry_negative);
+		check_negative_dentry_limit();
+	}
 	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -1263,6 +1293,57 @@ void shrink_dcache_sb(struct super_block *sb)
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
+static enum lru_status dentry_lru_isolate_negative(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	/*
+	 * Checked without d_lock: a dentry that just turned positive is
+	 * only shrunk as the shrinker would have done.  Positive ones are
+	 * rotated, so that the next batch looks at different entries.
+	 */
+	if (!d_is_negative(dentry))
+		return LRU_ROTATE;
+
+	return dentry_lru_isolate(item, lru, lru_lock, arg);
+}
+
+static void prune_negative_sb(struct super_block *sb, void *arg)
+{
+	long *excess = arg;
+	unsigned long nr = list_lru_count(&sb->s_dentry_lru);
+
+	while (*excess > 0 && nr) {
+		unsigned long batch = min(nr, 1024UL);
+		LIST_HEAD(dispose);
+
+		*excess -= list_lru_walk(&sb->s_dentry_lru,
+					 dentry_lru_isolate_negative,
+					 &dispose, batch);
+		shrink_dentry_list(&dispose);
+		nr -= batch;
+		cond_resched();
+	}
+}
+
+/*
+ * Bring the number of unused negative dentries 1/8th below the limit, so
+ * that the worker doesn't run again as soon as a few more are created.
+ */
+static void prune_negative_dentries(struct work_struct *work)
+{
+	long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	long excess;
+
+	if (!limit)
+		return;
+
+	excess = get_nr_dentry_negative() - (limit - limit / 8);
+	if (excess > 0)
+		iterate_supers(prune_negative_sb, &excess);
+}
+
 /**
  * enum d_walk_ret - action to talke during tree walk
  * @D_WALK_CONTINUE:	contrinue walk
@@ -7,6 +7,8 @@
 #include "zdata.h"
 #include "compress.h"
 #include <linux/prefetch.h>
+#include <linux/cpuhotplug.h>
+#include <linux/kobject.h>
 
 #include <trace/events/erofs.h>
 
@@ -34,8 +36,209 @@ typedef tagptr1_t compressed_page_t;
 static struct workqueue_struct *z_erofs_workqueue __read_mostly;
 static struct kmem_cache *pcluster_cachep __read_mostly;
 
+/*
+ * decompression statistics, summed over all cpus and reported in
+ * /sys/fs/erofs/stats/.  Times are in nanoseconds internally.
+ */
+struct z_erofs_stats {
+	u64 decompressed_pages;
+	u64 decompress_ns;
+	u64 async_queues;
+	u64 queue_wait_ns;
+};
+
+static DEFINE_PER_CPU(struct z_erofs_stats, z_erofs_stats);
+static struct kobject *z_erofs_kobj;
+
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+static struct kthread_worker __rcu **z_erofs_pcpu_workers;
+
+static void erofs_destroy_percpu_workers(void)
+{
+	struct kthread_worker *worker;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		worker = rcu_dereference_protected(
+					z_erofs_pcpu_workers[cpu], 1);
+		rcu_assign_pointer(z_erofs_pcpu_workers[cpu], NULL);
+		if (worker)
+			kthread_destroy_worker(worker);
+	}
+	kfree(z_erofs_pcpu_workers);
+}
+
+static struct kthread_worker *erofs_init_percpu_worker(int cpu)
+{
+	struct kthread_worker *worker =
+		kthread_create_worker_on_cpu(cpu, 0, "erofs_worker/%u", cpu);
+
+	if (IS_ERR(worker))
+		return worker;
+	if (IS_ENABLED(CONFIG_EROFS_FS_PCPU_KTHREAD_HIPRI))
+		sched_set_fifo_low(worker->task);
+	else
+		sched_set_normal(worker->task, 0);
+	return worker;
+}
+
+static int erofs_init_percpu_workers(void)
+{
+	struct kthread_worker *worker;
+	unsigned int cpu;
+
+	z_erofs_pcpu_workers = kcalloc(nr_cpu_ids,
+			sizeof(struct kthread_worker *), GFP_KERNEL);
+	if (!z_erofs_pcpu_workers)
+		return -ENOMEM;
+
+	for_each_online_cpu(cpu) {	/* could miss cpu{off,on}line? */
+		worker = erofs_init_percpu_worker(cpu);
+		if (!IS_ERR(worker))
+			rcu_assign_pointer(z_erofs_pcpu_workers[cpu], worker);
+	}
+	return 0;
+}
+#else
+static inline void erofs_destroy_percpu_workers(void) {}
+static inline int erofs_init_percpu_workers(void) { return 0; }
+#endif
+
+#if defined(CONFIG_HOTPLUG_CPU) && defined(CONFIG_EROFS_FS_PCPU_KTHREAD)
+static DEFINE_SPINLOCK(z_erofs_pcpu_worker_lock);
+static enum cpuhp_state erofs_cpuhp_state;
+
+static int erofs_cpu_online(unsigned int cpu)
+{
+	struct kthread_worker *worker, *old;
+
+	worker = erofs_init_percpu_worker(cpu);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	spin_lock(&z_erofs_pcpu_worker_lock);
+	old = rcu_dereference_protected(z_erofs_pcpu_workers[cpu],
+			lockdep_is_held(&z_erofs_pcpu_worker_lock));
+	if (!old)
+		rcu_assign_pointer(z_erofs_pcpu_workers[cpu], worker);
+	spin_unlock(&z_erofs_pcpu_worker_lock);
+	if (old)
+		kthread_destroy_worker(worker);
+	return 0;
+}
+
+static int erofs_cpu_offline(unsigned int cpu)
+{
+	struct kthread_worker *worker;
+
+	spin_lock(&z_erofs_pcpu_worker_lock);
+	worker = rcu_dereference_protected(z_erofs_pcpu_workers[cpu],
+			lockdep_is_held(&z_erofs_pcpu_worker_lock));
+	rcu_assign_pointer(z_erofs_pcpu_workers[cpu], NULL);
+	spin_unlock(&z_erofs_pcpu_worker_lock);
+
+	synchronize_rcu();
+	if (worker)
+		kthread_destroy_worker(worker);
+	return 0;
+}
+
+static int erofs_cpu_hotplug_init(void)
+{
+	int state;
+
+	state = cpuhp_setup_state_nocalls(CPUHP_AP_ONLINE_DYN,
+			"fs/erofs:online", erofs_cpu_online, erofs_cpu_offline);
+	if (state < 0)
+		return state;
+
+	erofs_cpuhp_state = state;
+	return 0;
+}
+
+static void erofs_cpu_hotplug_destroy(void)
+{
+	if (erofs_cpuhp_state)
+		cpuhp_remove_state_nocalls(erofs_cpuhp_state);
+}
+#else /* !CONFIG_HOTPLUG_CPU || !CONFIG_EROFS_FS_PCPU_KTHREAD */
+static inline int erofs_cpu_hotplug_init(void) { return 0; }
+static inline void erofs_cpu_hotplug_destroy(void) {}
+#endif
+
+static void z_erofs_sum_stats(struct z_erofs_stats *sum)
+{
+	unsigned int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct z_erofs_stats *st = per_cpu_ptr(&z_erofs_stats, cpu);
+
+		sum->decompressed_pages += READ_ONCE(st->decompressed_pages);
+		sum->decompress_ns += READ_ONCE(st->decompress_ns);
+		sum->async_queues += READ_ONCE(st->async_queues);
+		sum->queue_wait_ns += READ_ONCE(st->queue_wait_ns);
+	}
+}
+
+#define Z_EROFS_STATS_ATTR(_name, _expr)				\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	struct z_erofs_stats st;					\
+									\
+	z_erofs_sum_stats(&st);						\
+	return sprintf(buf, "%llu\n", (unsigned long long)(_expr));	\
+}									\
+static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+
+Z_EROFS_STATS_ATTR(decompressed_pages, st.decompressed_pages);
+Z_EROFS_STATS_ATTR(decompress_time_us, div_u64(st.decompress_ns, NSEC_PER_USEC));
+Z_EROFS_STATS_ATTR(async_queues, st.async_queues);
+Z_EROFS_STATS_ATTR(queue_wait_us, div_u64(st.queue_wait_ns, NSEC_PER_USEC));
+
+static struct attribute *z_erofs_stats_attrs[] = {
+	&decompressed_pages_attr.attr,
+	&decompress_time_us_attr.attr,
+	&async_queues_attr.attr,
+	&queue_wait_us_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group z_erofs_stats_group = {
+	.name = "stats",
+	.attrs = z_erofs_stats_attrs,
+};
+
+static int __init z_erofs_init_sysfs(void)
+{
+	int err;
+
+	z_erofs_kobj = kobject_create_and_add("erofs", fs_kobj);
+	if (!z_erofs_kobj)
+		return -ENOMEM;
+
+	err = sysfs_create_group(z_erofs_kobj, &z_erofs_stats_group);
+	if (err) {
+		kobject_put(z_erofs_kobj);
+		z_erofs_kobj = NULL;
+	}
+	return err;
+}
+
+static void z_erofs_exit_sysfs(void)
+{
+	if (!z_erofs_kobj)
+		return;
+	sysfs_remove_group(z_erofs_kobj, &z_erofs_stats_group);
+	kobject_put(z_erofs_kobj);
+}
+
 void z_erofs_exit_zip_subsystem(void)
 {
+	z_erofs_exit_sysfs();
+	erofs_cpu_hotplug_destroy();
+	erofs_destroy_percpu_workers();
 	destroy_workqueue(z_erofs_workqueue);
 	kmem_cache_destroy(pcluster_cachep);
 }
@@ -46,7 +249,8 @@ static inline int z_erofs_init_workqueue(void)
 
 	/*
 	 * no need to spawn too many threads, limiting threads could minimum
-	 * scheduling overhead, perhaps per-CPU threads should be better?
+	 * scheduling overhead.  With CONFIG_EROFS_FS_PCPU_KTHREAD this is
+	 * only the fallback for cpus which have no worker yet.
 	 */
 	z_erofs_workqueue = alloc_workqueue("erofs_unzipd",
 					    WQ_UNBOUND | WQ_HIGHPRI,
@@ -69,17 +273,39 @@ static void z_erofs_pcluster_init_once(void *ptr)
 
 int __init z_erofs_init_zip_subsystem(void)
 {
+	int err;
+
 	pcluster_cachep = kmem_cache_create("erofs_compress",
 					    Z_EROFS_WORKGROUP_SIZE, 0,
 					    SLAB_RECLAIM_ACCOUNT,
 					    z_erofs_pcluster_init_once);
-	if (pcluster_cachep) {
-		if (!z_erofs_init_workqueue())
-			return 0;
+	if (!pcluster_cachep)
+		return -ENOMEM;
 
-		kmem_cache_destroy(pcluster_cachep);
-	}
-	return -ENOMEM;
+	err = z_erofs_init_workqueue();
+	if (err)
+		goto out_error_workqueue_init;
+
+	err = erofs_init_percpu_workers();
+	if (err)
+		goto out_error_pcpu_worker;
+
+	err = erofs_cpu_hotplug_init();
+	if (err < 0)
+		goto out_error_cpuhp_init;
+
+	/* statistics are best effort, don't fail the module load for them */
+	if (z_erofs_init_sysfs())
+		pr_warn("erofs: failed to register decompression statistics\n");
+	return 0;
+
+out_error_cpuhp_init:
+	erofs_destroy_percpu_workers();
+out_error_pcpu_worker:
+	destroy_workqueue(z_erofs_workqueue);
+out_error_workqueue_init:
+	kmem_cache_destroy(pcluster_cachep);
+	return err;
 }
 
 enum z_erofs_collectmode {
@@ -694,6 +920,7 @@ err_out:
 	goto out;
 }
 
+static void z_erofs_decompressqueue_work(struct work_struct *work);
 static void z_erofs_decompress_kickoff(struct z_erofs_decompressqueue *io,
 				       bool sync, int bios)
 {
@@ -708,8 +935,29 @@ static void z_erofs_decompress_kickoff(struct z_erofs_decompressqueue *io,
 		return;
 	}
 
-	if (!atomic_add_return(bios, &io->pending_bios))
-		queue_work(z_erofs_workqueue, &io->u.work);
+	if (atomic_add_return(bios, &io->pending_bios))
+		return;
+
+	io->queued = ktime_get();
+	this_cpu_inc(z_erofs_stats.async_queues);
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+	{
+		struct kthread_worker *worker;
+
+		rcu_read_lock();
+		worker = rcu_dereference(
+				z_erofs_pcpu_workers[raw_smp_processor_id()]);
+		if (!worker) {
+			INIT_WORK(&io->u.work, z_erofs_decompressqueue_work);
+			queue_work(z_erofs_workqueue, &io->u.work);
+		} else {
+			kthread_queue_work(worker, &io->u.kthread_work);
+		}
+		rcu_read_unlock();
+	}
+#else
+	queue_work(z_erofs_workqueue, &io->u.work);
+#endif
 }
 
 static void z_erofs_decompressqueue_endio(struct bio *bio)
@@ -944,6 +1192,13 @@ static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
 				     struct list_head *pagepool)
 {
 	z_erofs_next_pcluster_t owned = io->head;
+	unsigned long nr_pages = 0;
+	ktime_t start;
+
+	if (owned == Z_EROFS_PCLUSTER_TAIL_CLOSED)
+		return;
+
+	start = ktime_get();
 
 	while (owned != Z_EROFS_PCLUSTER_TAIL_CLOSED) {
 		struct z_erofs_pcluster *pcl;
@@ -957,16 +1212,24 @@ static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
 		pcl = container_of(owned, struct z_erofs_pcluster, next);
 		owned = READ_ONCE(pcl->next);
 
+		nr_pages += READ_ONCE(z_erofs_primarycollection(pcl)->nr_pages);
 		z_erofs_decompress_pcluster(io->sb, pcl, pagepool);
 	}
+
+	preempt_disable();
+	__this_cpu_add(z_erofs_stats.decompressed_pages, nr_pages);
+	__this_cpu_add(z_erofs_stats.decompress_ns,
+		       ktime_to_ns(ktime_sub(ktime_get(), start)));
+	preempt_enable();
 }
 
-static void z_erofs_decompressqueue_work(struct work_struct *work)
+static void z_erofs_run_bgqueue(struct z_erofs_decompressqueue *bgq)
 {
-	struct z_erofs_decompressqueue *bgq =
-		container_of(work, struct z_erofs_decompressqueue, u.work);
 	LIST_HEAD(pagepool);
 
+	this_cpu_add(z_erofs_stats.queue_wait_ns,
+		     ktime_to_ns(ktime_sub(ktime_get(), bgq->queued)));
+
 	DBG_BUGON(bgq->head == Z_EROFS_PCLUSTER_TAIL_CLOSED);
 	z_erofs_decompress_queue(bgq, &pagepool);
 
@@ -974,6 +1237,20 @@ static void z_erofs_decompressqueue_work(struct work_struct *work)
 	kvfree(bgq);
 }
 
+static void z_erofs_decompressqueue_work(struct work_struct *work)
+{
+	z_erofs_run_bgqueue(container_of(work, struct z_erofs_decompressqueue,
+					 u.work));
+}
+
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+static void z_erofs_decompressqueue_kthread_work(struct kthread_work *work)
+{
+	z_erofs_run_bgqueue(container_of(work, struct z_erofs_decompressqueue,
+					 u.kthread_work));
+}
+#endif
+
 static struct page *pickup_page_for_submission(struct z_erofs_pcluster *pcl,
 					       unsigned int nr,
 					       struct list_head *pagepool,
@@ -1098,7 +1375,12 @@ jobqueue_init(struct super_block *sb,
 			*fg = true;
 			goto fg_out;
 		}
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+		kthread_init_work(&q->u.kthread_work,
+				  z_erofs_decompressqueue_kthread_work);
+#else
 		INIT_WORK(&q->u.work, z_erofs_decompressqueue_work);
+#endif
 	} else {
 fg_out:
 		q = fgq;
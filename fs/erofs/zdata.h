@@ -7,6 +7,7 @@
 #ifndef __EROFS_FS_ZDATA_H
 #define __EROFS_FS_ZDATA_H
 
+#include <linux/kthread.h>
 #include "internal.h"
 #include "zpvec.h"
 
@@ -89,9 +90,15 @@ struct z_erofs_decompressqueue {
 	atomic_t pending_bios;
 	z_erofs_next_pcluster_t head;
 
+	/* when the queue was handed over to a background worker */
+	ktime_t queued;
+
 	union {
 		wait_queue_head_t wait;
 		struct work_struct work;
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+		struct kthread_work kthread_work;
+#endif
 	} u;
 };
 
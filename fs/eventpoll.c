@@ -224,6 +224,11 @@ struct eventpoll {
 #ifdef CONFIG_NET_RX_BUSY_POLL
 	/* used to track busy poll napi_id */
 	unsigned int napi_id;
+	/* busy poll timeout, 0 to use net.core.busy_poll */
+	u32 busy_poll_usecs;
+	/* busy poll packet budget, 0 to use BUSY_POLL_BUDGET */
+	u16 busy_poll_budget;
+	bool prefer_busy_poll;
 #endif
 
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
@@ -381,25 +386,43 @@ static inline int ep_events_available(struct eventpoll *ep)
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
+static unsigned long ep_busy_poll_usecs(struct eventpoll *ep)
+{
+	return READ_ONCE(ep->busy_poll_usecs) ?: READ_ONCE(sysctl_net_busy_poll);
+}
+
+static bool ep_busy_loop_on(struct eventpoll *ep)
+{
+	return !!ep_busy_poll_usecs(ep);
+}
+
 static bool ep_busy_loop_end(void *p, unsigned long start_time)
 {
 	struct eventpoll *ep = p;
+	unsigned long bp_usec = ep_busy_poll_usecs(ep);
 
-	return ep_events_available(ep) || busy_loop_timeout(start_time);
+	return ep_events_available(ep) || !bp_usec ||
+	       time_after(busy_loop_current_time(), start_time + bp_usec);
 }
 
 /*
- * Busy poll if globally on and supporting sockets found && no events,
- * busy loop will return if need_resched or ep_events_available.
+ * Busy poll if on for this epoll instance or globally and supporting
+ * sockets found && no events, busy loop will return if need_resched or
+ * ep_events_available.
  *
  * we must do our busy polling with irqs enabled
  */
 static void ep_busy_loop(struct eventpoll *ep, int nonblock)
 {
 	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	u16 budget = READ_ONCE(ep->busy_poll_budget);
+
+	if (!budget)
+		budget = BUSY_POLL_BUDGET;
 
-	if ((napi_id >= MIN_NAPI_ID) && net_busy_loop_on())
-		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep);
+	if ((napi_id >= MIN_NAPI_ID) && ep_busy_loop_on(ep))
+		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep,
+			       READ_ONCE(ep->prefer_busy_poll), budget);
 }
 
 static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
@@ -419,7 +442,8 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	struct sock *sk;
 	int err;
 
-	if (!net_busy_loop_on())
+	ep = epi->ep;
+	if (!ep_busy_loop_on(ep))
 		return;
 
 	sock = sock_from_file(epi->ffd.file, &err);
@@ -431,7 +455,6 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 		return;
 
 	napi_id = READ_ONCE(sk->sk_napi_id);
-	ep = epi->ep;
 
 	/* Non-NAPI IDs can be rejected
 	 *	or
@@ -460,6 +483,61 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
+static long ep_eventpoll_bp_ioctl(struct eventpoll *ep, unsigned int cmd,
+				  void __user *uarg)
+{
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct epoll_params epoll_params;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+		if (copy_from_user(&epoll_params, uarg, sizeof(epoll_params)))
+			return -EFAULT;
+
+		/* pad byte must be zero */
+		if (epoll_params.__pad)
+			return -EINVAL;
+
+		if (epoll_params.busy_poll_usecs > S32_MAX)
+			return -EINVAL;
+
+		if (epoll_params.prefer_busy_poll > 1)
+			return -EINVAL;
+
+		if (epoll_params.busy_poll_budget > NAPI_POLL_WEIGHT &&
+		    !capable(CAP_NET_ADMIN))
+			return -EPERM;
+
+		WRITE_ONCE(ep->busy_poll_usecs, epoll_params.busy_poll_usecs);
+		WRITE_ONCE(ep->busy_poll_budget, epoll_params.busy_poll_budget);
+		WRITE_ONCE(ep->prefer_busy_poll, epoll_params.prefer_busy_poll);
+		return 0;
+	case EPIOCGPARAMS:
+		memset(&epoll_params, 0, sizeof(epoll_params));
+		epoll_params.busy_poll_usecs = READ_ONCE(ep->busy_poll_usecs);
+		epoll_params.busy_poll_budget = READ_ONCE(ep->busy_poll_budget);
+		epoll_params.prefer_busy_poll = READ_ONCE(ep->prefer_busy_poll);
+		if (copy_to_user(uarg, &epoll_params, sizeof(epoll_params)))
+			return -EFAULT;
+		return 0;
+	}
+#endif
+	return -EOPNOTSUPP;
+}
+
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	switch (cmd) {
+	case EPIOCSPARAMS:
+	case EPIOCGPARAMS:
+		return ep_eventpoll_bp_ioctl(file->private_data, cmd,
+					     (void __user *)arg);
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -970,6 +1048,8 @@ static const struct file_operations eventpoll_fops = {
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
 	.llseek		= noop_llseek,
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
 };
 
 /*
@@ -1693,15 +1773,70 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 	return 0;
 }
 
+/* Number of events ep_send_events_proc() copies to userspace at once */
+#define EP_SEND_BATCH 16
+
+/*
+ * Copy a batch of events to userspace and finish off their items: a
+ * one-shot item is disabled and a level triggered one goes back to the
+ * ready list, now that its event has been delivered.  If the copy fails,
+ * the items go back to the head of @head, so that nothing is lost.
+ */
+static int ep_send_events_flush(struct eventpoll *ep, struct list_head *head,
+				struct ep_send_events_data *esed,
+				struct epoll_event *batch,
+				struct epitem **epis, int nr)
+{
+	struct epitem *epi;
+	int i;
+
+	if (copy_to_user(esed->events + esed->res, batch,
+			 nr * sizeof(*batch))) {
+		for (i = nr - 1; i >= 0; i--) {
+			list_add(&epis[i]->rdllink, head);
+			ep_pm_stay_awake(epis[i]);
+		}
+		if (!esed->res)
+			esed->res = -EFAULT;
+		return -EFAULT;
+	}
+
+	for (i = 0; i < nr; i++) {
+		epi = epis[i];
+		if (epi->event.events & EPOLLONESHOT)
+			epi->event.events &= EP_PRIVATE_BITS;
+		else if (!(epi->event.events & EPOLLET)) {
+			/*
+			 * If this file has been added with Level
+			 * Trigger mode, we need to insert back inside
+			 * the ready list, so that the next call to
+			 * epoll_wait() will check again the events
+			 * availability. At this point, no one can insert
+			 * into ep->rdllist besides us. The epoll_ctl()
+			 * callers are locked out by
+			 * ep_scan_ready_list() holding "mtx" and the
+			 * poll callback will queue them in ep->ovflist.
+			 */
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+			ep_pm_stay_awake(epi);
+		}
+	}
+	esed->res += nr;
+
+	return 0;
+}
+
 static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 			       void *priv)
 {
 	struct ep_send_events_data *esed = priv;
+	struct epoll_event batch[EP_SEND_BATCH];
+	struct epitem *epis[EP_SEND_BATCH];
 	__poll_t revents;
 	struct epitem *epi, *tmp;
-	struct epoll_event __user *uevent = esed->events;
 	struct wakeup_source *ws;
 	poll_table pt;
+	int nr = 0;
 
 	init_poll_funcptr(&pt, NULL);
 	esed->res = 0;
@@ -1714,7 +1849,7 @@ static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head
 	lockdep_assert_held(&ep->mtx);
 
 	list_for_each_entry_safe(epi, tmp, head, rdllink) {
-		if (esed->res >= esed->maxevents)
+		if (esed->res + nr >= esed->maxevents)
 			break;
 
 		/*
@@ -1745,35 +1880,20 @@ static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head
 		if (!revents)
 			continue;
 
-		if (__put_user(revents, &uevent->events) ||
-		    __put_user(epi->event.data, &uevent->data)) {
-			list_add(&epi->rdllink, head);
-			ep_pm_stay_awake(epi);
-			if (!esed->res)
-				esed->res = -EFAULT;
-			return 0;
-		}
-		esed->res++;
-		uevent++;
-		if (epi->event.events & EPOLLONESHOT)
-			epi->event.events &= EP_PRIVATE_BITS;
-		else if (!(epi->event.events & EPOLLET)) {
-			/*
-			 * If this file has been added with Level
-			 * Trigger mode, we need to insert back inside
-			 * the ready list, so that the next call to
-			 * epoll_wait() will check again the events
-			 * availability. At this point, no one can insert
-			 * into ep->rdllist besides us. The epoll_ctl()
-			 * callers are locked out by
-			 * ep_scan_ready_list() holding "mtx" and the
-			 * poll callback will queue them in ep->ovflist.
-			 */
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
+		batch[nr].events = revents;
+		batch[nr].data = epi->event.data;
+		epis[nr++] = epi;
+		if (nr == EP_SEND_BATCH) {
+			if (ep_send_events_flush(ep, head, esed, batch,
+						 epis, nr))
+				return 0;
+			nr = 0;
 		}
 	}
 
+	if (nr)
+		ep_send_events_flush(ep, head, esed, batch, epis, nr);
+
 	return 0;
 }
 
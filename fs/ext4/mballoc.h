@@ -78,6 +78,15 @@
  */
 #define MB_DEFAULT_MAX_INODE_PREALLOC	512
 
+/*
+ * Number of groups from which mb_optimize_scan is turned on by default,
+ * smaller file systems are fast enough to scan linearly
+ */
+#define MB_DEFAULT_LINEAR_SCAN_THRESHOLD	16
+
+/* Orders of free extents tracked in the buddy: 2^0 .. 2^(blocksize_bits+1) */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 struct ext4_free_data {
 	/* this links the free block information from sb_info */
 	struct list_head		efd_list;
@@ -161,6 +170,9 @@ struct ext4_allocation_context {
 	/* copy of the best found extent taken before preallocation efforts */
 	struct ext4_free_extent ac_f_ex;
 
+	/* last group picked from the group lists by mb_optimize_scan */
+	ext4_group_t ac_last_optimal_group;
+
 	__u16 ac_groups_scanned;
 	__u16 ac_found;
 	__u16 ac_tail;
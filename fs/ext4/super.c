@@ -1527,7 +1527,7 @@ enum {
 	Opt_dioread_nolock, Opt_dioread_lock,
 	Opt_discard, Opt_nodiscard, Opt_init_itable, Opt_noinit_itable,
 	Opt_max_dir_size_kb, Opt_nojournal_checksum, Opt_nombcache,
-	Opt_prefetch_block_bitmaps,
+	Opt_prefetch_block_bitmaps, Opt_mb_optimize_scan,
 };
 
 static const match_table_t tokens = {
@@ -1621,6 +1621,7 @@ static const match_table_t tokens = {
 	{Opt_nombcache, "nombcache"},
 	{Opt_nombcache, "no_mbcache"},	/* for backward compatibility */
 	{Opt_prefetch_block_bitmaps, "prefetch_block_bitmaps"},
+	{Opt_mb_optimize_scan, "mb_optimize_scan=%d"},
 	{Opt_removed, "check=none"},	/* mount option from ext2/3 */
 	{Opt_removed, "nocheck"},	/* mount option from ext2/3 */
 	{Opt_removed, "reservation"},	/* mount option from ext2/3 */
@@ -1840,6 +1841,7 @@ static const struct mount_opts {
 	{Opt_nombcache, EXT4_MOUNT_NO_MBCACHE, MOPT_SET},
 	{Opt_prefetch_block_bitmaps, EXT4_MOUNT_PREFETCH_BLOCK_BITMAPS,
 	 MOPT_SET},
+	{Opt_mb_optimize_scan, 0, MOPT_GTE0},
 	{Opt_err, 0, 0}
 };
 
@@ -2050,6 +2052,17 @@ static int handle_mount_opt(struct super_block *sb, char *opt, int token,
 		sbi->s_max_dir_size_kb = arg;
 	} else if (token == Opt_stripe) {
 		sbi->s_stripe = arg;
+	} else if (token == Opt_mb_optimize_scan) {
+		if (arg != 0 && arg != 1) {
+			ext4_msg(sb, KERN_ERR,
+				 "mb_optimize_scan should be set to 0 or 1.");
+			return -1;
+		}
+		if (arg)
+			set_opt2(sb, MB_OPTIMIZE_SCAN);
+		else
+			clear_opt2(sb, MB_OPTIMIZE_SCAN);
+		set_opt2(sb, EXPLICIT_MB_OPTIMIZE_SCAN);
 	} else if (token == Opt_resuid) {
 		uid = make_kuid(current_user_ns(), arg);
 		if (!uid_valid(uid)) {
@@ -2419,6 +2432,9 @@ static int _ext4_show_options(struct seq_file *seq, struct super_block *sb,
 		SEQ_OPTS_PRINT("max_dir_size_kb=%u", sbi->s_max_dir_size_kb);
 	if (test_opt(sb, DATA_ERR_ABORT))
 		SEQ_OPTS_PUTS("data_err=abort");
+	if (nodefs || test_opt2(sb, EXPLICIT_MB_OPTIMIZE_SCAN))
+		SEQ_OPTS_PRINT("mb_optimize_scan=%d",
+			       test_opt2(sb, MB_OPTIMIZE_SCAN) ? 1 : 0);
 
 	fscrypt_show_test_dummy_encryption(seq, sep, sb);
 
@@ -21,6 +21,7 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -101,6 +102,7 @@ static void fuse_drop_waiting(struct fuse_conn *fc)
 }
 
 static void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req);
+static bool fuse_ring_queue(struct fuse_conn *fc, struct fuse_req *req);
 
 static struct fuse_req *fuse_get_req(struct fuse_conn *fc, bool for_background)
 {
@@ -407,6 +409,13 @@ static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 	struct fuse_iqueue *fiq = &fc->iq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
+	if (fuse_ring_queue(fc, req)) {
+		request_wait_answer(fc, req);
+		/* Pairs with smp_wmb() in fuse_request_end() */
+		smp_rmb();
+		return;
+	}
+
 	spin_lock(&fiq->lock);
 	if (!fiq->connected) {
 		spin_unlock(&fiq->lock);
@@ -1628,7 +1637,7 @@ static void fuse_retrieve_end(struct fuse_conn *fc, struct fuse_args *args,
 		container_of(args, typeof(*ra), ap.args);
 
 	release_pages(ra->ap.pages, ra->ap.num_pages);
-	kfree(ra);
+	kvfree(ra);
 }
 
 static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
@@ -1661,7 +1670,7 @@ static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
 
 	args_size += num_pages * (sizeof(ap->pages[0]) + sizeof(ap->descs[0]));
 
-	ra = kzalloc(args_size, GFP_KERNEL);
+	ra = kvzalloc(args_size, GFP_KERNEL);
 	if (!ra)
 		return -ENOMEM;
 
@@ -2022,22 +2031,366 @@ out_free:
 	return ret;
 }
 
+/*
+ * Shared memory request rings
+ *
+ * A server can set up a ring on each of its fuse devices, bound to a CPU.
+ * Synchronous requests issued on that CPU are then written directly to a
+ * slot of the shared memory and the slot index is published to the
+ * submission array, without going through the input queue and its lock.
+ * Replies are written by the server to the same slot, and are processed in
+ * batches by FUSE_DEV_IOC_RING_ENTER with the same code as write() on the
+ * device, so a request on a ring is otherwise treated like one read from
+ * the device: it is on the processing queue of the device while the server
+ * handles it, and it can be interrupted or aborted the usual way.
+ */
+
+/* Ring request IDs have the top bit set, then the CPU of the ring */
+#define FUSE_RING_REQ_ID(cpu)	((1ULL << 63) | ((u64)(cpu) << 40))
+
+#define FUSE_RING_MAX_ENTRIES	4096
+#define FUSE_RING_MAX_SIZE	(64U << 20)
+
+static void *fuse_ring_slot(struct fuse_ring *ring, u32 slot)
+{
+	return ring->slots + (size_t)slot * ring->slot_size;
+}
+
+static void fuse_ring_put_slot(struct fuse_ring *ring, u32 slot)
+{
+	spin_lock(&ring->lock);
+	__clear_bit(slot, ring->busy);
+	ring->free_slots[ring->nr_free++] = slot;
+	spin_unlock(&ring->lock);
+}
+
+static bool fuse_ring_sq_pending(struct fuse_ring *ring)
+{
+	return READ_ONCE(ring->hdr->sq_head) != READ_ONCE(ring->sq_tail);
+}
+
+static void fuse_ring_copy_in(void *dst, struct fuse_req *req)
+{
+	struct fuse_args *args = req->args;
+	unsigned int i;
+
+	memcpy(dst, &req->in.h, sizeof(req->in.h));
+	dst += sizeof(req->in.h);
+	for (i = 0; i < args->in_numargs; i++) {
+		memcpy(dst, args->in_args[i].value, args->in_args[i].size);
+		dst += args->in_args[i].size;
+	}
+}
+
+/*
+ * Queue a synchronous request on the ring of the current CPU.  Returns
+ * false if there is no such ring, it is full or the request doesn't fit in
+ * a slot, in which case the request goes through the input queue.  On
+ * success the extra reference needed by __fuse_request_send() is taken.
+ */
+static bool fuse_ring_queue(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_args *args = req->args;
+	struct fuse_ring __rcu **rings;
+	struct fuse_ring *ring;
+	struct fuse_pqueue *fpq;
+	bool queued = false;
+	unsigned int len, hash;
+	u32 slot;
+
+	rings = smp_load_acquire(&fc->rings);
+	if (!rings || args->in_pages)
+		return false;
+
+	len = sizeof(struct fuse_in_header) +
+	      fuse_len_args(args->in_numargs,
+			    (struct fuse_arg *) args->in_args);
+
+	rcu_read_lock();
+	ring = rcu_dereference(rings[raw_smp_processor_id()]);
+	if (!ring || len > ring->slot_size)
+		goto out_unlock;
+
+	spin_lock(&ring->lock);
+	if (!ring->nr_free) {
+		spin_unlock(&ring->lock);
+		goto out_unlock;
+	}
+	slot = ring->free_slots[--ring->nr_free];
+	__set_bit(slot, ring->busy);
+	req->in.h.unique = ring->reqctr;
+	ring->reqctr += FUSE_REQ_ID_STEP;
+	spin_unlock(&ring->lock);
+
+	req->in.h.len = len;
+	fuse_ring_copy_in(fuse_ring_slot(ring, slot), req);
+
+	fpq = &ring->fud->pq;
+	spin_lock(&fpq->lock);
+	if (!fpq->connected) {
+		spin_unlock(&fpq->lock);
+		fuse_ring_put_slot(ring, slot);
+		goto out_unlock;
+	}
+	/* acquire extra reference, since request is still needed
+	   after fuse_request_end() */
+	__fuse_get_request(req);
+	clear_bit(FR_PENDING, &req->flags);
+	if (test_bit(FR_ISREPLY, &req->flags)) {
+		hash = fuse_req_hash(req->in.h.unique);
+		list_add_tail(&req->list, &fpq->processing[hash]);
+		set_bit(FR_SENT, &req->flags);
+	}
+	spin_unlock(&fpq->lock);
+
+	spin_lock(&ring->lock);
+	WRITE_ONCE(ring->sq[ring->sq_tail & (ring->entries - 1)], slot);
+	/* Pairs with the acquire of sq_tail by the server */
+	smp_store_release(&ring->hdr->sq_tail, ring->sq_tail + 1);
+	WRITE_ONCE(ring->sq_tail, ring->sq_tail + 1);
+	spin_unlock(&ring->lock);
+	wake_up(&ring->waitq);
+	queued = true;
+
+out_unlock:
+	rcu_read_unlock();
+
+	/* The server hands the slot back without a reply */
+	if (queued && !test_bit(FR_ISREPLY, &req->flags))
+		fuse_request_end(fc, req);
+
+	return queued;
+}
+
+static void fuse_ring_complete(struct fuse_ring *ring, u32 slot)
+{
+	unsigned int pages = ring->slot_size >> PAGE_SHIFT;
+	struct fuse_out_header *oh;
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	u32 len;
+
+	if (slot >= ring->entries || !test_bit(slot, ring->busy))
+		return;
+
+	oh = fuse_ring_slot(ring, slot);
+	len = READ_ONCE(oh->len);
+	if (len && len <= ring->slot_size) {
+		iov_iter_bvec(&iter, WRITE, ring->bvecs + slot * pages, pages,
+			      len);
+		fuse_copy_init(&cs, 0, &iter);
+		fuse_dev_do_write(ring->fud, &cs, len);
+	}
+	fuse_ring_put_slot(ring, slot);
+}
+
+static long fuse_ring_enter(struct fuse_dev *fud,
+			    struct fuse_ring_enter __user *uarg)
+{
+	struct fuse_ring *ring = smp_load_acquire(&fud->ring);
+	struct fuse_ring_enter arg;
+	unsigned int done = 0;
+	u32 head, tail, mask;
+	int err;
+
+	if (!ring)
+		return -EINVAL;
+	if (copy_from_user(&arg, uarg, sizeof(arg)))
+		return -EFAULT;
+	if ((arg.flags & ~FUSE_RING_ENTER_WAIT) || arg.padding)
+		return -EINVAL;
+
+	mask = ring->entries - 1;
+	mutex_lock(&ring->enter_lock);
+	head = ring->cq_head;
+	/* Pairs with the release of cq_tail by the server */
+	tail = smp_load_acquire(&ring->hdr->cq_tail);
+	while (head != tail && done < ring->entries) {
+		fuse_ring_complete(ring, READ_ONCE(ring->cq[head & mask]));
+		head++;
+		done++;
+	}
+	ring->cq_head = head;
+	smp_store_release(&ring->hdr->cq_head, head);
+	mutex_unlock(&ring->enter_lock);
+
+	if (arg.flags & FUSE_RING_ENTER_WAIT) {
+		err = wait_event_interruptible_exclusive(ring->waitq,
+				fuse_ring_sq_pending(ring) ||
+				!READ_ONCE(fud->pq.connected));
+		if (err && !done)
+			return err;
+	}
+	if (!done && !READ_ONCE(fud->pq.connected))
+		return -ENODEV;
+
+	return done;
+}
+
+static void fuse_ring_free(struct fuse_ring *ring)
+{
+	kvfree(ring->bvecs);
+	kvfree(ring->free_slots);
+	bitmap_free(ring->busy);
+	vfree(ring->mem);
+	kfree(ring);
+}
+
+static long fuse_ring_setup(struct fuse_dev *fud,
+			    struct fuse_ring_setup __user *uarg)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_ring __rcu **rings = NULL;
+	struct fuse_ring_setup arg;
+	struct fuse_ring *ring;
+	unsigned int i, pages;
+	size_t arrays;
+	int err;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)))
+		return -EFAULT;
+	if (arg.flags || !is_power_of_2(arg.entries) ||
+	    arg.entries > FUSE_RING_MAX_ENTRIES ||
+	    !arg.slot_size || !PAGE_ALIGNED(arg.slot_size) ||
+	    (u64) arg.entries * arg.slot_size > FUSE_RING_MAX_SIZE ||
+	    arg.cpu >= nr_cpu_ids || !cpu_possible(arg.cpu))
+		return -EINVAL;
+	if (READ_ONCE(fud->ring))
+		return -EBUSY;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->fud = fud;
+	ring->cpu = arg.cpu;
+	ring->entries = arg.entries;
+	ring->slot_size = arg.slot_size;
+	ring->reqctr = FUSE_RING_REQ_ID(arg.cpu);
+	spin_lock_init(&ring->lock);
+	mutex_init(&ring->enter_lock);
+	init_waitqueue_head(&ring->waitq);
+
+	err = -ENOMEM;
+	arrays = PAGE_ALIGN(sizeof(struct fuse_ring_hdr) +
+			    2 * arg.entries * sizeof(u32));
+	ring->mem_size = arrays + (size_t) arg.entries * arg.slot_size;
+	ring->mem = vmalloc_user(ring->mem_size);
+	if (!ring->mem)
+		goto out_free;
+	ring->hdr = ring->mem;
+	ring->sq = ring->mem + sizeof(struct fuse_ring_hdr);
+	ring->cq = ring->sq + arg.entries;
+	ring->slots = ring->mem + arrays;
+	ring->hdr->entries = arg.entries;
+	ring->hdr->slot_size = arg.slot_size;
+
+	pages = arg.entries * (arg.slot_size >> PAGE_SHIFT);
+	ring->bvecs = kvmalloc_array(pages, sizeof(struct bio_vec),
+				     GFP_KERNEL);
+	ring->free_slots = kvmalloc_array(arg.entries, sizeof(u32),
+					  GFP_KERNEL);
+	ring->busy = bitmap_zalloc(arg.entries, GFP_KERNEL);
+	if (!ring->bvecs || !ring->free_slots || !ring->busy)
+		goto out_free;
+	for (i = 0; i < pages; i++) {
+		ring->bvecs[i].bv_page =
+			vmalloc_to_page(ring->slots + i * PAGE_SIZE);
+		ring->bvecs[i].bv_len = PAGE_SIZE;
+		ring->bvecs[i].bv_offset = 0;
+	}
+	for (i = 0; i < arg.entries; i++)
+		ring->free_slots[i] = arg.entries - 1 - i;
+	ring->nr_free = arg.entries;
+
+	if (!smp_load_acquire(&fc->rings)) {
+		rings = kcalloc(nr_cpu_ids, sizeof(*rings), GFP_KERNEL);
+		if (!rings)
+			goto out_free;
+	}
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fud->pq.connected)
+		goto out_unlock;
+	err = -EBUSY;
+	if (fud->ring)
+		goto out_unlock;
+	if (!fc->rings) {
+		smp_store_release(&fc->rings, rings);
+		rings = NULL;
+	}
+	if (rcu_access_pointer(fc->rings[arg.cpu]))
+		goto out_unlock;
+	rcu_assign_pointer(fc->rings[arg.cpu], ring);
+	smp_store_release(&fud->ring, ring);
+	err = 0;
+out_unlock:
+	spin_unlock(&fc->lock);
+	kfree(rings);
+	if (err)
+		goto out_free;
+
+	arg.mmap_size = ring->mem_size;
+	arg.sq_off = (void *) ring->sq - ring->mem;
+	arg.cq_off = (void *) ring->cq - ring->mem;
+	arg.slots_off = arrays;
+	if (copy_to_user(uarg, &arg, sizeof(arg)))
+		return -EFAULT;
+
+	return 0;
+
+out_free:
+	fuse_ring_free(ring);
+	return err;
+}
+
+/* Stop new submissions to the ring of a device being released */
+static void fuse_ring_detach(struct fuse_conn *fc, struct fuse_ring *ring)
+{
+	spin_lock(&fc->lock);
+	RCU_INIT_POINTER(fc->rings[ring->cpu], NULL);
+	spin_unlock(&fc->lock);
+
+	/* Wait for submissions that found the ring */
+	synchronize_rcu();
+}
+
+static int fuse_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_ring *ring;
+
+	if (!fud)
+		return -EPERM;
+
+	ring = smp_load_acquire(&fud->ring);
+	if (!ring || vma->vm_pgoff)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->mem, 0);
+}
+
 static __poll_t fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
 	struct fuse_iqueue *fiq;
 	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_ring *ring;
 
 	if (!fud)
 		return EPOLLERR;
 
 	fiq = &fud->fc->iq;
 	poll_wait(file, &fiq->waitq, wait);
+	ring = smp_load_acquire(&fud->ring);
+	if (ring)
+		poll_wait(file, &ring->waitq, wait);
 
 	spin_lock(&fiq->lock);
 	if (!fiq->connected)
 		mask = EPOLLERR;
-	else if (request_pending(fiq))
+	else if (request_pending(fiq) || (ring && fuse_ring_sq_pending(ring)))
 		mask |= EPOLLIN | EPOLLRDNORM;
 	spin_unlock(&fiq->lock);
 
@@ -2112,6 +2465,8 @@ void fuse_abort_conn(struct fuse_conn *fc)
 
 			spin_lock(&fpq->lock);
 			fpq->connected = 0;
+			if (fud->ring)
+				wake_up_all(&fud->ring->waitq);
 			list_for_each_entry_safe(req, next, &fpq->io, list) {
 				req->out.h.error = -ECONNABORTED;
 				spin_lock(&req->waitq.lock);
@@ -2172,6 +2527,9 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		LIST_HEAD(to_end);
 		unsigned int i;
 
+		if (fud->ring)
+			fuse_ring_detach(fc, fud->ring);
+
 		spin_lock(&fpq->lock);
 		WARN_ON(!list_empty(&fpq->io));
 		for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
@@ -2180,6 +2538,9 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 
 		end_requests(fc, &to_end);
 
+		if (fud->ring)
+			fuse_ring_free(fud->ring);
+
 		/* Are we the last open device? */
 		if (atomic_dec_and_test(&fc->dev_count)) {
 			WARN_ON(fc->iq.fasync != NULL);
@@ -2251,6 +2612,26 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 				fput(old);
 			}
 		}
+	} else if (cmd == FUSE_DEV_IOC_PASSTHROUGH_OPEN) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		int lower_fd;
+
+		err = -EFAULT;
+		if (!get_user(lower_fd, (__u32 __user *) arg)) {
+			err = -EINVAL;
+			if (fud)
+				err = fuse_passthrough_open(fud, lower_fd);
+		}
+	} else if (cmd == FUSE_DEV_IOC_RING_SETUP ||
+		   cmd == FUSE_DEV_IOC_RING_ENTER) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		void __user *argp = (void __user *) arg;
+
+		err = -EINVAL;
+		if (fud && cmd == FUSE_DEV_IOC_RING_SETUP)
+			err = fuse_ring_setup(fud, argp);
+		else if (fud)
+			err = fuse_ring_enter(fud, argp);
 	}
 	return err;
 }
@@ -2264,6 +2645,7 @@ const struct file_operations fuse_dev_operations = {
 	.write_iter	= fuse_dev_write,
 	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
+	.mmap		= fuse_dev_mmap,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
 	.unlocked_ioctl = fuse_dev_ioctl,
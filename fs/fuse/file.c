@@ -25,8 +25,8 @@ static struct page **fuse_pages_alloc(unsigned int npages, gfp_t flags,
 {
 	struct page **pages;
 
-	pages = kzalloc(npages * (sizeof(struct page *) +
-				  sizeof(struct fuse_page_desc)), flags);
+	pages = kvzalloc(npages * (sizeof(struct page *) +
+				   sizeof(struct fuse_page_desc)), flags);
 	*desc = (void *) (pages + npages);
 
 	return pages;
@@ -126,6 +126,7 @@ static void fuse_file_put(struct fuse_file *ff, bool sync, bool isdir)
 						   GFP_KERNEL | __GFP_NOFAIL))
 				fuse_release_end(ff->fc, args, -ENOTCONN);
 		}
+		fuse_passthrough_release(&ff->passthrough);
 		kfree(ff);
 	}
 }
@@ -151,6 +152,8 @@ int fuse_do_open(struct fuse_conn *fc, u64 nodeid, struct file *file,
 		if (!err) {
 			ff->fh = outarg.fh;
 			ff->open_flags = outarg.open_flags;
+			if (!isdir)
+				fuse_passthrough_setup(fc, ff, &outarg);
 
 		} else if (err != -ENOSYS) {
 			fuse_file_free(ff);
@@ -682,7 +685,7 @@ static struct fuse_io_args *fuse_io_alloc(struct fuse_io_priv *io,
 
 static void fuse_io_free(struct fuse_io_args *ia)
 {
-	kfree(ia->ap.pages);
+	kvfree(ia->ap.pages);
 	kfree(ia);
 }
 
@@ -1226,7 +1229,7 @@ static ssize_t fuse_perform_write(struct kiocb *iocb,
 					err = -EIO;
 			}
 		}
-		kfree(ap->pages);
+		kvfree(ap->pages);
 	} while (!err && iov_iter_count(ii));
 
 	if (res > 0)
@@ -1543,6 +1546,8 @@ static ssize_t fuse_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
 	if (is_bad_inode(file_inode(file)))
 		return -EIO;
 
+	if (ff->passthrough.filp)
+		return fuse_passthrough_read_iter(iocb, to);
 	if (!(ff->open_flags & FOPEN_DIRECT_IO))
 		return fuse_cache_read_iter(iocb, to);
 	else
@@ -1557,6 +1562,8 @@ static ssize_t fuse_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	if (is_bad_inode(file_inode(file)))
 		return -EIO;
 
+	if (ff->passthrough.filp)
+		return fuse_passthrough_write_iter(iocb, from);
 	if (!(ff->open_flags & FOPEN_DIRECT_IO))
 		return fuse_cache_write_iter(iocb, from);
 	else
@@ -1574,7 +1581,7 @@ static void fuse_writepage_free(struct fuse_writepage_args *wpa)
 	if (wpa->ia.ff)
 		fuse_file_put(wpa->ia.ff, false, false);
 
-	kfree(ap->pages);
+	kvfree(ap->pages);
 	kfree(wpa);
 }
 
@@ -1934,7 +1941,7 @@ static bool fuse_pages_realloc(struct fuse_fill_wb_data *data)
 
 	memcpy(pages, ap->pages, sizeof(struct page *) * ap->num_pages);
 	memcpy(descs, ap->descs, sizeof(struct fuse_page_desc) * ap->num_pages);
-	kfree(ap->pages);
+	kvfree(ap->pages);
 	ap->pages = pages;
 	ap->descs = descs;
 	data->max_pages = npages;
@@ -2158,9 +2165,9 @@ static int fuse_writepages(struct address_space *mapping,
 	data.ff = NULL;
 
 	err = -ENOMEM;
-	data.orig_pages = kcalloc(fc->max_pages,
-				  sizeof(struct page *),
-				  GFP_NOFS);
+	data.orig_pages = kvcalloc(fc->max_pages,
+				   sizeof(struct page *),
+				   GFP_NOFS);
 	if (!data.orig_pages)
 		goto out;
 
@@ -2172,7 +2179,7 @@ static int fuse_writepages(struct address_space *mapping,
 	if (data.ff)
 		fuse_file_put(data.ff, false, false);
 
-	kfree(data.orig_pages);
+	kvfree(data.orig_pages);
 out:
 	return err;
 }
@@ -2913,7 +2920,7 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 	free_page((unsigned long) iov_page);
 	while (ap.num_pages)
 		__free_page(ap.pages[--ap.num_pages]);
-	kfree(ap.pages);
+	kvfree(ap.pages);
 
 	return err ? err : outarg.result;
 }
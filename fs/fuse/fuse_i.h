@@ -31,12 +31,16 @@
 #include <linux/pid_namespace.h>
 #include <linux/refcount.h>
 #include <linux/user_namespace.h>
+#include <linux/idr.h>
 
 /** Default max number of pages that can be used in a single read request */
 #define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
 
-/** Maximum of max_pages received in init_out */
-#define FUSE_MAX_MAX_PAGES 256
+/** Default limit of max_pages received in init_out */
+#define FUSE_DEFAULT_MAX_PAGES_LIMIT 256
+
+/** Upper bound of the max_pages_limit module parameter */
+#define FUSE_MAX_MAX_PAGES 65535
 
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
@@ -57,6 +61,9 @@ extern struct mutex fuse_mutex;
 extern unsigned max_user_bgreq;
 extern unsigned max_user_congthresh;
 
+/** Module parameter: limit of max_pages received in init_out */
+extern unsigned int fuse_max_pages_limit;
+
 /* One forget request */
 struct fuse_forget_link {
 	struct fuse_forget_one forget_one;
@@ -163,6 +170,12 @@ enum {
 struct fuse_conn;
 struct fuse_release_args;
 
+/** Lower file of a passthrough open, see passthrough.c */
+struct fuse_passthrough {
+	struct file *filp;
+	const struct cred *cred;
+};
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -214,6 +227,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Lower file read and written directly, if any */
+	struct fuse_passthrough passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -465,6 +481,65 @@ struct fuse_dev {
 
 	/** list entry on fc->devices */
 	struct list_head entry;
+
+	/** Shared memory request ring, if set up */
+	struct fuse_ring *ring;
+};
+
+/**
+ * Shared memory request ring of a device, see the "Shared memory request
+ * rings" part of dev.c
+ */
+struct fuse_ring {
+	/** Device the ring was set up on */
+	struct fuse_dev *fud;
+
+	/** CPU whose requests use the ring */
+	unsigned int cpu;
+
+	/** Number of slots, a power of two */
+	unsigned int entries;
+
+	/** Size of a slot, a multiple of PAGE_SIZE */
+	unsigned int slot_size;
+
+	/** Memory shared with the server and its size */
+	void *mem;
+	size_t mem_size;
+
+	/** Parts of the shared memory */
+	struct fuse_ring_hdr *hdr;
+	u32 *sq;
+	u32 *cq;
+	void *slots;
+
+	/** Pages of the slots, to copy replies with fuse_copy_state */
+	struct bio_vec *bvecs;
+
+	/** Protects free_slots, nr_free, busy, reqctr and sq_tail */
+	spinlock_t lock;
+
+	/** Stack of free slots */
+	u32 *free_slots;
+	unsigned int nr_free;
+
+	/** Slots handed to the server */
+	unsigned long *busy;
+
+	/** Next unique ID of a request submitted on the ring */
+	u64 reqctr;
+
+	/** Submission tail, published to hdr->sq_tail */
+	u32 sq_tail;
+
+	/** Serializes the processing of completions */
+	struct mutex enter_lock;
+
+	/** Completion head, published to hdr->cq_head */
+	u32 cq_head;
+
+	/** Servers waiting for submissions */
+	wait_queue_head_t waitq;
 };
 
 struct fuse_fs_context {
@@ -720,6 +795,9 @@ struct fuse_conn {
 	/* Do not show mount options */
 	unsigned int no_mount_options:1;
 
+	/** Can read/write be passed through to a lower file? */
+	unsigned int passthrough:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -755,6 +833,13 @@ struct fuse_conn {
 
 	/** List of device instances belonging to this connection */
 	struct list_head devices;
+
+	/** Request rings indexed by CPU, allocated by the first ring setup */
+	struct fuse_ring __rcu **rings;
+
+	/** Lower files registered for passthrough and not yet opened */
+	struct idr passthrough_req;
+	spinlock_t passthrough_req_lock;
 };
 
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
@@ -1093,4 +1178,14 @@ unsigned int fuse_len_args(unsigned int numargs, struct fuse_arg *args);
 u64 fuse_get_unique(struct fuse_iqueue *fiq);
 void fuse_free_conn(struct fuse_conn *fc);
 
+/* passthrough.c */
+int fuse_passthrough_open(struct fuse_dev *fud, u32 lower_fd);
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+void fuse_passthrough_free_all(struct fuse_conn *fc);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb,
+				    struct iov_iter *from);
+
 #endif /* _FS_FUSE_I_H */
@@ -50,6 +50,17 @@ MODULE_PARM_DESC(max_user_congthresh,
  "Global limit for the maximum congestion threshold an "
  "unprivileged user can set");
 
+static int set_max_pages_limit(const char *val,
+			       const struct kernel_param *kp);
+
+unsigned int fuse_max_pages_limit = FUSE_DEFAULT_MAX_PAGES_LIMIT;
+module_param_call(max_pages_limit, set_max_pages_limit, param_get_uint,
+		  &fuse_max_pages_limit, 0644);
+__MODULE_PARM_TYPE(max_pages_limit, "uint");
+MODULE_PARM_DESC(max_pages_limit,
+ "Limit for the maximum number of pages in a read or write request "
+ "a filesystem can set");
+
 #define FUSE_SUPER_MAGIC 0x65735546
 
 #define FUSE_DEFAULT_BLKSIZE 512
@@ -629,6 +640,8 @@ void fuse_conn_init(struct fuse_conn *fc, struct user_namespace *user_ns,
 	INIT_LIST_HEAD(&fc->bg_queue);
 	INIT_LIST_HEAD(&fc->entry);
 	INIT_LIST_HEAD(&fc->devices);
+	idr_init(&fc->passthrough_req);
+	spin_lock_init(&fc->passthrough_req_lock);
 	atomic_set(&fc->num_waiting, 0);
 	fc->max_background = FUSE_DEFAULT_MAX_BACKGROUND;
 	fc->congestion_threshold = FUSE_DEFAULT_CONGESTION_THRESHOLD;
@@ -652,6 +665,8 @@ void fuse_conn_put(struct fuse_conn *fc)
 
 		if (fiq->ops->release)
 			fiq->ops->release(fiq);
+		fuse_passthrough_free_all(fc);
+		kfree(fc->rings);
 		put_pid_ns(fc->pid_ns);
 		put_user_ns(fc->user_ns);
 		fc->release(fc);
@@ -862,6 +877,23 @@ static int set_global_limit(const char *val, const struct kernel_param *kp)
 	return 0;
 }
 
+static int set_max_pages_limit(const char *val,
+			       const struct kernel_param *kp)
+{
+	unsigned int limit;
+	int rv;
+
+	rv = kstrtouint(val, 0, &limit);
+	if (rv)
+		return rv;
+	if (!limit || limit > FUSE_MAX_MAX_PAGES)
+		return -EINVAL;
+
+	WRITE_ONCE(*(unsigned int *)kp->arg, limit);
+
+	return 0;
+}
+
 static void process_init_limits(struct fuse_conn *fc, struct fuse_init_out *arg)
 {
 	int cap_sys_admin = capable(CAP_SYS_ADMIN);
@@ -962,9 +994,16 @@ static void process_init_reply(struct fuse_conn *fc, struct fuse_args *args,
 				fc->abort_err = 1;
 			if (arg->flags & FUSE_MAX_PAGES) {
 				fc->max_pages =
-					min_t(unsigned int, FUSE_MAX_MAX_PAGES,
+					min_t(unsigned int,
+					      READ_ONCE(fuse_max_pages_limit),
 					max_t(unsigned int, arg->max_pages, 1));
 			}
+			if (arg->flags & FUSE_PASSTHROUGH) {
+				fc->passthrough = 1;
+				/* Lower files can't be stacked any deeper */
+				fc->sb->s_stack_depth =
+					FILESYSTEM_MAX_STACK_DEPTH;
+			}
 		} else {
 			ra_pages = fc->max_read / PAGE_SIZE;
 			fc->no_lock = 1;
@@ -1002,7 +1041,8 @@ void fuse_send_init(struct fuse_conn *fc)
 		FUSE_WRITEBACK_CACHE | FUSE_NO_OPEN_SUPPORT |
 		FUSE_PARALLEL_DIROPS | FUSE_HANDLE_KILLPRIV | FUSE_POSIX_ACL |
 		FUSE_ABORT_ERROR | FUSE_MAX_PAGES | FUSE_CACHE_SYMLINKS |
-		FUSE_NO_OPENDIR_SUPPORT | FUSE_EXPLICIT_INVAL_DATA;
+		FUSE_NO_OPENDIR_SUPPORT | FUSE_EXPLICIT_INVAL_DATA |
+		FUSE_PASSTHROUGH;
 	ia->args.opcode = FUSE_INIT;
 	ia->args.in_numargs = 1;
 	ia->args.in_args[0].size = sizeof(ia->in);
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * FUSE: read/write passthrough to a lower file
+ *
+ * The server registers an open file with FUSE_DEV_IOC_PASSTHROUGH_OPEN and
+ * returns the id it gets back in passthrough_fh of the reply to OPEN or
+ * CREATE.  Reads and writes of the FUSE file then go directly to the lower
+ * file with the credentials of the server at registration time, so the
+ * data never crosses userspace.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/uio.h>
+
+static rwf_t fuse_iocb_to_rwf(struct kiocb *iocb)
+{
+	rwf_t flags = 0;
+
+	if (iocb->ki_flags & IOCB_HIPRI)
+		flags |= RWF_HIPRI;
+	if (iocb->ki_flags & IOCB_DSYNC)
+		flags |= RWF_DSYNC;
+	if (iocb->ki_flags & IOCB_SYNC)
+		flags |= RWF_SYNC;
+	if (iocb->ki_flags & IOCB_APPEND)
+		flags |= RWF_APPEND;
+
+	return flags;
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = vfs_iter_read(lower, to, &iocb->ki_pos, fuse_iocb_to_rwf(iocb));
+	revert_creds(old_cred);
+
+	fuse_invalidate_atime(file_inode(file));
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough.filp;
+	const struct cred *old_cred;
+	loff_t pos;
+	ssize_t ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	inode_lock(inode);
+	pos = iocb->ki_pos;
+	old_cred = override_creds(ff->passthrough.cred);
+	file_start_write(lower);
+	ret = vfs_iter_write(lower, from, &iocb->ki_pos,
+			     fuse_iocb_to_rwf(iocb));
+	file_end_write(lower);
+	revert_creds(old_cred);
+
+	if (ret > 0) {
+		/* The lower file decides where an append lands */
+		if (iocb->ki_flags & IOCB_APPEND)
+			pos = iocb->ki_pos - ret;
+		fuse_write_update_size(inode, iocb->ki_pos);
+		invalidate_inode_pages2_range(inode->i_mapping,
+					      pos >> PAGE_SHIFT,
+					      (iocb->ki_pos - 1) >> PAGE_SHIFT);
+	}
+	fuse_invalidate_attr(inode);
+	inode_unlock(inode);
+
+	return ret;
+}
+
+/**
+ * fuse_passthrough_open - register a lower file for passthrough
+ * @fud: device the request came from
+ * @lower_fd: open file descriptor of the lower file in the server
+ *
+ * Returns the id to put in passthrough_fh, or a negative error.
+ */
+int fuse_passthrough_open(struct fuse_dev *fud, u32 lower_fd)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_passthrough *passthrough;
+	struct super_block *lower_sb;
+	struct file *lower;
+	int ret;
+
+	if (!fc->passthrough)
+		return -EPERM;
+
+	lower = fget(lower_fd);
+	if (!lower)
+		return -EBADF;
+
+	ret = -EINVAL;
+	if (!lower->f_op->read_iter || !lower->f_op->write_iter)
+		goto out_fput;
+
+	/* Also refuses files of FUSE mounts using passthrough */
+	lower_sb = file_inode(lower)->i_sb;
+	if (lower_sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	ret = -ENOMEM;
+	passthrough = kmalloc(sizeof(*passthrough), GFP_KERNEL);
+	if (!passthrough)
+		goto out_fput;
+
+	passthrough->filp = lower;
+	passthrough->cred = prepare_creds();
+	if (!passthrough->cred)
+		goto out_free;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->passthrough_req_lock);
+	ret = idr_alloc(&fc->passthrough_req, passthrough, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->passthrough_req_lock);
+	idr_preload_end();
+	if (ret > 0)
+		return ret;
+
+	put_cred(passthrough->cred);
+out_free:
+	kfree(passthrough);
+out_fput:
+	fput(lower);
+	return ret;
+}
+
+/*
+ * Take the lower file registered under @openarg->passthrough_fh for @ff.
+ * The open is done without passthrough if there is none.
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg)
+{
+	struct fuse_passthrough *passthrough;
+	int id = openarg->passthrough_fh;
+
+	if (!fc->passthrough || id <= 0)
+		return;
+
+	spin_lock(&fc->passthrough_req_lock);
+	passthrough = idr_remove(&fc->passthrough_req, id);
+	spin_unlock(&fc->passthrough_req_lock);
+	if (!passthrough)
+		return;
+
+	ff->passthrough = *passthrough;
+	kfree(passthrough);
+}
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough)
+{
+	if (passthrough->filp) {
+		fput(passthrough->filp);
+		passthrough->filp = NULL;
+	}
+	if (passthrough->cred) {
+		put_cred(passthrough->cred);
+		passthrough->cred = NULL;
+	}
+}
+
+/* Drop the files registered by the server and never opened */
+void fuse_passthrough_free_all(struct fuse_conn *fc)
+{
+	struct fuse_passthrough *passthrough;
+	int id;
+
+	idr_for_each_entry(&fc->passthrough_req, passthrough, id) {
+		fuse_passthrough_release(passthrough);
+		kfree(passthrough);
+	}
+	idr_destroy(&fc->passthrough_req);
+}
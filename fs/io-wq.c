@@ -17,6 +17,7 @@
 #include <linux/rculist_nulls.h>
 #include <linux/fs_struct.h>
 #include <linux/task_work.h>
+#include <linux/seq_file.h>
 
 #include "io-wq.h"
 
@@ -101,6 +102,14 @@ struct io_wqe {
 
 	struct io_wq *wq;
 	struct io_wq_work *hash_tail[IO_WQ_NR_HASH_BUCKETS];
+
+	/* other nodes on the same socket we may take unhashed work from */
+	nodemask_t steal_nodes;
+
+	/* stats, shown in the fdinfo of the ring */
+	atomic_t nr_queued;
+	unsigned long nr_steals;
+	unsigned long nr_hash_stalls;
 };
 
 /*
@@ -115,6 +124,7 @@ struct io_wq {
 
 	struct task_struct *manager;
 	struct user_struct *user;
+	unsigned long nproc_limit;
 	refcount_t refs;
 	struct completion done;
 
@@ -288,6 +298,20 @@ static void io_wqe_wake_worker(struct io_wqe *wqe, struct io_wqe_acct *acct)
 
 	rcu_read_lock();
 	ret = io_wqe_activate_free_worker(wqe);
+	/*
+	 * No free worker and no room for another one, kick an idle worker of
+	 * a nearby node instead. It will steal the work when it finds its own
+	 * queue empty.
+	 */
+	if (!ret && acct->nr_workers >= acct->max_workers) {
+		int node;
+
+		for_each_node_mask(node, wqe->steal_nodes) {
+			ret = io_wqe_activate_free_worker(wqe->wq->wqes[node]);
+			if (ret)
+				break;
+		}
+	}
 	rcu_read_unlock();
 
 	if (!ret && acct->nr_workers < acct->max_workers)
@@ -396,6 +420,7 @@ static struct io_wq_work *io_get_next_work(struct io_wqe *wqe)
 		/* not hashed, can run anytime */
 		if (!io_wq_is_hashed(work)) {
 			wq_list_del(&wqe->work_list, node, prev);
+			atomic_dec(&wqe->nr_queued);
 			return work;
 		}
 
@@ -407,6 +432,7 @@ static struct io_wq_work *io_get_next_work(struct io_wqe *wqe)
 			tail = wqe->hash_tail[hash];
 			wqe->hash_tail[hash] = NULL;
 			wq_list_cut(&wqe->work_list, &tail->list, prev);
+			atomic_dec(&wqe->nr_queued);
 			return work;
 		}
 	}
@@ -481,6 +507,7 @@ static void io_assign_current_work(struct io_worker *worker,
 }
 
 static void io_wqe_enqueue(struct io_wqe *wqe, struct io_wq_work *work);
+static void io_wqe_insert_work(struct io_wqe *wqe, struct io_wq_work *work);
 
 static void io_worker_handle_work(struct io_worker *worker)
 	__releases(wqe->lock)
@@ -499,10 +526,12 @@ get_next:
 		 * clear the stalled flag.
 		 */
 		work = io_get_next_work(wqe);
-		if (work)
+		if (work) {
 			__io_worker_busy(wqe, worker, work);
-		else if (!wq_list_empty(&wqe->work_list))
+		} else if (!wq_list_empty(&wqe->work_list)) {
 			wqe->flags |= IO_WQE_FLAG_STALLED;
+			wqe->nr_hash_stalls++;
+		}
 
 		spin_unlock_irq(&wqe->lock);
 		if (!work)
@@ -527,6 +556,8 @@ get_next:
 			linked = wq->do_work(work);
 
 			work = next_hashed;
+			if (work)
+				atomic_dec(&wqe->nr_queued);
 			if (!work && linked && !io_wq_is_hashed(linked)) {
 				work = linked;
 				linked = NULL;
@@ -552,6 +583,50 @@ get_next:
 	} while (1);
 }
 
+/*
+ * Our queue is empty, take an unhashed work item from a nearby node whose
+ * workers are all busy. Hashed work is left alone, it's serialized on its
+ * own node anyway.
+ */
+static bool io_wqe_steal_work(struct io_wqe *wqe)
+{
+	struct io_wq *wq = wqe->wq;
+	int node;
+
+	for_each_node_mask(node, wqe->steal_nodes) {
+		struct io_wqe *victim = wq->wqes[node];
+		struct io_wq_work_node *n, *prev;
+		struct io_wq_work *work = NULL;
+
+		if (wq_list_empty(&victim->work_list) ||
+		    !hlist_nulls_empty(&victim->free_list))
+			continue;
+
+		spin_lock_irq(&victim->lock);
+		wq_list_for_each(n, prev, &victim->work_list) {
+			work = container_of(n, struct io_wq_work, list);
+			if (!io_wq_is_hashed(work)) {
+				wq_list_del(&victim->work_list, n, prev);
+				atomic_dec(&victim->nr_queued);
+				break;
+			}
+			work = NULL;
+		}
+		spin_unlock_irq(&victim->lock);
+		if (!work)
+			continue;
+
+		spin_lock_irq(&wqe->lock);
+		io_wqe_insert_work(wqe, work);
+		wqe->flags &= ~IO_WQE_FLAG_STALLED;
+		wqe->nr_steals++;
+		spin_unlock_irq(&wqe->lock);
+		return true;
+	}
+
+	return false;
+}
+
 static int io_wqe_worker(void *data)
 {
 	struct io_worker *worker = data;
@@ -569,6 +644,16 @@ loop:
 			io_worker_handle_work(worker);
 			goto loop;
 		}
+		if (!nodes_empty(wqe->steal_nodes)) {
+			spin_unlock_irq(&wqe->lock);
+			if (io_wqe_steal_work(wqe))
+				goto loop;
+			spin_lock_irq(&wqe->lock);
+			if (io_wqe_run_queue(wqe)) {
+				spin_unlock_irq(&wqe->lock);
+				goto loop;
+			}
+		}
 		/* drops the lock on success, retry */
 		if (__io_worker_idle(wqe, worker)) {
 			__release(&wqe->lock);
@@ -763,7 +848,7 @@ static bool io_wq_can_queue(struct io_wqe *wqe, struct io_wqe_acct *acct,
 	if (free_worker)
 		return true;
 
-	if (atomic_read(&wqe->wq->user->processes) >= acct->max_workers &&
+	if (atomic_read(&wqe->wq->user->processes) >= wqe->wq->nproc_limit &&
 	    !(capable(CAP_SYS_RESOURCE) || capable(CAP_SYS_ADMIN)))
 		return false;
 
@@ -788,6 +873,7 @@ static void io_wqe_insert_work(struct io_wqe *wqe, struct io_wq_work *work)
 	unsigned int hash;
 	struct io_wq_work *tail;
 
+	atomic_inc(&wqe->nr_queued);
 	if (!io_wq_is_hashed(work)) {
 append:
 		wq_list_add_tail(&work->list, &wqe->work_list);
@@ -940,6 +1026,7 @@ retry:
 			continue;
 
 		wq_list_del(&wqe->work_list, node, prev);
+		atomic_dec(&wqe->nr_queued);
 		spin_unlock_irqrestore(&wqe->lock, flags);
 		io_run_cancel(work, wqe);
 		match->nr_pending++;
@@ -1014,6 +1101,26 @@ enum io_wq_cancel io_wq_cancel_work(struct io_wq *wq, struct io_wq_work *cwork)
 	return io_wq_cancel_cb(wq, io_wq_io_cb_cancel_data, (void *)cwork, false);
 }
 
+/*
+ * Nodes closer than REMOTE_DISTANCE share a socket, e.g. the nodes of an
+ * EPYC in NPS2/NPS4 mode. Let their workers pick up each other's work.
+ */
+static void io_wq_init_steal_nodes(struct io_wq *wq)
+{
+	int node, other;
+
+	for_each_online_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		nodes_clear(wqe->steal_nodes);
+		for_each_online_node(other) {
+			if (other != node &&
+			    node_distance(node, other) < REMOTE_DISTANCE)
+				node_set(other, wqe->steal_nodes);
+		}
+	}
+}
+
 struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 {
 	int ret = -ENOMEM, node;
@@ -1037,6 +1144,7 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 
 	/* caller must already hold a reference to this */
 	wq->user = data->user;
+	wq->nproc_limit = task_rlimit(current, RLIMIT_NPROC);
 
 	for_each_node(node) {
 		struct io_wqe *wqe;
@@ -1061,8 +1169,11 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 		INIT_WQ_LIST(&wqe->work_list);
 		INIT_HLIST_NULLS_HEAD(&wqe->free_list, 0);
 		INIT_LIST_HEAD(&wqe->all_list);
+		atomic_set(&wqe->nr_queued, 0);
 	}
 
+	io_wq_init_steal_nodes(wq);
+
 	init_completion(&wq->done);
 
 	wq->manager = kthread_create(io_wq_manager, wq, "io_wq_manager");
@@ -1133,3 +1244,59 @@ struct task_struct *io_wq_get_task(struct io_wq *wq)
 {
 	return wq->manager;
 }
+
+/*
+ * Set the per-node limits of bounded and unbounded workers to
+ * new_count[IO_WQ_ACCT_BOUND] and new_count[IO_WQ_ACCT_UNBOUND]. A value of
+ * zero leaves that limit alone. The previous limits are returned in
+ * new_count. Workers above a lowered limit exit once they go idle.
+ */
+int io_wq_max_workers(struct io_wq *wq, int *new_count)
+{
+	int prev[2] = { 0, 0 };
+	int i, node;
+
+	for (i = 0; i < 2; i++) {
+		if (new_count[i] < 0)
+			return -EINVAL;
+	}
+	if (new_count[IO_WQ_ACCT_UNBOUND] > wq->nproc_limit)
+		new_count[IO_WQ_ACCT_UNBOUND] = wq->nproc_limit;
+
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		spin_lock_irq(&wqe->lock);
+		for (i = 0; i < 2; i++) {
+			struct io_wqe_acct *acct = &wqe->acct[i];
+
+			prev[i] = max_t(int, prev[i], acct->max_workers);
+			if (new_count[i])
+				acct->max_workers = new_count[i];
+		}
+		spin_unlock_irq(&wqe->lock);
+	}
+
+	for (i = 0; i < 2; i++)
+		new_count[i] = prev[i];
+	return 0;
+}
+
+void io_wq_show_fdinfo(struct io_wq *wq, struct seq_file *m)
+{
+	int node;
+
+	for_each_online_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+		struct io_wqe_acct *bound = &wqe->acct[IO_WQ_ACCT_BOUND];
+		struct io_wqe_acct *unbound = &wqe->acct[IO_WQ_ACCT_UNBOUND];
+
+		spin_lock_irq(&wqe->lock);
+		seq_printf(m, "IoWqNode%d:\tqueued %d, bound %u/%u, unbound %u/%u, steals %lu, hashed stalls %lu\n",
+			   node, atomic_read(&wqe->nr_queued),
+			   bound->nr_workers, bound->max_workers,
+			   unbound->nr_workers, unbound->max_workers,
+			   wqe->nr_steals, wqe->nr_hash_stalls);
+		spin_unlock_irq(&wqe->lock);
+	}
+}
@@ -2,6 +2,7 @@
 #define INTERNAL_IO_WQ_H
 
 struct io_wq;
+struct seq_file;
 
 enum {
 	IO_WQ_WORK_CANCEL	= 1,
@@ -132,6 +133,8 @@ enum io_wq_cancel io_wq_cancel_cb(struct io_wq *wq, work_cancel_fn *cancel,
 					void *data, bool cancel_all);
 
 struct task_struct *io_wq_get_task(struct io_wq *wq);
+int io_wq_max_workers(struct io_wq *wq, int *new_count);
+void io_wq_show_fdinfo(struct io_wq *wq, struct seq_file *m);
 
 #if defined(CONFIG_IO_WQ)
 extern void io_wq_worker_sleeping(struct task_struct *);
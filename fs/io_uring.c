@@ -79,6 +79,9 @@
 #include <linux/splice.h>
 #include <linux/task_work.h>
 #include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/io_uring.h>
+#include <linux/topology.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/io_uring.h>
@@ -99,6 +102,9 @@
 #define IORING_FILE_TABLE_MASK	(IORING_MAX_FILES_TABLE - 1)
 #define IORING_MAX_FIXED_FILES	(64 * IORING_MAX_FILES_TABLE)
 
+/* Default per-pass SQE budget of a ring sharing its SQPOLL thread */
+#define IORING_SQPOLL_CAP_ENTRIES_VALUE	8
+
 struct io_uring {
 	u32 head ____cacheline_aligned_in_smp;
 	u32 tail ____cacheline_aligned_in_smp;
@@ -212,6 +218,15 @@ struct fixed_file_data {
 	spinlock_t			lock;
 };
 
+#define IO_RINGFD_REG_MAX	16
+
+/* per task state, hangs off task_struct->io_uring */
+struct io_uring_task {
+	struct file	*registered_rings[IO_RINGFD_REG_MAX];
+	/* fd the ring had when registered, see io_grab_files() */
+	int		registered_fds[IO_RINGFD_REG_MAX];
+};
+
 struct io_buffer {
 	struct list_head list;
 	__u64 addr;
@@ -219,6 +234,41 @@ struct io_buffer {
 	__u16 bid;
 };
 
+/*
+ * Provided buffers registered as a ring shared with the application. The
+ * ring is consumed without uring_lock: head only moves by cmpxchg, and the
+ * selected entry is copied into bufs[] so that it stays stable for the
+ * request while the application refills the ring slot.
+ */
+struct io_buffer_ring {
+	struct io_uring_buf_ring	*br;
+	struct page			**pages;
+	int				nr_pages;
+	unsigned int			head;
+	__u16				mask;
+	struct io_buffer		bufs[];
+};
+
+/*
+ * An SQPOLL thread, possibly shared by several rings through
+ * IORING_SETUP_ATTACH_WQ. The thread is parked while ->ctx_list changes.
+ */
+struct io_sq_data {
+	refcount_t		refs;
+	struct mutex		lock;
+	struct list_head	ctx_list;
+	unsigned		nr_rings;
+
+	struct task_struct	*thread;
+	struct wait_queue_head	wait;
+
+	/* longest idle period of the attached rings */
+	unsigned		sq_thread_idle;
+
+	unsigned long		nr_sleeps;
+	unsigned long		nr_wakeups;
+};
+
 struct io_ring_ctx {
 	struct {
 		struct percpu_ref	refs;
@@ -264,9 +314,12 @@ struct io_ring_ctx {
 
 	/* IO offload */
 	struct io_wq		*io_wq;
-	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	struct io_sq_data	*sq_data;	/* if using sq thread polling */
+	struct list_head	sqd_list;
+	struct wait_queue_head	*sqo_wait;
+	unsigned		sq_thread_batch;
+	bool			sq_cq_busy;
 	struct mm_struct	*sqo_mm;
-	wait_queue_head_t	sqo_wait;
 
 	/*
 	 * If used, fixed file set. Writers must ensure that ->refs is dead,
@@ -287,7 +340,6 @@ struct io_ring_ctx {
 	const struct cred	*creds;
 
 	struct completion	ref_comp;
-	struct completion	sq_thread_comp;
 
 	/* if all else fails... */
 	struct io_kiocb		*fallback_req;
@@ -297,9 +349,13 @@ struct io_ring_ctx {
 #endif
 
 	struct idr		io_buffer_idr;
+	struct xarray		io_buf_rings;
 
 	struct idr		personality_idr;
 
+	/* requests punted to io-wq, by opcode */
+	atomic_long_t		nr_punted[IORING_OP_LAST];
+
 	struct {
 		unsigned		cached_cq_tail;
 		unsigned		cq_entries;
@@ -374,6 +430,7 @@ struct io_accept {
 	struct sockaddr __user		*addr;
 	int __user			*addr_len;
 	int				flags;
+	u32				file_slot;
 	unsigned long			nofile;
 };
 
@@ -421,14 +478,33 @@ struct io_sr_msg {
 	int				msg_flags;
 	int				bgid;
 	size_t				len;
+	/* multishot recv: length limit of each completion */
+	size_t				max_len;
 	struct io_buffer		*kbuf;
 };
 
+struct io_sendzc_notif {
+	struct ubuf_info		uarg;
+	struct io_kiocb			*req;
+};
+
+struct io_sendzc {
+	struct file			*file;
+	void __user			*buf;
+	size_t				len;
+	int				msg_flags;
+	unsigned			flags;
+	/* result for the notification CQE */
+	int				res;
+	struct io_sendzc_notif		*notif;
+};
+
 struct io_open {
 	struct file			*file;
 	int				dfd;
 	struct filename			*filename;
 	struct open_how			how;
+	u32				file_slot;
 	unsigned long			nofile;
 };
 
@@ -545,6 +621,8 @@ enum {
 	REQ_F_NO_FILE_TABLE_BIT,
 	REQ_F_WORK_INITIALIZED_BIT,
 	REQ_F_TASK_PINNED_BIT,
+	REQ_F_BUFFER_RING_BIT,
+	REQ_F_MULTISHOT_BIT,
 
 	/* not a real bit, just to check we're not overflowing the space */
 	__REQ_F_LAST_BIT,
@@ -592,6 +670,10 @@ enum {
 	REQ_F_WORK_INITIALIZED	= BIT(REQ_F_WORK_INITIALIZED_BIT),
 	/* req->task is refcounted */
 	REQ_F_TASK_PINNED	= BIT(REQ_F_TASK_PINNED_BIT),
+	/* selected buffer came from a buffer ring */
+	REQ_F_BUFFER_RING	= BIT(REQ_F_BUFFER_RING_BIT),
+	/* stays armed and posts a CQE per completion until it fails */
+	REQ_F_MULTISHOT		= BIT(REQ_F_MULTISHOT_BIT),
 };
 
 struct async_poll {
@@ -625,6 +707,8 @@ struct io_kiocb {
 		struct io_splice	splice;
 		struct io_provide_buf	pbuf;
 		struct io_statx		statx;
+		struct io_uring_cmd	uring_cmd;
+		struct io_sendzc	sendzc;
 		/* use only after cleaning per-op data, see io_clean_op() */
 		struct io_completion	compl;
 	};
@@ -881,6 +965,17 @@ static const struct io_op_def io_op_defs[] = {
 		.hash_reg_file		= 1,
 		.unbound_nonreg_file	= 1,
 	},
+	[IORING_OP_URING_CMD] = {
+		.needs_mm		= 1,
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+	},
+	[IORING_OP_SEND_ZC] = {
+		.needs_mm		= 1,
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+		.pollout		= 1,
+	},
 };
 
 enum io_mem_account {
@@ -900,6 +995,8 @@ static void io_queue_linked_timeout(struct io_kiocb *req);
 static int __io_sqe_files_update(struct io_ring_ctx *ctx,
 				 struct io_uring_files_update *ip,
 				 unsigned nr_args);
+static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
+				 bool needs_lock, u32 slot);
 static int io_prep_work_files(struct io_kiocb *req);
 static void __io_clean_op(struct io_kiocb *req);
 static int io_file_get(struct io_submit_state *state, struct io_kiocb *req,
@@ -908,6 +1005,7 @@ static void __io_queue_sqe(struct io_kiocb *req,
 			   const struct io_uring_sqe *sqe,
 			   struct io_comp_state *cs);
 static void io_file_put_work(struct work_struct *work);
+static void io_uring_cmd_run_cb(struct io_kiocb *req);
 
 static ssize_t io_import_iovec(int rw, struct io_kiocb *req,
 			       struct iovec **iovec, struct iov_iter *iter,
@@ -967,6 +1065,11 @@ static void io_sq_thread_drop_mm(void)
 
 static int __io_sq_thread_acquire_mm(struct io_ring_ctx *ctx)
 {
+	/* a shared SQPOLL thread may still hold another ring's mm */
+	if (current->mm && current->mm != ctx->sqo_mm && ctx->sq_data &&
+	    current == ctx->sq_data->thread)
+		io_sq_thread_drop_mm();
+
 	if (!current->mm) {
 		if (unlikely(!(ctx->flags & IORING_SETUP_SQPOLL) ||
 			     !mmget_not_zero(ctx->sqo_mm)))
@@ -1054,12 +1157,12 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 		goto err;
 
 	ctx->flags = p->flags;
-	init_waitqueue_head(&ctx->sqo_wait);
+	INIT_LIST_HEAD(&ctx->sqd_list);
 	init_waitqueue_head(&ctx->cq_wait);
 	INIT_LIST_HEAD(&ctx->cq_overflow_list);
 	init_completion(&ctx->ref_comp);
-	init_completion(&ctx->sq_thread_comp);
 	idr_init(&ctx->io_buffer_idr);
+	xa_init(&ctx->io_buf_rings);
 	idr_init(&ctx->personality_idr);
 	mutex_init(&ctx->uring_lock);
 	init_waitqueue_head(&ctx->wait);
@@ -1195,6 +1298,7 @@ static struct io_kiocb *__io_queue_async_work(struct io_kiocb *req)
 
 	trace_io_uring_queue_async_work(ctx, io_wq_is_hashed(&req->work), req,
 					&req->work, req->flags);
+	atomic_long_inc(&ctx->nr_punted[req->opcode]);
 	io_wq_enqueue(ctx->io_wq, &req->work);
 	return link;
 }
@@ -1317,8 +1421,8 @@ static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
 {
 	if (waitqueue_active(&ctx->wait))
 		wake_up(&ctx->wait);
-	if (waitqueue_active(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	if (ctx->sqo_wait && waitqueue_active(ctx->sqo_wait))
+		wake_up(ctx->sqo_wait);
 	if (io_should_trigger_evfd(ctx))
 		eventfd_signal(ctx->cq_ev_fd, 1);
 }
@@ -1441,6 +1545,35 @@ static void io_cqring_add_event(struct io_kiocb *req, long res, long cflags)
 	io_cqring_ev_posted(ctx);
 }
 
+/*
+ * Post a CQE flagged IORING_CQE_F_MORE for a multishot request that stays
+ * armed. It can't be queued on the overflow list, as that would need the
+ * request itself, so return false if the CQ ring is full and let the
+ * caller complete the request with this result instead.
+ */
+static bool io_post_more_cqe(struct io_kiocb *req, long res, unsigned cflags)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_uring_cqe *cqe = NULL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	/* don't overtake CQEs on the overflow list */
+	if (list_empty(&ctx->cq_overflow_list))
+		cqe = io_get_cqring(ctx);
+	if (cqe) {
+		trace_io_uring_complete(ctx, req->user_data, res);
+		WRITE_ONCE(cqe->user_data, req->user_data);
+		WRITE_ONCE(cqe->res, res);
+		WRITE_ONCE(cqe->flags, cflags | IORING_CQE_F_MORE);
+		io_commit_cqring(ctx);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (cqe)
+		io_cqring_ev_posted(ctx);
+	return cqe != NULL;
+}
+
 static void io_submit_flush_completions(struct io_comp_state *cs)
 {
 	struct io_ring_ctx *ctx = cs->ctx;
@@ -1994,8 +2127,9 @@ static unsigned int io_put_kbuf(struct io_kiocb *req, struct io_buffer *kbuf)
 
 	cflags = kbuf->bid << IORING_CQE_BUFFER_SHIFT;
 	cflags |= IORING_CQE_F_BUFFER;
-	req->flags &= ~REQ_F_BUFFER_SELECTED;
-	kfree(kbuf);
+	if (!(req->flags & REQ_F_BUFFER_RING))
+		kfree(kbuf);
+	req->flags &= ~(REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING);
 	return cflags;
 }
 
@@ -2047,7 +2181,9 @@ static void io_iopoll_complete(struct io_ring_ctx *ctx, unsigned int *nr_events,
 		int cflags = 0;
 
 		req = list_first_entry(done, struct io_kiocb, inflight_entry);
-		if (READ_ONCE(req->result) == -EAGAIN) {
+		if (req->opcode == IORING_OP_URING_CMD) {
+			io_uring_cmd_run_cb(req);
+		} else if (READ_ONCE(req->result) == -EAGAIN) {
 			req->iopoll_completed = 0;
 			list_move_tail(&req->inflight_entry, &again);
 			continue;
@@ -2103,7 +2239,11 @@ static int io_do_iopoll(struct io_ring_ctx *ctx, unsigned int *nr_events,
 		if (!list_empty(&done))
 			break;
 
-		ret = kiocb->ki_filp->f_op->iopoll(kiocb, spin);
+		if (req->opcode == IORING_OP_URING_CMD)
+			ret = req->file->f_op->uring_cmd_iopoll(&req->uring_cmd,
+								spin);
+		else
+			ret = kiocb->ki_filp->f_op->iopoll(kiocb, spin);
 		if (ret < 0)
 			break;
 
@@ -2395,8 +2535,8 @@ static void io_iopoll_req_issued(struct io_kiocb *req)
 		list_add_tail(&req->inflight_entry, &ctx->iopoll_list);
 
 	if ((ctx->flags & IORING_SETUP_SQPOLL) &&
-	    wq_has_sleeper(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	    wq_has_sleeper(ctx->sqo_wait))
+		wake_up(ctx->sqo_wait);
 }
 
 static void __io_state_file_put(struct io_submit_state *state)
@@ -2532,7 +2672,7 @@ static int io_prep_rw(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 		    !kiocb->ki_filp->f_op->iopoll)
 			return -EOPNOTSUPP;
 
-		kiocb->ki_flags |= IOCB_HIPRI;
+		kiocb->ki_flags |= IOCB_HIPRI | IOCB_ALLOC_CACHE;
 		kiocb->ki_complete = io_complete_rw_iopoll;
 		req->iopoll_completed = 0;
 		io_get_req_task(req);
@@ -2590,15 +2730,14 @@ static void kiocb_done(struct kiocb *kiocb, ssize_t ret,
 		io_rw_done(kiocb, ret);
 }
 
-static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
-			       struct iov_iter *iter)
+static ssize_t __io_import_fixed(struct io_kiocb *req, int rw,
+				 struct iov_iter *iter, u64 buf_addr,
+				 size_t len)
 {
 	struct io_ring_ctx *ctx = req->ctx;
-	size_t len = req->rw.len;
 	struct io_mapped_ubuf *imu;
 	u16 index, buf_index;
 	size_t offset;
-	u64 buf_addr;
 
 	/* attempt to use fixed buffers without having provided iovecs */
 	if (unlikely(!ctx->user_bufs))
@@ -2610,7 +2749,6 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 
 	index = array_index_nospec(buf_index, ctx->nr_user_bufs);
 	imu = &ctx->user_bufs[index];
-	buf_addr = req->rw.addr;
 
 	/* overflow */
 	if (buf_addr + len < buf_addr)
@@ -2664,6 +2802,12 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 	return len;
 }
 
+static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
+			       struct iov_iter *iter)
+{
+	return __io_import_fixed(req, rw, iter, req->rw.addr, req->rw.len);
+}
+
 static void io_ring_submit_unlock(struct io_ring_ctx *ctx, bool needs_lock)
 {
 	if (needs_lock)
@@ -2682,15 +2826,61 @@ static void io_ring_submit_lock(struct io_ring_ctx *ctx, bool needs_lock)
 		mutex_lock(&ctx->uring_lock);
 }
 
+static struct io_buffer *io_ring_buffer_select(struct io_kiocb *req,
+					       size_t *len,
+					       struct io_buffer_ring *bl)
+{
+	struct io_uring_buf *buf;
+	struct io_buffer *kbuf;
+	unsigned int head;
+	__u64 addr;
+	__u32 blen;
+	__u16 bid;
+
+	do {
+		head = READ_ONCE(bl->head);
+		/* pairs with the store release of the tail by the application */
+		if ((__u16) head == smp_load_acquire(&bl->br->tail))
+			return ERR_PTR(-ENOBUFS);
+		buf = &bl->br->bufs[head & bl->mask];
+		addr = READ_ONCE(buf->addr);
+		blen = READ_ONCE(buf->len);
+		bid = READ_ONCE(buf->bid);
+	} while (cmpxchg(&bl->head, head, head + 1) != head);
+
+	/*
+	 * The slot can only be reused once the application has queued a full
+	 * ring of buffers behind this one, which it won't do before it has
+	 * seen the completion that hands this buffer back.
+	 */
+	kbuf = &bl->bufs[head & bl->mask];
+	kbuf->addr = addr;
+	kbuf->len = blen;
+	kbuf->bid = bid;
+	if (*len > blen)
+		*len = blen;
+	req->flags |= REQ_F_BUFFER_RING;
+	return kbuf;
+}
+
 static struct io_buffer *io_buffer_select(struct io_kiocb *req, size_t *len,
 					  int bgid, struct io_buffer *kbuf,
 					  bool needs_lock)
 {
+	struct io_buffer_ring *bl;
 	struct io_buffer *head;
 
 	if (req->flags & REQ_F_BUFFER_SELECTED)
 		return kbuf;
 
+	/*
+	 * Rings are only added and removed with the ctx quiesced, so the
+	 * lookup is safe against a request in flight without uring_lock.
+	 */
+	bl = xa_load(&req->ctx->io_buf_rings, bgid);
+	if (bl)
+		return io_ring_buffer_select(req, len, bl);
+
 	io_ring_submit_lock(req->ctx, needs_lock);
 
 	lockdep_assert_held(&req->ctx->uring_lock);
@@ -3254,6 +3444,7 @@ static int io_write(struct io_kiocb *req, bool force_nonblock,
 
 	/* file path doesn't support NOWAIT for non-direct_IO */
 	if (force_nonblock && !(kiocb->ki_flags & IOCB_DIRECT) &&
+	    !(req->file->f_mode & FMODE_BUF_WASYNC) &&
 	    (req->flags & REQ_F_ISREG))
 		goto copy_iov;
 
@@ -3290,9 +3481,23 @@ static int io_write(struct io_kiocb *req, bool force_nonblock,
 	 */
 	if (ret2 == -EOPNOTSUPP && (kiocb->ki_flags & IOCB_NOWAIT))
 		ret2 = -EAGAIN;
+
+	/*
+	 * A non-blocking buffered write stops short where it would have to
+	 * wait, finish the rest from io-wq rather than returning a short
+	 * write for a regular file.
+	 */
+	if (force_nonblock && ret2 > 0 && ret2 < io_size &&
+	    (req->flags & REQ_F_ISREG) && !(kiocb->ki_flags & IOCB_DIRECT) &&
+	    !(req->file->f_flags & O_NONBLOCK))
+		goto partial;
+
 	if (!force_nonblock || ret2 != -EAGAIN) {
 		kiocb_done(kiocb, ret2, cs);
 	} else {
+		/* the retry takes freeze protection again */
+		if (req->flags & REQ_F_ISREG)
+			kiocb_end_write(req);
 copy_iov:
 		ret = io_setup_async_rw(req, iovec, inline_vecs, iter, false);
 		if (!ret)
@@ -3303,6 +3508,17 @@ out_free:
 	if (iovec)
 		kfree(iovec);
 	return ret;
+partial:
+	ret = io_setup_async_rw(req, iovec, inline_vecs, iter, true);
+	if (ret) {
+		/* can't retry, settle for the short write */
+		kiocb_done(kiocb, ret2, cs);
+		ret = 0;
+		goto out_free;
+	}
+	kiocb_end_write(req);
+	req->io->rw.bytes_done += ret2;
+	return -EAGAIN;
 }
 
 static int __io_splice_prep(struct io_kiocb *req,
@@ -3408,6 +3624,134 @@ static int io_splice(struct io_kiocb *req, bool force_nonblock)
 	return 0;
 }
 
+static int io_uring_cmd_prep(struct io_kiocb *req,
+			     const struct io_uring_sqe *sqe)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+
+	if (!req->file->f_op->uring_cmd)
+		return -EOPNOTSUPP;
+	if ((req->ctx->flags & IORING_SETUP_IOPOLL) &&
+	    !req->file->f_op->uring_cmd_iopoll)
+		return -EOPNOTSUPP;
+	if (sqe->ioprio || sqe->__pad1 || sqe->rw_flags || sqe->buf_index)
+		return -EINVAL;
+
+	ioucmd->cmd = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	ioucmd->cmd_len = READ_ONCE(sqe->len);
+	ioucmd->cmd_op = READ_ONCE(sqe->cmd_op);
+	ioucmd->task_work_cb = NULL;
+	return 0;
+}
+
+static int io_uring_cmd(struct io_kiocb *req, bool force_nonblock)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+	unsigned int issue_flags = 0;
+	int ret;
+
+	if (force_nonblock)
+		issue_flags |= IO_URING_F_NONBLOCK;
+	if (req->ctx->flags & IORING_SETUP_IOPOLL) {
+		issue_flags |= IO_URING_F_IOPOLL;
+		req->iopoll_completed = 0;
+	}
+
+	ret = req->file->f_op->uring_cmd(ioucmd, issue_flags);
+	if (ret == -EAGAIN)
+		return ret;
+	if (ret != -EIOCBQUEUED)
+		io_uring_cmd_done(ioucmd, ret);
+	return 0;
+}
+
+/*
+ * Run the driver's completion callback for a command it finished with
+ * io_uring_cmd_complete_in_task(). Called from the issuing task, or for
+ * IOPOLL rings from whoever reaps the ring, with the ring's mm if there is
+ * one to be had.
+ */
+static void io_uring_cmd_run_cb(struct io_kiocb *req)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+	void (*cb)(struct io_uring_cmd *) = ioucmd->task_work_cb;
+
+	if (!cb)
+		return;
+	ioucmd->task_work_cb = NULL;
+	__io_sq_thread_acquire_mm(req->ctx);
+	cb(ioucmd);
+}
+
+static void io_uring_cmd_work(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+	struct io_ring_ctx *ctx = req->ctx;
+
+	io_uring_cmd_run_cb(req);
+	percpu_ref_put(&ctx->refs);
+}
+
+/**
+ * io_uring_cmd_complete_in_task - finish a command from task context
+ * @ioucmd: the command
+ * @task_work_cb: driver callback, must end in io_uring_cmd_done()
+ *
+ * May be called from any context, typically from the driver's interrupt
+ * time completion. @task_work_cb is run where user memory of the submitter
+ * can be accessed.
+ */
+void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *))
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+	int ret;
+
+	ioucmd->task_work_cb = task_work_cb;
+	if (req->ctx->flags & IORING_SETUP_IOPOLL) {
+		/* io_iopoll_complete() runs the callback when reaping */
+		smp_wmb();
+		WRITE_ONCE(req->iopoll_completed, 1);
+		return;
+	}
+
+	init_task_work(&req->task_work, io_uring_cmd_work);
+	percpu_ref_get(&req->ctx->refs);
+
+	ret = io_req_task_work_add(req, &req->task_work);
+	if (unlikely(ret)) {
+		struct task_struct *tsk;
+
+		tsk = io_wq_get_task(req->ctx->io_wq);
+		task_work_add(tsk, &req->task_work, 0);
+		wake_up_process(tsk);
+	}
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_complete_in_task);
+
+/**
+ * io_uring_cmd_done - post the completion of a command
+ * @ioucmd: the command
+ * @ret: result for the CQE
+ */
+void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret)
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+
+	if (ret < 0)
+		req_set_fail_links(req);
+
+	if (req->ctx->flags & IORING_SETUP_IOPOLL) {
+		WRITE_ONCE(req->result, ret);
+		/* order with io_iopoll_complete() checking ->result */
+		smp_wmb();
+		WRITE_ONCE(req->iopoll_completed, 1);
+	} else {
+		io_req_complete(req, ret);
+	}
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_done);
+
 /*
  * IORING_OP_NOP just posts a completion event, nothing else.
  */
@@ -3515,6 +3859,13 @@ static int __io_openat_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe
 		return ret;
 	}
 	req->open.nofile = rlimit(RLIMIT_NOFILE);
+	req->open.file_slot = READ_ONCE(sqe->file_index);
+	/* a fixed file isn't in the file table, so can't be closed on exec */
+	if (req->open.file_slot && (req->open.how.flags & O_CLOEXEC)) {
+		putname(req->open.filename);
+		req->open.filename = NULL;
+		return -EINVAL;
+	}
 	req->flags |= REQ_F_NEED_CLEANUP;
 	return 0;
 }
@@ -3554,6 +3905,7 @@ static int io_openat2_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 
 static int io_openat2(struct io_kiocb *req, bool force_nonblock)
 {
+	bool fixed = !!req->open.file_slot;
 	struct open_flags op;
 	struct file *file;
 	int ret;
@@ -3565,17 +3917,25 @@ static int io_openat2(struct io_kiocb *req, bool force_nonblock)
 	if (ret)
 		goto err;
 
-	ret = __get_unused_fd_flags(req->open.how.flags, req->open.nofile);
-	if (ret < 0)
-		goto err;
+	if (!fixed) {
+		ret = __get_unused_fd_flags(req->open.how.flags,
+					    req->open.nofile);
+		if (ret < 0)
+			goto err;
+	}
 
 	file = do_filp_open(req->open.dfd, req->open.filename, &op);
 	if (IS_ERR(file)) {
-		put_unused_fd(ret);
+		if (!fixed)
+			put_unused_fd(ret);
 		ret = PTR_ERR(file);
-	} else {
+	} else if (!fixed) {
 		fsnotify_open(file);
 		fd_install(ret, file);
+	} else {
+		fsnotify_open(file);
+		ret = io_install_fixed_file(req, file, true,
+					    req->open.file_slot - 1);
 	}
 err:
 	putname(req->open.filename);
@@ -3728,6 +4088,11 @@ static int io_provide_buffers(struct io_kiocb *req, bool force_nonblock,
 
 	list = head = idr_find(&ctx->io_buffer_idr, p->bgid);
 
+	/* a group is either a ring or a list of provided buffers */
+	ret = -EEXIST;
+	if (!list && xa_load(&ctx->io_buf_rings, p->bgid))
+		goto out;
+
 	ret = io_add_buffers(p, &head);
 	if (ret < 0)
 		goto out;
@@ -4123,6 +4488,7 @@ static int io_send(struct io_kiocb *req, bool force_nonblock,
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_namelen = 0;
+	msg.msg_ubuf = NULL;
 
 	flags = req->sr_msg.msg_flags;
 	if (flags & MSG_DONTWAIT)
@@ -4143,6 +4509,152 @@ static int io_send(struct io_kiocb *req, bool force_nonblock,
 	return 0;
 }
 
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_sendzc *zc = &req->sendzc;
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->off || sqe->splice_fd_in)
+		return -EINVAL;
+
+	zc->flags = READ_ONCE(sqe->ioprio);
+	if (zc->flags & ~IORING_RECVSEND_FIXED_BUF)
+		return -EINVAL;
+	if (zc->flags & IORING_RECVSEND_FIXED_BUF) {
+		req->buf_index = READ_ONCE(sqe->buf_index);
+		if (unlikely(req->buf_index >= ctx->nr_user_bufs))
+			return -EFAULT;
+	}
+
+	zc->buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	zc->len = READ_ONCE(sqe->len);
+	zc->msg_flags = READ_ONCE(sqe->msg_flags);
+	zc->notif = NULL;
+
+#ifdef CONFIG_COMPAT
+	if (ctx->compat)
+		zc->msg_flags |= MSG_CMSG_COMPAT;
+#endif
+	return 0;
+}
+
+static void io_sendzc_notif_task(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+	struct io_ring_ctx *ctx = req->ctx;
+
+	kfree(req->sendzc.notif);
+	__io_req_complete(req, req->sendzc.res, IORING_CQE_F_NOTIF, NULL);
+	percpu_ref_put(&ctx->refs);
+}
+
+/*
+ * Called by the network stack for every skb that releases its hold on the
+ * data, and once by io_sendzc() itself. The last one posts the notification.
+ */
+static void io_sendzc_callback(struct ubuf_info *uarg, bool success)
+{
+	struct io_sendzc_notif *notif;
+	struct io_kiocb *req;
+	int ret;
+
+	if (!refcount_dec_and_test(&uarg->refcnt))
+		return;
+
+	notif = container_of(uarg, struct io_sendzc_notif, uarg);
+	req = notif->req;
+	init_task_work(&req->task_work, io_sendzc_notif_task);
+	percpu_ref_get(&req->ctx->refs);
+
+	ret = io_req_task_work_add(req, &req->task_work);
+	if (unlikely(ret)) {
+		struct task_struct *tsk;
+
+		tsk = io_wq_get_task(req->ctx->io_wq);
+		task_work_add(tsk, &req->task_work, 0);
+		wake_up_process(tsk);
+	}
+}
+
+/*
+ * IORING_OP_SEND_ZC attaches the user pages to the skbs instead of copying
+ * them. The send result is posted flagged IORING_CQE_F_MORE, followed by a
+ * CQE flagged IORING_CQE_F_NOTIF once the stack is done with the buffer.
+ */
+static int io_sendzc(struct io_kiocb *req, bool force_nonblock)
+{
+	struct io_sendzc *zc = &req->sendzc;
+	struct io_sendzc_notif *notif;
+	struct msghdr msg;
+	struct iovec iov;
+	struct socket *sock;
+	unsigned flags;
+	int ret;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		return ret;
+
+	if (zc->flags & IORING_RECVSEND_FIXED_BUF) {
+		ret = __io_import_fixed(req, WRITE, &msg.msg_iter,
+					(u64)(unsigned long)zc->buf, zc->len);
+		if (unlikely(ret < 0))
+			return ret;
+	} else {
+		ret = import_single_range(WRITE, zc->buf, zc->len, &iov,
+					  &msg.msg_iter);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	notif = zc->notif;
+	if (!notif) {
+		notif = kmalloc(sizeof(*notif), GFP_KERNEL);
+		if (unlikely(!notif))
+			return -ENOMEM;
+		notif->uarg.callback = io_sendzc_callback;
+		notif->uarg.flags = UBUF_F_DONT_ORPHAN;
+		notif->uarg.mmp.user = NULL;
+		refcount_set(&notif->uarg.refcnt, 1);
+		notif->req = req;
+		zc->notif = notif;
+		req->flags |= REQ_F_NEED_CLEANUP;
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_ubuf = &notif->uarg;
+
+	flags = zc->msg_flags | MSG_ZEROCOPY;
+	if (flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	else if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+
+	msg.msg_flags = flags;
+	ret = sock_sendmsg(sock, &msg);
+	/* nothing was queued, the notification can be reused on retry */
+	if (force_nonblock && ret == -EAGAIN)
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	if (ret < 0)
+		req_set_fail_links(req);
+
+	/* the notification completes the request from here on */
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+	zc->res = ret;
+	if (io_post_more_cqe(req, ret, 0))
+		zc->res = 0;
+	io_sendzc_callback(&notif->uarg, true);
+	return 0;
+}
+
 static int __io_recvmsg_copy_hdr(struct io_kiocb *req,
 				 struct io_async_msghdr *iomsg)
 {
@@ -4257,6 +4769,7 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 {
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct io_async_ctx *io = req->io;
+	unsigned int flags;
 	int ret;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
@@ -4267,8 +4780,26 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 	sr->len = READ_ONCE(sqe->len);
 	sr->bgid = READ_ONCE(sqe->buf_group);
 
-#ifdef CONFIG_COMPAT
-	if (req->ctx->compat)
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_RECV_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_RECV_MULTISHOT) {
+		if (req->opcode != IORING_OP_RECV ||
+		    !(req->flags & REQ_F_BUFFER_SELECT))
+			return -EINVAL;
+		/* completions of a multishot request can't be ordered */
+		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK |
+				  REQ_F_FORCE_ASYNC))
+			return -EINVAL;
+		if (sr->msg_flags & MSG_WAITALL)
+			return -EINVAL;
+		sr->max_len = sr->len ? sr->len : SIZE_MAX;
+		sr->len = sr->max_len;
+		req->flags |= REQ_F_MULTISHOT;
+	}
+
+#ifdef CONFIG_COMPAT
+	if (req->ctx->compat)
 		sr->msg_flags |= MSG_CMSG_COMPAT;
 #endif
 
@@ -4361,6 +4892,7 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock,
 		return ret;
 
 	if (req->flags & REQ_F_BUFFER_SELECT) {
+retry:
 		kbuf = io_recv_buffer_select(req, !force_nonblock);
 		if (IS_ERR(kbuf))
 			return PTR_ERR(kbuf);
@@ -4379,7 +4911,8 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock,
 	msg.msg_flags = 0;
 
 	flags = req->sr_msg.msg_flags;
-	if (flags & MSG_DONTWAIT)
+	/* a multishot recv waits for data through poll */
+	if ((flags & MSG_DONTWAIT) && !(req->flags & REQ_F_MULTISHOT))
 		req->flags |= REQ_F_NOWAIT;
 	else if (force_nonblock)
 		flags |= MSG_DONTWAIT;
@@ -4392,6 +4925,17 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock,
 out_free:
 	if (req->flags & REQ_F_BUFFER_SELECTED)
 		cflags = io_put_recv_kbuf(req);
+	/*
+	 * Keep going while there is data and buffers. Zero is EOF, which
+	 * ends the request like an error or running out of buffers does.
+	 * From io-wq the recv may have blocked, so complete it there.
+	 */
+	if (ret > 0 && (req->flags & REQ_F_MULTISHOT) && force_nonblock &&
+	    io_post_more_cqe(req, ret, cflags)) {
+		sr->len = sr->max_len;
+		cflags = 0;
+		goto retry;
+	}
 	if (ret < 0)
 		req_set_fail_links(req);
 	__io_req_complete(req, ret, cflags, cs);
@@ -4401,16 +4945,37 @@ out_free:
 static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_accept *accept = &req->accept;
+	unsigned int flags;
 
 	if (unlikely(req->ctx->flags & (IORING_SETUP_IOPOLL|IORING_SETUP_SQPOLL)))
 		return -EINVAL;
-	if (sqe->ioprio || sqe->len || sqe->buf_index)
+	if (sqe->len || sqe->buf_index)
+		return -EINVAL;
+
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_ACCEPT_MULTISHOT)
 		return -EINVAL;
+	if (flags & IORING_ACCEPT_MULTISHOT) {
+		/* completions of a multishot request can't be ordered */
+		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK |
+				  REQ_F_FORCE_ASYNC))
+			return -EINVAL;
+		req->flags |= REQ_F_MULTISHOT;
+	}
 
 	accept->addr = u64_to_user_ptr(READ_ONCE(sqe->addr));
 	accept->addr_len = u64_to_user_ptr(READ_ONCE(sqe->addr2));
 	accept->flags = READ_ONCE(sqe->accept_flags);
 	accept->nofile = rlimit(RLIMIT_NOFILE);
+
+	accept->file_slot = READ_ONCE(sqe->file_index);
+	if (accept->file_slot && ((req->flags & REQ_F_MULTISHOT) ||
+				  (accept->flags & SOCK_CLOEXEC)))
+		return -EINVAL;
+	if (accept->flags & ~(SOCK_CLOEXEC | SOCK_NONBLOCK))
+		return -EINVAL;
+	if (SOCK_NONBLOCK != O_NONBLOCK && (accept->flags & SOCK_NONBLOCK))
+		accept->flags = (accept->flags & ~SOCK_NONBLOCK) | O_NONBLOCK;
 	return 0;
 }
 
@@ -4419,21 +4984,47 @@ static int io_accept(struct io_kiocb *req, bool force_nonblock,
 {
 	struct io_accept *accept = &req->accept;
 	unsigned int file_flags = force_nonblock ? O_NONBLOCK : 0;
-	int ret;
+	bool fixed = !!accept->file_slot;
+	struct file *file;
+	int ret, fd = -1;
 
-	if (req->file->f_flags & O_NONBLOCK)
+	/* a multishot accept waits for connections through poll */
+	if ((req->file->f_flags & O_NONBLOCK) &&
+	    !(req->flags & REQ_F_MULTISHOT))
 		req->flags |= REQ_F_NOWAIT;
 
-	ret = __sys_accept4_file(req->file, file_flags, accept->addr,
-					accept->addr_len, accept->flags,
-					accept->nofile);
-	if (ret == -EAGAIN && force_nonblock)
-		return -EAGAIN;
-	if (ret < 0) {
+retry:
+	if (!fixed) {
+		fd = __get_unused_fd_flags(accept->flags, accept->nofile);
+		if (unlikely(fd < 0))
+			return fd;
+	}
+	file = do_accept(req->file, file_flags, accept->addr, accept->addr_len,
+			 accept->flags);
+	if (IS_ERR(file)) {
+		if (!fixed)
+			put_unused_fd(fd);
+		ret = PTR_ERR(file);
+		if (ret == -EAGAIN && force_nonblock)
+			return -EAGAIN;
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
-		req_set_fail_links(req);
+	} else if (!fixed) {
+		fd_install(fd, file);
+		ret = fd;
+	} else {
+		ret = io_install_fixed_file(req, file, !force_nonblock,
+					    accept->file_slot - 1);
 	}
+	/*
+	 * Accept everything that is pending, then go back to poll. From
+	 * io-wq the accept may have blocked, so complete the request there.
+	 */
+	if (ret >= 0 && (req->flags & REQ_F_MULTISHOT) && force_nonblock &&
+	    io_post_more_cqe(req, ret, 0))
+		goto retry;
+	if (ret < 0)
+		req_set_fail_links(req);
 	__io_req_complete(req, ret, 0, cs);
 	return 0;
 }
@@ -4516,6 +5107,16 @@ static int io_send(struct io_kiocb *req, bool force_nonblock,
 	return -EOPNOTSUPP;
 }
 
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	return -EOPNOTSUPP;
+}
+
+static int io_sendzc(struct io_kiocb *req, bool force_nonblock)
+{
+	return -EOPNOTSUPP;
+}
+
 static int io_recvmsg_prep(struct io_kiocb *req,
 			   const struct io_uring_sqe *sqe)
 {
@@ -4878,7 +5479,8 @@ static bool io_arm_poll_handler(struct io_kiocb *req)
 
 	if (!req->file || !file_can_poll(req->file))
 		return false;
-	if (req->flags & REQ_F_POLLED)
+	/* multishot requests go back to poll each time they run dry */
+	if ((req->flags & REQ_F_POLLED) && !(req->flags & REQ_F_MULTISHOT))
 		return false;
 	if (!def->pollin && !def->pollout)
 		return false;
@@ -5509,6 +6111,12 @@ static int io_req_defer_prep(struct io_kiocb *req,
 	case IORING_OP_TEE:
 		ret = io_tee_prep(req, sqe);
 		break;
+	case IORING_OP_URING_CMD:
+		ret = io_uring_cmd_prep(req, sqe);
+		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_sendzc_prep(req, sqe);
+		break;
 	default:
 		printk_once(KERN_WARNING "io_uring: unhandled opcode %d\n",
 				req->opcode);
@@ -5581,6 +6189,9 @@ static void __io_clean_op(struct io_kiocb *req)
 	struct io_async_ctx *io = req->io;
 
 	if (req->flags & REQ_F_BUFFER_SELECTED) {
+		/* ring buffers live in the ring, nothing to free */
+		if (req->flags & REQ_F_BUFFER_RING)
+			goto done;
 		switch (req->opcode) {
 		case IORING_OP_READV:
 		case IORING_OP_READ_FIXED:
@@ -5592,7 +6203,8 @@ static void __io_clean_op(struct io_kiocb *req)
 			kfree(req->sr_msg.kbuf);
 			break;
 		}
-		req->flags &= ~REQ_F_BUFFER_SELECTED;
+done:
+		req->flags &= ~(REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING);
 	}
 
 	if (req->flags & REQ_F_NEED_CLEANUP) {
@@ -5616,6 +6228,9 @@ static void __io_clean_op(struct io_kiocb *req)
 			io_put_file(req, req->splice.file_in,
 				    (req->splice.flags & SPLICE_F_FD_IN_FIXED));
 			break;
+		case IORING_OP_SEND_ZC:
+			kfree(req->sendzc.notif);
+			break;
 		}
 		req->flags &= ~REQ_F_NEED_CLEANUP;
 	}
@@ -5863,6 +6478,22 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 		}
 		ret = io_tee(req, force_nonblock);
 		break;
+	case IORING_OP_URING_CMD:
+		if (sqe) {
+			ret = io_uring_cmd_prep(req, sqe);
+			if (ret)
+				break;
+		}
+		ret = io_uring_cmd(req, force_nonblock);
+		break;
+	case IORING_OP_SEND_ZC:
+		if (sqe) {
+			ret = io_sendzc_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_sendzc(req, force_nonblock);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -6292,7 +6923,10 @@ static void io_submit_state_end(struct io_submit_state *state)
 static void io_submit_state_start(struct io_submit_state *state,
 				  struct io_ring_ctx *ctx, unsigned int max_ios)
 {
-	blk_start_plug(&state->plug);
+	if (ctx->flags & IORING_SETUP_IOPOLL)
+		blk_start_plug_nr_ios(&state->plug, max_ios);
+	else
+		blk_start_plug(&state->plug);
 #ifdef CONFIG_BLOCK
 	state->plug.nowait = true;
 #endif
@@ -6498,119 +7132,171 @@ static inline void io_ring_clear_wakeup_flag(struct io_ring_ctx *ctx)
 	spin_unlock_irq(&ctx->completion_lock);
 }
 
-static int io_sq_thread(void *data)
+/*
+ * Submit and reap for one ring of the SQPOLL thread. @cap bounds the number
+ * of SQEs taken from the ring in one go, so that a busy ring can't starve
+ * the others sharing the thread. Returns true if the ring had work.
+ */
+static bool io_sq_thread_ring(struct io_ring_ctx *ctx, unsigned int cap)
 {
-	struct io_ring_ctx *ctx = data;
-	const struct cred *old_cred;
-	DEFINE_WAIT(wait);
-	unsigned long timeout;
+	unsigned int to_submit;
+	bool did_work = false;
 	int ret = 0;
 
-	complete(&ctx->sq_thread_comp);
-
-	old_cred = override_creds(ctx->creds);
+	if (!list_empty(&ctx->iopoll_list)) {
+		unsigned nr_events = 0;
 
-	timeout = jiffies + ctx->sq_thread_idle;
-	while (!kthread_should_park()) {
-		unsigned int to_submit;
+		mutex_lock(&ctx->uring_lock);
+		if (!list_empty(&ctx->iopoll_list) && !need_resched())
+			io_do_iopoll(ctx, &nr_events, 0);
+		mutex_unlock(&ctx->uring_lock);
+		did_work = true;
+	}
 
-		if (!list_empty(&ctx->iopoll_list)) {
-			unsigned nr_events = 0;
+	to_submit = io_sqring_entries(ctx);
+	if (cap && to_submit > cap)
+		to_submit = cap;
+	if (to_submit) {
+		mutex_lock(&ctx->uring_lock);
+		if (likely(!percpu_ref_is_dying(&ctx->refs)))
+			ret = io_submit_sqes(ctx, to_submit, NULL, -1);
+		mutex_unlock(&ctx->uring_lock);
+		if (ret > 0)
+			did_work = true;
+	}
 
-			mutex_lock(&ctx->uring_lock);
-			if (!list_empty(&ctx->iopoll_list) && !need_resched())
-				io_do_iopoll(ctx, &nr_events, 0);
-			else
-				timeout = jiffies + ctx->sq_thread_idle;
-			mutex_unlock(&ctx->uring_lock);
-		}
+	/*
+	 * If submit got -EBUSY, flag us as needing the application to enter
+	 * the kernel to reap and flush events before we retry this ring.
+	 */
+	ctx->sq_cq_busy = ret == -EBUSY;
+	return did_work;
+}
 
-		to_submit = io_sqring_entries(ctx);
+static bool io_sq_thread_needs_sleep(struct io_sq_data *sqd)
+{
+	struct io_ring_ctx *ctx;
 
+	list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
 		/*
-		 * If submit got -EBUSY, flag us as needing the application
-		 * to enter the kernel to reap and flush events.
+		 * While doing polled IO, before going to sleep, we need to
+		 * check if there are new reqs added to iopoll_list, it is
+		 * because reqs may have been punted to io worker and will be
+		 * added to iopoll_list later, hence check the iopoll_list
+		 * again.
 		 */
-		if (!to_submit || ret == -EBUSY || need_resched()) {
-			/*
-			 * Drop cur_mm before scheduling, we can't hold it for
-			 * long periods (or over schedule()). Do this before
-			 * adding ourselves to the waitqueue, as the unuse/drop
-			 * may sleep.
-			 */
-			io_sq_thread_drop_mm();
+		if ((ctx->flags & IORING_SETUP_IOPOLL) &&
+		    !list_empty_careful(&ctx->iopoll_list))
+			return false;
+		if (io_sqring_entries(ctx) && !ctx->sq_cq_busy)
+			return false;
+	}
+	return true;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_sq_data *sqd = data;
+	const struct cred *creds = NULL, *old_cred = NULL;
+	struct io_ring_ctx *ctx;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
 
+	timeout = jiffies + sqd->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		bool did_work = false;
+
+		if (kthread_should_park()) {
 			/*
-			 * We're polling. If we're within the defined idle
-			 * period, then let us spin without work before going
-			 * to sleep. The exception is if we got EBUSY doing
-			 * more IO, we should wait for the application to
-			 * reap events and wake us up.
+			 * The ring list is about to change, don't hang on to
+			 * the identity of a ring that may be going away.
 			 */
-			if (!list_empty(&ctx->iopoll_list) || need_resched() ||
-			    (!time_after(jiffies, timeout) && ret != -EBUSY &&
-			    !percpu_ref_is_dying(&ctx->refs))) {
-				io_run_task_work();
-				cond_resched();
-				continue;
+			io_sq_thread_drop_mm();
+			if (old_cred) {
+				revert_creds(old_cred);
+				old_cred = creds = NULL;
 			}
+			kthread_parkme();
+			timeout = jiffies + sqd->sq_thread_idle;
+			continue;
+		}
 
-			prepare_to_wait(&ctx->sqo_wait, &wait,
-						TASK_INTERRUPTIBLE);
+		/*
+		 * Visit every ring once per pass, taking at most a batch of
+		 * SQEs from each. Rings are only added and removed with the
+		 * thread parked, so the list is stable here.
+		 */
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
+			unsigned int cap = ctx->sq_thread_batch;
 
-			/*
-			 * While doing polled IO, before going to sleep, we need
-			 * to check if there are new reqs added to iopoll_list,
-			 * it is because reqs may have been punted to io worker
-			 * and will be added to iopoll_list later, hence check
-			 * the iopoll_list again.
-			 */
-			if ((ctx->flags & IORING_SETUP_IOPOLL) &&
-			    !list_empty_careful(&ctx->iopoll_list)) {
-				finish_wait(&ctx->sqo_wait, &wait);
-				continue;
+			if (!cap && sqd->nr_rings > 1)
+				cap = IORING_SQPOLL_CAP_ENTRIES_VALUE;
+
+			if (ctx->creds != creds) {
+				if (old_cred)
+					revert_creds(old_cred);
+				old_cred = override_creds(ctx->creds);
+				creds = ctx->creds;
 			}
+			if (current->mm && current->mm != ctx->sqo_mm)
+				io_sq_thread_drop_mm();
 
-			io_ring_set_wakeup_flag(ctx);
+			if (io_sq_thread_ring(ctx, cap))
+				did_work = true;
+		}
 
-			to_submit = io_sqring_entries(ctx);
-			if (!to_submit || ret == -EBUSY) {
-				if (kthread_should_park()) {
-					finish_wait(&ctx->sqo_wait, &wait);
-					break;
-				}
-				if (io_run_task_work()) {
-					finish_wait(&ctx->sqo_wait, &wait);
-					io_ring_clear_wakeup_flag(ctx);
-					continue;
-				}
-				if (signal_pending(current))
-					flush_signals(current);
-				schedule();
-				finish_wait(&ctx->sqo_wait, &wait);
+		if (did_work)
+			timeout = jiffies + sqd->sq_thread_idle;
 
-				io_ring_clear_wakeup_flag(ctx);
-				ret = 0;
-				continue;
+		/*
+		 * We're polling. If we're within the defined idle period, then
+		 * let us spin without work before going to sleep.
+		 */
+		if (did_work || need_resched() || !time_after(jiffies, timeout)) {
+			io_run_task_work();
+			if (need_resched()) {
+				/*
+				 * Drop cur_mm before scheduling, we can't hold
+				 * it for long periods (or over schedule()).
+				 */
+				io_sq_thread_drop_mm();
+				cond_resched();
 			}
-			finish_wait(&ctx->sqo_wait, &wait);
+			continue;
+		}
 
-			io_ring_clear_wakeup_flag(ctx);
+		/*
+		 * Do this before adding ourselves to the waitqueue, as the
+		 * unuse/drop may sleep.
+		 */
+		io_sq_thread_drop_mm();
+
+		prepare_to_wait(&sqd->wait, &wait, TASK_INTERRUPTIBLE);
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+			io_ring_set_wakeup_flag(ctx);
+
+		if (io_sq_thread_needs_sleep(sqd) && !kthread_should_park() &&
+		    !kthread_should_stop() && !io_run_task_work()) {
+			if (signal_pending(current))
+				flush_signals(current);
+			sqd->nr_sleeps++;
+			schedule();
+			sqd->nr_wakeups++;
+			list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+				ctx->sq_cq_busy = false;
 		}
+		finish_wait(&sqd->wait, &wait);
 
-		mutex_lock(&ctx->uring_lock);
-		if (likely(!percpu_ref_is_dying(&ctx->refs)))
-			ret = io_submit_sqes(ctx, to_submit, NULL, -1);
-		mutex_unlock(&ctx->uring_lock);
-		timeout = jiffies + ctx->sq_thread_idle;
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+			io_ring_clear_wakeup_flag(ctx);
+		timeout = jiffies + sqd->sq_thread_idle;
 	}
 
 	io_run_task_work();
 
 	io_sq_thread_drop_mm();
-	revert_creds(old_cred);
-
-	kthread_parkme();
+	if (old_cred)
+		revert_creds(old_cred);
 
 	return 0;
 }
@@ -6783,21 +7469,54 @@ static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
 	return 0;
 }
 
-static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+static void io_sqd_update_thread_idle(struct io_sq_data *sqd)
+{
+	struct io_ring_ctx *ctx;
+	unsigned sq_thread_idle = 0;
+
+	list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+		sq_thread_idle = max(sq_thread_idle, ctx->sq_thread_idle);
+	sqd->sq_thread_idle = sq_thread_idle;
+}
+
+static void io_put_sq_data(struct io_sq_data *sqd)
 {
-	if (ctx->sqo_thread) {
-		wait_for_completion(&ctx->sq_thread_comp);
+	if (refcount_dec_and_test(&sqd->refs)) {
 		/*
 		 * The park is a bit of a work-around, without it we get
 		 * warning spews on shutdown with SQPOLL set and affinity
 		 * set to a single CPU.
 		 */
-		kthread_park(ctx->sqo_thread);
-		kthread_stop(ctx->sqo_thread);
-		ctx->sqo_thread = NULL;
+		if (sqd->thread) {
+			kthread_park(sqd->thread);
+			kthread_stop(sqd->thread);
+		}
+		kfree(sqd);
 	}
 }
 
+static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+{
+	struct io_sq_data *sqd = ctx->sq_data;
+
+	if (!sqd)
+		return;
+
+	mutex_lock(&sqd->lock);
+	if (!list_empty(&ctx->sqd_list)) {
+		kthread_park(sqd->thread);
+		list_del_init(&ctx->sqd_list);
+		sqd->nr_rings--;
+		io_sqd_update_thread_idle(sqd);
+		kthread_unpark(sqd->thread);
+	}
+	mutex_unlock(&sqd->lock);
+
+	ctx->sq_data = NULL;
+	ctx->sqo_wait = NULL;
+	io_put_sq_data(sqd);
+}
+
 static void io_finish_async(struct io_ring_ctx *ctx)
 {
 	io_sq_thread_stop(ctx);
@@ -7356,6 +8075,77 @@ static int __io_sqe_files_update(struct io_ring_ctx *ctx,
 	return done ? done : err;
 }
 
+/*
+ * Install a file opened or accepted by a request straight into fixed file
+ * slot @slot, replacing what's there, without ever giving it an fd. Takes
+ * over the reference to @file, also on failure.
+ */
+static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
+				 bool needs_lock, u32 slot)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct fixed_file_ref_node *ref_node;
+	struct fixed_file_table *table;
+	struct fixed_file_data *data;
+	bool needs_switch = false;
+	unsigned int i, index;
+	int ret;
+
+	io_ring_submit_lock(ctx, needs_lock);
+
+	ret = -ENXIO;
+	data = ctx->file_data;
+	if (!data)
+		goto err;
+	ret = -EINVAL;
+	if (slot >= ctx->nr_user_files)
+		goto err;
+
+	ref_node = alloc_fixed_file_ref_node(ctx);
+	if (IS_ERR(ref_node)) {
+		ret = PTR_ERR(ref_node);
+		goto err;
+	}
+
+	i = array_index_nospec(slot, ctx->nr_user_files);
+	table = &data->table[i >> IORING_FILE_TABLE_SHIFT];
+	index = i & IORING_FILE_TABLE_MASK;
+	if (table->files[index]) {
+		ret = io_queue_file_removal(data, table->files[index]);
+		if (ret) {
+			destroy_fixed_file_ref_node(ref_node);
+			goto err;
+		}
+		table->files[index] = NULL;
+		needs_switch = true;
+	}
+
+	table->files[index] = file;
+	ret = io_sqe_file_register(ctx, file, i);
+	if (ret) {
+		table->files[index] = NULL;
+		fput(file);
+	}
+
+	if (needs_switch) {
+		percpu_ref_kill(data->cur_refs);
+		spin_lock(&data->lock);
+		list_add(&ref_node->node, &data->ref_list);
+		data->cur_refs = &ref_node->refs;
+		spin_unlock(&data->lock);
+		percpu_ref_get(&ctx->file_data->refs);
+	} else {
+		destroy_fixed_file_ref_node(ref_node);
+	}
+
+	io_ring_submit_unlock(ctx, needs_lock);
+	return ret;
+err:
+	io_ring_submit_unlock(ctx, needs_lock);
+	fput(file);
+	return ret;
+}
+
 static int io_sqe_files_update(struct io_ring_ctx *ctx, void __user *arg,
 			       unsigned nr_args)
 {
@@ -7428,6 +8218,87 @@ out_fput:
 	return ret;
 }
 
+/*
+ * With IORING_SETUP_ATTACH_WQ, share the SQPOLL thread of the ring we attach
+ * to, if it has one. Returns NULL if a new thread is needed.
+ */
+static struct io_sq_data *io_get_sq_data(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx_attach;
+	struct io_sq_data *sqd;
+	struct fd f;
+
+	if (p->flags & IORING_SETUP_ATTACH_WQ) {
+		f = fdget(p->wq_fd);
+		if (!f.file)
+			return ERR_PTR(-EBADF);
+		if (f.file->f_op != &io_uring_fops) {
+			fdput(f);
+			return ERR_PTR(-EINVAL);
+		}
+
+		ctx_attach = f.file->private_data;
+		/* @sq_data is protected by holding the fd */
+		sqd = ctx_attach->sq_data;
+		if (sqd)
+			refcount_inc(&sqd->refs);
+		fdput(f);
+		if (sqd)
+			return sqd;
+	}
+
+	sqd = kzalloc(sizeof(*sqd), GFP_KERNEL);
+	if (!sqd)
+		return ERR_PTR(-ENOMEM);
+
+	refcount_set(&sqd->refs, 1);
+	mutex_init(&sqd->lock);
+	INIT_LIST_HEAD(&sqd->ctx_list);
+	init_waitqueue_head(&sqd->wait);
+	return sqd;
+}
+
+/* CPUs sharing the last level cache with @cpu, e.g. a CCX on AMD Zen */
+static const struct cpumask *io_sq_llc_mask(int cpu)
+{
+#ifdef CONFIG_SCHED_MC
+	return cpu_coregroup_mask(cpu);
+#else
+	return cpumask_of_node(cpu_to_node(cpu));
+#endif
+}
+
+static int io_sq_thread_create(struct io_sq_data *sqd,
+			       struct io_uring_params *p)
+{
+	struct task_struct *tsk;
+
+	if (p->flags & IORING_SETUP_SQ_AFF) {
+		int cpu = p->sq_thread_cpu;
+
+		if (cpu >= nr_cpu_ids)
+			return -EINVAL;
+		if (!cpu_online(cpu))
+			return -EINVAL;
+
+		if (p->flags & IORING_SETUP_SQ_LLC) {
+			tsk = kthread_create(io_sq_thread, sqd, "io_uring-sq");
+			if (!IS_ERR(tsk))
+				kthread_bind_mask(tsk, io_sq_llc_mask(cpu));
+		} else {
+			tsk = kthread_create_on_cpu(io_sq_thread, sqd, cpu,
+						    "io_uring-sq");
+		}
+	} else {
+		tsk = kthread_create(io_sq_thread, sqd, "io_uring-sq");
+	}
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+
+	sqd->thread = tsk;
+	return 0;
+}
+
 static int io_sq_offload_start(struct io_ring_ctx *ctx,
 			       struct io_uring_params *p)
 {
@@ -7437,37 +8308,51 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 	ctx->sqo_mm = current->mm;
 
 	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		struct io_sq_data *sqd;
+
 		ret = -EPERM;
 		if (!capable(CAP_SYS_ADMIN))
 			goto err;
 
+		ret = -EINVAL;
+		if ((p->flags & IORING_SETUP_SQ_LLC) &&
+		    !(p->flags & IORING_SETUP_SQ_AFF))
+			goto err;
+
+		sqd = io_get_sq_data(p);
+		if (IS_ERR(sqd)) {
+			ret = PTR_ERR(sqd);
+			goto err;
+		}
+		ctx->sq_data = sqd;
+		ctx->sqo_wait = &sqd->wait;
+
 		ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
 		if (!ctx->sq_thread_idle)
 			ctx->sq_thread_idle = HZ;
-
-		if (p->flags & IORING_SETUP_SQ_AFF) {
-			int cpu = p->sq_thread_cpu;
-
-			ret = -EINVAL;
-			if (cpu >= nr_cpu_ids)
-				goto err;
-			if (!cpu_online(cpu))
-				goto err;
-
-			ctx->sqo_thread = kthread_create_on_cpu(io_sq_thread,
-							ctx, cpu,
-							"io_uring-sq");
+		ctx->sq_thread_batch = p->sq_thread_batch;
+
+		mutex_lock(&sqd->lock);
+		if (sqd->thread) {
+			/* an existing thread only takes on the new ring */
+			kthread_park(sqd->thread);
+			list_add_tail(&ctx->sqd_list, &sqd->ctx_list);
+			sqd->nr_rings++;
+			io_sqd_update_thread_idle(sqd);
+			kthread_unpark(sqd->thread);
 		} else {
-			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
-							"io_uring-sq");
+			ret = io_sq_thread_create(sqd, p);
+			if (!ret) {
+				list_add_tail(&ctx->sqd_list, &sqd->ctx_list);
+				sqd->nr_rings = 1;
+				sqd->sq_thread_idle = ctx->sq_thread_idle;
+				wake_up_process(sqd->thread);
+			}
 		}
-		if (IS_ERR(ctx->sqo_thread)) {
-			ret = PTR_ERR(ctx->sqo_thread);
-			ctx->sqo_thread = NULL;
+		mutex_unlock(&sqd->lock);
+		if (ret)
 			goto err;
-		}
-		wake_up_process(ctx->sqo_thread);
-	} else if (p->flags & IORING_SETUP_SQ_AFF) {
+	} else if (p->flags & (IORING_SETUP_SQ_AFF | IORING_SETUP_SQ_LLC)) {
 		/* Can't have SQ_AFF without SQPOLL */
 		ret = -EINVAL;
 		goto err;
@@ -7835,16 +8720,122 @@ static int __io_destroy_buffers(int id, void *p, void *data)
 	return 0;
 }
 
+static void io_free_buffer_ring(struct io_ring_ctx *ctx,
+				struct io_buffer_ring *bl)
+{
+	vunmap(bl->br);
+	unpin_user_pages(bl->pages, bl->nr_pages);
+	io_unaccount_mem(ctx, bl->nr_pages, ACCT_PINNED);
+	kvfree(bl->pages);
+	kvfree(bl);
+}
+
 static void io_destroy_buffers(struct io_ring_ctx *ctx)
 {
+	struct io_buffer_ring *bl;
+	unsigned long index;
+
 	idr_for_each(&ctx->io_buffer_idr, __io_destroy_buffers, ctx);
 	idr_destroy(&ctx->io_buffer_idr);
+
+	xa_for_each(&ctx->io_buf_rings, index, bl) {
+		xa_erase(&ctx->io_buf_rings, index);
+		io_free_buffer_ring(ctx, bl);
+	}
+	xa_destroy(&ctx->io_buf_rings);
+}
+
+static int io_register_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *bl;
+	unsigned long size;
+	int nr_pages, ret;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || memchr_inv(reg.resv, 0, sizeof(reg.resv)))
+		return -EINVAL;
+	if (!reg.ring_addr || (reg.ring_addr & ~PAGE_MASK))
+		return -EINVAL;
+	/* the tail is 16 bits, a full ring must not look empty */
+	if (!is_power_of_2(reg.ring_entries) || reg.ring_entries >= 65536)
+		return -EINVAL;
+	if (idr_find(&ctx->io_buffer_idr, reg.bgid) ||
+	    xa_load(&ctx->io_buf_rings, reg.bgid))
+		return -EEXIST;
+
+	bl = kvzalloc(struct_size(bl, bufs, reg.ring_entries), GFP_KERNEL);
+	if (!bl)
+		return -ENOMEM;
+
+	size = reg.ring_entries * sizeof(struct io_uring_buf);
+	nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+	ret = -ENOMEM;
+	bl->pages = kvmalloc_array(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!bl->pages)
+		goto err_free;
+
+	ret = io_account_mem(ctx, nr_pages, ACCT_PINNED);
+	if (ret)
+		goto err_free;
+
+	ret = pin_user_pages_fast(reg.ring_addr, nr_pages, FOLL_LONGTERM,
+				  bl->pages);
+	if (ret != nr_pages) {
+		if (ret > 0)
+			unpin_user_pages(bl->pages, ret);
+		ret = ret < 0 ? ret : -EFAULT;
+		goto err_unaccount;
+	}
+
+	ret = -ENOMEM;
+	bl->br = vmap(bl->pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!bl->br)
+		goto err_unpin;
+
+	bl->nr_pages = nr_pages;
+	bl->mask = reg.ring_entries - 1;
+	ret = xa_err(xa_store(&ctx->io_buf_rings, reg.bgid, bl, GFP_KERNEL));
+	if (ret) {
+		io_free_buffer_ring(ctx, bl);
+		return ret;
+	}
+	return 0;
+
+err_unpin:
+	unpin_user_pages(bl->pages, nr_pages);
+err_unaccount:
+	io_unaccount_mem(ctx, nr_pages, ACCT_PINNED);
+err_free:
+	kvfree(bl->pages);
+	kvfree(bl);
+	return ret;
+}
+
+static int io_unregister_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *bl;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || memchr_inv(reg.resv, 0, sizeof(reg.resv)))
+		return -EINVAL;
+
+	bl = xa_erase(&ctx->io_buf_rings, reg.bgid);
+	if (!bl)
+		return -ENOENT;
+
+	io_free_buffer_ring(ctx, bl);
+	return 0;
 }
 
 static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 {
 	io_finish_async(ctx);
 	io_sqe_buffer_unregister(ctx);
+	io_destroy_buffers(ctx);
 	if (ctx->sqo_mm) {
 		mmdrop(ctx->sqo_mm);
 		ctx->sqo_mm = NULL;
@@ -7852,7 +8843,6 @@ static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 
 	io_sqe_files_unregister(ctx);
 	io_eventfd_unregister(ctx);
-	io_destroy_buffers(ctx);
 	idr_destroy(&ctx->personality_idr);
 
 #if defined(CONFIG_UNIX)
@@ -8213,14 +9203,28 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	struct io_ring_ctx *ctx;
 	long ret = -EBADF;
 	int submitted = 0;
+	int ring_fd = fd;
 	struct fd f;
 
 	io_run_task_work();
 
-	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
+		      IORING_ENTER_REGISTERED_RING))
 		return -EINVAL;
 
-	f = fdget(fd);
+	if (flags & IORING_ENTER_REGISTERED_RING) {
+		struct io_uring_task *tctx = current->io_uring;
+
+		if (!tctx || fd >= IO_RINGFD_REG_MAX)
+			return -EINVAL;
+		fd = array_index_nospec(fd, IO_RINGFD_REG_MAX);
+		/* the task holds a reference, nothing to put */
+		f.file = tctx->registered_rings[fd];
+		f.flags = 0;
+		ring_fd = tctx->registered_fds[fd];
+	} else {
+		f = fdget(fd);
+	}
 	if (!f.file)
 		return -EBADF;
 
@@ -8243,11 +9247,11 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 		if (!list_empty_careful(&ctx->cq_overflow_list))
 			io_cqring_overflow_flush(ctx, false);
 		if (flags & IORING_ENTER_SQ_WAKEUP)
-			wake_up(&ctx->sqo_wait);
+			wake_up(ctx->sqo_wait);
 		submitted = to_submit;
 	} else if (to_submit) {
 		mutex_lock(&ctx->uring_lock);
-		submitted = io_submit_sqes(ctx, to_submit, f.file, fd);
+		submitted = io_submit_sqes(ctx, to_submit, f.file, ring_fd);
 		mutex_unlock(&ctx->uring_lock);
 
 		if (submitted != to_submit)
@@ -8313,9 +9317,20 @@ static int io_uring_show_cred(int id, void *p, void *data)
 
 static void __io_uring_show_fdinfo(struct io_ring_ctx *ctx, struct seq_file *m)
 {
+	struct io_sq_data *sqd = ctx->sq_data;
 	int i;
 
 	mutex_lock(&ctx->uring_lock);
+	if (sqd) {
+		seq_printf(m, "SqThreadPid:\t%d\n", task_pid_nr(sqd->thread));
+		seq_printf(m, "SqThreadCpu:\t%d\n", task_cpu(sqd->thread));
+		seq_printf(m, "SqRings:\t%u\n", READ_ONCE(sqd->nr_rings));
+		seq_printf(m, "SqBatch:\t%u\n", ctx->sq_thread_batch);
+		seq_printf(m, "SqSleeps:\t%lu\n", READ_ONCE(sqd->nr_sleeps));
+		seq_printf(m, "SqWakeups:\t%lu\n", READ_ONCE(sqd->nr_wakeups));
+	}
+	if (ctx->io_wq)
+		io_wq_show_fdinfo(ctx->io_wq, m);
 	seq_printf(m, "UserFiles:\t%u\n", ctx->nr_user_files);
 	for (i = 0; i < ctx->nr_user_files; i++) {
 		struct fixed_file_table *table;
@@ -8339,6 +9354,13 @@ static void __io_uring_show_fdinfo(struct io_ring_ctx *ctx, struct seq_file *m)
 		seq_printf(m, "Personalities:\n");
 		idr_for_each(&ctx->personality_idr, io_uring_show_cred, m);
 	}
+	seq_printf(m, "Punted:\n");
+	for (i = 0; i < IORING_OP_LAST; i++) {
+		long nr = atomic_long_read(&ctx->nr_punted[i]);
+
+		if (nr)
+			seq_printf(m, "  op=%d, count=%ld\n", i, nr);
+	}
 	seq_printf(m, "PollList:\n");
 	spin_lock_irq(&ctx->completion_lock);
 	for (i = 0; i < (1U << ctx->cancel_hash_bits); i++) {
@@ -8572,7 +9594,7 @@ static int io_uring_create(unsigned entries, struct io_uring_params *p,
 	p->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
 			IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS |
 			IORING_FEAT_CUR_PERSONALITY | IORING_FEAT_FAST_POLL |
-			IORING_FEAT_POLL_32BITS;
+			IORING_FEAT_POLL_32BITS | IORING_FEAT_SQPOLL_SHARED;
 
 	if (copy_to_user(params, p, sizeof(*p))) {
 		ret = -EFAULT;
@@ -8613,7 +9635,8 @@ static long io_uring_setup(u32 entries, struct io_uring_params __user *params)
 
 	if (p.flags & ~(IORING_SETUP_IOPOLL | IORING_SETUP_SQPOLL |
 			IORING_SETUP_SQ_AFF | IORING_SETUP_CQSIZE |
-			IORING_SETUP_CLAMP | IORING_SETUP_ATTACH_WQ))
+			IORING_SETUP_CLAMP | IORING_SETUP_ATTACH_WQ |
+			IORING_SETUP_SQ_LLC))
 		return -EINVAL;
 
 	return  io_uring_create(entries, &p, params);
@@ -8689,6 +9712,156 @@ static int io_unregister_personality(struct io_ring_ctx *ctx, unsigned id)
 	return -EINVAL;
 }
 
+/*
+ * Register ring fds with the calling task, so that io_uring_enter() can
+ * use an index into them with IORING_ENTER_REGISTERED_RING instead of
+ * doing fdget()/fdput() on the ring every time.
+ */
+static int io_register_ringfds(void __user *arg, unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg_upd = arg;
+	struct io_uring_task *tctx = current->io_uring;
+	struct io_uring_rsrc_update reg;
+	struct file *file;
+	unsigned int i;
+	int ret = 0;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+
+	if (!tctx) {
+		tctx = kzalloc(sizeof(*tctx), GFP_KERNEL);
+		if (!tctx)
+			return -ENOMEM;
+		current->io_uring = tctx;
+	}
+
+	for (i = 0; i < nr_args; i++) {
+		int start, end, offset;
+
+		if (copy_from_user(&reg, &arg_upd[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data > INT_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (reg.offset == -1U) {
+			start = 0;
+			end = IO_RINGFD_REG_MAX;
+		} else {
+			if (reg.offset >= IO_RINGFD_REG_MAX) {
+				ret = -EINVAL;
+				break;
+			}
+			start = array_index_nospec(reg.offset,
+						   IO_RINGFD_REG_MAX);
+			end = start + 1;
+		}
+
+		ret = -EBUSY;
+		for (offset = start; offset < end; offset++) {
+			if (!tctx->registered_rings[offset])
+				break;
+		}
+		if (offset == end)
+			break;
+
+		file = fget(reg.data);
+		if (!file) {
+			ret = -EBADF;
+			break;
+		}
+		if (file->f_op != &io_uring_fops) {
+			fput(file);
+			ret = -EOPNOTSUPP;
+			break;
+		}
+		tctx->registered_rings[offset] = file;
+		tctx->registered_fds[offset] = reg.data;
+
+		reg.offset = offset;
+		if (copy_to_user(&arg_upd[i], &reg, sizeof(reg))) {
+			fput(file);
+			tctx->registered_rings[offset] = NULL;
+			ret = -EFAULT;
+			break;
+		}
+		ret = 0;
+	}
+
+	return i ? i : ret;
+}
+
+static int io_unregister_ringfds(void __user *arg, unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg_upd = arg;
+	struct io_uring_task *tctx = current->io_uring;
+	struct io_uring_rsrc_update reg;
+	unsigned int i;
+	int ret = 0;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+	if (!tctx)
+		return 0;
+
+	for (i = 0; i < nr_args; i++) {
+		unsigned int offset;
+
+		if (copy_from_user(&reg, &arg_upd[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.offset >= IO_RINGFD_REG_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		offset = array_index_nospec(reg.offset, IO_RINGFD_REG_MAX);
+		if (tctx->registered_rings[offset]) {
+			fput(tctx->registered_rings[offset]);
+			tctx->registered_rings[offset] = NULL;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+void __io_uring_unreg_ringfds(void)
+{
+	struct io_uring_task *tctx = current->io_uring;
+	int i;
+
+	for (i = 0; i < IO_RINGFD_REG_MAX; i++) {
+		if (tctx->registered_rings[i])
+			fput(tctx->registered_rings[i]);
+	}
+	current->io_uring = NULL;
+	kfree(tctx);
+}
+
+static int io_register_iowq_max_workers(struct io_ring_ctx *ctx,
+					void __user *arg)
+{
+	int new_count[2];
+	int ret;
+
+	if (copy_from_user(new_count, arg, sizeof(new_count)))
+		return -EFAULT;
+	if (!ctx->io_wq)
+		return -EINVAL;
+	ret = io_wq_max_workers(ctx->io_wq, new_count);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(arg, new_count, sizeof(new_count)))
+		return -EFAULT;
+	return 0;
+}
+
 static bool io_register_op_must_quiesce(int op)
 {
 	switch (op) {
@@ -8697,6 +9870,9 @@ static bool io_register_op_must_quiesce(int op)
 	case IORING_REGISTER_PROBE:
 	case IORING_REGISTER_PERSONALITY:
 	case IORING_UNREGISTER_PERSONALITY:
+	case IORING_REGISTER_RING_FDS:
+	case IORING_UNREGISTER_RING_FDS:
+	case IORING_REGISTER_IOWQ_MAX_WORKERS:
 		return false;
 	default:
 		return true;
@@ -8798,6 +9974,30 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_unregister_personality(ctx, nr_args);
 		break;
+	case IORING_REGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_pbuf_ring(ctx, arg);
+		break;
+	case IORING_UNREGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_unregister_pbuf_ring(ctx, arg);
+		break;
+	case IORING_REGISTER_RING_FDS:
+		ret = io_register_ringfds(arg, nr_args);
+		break;
+	case IORING_UNREGISTER_RING_FDS:
+		ret = io_unregister_ringfds(arg, nr_args);
+		break;
+	case IORING_REGISTER_IOWQ_MAX_WORKERS:
+		ret = -EINVAL;
+		if (!arg || nr_args != 2)
+			break;
+		ret = io_register_iowq_max_workers(ctx, arg);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -8855,6 +10055,7 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(4,  __s32,  fd);
 	BUILD_BUG_SQE_ELEM(8,  __u64,  off);
 	BUILD_BUG_SQE_ELEM(8,  __u64,  addr2);
+	BUILD_BUG_SQE_ELEM(8,  __u32,  cmd_op);
 	BUILD_BUG_SQE_ELEM(16, __u64,  addr);
 	BUILD_BUG_SQE_ELEM(16, __u64,  splice_off_in);
 	BUILD_BUG_SQE_ELEM(24, __u32,  len);
@@ -8877,8 +10078,10 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(40, __u16,  buf_index);
 	BUILD_BUG_SQE_ELEM(42, __u16,  personality);
 	BUILD_BUG_SQE_ELEM(44, __s32,  splice_fd_in);
+	BUILD_BUG_SQE_ELEM(44, __u32,  file_index);
 
 	BUILD_BUG_ON(ARRAY_SIZE(io_op_defs) != IORING_OP_LAST);
+	BUILD_BUG_ON(sizeof(struct io_uring_cmd) > sizeof(struct io_rw));
 	BUILD_BUG_ON(__REQ_F_LAST_BIT >= 8 * sizeof(int));
 	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
 	return 0;
@@ -21,7 +21,7 @@ page_seek_hole_data(struct inode *inode, struct page *page, loff_t *lastoff,
 	const struct address_space_operations *ops = inode->i_mapping->a_ops;
 	unsigned int bsize = i_blocksize(inode), off;
 	bool seek_data = whence == SEEK_DATA;
-	loff_t poff = page_offset(page);
+	loff_t poff = (loff_t)page_to_index(page) << PAGE_SHIFT;
 
 	if (WARN_ON_ONCE(*lastoff >= poff + PAGE_SIZE))
 		return false;
@@ -43,7 +43,7 @@ page_seek_hole_data(struct inode *inode, struct page *page, loff_t *lastoff,
 		return PageUptodate(page) == seek_data;
 
 	lock_page(page);
-	if (unlikely(page->mapping != inode->i_mapping))
+	if (unlikely(compound_head(page)->mapping != inode->i_mapping))
 		goto out_unlock_not_found;
 
 	for (off = 0; off < PAGE_SIZE; off += bsize) {
@@ -498,6 +498,50 @@ void path_put(const struct path *path)
 }
 EXPORT_SYMBOL(path_put);
 
+/*
+ * Path walk statistics, reported in /proc/sys/fs/lookup-state as
+ *
+ *	walks restarts revals slow-lookups
+ *
+ * walks are the lookups started in RCU mode, restarts those of them
+ * that had to be redone in ref-walk mode, revals those then redone
+ * with LOOKUP_REVAL, and slow-lookups the components that were not
+ * in the dcache and had to be looked up by the filesystem.  Walks
+ * minus restarts is the number of lookups served from RCU mode.
+ */
+enum {
+	LOOKUP_STAT_WALKS,
+	LOOKUP_STAT_RESTARTS,
+	LOOKUP_STAT_REVALS,
+	LOOKUP_STAT_SLOW,
+	NR_LOOKUP_STATS
+};
+
+static DEFINE_PER_CPU(unsigned long [NR_LOOKUP_STATS], lookup_stats);
+
+static inline void lookup_stat_inc(int item)
+{
+	this_cpu_inc(lookup_stats[item]);
+}
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+int proc_nr_lookups(struct ctl_table *table, int write, void *buffer,
+		    size_t *lenp, loff_t *ppos)
+{
+	unsigned long stats[NR_LOOKUP_STATS] = { };
+	struct ctl_table t = *table;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < NR_LOOKUP_STATS; i++)
+			stats[i] += per_cpu(lookup_stats, cpu)[i];
+
+	t.data = stats;
+	t.maxlen = sizeof(stats);
+	return proc_doulongvec_minmax(&t, write, buffer, lenp, ppos);
+}
+#endif
+
 #define EMBEDDED_LEVELS 2
 struct nameidata {
 	struct path	path;
@@ -1857,6 +1901,7 @@ static const char *walk_component(struct nameidata *nd, int flags)
 	if (IS_ERR(dentry))
 		return ERR_CAST(dentry);
 	if (unlikely(!dentry)) {
+		lookup_stat_inc(LOOKUP_STAT_SLOW);
 		dentry = lookup_slow(&nd->last, nd->path.dentry, nd->flags);
 		if (IS_ERR(dentry))
 			return ERR_CAST(dentry);
@@ -2363,11 +2408,16 @@ int filename_lookup(int dfd, struct filename *name, unsigned flags,
 		flags |= LOOKUP_ROOT;
 	}
 	set_nameidata(&nd, dfd, name);
+	lookup_stat_inc(LOOKUP_STAT_WALKS);
 	retval = path_lookupat(&nd, flags | LOOKUP_RCU, path);
-	if (unlikely(retval == -ECHILD))
+	if (unlikely(retval == -ECHILD)) {
+		lookup_stat_inc(LOOKUP_STAT_RESTARTS);
 		retval = path_lookupat(&nd, flags, path);
-	if (unlikely(retval == -ESTALE))
+	}
+	if (unlikely(retval == -ESTALE)) {
+		lookup_stat_inc(LOOKUP_STAT_REVALS);
 		retval = path_lookupat(&nd, flags | LOOKUP_REVAL, path);
+	}
 
 	if (likely(!retval))
 		audit_inode(name, path->dentry,
@@ -2404,11 +2454,16 @@ static struct filename *filename_parentat(int dfd, struct filename *name,
 	if (IS_ERR(name))
 		return name;
 	set_nameidata(&nd, dfd, name);
+	lookup_stat_inc(LOOKUP_STAT_WALKS);
 	retval = path_parentat(&nd, flags | LOOKUP_RCU, parent);
-	if (unlikely(retval == -ECHILD))
+	if (unlikely(retval == -ECHILD)) {
+		lookup_stat_inc(LOOKUP_STAT_RESTARTS);
 		retval = path_parentat(&nd, flags, parent);
-	if (unlikely(retval == -ESTALE))
+	}
+	if (unlikely(retval == -ESTALE)) {
+		lookup_stat_inc(LOOKUP_STAT_REVALS);
 		retval = path_parentat(&nd, flags | LOOKUP_REVAL, parent);
+	}
 	if (likely(!retval)) {
 		*last = nd.last;
 		*type = nd.last_type;
@@ -3392,11 +3447,16 @@ struct file *do_filp_open(int dfd, struct filename *pathname,
 	struct file *filp;
 
 	set_nameidata(&nd, dfd, pathname);
+	lookup_stat_inc(LOOKUP_STAT_WALKS);
 	filp = path_openat(&nd, op, flags | LOOKUP_RCU);
-	if (unlikely(filp == ERR_PTR(-ECHILD)))
+	if (unlikely(filp == ERR_PTR(-ECHILD))) {
+		lookup_stat_inc(LOOKUP_STAT_RESTARTS);
 		filp = path_openat(&nd, op, flags);
-	if (unlikely(filp == ERR_PTR(-ESTALE)))
+	}
+	if (unlikely(filp == ERR_PTR(-ESTALE))) {
+		lookup_stat_inc(LOOKUP_STAT_REVALS);
 		filp = path_openat(&nd, op, flags | LOOKUP_REVAL);
+	}
 	restore_nameidata();
 	return filp;
 }
@@ -3420,11 +3480,16 @@ struct file *do_file_open_root(struct dentry *dentry, struct vfsmount *mnt,
 		return ERR_CAST(filename);
 
 	set_nameidata(&nd, -1, filename);
+	lookup_stat_inc(LOOKUP_STAT_WALKS);
 	file = path_openat(&nd, op, flags | LOOKUP_RCU);
-	if (unlikely(file == ERR_PTR(-ECHILD)))
+	if (unlikely(file == ERR_PTR(-ECHILD))) {
+		lookup_stat_inc(LOOKUP_STAT_RESTARTS);
 		file = path_openat(&nd, op, flags);
-	if (unlikely(file == ERR_PTR(-ESTALE)))
+	}
+	if (unlikely(file == ERR_PTR(-ESTALE))) {
+		lookup_stat_inc(LOOKUP_STAT_REVALS);
 		file = path_openat(&nd, op, flags | LOOKUP_REVAL);
+	}
 	restore_nameidata();
 	putname(filename);
 	return file;
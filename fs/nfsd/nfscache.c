@@ -121,14 +121,16 @@ nfsd_reply_cache_free_locked(struct nfsd_drc_bucket *b, struct svc_cacherep *rp,
 				struct nfsd_net *nn)
 {
 	if (rp->c_type == RC_REPLBUFF && rp->c_replvec.iov_base) {
-		nn->drc_mem_usage -= rp->c_replvec.iov_len;
+		percpu_counter_sub(&nn->counter[NFSD_NET_DRC_MEM_USAGE],
+				   rp->c_replvec.iov_len);
 		kfree(rp->c_replvec.iov_base);
 	}
 	if (rp->c_state != RC_UNUSED) {
 		rb_erase(&rp->c_node, &b->rb_head);
 		list_del(&rp->c_lru);
 		atomic_dec(&nn->num_drc_entries);
-		nn->drc_mem_usage -= sizeof(*rp);
+		percpu_counter_sub(&nn->counter[NFSD_NET_DRC_MEM_USAGE],
+				   sizeof(*rp));
 	}
 	kmem_cache_free(drc_slab, rp);
 }
@@ -154,12 +156,39 @@ void nfsd_drc_slab_free(void)
 	kmem_cache_destroy(drc_slab);
 }
 
+static int nfsd_net_counters_init(struct nfsd_net *nn)
+{
+	int i, err;
+
+	for (i = 0; i < NFSD_NET_COUNTERS_NUM; i++) {
+		err = percpu_counter_init(&nn->counter[i], 0, GFP_KERNEL);
+		if (err) {
+			while (--i >= 0)
+				percpu_counter_destroy(&nn->counter[i]);
+			return err;
+		}
+	}
+	return 0;
+}
+
+static void nfsd_net_counters_destroy(struct nfsd_net *nn)
+{
+	int i;
+
+	for (i = 0; i < NFSD_NET_COUNTERS_NUM; i++)
+		percpu_counter_destroy(&nn->counter[i]);
+}
+
 int nfsd_reply_cache_init(struct nfsd_net *nn)
 {
 	unsigned int hashsize;
 	unsigned int i;
 	int status = 0;
 
+	status = nfsd_net_counters_init(nn);
+	if (status)
+		goto out_nomem;
+
 	nn->max_drc_entries = nfsd_cache_size_limit();
 	atomic_set(&nn->num_drc_entries, 0);
 	hashsize = nfsd_hashsize(nn->max_drc_entries);
@@ -170,7 +199,7 @@ int nfsd_reply_cache_init(struct nfsd_net *nn)
 	nn->nfsd_reply_cache_shrinker.seeks = 1;
 	status = register_shrinker(&nn->nfsd_reply_cache_shrinker);
 	if (status)
-		goto out_nomem;
+		goto out_counters;
 
 	nn->drc_hashtbl = kcalloc(hashsize,
 				sizeof(*nn->drc_hashtbl), GFP_KERNEL);
@@ -190,6 +219,8 @@ int nfsd_reply_cache_init(struct nfsd_net *nn)
 	return 0;
 out_shrinker:
 	unregister_shrinker(&nn->nfsd_reply_cache_shrinker);
+out_counters:
+	nfsd_net_counters_destroy(nn);
 out_nomem:
 	printk(KERN_ERR "nfsd: failed to allocate reply cache\n");
 	return -ENOMEM;
@@ -211,6 +242,7 @@ void nfsd_reply_cache_shutdown(struct nfsd_net *nn)
 		}
 	}
 
+	nfsd_net_counters_destroy(nn);
 	kvfree(nn->drc_hashtbl);
 	nn->drc_hashtbl = NULL;
 	nn->drc_hashsize = 0;
@@ -328,7 +360,7 @@ nfsd_cache_key_cmp(const struct svc_cacherep *key,
 {
 	if (key->c_key.k_xid == rp->c_key.k_xid &&
 	    key->c_key.k_csum != rp->c_key.k_csum) {
-		++nn->payload_misses;
+		percpu_counter_inc(&nn->counter[NFSD_NET_PAYLOAD_MISSES]);
 		trace_nfsd_drc_mismatch(nn, key, rp);
 	}
 
@@ -368,15 +400,21 @@ nfsd_cache_insert(struct nfsd_drc_bucket *b, struct svc_cacherep *key,
 	rb_link_node(&key->c_node, parent, p);
 	rb_insert_color(&key->c_node, &b->rb_head);
 out:
-	/* tally hash chain length stats */
-	if (entries > nn->longest_chain) {
-		nn->longest_chain = entries;
-		nn->longest_chain_cachesize = atomic_read(&nn->num_drc_entries);
-	} else if (entries == nn->longest_chain) {
+	/*
+	 * Tally hash chain length stats. Once the cache is full most
+	 * chains are as long as the longest one, so only write to the
+	 * shared fields when they change.
+	 */
+	if (entries > READ_ONCE(nn->longest_chain)) {
+		WRITE_ONCE(nn->longest_chain, entries);
+		WRITE_ONCE(nn->longest_chain_cachesize,
+			   atomic_read(&nn->num_drc_entries));
+	} else if (entries == READ_ONCE(nn->longest_chain)) {
+		unsigned int num = atomic_read(&nn->num_drc_entries);
+
 		/* prefer to keep the smallest cachesize possible here */
-		nn->longest_chain_cachesize = min_t(unsigned int,
-				nn->longest_chain_cachesize,
-				atomic_read(&nn->num_drc_entries));
+		if (num < READ_ONCE(nn->longest_chain_cachesize))
+			WRITE_ONCE(nn->longest_chain_cachesize, num);
 	}
 
 	lru_put_end(b, ret);
@@ -411,7 +449,7 @@ int nfsd_cache_lookup(struct svc_rqst *rqstp)
 
 	rqstp->rq_cacherep = NULL;
 	if (type == RC_NOCACHE) {
-		nfsdstats.rcnocache++;
+		nfsd_stats_rc_nocache_inc();
 		goto out;
 	}
 
@@ -433,12 +471,12 @@ int nfsd_cache_lookup(struct svc_rqst *rqstp)
 		goto found_entry;
 	}
 
-	nfsdstats.rcmisses++;
+	nfsd_stats_rc_misses_inc();
 	rqstp->rq_cacherep = rp;
 	rp->c_state = RC_INPROG;
 
 	atomic_inc(&nn->num_drc_entries);
-	nn->drc_mem_usage += sizeof(*rp);
+	percpu_counter_add(&nn->counter[NFSD_NET_DRC_MEM_USAGE], sizeof(*rp));
 
 	/* go ahead and prune the cache */
 	prune_bucket(b, nn);
@@ -450,7 +488,7 @@ out:
 
 found_entry:
 	/* We found a matching entry which is either in progress or done. */
-	nfsdstats.rchits++;
+	nfsd_stats_rc_hits_inc();
 	rtn = RC_DROPIT;
 
 	/* Request being processed */
@@ -551,8 +589,8 @@ void nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 		nfsd_reply_cache_free(b, rp, nn);
 		return;
 	}
+	percpu_counter_add(&nn->counter[NFSD_NET_DRC_MEM_USAGE], bufsize);
 	spin_lock(&b->cache_lock);
-	nn->drc_mem_usage += bufsize;
 	lru_put_end(b, rp);
 	rp->c_secure = test_bit(RQ_SECURE, &rqstp->rq_flags);
 	rp->c_type = cachetype;
@@ -589,16 +627,22 @@ nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *data)
 static int nfsd_reply_cache_stats_show(struct seq_file *m, void *v)
 {
 	struct nfsd_net *nn = m->private;
+	struct percpu_counter *counter = nn->counter;
 
 	seq_printf(m, "max entries:           %u\n", nn->max_drc_entries);
 	seq_printf(m, "num entries:           %u\n",
 			atomic_read(&nn->num_drc_entries));
 	seq_printf(m, "hash buckets:          %u\n", 1 << nn->maskbits);
-	seq_printf(m, "mem usage:             %u\n", nn->drc_mem_usage);
-	seq_printf(m, "cache hits:            %u\n", nfsdstats.rchits);
-	seq_printf(m, "cache misses:          %u\n", nfsdstats.rcmisses);
-	seq_printf(m, "not cached:            %u\n", nfsdstats.rcnocache);
-	seq_printf(m, "payload misses:        %u\n", nn->payload_misses);
+	seq_printf(m, "mem usage:             %lld\n",
+		   percpu_counter_sum_positive(&counter[NFSD_NET_DRC_MEM_USAGE]));
+	seq_printf(m, "cache hits:            %u\n",
+		   nfsd_stats_read(NFSD_STATS_RC_HITS));
+	seq_printf(m, "cache misses:          %u\n",
+		   nfsd_stats_read(NFSD_STATS_RC_MISSES));
+	seq_printf(m, "not cached:            %u\n",
+		   nfsd_stats_read(NFSD_STATS_RC_NOCACHE));
+	seq_printf(m, "payload misses:        %lld\n",
+		   percpu_counter_sum_positive(&counter[NFSD_NET_PAYLOAD_MISSES]));
 	seq_printf(m, "longest chain len:     %u\n", nn->longest_chain);
 	seq_printf(m, "cachesize at longest:  %u\n", nn->longest_chain_cachesize);
 	return 0;
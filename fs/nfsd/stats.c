@@ -34,14 +34,19 @@ struct svc_stat		nfsd_svcstats = {
 	.program	= &nfsd_program,
 };
 
+unsigned int nfsd_stats_read(int item)
+{
+	return percpu_counter_sum_positive(&nfsdstats.counter[item]);
+}
+
 static int nfsd_proc_show(struct seq_file *seq, void *v)
 {
 	int i;
 
 	seq_printf(seq, "rc %u %u %u\nfh %u %u %u %u %u\nio %u %u\n",
-		      nfsdstats.rchits,
-		      nfsdstats.rcmisses,
-		      nfsdstats.rcnocache,
+		      nfsd_stats_read(NFSD_STATS_RC_HITS),
+		      nfsd_stats_read(NFSD_STATS_RC_MISSES),
+		      nfsd_stats_read(NFSD_STATS_RC_NOCACHE),
 		      nfsdstats.fh_stale,
 		      nfsdstats.fh_lookup,
 		      nfsdstats.fh_anon,
@@ -91,14 +96,32 @@ static const struct proc_ops nfsd_proc_ops = {
 	.proc_release	= single_release,
 };
 
-void
+int
 nfsd_stat_init(void)
 {
+	int i, err;
+
+	for (i = 0; i < NFSD_STATS_COUNTERS_NUM; i++) {
+		err = percpu_counter_init(&nfsdstats.counter[i], 0, GFP_KERNEL);
+		if (err)
+			goto out_destroy;
+	}
+
 	svc_proc_register(&init_net, &nfsd_svcstats, &nfsd_proc_ops);
+	return 0;
+
+out_destroy:
+	while (--i >= 0)
+		percpu_counter_destroy(&nfsdstats.counter[i]);
+	return err;
 }
 
 void
 nfsd_stat_shutdown(void)
 {
+	int i;
+
 	svc_proc_unregister(&init_net, "nfsd");
+	for (i = 0; i < NFSD_STATS_COUNTERS_NUM; i++)
+		percpu_counter_destroy(&nfsdstats.counter[i]);
 }
@@ -138,6 +138,7 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 	loff_t data_pos = -1;
 	loff_t hole_len;
 	bool skip_hole = false;
+	bool copy_offload;
 	int error = 0;
 
 	if (len == 0)
@@ -159,6 +160,18 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 		goto out;
 	/* Couldn't clone, so now we try to copy the data */
 
+	/*
+	 * If lower and upper share a filesystem that can copy on its own
+	 * (e.g. a server side copy), let it do that instead of moving the
+	 * data through the page cache.  Fall back to splice as soon as it
+	 * refuses.  Call the method directly, like do_clone_file_range(),
+	 * as we already hold write access to the upper fs.
+	 */
+	copy_offload = new_file->f_op->copy_file_range &&
+		       new_file->f_op->copy_file_range ==
+		       old_file->f_op->copy_file_range &&
+		       file_inode(old_file)->i_sb == file_inode(new_file)->i_sb;
+
 	/* Check if lower fs supports seek operation */
 	if (old_file->f_mode & FMODE_LSEEK &&
 	    old_file->f_op->llseek)
@@ -206,6 +219,18 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 			}
 		}
 
+		if (copy_offload) {
+			bytes = new_file->f_op->copy_file_range(old_file,
+					old_pos, new_file, new_pos, this_len, 0);
+			if (bytes > 0) {
+				old_pos += bytes;
+				new_pos += bytes;
+				len -= bytes;
+				continue;
+			}
+			copy_offload = false;
+		}
+
 		bytes = do_splice_direct(old_file, &old_pos,
 					 new_file, &new_pos,
 					 this_len, SPLICE_F_MOVE);
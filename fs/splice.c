@@ -50,6 +50,10 @@ static bool page_cache_pipe_buf_try_steal(struct pipe_inode_info *pipe,
 	struct page *page = buf->page;
 	struct address_space *mapping;
 
+	/* A buffer may cover a large page, which cannot be moved elsewhere */
+	if (PageCompound(page))
+		return false;
+
 	lock_page(page);
 
 	mapping = page_mapping(page);
@@ -871,6 +875,27 @@ static long do_splice_to(struct file *in, loff_t *ppos,
 	return default_file_splice_read(in, ppos, pipe, len, flags);
 }
 
+/*
+ * The internal pipe starts out with PIPE_DEF_BUFFERS slots, so a large
+ * sendfile() goes back and forth between ->splice_read() and the actor
+ * once for every 64k.  Grow it to cover the request, up to pipe_max_size.
+ * Only the ring itself gets bigger, the pages are released again before
+ * we return, so this is not charged against the user's pipe buffers.
+ * If the allocation fails we simply keep going with the smaller ring.
+ */
+static void splice_direct_grow_pipe(struct pipe_inode_info *pipe, size_t len)
+{
+	unsigned int nr_slots;
+
+	len = min_t(size_t, len, READ_ONCE(pipe_max_size));
+	nr_slots = round_pipe_size(len) >> PAGE_SHIFT;
+	if (nr_slots <= pipe->max_usage)
+		return;
+
+	if (!pipe_resize_ring(pipe, nr_slots))
+		pipe->max_usage = nr_slots;
+}
+
 /**
  * splice_direct_to_actor - splices data directly between two non-pipes
  * @in:		file to splice from
@@ -922,6 +947,8 @@ ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 		current->splice_pipe = pipe;
 	}
 
+	splice_direct_grow_pipe(pipe, sd->total_len);
+
 	/*
 	 * Do the splice.
 	 */
@@ -943,10 +970,17 @@ ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 		size_t read_len;
 		loff_t pos = sd->pos, prev_pos = pos;
 
-		/* Don't try to read more the pipe has space for. */
+		/*
+		 * Don't try to read more the pipe has space for.  Large pages
+		 * take a single slot however big they are, so if the file may
+		 * have them let ->splice_read() stop when the slots run out.
+		 */
 		p_space = pipe->max_usage -
 			pipe_occupancy(pipe->head, pipe->tail);
-		read_len = min_t(size_t, len, p_space << PAGE_SHIFT);
+		if (mapping_large_pages(in->f_mapping))
+			read_len = len;
+		else
+			read_len = min_t(size_t, len, p_space << PAGE_SHIFT);
 		ret = do_splice_to(in, &pos, pipe, read_len, flags);
 		if (unlikely(ret <= 0))
 			goto out_release;
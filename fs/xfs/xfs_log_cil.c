@@ -381,6 +381,10 @@ insert:
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * All of this is done on the per-cpu CIL structure of the committing CPU so
+ * that concurrent commits don't contend on the checkpoint context. The push
+ * aggregates the per-cpu state into the context, see xlog_cil_pcp_aggregate().
  */
 static void
 xlog_cil_insert_items(
@@ -389,11 +393,14 @@ xlog_cil_insert_items(
 {
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+	struct xlog_cil_pcp	*cilpcp;
 	struct xfs_log_item	*lip;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
 	int			iovhdr_res = 0, split_res = 0, ctx_res = 0;
+	int			space;
+	uint32_t		order;
 
 	ASSERT(tp);
 
@@ -403,16 +410,9 @@ xlog_cil_insert_items(
 	 */
 	xlog_cil_insert_format_items(log, tp, &len, &diff_iovecs);
 
-	spin_lock(&cil->xc_cil_lock);
-
 	/* account for space used by new iovec headers  */
 	iovhdr_res = diff_iovecs * sizeof(xlog_op_header_t);
 	len += iovhdr_res;
-	ctx->nvecs += diff_iovecs;
-
-	/* attach the transaction to the CIL if it has any busy extents */
-	if (!list_empty(&tp->t_busy))
-		list_splice_init(&tp->t_busy, &ctx->busy_extents);
 
 	/*
 	 * Now transfer enough transaction reservation to the context ticket
@@ -420,31 +420,83 @@ xlog_cil_insert_items(
 	 * reservation has to grow as well as the current reservation as we
 	 * steal from tickets so we can correctly determine the space used
 	 * during the transaction commit.
+	 *
+	 * The first commit into the context takes the unit reservation.
+	 * XLOG_CIL_EMPTY is only set again under the exclusive xc_ctx_lock, so
+	 * only one committer can clear it. Test it first so the fast path does
+	 * not dirty the cacheline with a locked operation.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) &&
+	    test_and_clear_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		ctx_res = ctx->ticket->t_unit_res;
 		ctx->ticket->t_curr_res = ctx_res;
 		tp->t_ticket->t_curr_res -= ctx_res;
 	}
 
-	/* do we need space for more log record headers? */
+	cilpcp = get_cpu_ptr(cil->xc_pcp);
+	cilpcp->nvecs += diff_iovecs;
+
+	/* attach the transaction to the CIL if it has any busy extents */
+	if (!list_empty(&tp->t_busy))
+		list_splice_init(&tp->t_busy, &cilpcp->busy_extents);
+
+	/*
+	 * Do we need space for more log record headers? Each CPU takes header
+	 * space for the iclog boundaries its own share of the checkpoint
+	 * crosses, and for its first commit into the context unless that one
+	 * also took the unit reservation. Summed up over all CPUs that covers
+	 * the headers needed for the whole checkpoint.
+	 */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
+	if (len > 0 && ((!cilpcp->space_used && !ctx_res) ||
+			cilpcp->space_used / iclog_space !=
+				(cilpcp->space_used + len) / iclog_space)) {
 		split_res = (len + iclog_space - 1) / iclog_space;
 		/* need to take into account split region headers, too */
 		split_res *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += split_res;
-		ctx->ticket->t_curr_res += split_res;
+		cilpcp->space_reserved += split_res;
 		tp->t_ticket->t_curr_res -= split_res;
 		ASSERT(tp->t_ticket->t_curr_res >= len);
 	}
 	tp->t_ticket->t_curr_res -= len;
-	ctx->space_used += len;
+	cilpcp->space_used += len;
+
+	/*
+	 * Fold the local space usage into the context once there is enough of
+	 * it to matter to the background push, and on every commit once the
+	 * context is over the push threshold so that the push throttle works
+	 * on exact numbers.
+	 */
+	space = cilpcp->space_used - cilpcp->space_folded;
+	if (space >= XLOG_CIL_PCP_SPACE(log) ||
+	    atomic_read(&ctx->space_used) >= XLOG_CIL_SPACE_LIMIT(log)) {
+		atomic_add(space, &ctx->space_used);
+		cilpcp->space_folded = cilpcp->space_used;
+		XFS_STATS_INC(log->l_mp, xs_cil_pcp_fold);
+	}
+
+	/*
+	 * Now add everything modified to the CIL. An item that is already in
+	 * the CIL may sit on the list of another CPU, and moving it would mean
+	 * serialising against that CPU. Leave it where it is and record the
+	 * commit order instead, the push sorts the items back into order.
+	 */
+	order = atomic_inc_return(&ctx->order_id);
+	list_for_each_entry(lip, &tp->t_items, li_trans) {
+
+		/* Skip items which aren't dirty in this transaction. */
+		if (!test_bit(XFS_LI_DIRTY, &lip->li_flags))
+			continue;
+
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &cilpcp->log_items);
+	}
+	put_cpu_ptr(cil->xc_pcp);
 
 	/*
 	 * If we've overrun the reservation, dump the tx details before we move
-	 * the log items. Shutdown is imminent...
+	 * on. Shutdown is imminent...
 	 */
 	if (WARN_ON(tp->t_ticket->t_curr_res < 0)) {
 		xfs_warn(log->l_mp, "Transaction log reservation overrun:");
@@ -455,32 +507,64 @@ xlog_cil_insert_items(
 			 split_res);
 		xfs_warn(log->l_mp, "  ctx ticket: %d bytes", ctx_res);
 		xlog_print_trans(tp);
+		xfs_force_shutdown(log->l_mp, SHUTDOWN_LOG_IO_ERROR);
 	}
+}
 
-	/*
-	 * Now (re-)position everything modified at the tail of the CIL.
-	 * We do this here so we only need to take the CIL lock once during
-	 * the transaction commit.
-	 */
-	list_for_each_entry(lip, &tp->t_items, li_trans) {
+/*
+ * Sort the log items aggregated from the per-cpu CILs back into the order
+ * they were last committed in.
+ */
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*l1,
+	struct list_head	*l2)
+{
+	struct xfs_log_item	*lip1 =
+		container_of(l1, struct xfs_log_item, li_cil);
+	struct xfs_log_item	*lip2 =
+		container_of(l2, struct xfs_log_item, li_cil);
 
-		/* Skip items which aren't dirty in this transaction. */
-		if (!test_bit(XFS_LI_DIRTY, &lip->li_flags))
+	return lip1->li_order_id > lip2->li_order_id;
+}
+
+/*
+ * Pull the per-cpu CIL state into the context that is about to be pushed and
+ * reset it for the next context. The caller holds the xc_ctx_lock exclusively
+ * so there are no commits running that could modify the per-cpu structures.
+ */
+static void
+xlog_cil_pcp_aggregate(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx)
+{
+	struct xlog_cil_pcp	*cilpcp;
+	int			cpu, count = 0;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+		if (!cilpcp->space_used && list_empty(&cilpcp->log_items) &&
+		    list_empty(&cilpcp->busy_extents))
 			continue;
 
-		/*
-		 * Only move the item if it isn't already at the tail. This is
-		 * to prevent a transient list_empty() state when reinserting
-		 * an item that is already the only item in the CIL.
-		 */
-		if (!list_is_last(&lip->li_cil, &cil->xc_cil))
-			list_move_tail(&lip->li_cil, &cil->xc_cil);
+		ctx->nvecs += cilpcp->nvecs;
+		atomic_add(cilpcp->space_used - cilpcp->space_folded,
+			   &ctx->space_used);
+		ctx->ticket->t_unit_res += cilpcp->space_reserved;
+		ctx->ticket->t_curr_res += cilpcp->space_reserved;
+		list_splice_init(&cilpcp->log_items, &cil->xc_cil);
+		list_splice_init(&cilpcp->busy_extents, &ctx->busy_extents);
+
+		cilpcp->space_used = 0;
+		cilpcp->space_folded = 0;
+		cilpcp->space_reserved = 0;
+		cilpcp->nvecs = 0;
+		count++;
 	}
 
-	spin_unlock(&cil->xc_cil_lock);
-
-	if (tp->t_ticket->t_curr_res < 0)
-		xfs_force_shutdown(log->l_mp, SHUTDOWN_LOG_IO_ERROR);
+	list_sort(NULL, &cil->xc_cil, xlog_cil_order_cmp);
+	XFS_STATS_ADD(cil->xc_log->l_mp, xs_cil_pcp_aggregate, count);
 }
 
 static void
@@ -670,7 +754,7 @@ xlog_cil_push_work(
 	/*
 	 * Wake up any background push waiters now this context is being pushed.
 	 */
-	if (ctx->space_used >= XLOG_CIL_BLOCKING_SPACE_LIMIT(log))
+	if (atomic_read(&ctx->space_used) >= XLOG_CIL_BLOCKING_SPACE_LIMIT(log))
 		wake_up_all(&cil->xc_push_wait);
 
 	/*
@@ -678,7 +762,7 @@ xlog_cil_push_work(
 	 * move on to a new sequence number and so we have to be able to push
 	 * this sequence again later.
 	 */
-	if (list_empty(&cil->xc_cil)) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_push_lock);
 		goto out_skip;
@@ -718,11 +802,18 @@ xlog_cil_push_work(
 	list_add(&ctx->committing, &cil->xc_committing);
 	spin_unlock(&cil->xc_push_lock);
 
+	/*
+	 * Gather the items, busy extents and space accounting of the
+	 * transactions committed on each CPU into the context. We don't need
+	 * any other locking here because the transaction commit side is
+	 * currently locked out by the flush lock.
+	 */
+	xlog_cil_pcp_aggregate(cil, ctx);
+	XFS_STATS_INC(log->l_mp, xs_cil_push);
+
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL.
 	 */
 	lv = NULL;
 	num_iovecs = 0;
@@ -739,6 +830,7 @@ xlog_cil_push_work(
 		lv = item->li_lv;
 		item->li_lv = NULL;
 		num_iovecs += lv->lv_niovecs;
+		XFS_STATS_INC(log->l_mp, xs_cil_items);
 	}
 
 	/*
@@ -752,6 +844,7 @@ xlog_cil_push_work(
 	new_ctx->sequence = ctx->sequence + 1;
 	new_ctx->cil = cil;
 	cil->xc_ctx = new_ctx;
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 
 	/*
 	 * The switch is now done, so we can drop the context lock and move out
@@ -904,13 +997,13 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(!test_bit(XLOG_CIL_EMPTY, &cil->xc_flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
 	 * space available yet.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log)) {
+	if (atomic_read(&cil->xc_ctx->space_used) < XLOG_CIL_SPACE_LIMIT(log)) {
 		up_read(&cil->xc_ctx_lock);
 		return;
 	}
@@ -933,9 +1026,10 @@ xlog_cil_push_background(
 	 * If we are well over the space limit, throttle the work that is being
 	 * done until the push work on this context has begun.
 	 */
-	if (cil->xc_ctx->space_used >= XLOG_CIL_BLOCKING_SPACE_LIMIT(log)) {
+	if (atomic_read(&cil->xc_ctx->space_used) >=
+			XLOG_CIL_BLOCKING_SPACE_LIMIT(log)) {
 		trace_xfs_log_cil_wait(log, cil->xc_ctx->ticket);
-		ASSERT(cil->xc_ctx->space_used < log->l_logsize);
+		ASSERT(atomic_read(&cil->xc_ctx->space_used) < log->l_logsize);
 		xlog_wait(&cil->xc_push_wait, &cil->xc_push_lock);
 		return;
 	}
@@ -970,7 +1064,8 @@ xlog_cil_push_now(
 	 * there's no work we need to do.
 	 */
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) ||
+	    push_seq <= cil->xc_push_seq) {
 		spin_unlock(&cil->xc_push_lock);
 		return;
 	}
@@ -988,7 +1083,7 @@ xlog_cil_empty(
 	bool		empty = false;
 
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil))
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		empty = true;
 	spin_unlock(&cil->xc_push_lock);
 	return empty;
@@ -1140,7 +1235,7 @@ restart:
 	 * we would have found the context on the committing list.
 	 */
 	if (sequence == cil->xc_current_sequence &&
-	    !list_empty(&cil->xc_cil)) {
+	    !test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		spin_unlock(&cil->xc_push_lock);
 		goto restart;
 	}
@@ -1199,21 +1294,31 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	struct xlog_cil_pcp *cilpcp;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_MAYFAIL);
 	if (!cil)
 		return -ENOMEM;
 
-	ctx = kmem_zalloc(sizeof(*ctx), KM_MAYFAIL);
-	if (!ctx) {
-		kmem_free(cil);
-		return -ENOMEM;
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp)
+		goto out_free_cil;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+		INIT_LIST_HEAD(&cilpcp->busy_extents);
+		INIT_LIST_HEAD(&cilpcp->log_items);
 	}
 
+	ctx = kmem_zalloc(sizeof(*ctx), KM_MAYFAIL);
+	if (!ctx)
+		goto out_free_pcp;
+
 	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
 	INIT_LIST_HEAD(&cil->xc_cil);
 	INIT_LIST_HEAD(&cil->xc_committing);
-	spin_lock_init(&cil->xc_cil_lock);
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 	spin_lock_init(&cil->xc_push_lock);
 	init_waitqueue_head(&cil->xc_push_wait);
 	init_rwsem(&cil->xc_ctx_lock);
@@ -1229,6 +1334,12 @@ xlog_cil_init(
 	cil->xc_log = log;
 	log->l_cilp = cil;
 	return 0;
+
+out_free_pcp:
+	free_percpu(cil->xc_pcp);
+out_free_cil:
+	kmem_free(cil);
+	return -ENOMEM;
 }
 
 void
@@ -1242,6 +1353,8 @@ xlog_cil_destroy(
 	}
 
 	ASSERT(list_empty(&log->l_cilp->xc_cil));
+	ASSERT(test_bit(XLOG_CIL_EMPTY, &log->l_cilp->xc_flags));
+	free_percpu(log->l_cilp->xc_pcp);
 	kmem_free(log->l_cilp);
 }
 
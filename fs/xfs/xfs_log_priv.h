@@ -235,7 +235,8 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* item commit order */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct list_head	iclog_entry;
@@ -243,6 +244,30 @@ struct xfs_cil_ctx {
 	struct work_struct	discard_endio_work;
 };
 
+/*
+ * Per-cpu CIL commit state.
+ *
+ * Transaction commits only ever touch the structure of the CPU they run on,
+ * under the xc_ctx_lock held shared, so the fast path does not bounce any
+ * shared cachelines around. The push aggregates all of them into the context
+ * being pushed while it holds the xc_ctx_lock exclusively, then resets them
+ * for the next context.
+ *
+ * space_used is the space this CPU has added to the current context, of which
+ * space_folded has already been added to ctx->space_used to keep the
+ * background push thresholds up to date. space_reserved is the iclog header
+ * space stolen from transactions that still has to be added to the context
+ * ticket.
+ */
+struct xlog_cil_pcp {
+	int			space_used;
+	int			space_folded;
+	int			space_reserved;
+	int			nvecs;
+	struct list_head	busy_extents;
+	struct list_head	log_items;
+};
+
 /*
  * Committed Item List structure
  *
@@ -261,8 +286,9 @@ struct xfs_cil_ctx {
  */
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	unsigned long		xc_flags;
+	struct list_head	xc_cil;		/* items being pushed */
+	struct xlog_cil_pcp __percpu *xc_pcp;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -276,6 +302,9 @@ struct xfs_cil {
 	wait_queue_head_t	xc_push_wait;	/* background push throttle */
 } ____cacheline_aligned_in_smp;
 
+/* xc_flags bit values */
+#define	XLOG_CIL_EMPTY		0	/* nothing committed to current ctx */
+
 /*
  * The amount of log space we allow the CIL to aggregate is difficult to size.
  * Whatever we choose, we have to make sure we can get a reservation for the
@@ -365,6 +394,14 @@ struct xfs_cil {
 #define XLOG_CIL_BLOCKING_SPACE_LIMIT(log)	\
 	(XLOG_CIL_SPACE_LIMIT(log) * 2)
 
+/*
+ * Amount of space a CPU can add to the context before it has to be folded into
+ * ctx->space_used. All CPUs together can hide at most half the space limit, so
+ * background pushes are never started later than at 1.5 times the limit.
+ */
+#define XLOG_CIL_PCP_SPACE(log)	\
+	(XLOG_CIL_SPACE_LIMIT(log) / (2 * num_online_cpus()))
+
 /*
  * ticket grant locks, queues and accounting have their own cachlines
  * as these are quite hot and can be operated on concurrently.
@@ -125,6 +125,10 @@ struct __xfsstats {
 	uint32_t		xs_fibt_2[__XBTS_MAX];
 	uint32_t		xs_rmap_2[__XBTS_MAX];
 	uint32_t		xs_refcbt_2[__XBTS_MAX];
+	uint32_t		xs_cil_push;		/* checkpoints pushed */
+	uint32_t		xs_cil_pcp_aggregate;	/* pcp CILs merged */
+	uint32_t		xs_cil_items;		/* log items pushed */
+	uint32_t		xs_cil_pcp_fold;	/* pcp space folds */
 	uint32_t		xs_qm_dqreclaims;
 	uint32_t		xs_qm_dqreclaim_misses;
 	uint32_t		xs_qm_dquot_dups;
@@ -180,6 +180,14 @@ struct backing_dev_info {
 	 */
 	atomic_long_t tot_write_bandwidth;
 
+	/*
+	 * Latency based dirty throttling: the target write completion
+	 * latency set through the queue's dirty_lat_usec, 0 if disabled,
+	 * and the running average the block layer measures against it.
+	 */
+	u64 write_lat_target_nsec;
+	u64 write_lat_nsec;
+
 	struct bdi_writeback wb;  /* the root writeback info for this bdi */
 	struct list_head wb_list; /* list of all wbs */
 #ifdef CONFIG_CGROUP_WRITEBACK
@@ -125,6 +125,14 @@ struct blk_mq_hw_ctx {
 	unsigned long		queued;
 	/** @run: Number of dispatched requests. */
 	unsigned long		run;
+	/** @tag_batches: Number of batched tag allocations. */
+	unsigned long		tag_batches;
+	/** @tags_batched: Number of tags allocated in batches. */
+	unsigned long		tags_batched;
+	/** @cached_rqs_used: Plug cached requests used for a bio. */
+	unsigned long		cached_rqs_used;
+	/** @cached_rqs_freed: Plug cached requests freed unused. */
+	unsigned long		cached_rqs_freed;
 #define BLK_MQ_MAX_DISPATCH_ORDER	7
 	/** @dispatched: Number of dispatch requests by queue. */
 	unsigned long		dispatched[BLK_MQ_MAX_DISPATCH_ORDER];
@@ -153,6 +161,28 @@ struct blk_mq_hw_ctx {
 	unsigned long		poll_invoked;
 	/** @poll_success: Count how many polled requests were completed. */
 	unsigned long		poll_success;
+	/** @poll_slept: Count times blk_poll() slept before polling. */
+	unsigned long		poll_slept;
+	/**
+	 * @poll_irq_waits: Count times blk_poll() waited for an interrupt
+	 * because polled requests were sent to an interrupt driven queue.
+	 */
+	unsigned long		poll_irq_waits;
+	/**
+	 * @poll_time: Sum of the completion times of the polled requests
+	 * completed in the current polling stats window, in nsecs.
+	 */
+	u64			poll_time;
+	/**
+	 * @poll_depth: Average number of polled requests in flight during
+	 * the last polling stats window, in 1/1000ths of a request.
+	 */
+	unsigned int		poll_depth;
+	/**
+	 * @poll_lat: Running average of the completion time of the polled
+	 * requests of this queue, indexed like &request_queue->poll_stat.
+	 */
+	u64			poll_lat[BLK_MQ_POLL_STATS_BKTS];
 
 #ifdef CONFIG_BLK_DEBUG_FS
 	/**
@@ -291,6 +321,15 @@ struct blk_mq_ops {
 	 */
 	void (*commit_rqs)(struct blk_mq_hw_ctx *);
 
+	/**
+	 * @queue_rqs: Queue a list of new requests for a single queue that
+	 * has no I/O scheduler.  The requests have a driver tag but are not
+	 * started yet, and may span several hardware queues.  Requests the
+	 * driver queued must be removed from the list; the ones left on it
+	 * are issued one at a time through @queue_rq.
+	 */
+	void (*queue_rqs)(struct list_head *rqlist);
+
 	/**
 	 * @get_budget: Reserve budget before queue request, once .queue_rq is
 	 * run, it is driver's responsibility to release the
@@ -373,6 +412,12 @@ struct blk_mq_ops {
 	 * information about a request.
 	 */
 	void (*show_rq)(struct seq_file *m, struct request *rq);
+
+	/**
+	 * @show_hctx: Used by the debugfs implementation to show
+	 * driver-specific information about a hardware queue.
+	 */
+	void (*show_hctx)(struct seq_file *m, struct blk_mq_hw_ctx *hctx);
 #endif
 };
 
@@ -396,6 +441,9 @@ enum {
 	/* hw queue is inactive after all its CPUs become offline */
 	BLK_MQ_S_INACTIVE	= 3,
 
+	/* poll queue is mostly idle, polled requests use interrupts instead */
+	BLK_MQ_S_POLL_IRQ	= 4,
+
 	BLK_MQ_MAX_DEPTH	= 10240,
 
 	BLK_MQ_CPU_WORK_BATCH	= 8,
@@ -483,6 +531,37 @@ static inline int blk_mq_request_completed(struct request *rq)
 void blk_mq_start_request(struct request *rq);
 void blk_mq_end_request(struct request *rq, blk_status_t error);
 void __blk_mq_end_request(struct request *rq, blk_status_t error);
+void blk_mq_end_request_batch(struct io_comp_batch *iob);
+
+/*
+ * Only need start/end time stamping if we have iostat or
+ * blk stats enabled, or using an IO scheduler.
+ */
+static inline bool blk_mq_need_time_stamp(struct request *rq)
+{
+	return (rq->rq_flags & (RQF_IO_STAT | RQF_STATS)) || rq->q->elevator;
+}
+
+/*
+ * Batched completions only work when there is no I/O error and no special
+ * ->end_io handler.  Requests that went through an I/O scheduler are ended
+ * one at a time as well.
+ */
+static inline bool blk_mq_add_to_batch(struct request *req,
+				       struct io_comp_batch *iob, int ioerror,
+				       void (*complete)(struct io_comp_batch *))
+{
+	if (!iob || req->q->elevator || req->end_io || ioerror)
+		return false;
+	if (!iob->complete)
+		iob->complete = complete;
+	else if (iob->complete != complete)
+		return false;
+	iob->need_ts |= blk_mq_need_time_stamp(req);
+	req->rq_next = iob->req_list;
+	iob->req_list = req;
+	return true;
+}
 
 void blk_mq_requeue_request(struct request *rq, bool kick_requeue_list);
 void blk_mq_kick_requeue_list(struct request_queue *q);
@@ -143,7 +143,10 @@ struct request {
 	struct bio *bio;
 	struct bio *biotail;
 
-	struct list_head queuelist;
+	union {
+		struct list_head queuelist;
+		struct request *rq_next;	/* for struct io_comp_batch */
+	};
 
 	/*
 	 * The hash is used inside the scheduler, and killed once the
@@ -481,6 +484,9 @@ struct request_queue {
 	struct blk_stat_callback	*poll_cb;
 	struct blk_rq_stat	poll_stat[BLK_MQ_POLL_STATS_BKTS];
 
+	/* write latency sampling for latency based dirty throttling */
+	struct blk_stat_callback	*dirty_lat_cb;
+
 	struct timer_list	timeout;
 	struct work_struct	timeout_work;
 
@@ -1195,6 +1201,18 @@ extern void blk_put_queue(struct request_queue *);
 extern void blk_set_queue_dying(struct request_queue *);
 
 #ifdef CONFIG_BLOCK
+/*
+ * Requests completed by a driver in one go, for example from a single pass
+ * over a completion queue, and ended together by the ->complete handler.
+ */
+struct io_comp_batch {
+	struct request *req_list;
+	bool need_ts;
+	void (*complete)(struct io_comp_batch *);
+};
+
+#define DEFINE_IO_COMP_BATCH(name)	struct io_comp_batch name = { }
+
 /*
  * blk_plug permits building a queue of related requests by holding the I/O
  * fragments for a short period. This allows merging of sequential requests
@@ -1210,7 +1228,9 @@ extern void blk_set_queue_dying(struct request_queue *);
 struct blk_plug {
 	struct list_head mq_list; /* blk-mq requests */
 	struct list_head cb_list; /* md requires an unplug callback */
+	struct list_head cached_rqs; /* requests allocated ahead of time */
 	unsigned short rq_count;
+	unsigned short nr_ios; /* requests to allocate in one batch */
 	bool multiple_queues;
 	bool nowait;
 };
@@ -1227,6 +1247,7 @@ struct blk_plug_cb {
 extern struct blk_plug_cb *blk_check_plugged(blk_plug_cb_fn unplug,
 					     void *data, int size);
 extern void blk_start_plug(struct blk_plug *);
+extern void blk_start_plug_nr_ios(struct blk_plug *, unsigned int);
 extern void blk_finish_plug(struct blk_plug *);
 extern void blk_flush_plug_list(struct blk_plug *, bool);
 
@@ -1265,6 +1286,11 @@ static inline void blk_start_plug(struct blk_plug *plug)
 {
 }
 
+static inline void blk_start_plug_nr_ios(struct blk_plug *plug,
+					 unsigned int nr_ios)
+{
+}
+
 static inline void blk_finish_plug(struct blk_plug *plug)
 {
 }
@@ -424,9 +424,13 @@ enum ccp_passthru_byteswap {
  * @dst: data produced by this operation
  * @src_len: length in bytes of data used for this operation
  * @final: indicate final pass-through operation
+ * @segs: if not NULL, segments to copy instead of src, dst and src_len.
+ *   The segments are queued as consecutive descriptors and only the
+ *   last one is waited for.
+ * @seg_count: number of entries in @segs
  *
  * Variables required to be set when calling ccp_enqueue_cmd():
- *   - bit_mod, byte_swap, src, dst, src_len
+ *   - bit_mod, byte_swap, src, dst, src_len or segs, seg_count
  *   - mask, mask_len if bit_mod is not CCP_PASSTHRU_BITWISE_NOOP
  */
 struct ccp_passthru_engine {
@@ -442,6 +446,17 @@ struct ccp_passthru_engine {
 	u32 final;
 };
 
+/**
+ * struct ccp_passthru_seg - one segment of a chained pass-through operation
+ * @src_dma: source of the segment
+ * @dst_dma: destination of the segment
+ * @len: length in bytes of the segment
+ */
+struct ccp_passthru_seg {
+	dma_addr_t src_dma, dst_dma;
+	u32 len;
+};
+
 /**
  * struct ccp_passthru_nomap_engine - CCP pass-through operation
  *   without performing DMA mapping
@@ -469,6 +484,9 @@ struct ccp_passthru_nomap_engine {
 	u64 src_len;		/* In bytes */
 
 	u32 final;
+
+	struct ccp_passthru_seg *segs;
+	unsigned int seg_count;
 };
 
 /***** ECC engine *****/
@@ -614,6 +632,8 @@ enum ccp_engine {
 /* Flag values for flags member of ccp_cmd */
 #define CCP_CMD_MAY_BACKLOG		0x00000001
 #define CCP_CMD_PASSTHRU_NO_DMA_MAP	0x00000002
+/* Busy-poll for completion instead of sleeping until the interrupt */
+#define CCP_CMD_POLL			0x00000004
 
 /**
  * struct ccp_cmd - CCP operation request
@@ -451,6 +451,8 @@ struct cgroup {
 	/* per-cpu recursive resource statistics */
 	struct cgroup_rstat_cpu __percpu *rstat_cpu;
 	struct list_head rstat_css_list;
+	/* jiffies_64 when the subtree was last flushed completely */
+	u64 rstat_flushed_at;
 
 	/* cgroup basic resource statistics */
 	struct cgroup_base_stat last_bstat;
@@ -23,6 +23,7 @@ struct console_font;
 struct module;
 struct tty_struct;
 struct notifier_block;
+struct task_struct;
 
 enum con_scroll {
 	SM_UP,
@@ -152,6 +153,10 @@ struct console {
 	int	cflag;
 	void	*data;
 	struct	 console *next;
+	/* printk state, owned by kernel/printk/printk.c */
+	u64	seq;		/* next record to print */
+	u32	idx;		/* log buffer index of @seq */
+	struct task_struct *thread;	/* printing kthread, if any */
 };
 
 /*
@@ -6,6 +6,7 @@
 #include <linux/vtime.h>
 #include <linux/context_tracking_state.h>
 #include <linux/instrumentation.h>
+#include <linux/tick.h>
 
 #include <asm/ptrace.h>
 
@@ -110,6 +111,13 @@ static __always_inline void guest_enter_irqoff(void)
 		vtime_guest_enter(current);
 	else
 		current->flags |= PF_VCPU;
+
+	/*
+	 * Guest mode does not need the tick on a nohz_full CPU, see
+	 * tick_nohz_guest_enter().
+	 */
+	if (tick_nohz_full_cpu(smp_processor_id()))
+		tick_nohz_guest_enter();
 	instrumentation_end();
 
 	if (context_tracking_enabled())
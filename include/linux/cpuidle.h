@@ -38,6 +38,9 @@ struct cpuidle_state_usage {
 	u64			time_ns;
 	unsigned long long	above; /* Number of times it's been too deep */
 	unsigned long long	below; /* Number of times it's been too shallow */
+	unsigned long long	pred_hits; /* Predicted idle duration matched */
+	unsigned long long	pred_early; /* Woke up before the prediction */
+	unsigned long long	pred_late; /* Woke up after the prediction */
 #ifdef CONFIG_SUSPEND
 	unsigned long long	s2idle_usage;
 	unsigned long long	s2idle_time; /* in US */
@@ -271,9 +274,12 @@ struct cpuidle_governor {
 #ifdef CONFIG_CPU_IDLE
 extern int cpuidle_register_governor(struct cpuidle_governor *gov);
 extern s64 cpuidle_governor_latency_req(unsigned int cpu);
+extern void cpuidle_expect_wakeup(u64 delay_ns);
+extern u64 cpuidle_wakeup_hint(unsigned int cpu);
 #else
 static inline int cpuidle_register_governor(struct cpuidle_governor *gov)
 {return 0;}
+static inline void cpuidle_expect_wakeup(u64 delay_ns) { }
 #endif
 
 #define __CPU_PM_CPU_IDLE_ENTER(low_level_idle_enter,			\
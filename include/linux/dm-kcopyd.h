@@ -85,5 +85,40 @@ void dm_kcopyd_zero(struct dm_kcopyd_client *kc,
 		    unsigned num_dests, struct dm_io_region *dests,
 		    unsigned flags, dm_kcopyd_notify_fn fn, void *context);
 
+/*
+ * Copy offload, e.g. to a device that copies between LBAs itself.
+ *
+ * If set, dm_kcopyd_copy() hands every copy that doesn't need sequential
+ * writes to the offload fn first.  It returns 0 if it took the copy, which
+ * it must later complete by passing job to dm_kcopyd_do_callback(), or an
+ * error to make kcopyd copy it the usual way.  It is called from the
+ * dm_kcopyd_copy() caller's context.
+ *
+ * Set this before submitting any copies.
+ */
+typedef int (*dm_kcopyd_offload_fn)(void *context, struct dm_io_region *from,
+				    unsigned num_dests,
+				    struct dm_io_region *dests, void *job);
+
+void dm_kcopyd_set_offload(struct dm_kcopyd_client *kc,
+			   dm_kcopyd_offload_fn fn, void *context);
+
+/*
+ * Cumulative statistics of a client.  busy_ns is the time the client had
+ * jobs in flight, so (read_sectors + write_sectors) / busy_ns gives its
+ * throughput while busy.
+ */
+struct dm_kcopyd_stats {
+	u64 jobs;
+	u64 sub_jobs;
+	u64 read_sectors;
+	u64 write_sectors;
+	u64 offload_sectors;
+	u64 busy_ns;
+};
+
+void dm_kcopyd_client_stats(struct dm_kcopyd_client *kc,
+			    struct dm_kcopyd_stats *stats);
+
 #endif	/* __KERNEL__ */
 #endif	/* _LINUX_DM_KCOPYD_H */
@@ -159,8 +159,15 @@ static inline dma_addr_t dma_direct_map_page(struct device *dev,
 	phys_addr_t phys = page_to_phys(page) + offset;
 	dma_addr_t dma_addr = phys_to_dma(dev, phys);
 
-	if (unlikely(swiotlb_force == SWIOTLB_FORCE))
+	if (unlikely(swiotlb_force == SWIOTLB_FORCE)) {
+		/* Already shared with the device, no need to bounce. */
+		if (dma_is_shared(phys, size)) {
+			dma_addr = __phys_to_dma(dev, phys);
+			if (dma_capable(dev, dma_addr, size, true))
+				return dma_addr;
+		}
 		return swiotlb_map(dev, phys, size, dir, attrs);
+	}
 
 	if (unlikely(!dma_capable(dev, dma_addr, size, true))) {
 		if (swiotlb_force != SWIOTLB_NO_FORCE)
@@ -527,6 +527,33 @@ struct page *dma_alloc_from_pool(struct device *dev, size_t size,
 		bool (*phys_addr_ok)(struct device *, phys_addr_t, size_t));
 bool dma_free_from_pool(struct device *dev, void *start, size_t size);
 
+#ifdef CONFIG_DMA_COHERENT_POOL
+void *dma_alloc_shared(size_t size);
+void dma_free_shared(void *vaddr, size_t size);
+struct page *dma_alloc_shared_page(void);
+void dma_free_shared_page(struct page *page);
+bool dma_is_shared(phys_addr_t phys, size_t size);
+#else
+static inline void *dma_alloc_shared(size_t size)
+{
+	return NULL;
+}
+static inline void dma_free_shared(void *vaddr, size_t size)
+{
+}
+static inline struct page *dma_alloc_shared_page(void)
+{
+	return NULL;
+}
+static inline void dma_free_shared_page(struct page *page)
+{
+}
+static inline bool dma_is_shared(phys_addr_t phys, size_t size)
+{
+	return false;
+}
+#endif /* CONFIG_DMA_COHERENT_POOL */
+
 int
 dma_common_get_sgtable(struct device *dev, struct sg_table *sgt, void *cpu_addr,
 		dma_addr_t dma_addr, size_t size, unsigned long attrs);
@@ -51,6 +51,7 @@ struct fiemap_extent_info;
 struct hd_geometry;
 struct iovec;
 struct kiocb;
+struct io_uring_cmd;
 struct kobject;
 struct pipe_inode_info;
 struct poll_table_struct;
@@ -178,6 +179,9 @@ typedef int (dio_iodone_t)(struct kiocb *iocb, loff_t offset,
 /* File supports async buffered reads */
 #define FMODE_BUF_RASYNC	((__force fmode_t)0x40000000)
 
+/* File supports non-blocking buffered writes */
+#define FMODE_BUF_WASYNC	((__force fmode_t)0x80000000)
+
 /*
  * Flag for rw_copy_check_uvector and compat_rw_copy_check_uvector
  * that indicates that they should check the contents of the iovec are
@@ -288,6 +292,8 @@ enum positive_aop_returns {
 #define AOP_FLAG_NOFS			0x0002 /* used by filesystem to direct
 						* helper code (eg buffer layer)
 						* to clear GFP_FS from alloc */
+#define AOP_FLAG_NOWAIT			0x0004 /* don't block on the page lock,
+						* allocation or stable writes */
 
 /*
  * oh the beauties of C type declarations.
@@ -321,6 +327,8 @@ enum rw_hint {
 /* iocb->ki_waitq is valid */
 #define IOCB_WAITQ		(1 << 8)
 #define IOCB_NOIO		(1 << 9)
+/* can use bio alloc cache */
+#define IOCB_ALLOC_CACHE	(1 << 10)
 
 struct kiocb {
 	struct file		*ki_filp;
@@ -907,6 +915,11 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	pgoff_t fault_prev;		/* Last mmap fault index */
+	long fault_stride;		/* Delta between the last two faults */
+	pgoff_t stride_next;		/* Next index predicted by the stride */
+	unsigned int stride_hits;	/* # of faults at fault_stride */
 };
 
 /*
@@ -1838,6 +1851,8 @@ struct file_operations {
 				   struct file *file_out, loff_t pos_out,
 				   loff_t len, unsigned int remap_flags);
 	int (*fadvise)(struct file *, loff_t, loff_t, int);
+	int (*uring_cmd)(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+	int (*uring_cmd_iopoll)(struct io_uring_cmd *ioucmd, bool spin);
 } __randomize_layout;
 
 struct inode_operations {
@@ -3425,6 +3440,8 @@ int proc_nr_dentry(struct ctl_table *table, int write,
 		  void *buffer, size_t *lenp, loff_t *ppos);
 int proc_nr_inodes(struct ctl_table *table, int write,
 		   void *buffer, size_t *lenp, loff_t *ppos);
+int proc_nr_lookups(struct ctl_table *table, int write,
+		    void *buffer, size_t *lenp, loff_t *ppos);
 int __init get_filesystem_list(char *buf);
 
 #define __FMODE_EXEC		((__force int) FMODE_EXEC)
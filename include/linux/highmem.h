@@ -232,6 +232,22 @@ static inline void clear_user_highpage(struct page *page, unsigned long vaddr)
 }
 #endif
 
+/*
+ * Clear a page that is not going to be accessed soon, without pulling it
+ * into the cache where the architecture allows.
+ */
+#ifdef __HAVE_ARCH_CLEAR_PAGE_NOCACHE
+static inline void clear_user_highpage_nocache(struct page *page,
+					       unsigned long vaddr)
+{
+	void *addr = kmap_atomic(page);
+	clear_page_nocache(addr);
+	kunmap_atomic(addr);
+}
+#else
+#define clear_user_highpage_nocache clear_user_highpage
+#endif
+
 #ifndef __HAVE_ARCH_ALLOC_ZEROED_USER_HIGHPAGE
 /**
  * __alloc_zeroed_user_highpage - Allocate a zeroed HIGHMEM page for a VMA with caller-specified movable GFP flags
@@ -284,22 +300,36 @@ static inline void clear_highpage(struct page *page)
 	kunmap_atomic(kaddr);
 }
 
+/*
+ * The offsets may extend past the first page of a THP; each subpage in the
+ * segments is mapped and zeroed in turn.
+ */
 static inline void zero_user_segments(struct page *page,
 	unsigned start1, unsigned end1,
 	unsigned start2, unsigned end2)
 {
-	void *kaddr = kmap_atomic(page);
-
-	BUG_ON(end1 > PAGE_SIZE || end2 > PAGE_SIZE);
-
-	if (end1 > start1)
-		memset(kaddr + start1, 0, end1 - start1);
-
-	if (end2 > start2)
-		memset(kaddr + start2, 0, end2 - start2);
-
-	kunmap_atomic(kaddr);
-	flush_dcache_page(page);
+	unsigned int i;
+
+	BUG_ON(end1 > page_size(page) || end2 > page_size(page));
+
+	for (i = 0; i < compound_nr(page); i++) {
+		unsigned int base = i * PAGE_SIZE, top = base + PAGE_SIZE;
+		void *kaddr;
+
+		if ((end1 <= start1 || end1 <= base || start1 >= top) &&
+		    (end2 <= start2 || end2 <= base || start2 >= top))
+			continue;
+
+		kaddr = kmap_atomic(page + i);
+		if (end1 > start1 && end1 > base && start1 < top)
+			memset(kaddr + max(start1, base) - base, 0,
+			       min(end1, top) - max(start1, base));
+		if (end2 > start2 && end2 > base && start2 < top)
+			memset(kaddr + max(start2, base) - base, 0,
+			       min(end2, top) - max(start2, base));
+		kunmap_atomic(kaddr);
+		flush_dcache_page(page + i);
+	}
 }
 
 static inline void zero_user_segment(struct page *page,
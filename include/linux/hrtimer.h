@@ -195,6 +195,9 @@ enum  hrtimer_base_type {
  * @nr_retries:		Total number of hrtimer interrupt retries
  * @nr_hangs:		Total number of hrtimer interrupt hangs
  * @max_hang_time:	Maximum time spent in hrtimer_interrupt
+ * @nr_programmed:	Total number of clock event device programmings
+ * @nr_coalesced:	Total number of timers expired ahead of their hard
+ *			expiry time, sharing an event with an earlier timer
  * @softirq_expiry_lock: Lock which is taken while softirq based hrtimer are
  *			 expired
  * @timer_waiters:	A hrtimer_cancel() invocation waits for the timer
@@ -225,6 +228,8 @@ struct hrtimer_cpu_base {
 	unsigned short			nr_retries;
 	unsigned short			nr_hangs;
 	unsigned int			max_hang_time;
+	unsigned int			nr_programmed;
+	unsigned int			nr_coalesced;
 #endif
 #ifdef CONFIG_PREEMPT_RT
 	spinlock_t			softirq_expiry_lock;
@@ -321,6 +326,7 @@ extern void hrtimer_interrupt(struct clock_event_device *dev);
 extern void clock_was_set_delayed(void);
 
 extern unsigned int hrtimer_resolution;
+extern unsigned int sysctl_hrtimer_coalesce_ns;
 
 #else
 
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#ifndef _LINUX_IO_URING_H
+#define _LINUX_IO_URING_H
+
+#include <linux/sched.h>
+
+/* issue_flags passed to ->uring_cmd() */
+enum io_uring_cmd_flags {
+	IO_URING_F_NONBLOCK		= (1 << 0),	/* must not block */
+	IO_URING_F_IOPOLL		= (1 << 1),	/* ring is IORING_SETUP_IOPOLL */
+};
+
+/*
+ * Per request state of IORING_OP_URING_CMD, handed to the file's
+ * ->uring_cmd() handler. A handler that returns -EIOCBQUEUED owns the
+ * command until it calls io_uring_cmd_done(), directly or from the callback
+ * given to io_uring_cmd_complete_in_task().
+ */
+struct io_uring_cmd {
+	struct file	*file;
+	const void __user *cmd;		/* driver defined payload */
+	u32		cmd_op;
+	u32		cmd_len;
+	void (*task_work_cb)(struct io_uring_cmd *ioucmd);
+	u8		pdu[32];	/* available inline for free use */
+};
+
+#if defined(CONFIG_IO_URING)
+void __io_uring_unreg_ringfds(void);
+
+/* drop the ring files registered with IORING_REGISTER_RING_FDS */
+static inline void io_uring_unreg_ringfds(void)
+{
+	if (current->io_uring)
+		__io_uring_unreg_ringfds();
+}
+
+void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret);
+void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *));
+#else
+static inline void io_uring_unreg_ringfds(void)
+{
+}
+
+static inline void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret)
+{
+}
+
+static inline void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *))
+{
+}
+#endif
+
+#endif
@@ -248,6 +248,15 @@ int kexec_elf_load(struct kimage *image, struct elfhdr *ehdr,
 void kexec_free_elf_info(struct kexec_elf_info *elf_info);
 int kexec_elf_probe(const char *buf, unsigned long len);
 #endif
+/* Time spent in each phase of loading an image, and the amount loaded */
+struct kexec_load_stats {
+	u64 alloc_ns;		/* allocating destination pages */
+	u64 copy_ns;		/* filling them from the segments */
+	u64 digest_ns;		/* computing the purgatory digest */
+	u64 total_ns;		/* the whole load, with the phases overlapped */
+	unsigned long bytes;
+};
+
 struct kimage {
 	kimage_entry_t head;
 	kimage_entry_t *entry;
@@ -264,6 +273,8 @@ struct kimage {
 	struct list_head control_pages;
 	struct list_head dest_pages;
 	struct list_head unusable_pages;
+	/* Pages of a split high-order chunk, not used by a segment yet */
+	struct list_head spare_pages;
 
 	/* Address of next control page to allocate for crash kernels. */
 	unsigned long control_page;
@@ -275,6 +286,10 @@ struct kimage {
 	unsigned int preserve_context : 1;
 	/* If set, we are using file mode kexec syscall */
 	unsigned int file_mode:1;
+	/* Set once a high-order chunk for spare_pages could not be allocated */
+	unsigned int no_spare_chunks:1;
+
+	struct kexec_load_stats load_stats;
 
 #ifdef ARCH_HAS_KIMAGE_ARCH
 	struct kimage_arch arch;
@@ -319,6 +334,7 @@ extern int kimage_crash_copy_vmcoreinfo(struct kimage *image);
 extern struct kimage *kexec_image;
 extern struct kimage *kexec_crash_image;
 extern int kexec_load_disabled;
+extern struct kexec_load_stats kexec_last_load_stats;
 
 #ifndef kexec_flush_icache_page
 #define kexec_flush_icache_page(page)
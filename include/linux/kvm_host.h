@@ -32,6 +32,7 @@
 #include <linux/kvm_para.h>
 
 #include <linux/kvm_types.h>
+#include <linux/kvm_dirty_ring.h>
 
 #include <asm/kvm_host.h>
 
@@ -259,6 +260,25 @@ struct kvm_mmio_fragment {
 	unsigned len;
 };
 
+/*
+ * Halt durations are sorted in power of two buckets, from under
+ * KVM_HALT_POLL_HIST_MIN_NS up; the counts decay by half every
+ * KVM_HALT_POLL_HIST_WINDOW halts so that the histogram follows the recent
+ * behaviour of the guest.
+ */
+#define KVM_HALT_POLL_HIST_BUCKETS	16
+#define KVM_HALT_POLL_HIST_MIN_SHIFT	10
+#define KVM_HALT_POLL_HIST_MIN_NS	(1U << KVM_HALT_POLL_HIST_MIN_SHIFT)
+#define KVM_HALT_POLL_HIST_WINDOW	64
+
+struct kvm_halt_poll_hist {
+	u16 count[KVM_HALT_POLL_HIST_BUCKETS];
+	u16 samples;
+	/* Halts that polled, and those whose poll other tasks cut short */
+	u16 polls;
+	u16 contended;
+};
+
 struct kvm_vcpu {
 	struct kvm *kvm;
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -284,6 +304,7 @@ struct kvm_vcpu {
 	sigset_t sigset;
 	struct kvm_vcpu_stat stat;
 	unsigned int halt_poll_ns;
+	struct kvm_halt_poll_hist halt_poll_hist;
 	bool valid_wakeup;
 
 #ifdef CONFIG_HAS_IOMEM
@@ -319,6 +340,7 @@ struct kvm_vcpu {
 	bool preempted;
 	bool ready;
 	struct kvm_vcpu_arch arch;
+	struct kvm_dirty_ring dirty_ring;
 };
 
 static inline int kvm_vcpu_exiting_guest_mode(struct kvm_vcpu *vcpu)
@@ -346,6 +368,7 @@ struct kvm_memory_slot {
 	unsigned long userspace_addr;
 	u32 flags;
 	short id;
+	u16 as_id;
 };
 
 static inline unsigned long kvm_dirty_bitmap_bytes(struct kvm_memory_slot *memslot)
@@ -443,7 +466,12 @@ struct kvm_memslots {
 };
 
 struct kvm {
+#ifdef KVM_HAVE_MMU_RWLOCK
+	rwlock_t mmu_lock;
+#else
 	spinlock_t mmu_lock;
+#endif /* KVM_HAVE_MMU_RWLOCK */
+
 	struct mutex slots_lock;
 	struct mm_struct *mm; /* userspace tied to this vm */
 	struct kvm_memslots __rcu *memslots[KVM_ADDRESS_SPACE_NUM];
@@ -498,12 +526,15 @@ struct kvm {
 	long tlbs_dirty;
 	struct list_head devices;
 	u64 manual_dirty_log_protect;
+	u32 dirty_ring_size;
 	struct dentry *debugfs_dentry;
 	struct kvm_stat_data **debugfs_stat_data;
 	struct srcu_struct srcu;
 	struct srcu_struct irq_srcu;
 	pid_t userspace_pid;
 	unsigned int max_halt_poll_ns;
+	/* Wakeup likelihood (percent) to poll for, 0 to grow/shrink instead */
+	unsigned int halt_poll_adaptive_pct;
 };
 
 #define kvm_err(fmt, ...) \
@@ -846,6 +877,7 @@ void kvm_arch_mmu_enable_log_dirty_pt_masked(struct kvm *kvm,
 					gfn_t gfn_offset,
 					unsigned long mask);
 void kvm_arch_sync_dirty_log(struct kvm *kvm, struct kvm_memory_slot *memslot);
+int kvm_cpu_dirty_log_size(void);
 
 #ifdef CONFIG_KVM_GENERIC_DIRTYLOG_READ_PROTECT
 void kvm_arch_flush_remote_tlbs_memslot(struct kvm *kvm,
@@ -1140,6 +1172,9 @@ struct kvm_stats_debugfs_item {
 	int offset;
 	enum kvm_stat_kind kind;
 	int mode;
+	/* KVM_STATS_* type, unit and base for the binary stats fd */
+	u32 stats_flags;
+	s16 stats_exponent;
 };
 
 #define KVM_DBGFS_GET_MODE(dbgfs_item)                                         \
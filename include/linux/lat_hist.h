@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Per-CPU log2 latency histograms for kernel hot paths.
+ *
+ * A histogram is defined statically with DEFINE_LAT_HIST(), which creates
+ * the global lat_hist_<name>, and registered with lat_hist_register(), which
+ * creates latency_hist/<name>/ in tracefs.  Recording is gated by a static
+ * key that is only enabled while latency_hist/<name>/enable is set, so an
+ * idle histogram costs a NOP in the hot path:
+ *
+ *	DEFINE_LAT_HIST(foo_wait);
+ *
+ *	u64 start = lat_hist_start(&lat_hist_foo_wait);
+ *	...
+ *	lat_hist_end(&lat_hist_foo_wait, start);
+ *
+ * Bucket n counts the samples in [2^n, 2^(n+1)) ns, the last bucket also
+ * everything above.  Samples are added with this_cpu operations, without
+ * locks or atomics.
+ */
+#ifndef _LINUX_LAT_HIST_H
+#define _LINUX_LAT_HIST_H
+
+#include <linux/bitops.h>
+#include <linux/export.h>
+#include <linux/jump_label.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/sched/clock.h>
+#include <linux/types.h>
+
+#define LAT_HIST_BUCKETS	32
+
+struct lat_hist_cpu {
+	u64			count[LAT_HIST_BUCKETS];
+	u64			sum_ns;
+};
+
+#ifdef CONFIG_LATENCY_HIST
+
+struct lat_hist {
+	const char			*name;
+	struct module			*owner;
+	struct static_key_false		key;
+	struct lat_hist_cpu __percpu	*cpu;
+	struct list_head		list;
+	struct dentry			*dentry;
+};
+
+#define DECLARE_LAT_HIST(_name)						\
+	extern struct lat_hist lat_hist_##_name
+
+#define DEFINE_LAT_HIST(_name)						\
+	static DEFINE_PER_CPU(struct lat_hist_cpu, lat_hist_cpu_##_name);	\
+	struct lat_hist lat_hist_##_name = {				\
+		.name	= #_name,					\
+		.owner	= THIS_MODULE,					\
+		.key	= STATIC_KEY_FALSE_INIT,			\
+		.cpu	= &lat_hist_cpu_##_name,			\
+		.list	= LIST_HEAD_INIT(lat_hist_##_name.list),	\
+	}
+
+int lat_hist_register(struct lat_hist *hist);
+void lat_hist_unregister(struct lat_hist *hist);
+
+static __always_inline bool lat_hist_enabled(struct lat_hist *hist)
+{
+	return static_branch_unlikely(&hist->key);
+}
+
+/* Add a sample measured by the caller */
+static __always_inline void lat_hist_record(struct lat_hist *hist, u64 ns)
+{
+	unsigned int bucket;
+
+	if (!lat_hist_enabled(hist))
+		return;
+
+	bucket = ns ? min_t(unsigned int, fls64(ns) - 1, LAT_HIST_BUCKETS - 1) : 0;
+	this_cpu_inc(hist->cpu->count[bucket]);
+	this_cpu_add(hist->cpu->sum_ns, ns);
+}
+
+/* Returns the start timestamp, or 0 if @hist is disabled */
+static __always_inline u64 lat_hist_start(struct lat_hist *hist)
+{
+	return lat_hist_enabled(hist) ? local_clock() : 0;
+}
+
+static __always_inline void lat_hist_end(struct lat_hist *hist, u64 start)
+{
+	if (lat_hist_enabled(hist) && start)
+		lat_hist_record(hist, local_clock() - start);
+}
+
+#else /* !CONFIG_LATENCY_HIST */
+
+struct lat_hist { };
+
+#define DECLARE_LAT_HIST(_name)						\
+	extern struct lat_hist lat_hist_##_name
+#define DEFINE_LAT_HIST(_name)						\
+	struct lat_hist lat_hist_##_name
+
+static inline int lat_hist_register(struct lat_hist *hist) { return 0; }
+static inline void lat_hist_unregister(struct lat_hist *hist) { }
+static inline bool lat_hist_enabled(struct lat_hist *hist) { return false; }
+static inline void lat_hist_record(struct lat_hist *hist, u64 ns) { }
+static inline u64 lat_hist_start(struct lat_hist *hist) { return 0; }
+static inline void lat_hist_end(struct lat_hist *hist, u64 start) { }
+
+#endif /* CONFIG_LATENCY_HIST */
+
+#endif /* _LINUX_LAT_HIST_H */
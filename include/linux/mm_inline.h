@@ -4,6 +4,7 @@
 
 #include <linux/huge_mm.h>
 #include <linux/swap.h>
+#include <linux/jump_label.h>
 
 /**
  * page_is_file_lru - should the page be on a file LRU or anon LRU?
@@ -45,9 +46,150 @@ static __always_inline void update_lru_size(struct lruvec *lruvec,
 #endif
 }
 
+#ifdef CONFIG_LRU_GEN
+
+DECLARE_STATIC_KEY_FALSE(lru_gen_key);
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_branch_unlikely(&lru_gen_key);
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* The generation @page is on, or -1 if it is not on a generation list */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((READ_ONCE(page->flags) & LRU_GEN_MASK) >>
+		     LRU_GEN_PGOFF) - 1;
+}
+
+/* The two youngest generations are reported as the active list */
+static inline bool lru_gen_is_active(struct lruvec *lruvec, int type, int gen)
+{
+	unsigned long max_seq = lruvec->lrugen.max_seq[type];
+
+	return gen == lru_gen_from_seq(max_seq) ||
+	       gen == lru_gen_from_seq(max_seq - 1);
+}
+
+static __always_inline void lru_gen_update_size(struct lruvec *lruvec,
+				struct page *page, int old_gen, int new_gen)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = page_is_file_lru(page);
+	int zone = page_zonenum(page);
+	int delta = thp_nr_pages(page);
+	enum lru_list lru = type * LRU_FILE;
+
+	if (old_gen >= 0) {
+		lrugen->nr_pages[old_gen][type][zone] -= delta;
+		update_lru_size(lruvec, lru +
+				(lru_gen_is_active(lruvec, type, old_gen) ?
+				 LRU_ACTIVE : 0), zone, -delta);
+	}
+	if (new_gen >= 0) {
+		lrugen->nr_pages[new_gen][type][zone] += delta;
+		update_lru_size(lruvec, lru +
+				(lru_gen_is_active(lruvec, type, new_gen) ?
+				 LRU_ACTIVE : 0), zone, delta);
+	}
+}
+
+static __always_inline bool lru_gen_add_page(struct lruvec *lruvec,
+				struct page *page, enum lru_list lru, bool tail)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = page_is_file_lru(page);
+	int zone = page_zonenum(page);
+	unsigned long seq;
+	int gen;
+
+	if (!lru_gen_enabled() || lru == LRU_UNEVICTABLE)
+		return false;
+
+	VM_BUG_ON_PAGE(page_lru_gen(page) >= 0, page);
+
+	/*
+	 * Active pages go to the youngest generation, pages rotated to the
+	 * tail to the oldest one and everything else to the second oldest,
+	 * so that it is not reclaimed before it had a chance to be used.
+	 */
+	if (is_active_lru(lru)) {
+		ClearPageActive(page);
+		seq = lrugen->max_seq[type];
+	} else if (tail) {
+		seq = lrugen->min_seq[type];
+	} else {
+		seq = lrugen->min_seq[type] + 1;
+	}
+	gen = lru_gen_from_seq(seq);
+
+	set_mask_bits(&page->flags, LRU_GEN_MASK,
+		      (gen + 1UL) << LRU_GEN_PGOFF);
+	lru_gen_update_size(lruvec, page, -1, gen);
+	if (tail)
+		list_add_tail(&page->lru, &lrugen->lists[gen][type][zone]);
+	else
+		list_add(&page->lru, &lrugen->lists[gen][type][zone]);
+
+	return true;
+}
+
+static __always_inline bool lru_gen_del_page(struct lruvec *lruvec,
+					     struct page *page)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	lru_gen_update_size(lruvec, page, gen, -1);
+	list_del(&page->lru);
+	set_mask_bits(&page->flags, LRU_GEN_MASK, 0);
+
+	return true;
+}
+
+/* A tail page split off a huge page stays on the list of its head */
+static inline void lru_gen_split_page(struct page *head, struct page *tail)
+{
+	set_mask_bits(&tail->flags, LRU_GEN_MASK, head->flags & LRU_GEN_MASK);
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct lruvec *lruvec, struct page *page,
+				    enum lru_list lru, bool tail)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct lruvec *lruvec, struct page *page)
+{
+	return false;
+}
+
+static inline void lru_gen_split_page(struct page *head, struct page *tail)
+{
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_add_page(lruvec, page, lru, false))
+		return;
+
 	update_lru_size(lruvec, lru, page_zonenum(page), thp_nr_pages(page));
 	list_add(&page->lru, &lruvec->lists[lru]);
 }
@@ -55,6 +197,9 @@ static __always_inline void add_page_to_lru_list(struct page *page,
 static __always_inline void add_page_to_lru_list_tail(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_add_page(lruvec, page, lru, true))
+		return;
+
 	update_lru_size(lruvec, lru, page_zonenum(page), thp_nr_pages(page));
 	list_add_tail(&page->lru, &lruvec->lists[lru]);
 }
@@ -62,6 +207,9 @@ static __always_inline void add_page_to_lru_list_tail(struct page *page,
 static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
+	if (lru_gen_del_page(lruvec, page))
+		return;
+
 	list_del(&page->lru);
 	update_lru_size(lruvec, lru, page_zonenum(page), -thp_nr_pages(page));
 }
@@ -9,6 +9,7 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -99,6 +100,13 @@ struct page {
 			 * 32-bit architectures.
 			 */
 			dma_addr_t dma_addr;
+			/**
+			 * @pp_frag_count: fragments of the page handed out
+			 * by a PP_FLAG_PAGE_FRAG pool and not returned yet.
+			 * Would overlap @mapping on 32-bit architectures
+			 * with 64-bit dma_addr_t, so it is not used there.
+			 */
+			atomic_long_t pp_frag_count;
 		};
 		struct {	/* slab, slob and slub */
 			union {
@@ -371,6 +379,9 @@ struct vm_area_struct {
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
 	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	struct rcu_head vm_rcu;		/* Freed by RCU, see vm_area_free() */
+#endif
 } __randomize_layout;
 
 struct core_thread {
@@ -385,6 +396,7 @@ struct core_state {
 };
 
 struct kioctx_table;
+struct futex_private_hash;
 struct mm_struct {
 	struct {
 		struct vm_area_struct *mmap;		/* list of VMAs */
@@ -445,6 +457,9 @@ struct mm_struct {
 					     * counters
 					     */
 		struct rw_semaphore mmap_lock;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		seqcount_t mmap_seq;	/* Odd while mmap_lock is write held */
+#endif
 
 		struct list_head mmlist; /* List of maybe swapped mm's.	These
 					  * are globally strung together off
@@ -490,6 +505,10 @@ struct mm_struct {
 		spinlock_t			ioctx_lock;
 		struct kioctx_table __rcu	*ioctx_table;
 #endif
+#ifdef CONFIG_FUTEX
+		/* private futex hash, see futex_private_hash_init() */
+		struct futex_private_hash	*futex_hash;
+#endif
 #ifdef CONFIG_MEMCG
 		/*
 		 * "owner" points to a task that is regarded as the canonical
@@ -540,6 +559,24 @@ struct mm_struct {
 		struct uprobes_state uprobes_state;
 #ifdef CONFIG_HUGETLB_PAGE
 		atomic_long_t hugetlb_usage;
+#endif
+#ifdef CONFIG_KSM
+		/* Pages of this mm merged by ksm, see /proc/<pid>/ksm_stat */
+		atomic_long_t ksm_merging_pages;
+		/* rmap_items ksm keeps for this mm */
+		atomic_long_t ksm_rmap_items;
+		/* Only scanned every n-th full scan, kept across fork */
+		unsigned int ksm_scan_interval;
+#endif
+#ifdef CONFIG_LRU_GEN
+		struct {
+			/* on the lru_gen_mm_list of the memcg below */
+			struct list_head list;
+#ifdef CONFIG_MEMCG
+			/* memcg of "owner" when the mm was listed, pinned */
+			struct mem_cgroup *memcg;
+#endif
+		} lru_gen;
 #endif
 		struct work_struct async_put_work;
 	} __randomize_layout;
@@ -772,4 +809,45 @@ typedef struct {
 	unsigned long val;
 } swp_entry_t;
 
+#ifdef CONFIG_LRU_GEN
+/* The address spaces whose page tables are walked to age a memcg */
+struct lru_gen_mm_list {
+	struct list_head fifo;
+	unsigned long nr_mms;
+	spinlock_t lock;
+};
+
+void lru_gen_add_mm(struct mm_struct *mm);
+void lru_gen_del_mm(struct mm_struct *mm);
+#ifdef CONFIG_MEMCG
+void lru_gen_migrate_mm(struct mm_struct *mm);
+#endif
+
+static inline void lru_gen_init_mm(struct mm_struct *mm)
+{
+	INIT_LIST_HEAD(&mm->lru_gen.list);
+#ifdef CONFIG_MEMCG
+	mm->lru_gen.memcg = NULL;
+#endif
+}
+#else /* !CONFIG_LRU_GEN */
+static inline void lru_gen_add_mm(struct mm_struct *mm)
+{
+}
+
+static inline void lru_gen_del_mm(struct mm_struct *mm)
+{
+}
+
+#ifdef CONFIG_MEMCG
+static inline void lru_gen_migrate_mm(struct mm_struct *mm)
+{
+}
+#endif
+
+static inline void lru_gen_init_mm(struct mm_struct *mm)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 #endif /* _LINUX_MM_TYPES_H */
@@ -207,6 +207,12 @@ enum node_stat_item {
 #if IS_ENABLED(CONFIG_SHADOW_CALL_STACK)
 	NR_KERNEL_SCS_KB,	/* measured in KiB */
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	PGPROMOTE_SUCCESS,	/* pages promoted to this node */
+	PGPROMOTE_CANDIDATE,	/* pages considered for promotion */
+#endif
+	PGDEMOTE_KSWAPD,	/* pages demoted from this node by kswapd */
+	PGDEMOTE_DIRECT,	/* ... and by direct reclaim */
 	NR_VM_NODE_STAT_ITEMS
 };
 
@@ -272,6 +278,35 @@ enum lruvec_flags {
 					 */
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-generational LRU keeps the evictable pages of an lruvec in up
+ * to MAX_NR_GENS generations per type, anon and file. Generation seq lives
+ * in lists[seq % MAX_NR_GENS]. New generations are created by aging, which
+ * walks the page tables of the processes of the memcg and marks the pages
+ * it finds young as referenced. Eviction takes pages from the generations
+ * older than the youngest MIN_NR_GENS, moving the referenced ones to the
+ * youngest generation instead. Page->flags holds gen + 1 for pages on a
+ * generation list, and 0 otherwise.
+ */
+#define MIN_NR_GENS		2U
+#define MAX_NR_GENS		4U
+
+#define LRU_GEN_ANON		0
+#define LRU_GEN_FILE		1
+#define LRU_GEN_TYPES		2
+
+struct lru_gen_struct {
+	/* the youngest and the oldest generation of each type */
+	unsigned long		max_seq[LRU_GEN_TYPES];
+	unsigned long		min_seq[LRU_GEN_TYPES];
+	/* when each generation was created, in jiffies */
+	unsigned long		timestamps[LRU_GEN_TYPES][MAX_NR_GENS];
+	struct list_head	lists[MAX_NR_GENS][LRU_GEN_TYPES][MAX_NR_ZONES];
+	long			nr_pages[MAX_NR_GENS][LRU_GEN_TYPES][MAX_NR_ZONES];
+};
+#endif
+
 struct lruvec {
 	struct list_head		lists[NR_LRU_LISTS];
 	/*
@@ -290,6 +325,9 @@ struct lruvec {
 #ifdef CONFIG_MEMCG
 	struct pglist_data *pgdat;
 #endif
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct lrugen;
+#endif
 };
 
 /* Isolate unmapped pages */
@@ -314,13 +352,28 @@ enum zone_watermarks {
 #define high_wmark_pages(z) (z->_watermark[WMARK_HIGH] + z->watermark_boost)
 #define wmark_pages(z, i) (z->_watermark[i] + z->watermark_boost)
 
+/*
+ * The pcp lists cache pages of order 0 to PAGE_ALLOC_COSTLY_ORDER and, with
+ * THP, of the THP order. Each cached order has one list per migrate type.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define NR_PCP_THP 1
+#else
+#define NR_PCP_THP 0
+#endif
+#define NR_PCP_ORDERS	(PAGE_ALLOC_COSTLY_ORDER + 1 + NR_PCP_THP)
+#define NR_PCP_LISTS	(MIGRATE_PCPTYPES * NR_PCP_ORDERS)
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Number of blocks on the lists, per cached order */
+	int nr_blocks[NR_PCP_ORDERS];
+
+	/* Lists of pages, one per cached order and migrate type */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -506,6 +559,11 @@ struct zone {
 	/* free areas of different sizes */
 	struct free_area	free_area[MAX_ORDER];
 
+#ifdef CONFIG_PAGE_REPORTING
+	/* pages on the free lists that have been reported */
+	unsigned long		reported_pages;
+#endif
+
 	/* zone flags, see below */
 	unsigned long		flags;
 
@@ -784,6 +842,13 @@ typedef struct pglist_data {
 
 	ZONE_PADDING(_pad2_)
 
+#ifdef CONFIG_NUMA_BALANCING
+	/* start of the current promotion rate limit period, in ms */
+	unsigned int		nbp_rl_start;
+	/* PGPROMOTE_CANDIDATE at the start of the period */
+	unsigned long		nbp_rl_nr_cand;
+#endif
+
 	/* Per-node vmstats */
 	struct per_cpu_nodestat __percpu *per_cpu_nodestats;
 	atomic_long_t		vm_stat[NR_VM_NODE_STAT_ITEMS];
@@ -832,6 +897,13 @@ extern void init_currently_empty_zone(struct zone *zone, unsigned long start_pfn
 				     unsigned long size);
 
 extern void lruvec_init(struct lruvec *lruvec);
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_init_lruvec(struct lruvec *lruvec);
+#else
+static inline void lru_gen_init_lruvec(struct lruvec *lruvec)
+{
+}
+#endif
 
 static inline struct pglist_data *lruvec_pgdat(struct lruvec *lruvec)
 {
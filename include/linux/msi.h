@@ -108,6 +108,7 @@ struct msi_desc {
 				u8	maskbit		: 1;
 				u8	is_64		: 1;
 				u8	is_virtual	: 1;
+				u8	is_dynamic	: 1;
 				u16	entry_nr;
 				unsigned default_irq;
 			} msi_attrib;
@@ -330,6 +331,9 @@ struct irq_domain *msi_create_irq_domain(struct fwnode_handle *fwnode,
 int msi_domain_alloc_irqs(struct irq_domain *domain, struct device *dev,
 			  int nvec);
 void msi_domain_free_irqs(struct irq_domain *domain, struct device *dev);
+int msi_domain_alloc_irq_desc(struct irq_domain *domain, struct device *dev,
+			      struct msi_desc *desc);
+void msi_domain_free_irq_desc(struct irq_domain *domain, struct msi_desc *desc);
 struct msi_domain_info *msi_get_domain_info(struct irq_domain *domain);
 
 struct irq_domain *platform_msi_create_irq_domain(struct fwnode_handle *fwnode,
@@ -18,6 +18,8 @@ struct ip_conntrack_stat {
 	unsigned int expect_create;
 	unsigned int expect_delete;
 	unsigned int search_restart;
+	unsigned int clash_resolve;
+	unsigned int cache_hit;
 };
 
 #define NFCT_INFOMASK	7UL
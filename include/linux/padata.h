@@ -114,12 +114,16 @@ struct parallel_data {
  * @pd: Actual parallel_data structure which may be substituted on the fly.
  * @opd: Pointer to old pd to be freed by padata_replace.
  * @list: List entry in padata_instance list.
+ * @scoped: Whether @scope restricts the CPUs of this shell.
+ * @scope: CPUs to use out of the instance's cpumasks, if @scoped.
  */
 struct padata_shell {
 	struct padata_instance		*pinst;
 	struct parallel_data __rcu	*pd;
 	struct parallel_data		*opd;
 	struct list_head		list;
+	bool				scoped;
+	cpumask_var_t			scope;
 };
 
 /**
@@ -136,6 +140,13 @@ struct padata_shell {
  *             appropriate for one worker thread to do at once.
  * @max_threads: Max threads to use for the job, actual number may be less
  *               depending on task size and minimum chunk size.
+ * @nid: Run the helper threads on CPUs of this node, or anywhere if
+ *       NUMA_NO_NODE.
+ * @flags: PADATA_MT_* flags.
+ *
+ * Each thread starts on its own contiguous part of the job and then steals
+ * from the thread with the most work left.  CPU time helper threads spend on
+ * a job started by a user task is charged to that task's cgroup.
  */
 struct padata_mt_job {
 	void (*thread_fn)(unsigned long start, unsigned long end, void *arg);
@@ -145,14 +156,23 @@ struct padata_mt_job {
 	unsigned long		align;
 	unsigned long		min_chunk;
 	int			max_threads;
+	int			nid;
+	unsigned int		flags;
 };
 
+/*
+ * With nid == NUMA_NO_NODE, queue the helpers round robin on all nodes with
+ * CPUs, for jobs touching memory on all of them.
+ */
+#define PADATA_MT_SPREAD	0x1
+
 /**
  * struct padata_instance - The overall control structure.
  *
  * @cpu_online_node: Linkage for CPU online callback.
  * @cpu_dead_node: Linkage for CPU offline callback.
  * @parallel_wq: The workqueue used for parallel work.
+ * @parallel_pcpu_wq: The workqueue used for parallel work of scoped shells.
  * @serial_wq: The workqueue used for serial work.
  * @pslist: List of padata_shell objects attached to this instance.
  * @cpumask: User supplied cpumasks for parallel and serial works.
@@ -164,6 +184,7 @@ struct padata_instance {
 	struct hlist_node		cpu_online_node;
 	struct hlist_node		cpu_dead_node;
 	struct workqueue_struct		*parallel_wq;
+	struct workqueue_struct		*parallel_pcpu_wq;
 	struct workqueue_struct		*serial_wq;
 	struct list_head		pslist;
 	struct padata_cpumask		cpumask;
@@ -184,11 +205,13 @@ static inline void __init padata_init(void) {}
 extern struct padata_instance *padata_alloc(const char *name);
 extern void padata_free(struct padata_instance *pinst);
 extern struct padata_shell *padata_alloc_shell(struct padata_instance *pinst);
+extern struct padata_shell *padata_alloc_shell_scoped(struct padata_instance *pinst,
+						      const struct cpumask *scope);
 extern void padata_free_shell(struct padata_shell *ps);
 extern int padata_do_parallel(struct padata_shell *ps,
 			      struct padata_priv *padata, int *cb_cpu);
 extern void padata_do_serial(struct padata_priv *padata);
-extern void __init padata_do_multithreaded(struct padata_mt_job *job);
+extern void padata_do_multithreaded(struct padata_mt_job *job);
 extern int padata_set_cpumask(struct padata_instance *pinst, int cpumask_type,
 			      cpumask_var_t cpumask);
 #endif
@@ -18,6 +18,22 @@ struct page_reporting_dev_info {
 
 	/* Current state of page reporting */
 	atomic_t state;
+
+	/* Minimum order of the pages reported, 0 for pageblock_order */
+	unsigned int order;
+
+	/* Delay between reporting passes in milliseconds, 0 for 2 seconds */
+	unsigned int delay_ms;
+
+	/* Maximum number of pages reported per second, 0 for no limit */
+	unsigned long rate;
+
+	/* Pages the current pass may still report when rate limited */
+	long budget;
+
+	/* Pages reported, and reported pages allocated again afterwards */
+	atomic_long_t reported_pages;
+	atomic_long_t reused_pages;
 };
 
 /* Tear-down and bring-up for page reporting devices */
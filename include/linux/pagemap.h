@@ -29,6 +29,7 @@ enum mapping_flags {
 	AS_EXITING	= 4, 	/* final truncate in progress */
 	/* writeback related tags are not used */
 	AS_NO_WRITEBACK_TAGS = 5,
+	AS_LARGE_PAGES	= 6,	/* readahead may add THPs to the cache */
 };
 
 /**
@@ -98,6 +99,21 @@ static inline int mapping_use_writeback_tags(struct address_space *mapping)
 	return !test_bit(AS_NO_WRITEBACK_TAGS, &mapping->flags);
 }
 
+/*
+ * The filesystem handles THPs in ->readahead, ->readpage and the other
+ * page cache operations, so readahead may allocate them for this mapping.
+ */
+static inline void mapping_set_large_pages(struct address_space *mapping)
+{
+	set_bit(AS_LARGE_PAGES, &mapping->flags);
+}
+
+static inline bool mapping_large_pages(struct address_space *mapping)
+{
+	return IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE) &&
+		test_bit(AS_LARGE_PAGES, &mapping->flags);
+}
+
 static inline gfp_t mapping_gfp_mask(struct address_space * mapping)
 {
 	return mapping->gfp_mask;
@@ -1476,6 +1476,9 @@ int pci_alloc_irq_vectors_affinity(struct pci_dev *dev, unsigned int min_vecs,
 
 void pci_free_irq_vectors(struct pci_dev *dev);
 int pci_irq_vector(struct pci_dev *dev, unsigned int nr);
+int pci_msix_alloc_irq_at(struct pci_dev *dev, unsigned int index,
+			  const struct irq_affinity_desc *affdesc);
+void pci_msix_free_irq(struct pci_dev *dev, int irq);
 const struct cpumask *pci_irq_get_affinity(struct pci_dev *pdev, int vec);
 
 #else
@@ -1514,6 +1517,10 @@ static inline int pci_irq_vector(struct pci_dev *dev, unsigned int nr)
 		return -EINVAL;
 	return dev->irq;
 }
+static inline int pci_msix_alloc_irq_at(struct pci_dev *dev, unsigned int index,
+			const struct irq_affinity_desc *affdesc)
+{ return -ENOSYS; }
+static inline void pci_msix_free_irq(struct pci_dev *dev, int irq) { }
 static inline const struct cpumask *pci_irq_get_affinity(struct pci_dev *pdev,
 		int vec)
 {
@@ -30,6 +30,8 @@ int psi_show(struct seq_file *s, struct psi_group *group, enum psi_res res);
 int psi_cgroup_alloc(struct cgroup *cgrp);
 void psi_cgroup_free(struct cgroup *cgrp);
 void cgroup_move_task(struct task_struct *p, struct css_set *to);
+void psi_rstat_flush(struct cgroup *cgrp, int cpu);
+int psi_show_tree(struct seq_file *s, struct cgroup *cgrp);
 
 struct psi_trigger *psi_trigger_create(struct psi_group *group,
 			char *buf, size_t nbytes, enum psi_res res);
@@ -58,6 +60,9 @@ static inline void cgroup_move_task(struct task_struct *p, struct css_set *to)
 {
 	rcu_assign_pointer(p->cgroups, to);
 }
+static inline void psi_rstat_flush(struct cgroup *cgrp, int cpu)
+{
+}
 #endif
 
 #endif /* CONFIG_PSI */
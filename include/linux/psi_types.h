@@ -84,6 +84,17 @@ struct psi_group_cpu {
 	/* Delta detection against the sampling buckets */
 	u32 times_prev[NR_PSI_AGGREGATORS][NR_PSI_STATES]
 			____cacheline_aligned_in_smp;
+
+	/* 3rd cacheline updated by the rstat flush in lazy mode */
+
+	/* Times of this group and its descendants */
+	u32 tree_times[NR_PSI_STATES] ____cacheline_aligned_in_smp;
+
+	/* Own times already folded into tree_times */
+	u32 tree_own[NR_PSI_STATES];
+
+	/* tree_times already folded into the parent's */
+	u32 tree_pushed[NR_PSI_STATES];
 };
 
 /* PSI growth tracking window */
@@ -13,6 +13,8 @@
 #define __PSP_SEV_H__
 
 #include <uapi/linux/psp-sev.h>
+#include <linux/completion.h>
+#include <linux/list.h>
 
 #ifdef CONFIG_X86
 #include <linux/mem_encrypt.h>
@@ -483,6 +485,27 @@ struct sev_data_dbg {
 	u32 len;				/* In */
 } __packed;
 
+/**
+ * struct sev_async_cmd - SEV command queued with sev_issue_cmd_external_user_async()
+ *
+ * @entry: link in the PSP command queue
+ * @cmd: command to issue
+ * @data: command buffer, must stay valid until the command completes
+ * @psp_ret: SEV command return code
+ * @ret: result, as returned by sev_issue_cmd_external_user()
+ * @queued_ns: time the command was queued
+ * @done: completed once the PSP has processed the command
+ */
+struct sev_async_cmd {
+	struct list_head entry;
+	unsigned int cmd;
+	void *data;
+	int psp_ret;
+	int ret;
+	u64 queued_ns;
+	struct completion done;
+};
+
 #ifdef CONFIG_CRYPTO_DEV_SP_PSP
 
 /**
@@ -538,6 +561,38 @@ int sev_platform_status(struct sev_user_data_status *status, int *error);
 int sev_issue_cmd_external_user(struct file *filep, unsigned int id,
 				void *data, int *error);
 
+/**
+ * sev_issue_cmd_external_user_async - queue SEV command by other driver with
+ * a file handle.
+ *
+ * Like sev_issue_cmd_external_user(), but returns once @acmd->cmd is queued
+ * instead of waiting for the PSP. Queued commands are executed in order,
+ * interleaved with synchronous commands issued by other callers. The caller
+ * must wait for @acmd with sev_async_cmd_wait() before reusing it or its
+ * command buffer.
+ *
+ * @filep - SEV device file pointer
+ * @acmd - command to queue, with @cmd and @data filled in
+ *
+ * Returns:
+ * 0 if the command was queued
+ * -%ENODEV    if the SEV device is not available
+ * -%EBUSY     if the PSP is not responding
+ * -%EBADF     if the SEV file descriptor is not valid
+ */
+int sev_issue_cmd_external_user_async(struct file *filep,
+				      struct sev_async_cmd *acmd);
+
+/**
+ * sev_async_cmd_wait - wait for a queued SEV command to complete
+ *
+ * @acmd - command queued with sev_issue_cmd_external_user_async()
+ * @error: SEV command return code
+ *
+ * Returns the same values as sev_issue_cmd_external_user().
+ */
+int sev_async_cmd_wait(struct sev_async_cmd *acmd, int *error);
+
 /**
  * sev_guest_deactivate - perform SEV DEACTIVATE command
  *
@@ -620,6 +675,11 @@ static inline int sev_guest_df_flush(int *error) { return -ENODEV; }
 static inline int
 sev_issue_cmd_external_user(struct file *filep, unsigned int id, void *data, int *error) { return -ENODEV; }
 
+static inline int
+sev_issue_cmd_external_user_async(struct file *filep, struct sev_async_cmd *acmd) { return -ENODEV; }
+
+static inline int sev_async_cmd_wait(struct sev_async_cmd *acmd, int *error) { return -ENODEV; }
+
 static inline void *psp_copy_user_blob(u64 __user uaddr, u32 len) { return ERR_PTR(-EINVAL); }
 
 #endif	/* CONFIG_CRYPTO_DEV_SP_PSP */
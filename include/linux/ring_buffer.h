@@ -196,6 +196,9 @@ void ring_buffer_free_read_page(struct trace_buffer *buffer, int cpu, void *data
 int ring_buffer_read_page(struct trace_buffer *buffer, void **data_page,
 			  size_t len, int cpu, int full);
 
+unsigned int ring_buffer_subbuf_size_get(struct trace_buffer *buffer);
+int ring_buffer_subbuf_order_set(struct trace_buffer *buffer, int order);
+
 struct trace_seq;
 
 int ring_buffer_print_entry_header(struct trace_seq *s);
@@ -414,6 +414,21 @@ int __sbitmap_queue_get(struct sbitmap_queue *sbq);
 int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 				unsigned int shallow_depth);
 
+/**
+ * __sbitmap_queue_get_batch() - Try to allocate a batch of free bits from a
+ * &struct sbitmap_queue with preemption already disabled.
+ * @sbq: Bitmap queue to allocate from.
+ * @nr_tags: Number of bits wanted, at most %BITS_PER_LONG.
+ * @offset: Set to the bit number that bit 0 of the returned mask stands for.
+ *
+ * The bits are taken from a single word with one atomic operation, so fewer
+ * than @nr_tags may be returned. Not supported for round robin allocation.
+ *
+ * Return: Mask of the allocated bits relative to @offset, 0 if none.
+ */
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset);
+
 /**
  * sbitmap_queue_get() - Try to allocate a free bit from a &struct
  * sbitmap_queue.
@@ -477,6 +492,20 @@ static inline int sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 void sbitmap_queue_min_shallow_depth(struct sbitmap_queue *sbq,
 				     unsigned int min_shallow_depth);
 
+/**
+ * sbitmap_queue_clear_batch() - Free a batch of allocated bits and wake up
+ * waiters on a &struct sbitmap_queue.
+ * @sbq: Bitmap to free from.
+ * @offset: Offset to subtract from each entry of @tags.
+ * @tags: Bit numbers to free, plus @offset.
+ * @nr_tags: Number of entries in @tags.
+ *
+ * Bits sharing a word are cleared with a single atomic operation, so this is
+ * cheapest when @tags is roughly sorted.
+ */
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+				int *tags, int nr_tags);
+
 /**
  * sbitmap_queue_clear() - Free an allocated bit and wake up waiters on a
  * &struct sbitmap_queue.
@@ -22,6 +22,18 @@ extern void set_numabalancing_state(bool enabled);
 extern void task_numa_free(struct task_struct *p, bool final);
 extern bool should_numa_migrate_memory(struct task_struct *p, struct page *page,
 					int src_nid, int dst_cpu);
+
+/*
+ * Hardware sampling of memory accesses as an alternative to PTE scanning,
+ * selected per process with PR_SET_NUMA_SOURCE. The architecture provides
+ * a sampler that calls task_numa_sample() from NMI context for accesses
+ * of current.
+ */
+extern void task_numa_sample(unsigned long addr, phys_addr_t paddr);
+extern int task_numa_set_samples(bool enable);
+extern void task_numa_mm_exit(struct mm_struct *mm);
+extern int arch_numa_sampling_start(void);
+extern void arch_numa_sampling_stop(void);
 #else
 static inline void task_numa_fault(int last_node, int node, int pages,
 				   int flags)
@@ -42,6 +54,16 @@ static inline bool should_numa_migrate_memory(struct task_struct *p,
 {
 	return true;
 }
+static inline void task_numa_sample(unsigned long addr, phys_addr_t paddr)
+{
+}
+static inline int task_numa_set_samples(bool enable)
+{
+	return -EINVAL;
+}
+static inline void task_numa_mm_exit(struct mm_struct *mm)
+{
+}
 #endif
 
 #endif /* _LINUX_SCHED_NUMA_BALANCING_H */
@@ -6,6 +6,18 @@
 
 #include <linux/sched/idle.h>
 
+/*
+ * Topology distance of a task migration, as counted in the schedstats
+ * and reported by the sched_migrate_level tracepoint.
+ */
+enum sched_migrate_level {
+	SCHED_MIGRATE_SMT,		/* to an SMT sibling */
+	SCHED_MIGRATE_LLC,		/* to another core sharing the LLC */
+	SCHED_MIGRATE_NODE,		/* to another LLC of the node */
+	SCHED_MIGRATE_REMOTE,		/* to another node */
+	NR_SCHED_MIGRATE_LEVELS,
+};
+
 /*
  * sched-domains (multiprocessor balancing) declarations:
  */
@@ -82,8 +94,23 @@ struct sched_domain_shared {
 	atomic_t	ref;
 	atomic_t	nr_busy_cpus;
 	int		has_idle_cores;
+
+	/*
+	 * Fully idle cores of this LLC, one bit per core at its first SMT
+	 * sibling; maintained from the idle task's entry and exit.
+	 *
+	 * NOTE: this field is variable length. (Allocated dynamically
+	 * by attaching extra space to the end of the structure,
+	 * depending on how many CPUs the kernel has booted up with)
+	 */
+	unsigned long	idle_cores[];
 };
 
+static inline struct cpumask *sds_idle_cores(struct sched_domain_shared *sds)
+{
+	return to_cpumask(sds->idle_cores);
+}
+
 struct sched_domain {
 	/* These fields must be setup */
 	struct sched_domain __rcu *parent;	/* top domain must be null terminated */
@@ -459,7 +459,12 @@ enum {
  * false on data copy or out of memory error caused by data copy attempt.
  * The ctx field is used to track device context.
  * The desc field is used to track userspace buffer index.
+ *
+ * With UBUF_F_DONT_ORPHAN the frags only hold page references, like those of
+ * MSG_ZEROCOPY, so they may be shared between skbs instead of copied.
  */
+#define UBUF_F_DONT_ORPHAN	(1U << 0)
+
 struct ubuf_info {
 	void (*callback)(struct ubuf_info *, bool zerocopy_success);
 	union {
@@ -475,6 +480,7 @@ struct ubuf_info {
 		};
 	};
 	refcount_t refcnt;
+	u8 flags;
 
 	struct mmpin {
 		struct user_struct *user;
@@ -2757,7 +2763,8 @@ static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
 	if (likely(!skb_zcopy(skb)))
 		return 0;
 	if (!skb_zcopy_is_nouarg(skb) &&
-	    skb_uarg(skb)->callback == sock_zerocopy_callback)
+	    (skb_uarg(skb)->callback == sock_zerocopy_callback ||
+	     skb_uarg(skb)->flags & UBUF_F_DONT_ORPHAN))
 		return 0;
 	return skb_copy_ubufs(skb, gfp_mask);
 }
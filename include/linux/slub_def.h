@@ -37,6 +37,8 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	FREE_REMOTE,		/* Free to a slab on a remote node */
+	FREE_REMOTE_FLUSH,	/* Remote free sheaf flushed */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -77,6 +79,8 @@ struct kmem_cache_order_objects {
 	unsigned int x;
 };
 
+struct slub_remote_sheaf;
+
 /*
  * Slab cache management.
  */
@@ -118,6 +122,8 @@ struct kmem_cache {
 	 * Defragmentation by allocating from a remote node.
 	 */
 	unsigned int remote_node_defrag_ratio;
+	/* Frees to remote nodes batched per cpu, see slub_remote_sheaves */
+	struct slub_remote_sheaf __percpu *remote_sheaves;
 #endif
 
 #ifdef CONFIG_SLAB_FREELIST_RANDOM
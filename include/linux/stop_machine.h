@@ -121,6 +121,9 @@ int stop_machine_cpuslocked(cpu_stop_fn_t fn, void *data, const struct cpumask *
 
 int stop_machine_from_inactive_cpu(cpu_stop_fn_t fn, void *data,
 				   const struct cpumask *cpus);
+
+int stop_cpus_cpuslocked(const struct cpumask *cpus, cpu_stop_fn_t fn,
+			 void *data);
 #else	/* CONFIG_SMP || CONFIG_HOTPLUG_CPU */
 
 static inline int stop_machine_cpuslocked(cpu_stop_fn_t fn, void *data,
@@ -146,5 +149,11 @@ static inline int stop_machine_from_inactive_cpu(cpu_stop_fn_t fn, void *data,
 	return stop_machine(fn, data, cpus);
 }
 
+static inline int stop_cpus_cpuslocked(const struct cpumask *cpus,
+				       cpu_stop_fn_t fn, void *data)
+{
+	return stop_machine_cpuslocked(fn, data, cpus);
+}
+
 #endif	/* CONFIG_SMP || CONFIG_HOTPLUG_CPU */
 #endif	/* _LINUX_STOP_MACHINE */
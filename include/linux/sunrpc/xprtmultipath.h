@@ -16,6 +16,8 @@ struct rpc_xprt_switch {
 
 	unsigned int		xps_nxprts;
 	unsigned int		xps_nactive;
+	unsigned int		xps_nwant;
+	unsigned long		xps_scale_time;
 	atomic_long_t		xps_queuelen;
 	struct list_head	xps_xprt_list;
 
@@ -47,6 +49,7 @@ extern struct rpc_xprt_switch *xprt_switch_get(struct rpc_xprt_switch *xps);
 extern void xprt_switch_put(struct rpc_xprt_switch *xps);
 
 extern void rpc_xprt_switch_set_roundrobin(struct rpc_xprt_switch *xps);
+extern void rpc_xprt_switch_set_leastqueued(struct rpc_xprt_switch *xps);
 
 extern void rpc_xprt_switch_add_xprt(struct rpc_xprt_switch *xps,
 		struct rpc_xprt *xprt);
@@ -365,6 +365,9 @@ struct tcp_sock {
 
 	u32 rcv_ooopack; /* Received out-of-order packets, for tcpinfo */
 
+	u64 zc_rcv_mapped; /* Bytes mapped by TCP_ZEROCOPY_RECEIVE, for tcpinfo */
+	u64 zc_rcv_copied; /* Bytes it copied instead, for tcpinfo */
+
 /* Receiver side RTT estimation */
 	u32 rcv_rtt_last_tsecr;
 	struct {
@@ -247,6 +247,17 @@ __copy_from_user_inatomic_nocache(void *to, const void __user *from,
 
 #endif		/* ARCH_HAS_NOCACHE_UACCESS */
 
+#ifndef ARCH_HAS_STREAM_UACCESS
+
+static inline __must_check unsigned long
+raw_copy_to_user_stream(void __user *to, const void *from, unsigned long n,
+			unsigned long stream)
+{
+	return raw_copy_to_user(to, from, n);
+}
+
+#endif		/* ARCH_HAS_STREAM_UACCESS */
+
 extern __must_check int check_zeroed_user(const void __user *from, size_t size);
 
 /**
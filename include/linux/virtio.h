@@ -68,6 +68,10 @@ void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len);
 void *virtqueue_get_buf_ctx(struct virtqueue *vq, unsigned int *len,
 			    void **ctx);
 
+unsigned int virtqueue_get_buf_batch(struct virtqueue *vq, void **bufs,
+				     unsigned int *lens, void **ctxs,
+				     unsigned int max);
+
 void virtqueue_disable_cb(struct virtqueue *vq);
 
 bool virtqueue_enable_cb(struct virtqueue *vq);
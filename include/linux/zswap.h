@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_ZSWAP_H
+#define _LINUX_ZSWAP_H
+
+struct mem_cgroup;
+struct seq_file;
+
+#if defined(CONFIG_ZSWAP) && defined(CONFIG_MEMCG_KMEM)
+
+int zswap_memcg_set_compressor(struct mem_cgroup *memcg, char *name);
+void zswap_memcg_show_compressor(struct seq_file *m, struct mem_cgroup *memcg);
+void zswap_memcg_offline(struct mem_cgroup *memcg);
+
+#else
+
+static inline void zswap_memcg_offline(struct mem_cgroup *memcg)
+{
+}
+
+#endif
+
+#endif /* _LINUX_ZSWAP_H */
@@ -6,6 +6,7 @@
 #include <linux/netdevice.h>
 #include <linux/rhashtable-types.h>
 #include <linux/rcupdate.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter/nf_conntrack_tuple_common.h>
 #include <net/flow_offload.h>
@@ -66,6 +67,12 @@ enum nf_flowtable_flags {
 	NF_FLOWTABLE_COUNTER		= 0x2,	/* NFT_FLOWTABLE_COUNTER */
 };
 
+struct nf_flow_table_stat {
+	u64				hit;
+	u64				miss;
+	struct u64_stats_sync		syncp;
+};
+
 struct nf_flowtable {
 	struct list_head		list;
 	struct rhashtable		rhashtable;
@@ -76,6 +83,7 @@ struct nf_flowtable {
 	struct flow_block		flow_block;
 	struct rw_semaphore		flow_block_lock; /* Guards flow_block */
 	possible_net_t			net;
+	struct nf_flow_table_stat __percpu *stat;
 };
 
 static inline bool nf_flowtable_hw_offload(struct nf_flowtable *flowtable)
@@ -83,6 +91,44 @@ static inline bool nf_flowtable_hw_offload(struct nf_flowtable *flowtable)
 	return flowtable->flags & NF_FLOWTABLE_HW_OFFLOAD;
 }
 
+static inline void nf_flow_table_stat_inc(struct nf_flowtable *flowtable,
+					  bool hit)
+{
+	struct nf_flow_table_stat *stat = this_cpu_ptr(flowtable->stat);
+
+	u64_stats_update_begin(&stat->syncp);
+	if (hit)
+		stat->hit++;
+	else
+		stat->miss++;
+	u64_stats_update_end(&stat->syncp);
+}
+
+/* Sum of the software fast path counters of all cpus */
+static inline void nf_flow_table_stats(const struct nf_flowtable *flowtable,
+				       u64 *hit, u64 *miss)
+{
+	int cpu;
+
+	*hit = 0;
+	*miss = 0;
+	for_each_possible_cpu(cpu) {
+		const struct nf_flow_table_stat *stat;
+		unsigned int start;
+		u64 h, m;
+
+		stat = per_cpu_ptr(flowtable->stat, cpu);
+		do {
+			start = u64_stats_fetch_begin_irq(&stat->syncp);
+			h = stat->hit;
+			m = stat->miss;
+		} while (u64_stats_fetch_retry_irq(&stat->syncp, start));
+
+		*hit += h;
+		*miss += m;
+	}
+}
+
 enum flow_offload_tuple_dir {
 	FLOW_OFFLOAD_DIR_ORIGINAL = IP_CT_DIR_ORIGINAL,
 	FLOW_OFFLOAD_DIR_REPLY = IP_CT_DIR_REPLY,
@@ -86,10 +86,14 @@ struct nf_ip_net {
 #endif
 };
 
+/* Direct mapped cache of the entries recently looked up on a cpu, by hash */
+#define NF_CT_LOOKUP_CACHE_SIZE	64
+
 struct ct_pcpu {
 	spinlock_t		lock;
 	struct hlist_nulls_head unconfirmed;
 	struct hlist_nulls_head dying;
+	struct nf_conntrack_tuple_hash *lookup_cache[NF_CT_LOOKUP_CACHE_SIZE];
 };
 
 struct netns_ct {
@@ -45,7 +45,21 @@
 					* Please note DMA-sync-for-CPU is still
 					* device driver responsibility
 					*/
-#define PP_FLAG_ALL		(PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV)
+#define PP_FLAG_PAGE_FRAG	BIT(2) /* for page frag feature */
+#define PP_FLAG_DMA_SHARED	BIT(3) /* Take pages from the shared DMA
+					* pool while it has some, see
+					* dma_alloc_shared_page()
+					*/
+#define PP_FLAG_ALL		(PP_FLAG_DMA_MAP |\
+				 PP_FLAG_DMA_SYNC_DEV |\
+				 PP_FLAG_PAGE_FRAG |\
+				 PP_FLAG_DMA_SHARED)
+
+/* struct page has room for the fragment count only next to a dma_addr_t
+ * that fits in a long, see page_pool_init().
+ */
+#define PAGE_POOL_DMA_USE_PP_FRAG_COUNT	\
+		(sizeof(dma_addr_t) > sizeof(unsigned long))
 
 /*
  * Fast allocation side cache array/stack
@@ -68,6 +82,58 @@ struct pp_alloc_cache {
 	void *cache[PP_ALLOC_CACHE_SIZE];
 };
 
+/*
+ * Per-CPU return cache
+ *
+ * Pages are usually freed on the CPU that consumed the skb, which is
+ * not the CPU running RX-NAPI for the pool.  Rather than taking the
+ * ptr_ring producer lock for every page, such frees are collected in a
+ * small per-CPU array that is flushed into the ring in one go.  The
+ * lock only protects against the pool being scrubbed from another CPU
+ * and is otherwise uncontended.
+ */
+#define PP_RECYCLE_CACHE_SIZE	16
+struct pp_recycle_cache {
+	spinlock_t lock;
+	u32 count;
+	void *cache[PP_RECYCLE_CACHE_SIZE];
+};
+
+#ifdef CONFIG_PAGE_POOL_STATS
+struct page_pool_alloc_stats {
+	u64 fast; /* fast path allocations */
+	u64 slow; /* slow-path order 0 allocations */
+	u64 slow_high_order; /* slow-path high order allocations */
+	u64 empty; /* failed refills due to empty ptr ring, forcing
+		    * slow path allocation
+		    */
+	u64 refill; /* allocations via successful refill */
+	u64 waive;  /* failed refills due to numa zone mismatch */
+};
+
+struct page_pool_recycle_stats {
+	u64 cached;	/* recycling placed page in the alloc cache */
+	u64 cache_full; /* alloc cache was full */
+	u64 percpu;	/* recycling placed page in a per-CPU return cache */
+	u64 ring;	/* recycling placed page back into the ptr ring */
+	u64 ring_full;	/* page was released from page-pool because
+			 * the ptr ring was full
+			 */
+	u64 released_refcnt; /* page released because of elevated
+			      * refcnt
+			      */
+};
+
+/* This struct wraps the above stats structs so users of the
+ * page_pool_get_stats API can pass a single argument when requesting the
+ * stats for the page pool.
+ */
+struct page_pool_stats {
+	struct page_pool_alloc_stats alloc_stats;
+	struct page_pool_recycle_stats recycle_stats;
+};
+#endif
+
 struct page_pool_params {
 	unsigned int	flags;
 	unsigned int	order;
@@ -87,6 +153,10 @@ struct page_pool {
 	unsigned long defer_start;
 	unsigned long defer_warn;
 
+	struct page *frag_page;
+	unsigned int frag_offset;
+	long frag_users;
+
 	u32 pages_state_hold_cnt;
 
 	/*
@@ -104,6 +174,11 @@ struct page_pool {
 	 */
 	struct pp_alloc_cache alloc ____cacheline_aligned_in_smp;
 
+#ifdef CONFIG_PAGE_POOL_STATS
+	/* these stats are incremented while in softirq context */
+	struct page_pool_alloc_stats alloc_stats;
+#endif
+
 	/* Data structure for storing recycled pages.
 	 *
 	 * Returning/freeing pages is more complicated synchronization
@@ -113,12 +188,28 @@ struct page_pool {
 	 * Use ptr_ring, as it separates consumer and producer
 	 * effeciently, it a way that doesn't bounce cache-lines.
 	 *
-	 * TODO: Implement bulk return pages into this structure.
+	 * Frees outside the allocation side are batched through the
+	 * per-CPU recycle caches, recycle_batch pages at a time (zero
+	 * when the ring is too small to give every CPU a batch).
 	 */
 	struct ptr_ring ring;
+	struct pp_recycle_cache __percpu *recycle;
+	unsigned int recycle_batch;
+
+#ifdef CONFIG_PAGE_POOL_STATS
+	/* recycle stats are per-cpu to avoid locking */
+	struct page_pool_recycle_stats __percpu *recycle_stats;
+#endif
 
 	atomic_t pages_state_release_cnt;
 
+	/* Pages of the shared DMA pool that were released while the
+	 * stack still held them.  They stay in-flight until the pool
+	 * holds their only reference again, linked through page->lru.
+	 */
+	spinlock_t shared_lock;
+	struct list_head shared_parked;
+
 	/* A page_pool is strictly tied to a single RX-queue being
 	 * protected by NAPI, due to above pp_alloc_cache. This
 	 * refcnt serves purpose is to simplify drivers error handling.
@@ -137,6 +228,18 @@ static inline struct page *page_pool_dev_alloc_pages(struct page_pool *pool)
 	return page_pool_alloc_pages(pool, gfp);
 }
 
+struct page *page_pool_alloc_frag(struct page_pool *pool, unsigned int *offset,
+				  unsigned int size, gfp_t gfp);
+
+static inline struct page *page_pool_dev_alloc_frag(struct page_pool *pool,
+						    unsigned int *offset,
+						    unsigned int size)
+{
+	gfp_t gfp = (GFP_ATOMIC | __GFP_NOWARN);
+
+	return page_pool_alloc_frag(pool, offset, size, gfp);
+}
+
 /* get the stored dma direction. A driver might decide to treat this locally and
  * avoid the extra cache line from page_pool to determine the direction
  */
@@ -146,6 +249,37 @@ inline enum dma_data_direction page_pool_get_dma_dir(struct page_pool *pool)
 	return pool->p.dma_dir;
 }
 
+#ifdef CONFIG_PAGE_POOL_STATS
+int page_pool_ethtool_stats_get_count(void);
+u8 *page_pool_ethtool_stats_get_strings(u8 *data);
+u64 *page_pool_ethtool_stats_get(u64 *data, void *stats);
+
+/*
+ * Drivers that wish to harvest page pool stats and report them to users
+ * (perhaps via ethtool, debugfs, or another mechanism) can allocate a
+ * struct page_pool_stats and call page_pool_get_stats to get the stats.
+ * The stats are added to @stats, so the stats of several pools can be
+ * summed up.
+ */
+bool page_pool_get_stats(struct page_pool *pool,
+			 struct page_pool_stats *stats);
+#else
+static inline int page_pool_ethtool_stats_get_count(void)
+{
+	return 0;
+}
+
+static inline u8 *page_pool_ethtool_stats_get_strings(u8 *data)
+{
+	return data;
+}
+
+static inline u64 *page_pool_ethtool_stats_get(u64 *data, void *stats)
+{
+	return data;
+}
+#endif
+
 struct page_pool *page_pool_create(const struct page_pool_params *params);
 
 #ifdef CONFIG_PAGE_POOL
@@ -194,6 +328,31 @@ static inline dma_addr_t page_pool_get_dma_addr(struct page *page)
 	return page->dma_addr;
 }
 
+/* Set the number of fragments of a page of a PP_FLAG_PAGE_FRAG pool.  A
+ * page a driver got from page_pool_alloc_pages() on such a pool must be
+ * given a count of one before it is returned with page_pool_put_page().
+ */
+static inline void page_pool_fragment_page(struct page *page, long nr)
+{
+	atomic_long_set(&page->pp_frag_count, nr);
+}
+
+static inline long page_pool_atomic_sub_frag_count_return(struct page *page,
+							  long nr)
+{
+	long ret;
+
+	/* Returning the last fragments is the common case, and does not
+	 * need the atomic operation as nobody else holds a fragment.
+	 */
+	if (atomic_long_read(&page->pp_frag_count) == nr)
+		return 0;
+
+	ret = atomic_long_sub_return(nr, &page->pp_frag_count);
+	WARN_ON(ret < 0);
+	return ret;
+}
+
 static inline bool is_page_pool_compiled_in(void)
 {
 #ifdef CONFIG_PAGE_POOL
@@ -13,8 +13,13 @@ extern spinlock_t reuseport_lock;
 struct sock_reuseport {
 	struct rcu_head		rcu;
 
-	u16			max_socks;	/* length of socks */
-	u16			num_socks;	/* elements in socks */
+	u16			max_socks;		/* length of socks */
+	u16			num_socks;		/* elements in socks */
+	u16			num_closed_socks;	/* closed elements in socks */
+	/* Listeners that set SO_INCOMING_CPU, selection prefers the one
+	 * whose CPU is processing the SYN.
+	 */
+	u16			incoming_cpu;
 	/* The last synq overflow event timestamp of this
 	 * reuse->socks[] group.
 	 */
@@ -24,6 +29,10 @@ struct sock_reuseport {
 	unsigned int		bind_inany:1;
 	unsigned int		has_conns:1;
 	struct bpf_prog __rcu	*prog;		/* optional BPF sock selector */
+	/* socks[0, num_socks) are listening, and closed TCP listeners whose
+	 * requests may still be migrated are kept at the other end, in
+	 * socks[max_socks - num_closed_socks, max_socks).
+	 */
 	struct sock		*socks[];	/* array of sock pointers */
 };
 
@@ -31,10 +40,14 @@ extern int reuseport_alloc(struct sock *sk, bool bind_inany);
 extern int reuseport_add_sock(struct sock *sk, struct sock *sk2,
 			      bool bind_inany);
 extern void reuseport_detach_sock(struct sock *sk);
+extern void reuseport_stop_listen_sock(struct sock *sk);
+extern void reuseport_update_incoming_cpu(struct sock *sk, int val);
 extern struct sock *reuseport_select_sock(struct sock *sk,
 					  u32 hash,
 					  struct sk_buff *skb,
 					  int hdr_len);
+extern struct sock *reuseport_migrate_sock(struct sock *sk,
+					   struct sock *migrating_sk);
 extern int reuseport_attach_prog(struct sock *sk, struct bpf_prog *prog);
 extern int reuseport_detach_prog(struct sock *sk);
 
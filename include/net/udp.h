@@ -180,6 +180,25 @@ int udp_gro_complete(struct sk_buff *skb, int nhoff, udp_lookup_t lookup);
 struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
 				  netdev_features_t features);
 
+/* Only called for packets made of more than one datagram, so the atomics
+ * are paid once per GRO packet.
+ */
+static inline void udp_gro_account(struct sk_buff *skb)
+{
+	atomic_long_inc(&skb->dev->udp_gro_packets);
+	atomic_long_add(NAPI_GRO_CB(skb)->count, &skb->dev->udp_gro_segs);
+}
+
+/* A socket is only looked up for GRO when a tunnel might want the packet,
+ * or when the device does fraglist GRO, which only aggregates datagrams
+ * that will not be delivered locally, that is forwarded ones.
+ */
+static inline bool udp_gro_lookup_needed(const struct sk_buff *skb,
+					 bool encap_needed)
+{
+	return encap_needed || (skb->dev->features & NETIF_F_GRO_FRAGLIST);
+}
+
 static inline struct udphdr *udp_gro_udphdr(struct sk_buff *skb)
 {
 	struct udphdr *uh;
@@ -54,6 +54,7 @@ struct xdp_sock {
 	struct list_head flush_node;
 	u16 queue_id;
 	bool zc;
+	bool sg;
 	enum {
 		XSK_READY = 0,
 		XSK_BOUND,
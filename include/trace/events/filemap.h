@@ -54,6 +54,58 @@ DEFINE_EVENT(mm_filemap_op_page_cache, mm_filemap_add_to_page_cache,
 	TP_ARGS(page)
 	);
 
+DECLARE_EVENT_CLASS(mm_filemap_stride,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t index, long stride,
+		 unsigned long nr),
+
+	TP_ARGS(mapping, index, stride, nr),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, i_ino)
+		__field(dev_t, s_dev)
+		__field(pgoff_t, index)
+		__field(long, stride)
+		__field(unsigned long, nr)
+	),
+
+	TP_fast_assign(
+		__entry->i_ino = mapping->host->i_ino;
+		if (mapping->host->i_sb)
+			__entry->s_dev = mapping->host->i_sb->s_dev;
+		else
+			__entry->s_dev = mapping->host->i_rdev;
+		__entry->index = index;
+		__entry->stride = stride;
+		__entry->nr = nr;
+	),
+
+	TP_printk("dev %d:%d ino %lx index=%lu stride=%ld nr=%lu",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino, __entry->index, __entry->stride, __entry->nr)
+);
+
+/* @nr predicted pages were read ahead of the fault at @index */
+DEFINE_EVENT(mm_filemap_stride, mm_filemap_stride_readahead,
+	TP_PROTO(struct address_space *mapping, pgoff_t index, long stride,
+		 unsigned long nr),
+	TP_ARGS(mapping, index, stride, nr)
+	);
+
+/* the fault at @index found the page read ahead for it */
+DEFINE_EVENT(mm_filemap_stride, mm_filemap_stride_hit,
+	TP_PROTO(struct address_space *mapping, pgoff_t index, long stride,
+		 unsigned long nr),
+	TP_ARGS(mapping, index, stride, nr)
+	);
+
+/* the stride broke at @index, leaving @nr pages read ahead for nothing */
+DEFINE_EVENT(mm_filemap_stride, mm_filemap_stride_waste,
+	TP_PROTO(struct address_space *mapping, pgoff_t index, long stride,
+		 unsigned long nr),
+	TP_ARGS(mapping, index, stride, nr)
+	);
+
 TRACE_EVENT(filemap_set_wb_err,
 		TP_PROTO(struct address_space *mapping, errseq_t eseq),
 
@@ -20,7 +20,8 @@
 	EM( MR_SYSCALL,		"syscall_or_cpuset")		\
 	EM( MR_MEMPOLICY_MBIND,	"mempolicy_mbind")		\
 	EM( MR_NUMA_MISPLACED,	"numa_misplaced")		\
-	EMe(MR_CONTIG_RANGE,	"contig_range")
+	EM( MR_CONTIG_RANGE,	"contig_range")		\
+	EMe(MR_DEMOTION,	"demotion")
 
 /*
  * First define the enums in the above macros to be exported to userspace
@@ -81,6 +82,30 @@ TRACE_EVENT(mm_migrate_pages,
 		__print_symbolic(__entry->mode, MIGRATE_MODE),
 		__print_symbolic(__entry->reason, MIGRATE_REASON))
 );
+
+TRACE_EVENT(mm_migrate_pages_batch,
+
+	TP_PROTO(unsigned long nr_pages, u64 copy_ns, const char *method),
+
+	TP_ARGS(nr_pages, copy_ns, method),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	nr_pages)
+		__field(	u64,		copy_ns)
+		__string(	method,		method)
+	),
+
+	TP_fast_assign(
+		__entry->nr_pages	= nr_pages;
+		__entry->copy_ns	= copy_ns;
+		__assign_str(method, method);
+	),
+
+	TP_printk("nr_pages=%lu copy_ns=%llu method=%s",
+		__entry->nr_pages,
+		__entry->copy_ns,
+		__get_str(method))
+);
 #endif /* _TRACE_MIGRATE_H */
 
 /* This part must be outside protection */
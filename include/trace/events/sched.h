@@ -6,6 +6,7 @@
 #define _TRACE_SCHED_H
 
 #include <linux/sched/numa_balancing.h>
+#include <linux/sched/topology.h>
 #include <linux/tracepoint.h>
 #include <linux/binfmts.h>
 
@@ -213,6 +214,46 @@ TRACE_EVENT(sched_migrate_task,
 		  __entry->orig_cpu, __entry->dest_cpu)
 );
 
+TRACE_DEFINE_ENUM(SCHED_MIGRATE_SMT);
+TRACE_DEFINE_ENUM(SCHED_MIGRATE_LLC);
+TRACE_DEFINE_ENUM(SCHED_MIGRATE_NODE);
+TRACE_DEFINE_ENUM(SCHED_MIGRATE_REMOTE);
+
+/*
+ * Tracepoint for the topology distance of a task migration:
+ */
+TRACE_EVENT(sched_migrate_level,
+
+	TP_PROTO(struct task_struct *p, int dest_cpu, int level),
+
+	TP_ARGS(p, dest_cpu, level),
+
+	TP_STRUCT__entry(
+		__array(	char,	comm,	TASK_COMM_LEN	)
+		__field(	pid_t,	pid			)
+		__field(	int,	orig_cpu		)
+		__field(	int,	dest_cpu		)
+		__field(	int,	level			)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid		= p->pid;
+		__entry->orig_cpu	= task_cpu(p);
+		__entry->dest_cpu	= dest_cpu;
+		__entry->level		= level;
+	),
+
+	TP_printk("comm=%s pid=%d orig_cpu=%d dest_cpu=%d level=%s",
+		  __entry->comm, __entry->pid,
+		  __entry->orig_cpu, __entry->dest_cpu,
+		  __print_symbolic(__entry->level,
+				   { SCHED_MIGRATE_SMT,		"smt" },
+				   { SCHED_MIGRATE_LLC,		"llc" },
+				   { SCHED_MIGRATE_NODE,	"node" },
+				   { SCHED_MIGRATE_REMOTE,	"remote" }))
+);
+
 DECLARE_EVENT_CLASS(sched_process_template,
 
 	TP_PROTO(struct task_struct *p),
@@ -704,6 +704,48 @@ TRACE_EVENT(balance_dirty_pages,
 	  )
 );
 
+TRACE_EVENT(balance_dirty_pages_latency,
+
+	TP_PROTO(struct bdi_writeback *wb,
+		 u64 lat,
+		 u64 target,
+		 unsigned long dirtied,
+		 long pause),
+
+	TP_ARGS(wb, lat, target, dirtied, pause),
+
+	TP_STRUCT__entry(
+		__array(	 char,	bdi, 32)
+		__field(unsigned long,	lat)
+		__field(unsigned long,	target)
+		__field(unsigned long,	write_bw)
+		__field(unsigned int,	dirtied)
+		__field(	 long,	pause)
+		__field(ino_t,		cgroup_ino)
+	),
+
+	TP_fast_assign(
+		strscpy_pad(__entry->bdi, bdi_dev_name(wb->bdi), 32);
+		__entry->lat		= div_u64(lat, NSEC_PER_USEC);
+		__entry->target		= div_u64(target, NSEC_PER_USEC);
+		__entry->write_bw	= KBps(wb->avg_write_bandwidth);
+		__entry->dirtied	= dirtied;
+		__entry->pause		= pause * 1000 / HZ;
+		__entry->cgroup_ino	= __trace_wb_assign_cgroup(wb);
+	),
+
+	TP_printk("bdi %s: lat=%lu target=%lu write_bw=%lu "
+		  "dirtied=%u pause=%ld cgroup_ino=%lu",
+		  __entry->bdi,
+		  __entry->lat,		/* us */
+		  __entry->target,	/* us */
+		  __entry->write_bw,	/* KBps */
+		  __entry->dirtied,
+		  __entry->pause,	/* ms */
+		  (unsigned long)__entry->cgroup_ino
+	  )
+);
+
 TRACE_EVENT(writeback_sb_inodes_requeue,
 
 	TP_PROTO(struct inode *inode),
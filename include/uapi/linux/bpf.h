@@ -155,6 +155,7 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_DEVMAP_HASH,
 	BPF_MAP_TYPE_STRUCT_OPS,
 	BPF_MAP_TYPE_RINGBUF,
+	BPF_MAP_TYPE_BLOOM_FILTER,
 };
 
 /* Note that tracing related programs such as
@@ -406,6 +407,17 @@ enum {
 	BPF_F_MMAPABLE		= (1U << 10),
 };
 
+/* map_extra of BPF_MAP_TYPE_BLOOM_FILTER: the number of hash functions (0
+ * for the default of 5) and the hash function family.
+ */
+#define BPF_BLOOM_NR_HASHES_MASK	0x0fULL
+#define BPF_BLOOM_HASH_FN_SHIFT		4
+#define BPF_BLOOM_HASH_FN_MASK		(0x0fULL << BPF_BLOOM_HASH_FN_SHIFT)
+enum {
+	BPF_BLOOM_HASH_JHASH	= 0,
+	BPF_BLOOM_HASH_XXHASH	= 1,
+};
+
 /* Flags for BPF_PROG_QUERY. */
 
 /* Query effective (directly attached + inherited from ancestor cgroups)
@@ -463,6 +475,11 @@ union bpf_attr {
 						   * struct stored as the
 						   * map value
 						   */
+		__u64	map_extra;	/* map type specific, see
+					 * BPF_BLOOM_* for the bloom filter,
+					 * sub-rings per NUMA node for the
+					 * ring buffer
+					 */
 	};
 
 	struct { /* anonymous struct used by BPF_MAP_*_ELEM commands */
@@ -3260,6 +3277,21 @@ union bpf_attr {
  * void *bpf_ringbuf_reserve(void *ringbuf, u64 size, u64 flags)
  * 	Description
  * 		Reserve *size* bytes of payload in a ring buffer *ringbuf*.
+ *
+ * 		**BPF_RB_BATCH**\ (*n*) in *flags* reserves *n* records of
+ * 		the same length with a single reservation. The records are
+ * 		laid out as they are in the ring buffer: the first record,
+ * 		followed by **BPF_RINGBUF_HDR_SZ** bytes for the header of the
+ * 		second one, the second record, and so on. *size* thus is
+ * 		*n* \* (*len* + **BPF_RINGBUF_HDR_SZ**) -
+ * 		**BPF_RINGBUF_HDR_SZ** for records of *len* bytes, with *len*
+ * 		a multiple of 8. Record *i* starts at offset *i* \* (*len* +
+ * 		**BPF_RINGBUF_HDR_SZ**), and all of them are submitted or
+ * 		discarded together through the returned pointer.
+ *
+ * 		If *ringbuf* was created with sub-rings per NUMA node in
+ * 		*map_extra*, the space is reserved in a sub-ring of the node
+ * 		of the current CPU.
  * 	Return
  * 		Valid pointer with *size* bytes of memory available; NULL,
  * 		otherwise.
@@ -3289,6 +3321,9 @@ union bpf_attr {
  *		Query various characteristics of provided ring buffer. What
  *		exactly is queries is determined by *flags*:
  *
+ *		For a ring buffer with sub-rings per NUMA node, the values
+ *		are the ones of the sub-ring of the current CPU.
+ *
  *		* **BPF_RB_AVAIL_DATA**: Amount of data not yet consumed.
  *		* **BPF_RB_RING_SIZE**: The size of ring buffer.
  *		* **BPF_RB_CONS_POS**: Consumer position (can wrap around).
@@ -3666,6 +3701,13 @@ enum {
 	BPF_RB_FORCE_WAKEUP		= (1ULL << 1),
 };
 
+/* BPF_FUNC_bpf_ringbuf_reserve flags */
+enum {
+	BPF_RB_BATCH_MASK		= 0xffULL,
+};
+
+#define BPF_RB_BATCH(n)		((__u64)(n) & BPF_RB_BATCH_MASK)
+
 /* BPF_FUNC_bpf_ringbuf_query flags */
 enum {
 	BPF_RB_AVAIL_DATA = 0,
@@ -172,6 +172,13 @@
  *  - add FUSE_WRITE_KILL_PRIV flag
  *  - add FUSE_SETUPMAPPING and FUSE_REMOVEMAPPING
  *  - add map_alignment to fuse_init_out, add FUSE_MAP_ALIGNMENT flag
+ *
+ *  7.32
+ *  - add FUSE_PASSTHROUGH flag, add passthrough_fh to fuse_open_out
+ *  - add FUSE_DEV_IOC_PASSTHROUGH_OPEN
+ *  - add shared memory request rings: FUSE_DEV_IOC_RING_SETUP,
+ *    FUSE_DEV_IOC_RING_ENTER, struct fuse_ring_setup, struct fuse_ring_hdr
+ *    and struct fuse_ring_enter
  */
 
 #ifndef _LINUX_FUSE_H
@@ -207,7 +214,7 @@
 #define FUSE_KERNEL_VERSION 7
 
 /** Minor version number of this interface */
-#define FUSE_KERNEL_MINOR_VERSION 31
+#define FUSE_KERNEL_MINOR_VERSION 32
 
 /** The node ID of the root inode */
 #define FUSE_ROOT_ID 1
@@ -314,6 +321,8 @@ struct fuse_file_lock {
  * FUSE_NO_OPENDIR_SUPPORT: kernel supports zero-message opendir
  * FUSE_EXPLICIT_INVAL_DATA: only invalidate cached pages on explicit request
  * FUSE_MAP_ALIGNMENT: map_alignment field is valid
+ * FUSE_PASSTHROUGH: read/write of files opened with passthrough_fh set go
+ *		     directly to the file registered by the server
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -342,6 +351,7 @@ struct fuse_file_lock {
 #define FUSE_NO_OPENDIR_SUPPORT (1 << 24)
 #define FUSE_EXPLICIT_INVAL_DATA (1 << 25)
 #define FUSE_MAP_ALIGNMENT	(1 << 26)
+#define FUSE_PASSTHROUGH	(1 << 27)
 
 /**
  * CUSE INIT request/reply flags
@@ -591,7 +601,7 @@ struct fuse_create_in {
 struct fuse_open_out {
 	uint64_t	fh;
 	uint32_t	open_flags;
-	uint32_t	padding;
+	uint32_t	passthrough_fh;
 };
 
 struct fuse_release_in {
@@ -868,8 +878,62 @@ struct fuse_notify_retrieve_in {
 	uint64_t	dummy4;
 };
 
+/**
+ * Shared memory request ring
+ *
+ * A ring is set up with FUSE_DEV_IOC_RING_SETUP on a /dev/fuse file
+ * descriptor, normally one cloned with FUSE_DEV_IOC_CLONE for each server
+ * thread, and mapped with mmap() at offset zero.  Synchronous requests
+ * issued on the CPU the ring was set up for are then written to a slot of
+ * the ring instead of being queued for read(), and the slot index is
+ * appended to the submission array (sq) at sq_tail.
+ *
+ * The server consumes submissions from sq_head, writes the reply (a
+ * fuse_out_header followed by the output arguments) to the start of the
+ * same slot and appends the slot index to the completion array (cq) at
+ * cq_tail.  A slot is handed back without a reply by setting the len of
+ * its fuse_out_header to zero, which must be done for requests that don't
+ * take a reply.  FUSE_DEV_IOC_RING_ENTER processes all completions and,
+ * with FUSE_RING_ENTER_WAIT, then waits for new submissions.
+ *
+ * Requests that don't fit in a slot, background requests, interrupts and
+ * forgets are still read from the device, so a server using rings must
+ * keep reading it as well.
+ */
+struct fuse_ring_setup {
+	uint32_t	entries;	/* number of slots, a power of two */
+	uint32_t	slot_size;	/* multiple of the page size */
+	uint32_t	cpu;		/* CPU whose requests use the ring */
+	uint32_t	flags;		/* must be zero */
+	uint64_t	mmap_size;	/* out: size of the mapping */
+	uint32_t	sq_off;		/* out: offset of submission array */
+	uint32_t	cq_off;		/* out: offset of completion array */
+	uint64_t	slots_off;	/* out: offset of the first slot */
+};
+
+/* At offset zero of the mapping */
+struct fuse_ring_hdr {
+	uint32_t	sq_head;	/* written by the server */
+	uint32_t	sq_tail;	/* written by the kernel */
+	uint32_t	cq_head;	/* written by the kernel */
+	uint32_t	cq_tail;	/* written by the server */
+	uint32_t	entries;
+	uint32_t	slot_size;
+	uint64_t	padding;
+};
+
+#define FUSE_RING_ENTER_WAIT	(1 << 0)
+
+struct fuse_ring_enter {
+	uint32_t	flags;
+	uint32_t	padding;
+};
+
 /* Device ioctls: */
 #define FUSE_DEV_IOC_CLONE	_IOR(229, 0, uint32_t)
+#define FUSE_DEV_IOC_PASSTHROUGH_OPEN	_IOW(229, 1, uint32_t)
+#define FUSE_DEV_IOC_RING_SETUP	_IOWR(229, 2, struct fuse_ring_setup)
+#define FUSE_DEV_IOC_RING_ENTER	_IOW(229, 3, struct fuse_ring_enter)
 
 struct fuse_lseek_in {
 	uint64_t	fh;
@@ -67,6 +67,7 @@ struct sockaddr_ll {
 #define PACKET_FANOUT_QM		5
 #define PACKET_FANOUT_CBPF		6
 #define PACKET_FANOUT_EBPF		7
+#define PACKET_FANOUT_LLC		8
 #define PACKET_FANOUT_FLAG_ROLLOVER	0x1000
 #define PACKET_FANOUT_FLAG_UNIQUEID	0x2000
 #define PACKET_FANOUT_FLAG_DEFRAG	0x8000
@@ -127,6 +128,7 @@ struct tpacket_auxdata {
 
 /* Rx ring - feature request bits */
 #define TP_FT_REQ_FILL_RXHASH	0x1
+#define TP_FT_REQ_RETIRE_NAPI	0x2
 
 struct tpacket_hdr {
 	unsigned long	tp_status;
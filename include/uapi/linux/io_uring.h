@@ -22,6 +22,10 @@ struct io_uring_sqe {
 	union {
 		__u64	off;	/* offset into file */
 		__u64	addr2;
+		struct {
+			__u32	cmd_op;	/* IORING_OP_URING_CMD command */
+			__u32	__pad1;
+		};
 	};
 	union {
 		__u64	addr;	/* pointer to buffer or iovecs */
@@ -55,7 +59,11 @@ struct io_uring_sqe {
 			} __attribute__((packed));
 			/* personality to use, if used */
 			__u16	personality;
-			__s32	splice_fd_in;
+			union {
+				__s32	splice_fd_in;
+				/* accept/open into fixed file slot - 1 */
+				__u32	file_index;
+			};
 		};
 		__u64	__pad2[3];
 	};
@@ -86,6 +94,24 @@ enum {
 /* select buffer from sqe->buf_group */
 #define IOSQE_BUFFER_SELECT	(1U << IOSQE_BUFFER_SELECT_BIT)
 
+/*
+ * sqe->ioprio flags of IORING_OP_ACCEPT and IORING_OP_RECV
+ *
+ * IORING_ACCEPT_MULTISHOT	post a CQE for every accepted connection
+ * IORING_RECV_MULTISHOT	post a CQE for every buffer filled, needs
+ *				IOSQE_BUFFER_SELECT
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+#define IORING_RECV_MULTISHOT	(1U << 0)
+
+/*
+ * sqe->ioprio flags of IORING_OP_SEND_ZC
+ *
+ * IORING_RECVSEND_FIXED_BUF	send from the registered buffer at
+ *				sqe->buf_index, sqe->addr is inside it
+ */
+#define IORING_RECVSEND_FIXED_BUF	(1U << 1)
+
 /*
  * io_uring_setup() flags
  */
@@ -95,6 +121,7 @@ enum {
 #define IORING_SETUP_CQSIZE	(1U << 3)	/* app defines CQ size */
 #define IORING_SETUP_CLAMP	(1U << 4)	/* clamp SQ/CQ ring sizes */
 #define IORING_SETUP_ATTACH_WQ	(1U << 5)	/* attach to existing wq */
+#define IORING_SETUP_SQ_LLC	(1U << 6)	/* SQ_AFF binds to sq_thread_cpu's LLC */
 
 enum {
 	IORING_OP_NOP,
@@ -131,6 +158,8 @@ enum {
 	IORING_OP_PROVIDE_BUFFERS,
 	IORING_OP_REMOVE_BUFFERS,
 	IORING_OP_TEE,
+	IORING_OP_URING_CMD,
+	IORING_OP_SEND_ZC,
 
 	/* this goes last, obviously */
 	IORING_OP_LAST,
@@ -152,6 +181,13 @@ enum {
  */
 #define SPLICE_F_FD_IN_FIXED	(1U << 31) /* the last bit of __u32 */
 
+/*
+ * IORING_OP_URING_CMD passes sqe->cmd_op and the driver defined payload at
+ * sqe->addr, sqe->len bytes long, to the file's handler. The payload must
+ * stay valid until the command completes, drivers may write results back
+ * into it.
+ */
+
 /*
  * IO completion data structure (Completion Queue Entry)
  */
@@ -165,8 +201,15 @@ struct io_uring_cqe {
  * cqe->flags
  *
  * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
+ * IORING_CQE_F_MORE	If set, the request stays armed and more CQEs will
+ *			follow for it
+ * IORING_CQE_F_NOTIF	IORING_OP_SEND_ZC is done with the buffer. If no
+ *			IORING_CQE_F_MORE CQE came first, because the CQ ring
+ *			was full, res is the send result, else it is 0
  */
 #define IORING_CQE_F_BUFFER		(1U << 0)
+#define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 2)
 
 enum {
 	IORING_CQE_BUFFER_SHIFT		= 16,
@@ -224,6 +267,7 @@ struct io_cqring_offsets {
  */
 #define IORING_ENTER_GETEVENTS	(1U << 0)
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+#define IORING_ENTER_REGISTERED_RING	(1U << 2)	/* fd is a registered ring index */
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -236,7 +280,8 @@ struct io_uring_params {
 	__u32 sq_thread_idle;
 	__u32 features;
 	__u32 wq_fd;
-	__u32 resv[3];
+	__u32 sq_thread_batch;
+	__u32 resv[2];
 	struct io_sqring_offsets sq_off;
 	struct io_cqring_offsets cq_off;
 };
@@ -251,6 +296,7 @@ struct io_uring_params {
 #define IORING_FEAT_CUR_PERSONALITY	(1U << 4)
 #define IORING_FEAT_FAST_POLL		(1U << 5)
 #define IORING_FEAT_POLL_32BITS 	(1U << 6)
+#define IORING_FEAT_SQPOLL_SHARED	(1U << 7)
 
 /*
  * io_uring_register(2) opcodes and arguments
@@ -266,6 +312,11 @@ struct io_uring_params {
 #define IORING_REGISTER_PROBE		8
 #define IORING_REGISTER_PERSONALITY	9
 #define IORING_UNREGISTER_PERSONALITY	10
+#define IORING_REGISTER_PBUF_RING	11
+#define IORING_UNREGISTER_PBUF_RING	12
+#define IORING_REGISTER_RING_FDS	13
+#define IORING_UNREGISTER_RING_FDS	14
+#define IORING_REGISTER_IOWQ_MAX_WORKERS	15
 
 struct io_uring_files_update {
 	__u32 offset;
@@ -273,6 +324,53 @@ struct io_uring_files_update {
 	__aligned_u64 /* __s32 * */ fds;
 };
 
+/*
+ * argument array of IORING_(UN)REGISTER_RING_FDS: data is the ring fd,
+ * offset the registered index, -1U to pick a free one on registration
+ */
+struct io_uring_rsrc_update {
+	__u32 offset;
+	__u32 resv;
+	__aligned_u64 data;
+};
+
+/*
+ * Buffer ring entry. The first entry of the ring overlays the tail index
+ * with its reserved field, see struct io_uring_buf_ring.
+ */
+struct io_uring_buf {
+	__u64	addr;
+	__u32	len;
+	__u16	bid;
+	__u16	resv;
+};
+
+/*
+ * Ring of provided buffers shared with the application. The application
+ * fills bufs[tail & (ring_entries - 1)] and then bumps tail with a store
+ * release; the kernel consumes entries from its private head.
+ */
+struct io_uring_buf_ring {
+	union {
+		struct {
+			__u64	resv1;
+			__u32	resv2;
+			__u16	resv3;
+			__u16	tail;
+		};
+		struct io_uring_buf	bufs[0];
+	};
+};
+
+/* argument for IORING_(UN)REGISTER_PBUF_RING */
+struct io_uring_buf_reg {
+	__u64	ring_addr;
+	__u32	ring_entries;
+	__u16	bgid;
+	__u16	pad;
+	__u64	resv[3];
+};
+
 #define IO_URING_OP_SUPPORTED	(1U << 0)
 
 struct io_uring_probe_op {
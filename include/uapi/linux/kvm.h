@@ -248,6 +248,7 @@ struct kvm_hyperv_exit {
 #define KVM_EXIT_IOAPIC_EOI       26
 #define KVM_EXIT_HYPERV           27
 #define KVM_EXIT_ARM_NISV         28
+#define KVM_EXIT_DIRTY_RING_FULL  29
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 /* Emulate instruction failed. */
@@ -728,6 +729,10 @@ struct kvm_ioeventfd {
                                               KVM_X86_DISABLE_EXITS_PAUSE | \
                                               KVM_X86_DISABLE_EXITS_CSTATE)
 
+/* for KVM_CAP_X86_MSR_PASSTHROUGH */
+#define KVM_X86_MSR_PASSTHROUGH_SPEC_CTRL    (1 << 0)
+#define KVM_X86_MSR_PASSTHROUGH_PRED_CMD     (1 << 1)
+
 /* for KVM_ENABLE_CAP */
 struct kvm_enable_cap {
 	/* in */
@@ -1035,6 +1040,10 @@ struct kvm_ppc_resize_hpt {
 #define KVM_CAP_LAST_CPU 184
 #define KVM_CAP_SMALLER_MAXPHYADDR 185
 #define KVM_CAP_S390_DIAG318 186
+#define KVM_CAP_DIRTY_LOG_RING 187
+#define KVM_CAP_HALT_POLL_ADAPTIVE 188
+#define KVM_CAP_BINARY_STATS_FD 189
+#define KVM_CAP_X86_MSR_PASSTHROUGH 190
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1503,6 +1512,12 @@ struct kvm_enc_region {
 #define KVM_S390_NORMAL_RESET	_IO(KVMIO,   0xc3)
 #define KVM_S390_CLEAR_RESET	_IO(KVMIO,   0xc4)
 
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_RESET_DIRTY_RINGS	_IO(KVMIO,   0xc7)
+
+/* Available with KVM_CAP_BINARY_STATS_FD, on VM and vcpu fds */
+#define KVM_GET_STATS_FD	_IO(KVMIO,   0xce)
+
 struct kvm_s390_pv_sec_parm {
 	__u64 origin;
 	__u64 length;
@@ -1564,6 +1579,11 @@ enum sev_cmd_id {
 	KVM_SEV_DBG_ENCRYPT,
 	/* Guest certificates commands */
 	KVM_SEV_CERT_EXPORT,
+	/* Pipelined variant of KVM_SEV_LAUNCH_UPDATE_DATA */
+	KVM_SEV_LAUNCH_UPDATE_DATA_PIPELINED,
+	/* Vectored variants of KVM_SEV_DBG_{DE,EN}CRYPT */
+	KVM_SEV_DBG_DECRYPT_VEC,
+	KVM_SEV_DBG_ENCRYPT_VEC,
 
 	KVM_SEV_NR_MAX,
 };
@@ -1589,6 +1609,20 @@ struct kvm_sev_launch_update_data {
 	__u32 len;
 };
 
+struct kvm_sev_launch_update_data_pipelined {
+	/* in */
+	__u64 uaddr;
+	__u64 len;
+	__u32 chunk_size;	/* bytes, 0 selects the default */
+	__u32 flags;		/* must be zero */
+	/* out */
+	__u64 pin_ns;		/* time spent pinning user memory */
+	__u64 flush_ns;		/* time spent in CLFLUSH */
+	__u64 psp_ns;		/* time from queuing to completing each chunk */
+	__u64 wait_ns;		/* time the pinning side waited for the PSP */
+	__u32 nr_chunks;
+	__u32 nr_cmds;		/* PSP commands issued */
+};
 
 struct kvm_sev_launch_secret {
 	__u64 hdr_uaddr;
@@ -1616,6 +1650,23 @@ struct kvm_sev_dbg {
 	__u32 len;
 };
 
+struct kvm_sev_dbg_range {
+	__u64 gpa;		/* guest physical address */
+	__u64 uaddr;		/* plaintext buffer in the caller */
+	__u32 len;
+	__u32 pad;
+};
+
+struct kvm_sev_dbg_vec {
+	/* in */
+	__u64 ranges_uaddr;	/* array of struct kvm_sev_dbg_range */
+	__u32 nr_ranges;
+	__u32 flags;		/* must be zero */
+	/* out */
+	__u32 nr_done;		/* ranges completely processed */
+	__u32 nr_cmds;		/* PSP commands issued */
+};
+
 #define KVM_DEV_ASSIGN_ENABLE_IOMMU	(1 << 0)
 #define KVM_DEV_ASSIGN_PCI_2_3		(1 << 1)
 #define KVM_DEV_ASSIGN_MASK_INTX	(1 << 2)
@@ -1689,4 +1740,106 @@ struct kvm_hyperv_eventfd {
 #define KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE    (1 << 0)
 #define KVM_DIRTY_LOG_INITIALLY_SET            (1 << 1)
 
+/*
+ * Arch needs to define the macro after implementing the dirty ring
+ * feature.  KVM_DIRTY_LOG_PAGE_OFFSET should be defined as the
+ * starting page offset of the dirty ring structures.
+ */
+#ifndef KVM_DIRTY_LOG_PAGE_OFFSET
+#define KVM_DIRTY_LOG_PAGE_OFFSET 0
+#endif
+
+/*
+ * KVM dirty GFN flags, defined as:
+ *
+ * |---------------+---------------+--------------|
+ * | bit 1 (reset) | bit 0 (dirty) | Status       |
+ * |---------------+---------------+--------------|
+ * |             0 |             0 | Invalid GFN  |
+ * |             0 |             1 | Dirty GFN    |
+ * |             1 |             X | GFN to reset |
+ * |---------------+---------------+--------------|
+ *
+ * Lifecycle of a dirty GFN goes like:
+ *
+ *      dirtied         harvested        reset
+ * 00 -----------> 01 -------------> 1X -------+
+ *  ^                                          |
+ *  |                                          |
+ *  +------------------------------------------+
+ *
+ * The userspace program is only responsible for the 01->1X state
+ * conversion after harvesting an entry.  Also, it must not skip any
+ * dirty bits, so that dirty bits are always harvested in sequence.
+ */
+#define KVM_DIRTY_GFN_F_DIRTY           (1 << 0)
+#define KVM_DIRTY_GFN_F_RESET           (1 << 1)
+#define KVM_DIRTY_GFN_F_MASK            0x3
+
+/*
+ * KVM dirty rings should be mapped at KVM_DIRTY_LOG_PAGE_OFFSET of
+ * per-vcpu mmaped regions as an array of struct kvm_dirty_gfn.  The
+ * size of the gfn buffer is decided by the first argument when
+ * enabling KVM_CAP_DIRTY_LOG_RING.
+ */
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot;
+	__u64 offset;
+};
+
+/*
+ * The fd returned by KVM_GET_STATS_FD starts with a struct kvm_stats_header.
+ * The id string (name_size bytes) and the array of num_desc descriptors, each
+ * sizeof(struct kvm_stats_desc) + name_size bytes long, never change for the
+ * life of the fd; the data block is a snapshot of the statistics taken by
+ * every read, as an array of __u64 laid out by the descriptors' offsets.
+ */
+struct kvm_stats_header {
+	__u32 flags;
+	__u32 name_size;
+	__u32 num_desc;
+	__u32 id_offset;
+	__u32 desc_offset;
+	__u32 data_offset;
+};
+
+#define KVM_STATS_TYPE_SHIFT		0
+#define KVM_STATS_TYPE_MASK		(0xF << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_CUMULATIVE	(0x0 << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_INSTANT		(0x1 << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_PEAK		(0x2 << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_LINEAR_HIST	(0x3 << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_LOG_HIST		(0x4 << KVM_STATS_TYPE_SHIFT)
+#define KVM_STATS_TYPE_MAX		KVM_STATS_TYPE_LOG_HIST
+
+#define KVM_STATS_UNIT_SHIFT		4
+#define KVM_STATS_UNIT_MASK		(0xF << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_NONE		(0x0 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_BYTES		(0x1 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_SECONDS		(0x2 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_CYCLES		(0x3 << KVM_STATS_UNIT_SHIFT)
+#define KVM_STATS_UNIT_MAX		KVM_STATS_UNIT_CYCLES
+
+#define KVM_STATS_BASE_SHIFT		8
+#define KVM_STATS_BASE_MASK		(0xF << KVM_STATS_BASE_SHIFT)
+#define KVM_STATS_BASE_POW10		(0x0 << KVM_STATS_BASE_SHIFT)
+#define KVM_STATS_BASE_POW2		(0x1 << KVM_STATS_BASE_SHIFT)
+#define KVM_STATS_BASE_MAX		KVM_STATS_BASE_POW2
+
+/*
+ * A statistic is @size __u64 values at @offset in the data block, in units
+ * of base^exponent.  For a LOG_HIST, bucket 0 counts the values below
+ * @bucket_size and bucket i those below @bucket_size << i, the last bucket
+ * gathering everything above; a LINEAR_HIST has buckets @bucket_size wide.
+ */
+struct kvm_stats_desc {
+	__u32 flags;
+	__s16 exponent;
+	__u16 size;
+	__u32 offset;
+	__u32 bucket_size;
+	char name[];
+};
+
 #endif /* __LINUX_KVM_H */
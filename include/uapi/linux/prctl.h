@@ -238,4 +238,10 @@ struct prctl_mm_map {
 #define PR_SET_IO_FLUSHER		57
 #define PR_GET_IO_FLUSHER		58
 
+/* Source of memory access information for NUMA balancing */
+#define PR_SET_NUMA_SOURCE		59
+#define PR_GET_NUMA_SOURCE		60
+# define PR_NUMA_SOURCE_FAULTS		0	/* PTE scanning and hinting faults */
+# define PR_NUMA_SOURCE_SAMPLES		1	/* hardware access sampling */
+
 #endif /* _LINUX_PRCTL_H */
@@ -288,6 +288,11 @@ enum
 	LINUX_MIB_TCPTIMEOUTREHASH,		/* TCPTimeoutRehash */
 	LINUX_MIB_TCPDUPLICATEDATAREHASH,	/* TCPDuplicateDataRehash */
 	LINUX_MIB_TCPDSACKRECVSEGS,		/* TCPDSACKRecvSegs */
+	LINUX_MIB_TCPMIGRATEREQSUCCESS,		/* TCPMigrateReqSuccess */
+	LINUX_MIB_TCPMIGRATEREQFAILURE,		/* TCPMigrateReqFailure */
+	LINUX_MIB_TCPTSQBATCHES,		/* TCPTSQBatches */
+	LINUX_MIB_TCPTSQBATCHPKTS,		/* TCPTSQBatchPkts */
+	LINUX_MIB_TCPACKTSQCOALESCED,		/* TCPAckTSQCoalesced */
 	__LINUX_MIB_MAX
 };
 
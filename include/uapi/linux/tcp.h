@@ -284,6 +284,8 @@ struct tcp_info {
 	__u32	tcpi_snd_wnd;	     /* peer's advertised receive window after
 				      * scaling (bytes)
 				      */
+	__u64	tcpi_rcv_zc_mapped;  /* TCP_ZEROCOPY_RECEIVE bytes mapped */
+	__u64	tcpi_rcv_zc_copied;  /* TCP_ZEROCOPY_RECEIVE bytes copied */
 };
 
 /* netlink attributes types for SCM_TIMESTAMPING_OPT_STATS */
@@ -349,5 +351,8 @@ struct tcp_zerocopy_receive {
 	__u32 recv_skip_hint;	/* out: amount of bytes to skip */
 	__u32 inq; /* out: amount of bytes in read queue */
 	__s32 err; /* out: socket error */
+	__u64 copybuf_address;	/* in: buffer for bytes that can't be mapped */
+	__s32 copybuf_len; /* in/out: copybuf bytes avail/used or error */
+	__u32 flags; /* in: must be 0 */
 };
 #endif /* _UAPI_LINUX_TCP_H */
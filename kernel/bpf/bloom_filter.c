@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * bloom_filter.c: BPF bloom filter map
+ *
+ * A set membership test without false negatives: values are added with
+ * bpf_map_push_elem() and tested with bpf_map_peek_elem(), which returns 0
+ * if the value may have been added and -ENOENT if it certainly was not.
+ * Nothing can be removed.  The bitset holds about max_entries * nr_hashes /
+ * ln(2) bits, which keeps the false positive rate close to 2^-nr_hashes when
+ * max_entries values were added.
+ */
+#include <linux/bpf.h>
+#include <linux/err.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/xxhash.h>
+
+#define BLOOM_CREATE_FLAG_MASK \
+	(BPF_F_NUMA_NODE | BPF_F_ZERO_SEED | BPF_F_ACCESS_MASK)
+
+#define BLOOM_DEFAULT_NR_HASHES	5
+
+struct bpf_bloom_filter {
+	struct bpf_map map;
+	u32 bitset_mask;
+	u32 hash_seed;
+	u32 nr_hashes;
+	u32 hash_fn;
+	/* value_size / 4 if the value can be fed to jhash2(), 0 otherwise */
+	u32 nr_u32s;
+	unsigned long bitset[];
+};
+
+static struct bpf_bloom_filter *bpf_bloom(struct bpf_map *map)
+{
+	return container_of(map, struct bpf_bloom_filter, map);
+}
+
+static u32 bloom_hash(struct bpf_bloom_filter *bloom, void *value, u32 index)
+{
+	u32 seed = bloom->hash_seed + index;
+	u32 h;
+
+	if (bloom->hash_fn == BPF_BLOOM_HASH_XXHASH)
+		h = xxh32(value, bloom->map.value_size, seed);
+	else if (bloom->nr_u32s)
+		h = jhash2(value, bloom->nr_u32s, seed);
+	else
+		h = jhash(value, bloom->map.value_size, seed);
+
+	return h & bloom->bitset_mask;
+}
+
+/* Called from syscall or from eBPF program */
+static int bloom_map_peek_elem(struct bpf_map *map, void *value)
+{
+	struct bpf_bloom_filter *bloom = bpf_bloom(map);
+	u32 i;
+
+	for (i = 0; i < bloom->nr_hashes; i++)
+		if (!test_bit(bloom_hash(bloom, value, i), bloom->bitset))
+			return -ENOENT;
+
+	return 0;
+}
+
+/* Called from syscall or from eBPF program */
+static int bloom_map_push_elem(struct bpf_map *map, void *value, u64 flags)
+{
+	struct bpf_bloom_filter *bloom = bpf_bloom(map);
+	u32 i, bit;
+
+	if (flags != BPF_ANY)
+		return -EINVAL;
+
+	for (i = 0; i < bloom->nr_hashes; i++) {
+		bit = bloom_hash(bloom, value, i);
+		/* Don't dirty the cacheline of bits that are already set */
+		if (!test_bit(bit, bloom->bitset))
+			set_bit(bit, bloom->bitset);
+	}
+
+	return 0;
+}
+
+static int bloom_map_pop_elem(struct bpf_map *map, void *value)
+{
+	return -EOPNOTSUPP;
+}
+
+static void *bloom_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	/* The eBPF program should use map_peek_elem instead */
+	return ERR_PTR(-EINVAL);
+}
+
+static int bloom_map_update_elem(struct bpf_map *map, void *key,
+				 void *value, u64 flags)
+{
+	/* The eBPF program should use map_push_elem instead */
+	return -EINVAL;
+}
+
+static int bloom_map_delete_elem(struct bpf_map *map, void *key)
+{
+	return -EOPNOTSUPP;
+}
+
+static int bloom_map_get_next_key(struct bpf_map *map, void *key,
+				  void *next_key)
+{
+	return -EOPNOTSUPP;
+}
+
+/* Called from syscall */
+static int bloom_map_alloc_check(union bpf_attr *attr)
+{
+	if (!bpf_capable())
+		return -EPERM;
+
+	if (attr->max_entries == 0 || attr->key_size != 0 ||
+	    attr->value_size == 0 ||
+	    attr->map_flags & ~BLOOM_CREATE_FLAG_MASK ||
+	    !bpf_map_flags_access_ok(attr->map_flags) ||
+	    attr->map_extra & ~(BPF_BLOOM_NR_HASHES_MASK |
+				BPF_BLOOM_HASH_FN_MASK))
+		return -EINVAL;
+
+	if (((attr->map_extra & BPF_BLOOM_HASH_FN_MASK) >>
+	     BPF_BLOOM_HASH_FN_SHIFT) > BPF_BLOOM_HASH_XXHASH)
+		return -EINVAL;
+
+	if (attr->value_size > KMALLOC_MAX_SIZE)
+		return -E2BIG;
+
+	return 0;
+}
+
+static struct bpf_map *bloom_map_alloc(union bpf_attr *attr)
+{
+	int ret, numa_node = bpf_map_attr_numa_node(attr);
+	struct bpf_map_memory mem = {0};
+	struct bpf_bloom_filter *bloom;
+	u32 nr_hashes, nr_bits;
+	u64 cost;
+
+	nr_hashes = attr->map_extra & BPF_BLOOM_NR_HASHES_MASK;
+	if (!nr_hashes)
+		nr_hashes = BLOOM_DEFAULT_NR_HASHES;
+
+	/* nr_bits = max_entries * nr_hashes / ln(2), 7 / 5 approximating
+	 * 1 / ln(2), rounded up to a power of 2 so that hashes can be masked.
+	 */
+	cost = div_u64((u64)attr->max_entries * nr_hashes * 7, 5);
+	if (cost > (1ULL << 31))
+		return ERR_PTR(-E2BIG);
+	nr_bits = max_t(u32, roundup_pow_of_two(cost), BITS_PER_LONG);
+
+	cost = sizeof(*bloom) + BITS_TO_LONGS(nr_bits) * sizeof(unsigned long);
+	ret = bpf_map_charge_init(&mem, cost);
+	if (ret < 0)
+		return ERR_PTR(ret);
+
+	bloom = bpf_map_area_alloc(cost, numa_node);
+	if (!bloom) {
+		bpf_map_charge_finish(&mem);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	memset(bloom, 0, cost);
+	bpf_map_init_from_attr(&bloom->map, attr);
+	bpf_map_charge_move(&bloom->map.memory, &mem);
+
+	bloom->bitset_mask = nr_bits - 1;
+	bloom->nr_hashes = nr_hashes;
+	bloom->hash_fn = (attr->map_extra & BPF_BLOOM_HASH_FN_MASK) >>
+			 BPF_BLOOM_HASH_FN_SHIFT;
+	if (!(attr->value_size & (sizeof(u32) - 1)))
+		bloom->nr_u32s = attr->value_size / sizeof(u32);
+	if (!(attr->map_flags & BPF_F_ZERO_SEED))
+		bloom->hash_seed = get_random_int();
+
+	return &bloom->map;
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void bloom_map_free(struct bpf_map *map)
+{
+	bpf_map_area_free(bpf_bloom(map));
+}
+
+static int bloom_map_btf_id;
+const struct bpf_map_ops bloom_filter_map_ops = {
+	.map_alloc_check = bloom_map_alloc_check,
+	.map_alloc = bloom_map_alloc,
+	.map_free = bloom_map_free,
+	.map_get_next_key = bloom_map_get_next_key,
+	.map_push_elem = bloom_map_push_elem,
+	.map_peek_elem = bloom_map_peek_elem,
+	.map_pop_elem = bloom_map_pop_elem,
+	.map_lookup_elem = bloom_map_lookup_elem,
+	.map_update_elem = bloom_map_update_elem,
+	.map_delete_elem = bloom_map_delete_elem,
+	.map_btf_name = "bpf_bloom_filter",
+	.map_btf_id = &bloom_map_btf_id,
+};
@@ -89,6 +89,7 @@ struct bpf_htab {
 	struct bpf_map map;
 	struct bucket *buckets;
 	void *elems;
+	void **node_elems;	/* per node element pools, or NULL */
 	union {
 		struct pcpu_freelist freelist;
 		struct bpf_lru lru;
@@ -118,6 +119,7 @@ struct htab_elem {
 		struct bpf_lru_node lru_node;
 	};
 	u32 hash;
+	u32 nid;	/* home node, with per node element pools */
 	char key[] __aligned(8);
 };
 
@@ -205,6 +207,13 @@ static void htab_free_elems(struct bpf_htab *htab)
 {
 	int i;
 
+	if (htab->node_elems) {
+		for_each_node(i)
+			bpf_map_area_free(htab->node_elems[i]);
+		kfree(htab->node_elems);
+		return;
+	}
+
 	if (!htab_is_percpu(htab))
 		goto free_elems;
 
@@ -246,13 +255,80 @@ static struct htab_elem *prealloc_lru_pop(struct bpf_htab *htab, void *key,
 	return NULL;
 }
 
+/*
+ * Maps that are not bound to a node are typically updated from all CPUs,
+ * e.g. by XDP programs.  Give each node a pool of elements sized by its share
+ * of the CPUs and populate the freelists of its CPUs from it.  Freed elements
+ * go back to their home node, so they neither drift into the freelists of
+ * remote CPUs nor make a node work on another node's memory.
+ */
+static int prealloc_init_numa(struct bpf_htab *htab)
+{
+	u32 num_entries = htab->map.max_entries + num_possible_cpus();
+	u32 nr_cpus = 0, cpus = 0, done = 0, nr, i;
+	struct htab_elem *l;
+	void *elems;
+	int err, nid;
+
+	for_each_node(nid)
+		nr_cpus += cpumask_weight(cpumask_of_node(nid));
+	if (!nr_cpus)
+		return -EINVAL;
+
+	htab->node_elems = kcalloc(nr_node_ids, sizeof(void *),
+				   GFP_USER | __GFP_NOWARN);
+	if (!htab->node_elems)
+		return -ENOMEM;
+
+	err = pcpu_freelist_init_numa(&htab->freelist);
+	if (err)
+		goto free_elems;
+
+	for_each_node(nid) {
+		cpus += cpumask_weight(cpumask_of_node(nid));
+		nr = div_u64((u64)num_entries * cpus, nr_cpus) - done;
+		if (!nr)
+			continue;
+
+		elems = bpf_map_area_alloc(htab->elem_size * nr, nid);
+		if (!elems) {
+			err = -ENOMEM;
+			goto free_freelist;
+		}
+		htab->node_elems[nid] = elems;
+
+		for (i = 0; i < nr; i++) {
+			l = elems + i * htab->elem_size;
+			l->nid = nid;
+		}
+		pcpu_freelist_populate_nid(&htab->freelist,
+					   elems + offsetof(struct htab_elem, fnode),
+					   htab->elem_size, nr, nid);
+		done += nr;
+		cond_resched();
+	}
+
+	return 0;
+
+free_freelist:
+	pcpu_freelist_destroy(&htab->freelist);
+free_elems:
+	htab_free_elems(htab);
+	htab->node_elems = NULL;
+	return err;
+}
+
 static int prealloc_init(struct bpf_htab *htab)
 {
 	u32 num_entries = htab->map.max_entries;
 	int err = -ENOMEM, i;
 
-	if (!htab_is_percpu(htab) && !htab_is_lru(htab))
+	if (!htab_is_percpu(htab) && !htab_is_lru(htab)) {
+		if (htab->map.numa_node == NUMA_NO_NODE &&
+		    num_possible_nodes() > 1)
+			return prealloc_init_numa(htab);
 		num_entries += num_possible_cpus();
+	}
 
 	htab->elems = bpf_map_area_alloc(htab->elem_size * num_entries,
 					 htab->map.numa_node);
@@ -794,7 +870,9 @@ static void free_htab_elem(struct bpf_htab *htab, struct htab_elem *l)
 {
 	htab_put_fd_value(htab, l);
 
-	if (htab_is_prealloc(htab)) {
+	if (htab->node_elems) {
+		__pcpu_freelist_push_nid(&htab->freelist, &l->fnode, l->nid);
+	} else if (htab_is_prealloc(htab)) {
 		__pcpu_freelist_push(&htab->freelist, &l->fnode);
 	} else {
 		atomic_dec(&htab->count);
@@ -925,6 +1003,32 @@ static int check_flags(struct bpf_htab *htab, struct htab_elem *l_old,
 	return 0;
 }
 
+/* A value of a u32 or a long can be replaced by a single store, that lookups
+ * see entirely or not at all. Updating an existing key of such a map then
+ * needs neither the bucket lock nor a new element, like a BPF_F_LOCK update.
+ */
+static bool htab_value_update_inplace(const struct bpf_map *map)
+{
+	return map->map_type == BPF_MAP_TYPE_HASH &&
+	       (map->value_size == sizeof(u32) ||
+		map->value_size == sizeof(long)) &&
+	       !map_value_has_spin_lock(map);
+}
+
+static void htab_value_store(const struct bpf_map *map, void *dst, void *value)
+{
+	unsigned long val;
+	u32 val32;
+
+	if (map->value_size == sizeof(u32)) {
+		memcpy(&val32, value, sizeof(val32));
+		WRITE_ONCE(*(u32 *)dst, val32);
+	} else {
+		memcpy(&val, value, sizeof(val));
+		WRITE_ONCE(*(unsigned long *)dst, val);
+	}
+}
+
 /* Called from syscall or from eBPF program */
 static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 				u64 map_flags)
@@ -970,6 +1074,15 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 		 * 99.9% chance that the element won't be found,
 		 * but second lookup under lock has to be done.
 		 */
+	} else if (map_flags != BPF_NOEXIST && htab_value_update_inplace(map)) {
+		l_old = lookup_nulls_elem_raw(head, hash, key, key_size,
+					      htab->n_buckets);
+		if (l_old) {
+			htab_value_store(map, l_old->key + round_up(key_size, 8),
+					 value);
+			return 0;
+		}
+		/* fall through, a new element needs the bucket lock */
 	}
 
 	flags = htab_lock_bucket(htab, b);
@@ -1,8 +1,13 @@
 // SPDX-License-Identifier: GPL-2.0-only
 /* Copyright (c) 2016 Facebook
  */
+#include <linux/slab.h>
+#include <linux/topology.h>
 #include "percpu_freelist.h"
 
+/* Max nodes moved to the local list when another list is raided */
+#define PCPU_FREELIST_BATCH	16
+
 int pcpu_freelist_init(struct pcpu_freelist *s)
 {
 	int cpu;
@@ -17,11 +22,40 @@ int pcpu_freelist_init(struct pcpu_freelist *s)
 		raw_spin_lock_init(&head->lock);
 		head->first = NULL;
 	}
+	s->nodelist = NULL;
+	return 0;
+}
+
+/*
+ * Like pcpu_freelist_init(), for users that populate the freelist of each
+ * node's CPUs with memory of that node (pcpu_freelist_populate_nid()) and
+ * give nodes back with __pcpu_freelist_push_nid().  Nodes freed on another
+ * node are kept aside for their home node instead of joining the local
+ * CPU's list, and pops prefer the lists of the local node.
+ */
+int pcpu_freelist_init_numa(struct pcpu_freelist *s)
+{
+	int err, nid;
+
+	err = pcpu_freelist_init(s);
+	if (err)
+		return err;
+
+	s->nodelist = kcalloc(nr_node_ids, sizeof(*s->nodelist),
+			      GFP_USER | __GFP_NOWARN);
+	if (!s->nodelist) {
+		free_percpu(s->freelist);
+		return -ENOMEM;
+	}
+
+	for (nid = 0; nid < nr_node_ids; nid++)
+		raw_spin_lock_init(&s->nodelist[nid].lock);
 	return 0;
 }
 
 void pcpu_freelist_destroy(struct pcpu_freelist *s)
 {
+	kfree(s->nodelist);
 	free_percpu(s->freelist);
 }
 
@@ -48,6 +82,16 @@ void __pcpu_freelist_push(struct pcpu_freelist *s,
 	___pcpu_freelist_push(head, node);
 }
 
+/* Give back a node whose memory is on @nid. */
+void __pcpu_freelist_push_nid(struct pcpu_freelist *s,
+			      struct pcpu_freelist_node *node, int nid)
+{
+	if (s->nodelist && nid != NUMA_NO_NODE && nid != numa_node_id())
+		___pcpu_freelist_push(&s->nodelist[nid], node);
+	else
+		__pcpu_freelist_push(s, node);
+}
+
 void pcpu_freelist_push(struct pcpu_freelist *s,
 			struct pcpu_freelist_node *node)
 {
@@ -81,29 +125,126 @@ again:
 	}
 }
 
-struct pcpu_freelist_node *__pcpu_freelist_pop(struct pcpu_freelist *s)
+/*
+ * Spread @nr_elems nodes allocated on @nid over the lists of its CPUs, for
+ * a freelist set up by pcpu_freelist_init_numa().
+ */
+void pcpu_freelist_populate_nid(struct pcpu_freelist *s, void *buf,
+				u32 elem_size, u32 nr_elems, int nid)
+{
+	const struct cpumask *mask = cpumask_of_node(nid);
+	int i, cpu;
+
+	/* No locking required as this is not visible yet. */
+	if (cpumask_empty(mask)) {
+		for (i = 0; i < nr_elems; i++, buf += elem_size)
+			pcpu_freelist_push_node(&s->nodelist[nid], buf);
+		return;
+	}
+
+	cpu = cpumask_first(mask);
+	for (i = 0; i < nr_elems; i++, buf += elem_size) {
+		pcpu_freelist_push_node(per_cpu_ptr(s->freelist, cpu), buf);
+		cpu = cpumask_next(cpu, mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(mask);
+	}
+}
+
+static struct pcpu_freelist_node *
+pcpu_freelist_pop_head(struct pcpu_freelist_head *head)
 {
-	struct pcpu_freelist_head *head;
 	struct pcpu_freelist_node *node;
-	int orig_cpu, cpu;
 
-	orig_cpu = cpu = raw_smp_processor_id();
-	while (1) {
-		head = per_cpu_ptr(s->freelist, cpu);
+	raw_spin_lock(&head->lock);
+	node = head->first;
+	if (node)
+		head->first = node->next;
+	raw_spin_unlock(&head->lock);
+	return node;
+}
+
+/*
+ * Take up to PCPU_FREELIST_BATCH nodes off another list in one go.  The
+ * first one is returned and the others move to the local CPU's list, so a
+ * CPU whose list ran dry does not take a remote lock for every node.
+ */
+static struct pcpu_freelist_node *
+pcpu_freelist_steal(struct pcpu_freelist *s, struct pcpu_freelist_head *victim)
+{
+	struct pcpu_freelist_head *head = this_cpu_ptr(s->freelist);
+	struct pcpu_freelist_node *first, *last;
+	int i;
+
+	/* Don't bounce the lock of a list that is known to be empty */
+	if (!READ_ONCE(victim->first))
+		return NULL;
+
+	raw_spin_lock(&victim->lock);
+	first = last = victim->first;
+	if (!first) {
+		raw_spin_unlock(&victim->lock);
+		return NULL;
+	}
+	for (i = 1; i < PCPU_FREELIST_BATCH && last->next; i++)
+		last = last->next;
+	victim->first = last->next;
+	raw_spin_unlock(&victim->lock);
+
+	if (first != last) {
 		raw_spin_lock(&head->lock);
-		node = head->first;
-		if (node) {
-			head->first = node->next;
-			raw_spin_unlock(&head->lock);
+		last->next = head->first;
+		head->first = first->next;
+		raw_spin_unlock(&head->lock);
+	}
+	return first;
+}
+
+struct pcpu_freelist_node *__pcpu_freelist_pop(struct pcpu_freelist *s)
+{
+	struct pcpu_freelist_node *node;
+	int orig_cpu, cpu, nid;
+
+	orig_cpu = raw_smp_processor_id();
+	node = pcpu_freelist_pop_head(per_cpu_ptr(s->freelist, orig_cpu));
+	if (node)
+		return node;
+
+	if (s->nodelist) {
+		/* Local memory first: what was given back, then the CPUs */
+		nid = cpu_to_node(orig_cpu);
+		node = pcpu_freelist_steal(s, &s->nodelist[nid]);
+		if (node)
 			return node;
+		for_each_cpu(cpu, cpumask_of_node(nid)) {
+			if (cpu == orig_cpu)
+				continue;
+			node = pcpu_freelist_steal(s, per_cpu_ptr(s->freelist, cpu));
+			if (node)
+				return node;
 		}
-		raw_spin_unlock(&head->lock);
+	}
+
+	cpu = orig_cpu;
+	while (1) {
 		cpu = cpumask_next(cpu, cpu_possible_mask);
 		if (cpu >= nr_cpu_ids)
-			cpu = 0;
+			cpu = cpumask_first(cpu_possible_mask);
 		if (cpu == orig_cpu)
-			return NULL;
+			break;
+		node = pcpu_freelist_steal(s, per_cpu_ptr(s->freelist, cpu));
+		if (node)
+			return node;
+	}
+
+	if (s->nodelist) {
+		for (nid = 0; nid < nr_node_ids; nid++) {
+			node = pcpu_freelist_steal(s, &s->nodelist[nid]);
+			if (node)
+				return node;
+		}
 	}
+	return NULL;
 }
 
 struct pcpu_freelist_node *pcpu_freelist_pop(struct pcpu_freelist *s)
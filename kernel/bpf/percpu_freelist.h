@@ -13,6 +13,8 @@ struct pcpu_freelist_head {
 
 struct pcpu_freelist {
 	struct pcpu_freelist_head __percpu *freelist;
+	/* pcpu_freelist_init_numa() only: nodes freed away from their node */
+	struct pcpu_freelist_head *nodelist;
 };
 
 struct pcpu_freelist_node {
@@ -24,9 +26,14 @@ void pcpu_freelist_push(struct pcpu_freelist *, struct pcpu_freelist_node *);
 struct pcpu_freelist_node *pcpu_freelist_pop(struct pcpu_freelist *);
 /* __pcpu_freelist_* do spin_lock only. caller must disable irqs. */
 void __pcpu_freelist_push(struct pcpu_freelist *, struct pcpu_freelist_node *);
+void __pcpu_freelist_push_nid(struct pcpu_freelist *,
+			      struct pcpu_freelist_node *, int nid);
 struct pcpu_freelist_node *__pcpu_freelist_pop(struct pcpu_freelist *);
 void pcpu_freelist_populate(struct pcpu_freelist *s, void *buf, u32 elem_size,
 			    u32 nr_elems);
+void pcpu_freelist_populate_nid(struct pcpu_freelist *s, void *buf,
+				u32 elem_size, u32 nr_elems, int nid);
 int pcpu_freelist_init(struct pcpu_freelist *);
+int pcpu_freelist_init_numa(struct pcpu_freelist *);
 void pcpu_freelist_destroy(struct pcpu_freelist *s);
 #endif
@@ -29,6 +29,16 @@
 #define RINGBUF_MAX_DATA_SZ \
 	(((1ULL << 24) - RINGBUF_POS_PAGES - RINGBUF_PGOFF) * PAGE_SIZE)
 
+/* The top 8 bits of the page offset of a record header reserved with
+ * BPF_RB_BATCH() hold the number of records in the batch until it is
+ * committed.
+ */
+#define RINGBUF_PG_OFF_MASK ((1U << 24) - 1)
+#define RINGBUF_BATCH_SHIFT 24
+
+/* Sub-rings per NUMA node of a sharded ring buffer (map_extra) */
+#define RINGBUF_MAX_RINGS_PER_NODE 64
+
 struct bpf_ringbuf {
 	wait_queue_head_t waitq;
 	struct irq_work work;
@@ -49,7 +59,15 @@ struct bpf_ringbuf {
 struct bpf_ringbuf_map {
 	struct bpf_map map;
 	struct bpf_map_memory memory;
-	struct bpf_ringbuf *rb;
+	/* A ring buffer created with a non-zero map_extra is sharded into
+	 * map_extra sub-rings per NUMA node, and each producer reserves from
+	 * one of the sub-rings of its own node. Sub-ring i is mmap()'ed at
+	 * page offset i * bpf_ringbuf_mmap_page_cnt(), and polling the map
+	 * waits for data in any of them.
+	 */
+	u32 nr_rings;
+	u32 rings_per_node;
+	struct bpf_ringbuf *rings[];
 };
 
 /* 8-byte ring buffer record header structure */
@@ -147,15 +165,38 @@ static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
 	return rb;
 }
 
+static void bpf_ringbuf_free(struct bpf_ringbuf *rb)
+{
+	/* copy pages pointer and nr_pages to local variable, as we are going
+	 * to unmap rb itself with vunmap() below
+	 */
+	struct page **pages = rb->pages;
+	int i, nr_pages = rb->nr_pages;
+
+	vunmap(rb);
+	for (i = 0; i < nr_pages; i++)
+		__free_page(pages[i]);
+	kvfree(pages);
+}
+
 static struct bpf_map *ringbuf_map_alloc(union bpf_attr *attr)
 {
 	struct bpf_ringbuf_map *rb_map;
+	u32 i, nr_rings = 1;
+	struct bpf_ringbuf *rb;
+	int err, nid;
 	u64 cost;
-	int err;
 
 	if (attr->map_flags & ~RINGBUF_CREATE_FLAG_MASK)
 		return ERR_PTR(-EINVAL);
 
+	if (attr->map_extra) {
+		if (attr->map_extra > RINGBUF_MAX_RINGS_PER_NODE ||
+		    (attr->map_flags & BPF_F_NUMA_NODE))
+			return ERR_PTR(-EINVAL);
+		nr_rings = nr_node_ids * attr->map_extra;
+	}
+
 	if (attr->key_size || attr->value_size ||
 	    !is_power_of_2(attr->max_entries) ||
 	    !PAGE_ALIGNED(attr->max_entries))
@@ -167,54 +208,55 @@ static struct bpf_map *ringbuf_map_alloc(union bpf_attr *attr)
 		return ERR_PTR(-E2BIG);
 #endif
 
-	rb_map = kzalloc(sizeof(*rb_map), GFP_USER);
+	rb_map = kzalloc(struct_size(rb_map, rings, nr_rings), GFP_USER);
 	if (!rb_map)
 		return ERR_PTR(-ENOMEM);
 
 	bpf_map_init_from_attr(&rb_map->map, attr);
+	rb_map->nr_rings = nr_rings;
+	rb_map->rings_per_node = attr->map_extra ?: 1;
 
-	cost = sizeof(struct bpf_ringbuf_map) +
-	       sizeof(struct bpf_ringbuf) +
-	       attr->max_entries;
+	cost = struct_size(rb_map, rings, nr_rings) +
+	       (u64)nr_rings * (sizeof(struct bpf_ringbuf) + attr->max_entries);
 	err = bpf_map_charge_init(&rb_map->map.memory, cost);
 	if (err)
 		goto err_free_map;
 
-	rb_map->rb = bpf_ringbuf_alloc(attr->max_entries, rb_map->map.numa_node);
-	if (IS_ERR(rb_map->rb)) {
-		err = PTR_ERR(rb_map->rb);
-		goto err_uncharge;
+	for (i = 0; i < nr_rings; i++) {
+		nid = rb_map->map.numa_node;
+		if (attr->map_extra) {
+			nid = i / rb_map->rings_per_node;
+			if (!node_online(nid))
+				nid = NUMA_NO_NODE;
+		}
+
+		rb = bpf_ringbuf_alloc(attr->max_entries, nid);
+		if (IS_ERR(rb)) {
+			err = PTR_ERR(rb);
+			goto err_free_rings;
+		}
+		rb_map->rings[i] = rb;
 	}
 
 	return &rb_map->map;
 
-err_uncharge:
+err_free_rings:
+	while (i--)
+		bpf_ringbuf_free(rb_map->rings[i]);
 	bpf_map_charge_finish(&rb_map->map.memory);
 err_free_map:
 	kfree(rb_map);
 	return ERR_PTR(err);
 }
 
-static void bpf_ringbuf_free(struct bpf_ringbuf *rb)
-{
-	/* copy pages pointer and nr_pages to local variable, as we are going
-	 * to unmap rb itself with vunmap() below
-	 */
-	struct page **pages = rb->pages;
-	int i, nr_pages = rb->nr_pages;
-
-	vunmap(rb);
-	for (i = 0; i < nr_pages; i++)
-		__free_page(pages[i]);
-	kvfree(pages);
-}
-
 static void ringbuf_map_free(struct bpf_map *map)
 {
 	struct bpf_ringbuf_map *rb_map;
+	u32 i;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	bpf_ringbuf_free(rb_map->rb);
+	for (i = 0; i < rb_map->nr_rings; i++)
+		bpf_ringbuf_free(rb_map->rings[i]);
 	kfree(rb_map);
 }
 
@@ -251,16 +293,21 @@ static size_t bpf_ringbuf_mmap_page_cnt(const struct bpf_ringbuf *rb)
 static int ringbuf_map_mmap(struct bpf_map *map, struct vm_area_struct *vma)
 {
 	struct bpf_ringbuf_map *rb_map;
-	size_t mmap_sz;
+	unsigned long ring, pgoff;
+	size_t ring_pages;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	mmap_sz = bpf_ringbuf_mmap_page_cnt(rb_map->rb) << PAGE_SHIFT;
+	ring_pages = bpf_ringbuf_mmap_page_cnt(rb_map->rings[0]);
+	ring = vma->vm_pgoff / ring_pages;
+	pgoff = vma->vm_pgoff % ring_pages;
 
-	if (vma->vm_pgoff * PAGE_SIZE + (vma->vm_end - vma->vm_start) > mmap_sz)
+	if (ring >= rb_map->nr_rings ||
+	    pgoff * PAGE_SIZE + (vma->vm_end - vma->vm_start) >
+	    ring_pages << PAGE_SHIFT)
 		return -EINVAL;
 
-	return remap_vmalloc_range(vma, rb_map->rb,
-				   vma->vm_pgoff + RINGBUF_PGOFF);
+	return remap_vmalloc_range(vma, rb_map->rings[ring],
+				   pgoff + RINGBUF_PGOFF);
 }
 
 static unsigned long ringbuf_avail_data_sz(struct bpf_ringbuf *rb)
@@ -276,15 +323,37 @@ static __poll_t ringbuf_map_poll(struct bpf_map *map, struct file *filp,
 				 struct poll_table_struct *pts)
 {
 	struct bpf_ringbuf_map *rb_map;
+	u32 i;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	poll_wait(filp, &rb_map->rb->waitq, pts);
+	/* register on all the wait queues before looking at the data, epoll
+	 * only gets to see the ones added by the first poll
+	 */
+	for (i = 0; i < rb_map->nr_rings; i++)
+		poll_wait(filp, &rb_map->rings[i]->waitq, pts);
 
-	if (ringbuf_avail_data_sz(rb_map->rb))
-		return EPOLLIN | EPOLLRDNORM;
+	for (i = 0; i < rb_map->nr_rings; i++) {
+		if (ringbuf_avail_data_sz(rb_map->rings[i]))
+			return EPOLLIN | EPOLLRDNORM;
+	}
 	return 0;
 }
 
+/* Sub-ring a BPF program running on this CPU produces into. Sleepable
+ * programs may migrate, which only costs locality.
+ */
+static struct bpf_ringbuf *ringbuf_map_local_rb(struct bpf_ringbuf_map *rb_map)
+{
+	unsigned int cpu;
+
+	if (likely(rb_map->nr_rings == 1))
+		return rb_map->rings[0];
+
+	cpu = raw_smp_processor_id();
+	return rb_map->rings[cpu_to_node(cpu) * rb_map->rings_per_node +
+			     cpu % rb_map->rings_per_node];
+}
+
 static int ringbuf_map_btf_id;
 const struct bpf_map_ops ringbuf_map_ops = {
 	.map_alloc = ringbuf_map_alloc,
@@ -318,21 +387,38 @@ static struct bpf_ringbuf *
 bpf_ringbuf_restore_from_rec(struct bpf_ringbuf_hdr *hdr)
 {
 	unsigned long addr = (unsigned long)(void *)hdr;
-	unsigned long off = (unsigned long)hdr->pg_off << PAGE_SHIFT;
+	unsigned long off = (unsigned long)(hdr->pg_off & RINGBUF_PG_OFF_MASK)
+			    << PAGE_SHIFT;
 
 	return (void*)((addr & PAGE_MASK) - off);
 }
 
-static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
+/* Reserve @nr records of the same length in one go, laid out as they would
+ * be by @nr separate reservations: the @size bytes handed out hold the first
+ * record, then the header of the second one and the second record, and so
+ * on. The headers past the first are written at commit time.
+ */
+static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size, u32 nr)
 {
 	unsigned long cons_pos, prod_pos, new_prod_pos, flags;
-	u32 len, pg_off;
+	u32 len, rec_len, pg_off, stride;
 	struct bpf_ringbuf_hdr *hdr;
 
 	if (unlikely(size > RINGBUF_MAX_RECORD_SZ))
 		return NULL;
 
 	len = round_up(size + BPF_RINGBUF_HDR_SZ, 8);
+	rec_len = size;
+	if (nr > 1) {
+		stride = len / nr;
+		if (size + BPF_RINGBUF_HDR_SZ != len || stride * nr != len ||
+		    !IS_ALIGNED(stride, 8))
+			return NULL;
+		rec_len = stride - BPF_RINGBUF_HDR_SZ;
+	} else {
+		nr = 0;
+	}
+
 	cons_pos = smp_load_acquire(&rb->consumer_pos);
 
 	if (in_nmi()) {
@@ -355,8 +441,8 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 
 	hdr = (void *)rb->data + (prod_pos & rb->mask);
 	pg_off = bpf_ringbuf_rec_pg_off(rb, hdr);
-	hdr->len = size | BPF_RINGBUF_BUSY_BIT;
-	hdr->pg_off = pg_off;
+	hdr->len = rec_len | BPF_RINGBUF_BUSY_BIT;
+	hdr->pg_off = pg_off | (nr << RINGBUF_BATCH_SHIFT);
 
 	/* pairs with consumer's smp_load_acquire() */
 	smp_store_release(&rb->producer_pos, new_prod_pos);
@@ -370,11 +456,12 @@ BPF_CALL_3(bpf_ringbuf_reserve, struct bpf_map *, map, u64, size, u64, flags)
 {
 	struct bpf_ringbuf_map *rb_map;
 
-	if (unlikely(flags))
+	if (unlikely(flags & ~BPF_RB_BATCH_MASK))
 		return 0;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	return (unsigned long)__bpf_ringbuf_reserve(rb_map->rb, size);
+	return (unsigned long)__bpf_ringbuf_reserve(ringbuf_map_local_rb(rb_map),
+						    size, flags);
 }
 
 const struct bpf_func_proto bpf_ringbuf_reserve_proto = {
@@ -385,6 +472,30 @@ const struct bpf_func_proto bpf_ringbuf_reserve_proto = {
 	.arg3_type	= ARG_ANYTHING,
 };
 
+/* The headers of the records after the first one of a batch are in memory
+ * the program could write to, so they are all rewritten here, before the
+ * first record is committed and lets the consumer walk past it.
+ */
+static void bpf_ringbuf_commit_batch(struct bpf_ringbuf *rb,
+				     struct bpf_ringbuf_hdr *hdr, bool discard)
+{
+	u32 nr = hdr->pg_off >> RINGBUF_BATCH_SHIFT;
+	u32 rec_len = hdr->len & ~BPF_RINGBUF_BUSY_BIT;
+	u32 stride = rec_len + BPF_RINGBUF_HDR_SZ;
+	struct bpf_ringbuf_hdr *rec;
+	u32 i;
+
+	if (discard)
+		rec_len |= BPF_RINGBUF_DISCARD_BIT;
+
+	for (i = 1; i < nr; i++) {
+		rec = (void *)hdr + i * stride;
+		rec->len = rec_len;
+		rec->pg_off = bpf_ringbuf_rec_pg_off(rb, rec);
+	}
+	hdr->pg_off &= RINGBUF_PG_OFF_MASK;
+}
+
 static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
 {
 	unsigned long rec_pos, cons_pos;
@@ -394,6 +505,9 @@ static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
 
 	hdr = sample - BPF_RINGBUF_HDR_SZ;
 	rb = bpf_ringbuf_restore_from_rec(hdr);
+	if (hdr->pg_off >> RINGBUF_BATCH_SHIFT)
+		bpf_ringbuf_commit_batch(rb, hdr, discard);
+
 	new_len = hdr->len ^ BPF_RINGBUF_BUSY_BIT;
 	if (discard)
 		new_len |= BPF_RINGBUF_DISCARD_BIT;
@@ -449,7 +563,7 @@ BPF_CALL_4(bpf_ringbuf_output, struct bpf_map *, map, void *, data, u64, size,
 		return -EINVAL;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	rec = __bpf_ringbuf_reserve(rb_map->rb, size);
+	rec = __bpf_ringbuf_reserve(ringbuf_map_local_rb(rb_map), size, 1);
 	if (!rec)
 		return -EAGAIN;
 
@@ -471,7 +585,7 @@ BPF_CALL_2(bpf_ringbuf_query, struct bpf_map *, map, u64, flags)
 {
 	struct bpf_ringbuf *rb;
 
-	rb = container_of(map, struct bpf_ringbuf_map, map)->rb;
+	rb = ringbuf_map_local_rb(container_of(map, struct bpf_ringbuf_map, map));
 
 	switch (flags) {
 	case BPF_RB_AVAIL_DATA:
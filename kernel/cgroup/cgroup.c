@@ -3563,6 +3563,11 @@ static int cgroup_cpu_pressure_show(struct seq_file *seq, void *v)
 	return psi_show(seq, psi, PSI_CPU);
 }
 
+static int cgroup_pressure_tree_show(struct seq_file *seq, void *v)
+{
+	return psi_show_tree(seq, seq_css(seq)->cgroup);
+}
+
 static ssize_t cgroup_pressure_write(struct kernfs_open_file *of, char *buf,
 					  size_t nbytes, enum psi_res res)
 {
@@ -4876,6 +4881,10 @@ static struct cftype cgroup_base_files[] = {
 		.name = "cpu.stat",
 		.seq_show = cpu_stat_show,
 	},
+	{
+		.name = "cpu.stat.subtree",
+		.seq_show = cgroup_base_stat_subtree_show,
+	},
 #ifdef CONFIG_PSI
 	{
 		.name = "io.pressure",
@@ -4898,6 +4907,10 @@ static struct cftype cgroup_base_files[] = {
 		.poll = cgroup_pressure_poll,
 		.release = cgroup_pressure_release,
 	},
+	{
+		.name = "pressure.tree",
+		.seq_show = cgroup_pressure_tree_show,
+	},
 #endif /* CONFIG_PSI */
 	{ }	/* terminate */
 };
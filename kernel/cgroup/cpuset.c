@@ -56,6 +56,7 @@
 #include <linux/string.h>
 #include <linux/time.h>
 #include <linux/time64.h>
+#include <linux/topology.h>
 #include <linux/backing-dev.h>
 #include <linux/sort.h>
 #include <linux/oom.h>
@@ -215,6 +216,7 @@ typedef enum {
 	CS_SCHED_LOAD_BALANCE,
 	CS_SPREAD_PAGE,
 	CS_SPREAD_SLAB,
+	CS_LLC_EXCLUSIVE,
 } cpuset_flagbits_t;
 
 /* convenient tests for these bits */
@@ -263,6 +265,49 @@ static inline int is_partition_root(const struct cpuset *cs)
 	return cs->partition_root_state > 0;
 }
 
+static inline int is_llc_exclusive(const struct cpuset *cs)
+{
+	return test_bit(CS_LLC_EXCLUSIVE, &cs->flags);
+}
+
+/*
+ * The CPUs sharing the last level cache with @cpu. This is the mask the
+ * MC sched domain, and so sd_llc, is built from; sd_llc itself can't be
+ * used as it is clipped by the partitions being set up here.
+ */
+static const struct cpumask *cpuset_llc_mask(int cpu)
+{
+#ifdef CONFIG_SCHED_MC
+	return cpu_coregroup_mask(cpu);
+#else
+	return cpumask_of(cpu);
+#endif
+}
+
+/* Check that @mask is made up of whole LLCs */
+static bool cpuset_llc_whole(const struct cpumask *mask)
+{
+	int cpu;
+
+	for_each_cpu(cpu, mask) {
+		if (!cpumask_subset(cpuset_llc_mask(cpu), mask))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Round @mask up to whole LLCs. This only ever adds CPUs whose LLC is
+ * already in the mask, so it is fine to do while walking it.
+ */
+static void cpuset_llc_round(struct cpumask *mask)
+{
+	int cpu;
+
+	for_each_cpu(cpu, mask)
+		cpumask_or(mask, mask, cpuset_llc_mask(cpu));
+}
+
 static struct cpuset top_cpuset = {
 	.flags = ((1 << CS_ONLINE) | (1 << CS_CPU_EXCLUSIVE) |
 		  (1 << CS_MEM_EXCLUSIVE)),
@@ -1498,6 +1543,10 @@ static int update_cpumask(struct cpuset *cs, struct cpuset *trialcs,
 		if (retval < 0)
 			return retval;
 
+		/* An LLC exclusive partition never splits a cache */
+		if (is_llc_exclusive(cs))
+			cpuset_llc_round(trialcs->cpus_allowed);
+
 		if (!cpumask_subset(trialcs->cpus_allowed,
 				    top_cpuset.cpus_allowed))
 			return -EINVAL;
@@ -1916,10 +1965,11 @@ out:
  * update_prstate - update partititon_root_state
  * cs:	the cpuset to update
  * val: 0 - disabled, 1 - enabled
+ * llc: the partition must be made of whole LLCs
  *
  * Call with cpuset_mutex held.
  */
-static int update_prstate(struct cpuset *cs, int val)
+static int update_prstate(struct cpuset *cs, int val, bool llc)
 {
 	int err;
 	struct cpuset *parent = parent_cs(cs);
@@ -1927,8 +1977,14 @@ static int update_prstate(struct cpuset *cs, int val)
 
 	if ((val != 0) && (val != 1))
 		return -EINVAL;
-	if (val == cs->partition_root_state)
+	if (llc && (!val || !cpuset_llc_whole(cs->cpus_allowed)))
+		return -EINVAL;
+	if (val == cs->partition_root_state) {
+		/* Switching between "root" and "root-llc" */
+		if (val)
+			return update_flag(CS_LLC_EXCLUSIVE, cs, llc);
 		return 0;
+	}
 
 	/*
 	 * Cannot force a partial or invalid partition root to a full
@@ -1961,11 +2017,15 @@ static int update_prstate(struct cpuset *cs, int val)
 			goto out;
 		}
 		cs->partition_root_state = PRS_ENABLED;
+		if (llc)
+			update_flag(CS_LLC_EXCLUSIVE, cs, 1);
 	} else {
 		/*
 		 * Turning off partition root will clear the
 		 * CS_CPU_EXCLUSIVE bit.
 		 */
+		update_flag(CS_LLC_EXCLUSIVE, cs, 0);
+
 		if (cs->partition_root_state == PRS_ERROR) {
 			cs->partition_root_state = 0;
 			update_flag(CS_CPU_EXCLUSIVE, cs, 0);
@@ -2240,6 +2300,7 @@ typedef enum {
 	FILE_EFFECTIVE_CPULIST,
 	FILE_EFFECTIVE_MEMLIST,
 	FILE_SUBPARTS_CPULIST,
+	FILE_LLC_SHARED_CPULIST,
 	FILE_CPU_EXCLUSIVE,
 	FILE_MEM_EXCLUSIVE,
 	FILE_MEM_HARDWALL,
@@ -2435,6 +2496,39 @@ static int cpuset_common_seq_show(struct seq_file *sf, void *v)
 	return ret;
 }
 
+/*
+ * Show the CPUs outside of the cpuset which share a last level cache with
+ * the CPUs granted to it. For a partition root, this is empty when its
+ * caches are not shared with anything else.
+ */
+static int cpuset_llc_shared_show(struct seq_file *sf, void *v)
+{
+	struct cpuset *cs = css_cs(seq_css(sf));
+	cpumask_var_t granted, shared;
+	int cpu, ret = -ENOMEM;
+
+	if (!zalloc_cpumask_var(&granted, GFP_KERNEL))
+		return ret;
+	if (!zalloc_cpumask_var(&shared, GFP_KERNEL))
+		goto out_free;
+
+	spin_lock_irq(&callback_lock);
+	cpumask_or(granted, cs->effective_cpus, cs->subparts_cpus);
+	spin_unlock_irq(&callback_lock);
+
+	for_each_cpu(cpu, granted)
+		cpumask_or(shared, shared, cpuset_llc_mask(cpu));
+	cpumask_andnot(shared, shared, granted);
+
+	seq_printf(sf, "%*pbl\n", cpumask_pr_args(shared));
+	ret = 0;
+
+	free_cpumask_var(shared);
+out_free:
+	free_cpumask_var(granted);
+	return ret;
+}
+
 static u64 cpuset_read_u64(struct cgroup_subsys_state *css, struct cftype *cft)
 {
 	struct cpuset *cs = css_cs(css);
@@ -2487,7 +2581,7 @@ static int sched_partition_show(struct seq_file *seq, void *v)
 
 	switch (cs->partition_root_state) {
 	case PRS_ENABLED:
-		seq_puts(seq, "root\n");
+		seq_puts(seq, is_llc_exclusive(cs) ? "root-llc\n" : "root\n");
 		break;
 	case PRS_DISABLED:
 		seq_puts(seq, "member\n");
@@ -2503,20 +2597,26 @@ static ssize_t sched_partition_write(struct kernfs_open_file *of, char *buf,
 				     size_t nbytes, loff_t off)
 {
 	struct cpuset *cs = css_cs(of_css(of));
+	bool llc = false;
 	int val;
 	int retval = -ENODEV;
 
 	buf = strstrip(buf);
 
 	/*
-	 * Convert "root" to ENABLED, and convert "member" to DISABLED.
+	 * Convert "root" and "root-llc" to ENABLED, and convert "member"
+	 * to DISABLED.
 	 */
-	if (!strcmp(buf, "root"))
+	if (!strcmp(buf, "root")) {
+		val = PRS_ENABLED;
+	} else if (!strcmp(buf, "root-llc")) {
 		val = PRS_ENABLED;
-	else if (!strcmp(buf, "member"))
+		llc = true;
+	} else if (!strcmp(buf, "member")) {
 		val = PRS_DISABLED;
-	else
+	} else {
 		return -EINVAL;
+	}
 
 	css_get(&cs->css);
 	get_online_cpus();
@@ -2524,7 +2624,7 @@ static ssize_t sched_partition_write(struct kernfs_open_file *of, char *buf,
 	if (!is_cpuset_online(cs))
 		goto out_unlock;
 
-	retval = update_prstate(cs, val);
+	retval = update_prstate(cs, val, llc);
 out_unlock:
 	percpu_up_write(&cpuset_rwsem);
 	put_online_cpus();
@@ -2688,6 +2788,13 @@ static struct cftype dfl_files[] = {
 		.flags = CFTYPE_DEBUG,
 	},
 
+	{
+		.name = "cpus.llc_shared",
+		.seq_show = cpuset_llc_shared_show,
+		.private = FILE_LLC_SHARED_CPULIST,
+		.flags = CFTYPE_NOT_ON_ROOT,
+	},
+
 	{ }	/* terminate */
 };
 
@@ -2809,7 +2916,7 @@ static void cpuset_css_offline(struct cgroup_subsys_state *css)
 	percpu_down_write(&cpuset_rwsem);
 
 	if (is_partition_root(cs))
-		update_prstate(cs, 0);
+		update_prstate(cs, 0, false);
 
 	if (!cgroup_subsys_on_dfl(cpuset_cgrp_subsys) &&
 	    is_sched_load_balance(cs))
@@ -2,10 +2,20 @@
 #include "cgroup-internal.h"
 
 #include <linux/sched/cputime.h>
+#include <linux/psi.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
 
 static DEFINE_SPINLOCK(cgroup_rstat_lock);
 static DEFINE_PER_CPU(raw_spinlock_t, cgroup_rstat_cpu_lock);
 
+/*
+ * How stale the stats returned to readers using the ratelimited flushes may
+ * be, in ms.  0 flushes on every read.
+ */
+static unsigned int flush_staleness_ms;
+module_param(flush_staleness_ms, uint, 0644);
+
 static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu);
 
 static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
@@ -150,11 +160,22 @@ static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
 						       cpu);
 		struct cgroup *pos = NULL;
 
+		/*
+		 * Skip CPUs without updates in the subtree without taking
+		 * their lock.  Like the speculative test in
+		 * cgroup_rstat_updated(), this may race with an update,
+		 * which is then picked up by the next flush.
+		 */
+		if (READ_ONCE(cgroup_rstat_cpu(cgrp, cpu)->updated_children) ==
+		    cgrp)
+			continue;
+
 		raw_spin_lock(cpu_lock);
 		while ((pos = cgroup_rstat_cpu_pop_updated(pos, cgrp, cpu))) {
 			struct cgroup_subsys_state *css;
 
 			cgroup_base_stat_flush(pos, cpu);
+			psi_rstat_flush(pos, cpu);
 
 			rcu_read_lock();
 			list_for_each_entry_rcu(css, &pos->rstat_css_list,
@@ -173,6 +194,30 @@ static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
 			spin_lock_irq(&cgroup_rstat_lock);
 		}
 	}
+
+	cgrp->rstat_flushed_at = get_jiffies_64();
+}
+
+/*
+ * Whether @cgrp's subtree was flushed, on its own or as part of an
+ * ancestor's, within flush_staleness_ms.
+ */
+static bool cgroup_rstat_fresh(struct cgroup *cgrp)
+{
+	u64 now = get_jiffies_64(), max_age;
+
+	if (!flush_staleness_ms)
+		return false;
+
+	max_age = msecs_to_jiffies(flush_staleness_ms);
+	for (; cgrp; cgrp = cgroup_parent(cgrp)) {
+		u64 flushed_at = READ_ONCE(cgrp->rstat_flushed_at);
+
+		if (flushed_at && now - flushed_at < max_age)
+			return true;
+	}
+
+	return false;
 }
 
 /**
@@ -197,6 +242,23 @@ void cgroup_rstat_flush(struct cgroup *cgrp)
 	spin_unlock_irq(&cgroup_rstat_lock);
 }
 
+/**
+ * cgroup_rstat_flush_ratelimited - flush stats in @cgrp's subtree for a reader
+ * @cgrp: target cgroup
+ *
+ * Like cgroup_rstat_flush(), but skips the flush if @cgrp's subtree was
+ * flushed within the last flush_staleness_ms, so that frequent readers don't
+ * serialize on cgroup_rstat_lock.  For readers only, teardown paths which
+ * need exact stats must use cgroup_rstat_flush().
+ *
+ * This function may block.
+ */
+void cgroup_rstat_flush_ratelimited(struct cgroup *cgrp)
+{
+	if (!cgroup_rstat_fresh(cgrp))
+		cgroup_rstat_flush(cgrp);
+}
+
 /**
  * cgroup_rstat_flush_irqsafe - irqsafe version of cgroup_rstat_flush()
  * @cgrp: target cgroup
@@ -229,6 +291,22 @@ void cgroup_rstat_flush_hold(struct cgroup *cgrp)
 	cgroup_rstat_flush_locked(cgrp, true);
 }
 
+/**
+ * cgroup_rstat_flush_hold_ratelimited - ratelimited cgroup_rstat_flush_hold()
+ * @cgrp: target cgroup
+ *
+ * See cgroup_rstat_flush_ratelimited().  Must be paired with
+ * cgroup_rstat_flush_release().
+ */
+void cgroup_rstat_flush_hold_ratelimited(struct cgroup *cgrp)
+	__acquires(&cgroup_rstat_lock)
+{
+	might_sleep();
+	spin_lock_irq(&cgroup_rstat_lock);
+	if (!cgroup_rstat_fresh(cgrp))
+		cgroup_rstat_flush_locked(cgrp, true);
+}
+
 /**
  * cgroup_rstat_flush_release - release cgroup_rstat_flush_hold()
  */
@@ -426,6 +504,16 @@ static void root_cgroup_cputime(struct task_cputime *cputime)
 	}
 }
 
+/* must be called with cgroup_rstat_lock held, returns nanoseconds */
+static void cgroup_base_stat_cputime_read(struct cgroup *cgrp, u64 *usage,
+					  u64 *utime, u64 *stime)
+{
+	lockdep_assert_held(&cgroup_rstat_lock);
+
+	*usage = cgrp->bstat.cputime.sum_exec_runtime;
+	cputime_adjust(&cgrp->bstat.cputime, &cgrp->prev_cputime, utime, stime);
+}
+
 void cgroup_base_stat_cputime_show(struct seq_file *seq)
 {
 	struct cgroup *cgrp = seq_css(seq)->cgroup;
@@ -433,10 +521,8 @@ void cgroup_base_stat_cputime_show(struct seq_file *seq)
 	struct task_cputime cputime;
 
 	if (cgroup_parent(cgrp)) {
-		cgroup_rstat_flush_hold(cgrp);
-		usage = cgrp->bstat.cputime.sum_exec_runtime;
-		cputime_adjust(&cgrp->bstat.cputime, &cgrp->prev_cputime,
-			       &utime, &stime);
+		cgroup_rstat_flush_hold_ratelimited(cgrp);
+		cgroup_base_stat_cputime_read(cgrp, &usage, &utime, &stime);
 		cgroup_rstat_flush_release();
 	} else {
 		root_cgroup_cputime(&cputime);
@@ -454,3 +540,51 @@ void cgroup_base_stat_cputime_show(struct seq_file *seq)
 		   "system_usec %llu\n",
 		   usage, utime, stime);
 }
+
+/*
+ * cpu.stat.subtree: the base cputime stats of all descendants of a cgroup in
+ * one read, one line each, keyed by the path relative to the cgroup read:
+ *
+ *   <path> usage_usec <n> user_usec <n> system_usec <n>
+ *
+ * The subtree is flushed once for all of them, and cgroup_rstat_lock is only
+ * held while copying out the stats of one cgroup at a time.
+ */
+int cgroup_base_stat_subtree_show(struct seq_file *seq, void *v)
+{
+	struct cgroup_subsys_state *root = seq_css(seq), *css;
+	char *path;
+
+	path = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	cgroup_rstat_flush_ratelimited(root->cgroup);
+
+	rcu_read_lock();
+	css_for_each_descendant_pre(css, root) {
+		struct cgroup *cgrp = css->cgroup;
+		u64 usage, utime, stime;
+
+		if (css == root || !cgroup_parent(cgrp))
+			continue;
+		if (kernfs_path_from_node(cgrp->kn, root->cgroup->kn, path,
+					  PATH_MAX) < 0)
+			continue;
+
+		spin_lock_irq(&cgroup_rstat_lock);
+		cgroup_base_stat_cputime_read(cgrp, &usage, &utime, &stime);
+		spin_unlock_irq(&cgroup_rstat_lock);
+
+		do_div(usage, NSEC_PER_USEC);
+		do_div(utime, NSEC_PER_USEC);
+		do_div(stime, NSEC_PER_USEC);
+
+		seq_printf(seq, "%s usage_usec %llu user_usec %llu system_usec %llu\n",
+			   path, usage, utime, stime);
+	}
+	rcu_read_unlock();
+
+	kfree(path);
+	return 0;
+}
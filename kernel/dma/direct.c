@@ -107,6 +107,142 @@ static inline bool dma_should_free_from_pool(struct device *dev,
 	return false;
 }
 
+/*
+ * Single page coherent allocations for devices that need unencrypted memory
+ * are served from a cache of pages that were decrypted in bulk.  A refill
+ * decrypts a whole PMD sized block with one call so the direct map keeps its
+ * large page, and freed pages stay decrypted until the cache overflows, at
+ * which point a batch of them is re-encrypted with a single flush.
+ */
+#define DMA_DECRYPTED_CACHE_ORDER	\
+	min_t(unsigned int, PMD_SHIFT - PAGE_SHIFT, MAX_ORDER - 1)
+#define DMA_DECRYPTED_CACHE_MAX		(2UL << DMA_DECRYPTED_CACHE_ORDER)
+#define DMA_DECRYPTED_CACHE_BATCH	32
+#define DMA_DECRYPTED_CACHE_MAGIC	0x64656372UL
+
+static LIST_HEAD(dma_decrypted_pages);
+static DEFINE_SPINLOCK(dma_decrypted_lock);
+static unsigned long dma_decrypted_count;
+
+static int dma_set_pages_enc_dec(struct page **pages, int numpages, bool enc)
+{
+#ifdef set_pages_array_decrypted
+	return enc ? set_pages_array_encrypted(pages, numpages) :
+		     set_pages_array_decrypted(pages, numpages);
+#else
+	int i, ret;
+
+	for (i = 0; i < numpages; i++) {
+		unsigned long addr = (unsigned long)page_address(pages[i]);
+
+		ret = enc ? set_memory_encrypted(addr, 1) :
+			    set_memory_decrypted(addr, 1);
+		if (ret)
+			return ret;
+	}
+	return 0;
+#endif
+}
+
+static void dma_decrypted_cache_refill(void)
+{
+	unsigned int order = DMA_DECRYPTED_CACHE_ORDER;
+	struct page *pages[DMA_DECRYPTED_CACHE_BATCH];
+	struct page *page;
+	LIST_HEAD(list);
+	int i, nr;
+
+	page = alloc_pages(GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY, order);
+	if (page) {
+		if (set_memory_decrypted((unsigned long)page_address(page),
+					 1 << order)) {
+			__free_pages(page, order);
+			return;
+		}
+		split_page(page, order);
+		for (nr = 0; nr < (1 << order); nr++)
+			list_add_tail(&page[nr].lru, &list);
+	} else {
+		/* No large block available, decrypt a batch of single pages */
+		for (nr = 0; nr < DMA_DECRYPTED_CACHE_BATCH; nr++) {
+			pages[nr] = alloc_page(GFP_KERNEL | __GFP_NOWARN);
+			if (!pages[nr])
+				break;
+		}
+		if (nr && dma_set_pages_enc_dec(pages, nr, false)) {
+			for (i = 0; i < nr; i++)
+				__free_page(pages[i]);
+			return;
+		}
+		for (i = 0; i < nr; i++)
+			list_add_tail(&pages[i]->lru, &list);
+	}
+
+	spin_lock(&dma_decrypted_lock);
+	list_splice_tail(&list, &dma_decrypted_pages);
+	dma_decrypted_count += nr;
+	spin_unlock(&dma_decrypted_lock);
+}
+
+static struct page *dma_decrypted_cache_alloc(struct device *dev)
+{
+	struct page *page;
+
+	if (list_empty_careful(&dma_decrypted_pages))
+		dma_decrypted_cache_refill();
+
+	spin_lock(&dma_decrypted_lock);
+	page = list_first_entry_or_null(&dma_decrypted_pages, struct page, lru);
+	if (page && dma_coherent_ok(dev, page_to_phys(page), PAGE_SIZE)) {
+		list_del(&page->lru);
+		dma_decrypted_count--;
+	} else {
+		page = NULL;
+	}
+	spin_unlock(&dma_decrypted_lock);
+
+	if (page)
+		set_page_private(page, DMA_DECRYPTED_CACHE_MAGIC);
+	return page;
+}
+
+static bool dma_decrypted_cache_free(struct page *page)
+{
+	struct page *pages[DMA_DECRYPTED_CACHE_BATCH];
+	int i, nr = 0;
+
+	if (page_private(page) != DMA_DECRYPTED_CACHE_MAGIC)
+		return false;
+	set_page_private(page, 0);
+
+	spin_lock(&dma_decrypted_lock);
+	list_add(&page->lru, &dma_decrypted_pages);
+	if (++dma_decrypted_count > DMA_DECRYPTED_CACHE_MAX) {
+		/* Give back the coldest pages, encrypting them in one go */
+		while (nr < DMA_DECRYPTED_CACHE_BATCH) {
+			pages[nr] = list_last_entry(&dma_decrypted_pages,
+						    struct page, lru);
+			list_del(&pages[nr++]->lru);
+		}
+		dma_decrypted_count -= nr;
+	}
+	spin_unlock(&dma_decrypted_lock);
+
+	/* If memory cannot be re-encrypted, it must be leaked */
+	if (nr && !dma_set_pages_enc_dec(pages, nr, true)) {
+		for (i = 0; i < nr; i++)
+			__free_page(pages[i]);
+	}
+	return true;
+}
+
+static inline bool dma_use_decrypted_cache(struct device *dev, size_t size,
+		unsigned long attrs)
+{
+	return force_dma_unencrypted(dev) && size == PAGE_SIZE &&
+		!dma_alloc_need_uncached(dev, attrs);
+}
+
 static struct page *__dma_direct_alloc_pages(struct device *dev, size_t size,
 		gfp_t gfp, unsigned long attrs)
 {
@@ -172,6 +308,15 @@ void *dma_direct_alloc_pages(struct device *dev, size_t size,
 		goto done;
 	}
 
+	if (dma_use_decrypted_cache(dev, size, attrs)) {
+		page = dma_decrypted_cache_alloc(dev);
+		if (page) {
+			ret = page_address(page);
+			memset(ret, 0, size);
+			goto done;
+		}
+	}
+
 	page = __dma_direct_alloc_pages(dev, size, gfp, attrs);
 	if (!page)
 		return NULL;
@@ -273,6 +418,10 @@ void dma_direct_free_pages(struct device *dev, size_t size, void *cpu_addr,
 		return;
 	}
 
+	if (dma_use_decrypted_cache(dev, PAGE_ALIGN(size), attrs) &&
+	    dma_decrypted_cache_free(dma_direct_to_page(dev, dma_addr)))
+		return;
+
 	if (force_dma_unencrypted(dev))
 		set_memory_encrypted((unsigned long)cpu_addr, 1 << page_order);
 
@@ -10,6 +10,7 @@
 #include <linux/dma-noncoherent.h>
 #include <linux/init.h>
 #include <linux/genalloc.h>
+#include <linux/mem_encrypt.h>
 #include <linux/set_memory.h>
 #include <linux/slab.h>
 #include <linux/workqueue.h>
@@ -27,6 +28,16 @@ static size_t atomic_pool_size;
 /* Dynamic background expansion when the atomic pool is near capacity */
 static struct work_struct atomic_pool_work;
 
+/*
+ * Persistent pool of memory that is shared with the hypervisor when memory
+ * encryption is active.  Buffers allocated from it can be handed to
+ * dma_map_*() without being bounced through swiotlb.
+ */
+static struct gen_pool *dma_shared_pool __ro_after_init;
+static phys_addr_t dma_shared_start __ro_after_init;
+static phys_addr_t dma_shared_end __ro_after_init;
+static size_t dma_shared_pool_size = SZ_4M;
+
 static int __init early_coherent_pool(char *p)
 {
 	atomic_pool_size = memparse(p, &p);
@@ -34,6 +45,13 @@ static int __init early_coherent_pool(char *p)
 }
 early_param("coherent_pool", early_coherent_pool);
 
+static int __init early_dma_shared_pool(char *p)
+{
+	dma_shared_pool_size = memparse(p, &p);
+	return 0;
+}
+early_param("dma_shared_pool", early_dma_shared_pool);
+
 static void __init dma_atomic_pool_debugfs_init(void)
 {
 	struct dentry *root;
@@ -45,6 +63,9 @@ static void __init dma_atomic_pool_debugfs_init(void)
 	debugfs_create_ulong("pool_size_dma", 0400, root, &pool_size_dma);
 	debugfs_create_ulong("pool_size_dma32", 0400, root, &pool_size_dma32);
 	debugfs_create_ulong("pool_size_kernel", 0400, root, &pool_size_kernel);
+	if (dma_shared_pool)
+		debugfs_create_size_t("pool_size_shared", 0400, root,
+				      &dma_shared_pool_size);
 }
 
 static void dma_atomic_pool_size_add(gfp_t gfp, size_t size)
@@ -188,6 +209,67 @@ static __init struct gen_pool *__dma_atomic_pool_init(size_t pool_size,
 	return pool;
 }
 
+static void __init dma_shared_pool_init(void)
+{
+	unsigned int order;
+	struct page *page;
+	void *addr;
+
+	if (!mem_encrypt_active() || !dma_shared_pool_size)
+		return;
+
+	/* Cannot allocate larger than MAX_ORDER-1 */
+	order = min(get_order(dma_shared_pool_size), MAX_ORDER-1);
+	page = alloc_pages(GFP_KERNEL, order);
+	if (!page)
+		goto out;
+
+	addr = page_to_virt(page);
+	/*
+	 * The pool never shrinks, so the pages stay decrypted for the lifetime
+	 * of the system.
+	 */
+	if (set_memory_decrypted((unsigned long)addr, 1 << order))
+		goto free_page;
+	memset(addr, 0, PAGE_SIZE << order);
+
+	dma_shared_pool = gen_pool_create(L1_CACHE_SHIFT, NUMA_NO_NODE);
+	if (!dma_shared_pool)
+		goto encrypt_mapping;
+	if (gen_pool_add_virt(dma_shared_pool, (unsigned long)addr,
+			      page_to_phys(page), PAGE_SIZE << order,
+			      NUMA_NO_NODE))
+		goto destroy_pool;
+
+	/*
+	 * Give every page its own reference, so that single pages can be
+	 * handed out by dma_alloc_shared_page() and reference counted by
+	 * their users.  The pool holds that reference for good.
+	 */
+	split_page(page, order);
+
+	dma_shared_pool_size = PAGE_SIZE << order;
+	dma_shared_start = page_to_phys(page);
+	dma_shared_end = dma_shared_start + dma_shared_pool_size;
+	pr_info("DMA: preallocated %zu KiB shared pool for unencrypted buffers\n",
+		dma_shared_pool_size >> 10);
+	return;
+
+destroy_pool:
+	gen_pool_destroy(dma_shared_pool);
+	dma_shared_pool = NULL;
+encrypt_mapping:
+	if (WARN_ON_ONCE(set_memory_encrypted((unsigned long)addr, 1 << order))) {
+		/* Decrypt succeeded but encrypt failed, purposely leak */
+		goto out;
+	}
+free_page:
+	__free_pages(page, order);
+out:
+	pr_err("DMA: failed to allocate %zu KiB shared pool\n",
+	       dma_shared_pool_size >> 10);
+}
+
 static int __init dma_atomic_pool_init(void)
 {
 	int ret = 0;
@@ -220,6 +302,8 @@ static int __init dma_atomic_pool_init(void)
 			ret = -ENOMEM;
 	}
 
+	dma_shared_pool_init();
+
 	dma_atomic_pool_debugfs_init();
 	return ret;
 }
@@ -297,3 +381,88 @@ bool dma_free_from_pool(struct device *dev, void *start, size_t size)
 
 	return false;
 }
+
+/**
+ * dma_alloc_shared - allocate a buffer that is shared with the device
+ * @size:	size of the buffer in bytes
+ *
+ * Returns a zeroed buffer from the persistent shared pool, or %NULL if the
+ * pool is not in use or exhausted.  Callers are expected to fall back to a
+ * regular allocation in that case.  The buffer is still mapped with the
+ * normal streaming DMA API, which will not bounce it.
+ */
+void *dma_alloc_shared(size_t size)
+{
+	unsigned long addr;
+
+	if (!dma_shared_pool)
+		return NULL;
+
+	addr = gen_pool_alloc(dma_shared_pool, size);
+	if (!addr)
+		return NULL;
+
+	memset((void *)addr, 0, size);
+	return (void *)addr;
+}
+EXPORT_SYMBOL_GPL(dma_alloc_shared);
+
+/**
+ * dma_free_shared - free a buffer allocated by dma_alloc_shared()
+ * @vaddr:	buffer returned by dma_alloc_shared()
+ * @size:	size passed to dma_alloc_shared()
+ */
+void dma_free_shared(void *vaddr, size_t size)
+{
+	gen_pool_free(dma_shared_pool, (unsigned long)vaddr, size);
+}
+EXPORT_SYMBOL_GPL(dma_free_shared);
+
+/**
+ * dma_alloc_shared_page - allocate a whole page from the shared pool
+ *
+ * Like dma_alloc_shared(), but returns a page aligned page that is not
+ * cleared.  The page holds the reference of the pool: it must never be
+ * freed with put_page(), only given back with dma_free_shared_page() once
+ * all other references to it are gone.
+ */
+struct page *dma_alloc_shared_page(void)
+{
+	struct genpool_data_align align = { .align = PAGE_SIZE };
+	unsigned long addr;
+
+	if (!dma_shared_pool)
+		return NULL;
+
+	addr = gen_pool_alloc_algo(dma_shared_pool, PAGE_SIZE,
+				   gen_pool_first_fit_align, &align);
+	if (!addr)
+		return NULL;
+
+	return virt_to_page((void *)addr);
+}
+EXPORT_SYMBOL_GPL(dma_alloc_shared_page);
+
+/**
+ * dma_free_shared_page - free a page allocated by dma_alloc_shared_page()
+ * @page:	page returned by dma_alloc_shared_page()
+ */
+void dma_free_shared_page(struct page *page)
+{
+	VM_WARN_ON_ONCE(page_ref_count(page) != 1);
+	gen_pool_free(dma_shared_pool, (unsigned long)page_address(page),
+		      PAGE_SIZE);
+}
+EXPORT_SYMBOL_GPL(dma_free_shared_page);
+
+/**
+ * dma_is_shared - check whether a physical range lies in the shared pool
+ * @phys:	physical start address
+ * @size:	size of the range in bytes
+ */
+bool dma_is_shared(phys_addr_t phys, size_t size)
+{
+	return dma_shared_pool && phys >= dma_shared_start &&
+		phys + size <= dma_shared_end;
+}
+EXPORT_SYMBOL_GPL(dma_is_shared);
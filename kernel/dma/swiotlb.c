@@ -38,6 +38,7 @@
 #include <linux/set_memory.h>
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #endif
 
 #include <asm/io.h>
@@ -77,17 +78,35 @@ phys_addr_t io_tlb_start, io_tlb_end;
  */
 static unsigned long io_tlb_nslabs;
 
-/*
- * The number of used IO TLB block
- */
-static unsigned long io_tlb_used;
-
 /*
  * This is a free list describing the number of free entries available from
  * each index
  */
 static unsigned int *io_tlb_list;
-static unsigned int io_tlb_index;
+
+/*
+ * The slots are split into areas, each with its own lock and search index,
+ * so that CPUs mapping buffers at the same time do not all serialize on
+ * one lock.  A CPU allocates from its own area first and only looks at the
+ * others when that one is full.  Areas start on a segment boundary, so a
+ * free list run never crosses from one area into the next.
+ */
+struct io_tlb_area {
+	spinlock_t lock;	/* protects this area's part of io_tlb_list */
+	unsigned int start;	/* first slot of the area */
+	unsigned int nslabs;	/* number of slots in the area */
+	unsigned int index;	/* where to start the next search */
+	unsigned long used;	/* slots in use */
+} ____cacheline_aligned_in_smp;
+
+static struct io_tlb_area *io_tlb_areas;
+static unsigned int io_tlb_nareas;
+
+/* Requested number of areas, 0 means one per possible CPU */
+static unsigned int io_tlb_req_nareas;
+
+/* Mappings that failed because no area had room */
+static atomic_long_t io_tlb_alloc_failures;
 
 /*
  * Max segment that we can provide which (if pages are contingous) will
@@ -102,11 +121,6 @@ unsigned int max_segment;
 #define INVALID_PHYS_ADDR (~(phys_addr_t)0)
 static phys_addr_t *io_tlb_orig_addr;
 
-/*
- * Protect the above data structures in the map and unmap calls
- */
-static DEFINE_SPINLOCK(io_tlb_lock);
-
 static int late_alloc;
 
 static int __init
@@ -119,6 +133,11 @@ setup_io_tlb_npages(char *str)
 	}
 	if (*str == ',')
 		++str;
+	if (isdigit(*str)) {
+		io_tlb_req_nareas = simple_strtoul(str, &str, 0);
+		if (*str == ',')
+			++str;
+	}
 	if (!strcmp(str, "force")) {
 		swiotlb_force = SWIOTLB_FORCE;
 	} else if (!strcmp(str, "noforce")) {
@@ -152,6 +171,59 @@ void swiotlb_set_max_segment(unsigned int val)
 		max_segment = rounddown(val, PAGE_SIZE);
 }
 
+static unsigned long swiotlb_used(void)
+{
+	unsigned long used = 0;
+	unsigned int i;
+
+	for (i = 0; i < io_tlb_nareas; i++)
+		used += READ_ONCE(io_tlb_areas[i].used);
+
+	return used;
+}
+
+/*
+ * One area per possible CPU unless asked otherwise, rounded to a power of
+ * two, but never so many that an area is smaller than a segment.
+ */
+static unsigned int swiotlb_nareas(unsigned long nslabs)
+{
+	unsigned int nareas = io_tlb_req_nareas ?: num_possible_cpus();
+
+	nareas = roundup_pow_of_two(max(nareas, 1U));
+	while (nareas > 1 && nslabs / nareas < IO_TLB_SEGSIZE)
+		nareas >>= 1;
+
+	return nareas;
+}
+
+static void swiotlb_init_areas(struct io_tlb_area *areas, unsigned int nareas,
+			       unsigned long nslabs)
+{
+	unsigned int area_nslabs = rounddown(nslabs / nareas, IO_TLB_SEGSIZE);
+	unsigned int i;
+
+	for (i = 0; i < nareas; i++) {
+		spin_lock_init(&areas[i].lock);
+		areas[i].start = i * area_nslabs;
+		/* The last area takes what is left over */
+		areas[i].nslabs = i == nareas - 1 ?
+			nslabs - areas[i].start : area_nslabs;
+		areas[i].index = areas[i].start;
+		areas[i].used = 0;
+	}
+
+	io_tlb_areas = areas;
+	io_tlb_nareas = nareas;
+}
+
+static struct io_tlb_area *swiotlb_index_to_area(unsigned int index)
+{
+	unsigned int i = index / io_tlb_areas[0].nslabs;
+
+	return &io_tlb_areas[min(i, io_tlb_nareas - 1)];
+}
+
 /* default to 64MB */
 #define IO_TLB_DEFAULT_SIZE (64UL<<20)
 unsigned long swiotlb_size_or_default(void)
@@ -172,10 +244,10 @@ void swiotlb_print_info(void)
 		return;
 	}
 
-	pr_info("mapped [mem %#010llx-%#010llx] (%luMB)\n",
+	pr_info("mapped [mem %#010llx-%#010llx] (%luMB, %u areas)\n",
 	       (unsigned long long)io_tlb_start,
 	       (unsigned long long)io_tlb_end,
-	       bytes >> 20);
+	       bytes >> 20, io_tlb_nareas);
 }
 
 /*
@@ -200,6 +272,8 @@ void __init swiotlb_update_mem_attributes(void)
 
 int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 {
+	unsigned int nareas = swiotlb_nareas(nslabs);
+	struct io_tlb_area *areas;
 	unsigned long i, bytes;
 	size_t alloc_size;
 
@@ -226,11 +300,17 @@ int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 		panic("%s: Failed to allocate %zu bytes align=0x%lx\n",
 		      __func__, alloc_size, PAGE_SIZE);
 
+	alloc_size = PAGE_ALIGN(array_size(nareas, sizeof(*areas)));
+	areas = memblock_alloc(alloc_size, PAGE_SIZE);
+	if (!areas)
+		panic("%s: Failed to allocate %zu bytes align=0x%lx\n",
+		      __func__, alloc_size, PAGE_SIZE);
+
 	for (i = 0; i < io_tlb_nslabs; i++) {
 		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
 		io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
 	}
-	io_tlb_index = 0;
+	swiotlb_init_areas(areas, nareas, io_tlb_nslabs);
 
 	if (verbose)
 		swiotlb_print_info();
@@ -323,12 +403,16 @@ static void swiotlb_cleanup(void)
 	io_tlb_end = 0;
 	io_tlb_start = 0;
 	io_tlb_nslabs = 0;
+	io_tlb_areas = NULL;
+	io_tlb_nareas = 0;
 	max_segment = 0;
 }
 
 int
 swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 {
+	unsigned int nareas = swiotlb_nareas(nslabs);
+	struct io_tlb_area *areas;
 	unsigned long i, bytes;
 
 	bytes = nslabs << IO_TLB_SHIFT;
@@ -357,11 +441,15 @@ swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 	if (!io_tlb_orig_addr)
 		goto cleanup4;
 
+	areas = kcalloc(nareas, sizeof(*areas), GFP_KERNEL);
+	if (!areas)
+		goto cleanup5;
+
 	for (i = 0; i < io_tlb_nslabs; i++) {
 		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
 		io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
 	}
-	io_tlb_index = 0;
+	swiotlb_init_areas(areas, nareas, io_tlb_nslabs);
 
 	swiotlb_print_info();
 
@@ -371,6 +459,10 @@ swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 
 	return 0;
 
+cleanup5:
+	free_pages((unsigned long)io_tlb_orig_addr,
+		   get_order(io_tlb_nslabs * sizeof(phys_addr_t)));
+	io_tlb_orig_addr = NULL;
 cleanup4:
 	free_pages((unsigned long)io_tlb_list, get_order(io_tlb_nslabs *
 	                                                 sizeof(int)));
@@ -386,6 +478,7 @@ void __init swiotlb_exit(void)
 		return;
 
 	if (late_alloc) {
+		kfree(io_tlb_areas);
 		free_pages((unsigned long)io_tlb_orig_addr,
 			   get_order(io_tlb_nslabs * sizeof(phys_addr_t)));
 		free_pages((unsigned long)io_tlb_list, get_order(io_tlb_nslabs *
@@ -393,6 +486,9 @@ void __init swiotlb_exit(void)
 		free_pages((unsigned long)phys_to_virt(io_tlb_start),
 			   get_order(io_tlb_nslabs << IO_TLB_SHIFT));
 	} else {
+		memblock_free_late(__pa(io_tlb_areas),
+				   PAGE_ALIGN(array_size(io_tlb_nareas,
+							 sizeof(*io_tlb_areas))));
 		memblock_free_late(__pa(io_tlb_orig_addr),
 				   PAGE_ALIGN(io_tlb_nslabs * sizeof(phys_addr_t)));
 		memblock_free_late(__pa(io_tlb_list),
@@ -443,6 +539,73 @@ static void swiotlb_bounce(phys_addr_t orig_addr, phys_addr_t tlb_addr,
 	}
 }
 
+/*
+ * Find @nslots free contiguous slots in @area.  Returns the index of the
+ * first slot, or -1 if the area has no room.
+ */
+static int swiotlb_area_find_slots(struct io_tlb_area *area,
+				   unsigned int nslots, unsigned int stride,
+				   unsigned long offset_slots,
+				   unsigned long max_slots)
+{
+	unsigned int index, wrap, end = area->start + area->nslabs;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&area->lock, flags);
+
+	if (unlikely(nslots > area->nslabs - area->used))
+		goto not_found;
+
+	index = area->start + ALIGN(area->index - area->start, stride);
+	if (index >= end)
+		index = area->start;
+	wrap = index;
+
+	do {
+		while (iommu_is_span_boundary(index, nslots, offset_slots,
+					      max_slots)) {
+			index += stride;
+			if (index >= end)
+				index = area->start;
+			if (index == wrap)
+				goto not_found;
+		}
+
+		/*
+		 * If we find a slot that indicates we have 'nslots' number of
+		 * contiguous buffers, we allocate the buffers from that slot
+		 * and mark the entries as '0' indicating unavailable.
+		 */
+		if (io_tlb_list[index] >= nslots) {
+			int count = 0;
+
+			for (i = index; i < (int) (index + nslots); i++)
+				io_tlb_list[i] = 0;
+			for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE - 1) && io_tlb_list[i]; i--)
+				io_tlb_list[i] = ++count;
+
+			/*
+			 * Update the indices to avoid searching in the next
+			 * round.
+			 */
+			area->index = ((index + nslots) < end
+				       ? (index + nslots) : area->start);
+			area->used += nslots;
+
+			spin_unlock_irqrestore(&area->lock, flags);
+			return index;
+		}
+		index += stride;
+		if (index >= end)
+			index = area->start;
+	} while (index != wrap);
+
+not_found:
+	spin_unlock_irqrestore(&area->lock, flags);
+	return -1;
+}
+
 phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 				   dma_addr_t tbl_dma_addr,
 				   phys_addr_t orig_addr,
@@ -451,14 +614,12 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 				   enum dma_data_direction dir,
 				   unsigned long attrs)
 {
-	unsigned long flags;
 	phys_addr_t tlb_addr;
-	unsigned int nslots, stride, index, wrap;
-	int i;
+	unsigned int nslots, stride, start, n;
+	int i, index = -1;
 	unsigned long mask;
 	unsigned long offset_slots;
 	unsigned long max_slots;
-	unsigned long tmp_io_tlb_used;
 
 	if (no_iotlb_memory)
 		panic("Can not allocate SWIOTLB buffer earlier and can't now provide you with the DMA bounce buffer");
@@ -499,67 +660,29 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 
 	/*
 	 * Find suitable number of IO TLB entries size that will fit this
-	 * request and allocate a buffer from that IO TLB pool.
+	 * request and allocate a buffer from that IO TLB pool, starting
+	 * with the area of this CPU.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
-
-	if (unlikely(nslots > io_tlb_nslabs - io_tlb_used))
-		goto not_found;
-
-	index = ALIGN(io_tlb_index, stride);
-	if (index >= io_tlb_nslabs)
-		index = 0;
-	wrap = index;
-
-	do {
-		while (iommu_is_span_boundary(index, nslots, offset_slots,
-					      max_slots)) {
-			index += stride;
-			if (index >= io_tlb_nslabs)
-				index = 0;
-			if (index == wrap)
-				goto not_found;
-		}
-
-		/*
-		 * If we find a slot that indicates we have 'nslots' number of
-		 * contiguous buffers, we allocate the buffers from that slot
-		 * and mark the entries as '0' indicating unavailable.
-		 */
-		if (io_tlb_list[index] >= nslots) {
-			int count = 0;
-
-			for (i = index; i < (int) (index + nslots); i++)
-				io_tlb_list[i] = 0;
-			for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE - 1) && io_tlb_list[i]; i--)
-				io_tlb_list[i] = ++count;
-			tlb_addr = io_tlb_start + (index << IO_TLB_SHIFT);
-
-			/*
-			 * Update the indices to avoid searching in the next
-			 * round.
-			 */
-			io_tlb_index = ((index + nslots) < io_tlb_nslabs
-					? (index + nslots) : 0);
-
-			goto found;
-		}
-		index += stride;
-		if (index >= io_tlb_nslabs)
-			index = 0;
-	} while (index != wrap);
+	start = raw_smp_processor_id() & (io_tlb_nareas - 1);
+	for (n = 0; n < io_tlb_nareas; n++) {
+		struct io_tlb_area *area;
+
+		area = &io_tlb_areas[(start + n) & (io_tlb_nareas - 1)];
+		index = swiotlb_area_find_slots(area, nslots, stride,
+						offset_slots, max_slots);
+		if (index >= 0)
+			break;
+	}
 
-not_found:
-	tmp_io_tlb_used = io_tlb_used;
+	if (index < 0) {
+		atomic_long_inc(&io_tlb_alloc_failures);
+		if (!(attrs & DMA_ATTR_NO_WARN) && printk_ratelimit())
+			dev_warn(hwdev, "swiotlb buffer is full (sz: %zd bytes), total %lu (slots), used %lu (slots)\n",
+				 alloc_size, io_tlb_nslabs, swiotlb_used());
+		return (phys_addr_t)DMA_MAPPING_ERROR;
+	}
 
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
-	if (!(attrs & DMA_ATTR_NO_WARN) && printk_ratelimit())
-		dev_warn(hwdev, "swiotlb buffer is full (sz: %zd bytes), total %lu (slots), used %lu (slots)\n",
-			 alloc_size, io_tlb_nslabs, tmp_io_tlb_used);
-	return (phys_addr_t)DMA_MAPPING_ERROR;
-found:
-	io_tlb_used += nslots;
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	tlb_addr = io_tlb_start + ((phys_addr_t)index << IO_TLB_SHIFT);
 
 	/*
 	 * Save away the mapping from the original address to the DMA address.
@@ -586,6 +709,7 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 	int i, count, nslots = ALIGN(alloc_size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
 	int index = (tlb_addr - io_tlb_start) >> IO_TLB_SHIFT;
 	phys_addr_t orig_addr = io_tlb_orig_addr[index];
+	struct io_tlb_area *area = swiotlb_index_to_area(index);
 
 	/*
 	 * First, sync the memory before unmapping the entry
@@ -601,7 +725,7 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 	 * While returning the entries to the free list, we merge the entries
 	 * with slots below and above the pool being returned.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
+	spin_lock_irqsave(&area->lock, flags);
 	{
 		count = ((index + nslots) < ALIGN(index + 1, IO_TLB_SEGSIZE) ?
 			 io_tlb_list[index + nslots] : 0);
@@ -620,9 +744,9 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 		for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE -1) && io_tlb_list[i]; i--)
 			io_tlb_list[i] = ++count;
 
-		io_tlb_used -= nslots;
+		area->used -= nslots;
 	}
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	spin_unlock_irqrestore(&area->lock, flags);
 }
 
 void swiotlb_tbl_sync_single(struct device *hwdev, phys_addr_t tlb_addr,
@@ -707,13 +831,47 @@ bool is_swiotlb_active(void)
 
 #ifdef CONFIG_DEBUG_FS
 
+static int io_tlb_used_get(void *data, u64 *val)
+{
+	*val = swiotlb_used();
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(fops_io_tlb_used, io_tlb_used_get, NULL, "%llu\n");
+
+static int io_tlb_alloc_failures_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&io_tlb_alloc_failures);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(fops_io_tlb_alloc_failures, io_tlb_alloc_failures_get,
+			 NULL, "%llu\n");
+
+static int io_tlb_areas_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	seq_puts(m, "area      start     slots      used\n");
+	for (i = 0; i < io_tlb_nareas; i++)
+		seq_printf(m, "%4u %10u %9u %9lu\n", i, io_tlb_areas[i].start,
+			   io_tlb_areas[i].nslabs,
+			   READ_ONCE(io_tlb_areas[i].used));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(io_tlb_areas);
+
 static int __init swiotlb_create_debugfs(void)
 {
 	struct dentry *root;
 
 	root = debugfs_create_dir("swiotlb", NULL);
 	debugfs_create_ulong("io_tlb_nslabs", 0400, root, &io_tlb_nslabs);
-	debugfs_create_ulong("io_tlb_used", 0400, root, &io_tlb_used);
+	debugfs_create_file_unsafe("io_tlb_used", 0400, root, NULL,
+				   &fops_io_tlb_used);
+	debugfs_create_u32("io_tlb_nareas", 0400, root, &io_tlb_nareas);
+	debugfs_create_file("io_tlb_areas", 0400, root, NULL,
+			    &io_tlb_areas_fops);
+	debugfs_create_file_unsafe("io_tlb_alloc_failures", 0400, root, NULL,
+				   &fops_io_tlb_alloc_failures);
 	return 0;
 }
 
@@ -368,10 +368,26 @@ struct vm_area_struct *vm_area_dup(struct vm_area_struct *orig)
 	return new;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void __vm_area_free(struct rcu_head *head)
+{
+	struct vm_area_struct *vma = container_of(head, struct vm_area_struct,
+						  vm_rcu);
+
+	kmem_cache_free(vm_area_cachep, vma);
+}
+
+void vm_area_free(struct vm_area_struct *vma)
+{
+	/* Speculative page faults look VMAs up without mmap_lock */
+	call_rcu(&vma->vm_rcu, __vm_area_free);
+}
+#else
 void vm_area_free(struct vm_area_struct *vma)
 {
 	kmem_cache_free(vm_area_cachep, vma);
 }
+#endif
 
 static void account_kernel_stack(struct task_struct *tsk, int account)
 {
@@ -682,6 +698,7 @@ void __mmdrop(struct mm_struct *mm)
 	destroy_context(mm);
 	mmu_notifier_subscriptions_destroy(mm);
 	check_mm(mm);
+	futex_mm_free(mm);
 	put_user_ns(mm->user_ns);
 	free_mm(mm);
 }
@@ -1017,6 +1034,9 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 	spin_lock_init(&mm->arg_lock);
 	mm_init_cpumask(mm);
 	mm_init_aio(mm);
+#ifdef CONFIG_FUTEX
+	mm->futex_hash = NULL;
+#endif
 	mm_init_owner(mm, p);
 	RCU_INIT_POINTER(mm->exe_file, NULL);
 	mmu_notifier_subscriptions_init(mm);
@@ -1025,6 +1045,11 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 	mm->pmd_huge_pte = NULL;
 #endif
 	mm_init_uprobes_state(mm);
+	lru_gen_init_mm(mm);
+#ifdef CONFIG_KSM
+	atomic_long_set(&mm->ksm_merging_pages, 0);
+	atomic_long_set(&mm->ksm_rmap_items, 0);
+#endif
 
 	if (current->mm) {
 		mm->flags = current->mm->flags & MMF_INIT_MASK;
@@ -1075,6 +1100,7 @@ static inline void __mmput(struct mm_struct *mm)
 	khugepaged_exit(mm); /* must run before exit_mmap */
 	exit_mmap(mm);
 	mm_put_huge_zero_page(mm);
+	task_numa_mm_exit(mm);
 	set_mm_exe_file(mm, NULL);
 	if (!list_empty(&mm->mmlist)) {
 		spin_lock(&mmlist_lock);
@@ -1083,6 +1109,7 @@ static inline void __mmput(struct mm_struct *mm)
 	}
 	if (mm->binfmt)
 		module_put(mm->binfmt->module);
+	lru_gen_del_mm(mm);
 	mmdrop(mm);
 }
 
@@ -2023,6 +2050,10 @@ static __latent_entropy struct task_struct *copy_process(
 
 	p->pagefault_disabled = 0;
 
+#ifdef CONFIG_IO_URING
+	p->io_uring = NULL;
+#endif
+
 #ifdef CONFIG_LOCKDEP
 	lockdep_init_task(p);
 #endif
@@ -2449,6 +2480,13 @@ long _do_fork(struct kernel_clone_args *args)
 		get_task_struct(p);
 	}
 
+	if (IS_ENABLED(CONFIG_LRU_GEN) && !(clone_flags & CLONE_VM) && p->mm) {
+		/* Lock the task to synchronize with memcg migration */
+		task_lock(p);
+		lru_gen_add_mm(p->mm);
+		task_unlock(p);
+	}
+
 	wake_up_new_task(p);
 
 	/* forking complete and child started to run, tell ptracer */
@@ -8,6 +8,9 @@
 #include <linux/slab.h>
 #include <linux/cpu.h>
 #include <linux/sort.h>
+#include <linux/sched/topology.h>
+
+#include "internals.h"
 
 static void irq_spread_init_one(struct cpumask *irqmsk, struct cpumask *nmsk,
 				unsigned int cpus_per_vec)
@@ -113,47 +116,20 @@ static int ncpus_cmp_func(const void *l, const void *r)
 }
 
 /*
- * Allocate vector number for each node, so that for each node:
- *
- * 1) the allocated number is >= 1
- *
- * 2) the allocated numbver is <= active CPU number of this node
- *
- * The actual allocated total vectors may be less than @numvecs when
- * active total CPU number is less than @numvecs.
- *
- * Active CPUs means the CPUs in '@cpu_mask AND @node_to_cpumask[]'
- * for each node.
+ * Allocate vector number for each of @ngroups groups of CPUs (NUMA nodes
+ * or LLC domains), see alloc_nodes_vectors().  Groups without active CPUs
+ * have ncpus set to UINT_MAX and are skipped.
  */
-static void alloc_nodes_vectors(unsigned int numvecs,
-				cpumask_var_t *node_to_cpumask,
-				const struct cpumask *cpu_mask,
-				const nodemask_t nodemsk,
-				struct cpumask *nmsk,
-				struct node_vectors *node_vectors)
+static void alloc_groups_vectors(unsigned int numvecs,
+				 unsigned int remaining_ncpus,
+				 unsigned int ngroups,
+				 struct node_vectors *node_vectors)
 {
-	unsigned n, remaining_ncpus = 0;
-
-	for (n = 0; n < nr_node_ids; n++) {
-		node_vectors[n].id = n;
-		node_vectors[n].ncpus = UINT_MAX;
-	}
-
-	for_each_node_mask(n, nodemsk) {
-		unsigned ncpus;
-
-		cpumask_and(nmsk, cpu_mask, node_to_cpumask[n]);
-		ncpus = cpumask_weight(nmsk);
-
-		if (!ncpus)
-			continue;
-		remaining_ncpus += ncpus;
-		node_vectors[n].ncpus = ncpus;
-	}
+	unsigned n;
 
 	numvecs = min_t(unsigned, remaining_ncpus, numvecs);
 
-	sort(node_vectors, nr_node_ids, sizeof(node_vectors[0]),
+	sort(node_vectors, ngroups, sizeof(node_vectors[0]),
 	     ncpus_cmp_func, NULL);
 
 	/*
@@ -224,7 +200,7 @@ static void alloc_nodes_vectors(unsigned int numvecs,
 	 * finally for each node X: vecs(X) <= ncpu(X).
 	 *
 	 */
-	for (n = 0; n < nr_node_ids; n++) {
+	for (n = 0; n < ngroups; n++) {
 		unsigned nvectors, ncpus;
 
 		if (node_vectors[n].ncpus == UINT_MAX)
@@ -244,15 +220,159 @@ static void alloc_nodes_vectors(unsigned int numvecs,
 	}
 }
 
+/*
+ * Allocate vector number for each node, so that for each node:
+ *
+ * 1) the allocated number is >= 1
+ *
+ * 2) the allocated numbver is <= active CPU number of this node
+ *
+ * The actual allocated total vectors may be less than @numvecs when
+ * active total CPU number is less than @numvecs.
+ *
+ * Active CPUs means the CPUs in '@cpu_mask AND @node_to_cpumask[]'
+ * for each node.
+ */
+static void alloc_nodes_vectors(unsigned int numvecs,
+				cpumask_var_t *node_to_cpumask,
+				const struct cpumask *cpu_mask,
+				const nodemask_t nodemsk,
+				struct cpumask *nmsk,
+				struct node_vectors *node_vectors)
+{
+	unsigned n, remaining_ncpus = 0;
+
+	for (n = 0; n < nr_node_ids; n++) {
+		node_vectors[n].id = n;
+		node_vectors[n].ncpus = UINT_MAX;
+	}
+
+	for_each_node_mask(n, nodemsk) {
+		unsigned ncpus;
+
+		cpumask_and(nmsk, cpu_mask, node_to_cpumask[n]);
+		ncpus = cpumask_weight(nmsk);
+
+		if (!ncpus)
+			continue;
+		remaining_ncpus += ncpus;
+		node_vectors[n].ncpus = ncpus;
+	}
+
+	alloc_groups_vectors(numvecs, remaining_ncpus, nr_node_ids,
+			     node_vectors);
+}
+
+/* Spread @nvectors vectors evenly over the CPUs in @nmsk */
+static unsigned int irq_spread_vectors(struct irq_affinity_desc *masks,
+				       unsigned int curvec,
+				       unsigned int firstvec,
+				       unsigned int last_affv,
+				       struct cpumask *nmsk,
+				       unsigned int nvectors)
+{
+	unsigned int v, cpus_per_vec, extra_vecs;
+	unsigned int ncpus = cpumask_weight(nmsk);
+
+	/* Account for rounding errors */
+	extra_vecs = ncpus - nvectors * (ncpus / nvectors);
+
+	for (v = 0; v < nvectors; v++, curvec++) {
+		cpus_per_vec = ncpus / nvectors;
+
+		/* Account for extra vectors to compensate rounding errors */
+		if (extra_vecs) {
+			cpus_per_vec++;
+			--extra_vecs;
+		}
+
+		/*
+		 * wrapping has to be considered given 'startvec'
+		 * may start anywhere
+		 */
+		if (curvec >= last_affv)
+			curvec = firstvec;
+		irq_spread_init_one(&masks[curvec].mask, nmsk,
+					cpus_per_vec);
+	}
+	return curvec;
+}
+
+/*
+ * Spread @nvectors vectors over the CPUs in @nmsk so that no vector spans
+ * more than one last level cache.  The vectors are distributed over the
+ * LLC domains in @nmsk the same way they are distributed over the nodes.
+ *
+ * Returns the next vector, or a negative value if there are fewer vectors
+ * than LLC domains (or the domains are not known) and the caller has to
+ * spread over the whole node instead.
+ */
+static int irq_spread_vectors_llc(struct irq_affinity_desc *masks,
+				  unsigned int curvec,
+				  unsigned int firstvec,
+				  unsigned int last_affv,
+				  struct cpumask *nmsk,
+				  unsigned int nvectors,
+				  struct cpumask *lmsk)
+{
+	unsigned int ncpus = cpumask_weight(nmsk);
+	unsigned int g, ngroups = 0;
+	struct node_vectors *groups;
+	int cpu, sibl;
+
+	/* LLC ids of CPUs which are not online are meaningless */
+	if (nvectors < 2 || !cpumask_subset(nmsk, cpu_online_mask))
+		return -1;
+
+	groups = kcalloc(ncpus, sizeof(*groups), GFP_KERNEL);
+	if (!groups)
+		return -1;
+
+	cpumask_copy(lmsk, nmsk);
+	for_each_cpu(cpu, lmsk) {
+		unsigned int n = 0;
+
+		for_each_cpu(sibl, lmsk) {
+			if (!cpus_share_cache(cpu, sibl))
+				continue;
+			cpumask_clear_cpu(sibl, lmsk);
+			n++;
+		}
+		groups[ngroups].id = cpu;
+		groups[ngroups].ncpus = n;
+		ngroups++;
+	}
+
+	if (nvectors < ngroups || ngroups == 1) {
+		kfree(groups);
+		return -1;
+	}
+
+	alloc_groups_vectors(nvectors, ncpus, ngroups, groups);
+
+	for (g = 0; g < ngroups; g++) {
+		cpumask_clear(lmsk);
+		for_each_cpu(sibl, nmsk)
+			if (cpus_share_cache(groups[g].id, sibl))
+				cpumask_set_cpu(sibl, lmsk);
+
+		curvec = irq_spread_vectors(masks, curvec, firstvec, last_affv,
+					    lmsk, groups[g].nvectors);
+	}
+	kfree(groups);
+	return curvec;
+}
+
 static int __irq_build_affinity_masks(unsigned int startvec,
 				      unsigned int numvecs,
 				      unsigned int firstvec,
 				      cpumask_var_t *node_to_cpumask,
 				      const struct cpumask *cpu_mask,
 				      struct cpumask *nmsk,
+				      struct cpumask *lmsk,
 				      struct irq_affinity_desc *masks)
 {
-	unsigned int i, n, nodes, cpus_per_vec, extra_vecs, done = 0;
+	unsigned int i, n, nodes, done = 0;
 	unsigned int last_affv = firstvec + numvecs;
 	unsigned int curvec = startvec;
 	nodemask_t nodemsk = NODE_MASK_NONE;
@@ -288,8 +408,9 @@ static int __irq_build_affinity_masks(unsigned int startvec,
 			    nodemsk, nmsk, node_vectors);
 
 	for (i = 0; i < nr_node_ids; i++) {
-		unsigned int ncpus, v;
+		unsigned int ncpus;
 		struct node_vectors *nv = &node_vectors[i];
+		int next;
 
 		if (nv->nvectors == UINT_MAX)
 			continue;
@@ -302,28 +423,17 @@ static int __irq_build_affinity_masks(unsigned int startvec,
 
 		WARN_ON_ONCE(nv->nvectors > ncpus);
 
-		/* Account for rounding errors */
-		extra_vecs = ncpus - nv->nvectors * (ncpus / nv->nvectors);
-
 		/* Spread allocated vectors on CPUs of the current node */
-		for (v = 0; v < nv->nvectors; v++, curvec++) {
-			cpus_per_vec = ncpus / nv->nvectors;
-
-			/* Account for extra vectors to compensate rounding errors */
-			if (extra_vecs) {
-				cpus_per_vec++;
-				--extra_vecs;
-			}
-
-			/*
-			 * wrapping has to be considered given 'startvec'
-			 * may start anywhere
-			 */
-			if (curvec >= last_affv)
-				curvec = firstvec;
-			irq_spread_init_one(&masks[curvec].mask, nmsk,
-						cpus_per_vec);
-		}
+		next = -1;
+		if (irq_llc_aware)
+			next = irq_spread_vectors_llc(masks, curvec, firstvec,
+						      last_affv, nmsk,
+						      nv->nvectors, lmsk);
+		if (next < 0)
+			next = irq_spread_vectors(masks, curvec, firstvec,
+						  last_affv, nmsk,
+						  nv->nvectors);
+		curvec = next;
 		done += nv->nvectors;
 	}
 	kfree(node_vectors);
@@ -341,7 +451,7 @@ static int irq_build_affinity_masks(unsigned int startvec, unsigned int numvecs,
 {
 	unsigned int curvec = startvec, nr_present = 0, nr_others = 0;
 	cpumask_var_t *node_to_cpumask;
-	cpumask_var_t nmsk, npresmsk;
+	cpumask_var_t nmsk, npresmsk, lmsk;
 	int ret = -ENOMEM;
 
 	if (!zalloc_cpumask_var(&nmsk, GFP_KERNEL))
@@ -350,9 +460,12 @@ static int irq_build_affinity_masks(unsigned int startvec, unsigned int numvecs,
 	if (!zalloc_cpumask_var(&npresmsk, GFP_KERNEL))
 		goto fail_nmsk;
 
+	if (!zalloc_cpumask_var(&lmsk, GFP_KERNEL))
+		goto fail_npresmsk;
+
 	node_to_cpumask = alloc_node_to_cpumask();
 	if (!node_to_cpumask)
-		goto fail_npresmsk;
+		goto fail_lmsk;
 
 	/* Stabilize the cpumasks */
 	get_online_cpus();
@@ -361,7 +474,7 @@ static int irq_build_affinity_masks(unsigned int startvec, unsigned int numvecs,
 	/* Spread on present CPUs starting from affd->pre_vectors */
 	ret = __irq_build_affinity_masks(curvec, numvecs, firstvec,
 					 node_to_cpumask, cpu_present_mask,
-					 nmsk, masks);
+					 nmsk, lmsk, masks);
 	if (ret < 0)
 		goto fail_build_affinity;
 	nr_present = ret;
@@ -379,7 +492,7 @@ static int irq_build_affinity_masks(unsigned int startvec, unsigned int numvecs,
 	cpumask_andnot(npresmsk, cpu_possible_mask, cpu_present_mask);
 	ret = __irq_build_affinity_masks(curvec, numvecs, firstvec,
 					 node_to_cpumask, npresmsk, nmsk,
-					 masks);
+					 lmsk, masks);
 	if (ret >= 0)
 		nr_others = ret;
 
@@ -391,6 +504,9 @@ static int irq_build_affinity_masks(unsigned int startvec, unsigned int numvecs,
 
 	free_node_to_cpumask(node_to_cpumask);
 
+ fail_lmsk:
+	free_cpumask_var(lmsk);
+
  fail_npresmsk:
 	free_cpumask_var(npresmsk);
 
@@ -134,8 +134,10 @@ extern int irq_do_set_affinity(struct irq_data *data,
 			       const struct cpumask *dest, bool force);
 
 #ifdef CONFIG_SMP
+extern bool irq_llc_aware;
 extern int irq_setup_affinity(struct irq_desc *desc);
 #else
+# define irq_llc_aware		(false)
 static inline int irq_setup_affinity(struct irq_desc *desc) { return 0; }
 #endif
 
@@ -38,6 +38,19 @@ static int __init irq_affinity_setup(char *str)
 }
 __setup("irqaffinity=", irq_affinity_setup);
 
+/*
+ * Keep managed interrupt spreading and vector allocation within last level
+ * cache domains.
+ */
+bool irq_llc_aware __read_mostly;
+
+static int __init irq_llc_aware_setup(char *str)
+{
+	irq_llc_aware = true;
+	return 1;
+}
+__setup("irq_llc_aware", irq_llc_aware_setup);
+
 static void __init init_irq_default_affinity(void)
 {
 	if (!cpumask_available(irq_default_affinity))
@@ -7,6 +7,9 @@
 #include <linux/percpu.h>
 #include <linux/cpu.h>
 #include <linux/irq.h>
+#include <linux/sched/topology.h>
+
+#include "internals.h"
 
 #define IRQ_MATRIX_SIZE	(BITS_TO_LONGS(IRQ_MATRIX_BITS))
 
@@ -34,6 +37,8 @@ struct irq_matrix {
 	struct cpumap __percpu	*maps;
 	unsigned long		scratch_map[IRQ_MATRIX_SIZE];
 	unsigned long		system_map[IRQ_MATRIX_SIZE];
+	struct cpumask		scratch_cpus;
+	struct cpumask		llc_cpus;
 };
 
 #define CREATE_TRACE_POINTS
@@ -125,6 +130,58 @@ static unsigned int matrix_alloc_area(struct irq_matrix *m, struct cpumap *cm,
 	return area;
 }
 
+/*
+ * Narrow @msk down to the CPUs of the last level cache domain with the
+ * lowest average number of allocated (or managed allocated) vectors per
+ * online CPU, so interrupts are balanced across LLCs before CPUs.
+ */
+static const struct cpumask *matrix_find_best_llc(struct irq_matrix *m,
+						  const struct cpumask *msk,
+						  bool managed)
+{
+	unsigned int cpu, sibl, best_cpu = UINT_MAX;
+	unsigned int best_load = 0, best_n = 0;
+	struct cpumap *cm;
+
+	if (!irq_llc_aware)
+		return msk;
+
+	cpumask_copy(&m->scratch_cpus, msk);
+	for_each_cpu(cpu, &m->scratch_cpus) {
+		unsigned int load = 0, n = 0;
+
+		for_each_cpu(sibl, &m->scratch_cpus) {
+			if (!cpus_share_cache(cpu, sibl))
+				continue;
+			__cpumask_clear_cpu(sibl, &m->scratch_cpus);
+
+			cm = per_cpu_ptr(m->maps, sibl);
+			if (!cm->online)
+				continue;
+			load += managed ? cm->managed_allocated : cm->allocated;
+			n++;
+		}
+
+		if (!n)
+			continue;
+		/* load / n < best_load / best_n */
+		if (best_cpu == UINT_MAX || load * best_n < best_load * n) {
+			best_cpu = cpu;
+			best_load = load;
+			best_n = n;
+		}
+	}
+
+	if (best_cpu == UINT_MAX)
+		return msk;
+
+	cpumask_clear(&m->llc_cpus);
+	for_each_cpu(sibl, msk)
+		if (cpus_share_cache(best_cpu, sibl))
+			__cpumask_set_cpu(sibl, &m->llc_cpus);
+	return &m->llc_cpus;
+}
+
 /* Find the best CPU which has the lowest vector allocation count */
 static unsigned int matrix_find_best_cpu(struct irq_matrix *m,
 					const struct cpumask *msk)
@@ -291,7 +348,10 @@ int irq_matrix_alloc_managed(struct irq_matrix *m, const struct cpumask *msk,
 	if (cpumask_empty(msk))
 		return -EINVAL;
 
-	cpu = matrix_find_best_cpu_managed(m, msk);
+	cpu = matrix_find_best_cpu_managed(m,
+					   matrix_find_best_llc(m, msk, true));
+	if (cpu == UINT_MAX)
+		cpu = matrix_find_best_cpu_managed(m, msk);
 	if (cpu == UINT_MAX)
 		return -ENOSPC;
 
@@ -380,7 +440,9 @@ int irq_matrix_alloc(struct irq_matrix *m, const struct cpumask *msk,
 	unsigned int cpu, bit;
 	struct cpumap *cm;
 
-	cpu = matrix_find_best_cpu(m, msk);
+	cpu = matrix_find_best_cpu(m, matrix_find_best_llc(m, msk, false));
+	if (cpu == UINT_MAX)
+		cpu = matrix_find_best_cpu(m, msk);
 	if (cpu == UINT_MAX)
 		return -ENOSPC;
 
@@ -513,6 +513,89 @@ void msi_domain_free_irqs(struct irq_domain *domain, struct device *dev)
 	}
 }
 
+/**
+ * msi_domain_alloc_irq_desc - Allocate interrupts for a single MSI descriptor
+ * @domain:	The domain to allocate from
+ * @dev:	Pointer to device struct of the device owning @desc
+ * @desc:	The MSI descriptor, already added to the MSI list of @dev
+ *
+ * Used for descriptors added after the initial msi_domain_alloc_irqs() call,
+ * e.g. MSI-X entries which are allocated on demand.
+ *
+ * Returns 0 on success or an error code.
+ */
+int msi_domain_alloc_irq_desc(struct irq_domain *domain, struct device *dev,
+			      struct msi_desc *desc)
+{
+	struct msi_domain_info *info = domain->host_data;
+	struct msi_domain_ops *ops = info->ops;
+	struct irq_data *irq_data;
+	msi_alloc_info_t arg;
+	int i, ret, virq;
+	bool can_reserve;
+
+	ret = msi_domain_prepare_irqs(domain, dev, desc->nvec_used, &arg);
+	if (ret)
+		return ret;
+
+	ops->set_desc(&arg, desc);
+
+	virq = __irq_domain_alloc_irqs(domain, -1, desc->nvec_used,
+				       dev_to_node(dev), &arg, false,
+				       desc->affinity);
+	if (virq < 0) {
+		ret = -ENOSPC;
+		if (ops->handle_error)
+			ret = ops->handle_error(domain, desc, ret);
+		if (ops->msi_finish)
+			ops->msi_finish(&arg, ret);
+		return ret;
+	}
+
+	for (i = 0; i < desc->nvec_used; i++) {
+		irq_set_msi_desc_off(virq, i, desc);
+		irq_debugfs_copy_devname(virq + i, dev);
+	}
+
+	if (ops->msi_finish)
+		ops->msi_finish(&arg, 0);
+
+	if (!(info->flags & MSI_FLAG_ACTIVATE_EARLY))
+		return 0;
+
+	can_reserve = msi_check_reservation_mode(domain, info, dev);
+
+	irq_data = irq_domain_get_irq_data(domain, desc->irq);
+	if (!can_reserve) {
+		irqd_clr_can_reserve(irq_data);
+		if (domain->flags & IRQ_DOMAIN_MSI_NOMASK_QUIRK)
+			irqd_set_msi_nomask_quirk(irq_data);
+	}
+	ret = irq_domain_activate_irq(irq_data, can_reserve);
+	if (ret) {
+		msi_domain_free_irq_desc(domain, desc);
+		return ret;
+	}
+
+	/* See msi_domain_alloc_irqs() */
+	if (can_reserve)
+		irqd_clr_activated(irq_data);
+	return 0;
+}
+
+/**
+ * msi_domain_free_irq_desc - Free the interrupts of a single MSI descriptor
+ * @domain:	The domain managing the interrupts
+ * @desc:	The MSI descriptor
+ */
+void msi_domain_free_irq_desc(struct irq_domain *domain, struct msi_desc *desc)
+{
+	if (desc->irq) {
+		irq_domain_free_irqs(desc->irq, desc->nvec_used);
+		desc->irq = 0;
+	}
+}
+
 /**
  * msi_get_domain_info - Get the MSI interrupt domain info for @domain
  * @domain:	The interrupt domain to retrieve data from
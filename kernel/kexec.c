@@ -16,6 +16,7 @@
 #include <linux/syscalls.h>
 #include <linux/vmalloc.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
 
 #include "kexec_internal.h"
 
@@ -108,6 +109,7 @@ static int do_kexec_load(unsigned long entry, unsigned long nr_segments,
 {
 	struct kimage **dest_image, *image;
 	unsigned long i;
+	u64 start;
 	int ret;
 
 	if (flags & KEXEC_ON_CRASH) {
@@ -151,11 +153,13 @@ static int do_kexec_load(unsigned long entry, unsigned long nr_segments,
 	if (ret)
 		goto out;
 
+	start = ktime_get_ns();
 	for (i = 0; i < nr_segments; i++) {
 		ret = kimage_load_segment(image, &image->segment[i]);
 		if (ret)
 			goto out;
 	}
+	image->load_stats.total_ns = ktime_get_ns() - start;
 
 	kimage_terminate(image);
 
@@ -163,6 +167,8 @@ static int do_kexec_load(unsigned long entry, unsigned long nr_segments,
 	if (ret)
 		goto out;
 
+	kexec_last_load_stats = image->load_stats;
+
 	/* Install the new kernel and uninstall the old */
 	image = xchg(dest_image, image);
 
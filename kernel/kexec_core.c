@@ -37,6 +37,8 @@
 #include <linux/compiler.h>
 #include <linux/hugetlb.h>
 #include <linux/frame.h>
+#include <linux/ktime.h>
+#include <linux/padata.h>
 
 #include <asm/page.h>
 #include <asm/sections.h>
@@ -275,6 +277,9 @@ struct kimage *do_kimage_alloc_init(void)
 	/* Initialize the list of unusable pages */
 	INIT_LIST_HEAD(&image->unusable_pages);
 
+	/* Initialize the list of spare segment pages */
+	INIT_LIST_HEAD(&image->spare_pages);
+
 	return image;
 }
 
@@ -588,6 +593,8 @@ static void kimage_free_extra_pages(struct kimage *image)
 	/* Walk through and free any unusable pages I have cached */
 	kimage_free_page_list(&image->unusable_pages);
 
+	/* And any spare pages left over from loading the segments */
+	kimage_free_page_list(&image->spare_pages);
 }
 
 int __weak machine_kexec_post_load(struct kimage *image)
@@ -601,6 +608,9 @@ void kimage_terminate(struct kimage *image)
 		image->entry++;
 
 	*image->entry = IND_DONE;
+
+	/* All segments are loaded, so the spare pages won't be needed */
+	kimage_free_page_list(&image->spare_pages);
 }
 
 #define for_each_kimage_entry(image, ptr, entry) \
@@ -662,6 +672,44 @@ void kimage_free(struct kimage *image)
 	kfree(image);
 }
 
+/*
+ * Segment pages are taken from high-order chunks split into single pages
+ * when possible.  Loading a large initrd then needs far fewer trips into
+ * the page allocator, and the pages of a segment end up physically close.
+ */
+#define KIMAGE_SPARE_ORDER	(MAX_ORDER - 1)
+
+static struct page *kimage_alloc_source_page(struct kimage *image,
+					     gfp_t gfp_mask)
+{
+	struct page *page;
+	unsigned int i;
+
+	if (gfp_mask != GFP_HIGHUSER)
+		return kimage_alloc_pages(gfp_mask, 0);
+
+	if (list_empty(&image->spare_pages) && !image->no_spare_chunks) {
+		page = kimage_alloc_pages(gfp_mask | __GFP_NORETRY | __GFP_NOWARN,
+					  KIMAGE_SPARE_ORDER);
+		if (page) {
+			/* Each page is freed on its own by kimage_free_pages() */
+			set_page_private(page, 0);
+			split_page(page, KIMAGE_SPARE_ORDER);
+			for (i = 0; i < (1 << KIMAGE_SPARE_ORDER); i++)
+				list_add_tail(&page[i].lru, &image->spare_pages);
+		} else {
+			image->no_spare_chunks = 1;
+		}
+	}
+
+	page = list_first_entry_or_null(&image->spare_pages, struct page, lru);
+	if (!page)
+		return kimage_alloc_pages(gfp_mask, 0);
+
+	list_del(&page->lru);
+	return page;
+}
+
 static kimage_entry_t *kimage_dst_used(struct kimage *image,
 					unsigned long page)
 {
@@ -722,7 +770,7 @@ static struct page *kimage_alloc_page(struct kimage *image,
 		kimage_entry_t *old;
 
 		/* Allocate a page, if we run out of memory give up */
-		page = kimage_alloc_pages(gfp_mask, 0);
+		page = kimage_alloc_source_page(image, gfp_mask);
 		if (!page)
 			return NULL;
 		/* If the page cannot be used file it away */
@@ -778,6 +826,141 @@ static struct page *kimage_alloc_page(struct kimage *image,
 	return page;
 }
 
+/* Pages filled by one thread at a time when loading a segment in parallel */
+#define KEXEC_COPY_MIN_CHUNK	512
+
+struct kimage_copy_job {
+	struct kexec_segment *segment;
+	struct page **pages;
+};
+
+/* Fill pages [start, end) of a file mode segment from its kernel buffer */
+static void kimage_copy_segment_pages(unsigned long start, unsigned long end,
+				      void *arg)
+{
+	struct kimage_copy_job *job = arg;
+	struct kexec_segment *segment = job->segment;
+	unsigned long base = segment->mem & PAGE_MASK;
+	unsigned long i;
+
+	for (i = start; i < end; i++) {
+		unsigned long maddr = max(base + i * PAGE_SIZE, segment->mem);
+		unsigned long mend = min(base + (i + 1) * PAGE_SIZE,
+					 segment->mem + segment->memsz);
+		size_t offset = maddr - segment->mem;
+		size_t uchunk = 0;
+		char *ptr;
+
+		if (offset < segment->bufsz)
+			uchunk = min(segment->bufsz - offset, mend - maddr);
+
+		ptr = kmap(job->pages[i]);
+		/* Start with a clear page */
+		clear_page(ptr);
+		memcpy(ptr + (maddr & ~PAGE_MASK), segment->kbuf + offset,
+		       uchunk);
+		kunmap(job->pages[i]);
+
+		cond_resched();
+	}
+}
+
+/*
+ * Collect the source page of each destination page of @segment.  Allocating
+ * later pages may have moved the contents of earlier ones to other source
+ * pages, so this can only be done once all of them are allocated.
+ */
+static void kimage_segment_pages(struct kimage *image,
+				 struct kexec_segment *segment,
+				 struct page **pages, unsigned long nr_pages)
+{
+	unsigned long base = segment->mem & PAGE_MASK;
+	unsigned long destination = 0;
+	kimage_entry_t *ptr, entry;
+
+	for_each_kimage_entry(image, ptr, entry) {
+		if (entry & IND_DESTINATION) {
+			destination = entry & PAGE_MASK;
+		} else if (entry & IND_SOURCE) {
+			if (destination >= base &&
+			    destination < base + nr_pages * PAGE_SIZE)
+				pages[(destination - base) >> PAGE_SHIFT] =
+					boot_pfn_to_page(entry >> PAGE_SHIFT);
+			destination += PAGE_SIZE;
+		}
+	}
+}
+
+/*
+ * For file based kexec the segments are already in kernel memory, so once
+ * the destination pages are allocated, which has to be done in order, they
+ * can be filled by several CPUs at once.
+ */
+static int kimage_load_file_segment(struct kimage *image,
+				    struct kexec_segment *segment)
+{
+	unsigned long maddr = segment->mem;
+	unsigned long nr_pages, i;
+	struct kimage_copy_job job = { .segment = segment };
+	u64 start;
+	int result;
+
+	nr_pages = (PAGE_ALIGN(segment->mem + segment->memsz) -
+		    (segment->mem & PAGE_MASK)) >> PAGE_SHIFT;
+	job.pages = kvmalloc_array(nr_pages, sizeof(*job.pages), GFP_KERNEL);
+	if (!job.pages)
+		return -ENOMEM;
+
+	start = ktime_get_ns();
+	result = kimage_set_destination(image, maddr);
+	if (result < 0)
+		goto out;
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page;
+
+		page = kimage_alloc_page(image, GFP_HIGHUSER, maddr);
+		if (!page) {
+			result  = -ENOMEM;
+			goto out;
+		}
+		result = kimage_add_page(image, page_to_boot_pfn(page)
+								<< PAGE_SHIFT);
+		if (result < 0)
+			goto out;
+
+		maddr = (maddr & PAGE_MASK) + PAGE_SIZE;
+		cond_resched();
+	}
+	kimage_segment_pages(image, segment, job.pages, nr_pages);
+	image->load_stats.alloc_ns += ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+#ifdef CONFIG_PADATA
+	{
+		struct padata_mt_job mt_job = {
+			.thread_fn   = kimage_copy_segment_pages,
+			.fn_arg      = &job,
+			.start       = 0,
+			.size        = nr_pages,
+			.align       = 1,
+			.min_chunk   = KEXEC_COPY_MIN_CHUNK,
+			.max_threads = num_online_cpus(),
+			.nid         = NUMA_NO_NODE,
+		};
+
+		padata_do_multithreaded(&mt_job);
+	}
+#else
+	kimage_copy_segment_pages(0, nr_pages, &job);
+#endif
+	image->load_stats.copy_ns += ktime_get_ns() - start;
+	image->load_stats.bytes += segment->memsz;
+out:
+	kvfree(job.pages);
+	return result;
+}
+
 static int kimage_load_normal_segment(struct kimage *image,
 					 struct kexec_segment *segment)
 {
@@ -785,17 +968,18 @@ static int kimage_load_normal_segment(struct kimage *image,
 	size_t ubytes, mbytes;
 	int result;
 	unsigned char __user *buf = NULL;
-	unsigned char *kbuf = NULL;
+	u64 start;
 
-	result = 0;
 	if (image->file_mode)
-		kbuf = segment->kbuf;
-	else
-		buf = segment->buf;
+		return kimage_load_file_segment(image, segment);
+
+	result = 0;
+	buf = segment->buf;
 	ubytes = segment->bufsz;
 	mbytes = segment->memsz;
 	maddr = segment->mem;
 
+	start = ktime_get_ns();
 	result = kimage_set_destination(image, maddr);
 	if (result < 0)
 		goto out;
@@ -823,11 +1007,7 @@ static int kimage_load_normal_segment(struct kimage *image,
 				PAGE_SIZE - (maddr & ~PAGE_MASK));
 		uchunk = min(ubytes, mchunk);
 
-		/* For file based kexec, source pages are in kernel memory */
-		if (image->file_mode)
-			memcpy(ptr, kbuf, uchunk);
-		else
-			result = copy_from_user(ptr, buf, uchunk);
+		result = copy_from_user(ptr, buf, uchunk);
 		kunmap(page);
 		if (result) {
 			result = -EFAULT;
@@ -835,14 +1015,15 @@ static int kimage_load_normal_segment(struct kimage *image,
 		}
 		ubytes -= uchunk;
 		maddr  += mchunk;
-		if (image->file_mode)
-			kbuf += mchunk;
-		else
-			buf += mchunk;
+		buf += mchunk;
 		mbytes -= mchunk;
 
 		cond_resched();
 	}
+
+	/* Allocation and copy are interleaved here, account both as copy */
+	image->load_stats.copy_ns += ktime_get_ns() - start;
+	image->load_stats.bytes += segment->memsz;
 out:
 	return result;
 }
@@ -935,6 +1116,7 @@ int kimage_load_segment(struct kimage *image,
 struct kimage *kexec_image;
 struct kimage *kexec_crash_image;
 int kexec_load_disabled;
+struct kexec_load_stats kexec_last_load_stats;
 
 /*
  * No panic_cpu check version of crash_kexec().  This function is called
@@ -26,6 +26,8 @@
 #include <linux/kernel.h>
 #include <linux/syscalls.h>
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include "kexec_internal.h"
 
 static int kexec_calculate_store_digests(struct kimage *image);
@@ -345,6 +347,67 @@ out_free_image:
 	return ret;
 }
 
+struct kexec_digest_work {
+	struct work_struct work;
+	struct kimage *image;
+	int ret;
+};
+
+static void kexec_digest_workfn(struct work_struct *work)
+{
+	struct kexec_digest_work *dw = container_of(work, struct kexec_digest_work,
+						    work);
+	u64 start = ktime_get_ns();
+
+	dw->ret = kexec_calculate_store_digests(dw->image);
+	dw->image->load_stats.digest_ns = ktime_get_ns() - start;
+}
+
+/*
+ * The digest only reads the kernel copies of the segments, so it is computed
+ * by a worker while the segments are loaded.  Purgatory is the exception: the
+ * digest is stored in it, so it is loaded once the worker is done.
+ */
+static int kexec_load_segments(struct kimage *image)
+{
+	struct kexec_digest_work dw = { .image = image };
+	struct kexec_segment *purgatory = NULL;
+	u64 start = ktime_get_ns();
+	int ret = 0, i;
+
+	INIT_WORK_ONSTACK(&dw.work, kexec_digest_workfn);
+	queue_work(system_unbound_wq, &dw.work);
+
+	for (i = 0; i < image->nr_segments; i++) {
+		struct kexec_segment *ksegment;
+
+		ksegment = &image->segment[i];
+		if (ksegment->kbuf == image->purgatory_info.purgatory_buf) {
+			purgatory = ksegment;
+			continue;
+		}
+
+		pr_debug("Loading segment %d: buf=0x%p bufsz=0x%zx mem=0x%lx memsz=0x%zx\n",
+			 i, ksegment->buf, ksegment->bufsz, ksegment->mem,
+			 ksegment->memsz);
+
+		ret = kimage_load_segment(image, ksegment);
+		if (ret)
+			break;
+	}
+
+	flush_work(&dw.work);
+	destroy_work_on_stack(&dw.work);
+
+	if (!ret)
+		ret = dw.ret;
+	if (!ret && purgatory)
+		ret = kimage_load_segment(image, purgatory);
+
+	image->load_stats.total_ns = ktime_get_ns() - start;
+	return ret;
+}
+
 SYSCALL_DEFINE5(kexec_file_load, int, kernel_fd, int, initrd_fd,
 		unsigned long, cmdline_len, const char __user *, cmdline_ptr,
 		unsigned long, flags)
@@ -400,29 +463,24 @@ SYSCALL_DEFINE5(kexec_file_load, int, kernel_fd, int, initrd_fd,
 	if (ret)
 		goto out;
 
-	ret = kexec_calculate_store_digests(image);
+	ret = kexec_load_segments(image);
 	if (ret)
 		goto out;
 
-	for (i = 0; i < image->nr_segments; i++) {
-		struct kexec_segment *ksegment;
-
-		ksegment = &image->segment[i];
-		pr_debug("Loading segment %d: buf=0x%p bufsz=0x%zx mem=0x%lx memsz=0x%zx\n",
-			 i, ksegment->buf, ksegment->bufsz, ksegment->mem,
-			 ksegment->memsz);
-
-		ret = kimage_load_segment(image, &image->segment[i]);
-		if (ret)
-			goto out;
-	}
-
 	kimage_terminate(image);
 
 	ret = machine_kexec_post_load(image);
 	if (ret)
 		goto out;
 
+	kexec_last_load_stats = image->load_stats;
+	pr_info("Loaded %lu KiB in %llu ms (alloc %llu ms, copy %llu ms, digest %llu ms)\n",
+		image->load_stats.bytes >> 10,
+		div_u64(image->load_stats.total_ns, NSEC_PER_MSEC),
+		div_u64(image->load_stats.alloc_ns, NSEC_PER_MSEC),
+		div_u64(image->load_stats.copy_ns, NSEC_PER_MSEC),
+		div_u64(image->load_stats.digest_ns, NSEC_PER_MSEC));
+
 	/*
 	 * Free up any temporary buffers allocated which are not needed
 	 * after image has been loaded
@@ -123,6 +123,17 @@ static ssize_t kexec_crash_size_store(struct kobject *kobj,
 }
 KERNEL_ATTR_RW(kexec_crash_size);
 
+static ssize_t kexec_load_stats_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	struct kexec_load_stats *stats = &kexec_last_load_stats;
+
+	return sprintf(buf, "bytes %lu\nalloc_ns %llu\ncopy_ns %llu\ndigest_ns %llu\ntotal_ns %llu\n",
+		       stats->bytes, stats->alloc_ns, stats->copy_ns,
+		       stats->digest_ns, stats->total_ns);
+}
+KERNEL_ATTR_RO(kexec_load_stats);
+
 #endif /* CONFIG_KEXEC_CORE */
 
 #ifdef CONFIG_CRASH_CORE
@@ -221,6 +232,7 @@ static struct attribute * kernel_attrs[] = {
 	&kexec_loaded_attr.attr,
 	&kexec_crash_loaded_attr.attr,
 	&kexec_crash_size_attr.attr,
+	&kexec_load_stats_attr.attr,
 #endif
 #ifdef CONFIG_CRASH_CORE
 	&vmcoreinfo_attr.attr,
@@ -38,6 +38,8 @@ torture_param(int, nwriters_stress, -1,
 torture_param(int, nreaders_stress, -1,
 	     "Number of read-locking stress-test threads");
 torture_param(int, onoff_holdoff, 0, "Time after boot before CPU hotplugs (s)");
+torture_param(bool, read_scale, false,
+	     "Hold read locks only briefly, to measure reader scalability");
 torture_param(int, onoff_interval, 0,
 	     "Time between CPU hotplugs (s), 0=disable");
 torture_param(int, shuffle_interval, 3,
@@ -537,6 +539,18 @@ static void torture_rwsem_read_delay(struct torture_random_state *trsp)
 {
 	const unsigned long longdelay_ms = 100;
 
+	/*
+	 * With read_scale the readers spend their time taking and
+	 * releasing the lock, so the read count per stat_interval shows
+	 * how acquisition scales with the number of readers.
+	 */
+	if (read_scale) {
+		udelay(1);
+		if (!(torture_random(trsp) % (cxt.nrealreaders_stress * 20000)))
+			torture_preempt_schedule();  /* Allow test to be preempted. */
+		return;
+	}
+
 	/* We want a long delay occasionally to force massive contention.  */
 	if (!(torture_random(trsp) %
 	      (cxt.nrealreaders_stress * 2000 * longdelay_ms)))
@@ -770,11 +784,11 @@ lock_torture_print_module_parms(struct lock_torture_ops *cur_ops,
 				const char *tag)
 {
 	pr_alert("%s" TORTURE_FLAG
-		 "--- %s%s: nwriters_stress=%d nreaders_stress=%d stat_interval=%d verbose=%d shuffle_interval=%d stutter=%d shutdown_secs=%d onoff_interval=%d onoff_holdoff=%d\n",
+		 "--- %s%s: nwriters_stress=%d nreaders_stress=%d stat_interval=%d verbose=%d shuffle_interval=%d stutter=%d shutdown_secs=%d onoff_interval=%d onoff_holdoff=%d read_scale=%d\n",
 		 torture_type, tag, cxt.debug_lock ? " [debug]": "",
 		 cxt.nrealwriters_stress, cxt.nrealreaders_stress, stat_interval,
 		 verbose, shuffle_interval, stutter, shutdown_secs,
-		 onoff_interval, onoff_holdoff);
+		 onoff_interval, onoff_holdoff, read_scale);
 }
 
 static void lock_torture_cleanup(void)
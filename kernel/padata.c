@@ -24,6 +24,7 @@
  * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <linux/cgroup.h>
 #include <linux/completion.h>
 #include <linux/export.h>
 #include <linux/cpumask.h>
@@ -31,7 +32,9 @@
 #include <linux/cpu.h>
 #include <linux/padata.h>
 #include <linux/mutex.h>
+#include <linux/numa.h>
 #include <linux/sched.h>
+#include <linux/sched/cputime.h>
 #include <linux/slab.h>
 #include <linux/sysfs.h>
 #include <linux/rcupdate.h>
@@ -48,6 +51,12 @@ static DEFINE_SPINLOCK(padata_works_lock);
 static struct padata_work *padata_works;
 static LIST_HEAD(padata_free_works);
 
+/* The part of a multithreaded job a helper has yet to do: [start, end) */
+struct padata_mt_range {
+	unsigned long		start;
+	unsigned long		end;
+};
+
 struct padata_mt_job_state {
 	spinlock_t		lock;
 	struct completion	completion;
@@ -55,10 +64,14 @@ struct padata_mt_job_state {
 	int			nworks;
 	int			nworks_fini;
 	unsigned long		chunk_size;
+	struct padata_mt_range	*ranges;
+	int			nranges;
+	int			next_range;
+	struct task_struct	*owner;
 };
 
 static void padata_free_pd(struct parallel_data *pd);
-static void __init padata_mt_helper(struct work_struct *work);
+static void padata_mt_helper(struct work_struct *work);
 
 static int padata_index_to_cpu(struct parallel_data *pd, int cpu_index)
 {
@@ -106,7 +119,7 @@ static void padata_work_init(struct padata_work *pw, work_func_t work_fn,
 	pw->pw_data = data;
 }
 
-static int __init padata_work_alloc_mt(int nworks, void *data,
+static int padata_work_alloc_mt(int nworks, void *data,
 				       struct list_head *head)
 {
 	int i;
@@ -132,7 +145,7 @@ static void padata_work_free(struct padata_work *pw)
 	list_add(&pw->pw_list, &padata_free_works);
 }
 
-static void __init padata_works_free(struct list_head *works)
+static void padata_works_free(struct list_head *works)
 {
 	struct padata_work *cur, *next;
 
@@ -223,7 +236,15 @@ int padata_do_parallel(struct padata_shell *ps,
 	spin_unlock(&padata_works_lock);
 	if (pw) {
 		padata_work_init(pw, padata_parallel_worker, padata, 0);
-		queue_work(pinst->parallel_wq, &pw->pw_work);
+		/*
+		 * A scoped shell runs each object on the CPU whose reorder
+		 * list it ends up in, which keeps it within the scope.
+		 */
+		if (ps->scoped)
+			queue_work_on(padata_cpu_hash(pd, padata->seq_nr),
+				      pinst->parallel_pcpu_wq, &pw->pw_work);
+		else
+			queue_work(pinst->parallel_wq, &pw->pw_work);
 	} else {
 		/* Maximum works limit exceeded, run in the current task. */
 		padata->parallel(padata);
@@ -437,26 +458,119 @@ static int padata_setup_cpumasks(struct padata_instance *pinst)
 	return err;
 }
 
-static void __init padata_mt_helper(struct work_struct *w)
+/*
+ * Split the job into one contiguous range per helper, with boundaries on
+ * chunk_size, so that each helper works through memory that is close
+ * together for as long as it has work of its own.
+ */
+static void padata_mt_init_ranges(struct padata_mt_job_state *ps)
+{
+	struct padata_mt_job *job = ps->job;
+	unsigned long end = job->start + job->size;
+	unsigned long per = DIV_ROUND_UP(job->size, ps->nranges);
+	int i;
+
+	for (i = 0; i < ps->nranges; i++) {
+		ps->ranges[i].start = i ? ps->ranges[i - 1].end : job->start;
+		ps->ranges[i].end = min(roundup(job->start + (i + 1) * per,
+						ps->chunk_size), end);
+		ps->ranges[i].end = max(ps->ranges[i].end, ps->ranges[i].start);
+	}
+	ps->ranges[ps->nranges - 1].end = end;
+}
+
+/*
+ * Steal the second half of the largest range left into @r, or all of it if
+ * it's no more than a chunk.  Returns false if there is no work left.
+ */
+static bool padata_mt_steal(struct padata_mt_job_state *ps,
+			    struct padata_mt_range *r)
+{
+	struct padata_mt_range *victim = NULL;
+	unsigned long left, mid;
+	int i;
+
+	lockdep_assert_held(&ps->lock);
+
+	for (i = 0; i < ps->nranges; i++) {
+		left = ps->ranges[i].end - ps->ranges[i].start;
+		if (left && (!victim || left > victim->end - victim->start))
+			victim = &ps->ranges[i];
+	}
+	if (!victim)
+		return false;
+
+	left = victim->end - victim->start;
+	mid = victim->start;
+	if (left > ps->chunk_size)
+		mid = min(roundup(victim->start + left / 2, ps->chunk_size),
+			  victim->end);
+
+	r->start = mid;
+	r->end = victim->end;
+	victim->end = mid;
+	return true;
+}
+
+/*
+ * Charge the CPU time a helper spent on the job to the cgroup of the task
+ * that started it, the same way as if that task had done the work itself.
+ * The kworker's own accounting stays as it is.
+ */
+static void padata_mt_charge(struct task_struct *owner, u64 delta_exec)
+{
+#ifdef CONFIG_CGROUPS
+	struct cgroup *cgrp;
+	unsigned long flags;
+
+	rcu_read_lock();
+	cgrp = task_dfl_cgroup(owner);
+	if (cgroup_parent(cgrp)) {
+		/* The tick updates the same per-cpu stats */
+		local_irq_save(flags);
+		__cgroup_account_cputime(cgrp, delta_exec);
+		__cgroup_account_cputime_field(cgrp, CPUTIME_SYSTEM, delta_exec);
+		local_irq_restore(flags);
+	}
+	rcu_read_unlock();
+#endif
+}
+
+static void padata_mt_helper(struct work_struct *w)
 {
 	struct padata_work *pw = container_of(w, struct padata_work, pw_work);
 	struct padata_mt_job_state *ps = pw->pw_data;
 	struct padata_mt_job *job = ps->job;
+	struct task_struct *owner = ps->owner;
+	struct padata_mt_range *r;
+	u64 runtime = 0;
 	bool done;
 
+	if (owner == current)
+		owner = NULL;
+	if (owner)
+		runtime = task_sched_runtime(current);
+
 	spin_lock(&ps->lock);
 
-	while (job->size > 0) {
+	r = &ps->ranges[ps->next_range++ % ps->nranges];
+
+	for (;;) {
 		unsigned long start, size, end;
 
-		start = job->start;
+		if (r->start == r->end) {
+			/* Our own range is done, help with the largest one */
+			if (!padata_mt_steal(ps, r))
+				break;
+		}
+
+		start = r->start;
 		/* So end is chunk size aligned if enough work remains. */
 		size = roundup(start + 1, ps->chunk_size) - start;
-		size = min(size, job->size);
+		size = min(size, r->end - start);
 		end = start + size;
 
-		job->start = end;
-		job->size -= size;
+		r->start = end;
 
 		spin_unlock(&ps->lock);
 		job->thread_fn(start, end, job->fn_arg);
@@ -467,21 +581,50 @@ static void __init padata_mt_helper(struct work_struct *w)
 	done = (ps->nworks_fini == ps->nworks);
 	spin_unlock(&ps->lock);
 
+	if (owner)
+		padata_mt_charge(owner, task_sched_runtime(current) - runtime);
+
 	if (done)
 		complete(&ps->completion);
 }
 
+/*
+ * Where to queue the helpers: the job's node, every node with CPUs in turn
+ * for PADATA_MT_SPREAD jobs, or wherever the workqueue picks.
+ */
+static void padata_mt_queue_works(struct padata_mt_job *job,
+				  struct list_head *works)
+{
+	struct padata_work *pw;
+	int node = NUMA_NO_NODE;
+
+	list_for_each_entry(pw, works, pw_list) {
+		if (job->nid != NUMA_NO_NODE)
+			node = job->nid;
+		else if (job->flags & PADATA_MT_SPREAD)
+			node = next_node_in(node == NUMA_NO_NODE ?
+					    numa_node_id() : node,
+					    node_states[N_CPU]);
+
+		if (node == NUMA_NO_NODE || node >= MAX_NUMNODES)
+			queue_work(system_unbound_wq, &pw->pw_work);
+		else
+			queue_work_node(node, system_unbound_wq, &pw->pw_work);
+	}
+}
+
 /**
  * padata_do_multithreaded - run a multithreaded job
  * @job: Description of the job.
  *
  * See the definition of struct padata_mt_job for more details.
  */
-void __init padata_do_multithreaded(struct padata_mt_job *job)
+void padata_do_multithreaded(struct padata_mt_job *job)
 {
 	/* In case threads finish at different times. */
 	static const unsigned long load_balance_factor = 4;
-	struct padata_work my_work, *pw;
+	struct padata_mt_range single_range;
+	struct padata_work my_work;
 	struct padata_mt_job_state ps;
 	LIST_HEAD(works);
 	int nworks;
@@ -515,8 +658,24 @@ void __init padata_do_multithreaded(struct padata_mt_job *job)
 	ps.chunk_size = max(ps.chunk_size, job->min_chunk);
 	ps.chunk_size = roundup(ps.chunk_size, job->align);
 
-	list_for_each_entry(pw, &works, pw_list)
-		queue_work(system_unbound_wq, &pw->pw_work);
+	/*
+	 * One range per helper, stolen from when a helper runs out of work.
+	 * Without memory for them, all helpers share one range, which still
+	 * balances the load, just without the locality.
+	 */
+	ps.nranges = ps.nworks;
+	ps.ranges = kmalloc_array(ps.nranges, sizeof(*ps.ranges), GFP_KERNEL);
+	if (!ps.ranges) {
+		ps.nranges = 1;
+		ps.ranges = &single_range;
+	}
+	ps.next_range = 0;
+	padata_mt_init_ranges(&ps);
+
+	/* Only user tasks have a cgroup worth charging the helpers to */
+	ps.owner = (current->flags & PF_KTHREAD) ? NULL : current;
+
+	padata_mt_queue_works(job, &works);
 
 	/* Use the current thread, which saves starting a workqueue worker. */
 	padata_work_init(&my_work, padata_mt_helper, &ps, PADATA_WORK_ONSTACK);
@@ -527,7 +686,10 @@ void __init padata_do_multithreaded(struct padata_mt_job *job)
 
 	destroy_work_on_stack(&my_work.pw_work);
 	padata_works_free(&works);
+	if (ps.ranges != &single_range)
+		kfree(ps.ranges);
 }
+EXPORT_SYMBOL_GPL(padata_do_multithreaded);
 
 static void __padata_list_init(struct padata_list *pd_list)
 {
@@ -589,6 +751,12 @@ static struct parallel_data *padata_alloc_pd(struct padata_shell *ps)
 	cpumask_and(pd->cpumask.pcpu, pinst->cpumask.pcpu, cpu_online_mask);
 	cpumask_and(pd->cpumask.cbcpu, pinst->cpumask.cbcpu, cpu_online_mask);
 
+	/* Fall back to the instance's CPUs if none in the scope are left */
+	if (ps->scoped && cpumask_intersects(pd->cpumask.pcpu, ps->scope))
+		cpumask_and(pd->cpumask.pcpu, pd->cpumask.pcpu, ps->scope);
+	if (ps->scoped && cpumask_intersects(pd->cpumask.cbcpu, ps->scope))
+		cpumask_and(pd->cpumask.cbcpu, pd->cpumask.cbcpu, ps->scope);
+
 	padata_init_reorder_list(pd);
 	padata_init_squeues(pd);
 	pd->seq_nr = -1;
@@ -842,6 +1010,7 @@ static void __padata_free(struct padata_instance *pinst)
 	free_cpumask_var(pinst->cpumask.pcpu);
 	free_cpumask_var(pinst->cpumask.cbcpu);
 	destroy_workqueue(pinst->serial_wq);
+	destroy_workqueue(pinst->parallel_pcpu_wq);
 	destroy_workqueue(pinst->parallel_wq);
 	kfree(pinst);
 }
@@ -991,6 +1160,11 @@ struct padata_instance *padata_alloc(const char *name)
 	if (!pinst->parallel_wq)
 		goto err_free_inst;
 
+	pinst->parallel_pcpu_wq = alloc_workqueue("%s_parallel_pcpu",
+						  WQ_CPU_INTENSIVE, 0, name);
+	if (!pinst->parallel_pcpu_wq)
+		goto err_free_parallel_wq;
+
 	get_online_cpus();
 
 	pinst->serial_wq = alloc_workqueue("%s_serial", WQ_MEM_RECLAIM |
@@ -1036,6 +1210,8 @@ err_free_serial_wq:
 	destroy_workqueue(pinst->serial_wq);
 err_put_cpus:
 	put_online_cpus();
+	destroy_workqueue(pinst->parallel_pcpu_wq);
+err_free_parallel_wq:
 	destroy_workqueue(pinst->parallel_wq);
 err_free_inst:
 	kfree(pinst);
@@ -1063,6 +1239,26 @@ EXPORT_SYMBOL(padata_free);
  * Return: new shell on success, NULL on error
  */
 struct padata_shell *padata_alloc_shell(struct padata_instance *pinst)
+{
+	return padata_alloc_shell_scoped(pinst, NULL);
+}
+EXPORT_SYMBOL(padata_alloc_shell);
+
+/**
+ * padata_alloc_shell_scoped - Allocate a padata shell limited to some CPUs.
+ *
+ * @pinst: Parent padata_instance object.
+ * @scope: CPUs to use out of @pinst's cpumasks, or NULL for all of them.
+ *
+ * Each shell has its own sequence numbers and reorder state, so objects of
+ * different shells are never ordered against each other.  With @scope, e.g.
+ * the CPUs sharing a cache, a shell's parallel and serial work stays on those
+ * CPUs for as long as any of them is online.
+ *
+ * Return: new shell on success, NULL on error
+ */
+struct padata_shell *padata_alloc_shell_scoped(struct padata_instance *pinst,
+					       const struct cpumask *scope)
 {
 	struct parallel_data *pd;
 	struct padata_shell *ps;
@@ -1073,6 +1269,13 @@ struct padata_shell *padata_alloc_shell(struct padata_instance *pinst)
 
 	ps->pinst = pinst;
 
+	if (scope) {
+		if (!alloc_cpumask_var(&ps->scope, GFP_KERNEL))
+			goto out_free_ps;
+		cpumask_copy(ps->scope, scope);
+		ps->scoped = true;
+	}
+
 	get_online_cpus();
 	pd = padata_alloc_pd(ps);
 	put_online_cpus();
@@ -1088,11 +1291,13 @@ struct padata_shell *padata_alloc_shell(struct padata_instance *pinst)
 	return ps;
 
 out_free_ps:
+	if (ps->scoped)
+		free_cpumask_var(ps->scope);
 	kfree(ps);
 out:
 	return NULL;
 }
-EXPORT_SYMBOL(padata_alloc_shell);
+EXPORT_SYMBOL(padata_alloc_shell_scoped);
 
 /**
  * padata_free_shell - free a padata shell
@@ -1109,6 +1314,8 @@ void padata_free_shell(struct padata_shell *ps)
 	padata_free_pd(rcu_dereference_protected(ps->pd, 1));
 	mutex_unlock(&ps->pinst->lock);
 
+	if (ps->scoped)
+		free_cpumask_var(ps->scope);
 	kfree(ps);
 }
 EXPORT_SYMBOL(padata_free_shell);
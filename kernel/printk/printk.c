@@ -47,6 +47,7 @@
 #include <linux/sched/clock.h>
 #include <linux/sched/debug.h>
 #include <linux/sched/task_stack.h>
+#include <linux/kthread.h>
 
 #include <linux/uaccess.h>
 #include <asm/sections.h>
@@ -210,9 +211,6 @@ int devkmsg_sysctl_set_loglvl(struct ctl_table *table, int write,
 	return 0;
 }
 
-/* Number of registered extended console drivers. */
-static int nr_ext_console_drivers;
-
 /*
  * Helper macros to handle lockdep when locking/unlocking console_sem. We use
  * macros instead of functions so that _RET_IP_ contains useful information.
@@ -266,9 +264,44 @@ static void __up_console_sem(unsigned long ip)
 static int console_locked, console_suspended;
 
 /*
- * If exclusive_console is non-NULL then only this console is to be printed to.
+ * Once printk_late_init() has started them, every console but the boot
+ * consoles is printed by its own kthread and printk() only stores the record
+ * and wakes them up, so a slow console no longer stalls the printk() caller.
+ *
+ * The kthreads do not take console_sem.  Instead a console_lock() holder
+ * sets CONSOLE_KTHREADS_BLOCKED and waits for the kthreads that are inside
+ * a console driver, whose number is kept in the low bits, to leave it.
  */
-static struct console *exclusive_console;
+static bool printk_console_kthreads = true;
+module_param_named(console_kthreads, printk_console_kthreads, bool, 0444);
+MODULE_PARM_DESC(console_kthreads, "print the consoles from per-console kthreads");
+
+static bool printk_kthreads_running;
+/* Registered consoles without a kthread, protected by console_sem */
+static int console_nr_unthreaded;
+
+#define CONSOLE_KTHREADS_BLOCKED	(1 << 30)
+static atomic_t console_kthreads_state = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(console_kthreads_idle_wait);
+static DECLARE_WAIT_QUEUE_HEAD(console_kthread_wait);
+
+/*
+ * Nobody is going to schedule the kthreads anymore, or not soon enough:
+ * print the consoles directly like before.
+ */
+static bool printk_emergency(void)
+{
+	return oops_in_progress ||
+	       atomic_read(&panic_cpu) != PANIC_CPU_INVALID ||
+	       system_state > SYSTEM_RUNNING;
+}
+
+/* Should printk() try to print the consoles itself? */
+static bool printk_direct_wanted(void)
+{
+	return !READ_ONCE(printk_kthreads_running) ||
+	       READ_ONCE(console_nr_unthreaded) || printk_emergency();
+}
 
 /*
  *	Array of consoles built from command line options (console=)
@@ -433,11 +466,6 @@ static u32 log_first_idx;
 static u64 log_next_seq;
 static u32 log_next_idx;
 
-/* the next printk record to write to the console */
-static u64 console_seq;
-static u32 console_idx;
-static u64 exclusive_console_stop_seq;
-
 /* the next printk record to read after the last 'clear' command */
 static u64 clear_seq;
 static u32 clear_idx;
@@ -1797,32 +1825,86 @@ static int console_trylock_spinning(void)
 }
 
 /*
- * Call the console drivers, asking them to write out
- * log_buf[start] to log_buf[end - 1].
- * The console_lock must be held.
+ * Print the next record of @con, formatted into @text, or into @ext_text for
+ * an extended console.  The caller either holds console_sem, in which case
+ * @handover is set and tells whether console_sem was handed over to a
+ * spinning printk() meanwhile, or is the kthread of @con.
+ *
+ * Returns false if there was nothing left to print.
  */
-static void call_console_drivers(const char *ext_text, size_t ext_len,
-				 const char *text, size_t len)
+static bool console_emit_next_record(struct console *con, char *text,
+				     char *ext_text, bool *handover)
 {
-	struct console *con;
+	struct printk_log *msg;
+	size_t ext_len = 0;
+	unsigned long flags;
+	size_t len = 0;
 
-	trace_console_rcuidle(text, len);
+	if (handover)
+		*handover = false;
 
-	for_each_console(con) {
-		if (exclusive_console && con != exclusive_console)
-			continue;
-		if (!(con->flags & CON_ENABLED))
-			continue;
-		if (!con->write)
-			continue;
-		if (!cpu_online(smp_processor_id()) &&
-		    !(con->flags & CON_ANYTIME))
-			continue;
-		if (con->flags & CON_EXTENDED)
-			con->write(con, ext_text, ext_len);
-		else
-			con->write(con, text, len);
+	printk_safe_enter_irqsave(flags);
+	raw_spin_lock(&logbuf_lock);
+	if (con->seq < log_first_seq) {
+		len = snprintf(text, LOG_LINE_MAX + PREFIX_MAX,
+			       "** %llu printk messages dropped **\n",
+			       log_first_seq - con->seq);
+
+		/* messages are gone, move to first one */
+		con->seq = log_first_seq;
+		con->idx = log_first_idx;
 	}
+skip:
+	if (con->seq == log_next_seq) {
+		raw_spin_unlock(&logbuf_lock);
+		printk_safe_exit_irqrestore(flags);
+		return false;
+	}
+
+	msg = log_from_idx(con->idx);
+	if (suppress_message_printing(msg->level)) {
+		/* Skip record that has level above the console loglevel. */
+		con->idx = log_next(con->idx);
+		con->seq++;
+		goto skip;
+	}
+
+	len += msg_print_text(msg, console_msg_format & MSG_FORMAT_SYSLOG,
+			      printk_time, text + len,
+			      LOG_LINE_MAX + PREFIX_MAX - len);
+	if (con->flags & CON_EXTENDED) {
+		ext_len = msg_print_ext_header(ext_text, CONSOLE_EXT_LOG_MAX,
+					       msg, con->seq);
+		ext_len += msg_print_ext_body(ext_text + ext_len,
+					      CONSOLE_EXT_LOG_MAX - ext_len,
+					      log_dict(msg), msg->dict_len,
+					      log_text(msg), msg->text_len);
+	}
+	con->idx = log_next(con->idx);
+	con->seq++;
+	raw_spin_unlock(&logbuf_lock);
+
+	/*
+	 * While actively printing out messages, if another printk()
+	 * were to occur on another CPU, it may wait for this one to
+	 * finish. This task can not be preempted if there is a
+	 * waiter waiting to take over.
+	 */
+	if (handover)
+		console_lock_spinning_enable();
+
+	stop_critical_timings();	/* don't trace print latency */
+	if (con->flags & CON_EXTENDED)
+		con->write(con, ext_text, ext_len);
+	else
+		con->write(con, text, len);
+	start_critical_timings();
+
+	if (handover)
+		*handover = console_lock_spinning_disable_and_check();
+
+	printk_safe_exit_irqrestore(flags);
+	return true;
 }
 
 int printk_delay_msec __read_mostly;
@@ -1980,6 +2062,8 @@ int vprintk_store(int facility, int level,
 	if (dict)
 		lflags |= LOG_NEWLINE;
 
+	trace_console_rcuidle(text, text_len);
+
 	return log_output(facility, level, lflags,
 			  dict, dictlen, text, text_len);
 }
@@ -2013,7 +2097,7 @@ asmlinkage int vprintk_emit(int facility, int level,
 	logbuf_unlock_irqrestore(flags);
 
 	/* If called from the scheduler, we can not call up(). */
-	if (!in_sched && pending_output) {
+	if (!in_sched && pending_output && printk_direct_wanted()) {
 		/*
 		 * Disable preemption to avoid being preempted while holding
 		 * console_sem which would prevent anyone from printing to
@@ -2028,6 +2112,9 @@ asmlinkage int vprintk_emit(int facility, int level,
 		if (console_trylock_spinning())
 			console_unlock();
 		preempt_enable();
+	} else if (!in_sched && pending_output) {
+		/* Leave the printing to the kthreads */
+		defer_console_output();
 	}
 
 	if (pending_output)
@@ -2060,6 +2147,10 @@ EXPORT_SYMBOL_GPL(vprintk_default);
  * the console_sem will notice the new output in console_unlock(); and will
  * send it to the consoles before releasing the lock.
  *
+ * Once the per-console printing kthreads are running, printk() only stores
+ * the output and wakes them up.  It still prints the consoles itself while
+ * an oops or panic is in progress, or the system is going down.
+ *
  * One effect of this deferred printing is that code which calls printk() and
  * then changes console_loglevel may break. This is because console_loglevel
  * is inspected when the actual printing occurs.
@@ -2086,33 +2177,18 @@ EXPORT_SYMBOL(printk);
 
 #define LOG_LINE_MAX		0
 #define PREFIX_MAX		0
-#define printk_time		false
 
 static u64 syslog_seq;
 static u32 syslog_idx;
-static u64 console_seq;
-static u32 console_idx;
-static u64 exclusive_console_stop_seq;
 static u64 log_first_seq;
 static u32 log_first_idx;
 static u64 log_next_seq;
-static char *log_text(const struct printk_log *msg) { return NULL; }
-static char *log_dict(const struct printk_log *msg) { return NULL; }
-static struct printk_log *log_from_idx(u32 idx) { return NULL; }
-static u32 log_next(u32 idx) { return 0; }
-static ssize_t msg_print_ext_header(char *buf, size_t size,
-				    struct printk_log *msg,
-				    u64 seq) { return 0; }
-static ssize_t msg_print_ext_body(char *buf, size_t size,
-				  char *dict, size_t dict_len,
-				  char *text, size_t text_len) { return 0; }
-static void console_lock_spinning_enable(void) { }
-static int console_lock_spinning_disable_and_check(void) { return 0; }
-static void call_console_drivers(const char *ext_text, size_t ext_len,
-				 const char *text, size_t len) {}
-static size_t msg_print_text(const struct printk_log *msg, bool syslog,
-			     bool time, char *buf, size_t size) { return 0; }
-static bool suppress_message_printing(int level) { return false; }
+static u32 log_next_idx;
+static bool console_emit_next_record(struct console *con, char *text,
+				     char *ext_text, bool *handover)
+{
+	return false;
+}
 
 #endif /* CONFIG_PRINTK */
 
@@ -2302,6 +2378,52 @@ static int console_cpu_notify(unsigned int cpu)
 	return 0;
 }
 
+/*
+ * A console_sem holder keeps the printing kthreads out of the console
+ * drivers.  console_kthreads_block() waits for the kthreads that are
+ * printing right now, console_kthreads_tryblock() fails if there are any.
+ * A suspended console stays blocked until resume_console().
+ */
+static void console_kthreads_block(void)
+{
+	atomic_or(CONSOLE_KTHREADS_BLOCKED, &console_kthreads_state);
+	wait_event(console_kthreads_idle_wait,
+		   atomic_read(&console_kthreads_state) ==
+		   CONSOLE_KTHREADS_BLOCKED);
+}
+
+static bool console_kthreads_tryblock(void)
+{
+	return atomic_cmpxchg(&console_kthreads_state, 0,
+			      CONSOLE_KTHREADS_BLOCKED) == 0;
+}
+
+static void console_kthreads_unblock(void)
+{
+	atomic_andnot(CONSOLE_KTHREADS_BLOCKED, &console_kthreads_state);
+}
+
+/* A kthread enters a console driver only if console_sem is not held */
+static bool console_kthread_tryenter(void)
+{
+	int state = atomic_read(&console_kthreads_state);
+
+	do {
+		if (state & CONSOLE_KTHREADS_BLOCKED)
+			return false;
+	} while (!atomic_try_cmpxchg(&console_kthreads_state, &state,
+				     state + 1));
+
+	return true;
+}
+
+static void console_kthread_exit(void)
+{
+	if (atomic_dec_return(&console_kthreads_state) ==
+	    CONSOLE_KTHREADS_BLOCKED)
+		wake_up(&console_kthreads_idle_wait);
+}
+
 /**
  * console_lock - lock the console system for exclusive use.
  *
@@ -2317,6 +2439,7 @@ void console_lock(void)
 	down_console_sem();
 	if (console_suspended)
 		return;
+	console_kthreads_block();
 	console_locked = 1;
 	console_may_schedule = 1;
 }
@@ -2338,6 +2461,11 @@ int console_trylock(void)
 		up_console_sem();
 		return 0;
 	}
+	/* A printing kthread counts as a console_sem holder */
+	if (!console_kthreads_tryblock()) {
+		up_console_sem();
+		return 0;
+	}
 	console_locked = 1;
 	console_may_schedule = 0;
 	return 1;
@@ -2346,36 +2474,170 @@ EXPORT_SYMBOL(console_trylock);
 
 int is_console_locked(void)
 {
-	return console_locked;
+	/* The console drivers are also called from the printing kthreads */
+	return console_locked ||
+	       (atomic_read(&console_kthreads_state) &
+		~CONSOLE_KTHREADS_BLOCKED);
 }
 EXPORT_SYMBOL(is_console_locked);
 
 /*
- * Check if we have any console that is capable of printing while cpu is
- * booting or shutting down. Requires console_sem.
+ * Can we actually use @con at this time on this cpu?
+ *
+ * Console drivers may assume that per-cpu resources have been allocated. So
+ * unless they're explicitly marked as being able to cope (CON_ANYTIME) don't
+ * call them until this CPU is officially up.
  */
-static int have_callable_console(void)
+static bool console_is_usable(struct console *con)
 {
-	struct console *con;
+	if (!(con->flags & CON_ENABLED) || !con->write)
+		return false;
 
-	for_each_console(con)
-		if ((con->flags & CON_ENABLED) &&
-				(con->flags & CON_ANYTIME))
-			return 1;
+	return cpu_online(raw_smp_processor_id()) ||
+	       (con->flags & CON_ANYTIME);
+}
+
+struct printk_kthread_data {
+	struct console	*con;
+	char		*text;
+	char		*ext_text;
+};
+
+static bool printk_kthread_should_wakeup(struct console *con)
+{
+	unsigned long flags;
+	bool pending;
+
+	if (kthread_should_stop())
+		return true;
+	if (atomic_read(&console_kthreads_state) & CONSOLE_KTHREADS_BLOCKED)
+		return false;
+	if (!console_is_usable(con))
+		return false;
+
+	logbuf_lock_irqsave(flags);
+	pending = con->seq != log_next_seq;
+	logbuf_unlock_irqrestore(flags);
+
+	return pending;
+}
+
+static int printk_kthread_func(void *data)
+{
+	struct printk_kthread_data *kd = data;
+	struct console *con = kd->con;
+
+	for (;;) {
+		wait_event_interruptible(console_kthread_wait,
+					 printk_kthread_should_wakeup(con));
+		if (kthread_should_stop())
+			break;
+
+		if (console_kthread_tryenter()) {
+			if (console_is_usable(con))
+				console_emit_next_record(con, kd->text,
+							 kd->ext_text, NULL);
+			console_kthread_exit();
+		}
+
+		/*
+		 * A printk() that wanted to print a console without a kthread
+		 * may have failed to get console_sem because of us.
+		 */
+		if (printk_direct_wanted() && console_trylock())
+			console_unlock();
+
+		cond_resched();
+	}
 
+	kfree(kd->ext_text);
+	kfree(kd->text);
+	kfree(kd);
 	return 0;
 }
 
 /*
- * Can we actually use the console at this time on this cpu?
- *
- * Console drivers may assume that per-cpu resources have been allocated. So
- * unless they're explicitly marked as being able to cope (CON_ANYTIME) don't
- * call them until this CPU is officially up.
+ * Start the printing kthread of @con.  Boot consoles are left to printk(),
+ * they may share the device with the real console that replaces them.
+ * Requires console_sem.
  */
-static inline int can_use_console(void)
+static void printk_start_kthread(struct console *con)
 {
-	return cpu_online(raw_smp_processor_id()) || have_callable_console();
+	struct printk_kthread_data *kd;
+	struct task_struct *tsk;
+
+	if (con->thread || (con->flags & CON_BOOT))
+		return;
+
+	kd = kzalloc(sizeof(*kd), GFP_KERNEL);
+	if (!kd)
+		goto err;
+	kd->con = con;
+	kd->text = kmalloc(LOG_LINE_MAX + PREFIX_MAX, GFP_KERNEL);
+	if (!kd->text)
+		goto err;
+	if (con->flags & CON_EXTENDED) {
+		kd->ext_text = kmalloc(CONSOLE_EXT_LOG_MAX, GFP_KERNEL);
+		if (!kd->ext_text)
+			goto err;
+	}
+
+	tsk = kthread_run(printk_kthread_func, kd, "pr/%s%d",
+			  con->name, con->index);
+	if (IS_ERR(tsk))
+		goto err;
+	con->thread = tsk;
+	return;
+
+err:
+	if (kd) {
+		kfree(kd->ext_text);
+		kfree(kd->text);
+		kfree(kd);
+	}
+	pr_warn("failed to start printing thread for console [%s%d]\n",
+		con->name, con->index);
+}
+
+/* Requires console_sem */
+static void console_update_unthreaded(void)
+{
+	struct console *con;
+	int nr = 0;
+
+	for_each_console(con)
+		if (!con->thread)
+			nr++;
+
+	WRITE_ONCE(console_nr_unthreaded, nr);
+}
+
+/* Requires console_sem.  Is there anything left for the kthreads? */
+static bool console_kthreads_pending(void)
+{
+	struct console *con;
+	unsigned long flags;
+	bool pending = false;
+
+	if (!printk_kthreads_running)
+		return false;
+
+	logbuf_lock_irqsave(flags);
+	for_each_console(con) {
+		if (con->thread && con->seq != log_next_seq) {
+			pending = true;
+			break;
+		}
+	}
+	logbuf_unlock_irqrestore(flags);
+
+	return pending;
+}
+
+static void wake_up_console_kthreads(void)
+{
+	if (wq_has_sleeper(&console_kthread_wait))
+		wake_up_interruptible_all(&console_kthread_wait);
 }
 
 /**
@@ -2396,8 +2658,10 @@ void console_unlock(void)
 {
 	static char ext_text[CONSOLE_EXT_LOG_MAX];
 	static char text[LOG_LINE_MAX + PREFIX_MAX];
+	bool do_cond_resched, handover, progress, retry, wake;
+	struct console *con;
 	unsigned long flags;
-	bool do_cond_resched, retry;
+	u64 next_seq;
 
 	if (console_suspended) {
 		up_console_sem();
@@ -2423,113 +2687,54 @@ again:
 	console_may_schedule = 0;
 
 	/*
-	 * We released the console_sem lock, so we need to recheck if
-	 * cpu is online and (if not) is there at least one CON_ANYTIME
-	 * console.
+	 * Print the consoles without a kthread, and all of them if
+	 * printk() cannot rely on the kthreads.  Each console is printed
+	 * from its own position, one record per console at a time.
 	 */
-	if (!can_use_console()) {
-		console_locked = 0;
-		up_console_sem();
-		return;
-	}
-
-	for (;;) {
-		struct printk_log *msg;
-		size_t ext_len = 0;
-		size_t len;
-
-		printk_safe_enter_irqsave(flags);
-		raw_spin_lock(&logbuf_lock);
-		if (console_seq < log_first_seq) {
-			len = snprintf(text, sizeof(text),
-				       "** %llu printk messages dropped **\n",
-				       log_first_seq - console_seq);
-
-			/* messages are gone, move to first one */
-			console_seq = log_first_seq;
-			console_idx = log_first_idx;
-		} else {
-			len = 0;
-		}
-skip:
-		if (console_seq == log_next_seq)
-			break;
-
-		msg = log_from_idx(console_idx);
-		if (suppress_message_printing(msg->level)) {
-			/*
-			 * Skip record we have buffered and already printed
-			 * directly to the console when we received it, and
-			 * record that has level above the console loglevel.
-			 */
-			console_idx = log_next(console_idx);
-			console_seq++;
-			goto skip;
-		}
-
-		/* Output to all consoles once old messages replayed. */
-		if (unlikely(exclusive_console &&
-			     console_seq >= exclusive_console_stop_seq)) {
-			exclusive_console = NULL;
-		}
+	do {
+		progress = false;
+		for_each_console(con) {
+			if (!console_is_usable(con))
+				continue;
+			if (con->thread && !printk_emergency())
+				continue;
+			if (!console_emit_next_record(con, text, ext_text,
+						      &handover))
+				continue;
+			if (handover)
+				return;
+			progress = true;
 
-		len += msg_print_text(msg,
-				console_msg_format & MSG_FORMAT_SYSLOG,
-				printk_time, text + len, sizeof(text) - len);
-		if (nr_ext_console_drivers) {
-			ext_len = msg_print_ext_header(ext_text,
-						sizeof(ext_text),
-						msg, console_seq);
-			ext_len += msg_print_ext_body(ext_text + ext_len,
-						sizeof(ext_text) - ext_len,
-						log_dict(msg), msg->dict_len,
-						log_text(msg), msg->text_len);
+			if (do_cond_resched)
+				cond_resched();
 		}
-		console_idx = log_next(console_idx);
-		console_seq++;
-		raw_spin_unlock(&logbuf_lock);
+	} while (progress);
 
-		/*
-		 * While actively printing out messages, if another printk()
-		 * were to occur on another CPU, it may wait for this one to
-		 * finish. This task can not be preempted if there is a
-		 * waiter waiting to take over.
-		 */
-		console_lock_spinning_enable();
+	wake = console_kthreads_pending();
 
-		stop_critical_timings();	/* don't trace print latency */
-		call_console_drivers(ext_text, ext_len, text, len);
-		start_critical_timings();
-
-		if (console_lock_spinning_disable_and_check()) {
-			printk_safe_exit_irqrestore(flags);
-			return;
-		}
-
-		printk_safe_exit_irqrestore(flags);
-
-		if (do_cond_resched)
-			cond_resched();
-	}
+	logbuf_lock_irqsave(flags);
+	next_seq = log_next_seq;
+	logbuf_unlock_irqrestore(flags);
 
 	console_locked = 0;
-
-	raw_spin_unlock(&logbuf_lock);
-
+	console_kthreads_unblock();
 	up_console_sem();
 
 	/*
 	 * Someone could have filled up the buffer again, so re-check if there's
 	 * something to flush. In case we cannot trylock the console_sem again,
 	 * there's a new owner and the console_unlock() from them will do the
-	 * flush, no worries.
+	 * flush, no worries.  The kthreads may have given up while we held
+	 * console_sem, let them have another look.
 	 */
-	raw_spin_lock(&logbuf_lock);
-	retry = console_seq != log_next_seq;
-	raw_spin_unlock(&logbuf_lock);
-	printk_safe_exit_irqrestore(flags);
+	logbuf_lock_irqsave(flags);
+	retry = next_seq != log_next_seq;
+	logbuf_unlock_irqrestore(flags);
+
+	if (wake || (retry && printk_kthreads_running))
+		wake_up_console_kthreads();
 
-	if (retry && console_trylock())
+	if (retry && printk_direct_wanted() && console_trylock())
 		goto again;
 }
 EXPORT_SYMBOL(console_unlock);
@@ -2561,6 +2766,10 @@ void console_unblank(void)
 	if (oops_in_progress) {
 		if (down_trylock_console_sem() != 0)
 			return;
+		if (!console_kthreads_tryblock()) {
+			up_console_sem();
+			return;
+		}
 	} else
 		console_lock();
 
@@ -2591,11 +2800,14 @@ void console_flush_on_panic(enum con_flush_mode mode)
 	console_may_schedule = 0;
 
 	if (mode == CONSOLE_REPLAY_ALL) {
+		struct console *con;
 		unsigned long flags;
 
 		logbuf_lock_irqsave(flags);
-		console_seq = log_first_seq;
-		console_idx = log_first_idx;
+		for_each_console(con) {
+			con->seq = log_first_seq;
+			con->idx = log_first_idx;
+		}
 		logbuf_unlock_irqrestore(flags);
 	}
 	console_unlock();
@@ -2734,6 +2946,7 @@ void register_console(struct console *newcon)
 {
 	unsigned long flags;
 	struct console *bcon = NULL;
+	struct console *con;
 	int err;
 
 	for_each_console(bcon) {
@@ -2817,30 +3030,33 @@ void register_console(struct console *newcon)
 		console_drivers->next = newcon;
 	}
 
-	if (newcon->flags & CON_EXTENDED)
-		nr_ext_console_drivers++;
-
+	/*
+	 * With CON_PRINTBUFFER the new console replays the log buffer, the
+	 * other consoles are not affected.  Otherwise it starts where the
+	 * furthest behind of them is, so that nothing is lost when it
+	 * replaces a boot console.  Either way console_unlock() or the
+	 * kthread of the console prints the backlog.
+	 */
+	logbuf_lock_irqsave(flags);
 	if (newcon->flags & CON_PRINTBUFFER) {
-		/*
-		 * console_unlock(); will print out the buffered messages
-		 * for us.
-		 */
-		logbuf_lock_irqsave(flags);
-		/*
-		 * We're about to replay the log buffer.  Only do this to the
-		 * just-registered console to avoid excessive message spam to
-		 * the already-registered consoles.
-		 *
-		 * Set exclusive_console with disabled interrupts to reduce
-		 * race window with eventual console_flush_on_panic() that
-		 * ignores console_lock.
-		 */
-		exclusive_console = newcon;
-		exclusive_console_stop_seq = console_seq;
-		console_seq = syslog_seq;
-		console_idx = syslog_idx;
-		logbuf_unlock_irqrestore(flags);
+		newcon->seq = syslog_seq;
+		newcon->idx = syslog_idx;
+	} else {
+		newcon->seq = log_next_seq;
+		newcon->idx = log_next_idx;
+		for_each_console(con) {
+			if (con != newcon && (con->flags & CON_ENABLED) &&
+			    con->seq < newcon->seq) {
+				newcon->seq = con->seq;
+				newcon->idx = con->idx;
+			}
+		}
 	}
+	logbuf_unlock_irqrestore(flags);
+
+	if (printk_kthreads_running)
+		printk_start_kthread(newcon);
+	console_update_unthreaded();
 	console_unlock();
 	console_sysfs_notify();
 
@@ -2900,8 +3116,7 @@ int unregister_console(struct console *console)
 	if (res)
 		goto out_disable_unlock;
 
-	if (console->flags & CON_EXTENDED)
-		nr_ext_console_drivers--;
+	console_update_unthreaded();
 
 	/*
 	 * If this isn't the last console and it has CON_CONSDEV set, we
@@ -2914,6 +3129,11 @@ int unregister_console(struct console *console)
 	console_unlock();
 	console_sysfs_notify();
 
+	if (console->thread) {
+		kthread_stop(console->thread);
+		console->thread = NULL;
+	}
+
 	if (console->exit)
 		res = console->exit(console);
 
@@ -2996,6 +3216,16 @@ static int __init printk_late_init(void)
 			unregister_console(con);
 		}
 	}
+
+	if (IS_ENABLED(CONFIG_PRINTK) && printk_console_kthreads) {
+		console_lock();
+		printk_kthreads_running = true;
+		for_each_console(con)
+			printk_start_kthread(con);
+		console_update_unthreaded();
+		console_unlock();
+	}
+
 	ret = cpuhp_setup_state_nocalls(CPUHP_PRINTK_DEAD, "printk:dead", NULL,
 					console_cpu_notify);
 	WARN_ON(ret < 0);
@@ -3021,7 +3251,9 @@ static void wake_up_klogd_work_func(struct irq_work *irq_work)
 
 	if (pending & PRINTK_PENDING_OUTPUT) {
 		/* If trylock fails, someone else is doing the printing */
-		if (console_trylock())
+		if (!printk_direct_wanted())
+			wake_up_console_kthreads();
+		else if (console_trylock())
 			console_unlock();
 	}
 
@@ -60,6 +60,8 @@
 #include <linux/vmalloc.h>
 #include <linux/mm.h>
 #include <linux/kasan.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "../time/tick-internal.h"
 
 #include "tree.h"
@@ -1468,6 +1468,20 @@ early_param("rcu_nocb_poll", parse_rcu_nocb_poll);
 int nocb_nobypass_lim_per_jiffy = 16 * 1000 / HZ;
 module_param(nocb_nobypass_lim_per_jiffy, int, 0);
 
+/*
+ * How many jiffies callbacks may sit in ->nocb_bypass before they are
+ * flushed to ->cblist.  Larger values collect bigger batches during
+ * call_rcu() floods, with fewer rcuog wakeups, at the cost of callbacks
+ * being invoked that much later.
+ */
+static int nocb_bypass_delay = 1;
+module_param(nocb_bypass_delay, int, 0644);
+
+static unsigned long rcu_nocb_bypass_delay(void)
+{
+	return clamp(READ_ONCE(nocb_bypass_delay), 1, HZ);
+}
+
 /*
  * Acquire the specified rcu_data structure's ->nocb_bypass_lock.  If the
  * lock isn't immediately available, increment ->nocb_lock_contended to
@@ -1776,7 +1790,8 @@ static bool rcu_nocb_try_bypass(struct rcu_data *rdp, struct rcu_head *rhp,
 
 	// If ->nocb_bypass has been used too long or is too full,
 	// flush ->nocb_bypass to ->cblist.
-	if ((ncbs && j != READ_ONCE(rdp->nocb_bypass_first)) ||
+	if ((ncbs && time_after(j, READ_ONCE(rdp->nocb_bypass_first) +
+				    rcu_nocb_bypass_delay() - 1)) ||
 	    ncbs >= qhimark) {
 		rcu_nocb_lock(rdp);
 		if (!rcu_nocb_flush_bypass(rdp, rhp, j)) {
@@ -1931,7 +1946,8 @@ static void nocb_gp_wait(struct rcu_data *my_rdp)
 		rcu_nocb_lock_irqsave(rdp, flags);
 		bypass_ncbs = rcu_cblist_n_cbs(&rdp->nocb_bypass);
 		if (bypass_ncbs &&
-		    (time_after(j, READ_ONCE(rdp->nocb_bypass_first) + 1) ||
+		    (time_after(j, READ_ONCE(rdp->nocb_bypass_first) +
+				rcu_nocb_bypass_delay()) ||
 		     bypass_ncbs > 2 * qhimark)) {
 			// Bypass full or old, so flush it.
 			(void)rcu_nocb_try_flush_bypass(rdp, j);
@@ -1998,7 +2014,8 @@ static void nocb_gp_wait(struct rcu_data *my_rdp)
 		// At least one child with non-empty ->nocb_bypass, so set
 		// timer in order to avoid stranding its callbacks.
 		raw_spin_lock_irqsave(&my_rdp->nocb_gp_lock, flags);
-		mod_timer(&my_rdp->nocb_bypass_timer, j + 2);
+		mod_timer(&my_rdp->nocb_bypass_timer,
+			  j + rcu_nocb_bypass_delay() + 1);
 		raw_spin_unlock_irqrestore(&my_rdp->nocb_gp_lock, flags);
 	}
 	if (rcu_nocb_poll) {
@@ -2352,6 +2369,51 @@ void rcu_bind_current_to_nocb(void)
 }
 EXPORT_SYMBOL_GPL(rcu_bind_current_to_nocb);
 
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Report the callback queues of each no-CBs CPU in
+ * /sys/kernel/debug/rcu/nocb_queues: the CPU whose rcuog kthread serves
+ * it, the number of callbacks queued, how many of those are still in
+ * ->nocb_bypass, and how long (jiffies) the oldest bypass callback has
+ * been waiting.
+ */
+static int rcu_nocb_queues_show(struct seq_file *m, void *v)
+{
+	unsigned long age;
+	struct rcu_data *rdp;
+	long bypass_ncbs;
+	int cpu;
+
+	seq_puts(m, "cpu gp_cpu cbs bypass_cbs bypass_age\n");
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = per_cpu_ptr(&rcu_data, cpu);
+		bypass_ncbs = rcu_cblist_n_cbs(&rdp->nocb_bypass);
+		age = 0;
+		if (bypass_ncbs)
+			age = jiffies - READ_ONCE(rdp->nocb_bypass_first);
+		seq_printf(m, "%d %d %ld %ld %lu\n", cpu,
+			   rdp->nocb_gp_rdp ? rdp->nocb_gp_rdp->cpu : -1,
+			   rcu_segcblist_n_cbs(&rdp->cblist), bypass_ncbs, age);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rcu_nocb_queues);
+
+static int __init rcu_nocb_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	if (!cpumask_available(rcu_nocb_mask) || cpumask_empty(rcu_nocb_mask))
+		return 0;
+
+	dir = debugfs_create_dir("rcu", NULL);
+	debugfs_create_file("nocb_queues", 0444, dir, NULL,
+			    &rcu_nocb_queues_fops);
+	return 0;
+}
+late_initcall(rcu_nocb_debugfs_init);
+#endif /* #ifdef CONFIG_DEBUG_FS */
+
 /*
  * Dump out nocb grace-period kthread state for the specified rcu_data
  * structure.
@@ -1955,6 +1955,32 @@ int set_cpus_allowed_ptr(struct task_struct *p, const struct cpumask *new_mask)
 }
 EXPORT_SYMBOL_GPL(set_cpus_allowed_ptr);
 
+static void account_migrate_level(struct task_struct *p, int new_cpu)
+{
+	int level;
+
+	if (!schedstat_enabled() && !trace_sched_migrate_level_enabled())
+		return;
+
+	level = sched_migrate_level(task_cpu(p), new_cpu);
+	trace_sched_migrate_level(p, new_cpu, level);
+
+	switch (level) {
+	case SCHED_MIGRATE_SMT:
+		schedstat_inc(p->se.statistics.nr_migrations_smt);
+		break;
+	case SCHED_MIGRATE_LLC:
+		schedstat_inc(p->se.statistics.nr_migrations_llc);
+		break;
+	case SCHED_MIGRATE_NODE:
+		schedstat_inc(p->se.statistics.nr_migrations_node);
+		break;
+	default:
+		schedstat_inc(p->se.statistics.nr_migrations_remote);
+		break;
+	}
+}
+
 void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 {
 #ifdef CONFIG_SCHED_DEBUG
@@ -2002,6 +2028,7 @@ void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 		p->se.nr_migrations++;
 		rseq_migrate(p);
 		perf_event_task_migrate(p);
+		account_migrate_level(p, new_cpu);
 	}
 
 	__set_task_cpu(p, new_cpu);
@@ -2588,14 +2615,37 @@ void sched_ttwu_pending(void *arg)
 	rq_unlock_irqrestore(rq, &rf);
 }
 
-void send_call_function_single_ipi(int cpu)
+bool send_call_function_single_ipi(int cpu)
 {
 	struct rq *rq = cpu_rq(cpu);
 
-	if (!set_nr_if_polling(rq->idle))
+	if (!set_nr_if_polling(rq->idle)) {
 		arch_send_call_function_single_ipi(cpu);
-	else
-		trace_sched_wake_idle_without_ipi(cpu);
+		return true;
+	}
+
+	trace_sched_wake_idle_without_ipi(cpu);
+	return false;
+}
+
+/*
+ * Like send_call_function_single_ipi(), for all CPUs in @mask. CPUs polling
+ * in idle are woken by setting TIF_NEED_RESCHED instead and are cleared
+ * from @mask, which is left with the CPUs that were sent an IPI.
+ */
+void send_call_function_ipi_mask(struct cpumask *mask)
+{
+	int cpu;
+
+	for_each_cpu(cpu, mask) {
+		if (set_nr_if_polling(cpu_rq(cpu)->idle)) {
+			__cpumask_clear_cpu(cpu, mask);
+			trace_sched_wake_idle_without_ipi(cpu);
+		}
+	}
+
+	if (!cpumask_empty(mask))
+		arch_send_call_function_ipi_mask(mask);
 }
 
 /*
@@ -2642,6 +2692,7 @@ bool cpus_share_cache(int this_cpu, int that_cpu)
 {
 	return per_cpu(sd_llc_id, this_cpu) == per_cpu(sd_llc_id, that_cpu);
 }
+EXPORT_SYMBOL_GPL(cpus_share_cache);
 
 static inline bool ttwu_queue_cond(int cpu, int wake_flags)
 {
@@ -3109,7 +3160,9 @@ DEFINE_STATIC_KEY_FALSE(sched_numa_balancing);
 
 #ifdef CONFIG_NUMA_BALANCING
 
-void set_numabalancing_state(bool enabled)
+int sysctl_numa_balancing_mode;
+
+static void __set_numabalancing_state(bool enabled)
 {
 	if (enabled)
 		static_branch_enable(&sched_numa_balancing);
@@ -3117,13 +3170,22 @@ void set_numabalancing_state(bool enabled)
 		static_branch_disable(&sched_numa_balancing);
 }
 
+void set_numabalancing_state(bool enabled)
+{
+	if (enabled)
+		sysctl_numa_balancing_mode = NUMA_BALANCING_NORMAL;
+	else
+		sysctl_numa_balancing_mode = NUMA_BALANCING_DISABLED;
+	__set_numabalancing_state(enabled);
+}
+
 #ifdef CONFIG_PROC_SYSCTL
 int sysctl_numa_balancing(struct ctl_table *table, int write,
 			  void *buffer, size_t *lenp, loff_t *ppos)
 {
 	struct ctl_table t;
 	int err;
-	int state = static_branch_likely(&sched_numa_balancing);
+	int state = sysctl_numa_balancing_mode;
 
 	if (write && !capable(CAP_SYS_ADMIN))
 		return -EPERM;
@@ -3133,8 +3195,10 @@ int sysctl_numa_balancing(struct ctl_table *table, int write,
 	err = proc_dointvec_minmax(&t, write, buffer, lenp, ppos);
 	if (err < 0)
 		return err;
-	if (write)
-		set_numabalancing_state(state);
+	if (write) {
+		sysctl_numa_balancing_mode = state;
+		__set_numabalancing_state(state);
+	}
 	return err;
 }
 #endif
@@ -6153,6 +6217,26 @@ int __cond_resched_lock(spinlock_t *lock)
 }
 EXPORT_SYMBOL(__cond_resched_lock);
 
+int __cond_resched_rwlock_write(rwlock_t *lock)
+{
+	int resched = should_resched(PREEMPT_LOCK_OFFSET);
+	int ret = 0;
+
+	lockdep_assert_held_write(lock);
+
+	if (rwlock_needbreak(lock) || resched) {
+		write_unlock(lock);
+		if (resched)
+			preempt_schedule_common();
+		else
+			cpu_relax();
+		ret = 1;
+		write_lock(lock);
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__cond_resched_rwlock_write);
+
 /**
  * yield - yield the current processor to other threads.
  *
@@ -773,6 +773,12 @@ static void sched_debug_header(struct seq_file *m)
 	PN(sysctl_sched_latency);
 	PN(sysctl_sched_min_granularity);
 	PN(sysctl_sched_wakeup_granularity);
+	PN(sysctl_sched_migration_cost);
+	PN(sysctl_sched_migration_cost_level[SCHED_MIGRATE_SMT]);
+	PN(sysctl_sched_migration_cost_level[SCHED_MIGRATE_LLC]);
+	PN(sysctl_sched_migration_cost_level[SCHED_MIGRATE_NODE]);
+	PN(sysctl_sched_migration_cost_level[SCHED_MIGRATE_REMOTE]);
+	PN(sysctl_sched_llc_pull_cost);
 	P(sysctl_sched_child_runs_first);
 	P(sysctl_sched_features);
 #undef PN
@@ -952,6 +958,10 @@ void proc_sched_show_task(struct task_struct *p, struct pid_namespace *ns,
 		PN_SCHEDSTAT(se.statistics.iowait_sum);
 		P_SCHEDSTAT(se.statistics.iowait_count);
 		P_SCHEDSTAT(se.statistics.nr_migrations_cold);
+		P_SCHEDSTAT(se.statistics.nr_migrations_smt);
+		P_SCHEDSTAT(se.statistics.nr_migrations_llc);
+		P_SCHEDSTAT(se.statistics.nr_migrations_node);
+		P_SCHEDSTAT(se.statistics.nr_migrations_remote);
 		P_SCHEDSTAT(se.statistics.nr_failed_migrations_affine);
 		P_SCHEDSTAT(se.statistics.nr_failed_migrations_running);
 		P_SCHEDSTAT(se.statistics.nr_failed_migrations_hot);
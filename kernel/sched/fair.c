@@ -84,6 +84,30 @@ static unsigned int normalized_sysctl_sched_wakeup_granularity	= 1000000UL;
 
 const_debug unsigned int sysctl_sched_migration_cost	= 500000UL;
 
+/*
+ * How long a task stays cache hot after it last ran, depending on how far
+ * the load balancer would move it. SMT siblings share all but the L1, the
+ * cores of an LLC share the L3, anything further shares no cache at all;
+ * on parts with many LLCs per package, moving to another LLC of the same
+ * node costs about as much as moving to another node.
+ *
+ * (default: 0.125/0.5/1/1 msec, units: nanoseconds)
+ */
+const_debug unsigned int sysctl_sched_migration_cost_level[NR_SCHED_MIGRATE_LEVELS] = {
+	[SCHED_MIGRATE_SMT]	=  125000UL,
+	[SCHED_MIGRATE_LLC]	=  500000UL,
+	[SCHED_MIGRATE_NODE]	= 1000000UL,
+	[SCHED_MIGRATE_REMOTE]	= 1000000UL,
+};
+
+/*
+ * Minimum average idle time of a CPU for newidle balance to pull from an
+ * overloaded LLC of the node, see newidle_pull_llc().
+ *
+ * (default: 0.05 msec, units: nanoseconds)
+ */
+const_debug unsigned int sysctl_sched_llc_pull_cost	= 50000UL;
+
 int sched_thermal_decay_shift;
 static int __init setup_sched_thermal_decay_shift(char *str)
 {
@@ -1074,6 +1098,9 @@ unsigned int sysctl_numa_balancing_scan_size = 256;
 /* Scan @scan_size MB every @scan_period after an initial @scan_delay in ms */
 unsigned int sysctl_numa_balancing_scan_delay = 1000;
 
+/* Maximum MB per second of pages promoted to each top tier node */
+unsigned int sysctl_numa_balancing_promote_rate_limit = 65536;
+
 struct numa_group {
 	refcount_t refcount;
 
@@ -1414,6 +1441,27 @@ static inline unsigned long group_weight(struct task_struct *p, int nid,
 	return 1000 * faults / total_faults;
 }
 
+/*
+ * Returns true if promoting @nr more pages to @pgdat would exceed the promotion
+ * rate limit of the current one second period.
+ */
+static bool numa_promotion_rate_limit(struct pglist_data *pgdat,
+				      unsigned long rate_limit, int nr)
+{
+	unsigned long nr_cand;
+	unsigned int now, start;
+
+	now = jiffies_to_msecs(jiffies);
+	mod_node_page_state(pgdat, PGPROMOTE_CANDIDATE, nr);
+	nr_cand = node_page_state(pgdat, PGPROMOTE_CANDIDATE);
+	start = pgdat->nbp_rl_start;
+	if (now - start > MSEC_PER_SEC &&
+	    cmpxchg(&pgdat->nbp_rl_start, start, now) == start)
+		pgdat->nbp_rl_nr_cand = nr_cand;
+
+	return nr_cand - pgdat->nbp_rl_nr_cand >= rate_limit;
+}
+
 bool should_numa_migrate_memory(struct task_struct *p, struct page * page,
 				int src_nid, int dst_cpu)
 {
@@ -1424,6 +1472,26 @@ bool should_numa_migrate_memory(struct task_struct *p, struct page * page,
 	this_cpupid = cpu_pid_to_cpupid(dst_cpu, current->pid);
 	last_cpupid = page_cpupid_xchg_last(page, this_cpupid);
 
+	/*
+	 * Pages on a slow memory node are promoted based on how hot they
+	 * are rather than on private/shared faults: a page that took two
+	 * hinting faults in a row from the same top tier node is hot, and
+	 * is promoted unless the target is over its promotion rate limit.
+	 */
+	if ((sysctl_numa_balancing_mode & NUMA_BALANCING_MEMORY_TIERING) &&
+	    !node_is_toptier(src_nid)) {
+		unsigned long rate_limit;
+
+		if (!node_is_toptier(dst_nid) || cpupid_pid_unset(last_cpupid) ||
+		    cpupid_to_nid(last_cpupid) != dst_nid)
+			return false;
+
+		rate_limit = READ_ONCE(sysctl_numa_balancing_promote_rate_limit) <<
+			     (20 - PAGE_SHIFT);
+		return !numa_promotion_rate_limit(NODE_DATA(dst_nid), rate_limit,
+						  thp_nr_pages(page));
+	}
+
 	/*
 	 * Allow first faults or private faults to migrate immediately early in
 	 * the lifetime of a task. The magic number 4 is based on waiting for
@@ -2590,6 +2658,11 @@ void task_numa_free(struct task_struct *p, bool final)
 	unsigned long flags;
 	int i;
 
+	if (final) {
+		kfree(p->numa_samples);
+		p->numa_samples = NULL;
+	}
+
 	if (!numa_faults)
 		return;
 
@@ -2704,6 +2777,232 @@ static void reset_ptenuma_scan(struct task_struct *p)
 	p->mm->numa_scan_offset = 0;
 }
 
+/*
+ * Whether NUMA balancing looks at the memory of @vma at all.
+ */
+static bool vma_numa_balanced(struct vm_area_struct *vma)
+{
+	if (!vma_migratable(vma) || !vma_policy_mof(vma) ||
+		is_vm_hugetlb_page(vma) || (vma->vm_flags & VM_MIXEDMAP)) {
+		return false;
+	}
+
+	/*
+	 * Shared library pages mapped by multiple processes are not
+	 * migrated as it is expected they are cache replicated. Avoid
+	 * hinting faults in read-only file-backed mappings or the vdso
+	 * as migrating the pages will be of marginal benefit.
+	 */
+	if (!vma->vm_mm ||
+	    (vma->vm_file && (vma->vm_flags & (VM_READ|VM_WRITE)) == (VM_READ)))
+		return false;
+
+	/*
+	 * Skip inaccessible VMAs to avoid any confusion between
+	 * PROT_NONE and NUMA hinting ptes
+	 */
+	if (!vma_is_accessible(vma))
+		return false;
+
+	return true;
+}
+
+/*
+ * Hardware access samples, an alternative source to PTE scanning for
+ * processes that select it with PR_SET_NUMA_SOURCE.
+ *
+ * While any mm uses them the architecture runs a sampler on every CPU that
+ * calls task_numa_sample() from NMI context with the virtual and physical
+ * address of an access made by current. Samples are queued on a per-task
+ * ring, which only current ever touches: the NMI produces and the task
+ * consumes from task_work, accounting each sample like a hinting fault.
+ * task_numa_work() does not scan such mms, so they take no hinting faults
+ * and no PTE update TLB flushes at all.
+ */
+#define NUMA_SAMPLES_NR		128
+
+struct numa_sample_ring {
+	unsigned int		head;	/* written from NMI */
+	unsigned int		tail;	/* written by the task */
+	struct {
+		unsigned long	addr;
+		phys_addr_t	paddr;
+	} samples[NUMA_SAMPLES_NR];
+};
+
+static DEFINE_MUTEX(numa_sampling_mutex);
+static unsigned int numa_sampling_users;
+static bool numa_sampling_active;
+
+int __weak arch_numa_sampling_start(void)
+{
+	return -EOPNOTSUPP;
+}
+
+void __weak arch_numa_sampling_stop(void)
+{
+}
+
+static int numa_sampling_get(void)
+{
+	int ret = 0;
+
+	mutex_lock(&numa_sampling_mutex);
+	if (!numa_sampling_active) {
+		ret = arch_numa_sampling_start();
+		numa_sampling_active = !ret;
+	}
+	if (!ret)
+		numa_sampling_users++;
+	mutex_unlock(&numa_sampling_mutex);
+
+	return ret;
+}
+
+static void numa_sampling_stop_workfn(struct work_struct *work)
+{
+	mutex_lock(&numa_sampling_mutex);
+	if (!numa_sampling_users && numa_sampling_active) {
+		arch_numa_sampling_stop();
+		numa_sampling_active = false;
+	}
+	mutex_unlock(&numa_sampling_mutex);
+}
+
+static DECLARE_WORK(numa_sampling_stop_work, numa_sampling_stop_workfn);
+
+/*
+ * The last put can come from __mmput(); stopping the sampler goes through
+ * CPU hotplug, so leave that to a work item.
+ */
+static void numa_sampling_put(void)
+{
+	mutex_lock(&numa_sampling_mutex);
+	if (!--numa_sampling_users)
+		schedule_work(&numa_sampling_stop_work);
+	mutex_unlock(&numa_sampling_mutex);
+}
+
+/*
+ * Switch the mm of current between PTE scanning and hardware samples. It
+ * applies to all threads of the process; it is not inherited by fork() and
+ * does not survive exec().
+ */
+int task_numa_set_samples(bool enable)
+{
+	struct mm_struct *mm = current->mm;
+	int ret;
+
+	if (!enable) {
+		if (test_and_clear_bit(MMF_NUMA_SAMPLES, &mm->flags))
+			numa_sampling_put();
+		return 0;
+	}
+
+	if (test_bit(MMF_NUMA_SAMPLES, &mm->flags))
+		return 0;
+
+	ret = numa_sampling_get();
+	if (ret)
+		return ret;
+
+	/* Another thread of this mm won the race */
+	if (test_and_set_bit(MMF_NUMA_SAMPLES, &mm->flags))
+		numa_sampling_put();
+
+	return 0;
+}
+
+void task_numa_mm_exit(struct mm_struct *mm)
+{
+	if (test_bit(MMF_NUMA_SAMPLES, &mm->flags))
+		numa_sampling_put();
+}
+
+/*
+ * Called from NMI context by the architecture's sampler for an access by
+ * current to @addr, backed by @paddr.
+ */
+void task_numa_sample(unsigned long addr, phys_addr_t paddr)
+{
+	struct task_struct *p = current;
+	struct numa_sample_ring *r = READ_ONCE(p->numa_samples);
+	unsigned int head;
+
+	if (!r || !p->mm || (p->flags & PF_EXITING) || addr >= TASK_SIZE)
+		return;
+
+	if (!test_bit(MMF_NUMA_SAMPLES, &p->mm->flags))
+		return;
+
+	/* Full, the task has not got around to it yet */
+	head = r->head;
+	if (head - READ_ONCE(r->tail) >= NUMA_SAMPLES_NR)
+		return;
+
+	r->samples[head % NUMA_SAMPLES_NR].addr = addr;
+	r->samples[head % NUMA_SAMPLES_NR].paddr = paddr;
+	smp_store_release(&r->head, head + 1);
+}
+
+static void task_numa_drain_samples(struct task_struct *p)
+{
+	struct numa_sample_ring *r = p->numa_samples;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma = NULL;
+	unsigned int head, tail;
+
+	if (!r)
+		return;
+
+	head = smp_load_acquire(&r->head);
+	tail = r->tail;
+	if (head == tail)
+		return;
+
+	/*
+	 * Samples are statistical; drop them rather than wait for the
+	 * mmap_lock, or once the mm went back to PTE scanning.
+	 */
+	if (!test_bit(MMF_NUMA_SAMPLES, &mm->flags) || !mmap_read_trylock(mm))
+		goto out;
+
+	for (; tail != head; tail++) {
+		unsigned long addr = r->samples[tail % NUMA_SAMPLES_NR].addr;
+		phys_addr_t paddr = r->samples[tail % NUMA_SAMPLES_NR].paddr;
+
+		if (!vma || addr < vma->vm_start || addr >= vma->vm_end) {
+			vma = find_vma(mm, addr);
+			if (!vma || addr < vma->vm_start)
+				continue;
+		}
+
+		if (!vma_numa_balanced(vma))
+			continue;
+
+		do_numa_sample(vma, addr, PHYS_PFN(paddr));
+	}
+	mmap_read_unlock(mm);
+out:
+	smp_store_release(&r->tail, head);
+}
+
+/*
+ * Triggered from task_tick_numa() once enough samples have been queued.
+ */
+static void task_numa_sample_work(struct callback_head *work)
+{
+	struct task_struct *p = current;
+
+	SCHED_WARN_ON(p != container_of(work, struct task_struct, numa_sample_work));
+
+	work->next = work;
+	if (p->flags & PF_EXITING)
+		return;
+
+	task_numa_drain_samples(p);
+}
+
 /*
  * The expensive part of numa migration is done from task_work context.
  * Triggered from task_tick_numa().
@@ -2733,6 +3032,14 @@ static void task_numa_work(struct callback_head *work)
 	if (p->flags & PF_EXITING)
 		return;
 
+	if (test_bit(MMF_NUMA_SAMPLES, &mm->flags)) {
+		if (!p->numa_samples)
+			WRITE_ONCE(p->numa_samples,
+				   kzalloc(sizeof(struct numa_sample_ring),
+					   GFP_KERNEL));
+		task_numa_drain_samples(p);
+	}
+
 	if (!mm->numa_next_scan) {
 		mm->numa_next_scan = now +
 			msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
@@ -2760,6 +3067,15 @@ static void task_numa_work(struct callback_head *work)
 	 */
 	p->node_stamp += 2 * TICK_NSEC;
 
+	/*
+	 * With hardware samples there is nothing to scan; only open a new
+	 * placement window like a completed scan pass would.
+	 */
+	if (test_bit(MMF_NUMA_SAMPLES, &mm->flags)) {
+		reset_ptenuma_scan(p);
+		return;
+	}
+
 	start = mm->numa_scan_offset;
 	pages = sysctl_numa_balancing_scan_size;
 	pages <<= 20 - PAGE_SHIFT; /* MB in pages */
@@ -2777,26 +3093,7 @@ static void task_numa_work(struct callback_head *work)
 		vma = mm->mmap;
 	}
 	for (; vma; vma = vma->vm_next) {
-		if (!vma_migratable(vma) || !vma_policy_mof(vma) ||
-			is_vm_hugetlb_page(vma) || (vma->vm_flags & VM_MIXEDMAP)) {
-			continue;
-		}
-
-		/*
-		 * Shared library pages mapped by multiple processes are not
-		 * migrated as it is expected they are cache replicated. Avoid
-		 * hinting faults in read-only file-backed mappings or the vdso
-		 * as migrating the pages will be of marginal benefit.
-		 */
-		if (!vma->vm_mm ||
-		    (vma->vm_file && (vma->vm_flags & (VM_READ|VM_WRITE)) == (VM_READ)))
-			continue;
-
-		/*
-		 * Skip inaccessible VMAs to avoid any confusion between
-		 * PROT_NONE and NUMA hinting ptes
-		 */
-		if (!vma_is_accessible(vma))
+		if (!vma_numa_balanced(vma))
 			continue;
 
 		do {
@@ -2867,12 +3164,15 @@ void init_numa_balancing(unsigned long clone_flags, struct task_struct *p)
 	p->numa_scan_period		= sysctl_numa_balancing_scan_delay;
 	/* Protect against double add, see task_tick_numa and task_numa_work */
 	p->numa_work.next		= &p->numa_work;
+	p->numa_sample_work.next	= &p->numa_sample_work;
+	p->numa_samples			= NULL;
 	p->numa_faults			= NULL;
 	RCU_INIT_POINTER(p->numa_group, NULL);
 	p->last_task_numa_placement	= 0;
 	p->last_sum_exec_runtime	= 0;
 
 	init_task_work(&p->numa_work, task_numa_work);
+	init_task_work(&p->numa_sample_work, task_numa_sample_work);
 
 	/* New address space, reset the preferred nid */
 	if (!(clone_flags & CLONE_VM)) {
@@ -2900,12 +3200,20 @@ void init_numa_balancing(unsigned long clone_flags, struct task_struct *p)
 static void task_tick_numa(struct rq *rq, struct task_struct *curr)
 {
 	struct callback_head *work = &curr->numa_work;
+	struct numa_sample_ring *r = curr->numa_samples;
 	u64 period, now;
 
 	/*
 	 * We don't care about NUMA placement if we don't have memory.
 	 */
-	if ((curr->flags & (PF_EXITING | PF_KTHREAD)) || work->next != work)
+	if (curr->flags & (PF_EXITING | PF_KTHREAD))
+		return;
+
+	if (r && curr->numa_sample_work.next == &curr->numa_sample_work &&
+	    READ_ONCE(r->head) - r->tail >= NUMA_SAMPLES_NR / 4)
+		task_work_add(curr, &curr->numa_sample_work, true);
+
+	if (work->next != work)
 		return;
 
 	/*
@@ -5982,15 +6290,6 @@ static inline int find_idlest_cpu(struct sched_domain *sd, struct task_struct *p
 DEFINE_STATIC_KEY_FALSE(sched_smt_present);
 EXPORT_SYMBOL_GPL(sched_smt_present);
 
-static inline void set_idle_cores(int cpu, int val)
-{
-	struct sched_domain_shared *sds;
-
-	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
-	if (sds)
-		WRITE_ONCE(sds->has_idle_cores, val);
-}
-
 static inline bool test_idle_cores(int cpu, bool def)
 {
 	struct sched_domain_shared *sds;
@@ -6004,7 +6303,7 @@ static inline bool test_idle_cores(int cpu, bool def)
 
 /*
  * Scans the local SMT mask to see if the entire core is idle, and records this
- * information in sd_llc_shared->has_idle_cores.
+ * information in sd_llc_shared->idle_cores and sd_llc_shared->has_idle_cores.
  *
  * Since SMT siblings share all cache levels, inspecting this limited remote
  * state should be fairly cheap.
@@ -6012,10 +6311,17 @@ static inline bool test_idle_cores(int cpu, bool def)
 void __update_idle_core(struct rq *rq)
 {
 	int core = cpu_of(rq);
-	int cpu;
+	struct sched_domain_shared *sds;
+	int cpu, id;
 
 	rcu_read_lock();
-	if (test_idle_cores(core, true))
+	sds = rcu_dereference(per_cpu(sd_llc_shared, core));
+	if (!sds)
+		goto unlock;
+
+	id = cpumask_first(cpu_smt_mask(core));
+	if (cpumask_test_cpu(id, sds_idle_cores(sds)) &&
+	    READ_ONCE(sds->has_idle_cores))
 		goto unlock;
 
 	for_each_cpu(cpu, cpu_smt_mask(core)) {
@@ -6026,28 +6332,56 @@ void __update_idle_core(struct rq *rq)
 			goto unlock;
 	}
 
-	set_idle_cores(core, 1);
+	cpumask_set_cpu(id, sds_idle_cores(sds));
+	WRITE_ONCE(sds->has_idle_cores, 1);
 unlock:
 	rcu_read_unlock();
 }
 
 /*
- * Scan the entire LLC domain for idle cores; this dynamically switches off if
- * there are no idle cores left in the system; tracked through
- * sd_llc->shared->has_idle_cores and enabled through update_idle_core() above.
+ * The idle task is about to be switched out; the core is no longer fully
+ * idle. Only write the shared mask when our core is actually marked, so that
+ * busy LLCs don't bounce its cacheline on every idle exit.
+ */
+void __clear_idle_core(struct rq *rq)
+{
+	int core = cpu_of(rq);
+	struct sched_domain_shared *sds;
+	int id;
+
+	rcu_read_lock();
+	sds = rcu_dereference(per_cpu(sd_llc_shared, core));
+	if (sds) {
+		id = cpumask_first(cpu_smt_mask(core));
+		if (cpumask_test_cpu(id, sds_idle_cores(sds)))
+			cpumask_clear_cpu(id, sds_idle_cores(sds));
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Find an idle core in the LLC domain from sd_llc->shared->idle_cores; this
+ * dynamically switches off if there are no idle cores left in the system;
+ * tracked through sd_llc->shared->has_idle_cores and enabled through
+ * update_idle_core() above.
+ *
+ * A core's bit can be stale when a wakeup has been queued on it but has not
+ * run yet, so each candidate is still checked; stale bits are cleared here.
  */
 static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
 {
 	struct cpumask *cpus = this_cpu_cpumask_var_ptr(select_idle_mask);
+	struct sched_domain_shared *sds;
 	int core, cpu;
 
 	if (!static_branch_likely(&sched_smt_present))
 		return -1;
 
-	if (!test_idle_cores(target, false))
+	sds = rcu_dereference(per_cpu(sd_llc_shared, target));
+	if (!sds || !READ_ONCE(sds->has_idle_cores))
 		return -1;
 
-	cpumask_and(cpus, sched_domain_span(sd), p->cpus_ptr);
+	cpumask_and(cpus, sds_idle_cores(sds), sched_domain_span(sd));
 
 	for_each_cpu_wrap(core, cpus, target) {
 		bool idle = true;
@@ -6058,16 +6392,21 @@ static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int
 				break;
 			}
 		}
-		cpumask_andnot(cpus, cpus, cpu_smt_mask(core));
 
-		if (idle)
-			return core;
+		if (!idle) {
+			cpumask_clear_cpu(core, sds_idle_cores(sds));
+			continue;
+		}
+
+		cpu = cpumask_first_and(cpu_smt_mask(core), p->cpus_ptr);
+		if (cpu < nr_cpu_ids)
+			return cpu;
 	}
 
 	/*
 	 * Failed to find an idle core; stop looking for one.
 	 */
-	set_idle_cores(target, 0);
+	WRITE_ONCE(sds->has_idle_cores, 0);
 
 	return -1;
 }
@@ -6159,6 +6498,67 @@ static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int t
 	return cpu;
 }
 
+/*
+ * Scan the other LLCs of the package for idle CPUs, one domain level at a
+ * time so that nearer LLCs are tried first.  The number of CPUs scanned is
+ * regulated like select_idle_cpu() does, with the cost of this scan tracked
+ * in the avg_scan_cost of the package level domain.
+ */
+static int select_idle_node(struct task_struct *p, struct sched_domain *llc, int target)
+{
+	struct cpumask *cpus = this_cpu_cpumask_var_ptr(select_idle_mask);
+	struct sched_domain *sd, *node, *this_node;
+	u64 avg_cost, avg_idle;
+	u64 time;
+	int this = smp_processor_id();
+	int cpu, nr = INT_MAX;
+
+	node = rcu_dereference(per_cpu(sd_node, target));
+	this_node = rcu_dereference(*this_cpu_ptr(&sd_node));
+	if (!node || !this_node)
+		return -1;
+
+	avg_idle = this_rq()->avg_idle / 512;
+	avg_cost = this_node->avg_scan_cost + 1;
+
+	if (sched_feat(SIS_PROP)) {
+		u64 span_avg = (node->span_weight - llc->span_weight) * avg_idle;
+		if (span_avg > 4*avg_cost)
+			nr = div_u64(span_avg, avg_cost);
+		else
+			nr = 4;
+	}
+
+	schedstat_inc(this_rq()->sis_node_scan);
+	time = cpu_clock(this);
+
+	for (sd = llc->parent; sd; sd = sd->parent) {
+		cpumask_andnot(cpus, sched_domain_span(sd),
+			       sched_domain_span(sd->child));
+		cpumask_and(cpus, cpus, p->cpus_ptr);
+
+		for_each_cpu_wrap(cpu, cpus, target) {
+			if (!--nr)
+				return -1;
+			if (available_idle_cpu(cpu) || sched_idle_cpu(cpu))
+				goto found;
+		}
+
+		if (sd == node)
+			break;
+	}
+	cpu = -1;
+
+found:
+	time = cpu_clock(this) - time;
+	update_avg(&this_node->avg_scan_cost, time);
+
+	if (cpu >= 0)
+		schedstat_inc(this_rq()->sis_node_found);
+
+	return cpu;
+}
+
 /*
  * Scan the asym_capacity domain for idle CPUs; pick the first idle one on which
  * the task fits. If no CPU is big enough, but there are idle ones, try to
@@ -6278,6 +6678,12 @@ symmetric:
 	if ((unsigned)i < nr_cpumask_bits)
 		return i;
 
+	if (sched_feat(SIS_NODE)) {
+		i = select_idle_node(p, sd, target);
+		if ((unsigned)i < nr_cpumask_bits)
+			return i;
+	}
+
 	return target;
 }
 
@@ -7392,6 +7798,7 @@ struct lb_env {
  */
 static int task_hot(struct task_struct *p, struct lb_env *env)
 {
+	int level;
 	s64 delta;
 
 	lockdep_assert_held(&env->src_rq->lock);
@@ -7415,9 +7822,10 @@ static int task_hot(struct task_struct *p, struct lb_env *env)
 	if (sysctl_sched_migration_cost == 0)
 		return 0;
 
+	level = sched_migrate_level(env->src_cpu, env->dst_cpu);
 	delta = rq_clock_task(env->src_rq) - p->se.exec_start;
 
-	return delta < (s64)sysctl_sched_migration_cost;
+	return delta < (s64)sysctl_sched_migration_cost_level[level];
 }
 
 #ifdef CONFIG_NUMA_BALANCING
@@ -10462,6 +10870,133 @@ static inline bool nohz_idle_balance(struct rq *this_rq, enum cpu_idle_type idle
 static inline void nohz_newidle_balance(struct rq *this_rq) { }
 #endif /* CONFIG_NO_HZ_COMMON */
 
+/*
+ * LLCs with a runqueue running more than one task, indexed by sd_llc_id,
+ * one mask per node.  Bits are set when a runqueue becomes overloaded and
+ * only cleared when newidle_pull_llc() finds nothing left to pull, so a
+ * set bit is a hint.
+ */
+static cpumask_var_t *llc_overloaded_mask;
+
+void set_llc_overloaded(struct rq *rq)
+{
+	struct cpumask *mask;
+	int llc;
+
+	if (!sched_feat(NEWIDLE_LLC) || !llc_overloaded_mask)
+		return;
+
+	mask = llc_overloaded_mask[cpu_to_node(cpu_of(rq))];
+	llc = per_cpu(sd_llc_id, cpu_of(rq));
+	if (!cpumask_test_cpu(llc, mask))
+		cpumask_set_cpu(llc, mask);
+}
+
+/*
+ * Pull a task from @busiest, using the lowest domain spanning both CPUs
+ * for the cache hot and locality checks.
+ */
+static int newidle_pull_from(struct rq *this_rq, struct rq *busiest)
+{
+	struct cpumask *cpus = this_cpu_cpumask_var_ptr(load_balance_mask);
+	struct sched_domain *sd;
+	struct rq_flags rf;
+	int ld_moved;
+
+	struct lb_env env = {
+		.dst_cpu	= cpu_of(this_rq),
+		.dst_rq		= this_rq,
+		.src_cpu	= cpu_of(busiest),
+		.src_rq		= busiest,
+		.idle		= CPU_NEWLY_IDLE,
+		.imbalance	= 1,
+		.cpus		= cpus,
+		.loop_break	= sched_nr_migrate_break,
+		.fbq_type	= all,
+		.migration_type	= migrate_task,
+		.tasks		= LIST_HEAD_INIT(env.tasks),
+	};
+
+	for_each_domain(env.dst_cpu, sd) {
+		if (cpumask_test_cpu(env.src_cpu, sched_domain_span(sd)))
+			break;
+	}
+	if (!sd)
+		return 0;
+
+	env.sd = sd;
+	cpumask_and(cpus, sched_domain_span(sd), cpu_active_mask);
+
+	rq_lock_irqsave(busiest, &rf);
+	update_rq_clock(busiest);
+	env.loop_max = min(sysctl_sched_nr_migrate, busiest->nr_running);
+	ld_moved = detach_tasks(&env);
+	rq_unlock(busiest, &rf);
+
+	if (ld_moved)
+		attach_tasks(&env);
+
+	local_irq_restore(rf.flags);
+
+	return ld_moved;
+}
+
+/*
+ * Pull a task from the nearest overloaded LLC of this node, going by LLC
+ * id, without walking the domains up to the one spanning it.  LLCs which
+ * turn out to have nothing to pull have their bit cleared.
+ *
+ * Called with this_rq unlocked and the RCU read lock held.
+ */
+static int newidle_pull_llc(struct rq *this_rq)
+{
+	int this_cpu = cpu_of(this_rq);
+	int this_llc = per_cpu(sd_llc_id, this_cpu);
+	struct cpumask *mask;
+	int llc, cpu, pulled = 0;
+
+	if (!llc_overloaded_mask)
+		return 0;
+
+	mask = llc_overloaded_mask[cpu_to_node(this_cpu)];
+	for_each_cpu_wrap(llc, mask, this_llc) {
+		struct rq *rq, *busiest = NULL;
+		unsigned int nr, busiest_nr = 1;
+		struct sched_domain *sd;
+
+		/* The own LLC is covered by the domain walk */
+		if (llc == this_llc)
+			continue;
+
+		sd = rcu_dereference(per_cpu(sd_llc, llc));
+		if (!sd)
+			continue;
+
+		for_each_cpu(cpu, sched_domain_span(sd)) {
+			rq = cpu_rq(cpu);
+			nr = READ_ONCE(rq->cfs.h_nr_running);
+			if (nr > busiest_nr) {
+				busiest = rq;
+				busiest_nr = nr;
+			}
+		}
+
+		if (!busiest) {
+			cpumask_clear_cpu(llc, mask);
+			schedstat_inc(this_rq->llc_pull_stale);
+			continue;
+		}
+
+		/* One attempt only, newidle has to stay cheap */
+		schedstat_inc(this_rq->llc_pull_count);
+		pulled = newidle_pull_from(this_rq, busiest);
+		schedstat_add(this_rq->llc_pull_gained, pulled);
+		break;
+	}
+
+	return pulled;
+}
+
 /*
  * idle_balance is called by schedule() if this_cpu is about to become
  * idle. Attempts to pull tasks from other CPUs.
@@ -10475,7 +11010,9 @@ static int newidle_balance(struct rq *this_rq, struct rq_flags *rf)
 {
 	unsigned long next_balance = jiffies + HZ;
 	int this_cpu = this_rq->cpu;
+	u64 min_idle = sysctl_sched_migration_cost;
 	struct sched_domain *sd;
+	bool walk_cut = false;
 	int pulled_task = 0;
 	u64 curr_cost = 0;
 
@@ -10500,7 +11037,10 @@ static int newidle_balance(struct rq *this_rq, struct rq_flags *rf)
 	 */
 	rq_unpin_lock(this_rq, rf);
 
-	if (this_rq->avg_idle < sysctl_sched_migration_cost ||
+	if (sched_feat(NEWIDLE_LLC))
+		min_idle = min(min_idle, (u64)sysctl_sched_llc_pull_cost);
+
+	if (this_rq->avg_idle < min_idle ||
 	    !READ_ONCE(this_rq->rd->overload)) {
 
 		rcu_read_lock();
@@ -10522,8 +11062,10 @@ static int newidle_balance(struct rq *this_rq, struct rq_flags *rf)
 		int continue_balancing = 1;
 		u64 t0, domain_cost;
 
-		if (this_rq->avg_idle < curr_cost + sd->max_newidle_lb_cost) {
+		if (this_rq->avg_idle < sysctl_sched_migration_cost ||
+		    this_rq->avg_idle < curr_cost + sd->max_newidle_lb_cost) {
 			update_next_balance(sd, &next_balance);
+			walk_cut = true;
 			break;
 		}
 
@@ -10550,6 +11092,15 @@ static int newidle_balance(struct rq *this_rq, struct rq_flags *rf)
 		if (pulled_task || this_rq->nr_running > 0)
 			break;
 	}
+
+	/*
+	 * The walk stopped short of the wider domains: pull straight from an
+	 * overloaded LLC of the node if it can still be afforded.
+	 */
+	if (sched_feat(NEWIDLE_LLC) && walk_cut && !pulled_task &&
+	    !this_rq->nr_running &&
+	    this_rq->avg_idle >= curr_cost + sysctl_sched_llc_pull_cost)
+		pulled_task = newidle_pull_llc(this_rq);
 	rcu_read_unlock();
 
 	raw_spin_lock(&this_rq->lock);
@@ -11228,6 +11779,21 @@ __init void init_sched_fair_class(void)
 	nohz.next_blocked = jiffies;
 	zalloc_cpumask_var(&nohz.idle_cpus_mask, GFP_NOWAIT);
 #endif
+
+	llc_overloaded_mask = kcalloc(nr_node_ids, sizeof(cpumask_var_t),
+				      GFP_NOWAIT);
+	if (llc_overloaded_mask) {
+		int node;
+
+		for_each_node(node) {
+			if (!zalloc_cpumask_var_node(&llc_overloaded_mask[node],
+						     GFP_NOWAIT, node)) {
+				/* masks are never freed, a partial set is of no use */
+				llc_overloaded_mask = NULL;
+				break;
+			}
+		}
+	}
 #endif /* SMP */
 
 }
@@ -57,6 +57,18 @@ SCHED_FEAT(TTWU_QUEUE, true)
 SCHED_FEAT(SIS_AVG_CPU, false)
 SCHED_FEAT(SIS_PROP, true)
 
+/*
+ * When the LLC has no idle CPU, look for one in the other LLCs of the
+ * package, nearest first.
+ */
+SCHED_FEAT(SIS_NODE, false)
+
+/*
+ * When newidle balance can't afford the domain walk up to the node level,
+ * pull straight from an LLC of the node marked overloaded.
+ */
+SCHED_FEAT(NEWIDLE_LLC, false)
+
 /*
  * Issue a WARN when we do multiple update_rq_clock() calls
  * in a single rq->lock section. Default disabled because the
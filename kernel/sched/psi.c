@@ -125,6 +125,23 @@
  * This gives us an approximation of pressure that is practical
  * cost-wise, yet way more sensitive and accurate than periodic
  * sampling of the aggregate task states would be.
+ *
+ *			Lazy hierarchy (psi_lazy=1)
+ *
+ * Normally a task change updates the task's cgroup and every one of
+ * its ancestors, so the cost of a context switch grows with the depth
+ * of the hierarchy. In lazy mode a task change only updates the task's
+ * own cgroup and the system group, and marks the cgroup updated in the
+ * cgroup rstat tree. Ancestors pick up the times when they are read:
+ * the rstat flush folds each updated cgroup's times into its parent,
+ * bottom-up, and only visits the parts of the subtree that changed.
+ *
+ * An ancestor's per-CPU times are then the sums of its descendants'.
+ * That is exact as long as no two descendants are stalled on a CPU at
+ * the same time. Otherwise it overestimates, and the excess is carried
+ * forward like any delta in excess of the sampling period, see
+ * update_averages(). Pressure triggers are only supported on cgroups
+ * without children.
  */
 
 #include "../workqueue_internal.h"
@@ -132,6 +149,7 @@
 #include <linux/seq_file.h>
 #include <linux/proc_fs.h>
 #include <linux/seqlock.h>
+#include <linux/nsproxy.h>
 #include <linux/uaccess.h>
 #include <linux/cgroup.h>
 #include <linux/module.h>
@@ -157,6 +175,15 @@ static int __init setup_psi(char *str)
 }
 __setup("psi=", setup_psi);
 
+DEFINE_STATIC_KEY_FALSE(psi_lazy);
+
+static bool psi_lazy_enable;
+static int __init setup_psi_lazy(char *str)
+{
+	return kstrtobool(str, &psi_lazy_enable) == 0;
+}
+__setup("psi_lazy=", setup_psi_lazy);
+
 /* Running averages - we need to be higher-res than loadavg */
 #define PSI_FREQ	(2*HZ+1)	/* 2 sec intervals */
 #define EXP_10s		1677		/* 1/exp(2s/10s) as fixed-point */
@@ -208,10 +235,62 @@ void __init psi_init(void)
 		return;
 	}
 
+	if (IS_ENABLED(CONFIG_CGROUPS) && psi_lazy_enable)
+		static_branch_enable(&psi_lazy);
+
 	psi_period = jiffies_to_nsecs(PSI_FREQ);
 	group_init(&psi_system);
 }
 
+/* Whether @group is a cgroup whose times come from the rstat flush */
+static inline bool psi_group_lazy(struct psi_group *group)
+{
+	return static_branch_unlikely(&psi_lazy) && group != &psi_system;
+}
+
+#ifdef CONFIG_CGROUPS
+static inline struct cgroup *psi_group_cgroup(struct psi_group *group)
+{
+	return container_of(group, struct cgroup, psi);
+}
+
+/*
+ * Lazy mode: bring the tree times of @group and its subtree up to date.
+ */
+static void psi_flush(struct psi_group *group)
+{
+	if (psi_group_lazy(group))
+		cgroup_rstat_flush(psi_group_cgroup(group));
+}
+
+/*
+ * Lazy mode: the periodic aggregation of an active cgroup keeps its
+ * ancestors' clocks running, and makes sure states that last for many
+ * periods without task changes are flushed as they go.
+ */
+static void psi_lazy_kick(struct psi_group *group)
+{
+	struct cgroup *cgrp = psi_group_cgroup(group);
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (per_cpu_ptr(group->pcpu, cpu)->state_mask)
+			cgroup_rstat_updated(cgrp, cpu);
+	}
+
+	for (cgrp = cgroup_parent(cgrp); cgroup_parent(cgrp);
+	     cgrp = cgroup_parent(cgrp)) {
+		struct delayed_work *dwork = &cgroup_psi(cgrp)->avgs_work;
+
+		if (!delayed_work_pending(dwork))
+			schedule_delayed_work(dwork, PSI_FREQ);
+	}
+}
+#else
+static inline void psi_flush(struct psi_group *group) { }
+static inline void psi_lazy_kick(struct psi_group *group) { }
+#endif
+
 static bool test_state(unsigned int *tasks, enum psi_states state)
 {
 	switch (state) {
@@ -233,18 +312,15 @@ static bool test_state(unsigned int *tasks, enum psi_states state)
 	}
 }
 
-static void get_recent_times(struct psi_group *group, int cpu,
-			     enum psi_aggregators aggregator, u32 *times,
-			     u32 *pchanged_states)
+/* Cumulative state times of @groupc, including the active states */
+static void get_group_times(struct psi_group_cpu *groupc, int cpu,
+			    u32 *times)
 {
-	struct psi_group_cpu *groupc = per_cpu_ptr(group->pcpu, cpu);
 	u64 now, state_start;
 	enum psi_states s;
 	unsigned int seq;
 	u32 state_mask;
 
-	*pchanged_states = 0;
-
 	/* Snapshot a coherent view of the CPU state */
 	do {
 		seq = read_seqcount_begin(&groupc->seq);
@@ -254,20 +330,40 @@ static void get_recent_times(struct psi_group *group, int cpu,
 		state_start = groupc->state_start;
 	} while (read_seqcount_retry(&groupc->seq, seq));
 
-	/* Calculate state time deltas against the previous snapshot */
+	/*
+	 * In addition to already concluded states, we also
+	 * incorporate currently active states on the CPU,
+	 * since states may last for many sampling periods.
+	 *
+	 * This way we keep our delta sampling buckets small
+	 * (u32) and our reported pressure close to what's
+	 * actually happening.
+	 */
 	for (s = 0; s < NR_PSI_STATES; s++) {
-		u32 delta;
-		/*
-		 * In addition to already concluded states, we also
-		 * incorporate currently active states on the CPU,
-		 * since states may last for many sampling periods.
-		 *
-		 * This way we keep our delta sampling buckets small
-		 * (u32) and our reported pressure close to what's
-		 * actually happening.
-		 */
 		if (state_mask & (1 << s))
 			times[s] += now - state_start;
+	}
+}
+
+static void get_recent_times(struct psi_group *group, int cpu,
+			     enum psi_aggregators aggregator, u32 *times,
+			     u32 *pchanged_states)
+{
+	struct psi_group_cpu *groupc = per_cpu_ptr(group->pcpu, cpu);
+	enum psi_states s;
+
+	*pchanged_states = 0;
+
+	if (psi_group_lazy(group)) {
+		for (s = 0; s < NR_PSI_STATES; s++)
+			times[s] = READ_ONCE(groupc->tree_times[s]);
+	} else {
+		get_group_times(groupc, cpu, times);
+	}
+
+	/* Calculate state time deltas against the previous snapshot */
+	for (s = 0; s < NR_PSI_STATES; s++) {
+		u32 delta;
 
 		delta = times[s] - groupc->times_prev[aggregator][s];
 		groupc->times_prev[aggregator][s] = times[s];
@@ -417,6 +513,11 @@ static void psi_avgs_work(struct work_struct *work)
 	dwork = to_delayed_work(work);
 	group = container_of(dwork, struct psi_group, avgs_work);
 
+	if (psi_group_lazy(group)) {
+		psi_lazy_kick(group);
+		psi_flush(group);
+	}
+
 	mutex_lock(&group->avgs_lock);
 
 	now = sched_clock();
@@ -578,6 +679,8 @@ static void psi_poll_work(struct psi_group *group)
 	u32 changed_states;
 	u64 now;
 
+	psi_flush(group);
+
 	mutex_lock(&group->trigger_lock);
 
 	now = sched_clock();
@@ -734,6 +837,11 @@ static void psi_group_change(struct psi_group *group, int cpu,
 
 	write_seqcount_end(&groupc->seq);
 
+#ifdef CONFIG_CGROUPS
+	if (psi_group_lazy(group))
+		cgroup_rstat_updated(psi_group_cgroup(group), cpu);
+#endif
+
 	if (state_mask & group->poll_states)
 		psi_schedule_poll_work(group, 1);
 
@@ -750,6 +858,8 @@ static struct psi_group *iterate_groups(struct task_struct *task, void **iter)
 		cgroup = task->cgroups->dfl_cgrp;
 	else if (*iter == &psi_system)
 		return NULL;
+	else if (static_branch_unlikely(&psi_lazy))
+		cgroup = NULL;	/* ancestors are flushed on read */
 	else
 		cgroup = cgroup_parent(*iter);
 
@@ -1000,23 +1110,64 @@ void cgroup_move_task(struct task_struct *task, struct css_set *to)
 
 	task_rq_unlock(rq, task, &rf);
 }
+
+/**
+ * psi_rstat_flush - fold the stall times of a cgroup into its parent
+ * @cgrp: the cgroup
+ * @cpu: the cpu to flush
+ *
+ * In lazy mode, task changes only update the task's own cgroup. This is
+ * called from the rstat flush for every cgroup updated on @cpu, children
+ * before their parents, and adds the times @cgrp's own tasks and its
+ * children accumulated since the last flush to its parent.
+ */
+void psi_rstat_flush(struct cgroup *cgrp, int cpu)
+{
+	struct cgroup *parent = cgroup_parent(cgrp);
+	struct psi_group_cpu *groupc, *parentc;
+	u32 times[NR_PSI_STATES];
+	enum psi_states s;
+
+	if (!static_branch_unlikely(&psi_lazy) || !parent)
+		return;
+
+	groupc = per_cpu_ptr(cgroup_psi(cgrp)->pcpu, cpu);
+	get_group_times(groupc, cpu, times);
+
+	for (s = 0; s < NR_PSI_STATES; s++) {
+		groupc->tree_times[s] += times[s] - groupc->tree_own[s];
+		groupc->tree_own[s] = times[s];
+	}
+
+	/* The root cgroup reports psi_system, which sees all tasks */
+	if (!cgroup_parent(parent))
+		return;
+
+	parentc = per_cpu_ptr(cgroup_psi(parent)->pcpu, cpu);
+	for (s = 0; s < NR_PSI_STATES; s++) {
+		parentc->tree_times[s] += groupc->tree_times[s] -
+					  groupc->tree_pushed[s];
+		groupc->tree_pushed[s] = groupc->tree_times[s];
+	}
+}
 #endif /* CONFIG_CGROUPS */
 
-int psi_show(struct seq_file *m, struct psi_group *group, enum psi_res res)
+static void psi_update_averages(struct psi_group *group)
 {
-	int full;
 	u64 now;
 
-	if (static_branch_likely(&psi_disabled))
-		return -EOPNOTSUPP;
-
-	/* Update averages before reporting them */
 	mutex_lock(&group->avgs_lock);
 	now = sched_clock();
 	collect_percpu_times(group, PSI_AVGS, NULL);
 	if (now >= group->avg_next_update)
 		group->avg_next_update = update_averages(group, now);
 	mutex_unlock(&group->avgs_lock);
+}
+
+static void psi_print(struct seq_file *m, struct psi_group *group,
+		      enum psi_res res, const char *prefix)
+{
+	int full;
 
 	for (full = 0; full < 2 - (res == PSI_CPU); full++) {
 		unsigned long avg[3];
@@ -1028,6 +1179,8 @@ int psi_show(struct seq_file *m, struct psi_group *group, enum psi_res res)
 		total = div_u64(group->total[PSI_AVGS][res * 2 + full],
 				NSEC_PER_USEC);
 
+		if (prefix)
+			seq_printf(m, "%s ", prefix);
 		seq_printf(m, "%s avg10=%lu.%02lu avg60=%lu.%02lu avg300=%lu.%02lu total=%llu\n",
 			   full ? "full" : "some",
 			   LOAD_INT(avg[0]), LOAD_FRAC(avg[0]),
@@ -1035,9 +1188,84 @@ int psi_show(struct seq_file *m, struct psi_group *group, enum psi_res res)
 			   LOAD_INT(avg[2]), LOAD_FRAC(avg[2]),
 			   total);
 	}
+}
+
+int psi_show(struct seq_file *m, struct psi_group *group, enum psi_res res)
+{
+	if (static_branch_likely(&psi_disabled))
+		return -EOPNOTSUPP;
+
+	/* Update averages before reporting them */
+	psi_flush(group);
+	psi_update_averages(group);
+	psi_print(m, group, res, NULL);
+
+	return 0;
+}
+
+#ifdef CONFIG_CGROUPS
+static const char * const psi_res_names[NR_PSI_RESOURCES] = {
+	[PSI_IO]	= "io",
+	[PSI_MEM]	= "memory",
+	[PSI_CPU]	= "cpu",
+};
+
+/**
+ * psi_show_tree - report the pressure of a whole cgroup subtree
+ * @m: seq_file to print to
+ * @cgrp: root of the subtree
+ *
+ * Prints the pressure lines of every resource for @cgrp and each of its
+ * descendants, prefixed with the cgroup path and the resource. In lazy
+ * mode, the subtree is flushed once for all of them.
+ */
+int psi_show_tree(struct seq_file *m, struct cgroup *cgrp)
+{
+	struct cgroup_subsys_state *css;
+	char *buf, *prefix;
+	int res;
+
+	if (static_branch_likely(&psi_disabled))
+		return -EOPNOTSUPP;
+
+	buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	/* One flush brings the whole subtree up to date */
+	if (static_branch_unlikely(&psi_lazy))
+		cgroup_rstat_flush(cgrp);
+
+	rcu_read_lock();
+	css_for_each_descendant_pre(css, &cgrp->self) {
+		struct cgroup *pos = css->cgroup;
+		struct psi_group *group;
+
+		if (!css_tryget_online(css))
+			continue;
+		rcu_read_unlock();
+
+		group = cgroup_parent(pos) ? cgroup_psi(pos) : &psi_system;
+		psi_update_averages(group);
+
+		cgroup_path_ns(pos, buf, PATH_MAX, current->nsproxy->cgroup_ns);
+		prefix = buf + strlen(buf) + 1;
+		for (res = 0; res < NR_PSI_RESOURCES; res++) {
+			snprintf(prefix, PATH_MAX - (prefix - buf), "%s %s",
+				 buf, psi_res_names[res]);
+			psi_print(m, group, res, prefix);
+		}
+
+		rcu_read_lock();
+		css_put(css);
+	}
+	rcu_read_unlock();
+
+	kfree(buf);
 
 	return 0;
 }
+#endif
 
 static int psi_io_show(struct seq_file *m, void *v)
 {
@@ -1090,6 +1318,13 @@ struct psi_trigger *psi_trigger_create(struct psi_group *group,
 	if (state >= PSI_NONIDLE)
 		return ERR_PTR(-EINVAL);
 
+#ifdef CONFIG_CGROUPS
+	/* In lazy mode nothing drives the monitor of an ancestor */
+	if (psi_group_lazy(group) &&
+	    css_has_online_children(&psi_group_cgroup(group)->self))
+		return ERR_PTR(-EOPNOTSUPP);
+#endif
+
 	if (window_us < WINDOW_MIN_US ||
 		window_us > WINDOW_MAX_US)
 		return ERR_PTR(-EINVAL);
@@ -1042,6 +1042,15 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int		ttwu_count;
 	unsigned int		ttwu_local;
+
+	/* select_idle_node() stats */
+	unsigned int		sis_node_scan;
+	unsigned int		sis_node_found;
+
+	/* newidle_pull_llc() stats */
+	unsigned int		llc_pull_count;
+	unsigned int		llc_pull_gained;
+	unsigned int		llc_pull_stale;
 #endif
 
 #ifdef CONFIG_CPU_IDLE
@@ -1085,8 +1094,17 @@ static inline void update_idle_core(struct rq *rq)
 		__update_idle_core(rq);
 }
 
+extern void __clear_idle_core(struct rq *rq);
+
+static inline void clear_idle_core(struct rq *rq)
+{
+	if (static_branch_unlikely(&sched_smt_present))
+		__clear_idle_core(rq);
+}
+
 #else
 static inline void update_idle_core(struct rq *rq) { }
+static inline void clear_idle_core(struct rq *rq) { }
 #endif
 
 DECLARE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
@@ -1451,10 +1469,23 @@ DECLARE_PER_CPU(int, sd_llc_size);
 DECLARE_PER_CPU(int, sd_llc_id);
 DECLARE_PER_CPU(struct sched_domain_shared __rcu *, sd_llc_shared);
 DECLARE_PER_CPU(struct sched_domain __rcu *, sd_numa);
+DECLARE_PER_CPU(struct sched_domain __rcu *, sd_node);
 DECLARE_PER_CPU(struct sched_domain __rcu *, sd_asym_packing);
 DECLARE_PER_CPU(struct sched_domain __rcu *, sd_asym_cpucapacity);
 extern struct static_key_false sched_asym_cpucapacity;
 
+/* How far in the topology a migration from @src_cpu to @dst_cpu goes */
+static inline int sched_migrate_level(int src_cpu, int dst_cpu)
+{
+	if (cpumask_test_cpu(dst_cpu, topology_sibling_cpumask(src_cpu)))
+		return SCHED_MIGRATE_SMT;
+	if (per_cpu(sd_llc_id, src_cpu) == per_cpu(sd_llc_id, dst_cpu))
+		return SCHED_MIGRATE_LLC;
+	if (cpu_to_node(src_cpu) == cpu_to_node(dst_cpu))
+		return SCHED_MIGRATE_NODE;
+	return SCHED_MIGRATE_REMOTE;
+}
+
 struct sched_group_capacity {
 	atomic_t		ref;
 	/*
@@ -1976,6 +2007,10 @@ static inline int sched_tick_offload_init(void) { return 0; }
 static inline void sched_update_tick_dependency(struct rq *rq) { }
 #endif
 
+#ifdef CONFIG_SMP
+extern void set_llc_overloaded(struct rq *rq);
+#endif
+
 static inline void add_nr_running(struct rq *rq, unsigned count)
 {
 	unsigned prev_nr = rq->nr_running;
@@ -1989,6 +2024,7 @@ static inline void add_nr_running(struct rq *rq, unsigned count)
 	if (prev_nr < 2 && rq->nr_running >= 2) {
 		if (!READ_ONCE(rq->rd->overload))
 			WRITE_ONCE(rq->rd->overload, 1);
+		set_llc_overloaded(rq);
 	}
 #endif
 
@@ -2013,6 +2049,8 @@ extern void check_preempt_curr(struct rq *rq, struct task_struct *p, int flags);
 
 extern const_debug unsigned int sysctl_sched_nr_migrate;
 extern const_debug unsigned int sysctl_sched_migration_cost;
+extern const_debug unsigned int sysctl_sched_migration_cost_level[NR_SCHED_MIGRATE_LEVELS];
+extern const_debug unsigned int sysctl_sched_llc_pull_cost;
 
 #ifdef CONFIG_SCHED_HRTICK
 
@@ -20,6 +20,8 @@
 #include <linux/sched.h>
 #include <linux/sched/idle.h>
 #include <linux/hypervisor.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "smpboot.h"
 #include "sched/smp.h"
@@ -36,6 +38,19 @@ static DEFINE_PER_CPU_ALIGNED(struct call_function_data, cfd_data);
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct llist_head, call_single_queue);
 
+/*
+ * Requests queued to a CPU which already has requests pending ride on the
+ * IPI that is already on its way, and CPUs polling in idle are woken
+ * without one. Count both against the IPIs actually sent, per sender.
+ */
+struct call_function_stats {
+	unsigned long		ipi_sent;
+	unsigned long		ipi_coalesced;
+	unsigned long		ipi_polling;
+};
+
+static DEFINE_PER_CPU(struct call_function_stats, cfd_stats);
+
 static void flush_smp_call_function_queue(bool warn_cpu_offline);
 
 int smpcfd_prepare_cpu(unsigned int cpu)
@@ -146,8 +161,12 @@ void __smp_call_single_queue(int cpu, struct llist_node *node)
 	 * locking and barrier primitives. Generic code isn't really
 	 * equipped to do the right thing...
 	 */
-	if (llist_add(node, &per_cpu(call_single_queue, cpu)))
-		send_call_function_single_ipi(cpu);
+	if (!llist_add(node, &per_cpu(call_single_queue, cpu)))
+		this_cpu_inc(cfd_stats.ipi_coalesced);
+	else if (send_call_function_single_ipi(cpu))
+		this_cpu_inc(cfd_stats.ipi_sent);
+	else
+		this_cpu_inc(cfd_stats.ipi_polling);
 }
 
 /*
@@ -480,6 +499,7 @@ static void smp_call_function_many_cond(const struct cpumask *mask,
 {
 	struct call_function_data *cfd;
 	int cpu, next_cpu, this_cpu = smp_processor_id();
+	unsigned int nr_queued = 0, nr_coalesced = 0, nr_sent;
 
 	/*
 	 * Can deadlock when called with interrupts disabled.
@@ -540,12 +560,23 @@ static void smp_call_function_many_cond(const struct cpumask *mask,
 			csd->flags |= CSD_TYPE_SYNC;
 		csd->func = func;
 		csd->info = info;
+		nr_queued++;
 		if (llist_add(&csd->llist, &per_cpu(call_single_queue, cpu)))
 			__cpumask_set_cpu(cpu, cfd->cpumask_ipi);
+		else
+			nr_coalesced++;
 	}
 
-	/* Send a message to all CPUs in the map */
-	arch_send_call_function_ipi_mask(cfd->cpumask_ipi);
+	/*
+	 * Send a message to all CPUs in the map which had nothing pending,
+	 * the others will find our request when handling the earlier IPI.
+	 */
+	send_call_function_ipi_mask(cfd->cpumask_ipi);
+
+	nr_sent = cpumask_weight(cfd->cpumask_ipi);
+	this_cpu_add(cfd_stats.ipi_sent, nr_sent);
+	this_cpu_add(cfd_stats.ipi_coalesced, nr_coalesced);
+	this_cpu_add(cfd_stats.ipi_polling, nr_queued - nr_coalesced - nr_sent);
 
 	if (wait) {
 		for_each_cpu(cpu, cfd->cpumask) {
@@ -875,3 +906,31 @@ int smp_call_on_cpu(unsigned int cpu, int (*func)(void *), void *par, bool phys)
 	return sscs.ret;
 }
 EXPORT_SYMBOL_GPL(smp_call_on_cpu);
+
+#ifdef CONFIG_DEBUG_FS
+static int cfd_stats_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_puts(m, "# cpu sent coalesced polling\n");
+	for_each_possible_cpu(cpu) {
+		struct call_function_stats *st = per_cpu_ptr(&cfd_stats, cpu);
+
+		seq_printf(m, "cpu%d %lu %lu %lu\n", cpu,
+			   READ_ONCE(st->ipi_sent),
+			   READ_ONCE(st->ipi_coalesced),
+			   READ_ONCE(st->ipi_polling));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cfd_stats);
+
+static int __init cfd_stats_init(void)
+{
+	debugfs_create_file("smp_call_function_stats", 0444, NULL, NULL,
+			    &cfd_stats_fops);
+	return 0;
+}
+late_initcall(cfd_stats_init);
+#endif
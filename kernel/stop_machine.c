@@ -611,6 +611,45 @@ int stop_machine(cpu_stop_fn_t fn, void *data, const struct cpumask *cpus)
 }
 EXPORT_SYMBOL_GPL(stop_machine);
 
+/**
+ * stop_cpus_cpuslocked - stop_machine() restricted to a set of CPUs
+ * @cpus: the cpus to stop and run @fn() on
+ * @fn: the function to run
+ * @data: the data ptr for the @fn()
+ *
+ * Like stop_machine_cpuslocked(), except that only the CPUs in @cpus are
+ * stopped.  All of them run @fn() in lockstep with interrupts disabled,
+ * while the remaining online CPUs keep running normally.  This is for
+ * updates which only need a subset of the machine quiescent, such as the
+ * SMT siblings sharing a core.
+ *
+ * Must be called from within a cpus_read_lock() protected region.
+ *
+ * RETURNS:
+ * 0 if all executions of @fn returned 0, any non zero return value if any
+ * returned non zero.
+ */
+int stop_cpus_cpuslocked(const struct cpumask *cpus, cpu_stop_fn_t fn,
+			 void *data)
+{
+	struct multi_stop_data msdata = {
+		.fn = fn,
+		.data = data,
+		.num_threads = cpumask_weight(cpus),
+		.active_cpus = cpus,
+	};
+
+	lockdep_assert_cpus_held();
+
+	if (WARN_ON_ONCE(!cpumask_subset(cpus, cpu_online_mask)))
+		return -EINVAL;
+
+	/* Set the initial state and stop the requested CPUs */
+	set_state(&msdata, MULTI_STOP_PREPARE);
+	return stop_cpus(cpus, multi_cpu_stop, &msdata);
+}
+EXPORT_SYMBOL_GPL(stop_cpus_cpuslocked);
+
 /**
  * stop_machine_from_inactive_cpu - stop_machine() from inactive CPU
  * @fn: the function to run
@@ -58,6 +58,7 @@
 #include <linux/sched/coredump.h>
 #include <linux/sched/task.h>
 #include <linux/sched/cputime.h>
+#include <linux/sched/numa_balancing.h>
 #include <linux/rcupdate.h>
 #include <linux/uidgid.h>
 #include <linux/cred.h>
@@ -2530,6 +2531,24 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 
 		error = (current->flags & PR_IO_FLUSHER) == PR_IO_FLUSHER;
 		break;
+	case PR_SET_NUMA_SOURCE:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (arg2 == PR_NUMA_SOURCE_SAMPLES)
+			error = task_numa_set_samples(true);
+		else if (arg2 == PR_NUMA_SOURCE_FAULTS)
+			error = task_numa_set_samples(false);
+		else
+			return -EINVAL;
+		break;
+	case PR_GET_NUMA_SOURCE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (!IS_ENABLED(CONFIG_NUMA_BALANCING))
+			return -EINVAL;
+		error = test_bit(MMF_NUMA_SAMPLES, &me->mm->flags) ?
+			PR_NUMA_SOURCE_SAMPLES : PR_NUMA_SOURCE_FAULTS;
+		break;
 	default:
 		error = -EINVAL;
 		break;
@@ -623,6 +623,19 @@ static inline int hrtimer_hres_active(void)
 	return __hrtimer_hres_active(this_cpu_ptr(&hrtimer_bases));
 }
 
+/*
+ * Program the clock event device and account for it.  Only used when the
+ * high resolution mode is active.
+ */
+static inline int hrtimer_program_event(struct hrtimer_cpu_base *cpu_base,
+					ktime_t expires, int force)
+{
+#ifdef CONFIG_HIGH_RES_TIMERS
+	cpu_base->nr_programmed++;
+#endif
+	return tick_program_event(expires, force);
+}
+
 /*
  * Reprogram the event source with checking both queues for the
  * next event
@@ -676,7 +689,7 @@ hrtimer_force_reprogram(struct hrtimer_cpu_base *cpu_base, int skip_equal)
 	if (!__hrtimer_hres_active(cpu_base) || cpu_base->hang_detected)
 		return;
 
-	tick_program_event(cpu_base->expires_next, 1);
+	hrtimer_program_event(cpu_base, cpu_base->expires_next, 1);
 }
 
 /* High resolution timer related functions */
@@ -699,6 +712,39 @@ static int __init setup_hrtimer_hres(char *str)
 
 __setup("highres=", setup_hrtimer_hres);
 
+/*
+ * Granularity in nanoseconds to which the hard expiry of timers with at least
+ * that much slack is rounded down, so that independent timers end up sharing
+ * clock event device programmings.  Zero disables the alignment.
+ */
+unsigned int sysctl_hrtimer_coalesce_ns __read_mostly;
+
+static u64 hrtimer_coalesce_range(ktime_t tim, u64 delta_ns)
+{
+	unsigned int grid = READ_ONCE(sysctl_hrtimer_coalesce_ns);
+	ktime_t expires;
+	u32 rem;
+
+	if (!grid || delta_ns < grid || tim < 0)
+		return delta_ns;
+
+	expires = ktime_add_safe(tim, ns_to_ktime(delta_ns));
+	if (expires == KTIME_MAX)
+		return delta_ns;
+
+	/* The aligned expiry stays within [tim, tim + delta_ns]. */
+	div_u64_rem(expires, grid, &rem);
+	return delta_ns - rem;
+}
+
+static inline void hrtimer_account_coalesced(struct hrtimer_cpu_base *cpu_base,
+					     struct hrtimer *timer,
+					     ktime_t basenow)
+{
+	if (basenow < hrtimer_get_expires_tv64(timer))
+		cpu_base->nr_coalesced++;
+}
+
 /*
  * hrtimer_high_res_enabled - query, if the highres mode is enabled
  */
@@ -764,6 +810,13 @@ void clock_was_set_delayed(void)
 #else
 
 static inline int hrtimer_is_hres_enabled(void) { return 0; }
+static inline u64 hrtimer_coalesce_range(ktime_t tim, u64 delta_ns)
+{
+	return delta_ns;
+}
+static inline void hrtimer_account_coalesced(struct hrtimer_cpu_base *cpu_base,
+					     struct hrtimer *timer,
+					     ktime_t basenow) { }
 static inline void hrtimer_switch_to_hres(void) { }
 static inline void retrigger_next_event(void *arg) { }
 
@@ -855,7 +908,7 @@ static void hrtimer_reprogram(struct hrtimer *timer, bool reprogram)
 	 * Program the timer hardware. We enforce the expiry for
 	 * events which are already in the past.
 	 */
-	tick_program_event(expires, 1);
+	hrtimer_program_event(cpu_base, expires, 1);
 }
 
 /*
@@ -1099,6 +1152,7 @@ static int __hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
 
 	tim = hrtimer_update_lowres(timer, tim, mode);
 
+	delta_ns = hrtimer_coalesce_range(tim, delta_ns);
 	hrtimer_set_expires_range_ns(timer, tim, delta_ns);
 
 	/* Switch the timer base, if necessary: */
@@ -1585,6 +1639,7 @@ static void __hrtimer_run_queues(struct hrtimer_cpu_base *cpu_base, ktime_t now,
 			if (basenow < hrtimer_get_softexpires_tv64(timer))
 				break;
 
+			hrtimer_account_coalesced(cpu_base, timer, basenow);
 			__run_hrtimer(cpu_base, base, timer, &basenow, flags);
 			if (active_mask == HRTIMER_ACTIVE_SOFT)
 				hrtimer_sync_wait_running(cpu_base, flags);
@@ -1660,7 +1715,7 @@ retry:
 	raw_spin_unlock_irqrestore(&cpu_base->lock, flags);
 
 	/* Reprogramming necessary ? */
-	if (!tick_program_event(expires_next, 0)) {
+	if (!hrtimer_program_event(cpu_base, expires_next, 0)) {
 		cpu_base->hang_detected = 0;
 		return;
 	}
@@ -1704,7 +1759,7 @@ retry:
 		expires_next = ktime_add_ns(now, 100 * NSEC_PER_MSEC);
 	else
 		expires_next = ktime_add(now, delta);
-	tick_program_event(expires_next, 1);
+	hrtimer_program_event(cpu_base, expires_next, 1);
 	pr_warn_once("hrtimer: interrupt took %llu ns\n", ktime_to_ns(delta));
 }
 
@@ -896,6 +896,32 @@ static void tick_nohz_full_update_tick(struct tick_sched *ts)
 #endif
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/**
+ * tick_nohz_guest_enter - Try to stop the tick before entering guest mode
+ *
+ * Guest mode is an RCU extended quiescent state and is accounted by vtime
+ * through context tracking, just like user mode, so a nohz_full CPU does not
+ * need the tick while it runs a vCPU.  The tick may have been restarted while
+ * handling the last VM exit though, and it would otherwise only be stopped
+ * again from the next interrupt, which itself forces a VM exit.
+ *
+ * Must be called with interrupts disabled.
+ */
+void tick_nohz_guest_enter(void)
+{
+	struct tick_sched *ts = this_cpu_ptr(&tick_cpu_sched);
+
+	lockdep_assert_irqs_disabled();
+
+	if (ts->tick_stopped)
+		return;
+
+	tick_nohz_full_update_tick(ts);
+}
+EXPORT_SYMBOL_GPL(tick_nohz_guest_enter);
+#endif
+
 static bool can_stop_idle_tick(int cpu, struct tick_sched *ts)
 {
 	/*
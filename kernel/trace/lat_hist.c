@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Per-CPU log2 latency histograms, see include/linux/lat_hist.h.
+ *
+ * Each registered histogram gets a directory in tracing/latency_hist/:
+ *
+ *   enable - write 1 to start recording, 0 to stop
+ *   hist   - the histogram summed over all CPUs, write anything to reset it
+ *
+ * Resetting while recording races with the CPUs adding samples, a few
+ * samples may survive the reset.
+ */
+
+#include <linux/kernel.h>
+#include <linux/lat_hist.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/tracefs.h>
+#include <linux/uaccess.h>
+
+#include "trace.h"
+
+static LIST_HEAD(lat_hists);
+static DEFINE_MUTEX(lat_hist_mutex);
+static struct dentry *lat_hist_dir;
+
+static int lat_hist_show(struct seq_file *m, void *v)
+{
+	struct lat_hist *hist = m->private;
+	u64 count[LAT_HIST_BUCKETS] = { 0 };
+	u64 total = 0, sum_ns = 0;
+	int first = -1, last = -1;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct lat_hist_cpu *c = per_cpu_ptr(hist->cpu, cpu);
+
+		for (i = 0; i < LAT_HIST_BUCKETS; i++)
+			count[i] += READ_ONCE(c->count[i]);
+		sum_ns += READ_ONCE(c->sum_ns);
+	}
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		if (!count[i])
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+		total += count[i];
+	}
+
+	seq_printf(m, "# %s: %llu samples, mean %llu ns, %s\n", hist->name,
+		   total, total ? div64_u64(sum_ns, total) : 0,
+		   lat_hist_enabled(hist) ? "enabled" : "disabled");
+	seq_printf(m, "# %-24s %12s\n", "ns", "count");
+
+	for (i = first; first >= 0 && i <= last; i++) {
+		char range[48];
+
+		if (i == LAT_HIST_BUCKETS - 1)
+			snprintf(range, sizeof(range), "[%llu, ...)", 1ULL << i);
+		else
+			snprintf(range, sizeof(range), "[%llu, %llu)",
+				 i ? 1ULL << i : 0, 1ULL << (i + 1));
+		seq_printf(m, "  %-24s %12llu\n", range, count[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * The histograms of kvm-amd and ccp live in the module, so an open file
+ * pins the module that defined the histogram.
+ */
+static int lat_hist_open(struct inode *inode, struct file *file)
+{
+	struct lat_hist *hist = inode->i_private;
+	int ret;
+
+	ret = tracing_check_open_get_tr(NULL);
+	if (ret)
+		return ret;
+
+	if (!try_module_get(hist->owner))
+		return -ENODEV;
+
+	ret = single_open(file, lat_hist_show, hist);
+	if (ret)
+		module_put(hist->owner);
+
+	return ret;
+}
+
+static int lat_hist_release(struct inode *inode, struct file *file)
+{
+	struct lat_hist *hist = inode->i_private;
+
+	single_release(inode, file);
+	module_put(hist->owner);
+	return 0;
+}
+
+static ssize_t lat_hist_write(struct file *file, const char __user *ubuf,
+			      size_t cnt, loff_t *ppos)
+{
+	struct lat_hist *hist = file_inode(file)->i_private;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(hist->cpu, cpu), 0, sizeof(struct lat_hist_cpu));
+
+	return cnt;
+}
+
+static const struct file_operations lat_hist_fops = {
+	.open		= lat_hist_open,
+	.read		= seq_read,
+	.write		= lat_hist_write,
+	.llseek		= seq_lseek,
+	.release	= lat_hist_release,
+};
+
+static int lat_hist_enable_open(struct inode *inode, struct file *file)
+{
+	struct lat_hist *hist = inode->i_private;
+	int ret;
+
+	ret = tracing_open_generic(inode, file);
+	if (ret)
+		return ret;
+
+	if (!try_module_get(hist->owner))
+		return -ENODEV;
+
+	return 0;
+}
+
+static int lat_hist_enable_release(struct inode *inode, struct file *file)
+{
+	struct lat_hist *hist = inode->i_private;
+
+	module_put(hist->owner);
+	return 0;
+}
+
+static ssize_t lat_hist_enable_read(struct file *file, char __user *ubuf,
+				    size_t cnt, loff_t *ppos)
+{
+	struct lat_hist *hist = file_inode(file)->i_private;
+	char buf[3];
+
+	buf[0] = lat_hist_enabled(hist) ? '1' : '0';
+	buf[1] = '\n';
+	buf[2] = '\0';
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, 2);
+}
+
+static ssize_t lat_hist_enable_write(struct file *file, const char __user *ubuf,
+				     size_t cnt, loff_t *ppos)
+{
+	struct lat_hist *hist = file_inode(file)->i_private;
+	bool enable;
+	int ret;
+
+	ret = kstrtobool_from_user(ubuf, cnt, &enable);
+	if (ret)
+		return ret;
+
+	if (enable)
+		static_branch_enable(&hist->key);
+	else
+		static_branch_disable(&hist->key);
+
+	return cnt;
+}
+
+static const struct file_operations lat_hist_enable_fops = {
+	.open		= lat_hist_enable_open,
+	.read		= lat_hist_enable_read,
+	.write		= lat_hist_enable_write,
+	.llseek		= default_llseek,
+	.release	= lat_hist_enable_release,
+};
+
+static int lat_hist_create_files(struct lat_hist *hist)
+{
+	hist->dentry = tracefs_create_dir(hist->name, lat_hist_dir);
+	if (!hist->dentry)
+		return -ENOMEM;
+
+	if (!tracefs_create_file("enable", 0644, hist->dentry, hist,
+				 &lat_hist_enable_fops) ||
+	    !tracefs_create_file("hist", 0644, hist->dentry, hist,
+				 &lat_hist_fops)) {
+		tracefs_remove(hist->dentry);
+		hist->dentry = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * lat_hist_register - make a histogram visible in tracefs
+ * @hist:	histogram defined with DEFINE_LAT_HIST()
+ *
+ * Histograms registered before tracefs is up get their files once it is.
+ * Returns -EEXIST if a histogram with the same name is registered already.
+ */
+int lat_hist_register(struct lat_hist *hist)
+{
+	struct lat_hist *pos;
+	int ret = 0;
+
+	mutex_lock(&lat_hist_mutex);
+
+	list_for_each_entry(pos, &lat_hists, list) {
+		if (!strcmp(pos->name, hist->name)) {
+			ret = -EEXIST;
+			goto out;
+		}
+	}
+
+	if (lat_hist_dir)
+		ret = lat_hist_create_files(hist);
+	if (!ret)
+		list_add_tail(&hist->list, &lat_hists);
+out:
+	mutex_unlock(&lat_hist_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(lat_hist_register);
+
+/**
+ * lat_hist_unregister - stop recording and remove the tracefs files
+ * @hist:	histogram passed to lat_hist_register()
+ */
+void lat_hist_unregister(struct lat_hist *hist)
+{
+	static_branch_disable(&hist->key);
+
+	mutex_lock(&lat_hist_mutex);
+	list_del_init(&hist->list);
+	tracefs_remove(hist->dentry);
+	hist->dentry = NULL;
+	mutex_unlock(&lat_hist_mutex);
+}
+EXPORT_SYMBOL_GPL(lat_hist_unregister);
+
+static __init int lat_hist_init_tracefs(void)
+{
+	struct lat_hist *hist;
+	struct dentry *d_tracer;
+
+	d_tracer = tracing_init_dentry();
+	if (IS_ERR(d_tracer))
+		return 0;
+
+	mutex_lock(&lat_hist_mutex);
+
+	lat_hist_dir = tracefs_create_dir("latency_hist", d_tracer);
+	if (!lat_hist_dir) {
+		pr_warn("Could not create tracefs 'latency_hist' entry\n");
+		goto out;
+	}
+
+	list_for_each_entry(hist, &lat_hists, list) {
+		if (lat_hist_create_files(hist))
+			pr_warn("Could not create tracefs entries for latency histogram '%s'\n",
+				hist->name);
+	}
+out:
+	mutex_unlock(&lat_hist_mutex);
+	return 0;
+}
+fs_initcall(lat_hist_init_tracefs);
@@ -25,6 +25,7 @@
 #include <linux/list.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/sizes.h>
 
 #include <asm/local.h>
 
@@ -336,23 +337,53 @@ struct buffer_page {
  * the update partition of the counter is incremented. This will
  * allow the updater to update the counter atomically.
  *
- * The counter is 20 bits, and the state data is 12.
+ * The counter is 21 bits, and the state data is 11. The counter must
+ * be able to hold the size of the largest sub buffer plus the largest
+ * event, as a writer may move the write index past the end of the
+ * sub buffer before it notices that it needs to move to the next one.
  */
-#define RB_WRITE_MASK		0xfffff
-#define RB_WRITE_INTCNT		(1 << 20)
+#define RB_WRITE_MASK		0x1fffff
+#define RB_WRITE_INTCNT		(1 << 21)
 
 static void rb_init_page(struct buffer_data_page *bpage)
 {
 	local_set(&bpage->commit, 0);
 }
 
+/*
+ * Sub buffers are allocated as compound pages, so that their order can
+ * be found from the page itself when they are freed, even if they were
+ * handed out to a reader before the sub buffer size was changed.
+ */
+static struct buffer_data_page *rb_alloc_data_page(int cpu, gfp_t gfp,
+						   unsigned int order)
+{
+	struct page *page;
+
+	page = alloc_pages_node(cpu_to_node(cpu), gfp | __GFP_COMP, order);
+	if (!page)
+		return NULL;
+
+	return page_address(page);
+}
+
+static inline unsigned int rb_data_page_order(void *data)
+{
+	return compound_order(virt_to_page(data));
+}
+
+static void rb_free_data_page(void *data)
+{
+	free_pages((unsigned long)data, rb_data_page_order(data));
+}
+
 /*
  * Also stolen from mm/slob.c. Thanks to Mathieu Desnoyers for pointing
  * this issue out.
  */
 static void free_buffer_page(struct buffer_page *bpage)
 {
-	free_page((unsigned long)bpage->page);
+	rb_free_data_page(bpage->page);
 	kfree(bpage);
 }
 
@@ -368,9 +399,16 @@ static inline int test_time_stamp(u64 delta)
 
 #define BUF_PAGE_SIZE (PAGE_SIZE - BUF_PAGE_HDR_SIZE)
 
-/* Max payload is BUF_PAGE_SIZE - header (8bytes) */
+/*
+ * Max payload is BUF_PAGE_SIZE - header (8bytes). Events are limited to
+ * a system page even when sub buffers are larger, all event producers
+ * reserve at most that much.
+ */
 #define BUF_MAX_DATA_SIZE (BUF_PAGE_SIZE - (sizeof(u32) * 2))
 
+/* Largest sub buffer, it must fit in RB_WRITE_MASK with one event */
+#define RB_SUBBUF_MAX_SIZE	SZ_1M
+
 int ring_buffer_print_page_header(struct trace_seq *s)
 {
 	struct buffer_data_page field;
@@ -488,6 +526,12 @@ struct ring_buffer_per_cpu {
 	struct lock_class_key		lock_key;
 	struct buffer_data_page		*free_page;
 	unsigned long			nr_pages;
+	/*
+	 * Copies of the buffer's sub buffer order and size, only changed
+	 * together with the pages under reader_lock and lock
+	 */
+	unsigned int			subbuf_order;
+	unsigned int			subbuf_size;
 	unsigned int			current_context;
 	struct list_head		*pages;
 	struct buffer_page		*head_page;	/* read from head */
@@ -539,8 +583,25 @@ struct trace_buffer {
 
 	struct rb_irq_work		irq_work;
 	bool				time_stamp_abs;
+
+	unsigned int			subbuf_order;	/* pages per sub buffer */
+	unsigned int			subbuf_size;	/* data bytes in one */
 };
 
+/* Number of data bytes in a sub buffer of @cpu_buffer */
+static __always_inline unsigned int
+rb_subbuf_size(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	return cpu_buffer->subbuf_size;
+}
+
+/* Start of the sub buffer that @addr points into */
+static __always_inline unsigned long
+rb_subbuf_start(struct ring_buffer_per_cpu *cpu_buffer, unsigned long addr)
+{
+	return addr & ~((PAGE_SIZE << cpu_buffer->subbuf_order) - 1);
+}
+
 struct ring_buffer_iter {
 	struct ring_buffer_per_cpu	*cpu_buffer;
 	unsigned long			head;
@@ -1420,8 +1481,11 @@ static int rb_check_pages(struct ring_buffer_per_cpu *cpu_buffer)
 	return 0;
 }
 
-static int __rb_allocate_pages(long nr_pages, struct list_head *pages, int cpu)
+static int __rb_allocate_pages(struct ring_buffer_per_cpu *cpu_buffer,
+			       long nr_pages, struct list_head *pages,
+			       unsigned int order)
 {
+	int cpu = cpu_buffer->cpu;
 	struct buffer_page *bpage, *tmp;
 	bool user_thread = current->mm != NULL;
 	gfp_t mflags;
@@ -1457,8 +1521,6 @@ static int __rb_allocate_pages(long nr_pages, struct list_head *pages, int cpu)
 	if (user_thread)
 		set_current_oom_origin();
 	for (i = 0; i < nr_pages; i++) {
-		struct page *page;
-
 		bpage = kzalloc_node(ALIGN(sizeof(*bpage), cache_line_size()),
 				    mflags, cpu_to_node(cpu));
 		if (!bpage)
@@ -1466,10 +1528,9 @@ static int __rb_allocate_pages(long nr_pages, struct list_head *pages, int cpu)
 
 		list_add(&bpage->list, pages);
 
-		page = alloc_pages_node(cpu_to_node(cpu), mflags, 0);
-		if (!page)
+		bpage->page = rb_alloc_data_page(cpu, mflags, order);
+		if (!bpage->page)
 			goto free_pages;
-		bpage->page = page_address(page);
 		rb_init_page(bpage->page);
 
 		if (user_thread && fatal_signal_pending(current))
@@ -1498,7 +1559,8 @@ static int rb_allocate_pages(struct ring_buffer_per_cpu *cpu_buffer,
 
 	WARN_ON(!nr_pages);
 
-	if (__rb_allocate_pages(nr_pages, &pages, cpu_buffer->cpu))
+	if (__rb_allocate_pages(cpu_buffer, nr_pages, &pages,
+				cpu_buffer->subbuf_order))
 		return -ENOMEM;
 
 	/*
@@ -1521,7 +1583,6 @@ rb_allocate_cpu_buffer(struct trace_buffer *buffer, long nr_pages, int cpu)
 {
 	struct ring_buffer_per_cpu *cpu_buffer;
 	struct buffer_page *bpage;
-	struct page *page;
 	int ret;
 
 	cpu_buffer = kzalloc_node(ALIGN(sizeof(*cpu_buffer), cache_line_size()),
@@ -1531,6 +1592,8 @@ rb_allocate_cpu_buffer(struct trace_buffer *buffer, long nr_pages, int cpu)
 
 	cpu_buffer->cpu = cpu;
 	cpu_buffer->buffer = buffer;
+	cpu_buffer->subbuf_order = buffer->subbuf_order;
+	cpu_buffer->subbuf_size = buffer->subbuf_size;
 	raw_spin_lock_init(&cpu_buffer->reader_lock);
 	lockdep_set_class(&cpu_buffer->reader_lock, buffer->reader_lock_key);
 	cpu_buffer->lock = (arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
@@ -1548,10 +1611,10 @@ rb_allocate_cpu_buffer(struct trace_buffer *buffer, long nr_pages, int cpu)
 	rb_check_bpage(cpu_buffer, bpage);
 
 	cpu_buffer->reader_page = bpage;
-	page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL, 0);
-	if (!page)
+	bpage->page = rb_alloc_data_page(cpu, GFP_KERNEL,
+					 cpu_buffer->subbuf_order);
+	if (!bpage->page)
 		goto fail_free_reader;
-	bpage->page = page_address(page);
 	rb_init_page(bpage->page);
 
 	INIT_LIST_HEAD(&cpu_buffer->reader_page->list);
@@ -1627,7 +1690,10 @@ struct trace_buffer *__ring_buffer_alloc(unsigned long size, unsigned flags,
 	if (!zalloc_cpumask_var(&buffer->cpumask, GFP_KERNEL))
 		goto fail_free_buffer;
 
-	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
+	buffer->subbuf_order = 0;
+	buffer->subbuf_size = BUF_PAGE_SIZE;
+
+	nr_pages = DIV_ROUND_UP(size, buffer->subbuf_size);
 	buffer->flags = flags;
 	buffer->clock = trace_clock_local;
 	buffer->reader_lock_key = key;
@@ -1821,7 +1887,8 @@ rb_remove_pages(struct ring_buffer_per_cpu *cpu_buffer, unsigned long nr_pages)
 			 * Increment overrun to account for the lost events.
 			 */
 			local_add(page_entries, &cpu_buffer->overrun);
-			local_sub(BUF_PAGE_SIZE, &cpu_buffer->entries_bytes);
+			local_sub(rb_subbuf_size(cpu_buffer),
+				  &cpu_buffer->entries_bytes);
 		}
 
 		/*
@@ -1943,7 +2010,7 @@ static void update_pages_handler(struct work_struct *work)
  * @size: the new size.
  * @cpu_id: the cpu buffer to resize
  *
- * Minimum size is 2 * BUF_PAGE_SIZE.
+ * Minimum size is two sub buffers.
  *
  * Returns 0 on success and < 0 on failure.
  */
@@ -1965,13 +2032,13 @@ int ring_buffer_resize(struct trace_buffer *buffer, unsigned long size,
 	    !cpumask_test_cpu(cpu_id, buffer->cpumask))
 		return size;
 
-	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
+	nr_pages = DIV_ROUND_UP(size, buffer->subbuf_size);
 
 	/* we need a minimum of two pages */
 	if (nr_pages < 2)
 		nr_pages = 2;
 
-	size = nr_pages * BUF_PAGE_SIZE;
+	size = nr_pages * buffer->subbuf_size;
 
 	/* prevent another thread from changing buffer sizes */
 	mutex_lock(&buffer->mutex);
@@ -2007,8 +2074,10 @@ int ring_buffer_resize(struct trace_buffer *buffer, unsigned long size,
 			 * allocated without receiving ENOMEM
 			 */
 			INIT_LIST_HEAD(&cpu_buffer->new_pages);
-			if (__rb_allocate_pages(cpu_buffer->nr_pages_to_update,
-						&cpu_buffer->new_pages, cpu)) {
+			if (__rb_allocate_pages(cpu_buffer,
+						cpu_buffer->nr_pages_to_update,
+						&cpu_buffer->new_pages,
+						cpu_buffer->subbuf_order)) {
 				/* not enough memory for new pages */
 				err = -ENOMEM;
 				goto out_err;
@@ -2073,8 +2142,10 @@ int ring_buffer_resize(struct trace_buffer *buffer, unsigned long size,
 
 		INIT_LIST_HEAD(&cpu_buffer->new_pages);
 		if (cpu_buffer->nr_pages_to_update > 0 &&
-			__rb_allocate_pages(cpu_buffer->nr_pages_to_update,
-					    &cpu_buffer->new_pages, cpu_id)) {
+			__rb_allocate_pages(cpu_buffer,
+					    cpu_buffer->nr_pages_to_update,
+					    &cpu_buffer->new_pages,
+					    cpu_buffer->subbuf_order)) {
 			err = -ENOMEM;
 			goto out_err;
 		}
@@ -2238,11 +2309,12 @@ rb_commit_index(struct ring_buffer_per_cpu *cpu_buffer)
 }
 
 static __always_inline unsigned
-rb_event_index(struct ring_buffer_event *event)
+rb_event_index(struct ring_buffer_per_cpu *cpu_buffer,
+	       struct ring_buffer_event *event)
 {
 	unsigned long addr = (unsigned long)event;
 
-	return (addr & ~PAGE_MASK) - BUF_PAGE_HDR_SIZE;
+	return addr - rb_subbuf_start(cpu_buffer, addr) - BUF_PAGE_HDR_SIZE;
 }
 
 static void rb_inc_iter(struct ring_buffer_iter *iter)
@@ -2311,7 +2383,8 @@ rb_handle_head_page(struct ring_buffer_per_cpu *cpu_buffer,
 		 * the counters.
 		 */
 		local_add(entries, &cpu_buffer->overrun);
-		local_sub(BUF_PAGE_SIZE, &cpu_buffer->entries_bytes);
+		local_sub(rb_subbuf_size(cpu_buffer),
+			  &cpu_buffer->entries_bytes);
 
 		/*
 		 * The entries will be zeroed out when we move the
@@ -2430,6 +2503,7 @@ static inline void
 rb_reset_tail(struct ring_buffer_per_cpu *cpu_buffer,
 	      unsigned long tail, struct rb_event_info *info)
 {
+	unsigned long bsize = rb_subbuf_size(cpu_buffer);
 	struct buffer_page *tail_page = info->tail_page;
 	struct ring_buffer_event *event;
 	unsigned long length = info->length;
@@ -2438,13 +2512,13 @@ rb_reset_tail(struct ring_buffer_per_cpu *cpu_buffer,
 	 * Only the event that crossed the page boundary
 	 * must fill the old tail_page with padding.
 	 */
-	if (tail >= BUF_PAGE_SIZE) {
+	if (tail >= bsize) {
 		/*
 		 * If the page was filled, then we still need
 		 * to update the real_end. Reset it to zero
 		 * and the reader will ignore it.
 		 */
-		if (tail == BUF_PAGE_SIZE)
+		if (tail == bsize)
 			tail_page->real_end = 0;
 
 		local_sub(length, &tail_page->write);
@@ -2454,7 +2528,7 @@ rb_reset_tail(struct ring_buffer_per_cpu *cpu_buffer,
 	event = __rb_page_index(tail_page, tail);
 
 	/* account for padding bytes */
-	local_add(BUF_PAGE_SIZE - tail, &cpu_buffer->entries_bytes);
+	local_add(bsize - tail, &cpu_buffer->entries_bytes);
 
 	/*
 	 * Save the original length to the meta data.
@@ -2474,7 +2548,7 @@ rb_reset_tail(struct ring_buffer_per_cpu *cpu_buffer,
 	 * If we are less than the minimum size, we don't need to
 	 * worry about it.
 	 */
-	if (tail > (BUF_PAGE_SIZE - RB_EVNT_MIN_SIZE)) {
+	if (tail > (bsize - RB_EVNT_MIN_SIZE)) {
 		/* No room for any events */
 
 		/* Mark the rest of the page with padding */
@@ -2486,13 +2560,13 @@ rb_reset_tail(struct ring_buffer_per_cpu *cpu_buffer,
 	}
 
 	/* Put in a discarded event */
-	event->array[0] = (BUF_PAGE_SIZE - tail) - RB_EVNT_HDR_SIZE;
+	event->array[0] = (bsize - tail) - RB_EVNT_HDR_SIZE;
 	event->type_len = RINGBUF_TYPE_PADDING;
 	/* time delta must be non zero */
 	event->time_delta = 1;
 
 	/* Set write to end of buffer */
-	length = (tail + length) - BUF_PAGE_SIZE;
+	length = (tail + length) - bsize;
 	local_sub(length, &tail_page->write);
 }
 
@@ -2606,7 +2680,8 @@ rb_move_tail(struct ring_buffer_per_cpu *cpu_buffer,
 
 /* Slow path */
 static struct ring_buffer_event *
-rb_add_time_stamp(struct ring_buffer_event *event, u64 delta, bool abs)
+rb_add_time_stamp(struct ring_buffer_per_cpu *cpu_buffer,
+		  struct ring_buffer_event *event, u64 delta, bool abs)
 {
 	if (abs)
 		event->type_len = RINGBUF_TYPE_TIME_STAMP;
@@ -2614,7 +2689,7 @@ rb_add_time_stamp(struct ring_buffer_event *event, u64 delta, bool abs)
 		event->type_len = RINGBUF_TYPE_TIME_EXTEND;
 
 	/* Not the first event on the page, or not delta? */
-	if (abs || rb_event_index(event)) {
+	if (abs || rb_event_index(cpu_buffer, event)) {
 		event->time_delta = delta & TS_MASK;
 		event->array[0] = delta >> TS_SHIFT;
 	} else {
@@ -2684,7 +2759,7 @@ static void rb_add_timestamp(struct ring_buffer_per_cpu *cpu_buffer,
 		if (!abs)
 			info->delta = 0;
 	}
-	*event = rb_add_time_stamp(*event, info->delta, abs);
+	*event = rb_add_time_stamp(cpu_buffer, *event, info->delta, abs);
 	*length -= RB_LEN_TIME_EXTEND;
 	*delta = 0;
 }
@@ -2763,8 +2838,8 @@ rb_event_is_commit(struct ring_buffer_per_cpu *cpu_buffer,
 	unsigned long addr = (unsigned long)event;
 	unsigned long index;
 
-	index = rb_event_index(event);
-	addr &= PAGE_MASK;
+	index = rb_event_index(cpu_buffer, event);
+	addr = rb_subbuf_start(cpu_buffer, addr);
 
 	return cpu_buffer->commit_page->page == (void *)addr &&
 		rb_commit_index(cpu_buffer) == index;
@@ -2800,10 +2875,10 @@ rb_try_to_discard(struct ring_buffer_per_cpu *cpu_buffer,
 	u64 write_stamp;
 	u64 delta;
 
-	new_index = rb_event_index(event);
+	new_index = rb_event_index(cpu_buffer, event);
 	old_index = new_index + rb_event_ts_length(event);
 	addr = (unsigned long)event;
-	addr &= PAGE_MASK;
+	addr = rb_subbuf_start(cpu_buffer, addr);
 
 	bpage = READ_ONCE(cpu_buffer->tail_page);
 
@@ -3199,7 +3274,7 @@ __rb_reserve_next(struct ring_buffer_per_cpu *cpu_buffer,
 	tail = write - info->length;
 
 	/* See if we shot pass the end of this buffer page */
-	if (unlikely(write > BUF_PAGE_SIZE)) {
+	if (unlikely(write > rb_subbuf_size(cpu_buffer))) {
 		if (tail != w) {
 			/* before and after may now different, fix it up*/
 			b_ok = rb_time_read(&cpu_buffer->before_stamp, &info->before);
@@ -3441,7 +3516,7 @@ rb_decrement_entry(struct ring_buffer_per_cpu *cpu_buffer,
 	struct buffer_page *bpage = cpu_buffer->commit_page;
 	struct buffer_page *start;
 
-	addr &= PAGE_MASK;
+	addr = rb_subbuf_start(cpu_buffer, addr);
 
 	/* Do the likely case first */
 	if (likely(bpage->page == (void *)addr)) {
@@ -4784,10 +4859,159 @@ unsigned long ring_buffer_size(struct trace_buffer *buffer, int cpu)
 	if (!cpumask_test_cpu(cpu, buffer->cpumask))
 		return 0;
 
-	return BUF_PAGE_SIZE * buffer->buffers[cpu]->nr_pages;
+	return buffer->subbuf_size * buffer->buffers[cpu]->nr_pages;
 }
 EXPORT_SYMBOL_GPL(ring_buffer_size);
 
+/**
+ * ring_buffer_subbuf_size_get - get the size of a sub buffer
+ * @buffer: The ring buffer.
+ *
+ * Returns the size in bytes of a sub buffer including its header. This
+ * is the size of the pages handed out by ring_buffer_alloc_read_page().
+ */
+unsigned int ring_buffer_subbuf_size_get(struct trace_buffer *buffer)
+{
+	return PAGE_SIZE << READ_ONCE(buffer->subbuf_order);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_subbuf_size_get);
+
+/**
+ * ring_buffer_subbuf_order_set - set the size of the sub buffers
+ * @buffer: The ring buffer.
+ * @order: Sub buffers will be 2^@order system pages.
+ *
+ * Reallocates all per CPU buffers with sub buffers of the new size,
+ * keeping the size of each per CPU buffer about the same. The content
+ * of the buffer is lost. Larger sub buffers mean fewer page switches
+ * for the writers and larger units for readers that splice them out.
+ *
+ * Returns 0 on success and < 0 on failure.
+ */
+int ring_buffer_subbuf_order_set(struct trace_buffer *buffer, int order)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *bpage, *tmp;
+	unsigned long nr_pages, flags;
+	unsigned int size;
+	int cpu, err = 0;
+
+	if (order < 0 || (PAGE_SIZE << order) > RB_SUBBUF_MAX_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&buffer->mutex);
+
+	if (order == buffer->subbuf_order)
+		goto out_unlock;
+
+	for_each_buffer_cpu(buffer, cpu) {
+		if (atomic_read(&buffer->buffers[cpu]->resize_disabled)) {
+			err = -EBUSY;
+			goto out_unlock;
+		}
+	}
+
+	size = (PAGE_SIZE << order) - BUF_PAGE_HDR_SIZE;
+
+	/*
+	 * Allocate the new sub buffers, plus one for the reader page.
+	 * Writers keep using the old ones meanwhile, so the new order and
+	 * size must not be visible before the pages are swapped.
+	 */
+	for_each_buffer_cpu(buffer, cpu) {
+		cpu_buffer = buffer->buffers[cpu];
+
+		nr_pages = DIV_ROUND_UP(cpu_buffer->subbuf_size *
+					cpu_buffer->nr_pages, size);
+		if (nr_pages < 2)
+			nr_pages = 2;
+
+		cpu_buffer->nr_pages_to_update = nr_pages;
+		INIT_LIST_HEAD(&cpu_buffer->new_pages);
+		if (__rb_allocate_pages(cpu_buffer, nr_pages + 1,
+					&cpu_buffer->new_pages, order)) {
+			err = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	ring_buffer_record_disable(buffer);
+	/* Make sure all writers are done with the old sub buffers */
+	synchronize_rcu();
+
+	for_each_buffer_cpu(buffer, cpu) {
+		struct buffer_data_page *free_page;
+		LIST_HEAD(old_pages);
+
+		cpu_buffer = buffer->buffers[cpu];
+
+		raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+		arch_spin_lock(&cpu_buffer->lock);
+
+		rb_head_page_deactivate(cpu_buffer);
+
+		/* Collect the old sub buffers, they are freed after unlock */
+		list_add(&old_pages, cpu_buffer->pages);
+		list_add(&cpu_buffer->reader_page->list, &old_pages);
+
+		cpu_buffer->reader_page = list_first_entry(&cpu_buffer->new_pages,
+							   struct buffer_page,
+							   list);
+		list_del_init(&cpu_buffer->reader_page->list);
+
+		/* The ring buffer page list does not have a list head */
+		cpu_buffer->pages = cpu_buffer->new_pages.next;
+		list_del_init(&cpu_buffer->new_pages);
+		cpu_buffer->nr_pages = cpu_buffer->nr_pages_to_update;
+		cpu_buffer->nr_pages_to_update = 0;
+		WRITE_ONCE(cpu_buffer->subbuf_order, order);
+		cpu_buffer->subbuf_size = size;
+
+		free_page = cpu_buffer->free_page;
+		cpu_buffer->free_page = NULL;
+
+		rb_reset_cpu(cpu_buffer);
+		rb_check_pages(cpu_buffer);
+
+		arch_spin_unlock(&cpu_buffer->lock);
+		raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+		if (free_page)
+			rb_free_data_page(free_page);
+
+		list_for_each_entry_safe(bpage, tmp, &old_pages, list) {
+			list_del_init(&bpage->list);
+			free_buffer_page(bpage);
+		}
+	}
+
+	WRITE_ONCE(buffer->subbuf_order, order);
+	WRITE_ONCE(buffer->subbuf_size, size);
+
+	ring_buffer_record_enable(buffer);
+	mutex_unlock(&buffer->mutex);
+
+	return 0;
+
+ out_free:
+	for_each_buffer_cpu(buffer, cpu) {
+		cpu_buffer = buffer->buffers[cpu];
+		if (!cpu_buffer->nr_pages_to_update)
+			continue;
+		cpu_buffer->nr_pages_to_update = 0;
+		list_for_each_entry_safe(bpage, tmp, &cpu_buffer->new_pages,
+					 list) {
+			list_del_init(&bpage->list);
+			free_buffer_page(bpage);
+		}
+	}
+ out_unlock:
+	mutex_unlock(&buffer->mutex);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_subbuf_order_set);
+
 static void
 rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 {
@@ -5024,6 +5248,9 @@ int ring_buffer_swap_cpu(struct trace_buffer *buffer_a,
 	if (cpu_buffer_a->nr_pages != cpu_buffer_b->nr_pages)
 		goto out;
 
+	if (cpu_buffer_a->subbuf_order != cpu_buffer_b->subbuf_order)
+		goto out;
+
 	ret = -EAGAIN;
 
 	if (atomic_read(&buffer_a->record_disabled))
@@ -5091,7 +5318,6 @@ void *ring_buffer_alloc_read_page(struct trace_buffer *buffer, int cpu)
 	struct ring_buffer_per_cpu *cpu_buffer;
 	struct buffer_data_page *bpage = NULL;
 	unsigned long flags;
-	struct page *page;
 
 	if (!cpumask_test_cpu(cpu, buffer->cpumask))
 		return ERR_PTR(-ENODEV);
@@ -5111,13 +5337,11 @@ void *ring_buffer_alloc_read_page(struct trace_buffer *buffer, int cpu)
 	if (bpage)
 		goto out;
 
-	page = alloc_pages_node(cpu_to_node(cpu),
-				GFP_KERNEL | __GFP_NORETRY, 0);
-	if (!page)
+	bpage = rb_alloc_data_page(cpu, GFP_KERNEL | __GFP_NORETRY,
+				   READ_ONCE(cpu_buffer->subbuf_order));
+	if (!bpage)
 		return ERR_PTR(-ENOMEM);
 
-	bpage = page_address(page);
-
  out:
 	rb_init_page(bpage);
 
@@ -5140,14 +5364,18 @@ void ring_buffer_free_read_page(struct trace_buffer *buffer, int cpu, void *data
 	struct page *page = virt_to_page(bpage);
 	unsigned long flags;
 
-	/* If the page is still in use someplace else, we can't reuse it */
+	/*
+	 * If the page is still in use someplace else, or it is left over
+	 * from before the sub buffer size changed, we can't reuse it.
+	 */
 	if (page_ref_count(page) > 1)
 		goto out;
 
 	local_irq_save(flags);
 	arch_spin_lock(&cpu_buffer->lock);
 
-	if (!cpu_buffer->free_page) {
+	if (!cpu_buffer->free_page &&
+	    compound_order(page) == cpu_buffer->subbuf_order) {
 		cpu_buffer->free_page = bpage;
 		bpage = NULL;
 	}
@@ -5156,7 +5384,8 @@ void ring_buffer_free_read_page(struct trace_buffer *buffer, int cpu, void *data
 	local_irq_restore(flags);
 
  out:
-	free_page((unsigned long)bpage);
+	if (bpage)
+		rb_free_data_page(bpage);
 }
 EXPORT_SYMBOL_GPL(ring_buffer_free_read_page);
 
@@ -5228,6 +5457,10 @@ int ring_buffer_read_page(struct trace_buffer *buffer,
 
 	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
 
+	/* The page must be able to hold (and replace) a whole sub buffer */
+	if (rb_data_page_order(bpage) != cpu_buffer->subbuf_order)
+		goto out_unlock;
+
 	reader = rb_get_reader_page(cpu_buffer);
 	if (!reader)
 		goto out_unlock;
@@ -5303,7 +5536,7 @@ int ring_buffer_read_page(struct trace_buffer *buffer,
 	} else {
 		/* update the entry counter */
 		cpu_buffer->read += rb_page_entries(reader);
-		cpu_buffer->read_bytes += BUF_PAGE_SIZE;
+		cpu_buffer->read_bytes += rb_subbuf_size(cpu_buffer);
 
 		/* swap the pages */
 		rb_init_page(bpage);
@@ -5334,7 +5567,8 @@ int ring_buffer_read_page(struct trace_buffer *buffer,
 		/* If there is room at the end of the page to save the
 		 * missed events, then record it there.
 		 */
-		if (BUF_PAGE_SIZE - commit >= sizeof(missed_events)) {
+		if (rb_subbuf_size(cpu_buffer) - commit >=
+		    sizeof(missed_events)) {
 			memcpy(&bpage->data[commit], &missed_events,
 			       sizeof(missed_events));
 			local_add(RB_MISSED_STORED, &bpage->commit);
@@ -5346,8 +5580,9 @@ int ring_buffer_read_page(struct trace_buffer *buffer,
 	/*
 	 * This page may be off to user land. Zero it out here.
 	 */
-	if (commit < BUF_PAGE_SIZE)
-		memset(&bpage->data[commit], 0, BUF_PAGE_SIZE - commit);
+	if (commit < rb_subbuf_size(cpu_buffer))
+		memset(&bpage->data[commit], 0,
+		       rb_subbuf_size(cpu_buffer) - commit);
 
  out_unlock:
 	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
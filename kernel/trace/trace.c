@@ -7489,6 +7489,7 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 {
 	struct ftrace_buffer_info *info = filp->private_data;
 	struct trace_iterator *iter = &info->iter;
+	unsigned int page_size;
 	ssize_t ret = 0;
 	ssize_t size;
 
@@ -7513,8 +7514,10 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 	if (!info->spare)
 		return ret;
 
+	page_size = ring_buffer_subbuf_size_get(iter->array_buffer->buffer);
+
 	/* Do we have previous read data to read? */
-	if (info->read < PAGE_SIZE)
+	if (info->read < page_size)
 		goto read;
 
  again:
@@ -7541,7 +7544,7 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 
 	info->read = 0;
  read:
-	size = PAGE_SIZE - info->read;
+	size = page_size - info->read;
 	if (size > count)
 		size = count;
 
@@ -7650,6 +7653,7 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		.spd_release	= buffer_spd_release,
 	};
 	struct buffer_ref *ref;
+	unsigned int page_size;
 	int entries, i;
 	ssize_t ret = 0;
 
@@ -7658,13 +7662,19 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		return -EBUSY;
 #endif
 
-	if (*ppos & (PAGE_SIZE - 1))
+	/*
+	 * Each pipe buffer carries one whole sub buffer, so that they can
+	 * be spliced on to files opened with O_DIRECT without copying.
+	 */
+	page_size = ring_buffer_subbuf_size_get(iter->array_buffer->buffer);
+
+	if (*ppos & (page_size - 1))
 		return -EINVAL;
 
-	if (len & (PAGE_SIZE - 1)) {
-		if (len < PAGE_SIZE)
+	if (len & (page_size - 1)) {
+		if (len < page_size)
 			return -EINVAL;
-		len &= PAGE_MASK;
+		len &= ~((size_t)page_size - 1);
 	}
 
 	if (splice_grow_spd(pipe, &spd))
@@ -7674,7 +7684,7 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	trace_access_lock(iter->cpu_file);
 	entries = ring_buffer_entries_cpu(iter->array_buffer->buffer, iter->cpu_file);
 
-	for (i = 0; i < spd.nr_pages_max && len && entries; i++, len -= PAGE_SIZE) {
+	for (i = 0; i < spd.nr_pages_max && len && entries; i++, len -= page_size) {
 		struct page *page;
 		int r;
 
@@ -7707,11 +7717,11 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		page = virt_to_page(ref->page);
 
 		spd.pages[i] = page;
-		spd.partial[i].len = PAGE_SIZE;
+		spd.partial[i].len = page_size;
 		spd.partial[i].offset = 0;
 		spd.partial[i].private = (unsigned long)ref;
 		spd.nr_pages++;
-		*ppos += PAGE_SIZE;
+		*ppos += page_size;
 
 		entries = ring_buffer_entries_cpu(iter->array_buffer->buffer, iter->cpu_file);
 	}
@@ -8500,6 +8510,77 @@ static const struct file_operations buffer_percent_fops = {
 	.llseek		= default_llseek,
 };
 
+static ssize_t
+buffer_subbuf_size_read(struct file *filp, char __user *ubuf,
+			size_t cnt, loff_t *ppos)
+{
+	struct trace_array *tr = filp->private_data;
+	size_t size;
+	char buf[64];
+	int r;
+
+	size = ring_buffer_subbuf_size_get(tr->array_buffer.buffer);
+	r = sprintf(buf, "%zd\n", size >> 10);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, r);
+}
+
+static ssize_t
+buffer_subbuf_size_write(struct file *filp, const char __user *ubuf,
+			 size_t cnt, loff_t *ppos)
+{
+	struct trace_array *tr = filp->private_data;
+	unsigned long val;
+	int order;
+	int ret;
+
+	ret = kstrtoul_from_user(ubuf, cnt, 10, &val);
+	if (ret)
+		return ret;
+
+	/* Sub buffers are a power of two system pages, up to 1 MiB */
+	if (!val || val > 1024)
+		return -EINVAL;
+
+	order = get_order(val << 10);
+
+	mutex_lock(&trace_types_lock);
+
+	/* Readers of the raw buffers hold pages of the current size */
+	if (tr->trace_ref) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ret = ring_buffer_subbuf_order_set(tr->array_buffer.buffer, order);
+	if (ret)
+		goto out;
+
+#ifdef CONFIG_TRACER_MAX_TRACE
+	/* The snapshot buffer is swapped with this one, keep them alike */
+	if (tr->max_buffer.buffer) {
+		ret = ring_buffer_subbuf_order_set(tr->max_buffer.buffer, order);
+		if (ret)
+			goto out;
+	}
+#endif
+
+	(*ppos)++;
+	ret = cnt;
+ out:
+	mutex_unlock(&trace_types_lock);
+
+	return ret;
+}
+
+static const struct file_operations buffer_subbuf_size_fops = {
+	.open		= tracing_open_generic_tr,
+	.read		= buffer_subbuf_size_read,
+	.write		= buffer_subbuf_size_write,
+	.release	= tracing_release_generic_tr,
+	.llseek		= default_llseek,
+};
+
 static struct dentry *trace_instance_dir;
 
 static void
@@ -8919,6 +9000,9 @@ init_tracer_tracefs(struct trace_array *tr, struct dentry *d_tracer)
 	trace_create_file("buffer_percent", 0444, d_tracer,
 			tr, &buffer_percent_fops);
 
+	trace_create_file("buffer_subbuf_size_kb", 0644, d_tracer,
+			  tr, &buffer_subbuf_size_fops);
+
 	create_trace_options_dir(tr);
 
 #if defined(CONFIG_TRACER_MAX_TRACE) || defined(CONFIG_HWLAT_TRACER)
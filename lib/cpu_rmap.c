@@ -7,6 +7,7 @@
 #include <linux/cpu_rmap.h>
 #include <linux/interrupt.h>
 #include <linux/export.h>
+#include <linux/sched/topology.h>
 
 /*
  * These functions maintain a mapping from CPUs to some ordered set of
@@ -107,6 +108,24 @@ static bool cpu_rmap_copy_neigh(struct cpu_rmap *rmap, unsigned int cpu,
 	return false;
 }
 
+/* Same as cpu_rmap_copy_neigh(), for the CPUs sharing the LLC of @cpu */
+static bool cpu_rmap_copy_llc_neigh(struct cpu_rmap *rmap, unsigned int cpu,
+				    u16 dist)
+{
+	int neigh;
+
+	for_each_cpu(neigh, cpumask_of_node(cpu_to_node(cpu))) {
+		if (rmap->near[cpu].dist > dist &&
+		    rmap->near[neigh].dist <= dist &&
+		    cpus_share_cache(cpu, neigh)) {
+			rmap->near[cpu].index = rmap->near[neigh].index;
+			rmap->near[cpu].dist = dist;
+			return true;
+		}
+	}
+	return false;
+}
+
 #ifdef DEBUG
 static void debug_print_rmap(const struct cpu_rmap *rmap, const char *prefix)
 {
@@ -190,11 +209,13 @@ int cpu_rmap_update(struct cpu_rmap *rmap, u16 index,
 		if (cpu_rmap_copy_neigh(rmap, cpu,
 					topology_sibling_cpumask(cpu), 1))
 			continue;
+		if (cpu_rmap_copy_llc_neigh(rmap, cpu, 2))
+			continue;
 		if (cpu_rmap_copy_neigh(rmap, cpu,
-					topology_core_cpumask(cpu), 2))
+					topology_core_cpumask(cpu), 3))
 			continue;
 		if (cpu_rmap_copy_neigh(rmap, cpu,
-					cpumask_of_node(cpu_to_node(cpu)), 3))
+					cpumask_of_node(cpu_to_node(cpu)), 4))
 			continue;
 		/* We could continue into NUMA node distances, but for now
 		 * we give up.
@@ -146,6 +146,17 @@ static int copyout(void __user *to, const void *from, size_t n)
 	return n;
 }
 
+/* copyout() of a chunk of a @stream bytes long transfer */
+static int copyout_stream(void __user *to, const void *from, size_t n,
+			  size_t stream)
+{
+	if (access_ok(to, n)) {
+		instrument_copy_to_user(to, from, n);
+		n = raw_copy_to_user_stream(to, from, n, stream);
+	}
+	return n;
+}
+
 static int copyin(void *to, const void __user *from, size_t n)
 {
 	if (access_ok(from, n)) {
@@ -181,7 +192,7 @@ static size_t copy_page_to_iter_iovec(struct page *page, size_t offset, size_t b
 		from = kaddr + offset;
 
 		/* first chunk, usually the only one */
-		left = copyout(buf, from, copy);
+		left = copyout_stream(buf, from, copy, i->count);
 		copy -= left;
 		skip += copy;
 		from += copy;
@@ -191,7 +202,7 @@ static size_t copy_page_to_iter_iovec(struct page *page, size_t offset, size_t b
 			iov++;
 			buf = iov->iov_base;
 			copy = min(bytes, iov->iov_len);
-			left = copyout(buf, from, copy);
+			left = copyout_stream(buf, from, copy, i->count);
 			copy -= left;
 			skip = copy;
 			from += copy;
@@ -210,7 +221,7 @@ static size_t copy_page_to_iter_iovec(struct page *page, size_t offset, size_t b
 
 	kaddr = kmap(page);
 	from = kaddr + offset;
-	left = copyout(buf, from, copy);
+	left = copyout_stream(buf, from, copy, i->count);
 	copy -= left;
 	skip += copy;
 	from += copy;
@@ -219,7 +230,7 @@ static size_t copy_page_to_iter_iovec(struct page *page, size_t offset, size_t b
 		iov++;
 		buf = iov->iov_base;
 		copy = min(bytes, iov->iov_len);
-		left = copyout(buf, from, copy);
+		left = copyout_stream(buf, from, copy, i->count);
 		copy -= left;
 		skip = copy;
 		from += copy;
@@ -385,6 +396,20 @@ static size_t copy_page_to_iter_pipe(struct page *page, size_t offset, size_t by
 	if (!sanity(i))
 		return 0;
 
+	/*
+	 * Subpages of a large page are referenced through the head page, so
+	 * that reading through a THP extends a single buffer instead of
+	 * taking a slot and a reference for every subpage.  Buffer users
+	 * kmap() the page they are given, which only covers more than one
+	 * page if it is not in highmem.
+	 */
+	if (PageTransCompound(page) && !PageHighMem(page)) {
+		struct page *head = compound_head(page);
+
+		offset += (page - head) << PAGE_SHIFT;
+		page = head;
+	}
+
 	off = i->iov_offset;
 	buf = &pipe->bufs[i_head & p_mask];
 	if (off) {
@@ -1350,6 +1375,146 @@ ssize_t iov_iter_get_pages(struct iov_iter *i,
 }
 EXPORT_SYMBOL(iov_iter_get_pages);
 
+/* Maximum number of user segments pinned by one iov_iter_get_pages_batch() */
+#define GET_PAGES_BATCH_SEGS	16
+
+static ssize_t iovec_get_pages_batch(struct iov_iter *i, struct bio_vec *bvecs,
+				     unsigned int *nr_vecs, size_t maxsize)
+{
+	struct gup_range ranges[GET_PAGES_BATCH_SEGS];
+	size_t lens[GET_PAGES_BATCH_SEGS];
+	const struct iovec *iov = i->iov;
+	size_t skip = i->iov_offset, bytes = 0;
+	unsigned int maxpages = *nr_vecs, npages = 0, k = 0;
+	struct page **pages;
+	int nr_ranges = 0, r, res;
+
+	for (; maxsize && nr_ranges < GET_PAGES_BATCH_SEGS && npages < maxpages;
+	     iov++, skip = 0) {
+		unsigned long addr = (unsigned long)iov->iov_base + skip;
+		size_t len = min(maxsize, iov->iov_len - skip);
+		size_t offset = addr & (PAGE_SIZE - 1);
+		unsigned int n;
+
+		if (!len)
+			continue;
+
+		n = DIV_ROUND_UP(offset + len, PAGE_SIZE);
+		if (n > maxpages - npages) {
+			n = maxpages - npages;
+			len = n * PAGE_SIZE - offset;
+		}
+
+		ranges[nr_ranges].start = addr;
+		ranges[nr_ranges].nr_pages = n;
+		lens[nr_ranges++] = len;
+		npages += n;
+		maxsize -= len;
+	}
+
+	/*
+	 * Let GUP fill the upper half of @bvecs with page pointers.  Each page
+	 * is read before the bio_vec built from it can overwrite its slot.
+	 */
+	BUILD_BUG_ON(sizeof(struct bio_vec) < 2 * sizeof(struct page *));
+	pages = (struct page **)bvecs + maxpages;
+
+	res = get_user_pages_fast_ranges(ranges, nr_ranges,
+				iov_iter_rw(i) != WRITE ? FOLL_WRITE : 0, pages);
+	if (unlikely(res < 0))
+		return res;
+
+	for (r = 0; r < nr_ranges && k < res; r++) {
+		size_t offset = ranges[r].start & (PAGE_SIZE - 1);
+		size_t len = lens[r];
+
+		while (len && k < res) {
+			struct page *page = pages[k];
+			size_t n = min_t(size_t, len, PAGE_SIZE - offset);
+
+			bvecs[k].bv_page = page;
+			bvecs[k].bv_offset = offset;
+			bvecs[k].bv_len = n;
+			k++;
+			bytes += n;
+			len -= n;
+			offset = 0;
+		}
+	}
+
+	*nr_vecs = k;
+	return bytes;
+}
+
+static ssize_t bvec_get_pages_batch(struct iov_iter *i, struct bio_vec *bvecs,
+				    unsigned int *nr_vecs, size_t maxsize,
+				    bool get_ref)
+{
+	const struct bio_vec *bv = i->bvec;
+	size_t skip = i->iov_offset, bytes = 0;
+	unsigned int k = 0;
+
+	for (; maxsize && k < *nr_vecs; bv++, skip = 0) {
+		size_t len = min(maxsize, bv->bv_len - skip);
+
+		/* Split multi-page segments, as bio_release_pages() expects */
+		while (len && k < *nr_vecs) {
+			size_t offset = bv->bv_offset + skip;
+			struct page *page = nth_page(bv->bv_page, offset / PAGE_SIZE);
+			size_t n;
+
+			offset &= PAGE_SIZE - 1;
+			n = min_t(size_t, len, PAGE_SIZE - offset);
+			if (get_ref)
+				get_page(page);
+
+			bvecs[k].bv_page = page;
+			bvecs[k].bv_offset = offset;
+			bvecs[k].bv_len = n;
+			k++;
+			skip += n;
+			bytes += n;
+			len -= n;
+			maxsize -= n;
+		}
+	}
+
+	*nr_vecs = k;
+	return bytes;
+}
+
+/**
+ * iov_iter_get_pages_batch - get the pages of several segments of an iterator
+ * @i: ITER_IOVEC or ITER_BVEC iterator, not advanced
+ * @bvecs: array that receives one bio_vec per page
+ * @nr_vecs: number of entries in @bvecs on entry, number filled on return
+ * @maxsize: maximum number of bytes to get the pages for
+ * @get_ref: take a page reference for ITER_BVEC pages; callers that
+ *	guarantee the lifetime of the pages until they are done pass false
+ *
+ * Unlike iov_iter_get_pages(), which stops at the end of the first segment,
+ * this covers up to GET_PAGES_BATCH_SEGS user segments with a single
+ * get_user_pages_fast_ranges() call.  Pages of user memory always get a
+ * reference, which the caller drops with put_page().
+ *
+ * Returns the number of bytes covered by @bvecs, or -errno.
+ */
+ssize_t iov_iter_get_pages_batch(struct iov_iter *i, struct bio_vec *bvecs,
+				 unsigned int *nr_vecs, size_t maxsize,
+				 bool get_ref)
+{
+	if (maxsize > i->count)
+		maxsize = i->count;
+
+	if (iter_is_iovec(i))
+		return iovec_get_pages_batch(i, bvecs, nr_vecs, maxsize);
+	if (iov_iter_is_bvec(i))
+		return bvec_get_pages_batch(i, bvecs, nr_vecs, maxsize, get_ref);
+
+	return -EFAULT;
+}
+EXPORT_SYMBOL(iov_iter_get_pages_batch);
+
 static struct page **get_pages_array(size_t n)
 {
 	return kvmalloc_array(n, sizeof(struct page *), GFP_KERNEL);
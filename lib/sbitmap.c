@@ -480,6 +480,59 @@ int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 }
 EXPORT_SYMBOL_GPL(__sbitmap_queue_get_shallow);
 
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned int hint, depth, index, i;
+
+	if (unlikely(sbq->round_robin))
+		return 0;
+
+	hint = this_cpu_read(*sbq->alloc_hint);
+	depth = READ_ONCE(sb->depth);
+	if (unlikely(hint >= depth))
+		hint = depth ? prandom_u32() % depth : 0;
+	index = SB_NR_TO_INDEX(sb, hint);
+
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *map = &sb->map[index];
+		unsigned long get_mask, val;
+		unsigned int nr, map_tags;
+
+		nr = find_first_zero_bit(&map->word, map->depth);
+		if (nr >= map->depth && sbitmap_deferred_clear(sb, index))
+			nr = find_first_zero_bit(&map->word, map->depth);
+
+		if (nr < map->depth) {
+			map_tags = min_t(unsigned int, nr_tags, map->depth - nr);
+			get_mask = (~0UL >> (BITS_PER_LONG - map_tags)) << nr;
+
+			/* Set the whole run at once, keep the bits we won */
+			do {
+				val = READ_ONCE(map->word);
+			} while (cmpxchg(&map->word, val, val | get_mask) != val);
+
+			get_mask = (get_mask & ~val) >> nr;
+			if (get_mask) {
+				*offset = nr + (index << sb->shift);
+				hint = *offset + map_tags;
+				if (hint >= depth - 1)
+					hint = 0;
+				this_cpu_write(*sbq->alloc_hint, hint);
+				return get_mask;
+			}
+		}
+
+		/* Jump to next index. */
+		if (++index >= sb->map_nr)
+			index = 0;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__sbitmap_queue_get_batch);
+
 void sbitmap_queue_min_shallow_depth(struct sbitmap_queue *sbq,
 				     unsigned int min_shallow_depth)
 {
@@ -589,6 +642,45 @@ void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_clear);
 
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+				int *tags, int nr_tags)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned long *addr = NULL;
+	unsigned long mask = 0;
+	int i;
+
+	/* See sbitmap_queue_clear() for the barriers */
+	smp_mb__before_atomic();
+	for (i = 0; i < nr_tags; i++) {
+		const int tag = tags[i] - offset;
+		unsigned long *this_addr;
+
+		/* A bit in use is never in the cleared mask, skip it */
+		this_addr = &sb->map[SB_NR_TO_INDEX(sb, tag)].word;
+		if (!addr) {
+			addr = this_addr;
+		} else if (addr != this_addr) {
+			atomic_long_andnot(mask, (atomic_long_t *)addr);
+			mask = 0;
+			addr = this_addr;
+		}
+		mask |= 1UL << SB_NR_TO_BIT(sb, tag);
+	}
+
+	if (mask)
+		atomic_long_andnot(mask, (atomic_long_t *)addr);
+
+	smp_mb__after_atomic();
+	for (i = 0; i < nr_tags; i++)
+		sbitmap_queue_wake_up(sbq);
+
+	i = tags[nr_tags - 1] - offset;
+	if (likely(!sbq->round_robin && i < sb->depth))
+		this_cpu_write(*sbq->alloc_hint, i);
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_clear_batch);
+
 void sbitmap_queue_wake_all(struct sbitmap_queue *sbq)
 {
 	int i, wake_index;
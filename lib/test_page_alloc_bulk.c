@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Benchmark for the bulk page allocator.
+ *
+ * Allocates and frees nr_pages order-0 pages in batches of batch pages,
+ * once with alloc_page() per page and once with alloc_pages_bulk_array(),
+ * and reports the pages per second of both:
+ *
+ *   echo 1 > /sys/module/test_page_alloc_bulk/parameters/run
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/gfp.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+static unsigned int nr_pages = 1 << 20;
+module_param(nr_pages, uint, 0644);
+MODULE_PARM_DESC(nr_pages, "Number of pages allocated by each pass");
+
+static unsigned int batch = 64;
+module_param(batch, uint, 0644);
+MODULE_PARM_DESC(batch, "Pages allocated before they are freed again");
+
+static DEFINE_MUTEX(bench_mutex);
+
+static void free_batch(struct page **pages, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		__free_page(pages[i]);
+		pages[i] = NULL;
+	}
+}
+
+static int bench_single(struct page **pages, u64 *ns)
+{
+	unsigned int done = 0, i;
+	ktime_t start = ktime_get();
+
+	while (done < nr_pages) {
+		for (i = 0; i < batch; i++) {
+			pages[i] = alloc_page(GFP_KERNEL);
+			if (!pages[i]) {
+				free_batch(pages, i);
+				return -ENOMEM;
+			}
+		}
+		free_batch(pages, batch);
+		done += batch;
+		cond_resched();
+	}
+
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return 0;
+}
+
+static int bench_bulk(struct page **pages, u64 *ns)
+{
+	unsigned int done = 0, nr;
+	ktime_t start = ktime_get();
+
+	while (done < nr_pages) {
+		nr = alloc_pages_bulk_array(GFP_KERNEL, batch, pages);
+		if (nr != batch) {
+			free_batch(pages, nr);
+			return -ENOMEM;
+		}
+		free_batch(pages, batch);
+		done += batch;
+		cond_resched();
+	}
+
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return 0;
+}
+
+static u64 pages_per_sec(u64 ns)
+{
+	return div64_u64((u64)nr_pages * NSEC_PER_SEC, max_t(u64, ns, 1));
+}
+
+static int bench_run(void)
+{
+	struct page **pages;
+	u64 single_ns, bulk_ns;
+	int ret;
+
+	if (!nr_pages || !batch)
+		return -EINVAL;
+
+	mutex_lock(&bench_mutex);
+
+	pages = kcalloc(batch, sizeof(*pages), GFP_KERNEL);
+	if (!pages) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = bench_single(pages, &single_ns);
+	if (!ret)
+		ret = bench_bulk(pages, &bulk_ns);
+	if (!ret)
+		pr_info("%u pages in batches of %u: alloc_page %llu pages/sec, alloc_pages_bulk_array %llu pages/sec\n",
+			nr_pages, batch, pages_per_sec(single_ns),
+			pages_per_sec(bulk_ns));
+
+	kfree(pages);
+out:
+	mutex_unlock(&bench_mutex);
+	return ret;
+}
+
+static int bench_run_set(const char *val, const struct kernel_param *kp)
+{
+	return bench_run();
+}
+
+static const struct kernel_param_ops bench_run_ops = {
+	.set	= bench_run_set,
+};
+
+module_param_cb(run, &bench_run_ops, NULL, 0200);
+MODULE_PARM_DESC(run, "Write to run the benchmark again");
+
+static int __init test_page_alloc_bulk_init(void)
+{
+	return bench_run();
+}
+module_init(test_page_alloc_bulk_init);
+
+static void __exit test_page_alloc_bulk_exit(void)
+{
+}
+module_exit(test_page_alloc_bulk_exit);
+
+MODULE_DESCRIPTION("Benchmark for the bulk page allocator");
+MODULE_LICENSE("GPL");
@@ -177,6 +177,113 @@ out_free:
 	return ret;
 }
 
+#ifdef ARCH_HAS_STREAM_UACCESS
+/*
+ * Run every routine that raw_copy_to_user_stream() can pick, to and from
+ * user space, for a length of each size class.  A copy that runs into an
+ * unmapped page must copy up to the fault and report exactly the rest as
+ * not copied.
+ */
+static int test_copy_user_routines(void)
+{
+	static const unsigned int lens[] = { 300, 1500, 5001, 20003 };
+	size_t size = 8 * PAGE_SIZE;
+	char *ksrc = NULL, *kdst = NULL;
+	unsigned long user_addr;
+	char __user *umem, *uend;
+	unsigned int r, i, j;
+	int ret = 0;
+
+	user_addr = vm_mmap(NULL, 0, size + PAGE_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (test(user_addr >= (unsigned long)(TASK_SIZE),
+		 "failed to allocate user memory"))
+		return -ENOMEM;
+	/* Leave an unmapped page behind the buffer to fault on */
+	vm_munmap(user_addr + size, PAGE_SIZE);
+	umem = (char __user *)user_addr;
+	uend = umem + size;
+
+	ksrc = vmalloc(size);
+	kdst = vmalloc(size);
+	ret = test(!ksrc || !kdst, "vmalloc failed");
+	if (ret)
+		goto out;
+
+	for (r = 0; r < COPY_USER_NR_ROUTINES; r++) {
+		const char *name = copy_user_routine_name(r);
+
+		if (!name)
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(lens); i++) {
+			unsigned int len = lens[i], part = len / 2;
+			unsigned long left;
+
+			for (j = 0; j < len; j++)
+				ksrc[j] = j * 7 + r + 1;
+
+			/* Whole copies, misaligned on the user side */
+			ret |= test(clear_user(umem, size),
+				    "legitimate clear_user failed");
+			left = copy_user_routine(r, (__force void *)(umem + 1),
+						 ksrc, len);
+			ret |= test(left, "%s: copy of %u bytes to user left %lu",
+				    name, len, left);
+			memset(kdst, 0, len);
+			ret |= test(copy_from_user(kdst, umem + 1, len),
+				    "legitimate copy_from_user failed");
+			ret |= test(memcmp(kdst, ksrc, len),
+				    "%s: copy of %u bytes to user is wrong",
+				    name, len);
+
+			memset(kdst, 0, len);
+			left = copy_user_routine(r, kdst,
+						 (__force void *)(umem + 1), len);
+			ret |= test(left,
+				    "%s: copy of %u bytes from user left %lu",
+				    name, len, left);
+			ret |= test(memcmp(kdst, ksrc, len),
+				    "%s: copy of %u bytes from user is wrong",
+				    name, len);
+
+			/* Tails that fault half way through */
+			ret |= test(clear_user(umem, size),
+				    "legitimate clear_user failed");
+			left = copy_user_routine(r, (__force void *)(uend - part),
+						 ksrc, len);
+			ret |= test(left != len - part,
+				    "%s: faulting copy of %u bytes to user left %lu, expected %u",
+				    name, len, left, len - part);
+			memset(kdst, 0, part);
+			ret |= test(copy_from_user(kdst, uend - part, part),
+				    "legitimate copy_from_user failed");
+			ret |= test(memcmp(kdst, ksrc, part),
+				    "%s: faulting copy of %u bytes to user is wrong",
+				    name, len);
+
+			ret |= test(copy_to_user(uend - part, ksrc, part),
+				    "legitimate copy_to_user failed");
+			memset(kdst, 0, len);
+			left = copy_user_routine(r, kdst,
+						 (__force void *)(uend - part), len);
+			ret |= test(left != len - part,
+				    "%s: faulting copy of %u bytes from user left %lu, expected %u",
+				    name, len, left, len - part);
+			ret |= test(memcmp(kdst, ksrc, part),
+				    "%s: faulting copy of %u bytes from user is wrong",
+				    name, len);
+		}
+	}
+
+out:
+	vfree(kdst);
+	vfree(ksrc);
+	vm_munmap(user_addr, size);
+	return ret;
+}
+#endif
+
 static int __init test_user_copy_init(void)
 {
 	int ret = 0;
@@ -248,6 +355,10 @@ static int __init test_user_copy_init(void)
 	ret |= test_check_nonzero_user(kmem, usermem, 2 * PAGE_SIZE);
 	/* Test usage of copy_struct_from_user(). */
 	ret |= test_copy_struct_from_user(kmem, usermem, 2 * PAGE_SIZE);
+#ifdef ARCH_HAS_STREAM_UACCESS
+	/* Test the routines behind raw_copy_to_user_stream(). */
+	ret |= test_copy_user_routines();
+#endif
 
 	/*
 	 * Invalid usage: none of these copies should succeed.
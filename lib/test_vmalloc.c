@@ -49,6 +49,7 @@ __param(int, run_test_mask, INT_MAX,
 		"\t\tid: 512,  name: kvfree_rcu_2_arg_vmalloc_test\n"
 		"\t\tid: 1024, name: kvfree_rcu_1_arg_slab_test\n"
 		"\t\tid: 2048, name: kvfree_rcu_2_arg_slab_test\n"
+		"\t\tid: 4096, name: fix_size_huge_alloc_test\n"
 		/* Add a new test case description here. */
 );
 
@@ -284,6 +285,37 @@ static int fix_size_alloc_test(void)
 	return 0;
 }
 
+/*
+ * Huge page backed allocations are expensive, so do fewer of them. Every
+ * page of the area has to be reachable through vmalloc_to_page(), whether
+ * it ended up mapped with PMDs or fell back to small pages.
+ */
+static int fix_size_huge_alloc_test(void)
+{
+	unsigned long size = 2 * PMD_SIZE + PAGE_SIZE;
+	int i, loops = max(test_loop_count >> 10, 1);
+	unsigned long off;
+	void *ptr;
+
+	for (i = 0; i < loops; i++) {
+		ptr = vmalloc_huge(size, GFP_KERNEL);
+		if (!ptr)
+			return -1;
+
+		for (off = 0; off < size; off += PAGE_SIZE) {
+			*((__u8 *)ptr + off) = 0;
+			if (!vmalloc_to_page(ptr + off)) {
+				vfree(ptr);
+				return -1;
+			}
+		}
+
+		vfree(ptr);
+	}
+
+	return 0;
+}
+
 static int
 pcpu_alloc_test(void)
 {
@@ -417,6 +449,7 @@ static struct test_case_desc test_case_array[] = {
 	{ "kvfree_rcu_2_arg_vmalloc_test", kvfree_rcu_2_arg_vmalloc_test },
 	{ "kvfree_rcu_1_arg_slab_test", kvfree_rcu_1_arg_slab_test },
 	{ "kvfree_rcu_2_arg_slab_test", kvfree_rcu_2_arg_slab_test },
+	{ "fix_size_huge_alloc_test", fix_size_huge_alloc_test },
 	/* Add a new test case here. */
 };
 
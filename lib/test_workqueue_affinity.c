@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Benchmark for the affinity scopes of unbound workqueues.
+ *
+ * Every online CPU repeatedly fills a buffer and hands it to a work item
+ * on an unbound workqueue which reads it back, the way dm-crypt or
+ * checksumming hand data off to a workqueue. The time per item and the
+ * cache misses counted on all CPUs are reported.
+ *
+ * The workqueue is visible in sysfs, so its affinity scope can be changed
+ * between runs:
+ *
+ *   echo cache > /sys/devices/virtual/workqueue/wq_affn_bench/affinity_scope
+ *   echo 1 > /sys/module/test_workqueue_affinity/parameters/run
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/cpu.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/perf_event.h>
+#include <linux/sched.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
+
+static unsigned int nr_items = 10000;
+module_param(nr_items, uint, 0644);
+MODULE_PARM_DESC(nr_items, "Number of work items queued by each CPU");
+
+static unsigned int buf_size = SZ_256K;
+module_param(buf_size, uint, 0644);
+MODULE_PARM_DESC(buf_size, "Bytes handed to each work item");
+
+struct bench_cpu {
+	struct work_struct	submit;
+	struct work_struct	consume;
+	struct perf_event	*event;
+	u64			*buf;
+	u64			sum;
+};
+
+static DEFINE_PER_CPU(struct bench_cpu, bench_cpus);
+static struct workqueue_struct *bench_wq;
+static DEFINE_MUTEX(bench_mutex);
+
+static void bench_consume(struct work_struct *work)
+{
+	struct bench_cpu *bc = container_of(work, struct bench_cpu, consume);
+	size_t i, n = buf_size / sizeof(u64);
+	u64 sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += READ_ONCE(bc->buf[i]);
+	bc->sum += sum;
+}
+
+static void bench_submit(struct work_struct *work)
+{
+	struct bench_cpu *bc = container_of(work, struct bench_cpu, submit);
+	size_t i, n = buf_size / sizeof(u64);
+	unsigned int item;
+
+	for (item = 0; item < nr_items; item++) {
+		for (i = 0; i < n; i++)
+			bc->buf[i] = item + i;
+
+		queue_work(bench_wq, &bc->consume);
+		flush_work(&bc->consume);
+		cond_resched();
+	}
+}
+
+static int bench_run(void)
+{
+	struct perf_event_attr attr = {
+		.type		= PERF_TYPE_HARDWARE,
+		.config		= PERF_COUNT_HW_CACHE_MISSES,
+		.size		= sizeof(attr),
+		.pinned		= 1,
+	};
+	u64 misses = 0, enabled, running, items;
+	unsigned int nr_cpus = 0;
+	struct bench_cpu *bc;
+	bool counted = true;
+	ktime_t start, time;
+	int cpu, ret = 0;
+
+	if (!nr_items || buf_size < sizeof(u64))
+		return -EINVAL;
+
+	mutex_lock(&bench_mutex);
+	get_online_cpus();
+
+	for_each_online_cpu(cpu) {
+		bc = per_cpu_ptr(&bench_cpus, cpu);
+		bc->buf = kvmalloc_node(buf_size, GFP_KERNEL, cpu_to_node(cpu));
+		if (!bc->buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		bc->event = perf_event_create_kernel_counter(&attr, cpu, NULL,
+							     NULL, NULL);
+		if (IS_ERR(bc->event)) {
+			bc->event = NULL;
+			counted = false;
+		}
+		nr_cpus++;
+	}
+
+	start = ktime_get();
+	for_each_online_cpu(cpu)
+		queue_work_on(cpu, system_long_wq,
+			      &per_cpu_ptr(&bench_cpus, cpu)->submit);
+	for_each_online_cpu(cpu)
+		flush_work(&per_cpu_ptr(&bench_cpus, cpu)->submit);
+	time = ktime_sub(ktime_get(), start);
+
+	for_each_online_cpu(cpu) {
+		bc = per_cpu_ptr(&bench_cpus, cpu);
+		if (bc->event)
+			misses += perf_event_read_value(bc->event, &enabled,
+							&running);
+	}
+
+	items = (u64)nr_items * nr_cpus;
+	if (counted)
+		pr_info("%u CPUs, %llu items of %u bytes: %llu ns/item, %llu cache misses/item\n",
+			nr_cpus, items, buf_size,
+			div64_u64(ktime_to_ns(time), items),
+			div64_u64(misses, items));
+	else
+		pr_info("%u CPUs, %llu items of %u bytes: %llu ns/item, cache misses not counted\n",
+			nr_cpus, items, buf_size,
+			div64_u64(ktime_to_ns(time), items));
+out:
+	for_each_online_cpu(cpu) {
+		bc = per_cpu_ptr(&bench_cpus, cpu);
+		if (bc->event)
+			perf_event_release_kernel(bc->event);
+		bc->event = NULL;
+		kvfree(bc->buf);
+		bc->buf = NULL;
+	}
+
+	put_online_cpus();
+	mutex_unlock(&bench_mutex);
+	return ret;
+}
+
+static int bench_run_set(const char *val, const struct kernel_param *kp)
+{
+	return bench_run();
+}
+
+static const struct kernel_param_ops bench_run_ops = {
+	.set	= bench_run_set,
+};
+
+module_param_cb(run, &bench_run_ops, NULL, 0200);
+MODULE_PARM_DESC(run, "Write to run the benchmark again");
+
+static int __init test_workqueue_affinity_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct bench_cpu *bc = per_cpu_ptr(&bench_cpus, cpu);
+
+		INIT_WORK(&bc->submit, bench_submit);
+		INIT_WORK(&bc->consume, bench_consume);
+	}
+
+	bench_wq = alloc_workqueue("wq_affn_bench", WQ_UNBOUND | WQ_SYSFS, 0);
+	if (!bench_wq)
+		return -ENOMEM;
+
+	bench_run();
+	return 0;
+}
+module_init(test_workqueue_affinity_init);
+
+static void __exit test_workqueue_affinity_exit(void)
+{
+	destroy_workqueue(bench_wq);
+}
+module_exit(test_workqueue_affinity_exit);
+
+MODULE_DESCRIPTION("Benchmark for unbound workqueue affinity scopes");
+MODULE_LICENSE("GPL");
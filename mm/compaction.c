@@ -51,9 +51,11 @@ static inline void count_compact_events(enum vm_event_item item, long delta)
 #define pageblock_end_pfn(pfn)		block_end_pfn(pfn, pageblock_order)
 
 /*
- * Fragmentation score check interval for proactive compaction purposes.
+ * Fragmentation score check interval for proactive compaction purposes,
+ * and the share of one CPU proactive compaction may use on each node.
  */
-static const unsigned int HPAGE_FRAG_CHECK_INTERVAL_MSEC = 500;
+unsigned int __read_mostly sysctl_compaction_proactive_interval_ms = 500;
+unsigned int __read_mostly sysctl_compaction_proactive_cpu_pct = 25;
 
 /*
  * Page order with-respect-to which proactive compaction
@@ -1979,6 +1981,12 @@ static enum compact_result __compact_finished(struct compact_control *cc)
 		if (kswapd_is_running(pgdat))
 			return COMPACT_PARTIAL_SKIPPED;
 
+		/* Out of CPU budget, the next run resumes from here */
+		if (time_after(jiffies, cc->deadline)) {
+			cc->proactive_throttled = true;
+			return COMPACT_PARTIAL_SKIPPED;
+		}
+
 		score = fragmentation_score_zone(cc->zone);
 		wmark_low = fragmentation_score_wmark(pgdat, true);
 
@@ -2314,7 +2322,7 @@ compact_zone(struct compact_control *cc, struct capture_control *capc)
 
 		err = migrate_pages(&cc->migratepages, compaction_alloc,
 				compaction_free, (unsigned long)cc, cc->mode,
-				MR_COMPACTION);
+				MR_COMPACTION, NULL);
 
 		trace_mm_compaction_migratepages(cc->nr_migratepages, err,
 							&cc->migratepages);
@@ -2537,32 +2545,60 @@ enum compact_result try_to_compact_pages(gfp_t gfp_mask, unsigned int order,
  * It is possible that the function returns before reaching score targets
  * due to various back-off conditions, such as, contention on per-node or
  * per-zone locks.
+ *
+ * Each run may use sysctl_compaction_proactive_cpu_pct percent of the check
+ * interval. Returns true if the run was cut short, the next run then resumes
+ * from the cached scanner positions instead of rescanning whole zones.
  */
-static void proactive_compact_node(pg_data_t *pgdat)
+static bool proactive_compact_node(pg_data_t *pgdat, bool resume)
 {
+	unsigned long budget, start = jiffies;
 	int zoneid;
 	struct zone *zone;
 	struct compact_control cc = {
 		.order = -1,
 		.mode = MIGRATE_SYNC_LIGHT,
 		.ignore_skip_hint = true,
-		.whole_zone = true,
 		.gfp_mask = GFP_KERNEL,
 		.proactive_compaction = true,
 	};
 
+	budget = msecs_to_jiffies(sysctl_compaction_proactive_interval_ms *
+				  sysctl_compaction_proactive_cpu_pct / 100);
+	cc.deadline = start + max(budget, 1UL);
+
+	count_compact_event(KCOMPACTD_PROACTIVE);
+
 	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
 		zone = &pgdat->node_zones[zoneid];
 		if (!populated_zone(zone))
 			continue;
 
 		cc.zone = zone;
+		cc.whole_zone = !resume;
+		cc.total_migrate_scanned = 0;
+		cc.total_free_scanned = 0;
 
 		compact_zone(&cc, NULL);
 
+		count_compact_events(KCOMPACTD_PROACTIVE_MIGRATE_SCANNED,
+				     cc.total_migrate_scanned);
+		count_compact_events(KCOMPACTD_PROACTIVE_FREE_SCANNED,
+				     cc.total_free_scanned);
+
 		VM_BUG_ON(!list_empty(&cc.freepages));
 		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (cc.proactive_throttled)
+			break;
 	}
+
+	count_compact_events(KCOMPACTD_PROACTIVE_MS,
+			     jiffies_to_msecs(jiffies - start));
+	if (cc.proactive_throttled)
+		count_compact_event(KCOMPACTD_PROACTIVE_THROTTLED);
+
+	return cc.proactive_throttled;
 }
 
 /* Compact all zones within a node */
@@ -2797,6 +2833,7 @@ static int kcompactd(void *p)
 	pg_data_t *pgdat = (pg_data_t*)p;
 	struct task_struct *tsk = current;
 	unsigned int proactive_defer = 0;
+	bool proactive_resume = false;
 
 	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
 
@@ -2814,7 +2851,7 @@ static int kcompactd(void *p)
 		trace_mm_compaction_kcompactd_sleep(pgdat->node_id);
 		if (wait_event_freezable_timeout(pgdat->kcompactd_wait,
 			kcompactd_work_requested(pgdat),
-			msecs_to_jiffies(HPAGE_FRAG_CHECK_INTERVAL_MSEC))) {
+			msecs_to_jiffies(sysctl_compaction_proactive_interval_ms))) {
 
 			psi_memstall_enter(&pflags);
 			kcompactd_do_work(pgdat);
@@ -2831,7 +2868,8 @@ static int kcompactd(void *p)
 				continue;
 			}
 			prev_score = fragmentation_score_node(pgdat);
-			proactive_compact_node(pgdat);
+			proactive_resume = proactive_compact_node(pgdat,
+							proactive_resume);
 			score = fragmentation_score_node(pgdat);
 			/*
 			 * Defer proactive compaction if the fragmentation
@@ -2839,6 +2877,8 @@ static int kcompactd(void *p)
 			 */
 			proactive_defer = score < prev_score ?
 					0 : 1 << COMPACT_MAX_DEFER_SHIFT;
+		} else {
+			proactive_resume = false;
 		}
 	}
 
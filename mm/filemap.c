@@ -207,7 +207,8 @@ static void unaccount_page_cache_page(struct address_space *mapping,
 			__dec_node_page_state(page, NR_SHMEM_THPS);
 	} else if (PageTransHuge(page)) {
 		__dec_node_page_state(page, NR_FILE_THPS);
-		filemap_nr_thps_dec(mapping);
+		if (!mapping_large_pages(mapping))
+			filemap_nr_thps_dec(mapping);
 	}
 
 	/*
@@ -832,16 +833,18 @@ static int __add_to_page_cache_locked(struct page *page,
 				      pgoff_t offset, gfp_t gfp_mask,
 				      void **shadowp)
 {
-	XA_STATE(xas, &mapping->i_pages, offset);
 	int huge = PageHuge(page);
+	unsigned long i, nr = huge ? 1 : thp_nr_pages(page);
+	XA_STATE_ORDER(xas, &mapping->i_pages, offset,
+		       huge ? 0 : thp_order(page));
 	int error;
-	void *old;
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	VM_BUG_ON_PAGE(PageSwapBacked(page), page);
+	VM_BUG_ON_PAGE(offset & (nr - 1), page);
 	mapping_set_update(&xas, mapping);
 
-	get_page(page);
+	page_ref_add(page, nr);
 	page->mapping = mapping;
 	page->index = offset;
 
@@ -852,24 +855,46 @@ static int __add_to_page_cache_locked(struct page *page,
 	}
 
 	do {
+		unsigned long nr_shadows = 0;
+		void *entry, *old = NULL;
+
 		xas_lock_irq(&xas);
-		old = xas_load(&xas);
-		if (old && !xa_is_value(old))
-			xas_set_err(&xas, -EEXIST);
-		xas_store(&xas, page);
+		xas_for_each_conflict(&xas, entry) {
+			if (!xa_is_value(entry)) {
+				xas_set_err(&xas, -EEXIST);
+				goto unlock;
+			}
+			old = entry;
+			nr_shadows++;
+		}
+		if (nr > 1) {
+			/* A THP is stored in each of the slots it covers */
+			xas_create_range(&xas);
+			if (xas_error(&xas))
+				goto unlock;
+		}
+		for (i = 0; i < nr; i++) {
+			xas_store(&xas, page);
+			if (i + 1 < nr)
+				xas_next(&xas);
+		}
 		if (xas_error(&xas))
 			goto unlock;
 
-		if (xa_is_value(old)) {
-			mapping->nrexceptional--;
+		if (old) {
+			mapping->nrexceptional -= nr_shadows;
 			if (shadowp)
 				*shadowp = old;
 		}
-		mapping->nrpages++;
+		mapping->nrpages += nr;
 
 		/* hugetlb pages do not participate in page cache accounting */
-		if (!huge)
-			__inc_lruvec_page_state(page, NR_FILE_PAGES);
+		if (!huge) {
+			__mod_lruvec_page_state(page, NR_FILE_PAGES, nr);
+			/* Only mapping_large_pages() mappings get THPs here */
+			if (nr > 1)
+				__inc_node_page_state(page, NR_FILE_THPS);
+		}
 unlock:
 		xas_unlock_irq(&xas);
 	} while (xas_nomem(&xas, gfp_mask & GFP_RECLAIM_MASK));
@@ -884,7 +909,7 @@ unlock:
 error:
 	page->mapping = NULL;
 	/* Leave page->index set: truncation relies upon it */
-	put_page(page);
+	page_ref_sub(page, nr);
 	return error;
 }
 ALLOW_ERROR_INJECTION(__add_to_page_cache_locked, ERRNO);
@@ -2483,6 +2508,17 @@ static struct file *do_sync_mmap_readahead(struct vm_fault *vmf)
 		return fpin;
 	}
 
+	/* Strided faults read the predicted pages instead of around them */
+	if (page_cache_stride_update(mapping, ra, offset,
+				     vmf->vma->vm_flags & VM_STRIDE_READ,
+				     false)) {
+		fpin = maybe_unlock_mmap_for_io(vmf, fpin);
+		page_cache_stride_readahead(mapping, ra, file, offset);
+		return fpin;
+	}
+	if (vmf->vma->vm_flags & VM_STRIDE_READ)
+		return fpin;
+
 	/* Avoid banging the cache line if not needed */
 	mmap_miss = READ_ONCE(ra->mmap_miss);
 	if (mmap_miss < MMAP_LOTSAMISS * 10)
@@ -2527,6 +2563,16 @@ static struct file *do_async_mmap_readahead(struct vm_fault *vmf,
 	mmap_miss = READ_ONCE(ra->mmap_miss);
 	if (mmap_miss)
 		WRITE_ONCE(ra->mmap_miss, --mmap_miss);
+	if (!(vmf->vma->vm_flags & VM_SEQ_READ) &&
+	    page_cache_stride_update(mapping, ra, offset,
+				     vmf->vma->vm_flags & VM_STRIDE_READ,
+				     true)) {
+		if (page_cache_stride_wants_io(ra, offset)) {
+			fpin = maybe_unlock_mmap_for_io(vmf, fpin);
+			page_cache_stride_readahead(mapping, ra, file, offset);
+		}
+		return fpin;
+	}
 	if (PageReadahead(page)) {
 		fpin = maybe_unlock_mmap_for_io(vmf, fpin);
 		page_cache_async_readahead(mapping, ra, file,
@@ -3046,7 +3092,8 @@ inline ssize_t generic_write_checks(struct kiocb *iocb, struct iov_iter *from)
 	if (iocb->ki_flags & IOCB_APPEND)
 		iocb->ki_pos = i_size_read(inode);
 
-	if ((iocb->ki_flags & IOCB_NOWAIT) && !(iocb->ki_flags & IOCB_DIRECT))
+	if ((iocb->ki_flags & IOCB_NOWAIT) &&
+	    !((iocb->ki_flags & IOCB_DIRECT) || (file->f_mode & FMODE_BUF_WASYNC)))
 		return -EINVAL;
 
 	count = iov_iter_count(from);
@@ -3346,14 +3393,26 @@ struct page *grab_cache_page_write_begin(struct address_space *mapping,
 {
 	struct page *page;
 	int fgp_flags = FGP_LOCK|FGP_WRITE|FGP_CREAT;
+	gfp_t gfp = mapping_gfp_mask(mapping);
 
 	if (flags & AOP_FLAG_NOFS)
 		fgp_flags |= FGP_NOFS;
+	if (flags & AOP_FLAG_NOWAIT) {
+		fgp_flags |= FGP_NOWAIT;
+		gfp = (gfp & ~__GFP_DIRECT_RECLAIM) | __GFP_NOWARN;
+	}
 
-	page = pagecache_get_page(mapping, index, fgp_flags,
-			mapping_gfp_mask(mapping));
-	if (page)
-		wait_for_stable_page(page);
+	page = pagecache_get_page(mapping, index, fgp_flags, gfp);
+	if (!page)
+		return NULL;
+
+	if ((flags & AOP_FLAG_NOWAIT) && PageWriteback(page) &&
+	    bdi_cap_stable_pages_required(inode_to_bdi(mapping->host))) {
+		unlock_page(page);
+		put_page(page);
+		return NULL;
+	}
+	wait_for_stable_page(page);
 
 	return page;
 }
@@ -1653,7 +1653,8 @@ check_again:
 			put_page(pages[i]);
 
 		if (migrate_pages(&cma_page_list, alloc_migration_target, NULL,
-			(unsigned long)&mtc, MIGRATE_SYNC, MR_CONTIG_RANGE)) {
+			(unsigned long)&mtc, MIGRATE_SYNC, MR_CONTIG_RANGE,
+			NULL)) {
 			/*
 			 * some of the pages failed migration. Do get_user_pages
 			 * without migration.
@@ -2828,6 +2829,80 @@ int get_user_pages_fast(unsigned long start, int nr_pages,
 }
 EXPORT_SYMBOL_GPL(get_user_pages_fast);
 
+/**
+ * get_user_pages_fast_ranges() - get the pages of several user address ranges
+ * @ranges:	address ranges, each @nr_pages long from its page aligned start
+ * @nr_ranges:	number of entries in @ranges
+ * @gup_flags:	flags modifying pin behaviour, only FOLL_WRITE is allowed
+ * @pages:	array that receives the pages of all ranges, in order.
+ *		Should be at least the sum of all nr_pages long.
+ *
+ * Like calling get_user_pages_fast() on each range in turn, except that the
+ * page tables of all ranges are walked with interrupts disabled only once,
+ * which matters when a readv() or writev() for direct I/O has many small
+ * segments.  Getting pages stops at the first range which can't be handled
+ * entirely by the fast path: the slow path is tried for the remainder of
+ * that range only, and the caller is expected to call again for the ranges
+ * after it.
+ *
+ * Returns the total number of pages got, which may be fewer than requested.
+ * If no pages were got, returns -errno.
+ */
+int get_user_pages_fast_ranges(const struct gup_range *ranges, int nr_ranges,
+			       unsigned int gup_flags, struct page **pages)
+{
+	unsigned long start, end, flags;
+	int nr_pinned = 0, done = 0, r = 0, ret;
+
+	if (WARN_ON_ONCE(gup_flags & ~FOLL_WRITE))
+		return -EINVAL;
+
+	gup_flags |= FOLL_GET;
+	might_lock_read(&current->mm->mmap_lock);
+
+	if (IS_ENABLED(CONFIG_HAVE_FAST_GUP)) {
+		/* See internal_get_user_pages_fast() for FOLL_WRITE and IRQs */
+		local_irq_save(flags);
+		for (r = 0; r < nr_ranges; r++) {
+			start = untagged_addr(ranges[r].start) & PAGE_MASK;
+			end = start + ((unsigned long)ranges[r].nr_pages << PAGE_SHIFT);
+
+			if (end <= start ||
+			    !access_ok((void __user *)start, end - start) ||
+			    !gup_fast_permitted(start, end))
+				break;
+
+			done = nr_pinned;
+			gup_pgd_range(start, end, gup_flags | FOLL_WRITE, pages,
+				      &nr_pinned);
+			done = nr_pinned - done;
+			if (done < ranges[r].nr_pages)
+				break;
+			done = 0;
+		}
+		local_irq_restore(flags);
+	}
+
+	if (r == nr_ranges)
+		return nr_pinned;
+
+	start = (untagged_addr(ranges[r].start) & PAGE_MASK) +
+		((unsigned long)done << PAGE_SHIFT);
+	ret = ranges[r].nr_pages - done;
+	if (unlikely(!access_ok((void __user *)start,
+				(unsigned long)ret << PAGE_SHIFT)))
+		ret = -EFAULT;
+	else
+		ret = __gup_longterm_unlocked(start, ret, gup_flags,
+					      pages + nr_pinned);
+
+	if (ret < 0)
+		return nr_pinned ?: ret;
+
+	return nr_pinned + ret;
+}
+EXPORT_SYMBOL_GPL(get_user_pages_fast_ranges);
+
 /**
  * pin_user_pages_fast() - pin user pages in memory without taking locks
  *
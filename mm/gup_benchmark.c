@@ -10,6 +10,10 @@
 #define GUP_BENCHMARK		_IOWR('g', 3, struct gup_benchmark)
 #define PIN_FAST_BENCHMARK	_IOWR('g', 4, struct gup_benchmark)
 #define PIN_BENCHMARK		_IOWR('g', 5, struct gup_benchmark)
+#define GUP_FAST_RANGES_BENCHMARK	_IOWR('g', 6, struct gup_benchmark)
+
+/* Number of ranges each GUP_FAST_RANGES_BENCHMARK call is split into */
+#define GUP_BENCHMARK_RANGES	16
 
 struct gup_benchmark {
 	__u64 get_delta_usec;
@@ -30,6 +34,7 @@ static void put_back_pages(unsigned int cmd, struct page **pages,
 	case GUP_FAST_BENCHMARK:
 	case GUP_LONGTERM_BENCHMARK:
 	case GUP_BENCHMARK:
+	case GUP_FAST_RANGES_BENCHMARK:
 		for (i = 0; i < nr_pages; i++)
 			put_page(pages[i]);
 		break;
@@ -63,6 +68,28 @@ static void verify_dma_pinned(unsigned int cmd, struct page **pages,
 	}
 }
 
+/*
+ * Get the @nr pages at @addr with a single get_user_pages_fast_ranges() call,
+ * split into up to GUP_BENCHMARK_RANGES ranges, like a direct I/O readv()
+ * with that many segments.
+ */
+static int gup_benchmark_ranges(unsigned long addr, int nr,
+				unsigned int gup_flags, struct page **pages)
+{
+	struct gup_range ranges[GUP_BENCHMARK_RANGES];
+	int per_range = DIV_ROUND_UP(nr, GUP_BENCHMARK_RANGES);
+	int nr_ranges;
+
+	for (nr_ranges = 0; nr > 0; nr_ranges++) {
+		ranges[nr_ranges].start = addr;
+		ranges[nr_ranges].nr_pages = min(nr, per_range);
+		addr += (unsigned long)per_range * PAGE_SIZE;
+		nr -= per_range;
+	}
+
+	return get_user_pages_fast_ranges(ranges, nr_ranges, gup_flags, pages);
+}
+
 static int __gup_benchmark_ioctl(unsigned int cmd,
 		struct gup_benchmark *gup)
 {
@@ -118,6 +145,10 @@ static int __gup_benchmark_ioctl(unsigned int cmd,
 			nr = pin_user_pages(addr, nr, gup->flags, pages + i,
 					    NULL);
 			break;
+		case GUP_FAST_RANGES_BENCHMARK:
+			nr = gup_benchmark_ranges(addr, nr, gup->flags,
+						  pages + i);
+			break;
 		default:
 			kvfree(pages);
 			ret = -EINVAL;
@@ -166,6 +197,7 @@ static long gup_benchmark_ioctl(struct file *filep, unsigned int cmd,
 	case GUP_BENCHMARK:
 	case PIN_FAST_BENCHMARK:
 	case PIN_BENCHMARK:
+	case GUP_FAST_RANGES_BENCHMARK:
 		break;
 	default:
 		return -EINVAL;
@@ -9,6 +9,7 @@
 #include <linux/sched.h>
 #include <linux/sched/coredump.h>
 #include <linux/sched/numa_balancing.h>
+#include <linux/sched/sysctl.h>
 #include <linux/highmem.h>
 #include <linux/hugetlb.h>
 #include <linux/mmu_notifier.h>
@@ -295,6 +296,21 @@ static ssize_t use_zero_page_store(struct kobject *kobj,
 static struct kobj_attribute use_zero_page_attr =
 	__ATTR(use_zero_page, 0644, use_zero_page_show, use_zero_page_store);
 
+static ssize_t clear_nocache_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return single_hugepage_flag_show(kobj, attr, buf,
+				TRANSPARENT_HUGEPAGE_CLEAR_NOCACHE_FLAG);
+}
+static ssize_t clear_nocache_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	return single_hugepage_flag_store(kobj, attr, buf, count,
+				 TRANSPARENT_HUGEPAGE_CLEAR_NOCACHE_FLAG);
+}
+static struct kobj_attribute clear_nocache_attr =
+	__ATTR(clear_nocache, 0644, clear_nocache_show, clear_nocache_store);
+
 static ssize_t hpage_pmd_size_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
@@ -307,6 +323,7 @@ static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
 	&use_zero_page_attr.attr,
+	&clear_nocache_attr.attr,
 	&hpage_pmd_size_attr.attr,
 #ifdef CONFIG_SHMEM
 	&shmem_enabled_attr.attr,
@@ -586,7 +603,8 @@ static vm_fault_t __do_huge_pmd_anonymous_page(struct vm_fault *vmf,
 		goto release;
 	}
 
-	clear_huge_page(page, vmf->address, HPAGE_PMD_NR);
+	clear_huge_page(page, vmf->address, HPAGE_PMD_NR,
+			transparent_hugepage_clear_mode());
 	/*
 	 * The memory barrier inside __SetPageUptodate makes sure that
 	 * clear_huge_page writes become visible before the set_pmd_at()
@@ -754,6 +772,90 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 	return __do_huge_pmd_anonymous_page(vmf, page, gfp);
 }
 
+#ifdef CONFIG_USERFAULTFD
+/*
+ * UFFDIO_COPY of a whole PMD aligned range of an anonymous vma, with the
+ * dst_pmd still none: copy it into a THP and map that, the way a fault
+ * would have.  Called with mmap_lock held, so the source is not faulted
+ * in: -EAGAIN tells the caller to copy small pages instead, which deals
+ * with that and with the races.
+ */
+int mcopy_atomic_pmd(struct mm_struct *dst_mm, pmd_t *dst_pmd,
+		     struct vm_area_struct *dst_vma,
+		     unsigned long dst_addr, unsigned long src_addr)
+{
+	pgtable_t pgtable;
+	struct page *page;
+	spinlock_t *ptl;
+	pmd_t entry;
+	gfp_t gfp;
+	int ret;
+
+	if (!transhuge_vma_suitable(dst_vma, dst_addr) ||
+	    !__transparent_hugepage_enabled(dst_vma))
+		return -EAGAIN;
+
+	gfp = alloc_hugepage_direct_gfpmask(dst_vma);
+	page = alloc_hugepage_vma(gfp, dst_vma, dst_addr, HPAGE_PMD_ORDER);
+	if (unlikely(!page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return -EAGAIN;
+	}
+	prep_transhuge_page(page);
+
+	ret = -EAGAIN;
+	if (copy_huge_page_from_user(page, (const void __user *)src_addr,
+				     HPAGE_PMD_NR, false))
+		goto release;
+
+	if (mem_cgroup_charge(page, dst_mm, gfp)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		count_vm_event(THP_FAULT_FALLBACK_CHARGE);
+		goto release;
+	}
+	cgroup_throttle_swaprate(page, gfp);
+
+	ret = -ENOMEM;
+	pgtable = pte_alloc_one(dst_mm);
+	if (unlikely(!pgtable))
+		goto release;
+
+	/*
+	 * The memory barrier inside __SetPageUptodate makes sure that
+	 * the copied contents become visible before the set_pmd_at()
+	 * write.
+	 */
+	__SetPageUptodate(page);
+
+	ptl = pmd_lock(dst_mm, dst_pmd);
+	ret = -EAGAIN;
+	if (unlikely(!pmd_none(*dst_pmd)))
+		goto unlock_release;
+
+	entry = mk_huge_pmd(page, dst_vma->vm_page_prot);
+	entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), dst_vma);
+	page_add_new_anon_rmap(page, dst_vma, dst_addr, true);
+	lru_cache_add_inactive_or_unevictable(page, dst_vma);
+	pgtable_trans_huge_deposit(dst_mm, dst_pmd, pgtable);
+	set_pmd_at(dst_mm, dst_addr, dst_pmd, entry);
+	add_mm_counter(dst_mm, MM_ANONPAGES, HPAGE_PMD_NR);
+	mm_inc_nr_ptes(dst_mm);
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache_pmd(dst_vma, dst_addr, dst_pmd);
+	spin_unlock(ptl);
+	count_vm_event(THP_FAULT_ALLOC);
+	count_memcg_event_mm(dst_mm, THP_FAULT_ALLOC);
+	return 0;
+
+unlock_release:
+	spin_unlock(ptl);
+	pte_free(dst_mm, pgtable);
+release:
+	put_page(page);
+	return ret;
+}
+#endif /* CONFIG_USERFAULTFD */
+
 static void insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
 		pmd_t *pmd, pfn_t pfn, pgprot_t prot, bool write,
 		pgtable_t pgtable)
@@ -1805,6 +1907,12 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 	if (prot_numa && pmd_protnone(*pmd))
 		goto unlock;
 
+	/* See change_pte_range() */
+	if (prot_numa &&
+	    !(sysctl_numa_balancing_mode & NUMA_BALANCING_NORMAL) &&
+	    node_is_toptier(page_to_nid(pmd_page(*pmd))))
+		goto unlock;
+
 	/*
 	 * In case prot_numa, we are under mmap_read_lock(mm). It's critical
 	 * to not clear pmd intermittently to avoid race with MADV_DONTNEED
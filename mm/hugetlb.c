@@ -30,6 +30,7 @@
 #include <linux/numa.h>
 #include <linux/llist.h>
 #include <linux/cma.h>
+#include <linux/padata.h>
 
 #include <asm/page.h>
 #include <asm/pgalloc.h>
@@ -42,6 +43,7 @@
 #include <linux/userfaultfd_k.h>
 #include <linux/page_owner.h>
 #include "internal.h"
+#include "hugetlb_vmemmap.h"
 
 int hugetlb_max_hstate __read_mostly;
 unsigned int default_hstate_idx;
@@ -1292,12 +1294,49 @@ static inline void destroy_compound_gigantic_page(struct page *page,
 						unsigned int order) { }
 #endif
 
-static void update_and_free_page(struct hstate *h, struct page *page)
+/*
+ * Give the tail struct pages of @page, which is off the HugeTLB lists,
+ * their vmemmap pages back before they are written. hugetlb_lock is
+ * dropped meanwhile, the reference keeps dissolve_free_huge_page() away
+ * from the page. If the vmemmap pages cannot be allocated the page is put
+ * back on the free list as a surplus page: callers have already accounted
+ * for it leaving the pool and that keeps the persistent pool size in line.
+ */
+static int restore_huge_page_vmemmap(struct hstate *h, struct page *page)
 {
-	int i;
+	int nid = page_to_nid(page);
+	int ret;
+
+	if (!hugetlb_vmemmap_optimized(page))
+		return 0;
+
+	set_page_refcounted(page);
+	spin_unlock(&hugetlb_lock);
+	ret = alloc_huge_page_vmemmap(h, page);
+	spin_lock(&hugetlb_lock);
+	page_ref_dec(page);
+
+	if (ret) {
+		INIT_LIST_HEAD(&page->lru);
+		h->surplus_huge_pages++;
+		h->surplus_huge_pages_node[nid]++;
+		arch_clear_hugepage_flags(page);
+		enqueue_huge_page(h, page);
+	}
+
+	return ret;
+}
+
+static int update_and_free_page(struct hstate *h, struct page *page)
+{
+	int i, ret;
 
 	if (hstate_is_gigantic(h) && !gigantic_page_runtime_supported())
-		return;
+		return 0;
+
+	ret = restore_huge_page_vmemmap(h, page);
+	if (ret)
+		return ret;
 
 	h->nr_huge_pages--;
 	h->nr_huge_pages_node[page_to_nid(page)]--;
@@ -1323,6 +1362,8 @@ static void update_and_free_page(struct hstate *h, struct page *page)
 	} else {
 		__free_pages(page, huge_page_order(h));
 	}
+
+	return 0;
 }
 
 struct hstate *size_to_hstate(unsigned long size)
@@ -1498,6 +1539,7 @@ void free_huge_page(struct page *page)
 
 static void prep_new_huge_page(struct hstate *h, struct page *page, int nid)
 {
+	free_huge_page_vmemmap(h, page);
 	INIT_LIST_HEAD(&page->lru);
 	set_compound_page_dtor(page, HUGETLB_PAGE_DTOR);
 	spin_lock(&hugetlb_lock);
@@ -1851,6 +1893,13 @@ int dissolve_free_huge_page(struct page *page)
 		int nid = page_to_nid(head);
 		if (h->free_huge_pages - h->resv_huge_pages == 0)
 			goto out;
+		list_del(&head->lru);
+		h->free_huge_pages--;
+		h->free_huge_pages_node[nid]--;
+		h->max_huge_pages--;
+		rc = restore_huge_page_vmemmap(h, head);
+		if (rc)
+			goto out;
 		/*
 		 * Move PageHWPoison flag from head page to the raw error page,
 		 * which makes any subpages rather than the error page reusable.
@@ -1859,12 +1908,7 @@ int dissolve_free_huge_page(struct page *page)
 			SetPageHWPoison(page);
 			ClearPageHWPoison(head);
 		}
-		list_del(&head->lru);
-		h->free_huge_pages--;
-		h->free_huge_pages_node[nid]--;
-		h->max_huge_pages--;
 		update_and_free_page(h, head);
-		rc = 0;
 	}
 out:
 	spin_unlock(&hugetlb_lock);
@@ -2502,37 +2546,177 @@ static void __init prep_compound_huge_page(struct page *page,
 		prep_compound_page(page, order);
 }
 
+static void __init gather_bootmem_prealloc_page(struct huge_bootmem_page *m)
+{
+	struct page *page = virt_to_page(m);
+	struct hstate *h = m->hstate;
+
+	WARN_ON(page_count(page) != 1);
+	prep_compound_huge_page(page, h->order);
+	WARN_ON(PageReserved(page));
+	prep_new_huge_page(h, page, page_to_nid(page));
+	put_page(page); /* free it into the hugepage allocator */
+
+	/*
+	 * If we had gigantic hugepages allocated at boot time, we need
+	 * to restore the 'stolen' pages to totalram_pages in order to
+	 * fix confusing memory reports from free(1) and another
+	 * side-effects, like CommitLimit going negative.
+	 */
+	if (hstate_is_gigantic(h))
+		adjust_managed_page_count(page, 1 << h->order);
+}
+
+#ifdef CONFIG_PADATA
+static void __init gather_bootmem_prealloc_chunk(unsigned long start,
+						 unsigned long end, void *arg)
+{
+	struct huge_bootmem_page **pages = arg;
+	unsigned long i;
+
+	for (i = start; i < end; i++) {
+		gather_bootmem_prealloc_page(pages[i]);
+		cond_resched();
+	}
+}
+
+/*
+ * Preparing the struct pages of a gigantic page dominates, spread the pages
+ * over all CPUs. The list lives in the huge pages themselves, so it has to be
+ * copied out before the first page is handed to the allocator.
+ */
+static bool __init gather_bootmem_prealloc_parallel(unsigned long nr)
+{
+	struct padata_mt_job job = {
+		.thread_fn   = gather_bootmem_prealloc_chunk,
+		.start       = 0,
+		.size        = nr,
+		.align       = 1,
+		.min_chunk   = 1,
+		.max_threads = num_online_cpus(),
+		.nid         = NUMA_NO_NODE,
+		.flags       = PADATA_MT_SPREAD,
+	};
+	struct huge_bootmem_page *m, **pages;
+	unsigned long i = 0;
+
+	pages = kvmalloc_array(nr, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return false;
+
+	list_for_each_entry(m, &huge_boot_pages, list)
+		pages[i++] = m;
+
+	job.fn_arg = pages;
+	padata_do_multithreaded(&job);
+
+	kvfree(pages);
+	return true;
+}
+#else
+static inline bool gather_bootmem_prealloc_parallel(unsigned long nr)
+{
+	return false;
+}
+#endif
+
 /* Put bootmem huge pages into the standard lists after mem_map is up */
 static void __init gather_bootmem_prealloc(void)
 {
 	struct huge_bootmem_page *m;
+	unsigned long nr = 0, start = jiffies;
 
-	list_for_each_entry(m, &huge_boot_pages, list) {
-		struct page *page = virt_to_page(m);
-		struct hstate *h = m->hstate;
+	list_for_each_entry(m, &huge_boot_pages, list)
+		nr++;
+	if (!nr)
+		return;
 
-		WARN_ON(page_count(page) != 1);
-		prep_compound_huge_page(page, h->order);
-		WARN_ON(PageReserved(page));
-		prep_new_huge_page(h, page, page_to_nid(page));
-		put_page(page); /* free it into the hugepage allocator */
+	if (!gather_bootmem_prealloc_parallel(nr)) {
+		list_for_each_entry(m, &huge_boot_pages, list) {
+			gather_bootmem_prealloc_page(m);
+			cond_resched();
+		}
+	}
 
-		/*
-		 * If we had gigantic hugepages allocated at boot time, we need
-		 * to restore the 'stolen' pages to totalram_pages in order to
-		 * fix confusing memory reports from free(1) and another
-		 * side-effects, like CommitLimit going negative.
-		 */
-		if (hstate_is_gigantic(h))
-			adjust_managed_page_count(page, 1 << h->order);
+	pr_info("HugeTLB: prepared %lu boot time huge pages in %ums\n",
+		nr, jiffies_to_msecs(jiffies - start));
+}
+
+#ifdef CONFIG_PADATA
+/* Nodes the boot time allocation of an hstate is spread over */
+static int hugetlb_boot_nodes[MAX_NUMNODES] __initdata;
+static int nr_hugetlb_boot_nodes __initdata;
+static nodemask_t hugetlb_boot_nodes_failed __initdata;
+
+/*
+ * Huge page i of the allocation comes from node
+ * hugetlb_boot_nodes[i * nr_hugetlb_boot_nodes / max_huge_pages], which
+ * spreads the pages evenly like the serial interleaved allocation does
+ * while each chunk mostly allocates from a single node.
+ */
+static void __init hugetlb_alloc_boot_chunk(unsigned long start,
+					    unsigned long end, void *arg)
+{
+	struct hstate *h = arg;
+	gfp_t gfp_mask = htlb_alloc_mask(h) | __GFP_THISNODE;
+	unsigned long i;
+
+	for (i = start; i < end; i++) {
+		int node = hugetlb_boot_nodes[i * nr_hugetlb_boot_nodes /
+					      h->max_huge_pages];
+		struct page *page;
+
+		/* Do not keep reclaiming and compacting a node that is full */
+		if (node_isset(node, hugetlb_boot_nodes_failed))
+			continue;
+
+		page = alloc_fresh_huge_page(h, gfp_mask, node, NULL, NULL);
+		if (page)
+			put_page(page); /* free it into the hugepage allocator */
+		else
+			node_set(node, hugetlb_boot_nodes_failed);
 		cond_resched();
 	}
 }
 
+/* Returns the number of huge pages allocated */
+static unsigned long __init hugetlb_alloc_boot_pages_parallel(struct hstate *h)
+{
+	struct padata_mt_job job = {
+		.thread_fn   = hugetlb_alloc_boot_chunk,
+		.fn_arg      = h,
+		.start       = 0,
+		.size        = h->max_huge_pages,
+		.align       = 1,
+		.min_chunk   = max(SZ_1G / huge_page_size(h), 1UL),
+		.max_threads = num_online_cpus(),
+		.nid         = NUMA_NO_NODE,
+		.flags       = PADATA_MT_SPREAD,
+	};
+	int node;
+
+	nr_hugetlb_boot_nodes = 0;
+	for_each_node_state(node, N_MEMORY)
+		hugetlb_boot_nodes[nr_hugetlb_boot_nodes++] = node;
+	nodes_clear(hugetlb_boot_nodes_failed);
+
+	padata_do_multithreaded(&job);
+
+	return h->nr_huge_pages;
+}
+#else
+static inline unsigned long
+hugetlb_alloc_boot_pages_parallel(struct hstate *h)
+{
+	return 0;
+}
+#endif
+
 static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 {
-	unsigned long i;
+	unsigned long i = 0, start = jiffies;
 	nodemask_t *node_alloc_noretry;
+	char buf[32];
 
 	if (!hstate_is_gigantic(h)) {
 		/*
@@ -2552,7 +2736,15 @@ static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 	if (node_alloc_noretry)
 		nodes_clear(*node_alloc_noretry);
 
-	for (i = 0; i < h->max_huge_pages; ++i) {
+	/*
+	 * Gigantic pages come from memblock before other CPUs are up. Spread
+	 * the others over all CPUs, and top up whatever that could not find
+	 * on the intended nodes the regular way below.
+	 */
+	if (!hstate_is_gigantic(h))
+		i = hugetlb_alloc_boot_pages_parallel(h);
+
+	for (; i < h->max_huge_pages; ++i) {
 		if (hstate_is_gigantic(h)) {
 			if (hugetlb_cma_size) {
 				pr_warn_once("HugeTLB: hugetlb_cma is enabled, skip boot time allocation\n");
@@ -2566,14 +2758,16 @@ static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 			break;
 		cond_resched();
 	}
-	if (i < h->max_huge_pages) {
-		char buf[32];
 
-		string_get_size(huge_page_size(h), 1, STRING_UNITS_2, buf, 32);
+	string_get_size(huge_page_size(h), 1, STRING_UNITS_2, buf, 32);
+	if (i < h->max_huge_pages) {
 		pr_warn("HugeTLB: allocating %lu of page size %s failed.  Only allocated %lu hugepages.\n",
 			h->max_huge_pages, buf, i);
 		h->max_huge_pages = i;
 	}
+	if (!hstate_is_gigantic(h))
+		pr_info("HugeTLB: allocated %lu hugepages of page size %s in %ums\n",
+			i, buf, jiffies_to_msecs(jiffies - start));
 
 	kfree(node_alloc_noretry);
 }
@@ -2995,12 +3189,50 @@ static ssize_t surplus_hugepages_show(struct kobject *kobj,
 }
 HSTATE_ATTR_RO(surplus_hugepages);
 
+/* Only gigantic pages are big enough to be worth clearing in parallel */
+static int hstate_max_clear_mode(struct hstate *h)
+{
+	return hstate_is_gigantic(h) ? HUGE_CLEAR_PARALLEL : HUGE_CLEAR_NOCACHE;
+}
+
+static ssize_t clear_mode_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	enum huge_clear_mode cur = READ_ONCE(h->clear_mode);
+	ssize_t len = 0;
+	int mode;
+
+	for (mode = 0; mode <= hstate_max_clear_mode(h); mode++)
+		len += sprintf(buf + len, mode == cur ? "[%s] " : "%s ",
+			       huge_clear_mode_names[mode]);
+	buf[len - 1] = '\n';
+	return len;
+}
+
+static ssize_t clear_mode_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	int mode;
+
+	mode = __sysfs_match_string(huge_clear_mode_names,
+				    hstate_max_clear_mode(h) + 1, buf);
+	if (mode < 0)
+		return mode;
+
+	WRITE_ONCE(h->clear_mode, mode);
+	return count;
+}
+HSTATE_ATTR(clear_mode);
+
 static struct attribute *hstate_attrs[] = {
 	&nr_hugepages_attr.attr,
 	&nr_overcommit_hugepages_attr.attr,
 	&free_hugepages_attr.attr,
 	&resv_hugepages_attr.attr,
 	&surplus_hugepages_attr.attr,
+	&clear_mode_attr.attr,
 #ifdef CONFIG_NUMA
 	&nr_hugepages_mempolicy_attr.attr,
 #endif
@@ -3284,6 +3516,7 @@ void __init hugetlb_add_hstate(unsigned int order)
 	h->next_nid_to_free = first_memory_node;
 	snprintf(h->name, HSTATE_NAME_LEN, "hugepages-%lukB",
 					huge_page_size(h)/1024);
+	hugetlb_vmemmap_init(h);
 
 	parsed_hstate = h;
 }
@@ -4292,6 +4525,43 @@ int huge_add_to_page_cache(struct page *page, struct address_space *mapping,
 	return 0;
 }
 
+static inline vm_fault_t hugetlb_handle_userfault(struct vm_area_struct *vma,
+						  struct address_space *mapping,
+						  pgoff_t idx,
+						  unsigned int flags,
+						  unsigned long haddr,
+						  unsigned long reason)
+{
+	vm_fault_t ret;
+	u32 hash;
+	struct vm_fault vmf = {
+		.vma = vma,
+		.address = haddr,
+		.flags = flags,
+		/*
+		 * Hard to debug if it ends up being
+		 * used by a callee that assumes
+		 * something about the other
+		 * uninitialized fields... same as in
+		 * memory.c
+		 */
+	};
+
+	/*
+	 * hugetlb_fault_mutex and i_mmap_rwsem must be
+	 * dropped before handling userfault.  Reacquire
+	 * after handling fault to make calling code simpler.
+	 */
+	hash = hugetlb_fault_mutex_hash(mapping, idx);
+	mutex_unlock(&hugetlb_fault_mutex_table[hash]);
+	i_mmap_unlock_read(mapping);
+	ret = handle_userfault(&vmf, reason);
+	i_mmap_lock_read(mapping);
+	mutex_lock(&hugetlb_fault_mutex_table[hash]);
+
+	return ret;
+}
+
 static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 			struct vm_area_struct *vma,
 			struct address_space *mapping, pgoff_t idx,
@@ -4334,31 +4604,9 @@ retry:
 		 * Check for page in userfault range
 		 */
 		if (userfaultfd_missing(vma)) {
-			u32 hash;
-			struct vm_fault vmf = {
-				.vma = vma,
-				.address = haddr,
-				.flags = flags,
-				/*
-				 * Hard to debug if it ends up being
-				 * used by a callee that assumes
-				 * something about the other
-				 * uninitialized fields... same as in
-				 * memory.c
-				 */
-			};
-
-			/*
-			 * hugetlb_fault_mutex and i_mmap_rwsem must be
-			 * dropped before handling userfault.  Reacquire
-			 * after handling fault to make calling code simpler.
-			 */
-			hash = hugetlb_fault_mutex_hash(mapping, idx);
-			mutex_unlock(&hugetlb_fault_mutex_table[hash]);
-			i_mmap_unlock_read(mapping);
-			ret = handle_userfault(&vmf, VM_UFFD_MISSING);
-			i_mmap_lock_read(mapping);
-			mutex_lock(&hugetlb_fault_mutex_table[hash]);
+			ret = hugetlb_handle_userfault(vma, mapping, idx,
+						       flags, haddr,
+						       VM_UFFD_MISSING);
 			goto out;
 		}
 
@@ -4386,7 +4634,8 @@ retry:
 			ret = vmf_error(PTR_ERR(page));
 			goto out;
 		}
-		clear_huge_page(page, address, pages_per_huge_page(h));
+		clear_huge_page(page, address, pages_per_huge_page(h),
+				READ_ONCE(h->clear_mode));
 		__SetPageUptodate(page);
 		new_page = true;
 
@@ -4417,6 +4666,16 @@ retry:
 				VM_FAULT_SET_HINDEX(hstate_index(h));
 			goto backout_unlocked;
 		}
+
+		/* Check for page in userfault range. */
+		if (userfaultfd_minor(vma)) {
+			unlock_page(page);
+			put_page(page);
+			ret = hugetlb_handle_userfault(vma, mapping, idx,
+						       flags, haddr,
+						       VM_UFFD_MINOR);
+			goto out;
+		}
 	}
 
 	/*
@@ -4666,6 +4925,7 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 			    struct vm_area_struct *dst_vma,
 			    unsigned long dst_addr,
 			    unsigned long src_addr,
+			    bool is_continue,
 			    struct page **pagep)
 {
 	struct address_space *mapping;
@@ -4677,8 +4937,17 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	spinlock_t *ptl;
 	int ret;
 	struct page *page;
+	int writable;
 
-	if (!*pagep) {
+	mapping = dst_vma->vm_file->f_mapping;
+	idx = vma_hugecache_offset(h, dst_vma, dst_addr);
+
+	if (is_continue) {
+		ret = -EFAULT;
+		page = find_lock_page(mapping, idx);
+		if (!page)
+			goto out;
+	} else if (!*pagep) {
 		ret = -ENOMEM;
 		page = alloc_huge_page(dst_vma, dst_addr, 0);
 		if (IS_ERR(page))
@@ -4707,13 +4976,8 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	 */
 	__SetPageUptodate(page);
 
-	mapping = dst_vma->vm_file->f_mapping;
-	idx = vma_hugecache_offset(h, dst_vma, dst_addr);
-
-	/*
-	 * If shared, add to page cache
-	 */
-	if (vm_shared) {
+	/* Add shared, newly allocated pages to the page cache. */
+	if (vm_shared && !is_continue) {
 		size = i_size_read(mapping->host) >> huge_page_shift(h);
 		ret = -EFAULT;
 		if (idx >= size)
@@ -4751,37 +5015,44 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	if (!huge_pte_none(huge_ptep_get(dst_pte)))
 		goto out_release_unlock;
 
-	if (vm_shared) {
+	if (vm_shared || is_continue) {
 		page_dup_rmap(page, true);
 	} else {
 		ClearPagePrivate(page);
 		hugepage_add_new_anon_rmap(page, dst_vma, dst_addr);
 	}
 
-	_dst_pte = make_huge_pte(dst_vma, page, dst_vma->vm_flags & VM_WRITE);
-	if (dst_vma->vm_flags & VM_WRITE)
+	/* For CONTINUE on a non-shared VMA, don't set VM_WRITE for CoW. */
+	if (is_continue && !vm_shared)
+		writable = 0;
+	else
+		writable = dst_vma->vm_flags & VM_WRITE;
+
+	_dst_pte = make_huge_pte(dst_vma, page, writable);
+	if (writable)
 		_dst_pte = huge_pte_mkdirty(_dst_pte);
 	_dst_pte = pte_mkyoung(_dst_pte);
 
 	set_huge_pte_at(dst_mm, dst_addr, dst_pte, _dst_pte);
 
 	(void)huge_ptep_set_access_flags(dst_vma, dst_addr, dst_pte, _dst_pte,
-					dst_vma->vm_flags & VM_WRITE);
+					writable);
 	hugetlb_count_add(pages_per_huge_page(h), dst_mm);
 
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(dst_vma, dst_addr, dst_pte);
 
 	spin_unlock(ptl);
-	set_page_huge_active(page);
-	if (vm_shared)
+	if (!is_continue)
+		set_page_huge_active(page);
+	if (vm_shared || is_continue)
 		unlock_page(page);
 	ret = 0;
 out:
 	return ret;
 out_release_unlock:
 	spin_unlock(ptl);
-	if (vm_shared)
+	if (vm_shared || is_continue)
 		unlock_page(page);
 out_release_nounlock:
 	put_page(page);
@@ -65,6 +65,14 @@ static inline void ra_submit(struct file_ra_state *ra,
 			ra->start, ra->size, ra->async_size);
 }
 
+bool page_cache_stride_update(struct address_space *mapping,
+			      struct file_ra_state *ra, pgoff_t index,
+			      bool hinted, bool cached);
+bool page_cache_stride_wants_io(struct file_ra_state *ra, pgoff_t index);
+void page_cache_stride_readahead(struct address_space *mapping,
+				 struct file_ra_state *ra, struct file *filp,
+				 pgoff_t index);
+
 /**
  * page_evictable - test whether a page is evictable
  * @page: the page to test
@@ -204,6 +212,16 @@ extern int user_min_free_kbytes;
 extern void zone_pcp_update(struct zone *zone);
 extern void zone_pcp_reset(struct zone *zone);
 
+/* Order of the pages cached in slot @slot of the pcp lists */
+static inline unsigned int pcp_slot_order(unsigned int slot)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (slot > PAGE_ALLOC_COSTLY_ORDER)
+		return HPAGE_PMD_ORDER;
+#endif
+	return slot;
+}
+
 #if defined CONFIG_COMPACTION || defined CONFIG_CMA
 
 /*
@@ -234,12 +252,14 @@ struct compact_control {
 	int migratetype;		/* migratetype of direct compactor */
 	const unsigned int alloc_flags;	/* alloc flags of a direct compactor */
 	const int highest_zoneidx;	/* zone index of a direct compactor */
+	unsigned long deadline;		/* Proactive runs stop at this jiffy */
 	enum migrate_mode mode;		/* Async or sync migration mode */
 	bool ignore_skip_hint;		/* Scan blocks even if marked skip */
 	bool no_set_skip_hint;		/* Don't mark blocks for skipping */
 	bool ignore_block_suitable;	/* Scan blocks considered unsuitable */
 	bool direct_compaction;		/* False from kcompactd or /proc/... */
 	bool proactive_compaction;	/* kcompactd proactive compaction */
+	bool proactive_throttled;	/* Proactive run hit its deadline */
 	bool whole_zone;		/* Whole zone should/has been scanned */
 	bool contended;			/* Signal lock or sched contention */
 	bool rescan;			/* Rescanning the same pageblock */
@@ -14,6 +14,7 @@
 #include <linux/freezer.h>
 #include <linux/mman.h>
 #include <linux/hashtable.h>
+#include <linux/list_sort.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/page_idle.h>
 #include <linux/swapops.h>
@@ -74,6 +75,8 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
 static unsigned int khugepaged_max_ptes_none __read_mostly;
 static unsigned int khugepaged_max_ptes_swap __read_mostly;
 static unsigned int khugepaged_max_ptes_shared __read_mostly;
+static unsigned int khugepaged_min_ptes_young __read_mostly;
+static unsigned int khugepaged_pages_to_scan_per_mm __read_mostly;
 
 #define MM_SLOTS_HASH_BITS 10
 static __read_mostly DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
@@ -87,12 +90,21 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
  * @hash: hash collision list
  * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
  * @mm: the mm that this information is valid for
+ * @address: where to resume scanning when the scan budget ran out
+ * @nr_scanned: pages scanned since khugepaged moved to this mm
+ * @nr_hot: hot PMD ranges found by the last complete scan of this mm
+ * @nr_hot_scan: hot PMD ranges found so far by the current scan
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
 
+	unsigned long address;
+	unsigned int nr_scanned;
+	unsigned int nr_hot;
+	unsigned int nr_hot_scan;
+
 	/* pte-mapped THP in this mm */
 	int nr_pte_mapped_thp;
 	unsigned long pte_mapped_thp[MAX_PTE_MAPPED_THP];
@@ -116,6 +128,25 @@ static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/**
+ * struct collapse_control - state of one scan for collapse candidates
+ * @is_khugepaged: scan done by khugepaged rather than for MADV_COLLAPSE
+ * @nr_hot: PMD ranges found with at least khugepaged_min_ptes_young
+ *	young ptes
+ * @result: SCAN_* result for the last PMD range
+ * @node_load: pages of the range found on each node
+ */
+struct collapse_control {
+	bool is_khugepaged;
+	unsigned int nr_hot;
+	int result;
+	int node_load[MAX_NUMNODES];
+};
+
+static struct collapse_control khugepaged_collapse_control = {
+	.is_khugepaged = true,
+};
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -320,11 +351,67 @@ static struct kobj_attribute khugepaged_max_ptes_shared_attr =
 	__ATTR(max_ptes_shared, 0644, khugepaged_max_ptes_shared_show,
 	       khugepaged_max_ptes_shared_store);
 
+static ssize_t khugepaged_min_ptes_young_show(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_min_ptes_young);
+}
+
+static ssize_t khugepaged_min_ptes_young_store(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       const char *buf, size_t count)
+{
+	int err;
+	unsigned long min_ptes_young;
+
+	err = kstrtoul(buf, 10, &min_ptes_young);
+	if (err || min_ptes_young > HPAGE_PMD_NR)
+		return -EINVAL;
+
+	khugepaged_min_ptes_young = min_ptes_young;
+
+	return count;
+}
+
+static struct kobj_attribute khugepaged_min_ptes_young_attr =
+	__ATTR(min_ptes_young, 0644, khugepaged_min_ptes_young_show,
+	       khugepaged_min_ptes_young_store);
+
+static ssize_t pages_to_scan_per_mm_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_to_scan_per_mm);
+}
+
+static ssize_t pages_to_scan_per_mm_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	int err;
+	unsigned long pages;
+
+	err = kstrtoul(buf, 10, &pages);
+	if (err || pages > UINT_MAX)
+		return -EINVAL;
+
+	khugepaged_pages_to_scan_per_mm = pages;
+
+	return count;
+}
+
+static struct kobj_attribute pages_to_scan_per_mm_attr =
+	__ATTR(pages_to_scan_per_mm, 0644, pages_to_scan_per_mm_show,
+	       pages_to_scan_per_mm_store);
+
 static struct attribute *khugepaged_attr[] = {
 	&khugepaged_defrag_attr.attr,
 	&khugepaged_max_ptes_none_attr.attr,
 	&khugepaged_max_ptes_swap_attr.attr,
 	&khugepaged_max_ptes_shared_attr.attr,
+	&khugepaged_min_ptes_young_attr.attr,
+	&pages_to_scan_per_mm_attr.attr,
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
 	&full_scans_attr.attr,
@@ -390,6 +477,7 @@ int __init khugepaged_init(void)
 	khugepaged_max_ptes_none = HPAGE_PMD_NR - 1;
 	khugepaged_max_ptes_swap = HPAGE_PMD_NR / 8;
 	khugepaged_max_ptes_shared = HPAGE_PMD_NR / 2;
+	khugepaged_min_ptes_young = 1;
 
 	return 0;
 }
@@ -784,9 +872,7 @@ static void khugepaged_alloc_sleep(void)
 	remove_wait_queue(&khugepaged_wait, &wait);
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(int nid, struct collapse_control *cc)
 {
 	int i;
 
@@ -798,11 +884,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (cc->node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!cc->node_load[i])
 			continue;
 		if (node_distance(nid, i) > node_reclaim_distance)
 			return true;
@@ -817,15 +903,15 @@ static inline gfp_t alloc_hugepage_khugepaged_gfpmask(void)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (cc->node_load[nid] > max_value) {
+			max_value = cc->node_load[nid];
 			target_node = nid;
 		}
 
@@ -833,7 +919,7 @@ static int khugepaged_find_target_node(void)
 	if (target_node <= last_khugepaged_target_node)
 		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == cc->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
@@ -876,7 +962,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	return 0;
 }
@@ -1028,10 +1114,10 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 	return true;
 }
 
-static void collapse_huge_page(struct mm_struct *mm,
-				   unsigned long address,
-				   struct page **hpage,
-				   int node, int referenced, int unmapped)
+static int collapse_huge_page(struct mm_struct *mm,
+			      unsigned long address,
+			      struct page **hpage,
+			      int node, int referenced, int unmapped)
 {
 	LIST_HEAD(compound_pagelist);
 	pmd_t *pmd, _pmd;
@@ -1189,7 +1275,7 @@ out_nolock:
 	if (!IS_ERR_OR_NULL(*hpage))
 		mem_cgroup_uncharge(*hpage);
 	trace_mm_collapse_huge_page(mm, isolated, result);
-	return;
+	return result;
 out:
 	goto out_up_write;
 }
@@ -1197,7 +1283,8 @@ out:
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
-			       struct page **hpage)
+			       struct page **hpage,
+			       struct collapse_control *cc)
 {
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
@@ -1217,7 +1304,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 	}
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -1284,16 +1371,16 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to cc->node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			goto out_unmap;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			goto out_unmap;
@@ -1333,10 +1420,16 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		    mmu_notifier_test_young(vma->vm_mm, address))
 			referenced++;
 	}
+	if (referenced && referenced >= khugepaged_min_ptes_young)
+		cc->nr_hot++;
 	if (!writable) {
 		result = SCAN_PAGE_RO;
 	} else if (!referenced || (unmapped && referenced < HPAGE_PMD_NR/2)) {
 		result = SCAN_LACK_REFERENCED_PAGE;
+	} else if (cc->is_khugepaged &&
+		   referenced < khugepaged_min_ptes_young) {
+		/* MADV_COLLAPSE callers know which ranges are hot */
+		result = SCAN_LACK_REFERENCED_PAGE;
 	} else {
 		result = SCAN_SUCCEED;
 		ret = 1;
@@ -1344,17 +1437,40 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(cc);
 		/* collapse_huge_page will return with the mmap_lock released */
-		collapse_huge_page(mm, address, hpage, node,
-				referenced, unmapped);
+		cc->result = collapse_huge_page(mm, address, hpage, node,
+						referenced, unmapped);
 	}
 out:
+	if (!ret)
+		cc->result = result;
 	trace_mm_khugepaged_scan_pmd(mm, page, writable, referenced,
 				     none_or_zero, result, unmapped);
 	return ret;
 }
 
+static int mm_slot_hot_cmp(void *priv, struct list_head *a,
+			   struct list_head *b)
+{
+	struct mm_slot *slot_a = list_entry(a, struct mm_slot, mm_node);
+	struct mm_slot *slot_b = list_entry(b, struct mm_slot, mm_node);
+
+	return slot_b->nr_hot > slot_a->nr_hot;
+}
+
+/*
+ * Order the mm list so that the next full scan visits the mms with the
+ * most hot PMD ranges first. Every mm is still visited once per full scan,
+ * only the order changes.
+ */
+static void khugepaged_sort_mm_slots(void)
+{
+	lockdep_assert_held(&khugepaged_mm_lock);
+
+	list_sort(NULL, &khugepaged_scan.mm_head, mm_slot_hot_cmp);
+}
+
 static void collect_mm_slot(struct mm_slot *mm_slot)
 {
 	struct mm_struct *mm = mm_slot->mm;
@@ -1833,7 +1949,8 @@ out_unlock:
 		__inc_node_page_state(new_page, NR_SHMEM_THPS);
 	else {
 		__inc_node_page_state(new_page, NR_FILE_THPS);
-		filemap_nr_thps_inc(mapping);
+		if (!mapping_large_pages(mapping))
+			filemap_nr_thps_inc(mapping);
 	}
 
 	if (nr_none) {
@@ -1938,7 +2055,8 @@ out:
 }
 
 static void khugepaged_scan_file(struct mm_struct *mm,
-		struct file *file, pgoff_t start, struct page **hpage)
+		struct file *file, pgoff_t start, struct page **hpage,
+		struct collapse_control *cc)
 {
 	struct page *page = NULL;
 	struct address_space *mapping = file->f_mapping;
@@ -1949,7 +2067,7 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 
 	present = 0;
 	swap = 0;
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	rcu_read_lock();
 	xas_for_each(&xas, page, start + HPAGE_PMD_NR - 1) {
 		if (xas_retry(&xas, page))
@@ -1969,11 +2087,11 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 		}
 
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			break;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
@@ -2005,7 +2123,7 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
-			node = khugepaged_find_target_node();
+			node = khugepaged_find_target_node(cc);
 			collapse_file(mm, file, start, hpage, node);
 		}
 	}
@@ -2014,7 +2132,8 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 }
 #else
 static void khugepaged_scan_file(struct mm_struct *mm,
-		struct file *file, pgoff_t start, struct page **hpage)
+		struct file *file, pgoff_t start, struct page **hpage,
+		struct collapse_control *cc)
 {
 	BUILD_BUG();
 }
@@ -2030,9 +2149,12 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
 {
+	struct collapse_control *cc = &khugepaged_collapse_control;
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
+	unsigned int budget = UINT_MAX;
+	bool over_budget = false;
 	int progress = 0;
 
 	VM_BUG_ON(!pages);
@@ -2043,10 +2165,15 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	else {
 		mm_slot = list_entry(khugepaged_scan.mm_head.next,
 				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
+		khugepaged_scan.address = mm_slot->address;
 		khugepaged_scan.mm_slot = mm_slot;
 	}
+	if (khugepaged_pages_to_scan_per_mm)
+		budget = khugepaged_pages_to_scan_per_mm -
+			 min(mm_slot->nr_scanned,
+			     khugepaged_pages_to_scan_per_mm);
 	spin_unlock(&khugepaged_mm_lock);
+	cc->nr_hot = 0;
 	khugepaged_collapse_pte_mapped_thps(mm_slot);
 
 	mm = mm_slot->mm;
@@ -2102,20 +2229,23 @@ skip:
 
 				mmap_read_unlock(mm);
 				ret = 1;
-				khugepaged_scan_file(mm, file, pgoff, hpage);
+				khugepaged_scan_file(mm, file, pgoff, hpage,
+						     cc);
 				fput(file);
 			} else {
 				ret = khugepaged_scan_pmd(mm, vma,
 						khugepaged_scan.address,
-						hpage);
+						hpage, cc);
 			}
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
+			if (progress >= budget)
+				over_budget = true;
 			if (ret)
 				/* we released mmap_lock so break loop */
 				goto breakouterloop_mmap_lock;
-			if (progress >= pages)
+			if (progress >= pages || over_budget)
 				goto breakouterloop;
 		}
 	}
@@ -2125,11 +2255,23 @@ breakouterloop_mmap_lock:
 
 	spin_lock(&khugepaged_mm_lock);
 	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	mm_slot->nr_scanned += progress;
+	mm_slot->nr_hot_scan += cc->nr_hot;
 	/*
 	 * Release the current mm_slot if this mm is about to die, or
-	 * if we scanned all vmas of this mm.
+	 * if we scanned all vmas of this mm. If it only used up its scan
+	 * budget, move on and resume from the same address next time.
 	 */
-	if (khugepaged_test_exit(mm) || !vma) {
+	if (khugepaged_test_exit(mm) || !vma || over_budget) {
+		if (vma) {
+			mm_slot->address = khugepaged_scan.address;
+		} else {
+			mm_slot->address = 0;
+			mm_slot->nr_hot = mm_slot->nr_hot_scan;
+			mm_slot->nr_hot_scan = 0;
+		}
+		mm_slot->nr_scanned = 0;
+
 		/*
 		 * Make sure that if mm_users is reaching zero while
 		 * khugepaged runs here, khugepaged_exit will find
@@ -2139,10 +2281,12 @@ breakouterloop_mmap_lock:
 			khugepaged_scan.mm_slot = list_entry(
 				mm_slot->mm_node.next,
 				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
+			khugepaged_scan.address =
+				khugepaged_scan.mm_slot->address;
 		} else {
 			khugepaged_scan.mm_slot = NULL;
 			khugepaged_full_scans++;
+			khugepaged_sort_mm_slots();
 		}
 
 		collect_mm_slot(mm_slot);
@@ -2320,3 +2464,90 @@ fail:
 	mutex_unlock(&khugepaged_mutex);
 	return err;
 }
+
+/**
+ * madvise_collapse - collapse a range into huge pages right away
+ * @vma: the vma containing the range
+ * @prev: set to NULL to tell madvise that mmap_lock was dropped
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Does what khugepaged would do for every PMD sized range between @start
+ * and @end, without waiting for khugepaged to get there and without
+ * asking for the ranges to be young. Only anonymous memory that
+ * khugepaged may collapse is handled. Called and returns with mmap_lock
+ * held for read.
+ *
+ * Return: 0 if every range was collapsed or had nothing to collapse,
+ * -ENOMEM if no huge page could be allocated or charged, -EAGAIN if some
+ * ranges could not be collapsed and -EINVAL for an ineligible vma.
+ */
+int madvise_collapse(struct vm_area_struct *vma, struct vm_area_struct **prev,
+		     unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct collapse_control *cc;
+	unsigned long hstart, hend, addr;
+	struct page *hpage = NULL;
+	int ret = 0;
+
+	*prev = vma;
+	if (vma->vm_file || !hugepage_vma_check(vma, vma->vm_flags))
+		return -EINVAL;
+
+	hstart = (start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	hend = end & HPAGE_PMD_MASK;
+	if (hstart >= hend)
+		return 0;
+
+	cc = kmalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc)
+		return -ENOMEM;
+	cc->is_khugepaged = false;
+
+	lru_add_drain();
+
+	for (addr = hstart; addr < hend; addr += HPAGE_PMD_SIZE) {
+		bool wait = false;
+
+		cond_resched();
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		if (!khugepaged_prealloc_page(&hpage, &wait)) {
+			ret = -ENOMEM;
+			break;
+		}
+		/* The vma may have changed while mmap_lock was dropped */
+		if (!*prev && hugepage_vma_revalidate(mm, addr, &vma)) {
+			ret = -EAGAIN;
+			break;
+		}
+
+		if (khugepaged_scan_pmd(mm, vma, addr, &hpage, cc)) {
+			/* collapse_huge_page() released mmap_lock */
+			*prev = NULL;
+			mmap_read_lock(mm);
+		}
+
+		switch (cc->result) {
+		case SCAN_SUCCEED:
+		case SCAN_PMD_NULL:
+			break;
+		case SCAN_ALLOC_HUGE_PAGE_FAIL:
+		case SCAN_CGROUP_CHARGE_FAIL:
+			ret = -ENOMEM;
+			goto out;
+		default:
+			ret = -EAGAIN;
+			break;
+		}
+	}
+out:
+	if (!IS_ERR_OR_NULL(hpage))
+		put_page(hpage);
+	kfree(cc);
+
+	return ret;
+}
@@ -108,36 +108,53 @@
  *
  * If the merge_across_nodes tunable is unset, then KSM maintains multiple
  * stable trees and multiple unstable trees: one of each for each NUMA node.
+ * Unless the node_scanners tunable is unset, each node then has its own
+ * scanner thread (ksmd for the first, "ksmd/<nid>" for the others), which is
+ * the only one to touch that node's trees: a page is left to the scanner of
+ * the tree it is in (KSM pages), or would be inserted into (the node it is
+ * on). Every scanner walks its own list of mm_slots with its own cursor and
+ * rmap_items.
  */
 
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list, rooted in the scanner's mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @nid: the scanner this mm_slot belongs to
+ *
+ * Every mm being scanned has one mm_slot for each scanner, see ksm_scan.
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	int nid;
 };
 
 /**
  * struct ksm_scan - cursor for scanning
+ * @mm_head: head of the list of mm_slots of this scanner
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
  * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @nid: the NUMA node whose pages this scanner merges
+ * @thread: the ksmd thread running this scanner
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is one ksm_scan instance of this cursor structure for each NUMA
+ * node; all but the first are idle when merging across nodes.
  */
 struct ksm_scan {
+	struct mm_slot mm_head;
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
 	unsigned long seqnr;
+	int nid;
+	struct task_struct *thread;
 };
 
 /**
@@ -231,34 +248,30 @@ static LIST_HEAD(migrate_nodes);
 #define MM_SLOTS_HASH_BITS 10
 static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+static struct ksm_scan *ksm_scans;
+static int ksm_nr_scans = 1;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
 
 /* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
+static atomic_long_t ksm_pages_shared;
 
 /* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
+static atomic_long_t ksm_pages_sharing;
 
 /* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
+static atomic_long_t ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items;
 
 /* The number of stable_node chains */
-static unsigned long ksm_stable_node_chains;
+static atomic_long_t ksm_stable_node_chains;
 
 /* The number of stable_node dups linked to the stable_node chains */
-static unsigned long ksm_stable_node_dups;
+static atomic_long_t ksm_stable_node_dups;
 
 /* Delay in pruning stale stable_node_dups in the stable_node_chains */
 static int ksm_stable_node_chains_prune_millisecs = 2000;
@@ -266,7 +279,7 @@ static int ksm_stable_node_chains_prune_millisecs = 2000;
 /* Maximum number of page slots sharing a stable node */
 static int ksm_max_page_sharing = 256;
 
-/* Number of pages ksmd should scan in one batch */
+/* Number of pages each ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
 /* Milliseconds ksmd should sleep between batches */
@@ -282,6 +295,9 @@ static bool ksm_use_zero_pages __read_mostly;
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
 static int ksm_nr_node_ids = 1;
+
+/* Whether each node gets its own ksmd when not merging across nodes */
+static bool ksm_node_scanners = true;
 #else
 #define ksm_merge_across_nodes	1U
 #define ksm_nr_node_ids		1
@@ -296,7 +312,8 @@ static void wait_while_offlining(void);
 
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
 static DECLARE_WAIT_QUEUE_HEAD(ksm_iter_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+/* Held for read by the ksmds while scanning, for write to exclude them */
+static DECLARE_RWSEM(ksm_thread_sem);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -352,14 +369,14 @@ static inline void stable_node_chain_add_dup(struct stable_node *dup,
 	dup->head = STABLE_NODE_DUP_HEAD;
 	VM_BUG_ON(!is_stable_node_chain(chain));
 	hlist_add_head(&dup->hlist_dup, &chain->hlist);
-	ksm_stable_node_dups++;
+	atomic_long_inc(&ksm_stable_node_dups);
 }
 
 static inline void __stable_node_dup_del(struct stable_node *dup)
 {
 	VM_BUG_ON(!is_stable_node_dup(dup));
 	hlist_del(&dup->hlist_dup);
-	ksm_stable_node_dups--;
+	atomic_long_dec(&ksm_stable_node_dups);
 }
 
 static inline void stable_node_dup_del(struct stable_node *dup)
@@ -381,13 +398,14 @@ static inline struct rmap_item *alloc_rmap_item(void)
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL |
 						__GFP_NORETRY | __GFP_NOWARN);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
+	atomic_long_dec(&rmap_item->mm->ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -421,12 +439,13 @@ static inline void free_mm_slot(struct mm_slot *mm_slot)
 	kmem_cache_free(mm_slot_cache, mm_slot);
 }
 
-static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+/* Any scanner's mm_slot for @mm when @nid is NUMA_NO_NODE */
+static struct mm_slot *get_mm_slot(struct mm_struct *mm, int nid)
 {
 	struct mm_slot *slot;
 
 	hash_for_each_possible(mm_slots_hash, slot, link, (unsigned long)mm)
-		if (slot->mm == mm)
+		if (slot->mm == mm && (nid == NUMA_NO_NODE || slot->nid == nid))
 			return slot;
 
 	return NULL;
@@ -439,6 +458,15 @@ static void insert_to_mm_slots_hash(struct mm_struct *mm,
 	hash_add(mm_slots_hash, &mm_slot->link, (unsigned long)mm);
 }
 
+/*
+ * The scanner in charge of the stable and unstable trees of node @nid,
+ * as returned by get_kpfn_nid().
+ */
+static inline struct ksm_scan *ksm_tree_scan(int nid)
+{
+	return &ksm_scans[ksm_nr_scans > 1 ? nid : 0];
+}
+
 /*
  * ksmd, and unmerge_and_remove_all_rmap_items(), must not touch an mm's
  * page tables after it has passed through ksm_exit() - which, if necessary,
@@ -600,7 +628,7 @@ static struct stable_node *alloc_stable_node_chain(struct stable_node *dup,
 #if defined (CONFIG_DEBUG_VM) && defined(CONFIG_NUMA)
 		chain->nid = NUMA_NO_NODE; /* debug */
 #endif
-		ksm_stable_node_chains++;
+		atomic_long_inc(&ksm_stable_node_chains);
 
 		/*
 		 * Put the stable node chain in the first dimension of
@@ -626,7 +654,7 @@ static inline void free_stable_node_chain(struct stable_node *chain,
 {
 	rb_erase(&chain->node, root);
 	free_stable_node(chain);
-	ksm_stable_node_chains--;
+	atomic_long_dec(&ksm_stable_node_chains);
 }
 
 static void remove_node_from_stable_tree(struct stable_node *stable_node)
@@ -638,9 +666,10 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 
 	hlist_for_each_entry(rmap_item, &stable_node->hlist, hlist) {
 		if (rmap_item->hlist.next)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
+		atomic_long_dec(&rmap_item->mm->ksm_merging_pages);
 		VM_BUG_ON(stable_node->rmap_hlist_len <= 0);
 		stable_node->rmap_hlist_len--;
 		put_anon_vma(rmap_item->anon_vma);
@@ -787,9 +816,10 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		put_page(page);
 
 		if (!hlist_empty(&stable_node->hlist))
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
+		atomic_long_dec(&rmap_item->mm->ksm_merging_pages);
 		VM_BUG_ON(stable_node->rmap_hlist_len <= 0);
 		stable_node->rmap_hlist_len--;
 
@@ -805,12 +835,13 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_tree_scan(NUMA(rmap_item->nid))->seqnr -
+				      rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
 			rb_erase(&rmap_item->node,
 				 root_unstable_tree + NUMA(rmap_item->nid));
-		ksm_pages_unshared--;
+		atomic_long_dec(&ksm_pages_unshared);
 		rmap_item->address &= PAGE_MASK;
 	}
 out:
@@ -869,6 +900,47 @@ static inline void set_page_stable_node(struct page *page,
 	page->mapping = (void *)((unsigned long)stable_node | PAGE_MAPPING_KSM);
 }
 
+/*
+ * The scanner that @page is left to: with one ksmd for each node, that of
+ * the tree the page is in if it is a ksm page, or of the tree it would be
+ * inserted into otherwise. That way each tree is only touched by one ksmd.
+ */
+static int page_scan_nid(struct page *page)
+{
+	struct stable_node *stable_node;
+
+	if (ksm_nr_scans == 1)
+		return 0;
+
+	stable_node = page_stable_node(page);
+	if (stable_node) {
+		smp_rmb();	/* see stable_tree_insert() */
+		return NUMA(READ_ONCE(stable_node->nid));
+	}
+	return get_kpfn_nid(page_to_pfn(page));
+}
+
+/*
+ * Called with ksm_mmlist_lock held, returns with it released: @mm_slot is
+ * freed, and @mm is no longer scanned by any ksmd once that was its last
+ * mm_slot.
+ */
+static void remove_mm_slot(struct mm_slot *mm_slot)
+	__releases(&ksm_mmlist_lock)
+{
+	struct mm_struct *mm = mm_slot->mm;
+	bool last;
+
+	hash_del(&mm_slot->link);
+	list_del(&mm_slot->mm_list);
+	last = !get_mm_slot(mm, NUMA_NO_NODE);
+	spin_unlock(&ksm_mmlist_lock);
+
+	free_mm_slot(mm_slot);
+	if (last)
+		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
+}
+
 #ifdef CONFIG_SYSFS
 /*
  * Only called through the sysfs control interface:
@@ -964,58 +1036,60 @@ static int remove_all_stable_nodes(void)
 
 static int unmerge_and_remove_all_rmap_items(void)
 {
+	struct ksm_scan *scan;
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
-	int err = 0;
-
-	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
-						struct mm_slot, mm_list);
-	spin_unlock(&ksm_mmlist_lock);
+	int nid, err = 0;
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
-		mm = mm_slot->mm;
-		mmap_read_lock(mm);
-		for (vma = mm->mmap; vma; vma = vma->vm_next) {
-			if (ksm_test_exit(mm))
-				break;
-			if (!(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
-				continue;
-			err = unmerge_ksm_pages(vma,
-						vma->vm_start, vma->vm_end);
-			if (err)
-				goto error;
-		}
-
-		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
-		mmap_read_unlock(mm);
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		scan = &ksm_scans[nid];
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
-						struct mm_slot, mm_list);
-		if (ksm_test_exit(mm)) {
-			hash_del(&mm_slot->link);
-			list_del(&mm_slot->mm_list);
-			spin_unlock(&ksm_mmlist_lock);
+		scan->mm_slot = list_entry(scan->mm_head.mm_list.next,
+					   struct mm_slot, mm_list);
+		spin_unlock(&ksm_mmlist_lock);
 
-			free_mm_slot(mm_slot);
-			clear_bit(MMF_VM_MERGEABLE, &mm->flags);
-			mmdrop(mm);
-		} else
-			spin_unlock(&ksm_mmlist_lock);
+		for (mm_slot = scan->mm_slot; mm_slot != &scan->mm_head;
+		     mm_slot = scan->mm_slot) {
+			mm = mm_slot->mm;
+			mmap_read_lock(mm);
+			/* Breaking COW once, from the first ksmd's slots, is enough */
+			for (vma = nid ? NULL : mm->mmap; vma; vma = vma->vm_next) {
+				if (ksm_test_exit(mm))
+					break;
+				if (!(vma->vm_flags & VM_MERGEABLE) ||
+				    !vma->anon_vma)
+					continue;
+				err = unmerge_ksm_pages(vma,
+							vma->vm_start, vma->vm_end);
+				if (err)
+					goto error;
+			}
+
+			remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
+			mmap_read_unlock(mm);
+
+			spin_lock(&ksm_mmlist_lock);
+			scan->mm_slot = list_entry(mm_slot->mm_list.next,
+						   struct mm_slot, mm_list);
+			if (ksm_test_exit(mm)) {
+				remove_mm_slot(mm_slot);
+				mmdrop(mm);
+			} else
+				spin_unlock(&ksm_mmlist_lock);
+		}
+		scan->seqnr = 0;
 	}
 
 	/* Clean up stable nodes, but don't worry if some are still busy */
 	remove_all_stable_nodes();
-	ksm_scan.seqnr = 0;
 	return 0;
 
 error:
 	mmap_read_unlock(mm);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	scan->mm_slot = &scan->mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
@@ -1429,8 +1503,8 @@ static struct page *stable_node_dup(struct stable_node **_stable_node_dup,
 			rb_replace_node(&stable_node->node, &found->node,
 					root);
 			free_stable_node(stable_node);
-			ksm_stable_node_chains--;
-			ksm_stable_node_dups--;
+			atomic_long_dec(&ksm_stable_node_chains);
+			atomic_long_dec(&ksm_stable_node_dups);
 			/*
 			 * NOTE: the caller depends on the stable_node
 			 * to be equal to stable_node_dup if the chain
@@ -1690,6 +1764,13 @@ again:
 			if (get_kpfn_nid(stable_node_dup->kpfn) !=
 			    NUMA(stable_node_dup->nid)) {
 				put_page(tree_page);
+				/*
+				 * The tree of the node it migrated to is
+				 * another ksmd's: leave it here, just don't
+				 * merge more pages of this node with it.
+				 */
+				if (ksm_nr_scans > 1)
+					return NULL;
 				goto replace;
 			}
 			return tree_page;
@@ -1884,9 +1965,11 @@ again:
 
 	INIT_HLIST_HEAD(&stable_node_dup->hlist);
 	stable_node_dup->kpfn = kpfn;
-	set_page_stable_node(kpage, stable_node_dup);
 	stable_node_dup->rmap_hlist_len = 0;
+	/* Set before kpage can be seen as ksm page, see page_scan_nid() */
 	DO_NUMA(stable_node_dup->nid = nid);
+	smp_wmb();
+	set_page_stable_node(kpage, stable_node_dup);
 	if (!need_chain) {
 		rb_link_node(&stable_node_dup->node, parent, new);
 		rb_insert_color(&stable_node_dup->node, root);
@@ -1978,12 +2061,12 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_tree_scan(nid)->seqnr & SEQNR_MASK);
 	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
 	rb_insert_color(&rmap_item->node, root);
 
-	ksm_pages_unshared++;
+	atomic_long_inc(&ksm_pages_unshared);
 	return NULL;
 }
 
@@ -2019,9 +2102,10 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
-		ksm_pages_sharing++;
+		atomic_long_inc(&ksm_pages_sharing);
 	else
-		ksm_pages_shared++;
+		atomic_long_inc(&ksm_pages_shared);
+	atomic_long_inc(&rmap_item->mm->ksm_merging_pages);
 }
 
 /*
@@ -2046,7 +2130,9 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 
 	stable_node = page_stable_node(page);
 	if (stable_node) {
-		if (stable_node->head != &migrate_nodes &&
+		/* Only a single ksmd moves nodes between trees */
+		if (ksm_nr_scans == 1 &&
+		    stable_node->head != &migrate_nodes &&
 		    get_kpfn_nid(READ_ONCE(stable_node->kpfn)) !=
 		    NUMA(stable_node->nid)) {
 			stable_node_dup_del(stable_node);
@@ -2215,6 +2301,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	if (rmap_item) {
 		/* It has already been zeroed */
 		rmap_item->mm = mm_slot->mm;
+		atomic_long_inc(&mm_slot->mm->ksm_rmap_items);
 		rmap_item->address = addr;
 		rmap_item->rmap_list = *rmap_list;
 		*rmap_list = rmap_item;
@@ -2222,7 +2309,30 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * An mm whose ksm_scan_interval is n only gets scanned on every n-th full
+ * scan. Its unstable rmap_items go out of the unstable tree when it is
+ * skipped, as that is about to be rebuilt without them.
+ */
+static bool skip_mm_slot(struct ksm_scan *scan, struct mm_slot *slot)
+{
+	unsigned int interval = READ_ONCE(slot->mm->ksm_scan_interval);
+	struct rmap_item *rmap_item;
+
+	if (interval <= 1 || !(scan->seqnr % interval) ||
+	    ksm_test_exit(slot->mm))
+		return false;
+
+	for (rmap_item = slot->rmap_list; rmap_item;
+	     rmap_item = rmap_item->rmap_list) {
+		if (rmap_item->address & UNSTABLE_FLAG)
+			remove_rmap_item_from_tree(rmap_item);
+	}
+	return true;
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *scan,
+						 struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
@@ -2230,11 +2340,11 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	struct rmap_item *rmap_item;
 	int nid;
 
-	if (list_empty(&ksm_mm_head.mm_list))
+	if (list_empty(&scan->mm_head.mm_list))
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
+	slot = scan->mm_slot;
+	if (slot == &scan->mm_head) {
 		/*
 		 * A number of pages can hang around indefinitely on per-cpu
 		 * pagevecs, raised page count preventing write_protect_page
@@ -2253,7 +2363,7 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 * those moved out to the migrate_nodes list can accumulate:
 		 * so prune them once before each full scan.
 		 */
-		if (!ksm_merge_across_nodes) {
+		if (!ksm_merge_across_nodes && ksm_nr_scans == 1) {
 			struct stable_node *stable_node, *next;
 			struct page *page;
 
@@ -2267,22 +2377,38 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 			}
 		}
 
-		for (nid = 0; nid < ksm_nr_node_ids; nid++)
-			root_unstable_tree[nid] = RB_ROOT;
+		if (ksm_nr_scans > 1)
+			root_unstable_tree[scan->nid] = RB_ROOT;
+		else
+			for (nid = 0; nid < ksm_nr_node_ids; nid++)
+				root_unstable_tree[nid] = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/*
 		 * Although we tested list_empty() above, a racing __ksm_exit
 		 * of the last mm on the list may have removed it since then.
 		 */
-		if (slot == &ksm_mm_head)
+		if (slot == &scan->mm_head)
 			return NULL;
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
+
+		/* The mm_slot at the cursor cannot be freed under us */
+		if (skip_mm_slot(scan, slot)) {
+			spin_lock(&ksm_mmlist_lock);
+			slot = list_entry(slot->mm_list.next,
+					  struct mm_slot, mm_list);
+			scan->mm_slot = slot;
+			spin_unlock(&ksm_mmlist_lock);
+			if (slot != &scan->mm_head)
+				goto next_mm;
+			scan->seqnr++;
+			return NULL;
+		}
 	}
 
 	mm = slot->mm;
@@ -2290,59 +2416,60 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
-			if (PageAnon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+			/* Pages of other nodes are left to their own ksmd */
+			if (PageAnon(*page) && page_scan_nid(*page) == scan->nid) {
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+					scan->rmap_list, scan->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				mmap_read_unlock(mm);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	remove_trailing_rmap_items(slot, scan->rmap_list);
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+	scan->mm_slot = list_entry(slot->mm_list.next,
 						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_lock
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -2352,12 +2479,7 @@ next_mm:
 		 * or when all VM_MERGEABLE areas have been unmapped (and
 		 * mmap_lock then protects against race with MADV_MERGEABLE).
 		 */
-		hash_del(&slot->link);
-		list_del(&slot->mm_list);
-		spin_unlock(&ksm_mmlist_lock);
-
-		free_mm_slot(slot);
-		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
+		remove_mm_slot(slot);
 		mmap_read_unlock(mm);
 		mmdrop(mm);
 	} else {
@@ -2367,32 +2489,33 @@ next_mm:
 		 * spin_unlock(&ksm_mmlist_lock) run, the "mm" may
 		 * already have been freed under us by __ksm_exit()
 		 * because the "mm_slot" is still hashed and
-		 * ksm_scan.mm_slot doesn't point to it anymore.
+		 * scan->mm_slot doesn't point to it anymore.
 		 */
 		spin_unlock(&ksm_mmlist_lock);
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = scan->mm_slot;
+	if (slot != &scan->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	scan->seqnr++;
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @scan:	  the ksmd's scanning state.
  * @scan_npages:  number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_scan *scan, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *page;
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(scan, &page);
 		if (!rmap_item)
 			return;
 		cmp_and_merge_page(page, rmap_item);
@@ -2400,40 +2523,68 @@ static void ksm_do_scan(unsigned int scan_npages)
 	}
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_scan *scan)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return scan->nid < ksm_nr_scans && (ksm_run & KSM_RUN_MERGE) &&
+	       !list_empty(&scan->mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_scan *scan = data;
 	unsigned int sleep_ms;
 
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		/* While memory is going offline, just retry after a sleep */
+		down_read(&ksm_thread_sem);
+		if (!(ksm_run & KSM_RUN_OFFLINE) && ksmd_should_run(scan))
+			ksm_do_scan(scan, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
+		if (ksmd_should_run(scan)) {
 			sleep_ms = READ_ONCE(ksm_thread_sleep_millisecs);
 			wait_event_interruptible_timeout(ksm_iter_wait,
 				sleep_ms != READ_ONCE(ksm_thread_sleep_millisecs),
 				msecs_to_jiffies(sleep_ms));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(scan) || kthread_should_stop());
 		}
 	}
 	return 0;
 }
 
+/*
+ * Start the ksmd for @scan if it is not running yet: all but the first are
+ * kept on the cpus of the node they scan for.
+ */
+static int ksm_start_scan(struct ksm_scan *scan)
+{
+	struct task_struct *thread;
+
+	if (scan->thread)
+		return 0;
+
+	if (scan->nid)
+		thread = kthread_create_on_node(ksm_scan_thread, scan, scan->nid,
+						"ksmd/%d", scan->nid);
+	else
+		thread = kthread_create(ksm_scan_thread, scan, "ksmd");
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+
+	if (scan->nid && !cpumask_empty(cpumask_of_node(scan->nid)))
+		set_cpus_allowed_ptr(thread, cpumask_of_node(scan->nid));
+	scan->thread = thread;
+	wake_up_process(thread);
+	return 0;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -2458,11 +2609,9 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 			return 0;
 #endif
 
-		if (!test_bit(MMF_VM_MERGEABLE, &mm->flags)) {
-			err = __ksm_enter(mm);
-			if (err)
-				return err;
-		}
+		err = __ksm_enter(mm);
+		if (err)
+			return err;
 
 		*vm_flags |= VM_MERGEABLE;
 		break;
@@ -2487,36 +2636,56 @@ EXPORT_SYMBOL_GPL(ksm_madvise);
 
 int __ksm_enter(struct mm_struct *mm)
 {
-	struct mm_slot *mm_slot;
-	int needs_wakeup;
-
-	mm_slot = alloc_mm_slot();
-	if (!mm_slot)
-		return -ENOMEM;
-
-	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	struct mm_slot *mm_slot = NULL;
+	bool needs_wakeup = false;
+	int nid;
 
-	spin_lock(&ksm_mmlist_lock);
-	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
-	 * When KSM_RUN_MERGE (or KSM_RUN_STOP),
-	 * insert just behind the scanning cursor, to let the area settle
-	 * down a little; when fork is followed by immediate exec, we don't
-	 * want ksmd to waste time setting up and tearing down an rmap_list.
-	 *
-	 * But when KSM_RUN_UNMERGE, it's important to insert ahead of its
-	 * scanning cursor, otherwise KSM pages in newly forked mms will be
-	 * missed: then we might as well insert at the end of the list.
+	 * Every ksmd gets its own mm_slot: a ksmd which found no VM_MERGEABLE
+	 * pages for it may have dropped its one, so add back any missing.
 	 */
-	if (ksm_run & KSM_RUN_UNMERGE)
-		list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
-	else
-		list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
-	spin_unlock(&ksm_mmlist_lock);
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		struct ksm_scan *scan = &ksm_scans[nid];
+
+		if (!mm_slot) {
+			mm_slot = alloc_mm_slot();
+			if (!mm_slot)
+				return -ENOMEM;
+		}
 
-	set_bit(MMF_VM_MERGEABLE, &mm->flags);
-	mmgrab(mm);
+		spin_lock(&ksm_mmlist_lock);
+		if (get_mm_slot(mm, nid)) {
+			spin_unlock(&ksm_mmlist_lock);
+			continue;
+		}
+		/* Check ksm_run too?  Would need tighter locking */
+		if (list_empty(&scan->mm_head.mm_list))
+			needs_wakeup = true;
+		mm_slot->nid = nid;
+		insert_to_mm_slots_hash(mm, mm_slot);
+		/*
+		 * When KSM_RUN_MERGE (or KSM_RUN_STOP),
+		 * insert just behind the scanning cursor, to let the area settle
+		 * down a little; when fork is followed by immediate exec, we don't
+		 * want ksmd to waste time setting up and tearing down an rmap_list.
+		 *
+		 * But when KSM_RUN_UNMERGE, it's important to insert ahead of its
+		 * scanning cursor, otherwise KSM pages in newly forked mms will be
+		 * missed: then we might as well insert at the end of the list.
+		 */
+		if (ksm_run & KSM_RUN_UNMERGE)
+			list_add_tail(&mm_slot->mm_list, &scan->mm_head.mm_list);
+		else
+			list_add_tail(&mm_slot->mm_list, &scan->mm_slot->mm_list);
+		spin_unlock(&ksm_mmlist_lock);
+
+		set_bit(MMF_VM_MERGEABLE, &mm->flags);
+		mmgrab(mm);
+		mm_slot = NULL;
+	}
+
+	if (mm_slot)
+		free_mm_slot(mm_slot);
 
 	if (needs_wakeup)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -2527,7 +2696,8 @@ int __ksm_enter(struct mm_struct *mm)
 void __ksm_exit(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
-	int easy_to_free = 0;
+	bool busy = false;
+	int nid;
 
 	/*
 	 * This process is exiting: if it's straightforward (as is the
@@ -2537,26 +2707,35 @@ void __ksm_exit(struct mm_struct *mm)
 	 * are freed, and leave the mm_slot on the list for ksmd to free.
 	 * Beware: ksm may already have noticed it exiting and freed the slot.
 	 */
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		struct ksm_scan *scan = &ksm_scans[nid];
+		int easy_to_free = 0;
 
-	spin_lock(&ksm_mmlist_lock);
-	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
-		if (!mm_slot->rmap_list) {
-			hash_del(&mm_slot->link);
-			list_del(&mm_slot->mm_list);
-			easy_to_free = 1;
-		} else {
-			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+		spin_lock(&ksm_mmlist_lock);
+		mm_slot = get_mm_slot(mm, nid);
+		if (mm_slot && scan->mm_slot != mm_slot) {
+			if (!mm_slot->rmap_list) {
+				hash_del(&mm_slot->link);
+				list_del(&mm_slot->mm_list);
+				easy_to_free = 1;
+			} else {
+				list_move(&mm_slot->mm_list,
+					  &scan->mm_slot->mm_list);
+			}
+		}
+		spin_unlock(&ksm_mmlist_lock);
+
+		if (easy_to_free) {
+			free_mm_slot(mm_slot);
+			mmdrop(mm);
+		} else if (mm_slot) {
+			busy = true;
 		}
 	}
-	spin_unlock(&ksm_mmlist_lock);
 
-	if (easy_to_free) {
-		free_mm_slot(mm_slot);
+	if (!busy) {
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
-		mmdrop(mm);
-	} else if (mm_slot) {
+	} else {
 		mmap_write_lock(mm);
 		mmap_write_unlock(mm);
 	}
@@ -2711,10 +2890,10 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 static void wait_while_offlining(void)
 {
 	while (ksm_run & KSM_RUN_OFFLINE) {
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
 			    TASK_UNINTERRUPTIBLE);
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 	}
 }
 
@@ -2801,11 +2980,11 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * and remove_all_stable_nodes() while memory is going offline:
 		 * it is unsafe for them to touch the stable tree at this time.
 		 * But unmerge_ksm_pages(), rmap lookups and other entry points
-		 * which do not need the ksm_thread_mutex are all safe.
+		 * which do not need the ksm_thread_sem are all safe.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run |= KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
@@ -2820,9 +2999,9 @@ static int ksm_memory_callback(struct notifier_block *self,
 				      mn->start_pfn + mn->nr_pages);
 		fallthrough;
 	case MEM_CANCEL_OFFLINE:
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run &= ~KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 
 		smp_mb();	/* wake_up_bit advises this */
 		wake_up_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE));
@@ -2919,7 +3098,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_run != flags) {
 		ksm_run = flags;
@@ -2933,7 +3112,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -2943,6 +3122,38 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 KSM_ATTR(run);
 
 #ifdef CONFIG_NUMA
+static int ksm_nr_scans_for(bool merge_across_nodes, bool node_scanners)
+{
+	return !merge_across_nodes && node_scanners ? nr_node_ids : 1;
+}
+
+/*
+ * Switch between a single ksmd and one for each node: only done while there
+ * are no rmap_items, so no tree or mm_slot is half way through a scan.
+ */
+static int ksm_set_nr_scans(int nr_scans)
+{
+	int nid, err;
+
+	if (nr_scans == ksm_nr_scans)
+		return 0;
+
+	for (nid = 0; nid < nr_scans; nid++) {
+		err = ksm_start_scan(&ksm_scans[nid]);
+		if (err)
+			return err;
+	}
+
+	spin_lock(&ksm_mmlist_lock);
+	for (nid = 0; nid < nr_node_ids; nid++)
+		ksm_scans[nid].mm_slot = &ksm_scans[nid].mm_head;
+	spin_unlock(&ksm_mmlist_lock);
+
+	ksm_nr_scans = nr_scans;
+	wake_up_interruptible(&ksm_thread_wait);
+	return 0;
+}
+
 static ssize_t merge_across_nodes_show(struct kobject *kobj,
 				struct kobj_attribute *attr, char *buf)
 {
@@ -2953,7 +3164,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 				   struct kobj_attribute *attr,
 				   const char *buf, size_t count)
 {
-	int err;
+	int err, nr_scans;
 	unsigned long knob;
 
 	err = kstrtoul(buf, 10, &knob);
@@ -2962,10 +3173,14 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 	if (knob > 1)
 		return -EINVAL;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_merge_across_nodes != knob) {
-		if (ksm_pages_shared || remove_all_stable_nodes())
+		nr_scans = ksm_nr_scans_for(knob, ksm_node_scanners);
+		if (atomic_long_read(&ksm_pages_shared) ||
+		    remove_all_stable_nodes() ||
+		    (nr_scans != ksm_nr_scans &&
+		     atomic_long_read(&ksm_rmap_items)))
 			err = -EBUSY;
 		else if (root_stable_tree == one_stable_tree) {
 			struct rb_root *buf;
@@ -2988,16 +3203,53 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 				root_unstable_tree[0] = one_unstable_tree[0];
 			}
 		}
+		if (!err)
+			err = ksm_set_nr_scans(nr_scans);
 		if (!err) {
 			ksm_merge_across_nodes = knob;
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
 KSM_ATTR(merge_across_nodes);
+
+static ssize_t node_scanners_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_node_scanners);
+}
+
+static ssize_t node_scanners_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err, nr_scans;
+	bool value;
+
+	err = kstrtobool(buf, &value);
+	if (err)
+		return -EINVAL;
+
+	down_write(&ksm_thread_sem);
+	wait_while_offlining();
+	if (ksm_node_scanners != value) {
+		nr_scans = ksm_nr_scans_for(ksm_merge_across_nodes, value);
+		if (nr_scans != ksm_nr_scans &&
+		    atomic_long_read(&ksm_rmap_items))
+			err = -EBUSY;
+		else
+			err = ksm_set_nr_scans(nr_scans);
+		if (!err)
+			ksm_node_scanners = value;
+	}
+	up_write(&ksm_thread_sem);
+
+	return err ? err : count;
+}
+KSM_ATTR(node_scanners);
 #endif
 
 static ssize_t use_zero_pages_show(struct kobject *kobj,
@@ -3049,15 +3301,16 @@ static ssize_t max_page_sharing_store(struct kobject *kobj,
 	if (READ_ONCE(ksm_max_page_sharing) == knob)
 		return count;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_max_page_sharing != knob) {
-		if (ksm_pages_shared || remove_all_stable_nodes())
+		if (atomic_long_read(&ksm_pages_shared) ||
+		    remove_all_stable_nodes())
 			err = -EBUSY;
 		else
 			ksm_max_page_sharing = knob;
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -3066,21 +3319,21 @@ KSM_ATTR(max_page_sharing);
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_shared));
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_sharing));
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_unshared));
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -3089,8 +3342,10 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- atomic_long_read(&ksm_pages_shared)
+				- atomic_long_read(&ksm_pages_sharing)
+				- atomic_long_read(&ksm_pages_unshared);
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -3104,14 +3359,14 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t stable_node_dups_show(struct kobject *kobj,
 				     struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_stable_node_dups);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_stable_node_dups));
 }
 KSM_ATTR_RO(stable_node_dups);
 
 static ssize_t stable_node_chains_show(struct kobject *kobj,
 				       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_stable_node_chains);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_stable_node_chains));
 }
 KSM_ATTR_RO(stable_node_chains);
 
@@ -3144,7 +3399,13 @@ KSM_ATTR(stable_node_chains_prune_millisecs);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	unsigned long seqnr = ksm_scans[0].seqnr;
+	int nid;
+
+	/* Only count the scans which every ksmd has completed */
+	for (nid = 1; nid < ksm_nr_scans; nid++)
+		seqnr = min(seqnr, ksm_scans[nid].seqnr);
+	return sprintf(buf, "%lu\n", seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
@@ -3159,6 +3420,7 @@ static struct attribute *ksm_attrs[] = {
 	&full_scans_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
+	&node_scanners_attr.attr,
 #endif
 	&max_page_sharing_attr.attr,
 	&stable_node_chains_attr.attr,
@@ -3176,22 +3438,31 @@ static const struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
-	int err;
+	int nid, err;
 
 	/* The correct value depends on page size and endianness */
 	zero_checksum = calc_checksum(ZERO_PAGE(0));
 	/* Default to false for backwards compatibility */
 	ksm_use_zero_pages = false;
 
+	ksm_scans = kcalloc(nr_node_ids, sizeof(*ksm_scans), GFP_KERNEL);
+	if (!ksm_scans) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		INIT_LIST_HEAD(&ksm_scans[nid].mm_head.mm_list);
+		ksm_scans[nid].mm_slot = &ksm_scans[nid].mm_head;
+		ksm_scans[nid].nid = nid;
+	}
+
 	err = ksm_slab_init();
 	if (err)
-		goto out;
+		goto out_scans;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
+	err = ksm_start_scan(&ksm_scans[0]);
+	if (err) {
 		pr_err("ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
 		goto out_free;
 	}
 
@@ -3199,7 +3470,7 @@ static int __init ksm_init(void)
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		kthread_stop(ksm_scans[0].thread);
 		goto out_free;
 	}
 #else
@@ -3215,6 +3486,9 @@ static int __init ksm_init(void)
 
 out_free:
 	ksm_slab_free();
+out_scans:
+	kfree(ksm_scans);
+	ksm_scans = NULL;
 out:
 	return err;
 }
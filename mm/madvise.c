@@ -18,6 +18,7 @@
 #include <linux/fadvise.h>
 #include <linux/sched.h>
 #include <linux/ksm.h>
+#include <linux/khugepaged.h>
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/blkdev.h>
@@ -52,6 +53,7 @@ static int madvise_need_mmap_write(int behavior)
 	case MADV_COLD:
 	case MADV_PAGEOUT:
 	case MADV_FREE:
+	case MADV_COLLAPSE:
 		return 0;
 	default:
 		/* be safe, default to 1. list exceptions explicitly */
@@ -74,13 +76,20 @@ static long madvise_behavior(struct vm_area_struct *vma,
 
 	switch (behavior) {
 	case MADV_NORMAL:
-		new_flags = new_flags & ~VM_RAND_READ & ~VM_SEQ_READ;
+		new_flags = new_flags & ~VM_RAND_READ & ~VM_SEQ_READ &
+			    ~VM_STRIDE_READ;
 		break;
 	case MADV_SEQUENTIAL:
-		new_flags = (new_flags & ~VM_RAND_READ) | VM_SEQ_READ;
+		new_flags = (new_flags & ~VM_RAND_READ & ~VM_STRIDE_READ) |
+			    VM_SEQ_READ;
 		break;
 	case MADV_RANDOM:
-		new_flags = (new_flags & ~VM_SEQ_READ) | VM_RAND_READ;
+		new_flags = (new_flags & ~VM_SEQ_READ & ~VM_STRIDE_READ) |
+			    VM_RAND_READ;
+		break;
+	case MADV_STRIDED:
+		new_flags = (new_flags & ~VM_SEQ_READ & ~VM_RAND_READ) |
+			    VM_STRIDE_READ;
 		break;
 	case MADV_DONTFORK:
 		new_flags |= VM_DONTCOPY;
@@ -947,6 +956,8 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 	case MADV_FREE:
 	case MADV_DONTNEED:
 		return madvise_dontneed_free(vma, prev, start, end, behavior);
+	case MADV_COLLAPSE:
+		return madvise_collapse(vma, prev, start, end);
 	default:
 		return madvise_behavior(vma, prev, start, end, behavior);
 	}
@@ -961,6 +972,7 @@ madvise_behavior_valid(int behavior)
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
 	case MADV_RANDOM:
+	case MADV_STRIDED:
 	case MADV_REMOVE:
 	case MADV_WILLNEED:
 	case MADV_DONTNEED:
@@ -974,6 +986,7 @@ madvise_behavior_valid(int behavior)
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	case MADV_HUGEPAGE:
 	case MADV_NOHUGEPAGE:
+	case MADV_COLLAPSE:
 #endif
 	case MADV_DONTDUMP:
 	case MADV_DODUMP:
@@ -1008,6 +1021,9 @@ madvise_behavior_valid(int behavior)
  *  MADV_SEQUENTIAL - pages in the given range will probably be accessed
  *		once, so they can be aggressively read ahead, and
  *		can be freed soon after they are accessed.
+ *  MADV_STRIDED - pages in the given range will be accessed at a constant
+ *		stride, so only the pages predicted by it are read ahead
+ *		once it has been detected, and there is no read-around.
  *  MADV_WILLNEED - the application is notifying the system to read
  *		some pages ahead.
  *  MADV_DONTNEED - the application is finished with the given range,
@@ -1034,6 +1050,8 @@ madvise_behavior_valid(int behavior)
  *  MADV_NOHUGEPAGE - mark the given range as not worth being backed by
  *		transparent huge pages so the existing pages will not be
  *		coalesced into THP and new pages will not be allocated as THP.
+ *  MADV_COLLAPSE - collapse the existing pages in the given range into
+ *		transparent huge pages now, rather than waiting for khugepaged.
  *  MADV_DONTDUMP - the application wants to prevent pages in the given range
  *		from being included in its core dump.
  *  MADV_DODUMP - cancel MADV_DONTDUMP: no longer exclude from core dump.
@@ -71,6 +71,7 @@
 #include <linux/dax.h>
 #include <linux/oom.h>
 #include <linux/numa.h>
+#include <linux/padata.h>
 #include <linux/perf_event.h>
 #include <linux/ptrace.h>
 
@@ -3782,30 +3783,38 @@ late_initcall(fault_around_debugfs);
  * (and therefore to page order).  This way it's easier to guarantee
  * that we don't cross page table boundaries.
  */
-static vm_fault_t do_fault_around(struct vm_fault *vmf)
+static void fault_around_range(struct vm_fault *vmf, pgoff_t *start_pgoff,
+			       pgoff_t *end_pgoff)
 {
 	unsigned long address = vmf->address, nr_pages, mask;
-	pgoff_t start_pgoff = vmf->pgoff;
-	pgoff_t end_pgoff;
 	int off;
-	vm_fault_t ret = 0;
 
 	nr_pages = READ_ONCE(fault_around_bytes) >> PAGE_SHIFT;
 	mask = ~(nr_pages * PAGE_SIZE - 1) & PAGE_MASK;
 
 	vmf->address = max(address & mask, vmf->vma->vm_start);
 	off = ((address - vmf->address) >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
-	start_pgoff -= off;
+	*start_pgoff = vmf->pgoff - off;
 
 	/*
 	 *  end_pgoff is either the end of the page table, the end of
 	 *  the vma or nr_pages from start_pgoff, depending what is nearest.
 	 */
-	end_pgoff = start_pgoff -
+	*end_pgoff = *start_pgoff -
 		((vmf->address >> PAGE_SHIFT) & (PTRS_PER_PTE - 1)) +
 		PTRS_PER_PTE - 1;
-	end_pgoff = min3(end_pgoff, vma_pages(vmf->vma) + vmf->vma->vm_pgoff - 1,
-			start_pgoff + nr_pages - 1);
+	*end_pgoff = min3(*end_pgoff,
+			  vma_pages(vmf->vma) + vmf->vma->vm_pgoff - 1,
+			  *start_pgoff + nr_pages - 1);
+}
+
+static vm_fault_t do_fault_around(struct vm_fault *vmf)
+{
+	unsigned long address = vmf->address;
+	pgoff_t start_pgoff, end_pgoff;
+	vm_fault_t ret = 0;
+
+	fault_around_range(vmf, &start_pgoff, &end_pgoff);
 
 	if (pmd_none(*vmf->pmd)) {
 		vmf->prealloc_pte = pte_alloc_one(vmf->vma->vm_mm);
@@ -3847,7 +3856,12 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 	 * if page by the offset is not ready to be mapped (cold cache or
 	 * something).
 	 */
-	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+	/*
+	 * Fault-around maps pages that are in the page cache already, which
+	 * is exactly what a minor fault registration wants to be told about.
+	 */
+	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1 &&
+	    likely(!userfaultfd_minor(vma))) {
 		ret = do_fault_around(vmf);
 		if (ret)
 			return ret;
@@ -4100,6 +4114,66 @@ out:
 	return 0;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Account a hardware sample of an access by current to @addr, which mapped
+ * @pfn when the sample was taken, the same way do_numa_page() accounts a NUMA
+ * hinting fault, and migrate the page if the memory policy says it is
+ * misplaced. Called with the mmap_lock held for read.
+ */
+void do_numa_sample(struct vm_area_struct *vma, unsigned long addr,
+		    unsigned long pfn)
+{
+	struct page *page, *head;
+	int page_nid, target_nid, last_cpupid;
+	int flags = 0;
+
+	page = follow_page(vma, addr, FOLL_GET);
+	if (IS_ERR_OR_NULL(page))
+		return;
+
+	/* The address was remapped or the page migrated since the sample */
+	if (page_to_pfn(page) != pfn || is_zone_device_page(page)) {
+		put_page(page);
+		return;
+	}
+
+	/*
+	 * There is no pte to look at, see do_numa_page() for why RO mappings
+	 * avoid grouping.
+	 */
+	head = compound_head(page);
+	if (!(vma->vm_flags & VM_WRITE))
+		flags |= TNF_NO_GROUP;
+	if (page_mapcount(head) > 1 && (vma->vm_flags & VM_SHARED))
+		flags |= TNF_SHARED;
+
+	last_cpupid = page_cpupid_last(head);
+	page_nid = page_to_nid(head);
+	count_vm_numa_event(NUMA_SAMPLES);
+	if (page_nid == numa_node_id()) {
+		count_vm_numa_event(NUMA_SAMPLES_LOCAL);
+		flags |= TNF_FAULT_LOCAL;
+	}
+
+	/* THPs are only migrated from the huge pmd hinting fault path */
+	target_nid = mpol_misplaced(head, vma, addr);
+	if (target_nid == NUMA_NO_NODE || PageCompound(page)) {
+		put_page(page);
+		goto out;
+	}
+
+	if (migrate_misplaced_page(page, vma, target_nid)) {
+		page_nid = target_nid;
+		flags |= TNF_MIGRATED;
+	} else
+		flags |= TNF_MIGRATE_FAIL;
+
+out:
+	task_numa_fault(last_cpupid, page_nid, 1, flags);
+}
+#endif
+
 static inline vm_fault_t create_huge_pmd(struct vm_fault *vmf)
 {
 	if (vma_is_anonymous(vmf->vma))
@@ -4474,6 +4548,303 @@ vm_fault_t handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults
+ *
+ * Threads faulting in memory serialize on mmap_lock against any other thread
+ * of the process calling mmap(), munmap() or mprotect(), even though most
+ * faults never change the VMAs. Anonymous faults on empty PTEs and read
+ * faults on file pages already in the page cache are handled here without
+ * mmap_lock:
+ *
+ * - The VMA is looked up under RCU, VMAs are freed by RCU. Whatever was read
+ *   from it is validated against mm->mmap_seq, which is odd while mmap_lock
+ *   is held for writing.
+ *
+ * - The page tables are walked with interrupts disabled, like GUP-fast does,
+ *   so that they cannot be freed under us. Only PTE tables that are already
+ *   populated are used; nothing is allocated.
+ *
+ * - The PTE lock is trylocked and mmap_seq checked once more under it. A
+ *   writer that started after that point has to take the PTE lock, or flush
+ *   the TLB, which needs interrupts enabled here, before it can change the
+ *   page table we are about to update. Interrupts stay disabled until the
+ *   PTE lock is released.
+ *
+ * Anything else, and any race, returns VM_FAULT_RETRY and the caller handles
+ * the fault the regular way under mmap_lock.
+ */
+
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long addr)
+{
+	struct rb_node *rb_node = READ_ONCE(mm->mm_rb.rb_node);
+
+	while (rb_node) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (addr >= READ_ONCE(vma->vm_end))
+			rb_node = READ_ONCE(rb_node->rb_right);
+		else if (addr >= READ_ONCE(vma->vm_start))
+			return vma;
+		else
+			rb_node = READ_ONCE(rb_node->rb_left);
+	}
+
+	return NULL;
+}
+
+/*
+ * Access errors are not reported from here, the regular path knows how to
+ * deliver them.
+ */
+static bool spf_vma_suitable(struct vm_area_struct *vma,
+			     unsigned long vm_flags, unsigned int flags)
+{
+	bool write = flags & FAULT_FLAG_WRITE;
+	bool instr = flags & FAULT_FLAG_INSTRUCTION;
+
+	if (vm_flags & (VM_HUGETLB | VM_GROWSDOWN | VM_GROWSUP | VM_IO |
+			VM_PFNMAP | VM_MIXEDMAP | VM_UFFD_MISSING | VM_UFFD_WP |
+			VM_UFFD_MINOR))
+		return false;
+
+	if (write) {
+		if (!(vm_flags & VM_WRITE))
+			return false;
+	} else if (instr) {
+		if (!(vm_flags & VM_EXEC))
+			return false;
+	} else if (!(vm_flags & VM_ACCESS_FLAGS)) {
+		return false;
+	}
+
+	return arch_vma_access_permitted(vma, write, instr, false);
+}
+
+/*
+ * Map and lock the PTE for vmf->address. Must be called with interrupts
+ * disabled; fails if the PTE table is not populated, if its lock is
+ * contended or if mmap_lock has been write locked since @seq was read.
+ */
+static bool spf_lock_pte(struct mm_struct *mm, struct vm_fault *vmf,
+			 unsigned int seq)
+{
+	unsigned long addr = vmf->address;
+	pmd_t *pmdp, pmd;
+	pud_t pud;
+	p4d_t p4d;
+	pgd_t pgd;
+
+	lockdep_assert_irqs_disabled();
+
+	pgd = READ_ONCE(*pgd_offset(mm, addr));
+	if (pgd_none(pgd) || unlikely(pgd_bad(pgd)))
+		return false;
+	p4d = READ_ONCE(*p4d_offset(&pgd, addr));
+	if (p4d_none(p4d) || unlikely(p4d_bad(p4d)))
+		return false;
+	pud = READ_ONCE(*pud_offset(&p4d, addr));
+	if (pud_none(pud) || pud_trans_huge(pud) || pud_devmap(pud) ||
+	    unlikely(pud_bad(pud)))
+		return false;
+	pmdp = pmd_offset(&pud, addr);
+	pmd = READ_ONCE(*pmdp);
+	if (!pmd_present(pmd) || pmd_trans_huge(pmd) || pmd_devmap(pmd) ||
+	    unlikely(pmd_bad(pmd)))
+		return false;
+
+	vmf->pmd = pmdp;
+	vmf->ptl = pte_lockptr(mm, &pmd);
+	vmf->pte = pte_offset_map(&pmd, addr);
+	if (!spin_trylock(vmf->ptl)) {
+		pte_unmap(vmf->pte);
+		return false;
+	}
+
+	if (unlikely(!pmd_same(pmd, READ_ONCE(*pmdp)) ||
+		     read_seqcount_retry(&mm->mmap_seq, seq))) {
+		pte_unmap_unlock(vmf->pte, vmf->ptl);
+		return false;
+	}
+
+	return true;
+}
+
+static vm_fault_t spf_anonymous_page(struct mm_struct *mm,
+				     struct vm_fault *vmf,
+				     unsigned long vm_flags, unsigned int seq)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	pgprot_t prot = READ_ONCE(vma->vm_page_prot);
+	struct page *page = NULL;
+	pte_t entry;
+
+	if (vm_flags & VM_SHARED)
+		return VM_FAULT_RETRY;
+
+	if (!(vmf->flags & FAULT_FLAG_WRITE) && !mm_forbids_zeropage(mm)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(vmf->address), prot));
+	} else {
+		/*
+		 * The VMA may be freed once we leave the RCU read side, so
+		 * the page is allocated without it. That is only what the
+		 * regular path would do if the VMA has no NUMA policy and
+		 * already has an anon_vma.
+		 */
+		if (!READ_ONCE(vma->anon_vma) || vma_policy(vma))
+			return VM_FAULT_RETRY;
+
+		rcu_read_unlock();
+		page = alloc_zeroed_user_highpage_movable(NULL, vmf->address);
+		if (page && mem_cgroup_charge(page, mm,
+					      GFP_KERNEL | __GFP_NORETRY)) {
+			put_page(page);
+			page = NULL;
+		}
+		if (page)
+			cgroup_throttle_swaprate(page, GFP_KERNEL);
+		rcu_read_lock();
+		if (!page)
+			return VM_FAULT_RETRY;
+
+		/* See do_anonymous_page() */
+		__SetPageUptodate(page);
+
+		entry = mk_pte(page, prot);
+		entry = pte_sw_mkyoung(entry);
+		if (vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	/* vma is only known to be alive once spf_lock_pte() succeeds */
+	local_irq_disable();
+	if (!spf_lock_pte(mm, vmf, seq))
+		goto out_irq;
+	if (!pte_none(*vmf->pte) || check_stable_address_space(mm))
+		goto out_unlock;
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, vmf->address, false);
+		lru_cache_add_inactive_or_unevictable(page, vma);
+	}
+	set_pte_at(mm, vmf->address, vmf->pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, vmf->address, vmf->pte);
+	pte_unmap_unlock(vmf->pte, vmf->ptl);
+	local_irq_enable();
+	return 0;
+
+out_unlock:
+	pte_unmap_unlock(vmf->pte, vmf->ptl);
+out_irq:
+	local_irq_enable();
+	if (page)
+		put_page(page);
+	return VM_FAULT_RETRY;
+}
+
+/*
+ * Only the pages ->map_pages() finds up to date in the page cache can be
+ * mapped; anything that needs ->fault() may sleep and has to take the
+ * regular path.
+ */
+static vm_fault_t spf_read_fault(struct mm_struct *mm, struct vm_fault *vmf,
+				 const struct vm_operations_struct *vm_ops,
+				 unsigned int seq)
+{
+	unsigned long address = vmf->address;
+	pgoff_t start_pgoff, end_pgoff;
+	vm_fault_t ret = VM_FAULT_RETRY;
+	pte_t *pte;
+
+	if ((vmf->flags & FAULT_FLAG_WRITE) || !vm_ops->map_pages ||
+	    !READ_ONCE(vmf->vma->vm_file))
+		return VM_FAULT_RETRY;
+
+	vmf->pgoff = linear_page_index(vmf->vma, address);
+	fault_around_range(vmf, &start_pgoff, &end_pgoff);
+
+	local_irq_disable();
+	if (!spf_lock_pte(mm, vmf, seq))
+		goto out;
+
+	pte = vmf->pte + ((address - vmf->address) >> PAGE_SHIFT);
+	if (pte_none(*pte) && !check_stable_address_space(mm)) {
+		vm_ops->map_pages(vmf, start_pgoff, end_pgoff);
+		if (!pte_none(*pte))
+			ret = 0;
+	}
+	pte_unmap_unlock(vmf->pte, vmf->ptl);
+out:
+	local_irq_enable();
+	return ret;
+}
+
+/**
+ * handle_speculative_fault - try to handle a page fault without mmap_lock
+ * @mm: the current task's mm
+ * @address: faulting address
+ * @flags: FAULT_FLAG_xxx flags
+ * @regs: the register state at the time of the fault, for accounting
+ *
+ * Returns 0 if the fault was handled, or VM_FAULT_RETRY if the caller has to
+ * handle it under mmap_lock with handle_mm_fault(). Never reports errors.
+ */
+vm_fault_t handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+				    unsigned int flags, struct pt_regs *regs)
+{
+	struct vm_fault vmf = {
+		.address = address & PAGE_MASK,
+		.flags = flags,
+	};
+	const struct vm_operations_struct *vm_ops;
+	struct vm_area_struct *vma;
+	vm_fault_t ret = VM_FAULT_RETRY;
+	unsigned long vm_flags;
+	unsigned int seq;
+
+	seq = raw_read_seqcount(&mm->mmap_seq);
+	if (seq & 1)
+		goto out;
+
+	check_sync_rss_stat(current);
+
+	rcu_read_lock();
+	vma = spf_find_vma(mm, address);
+	if (!vma)
+		goto out_unlock;
+
+	vm_flags = READ_ONCE(vma->vm_flags);
+	if (!spf_vma_suitable(vma, vm_flags, flags))
+		goto out_unlock;
+
+	vmf.vma = vma;
+	vm_ops = READ_ONCE(vma->vm_ops);
+	if (!vm_ops)
+		ret = spf_anonymous_page(mm, &vmf, vm_flags, seq);
+	else
+		ret = spf_read_fault(mm, &vmf, vm_ops, seq);
+out_unlock:
+	rcu_read_unlock();
+out:
+	if (ret & VM_FAULT_RETRY) {
+		count_vm_event(SPF_FALLBACK);
+		return ret;
+	}
+
+	count_vm_event(SPF_SUCCESS);
+	count_vm_event(PGFAULT);
+	count_memcg_event_mm(mm, PGFAULT);
+	mm_account_fault(regs, address, flags, ret);
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
@@ -4960,12 +5331,88 @@ static void clear_subpage(unsigned long addr, int idx, void *arg)
 	clear_user_highpage(page + idx, addr);
 }
 
+const char * const huge_clear_mode_names[NR_HUGE_CLEAR_MODES] = {
+	[HUGE_CLEAR_CACHED]	= "cached",
+	[HUGE_CLEAR_NOCACHE]	= "nocache",
+	[HUGE_CLEAR_PARALLEL]	= "parallel",
+};
+
+struct clear_huge_page_arg {
+	struct page *page;
+	unsigned long addr;
+	unsigned long target;
+};
+
+/* Clear subpages [start, end) with non-temporal stores, skipping the target */
+static void clear_huge_page_nocache(unsigned long start, unsigned long end,
+				    void *arg)
+{
+	struct clear_huge_page_arg *ch = arg;
+	struct page *p = nth_page(ch->page, start);
+	unsigned long i;
+
+	for (i = start; i < end; i++, p = mem_map_next(p, ch->page, i)) {
+		cond_resched();
+		if (i != ch->target)
+			clear_user_highpage_nocache(p, ch->addr + i * PAGE_SIZE);
+	}
+}
+
+static void clear_gigantic_page_parallel(struct clear_huge_page_arg *ch,
+					 unsigned int pages_per_huge_page)
+{
+#ifdef CONFIG_PADATA
+	int nid = page_to_nid(ch->page);
+	struct padata_mt_job job = {
+		.thread_fn   = clear_huge_page_nocache,
+		.fn_arg      = ch,
+		.start       = 0,
+		.size        = pages_per_huge_page,
+		.align       = MAX_ORDER_NR_PAGES,
+		.min_chunk   = MAX_ORDER_NR_PAGES,
+		.max_threads = 1,
+		.nid         = nid,
+	};
+	int cpu;
+
+	/* Only borrow CPUs that have nothing better to do right now */
+	for_each_cpu(cpu, cpumask_of_node(nid))
+		if (cpu != raw_smp_processor_id() && idle_cpu(cpu))
+			job.max_threads++;
+
+	padata_do_multithreaded(&job);
+#else
+	clear_huge_page_nocache(0, pages_per_huge_page, ch);
+#endif
+}
+
 void clear_huge_page(struct page *page,
-		     unsigned long addr_hint, unsigned int pages_per_huge_page)
+		     unsigned long addr_hint, unsigned int pages_per_huge_page,
+		     enum huge_clear_mode mode)
 {
 	unsigned long addr = addr_hint &
 		~(((unsigned long)pages_per_huge_page << PAGE_SHIFT) - 1);
 
+	if (mode != HUGE_CLEAR_CACHED) {
+		struct clear_huge_page_arg ch = {
+			.page	= page,
+			.addr	= addr,
+			.target	= (addr_hint - addr) >> PAGE_SHIFT,
+		};
+
+		might_sleep();
+		if (mode == HUGE_CLEAR_PARALLEL &&
+		    pages_per_huge_page > MAX_ORDER_NR_PAGES)
+			clear_gigantic_page_parallel(&ch, pages_per_huge_page);
+		else
+			clear_huge_page_nocache(0, pages_per_huge_page, &ch);
+
+		/* The faulting task is about to touch this one, keep it hot */
+		clear_user_highpage(nth_page(page, ch.target),
+				    addr + ch.target * PAGE_SIZE);
+		return;
+	}
+
 	if (unlikely(pages_per_huge_page > MAX_ORDER_NR_PAGES)) {
 		clear_gigantic_page(page, addr, pages_per_huge_page);
 		return;
@@ -36,6 +36,7 @@
 #include <linux/memblock.h>
 #include <linux/compaction.h>
 #include <linux/rmap.h>
+#include <linux/padata.h>
 
 #include <asm/tlbflush.h>
 
@@ -698,6 +699,60 @@ static void __meminit resize_pgdat_range(struct pglist_data *pgdat, unsigned lon
 	pgdat->node_spanned_pages = max(start_pfn + nr_pages, old_end_pfn) - pgdat->node_start_pfn;
 
 }
+
+#ifdef CONFIG_PADATA
+static void __meminit memmap_init_hotplug_chunk(unsigned long start_pfn,
+						 unsigned long end_pfn,
+						 void *arg)
+{
+	struct zone *zone = arg;
+
+	memmap_init_zone(end_pfn - start_pfn, zone_to_nid(zone),
+			 zone_idx(zone), start_pfn, MEMMAP_HOTPLUG, NULL);
+}
+#endif
+
+/*
+ * Initialize the memmap of a range being onlined. Ranges spanning more than
+ * one section are split across the CPUs of the node, the way the deferred
+ * memmap init does it at boot, which matters when onlining big memory blocks.
+ */
+static void __meminit memmap_init_hotplug(struct zone *zone,
+					  unsigned long start_pfn,
+					  unsigned long nr_pages,
+					  struct vmem_altmap *altmap)
+{
+	int nid = zone_to_nid(zone);
+
+#ifdef CONFIG_PADATA
+	if (!altmap && nr_pages > PAGES_PER_SECTION) {
+		unsigned long end_pfn = start_pfn + nr_pages;
+		unsigned long last = ALIGN_DOWN(end_pfn - 1, PAGES_PER_SECTION);
+		struct padata_mt_job job = {
+			.thread_fn   = memmap_init_hotplug_chunk,
+			.fn_arg      = zone,
+			.start       = start_pfn,
+			.size        = last - start_pfn,
+			.align       = PAGES_PER_SECTION,
+			.min_chunk   = PAGES_PER_SECTION,
+			.max_threads = max_t(unsigned int, 1,
+					     cpumask_weight(cpumask_of_node(nid))),
+			.nid         = nid,
+		};
+
+		/*
+		 * Do the last section first: it raises highest_memmap_pfn,
+		 * so none of the parallel chunks below has to update it.
+		 */
+		memmap_init_hotplug_chunk(last, end_pfn, zone);
+		padata_do_multithreaded(&job);
+		return;
+	}
+#endif
+	memmap_init_zone(nr_pages, nid, zone_idx(zone), start_pfn,
+			 MEMMAP_HOTPLUG, altmap);
+}
+
 /*
  * Associate the pfn range with the given zone, initializing the memmaps
  * and resizing the pgdat/zone data to span the added pages. After this
@@ -728,8 +783,7 @@ void __ref move_pfn_range_to_zone(struct zone *zone, unsigned long start_pfn,
 	 * expects the zone spans the pfn range. All the pages in the range
 	 * are reserved so nobody should be touching them so we should be safe
 	 */
-	memmap_init_zone(nr_pages, nid, zone_idx(zone), start_pfn,
-			MEMMAP_HOTPLUG, altmap);
+	memmap_init_hotplug(zone, start_pfn, nr_pages, altmap);
 
 	set_zone_contiguous(zone);
 }
@@ -1017,7 +1071,7 @@ static int check_hotplug_memory_range(u64 start, u64 size)
 
 static int online_memory_block(struct memory_block *mem, void *arg)
 {
-	mem->online_type = memhp_default_online_type;
+	mem->online_type = *(int *)arg;
 	return device_online(&mem->dev);
 }
 
@@ -1027,7 +1081,8 @@ static int online_memory_block(struct memory_block *mem, void *arg)
  *
  * we are OK calling __meminit stuff here - we have CONFIG_MEMORY_HOTPLUG
  */
-int __ref add_memory_resource(int nid, struct resource *res)
+static int __ref __add_memory_resource(int nid, struct resource *res,
+				       int online_type)
 {
 	struct mhp_params params = { .pgprot = PAGE_KERNEL };
 	u64 start, size;
@@ -1091,8 +1146,9 @@ int __ref add_memory_resource(int nid, struct resource *res)
 	mem_hotplug_done();
 
 	/* online pages if requested */
-	if (memhp_default_online_type != MMOP_OFFLINE)
-		walk_memory_blocks(start, size, NULL, online_memory_block);
+	if (online_type != MMOP_OFFLINE)
+		walk_memory_blocks(start, size, &online_type,
+				   online_memory_block);
 
 	return ret;
 error:
@@ -1105,6 +1161,12 @@ error:
 	return ret;
 }
 
+/* requires device_hotplug_lock, see __add_memory_resource() */
+int __ref add_memory_resource(int nid, struct resource *res)
+{
+	return __add_memory_resource(nid, res, memhp_default_online_type);
+}
+
 /* requires device_hotplug_lock, see add_memory_resource() */
 int __ref __add_memory(int nid, u64 start, u64 size)
 {
@@ -1153,9 +1215,12 @@ EXPORT_SYMBOL_GPL(add_memory);
  *
  * The resource_name (visible via /proc/iomem) has to have the format
  * "System RAM ($DRIVER)".
+ *
+ * The memory blocks are onlined with @online_type, MMOP_OFFLINE leaves them
+ * offline.
  */
-int add_memory_driver_managed(int nid, u64 start, u64 size,
-			      const char *resource_name)
+int add_memory_driver_managed_online(int nid, u64 start, u64 size,
+				     const char *resource_name, int online_type)
 {
 	struct resource *res;
 	int rc;
@@ -1173,7 +1238,7 @@ int add_memory_driver_managed(int nid, u64 start, u64 size,
 		goto out_unlock;
 	}
 
-	rc = add_memory_resource(nid, res);
+	rc = __add_memory_resource(nid, res, online_type);
 	if (rc < 0)
 		release_memory_resource(res);
 
@@ -1181,6 +1246,15 @@ out_unlock:
 	unlock_device_hotplug();
 	return rc;
 }
+EXPORT_SYMBOL_GPL(add_memory_driver_managed_online);
+
+/* Like add_memory_driver_managed_online(), onlined as the system default */
+int add_memory_driver_managed(int nid, u64 start, u64 size,
+			      const char *resource_name)
+{
+	return add_memory_driver_managed_online(nid, start, size, resource_name,
+						memhp_default_online_type);
+}
 EXPORT_SYMBOL_GPL(add_memory_driver_managed);
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
@@ -1356,7 +1430,7 @@ do_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
 	if (!list_empty(&source)) {
 		/* Allocate a new page from the nearest neighbor node */
 		ret = migrate_pages(&source, new_node_page, NULL, 0,
-					MIGRATE_SYNC, MR_MEMORY_HOTPLUG);
+					MIGRATE_SYNC, MR_MEMORY_HOTPLUG, NULL);
 		if (ret) {
 			list_for_each_entry(page, &source, lru) {
 				pr_warn("migrating pfn %lx failed ret:%d ",
@@ -49,6 +49,11 @@
 #include <linux/sched/mm.h>
 #include <linux/ptrace.h>
 #include <linux/oom.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/workqueue.h>
+#include <linux/sizes.h>
+#include <linux/memory.h>
 
 #include <asm/tlbflush.h>
 
@@ -672,13 +677,17 @@ void migrate_page_states(struct page *newpage, struct page *page)
 }
 EXPORT_SYMBOL(migrate_page_states);
 
-void migrate_page_copy(struct page *newpage, struct page *page)
+static void migrate_page_copy_data(struct page *newpage, struct page *page)
 {
 	if (PageHuge(page) || PageTransHuge(page))
 		copy_huge_page(newpage, page);
 	else
 		copy_highpage(newpage, page);
+}
 
+void migrate_page_copy(struct page *newpage, struct page *page)
+{
+	migrate_page_copy_data(newpage, page);
 	migrate_page_states(newpage, page);
 }
 EXPORT_SYMBOL(migrate_page_copy);
@@ -1392,6 +1401,481 @@ out:
 	return rc;
 }
 
+/*
+ * Batched migration
+ *
+ * Anonymous pages that are not in the swap cache are migrated in batches:
+ * up to migrate_batch_size pages are unmapped with a single TLB flush, their
+ * contents are copied together, either by a DMA engine memcpy channel or by
+ * several threads, and only then are they moved and remapped. Pages that
+ * don't qualify, or that can't be unmapped without blocking, are left on the
+ * list for the one-at-a-time path in migrate_pages().
+ */
+#define MIGRATE_BATCH_MAX		512
+#define MIGRATE_COPY_MAX_THREADS	8
+/* Don't bother waking up helper threads for less than this */
+#define MIGRATE_COPY_THREAD_MIN		(SZ_2M / PAGE_SIZE)
+
+static unsigned int migrate_batch_size = 32;
+static unsigned int migrate_copy_threads = 1;
+
+static DECLARE_RWSEM(migrate_dma_sem);
+static struct dma_chan *migrate_dma_chan;
+
+static bool migrate_batch_allowed(enum migrate_mode mode, int reason)
+{
+	if (READ_ONCE(migrate_batch_size) < 2 || mode == MIGRATE_SYNC_NO_COPY)
+		return false;
+
+	return reason == MR_SYSCALL || reason == MR_MEMPOLICY_MBIND ||
+	       reason == MR_NUMA_MISPLACED || reason == MR_DEMOTION;
+}
+
+static bool migrate_batch_eligible(struct page *page)
+{
+	if (PageHuge(page) || __PageMovable(page))
+		return false;
+	if (PageTransHuge(page) && !thp_migration_supported())
+		return false;
+
+	return PageAnon(page) && !PageKsm(page) && !PageSwapCache(page) &&
+	       page_mapped(page) && page_count(page) > 1;
+}
+
+/*
+ * Lock @page and replace its ptes with migration entries, leaving the TLB
+ * flush to the caller. Nothing is changed if this returns an error.
+ */
+static int migrate_page_unmap(struct page *page, struct page *newpage)
+{
+	struct anon_vma *anon_vma;
+
+	if (!trylock_page(page))
+		return -EAGAIN;
+
+	if (PageWriteback(page) || !page_mapped(page))
+		goto out_unlock;
+
+	anon_vma = page_get_anon_vma(page);
+	if (!anon_vma)
+		goto out_unlock;
+
+	if (unlikely(!trylock_page(newpage)))
+		goto out_put;
+
+	try_to_unmap(page, TTU_MIGRATION | TTU_IGNORE_MLOCK |
+			   TTU_IGNORE_ACCESS | TTU_BATCH_FLUSH);
+	if (page_mapped(page)) {
+		remove_migration_ptes(page, page, false);
+		unlock_page(newpage);
+		goto out_put;
+	}
+
+	/* Until the page is moved, newpage->private holds the anon_vma */
+	set_page_private(newpage, (unsigned long)anon_vma);
+	return 0;
+
+out_put:
+	put_anon_vma(anon_vma);
+out_unlock:
+	unlock_page(page);
+	return -EAGAIN;
+}
+
+struct migrate_copy_work {
+	struct work_struct	work;
+	struct page		*page;
+	struct page		*newpage;
+	int			nr;
+};
+
+static void migrate_copy_pages_range(struct page *page, struct page *newpage,
+				     int nr)
+{
+	while (nr--) {
+		migrate_page_copy_data(newpage, page);
+		page = list_next_entry(page, lru);
+		newpage = list_next_entry(newpage, lru);
+	}
+}
+
+static void migrate_copy_work_fn(struct work_struct *work)
+{
+	struct migrate_copy_work *mcw =
+		container_of(work, struct migrate_copy_work, work);
+
+	migrate_copy_pages_range(mcw->page, mcw->newpage, mcw->nr);
+}
+
+/* Split the batch between the current task and up to @threads - 1 workers */
+static void migrate_copy_pages_threads(struct list_head *src,
+				       struct list_head *dst, int nr,
+				       int threads)
+{
+	struct migrate_copy_work *works;
+	struct page *page = list_first_entry(src, struct page, lru);
+	struct page *newpage = list_first_entry(dst, struct page, lru);
+	int i, chunk;
+
+	works = kmalloc_array(threads, sizeof(*works), GFP_KERNEL | __GFP_NOWARN);
+	if (!works) {
+		migrate_copy_pages_range(page, newpage, nr);
+		return;
+	}
+
+	for (i = 0; i < threads; i++) {
+		chunk = nr / (threads - i);
+		works[i].page = page;
+		works[i].newpage = newpage;
+		works[i].nr = chunk;
+		nr -= chunk;
+		while (chunk--) {
+			page = list_next_entry(page, lru);
+			newpage = list_next_entry(newpage, lru);
+		}
+
+		INIT_WORK(&works[i].work, migrate_copy_work_fn);
+		if (i)
+			queue_work(system_unbound_wq, &works[i].work);
+	}
+
+	migrate_copy_work_fn(&works[0].work);
+	for (i = 1; i < threads; i++)
+		flush_work(&works[i].work);
+
+	kfree(works);
+}
+
+/*
+ * Copy the batch with a DMA engine memcpy channel, e.g. the CCP passthrough
+ * engine. Returns 0 once all copies completed, or an error if the caller has
+ * to copy the pages with the CPU instead.
+ */
+static int migrate_copy_pages_dma(struct dma_chan *chan, struct list_head *src,
+				  struct list_head *dst)
+{
+	struct device *dev = chan->device->dev;
+	struct page *page, *newpage;
+	dma_cookie_t cookie = 0;
+	int ret = 0;
+
+	newpage = list_first_entry(dst, struct page, lru);
+	list_for_each_entry(page, src, lru) {
+		struct dmaengine_unmap_data *unmap;
+		struct dma_async_tx_descriptor *tx;
+		size_t size = page_size(page);
+		dma_cookie_t c;
+
+		unmap = dmaengine_get_unmap_data(dev, 2, GFP_NOWAIT);
+		if (!unmap) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		unmap->len = size;
+		unmap->addr[0] = dma_map_page(dev, page, 0, size, DMA_TO_DEVICE);
+		if (dma_mapping_error(dev, unmap->addr[0]))
+			goto err_put;
+		unmap->to_cnt = 1;
+
+		unmap->addr[1] = dma_map_page(dev, newpage, 0, size,
+					      DMA_FROM_DEVICE);
+		if (dma_mapping_error(dev, unmap->addr[1]))
+			goto err_put;
+		unmap->from_cnt = 1;
+
+		tx = dmaengine_prep_dma_memcpy(chan, unmap->addr[1],
+					       unmap->addr[0], size,
+					       DMA_CTRL_ACK);
+		if (!tx)
+			goto err_put;
+
+		dma_set_unmap(tx, unmap);
+		c = dmaengine_submit(tx);
+		dmaengine_unmap_put(unmap);
+		if (dma_submit_error(c)) {
+			ret = -EIO;
+			break;
+		}
+
+		cookie = c;
+		newpage = list_next_entry(newpage, lru);
+		continue;
+err_put:
+		dmaengine_unmap_put(unmap);
+		ret = -EIO;
+		break;
+	}
+
+	if (!cookie)
+		return ret ? ret : -EIO;
+
+	dma_async_issue_pending(chan);
+	if (dma_sync_wait(chan, cookie) != DMA_COMPLETE) {
+		dmaengine_terminate_sync(chan);
+		ret = -EIO;
+	}
+
+	return ret;
+}
+
+static void migrate_copy_pages(struct list_head *src, struct list_head *dst,
+			       int nr, int nr_pages)
+{
+	const char *method = "cpu";
+	int threads;
+	u64 start;
+
+	start = ktime_get_ns();
+
+	if (READ_ONCE(migrate_dma_chan) && down_read_trylock(&migrate_dma_sem)) {
+		int ret = -ENODEV;
+
+		if (migrate_dma_chan)
+			ret = migrate_copy_pages_dma(migrate_dma_chan, src, dst);
+		up_read(&migrate_dma_sem);
+
+		if (!ret) {
+			count_vm_events(PGMIGRATE_DMA_COPY, nr_pages);
+			method = "dma";
+			goto out;
+		}
+	}
+
+	threads = min3(READ_ONCE(migrate_copy_threads), (unsigned int)nr,
+		       (unsigned int)(nr_pages / MIGRATE_COPY_THREAD_MIN));
+	if (threads > 1) {
+		migrate_copy_pages_threads(src, dst, nr, threads);
+		method = "threads";
+		goto out;
+	}
+
+	migrate_copy_pages_range(list_first_entry(src, struct page, lru),
+				 list_first_entry(dst, struct page, lru), nr);
+out:
+	trace_mm_migrate_pages_batch(nr_pages, ktime_get_ns() - start, method);
+}
+
+/*
+ * Flush the TLBs for the unmapped batch, copy it and finish the migration of
+ * every page. Pages that failed are put back on @from to be retried.
+ */
+static void migrate_batch_move(struct list_head *src, struct list_head *dst,
+			       int nr, int nr_pages, struct list_head *from,
+			       free_page_t put_new_page, unsigned long private,
+			       int reason, int *nr_succeeded,
+			       int *nr_thp_succeeded)
+{
+	struct page *page, *page2, *newpage, *newpage2;
+
+	/* Nobody may write to the old pages once they are copied */
+	try_to_unmap_flush();
+
+	migrate_copy_pages(src, dst, nr, nr_pages);
+
+	newpage = list_first_entry(dst, struct page, lru);
+	list_for_each_entry_safe(page, page2, src, lru) {
+		struct anon_vma *anon_vma = (void *)page_private(newpage);
+		bool is_thp = PageTransHuge(page);
+		int nr_subpages = thp_nr_pages(page);
+		int rc;
+
+		newpage2 = list_next_entry(newpage, lru);
+		list_del(&newpage->lru);
+		set_page_private(newpage, 0);
+
+		/* The data is already there, only move the mapping and state */
+		rc = move_to_new_page(newpage, page, MIGRATE_SYNC_NO_COPY);
+		remove_migration_ptes(page,
+			rc == MIGRATEPAGE_SUCCESS ? newpage : page, false);
+		unlock_page(newpage);
+		put_anon_vma(anon_vma);
+		unlock_page(page);
+
+		if (rc == MIGRATEPAGE_SUCCESS) {
+			putback_lru_page(newpage);
+			set_page_owner_migrate_reason(newpage, reason);
+
+			list_del(&page->lru);
+			mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+					page_is_file_lru(page), -nr_subpages);
+			put_page(page);
+
+			*nr_succeeded += nr_subpages;
+			if (is_thp)
+				(*nr_thp_succeeded)++;
+			count_vm_events(PGMIGRATE_BATCHED, nr_subpages);
+		} else {
+			list_move_tail(&page->lru, from);
+			if (put_new_page)
+				put_new_page(newpage, private);
+			else
+				put_page(newpage);
+		}
+
+		newpage = newpage2;
+	}
+}
+
+static void migrate_pages_batch(struct list_head *from,
+				new_page_t get_new_page,
+				free_page_t put_new_page,
+				unsigned long private, int reason,
+				int *nr_succeeded, int *nr_thp_succeeded)
+{
+	int batch = min_t(unsigned int, READ_ONCE(migrate_batch_size),
+			  MIGRATE_BATCH_MAX);
+	struct page *page, *page2, *newpage;
+	int nr = 0, nr_pages = 0;
+	LIST_HEAD(src);
+	LIST_HEAD(dst);
+
+	list_for_each_entry_safe(page, page2, from, lru) {
+		cond_resched();
+
+		if (!migrate_batch_eligible(page))
+			continue;
+
+		newpage = get_new_page(page, private);
+		if (!newpage)
+			continue;
+
+		/* The huge page may have to be split, leave it to the caller */
+		if (PageTransHuge(page) != PageTransHuge(newpage) ||
+		    migrate_page_unmap(page, newpage)) {
+			if (put_new_page)
+				put_new_page(newpage, private);
+			else
+				put_page(newpage);
+			continue;
+		}
+
+		list_move_tail(&page->lru, &src);
+		list_add_tail(&newpage->lru, &dst);
+		nr_pages += thp_nr_pages(page);
+		if (++nr < batch)
+			continue;
+
+		migrate_batch_move(&src, &dst, nr, nr_pages, from, put_new_page,
+				   private, reason, nr_succeeded,
+				   nr_thp_succeeded);
+		nr = nr_pages = 0;
+	}
+
+	if (nr)
+		migrate_batch_move(&src, &dst, nr, nr_pages, from, put_new_page,
+				   private, reason, nr_succeeded,
+				   nr_thp_succeeded);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t batch_size_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", migrate_batch_size);
+}
+
+static ssize_t batch_size_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val) || val > MIGRATE_BATCH_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(migrate_batch_size, val);
+	return count;
+}
+static struct kobj_attribute batch_size_attr = __ATTR_RW(batch_size);
+
+static ssize_t copy_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", migrate_copy_threads);
+}
+
+static ssize_t copy_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val) || !val ||
+	    val > MIGRATE_COPY_MAX_THREADS)
+		return -EINVAL;
+
+	WRITE_ONCE(migrate_copy_threads, val);
+	return count;
+}
+static struct kobj_attribute copy_threads_attr = __ATTR_RW(copy_threads);
+
+static ssize_t copy_dma_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	struct dma_chan *chan;
+	ssize_t ret;
+
+	down_read(&migrate_dma_sem);
+	chan = migrate_dma_chan;
+	ret = sprintf(buf, "%s\n", chan ? dma_chan_name(chan) : "none");
+	up_read(&migrate_dma_sem);
+
+	return ret;
+}
+
+static ssize_t copy_dma_store(struct kobject *kobj,
+			      struct kobj_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct dma_chan *chan = NULL;
+	bool enable;
+	int ret = count;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	down_write(&migrate_dma_sem);
+	if (enable && !migrate_dma_chan) {
+		dma_cap_mask_t mask;
+
+		dma_cap_zero(mask);
+		dma_cap_set(DMA_MEMCPY, mask);
+		chan = dma_request_chan_by_mask(&mask);
+		if (IS_ERR(chan))
+			ret = PTR_ERR(chan);
+		else
+			WRITE_ONCE(migrate_dma_chan, chan);
+	} else if (!enable && migrate_dma_chan) {
+		dma_release_channel(migrate_dma_chan);
+		WRITE_ONCE(migrate_dma_chan, NULL);
+	}
+	up_write(&migrate_dma_sem);
+
+	return ret;
+}
+static struct kobj_attribute copy_dma_attr = __ATTR_RW(copy_dma);
+
+static struct attribute *migrate_attrs[] = {
+	&batch_size_attr.attr,
+	&copy_threads_attr.attr,
+	&copy_dma_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group migrate_attr_group = {
+	.name = "migrate",
+	.attrs = migrate_attrs,
+};
+
+static int __init migrate_sysfs_init(void)
+{
+	return sysfs_create_group(mm_kobj, &migrate_attr_group);
+}
+subsys_initcall(migrate_sysfs_init);
+#endif /* CONFIG_SYSFS */
+
+
 /*
  * migrate_pages - migrate the pages specified in a list, to the free pages
  *		   supplied as the target for the page migration
@@ -1405,6 +1889,8 @@ out:
  * @mode:		The migration mode that specifies the constraints for
  *			page migration, if any.
  * @reason:		The reason for page migration.
+ * @ret_succeeded:	Set to the number of pages migrated successfully if
+ *			the caller passes a non-NULL pointer.
  *
  * The function returns after 10 attempts or if no pages are movable any more
  * because the list has become empty or no retryable pages exist any more.
@@ -1415,7 +1901,7 @@ out:
  */
 int migrate_pages(struct list_head *from, new_page_t get_new_page,
 		free_page_t put_new_page, unsigned long private,
-		enum migrate_mode mode, int reason)
+		enum migrate_mode mode, int reason, unsigned int *ret_succeeded)
 {
 	int retry = 1;
 	int thp_retry = 1;
@@ -1434,6 +1920,10 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 	if (!swapwrite)
 		current->flags |= PF_SWAPWRITE;
 
+	if (migrate_batch_allowed(mode, reason))
+		migrate_pages_batch(from, get_new_page, put_new_page, private,
+				    reason, &nr_succeeded, &nr_thp_succeeded);
+
 	for (pass = 0; pass < 10 && (retry || thp_retry); pass++) {
 		retry = 0;
 		thp_retry = 0;
@@ -1532,6 +2022,9 @@ out:
 	trace_mm_migrate_pages(nr_succeeded, nr_failed, nr_thp_succeeded,
 			       nr_thp_failed, nr_thp_split, mode, reason);
 
+	if (ret_succeeded)
+		*ret_succeeded = nr_succeeded;
+
 	if (!swapwrite)
 		current->flags &= ~PF_SWAPWRITE;
 
@@ -1583,6 +2076,148 @@ struct page *alloc_migration_target(struct page *page, unsigned long private)
 
 #ifdef CONFIG_NUMA
 
+/*
+ * Memory tiers
+ *
+ * Nodes with both CPUs and memory form the top tier. Every other memory
+ * node, typically PMEM or CXL memory onlined as a CPU-less node by dax/kmem,
+ * is placed below the nearest node by SLIT distance of the tier above, and
+ * becomes its demotion target. Reclaim demotes cold pages along these
+ * targets instead of swapping them out, and NUMA balancing in memory tiering
+ * mode promotes hot pages back to the top tier.
+ */
+bool numa_demotion_enabled __read_mostly;
+
+static int node_demotion[MAX_NUMNODES] __read_mostly = {
+	[0 ... MAX_NUMNODES - 1] = NUMA_NO_NODE,
+};
+static nodemask_t toptier_nodes __read_mostly = NODE_MASK_ALL;
+static DEFINE_MUTEX(demotion_mutex);
+
+/**
+ * next_demotion_node() - Get the node cold pages of @node are demoted to
+ * @node: The starting node to lookup the next node
+ *
+ * Return: node id for next memory node in the demotion path hierarchy
+ * from @node; NUMA_NO_NODE if @node is terminal.
+ */
+int next_demotion_node(int node)
+{
+	return READ_ONCE(node_demotion[node]);
+}
+
+bool node_is_toptier(int node)
+{
+	return node_isset(node, toptier_nodes);
+}
+
+static int find_demotion_target(int node, nodemask_t *used)
+{
+	int n, target = NUMA_NO_NODE, best = INT_MAX;
+
+	for_each_node_state(n, N_MEMORY) {
+		if (node_isset(n, *used))
+			continue;
+		if (node_distance(node, n) < best) {
+			best = node_distance(node, n);
+			target = n;
+		}
+	}
+
+	return target;
+}
+
+static void establish_demotion_targets(void)
+{
+	nodemask_t used, this_tier, next_tier;
+	int node, target;
+
+	mutex_lock(&demotion_mutex);
+
+	for_each_node(node)
+		WRITE_ONCE(node_demotion[node], NUMA_NO_NODE);
+
+	nodes_and(this_tier, node_states[N_CPU], node_states[N_MEMORY]);
+	if (nodes_empty(this_tier))
+		this_tier = node_states[N_MEMORY];
+	toptier_nodes = this_tier;
+	used = this_tier;
+
+	/* Several nodes of one tier may share a target in the next */
+	while (!nodes_empty(this_tier)) {
+		nodes_clear(next_tier);
+		for_each_node_mask(node, this_tier) {
+			target = find_demotion_target(node, &used);
+			if (target == NUMA_NO_NODE)
+				continue;
+			WRITE_ONCE(node_demotion[node], target);
+			node_set(target, next_tier);
+		}
+		nodes_or(used, used, next_tier);
+		this_tier = next_tier;
+	}
+
+	mutex_unlock(&demotion_mutex);
+}
+
+static int demotion_memory_callback(struct notifier_block *self,
+				    unsigned long action, void *arg)
+{
+	switch (action) {
+	case MEM_ONLINE:
+	case MEM_OFFLINE:
+		establish_demotion_targets();
+		break;
+	}
+
+	return notifier_from_errno(0);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t demotion_enabled_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_demotion_enabled ? "true" : "false");
+}
+
+static ssize_t demotion_enabled_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	bool enable;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	WRITE_ONCE(numa_demotion_enabled, enable);
+	return count;
+}
+static struct kobj_attribute demotion_enabled_attr =
+	__ATTR_RW(demotion_enabled);
+
+static struct attribute *numa_attrs[] = {
+	&demotion_enabled_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group numa_attr_group = {
+	.name = "numa",
+	.attrs = numa_attrs,
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init numa_tiering_init(void)
+{
+	establish_demotion_targets();
+	hotplug_memory_notifier(demotion_memory_callback, 100);
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &numa_attr_group))
+		pr_err("numa: failed to register sysfs group\n");
+#endif
+	return 0;
+}
+subsys_initcall(numa_tiering_init);
+
 static int store_status(int __user *status, int start, int value, int nr)
 {
 	while (nr-- > 0) {
@@ -1604,7 +2239,7 @@ static int do_move_pages_to_node(struct mm_struct *mm,
 	};
 
 	err = migrate_pages(pagelist, alloc_migration_target, NULL,
-			(unsigned long)&mtc, MIGRATE_SYNC, MR_SYSCALL);
+			(unsigned long)&mtc, MIGRATE_SYNC, MR_SYSCALL, NULL);
 	if (err)
 		putback_movable_pages(pagelist);
 	return err;
@@ -2014,8 +2649,22 @@ static int numamigrate_isolate_page(pg_data_t *pgdat, struct page *page)
 	VM_BUG_ON_PAGE(compound_order(page) && !PageTransHuge(page), page);
 
 	/* Avoid migrating to a node that is nearly full */
-	if (!migrate_balanced_pgdat(pgdat, compound_nr(page)))
+	if (!migrate_balanced_pgdat(pgdat, compound_nr(page))) {
+		int z;
+
+		if (!(sysctl_numa_balancing_mode & NUMA_BALANCING_MEMORY_TIERING))
+			return 0;
+
+		/* Let kswapd demote cold pages to make room for hot ones */
+		for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+			if (populated_zone(pgdat->node_zones + z))
+				break;
+		}
+		if (z >= 0)
+			wakeup_kswapd(pgdat->node_zones + z, 0,
+				      compound_order(page), ZONE_MOVABLE);
 		return 0;
+	}
 
 	if (isolate_lru_page(page))
 		return 0;
@@ -2060,6 +2709,8 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			   int node)
 {
 	pg_data_t *pgdat = NODE_DATA(node);
+	int src_nid = page_to_nid(page);
+	int nr_pages = thp_nr_pages(page);
 	int isolated;
 	int nr_remaining;
 	LIST_HEAD(migratepages);
@@ -2086,7 +2737,7 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 	list_add(&page->lru, &migratepages);
 	nr_remaining = migrate_pages(&migratepages, alloc_misplaced_dst_page,
 				     NULL, node, MIGRATE_ASYNC,
-				     MR_NUMA_MISPLACED);
+				     MR_NUMA_MISPLACED, NULL);
 	if (nr_remaining) {
 		if (!list_empty(&migratepages)) {
 			list_del(&page->lru);
@@ -2095,8 +2746,11 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			putback_lru_page(page);
 		}
 		isolated = 0;
-	} else
+	} else {
 		count_vm_numa_event(NUMA_PAGE_MIGRATE);
+		if (!node_is_toptier(src_nid) && node_is_toptier(node))
+			mod_node_page_state(pgdat, PGPROMOTE_SUCCESS, nr_pages);
+	}
 	BUG_ON(!list_empty(&migratepages));
 	return isolated;
 
@@ -2217,6 +2871,8 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 
 	count_vm_events(PGMIGRATE_SUCCESS, HPAGE_PMD_NR);
 	count_vm_numa_events(NUMA_PAGE_MIGRATE, HPAGE_PMD_NR);
+	if (!node_is_toptier(page_to_nid(page)) && node_is_toptier(node))
+		mod_node_page_state(pgdat, PGPROMOTE_SUCCESS, HPAGE_PMD_NR);
 
 	mod_node_page_state(page_pgdat(page),
 			NR_ISOLATED_ANON + page_lru,
@@ -28,6 +28,7 @@
 #include <linux/ksm.h>
 #include <linux/uaccess.h>
 #include <linux/mm_inline.h>
+#include <linux/sched/sysctl.h>
 #include <linux/pgtable.h>
 #include <asm/cacheflush.h>
 #include <asm/mmu_context.h>
@@ -111,6 +112,15 @@ static unsigned long change_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 				 */
 				if (target_node == page_to_nid(page))
 					continue;
+
+				/*
+				 * Memory tiering alone only promotes pages, so
+				 * there is no point in scanning the top tier.
+				 */
+				if (!(sysctl_numa_balancing_mode &
+				      NUMA_BALANCING_NORMAL) &&
+				    node_is_toptier(page_to_nid(page)))
+					continue;
 			}
 
 			oldpte = ptep_modify_prot_start(vma, addr, pte);
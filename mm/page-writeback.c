@@ -1429,6 +1429,27 @@ static unsigned long wb_max_pause(struct bdi_writeback *wb,
 	return min_t(unsigned long, t, MAX_PAUSE);
 }
 
+/*
+ * Pause for a writer of a bdi whose write latency is over its target: it
+ * may dirty pages at the rate the device writes them back, scaled down by
+ * how far the measured latency is over the target.
+ */
+static long wb_latency_pause(struct bdi_writeback *wb,
+			     unsigned long pages_dirtied,
+			     u64 lat, u64 target,
+			     int *nr_dirtied_pause)
+{
+	unsigned long rate;
+
+	rate = div64_u64((u64)wb->avg_write_bandwidth * target, lat);
+	rate = max(rate, 1UL);
+
+	/* aim for a 10ms pause the next time round */
+	*nr_dirtied_pause = max(1UL, rate * max(1, HZ / 100) / HZ);
+
+	return min_t(unsigned long, HZ * pages_dirtied / rate, MAX_PAUSE);
+}
+
 static long wb_min_pause(struct bdi_writeback *wb,
 			 long max_pause,
 			 unsigned long task_ratelimit,
@@ -1552,8 +1573,8 @@ static inline void wb_dirty_limits(struct dirty_throttle_control *dtc)
  * If we're over `background_thresh' then the writeback threads are woken to
  * perform some writeout.
  */
-static void balance_dirty_pages(struct bdi_writeback *wb,
-				unsigned long pages_dirtied)
+static int balance_dirty_pages(struct bdi_writeback *wb,
+			       unsigned long pages_dirtied, unsigned int flags)
 {
 	struct dirty_throttle_control gdtc_stor = { GDTC_INIT(wb) };
 	struct dirty_throttle_control mdtc_stor = { MDTC_INIT(wb, &gdtc_stor) };
@@ -1573,6 +1594,7 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 	struct backing_dev_info *bdi = wb->bdi;
 	bool strictlimit = bdi->capabilities & BDI_CAP_STRICTLIMIT;
 	unsigned long start_time = jiffies;
+	int ret = 0;
 
 	for (;;) {
 		unsigned long now = jiffies;
@@ -1580,6 +1602,7 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 		unsigned long m_dirty = 0;	/* stop bogus uninit warnings */
 		unsigned long m_thresh = 0;
 		unsigned long m_bg_thresh = 0;
+		u64 lat, lat_target;
 
 		nr_reclaimable = global_node_page_state(NR_FILE_DIRTY);
 		gdtc->avail = global_dirtyable_memory();
@@ -1625,6 +1648,46 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 			}
 		}
 
+		/*
+		 * Writers to a bdi with a write latency target are throttled
+		 * by its device's completion latency alone, so that they don't
+		 * stall on the dirty pages of slower devices and don't fill
+		 * memory with pages their own device can't keep up with.  The
+		 * hard limits of the dirty domains still apply.
+		 */
+		lat_target = READ_ONCE(bdi->write_lat_target_nsec);
+		if (lat_target && dirty <= thresh &&
+		    (!mdtc || m_dirty <= m_thresh)) {
+			lat = READ_ONCE(bdi->write_lat_nsec);
+			if (lat <= lat_target) {
+				trace_balance_dirty_pages_latency(wb, lat,
+						lat_target, pages_dirtied, 0);
+				goto free_running;
+			}
+
+			if (unlikely(!writeback_in_progress(wb)))
+				wb_start_background_writeback(wb);
+
+			pause = wb_latency_pause(wb, pages_dirtied, lat,
+						 lat_target, &nr_dirtied_pause);
+			trace_balance_dirty_pages_latency(wb, lat, lat_target,
+							  pages_dirtied, pause);
+			if (pause && (flags & BDP_ASYNC)) {
+				ret = -EAGAIN;
+				break;
+			}
+			if (pause) {
+				__set_current_state(TASK_KILLABLE);
+				wb->dirty_sleep = now;
+				io_schedule_timeout(pause);
+			}
+
+			current->dirty_paused_when = now + pause;
+			current->nr_dirtied = 0;
+			current->nr_dirtied_pause = nr_dirtied_pause;
+			break;
+		}
+
 		/*
 		 * Throttle it only when the background writeback cannot
 		 * catch-up. This avoids (excessively) small writeouts
@@ -1790,6 +1853,10 @@ pause:
 					  period,
 					  pause,
 					  start_time);
+		if (flags & BDP_ASYNC) {
+			ret = -EAGAIN;
+			break;
+		}
 		__set_current_state(TASK_KILLABLE);
 		wb->dirty_sleep = now;
 		io_schedule_timeout(pause);
@@ -1826,7 +1893,7 @@ pause:
 		wb->dirty_exceeded = 0;
 
 	if (writeback_in_progress(wb))
-		return;
+		return ret;
 
 	/*
 	 * In laptop mode, we wait until hitting the higher threshold before
@@ -1837,10 +1904,12 @@ pause:
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
 	if (laptop_mode)
-		return;
+		return ret;
 
 	if (nr_reclaimable > gdtc->bg_thresh)
 		wb_start_background_writeback(wb);
+
+	return ret;
 }
 
 static DEFINE_PER_CPU(int, bdp_ratelimits);
@@ -1862,8 +1931,9 @@ static DEFINE_PER_CPU(int, bdp_ratelimits);
 DEFINE_PER_CPU(int, dirty_throttle_leaks) = 0;
 
 /**
- * balance_dirty_pages_ratelimited - balance dirty memory state
+ * balance_dirty_pages_ratelimited_flags - balance dirty memory state
  * @mapping: address_space which was dirtied
+ * @flags: BDP flags
  *
  * Processes which are dirtying memory should call in here once for each page
  * which was newly dirtied.  The function will periodically check the system's
@@ -1873,17 +1943,23 @@ DEFINE_PER_CPU(int, dirty_throttle_leaks) = 0;
  * calling it too often (ratelimiting).  But once we're over the dirty memory
  * limit we decrease the ratelimiting by a lot, to prevent individual processes
  * from overshooting the limit by (ratelimit_pages) each.
+ *
+ * With BDP_ASYNC in @flags the caller is never put to sleep. If it would have
+ * been throttled, -EAGAIN is returned instead and the throttling is left to a
+ * later, blocking call.
  */
-void balance_dirty_pages_ratelimited(struct address_space *mapping)
+int balance_dirty_pages_ratelimited_flags(struct address_space *mapping,
+					  unsigned int flags)
 {
 	struct inode *inode = mapping->host;
 	struct backing_dev_info *bdi = inode_to_bdi(inode);
 	struct bdi_writeback *wb = NULL;
 	int ratelimit;
+	int ret = 0;
 	int *p;
 
 	if (!bdi_cap_account_dirty(bdi))
-		return;
+		return ret;
 
 	if (inode_cgwb_enabled(inode))
 		wb = wb_get_create_current(bdi, GFP_KERNEL);
@@ -1923,9 +1999,23 @@ void balance_dirty_pages_ratelimited(struct address_space *mapping)
 	preempt_enable();
 
 	if (unlikely(current->nr_dirtied >= ratelimit))
-		balance_dirty_pages(wb, current->nr_dirtied);
+		ret = balance_dirty_pages(wb, current->nr_dirtied, flags);
 
 	wb_put(wb);
+	return ret;
+}
+EXPORT_SYMBOL(balance_dirty_pages_ratelimited_flags);
+
+/**
+ * balance_dirty_pages_ratelimited - balance dirty memory state
+ * @mapping: address_space which was dirtied
+ *
+ * Like balance_dirty_pages_ratelimited_flags() without any flags, the caller
+ * is throttled until the dirty state is balanced.
+ */
+void balance_dirty_pages_ratelimited(struct address_space *mapping)
+{
+	balance_dirty_pages_ratelimited_flags(mapping, 0);
 }
 EXPORT_SYMBOL(balance_dirty_pages_ratelimited);
 
@@ -6,6 +6,9 @@
 #include <linux/export.h>
 #include <linux/delay.h>
 #include <linux/scatterlist.h>
+#include <linux/debugfs.h>
+#include <linux/nodemask.h>
+#include <linux/seq_file.h>
 
 #include "page_reporting.h"
 #include "internal.h"
@@ -13,12 +16,22 @@
 #define PAGE_REPORTING_DELAY	(2 * HZ)
 static struct page_reporting_dev_info __rcu *pr_dev_info __read_mostly;
 
+/* Lowest order reported, MAX_ORDER until a device is registered */
+unsigned int page_reporting_order = MAX_ORDER;
+
 enum {
 	PAGE_REPORTING_IDLE = 0,
 	PAGE_REPORTING_REQUESTED,
 	PAGE_REPORTING_ACTIVE
 };
 
+static unsigned long
+page_reporting_delay(struct page_reporting_dev_info *prdev)
+{
+	return prdev->delay_ms ? msecs_to_jiffies(prdev->delay_ms) :
+				 PAGE_REPORTING_DELAY;
+}
+
 /* request page reporting */
 static void
 __page_reporting_request(struct page_reporting_dev_info *prdev)
@@ -39,11 +52,11 @@ __page_reporting_request(struct page_reporting_dev_info *prdev)
 		return;
 
 	/*
-	 * Delay the start of work to allow a sizable queue to build. For
-	 * now we are limiting this to running no more than once every
+	 * Delay the start of work to allow a sizable queue to build. By
+	 * default we are limiting this to running no more than once every
 	 * couple of seconds.
 	 */
-	schedule_delayed_work(&prdev->work, PAGE_REPORTING_DELAY);
+	schedule_delayed_work(&prdev->work, page_reporting_delay(prdev));
 }
 
 /* notify prdev of free page reporting request */
@@ -64,6 +77,23 @@ void __page_reporting_notify(void)
 	rcu_read_unlock();
 }
 
+/* account a reported page that is being allocated again */
+void __page_reporting_reused(unsigned int order)
+{
+	struct page_reporting_dev_info *prdev;
+
+	rcu_read_lock();
+	prdev = rcu_dereference(pr_dev_info);
+	if (likely(prdev))
+		atomic_long_add(1L << order, &prdev->reused_pages);
+	rcu_read_unlock();
+}
+
+static bool page_reporting_over_rate(struct page_reporting_dev_info *prdev)
+{
+	return prdev->rate && prdev->budget <= 0;
+}
+
 static void
 page_reporting_drain(struct page_reporting_dev_info *prdev,
 		     struct scatterlist *sgl, unsigned int nents, bool reported)
@@ -81,6 +111,9 @@ page_reporting_drain(struct page_reporting_dev_info *prdev,
 
 		__putback_isolated_page(page, order, mt);
 
+		/* charge the rate limit whether or not the report succeeded */
+		prdev->budget -= 1L << order;
+
 		/* If the pages were not reported due to error skip flagging */
 		if (!reported)
 			continue;
@@ -92,8 +125,11 @@ page_reporting_drain(struct page_reporting_dev_info *prdev,
 		 * report on the new larger page when we make our way
 		 * up to that higher order.
 		 */
-		if (PageBuddy(page) && page_order(page) == order)
+		if (PageBuddy(page) && page_order(page) == order) {
 			__SetPageReported(page);
+			page_zone(page)->reported_pages += 1UL << order;
+			atomic_long_add(1L << order, &prdev->reported_pages);
+		}
 	} while ((sg = sg_next(sg)));
 
 	/* reinitialize scatterlist now that it is empty */
@@ -149,11 +185,12 @@ page_reporting_cycle(struct page_reporting_dev_info *prdev, struct zone *zone,
 			continue;
 
 		/*
-		 * If we fully consumed our budget then update our
-		 * state to indicate that we are requesting additional
+		 * If we fully consumed our budget, or the device is
+		 * over its rate for this pass, then update our state
+		 * to indicate that we are requesting additional
 		 * processing and exit this list.
 		 */
-		if (budget < 0) {
+		if (budget < 0 || page_reporting_over_rate(prdev)) {
 			atomic_set(&prdev->state, PAGE_REPORTING_REQUESTED);
 			next = page;
 			break;
@@ -229,7 +266,7 @@ page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 
 	/* Generate minimum watermark to be able to guarantee progress */
 	watermark = low_wmark_pages(zone) +
-		    (PAGE_REPORTING_CAPACITY << PAGE_REPORTING_MIN_ORDER);
+		    (PAGE_REPORTING_CAPACITY << page_reporting_order);
 
 	/*
 	 * Cancel request if insufficient free memory or if we failed
@@ -239,7 +276,7 @@ page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 		return err;
 
 	/* Process each free list starting from lowest order/mt */
-	for (order = PAGE_REPORTING_MIN_ORDER; order < MAX_ORDER; order++) {
+	for (order = page_reporting_order; order < MAX_ORDER; order++) {
 		for (mt = 0; mt < MIGRATE_TYPES; mt++) {
 			/* We do not pull pages from the isolate free list */
 			if (is_migrate_isolate(mt))
@@ -267,14 +304,71 @@ page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 	return err;
 }
 
+/*
+ * Free pages of the reporting order and above that have not been reported
+ * yet. Read without the zone lock, this only decides the order in which
+ * nodes and zones are processed.
+ */
+static unsigned long zone_unreported_pages(struct zone *zone)
+{
+	unsigned long pages = 0;
+	unsigned int order;
+
+	for (order = page_reporting_order; order < MAX_ORDER; order++)
+		pages += READ_ONCE(zone->free_area[order].nr_free) << order;
+
+	return pages - min(pages, READ_ONCE(zone->reported_pages));
+}
+
+static unsigned long node_unreported_pages(pg_data_t *pgdat)
+{
+	unsigned long pages = 0;
+	int i;
+
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		struct zone *zone = &pgdat->node_zones[i];
+
+		if (populated_zone(zone))
+			pages += zone_unreported_pages(zone);
+	}
+
+	return pages;
+}
+
+static int
+page_reporting_process_node(struct page_reporting_dev_info *prdev,
+			    struct scatterlist *sgl, pg_data_t *pgdat)
+{
+	int i, err = 0;
+
+	/*
+	 * Start with the highest zone, the lower zones are smaller and
+	 * more likely to be needed again by allocations that cannot use
+	 * anything else.
+	 */
+	for (i = MAX_NR_ZONES - 1; i >= 0; i--) {
+		struct zone *zone = &pgdat->node_zones[i];
+
+		if (!populated_zone(zone) || !zone_unreported_pages(zone))
+			continue;
+
+		err = page_reporting_process_zone(prdev, sgl, zone);
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
 static void page_reporting_process(struct work_struct *work)
 {
 	struct delayed_work *d_work = to_delayed_work(work);
 	struct page_reporting_dev_info *prdev =
 		container_of(d_work, struct page_reporting_dev_info, work);
 	int err = 0, state = PAGE_REPORTING_ACTIVE;
+	nodemask_t nodes = node_states[N_MEMORY];
 	struct scatterlist *sgl;
-	struct zone *zone;
+	int nid;
 
 	/*
 	 * Change the state to "Active" so that we can track if there is
@@ -291,8 +385,46 @@ static void page_reporting_process(struct work_struct *work)
 
 	sg_init_table(sgl, PAGE_REPORTING_CAPACITY);
 
-	for_each_zone(zone) {
-		err = page_reporting_process_zone(prdev, sgl, zone);
+	/*
+	 * Each pass may report one delay worth of the device's rate, but
+	 * at least one full scatterlist so that progress is guaranteed.
+	 */
+	if (prdev->rate) {
+		unsigned long ms = jiffies_to_msecs(page_reporting_delay(prdev));
+
+		prdev->budget = max_t(long, prdev->rate * ms / MSEC_PER_SEC,
+				      PAGE_REPORTING_CAPACITY << page_reporting_order);
+	}
+
+	/*
+	 * Process the node with the most unreported memory first, so that
+	 * a rate limited pass returns the memory that is worth the most to
+	 * the host.
+	 */
+	while (!nodes_empty(nodes)) {
+		unsigned long pages, most = 0;
+		int best = first_node(nodes);
+
+		/* Out of budget, pick up where we left off after the delay */
+		if (page_reporting_over_rate(prdev)) {
+			atomic_set(&prdev->state, PAGE_REPORTING_REQUESTED);
+			break;
+		}
+
+		for_each_node_mask(nid, nodes) {
+			pages = node_unreported_pages(NODE_DATA(nid));
+			if (pages > most) {
+				most = pages;
+				best = nid;
+			}
+		}
+
+		/* Nothing left to report on any node */
+		if (!most)
+			break;
+
+		node_clear(best, nodes);
+		err = page_reporting_process_node(prdev, sgl, NODE_DATA(best));
 		if (err)
 			break;
 	}
@@ -301,12 +433,12 @@ static void page_reporting_process(struct work_struct *work)
 err_out:
 	/*
 	 * If the state has reverted back to requested then there may be
-	 * additional pages to be processed. We will defer for 2s to allow
-	 * more pages to accumulate.
+	 * additional pages to be processed. We will defer for the device's
+	 * delay to allow more pages to accumulate.
 	 */
 	state = atomic_cmpxchg(&prdev->state, state, PAGE_REPORTING_IDLE);
 	if (state == PAGE_REPORTING_REQUESTED)
-		schedule_delayed_work(&prdev->work, PAGE_REPORTING_DELAY);
+		schedule_delayed_work(&prdev->work, page_reporting_delay(prdev));
 }
 
 static DEFINE_MUTEX(page_reporting_mutex);
@@ -324,10 +456,20 @@ int page_reporting_register(struct page_reporting_dev_info *prdev)
 		goto err_out;
 	}
 
-	/* initialize state and work structures */
+	if (prdev->order >= MAX_ORDER) {
+		err = -EINVAL;
+		goto err_out;
+	}
+
+	/* initialize state, statistics and work structures */
 	atomic_set(&prdev->state, PAGE_REPORTING_IDLE);
+	atomic_long_set(&prdev->reported_pages, 0);
+	atomic_long_set(&prdev->reused_pages, 0);
 	INIT_DELAYED_WORK(&prdev->work, &page_reporting_process);
 
+	/* Report from the device's order, pageblock_order by default */
+	page_reporting_order = prdev->order ? : PAGE_REPORTING_MIN_ORDER;
+
 	/* Begin initial flush of zones */
 	__page_reporting_request(prdev);
 
@@ -362,3 +504,44 @@ void page_reporting_unregister(struct page_reporting_dev_info *prdev)
 	mutex_unlock(&page_reporting_mutex);
 }
 EXPORT_SYMBOL_GPL(page_reporting_unregister);
+
+static int page_reporting_show(struct seq_file *m, void *v)
+{
+	struct page_reporting_dev_info *prdev;
+	struct zone *zone;
+
+	mutex_lock(&page_reporting_mutex);
+
+	prdev = rcu_dereference_protected(pr_dev_info,
+				lockdep_is_held(&page_reporting_mutex));
+	if (!prdev)
+		goto out;
+
+	seq_printf(m, "order %u\n", page_reporting_order);
+	seq_printf(m, "delay_ms %u\n",
+		   jiffies_to_msecs(page_reporting_delay(prdev)));
+	seq_printf(m, "rate %lu\n", prdev->rate);
+	seq_printf(m, "reported_pages %ld\n",
+		   atomic_long_read(&prdev->reported_pages));
+	seq_printf(m, "reused_pages %ld\n",
+		   atomic_long_read(&prdev->reused_pages));
+
+	for_each_populated_zone(zone)
+		seq_printf(m, "node %d zone %-8s reported %lu unreported %lu\n",
+			   zone_to_nid(zone), zone->name,
+			   READ_ONCE(zone->reported_pages),
+			   zone_unreported_pages(zone));
+out:
+	mutex_unlock(&page_reporting_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(page_reporting);
+
+static int __init page_reporting_debugfs_init(void)
+{
+	debugfs_create_file("page_reporting", 0400, NULL, NULL,
+			    &page_reporting_fops);
+	return 0;
+}
+late_initcall(page_reporting_debugfs_init);
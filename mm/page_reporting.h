@@ -14,7 +14,9 @@
 
 #ifdef CONFIG_PAGE_REPORTING
 DECLARE_STATIC_KEY_FALSE(page_reporting_enabled);
+extern unsigned int page_reporting_order;
 void __page_reporting_notify(void);
+void __page_reporting_reused(unsigned int order);
 
 static inline bool page_reported(struct page *page)
 {
@@ -22,6 +24,23 @@ static inline bool page_reported(struct page *page)
 	       PageReported(page);
 }
 
+/* Called with the zone lock held when a reported page leaves the free lists */
+static inline void page_reporting_dec(struct zone *zone, unsigned int order)
+{
+	zone->reported_pages -= 1UL << order;
+}
+
+/*
+ * A reported page is being allocated, the hypervisor has to fault it back
+ * in.  Called from the allocation path only, before the reported state is
+ * cleared, so that merging with a buddy is not counted as a reuse.
+ */
+static inline void page_reporting_reused(struct page *page, unsigned int order)
+{
+	if (page_reported(page))
+		__page_reporting_reused(order);
+}
+
 /**
  * page_reporting_notify_free - Free page notification to start page processing
  *
@@ -38,7 +57,7 @@ static inline void page_reporting_notify_free(unsigned int order)
 		return;
 
 	/* Determine if we have crossed reporting threshold */
-	if (order < PAGE_REPORTING_MIN_ORDER)
+	if (order < page_reporting_order)
 		return;
 
 	/* This will add a few cycles, but should be called infrequently */
@@ -47,6 +66,14 @@ static inline void page_reporting_notify_free(unsigned int order)
 #else /* CONFIG_PAGE_REPORTING */
 #define page_reported(_page)	false
 
+static inline void page_reporting_dec(struct zone *zone, unsigned int order)
+{
+}
+
+static inline void page_reporting_reused(struct page *page, unsigned int order)
+{
+}
+
 static inline void page_reporting_notify_free(unsigned int order)
 {
 }
@@ -323,7 +323,12 @@ static void pcpu_depopulate_chunk(struct pcpu_chunk *chunk,
 
 	pcpu_unmap_pages(chunk, pages, page_start, page_end);
 
-	/* no need to flush tlb, vmalloc will handle it lazily */
+	/*
+	 * Partially used chunks stay mapped in vmalloc space, so the TLB
+	 * can't be left for vmalloc to flush lazily before the pages are
+	 * freed.
+	 */
+	pcpu_post_unmap_tlb_flush(chunk, page_start, page_end);
 
 	pcpu_free_pages(chunk, pages, page_start, page_end);
 }
@@ -105,6 +105,27 @@
 
 #define PCPU_EMPTY_POP_PAGES_LOW	2
 #define PCPU_EMPTY_POP_PAGES_HIGH	4
+/* depopulate empty pages of partially used chunks above this */
+#define PCPU_EMPTY_POP_PAGES_RECLAIM	16
+
+/*
+ * Small allocations, mostly percpu counters and refcounts, are served from
+ * a per-cpu cache of preallocated areas without taking pcpu_lock.  The
+ * cache is refilled in batches from the chunk which served the miss, and
+ * its areas are zeroed when they are put in the cache.
+ */
+#define PCPU_CACHE_SIZE			8
+#define PCPU_CACHE_BATCH		8
+
+struct pcpu_cache {
+	int			nr;
+	struct {
+		struct pcpu_chunk	*chunk;
+		int			off;
+	} entries[PCPU_CACHE_BATCH];
+};
+
+static DEFINE_PER_CPU(struct pcpu_cache, pcpu_caches);
 
 #ifdef CONFIG_SMP
 /* default addr <-> pcpu_ptr mapping, override in asm/percpu.h if necessary */
@@ -1061,6 +1082,10 @@ static int pcpu_find_block_fit(struct pcpu_chunk *chunk, int alloc_bits,
 	struct pcpu_block_md *chunk_md = &chunk->chunk_md;
 	int bit_off, bits, next_off;
 
+	/* don't walk the hints of a chunk atomic allocations can't use */
+	if (pop_only && !chunk->nr_populated)
+		return -1;
+
 	/*
 	 * Check to see if the allocation can fit in the chunk's contig hint.
 	 * This is an optimization to prevent scanning by assuming if it
@@ -1659,6 +1684,88 @@ static void pcpu_memcg_free_hook(struct pcpu_chunk *chunk, int off, size_t size)
 }
 #endif /* CONFIG_MEMCG_KMEM */
 
+/**
+ * pcpu_cache_get - take an area from the local cache
+ * @chunkp: out param for the chunk of the area
+ * @offp: out param for the offset of the area in @chunkp
+ *
+ * RETURNS:
+ * %true if an area was found in the cache of this cpu.
+ */
+static bool pcpu_cache_get(struct pcpu_chunk **chunkp, int *offp)
+{
+	struct pcpu_cache *cache;
+	unsigned long flags;
+	bool found = false;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(&pcpu_caches);
+	if (cache->nr) {
+		cache->nr--;
+		*chunkp = cache->entries[cache->nr].chunk;
+		*offp = cache->entries[cache->nr].off;
+		found = true;
+	}
+	local_irq_restore(flags);
+
+	return found;
+}
+
+/**
+ * pcpu_cache_refill - refill the local cache from a chunk
+ * @chunk: chunk which served the last miss
+ *
+ * Allocate up to %PCPU_CACHE_BATCH areas from the populated part of
+ * @chunk in one go and put them in the cache of this cpu.  @chunk can't
+ * go away as the caller holds an area in it.
+ */
+static void pcpu_cache_refill(struct pcpu_chunk *chunk)
+{
+	const int bits = PCPU_CACHE_SIZE >> PCPU_MIN_ALLOC_SHIFT;
+	int offs[PCPU_CACHE_BATCH];
+	struct pcpu_cache *cache;
+	unsigned long flags;
+	int nr, i, off, cpu;
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+	for (nr = 0; nr < PCPU_CACHE_BATCH; nr++) {
+		off = pcpu_find_block_fit(chunk, bits, bits, true);
+		if (off < 0)
+			break;
+
+		off = pcpu_alloc_area(chunk, bits, bits, off);
+		if (off < 0)
+			break;
+
+		pcpu_stats_area_alloc(chunk, PCPU_CACHE_SIZE);
+		offs[nr] = off;
+	}
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+
+	for (i = 0; i < nr; i++)
+		for_each_possible_cpu(cpu)
+			memset((void *)pcpu_chunk_addr(chunk, cpu, 0) + offs[i],
+			       0, PCPU_CACHE_SIZE);
+
+	/* we may have migrated to a cpu whose cache got refilled meanwhile */
+	local_irq_save(flags);
+	cache = this_cpu_ptr(&pcpu_caches);
+	for (i = 0; i < nr && cache->nr < PCPU_CACHE_BATCH; i++) {
+		cache->entries[cache->nr].chunk = chunk;
+		cache->entries[cache->nr].off = offs[i];
+		cache->nr++;
+	}
+	local_irq_restore(flags);
+
+	if (i == nr)
+		return;
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+	for (; i < nr; i++)
+		pcpu_free_area(chunk, offs[i]);
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+}
+
 /**
  * pcpu_alloc - the percpu allocator
  * @size: size of area to allocate in bytes
@@ -1680,6 +1787,7 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved,
 	gfp_t pcpu_gfp;
 	bool is_atomic;
 	bool do_warn;
+	bool cacheable;
 	enum pcpu_chunk_type type;
 	struct list_head *pcpu_slot;
 	struct obj_cgroup *objcg = NULL;
@@ -1717,6 +1825,19 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved,
 		return NULL;
 	}
 
+	/* small unaccounted allocations are served from the local cache */
+	cacheable = !reserved && !(gfp & __GFP_ACCOUNT) &&
+		    size == PCPU_CACHE_SIZE && align <= PCPU_CACHE_SIZE;
+	if (cacheable && pcpu_cache_get(&chunk, &off)) {
+		ptr = __addr_to_pcpu_ptr(chunk->base_addr + off);
+		kmemleak_alloc_percpu(ptr, size, gfp);
+
+		trace_percpu_alloc_percpu(reserved, is_atomic, size, align,
+				chunk->base_addr, off, ptr);
+
+		return ptr;
+	}
+
 	type = pcpu_memcg_pre_alloc_hook(size, gfp, &objcg);
 	if (unlikely(type == PCPU_FAIL_ALLOC))
 		return NULL;
@@ -1832,6 +1953,9 @@ area_found:
 		mutex_unlock(&pcpu_alloc_mutex);
 	}
 
+	if (cacheable)
+		pcpu_cache_refill(chunk);
+
 	if (pcpu_nr_empty_pop_pages < PCPU_EMPTY_POP_PAGES_LOW)
 		pcpu_schedule_balance_work();
 
@@ -1929,12 +2053,74 @@ void __percpu *__alloc_reserved_percpu(size_t size, size_t align)
 	return pcpu_alloc(size, align, true, GFP_KERNEL);
 }
 
+/**
+ * pcpu_reclaim_populated - depopulate empty pages of partially used chunks
+ * @type: chunk type
+ *
+ * A chunk which still serves a few allocations keeps all of its pages
+ * populated, so percpu memory only ever grows after a burst of
+ * allocations.  Depopulate empty pages, emptiest chunks first, until
+ * %PCPU_EMPTY_POP_PAGES_HIGH of them are left for atomic allocations.
+ *
+ * Pages are marked depopulated under pcpu_lock before they are unmapped
+ * so atomic allocations stay away from them, non-atomic ones are kept
+ * out by pcpu_alloc_mutex.  The lists may change while pcpu_lock is
+ * dropped, so the scan restarts after each depopulated region.
+ */
+static void pcpu_reclaim_populated(enum pcpu_chunk_type type)
+{
+	struct list_head *pcpu_slot = pcpu_chunk_list(type);
+	struct pcpu_chunk *chunk;
+	int slot, rs, re, nr;
+
+	lockdep_assert_held(&pcpu_alloc_mutex);
+
+restart:
+	spin_lock_irq(&pcpu_lock);
+	for (slot = pcpu_nr_slots - 1; slot >= 0; slot--) {
+		list_for_each_entry(chunk, &pcpu_slot[slot], list) {
+			nr = pcpu_nr_empty_pop_pages - PCPU_EMPTY_POP_PAGES_HIGH;
+			if (nr <= 0)
+				goto out_unlock;
+
+			if (chunk->immutable || !chunk->nr_empty_pop_pages)
+				continue;
+
+			/* find a run of empty populated pages */
+			for (rs = 0; rs < chunk->nr_pages; rs++)
+				if (test_bit(rs, chunk->populated) &&
+				    chunk->md_blocks[rs].contig_hint ==
+				    PCPU_BITMAP_BLOCK_BITS)
+					break;
+			for (re = rs; re < chunk->nr_pages && re - rs < nr; re++)
+				if (!test_bit(re, chunk->populated) ||
+				    chunk->md_blocks[re].contig_hint !=
+				    PCPU_BITMAP_BLOCK_BITS)
+					break;
+			if (rs == re)
+				continue;
+
+			pcpu_chunk_depopulated(chunk, rs, re);
+			spin_unlock_irq(&pcpu_lock);
+
+			/* @chunk can't go away while pcpu_alloc_mutex is held */
+			pcpu_depopulate_chunk(chunk, rs, re);
+			cond_resched();
+			goto restart;
+		}
+	}
+out_unlock:
+	spin_unlock_irq(&pcpu_lock);
+}
+
 /**
  * __pcpu_balance_workfn - manage the amount of free chunks and populated pages
  * @type: chunk type
  *
- * Reclaim all fully free chunks except for the first one.  This is also
- * responsible for maintaining the pool of empty populated pages.  However,
+ * Reclaim all fully free chunks except for the first one and the empty
+ * pages of partially used chunks beyond what atomic allocations need.
+ * This is also responsible for maintaining the pool of empty populated
+ * pages.  However,
  * it is possible that this is called when physical memory is scarce causing
  * OOM killer to be triggered.  We should avoid doing so until an actual
  * allocation causes the failure as it is possible that requests can be
@@ -1983,6 +2169,8 @@ static void __pcpu_balance_workfn(enum pcpu_chunk_type type)
 		cond_resched();
 	}
 
+	pcpu_reclaim_populated(type);
+
 	/*
 	 * Ensure there are certain number of free populated pages for
 	 * atomic allocs.  Fill up from the most packed so that atomic
@@ -2083,7 +2271,7 @@ void free_percpu(void __percpu *ptr)
 	void *addr;
 	struct pcpu_chunk *chunk;
 	unsigned long flags;
-	int size, off;
+	int size, off, nr_empty;
 	bool need_balance = false;
 	struct list_head *pcpu_slot;
 
@@ -2098,6 +2286,7 @@ void free_percpu(void __percpu *ptr)
 
 	chunk = pcpu_chunk_addr_search(addr);
 	off = addr - chunk->base_addr;
+	nr_empty = chunk->nr_empty_pop_pages;
 
 	size = pcpu_free_area(chunk, off);
 
@@ -2116,6 +2305,11 @@ void free_percpu(void __percpu *ptr)
 			}
 	}
 
+	/* this emptied a page which can be depopulated */
+	if (!chunk->immutable && chunk->nr_empty_pop_pages > nr_empty &&
+	    pcpu_nr_empty_pop_pages > PCPU_EMPTY_POP_PAGES_RECLAIM)
+		need_balance = true;
+
 	trace_percpu_free_percpu(chunk->base_addr, off, ptr);
 
 	spin_unlock_irqrestore(&pcpu_lock, flags);
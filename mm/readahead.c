@@ -24,6 +24,8 @@
 #include <linux/fadvise.h>
 #include <linux/sched/mm.h>
 
+#include <trace/events/filemap.h>
+
 #include "internal.h"
 
 /*
@@ -157,6 +159,47 @@ out:
 		rac->_index++;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Mappings that can hold large pages get a PMD sized THP for every aligned
+ * part of the readahead window that is entirely covered by it.  The
+ * allocation is opportunistic: no direct reclaim or compaction, and the
+ * caller falls back to small pages if it fails or anything in the range is
+ * already cached.
+ */
+static struct page *ra_alloc_large_page(struct address_space *mapping,
+		pgoff_t index, unsigned long nr_left, gfp_t gfp_mask)
+{
+	struct page *page;
+
+	if (!mapping_large_pages(mapping) || !mapping->a_ops->readahead)
+		return NULL;
+	if ((index & (HPAGE_PMD_NR - 1)) || nr_left < HPAGE_PMD_NR)
+		return NULL;
+
+	gfp_mask |= __GFP_COMP | __GFP_NORETRY | __GFP_NOWARN;
+	page = alloc_pages(gfp_mask & ~__GFP_DIRECT_RECLAIM, HPAGE_PMD_ORDER);
+	if (!page) {
+		count_vm_event(THP_FILE_FALLBACK);
+		return NULL;
+	}
+	prep_transhuge_page(page);
+
+	if (add_to_page_cache_lru(page, mapping, index, gfp_mask) < 0) {
+		put_page(page);
+		return NULL;
+	}
+	count_vm_event(THP_FILE_ALLOC);
+	return page;
+}
+#else
+static inline struct page *ra_alloc_large_page(struct address_space *mapping,
+		pgoff_t index, unsigned long nr_left, gfp_t gfp_mask)
+{
+	return NULL;
+}
+#endif
+
 /**
  * page_cache_readahead_unbounded - Start unchecked readahead.
  * @mapping: File address space.
@@ -219,6 +262,18 @@ void page_cache_readahead_unbounded(struct address_space *mapping,
 			continue;
 		}
 
+		page = ra_alloc_large_page(mapping, index + i, nr_to_read - i,
+					   gfp_mask);
+		if (page) {
+			unsigned long nr = thp_nr_pages(page);
+
+			if (nr_to_read - lookahead_size - i < nr)
+				SetPageReadahead(page);
+			rac._nr_pages += nr;
+			i += nr - 1;
+			continue;
+		}
+
 		page = __page_cache_alloc(gfp_mask);
 		if (!page)
 			break;
@@ -454,6 +509,13 @@ static void ondemand_readahead(struct address_space *mapping,
 	if (req_size > max_pages && bdi->io_pages > max_pages)
 		max_pages = min(req_size, bdi->io_pages);
 
+	/*
+	 * Large pages are only used for windows covering a whole THP, so let
+	 * sequential streams on mappings that can hold them ramp up that far.
+	 */
+	if (mapping_large_pages(mapping))
+		max_pages = max_t(unsigned long, max_pages, HPAGE_PMD_NR);
+
 	/*
 	 * start of file
 	 */
@@ -548,6 +610,14 @@ readit:
 		}
 	}
 
+	/*
+	 * Stretch a full sized window to the next THP boundary so that the
+	 * windows following it are aligned and can use large pages.
+	 */
+	if (mapping_large_pages(mapping) && ra->size >= HPAGE_PMD_NR)
+		ra->size = round_up(ra->start + ra->size, HPAGE_PMD_NR) -
+			   ra->start;
+
 	ra_submit(ra, mapping, filp);
 }
 
@@ -616,7 +686,8 @@ page_cache_async_readahead(struct address_space *mapping,
 	if (PageWriteback(page))
 		return;
 
-	ClearPageReadahead(page);
+	/* A THP carries the marker on its head page */
+	ClearPageReadahead(compound_head(page));
 
 	/*
 	 * Defer asynchronous read-ahead on IO congestion.
@@ -632,6 +703,151 @@ page_cache_async_readahead(struct address_space *mapping,
 }
 EXPORT_SYMBOL_GPL(page_cache_async_readahead);
 
+/*
+ * Stride detection for mmap faults.
+ *
+ * Column scans and sampled reads of mmap'ed files fault on every n-th
+ * page: read-around spends most of its I/O on pages that are never used
+ * and sequential readahead never gets going.  Instead, keep the delta
+ * between consecutive faults in file_ra_state, and once it stays the same
+ * for RA_STRIDE_HITS faults (one with MADV_STRIDED), read the pages it
+ * predicts ahead of the faults.  Predictions are topped up in batches,
+ * so the mmap_lock is dropped for I/O once every few faults at most.
+ */
+#define RA_STRIDE_HITS		2
+#define RA_STRIDE_MAX_PAGES	32
+
+static unsigned long ra_stride_pages(struct file_ra_state *ra)
+{
+	return clamp_t(unsigned long, ra->ra_pages / 4, 1, RA_STRIDE_MAX_PAGES);
+}
+
+/* number of predicted pages already read beyond @index */
+static long ra_stride_ahead(struct file_ra_state *ra, pgoff_t index)
+{
+	return ((long)ra->stride_next - (long)index) / ra->fault_stride - 1;
+}
+
+/*
+ * Sequential access with fault-around also faults at a constant delta,
+ * but leaves the pages in between cached.
+ */
+static bool ra_stride_sparse(struct address_space *mapping, pgoff_t index,
+			     long stride)
+{
+	void *entry;
+
+	rcu_read_lock();
+	entry = xa_load(&mapping->i_pages, stride > 0 ? index - 1 : index + 1);
+	rcu_read_unlock();
+
+	return !entry || xa_is_value(entry);
+}
+
+/**
+ * page_cache_stride_update - track the stride of mmap faults
+ * @mapping: address_space of the faulting file
+ * @ra: file_ra_state which holds the stride state
+ * @index: index of the faulting page
+ * @hinted: the vma was marked with MADV_STRIDED
+ * @cached: the faulting page was found in the page cache
+ *
+ * Return: true if @index continues an established stride, in which case
+ * the caller should use page_cache_stride_readahead() instead of
+ * read-around.
+ */
+bool page_cache_stride_update(struct address_space *mapping,
+			      struct file_ra_state *ra, pgoff_t index,
+			      bool hinted, bool cached)
+{
+	unsigned int need = hinted ? 1 : RA_STRIDE_HITS;
+	long delta = (long)index - (long)ra->fault_prev;
+	long ahead;
+
+	/* refault of the same page after dropping the mmap_lock */
+	if (!delta)
+		return ra->stride_hits >= need;
+
+	if (delta != ra->fault_stride || delta == 1 || delta == -1 ||
+	    !ra_stride_sparse(mapping, index, delta)) {
+		ahead = ra->fault_stride ?
+			ra_stride_ahead(ra, ra->fault_prev) : 0;
+		if (ra->stride_hits >= need && ahead > 0)
+			trace_mm_filemap_stride_waste(mapping, index,
+						      ra->fault_stride, ahead);
+
+		ra->fault_prev = index;
+		ra->fault_stride = delta;
+		ra->stride_next = index;
+		ra->stride_hits = 0;
+		return false;
+	}
+
+	ra->fault_prev = index;
+	if (ra->stride_hits < UINT_MAX)
+		ra->stride_hits++;
+	if (ra->stride_hits < need)
+		return false;
+
+	if (cached && ra_stride_ahead(ra, index) >= 0)
+		trace_mm_filemap_stride_hit(mapping, index, delta, 1);
+
+	return true;
+}
+
+/**
+ * page_cache_stride_wants_io - check whether predictions should be topped up
+ * @ra: file_ra_state which holds the stride state
+ * @index: index of the faulting page
+ *
+ * Return: true once fewer than half of the predicted pages are left ahead
+ * of @index.
+ */
+bool page_cache_stride_wants_io(struct file_ra_state *ra, pgoff_t index)
+{
+	return ra_stride_ahead(ra, index) < (long)ra_stride_pages(ra) / 2;
+}
+
+/**
+ * page_cache_stride_readahead - read the pages predicted by the stride
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the stride state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @index: index of the faulting page
+ *
+ * Read up to ra_stride_pages() predicted pages beyond @index, each as a
+ * separate request through the usual readahead path, under one plug so
+ * the block layer sees them together.
+ */
+void page_cache_stride_readahead(struct address_space *mapping,
+				 struct file_ra_state *ra, struct file *filp,
+				 pgoff_t index)
+{
+	long stride = ra->fault_stride;
+	long next = ra->stride_next;
+	long last = (long)index + stride * (long)ra_stride_pages(ra);
+	unsigned long nr = 0;
+	struct blk_plug plug;
+
+	if (blk_cgroup_congested())
+		return;
+
+	if (ra_stride_ahead(ra, index) < 0)
+		next = (long)index + stride;
+
+	blk_start_plug(&plug);
+	while (next >= 0 && (stride > 0 ? next <= last : next >= last)) {
+		__do_page_cache_readahead(mapping, filp, next, 1, 0);
+		next += stride;
+		nr++;
+	}
+	blk_finish_plug(&plug);
+
+	ra->stride_next = next;
+	if (nr)
+		trace_mm_filemap_stride_readahead(mapping, index, stride, nr);
+}
+
 ssize_t ksys_readahead(int fd, loff_t offset, size_t count)
 {
 	ssize_t ret;
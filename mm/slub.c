@@ -224,6 +224,19 @@ static inline int sysfs_slab_alias(struct kmem_cache *s, const char *p)
 							{ return 0; }
 #endif
 
+#ifdef CONFIG_NUMA
+static bool remote_sheaf_free(struct kmem_cache *s, struct page *page,
+			      void *object, int cnt);
+static void flush_remote_sheaves(struct kmem_cache *s, int cpu);
+static bool has_remote_sheaves(struct kmem_cache *s, int cpu);
+#else
+static inline bool remote_sheaf_free(struct kmem_cache *s, struct page *page,
+				     void *object, int cnt) { return false; }
+static inline void flush_remote_sheaves(struct kmem_cache *s, int cpu) { }
+static inline bool has_remote_sheaves(struct kmem_cache *s, int cpu)
+							{ return false; }
+#endif
+
 static inline void stat(const struct kmem_cache *s, enum stat_item si)
 {
 #ifdef CONFIG_SLUB_STATS
@@ -2444,6 +2457,7 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 		flush_slab(s, c);
 
 	unfreeze_partials(s, c);
+	flush_remote_sheaves(s, cpu);
 }
 
 static void flush_cpu_slab(void *d)
@@ -2458,7 +2472,8 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->page || slub_percpu_partial(c);
+	return c->page || slub_percpu_partial(c) ||
+	       has_remote_sheaves(s, cpu);
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -3126,7 +3141,7 @@ redo:
 			goto redo;
 		}
 		stat(s, FREE_FASTPATH);
-	} else
+	} else if (!remote_sheaf_free(s, page, head, cnt))
 		__slab_free(s, page, head, tail_obj, cnt, addr);
 
 }
@@ -3251,6 +3266,160 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	return first_skipped_index;
 }
 
+#ifdef CONFIG_NUMA
+/*
+ * Remote free sheaves.
+ *
+ * Freeing an object to a slab on another node than the one the freeing cpu
+ * is on has to pull the struct page and the list_lock of the remote node
+ * into the local cache for every object. With slub_remote_sheaves such
+ * frees are collected in a small per cpu array for each node instead and
+ * handed back as detached freelists once the array is full, so a slab page
+ * is touched once per batch rather than once per object. The sheaves are
+ * emptied whenever the cpu slabs are flushed.
+ */
+#define SLUB_REMOTE_SHEAF_SIZE		32
+#define SLUB_REMOTE_SHEAF_MAX_NODES	8
+
+struct slub_remote_sheaf {
+	unsigned int count;
+	void *objects[SLUB_REMOTE_SHEAF_SIZE];
+};
+
+static bool slub_remote_sheaves __ro_after_init;
+static bool remote_sheaves_ready;
+
+static int __init setup_slub_remote_sheaves(char *str)
+{
+	slub_remote_sheaves = true;
+
+	return 1;
+}
+
+__setup("slub_remote_sheaves", setup_slub_remote_sheaves);
+
+/* Called with interrupts disabled */
+static void free_remote_sheaf(struct kmem_cache *s,
+			      struct slub_remote_sheaf *sheaf)
+{
+	size_t size = sheaf->count;
+
+	stat(s, FREE_REMOTE_FLUSH);
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, sheaf->objects, &df);
+		if (!df.page)
+			continue;
+
+		__slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			    _RET_IP_);
+	} while (likely(size));
+
+	sheaf->count = 0;
+}
+
+static bool remote_sheaf_free(struct kmem_cache *s, struct page *page,
+			      void *object, int cnt)
+{
+	struct slub_remote_sheaf *sheaf;
+	unsigned long flags;
+	int node = page_to_nid(page);
+
+	if (node == numa_mem_id())
+		return false;
+
+	stat(s, FREE_REMOTE);
+	if (!s->remote_sheaves || cnt > 1)
+		return false;
+
+	local_irq_save(flags);
+	sheaf = this_cpu_ptr(s->remote_sheaves) + node;
+	sheaf->objects[sheaf->count++] = object;
+	if (sheaf->count == SLUB_REMOTE_SHEAF_SIZE)
+		free_remote_sheaf(s, sheaf);
+	local_irq_restore(flags);
+
+	return true;
+}
+
+/* Called with interrupts disabled or for an offline cpu */
+static void flush_remote_sheaves(struct kmem_cache *s, int cpu)
+{
+	struct slub_remote_sheaf *sheaf;
+	int node;
+
+	if (!s->remote_sheaves)
+		return;
+
+	sheaf = per_cpu_ptr(s->remote_sheaves, cpu);
+	for (node = 0; node < nr_node_ids; node++)
+		if (sheaf[node].count)
+			free_remote_sheaf(s, &sheaf[node]);
+}
+
+static bool has_remote_sheaves(struct kmem_cache *s, int cpu)
+{
+	struct slub_remote_sheaf *sheaf;
+	int node;
+
+	if (!s->remote_sheaves)
+		return false;
+
+	sheaf = per_cpu_ptr(s->remote_sheaves, cpu);
+	for (node = 0; node < nr_node_ids; node++)
+		if (READ_ONCE(sheaf[node].count))
+			return true;
+
+	return false;
+}
+
+static void alloc_remote_sheaves(struct kmem_cache *s)
+{
+	if (!remote_sheaves_ready || kmem_cache_debug(s))
+		return;
+
+	/* Failing to get the sheaves only means frees are not batched */
+	s->remote_sheaves = __alloc_percpu(nr_node_ids *
+					   sizeof(struct slub_remote_sheaf),
+					   sizeof(void *));
+}
+
+static void free_remote_sheaves(struct kmem_cache *s)
+{
+	free_percpu(s->remote_sheaves);
+	s->remote_sheaves = NULL;
+}
+
+/*
+ * The boot caches are created before the percpu allocator can grow, so the
+ * sheaves of the caches that exist by then are only allocated here.
+ */
+static void __init init_remote_sheaves(void)
+{
+	struct kmem_cache *s;
+
+	if (!slub_remote_sheaves)
+		return;
+
+	if (nr_node_ids < 2 || nr_node_ids > SLUB_REMOTE_SHEAF_MAX_NODES) {
+		pr_info("SLUB: remote free sheaves need 2 to %d nodes, disabled\n",
+			SLUB_REMOTE_SHEAF_MAX_NODES);
+		return;
+	}
+
+	mutex_lock(&slab_mutex);
+	remote_sheaves_ready = true;
+	list_for_each_entry(s, &slab_caches, list)
+		alloc_remote_sheaves(s);
+	mutex_unlock(&slab_mutex);
+}
+#else
+static inline void alloc_remote_sheaves(struct kmem_cache *s) { }
+static inline void free_remote_sheaves(struct kmem_cache *s) { }
+static inline void init_remote_sheaves(void) { }
+#endif
+
 /* Note that interrupts must be enabled when calling this function. */
 void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 {
@@ -3496,6 +3665,7 @@ static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
 		return 0;
 
 	init_kmem_cache_cpus(s);
+	alloc_remote_sheaves(s);
 
 	return 1;
 }
@@ -3562,6 +3732,7 @@ static void free_kmem_cache_nodes(struct kmem_cache *s)
 void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
+	free_remote_sheaves(s);
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 }
@@ -4400,6 +4571,7 @@ void __init kmem_cache_init(void)
 
 void __init kmem_cache_init_late(void)
 {
+	init_remote_sheaves();
 }
 
 struct kmem_cache *
@@ -5408,6 +5580,8 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(FREE_REMOTE, free_remote);
+STAT_ATTR(FREE_REMOTE_FLUSH, free_remote_flush);
 #endif	/* CONFIG_SLUB_STATS */
 
 static struct attribute *slab_attrs[] = {
@@ -5474,6 +5648,8 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&free_remote_attr.attr,
+	&free_remote_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -23,12 +23,14 @@
 #include <linux/memblock.h>
 #include <linux/memremap.h>
 #include <linux/highmem.h>
+#include <linux/memory_hotplug.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 #include <linux/sched.h>
 #include <asm/dma.h>
 #include <asm/pgalloc.h>
+#include <asm/tlbflush.h>
 
 /*
  * Allocate a block of memory to be used to back the virtual memory map
@@ -263,3 +265,192 @@ struct page * __meminit __populate_section_memmap(unsigned long pfn,
 
 	return pfn_to_page(pfn);
 }
+
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+/*
+ * Remapping of populated vmemmap ranges, used to free the vmemmap pages
+ * backing the tail struct pages of HugeTLB pages (see mm/hugetlb_vmemmap.c).
+ *
+ * The range [@start, @end) is remapped onto the vmemmap page mapped at
+ * @reuse, which must be the page right before @start. Callers serialize
+ * on the struct pages being remapped, the vmemmap PTEs of different
+ * ranges never overlap; only splitting a PMD mapping of the vmemmap
+ * needs init_mm.page_table_lock.
+ */
+static pmd_t *vmemmap_pmd(unsigned long addr)
+{
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+
+	pgd = pgd_offset_k(addr);
+	if (pgd_none(*pgd))
+		return NULL;
+	p4d = p4d_offset(pgd, addr);
+	if (p4d_none(*p4d))
+		return NULL;
+	pud = pud_offset(p4d, addr);
+	if (pud_none(*pud) || pud_leaf(*pud))
+		return NULL;
+	return pmd_offset(pud, addr);
+}
+
+static pte_t *vmemmap_pte(unsigned long addr)
+{
+	return pte_offset_kernel(vmemmap_pmd(addr), addr);
+}
+
+static int vmemmap_split_pmd(pmd_t *pmd, unsigned long start)
+{
+	struct page *page = pmd_page(*pmd);
+	unsigned long addr = start;
+	pte_t *pgtable;
+	pmd_t __pmd;
+	int i;
+
+	pgtable = pte_alloc_one_kernel(&init_mm);
+	if (!pgtable)
+		return -ENOMEM;
+
+	pmd_populate_kernel(&init_mm, &__pmd, pgtable);
+	for (i = 0; i < PTRS_PER_PTE; i++, addr += PAGE_SIZE)
+		set_pte_at(&init_mm, addr, pte_offset_kernel(&__pmd, addr),
+			   mk_pte(page + i, PAGE_KERNEL));
+
+	spin_lock(&init_mm.page_table_lock);
+	if (likely(pmd_leaf(*pmd))) {
+		/* From now on the vmemmap pages are freed one by one */
+		if (!PageReserved(page))
+			split_page(page, get_order(PMD_SIZE));
+
+		/* Make the PTEs visible before the PMD, see __pte_alloc() */
+		smp_wmb();
+		pmd_populate_kernel(&init_mm, pmd, pgtable);
+		flush_tlb_kernel_range(start, start + PMD_SIZE);
+	} else {
+		pte_free_kernel(&init_mm, pgtable);
+	}
+	spin_unlock(&init_mm.page_table_lock);
+
+	return 0;
+}
+
+static void free_vmemmap_page(struct page *page)
+{
+	if (!PageReserved(page)) {
+		__free_page(page);
+		return;
+	}
+
+#ifdef CONFIG_HAVE_BOOTMEM_INFO_NODE
+	switch ((unsigned long)page->freelist) {
+	case SECTION_INFO:
+	case MIX_SECTION_INFO:
+		/* Registered by register_page_bootmem_memmap() */
+		put_page_bootmem(page);
+		return;
+	}
+#endif
+	free_reserved_page(page);
+}
+
+/**
+ * vmemmap_remap_free - remap a vmemmap range onto one page, read-only
+ * @start: start of the range, page aligned
+ * @end: end of the range, page aligned
+ * @reuse: vmemmap address of the page to map the range onto, @start - PAGE_SIZE
+ *
+ * The vmemmap pages that backed the range are freed. Nothing is remapped
+ * if the PMD mappings covering the range cannot be split.
+ *
+ * Return: 0 on success, -ENOMEM otherwise.
+ */
+int vmemmap_remap_free(unsigned long start, unsigned long end,
+		       unsigned long reuse)
+{
+	LIST_HEAD(vmemmap_pages);
+	struct page *page, *next, *reuse_page;
+	unsigned long addr;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	VM_BUG_ON(start - reuse != PAGE_SIZE);
+
+	for (addr = reuse & PMD_MASK; addr < end; addr += PMD_SIZE) {
+		pmd = vmemmap_pmd(addr);
+		if (WARN_ON_ONCE(!pmd || pmd_none(*pmd)))
+			return -ENOMEM;
+		if (pmd_leaf(*pmd) && vmemmap_split_pmd(pmd, addr))
+			return -ENOMEM;
+	}
+
+	reuse_page = pte_page(*vmemmap_pte(reuse));
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		pte = vmemmap_pte(addr);
+		page = pte_page(*pte);
+		list_add(&page->lru, &vmemmap_pages);
+		set_pte_at(&init_mm, addr, pte,
+			   mk_pte(reuse_page, PAGE_KERNEL_RO));
+	}
+	flush_tlb_kernel_range(start, end);
+
+	list_for_each_entry_safe(page, next, &vmemmap_pages, lru) {
+		list_del(&page->lru);
+		free_vmemmap_page(page);
+	}
+
+	return 0;
+}
+
+/**
+ * vmemmap_remap_alloc - undo vmemmap_remap_free()
+ * @start: start of the range, page aligned
+ * @end: end of the range, page aligned
+ * @reuse: vmemmap address of the page the range is mapped onto
+ * @gfp_mask: allocation flags for the new vmemmap pages
+ *
+ * Every page of the range gets its own vmemmap page again, initialized
+ * with a copy of the reused page and mapped writable.
+ *
+ * Return: 0 on success, -ENOMEM if the vmemmap pages cannot be allocated,
+ * in which case the range is left as it was.
+ */
+int vmemmap_remap_alloc(unsigned long start, unsigned long end,
+			unsigned long reuse, gfp_t gfp_mask)
+{
+	LIST_HEAD(vmemmap_pages);
+	int nid = page_to_nid((struct page *)start);
+	struct page *page, *next;
+	unsigned long addr;
+
+	VM_BUG_ON(start - reuse != PAGE_SIZE);
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		page = alloc_pages_node(nid, gfp_mask, 0);
+		if (!page)
+			goto out_free;
+		list_add_tail(&page->lru, &vmemmap_pages);
+	}
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		page = list_first_entry(&vmemmap_pages, struct page, lru);
+		list_del(&page->lru);
+		copy_page(page_to_virt(page), (void *)reuse);
+
+		/* Make the copy visible before the mapping */
+		smp_wmb();
+		set_pte_at(&init_mm, addr, vmemmap_pte(addr),
+			   mk_pte(page, PAGE_KERNEL));
+	}
+	flush_tlb_kernel_range(start, end);
+
+	return 0;
+
+out_free:
+	list_for_each_entry_safe(page, next, &vmemmap_pages, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	return -ENOMEM;
+}
+#endif /* CONFIG_HUGETLB_PAGE_FREE_VMEMMAP */
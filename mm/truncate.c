@@ -182,7 +182,7 @@ truncate_cleanup_page(struct address_space *mapping, struct page *page)
 	}
 
 	if (page_has_private(page))
-		do_invalidatepage(page, 0, PAGE_SIZE);
+		do_invalidatepage(page, 0, thp_size(page));
 
 	/*
 	 * Some filesystems seem to re-dirty the page even after
@@ -264,6 +264,74 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/**
+ * split_page_cache_thp - split a THP in the page cache of a regular file
+ * @page: any locked page of the THP
+ *
+ * The filesystem's private data is released first, as split_huge_page()
+ * refuses pages carrying the extra reference that comes with it.  @page
+ * stays locked and referenced, the other subpages are unlocked.
+ *
+ * Return: 0 on success, -EBUSY if the THP is busy.
+ */
+int split_page_cache_thp(struct page *page)
+{
+	struct page *head = compound_head(page);
+
+	VM_BUG_ON_PAGE(!PageLocked(head), head);
+
+	if (PageWriteback(head))
+		return -EBUSY;
+	if (page_has_private(head) && !try_to_release_page(head, GFP_KERNEL))
+		return -EBUSY;
+	return split_huge_page(page);
+}
+EXPORT_SYMBOL_GPL(split_page_cache_thp);
+
+/*
+ * A THP of a large page mapping containing @pos, the first or the last byte
+ * of the range [@lstart, @lend] being truncated, must not straddle the
+ * range when the per-page loops below see it, so split it.  If that fails,
+ * zero the part inside the range, keep the THP and return true, with its
+ * extent in *@thp_start and *@thp_end, so that the caller can shrink the
+ * range around it.
+ */
+static bool truncate_huge_boundary(struct address_space *mapping, loff_t pos,
+		loff_t lstart, loff_t lend, loff_t *thp_start, loff_t *thp_end)
+{
+	struct page *page, *head;
+	loff_t start, end;
+	bool kept = false;
+
+	page = find_lock_page(mapping, pos >> PAGE_SHIFT);
+	if (!page)
+		return false;
+
+	head = compound_head(page);
+	start = page_offset(head);
+	end = start + thp_size(head);
+	if (!PageTransHuge(head) || (start >= lstart && end - 1 <= lend))
+		goto out;
+
+	wait_on_page_writeback(head);
+	if (!split_page_cache_thp(page))
+		goto out;
+
+	zero_user_segment(head, max(start, lstart) - start,
+			  min(end - 1, lend) + 1 - start);
+	cleancache_invalidate_page(mapping, head);
+	if (page_has_private(head))
+		do_invalidatepage(head, max(start, lstart) - start,
+				  min(end - 1, lend) + 1 - max(start, lstart));
+	*thp_start = start;
+	*thp_end = end;
+	kept = true;
+out:
+	unlock_page(page);
+	put_page(page);
+	return kept;
+}
+
 /**
  * truncate_inode_pages_range - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -303,6 +371,21 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	if (mapping->nrpages == 0 && mapping->nrexceptional == 0)
 		goto out;
 
+	if (mapping_large_pages(mapping)) {
+		loff_t last = lend == -1 ? LLONG_MAX : lend;
+		loff_t thp_start, thp_end;
+
+		if (truncate_huge_boundary(mapping, lstart, lstart, last,
+					   &thp_start, &thp_end))
+			lstart = thp_end;
+		if (lend != -1 && lend >= lstart &&
+		    truncate_huge_boundary(mapping, lend, lstart, last,
+					   &thp_start, &thp_end))
+			lend = thp_start - 1;
+		if (lend != -1 && lend < lstart)
+			goto out;
+	}
+
 	/* Offsets within partial pages */
 	partial_start = lstart & (PAGE_SIZE - 1);
 	partial_end = (lend + 1) & (PAGE_SIZE - 1);
@@ -348,9 +431,13 @@ void truncate_inode_pages_range(struct address_space *mapping,
 			if (xa_is_value(page))
 				continue;
 
+			/* Don't look up the tail pages of a THP next */
+			if (PageTransHuge(page))
+				index += thp_nr_pages(page) - 1;
+
 			if (!trylock_page(page))
 				continue;
-			WARN_ON(page_to_index(page) != index);
+			WARN_ON(page_to_index(page) != indices[i]);
 			if (PageWriteback(page)) {
 				unlock_page(page);
 				continue;
@@ -717,6 +804,14 @@ int invalidate_inode_pages2_range(struct address_space *mapping,
 
 			lock_page(page);
 			WARN_ON(page_to_index(page) != index);
+			/* The rest of the THP is looked up again after this */
+			if (PageTransCompound(page) &&
+			    compound_head(page)->mapping == mapping &&
+			    split_page_cache_thp(page)) {
+				ret = -EBUSY;
+				unlock_page(page);
+				continue;
+			}
 			if (page->mapping != mapping) {
 				unlock_page(page);
 				continue;
@@ -176,6 +176,75 @@ out_unlock:
 	return ret;
 }
 
+/*
+ * Map a page which is already in the page cache of a shmem file, for
+ * UFFDIO_CONTINUE: the page is not copied, its reference and lock are handed
+ * over by the caller.
+ */
+static int mcontinue_install_pte(struct mm_struct *dst_mm,
+				 pmd_t *dst_pmd,
+				 struct vm_area_struct *dst_vma,
+				 unsigned long dst_addr,
+				 struct page *page)
+{
+	pte_t _dst_pte, *dst_pte;
+	spinlock_t *ptl;
+	int ret;
+	pgoff_t offset, max_off;
+	struct inode *inode = file_inode(dst_vma->vm_file);
+
+	_dst_pte = mk_pte(page, dst_vma->vm_page_prot);
+	/* A private mapping gets write access by breaking COW on a fault */
+	if ((dst_vma->vm_flags & VM_WRITE) && (dst_vma->vm_flags & VM_SHARED))
+		_dst_pte = pte_mkwrite(pte_mkdirty(_dst_pte));
+
+	dst_pte = pte_offset_map_lock(dst_mm, dst_pmd, dst_addr, &ptl);
+	offset = linear_page_index(dst_vma, dst_addr);
+	max_off = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
+	ret = -EFAULT;
+	if (unlikely(offset >= max_off))
+		goto out_unlock;
+	ret = -EEXIST;
+	if (!pte_none(*dst_pte))
+		goto out_unlock;
+
+	page_add_file_rmap(page, false);
+	inc_mm_counter(dst_mm, mm_counter_file(page));
+	set_pte_at(dst_mm, dst_addr, dst_pte, _dst_pte);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(dst_vma, dst_addr, dst_pte);
+	ret = 0;
+out_unlock:
+	pte_unmap_unlock(dst_pte, ptl);
+	return ret;
+}
+
+/* Handles UFFDIO_CONTINUE for all shmem VMAs (shared or private). */
+static int mcontinue_atomic_pte(struct mm_struct *dst_mm,
+				pmd_t *dst_pmd,
+				struct vm_area_struct *dst_vma,
+				unsigned long dst_addr)
+{
+	struct inode *inode = file_inode(dst_vma->vm_file);
+	pgoff_t pgoff = linear_page_index(dst_vma, dst_addr);
+	struct page *page;
+	int ret;
+
+	ret = shmem_getpage(inode, pgoff, &page, SGP_READ);
+	if (ret)
+		return ret;
+	/* A hole is not a minor fault: it wants UFFDIO_COPY instead */
+	if (!page)
+		return -EFAULT;
+
+	ret = mcontinue_install_pte(dst_mm, dst_pmd, dst_vma, dst_addr, page);
+	unlock_page(page);
+	if (ret)
+		put_page(page);
+	return ret;
+}
+
 static pmd_t *mm_alloc_pmd(struct mm_struct *mm, unsigned long address)
 {
 	pgd_t *pgd;
@@ -207,7 +276,7 @@ static __always_inline ssize_t __mcopy_atomic_hugetlb(struct mm_struct *dst_mm,
 					      unsigned long dst_start,
 					      unsigned long src_start,
 					      unsigned long len,
-					      bool zeropage)
+					      enum mcopy_atomic_mode mode)
 {
 	int vm_alloc_shared = dst_vma->vm_flags & VM_SHARED;
 	int vm_shared = dst_vma->vm_flags & VM_SHARED;
@@ -227,7 +296,7 @@ static __always_inline ssize_t __mcopy_atomic_hugetlb(struct mm_struct *dst_mm,
 	 * by THP.  Since we can not reliably insert a zero page, this
 	 * feature is not supported.
 	 */
-	if (zeropage) {
+	if (mode == MCOPY_ATOMIC_ZEROPAGE) {
 		mmap_read_unlock(dst_mm);
 		return -EINVAL;
 	}
@@ -306,7 +375,9 @@ retry:
 		}
 
 		err = hugetlb_mcopy_atomic_pte(dst_mm, dst_pte, dst_vma,
-						dst_addr, src_addr, &page);
+					       dst_addr, src_addr,
+					       mode == MCOPY_ATOMIC_CONTINUE,
+					       &page);
 
 		mutex_unlock(&hugetlb_fault_mutex_table[hash]);
 		i_mmap_unlock_read(mapping);
@@ -408,7 +479,7 @@ extern ssize_t __mcopy_atomic_hugetlb(struct mm_struct *dst_mm,
 				      unsigned long dst_start,
 				      unsigned long src_start,
 				      unsigned long len,
-				      bool zeropage);
+				      enum mcopy_atomic_mode mode);
 #endif /* CONFIG_HUGETLB_PAGE */
 
 static __always_inline ssize_t mfill_atomic_pte(struct mm_struct *dst_mm,
@@ -417,11 +488,16 @@ static __always_inline ssize_t mfill_atomic_pte(struct mm_struct *dst_mm,
 						unsigned long dst_addr,
 						unsigned long src_addr,
 						struct page **page,
-						bool zeropage,
+						enum mcopy_atomic_mode mode,
 						bool wp_copy)
 {
+	bool zeropage = mode == MCOPY_ATOMIC_ZEROPAGE;
 	ssize_t err;
 
+	if (mode == MCOPY_ATOMIC_CONTINUE)
+		return mcontinue_atomic_pte(dst_mm, dst_pmd, dst_vma,
+					    dst_addr);
+
 	/*
 	 * The normal page fault path for a shmem will invoke the
 	 * fault, fill the hole in the file and COW it right away. The
@@ -454,11 +530,31 @@ static __always_inline ssize_t mfill_atomic_pte(struct mm_struct *dst_mm,
 	return err;
 }
 
+/*
+ * An aligned UFFDIO_COPY of at least a PMD worth of an anonymous vma can
+ * install a THP right away, instead of leaving khugepaged to collapse the
+ * small pages later.
+ */
+static inline bool mcopy_atomic_pmd_suitable(struct vm_area_struct *dst_vma,
+					     unsigned long dst_addr,
+					     unsigned long len,
+					     enum mcopy_atomic_mode mode,
+					     bool wp_copy)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	return mode == MCOPY_ATOMIC_NORMAL && !wp_copy &&
+	       vma_is_anonymous(dst_vma) && !(dst_addr & ~HPAGE_PMD_MASK) &&
+	       len >= HPAGE_PMD_SIZE;
+#else
+	return false;
+#endif
+}
+
 static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 					      unsigned long dst_start,
 					      unsigned long src_start,
 					      unsigned long len,
-					      bool zeropage,
+					      enum mcopy_atomic_mode mcopy_mode,
 					      bool *mmap_changing,
 					      __u64 mode)
 {
@@ -468,6 +564,7 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 	unsigned long src_addr, dst_addr;
 	long copied;
 	struct page *page;
+	unsigned long size;
 	bool wp_copy;
 
 	/*
@@ -527,10 +624,12 @@ retry:
 	 */
 	if (is_vm_hugetlb_page(dst_vma))
 		return  __mcopy_atomic_hugetlb(dst_mm, dst_vma, dst_start,
-						src_start, len, zeropage);
+						src_start, len, mcopy_mode);
 
 	if (!vma_is_anonymous(dst_vma) && !vma_is_shmem(dst_vma))
 		goto out_unlock;
+	if (!vma_is_shmem(dst_vma) && mcopy_mode == MCOPY_ATOMIC_CONTINUE)
+		goto out_unlock;
 
 	/*
 	 * Ensure the dst_vma has a anon_vma or this page
@@ -554,6 +653,22 @@ retry:
 		}
 
 		dst_pmdval = pmd_read_atomic(dst_pmd);
+		if (pmd_none(dst_pmdval) &&
+		    mcopy_atomic_pmd_suitable(dst_vma, dst_addr,
+					      src_start + len - src_addr,
+					      mcopy_mode, wp_copy)) {
+			err = mcopy_atomic_pmd(dst_mm, dst_pmd, dst_vma,
+					       dst_addr, src_addr);
+			if (!err) {
+				size = HPAGE_PMD_SIZE;
+				cond_resched();
+				goto next;
+			}
+			/* otherwise fill it with small pages after all */
+			if (err != -EAGAIN)
+				break;
+			dst_pmdval = pmd_read_atomic(dst_pmd);
+		}
 		/*
 		 * If the dst_pmd is mapped as THP don't
 		 * override it and just be strict.
@@ -576,8 +691,9 @@ retry:
 		BUG_ON(pmd_none(*dst_pmd));
 		BUG_ON(pmd_trans_huge(*dst_pmd));
 
+		size = PAGE_SIZE;
 		err = mfill_atomic_pte(dst_mm, dst_pmd, dst_vma, dst_addr,
-				       src_addr, &page, zeropage, wp_copy);
+				       src_addr, &page, mcopy_mode, wp_copy);
 		cond_resched();
 
 		if (unlikely(err == -ENOENT)) {
@@ -599,10 +715,11 @@ retry:
 		} else
 			BUG_ON(page);
 
+next:
 		if (!err) {
-			dst_addr += PAGE_SIZE;
-			src_addr += PAGE_SIZE;
-			copied += PAGE_SIZE;
+			dst_addr += size;
+			src_addr += size;
+			copied += size;
 
 			if (fatal_signal_pending(current))
 				err = -EINTR;
@@ -626,14 +743,22 @@ ssize_t mcopy_atomic(struct mm_struct *dst_mm, unsigned long dst_start,
 		     unsigned long src_start, unsigned long len,
 		     bool *mmap_changing, __u64 mode)
 {
-	return __mcopy_atomic(dst_mm, dst_start, src_start, len, false,
-			      mmap_changing, mode);
+	return __mcopy_atomic(dst_mm, dst_start, src_start, len,
+			      MCOPY_ATOMIC_NORMAL, mmap_changing, mode);
 }
 
 ssize_t mfill_zeropage(struct mm_struct *dst_mm, unsigned long start,
 		       unsigned long len, bool *mmap_changing)
 {
-	return __mcopy_atomic(dst_mm, start, 0, len, true, mmap_changing, 0);
+	return __mcopy_atomic(dst_mm, start, 0, len, MCOPY_ATOMIC_ZEROPAGE,
+			      mmap_changing, 0);
+}
+
+ssize_t mcopy_continue(struct mm_struct *dst_mm, unsigned long start,
+		       unsigned long len, bool *mmap_changing)
+{
+	return __mcopy_atomic(dst_mm, start, 0, len, MCOPY_ATOMIC_CONTINUE,
+			      mmap_changing, 0);
 }
 
 int mwriteprotect_range(struct mm_struct *dst_mm, unsigned long start,
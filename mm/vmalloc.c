@@ -36,6 +36,7 @@
 #include <linux/bitops.h>
 #include <linux/rbtree_augmented.h>
 #include <linux/overflow.h>
+#include <linux/io.h>
 
 #include <linux/uaccess.h>
 #include <asm/tlbflush.h>
@@ -329,6 +330,79 @@ int map_kernel_range(unsigned long start, unsigned long size, pgprot_t prot,
 	return ret;
 }
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+static bool __ro_after_init vmap_allow_huge = true;
+
+static int __init set_nohugevmalloc(char *str)
+{
+	vmap_allow_huge = false;
+	return 0;
+}
+early_param("nohugevmalloc", set_nohugevmalloc);
+
+static int vmap_pmd_huge(unsigned long addr, phys_addr_t phys, pgprot_t prot,
+			 pgtbl_mod_mask *mask)
+{
+	pgd_t *pgd = pgd_offset_k(addr);
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	if (pgd_bad(*pgd))
+		*mask |= PGTBL_PGD_MODIFIED;
+	p4d = p4d_alloc_track(&init_mm, pgd, addr, mask);
+	if (!p4d)
+		return -ENOMEM;
+	pud = pud_alloc_track(&init_mm, p4d, addr, mask);
+	if (!pud)
+		return -ENOMEM;
+	pmd = pmd_alloc_track(&init_mm, pud, addr, mask);
+	if (!pmd)
+		return -ENOMEM;
+
+	if (WARN_ON(!pmd_none(*pmd)))
+		return -EBUSY;
+	if (!pmd_set_huge(pmd, phys, prot))
+		return -EINVAL;
+	*mask |= PGTBL_PMD_MODIFIED;
+	return 0;
+}
+
+/*
+ * Map @size bytes at @addr with one PMD per 1 << (PMD_SHIFT - PAGE_SHIFT)
+ * entries of @pages. Both @addr and @size must be PMD aligned and each
+ * such group of pages physically contiguous.
+ */
+static int map_kernel_range_huge(unsigned long start, unsigned long size,
+				 pgprot_t prot, struct page **pages)
+{
+	unsigned long addr, end = start + size;
+	pgtbl_mod_mask mask = 0;
+	int err = 0;
+
+	for (addr = start; addr != end; addr += PMD_SIZE) {
+		err = vmap_pmd_huge(addr, page_to_phys(*pages), prot, &mask);
+		if (err)
+			break;
+		pages += 1U << (PMD_SHIFT - PAGE_SHIFT);
+	}
+
+	if (mask & ARCH_PAGE_TABLE_SYNC_MASK)
+		arch_sync_kernel_mappings(start, end);
+	flush_cache_vmap(start, end);
+	return err;
+}
+#else
+static const bool vmap_allow_huge = false;
+
+static inline int map_kernel_range_huge(unsigned long start,
+					unsigned long size, pgprot_t prot,
+					struct page **pages)
+{
+	return -EINVAL;
+}
+#endif
+
 int is_vmalloc_or_module_addr(const void *x)
 {
 	/*
@@ -382,6 +456,15 @@ struct page *vmalloc_to_page(const void *vmalloc_addr)
 	if (pud_none(*pud) || pud_bad(*pud))
 		return NULL;
 	pmd = pmd_offset(pud, addr);
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+	/* huge vmalloc() mappings are backed by split, ordinary pages */
+	if (pmd_leaf(*pmd)) {
+		unsigned long pfn = pmd_pfn(*pmd) +
+				    ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+
+		return pfn_valid(pfn) ? pfn_to_page(pfn) : NULL;
+	}
+#endif
 	WARN_ON_ONCE(pmd_bad(*pmd));
 	if (pmd_none(*pmd) || pmd_bad(*pmd))
 		return NULL;
@@ -1978,6 +2061,11 @@ void __init vmalloc_init(void)
 	 */
 	vmap_area_cachep = KMEM_CACHE(vmap_area, SLAB_PANIC);
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+	if (!arch_ioremap_pmd_supported())
+		vmap_allow_huge = false;
+#endif
+
 	for_each_possible_cpu(i) {
 		struct vmap_block_queue *vbq;
 		struct vfree_deferred *p;
@@ -2407,8 +2495,22 @@ void *vmap(struct page **pages, unsigned int count,
 }
 EXPORT_SYMBOL(vmap);
 
+/*
+ * Allocations without a node go through alloc_page(), which follows the
+ * memory policy of the task. The bulk allocator only knows about nodes.
+ */
+static bool vmalloc_bulk_allowed(int node)
+{
+#ifdef CONFIG_NUMA
+	if (node == NUMA_NO_NODE && !in_interrupt() && current->mempolicy)
+		return false;
+#endif
+	return true;
+}
+
 static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
-				 pgprot_t prot, int node)
+				 pgprot_t prot, unsigned int page_shift,
+				 int node)
 {
 	struct page **pages;
 	unsigned int nr_pages, array_size, i;
@@ -2438,7 +2540,54 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 	area->pages = pages;
 	area->nr_pages = nr_pages;
 
-	for (i = 0; i < area->nr_pages; i++) {
+	/*
+	 * Huge mappings are backed by high-order pages that are split up, so
+	 * that everything else, freeing included, deals with ordinary pages.
+	 * Don't try hard: without them the caller falls back to small pages.
+	 */
+	for (i = 0; page_shift > PAGE_SHIFT && i < nr_pages; ) {
+		unsigned int j, order = page_shift - PAGE_SHIFT;
+		gfp_t huge_mask = alloc_mask | highmem_mask | __GFP_NORETRY;
+		struct page *page;
+
+		if (node == NUMA_NO_NODE)
+			page = alloc_pages(huge_mask, order);
+		else
+			page = alloc_pages_node(node, huge_mask, order);
+
+		if (unlikely(!page)) {
+			area->nr_pages = i;
+			atomic_long_add(area->nr_pages, &nr_vmalloc_pages);
+			goto fail;
+		}
+		split_page(page, order);
+		for (j = 0; j < (1U << order); j++)
+			area->pages[i++] = page + j;
+		if (gfpflags_allow_blocking(gfp_mask))
+			cond_resched();
+	}
+
+	/*
+	 * The array is zeroed, so the bulk allocator fills it from the start.
+	 * Allocations that follow the task's memory policy don't use it, and
+	 * whatever it didn't provide is allocated one page at a time below.
+	 */
+	if (page_shift == PAGE_SHIFT && vmalloc_bulk_allowed(node)) {
+		while (i < nr_pages) {
+			unsigned int nr, nr_request = min(100U, nr_pages - i);
+
+			nr = alloc_pages_bulk_array_node(alloc_mask|highmem_mask,
+							 node, nr_request,
+							 pages + i);
+			i += nr;
+			if (gfpflags_allow_blocking(gfp_mask))
+				cond_resched();
+			if (nr != nr_request)
+				break;
+		}
+	}
+
+	for (; i < area->nr_pages; i++) {
 		struct page *page;
 
 		if (node == NUMA_NO_NODE)
@@ -2458,16 +2607,25 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 	}
 	atomic_long_add(area->nr_pages, &nr_vmalloc_pages);
 
-	if (map_kernel_range((unsigned long)area->addr, get_vm_area_size(area),
-			prot, pages) < 0)
+	if (page_shift > PAGE_SHIFT) {
+		area->page_order = page_shift - PAGE_SHIFT;
+		if (map_kernel_range_huge((unsigned long)area->addr,
+					  get_vm_area_size(area), prot,
+					  pages) < 0)
+			goto fail;
+	} else if (map_kernel_range((unsigned long)area->addr,
+				    get_vm_area_size(area), prot, pages) < 0) {
 		goto fail;
+	}
 
 	return area->addr;
 
 fail:
-	warn_alloc(gfp_mask, NULL,
-			  "vmalloc: allocation failure, allocated %ld of %ld bytes",
-			  (area->nr_pages*PAGE_SIZE), area->size);
+	/* The caller retries with small pages */
+	if (page_shift == PAGE_SHIFT)
+		warn_alloc(gfp_mask, NULL,
+			   "vmalloc: allocation failure, allocated %ld of %ld bytes",
+			   (area->nr_pages*PAGE_SIZE), area->size);
 	__vfree(area->addr);
 	return NULL;
 }
@@ -2487,6 +2645,9 @@ fail:
  * Allocate enough pages to cover @size from the page level
  * allocator with @gfp_mask flags.  Map them into contiguous
  * kernel virtual space, using a pagetable protection of @prot.
+ * With %VM_ALLOW_HUGE_VMAP, allocations of PMD_SIZE or more are
+ * mapped with huge pages where the architecture supports it, and
+ * fall back to small pages when no huge pages are available.
  *
  * Return: the address of the area or %NULL on failure
  */
@@ -2498,19 +2659,41 @@ void *__vmalloc_node_range(unsigned long size, unsigned long align,
 	struct vm_struct *area;
 	void *addr;
 	unsigned long real_size = size;
+	unsigned long real_align = align;
+	unsigned int shift = PAGE_SHIFT;
 
 	size = PAGE_ALIGN(size);
 	if (!size || (size >> PAGE_SHIFT) > totalram_pages())
 		goto fail;
 
-	area = __get_vm_area_node(real_size, align, VM_ALLOC | VM_UNINITIALIZED |
+	/*
+	 * Opted-in allocations of at least PMD_SIZE are mapped with huge
+	 * pages, rounding the size up. Accounted allocations are left alone,
+	 * the memcg charge of a split high-order page can't be freed in
+	 * pieces.
+	 */
+	if (vmap_allow_huge && (vm_flags & VM_ALLOW_HUGE_VMAP) &&
+	    !(gfp_mask & __GFP_ACCOUNT) && size >= PMD_SIZE) {
+		shift = PMD_SHIFT;
+		align = max(real_align, PMD_SIZE);
+		size = ALIGN(real_size, PMD_SIZE);
+	}
+
+again:
+	area = __get_vm_area_node(size, align, VM_ALLOC | VM_UNINITIALIZED |
 				vm_flags, start, end, node, gfp_mask, caller);
-	if (!area)
+	if (!area) {
+		if (shift > PAGE_SHIFT)
+			goto fallback;
 		goto fail;
+	}
 
-	addr = __vmalloc_area_node(area, gfp_mask, prot, node);
-	if (!addr)
+	addr = __vmalloc_area_node(area, gfp_mask, prot, shift, node);
+	if (!addr) {
+		if (shift > PAGE_SHIFT)
+			goto fallback;
 		return NULL;
+	}
 
 	/*
 	 * In this function, newly allocated vm_struct has VM_UNINITIALIZED
@@ -2523,6 +2706,12 @@ void *__vmalloc_node_range(unsigned long size, unsigned long align,
 
 	return addr;
 
+fallback:
+	shift = PAGE_SHIFT;
+	align = real_align;
+	size = PAGE_ALIGN(real_size);
+	goto again;
+
 fail:
 	warn_alloc(gfp_mask, NULL,
 			  "vmalloc: allocation failure: %lu bytes", real_size);
@@ -2570,6 +2759,26 @@ void *__vmalloc(unsigned long size, gfp_t gfp_mask)
 }
 EXPORT_SYMBOL(__vmalloc);
 
+/**
+ * vmalloc_huge - allocate virtually contiguous memory, allow huge pages
+ * @size:      allocation size
+ * @gfp_mask:  flags for the page level allocator
+ *
+ * Allocate enough pages to cover @size from the page level
+ * allocator and map them into contiguous kernel virtual space.
+ * If @size is greater than or equal to PMD_SIZE, allow using
+ * huge pages for the memory.
+ *
+ * Return: pointer to the allocated memory or %NULL on error
+ */
+void *vmalloc_huge(unsigned long size, gfp_t gfp_mask)
+{
+	return __vmalloc_node_range(size, 1, VMALLOC_START, VMALLOC_END,
+				    gfp_mask, PAGE_KERNEL, VM_ALLOW_HUGE_VMAP,
+				    NUMA_NO_NODE, __builtin_return_address(0));
+}
+EXPORT_SYMBOL_GPL(vmalloc_huge);
+
 /**
  * vmalloc - allocate virtually contiguous memory
  * @size:    allocation size
@@ -3526,6 +3735,9 @@ static int s_show(struct seq_file *m, void *p)
 	if (v->nr_pages)
 		seq_printf(m, " pages=%d", v->nr_pages);
 
+	if (v->page_order)
+		seq_printf(m, " hugepages=%u", v->nr_pages >> v->page_order);
+
 	if (v->phys_addr)
 		seq_printf(m, " phys=%pa", &v->phys_addr);
 
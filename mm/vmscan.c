@@ -51,6 +51,12 @@
 #include <linux/printk.h>
 #include <linux/dax.h>
 #include <linux/psi.h>
+#include <linux/pagewalk.h>
+#include <linux/debugfs.h>
+#include <linux/memory_hotplug.h>
+#include <linux/pid_namespace.h>
+#include <linux/sched/task.h>
+#include <linux/migrate.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -101,6 +107,9 @@ struct scan_control {
 	/* Can pages be swapped as part of reclaim? */
 	unsigned int may_swap:1;
 
+	/* Reclaim must free the pages, not demote them to another node */
+	unsigned int no_demotion:1;
+
 	/*
 	 * Cgroups are not reclaimed below their configured memory.low,
 	 * unless we threaten to OOM. If any cgroups are skipped due to
@@ -288,6 +297,34 @@ static bool writeback_throttling_sane(struct scan_control *sc)
 }
 #endif
 
+static bool can_demote(int nid, struct scan_control *sc)
+{
+	if (!numa_demotion_enabled)
+		return false;
+
+	/* Demoted pages stay charged, it doesn't help a memcg limit */
+	if (sc->no_demotion || cgroup_reclaim(sc))
+		return false;
+
+	return next_demotion_node(nid) != NUMA_NO_NODE;
+}
+
+static bool can_reclaim_anon_pages(struct mem_cgroup *memcg, int nid,
+				   struct scan_control *sc)
+{
+	if (mem_cgroup_get_nr_swap_pages(memcg) > 0)
+		return true;
+
+	/* Without swap space, anon pages can still be demoted */
+	return can_demote(nid, sc);
+}
+
+static bool can_age_anon_pages(struct pglist_data *pgdat,
+			       struct scan_control *sc)
+{
+	return total_swap_pages || can_demote(pgdat->node_id, sc);
+}
+
 /*
  * This misses isolated pages which are not accounted for to save counters.
  * As the data only determines if reclaim or compaction continues, it is
@@ -1064,6 +1101,60 @@ static void page_check_dirty_writeback(struct page *page,
 		mapping->a_ops->is_dirty_writeback(page, dirty, writeback);
 }
 
+static struct page *alloc_demote_page(struct page *page, unsigned long node)
+{
+	struct migration_target_control mtc = {
+		/*
+		 * Fail quickly and quietly if @node is full, @page is then
+		 * reclaimed the usual way instead.
+		 */
+		.gfp_mask = (GFP_HIGHUSER_MOVABLE & ~__GFP_RECLAIM) |
+			    __GFP_THISNODE | __GFP_NOWARN |
+			    __GFP_NOMEMALLOC | GFP_NOWAIT,
+		.nid = node,
+	};
+
+	return alloc_migration_target(page, (unsigned long)&mtc);
+}
+
+/*
+ * Migrate the pages on @demote_pages to the demotion target of @pgdat.
+ * Returns the number of pages demoted; the ones that failed are left on
+ * the list.
+ */
+static unsigned int demote_page_list(struct list_head *demote_pages,
+				     struct pglist_data *pgdat)
+{
+	int target_nid = next_demotion_node(pgdat->node_id);
+	unsigned int nr_succeeded = 0;
+	struct page *page;
+
+	if (list_empty(demote_pages) || target_nid == NUMA_NO_NODE)
+		return 0;
+
+	/*
+	 * migrate_pages() subtracts the pages it is done with from
+	 * NR_ISOLATED, but our caller accounts for them when it puts the
+	 * rest of the list back. Count them twice while they are migrated.
+	 */
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+				    page_is_file_lru(page), thp_nr_pages(page));
+
+	/* Demotion ignores all cpuset and mempolicy settings */
+	migrate_pages(demote_pages, alloc_demote_page, NULL, target_nid,
+		      MIGRATE_ASYNC, MR_DEMOTION, &nr_succeeded);
+
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+				    page_is_file_lru(page), -thp_nr_pages(page));
+
+	mod_node_page_state(pgdat, current_is_kswapd() ? PGDEMOTE_KSWAPD :
+			    PGDEMOTE_DIRECT, nr_succeeded);
+
+	return nr_succeeded;
+}
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -1076,12 +1167,16 @@ static unsigned int shrink_page_list(struct list_head *page_list,
 {
 	LIST_HEAD(ret_pages);
 	LIST_HEAD(free_pages);
+	LIST_HEAD(demote_pages);
 	unsigned int nr_reclaimed = 0;
 	unsigned int pgactivate = 0;
+	bool do_demote_pass;
 
 	memset(stat, 0, sizeof(*stat));
 	cond_resched();
+	do_demote_pass = can_demote(pgdat->node_id, sc);
 
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -1230,6 +1325,17 @@ static unsigned int shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Before reclaiming the page, try to move its contents to
+		 * the slower node below this one.
+		 */
+		if (do_demote_pass &&
+		    (thp_migration_supported() || !PageTransHuge(page))) {
+			list_add(&page->lru, &demote_pages);
+			unlock_page(page);
+			continue;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -1273,7 +1379,13 @@ static unsigned int shrink_page_list(struct list_head *page_list,
 				mapping = page_mapping(page);
 			}
 		} else if (unlikely(PageTransHuge(page))) {
-			/* Split file THP */
+			/*
+			 * Split file THP.  Filesystem private data pins the
+			 * page, so it has to be released first.
+			 */
+			if (page_has_private(page) &&
+			    !try_to_release_page(page, sc->gfp_mask))
+				goto keep_locked;
 			if (split_huge_page_to_list(page, page_list))
 				goto keep_locked;
 		}
@@ -1478,6 +1590,14 @@ keep:
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
 
+	nr_reclaimed += demote_page_list(&demote_pages, pgdat);
+	/* Pages that could not be demoted are reclaimed the usual way */
+	if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		do_demote_pass = false;
+		goto retry;
+	}
+
 	pgactivate = stat->nr_activate[0] + stat->nr_activate[1];
 
 	mem_cgroup_uncharge_list(&free_pages);
@@ -1497,6 +1617,7 @@ unsigned int reclaim_clean_pages_from_list(struct zone *zone,
 		.gfp_mask = GFP_KERNEL,
 		.priority = DEF_PRIORITY,
 		.may_unmap = 1,
+		.no_demotion = 1,
 	};
 	struct reclaim_stat stat;
 	unsigned int nr_reclaimed;
@@ -1863,8 +1984,8 @@ static unsigned noinline_for_stack move_pages_to_lru(struct lruvec *lruvec,
 		lru = page_lru(page);
 
 		nr_pages = thp_nr_pages(page);
-		update_lru_size(lruvec, lru, page_zonenum(page), nr_pages);
-		list_move(&page->lru, &lruvec->lists[lru]);
+		list_del(&page->lru);
+		add_page_to_lru_list(page, lruvec, lru);
 
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
@@ -1879,7 +2000,7 @@ static unsigned noinline_for_stack move_pages_to_lru(struct lruvec *lruvec,
 				list_add(&page->lru, &pages_to_free);
 		} else {
 			nr_moved += nr_pages;
-			if (PageActive(page))
+			if (is_active_lru(lru))
 				workingset_age_nonresident(lruvec, nr_pages);
 		}
 	}
@@ -2111,6 +2232,7 @@ unsigned long reclaim_pages(struct list_head *page_list)
 		.may_writepage = 1,
 		.may_unmap = 1,
 		.may_swap = 1,
+		.no_demotion = 1,
 	};
 
 	while (!list_empty(page_list)) {
@@ -2244,7 +2366,8 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 	enum lru_list lru;
 
 	/* If we have no swap space, do not bother scanning anon pages. */
-	if (!sc->may_swap || mem_cgroup_get_nr_swap_pages(memcg) <= 0) {
+	if (!sc->may_swap ||
+	    !can_reclaim_anon_pages(memcg, lruvec_pgdat(lruvec)->node_id, sc)) {
 		scan_balance = SCAN_FILE;
 		goto out;
 	}
@@ -2419,6 +2542,840 @@ out:
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-generational LRU
+ *
+ * Instead of balancing an active and an inactive list, the pages of an
+ * lruvec are sorted into generations. Aging walks the page tables of the
+ * processes of the memcg, transfers the accessed bits to PG_referenced and
+ * starts a new generation; eviction takes pages from the oldest generations
+ * and moves those found referenced to the youngest one. The classic lists
+ * stay around, with the counts of the two youngest generations reported as
+ * active, so that the rest of reclaim and the statistics keep working.
+ */
+
+DEFINE_STATIC_KEY_FALSE(lru_gen_key);
+
+/* The number of pages moved between lists per lru_lock hold */
+#define LRU_GEN_BATCH		64
+
+#define for_each_gen_type_zone(gen, type, zone)				\
+	for ((gen) = 0; (gen) < MAX_NR_GENS; (gen)++)			\
+		for ((type) = 0; (type) < LRU_GEN_TYPES; (type)++)	\
+			for ((zone) = 0; (zone) < MAX_NR_ZONES; (zone)++)
+
+void lru_gen_init_lruvec(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, type, zone;
+
+	BUILD_BUG_ON(MAX_NR_GENS + 1 > BIT(LRU_GEN_WIDTH));
+	BUILD_BUG_ON(MIN_NR_GENS < 2 || MIN_NR_GENS >= MAX_NR_GENS);
+
+	for (type = 0; type < LRU_GEN_TYPES; type++) {
+		lrugen->min_seq[type] = 0;
+		lrugen->max_seq[type] = MAX_NR_GENS - 1;
+		for (gen = 0; gen < MAX_NR_GENS; gen++)
+			lrugen->timestamps[type][gen] = jiffies;
+	}
+
+	for_each_gen_type_zone(gen, type, zone) {
+		INIT_LIST_HEAD(&lrugen->lists[gen][type][zone]);
+		lrugen->nr_pages[gen][type][zone] = 0;
+	}
+}
+
+static int lru_gen_nr_gens(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+
+	return READ_ONCE(lrugen->max_seq[type]) -
+	       READ_ONCE(lrugen->min_seq[type]) + 1;
+}
+
+/* Whether @type has any pages in the zones up to @reclaim_idx */
+static bool lru_gen_has_pages(struct lruvec *lruvec, int type, int reclaim_idx)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, zone;
+
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		for (zone = 0; zone <= reclaim_idx; zone++) {
+			if (READ_ONCE(lrugen->nr_pages[gen][type][zone]) > 0)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/* Whether the generations eviction may take from have eligible pages */
+static bool lru_gen_has_evictable(struct lruvec *lruvec, int type,
+				  int reclaim_idx)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long seq;
+	int zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+
+	for (seq = lrugen->min_seq[type];
+	     seq + MIN_NR_GENS <= lrugen->max_seq[type]; seq++) {
+		int gen = lru_gen_from_seq(seq);
+
+		for (zone = 0; zone <= reclaim_idx; zone++) {
+			if (!list_empty(&lrugen->lists[gen][type][zone]))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/* Retire the oldest generations of @type that have become empty */
+static void lru_gen_try_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+
+	while (lru_gen_nr_gens(lruvec, type) > MIN_NR_GENS) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			if (!list_empty(&lrugen->lists[gen][type][zone]))
+				return;
+		}
+
+		WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+	}
+}
+
+/*
+ * All generations are in use but the ones eviction may take from only have
+ * pages in zones @sc can't reclaim from. Merge the oldest generation into
+ * the next one so that aging can make progress.
+ */
+static void lru_gen_fold_oldest(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int old = lru_gen_from_seq(lrugen->min_seq[type]);
+	int new = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+	struct page *page;
+	int zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+	VM_BUG_ON(lru_gen_is_active(lruvec, type, new));
+
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		struct list_head *head = &lrugen->lists[old][type][zone];
+
+		list_for_each_entry(page, head, lru)
+			set_mask_bits(&page->flags, LRU_GEN_MASK,
+				      (new + 1UL) << LRU_GEN_PGOFF);
+
+		/* Both are inactive, the classic counts stay the same */
+		list_splice_tail_init(head, &lrugen->lists[new][type][zone]);
+		lrugen->nr_pages[new][type][zone] +=
+			lrugen->nr_pages[old][type][zone];
+		lrugen->nr_pages[old][type][zone] = 0;
+	}
+
+	WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+}
+
+static void lru_gen_inc_max_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int prev = lru_gen_from_seq(lrugen->max_seq[type] - 1);
+	int next = lru_gen_from_seq(lrugen->max_seq[type] + 1);
+	enum lru_list lru = type * LRU_FILE;
+	int zone;
+
+	lockdep_assert_held(&lruvec_pgdat(lruvec)->lru_lock);
+	VM_BUG_ON(lru_gen_nr_gens(lruvec, type) >= MAX_NR_GENS);
+
+	/* The second youngest generation is no longer reported as active */
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		long delta = lrugen->nr_pages[prev][type][zone];
+
+		if (!delta)
+			continue;
+
+		update_lru_size(lruvec, lru + LRU_ACTIVE, zone, -delta);
+		update_lru_size(lruvec, lru, zone, delta);
+	}
+
+	lrugen->timestamps[type][next] = jiffies;
+	WRITE_ONCE(lrugen->max_seq[type], lrugen->max_seq[type] + 1);
+}
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr,
+			    unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	struct page *page;
+	spinlock_t *ptl;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd) && !is_huge_zero_pmd(*pmd) &&
+		    pmdp_test_and_clear_young(vma, addr, pmd)) {
+			page = pmd_page(*pmd);
+			SetPageReferenced(page);
+		}
+		spin_unlock(ptl);
+		return 0;
+	}
+#endif
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			SetPageReferenced(compound_head(page));
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+static const struct mm_walk_ops lru_gen_walk_ops = {
+	.pmd_entry		= lru_gen_walk_pmd,
+};
+
+/*
+ * The address spaces charged to each memcg are kept on a list of the memcg,
+ * so that aging a memcg walks only its own.  An mm is added on fork and exec,
+ * moved when its owner migrates to another memcg and removed when its last
+ * user is gone.  Without memcgs all of them are on a global list.
+ */
+static struct lru_gen_mm_list lru_gen_mm_list = {
+	.fifo	= LIST_HEAD_INIT(lru_gen_mm_list.fifo),
+	.lock	= __SPIN_LOCK_UNLOCKED(lru_gen_mm_list.lock),
+};
+
+static struct lru_gen_mm_list *get_mm_list(struct mem_cgroup *memcg)
+{
+#ifdef CONFIG_MEMCG
+	if (memcg)
+		return &memcg->mm_list;
+#endif
+	return &lru_gen_mm_list;
+}
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg = get_mem_cgroup_from_mm(mm);
+	struct lru_gen_mm_list *mm_list = get_mm_list(memcg);
+
+	VM_WARN_ON_ONCE(!list_empty(&mm->lru_gen.list));
+#ifdef CONFIG_MEMCG
+	VM_WARN_ON_ONCE(mm->lru_gen.memcg);
+	/* Keeps the reference taken above until the mm is removed */
+	mm->lru_gen.memcg = memcg;
+#endif
+	spin_lock(&mm_list->lock);
+	list_add_tail(&mm->lru_gen.list, &mm_list->fifo);
+	mm_list->nr_mms++;
+	spin_unlock(&mm_list->lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	struct lru_gen_mm_list *mm_list;
+	struct mem_cgroup *memcg = NULL;
+
+	if (list_empty(&mm->lru_gen.list))
+		return;
+
+#ifdef CONFIG_MEMCG
+	memcg = mm->lru_gen.memcg;
+#endif
+	mm_list = get_mm_list(memcg);
+
+	spin_lock(&mm_list->lock);
+	list_del_init(&mm->lru_gen.list);
+	mm_list->nr_mms--;
+	spin_unlock(&mm_list->lock);
+
+#ifdef CONFIG_MEMCG
+	mem_cgroup_put(memcg);
+	mm->lru_gen.memcg = NULL;
+#endif
+}
+
+#ifdef CONFIG_MEMCG
+/* Called with the task_lock of mm->owner held */
+void lru_gen_migrate_mm(struct mm_struct *mm)
+{
+	struct task_struct *task = rcu_dereference_protected(mm->owner, true);
+	struct mem_cgroup *memcg;
+
+	VM_WARN_ON_ONCE(task->mm != mm);
+	lockdep_assert_held(&task->alloc_lock);
+
+	/* Migration can happen before the mm is added on fork */
+	if (mem_cgroup_disabled() || !mm->lru_gen.memcg)
+		return;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(task) ?: root_mem_cgroup;
+	rcu_read_unlock();
+	if (memcg == mm->lru_gen.memcg)
+		return;
+
+	lru_gen_del_mm(mm);
+	lru_gen_add_mm(mm);
+}
+#endif
+
+static void lru_gen_walk_mm(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+
+	/* Aging is opportunistic, don't wait behind a writer */
+	if (!mmap_read_trylock(mm))
+		return;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_LOCKED | VM_SPECIAL | VM_HUGETLB))
+			continue;
+
+		walk_page_vma(vma, &lru_gen_walk_ops, NULL);
+	}
+
+	mmap_read_unlock(mm);
+}
+
+/*
+ * Walk the address spaces charged to @memcg.  Each one visited is moved to
+ * the tail of the list, so that agings which overlap or give up early still
+ * spread over all of them.  Aging is opportunistic: an mm added or migrated
+ * meanwhile may be missed, or another one visited twice.
+ */
+static void lru_gen_walk_mms(struct mem_cgroup *memcg)
+{
+	struct lru_gen_mm_list *mm_list = get_mm_list(memcg);
+	unsigned long nr = READ_ONCE(mm_list->nr_mms);
+	struct mm_struct *mm;
+
+	for (; nr; nr--) {
+		spin_lock(&mm_list->lock);
+		if (list_empty(&mm_list->fifo)) {
+			spin_unlock(&mm_list->lock);
+			break;
+		}
+		mm = list_first_entry(&mm_list->fifo, struct mm_struct,
+				      lru_gen.list);
+		list_move_tail(&mm->lru_gen.list, &mm_list->fifo);
+		/* The mm is not freed before it is taken off the list */
+		if (!mmget_not_zero(mm))
+			mm = NULL;
+		spin_unlock(&mm_list->lock);
+
+		if (!mm)
+			continue;
+
+		lru_gen_walk_mm(mm);
+
+		/* Don't tear down an exiting mm from reclaim */
+		mmput_async(mm);
+		cond_resched();
+	}
+}
+
+static void lru_gen_age(struct lruvec *lruvec, int type)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+
+	lru_gen_walk_mms(lruvec_memcg(lruvec));
+
+	spin_lock_irq(&pgdat->lru_lock);
+	/* Somebody else may have aged the lruvec in the meantime */
+	if (lru_gen_nr_gens(lruvec, type) < MAX_NR_GENS)
+		lru_gen_inc_max_seq(lruvec, type);
+	spin_unlock_irq(&pgdat->lru_lock);
+}
+
+/*
+ * Make sure there is something to evict from @type: retire the empty oldest
+ * generations, and age the lruvec when only the youngest ones are left.
+ * Returns false if @type has no pages @sc can reclaim at all.
+ */
+static bool lru_gen_prepare(struct lruvec *lruvec, int type,
+			    struct scan_control *sc)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	bool evictable;
+
+	spin_lock_irq(&pgdat->lru_lock);
+	lru_gen_try_inc_min_seq(lruvec, type);
+	evictable = lru_gen_has_evictable(lruvec, type, sc->reclaim_idx);
+	if (!evictable && lru_gen_nr_gens(lruvec, type) == MAX_NR_GENS)
+		lru_gen_fold_oldest(lruvec, type);
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	if (evictable)
+		return true;
+
+	if (!lru_gen_has_pages(lruvec, type, sc->reclaim_idx))
+		return false;
+
+	lru_gen_age(lruvec, type);
+	return true;
+}
+
+static int lru_gen_swappiness(struct lruvec *lruvec, struct scan_control *sc)
+{
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+
+	if (!sc->may_swap ||
+	    !can_reclaim_anon_pages(memcg, lruvec_pgdat(lruvec)->node_id, sc))
+		return 0;
+
+	return mem_cgroup_swappiness(memcg);
+}
+
+/*
+ * Evict the type whose oldest generation is older, weighted by swappiness
+ * the way get_scan_count() weighs the cost of the two lists.
+ */
+static int lru_gen_pick_type(struct lruvec *lruvec, int swappiness,
+			     struct scan_control *sc, int skip)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	bool anon, file;
+	unsigned long age[LRU_GEN_TYPES];
+	int type;
+
+	anon = skip != LRU_GEN_ANON && swappiness &&
+	       lru_gen_has_pages(lruvec, LRU_GEN_ANON, sc->reclaim_idx);
+	file = skip != LRU_GEN_FILE && swappiness < 200 &&
+	       lru_gen_has_pages(lruvec, LRU_GEN_FILE, sc->reclaim_idx);
+
+	if (anon && file) {
+		for (type = 0; type < LRU_GEN_TYPES; type++) {
+			int gen = lru_gen_from_seq(READ_ONCE(lrugen->min_seq[type]));
+
+			age[type] = jiffies - READ_ONCE(lrugen->timestamps[type][gen]);
+		}
+
+		return age[LRU_GEN_ANON] * swappiness >
+		       age[LRU_GEN_FILE] * (200 - swappiness) ?
+		       LRU_GEN_ANON : LRU_GEN_FILE;
+	}
+
+	return file ? LRU_GEN_FILE : anon ? LRU_GEN_ANON : -1;
+}
+
+static void lru_gen_promote(struct lruvec *lruvec, struct page *page,
+			    int type, int gen)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int new = lru_gen_from_seq(lrugen->max_seq[type]);
+
+	lru_gen_update_size(lruvec, page, gen, new);
+	set_mask_bits(&page->flags, LRU_GEN_MASK, (new + 1UL) << LRU_GEN_PGOFF);
+	list_move(&page->lru, &lrugen->lists[new][type][page_zonenum(page)]);
+}
+
+/*
+ * Isolate up to @nr_to_scan pages from the oldest generations of @type and
+ * reclaim them. Returns the number of pages reclaimed, and the number of
+ * pages looked at in @nr_scanned.
+ */
+static unsigned long lru_gen_evict(struct lruvec *lruvec, int type,
+				   unsigned long nr_to_scan,
+				   struct scan_control *sc,
+				   unsigned long *nr_scanned)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	isolate_mode_t mode = sc->may_unmap ? 0 : ISOLATE_UNMAPPED;
+	unsigned long scanned = 0, nr_taken = 0, nr_reclaimed;
+	struct reclaim_stat stat;
+	enum vm_event_item item;
+	LIST_HEAD(page_list);
+	unsigned long seq;
+	int zone;
+
+	*nr_scanned = 0;
+
+	if (unlikely(too_many_isolated(pgdat, type, sc)))
+		return 0;
+
+	lru_add_drain();
+
+	spin_lock_irq(&pgdat->lru_lock);
+
+	for (seq = lrugen->min_seq[type];
+	     seq + MIN_NR_GENS <= lrugen->max_seq[type] && scanned < nr_to_scan;
+	     seq++) {
+		int gen = lru_gen_from_seq(seq);
+
+		for (zone = sc->reclaim_idx; zone >= 0; zone--) {
+			struct list_head *head = &lrugen->lists[gen][type][zone];
+
+			while (!list_empty(head) && scanned < nr_to_scan) {
+				struct page *page = lru_to_page(head);
+				int delta = thp_nr_pages(page);
+
+				VM_BUG_ON_PAGE(!PageLRU(page), page);
+				VM_BUG_ON_PAGE(page_lru_gen(page) != gen, page);
+
+				scanned += delta;
+
+				if (TestClearPageReferenced(page)) {
+					lru_gen_promote(lruvec, page, type, gen);
+					continue;
+				}
+
+				switch (__isolate_lru_page(page, mode)) {
+				case 0:
+					nr_taken += delta;
+					lru_gen_del_page(lruvec, page);
+					list_add(&page->lru, &page_list);
+					break;
+				case -EBUSY:
+					list_move(&page->lru, head);
+					break;
+				default:
+					BUG();
+				}
+			}
+		}
+	}
+
+	lru_gen_try_inc_min_seq(lruvec, type);
+
+	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + type, nr_taken);
+	item = current_is_kswapd() ? PGSCAN_KSWAPD : PGSCAN_DIRECT;
+	if (!cgroup_reclaim(sc))
+		__count_vm_events(item, scanned);
+	__count_memcg_events(lruvec_memcg(lruvec), item, scanned);
+	__count_vm_events(PGSCAN_ANON + type, scanned);
+
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	*nr_scanned = scanned;
+	if (!nr_taken)
+		return 0;
+
+	nr_reclaimed = shrink_page_list(&page_list, pgdat, sc, 0, &stat, false);
+
+	spin_lock_irq(&pgdat->lru_lock);
+
+	move_pages_to_lru(lruvec, &page_list);
+
+	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + type, -nr_taken);
+	item = current_is_kswapd() ? PGSTEAL_KSWAPD : PGSTEAL_DIRECT;
+	if (!cgroup_reclaim(sc))
+		__count_vm_events(item, nr_reclaimed);
+	__count_memcg_events(lruvec_memcg(lruvec), item, nr_reclaimed);
+	__count_vm_events(PGSTEAL_ANON + type, nr_reclaimed);
+
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	mem_cgroup_uncharge_list(&page_list);
+	free_unref_page_list(&page_list);
+
+	sc->nr.dirty += stat.nr_dirty;
+	sc->nr.congested += stat.nr_congested;
+	sc->nr.unqueued_dirty += stat.nr_unqueued_dirty;
+	sc->nr.writeback += stat.nr_writeback;
+	sc->nr.immediate += stat.nr_immediate;
+	sc->nr.taken += nr_taken;
+	if (type == LRU_GEN_FILE)
+		sc->nr.file_taken += nr_taken;
+
+	return nr_reclaimed;
+}
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_reclaimed = 0, nr_to_scan = 0;
+	int swappiness = lru_gen_swappiness(lruvec, sc);
+	int gen, type, zone, skip = -1, retries = 0;
+	struct blk_plug plug;
+
+	for_each_gen_type_zone(gen, type, zone) {
+		if (zone > sc->reclaim_idx)
+			continue;
+		if ((type == LRU_GEN_ANON && !swappiness) ||
+		    (type == LRU_GEN_FILE && swappiness == 200))
+			continue;
+		nr_to_scan += max(READ_ONCE(lrugen->nr_pages[gen][type][zone]),
+				  0L);
+	}
+
+	nr_to_scan >>= sc->priority;
+	if (!nr_to_scan)
+		return;
+
+	blk_start_plug(&plug);
+
+	while (nr_to_scan && nr_reclaimed < nr_to_reclaim) {
+		unsigned long scanned;
+
+		type = lru_gen_pick_type(lruvec, swappiness, sc, skip);
+		if (type < 0)
+			break;
+
+		if (!lru_gen_prepare(lruvec, type, sc)) {
+			if (skip >= 0)
+				break;
+			skip = type;
+			continue;
+		}
+
+		nr_reclaimed += lru_gen_evict(lruvec, type,
+					      min(nr_to_scan, SWAP_CLUSTER_MAX),
+					      sc, &scanned);
+
+		/* Each empty pass ages the lruvec, give up if that is futile */
+		if (!scanned) {
+			if (++retries > MAX_NR_GENS)
+				break;
+			continue;
+		}
+
+		retries = 0;
+		nr_to_scan -= min(nr_to_scan, scanned);
+	}
+
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+}
+
+/*
+ * Move the pages of @lruvec between the classic and the generation lists
+ * after lru_gen_key was flipped. Returns true once there is nothing left to
+ * move, otherwise the caller is supposed to reschedule and try again.
+ */
+static bool lru_gen_fill(struct lruvec *lruvec)
+{
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	int remaining = LRU_GEN_BATCH;
+	enum lru_list lru;
+
+	spin_lock_irq(&pgdat->lru_lock);
+	for_each_evictable_lru(lru) {
+		struct list_head *head = &lruvec->lists[lru];
+
+		while (!list_empty(head)) {
+			struct page *page = lru_to_page(head);
+
+			del_page_from_lru_list(page, lruvec, lru);
+			add_page_to_lru_list(page, lruvec, lru);
+			if (!--remaining)
+				goto out;
+		}
+	}
+out:
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	return remaining;
+}
+
+static bool lru_gen_drain(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	int remaining = LRU_GEN_BATCH;
+	unsigned long seq;
+	int type, zone;
+
+	spin_lock_irq(&pgdat->lru_lock);
+	for (type = 0; type < LRU_GEN_TYPES; type++) {
+		for (seq = lrugen->min_seq[type];
+		     seq <= lrugen->max_seq[type]; seq++) {
+			int gen = lru_gen_from_seq(seq);
+
+			for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+				struct list_head *head = &lrugen->lists[gen][type][zone];
+
+				while (!list_empty(head)) {
+					struct page *page = lru_to_page(head);
+
+					if (lru_gen_is_active(lruvec, type, gen))
+						SetPageActive(page);
+					del_page_from_lru_list(page, lruvec,
+							       page_lru(page));
+					add_page_to_lru_list(page, lruvec,
+							     page_lru(page));
+					if (!--remaining)
+						goto out;
+				}
+			}
+		}
+	}
+out:
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	return remaining;
+}
+
+static void lru_gen_change_state(bool enable)
+{
+	static DEFINE_MUTEX(state_mutex);
+	struct mem_cgroup *memcg;
+
+	mutex_lock(&state_mutex);
+
+	if (enable == lru_gen_enabled())
+		goto unlock;
+
+	if (enable)
+		static_branch_enable(&lru_gen_key);
+	else
+		static_branch_disable(&lru_gen_key);
+
+	get_online_mems();
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		int nid;
+
+		for_each_node_state(nid, N_MEMORY) {
+			struct lruvec *lruvec;
+
+			lruvec = mem_cgroup_lruvec(memcg, NODE_DATA(nid));
+			while (!(enable ? lru_gen_fill(lruvec) :
+					  lru_gen_drain(lruvec)))
+				cond_resched();
+		}
+		cond_resched();
+	} while ((memcg = mem_cgroup_iter(NULL, memcg, NULL)));
+	put_online_mems();
+unlock:
+	mutex_unlock(&state_mutex);
+}
+
+static ssize_t enabled_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled());
+}
+
+static ssize_t enabled_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	bool enable;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	lru_gen_change_state(enable);
+
+	return count;
+}
+
+static struct kobj_attribute lru_gen_enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group lru_gen_attr_group = {
+	.name = "lru_gen",
+	.attrs = lru_gen_attrs,
+};
+
+/* memcg id, path and node, then type, seq, age in ms and pages per gen */
+static int lru_gen_seq_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg;
+	char *path;
+
+	path = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		int nid;
+
+		path[0] = '\0';
+#ifdef CONFIG_MEMCG
+		if (memcg)
+			cgroup_path(memcg->css.cgroup, path, PATH_MAX);
+#endif
+		seq_printf(m, "memcg %5hu %s\n", mem_cgroup_id(memcg), path);
+
+		for_each_node_state(nid, N_MEMORY) {
+			struct lruvec *lruvec;
+			struct lru_gen_struct *lrugen;
+			unsigned long seq;
+			int type, zone;
+
+			lruvec = mem_cgroup_lruvec(memcg, NODE_DATA(nid));
+			lrugen = &lruvec->lrugen;
+			seq_printf(m, " node %5d\n", nid);
+
+			for (type = 0; type < LRU_GEN_TYPES; type++) {
+				for (seq = READ_ONCE(lrugen->min_seq[type]);
+				     seq <= READ_ONCE(lrugen->max_seq[type]);
+				     seq++) {
+					int gen = lru_gen_from_seq(seq);
+					long nr = 0;
+
+					for (zone = 0; zone < MAX_NR_ZONES; zone++)
+						nr += READ_ONCE(lrugen->nr_pages[gen][type][zone]);
+
+					seq_printf(m, "  %s %10lu %10u %10ld\n",
+						   type == LRU_GEN_FILE ? "file" : "anon",
+						   seq, jiffies_to_msecs(jiffies -
+						   READ_ONCE(lrugen->timestamps[type][gen])),
+						   max(nr, 0L));
+				}
+			}
+		}
+	} while ((memcg = mem_cgroup_iter(NULL, memcg, NULL)));
+
+	kfree(path);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lru_gen_seq);
+
+static int __init lru_gen_init(void)
+{
+	if (sysfs_create_group(mm_kobj, &lru_gen_attr_group))
+		pr_err("lru_gen: failed to create sysfs group\n");
+
+	debugfs_create_file("lru_gen", 0444, NULL, NULL, &lru_gen_seq_fops);
+
+	return 0;
+}
+late_initcall(lru_gen_init);
+
+#else /* !CONFIG_LRU_GEN */
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc)
+{
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 {
 	unsigned long nr[NR_LRU_LISTS];
@@ -2430,6 +3387,11 @@ static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, sc);
+		return;
+	}
+
 	get_scan_count(lruvec, sc, nr);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2528,7 +3490,8 @@ static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
 	 */
-	if (total_swap_pages && inactive_is_low(lruvec, LRU_INACTIVE_ANON))
+	if (can_age_anon_pages(lruvec_pgdat(lruvec), sc) &&
+	    inactive_is_low(lruvec, LRU_INACTIVE_ANON))
 		shrink_active_list(SWAP_CLUSTER_MAX, lruvec,
 				   sc, LRU_ACTIVE_ANON);
 }
@@ -3349,7 +4312,7 @@ static void age_active_anon(struct pglist_data *pgdat,
 	struct mem_cgroup *memcg;
 	struct lruvec *lruvec;
 
-	if (!total_swap_pages)
+	if (!can_age_anon_pages(pgdat, sc) || lru_gen_enabled())
 		return;
 
 	lruvec = mem_cgroup_lruvec(NULL, pgdat);
@@ -1215,6 +1215,12 @@ const char * const vmstat_text[] = {
 #if IS_ENABLED(CONFIG_SHADOW_CALL_STACK)
 	"nr_shadow_call_stack",
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	"pgpromote_success",
+	"pgpromote_candidate",
+#endif
+	"pgdemote_kswapd",
+	"pgdemote_direct",
 
 	/* enum writeback_stat_item counters */
 	"nr_dirty_threshold",
@@ -1272,6 +1278,8 @@ const char * const vmstat_text[] = {
 	"numa_huge_pte_updates",
 	"numa_hint_faults",
 	"numa_hint_faults_local",
+	"numa_samples",
+	"numa_samples_local",
 	"numa_pages_migrated",
 #endif
 #ifdef CONFIG_MIGRATION
@@ -1280,6 +1288,8 @@ const char * const vmstat_text[] = {
 	"thp_migration_success",
 	"thp_migration_fail",
 	"thp_migration_split",
+	"pgmigrate_batched",
+	"pgmigrate_dma_copy",
 #endif
 #ifdef CONFIG_COMPACTION
 	"compact_migrate_scanned",
@@ -1291,6 +1301,12 @@ const char * const vmstat_text[] = {
 	"compact_daemon_wake",
 	"compact_daemon_migrate_scanned",
 	"compact_daemon_free_scanned",
+	"compact_daemon_proactive",
+	"compact_daemon_proactive_throttled",
+	"compact_daemon_proactive_migrate_scanned",
+	"compact_daemon_proactive_free_scanned",
+	"compact_daemon_proactive_ms",
+	"compact_stall_us",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -1349,6 +1365,10 @@ const char * const vmstat_text[] = {
 	"swap_ra",
 	"swap_ra_hit",
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_fallback",
+#endif
 #endif /* CONFIG_VM_EVENT_COUNTERS || CONFIG_MEMCG */
 };
 #endif /* CONFIG_PROC_FS || CONFIG_SYSFS || CONFIG_NUMA || CONFIG_MEMCG */
@@ -1668,6 +1688,7 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 	seq_printf(m, "\n  pagesets");
 	for_each_online_cpu(i) {
 		struct per_cpu_pageset *pageset;
+		int j;
 
 		pageset = per_cpu_ptr(zone->pageset, i);
 		seq_printf(m,
@@ -1679,6 +1700,10 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
 			   pageset->pcp.batch);
+		for (j = 1; j < NR_PCP_ORDERS; j++)
+			seq_printf(m, "\n              order-%u: %i",
+				   pcp_slot_order(j),
+				   pageset->pcp.nr_blocks[j]);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
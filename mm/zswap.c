@@ -33,6 +33,10 @@
 #include <linux/writeback.h>
 #include <linux/pagemap.h>
 #include <linux/workqueue.h>
+#include <linux/blkdev.h>
+#include <linux/memcontrol.h>
+#include <linux/seq_file.h>
+#include <linux/zswap.h>
 
 /*********************************
 * statistics
@@ -63,6 +67,8 @@ static u64 zswap_reject_compress_poor;
 static u64 zswap_reject_alloc_fail;
 /* Store failed because the entry metadata could not be allocated (rare) */
 static u64 zswap_reject_kmemcache_fail;
+/* Store failed because the memcg was over its zswap limit */
+static u64 zswap_reject_memcg_limit;
 /* Duplicate store was encountered (rare) */
 static u64 zswap_duplicate_entry;
 
@@ -70,6 +76,8 @@ static u64 zswap_duplicate_entry;
 static struct workqueue_struct *shrink_wq;
 /* Pool limit was hit, we need to calm down */
 static bool zswap_pool_reached_full;
+/* Maximum number of entries written back by one run of the shrinker */
+#define ZSWAP_WRITEBACK_BATCH 32
 
 /*********************************
 * tunables
@@ -155,6 +163,7 @@ struct zswap_pool {
  * length - the length in bytes of the compressed page data.  Needed during
  *          decompression. For a same value filled page length is 0.
  * pool - the zswap_pool the entry's data is in
+ * objcg - the obj_cgroup the compressed size is charged to, if any
  * handle - zpool allocation handle that stores the compressed page data
  * value - value of the same-value filled pages which have same content
  */
@@ -164,6 +173,7 @@ struct zswap_entry {
 	int refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
+	struct obj_cgroup *objcg;
 	union {
 		unsigned long handle;
 		unsigned long value;
@@ -178,6 +188,10 @@ struct zswap_header {
  * The tree lock in the zswap_tree struct protects a few things:
  * - the rbtree
  * - the refcount field of each entry in the tree
+ *
+ * Like the swap cache, each swap type is split into one tree per
+ * SWAP_ADDRESS_SPACE_PAGES slots, so that stores and loads to different
+ * parts of a large swap device don't serialize on a single lock.
  */
 struct zswap_tree {
 	struct rb_root rbroot;
@@ -185,6 +199,7 @@ struct zswap_tree {
 };
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+static unsigned int nr_zswap_trees[MAX_SWAPFILES];
 
 /* RCU-protected iteration */
 static LIST_HEAD(zswap_pools);
@@ -206,6 +221,12 @@ static bool zswap_has_pool;
 * helpers and fwd declarations
 **********************************/
 
+static inline struct zswap_tree *swap_zswap_tree(swp_entry_t swp)
+{
+	return &zswap_trees[swp_type(swp)][swp_offset(swp)
+		>> SWAP_ADDRESS_SPACE_SHIFT];
+}
+
 #define zswap_pool_debug(msg, p)				\
 	pr_debug("%s pool %s/%s\n", msg, (p)->tfm_name,		\
 		 zpool_get_type((p)->zpool))
@@ -339,6 +360,11 @@ static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
  */
 static void zswap_free_entry(struct zswap_entry *entry)
 {
+	if (entry->objcg) {
+		if (entry->length)
+			obj_cgroup_uncharge_zswap(entry->objcg, entry->length);
+		obj_cgroup_put(entry->objcg);
+	}
 	if (!entry->length)
 		atomic_dec(&zswap_same_filled_pages);
 	else {
@@ -518,13 +544,30 @@ static struct zswap_pool *zswap_pool_find_get(char *type, char *compressor)
 	return NULL;
 }
 
+/*
+ * Write back entries until the pool is below the accept threshold again,
+ * ZSWAP_WRITEBACK_BATCH at most, instead of a single one per store that
+ * hit the limit. The plug lets the block layer merge the writes to
+ * neighbouring swap slots.
+ */
 static void shrink_worker(struct work_struct *w)
 {
 	struct zswap_pool *pool = container_of(w, typeof(*pool),
 						shrink_work);
-
-	if (zpool_shrink(pool->zpool, 1, NULL))
-		zswap_reject_reclaim_fail++;
+	struct blk_plug plug;
+	int i;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < ZSWAP_WRITEBACK_BATCH; i++) {
+		if (zpool_shrink(pool->zpool, 1, NULL)) {
+			zswap_reject_reclaim_fail++;
+			break;
+		}
+		if (zswap_can_accept())
+			break;
+		cond_resched();
+	}
+	blk_finish_plug(&plug);
 	zswap_pool_put(pool);
 }
 
@@ -689,6 +732,105 @@ static void zswap_pool_put(struct zswap_pool *pool)
 	kref_put(&pool->kref, __zswap_pool_empty);
 }
 
+/*********************************
+* memcg functions
+**********************************/
+#ifdef CONFIG_MEMCG_KMEM
+/*
+ * A memcg can pick its own compressor through memory.zswap.compressor,
+ * e.g. lz4 for latency sensitive groups and zstd for batch jobs. The memcg
+ * holds a reference to a pool with that compressor and the zpool type
+ * that was current when it was set; stores from the memcg and its
+ * descendants use that pool instead of the current one.
+ */
+static struct zswap_pool *zswap_pool_memcg_get(struct obj_cgroup *objcg)
+{
+	struct zswap_pool *pool = NULL;
+	struct mem_cgroup *memcg;
+
+	if (!objcg)
+		return NULL;
+
+	/* pools are destroyed an RCU grace period after their last put */
+	rcu_read_lock();
+	for (memcg = obj_cgroup_memcg(objcg); memcg &&
+	     !mem_cgroup_is_root(memcg); memcg = parent_mem_cgroup(memcg)) {
+		pool = READ_ONCE(memcg->zswap_pool);
+		if (pool) {
+			if (!zswap_pool_get(pool))
+				pool = NULL;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return pool;
+}
+
+int zswap_memcg_set_compressor(struct mem_cgroup *memcg, char *name)
+{
+	struct zswap_pool *pool = NULL, *old;
+
+	if (zswap_init_failed || !zswap_has_pool)
+		return -ENODEV;
+
+	if (*name && strcmp(name, "default")) {
+		if (!crypto_has_comp(name, 0, 0)) {
+			pr_err("compressor %s not available\n", name);
+			return -ENOENT;
+		}
+
+		spin_lock(&zswap_pools_lock);
+		pool = zswap_pool_find_get(zswap_zpool_type, name);
+		spin_unlock(&zswap_pools_lock);
+
+		if (!pool) {
+			pool = zswap_pool_create(zswap_zpool_type, name);
+			if (!pool)
+				return -EINVAL;
+
+			/*
+			 * Add it right behind the current pool, the shrinker
+			 * writes back from the old pools at the end first.
+			 */
+			spin_lock(&zswap_pools_lock);
+			list_add_rcu(&pool->list, &zswap_pool_current()->list);
+			spin_unlock(&zswap_pools_lock);
+		}
+	}
+
+	old = xchg(&memcg->zswap_pool, pool);
+	if (old)
+		zswap_pool_put(old);
+
+	return 0;
+}
+
+void zswap_memcg_show_compressor(struct seq_file *m, struct mem_cgroup *memcg)
+{
+	struct zswap_pool *pool;
+
+	rcu_read_lock();
+	pool = READ_ONCE(memcg->zswap_pool);
+	seq_printf(m, "%s\n", pool ? pool->tfm_name : "default");
+	rcu_read_unlock();
+}
+
+void zswap_memcg_offline(struct mem_cgroup *memcg)
+{
+	struct zswap_pool *pool = xchg(&memcg->zswap_pool, NULL);
+
+	/* stored entries keep their own pool references */
+	if (pool)
+		zswap_pool_put(pool);
+}
+#else
+static inline struct zswap_pool *zswap_pool_memcg_get(struct obj_cgroup *objcg)
+{
+	return NULL;
+}
+#endif /* CONFIG_MEMCG_KMEM */
+
 /*********************************
 * param callbacks
 **********************************/
@@ -887,7 +1029,7 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	/* extract swpentry from data */
 	zhdr = zpool_map_handle(pool, handle, ZPOOL_MM_RO);
 	swpentry = zhdr->swpentry; /* here */
-	tree = zswap_trees[swp_type(swpentry)];
+	tree = swap_zswap_tree(swpentry);
 	offset = swp_offset(swpentry);
 
 	/* find and ref zswap entry */
@@ -1002,8 +1144,9 @@ static void zswap_fill_page(void *ptr, unsigned long value)
 static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree;
 	struct zswap_entry *entry, *dupentry;
+	struct obj_cgroup *objcg = NULL;
 	struct crypto_comp *tfm;
 	int ret;
 	unsigned int hlen, dlen = PAGE_SIZE;
@@ -1019,10 +1162,18 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
-	if (!zswap_enabled || !tree) {
+	if (!zswap_enabled || !zswap_trees[type]) {
 		ret = -ENODEV;
 		goto reject;
 	}
+	tree = swap_zswap_tree(zhdr.swpentry);
+
+	objcg = get_obj_cgroup_from_page(page);
+	if (objcg && !obj_cgroup_may_zswap(objcg)) {
+		zswap_reject_memcg_limit++;
+		ret = -ENOMEM;
+		goto reject;
+	}
 
 	/* reclaim space if needed */
 	if (zswap_is_full()) {
@@ -1067,7 +1218,9 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	}
 
 	/* if entry is successfully added, it keeps the reference */
-	entry->pool = zswap_pool_current_get();
+	entry->pool = zswap_pool_memcg_get(objcg);
+	if (!entry->pool)
+		entry->pool = zswap_pool_current_get();
 	if (!entry->pool) {
 		ret = -EINVAL;
 		goto freepage;
@@ -1105,12 +1258,22 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	zpool_unmap_handle(entry->pool->zpool, handle);
 	put_cpu_var(zswap_dstmem);
 
+	if (objcg && obj_cgroup_charge_zswap(objcg, dlen)) {
+		zpool_free(entry->pool->zpool, handle);
+		zswap_reject_memcg_limit++;
+		ret = -ENOMEM;
+		goto put_pool;
+	}
+
 	/* populate entry */
 	entry->offset = offset;
 	entry->handle = handle;
 	entry->length = dlen;
 
 insert_entry:
+	/* if entry is successfully added, it keeps the objcg reference */
+	entry->objcg = objcg;
+
 	/* map */
 	spin_lock(&tree->lock);
 	do {
@@ -1132,10 +1295,13 @@ insert_entry:
 
 put_dstmem:
 	put_cpu_var(zswap_dstmem);
+put_pool:
 	zswap_pool_put(entry->pool);
 freepage:
 	zswap_entry_cache_free(entry);
 reject:
+	if (objcg)
+		obj_cgroup_put(objcg);
 	return ret;
 }
 
@@ -1146,7 +1312,7 @@ reject:
 static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = swap_zswap_tree(swp_entry(type, offset));
 	struct zswap_entry *entry;
 	struct crypto_comp *tfm;
 	u8 *src, *dst;
@@ -1194,7 +1360,7 @@ freeentry:
 /* frees an entry in zswap */
 static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = swap_zswap_tree(swp_entry(type, offset));
 	struct zswap_entry *entry;
 
 	/* find */
@@ -1218,35 +1384,47 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 /* frees all zswap entries for the given swap type */
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *trees = zswap_trees[type], *tree;
 	struct zswap_entry *entry, *n;
+	unsigned int i;
 
-	if (!tree)
+	if (!trees)
 		return;
 
-	/* walk the tree and free everything */
-	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
-		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
-	spin_unlock(&tree->lock);
-	kfree(tree);
+	/* walk the trees and free everything */
+	for (i = 0; i < nr_zswap_trees[type]; i++) {
+		tree = &trees[i];
+		spin_lock(&tree->lock);
+		rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot,
+						     rbnode)
+			zswap_free_entry(entry);
+		tree->rbroot = RB_ROOT;
+		spin_unlock(&tree->lock);
+	}
+	kvfree(trees);
+	nr_zswap_trees[type] = 0;
 	zswap_trees[type] = NULL;
 }
 
 static void zswap_frontswap_init(unsigned type)
 {
-	struct zswap_tree *tree;
+	struct swap_info_struct *si = swp_swap_info(swp_entry(type, 0));
+	struct zswap_tree *trees;
+	unsigned int i, nr;
 
-	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
-	if (!tree) {
+	nr = DIV_ROUND_UP(si->max, SWAP_ADDRESS_SPACE_PAGES);
+	trees = kvcalloc(nr, sizeof(*trees), GFP_KERNEL);
+	if (!trees) {
 		pr_err("alloc failed, zswap disabled for swap type %d\n", type);
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
-	spin_lock_init(&tree->lock);
-	zswap_trees[type] = tree;
+	for (i = 0; i < nr; i++) {
+		trees[i].rbroot = RB_ROOT;
+		spin_lock_init(&trees[i].lock);
+	}
+	nr_zswap_trees[type] = nr;
+	zswap_trees[type] = trees;
 }
 
 static struct frontswap_ops zswap_frontswap_ops = {
@@ -1280,6 +1458,8 @@ static int __init zswap_debugfs_init(void)
 			   zswap_debugfs_root, &zswap_reject_alloc_fail);
 	debugfs_create_u64("reject_kmemcache_fail", 0444,
 			   zswap_debugfs_root, &zswap_reject_kmemcache_fail);
+	debugfs_create_u64("reject_memcg_limit", 0444,
+			   zswap_debugfs_root, &zswap_reject_memcg_limit);
 	debugfs_create_u64("reject_compress_poor", 0444,
 			   zswap_debugfs_root, &zswap_reject_compress_poor);
 	debugfs_create_u64("written_back_pages", 0444,
@@ -3657,6 +3657,7 @@ static int xdp_do_generic_redirect_map(struct net_device *dev,
 	} else if (map->map_type == BPF_MAP_TYPE_XSKMAP) {
 		struct xdp_sock *xs = fwd;
 
+		sk_mark_napi_id_once(&xs->sk, skb);
 		err = xsk_generic_rcv(xs, xdp);
 		if (err)
 			goto err;
@@ -12,6 +12,7 @@
 #include <linux/slab.h>
 #include <linux/sched/signal.h>
 #include <linux/sched/isolation.h>
+#include <linux/sched/topology.h>
 #include <linux/nsproxy.h>
 #include <net/sock.h>
 #include <net/net_namespace.h>
@@ -329,6 +330,27 @@ static ssize_t carrier_down_count_show(struct device *dev,
 }
 static DEVICE_ATTR_RO(carrier_down_count);
 
+static ssize_t udp_gro_packets_show(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buf)
+{
+	struct net_device *netdev = to_net_dev(dev);
+
+	return sprintf(buf, fmt_ulong,
+		       atomic_long_read(&netdev->udp_gro_packets));
+}
+static DEVICE_ATTR_RO(udp_gro_packets);
+
+static ssize_t udp_gro_segs_show(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct net_device *netdev = to_net_dev(dev);
+
+	return sprintf(buf, fmt_ulong, atomic_long_read(&netdev->udp_gro_segs));
+}
+static DEVICE_ATTR_RO(udp_gro_segs);
+
 /* read-write attributes */
 
 static int change_mtu(struct net_device *dev, unsigned long new_mtu)
@@ -400,6 +422,41 @@ static ssize_t napi_defer_hard_irqs_store(struct device *dev,
 }
 NETDEVICE_SHOW_RW(napi_defer_hard_irqs, fmt_dec);
 
+static ssize_t threaded_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct net_device *netdev = to_net_dev(dev);
+	ssize_t ret = -EINVAL;
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	if (dev_isalive(netdev))
+		ret = sprintf(buf, fmt_dec, netdev->threaded);
+
+	rtnl_unlock();
+	return ret;
+}
+
+static int modify_napi_threaded(struct net_device *dev, unsigned long val)
+{
+	if (list_empty(&dev->napi_list))
+		return -EOPNOTSUPP;
+
+	if (val != 0 && val != 1)
+		return -EOPNOTSUPP;
+
+	return dev_set_threaded(dev, val);
+}
+
+static ssize_t threaded_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t len)
+{
+	return netdev_store(dev, attr, buf, len, modify_napi_threaded);
+}
+static DEVICE_ATTR_RW(threaded);
+
 static ssize_t ifalias_store(struct device *dev, struct device_attribute *attr,
 			     const char *buf, size_t len)
 {
@@ -570,6 +627,9 @@ static struct attribute *net_class_attrs[] __ro_after_init = {
 	&dev_attr_proto_down.attr,
 	&dev_attr_carrier_up_count.attr,
 	&dev_attr_carrier_down_count.attr,
+	&dev_attr_udp_gro_packets.attr,
+	&dev_attr_udp_gro_segs.attr,
+	&dev_attr_threaded.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(net_class);
@@ -742,7 +802,7 @@ static ssize_t store_rps_map(struct netdev_rx_queue *queue,
 {
 	struct rps_map *old_map, *map;
 	cpumask_var_t mask;
-	int err, cpu, i, hk_flags;
+	int err, cpu, i, n, hk_flags;
 	static DEFINE_MUTEX(rps_map_mutex);
 
 	if (!capable(CAP_NET_ADMIN))
@@ -767,16 +827,30 @@ static ssize_t store_rps_map(struct netdev_rx_queue *queue,
 	}
 
 	map = kzalloc(max_t(unsigned int,
-			    RPS_MAP_SIZE(cpumask_weight(mask)), L1_CACHE_BYTES),
+			    RPS_MAP_SIZE(2 * cpumask_weight(mask)),
+			    L1_CACHE_BYTES),
 		      GFP_KERNEL);
 	if (!map) {
 		free_cpumask_var(mask);
 		return -ENOMEM;
 	}
 
+	/* Group the CPUs by last level cache, see get_rps_cpu() */
 	i = 0;
-	for_each_cpu_and(cpu, mask, cpu_online_mask)
+	cpumask_and(mask, mask, cpu_online_mask);
+	n = cpumask_weight(mask);
+	for_each_cpu(cpu, mask) {
+		int sibling;
+
+		map->cpus[n + map->llc_groups++] = i;
 		map->cpus[i++] = cpu;
+		for_each_cpu(sibling, mask) {
+			if (sibling > cpu && cpus_share_cache(cpu, sibling)) {
+				map->cpus[i++] = sibling;
+				cpumask_clear_cpu(sibling, mask);
+			}
+		}
+	}
 
 	if (i) {
 		map->len = i;
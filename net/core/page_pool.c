@@ -15,12 +15,118 @@
 #include <linux/dma-mapping.h>
 #include <linux/page-flags.h>
 #include <linux/mm.h> /* for __put_page() */
+#include <linux/percpu.h>
+#include <linux/ethtool.h>
 
 #include <trace/events/page_pool.h>
 
 #define DEFER_TIME (msecs_to_jiffies(1000))
 #define DEFER_WARN_INTERVAL (60 * HZ)
 
+#define BIAS_MAX	LONG_MAX
+
+#ifdef CONFIG_PAGE_POOL_STATS
+/* alloc_stat_inc is intended to be used in softirq context */
+#define alloc_stat_inc(pool, __stat)	(pool->alloc_stats.__stat++)
+/* recycle_stat_inc is safe to use when preemption is possible. */
+#define recycle_stat_inc(pool, __stat)					\
+	this_cpu_inc(pool->recycle_stats->__stat)
+
+#define recycle_stat_add(pool, __stat, val)				\
+	this_cpu_add(pool->recycle_stats->__stat, val)
+
+static const char pp_stats[][ETH_GSTRING_LEN] = {
+	"rx_pp_alloc_fast",
+	"rx_pp_alloc_slow",
+	"rx_pp_alloc_slow_ho",
+	"rx_pp_alloc_empty",
+	"rx_pp_alloc_refill",
+	"rx_pp_alloc_waive",
+	"rx_pp_recycle_cached",
+	"rx_pp_recycle_cache_full",
+	"rx_pp_recycle_percpu",
+	"rx_pp_recycle_ring",
+	"rx_pp_recycle_ring_full",
+	"rx_pp_recycle_released_ref",
+};
+
+bool page_pool_get_stats(struct page_pool *pool,
+			 struct page_pool_stats *stats)
+{
+	int cpu = 0;
+
+	if (!stats)
+		return false;
+
+	/* The caller is responsible to initialize stats. */
+	stats->alloc_stats.fast += pool->alloc_stats.fast;
+	stats->alloc_stats.slow += pool->alloc_stats.slow;
+	stats->alloc_stats.slow_high_order += pool->alloc_stats.slow_high_order;
+	stats->alloc_stats.empty += pool->alloc_stats.empty;
+	stats->alloc_stats.refill += pool->alloc_stats.refill;
+	stats->alloc_stats.waive += pool->alloc_stats.waive;
+
+	for_each_possible_cpu(cpu) {
+		const struct page_pool_recycle_stats *pcpu =
+			per_cpu_ptr(pool->recycle_stats, cpu);
+
+		stats->recycle_stats.cached += pcpu->cached;
+		stats->recycle_stats.cache_full += pcpu->cache_full;
+		stats->recycle_stats.percpu += pcpu->percpu;
+		stats->recycle_stats.ring += pcpu->ring;
+		stats->recycle_stats.ring_full += pcpu->ring_full;
+		stats->recycle_stats.released_refcnt += pcpu->released_refcnt;
+	}
+
+	return true;
+}
+EXPORT_SYMBOL(page_pool_get_stats);
+
+u8 *page_pool_ethtool_stats_get_strings(u8 *data)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(pp_stats); i++) {
+		memcpy(data, pp_stats[i], ETH_GSTRING_LEN);
+		data += ETH_GSTRING_LEN;
+	}
+
+	return data;
+}
+EXPORT_SYMBOL(page_pool_ethtool_stats_get_strings);
+
+int page_pool_ethtool_stats_get_count(void)
+{
+	return ARRAY_SIZE(pp_stats);
+}
+EXPORT_SYMBOL(page_pool_ethtool_stats_get_count);
+
+u64 *page_pool_ethtool_stats_get(u64 *data, void *stats)
+{
+	struct page_pool_stats *pool_stats = stats;
+
+	*data++ = pool_stats->alloc_stats.fast;
+	*data++ = pool_stats->alloc_stats.slow;
+	*data++ = pool_stats->alloc_stats.slow_high_order;
+	*data++ = pool_stats->alloc_stats.empty;
+	*data++ = pool_stats->alloc_stats.refill;
+	*data++ = pool_stats->alloc_stats.waive;
+	*data++ = pool_stats->recycle_stats.cached;
+	*data++ = pool_stats->recycle_stats.cache_full;
+	*data++ = pool_stats->recycle_stats.percpu;
+	*data++ = pool_stats->recycle_stats.ring;
+	*data++ = pool_stats->recycle_stats.ring_full;
+	*data++ = pool_stats->recycle_stats.released_refcnt;
+
+	return data;
+}
+EXPORT_SYMBOL(page_pool_ethtool_stats_get);
+#else
+#define alloc_stat_inc(pool, __stat)
+#define recycle_stat_inc(pool, __stat)
+#define recycle_stat_add(pool, __stat, val)
+#endif
+
 static int page_pool_init(struct page_pool *pool,
 			  const struct page_pool_params *params)
 {
@@ -64,8 +170,56 @@ static int page_pool_init(struct page_pool *pool,
 		 */
 	}
 
-	if (ptr_ring_init(&pool->ring, ring_qsize, GFP_KERNEL) < 0)
+	if (PAGE_POOL_DMA_USE_PP_FRAG_COUNT &&
+	    pool->p.flags & PP_FLAG_PAGE_FRAG)
+		return -EINVAL;
+
+	/* The shared pool hands out single pages, and parked pages reuse
+	 * the page_pool fields of struct page, so they cannot keep a DMA
+	 * mapping of the pool.
+	 */
+	if (pool->p.flags & PP_FLAG_DMA_SHARED &&
+	    (pool->p.order || pool->p.flags & PP_FLAG_DMA_MAP))
+		return -EINVAL;
+	spin_lock_init(&pool->shared_lock);
+	INIT_LIST_HEAD(&pool->shared_parked);
+
+	/* Never let the per-CPU return caches hold more pages than the
+	 * ring itself, so a pool on a many-CPU machine does not pin
+	 * more memory than its user asked for.  Small rings skip the
+	 * caches and free straight into the ring.
+	 */
+	pool->recycle_batch = min_t(unsigned int, PP_RECYCLE_CACHE_SIZE,
+				    ring_qsize / num_possible_cpus());
+	if (pool->recycle_batch < 2)
+		pool->recycle_batch = 0;
+
+	if (pool->recycle_batch) {
+		int cpu;
+
+		pool->recycle = alloc_percpu(struct pp_recycle_cache);
+		if (!pool->recycle)
+			return -ENOMEM;
+
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(pool->recycle, cpu)->lock);
+	}
+
+#ifdef CONFIG_PAGE_POOL_STATS
+	pool->recycle_stats = alloc_percpu(struct page_pool_recycle_stats);
+	if (!pool->recycle_stats) {
+		free_percpu(pool->recycle);
+		return -ENOMEM;
+	}
+#endif
+
+	if (ptr_ring_init(&pool->ring, ring_qsize, GFP_KERNEL) < 0) {
+#ifdef CONFIG_PAGE_POOL_STATS
+		free_percpu(pool->recycle_stats);
+#endif
+		free_percpu(pool->recycle);
 		return -ENOMEM;
+	}
 
 	atomic_set(&pool->pages_state_release_cnt, 0);
 
@@ -108,8 +262,10 @@ static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
 	int pref_nid; /* preferred NUMA node */
 
 	/* Quicker fallback, avoid locks when ring is empty */
-	if (__ptr_ring_empty(r))
+	if (__ptr_ring_empty(r)) {
+		alloc_stat_inc(pool, empty);
 		return NULL;
+	}
 
 	/* Softirq guarantee CPU and thus NUMA node is stable. This,
 	 * assumes CPU refilling driver RX-ring will also run RX-NAPI.
@@ -139,14 +295,17 @@ static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
 			 * This limit stress on page buddy alloactor.
 			 */
 			page_pool_return_page(pool, page);
+			alloc_stat_inc(pool, waive);
 			page = NULL;
 			break;
 		}
 	} while (pool->alloc.count < PP_ALLOC_CACHE_REFILL);
 
 	/* Return last page */
-	if (likely(pool->alloc.count > 0))
+	if (likely(pool->alloc.count > 0)) {
 		page = pool->alloc.cache[--pool->alloc.count];
+		alloc_stat_inc(pool, refill);
+	}
 
 	spin_unlock(&r->consumer_lock);
 	return page;
@@ -161,6 +320,7 @@ static struct page *__page_pool_get_cached(struct page_pool *pool)
 	if (likely(pool->alloc.count)) {
 		/* Fast-path */
 		page = pool->alloc.cache[--pool->alloc.count];
+		alloc_stat_inc(pool, fast);
 	} else {
 		page = page_pool_refill_alloc_cache(pool);
 	}
@@ -178,29 +338,37 @@ static void page_pool_dma_sync_for_device(struct page_pool *pool,
 					 pool->p.dma_dir);
 }
 
-/* slow path */
-noinline
-static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
-						 gfp_t _gfp)
+static bool page_pool_dma_map(struct page_pool *pool, struct page *page)
 {
-	struct page *page;
-	gfp_t gfp = _gfp;
 	dma_addr_t dma;
 
-	/* We could always set __GFP_COMP, and avoid this branch, as
-	 * prep_new_page() can handle order-0 with __GFP_COMP.
+	/* Setup DMA mapping: use 'struct page' area for storing DMA-addr
+	 * since dma_addr_t can be either 32 or 64 bits and does not always fit
+	 * into page private data (i.e 32bit cpu with 64bit DMA caps)
+	 * This mapping is kept for lifetime of page, until leaving pool.
 	 */
-	if (pool->p.order)
-		gfp |= __GFP_COMP;
+	dma = dma_map_page_attrs(pool->p.dev, page, 0,
+				 (PAGE_SIZE << pool->p.order),
+				 pool->p.dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
+	if (dma_mapping_error(pool->p.dev, dma))
+		return false;
 
-	/* FUTURE development:
-	 *
-	 * Current slow-path essentially falls back to single page
-	 * allocations, which doesn't improve performance.  This code
-	 * need bulk allocation support from the page allocator code.
-	 */
+	page->dma_addr = dma;
+
+	if (pool->p.flags & PP_FLAG_DMA_SYNC_DEV)
+		page_pool_dma_sync_for_device(pool, page, pool->p.max_len);
+
+	return true;
+}
+
+static struct page *__page_pool_alloc_page_order(struct page_pool *pool,
+						 gfp_t gfp)
+{
+	struct page *page;
+
+	/* Only used for high-order pages, which are handed out compound */
+	gfp |= __GFP_COMP;
 
-	/* Cache was empty, do real allocation */
 #ifdef CONFIG_NUMA
 	page = alloc_pages_node(pool->p.nid, gfp, pool->p.order);
 #else
@@ -209,36 +377,128 @@ static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
 	if (!page)
 		return NULL;
 
-	if (!(pool->p.flags & PP_FLAG_DMA_MAP))
-		goto skip_dma_map;
-
-	/* Setup DMA mapping: use 'struct page' area for storing DMA-addr
-	 * since dma_addr_t can be either 32 or 64 bits and does not always fit
-	 * into page private data (i.e 32bit cpu with 64bit DMA caps)
-	 * This mapping is kept for lifetime of page, until leaving pool.
-	 */
-	dma = dma_map_page_attrs(pool->p.dev, page, 0,
-				 (PAGE_SIZE << pool->p.order),
-				 pool->p.dma_dir, DMA_ATTR_SKIP_CPU_SYNC);
-	if (dma_mapping_error(pool->p.dev, dma)) {
+	if ((pool->p.flags & PP_FLAG_DMA_MAP) &&
+	    unlikely(!page_pool_dma_map(pool, page))) {
 		put_page(page);
 		return NULL;
 	}
-	page->dma_addr = dma;
 
-	if (pool->p.flags & PP_FLAG_DMA_SYNC_DEV)
-		page_pool_dma_sync_for_device(pool, page, pool->p.max_len);
+	alloc_stat_inc(pool, slow_high_order);
 
-skip_dma_map:
 	/* Track how many pages are held 'in-flight' */
 	pool->pages_state_hold_cnt++;
-
 	trace_page_pool_state_hold(pool, page, pool->pages_state_hold_cnt);
 
 	/* When page just alloc'ed is should/must have refcnt 1. */
 	return page;
 }
 
+/* Refill the alloc cache from the shared DMA pool.  Parked pages that
+ * the stack has let go of are reused first, they are still accounted as
+ * in-flight.
+ */
+static struct page *page_pool_alloc_shared(struct page_pool *pool)
+{
+	struct page *page, *next;
+
+	spin_lock_bh(&pool->shared_lock);
+	list_for_each_entry_safe(page, next, &pool->shared_parked, lru) {
+		if (page_ref_count(page) != 1)
+			continue;
+		list_del(&page->lru);
+		pool->alloc.cache[pool->alloc.count++] = page;
+		if (pool->alloc.count == PP_ALLOC_CACHE_REFILL)
+			break;
+	}
+	spin_unlock_bh(&pool->shared_lock);
+
+	while (pool->alloc.count < PP_ALLOC_CACHE_REFILL) {
+		page = dma_alloc_shared_page();
+		if (!page)
+			break;
+		pool->alloc.cache[pool->alloc.count++] = page;
+
+		/* Track how many pages are held 'in-flight' */
+		pool->pages_state_hold_cnt++;
+		trace_page_pool_state_hold(pool, page,
+					   pool->pages_state_hold_cnt);
+	}
+
+	if (!pool->alloc.count)
+		return NULL;
+
+	alloc_stat_inc(pool, slow);
+	return pool->alloc.cache[--pool->alloc.count];
+}
+
+/* slow path */
+noinline
+static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
+						 gfp_t gfp)
+{
+	const int bulk = PP_ALLOC_CACHE_REFILL;
+	struct page *page;
+	int i, nr_pages;
+
+	/* Don't support bulk alloc for high-order pages */
+	if (unlikely(pool->p.order))
+		return __page_pool_alloc_page_order(pool, gfp);
+
+	/* Unnecessary as alloc cache is empty, but guarantees zero count */
+	if (unlikely(pool->alloc.count > 0))
+		return pool->alloc.cache[--pool->alloc.count];
+
+	/* Fall back to the page allocator once the shared pool is used up */
+	if (pool->p.flags & PP_FLAG_DMA_SHARED) {
+		page = page_pool_alloc_shared(pool);
+		if (page)
+			return page;
+	}
+
+	/* Mark empty alloc.cache slots "empty" for alloc_pages_bulk_array */
+	memset(&pool->alloc.cache, 0, sizeof(void *) * bulk);
+
+	/* Cache was empty, refill it in one go from the page allocator */
+#ifdef CONFIG_NUMA
+	nr_pages = alloc_pages_bulk_array_node(gfp, pool->p.nid, bulk,
+					       (struct page **)pool->alloc.cache);
+#else
+	nr_pages = alloc_pages_bulk_array(gfp, bulk,
+					  (struct page **)pool->alloc.cache);
+#endif
+	if (unlikely(!nr_pages))
+		return NULL;
+
+	/* Pages have been filled into alloc.cache array, but count is zero
+	 * and the pages have not been DMA mapped yet.
+	 */
+	for (i = 0; i < nr_pages; i++) {
+		page = pool->alloc.cache[i];
+		if ((pool->p.flags & PP_FLAG_DMA_MAP) &&
+		    unlikely(!page_pool_dma_map(pool, page))) {
+			put_page(page);
+			continue;
+		}
+		pool->alloc.cache[pool->alloc.count++] = page;
+
+		/* Track how many pages are held 'in-flight' */
+		pool->pages_state_hold_cnt++;
+		trace_page_pool_state_hold(pool, page,
+					   pool->pages_state_hold_cnt);
+	}
+
+	/* Return last page */
+	if (likely(pool->alloc.count > 0)) {
+		page = pool->alloc.cache[--pool->alloc.count];
+		alloc_stat_inc(pool, slow);
+	} else {
+		page = NULL;
+	}
+
+	/* When page just alloc'ed is should/must have refcnt 1. */
+	return page;
+}
+
 /* For using page_pool replace: alloc_pages() API calls, but provide
  * synchronization guarantee for allocation side.
  */
@@ -308,9 +568,38 @@ skip_dma_unmap:
 }
 EXPORT_SYMBOL(page_pool_release_page);
 
+static bool page_pool_page_is_shared(struct page_pool *pool,
+				     struct page *page)
+{
+	return pool->p.flags & PP_FLAG_DMA_SHARED &&
+		dma_is_shared(page_to_phys(page), PAGE_SIZE);
+}
+
+/* A page of the shared DMA pool is decrypted and must never reach the
+ * page allocator.  It goes back to the shared pool when the pool holds
+ * its only reference, and is parked while the stack still holds it.
+ */
+static void page_pool_return_shared(struct page_pool *pool, struct page *page)
+{
+	if (page_ref_count(page) == 1) {
+		page_pool_release_page(pool, page);
+		dma_free_shared_page(page);
+		return;
+	}
+
+	spin_lock_bh(&pool->shared_lock);
+	list_add_tail(&page->lru, &pool->shared_parked);
+	spin_unlock_bh(&pool->shared_lock);
+}
+
 /* Return a page to the page allocator, cleaning up our state */
 static void page_pool_return_page(struct page_pool *pool, struct page *page)
 {
+	if (page_pool_page_is_shared(pool, page)) {
+		page_pool_return_shared(pool, page);
+		return;
+	}
+
 	page_pool_release_page(pool, page);
 
 	put_page(page);
@@ -329,7 +618,64 @@ static bool page_pool_recycle_in_ring(struct page_pool *pool, struct page *page)
 	else
 		ret = ptr_ring_produce_bh(&pool->ring, page);
 
-	return (ret == 0) ? true : false;
+	if (!ret) {
+		recycle_stat_inc(pool, ring);
+		return true;
+	}
+
+	return false;
+}
+
+/* Move the pages of a full per-CPU return cache into the ring, taking
+ * the producer lock once for the whole batch.  Pages that do not fit
+ * are handed back in @overflow; the caller must release them only after
+ * dropping rc->lock, as the last release may free the pool.
+ */
+static unsigned int page_pool_flush_recycle_cache(struct page_pool *pool,
+						  struct pp_recycle_cache *rc,
+						  struct page **overflow)
+{
+	struct ptr_ring *r = &pool->ring;
+	unsigned int i, n = 0;
+
+	spin_lock(&r->producer_lock);
+	for (i = 0; i < rc->count; i++)
+		if (__ptr_ring_produce(r, rc->cache[i]))
+			break;
+	spin_unlock(&r->producer_lock);
+	recycle_stat_add(pool, ring, i);
+
+	for (; i < rc->count; i++) {
+		recycle_stat_inc(pool, ring_full);
+		overflow[n++] = rc->cache[i];
+	}
+	rc->count = 0;
+
+	return n;
+}
+
+static void page_pool_recycle_in_percpu(struct page_pool *pool,
+					struct page *page)
+{
+	struct page *overflow[PP_RECYCLE_CACHE_SIZE];
+	struct pp_recycle_cache *rc;
+	unsigned int i, n = 0;
+
+	local_bh_disable();
+	rc = this_cpu_ptr(pool->recycle);
+	spin_lock(&rc->lock);
+
+	rc->cache[rc->count++] = page;
+	recycle_stat_inc(pool, percpu);
+	if (rc->count >= pool->recycle_batch)
+		n = page_pool_flush_recycle_cache(pool, rc, overflow);
+
+	spin_unlock(&rc->lock);
+	local_bh_enable();
+
+	/* Ring full, fallback to free pages */
+	for (i = 0; i < n; i++)
+		page_pool_return_page(pool, overflow[i]);
 }
 
 /* Only allow direct recycling in special circumstances, into the
@@ -340,11 +686,14 @@ static bool page_pool_recycle_in_ring(struct page_pool *pool, struct page *page)
 static bool page_pool_recycle_in_cache(struct page *page,
 				       struct page_pool *pool)
 {
-	if (unlikely(pool->alloc.count == PP_ALLOC_CACHE_SIZE))
+	if (unlikely(pool->alloc.count == PP_ALLOC_CACHE_SIZE)) {
+		recycle_stat_inc(pool, cache_full);
 		return false;
+	}
 
 	/* Caller MUST have verified/know (page_ref_count(page) == 1) */
 	pool->alloc.cache[pool->alloc.count++] = page;
+	recycle_stat_inc(pool, cached);
 	return true;
 }
 
@@ -370,7 +719,14 @@ void page_pool_put_page(struct page_pool *pool, struct page *page,
 	 * regular page allocator APIs.
 	 *
 	 * refcnt == 1 means page_pool owns page, and can recycle it.
+	 *
+	 * A fragmented page is only recycled or released once its
+	 * last fragment is returned.
 	 */
+	if ((pool->p.flags & PP_FLAG_PAGE_FRAG) &&
+	    page_pool_atomic_sub_frag_count_return(page, 1))
+		return;
+
 	if (likely(page_ref_count(page) == 1 &&
 		   pool_page_reusable(pool, page))) {
 		/* Read barrier done in page_ref_count / READ_ONCE */
@@ -383,8 +739,14 @@ void page_pool_put_page(struct page_pool *pool, struct page *page,
 			if (page_pool_recycle_in_cache(page, pool))
 				return;
 
+		if (pool->recycle_batch) {
+			page_pool_recycle_in_percpu(pool, page);
+			return;
+		}
+
 		if (!page_pool_recycle_in_ring(pool, page)) {
 			/* Cache full, fallback to free pages */
+			recycle_stat_inc(pool, ring_full);
 			page_pool_return_page(pool, page);
 		}
 		return;
@@ -402,12 +764,108 @@ void page_pool_put_page(struct page_pool *pool, struct page *page,
 	 * doing refcnt based recycle tricks, meaning another process
 	 * will be invoking put_page.
 	 */
+	recycle_stat_inc(pool, released_refcnt);
+	if (page_pool_page_is_shared(pool, page)) {
+		page_pool_return_shared(pool, page);
+		return;
+	}
 	/* Do not replace this with page_pool_return_page() */
 	page_pool_release_page(pool, page);
 	put_page(page);
 }
 EXPORT_SYMBOL(page_pool_put_page);
 
+/* Drop the bias of the page fragments are carved from.  If every
+ * fragment handed out has been returned meanwhile, the page can be
+ * reused right away for the next fragments.
+ */
+static struct page *page_pool_drain_frag(struct page_pool *pool,
+					 struct page *page)
+{
+	long drain_count = BIAS_MAX - pool->frag_users;
+
+	/* Some user is still using the page frag */
+	if (likely(page_pool_atomic_sub_frag_count_return(page,
+							  drain_count)))
+		return NULL;
+
+	if (page_ref_count(page) == 1 && pool_page_reusable(pool, page)) {
+		if (pool->p.flags & PP_FLAG_DMA_SYNC_DEV)
+			page_pool_dma_sync_for_device(pool, page, -1);
+
+		return page;
+	}
+
+	page_pool_return_page(pool, page);
+	return NULL;
+}
+
+static void page_pool_free_frag(struct page_pool *pool)
+{
+	long drain_count = BIAS_MAX - pool->frag_users;
+	struct page *page = pool->frag_page;
+
+	pool->frag_page = NULL;
+
+	if (!page ||
+	    atomic_long_sub_return(drain_count, &page->pp_frag_count))
+		return;
+
+	page_pool_return_page(pool, page);
+}
+
+/* Carve a fragment of @size bytes, at *@offset in the returned page, out
+ * of the page the pool is currently fragmenting.  The page is set up with
+ * a fragment count biased by BIAS_MAX, so handing out a fragment does not
+ * touch the shared count; the bias is dropped once the page is used up.
+ * Every fragment is returned with page_pool_put_page() and the DMA mapping
+ * of the page, if any, is shared by all of them.
+ *
+ * Same calling context as page_pool_alloc_pages().
+ */
+struct page *page_pool_alloc_frag(struct page_pool *pool,
+				  unsigned int *offset,
+				  unsigned int size, gfp_t gfp)
+{
+	unsigned int max_size = PAGE_SIZE << pool->p.order;
+	struct page *page = pool->frag_page;
+
+	if (WARN_ON(!(pool->p.flags & PP_FLAG_PAGE_FRAG) ||
+		    size > max_size))
+		return NULL;
+
+	size = ALIGN(size, dma_get_cache_alignment());
+	*offset = pool->frag_offset;
+
+	if (page && *offset + size > max_size) {
+		page = page_pool_drain_frag(pool, page);
+		if (page)
+			goto frag_reset;
+	}
+
+	if (!page) {
+		page = page_pool_alloc_pages(pool, gfp);
+		if (unlikely(!page)) {
+			pool->frag_page = NULL;
+			return NULL;
+		}
+
+		pool->frag_page = page;
+
+frag_reset:
+		pool->frag_users = 1;
+		*offset = 0;
+		pool->frag_offset = size;
+		page_pool_fragment_page(page, BIAS_MAX);
+		return page;
+	}
+
+	pool->frag_users++;
+	pool->frag_offset = *offset + size;
+	return page;
+}
+EXPORT_SYMBOL(page_pool_alloc_frag);
+
 static void page_pool_empty_ring(struct page_pool *pool)
 {
 	struct page *page;
@@ -429,6 +887,10 @@ static void page_pool_free(struct page_pool *pool)
 		pool->disconnect(pool);
 
 	ptr_ring_cleanup(&pool->ring, NULL);
+	free_percpu(pool->recycle);
+#ifdef CONFIG_PAGE_POOL_STATS
+	free_percpu(pool->recycle_stats);
+#endif
 
 	if (pool->p.flags & PP_FLAG_DMA_MAP)
 		put_device(pool->p.dev);
@@ -453,6 +915,53 @@ static void page_pool_empty_alloc_cache_once(struct page_pool *pool)
 	}
 }
 
+/* Return the pages parked in the per-CPU return caches.  Producers may
+ * still be adding to them, so this is repeated on every release retry.
+ */
+static void page_pool_empty_recycle_caches(struct page_pool *pool)
+{
+	struct page *pages[PP_RECYCLE_CACHE_SIZE];
+	struct pp_recycle_cache *rc;
+	unsigned int i, n;
+	int cpu;
+
+	if (!pool->recycle_batch)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		rc = per_cpu_ptr(pool->recycle, cpu);
+
+		spin_lock_bh(&rc->lock);
+		n = rc->count;
+		memcpy(pages, rc->cache, n * sizeof(pages[0]));
+		rc->count = 0;
+		spin_unlock_bh(&rc->lock);
+
+		for (i = 0; i < n; i++)
+			page_pool_return_page(pool, pages[i]);
+	}
+}
+
+/* Give the parked pages that the stack has let go of back to the shared
+ * pool, the others are waited for like any page in-flight.
+ */
+static void page_pool_empty_parked(struct page_pool *pool)
+{
+	struct page *page, *next;
+	LIST_HEAD(unused);
+
+	spin_lock_bh(&pool->shared_lock);
+	list_for_each_entry_safe(page, next, &pool->shared_parked, lru)
+		if (page_ref_count(page) == 1)
+			list_move(&page->lru, &unused);
+	spin_unlock_bh(&pool->shared_lock);
+
+	list_for_each_entry_safe(page, next, &unused, lru) {
+		list_del(&page->lru);
+		page_pool_return_shared(pool, page);
+	}
+}
+
 static void page_pool_scrub(struct page_pool *pool)
 {
 	page_pool_empty_alloc_cache_once(pool);
@@ -461,7 +970,9 @@ static void page_pool_scrub(struct page_pool *pool)
 	/* No more consumers should exist, but producers could still
 	 * be in-flight.
 	 */
+	page_pool_empty_recycle_caches(pool);
 	page_pool_empty_ring(pool);
+	page_pool_empty_parked(pool);
 }
 
 static int page_pool_release(struct page_pool *pool)
@@ -513,6 +1024,8 @@ void page_pool_destroy(struct page_pool *pool)
 	if (!page_pool_put(pool))
 		return;
 
+	page_pool_free_frag(pool);
+
 	if (!page_pool_release(pool))
 		return;
 
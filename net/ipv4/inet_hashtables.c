@@ -646,8 +646,12 @@ void inet_unhash(struct sock *sk)
 	if (sk_unhashed(sk))
 		goto unlock;
 
-	if (rcu_access_pointer(sk->sk_reuseport_cb))
-		reuseport_detach_sock(sk);
+	if (rcu_access_pointer(sk->sk_reuseport_cb)) {
+		if (ilb)
+			reuseport_stop_listen_sock(sk);
+		else
+			reuseport_detach_sock(sk);
+	}
 	if (ilb) {
 		inet_unhash2(hashinfo, sk);
 		ilb->count--;
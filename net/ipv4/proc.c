@@ -293,6 +293,11 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TcpTimeoutRehash", LINUX_MIB_TCPTIMEOUTREHASH),
 	SNMP_MIB_ITEM("TcpDuplicateDataRehash", LINUX_MIB_TCPDUPLICATEDATAREHASH),
 	SNMP_MIB_ITEM("TCPDSACKRecvSegs", LINUX_MIB_TCPDSACKRECVSEGS),
+	SNMP_MIB_ITEM("TCPMigrateReqSuccess", LINUX_MIB_TCPMIGRATEREQSUCCESS),
+	SNMP_MIB_ITEM("TCPMigrateReqFailure", LINUX_MIB_TCPMIGRATEREQFAILURE),
+	SNMP_MIB_ITEM("TCPTSQBatches", LINUX_MIB_TCPTSQBATCHES),
+	SNMP_MIB_ITEM("TCPTSQBatchPkts", LINUX_MIB_TCPTSQBATCHPKTS),
+	SNMP_MIB_ITEM("TCPAckTSQCoalesced", LINUX_MIB_TCPACKTSQCOALESCED),
 	SNMP_MIB_SENTINEL
 };
 
@@ -1196,17 +1196,23 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 
 	flags = msg->msg_flags;
 
-	if (flags & MSG_ZEROCOPY && size && sock_flag(sk, SOCK_ZEROCOPY)) {
-		skb = tcp_write_queue_tail(sk);
-		uarg = sock_zerocopy_realloc(sk, size, skb_zcopy(skb));
-		if (!uarg) {
-			err = -ENOBUFS;
-			goto out_err;
-		}
+	if ((flags & MSG_ZEROCOPY) && size) {
+		if (msg->msg_ubuf) {
+			/* the caller holds a reference for the whole call */
+			uarg = msg->msg_ubuf;
+			zc = sk->sk_route_caps & NETIF_F_SG;
+		} else if (sock_flag(sk, SOCK_ZEROCOPY)) {
+			skb = tcp_write_queue_tail(sk);
+			uarg = sock_zerocopy_realloc(sk, size, skb_zcopy(skb));
+			if (!uarg) {
+				err = -ENOBUFS;
+				goto out_err;
+			}
 
-		zc = sk->sk_route_caps & NETIF_F_SG;
-		if (!zc)
-			uarg->zerocopy = 0;
+			zc = sk->sk_route_caps & NETIF_F_SG;
+			if (!zc)
+				uarg->zerocopy = 0;
+		}
 	}
 
 	if (unlikely(flags & MSG_FASTOPEN || inet_sk(sk)->defer_connect) &&
@@ -1411,7 +1417,8 @@ out:
 		tcp_push(sk, flags, mss_now, tp->nonagle, size_goal);
 	}
 out_nopush:
-	sock_zerocopy_put(uarg);
+	if (!msg->msg_ubuf)
+		sock_zerocopy_put(uarg);
 	return copied + copied_syn;
 
 do_error:
@@ -1422,7 +1429,8 @@ do_fault:
 	if (copied + copied_syn)
 		goto out;
 out_err:
-	sock_zerocopy_put_abort(uarg, true);
+	if (!msg->msg_ubuf)
+		sock_zerocopy_put_abort(uarg, true);
 	err = sk_stream_error(sk, flags, err);
 	/* make sure we wake any epoll edge trigger waiter */
 	if (unlikely(tcp_rtx_and_write_queues_empty(sk) && err == -EAGAIN)) {
@@ -1746,16 +1754,33 @@ static int tcp_zerocopy_vm_insert_batch(struct vm_area_struct *vma,
 					struct page **pages,
 					unsigned long pages_to_map,
 					unsigned long *insert_addr,
+					unsigned long zap_end,
+					bool *zapped,
 					u32 *length_with_pending,
 					u32 *seq,
 					struct tcp_zerocopy_receive *zc)
 {
 	unsigned long pages_remaining = pages_to_map;
+	unsigned long pages_mapped;
 	int bytes_mapped;
 	int ret;
 
 	ret = vm_insert_pages(vma, *insert_addr, pages, &pages_remaining);
-	bytes_mapped = PAGE_SIZE * (pages_to_map - pages_remaining);
+	pages_mapped = pages_to_map - pages_remaining;
+	if (ret == -EBUSY && !*zapped) {
+		/* Pages from an earlier call are still mapped here. Rather
+		 * than zapping the whole range on every call, zap what is
+		 * left of it once, the first time an insert runs into them.
+		 */
+		unsigned long addr = *insert_addr + PAGE_SIZE * pages_mapped;
+
+		zap_page_range(vma, addr, zap_end - addr);
+		*zapped = true;
+		ret = vm_insert_pages(vma, addr, pages + pages_mapped,
+				      &pages_remaining);
+		pages_mapped = pages_to_map - pages_remaining;
+	}
+	bytes_mapped = PAGE_SIZE * pages_mapped;
 	/* Even if vm_insert_pages fails, it may have partially succeeded in
 	 * mapping (some but not all of the pages).
 	 */
@@ -1772,11 +1797,62 @@ static int tcp_zerocopy_vm_insert_batch(struct vm_area_struct *vma,
 	return ret;
 }
 
+/* Bytes from @offset to the next page of @skb that can be mapped, or to the
+ * end of @skb if there is none.
+ */
+static u32 tcp_zerocopy_skip_len(const struct sk_buff *skb, u32 offset)
+{
+	const struct skb_shared_info *shinfo = skb_shinfo(skb);
+	u32 pos = skb_headlen(skb);
+	int i;
+
+	if (skb_has_frag_list(skb))
+		return skb->len - offset;
+
+	for (i = 0; i < shinfo->nr_frags; i++) {
+		const skb_frag_t *frag = &shinfo->frags[i];
+
+		if (pos >= offset && skb_frag_size(frag) == PAGE_SIZE &&
+		    !skb_frag_off(frag))
+			return pos - offset;
+		pos += skb_frag_size(frag);
+	}
+	return skb->len - offset;
+}
+
+/* Copy up to @len bytes from @seq on into the user buffer at @address */
+static int tcp_zerocopy_copy(struct sock *sk, u64 address, u32 len, u32 *seq)
+{
+	struct sk_buff *skb;
+	struct iov_iter to;
+	struct iovec iov;
+	u32 offset, n;
+	int copied = 0;
+	int err;
+
+	err = import_single_range(READ, u64_to_user_ptr(address), len, &iov,
+				  &to);
+	if (err)
+		return err;
+
+	while (iov_iter_count(&to)) {
+		skb = tcp_recv_skb(sk, *seq, &offset);
+		if (!skb || offset >= skb->len)
+			break;
+		n = min_t(u32, skb->len - offset, iov_iter_count(&to));
+		if (skb_copy_datagram_iter(skb, offset, &to, n))
+			return copied ? : -EFAULT;
+		*seq += n;
+		copied += n;
+	}
+	return copied;
+}
+
 static int tcp_zerocopy_receive(struct sock *sk,
 				struct tcp_zerocopy_receive *zc)
 {
 	unsigned long address = (unsigned long)zc->address;
-	u32 length = 0, seq, offset, zap_len;
+	u32 length = 0, copylen = 0, seq, offset;
 	#define PAGE_BATCH_SIZE 8
 	struct page *pages[PAGE_BATCH_SIZE];
 	const skb_frag_t *frags = NULL;
@@ -1784,6 +1860,8 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	struct sk_buff *skb = NULL;
 	unsigned long pg_idx = 0;
 	unsigned long curr_addr;
+	unsigned long zap_end;
+	bool zapped = false;
 	struct tcp_sock *tp;
 	int inq;
 	int ret;
@@ -1791,6 +1869,9 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	if (address & (PAGE_SIZE - 1) || address != zc->address)
 		return -EINVAL;
 
+	if (zc->copybuf_len < 0 || zc->flags)
+		return -EINVAL;
+
 	if (sk->sk_state == TCP_LISTEN)
 		return -ENOTCONN;
 
@@ -1798,6 +1879,17 @@ static int tcp_zerocopy_receive(struct sock *sk,
 
 	tp = tcp_sk(sk);
 
+	seq = tp->copied_seq;
+	inq = tcp_inq(sk);
+	ret = 0;
+
+	/* Not a page worth of data: don't bother with the mmap_lock */
+	if (inq < PAGE_SIZE) {
+		zc->length = 0;
+		zc->recv_skip_hint = inq;
+		goto copy;
+	}
+
 	mmap_read_lock(current->mm);
 
 	vma = find_vma(current->mm, address);
@@ -1806,18 +1898,10 @@ static int tcp_zerocopy_receive(struct sock *sk,
 		return -EINVAL;
 	}
 	zc->length = min_t(unsigned long, zc->length, vma->vm_end - address);
-
-	seq = tp->copied_seq;
-	inq = tcp_inq(sk);
 	zc->length = min_t(u32, zc->length, inq);
-	zap_len = zc->length & ~(PAGE_SIZE - 1);
-	if (zap_len) {
-		zap_page_range(vma, address, zap_len);
-		zc->recv_skip_hint = 0;
-	} else {
-		zc->recv_skip_hint = zc->length;
-	}
-	ret = 0;
+	zc->recv_skip_hint = zc->length < PAGE_SIZE ? zc->length : 0;
+	zap_end = address + (zc->length & ~(PAGE_SIZE - 1));
+
 	curr_addr = address;
 	while (length + PAGE_SIZE <= zc->length) {
 		if (zc->recv_skip_hint < PAGE_SIZE) {
@@ -1826,6 +1910,8 @@ static int tcp_zerocopy_receive(struct sock *sk,
 				ret = tcp_zerocopy_vm_insert_batch(vma, pages,
 								   pg_idx,
 								   &curr_addr,
+								   zap_end,
+								   &zapped,
 								   &length,
 								   &seq, zc);
 				if (ret)
@@ -1841,26 +1927,28 @@ static int tcp_zerocopy_receive(struct sock *sk,
 				skb = tcp_recv_skb(sk, seq, &offset);
 			}
 			zc->recv_skip_hint = skb->len - offset;
-			offset -= skb_headlen(skb);
-			if ((int)offset < 0 || skb_has_frag_list(skb))
+			if (offset < skb_headlen(skb) ||
+			    skb_has_frag_list(skb)) {
+				zc->recv_skip_hint = tcp_zerocopy_skip_len(skb,
+									   offset);
 				break;
+			}
+			offset -= skb_headlen(skb);
 			frags = skb_shinfo(skb)->frags;
 			while (offset) {
-				if (skb_frag_size(frags) > offset)
+				if (skb_frag_size(frags) > offset) {
+					zc->recv_skip_hint =
+						tcp_zerocopy_skip_len(skb,
+							skb->len - zc->recv_skip_hint);
 					goto out;
+				}
 				offset -= skb_frag_size(frags);
 				frags++;
 			}
 		}
 		if (skb_frag_size(frags) != PAGE_SIZE || skb_frag_off(frags)) {
-			int remaining = zc->recv_skip_hint;
-
-			while (remaining && (skb_frag_size(frags) != PAGE_SIZE ||
-					     skb_frag_off(frags))) {
-				remaining -= skb_frag_size(frags);
-				frags++;
-			}
-			zc->recv_skip_hint -= remaining;
+			zc->recv_skip_hint = tcp_zerocopy_skip_len(skb,
+					skb->len - zc->recv_skip_hint);
 			break;
 		}
 		pages[pg_idx] = skb_frag_page(frags);
@@ -1870,7 +1958,8 @@ static int tcp_zerocopy_receive(struct sock *sk,
 		frags++;
 		if (pg_idx == PAGE_BATCH_SIZE) {
 			ret = tcp_zerocopy_vm_insert_batch(vma, pages, pg_idx,
-							   &curr_addr, &length,
+							   &curr_addr, zap_end,
+							   &zapped, &length,
 							   &seq, zc);
 			if (ret)
 				goto out;
@@ -1879,20 +1968,45 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	}
 	if (pg_idx) {
 		ret = tcp_zerocopy_vm_insert_batch(vma, pages, pg_idx,
-						   &curr_addr, &length, &seq,
-						   zc);
+						   &curr_addr, zap_end,
+						   &zapped, &length, &seq, zc);
 	}
 out:
 	mmap_read_unlock(current->mm);
-	if (length) {
+copy:
+	/* What couldn't be mapped goes to the copy buffer: the tail of the
+	 * data, or the bytes up to the next page that can be mapped, so that
+	 * the next call starts mapping on a page boundary.
+	 */
+	if (!ret && zc->recv_skip_hint && zc->copybuf_len) {
+		int copied;
+
+		if (length)
+			WRITE_ONCE(tp->copied_seq, seq);
+		copied = tcp_zerocopy_copy(sk, zc->copybuf_address,
+					   min_t(u32, zc->recv_skip_hint,
+						 zc->copybuf_len),
+					   &seq);
+		if (copied > 0) {
+			copylen = copied;
+			zc->recv_skip_hint -= copylen;
+		}
+		zc->copybuf_len = copied;
+	} else {
+		zc->copybuf_len = 0;
+	}
+
+	if (length + copylen) {
 		WRITE_ONCE(tp->copied_seq, seq);
 		tcp_rcv_space_adjust(sk);
 
 		/* Clean up data we have read: This will do ACK frames. */
 		tcp_recv_skb(sk, seq, &offset);
-		tcp_cleanup_rbuf(sk, length);
+		tcp_cleanup_rbuf(sk, length + copylen);
+		tp->zc_rcv_mapped += length;
+		tp->zc_rcv_copied += copylen;
 		ret = 0;
-		if (length == zc->length)
+		if (length == zc->length && !copylen)
 			zc->recv_skip_hint = 0;
 	} else {
 		if (!zc->recv_skip_hint && sock_flag(sk, SOCK_DONE))
@@ -2715,6 +2829,8 @@ int tcp_disconnect(struct sock *sk, int flags)
 	tp->bytes_acked = 0;
 	tp->bytes_received = 0;
 	tp->bytes_retrans = 0;
+	tp->zc_rcv_mapped = 0;
+	tp->zc_rcv_copied = 0;
 	tp->data_segs_in = 0;
 	tp->data_segs_out = 0;
 	tp->duplicate_sack[0].start_seq = 0;
@@ -3469,6 +3585,8 @@ void tcp_get_info(struct sock *sk, struct tcp_info *info)
 	info->tcpi_reord_seen = tp->reord_seen;
 	info->tcpi_rcv_ooopack = tp->rcv_ooopack;
 	info->tcpi_snd_wnd = tp->snd_wnd;
+	info->tcpi_rcv_zc_mapped = tp->zc_rcv_mapped;
+	info->tcpi_rcv_zc_copied = tp->zc_rcv_copied;
 	info->tcpi_fastopen_client_fail = tp->fastopen_client_fail;
 	unlock_sock_fast(sk, slow);
 }
@@ -3817,7 +3935,7 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 	}
 #ifdef CONFIG_MMU
 	case TCP_ZEROCOPY_RECEIVE: {
-		struct tcp_zerocopy_receive zc;
+		struct tcp_zerocopy_receive zc = {};
 		int err;
 
 		if (get_user(len, optlen))
@@ -3837,6 +3955,8 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 		if (len == sizeof(zc))
 			goto zerocopy_rcv_sk_err;
 		switch (len) {
+		case offsetofend(struct tcp_zerocopy_receive, copybuf_len):
+		case offsetofend(struct tcp_zerocopy_receive, copybuf_address):
 		case offsetofend(struct tcp_zerocopy_receive, err):
 			goto zerocopy_rcv_sk_err;
 		case offsetofend(struct tcp_zerocopy_receive, inq):
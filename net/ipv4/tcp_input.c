@@ -5301,6 +5301,33 @@ static inline void tcp_data_snd_check(struct sock *sk)
 /*
  * Check if sending an ack is needed.
  */
+/* Data held back by TSQ leaves as soon as the device completes earlier skbs
+ * of the flow, and carries the ACK.  Wait for it, bounded by the ack
+ * compression timer, rather than building a pure ACK for every other frame.
+ */
+static bool tcp_ack_coalesce_tsq(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *skb = tcp_send_head(sk);
+
+	if (!skb || !READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_tsq_ack_coalesce))
+		return false;
+
+	if (tcp_in_quickack_mode(sk) ||
+	    inet_csk(sk)->icsk_ack.pending & ICSK_ACK_NOW ||
+	    !RB_EMPTY_ROOT(&tp->out_of_order_queue) ||
+	    tp->compressed_ack >= sock_net(sk)->ipv4.sysctl_tcp_comp_sack_nr)
+		return false;
+
+	/* Neither cwnd nor the receive window may hold the data back */
+	if (tcp_packets_in_flight(tp) >= tp->snd_cwnd ||
+	    !before(TCP_SKB_CB(skb)->seq, tcp_wnd_end(tp)))
+		return false;
+
+	return test_bit(TSQ_THROTTLED, &sk->sk_tsq_flags) &&
+	       refcount_read(&sk->sk_wmem_alloc) > SKB_TRUESIZE(1);
+}
+
 static void __tcp_ack_snd_check(struct sock *sk, int ofo_possible)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
@@ -5319,6 +5346,10 @@ static void __tcp_ack_snd_check(struct sock *sk, int ofo_possible)
 	    tcp_in_quickack_mode(sk) ||
 	    /* Protocol state mandates a one-time immediate ACK */
 	    inet_csk(sk)->icsk_ack.pending & ICSK_ACK_NOW) {
+		if (tcp_ack_coalesce_tsq(sk)) {
+			NET_INC_STATS(sock_net(sk), LINUX_MIB_TCPACKTSQCOALESCED);
+			goto compress;
+		}
 send_now:
 		tcp_send_ack(sk);
 		return;
@@ -5341,6 +5372,7 @@ send_now:
 		tp->dup_ack_counter++;
 		goto send_now;
 	}
+compress:
 	tp->compressed_ack++;
 	if (hrtimer_is_queued(&tp->compressed_ack_timer))
 		return;
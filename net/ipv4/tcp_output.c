@@ -886,11 +886,14 @@ static void tcp_tsq_handler(struct sock *sk)
 static void tcp_tasklet_func(unsigned long data)
 {
 	struct tsq_tasklet *tsq = (struct tsq_tasklet *)data;
+	struct net *batch_net = NULL;
 	LIST_HEAD(list);
 	unsigned long flags;
 	struct list_head *q, *n;
 	struct tcp_sock *tp;
 	struct sock *sk;
+	u32 segs_out;
+	bool batch;
 
 	local_irq_save(flags);
 	list_splice_init(&tsq->head, &list);
@@ -904,9 +907,26 @@ static void tcp_tasklet_func(unsigned long data)
 		smp_mb__before_atomic();
 		clear_bit(TSQ_QUEUED, &sk->sk_tsq_flags);
 
+		/* Leave the packets in the qdiscs, net_tx_action() hands the
+		 * ones of all the sockets in the list to the device at once.
+		 */
+		batch = READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_tsq_xmit_batch);
+		dev_xmit_batch_set(batch);
+		segs_out = tp->segs_out;
+
 		tcp_tsq_handler(sk);
+
+		if (batch && tp->segs_out != segs_out) {
+			if (batch_net != sock_net(sk)) {
+				batch_net = sock_net(sk);
+				__NET_INC_STATS(batch_net, LINUX_MIB_TCPTSQBATCHES);
+			}
+			__NET_ADD_STATS(sock_net(sk), LINUX_MIB_TCPTSQBATCHPKTS,
+					tp->segs_out - segs_out);
+		}
 		sk_free(sk);
 	}
+	dev_xmit_batch_set(false);
 }
 
 #define TCP_DEFERRED_ALL (TCPF_TSQ_DEFERRED |		\
@@ -453,9 +453,13 @@ struct sk_buff *udp_gro_receive(struct list_head *head, struct sk_buff *skb,
 	unsigned int off = skb_gro_offset(skb);
 	int flush = 1;
 
+	/* Fraglist GRO is meant for forwarding: datagrams for a local
+	 * socket would only be split up again on delivery, and the ones for
+	 * a tunnel socket belong to the tunnel GRO below.
+	 */
 	NAPI_GRO_CB(skb)->is_flist = 0;
 	if (skb->dev->features & NETIF_F_GRO_FRAGLIST)
-		NAPI_GRO_CB(skb)->is_flist = sk ? !udp_sk(sk)->gro_enabled: 1;
+		NAPI_GRO_CB(skb)->is_flist = !sk;
 
 	if ((sk && udp_sk(sk)->gro_enabled) || NAPI_GRO_CB(skb)->is_flist) {
 		pp = call_gro_receive(udp_gro_receive_segment, head, skb);
@@ -523,7 +527,8 @@ struct sk_buff *udp4_gro_receive(struct list_head *head, struct sk_buff *skb)
 skip:
 	NAPI_GRO_CB(skb)->is_ipv6 = 0;
 	rcu_read_lock();
-	sk = static_branch_unlikely(&udp_encap_needed_key) ? udp4_lib_lookup_skb(skb, uh->source, uh->dest) : NULL;
+	sk = udp_gro_lookup_needed(skb, static_branch_unlikely(&udp_encap_needed_key)) ?
+	     udp4_lib_lookup_skb(skb, uh->source, uh->dest) : NULL;
 	pp = udp_gro_receive(head, skb, uh, sk);
 	rcu_read_unlock();
 	return pp;
@@ -543,6 +548,7 @@ static int udp_gro_complete_segment(struct sk_buff *skb)
 
 	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
 	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_L4;
+	udp_gro_account(skb);
 	return 0;
 }
 
@@ -600,6 +606,7 @@ INDIRECT_CALLABLE_SCOPE int udp4_gro_complete(struct sk_buff *skb, int nhoff)
 			skb->csum_level = 0;
 		}
 
+		udp_gro_account(skb);
 		return 0;
 	}
 
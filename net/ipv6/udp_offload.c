@@ -135,7 +135,8 @@ struct sk_buff *udp6_gro_receive(struct list_head *head, struct sk_buff *skb)
 skip:
 	NAPI_GRO_CB(skb)->is_ipv6 = 1;
 	rcu_read_lock();
-	sk = static_branch_unlikely(&udpv6_encap_needed_key) ? udp6_lib_lookup_skb(skb, uh->source, uh->dest) : NULL;
+	sk = udp_gro_lookup_needed(skb, static_branch_unlikely(&udpv6_encap_needed_key)) ?
+	     udp6_lib_lookup_skb(skb, uh->source, uh->dest) : NULL;
 	pp = udp_gro_receive(head, skb, uh, sk);
 	rcu_read_unlock();
 	return pp;
@@ -164,6 +165,7 @@ INDIRECT_CALLABLE_SCOPE int udp6_gro_complete(struct sk_buff *skb, int nhoff)
 			skb->csum_level = 0;
 		}
 
+		udp_gro_account(skb);
 		return 0;
 	}
 
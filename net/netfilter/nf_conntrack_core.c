@@ -765,14 +765,80 @@ begin:
 	return NULL;
 }
 
+/*
+ * The per-cpu lookup cache holds a reference on each entry it points to, so
+ * a cached entry cannot be freed or recycled.  Slots are only accessed with
+ * xchg(), a lookup that migrated to another cpu just uses that cpu's slot.
+ */
+static struct nf_conntrack_tuple_hash **
+nf_ct_lookup_cache_slot(struct net *net, u32 hash)
+{
+	struct ct_pcpu *pcpu = raw_cpu_ptr(net->ct.pcpu_lists);
+
+	return &pcpu->lookup_cache[hash % NF_CT_LOOKUP_CACHE_SIZE];
+}
+
+static void nf_ct_lookup_cache_store(struct nf_conntrack_tuple_hash **slot,
+				     struct nf_conntrack_tuple_hash *h)
+{
+	h = xchg(slot, h);
+	if (h)
+		nf_ct_put(nf_ct_tuplehash_to_ctrack(h));
+}
+
+static struct nf_conntrack_tuple_hash *
+nf_ct_lookup_cache_find_get(struct net *net,
+			    const struct nf_conntrack_zone *zone,
+			    const struct nf_conntrack_tuple *tuple,
+			    struct nf_conntrack_tuple_hash **slot)
+{
+	struct nf_conntrack_tuple_hash *h;
+	struct nf_conn *ct;
+
+	h = xchg(slot, NULL);
+	if (!h)
+		return NULL;
+
+	ct = nf_ct_tuplehash_to_ctrack(h);
+	if (likely(nf_ct_key_equal(h, tuple, zone, net) &&
+		   !nf_ct_is_dying(ct) && !nf_ct_is_expired(ct))) {
+		nf_conntrack_get(&ct->ct_general);
+		nf_ct_lookup_cache_store(slot, h);
+		NF_CT_STAT_INC_ATOMIC(net, cache_hit);
+		return h;
+	}
+
+	/* Other connection in the slot, or the cached one is going away */
+	nf_ct_put(ct);
+	return NULL;
+}
+
+/* Drop the references held by the lookup caches of @net */
+static void nf_ct_lookup_cache_flush(struct net *net)
+{
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		for (i = 0; i < NF_CT_LOOKUP_CACHE_SIZE; i++)
+			nf_ct_lookup_cache_store(&pcpu->lookup_cache[i], NULL);
+	}
+}
+
 /* Find a connection corresponding to a tuple. */
 static struct nf_conntrack_tuple_hash *
 __nf_conntrack_find_get(struct net *net, const struct nf_conntrack_zone *zone,
 			const struct nf_conntrack_tuple *tuple, u32 hash)
 {
-	struct nf_conntrack_tuple_hash *h;
+	struct nf_conntrack_tuple_hash *h, **slot;
 	struct nf_conn *ct;
 
+	slot = nf_ct_lookup_cache_slot(net, hash);
+	h = nf_ct_lookup_cache_find_get(net, zone, tuple, slot);
+	if (h)
+		return h;
+
 	rcu_read_lock();
 
 	h = ____nf_conntrack_find(net, zone, tuple, hash);
@@ -782,8 +848,12 @@ __nf_conntrack_find_get(struct net *net, const struct nf_conntrack_zone *zone,
 		 */
 		ct = nf_ct_tuplehash_to_ctrack(h);
 		if (likely(atomic_inc_not_zero(&ct->ct_general.use))) {
-			if (likely(nf_ct_key_equal(h, tuple, zone, net)))
+			if (likely(nf_ct_key_equal(h, tuple, zone, net))) {
+				/* Second reference, owned by the cache */
+				nf_conntrack_get(&ct->ct_general);
+				nf_ct_lookup_cache_store(slot, h);
 				goto found;
+			}
 
 			/* TYPESAFE_BY_RCU recycled the candidate */
 			nf_ct_put(ct);
@@ -1055,17 +1125,20 @@ nf_ct_resolve_clash(struct sk_buff *skb, struct nf_conntrack_tuple_hash *h,
 
 	ret = __nf_ct_resolve_clash(skb, h);
 	if (ret == NF_ACCEPT)
-		return ret;
+		goto resolved;
 
 	ret = nf_ct_resolve_clash_harder(skb, reply_hash);
 	if (ret == NF_ACCEPT)
-		return ret;
+		goto resolved;
 
 drop:
 	nf_ct_add_to_dying_list(loser_ct);
 	NF_CT_STAT_INC(net, drop);
 	NF_CT_STAT_INC(net, insert_failed);
 	return NF_DROP;
+resolved:
+	NF_CT_STAT_INC(net, clash_resolve);
+	return NF_ACCEPT;
 }
 
 /* Confirm a connection given skb; places it in hash table */
@@ -2332,6 +2405,7 @@ void nf_ct_iterate_cleanup_net(struct net *net,
 	d.net = net;
 
 	nf_ct_iterate_cleanup(iter_net_only, &d, portid, report);
+	nf_ct_lookup_cache_flush(net);
 }
 EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup_net);
 
@@ -2374,6 +2448,11 @@ nf_ct_iterate_destroy(int (*iter)(struct nf_conn *i, void *data), void *data)
 	synchronize_net();
 
 	nf_ct_iterate_cleanup(iter, data, 0, 0);
+
+	down_read(&net_rwsem);
+	for_each_net(net)
+		nf_ct_lookup_cache_flush(net);
+	up_read(&net_rwsem);
 }
 EXPORT_SYMBOL_GPL(nf_ct_iterate_destroy);
 
@@ -2434,6 +2513,7 @@ i_see_dead_people:
 	busy = 0;
 	list_for_each_entry(net, net_exit_list, exit_list) {
 		nf_ct_iterate_cleanup(kill_all, net, 0, 0);
+		nf_ct_lookup_cache_flush(net);
 		if (atomic_read(&net->ct.count) != 0)
 			busy = 1;
 	}
@@ -510,14 +510,25 @@ int nf_flow_table_init(struct nf_flowtable *flowtable)
 {
 	int err;
 
+	int cpu;
+
 	INIT_DEFERRABLE_WORK(&flowtable->gc_work, nf_flow_offload_work_gc);
 	flow_block_init(&flowtable->flow_block);
 	init_rwsem(&flowtable->flow_block_lock);
 
+	flowtable->stat = alloc_percpu(struct nf_flow_table_stat);
+	if (!flowtable->stat)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(flowtable->stat, cpu)->syncp);
+
 	err = rhashtable_init(&flowtable->rhashtable,
 			      &nf_flow_offload_rhash_params);
-	if (err < 0)
+	if (err < 0) {
+		free_percpu(flowtable->stat);
 		return err;
+	}
 
 	queue_delayed_work(system_power_efficient_wq,
 			   &flowtable->gc_work, HZ);
@@ -578,6 +589,7 @@ void nf_flow_table_free(struct nf_flowtable *flow_table)
 		nf_flow_table_iterate(flow_table, nf_flow_offload_gc_step,
 				      flow_table);
 	rhashtable_destroy(&flow_table->rhashtable);
+	free_percpu(flow_table->stat);
 }
 EXPORT_SYMBOL_GPL(nf_flow_table_free);
 
@@ -3,15 +3,35 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/netfilter.h>
+#include <linux/if_vlan.h>
 #include <linux/rhashtable.h>
 #include <net/netfilter/nf_flow_table.h>
 #include <net/netfilter/nf_tables.h>
 
+/* Network protocol of the packet, below any inline VLAN headers */
+static __be16 nf_flow_inet_protocol(const struct sk_buff *skb)
+{
+	unsigned int depth = VLAN_MAX_DEPTH, offset = 0;
+	__be16 proto = skb->protocol;
+	struct vlan_hdr _vhdr, *vhdr;
+
+	while (eth_type_vlan(proto)) {
+		vhdr = skb_header_pointer(skb, offset, sizeof(_vhdr), &_vhdr);
+		if (!vhdr || !--depth)
+			return 0;
+
+		proto = vhdr->h_vlan_encapsulated_proto;
+		offset += VLAN_HLEN;
+	}
+
+	return proto;
+}
+
 static unsigned int
 nf_flow_offload_inet_hook(void *priv, struct sk_buff *skb,
 			  const struct nf_hook_state *state)
 {
-	switch (skb->protocol) {
+	switch (nf_flow_inet_protocol(skb)) {
 	case htons(ETH_P_IP):
 		return nf_flow_offload_ip_hook(priv, skb, state);
 	case htons(ETH_P_IPV6):
@@ -7,6 +7,8 @@
 #include <linux/ip.h>
 #include <linux/ipv6.h>
 #include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_vlan.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/ip6_route.h>
@@ -164,17 +166,101 @@ static bool ip_has_options(unsigned int thoff)
 	return thoff != sizeof(struct iphdr);
 }
 
+/*
+ * Flows are keyed by the device the IP layer receives them on, which is a
+ * VLAN or a bridge device above the one the flowtable hooks into for VLAN
+ * and bridged segments.  Find that device the way the receive path would,
+ * looking through the VLAN tags of the packet without removing them.
+ * *offset is set to the length of the inline VLAN headers that precede
+ * the network header.
+ */
+static struct net_device *nf_flow_encap_dev(struct sk_buff *skb,
+					    struct net_device *dev,
+					    __be16 proto, unsigned int *offset)
+{
+	bool hwaccel = skb_vlan_tag_present(skb);
+	__be16 skb_proto = skb->protocol;
+	struct net_device *in = dev;
+	struct net_device *upper;
+	struct vlan_hdr *vhdr = NULL;
+	__be16 vlan_proto;
+	u16 vlan_id = 0;
+
+	*offset = 0;
+	for (;;) {
+		vlan_proto = 0;
+		if (hwaccel) {
+			vlan_proto = skb->vlan_proto;
+			vlan_id = skb_vlan_tag_get_id(skb);
+		} else if (eth_type_vlan(skb_proto)) {
+			if (!pskb_may_pull(skb, *offset + VLAN_HLEN))
+				return NULL;
+			vhdr = (struct vlan_hdr *)(skb->data + *offset);
+			vlan_proto = skb_proto;
+			vlan_id = ntohs(vhdr->h_vlan_TCI) & VLAN_VID_MASK;
+		}
+
+		if (vlan_proto) {
+			upper = __vlan_find_dev_deep_rcu(dev, vlan_proto,
+							 vlan_id);
+			if (upper) {
+				if (hwaccel) {
+					hwaccel = false;
+				} else {
+					skb_proto = vhdr->h_vlan_encapsulated_proto;
+					*offset += VLAN_HLEN;
+				}
+				dev = upper;
+				continue;
+			}
+		}
+
+		if (!netif_is_bridge_port(dev))
+			break;
+
+		dev = netdev_master_upper_dev_get_rcu(dev);
+		if (!dev)
+			return NULL;
+	}
+
+	if (hwaccel || skb_proto != proto)
+		return NULL;
+
+	/* Frames the upper device would not accept as its own */
+	if (dev != in &&
+	    (!skb_mac_header_was_set(skb) ||
+	     !ether_addr_equal(eth_hdr(skb)->h_dest, dev->dev_addr)))
+		return NULL;
+
+	return dev;
+}
+
+/* Strip the VLAN tags looked through by nf_flow_encap_dev() */
+static void nf_flow_encap_pop(struct sk_buff *skb, __be16 proto,
+			      unsigned int offset)
+{
+	if (skb_vlan_tag_present(skb))
+		__vlan_hwaccel_clear_tag(skb);
+
+	if (offset) {
+		skb_pull_rcsum(skb, offset);
+		skb_reset_network_header(skb);
+		skb->protocol = proto;
+	}
+}
+
 static int nf_flow_tuple_ip(struct sk_buff *skb, const struct net_device *dev,
-			    struct flow_offload_tuple *tuple)
+			    struct flow_offload_tuple *tuple,
+			    unsigned int offset)
 {
 	struct flow_ports *ports;
 	unsigned int thoff;
 	struct iphdr *iph;
 
-	if (!pskb_may_pull(skb, sizeof(*iph)))
+	if (!pskb_may_pull(skb, offset + sizeof(*iph)))
 		return -1;
 
-	iph = ip_hdr(skb);
+	iph = (struct iphdr *)(skb_network_header(skb) + offset);
 	thoff = iph->ihl * 4;
 
 	if (ip_is_fragment(iph) ||
@@ -189,11 +275,11 @@ static int nf_flow_tuple_ip(struct sk_buff *skb, const struct net_device *dev,
 		return -1;
 
 	thoff = iph->ihl * 4;
-	if (!pskb_may_pull(skb, thoff + sizeof(*ports)))
+	if (!pskb_may_pull(skb, offset + thoff + sizeof(*ports)))
 		return -1;
 
-	iph = ip_hdr(skb);
-	ports = (struct flow_ports *)(skb_network_header(skb) + thoff);
+	iph = (struct iphdr *)(skb_network_header(skb) + offset);
+	ports = (struct flow_ports *)((void *)iph + thoff);
 
 	tuple->src_v4.s_addr	= iph->saddr;
 	tuple->dst_v4.s_addr	= iph->daddr;
@@ -246,18 +332,21 @@ nf_flow_offload_ip_hook(void *priv, struct sk_buff *skb,
 	enum flow_offload_tuple_dir dir;
 	struct flow_offload *flow;
 	struct net_device *outdev;
+	unsigned int thoff, offset;
+	struct net_device *indev;
 	struct rtable *rt;
-	unsigned int thoff;
 	struct iphdr *iph;
 	__be32 nexthop;
 
-	if (skb->protocol != htons(ETH_P_IP))
+	indev = nf_flow_encap_dev(skb, state->in, htons(ETH_P_IP), &offset);
+	if (!indev)
 		return NF_ACCEPT;
 
-	if (nf_flow_tuple_ip(skb, state->in, &tuple) < 0)
+	if (nf_flow_tuple_ip(skb, indev, &tuple, offset) < 0)
 		return NF_ACCEPT;
 
 	tuplehash = flow_offload_lookup(flow_table, &tuple);
+	nf_flow_table_stat_inc(flow_table, tuplehash != NULL);
 	if (tuplehash == NULL)
 		return NF_ACCEPT;
 
@@ -266,14 +355,16 @@ nf_flow_offload_ip_hook(void *priv, struct sk_buff *skb,
 	rt = (struct rtable *)flow->tuplehash[dir].tuple.dst_cache;
 	outdev = rt->dst.dev;
 
-	if (unlikely(nf_flow_exceeds_mtu(skb, flow->tuplehash[dir].tuple.mtu)))
+	if (unlikely(nf_flow_exceeds_mtu(skb, offset +
+					 flow->tuplehash[dir].tuple.mtu)))
 		return NF_ACCEPT;
 
-	if (skb_try_make_writable(skb, sizeof(*iph)))
+	if (skb_try_make_writable(skb, offset + sizeof(*iph)))
 		return NF_DROP;
 
-	thoff = ip_hdr(skb)->ihl * 4;
-	if (nf_flow_state_check(flow, ip_hdr(skb)->protocol, skb, thoff))
+	iph = (struct iphdr *)(skb_network_header(skb) + offset);
+	thoff = iph->ihl * 4;
+	if (nf_flow_state_check(flow, iph->protocol, skb, offset + thoff))
 		return NF_ACCEPT;
 
 	flow_offload_refresh(flow_table, flow);
@@ -283,6 +374,8 @@ nf_flow_offload_ip_hook(void *priv, struct sk_buff *skb,
 		return NF_ACCEPT;
 	}
 
+	nf_flow_encap_pop(skb, htons(ETH_P_IP), offset);
+
 	if (nf_flow_nat_ip(flow, skb, thoff, dir) < 0)
 		return NF_DROP;
 
@@ -437,16 +530,17 @@ static int nf_flow_nat_ipv6(const struct flow_offload *flow,
 }
 
 static int nf_flow_tuple_ipv6(struct sk_buff *skb, const struct net_device *dev,
-			      struct flow_offload_tuple *tuple)
+			      struct flow_offload_tuple *tuple,
+			      unsigned int offset)
 {
 	struct flow_ports *ports;
 	struct ipv6hdr *ip6h;
 	unsigned int thoff;
 
-	if (!pskb_may_pull(skb, sizeof(*ip6h)))
+	if (!pskb_may_pull(skb, offset + sizeof(*ip6h)))
 		return -1;
 
-	ip6h = ipv6_hdr(skb);
+	ip6h = (struct ipv6hdr *)(skb_network_header(skb) + offset);
 
 	if (ip6h->nexthdr != IPPROTO_TCP &&
 	    ip6h->nexthdr != IPPROTO_UDP)
@@ -456,11 +550,11 @@ static int nf_flow_tuple_ipv6(struct sk_buff *skb, const struct net_device *dev,
 		return -1;
 
 	thoff = sizeof(*ip6h);
-	if (!pskb_may_pull(skb, thoff + sizeof(*ports)))
+	if (!pskb_may_pull(skb, offset + thoff + sizeof(*ports)))
 		return -1;
 
-	ip6h = ipv6_hdr(skb);
-	ports = (struct flow_ports *)(skb_network_header(skb) + thoff);
+	ip6h = (struct ipv6hdr *)(skb_network_header(skb) + offset);
+	ports = (struct flow_ports *)((void *)ip6h + thoff);
 
 	tuple->src_v6		= ip6h->saddr;
 	tuple->dst_v6		= ip6h->daddr;
@@ -484,16 +578,20 @@ nf_flow_offload_ipv6_hook(void *priv, struct sk_buff *skb,
 	const struct in6_addr *nexthop;
 	struct flow_offload *flow;
 	struct net_device *outdev;
+	struct net_device *indev;
 	struct ipv6hdr *ip6h;
+	unsigned int offset;
 	struct rt6_info *rt;
 
-	if (skb->protocol != htons(ETH_P_IPV6))
+	indev = nf_flow_encap_dev(skb, state->in, htons(ETH_P_IPV6), &offset);
+	if (!indev)
 		return NF_ACCEPT;
 
-	if (nf_flow_tuple_ipv6(skb, state->in, &tuple) < 0)
+	if (nf_flow_tuple_ipv6(skb, indev, &tuple, offset) < 0)
 		return NF_ACCEPT;
 
 	tuplehash = flow_offload_lookup(flow_table, &tuple);
+	nf_flow_table_stat_inc(flow_table, tuplehash != NULL);
 	if (tuplehash == NULL)
 		return NF_ACCEPT;
 
@@ -502,11 +600,13 @@ nf_flow_offload_ipv6_hook(void *priv, struct sk_buff *skb,
 	rt = (struct rt6_info *)flow->tuplehash[dir].tuple.dst_cache;
 	outdev = rt->dst.dev;
 
-	if (unlikely(nf_flow_exceeds_mtu(skb, flow->tuplehash[dir].tuple.mtu)))
+	if (unlikely(nf_flow_exceeds_mtu(skb, offset +
+					 flow->tuplehash[dir].tuple.mtu)))
 		return NF_ACCEPT;
 
-	if (nf_flow_state_check(flow, ipv6_hdr(skb)->nexthdr, skb,
-				sizeof(*ip6h)))
+	ip6h = (struct ipv6hdr *)(skb_network_header(skb) + offset);
+	if (nf_flow_state_check(flow, ip6h->nexthdr, skb,
+				offset + sizeof(*ip6h)))
 		return NF_ACCEPT;
 
 	flow_offload_refresh(flow_table, flow);
@@ -516,9 +616,11 @@ nf_flow_offload_ipv6_hook(void *priv, struct sk_buff *skb,
 		return NF_ACCEPT;
 	}
 
-	if (skb_try_make_writable(skb, sizeof(*ip6h)))
+	if (skb_try_make_writable(skb, offset + sizeof(*ip6h)))
 		return NF_DROP;
 
+	nf_flow_encap_pop(skb, htons(ETH_P_IPV6), offset);
+
 	if (nf_flow_nat_ipv6(flow, skb, dir) < 0)
 		return NF_DROP;
 
@@ -6860,6 +6860,7 @@ static int nf_tables_fill_flowtable_info(struct sk_buff *skb, struct net *net,
 	struct nfgenmsg *nfmsg;
 	struct nft_hook *hook;
 	struct nlmsghdr *nlh;
+	u64 hit, miss;
 
 	event = nfnl_msg_type(NFNL_SUBSYS_NFTABLES, event);
 	nlh = nlmsg_put(skb, portid, seq, event, sizeof(struct nfgenmsg), flags);
@@ -6879,6 +6880,15 @@ static int nf_tables_fill_flowtable_info(struct sk_buff *skb, struct net *net,
 	    nla_put_be32(skb, NFTA_FLOWTABLE_FLAGS, htonl(flowtable->data.flags)))
 		goto nla_put_failure;
 
+	if (flowtable->data.stat) {
+		nf_flow_table_stats(&flowtable->data, &hit, &miss);
+		if (nla_put_be64(skb, NFTA_FLOWTABLE_HITS, cpu_to_be64(hit),
+				 NFTA_FLOWTABLE_PAD) ||
+		    nla_put_be64(skb, NFTA_FLOWTABLE_MISSES, cpu_to_be64(miss),
+				 NFTA_FLOWTABLE_PAD))
+			goto nla_put_failure;
+	}
+
 	nest = nla_nest_start_noflag(skb, NFTA_FLOWTABLE_HOOK);
 	if (!nest)
 		goto nla_put_failure;
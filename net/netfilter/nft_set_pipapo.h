@@ -227,6 +227,9 @@ static inline void pipapo_and_field_buckets_8bit(struct nft_pipapo_field *f,
 	}
 }
 
+bool nft_pipapo_lookup(const struct net *net, const struct nft_set *set,
+		       const u32 *key, const struct nft_set_ext **ext);
+
 /**
  * pipapo_estimate_size() - Estimate worst-case for set size
  * @desc:	Set description, element count and field description used here
@@ -26,6 +26,13 @@
 
 #define NFT_PIPAPO_LONGS_PER_M256	(XSAVE_YMM_SIZE / BITS_PER_LONG)
 
+/* Lookups in sets of the AVX2 type can be switched to the generic routine at
+ * runtime, for instance to compare the two on the same set.
+ */
+static bool nft_pipapo_avx2_enable __read_mostly = true;
+module_param_named(pipapo_avx2, nft_pipapo_avx2_enable, bool, 0644);
+MODULE_PARM_DESC(pipapo_avx2, "Use AVX2 routines for pipapo set lookups");
+
 /* Load from memory into YMM register with non-temporal hint ("stream load"),
  * that is, don't fetch lines from memory into the cache. This avoids pushing
  * precious packet data out of the cache hierarchy, and is appropriate when:
@@ -1131,6 +1138,9 @@ bool nft_pipapo_avx2_lookup(const struct net *net, const struct nft_set *set,
 	bool map_index;
 	int i, ret = 0;
 
+	if (unlikely(!READ_ONCE(nft_pipapo_avx2_enable)))
+		return nft_pipapo_lookup(net, set, key, ext);
+
 	m = rcu_dereference(priv->match);
 
 	/* This also protects access to all data related to scratch maps */
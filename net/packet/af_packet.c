@@ -83,6 +83,8 @@
 #include <linux/errqueue.h>
 #include <linux/net_tstamp.h>
 #include <linux/percpu.h>
+#include <linux/interrupt.h>
+#include <linux/sched/topology.h>
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
 #endif
@@ -193,6 +195,7 @@ static void *prb_dispatch_next_block(struct tpacket_kbdq_core *,
 static void prb_retire_current_block(struct tpacket_kbdq_core *,
 		struct packet_sock *, unsigned int status);
 static int prb_queue_frozen(struct tpacket_kbdq_core *);
+static int prb_previous_blk_num(struct packet_ring_buffer *);
 static void prb_open_block(struct tpacket_kbdq_core *,
 		struct tpacket_block_desc *);
 static void prb_retire_rx_blk_timer_expired(struct timer_list *);
@@ -707,6 +710,86 @@ out:
 	spin_unlock(&po->sk.sk_receive_queue.lock);
 }
 
+/*
+ * TP_FT_REQ_RETIRE_NAPI:
+ * Instead of waiting for the timer, the partially filled block of a ring
+ * is retired once the packets of the current receive softirq run have all
+ * been delivered, provided user-space has already released the previous
+ * block.  While user-space is still behind nothing is gained by closing
+ * blocks early, so they are left to fill up as usual.
+ */
+#define PACKET_RETIRE_BATCH	16
+
+struct packet_retire_queue {
+	unsigned int		len;
+	struct sock		*sk[PACKET_RETIRE_BATCH];
+	struct tasklet_struct	tasklet;
+};
+
+static DEFINE_PER_CPU(struct packet_retire_queue, packet_retire_queue);
+
+static void prb_retire_rx_blk_napi(struct packet_sock *po)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+	struct tpacket_block_desc *pbd, *prev;
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+
+	/* The ring may have been torn down since the socket was queued */
+	if (!po->rx_ring.pg_vec || po->tp_version != TPACKET_V3 ||
+	    pkc->delete_blk_timer || prb_queue_frozen(pkc))
+		goto out;
+
+	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+	if (!BLOCK_NUM_PKTS(pbd))
+		goto out;
+
+	prev = GET_PBLOCK_DESC(pkc, prb_previous_blk_num(&po->rx_ring));
+	if (prev != pbd && prb_curr_blk_in_use(prev))
+		goto out;
+
+	/* Waiting for skb_copy_bits to finish... */
+	write_lock(&pkc->blk_fill_in_prog_lock);
+	write_unlock(&pkc->blk_fill_in_prog_lock);
+
+	prb_retire_current_block(pkc, po, TP_STATUS_BLK_TMO);
+	prb_dispatch_next_block(pkc, po);
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+static void packet_retire_queue_run(unsigned long data)
+{
+	struct packet_retire_queue *q = this_cpu_ptr(&packet_retire_queue);
+	unsigned int i, len = q->len;
+
+	q->len = 0;
+	for (i = 0; i < len; i++) {
+		prb_retire_rx_blk_napi(pkt_sk(q->sk[i]));
+		sock_put(q->sk[i]);
+	}
+}
+
+/* Called with BHs disabled after a packet has been stored in a block */
+static void packet_retire_queue_add(struct sock *sk)
+{
+	struct packet_retire_queue *q = this_cpu_ptr(&packet_retire_queue);
+	unsigned int i;
+
+	for (i = 0; i < q->len; i++) {
+		if (q->sk[i] == sk)
+			return;
+	}
+	/* Too many rings busy on this CPU, leave it to the timer */
+	if (q->len == PACKET_RETIRE_BATCH)
+		return;
+
+	sock_hold(sk);
+	q->sk[q->len++] = sk;
+	if (q->len == 1)
+		tasklet_schedule(&q->tasklet);
+}
+
 static void prb_flush_block(struct tpacket_kbdq_core *pkc1,
 		struct tpacket_block_desc *pbd1, __u32 status)
 {
@@ -1340,6 +1423,31 @@ static unsigned int fanout_demux_cpu(struct packet_fanout *f,
 	return smp_processor_id() % num;
 }
 
+/* Hash within the members that joined from a CPU sharing our LLC */
+static unsigned int fanout_demux_llc(struct packet_fanout *f,
+				     struct sk_buff *skb,
+				     unsigned int num)
+{
+	u32 hash = __skb_get_hash_symmetric(skb);
+	int cpu = smp_processor_id();
+	unsigned int i, n = 0;
+
+	for (i = 0; i < num; i++) {
+		if (cpus_share_cache(cpu, pkt_sk(f->arr[i])->fanout_cpu))
+			n++;
+	}
+	if (!n)
+		return reciprocal_scale(hash, num);
+
+	n = reciprocal_scale(hash, n);
+	for (i = 0; i < num; i++) {
+		if (cpus_share_cache(cpu, pkt_sk(f->arr[i])->fanout_cpu) &&
+		    !n--)
+			return i;
+	}
+	return 0;
+}
+
 static unsigned int fanout_demux_rnd(struct packet_fanout *f,
 				     struct sk_buff *skb,
 				     unsigned int num)
@@ -1444,6 +1552,9 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	case PACKET_FANOUT_CPU:
 		idx = fanout_demux_cpu(f, skb, num);
 		break;
+	case PACKET_FANOUT_LLC:
+		idx = fanout_demux_llc(f, skb, num);
+		break;
 	case PACKET_FANOUT_RND:
 		idx = fanout_demux_rnd(f, skb, num);
 		break;
@@ -1653,6 +1764,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	case PACKET_FANOUT_QM:
 	case PACKET_FANOUT_CBPF:
 	case PACKET_FANOUT_EBPF:
+	case PACKET_FANOUT_LLC:
 		break;
 	default:
 		return -EINVAL;
@@ -1732,6 +1844,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 			po->fanout = match;
 			po->rollover = rollover;
 			rollover = NULL;
+			po->fanout_cpu = raw_smp_processor_id();
 			refcount_set(&match->sk_ref, refcount_read(&match->sk_ref) + 1);
 			__fanout_link(sk, po);
 			err = 0;
@@ -2400,6 +2513,9 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		sk->sk_data_ready(sk);
 	} else if (po->tp_version == TPACKET_V3) {
 		prb_clear_blk_fill_status(&po->rx_ring);
+		if (po->rx_ring.prb_bdqc.feature_req_word &
+		    TP_FT_REQ_RETIRE_NAPI)
+			packet_retire_queue_add(sk);
 	}
 
 drop_n_restore:
@@ -4217,43 +4333,45 @@ static void free_pg_vec(struct pgv *pg_vec, unsigned int order,
 	kfree(pg_vec);
 }
 
-static char *alloc_one_pg_vec_page(unsigned long order)
+static char *alloc_one_pg_vec_page(unsigned long order, int node)
 {
 	char *buffer;
+	struct page *page;
 	gfp_t gfp_flags = GFP_KERNEL | __GFP_COMP |
 			  __GFP_ZERO | __GFP_NOWARN | __GFP_NORETRY;
 
-	buffer = (char *) __get_free_pages(gfp_flags, order);
-	if (buffer)
-		return buffer;
+	page = alloc_pages_node(node, gfp_flags, order);
+	if (page)
+		return page_address(page);
 
-	/* __get_free_pages failed, fall back to vmalloc */
-	buffer = vzalloc(array_size((1 << order), PAGE_SIZE));
+	/* alloc_pages_node failed, fall back to vmalloc */
+	buffer = vzalloc_node(array_size((1 << order), PAGE_SIZE), node);
 	if (buffer)
 		return buffer;
 
 	/* vmalloc failed, lets dig into swap here */
 	gfp_flags &= ~__GFP_NORETRY;
-	buffer = (char *) __get_free_pages(gfp_flags, order);
-	if (buffer)
-		return buffer;
+	page = alloc_pages_node(node, gfp_flags, order);
+	if (page)
+		return page_address(page);
 
 	/* complete and utter failure */
 	return NULL;
 }
 
-static struct pgv *alloc_pg_vec(struct tpacket_req *req, int order)
+static struct pgv *alloc_pg_vec(struct tpacket_req *req, int order, int node)
 {
 	unsigned int block_nr = req->tp_block_nr;
 	struct pgv *pg_vec;
 	int i;
 
-	pg_vec = kcalloc(block_nr, sizeof(struct pgv), GFP_KERNEL | __GFP_NOWARN);
+	pg_vec = kcalloc_node(block_nr, sizeof(struct pgv),
+			      GFP_KERNEL | __GFP_NOWARN, node);
 	if (unlikely(!pg_vec))
 		goto out;
 
 	for (i = 0; i < block_nr; i++) {
-		pg_vec[i].buffer = alloc_one_pg_vec_page(order);
+		pg_vec[i].buffer = alloc_one_pg_vec_page(order, node);
 		if (unlikely(!pg_vec[i].buffer))
 			goto out_free_pgvec;
 	}
@@ -4273,7 +4391,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	struct pgv *pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	unsigned long *rx_owner_map = NULL;
-	int was_running, order = 0;
+	int was_running, order = 0, node;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
 	__be16 num;
@@ -4336,9 +4454,14 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 					req->tp_frame_nr))
 			goto out;
 
+		/* Members of a fanout group get their ring on their own node */
+		node = NUMA_NO_NODE;
+		if (READ_ONCE(po->fanout))
+			node = cpu_to_node(po->fanout_cpu);
+
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
-		pg_vec = alloc_pg_vec(req, order);
+		pg_vec = alloc_pg_vec(req, order, node);
 		if (unlikely(!pg_vec))
 			goto out;
 		switch (po->tp_version) {
@@ -4628,15 +4751,23 @@ static struct pernet_operations packet_net_ops = {
 
 static void __exit packet_exit(void)
 {
+	int cpu;
+
 	unregister_netdevice_notifier(&packet_netdev_notifier);
 	unregister_pernet_subsys(&packet_net_ops);
 	sock_unregister(PF_PACKET);
 	proto_unregister(&packet_proto);
+	for_each_possible_cpu(cpu)
+		tasklet_kill(&per_cpu(packet_retire_queue, cpu).tasklet);
 }
 
 static int __init packet_init(void)
 {
-	int rc;
+	int cpu, rc;
+
+	for_each_possible_cpu(cpu)
+		tasklet_init(&per_cpu(packet_retire_queue, cpu).tasklet,
+			     packet_retire_queue_run, 0);
 
 	rc = proto_register(&packet_proto, 0);
 	if (rc)
@@ -25,6 +25,8 @@
  *   - Use a special fifo for high prio packets
  *
  *  dequeue() : serves flows in Round Robin
+ *  Flows waiting for their pacing time are kept in a timer wheel, or in a
+ *  rb tree once they are too far in the future for the wheel.
  *  Note : When a flow becomes empty, we do not immediately remove it from
  *  rb trees, for performance reasons (its expected to send additional packets,
  *  or SLAB cache will reuse socket for another flow)
@@ -80,14 +82,26 @@ struct fq_flow {
 
 /* Second cache line, used in fq_dequeue() */
 	int		credit;
-	/* 32bit hole on 64bit arches */
+	u32		wheel_idx;	/* slot in q->wheel, or FQ_WHEEL_NONE */
 
 	struct fq_flow *next;		/* next pointer in RR lists */
 
-	struct rb_node  rate_node;	/* anchor in q->delayed tree */
+	union {
+		struct rb_node	  rate_node;	/* anchor in q->delayed tree */
+		struct hlist_node wheel_node;	/* anchor in a q->wheel slot */
+	};
 	u64		time_next_packet;
 } ____cacheline_aligned_in_smp;
 
+/*
+ * Throttled flows are released once the timer wheel slot of their
+ * time_next_packet has elapsed, so 8 us late at most.  The wheel covers
+ * the next 16 ms, flows beyond that wait in q->delayed.
+ */
+#define FQ_WHEEL_SHIFT	13
+#define FQ_WHEEL_SLOTS	2048
+#define FQ_WHEEL_NONE	(~0U)
+
 struct fq_flow_head {
 	struct fq_flow *first;
 	struct fq_flow *last;
@@ -98,7 +112,9 @@ struct fq_sched_data {
 
 	struct fq_flow_head old_flows;
 
-	struct rb_root	delayed;	/* for rate limited flows */
+	struct hlist_head *wheel;	/* for rate limited flows */
+	u64		wheel_cursor;	/* first wheel slot not elapsed */
+	struct rb_root	delayed;	/* for flows beyond the wheel */
 	u64		time_next_delayed_flow;
 	u64		ktime_cache;	/* copy of last ktime_get_ns() */
 	unsigned long	unthrottle_latency_ns;
@@ -133,6 +149,8 @@ struct fq_sched_data {
 
 	u32		timer_slack; /* hrtimer slack in ns */
 	struct qdisc_watchdog watchdog;
+
+	DECLARE_BITMAP(wheel_map, FQ_WHEEL_SLOTS); /* non empty wheel slots */
 };
 
 /*
@@ -169,17 +187,44 @@ static void fq_flow_add_tail(struct fq_flow_head *head, struct fq_flow *flow)
 	flow->next = NULL;
 }
 
+static void fq_wheel_del(struct fq_sched_data *q, struct fq_flow *f)
+{
+	struct hlist_head *slot = &q->wheel[f->wheel_idx];
+
+	hlist_del(&f->wheel_node);
+	if (hlist_empty(slot))
+		__clear_bit(f->wheel_idx, q->wheel_map);
+}
+
 static void fq_flow_unset_throttled(struct fq_sched_data *q, struct fq_flow *f)
 {
-	rb_erase(&f->rate_node, &q->delayed);
+	if (f->wheel_idx != FQ_WHEEL_NONE)
+		fq_wheel_del(q, f);
+	else
+		rb_erase(&f->rate_node, &q->delayed);
 	q->throttled_flows--;
 	fq_flow_add_tail(&q->old_flows, f);
 }
 
-static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
+/* Time at which a flow throttled until @time is released */
+static u64 fq_wheel_release_time(u64 time)
+{
+	return ((time >> FQ_WHEEL_SHIFT) + 1) << FQ_WHEEL_SHIFT;
+}
+
+static void fq_delayed_add(struct fq_sched_data *q, struct fq_flow *f)
 {
 	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
+	u64 slot = f->time_next_packet >> FQ_WHEEL_SHIFT;
 
+	if (slot - q->wheel_cursor < FQ_WHEEL_SLOTS) {
+		f->wheel_idx = slot & (FQ_WHEEL_SLOTS - 1);
+		hlist_add_head(&f->wheel_node, &q->wheel[f->wheel_idx]);
+		__set_bit(f->wheel_idx, q->wheel_map);
+		return;
+	}
+
+	f->wheel_idx = FQ_WHEEL_NONE;
 	while (*p) {
 		struct fq_flow *aux;
 
@@ -192,12 +237,19 @@ static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
 	}
 	rb_link_node(&f->rate_node, parent, p);
 	rb_insert_color(&f->rate_node, &q->delayed);
+}
+
+static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
+{
+	u64 release = fq_wheel_release_time(f->time_next_packet);
+
+	fq_delayed_add(q, f);
 	q->throttled_flows++;
 	q->stat_throttled++;
 
 	f->next = &throttled;
-	if (q->time_next_delayed_flow > f->time_next_packet)
-		q->time_next_delayed_flow = f->time_next_packet;
+	if (q->time_next_delayed_flow > release)
+		q->time_next_delayed_flow = release;
 }
 
 
@@ -496,6 +548,65 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 	return NET_XMIT_SUCCESS;
 }
 
+static void fq_wheel_release_slot(struct fq_sched_data *q, unsigned int idx)
+{
+	struct hlist_node *tmp;
+	struct fq_flow *f;
+
+	hlist_for_each_entry_safe(f, tmp, &q->wheel[idx], wheel_node) {
+		hlist_del(&f->wheel_node);
+		q->throttled_flows--;
+		fq_flow_add_tail(&q->old_flows, f);
+	}
+	__clear_bit(idx, q->wheel_map);
+}
+
+/* Release the flows of the wheel slots that elapsed before @now */
+static void fq_wheel_advance(struct fq_sched_data *q, u64 now)
+{
+	u64 target = now >> FQ_WHEEL_SHIFT;
+	unsigned int idx, first, last, n;
+
+	if (target <= q->wheel_cursor)
+		return;
+
+	n = min_t(u64, target - q->wheel_cursor, FQ_WHEEL_SLOTS);
+	first = q->wheel_cursor & (FQ_WHEEL_SLOTS - 1);
+	while (n) {
+		last = min(first + n, FQ_WHEEL_SLOTS);
+		for (idx = find_next_bit(q->wheel_map, last, first); idx < last;
+		     idx = find_next_bit(q->wheel_map, last, idx + 1))
+			fq_wheel_release_slot(q, idx);
+		n -= last - first;
+		first = 0;
+	}
+	q->wheel_cursor = target;
+}
+
+/* Time at which the next throttled flow is released, ~0ULL if none */
+static u64 fq_next_release_time(const struct fq_sched_data *q)
+{
+	unsigned int first = q->wheel_cursor & (FQ_WHEEL_SLOTS - 1);
+	unsigned int idx;
+	struct rb_node *p;
+
+	idx = find_next_bit(q->wheel_map, FQ_WHEEL_SLOTS, first);
+	if (idx < FQ_WHEEL_SLOTS)
+		return (q->wheel_cursor + idx - first + 1) << FQ_WHEEL_SHIFT;
+
+	idx = find_first_bit(q->wheel_map, first);
+	if (idx < first)
+		return (q->wheel_cursor + FQ_WHEEL_SLOTS - first + idx + 1) <<
+		       FQ_WHEEL_SHIFT;
+
+	p = rb_first(&q->delayed);
+	if (p)
+		return fq_wheel_release_time(rb_entry(p, struct fq_flow,
+						      rate_node)->time_next_packet);
+
+	return ~0ULL;
+}
+
 static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 {
 	unsigned long sample;
@@ -511,16 +622,26 @@ static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 	q->unthrottle_latency_ns -= q->unthrottle_latency_ns >> 3;
 	q->unthrottle_latency_ns += sample >> 3;
 
-	q->time_next_delayed_flow = ~0ULL;
+	fq_wheel_advance(q, now);
+
+	/* Move the flows the wheel now covers out of the rb tree */
 	while ((p = rb_first(&q->delayed)) != NULL) {
 		struct fq_flow *f = rb_entry(p, struct fq_flow, rate_node);
 
-		if (f->time_next_packet > now) {
-			q->time_next_delayed_flow = f->time_next_packet;
-			break;
+		if (fq_wheel_release_time(f->time_next_packet) <= now) {
+			rb_erase(p, &q->delayed);
+			q->throttled_flows--;
+			fq_flow_add_tail(&q->old_flows, f);
+			continue;
 		}
-		fq_flow_unset_throttled(q, f);
+		if ((f->time_next_packet >> FQ_WHEEL_SHIFT) - q->wheel_cursor >=
+		    FQ_WHEEL_SLOTS)
+			break;
+		rb_erase(p, &q->delayed);
+		fq_delayed_add(q, f);
 	}
+
+	q->time_next_delayed_flow = fq_next_release_time(q);
 }
 
 static struct sk_buff *fq_dequeue(struct Qdisc *sch)
@@ -659,6 +780,16 @@ static void fq_flow_purge(struct fq_flow *flow)
 	flow->qlen = 0;
 }
 
+static void fq_wheel_reset(struct fq_sched_data *q)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < FQ_WHEEL_SLOTS; idx++)
+		INIT_HLIST_HEAD(&q->wheel[idx]);
+	bitmap_zero(q->wheel_map, FQ_WHEEL_SLOTS);
+	q->wheel_cursor = ktime_get_ns() >> FQ_WHEEL_SHIFT;
+}
+
 static void fq_reset(struct Qdisc *sch)
 {
 	struct fq_sched_data *q = qdisc_priv(sch);
@@ -688,7 +819,9 @@ static void fq_reset(struct Qdisc *sch)
 	}
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
+	fq_wheel_reset(q);
 	q->delayed		= RB_ROOT;
+	q->time_next_delayed_flow = ~0ULL;
 	q->flows		= 0;
 	q->inactive_flows	= 0;
 	q->throttled_flows	= 0;
@@ -920,6 +1053,7 @@ static void fq_destroy(struct Qdisc *sch)
 
 	fq_reset(sch);
 	fq_free(q->fq_root);
+	kvfree(q->wheel);
 	qdisc_watchdog_cancel(&q->watchdog);
 }
 
@@ -941,6 +1075,11 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt,
 	q->old_flows.first	= NULL;
 	q->delayed		= RB_ROOT;
 	q->fq_root		= NULL;
+	q->wheel		= kvmalloc_array(FQ_WHEEL_SLOTS, sizeof(*q->wheel),
+						 GFP_KERNEL);
+	if (!q->wheel)
+		return -ENOMEM;
+	fq_wheel_reset(q);
 	q->fq_trees_log		= ilog2(1024);
 	q->orphan_mask		= 1024 - 1;
 	q->low_rate_threshold	= 550000 / 8;
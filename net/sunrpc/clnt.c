@@ -2941,7 +2941,7 @@ int rpc_clnt_add_xprt(struct rpc_clnt *clnt,
 				connect_timeout,
 				reconnect_timeout);
 
-	rpc_xprt_switch_set_roundrobin(xps);
+	rpc_xprt_switch_set_leastqueued(xps);
 	if (setup) {
 		ret = setup(clnt, xps, xprt, data);
 		if (ret != 0)
@@ -244,9 +244,26 @@ static int do_print_stats(struct rpc_clnt *clnt, struct rpc_xprt *xprt, void *se
 	struct seq_file *seq = seqv;
 
 	xprt->ops->print_stats(xprt, seq);
+	seq_printf(seq, "\txprt queue:\t%ld\n",
+		   atomic_long_read(&xprt->queuelen));
 	return 0;
 }
 
+static void rpc_clnt_show_xprt_switch(struct seq_file *seq,
+				      struct rpc_clnt *clnt)
+{
+	struct rpc_xprt_switch *xps;
+
+	rcu_read_lock();
+	xps = rcu_dereference(clnt->cl_xpi.xpi_xpswitch);
+	if (xps)
+		seq_printf(seq, "\txprt switch:\t%u %u %ld\n",
+			   READ_ONCE(xps->xps_nactive),
+			   READ_ONCE(xps->xps_nwant),
+			   atomic_long_read(&xps->xps_queuelen));
+	rcu_read_unlock();
+}
+
 void rpc_clnt_show_stats(struct seq_file *seq, struct rpc_clnt *clnt)
 {
 	unsigned int op, maxproc = clnt->cl_maxproc;
@@ -259,6 +276,7 @@ void rpc_clnt_show_stats(struct seq_file *seq, struct rpc_clnt *clnt)
 			clnt->cl_prog, clnt->cl_vers, clnt->cl_program->name);
 
 	rpc_clnt_iterate_for_each_xprt(clnt, do_print_stats, seq);
+	rpc_clnt_show_xprt_switch(seq, clnt);
 
 	seq_printf(seq, "\tper-op statistics\n");
 	for (op = 0; op < maxproc; op++) {
@@ -37,7 +37,7 @@ static void svc_unregister(const struct svc_serv *serv, struct net *net);
 
 #define svc_serv_is_pooled(serv)    ((serv)->sv_ops->svo_function)
 
-#define SVC_POOL_DEFAULT	SVC_POOL_GLOBAL
+#define SVC_POOL_DEFAULT	SVC_POOL_AUTO
 
 /*
  * Structure for mapping cpus to pools and vice versa.
@@ -106,12 +106,15 @@ module_param_call(pool_mode, param_set_pool_mode, param_get_pool_mode,
 /*
  * Detect best pool mapping mode heuristically,
  * according to the machine's topology.
+ *
+ * Per-cpu pools are never chosen automatically: with the
+ * usual handful of threads most of them would end up with
+ * no thread at all, and transports enqueued on them would
+ * wait for a thread of another pool to be woken.
  */
 static int
 svc_pool_map_choose_mode(void)
 {
-	unsigned int node;
-
 	if (nr_online_nodes > 1) {
 		/*
 		 * Actually have multiple NUMA nodes,
@@ -120,17 +123,6 @@ svc_pool_map_choose_mode(void)
 		return SVC_POOL_PERNODE;
 	}
 
-	node = first_online_node;
-	if (nr_cpus_node(node) > 2) {
-		/*
-		 * Non-trivial SMP, or CONFIG_NUMA on
-		 * non-NUMA hardware, e.g. with a generic
-		 * x86_64 kernel on Xeons.  In this case we
-		 * want to divide the pools on cpu boundaries.
-		 */
-		return SVC_POOL_PERCPU;
-	}
-
 	/* default: one global pool */
 	return SVC_POOL_GLOBAL;
 }
@@ -295,6 +287,20 @@ static int svc_pool_map_get_node(unsigned int pidx)
 	}
 	return NUMA_NO_NODE;
 }
+
+/*
+ * Return the number of cpus serving the given pool, which is
+ * the weight the pool gets when threads are spread out.
+ */
+static unsigned int svc_pool_map_get_weight(unsigned int pidx)
+{
+	const struct svc_pool_map *m = &svc_pool_map;
+
+	if (m->count && m->mode == SVC_POOL_PERNODE)
+		return max(nr_cpus_node(m->pool_to[pidx]), 1U);
+	return 1;
+}
+
 /*
  * Set the given thread's cpus_allowed mask so that it
  * will only run on cpus in the given pool.
@@ -651,15 +657,37 @@ svc_prepare_thread(struct svc_serv *serv, struct svc_pool *pool, int node)
 EXPORT_SYMBOL_GPL(svc_prepare_thread);
 
 /*
- * Choose a pool in which to create a new thread, for svc_set_num_threads
+ * Choose a pool in which to create a new thread, for svc_set_num_threads.
+ * Without a pool given, pick the one with the fewest threads for the
+ * number of cpus it serves, so that each node gets its share.
  */
 static inline struct svc_pool *
 choose_pool(struct svc_serv *serv, struct svc_pool *pool, unsigned int *state)
 {
+	unsigned int i, best = 0, best_weight = 0, best_nr = 0;
+
 	if (pool != NULL)
 		return pool;
 
-	return &serv->sv_pools[(*state)++ % serv->sv_nrpools];
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		unsigned int pidx = (*state + i) % serv->sv_nrpools;
+		unsigned int weight = svc_pool_map_get_weight(pidx);
+		unsigned int nr;
+
+		spin_lock_bh(&serv->sv_pools[pidx].sp_lock);
+		nr = serv->sv_pools[pidx].sp_nrthreads;
+		spin_unlock_bh(&serv->sv_pools[pidx].sp_lock);
+
+		/* nr / weight < best_nr / best_weight */
+		if (!best_weight || nr * best_weight < best_nr * weight) {
+			best = pidx;
+			best_weight = weight;
+			best_nr = nr;
+		}
+	}
+	*state = best + 1;
+
+	return &serv->sv_pools[best];
 }
 
 /*
@@ -1398,18 +1398,27 @@ static void svc_pool_stats_stop(struct seq_file *m, void *p)
 static int svc_pool_stats_show(struct seq_file *m, void *p)
 {
 	struct svc_pool *pool = p;
+	struct svc_rqst *rqstp;
+	unsigned int busy = 0;
 
 	if (p == SEQ_START_TOKEN) {
-		seq_puts(m, "# pool packets-arrived sockets-enqueued threads-woken threads-timedout\n");
+		seq_puts(m, "# pool packets-arrived sockets-enqueued threads-woken threads-timedout threads threads-busy\n");
 		return 0;
 	}
 
-	seq_printf(m, "%u %lu %lu %lu %lu\n",
+	rcu_read_lock();
+	list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all)
+		if (test_bit(RQ_BUSY, &rqstp->rq_flags))
+			busy++;
+	rcu_read_unlock();
+
+	seq_printf(m, "%u %lu %lu %lu %lu %u %u\n",
 		pool->sp_id,
 		(unsigned long)atomic_long_read(&pool->sp_stats.packets),
 		pool->sp_stats.sockets_queued,
 		(unsigned long)atomic_long_read(&pool->sp_stats.threads_woken),
-		(unsigned long)atomic_long_read(&pool->sp_stats.threads_timedout));
+		(unsigned long)atomic_long_read(&pool->sp_stats.threads_timedout),
+		pool->sp_nrthreads, busy);
 
 	return 0;
 }
@@ -24,6 +24,7 @@ typedef struct rpc_xprt *(*xprt_switch_find_xprt_t)(struct rpc_xprt_switch *xps,
 
 static const struct rpc_xprt_iter_ops rpc_xprt_iter_singular;
 static const struct rpc_xprt_iter_ops rpc_xprt_iter_roundrobin;
+static const struct rpc_xprt_iter_ops rpc_xprt_iter_leastqueued;
 static const struct rpc_xprt_iter_ops rpc_xprt_iter_listall;
 
 static void xprt_switch_add_xprt_locked(struct rpc_xprt_switch *xps,
@@ -104,6 +105,8 @@ struct rpc_xprt_switch *xprt_switch_alloc(struct rpc_xprt *xprt,
 		spin_lock_init(&xps->xps_lock);
 		kref_init(&xps->xps_kref);
 		xps->xps_nxprts = xps->xps_nactive = 0;
+		xps->xps_nwant = 1;
+		xps->xps_scale_time = jiffies;
 		atomic_long_set(&xps->xps_queuelen, 0);
 		xps->xps_net = NULL;
 		INIT_LIST_HEAD(&xps->xps_xprt_list);
@@ -176,6 +179,19 @@ void rpc_xprt_switch_set_roundrobin(struct rpc_xprt_switch *xps)
 		WRITE_ONCE(xps->xps_iter_ops, &rpc_xprt_iter_roundrobin);
 }
 
+/**
+ * rpc_xprt_switch_set_leastqueued - Set a least-queued policy on xps
+ * @xps: pointer to struct rpc_xprt_switch
+ *
+ * Sets a policy sending tasks to the transport with the fewest queued
+ * tasks, and scaling the number of transports in use with the load.
+ */
+void rpc_xprt_switch_set_leastqueued(struct rpc_xprt_switch *xps)
+{
+	if (READ_ONCE(xps->xps_iter_ops) != &rpc_xprt_iter_leastqueued)
+		WRITE_ONCE(xps->xps_iter_ops, &rpc_xprt_iter_leastqueued);
+}
+
 static
 const struct rpc_xprt_iter_ops *xprt_iter_ops(const struct rpc_xprt_iter *xpi)
 {
@@ -358,6 +374,87 @@ struct rpc_xprt *xprt_iter_next_entry_roundrobin(struct rpc_xprt_iter *xpi)
 			xprt_switch_find_next_entry_roundrobin);
 }
 
+/*
+ * The least-queued policy only uses the first xps_nwant active transports.
+ * Every XPRT_SCALE_INTERVAL, xps_nwant doubles if the transports in use
+ * have more than XPRT_SCALE_UP_QUEUELEN tasks queued on average, and drops
+ * by one if the tasks would fit in one transport less at no more than
+ * XPRT_SCALE_DOWN_QUEUELEN each.  Transports out of use go idle and get
+ * disconnected by their idle timer, and reconnect once back in use.
+ */
+#define XPRT_SCALE_INTERVAL		(HZ / 4)
+#define XPRT_SCALE_UP_QUEUELEN		4
+#define XPRT_SCALE_DOWN_QUEUELEN	1
+
+static
+void xprt_switch_scale(struct rpc_xprt_switch *xps)
+{
+	unsigned long next = READ_ONCE(xps->xps_scale_time);
+	unsigned int nactive, nwant;
+	long queuelen;
+
+	if (time_before(jiffies, next) ||
+	    cmpxchg(&xps->xps_scale_time, next,
+		    jiffies + XPRT_SCALE_INTERVAL) != next)
+		return;
+
+	nactive = max(READ_ONCE(xps->xps_nactive), 1U);
+	nwant = clamp(READ_ONCE(xps->xps_nwant), 1U, nactive);
+	queuelen = atomic_long_read(&xps->xps_queuelen);
+	if (queuelen > (long)nwant * XPRT_SCALE_UP_QUEUELEN)
+		nwant = min(nwant * 2, nactive);
+	else if (queuelen <= (long)(nwant - 1) * XPRT_SCALE_DOWN_QUEUELEN &&
+		 nwant > 1)
+		nwant--;
+	WRITE_ONCE(xps->xps_nwant, nwant);
+}
+
+/*
+ * Returns the transport in use with the fewest queued tasks, preferring
+ * the first one after @cur among equals so that idle transports are still
+ * used in turn.
+ */
+static
+struct rpc_xprt *xprt_switch_find_next_entry_leastqueued(struct rpc_xprt_switch *xps,
+		const struct rpc_xprt *cur)
+{
+	struct rpc_xprt *pos, *best = NULL, *best_next = NULL;
+	long queuelen, best_len = LONG_MAX, best_next_len = LONG_MAX;
+	unsigned int n = 0, nwant;
+	bool after = false;
+
+	xprt_switch_scale(xps);
+	nwant = READ_ONCE(xps->xps_nwant);
+
+	list_for_each_entry_rcu(pos, &xps->xps_xprt_list, xprt_switch) {
+		if (!xprt_is_active(pos))
+			continue;
+		if (n++ >= nwant)
+			break;
+		queuelen = atomic_long_read(&pos->queuelen);
+		if (queuelen < best_len) {
+			best = pos;
+			best_len = queuelen;
+		}
+		if (after && queuelen < best_next_len) {
+			best_next = pos;
+			best_next_len = queuelen;
+		}
+		if (pos == cur)
+			after = true;
+	}
+	if (best_next && best_next_len == best_len)
+		return best_next;
+	return best;
+}
+
+static
+struct rpc_xprt *xprt_iter_next_entry_leastqueued(struct rpc_xprt_iter *xpi)
+{
+	return xprt_iter_next_entry_multiple(xpi,
+			xprt_switch_find_next_entry_leastqueued);
+}
+
 static
 struct rpc_xprt *xprt_switch_find_next_entry_all(struct rpc_xprt_switch *xps,
 		const struct rpc_xprt *cur)
@@ -532,6 +629,14 @@ const struct rpc_xprt_iter_ops rpc_xprt_iter_roundrobin = {
 	.xpi_next = xprt_iter_next_entry_roundrobin,
 };
 
+/* Policy for picking the least queued entry in the rpc_xprt_switch */
+static
+const struct rpc_xprt_iter_ops rpc_xprt_iter_leastqueued = {
+	.xpi_rewind = xprt_iter_default_rewind,
+	.xpi_xprt = xprt_iter_current_entry,
+	.xpi_next = xprt_iter_next_entry_leastqueued,
+};
+
 /* Policy for once-through iteration of entries in the rpc_xprt_switch */
 static
 const struct rpc_xprt_iter_ops rpc_xprt_iter_listall = {
@@ -24,12 +24,15 @@
 #include <linux/rculist.h>
 #include <net/xdp_sock_drv.h>
 #include <net/xdp.h>
+#include <net/busy_poll.h>
 
 #include "xsk_queue.h"
 #include "xdp_umem.h"
 #include "xsk.h"
 
 #define TX_BATCH_SIZE 16
+/* Most descriptors a multi-buffer frame can be made of */
+#define XSK_DESC_MAX_FRAGS (MAX_SKB_FRAGS + 1)
 
 static DEFINE_PER_CPU(struct list_head, xskmap_flush_list);
 
@@ -121,7 +124,7 @@ static int __xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len)
 	int err;
 
 	addr = xp_get_handle(xskb);
-	err = xskq_prod_reserve_desc(xs->rx, addr, len);
+	err = xskq_prod_reserve_desc(xs->rx, addr, len, 0);
 	if (err) {
 		xs->rx_queue_full++;
 		return err;
@@ -149,13 +152,70 @@ static void xsk_copy_xdp(struct xdp_buff *to, struct xdp_buff *from, u32 len)
 	memcpy(to_buf, from_buf, len + metalen);
 }
 
+/* Copies a frame larger than a chunk into a chain of chunks, all but the
+ * last one marked with XDP_PKT_CONTD. Either the whole frame makes it to
+ * the Rx ring or none of it does.
+ */
+static int __xsk_rcv_sg(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
+			u32 frame_size, bool explicit_free)
+{
+	struct xdp_buff *bufs[XSK_DESC_MAX_FRAGS];
+	u32 i, nr = DIV_ROUND_UP(len, frame_size);
+
+	if (nr > XSK_DESC_MAX_FRAGS) {
+		xs->rx_dropped++;
+		return -ENOSPC;
+	}
+
+	if (xskq_prod_nb_free(xs->rx, nr) < nr) {
+		xs->rx_queue_full++;
+		return -ENOBUFS;
+	}
+
+	for (i = 0; i < nr; i++) {
+		bufs[i] = xsk_buff_alloc(xs->umem);
+		if (!bufs[i]) {
+			while (i--)
+				xsk_buff_free(bufs[i]);
+			xs->rx_dropped++;
+			return -ENOSPC;
+		}
+	}
+
+	xsk_copy_xdp(bufs[0], xdp, frame_size);
+	for (i = 1; i < nr; i++)
+		memcpy(bufs[i]->data, xdp->data + i * frame_size,
+		       min(len - i * frame_size, frame_size));
+
+	for (i = 0; i < nr; i++) {
+		struct xdp_buff_xsk *xskb;
+		u32 frag_len = frame_size;
+
+		xskb = container_of(bufs[i], struct xdp_buff_xsk, xdp);
+		if (i == nr - 1)
+			frag_len = len - i * frame_size;
+		/* Cannot fail, room was checked above */
+		xskq_prod_reserve_desc(xs->rx, xp_get_handle(xskb), frag_len,
+				       i == nr - 1 ? 0 : XDP_PKT_CONTD);
+		xp_release(xskb);
+	}
+
+	if (explicit_free)
+		xdp_return_buff(xdp);
+	return 0;
+}
+
 static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
 		     bool explicit_free)
 {
+	u32 frame_size = xsk_umem_get_rx_frame_size(xs->umem);
 	struct xdp_buff *xsk_xdp;
 	int err;
 
-	if (len > xsk_umem_get_rx_frame_size(xs->umem)) {
+	if (len > frame_size) {
+		if (xs->sg)
+			return __xsk_rcv_sg(xs, xdp, len, frame_size,
+					    explicit_free);
 		xs->rx_dropped++;
 		return -ENOSPC;
 	}
@@ -198,6 +258,7 @@ static int xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp,
 	if (xs->dev != xdp->rxq->dev || xs->queue_id != xdp->rxq->queue_index)
 		return -EINVAL;
 
+	sk_mark_napi_id_once_xdp(&xs->sk, xdp);
 	len = xdp->data_end - xdp->data;
 
 	return xdp->rxq->mem.type == MEM_TYPE_XSK_BUFF_POOL ?
@@ -317,24 +378,90 @@ static int xsk_zc_xmit(struct xdp_sock *xs)
 
 static void xsk_destruct_skb(struct sk_buff *skb)
 {
-	u64 addr = (u64)(long)skb_shinfo(skb)->destructor_arg;
+	u32 nr_descs = (u32)(long)skb_shinfo(skb)->destructor_arg;
 	struct xdp_sock *xs = xdp_sk(skb->sk);
 	unsigned long flags;
 
+	/* The addresses were written to the completion ring when the
+	 * entries were reserved, and the data was copied into the skb, so
+	 * any reserved entry can be handed back to user space here.
+	 */
 	spin_lock_irqsave(&xs->tx_completion_lock, flags);
-	xskq_prod_submit_addr(xs->umem->cq, addr);
+	xskq_prod_submit_n(xs->umem->cq, nr_descs);
 	spin_unlock_irqrestore(&xs->tx_completion_lock, flags);
 
 	sock_wfree(skb);
 }
 
+static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
+				     struct xdp_desc *descs, u32 nr_descs,
+				     int *err)
+{
+	struct sock *sk = &xs->sk;
+	struct sk_buff *skb;
+	void *buffer;
+	u32 i;
+
+	skb = sock_alloc_send_skb(sk, descs[0].len, 1, err);
+	if (unlikely(!skb))
+		return NULL;
+
+	skb_put(skb, descs[0].len);
+	buffer = xsk_buff_raw_get_data(xs->umem, descs[0].addr);
+	*err = skb_store_bits(skb, 0, buffer, descs[0].len);
+	if (unlikely(*err))
+		goto free;
+
+	for (i = 1; i < nr_descs; i++) {
+		struct page *page;
+
+		page = alloc_page(sk->sk_allocation);
+		if (unlikely(!page)) {
+			*err = -EAGAIN;
+			goto free;
+		}
+
+		buffer = xsk_buff_raw_get_data(xs->umem, descs[i].addr);
+		memcpy(page_address(page), buffer, descs[i].len);
+		skb_add_rx_frag(skb, i - 1, page, 0, descs[i].len, PAGE_SIZE);
+		refcount_add(PAGE_SIZE, &sk->sk_wmem_alloc);
+	}
+
+	skb->dev = xs->dev;
+	skb->priority = sk->sk_priority;
+	skb->mark = sk->sk_mark;
+	return skb;
+
+free:
+	kfree_skb(skb);
+	return NULL;
+}
+
+/* Reserves completion ring entries for all the descriptors of a packet,
+ * writing their addresses right away.
+ */
+static int xsk_cq_reserve_descs(struct xdp_sock *xs, struct xdp_desc *descs,
+				u32 nr_descs)
+{
+	struct xsk_queue *cq = xs->umem->cq;
+	u32 i;
+
+	if (xskq_prod_nb_free(cq, nr_descs) < nr_descs)
+		return -ENOSPC;
+
+	for (i = 0; i < nr_descs; i++)
+		xskq_prod_reserve_addr(cq, descs[i].addr);
+	return 0;
+}
+
 static int xsk_generic_xmit(struct sock *sk)
 {
+	struct xdp_desc descs[XSK_DESC_MAX_FRAGS];
 	struct xdp_sock *xs = xdp_sk(sk);
+	struct sk_buff *skb, *head = NULL;
+	struct sk_buff **tail = &head;
 	u32 max_batch = TX_BATCH_SIZE;
-	bool sent_frame = false;
-	struct xdp_desc desc;
-	struct sk_buff *skb;
+	u32 nr_descs;
 	int err = 0;
 
 	mutex_lock(&xs->mutex);
@@ -342,59 +469,62 @@ static int xsk_generic_xmit(struct sock *sk)
 	if (xs->queue_id >= xs->dev->real_num_tx_queues)
 		goto out;
 
-	while (xskq_cons_peek_desc(xs->tx, &desc, xs->umem)) {
-		char *buffer;
-		u64 addr;
-		u32 len;
+	for (;;) {
+		if (xs->sg) {
+			nr_descs = xskq_cons_peek_pkt(xs->tx, descs,
+						      XSK_DESC_MAX_FRAGS,
+						      xs->umem);
+		} else {
+			nr_descs = xskq_cons_peek_desc(xs->tx, &descs[0],
+						       xs->umem);
+		}
+		if (!nr_descs) {
+			xs->tx->queue_empty_descs++;
+			break;
+		}
 
 		if (max_batch-- == 0) {
 			err = -EAGAIN;
-			goto out;
+			break;
 		}
 
-		len = desc.len;
-		skb = sock_alloc_send_skb(sk, len, 1, &err);
+		skb = xsk_build_skb(xs, descs, nr_descs, &err);
 		if (unlikely(!skb))
-			goto out;
+			break;
 
-		skb_put(skb, len);
-		addr = desc.addr;
-		buffer = xsk_buff_raw_get_data(xs->umem, addr);
-		err = skb_store_bits(skb, 0, buffer, len);
 		/* This is the backpressure mechanism for the Tx path.
 		 * Reserve space in the completion queue and only proceed
 		 * if there is space in it. This avoids having to implement
 		 * any buffering in the Tx path.
 		 */
-		if (unlikely(err) || xskq_prod_reserve(xs->umem->cq)) {
+		if (xsk_cq_reserve_descs(xs, descs, nr_descs)) {
 			kfree_skb(skb);
-			goto out;
+			break;
 		}
 
-		skb->dev = xs->dev;
-		skb->priority = sk->sk_priority;
-		skb->mark = sk->sk_mark;
-		skb_shinfo(skb)->destructor_arg = (void *)(long)desc.addr;
+		skb_shinfo(skb)->destructor_arg = (void *)(long)nr_descs;
 		skb->destructor = xsk_destruct_skb;
+		xskq_cons_release_n(xs->tx, nr_descs);
 
-		err = dev_direct_xmit(skb, xs->queue_id);
-		xskq_cons_release(xs->tx);
-		/* Ignore NET_XMIT_CN as packet might have been sent */
-		if (err == NET_XMIT_DROP || err == NETDEV_TX_BUSY) {
-			/* SKB completed but not sent */
-			err = -EBUSY;
-			goto out;
-		}
-
-		sent_frame = true;
+		*tail = skb;
+		tail = &skb->next;
 	}
 
-	xs->tx->queue_empty_descs++;
+	if (head) {
+		int ret;
+
+		/* All the frames of the batch go to the driver at once */
+		ret = dev_direct_xmit_list(head, xs->queue_id);
+		/* Ignore NET_XMIT_CN as packet might have been sent.
+		 * Frames not sent have been completed already.
+		 */
+		if (ret == NET_XMIT_DROP || ret == NETDEV_TX_BUSY)
+			err = -EBUSY;
 
-out:
-	if (sent_frame)
 		sk->sk_write_space(sk);
+	}
 
+out:
 	mutex_unlock(&xs->mutex);
 	return err;
 }
@@ -411,6 +541,19 @@ static int __xsk_sendmsg(struct sock *sk)
 	return xs->zc ? xsk_zc_xmit(xs) : xsk_generic_xmit(sk);
 }
 
+/* A zero-copy socket that busy polls its queue drives Rx and Tx from the
+ * busy poll loop, so the driver does not need to be woken up.
+ */
+static bool xsk_no_wakeup(struct sock *sk)
+{
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	return xdp_sk(sk)->zc && READ_ONCE(sk->sk_ll_usec) &&
+	       READ_ONCE(sk->sk_napi_id) >= MIN_NAPI_ID;
+#else
+	return false;
+#endif
+}
+
 static int xsk_sendmsg(struct socket *sock, struct msghdr *m, size_t total_len)
 {
 	bool need_wait = !(m->msg_flags & MSG_DONTWAIT);
@@ -422,9 +565,42 @@ static int xsk_sendmsg(struct socket *sock, struct msghdr *m, size_t total_len)
 	if (unlikely(need_wait))
 		return -EOPNOTSUPP;
 
+	if (sk_can_busy_loop(sk))
+		sk_busy_loop(sk, 1); /* only support non-blocking sockets */
+
+	if (xsk_no_wakeup(sk))
+		return 0;
+
 	return __xsk_sendmsg(sk);
 }
 
+static int xsk_recvmsg(struct socket *sock, struct msghdr *m, size_t len,
+		       int flags)
+{
+	bool need_wait = !(flags & MSG_DONTWAIT);
+	struct sock *sk = sock->sk;
+	struct xdp_sock *xs = xdp_sk(sk);
+
+	if (unlikely(!xsk_is_bound(xs)))
+		return -ENXIO;
+	if (unlikely(!(xs->dev->flags & IFF_UP)))
+		return -ENETDOWN;
+	if (unlikely(!xs->rx))
+		return -ENOBUFS;
+	if (unlikely(need_wait))
+		return -EOPNOTSUPP;
+
+	if (sk_can_busy_loop(sk))
+		sk_busy_loop(sk, 1); /* only support non-blocking sockets */
+
+	if (xsk_no_wakeup(sk))
+		return 0;
+
+	if (xs->zc && (xs->umem->need_wakeup & XDP_WAKEUP_RX))
+		return xsk_wakeup(xs, XDP_WAKEUP_RX);
+	return 0;
+}
+
 static __poll_t xsk_poll(struct file *file, struct socket *sock,
 			     struct poll_table_struct *wait)
 {
@@ -438,7 +614,10 @@ static __poll_t xsk_poll(struct file *file, struct socket *sock,
 
 	umem = xs->umem;
 
-	if (umem->need_wakeup) {
+	if (sk_can_busy_loop(sk))
+		sk_busy_loop(sk, 1); /* only support non-blocking sockets */
+
+	if (umem->need_wakeup && !xsk_no_wakeup(sk)) {
 		if (xs->zc)
 			xsk_wakeup(xs, umem->need_wakeup);
 		else
@@ -602,9 +781,13 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 
 	flags = sxdp->sxdp_flags;
 	if (flags & ~(XDP_SHARED_UMEM | XDP_COPY | XDP_ZEROCOPY |
-		      XDP_USE_NEED_WAKEUP))
+		      XDP_USE_NEED_WAKEUP | XDP_USE_SG))
 		return -EINVAL;
 
+	/* Multi-buffer frames are only supported in copy mode */
+	if ((flags & XDP_USE_SG) && (flags & XDP_ZEROCOPY))
+		return -EOPNOTSUPP;
+
 	rtnl_lock();
 	mutex_lock(&xs->mutex);
 	if (xs->state != XSK_READY) {
@@ -659,6 +842,11 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 			sockfd_put(sock);
 			goto out_unlock;
 		}
+		if ((flags & XDP_USE_SG) && umem_xs->umem->zc) {
+			err = -EOPNOTSUPP;
+			sockfd_put(sock);
+			goto out_unlock;
+		}
 
 		xdp_get_umem(umem_xs->umem);
 		WRITE_ONCE(xs->umem, umem_xs->umem);
@@ -668,6 +856,8 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 		goto out_unlock;
 	} else {
 		/* This xsk has its own umem. */
+		if (flags & XDP_USE_SG)
+			flags |= XDP_COPY;
 		err = xdp_umem_assign_dev(xs->umem, dev, qid, flags);
 		if (err)
 			goto out_unlock;
@@ -675,6 +865,7 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 
 	xs->dev = dev;
 	xs->zc = xs->umem->zc;
+	xs->sg = !!(flags & XDP_USE_SG);
 	xs->queue_id = qid;
 	xdp_add_sk_umem(xs->umem, xs);
 
@@ -1052,7 +1243,7 @@ static const struct proto_ops xsk_proto_ops = {
 	.setsockopt	= xsk_setsockopt,
 	.getsockopt	= xsk_getsockopt,
 	.sendmsg	= xsk_sendmsg,
-	.recvmsg	= sock_no_recvmsg,
+	.recvmsg	= xsk_recvmsg,
 	.mmap		= xsk_mmap,
 	.sendpage	= sock_no_sendpage,
 };
@@ -193,6 +193,49 @@ static inline bool xskq_cons_read_desc(struct xsk_queue *q,
 	return false;
 }
 
+/* Reads the descriptors of the packet at the head of the ring, chained
+ * with XDP_PKT_CONTD, into @descs without releasing them. Returns the
+ * number of descriptors, or 0 if the ring does not hold the whole packet
+ * yet. Packets with an invalid descriptor or more than @max descriptors
+ * are skipped and accounted as invalid.
+ */
+static inline u32 xskq_cons_peek_pkt(struct xsk_queue *q,
+				     struct xdp_desc *descs, u32 max,
+				     struct xdp_umem *umem)
+{
+	struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
+	struct xdp_desc desc;
+	bool valid;
+	u32 cons, n;
+
+	if (q->cached_prod == q->cached_cons)
+		xskq_cons_get_entries(q);
+again:
+	valid = true;
+	for (cons = q->cached_cons, n = 0; cons != q->cached_prod; cons++) {
+		u32 options;
+
+		desc = ring->desc[cons & q->ring_mask];
+		options = desc.options;
+		desc.options &= ~XDP_PKT_CONTD;
+		if (!xp_validate_desc(umem->pool, &desc))
+			valid = false;
+		if (n < max)
+			descs[n] = desc;
+		n++;
+
+		if (!(options & XDP_PKT_CONTD)) {
+			if (valid && n <= max)
+				return n;
+			q->invalid_descs++;
+			q->cached_cons = cons + 1;
+			goto again;
+		}
+	}
+
+	return 0;
+}
+
 /* Functions for consumers */
 
 static inline void __xskq_cons_release(struct xsk_queue *q)
@@ -253,6 +296,11 @@ static inline void xskq_cons_release(struct xsk_queue *q)
 	q->cached_cons++;
 }
 
+static inline void xskq_cons_release_n(struct xsk_queue *q, u32 cnt)
+{
+	q->cached_cons += cnt;
+}
+
 static inline bool xskq_cons_is_full(struct xsk_queue *q)
 {
 	/* No barriers needed since data is not accessed */
@@ -262,6 +310,20 @@ static inline bool xskq_cons_is_full(struct xsk_queue *q)
 
 /* Functions for producers */
 
+static inline u32 xskq_prod_nb_free(struct xsk_queue *q, u32 max)
+{
+	u32 free_entries = q->nentries - (q->cached_prod - q->cached_cons);
+
+	if (free_entries >= max)
+		return max;
+
+	/* Refresh the local tail pointer */
+	q->cached_cons = READ_ONCE(q->ring->consumer);
+	free_entries = q->nentries - (q->cached_prod - q->cached_cons);
+
+	return free_entries >= max ? max : free_entries;
+}
+
 static inline bool xskq_prod_is_full(struct xsk_queue *q)
 {
 	u32 free_entries = q->nentries - (q->cached_prod - q->cached_cons);
@@ -286,6 +348,11 @@ static inline int xskq_prod_reserve(struct xsk_queue *q)
 	return 0;
 }
 
+static inline void xskq_prod_cancel_n(struct xsk_queue *q, u32 cnt)
+{
+	q->cached_prod -= cnt;
+}
+
 static inline int xskq_prod_reserve_addr(struct xsk_queue *q, u64 addr)
 {
 	struct xdp_umem_ring *ring = (struct xdp_umem_ring *)q->ring;
@@ -299,7 +366,7 @@ static inline int xskq_prod_reserve_addr(struct xsk_queue *q, u64 addr)
 }
 
 static inline int xskq_prod_reserve_desc(struct xsk_queue *q,
-					 u64 addr, u32 len)
+					 u64 addr, u32 len, u32 options)
 {
 	struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
 	u32 idx;
@@ -311,6 +378,7 @@ static inline int xskq_prod_reserve_desc(struct xsk_queue *q,
 	idx = q->cached_prod++ & q->ring_mask;
 	ring->desc[idx].addr = addr;
 	ring->desc[idx].len = len;
+	ring->desc[idx].options = options;
 
 	return 0;
 }
@@ -327,16 +395,6 @@ static inline void xskq_prod_submit(struct xsk_queue *q)
 	__xskq_prod_submit(q, q->cached_prod);
 }
 
-static inline void xskq_prod_submit_addr(struct xsk_queue *q, u64 addr)
-{
-	struct xdp_umem_ring *ring = (struct xdp_umem_ring *)q->ring;
-	u32 idx = q->ring->producer;
-
-	ring->desc[idx++ & q->ring_mask] = addr;
-
-	__xskq_prod_submit(q, idx);
-}
-
 static inline void xskq_prod_submit_n(struct xsk_queue *q, u32 nb_entries)
 {
 	__xskq_prod_submit(q, q->ring->producer + nb_entries);
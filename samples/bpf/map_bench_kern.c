@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Hash map lookups and updates, run through BPF_PROG_TEST_RUN by
+ * map_bench_user.c. Each run does OPS_PER_RUN operations on keys picked at
+ * random among the first nr_keys (config[0]) keys.
+ */
+#include <uapi/linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+
+#define MAX_ENTRIES	(1 << 20)
+#define OPS_PER_RUN	64
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_ENTRIES);
+} hash_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, 1);
+} config SEC(".maps");
+
+static __always_inline u32 nr_keys(void)
+{
+	u32 zero = 0, *nr;
+
+	nr = bpf_map_lookup_elem(&config, &zero);
+	return nr && *nr ? *nr : 1;
+}
+
+SEC("xdp_lookup")
+int bench_lookup(struct xdp_md *ctx)
+{
+	u32 key, nr = nr_keys();
+	int i;
+
+	for (i = 0; i < OPS_PER_RUN; i++) {
+		key = bpf_get_prandom_u32() % nr;
+		bpf_map_lookup_elem(&hash_map, &key);
+	}
+	return XDP_PASS;
+}
+
+SEC("xdp_update")
+int bench_update(struct xdp_md *ctx)
+{
+	u32 key, nr = nr_keys();
+	u64 val;
+	int i;
+
+	for (i = 0; i < OPS_PER_RUN; i++) {
+		key = bpf_get_prandom_u32() % nr;
+		val = key;
+		bpf_map_update_elem(&hash_map, &key, &val, BPF_ANY);
+	}
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
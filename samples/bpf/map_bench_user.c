@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Rate of hash map lookups and updates from BPF programs, in Mops.
+ *
+ * One thread per CPU runs the xdp_lookup or xdp_update program of
+ * map_bench_kern.o in a BPF_PROG_TEST_RUN loop, so that the rate measured
+ * is the one of the map operations alone. The map is filled with nr_keys
+ * keys first, so updates replace the value of existing elements.
+ *
+ * Usage: map_bench [-c nr_cpus] [-k nr_keys] [-r runs] [lookup|update]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#define OPS_PER_RUN	64	/* as in map_bench_kern.c */
+
+static int prog_fd;
+static unsigned int runs = 100000;
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	double secs;
+	int err;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char pkt[64] = {};
+	__u32 retval, duration;
+	cpu_set_t cpus;
+	double start;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(w->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	start = now();
+	w->err = bpf_prog_test_run(prog_fd, runs, pkt, sizeof(pkt), NULL, NULL,
+				   &retval, &duration);
+	w->secs = now() - start;
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c nr_cpus] [-k nr_keys] [-r runs] [lookup|update]\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	int nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *mode = "lookup";
+	struct bpf_program *prog;
+	struct bpf_object *obj;
+	int map_fd, config_fd;
+	__u32 key, nr_keys = 1024, zero = 0;
+	struct worker *workers;
+	double secs = 0;
+	char filename[256];
+	__u64 val;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "c:k:r:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_cpus = atoi(optarg);
+			break;
+		case 'k':
+			nr_keys = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		mode = argv[optind];
+	if ((strcmp(mode, "lookup") && strcmp(mode, "update")) ||
+	    nr_cpus <= 0 || !nr_keys) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK)");
+		return 1;
+	}
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+	obj = bpf_object__open_file(filename, NULL);
+	if (libbpf_get_error(obj)) {
+		fprintf(stderr, "ERROR: opening BPF object file failed\n");
+		return 1;
+	}
+	if (bpf_object__load(obj)) {
+		fprintf(stderr, "ERROR: loading BPF object file failed\n");
+		return 1;
+	}
+
+	snprintf(filename, sizeof(filename), "xdp_%s", mode);
+	prog = bpf_object__find_program_by_title(obj, filename);
+	map_fd = bpf_object__find_map_fd_by_name(obj, "hash_map");
+	config_fd = bpf_object__find_map_fd_by_name(obj, "config");
+	if (!prog || map_fd < 0 || config_fd < 0) {
+		fprintf(stderr, "ERROR: finding programs and maps failed\n");
+		return 1;
+	}
+	prog_fd = bpf_program__fd(prog);
+
+	for (key = 0; key < nr_keys; key++) {
+		val = key;
+		if (bpf_map_update_elem(map_fd, &key, &val, BPF_ANY)) {
+			fprintf(stderr, "ERROR: filling the map failed: %s\n",
+				strerror(errno));
+			return 1;
+		}
+	}
+	bpf_map_update_elem(config_fd, &zero, &nr_keys, BPF_ANY);
+
+	workers = calloc(nr_cpus, sizeof(*workers));
+	if (!workers)
+		return 1;
+	for (i = 0; i < nr_cpus; i++) {
+		workers[i].cpu = i;
+		pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+	}
+	for (i = 0; i < nr_cpus; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err) {
+			fprintf(stderr, "ERROR: test run on cpu %d failed\n", i);
+			return 1;
+		}
+		secs += workers[i].secs;
+	}
+
+	/* Each thread contributes its own rate */
+	printf("%s: %d cpus, %u keys: %.2f Mops total, %.2f Mops per cpu\n",
+	       mode, nr_cpus, nr_keys,
+	       nr_cpus * nr_cpus * (double)runs * OPS_PER_RUN / secs / 1e6,
+	       nr_cpus * (double)runs * OPS_PER_RUN / secs / 1e6);
+
+	bpf_object__close(obj);
+	return 0;
+}
@@ -18,6 +18,8 @@ import math
 import drgn
 from drgn import container_of
 from drgn.helpers.linux.list import list_for_each_entry,list_empty
+from drgn.helpers.linux.cpumask import for_each_possible_cpu
+from drgn.helpers.linux.percpu import per_cpu_ptr
 from drgn.helpers.linux.radixtree import radix_tree_for_each,radix_tree_lookup
 
 import argparse
@@ -151,14 +153,27 @@ class IocgStat:
         self.hwi_pct = iocg.hweight_inuse.value_() * 100 / HWEIGHT_WHOLE
         self.address = iocg.value_()
 
+        # vtime reserved by CPUs but not issued yet, newer kernels only
+        vlocal = 0
+        self.nr_local = 0
+        try:
+            for cpu in for_each_possible_cpu(prog):
+                pcpu = per_cpu_ptr(iocg.pcpu, cpu)
+                vlocal += pcpu.budget.counter.value_()
+                self.nr_local += pcpu.nr_local.value_()
+        except:
+            pass
+
         vdone = iocg.done_vtime.counter.value_()
-        vtime = iocg.vtime.counter.value_()
+        vtime = iocg.vtime.counter.value_() - vlocal
         vrate = ioc.vtime_rate.counter.value_()
         period_vtime = ioc.period_us.value_() * vrate
         if period_vtime:
             self.inflight_pct = (vtime - vdone) * 100 / period_vtime
+            self.local_pct = vlocal * 100 / period_vtime
         else:
             self.inflight_pct = 0
+            self.local_pct = 0
 
         # vdebt used to be an atomic64_t and is now u64, support both
         try:
@@ -188,6 +203,8 @@ class IocgStat:
                 'hweight_active_pct'    : self.hwa_pct,
                 'hweight_inuse_pct'     : self.hwi_pct,
                 'inflight_pct'          : self.inflight_pct,
+                'local_budget_pct'      : self.local_pct,
+                'nr_local_ios'          : self.nr_local,
                 'debt_ms'               : self.debt_ms,
                 'use_delay'             : self.use_delay,
                 'delay_ms'              : self.delay_ms,
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * getrandom: getrandom() calls per second and per CPU
+ *
+ * One thread per CPU calls getrandom() for small buffers in a loop, the way
+ * TLS terminators and UUID generators do, and reports how many calls each
+ * thread got through.  With the crng shared, the per-thread rate drops as
+ * threads are added, with per-CPU crngs it should stay flat.
+ */
+
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <internal/cpumap.h>
+#include <perf/cpumap.h>
+
+#include "../util/stat.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+
+#include <err.h>
+
+#ifndef GRND_INSECURE
+#define GRND_INSECURE	0x0004
+#endif
+
+static unsigned int nthreads;
+static unsigned int nsecs = 5;
+static unsigned int nbytes = 16;
+static bool insecure, done, silent;
+
+static struct timeval start, end, runtime;
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats throughput_stats;
+static pthread_cond_t thread_parent, thread_worker;
+
+struct worker {
+	int tid;
+	int cpu;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads (default: one per CPU)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('b', "bytes",   &nbytes,   "Specify bytes per getrandom() call"),
+	OPT_BOOLEAN( 'i', "insecure", &insecure, "Pass GRND_INSECURE"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_getrandom_usage[] = {
+	"perf bench syscall getrandom <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	unsigned int flags = insecure ? GRND_INSECURE : 0;
+	unsigned long ops = 0;
+	char *buf;
+
+	buf = malloc(nbytes);
+	if (!buf)
+		err(EXIT_FAILURE, "malloc");
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		if (syscall(SYS_getrandom, buf, nbytes, flags) != (long)nbytes)
+			err(EXIT_FAILURE, "getrandom");
+		ops++;
+	} while (!done);
+
+	w->ops = ops;
+	free(buf);
+	return NULL;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime);
+}
+
+int bench_syscall_getrandom(int argc, const char **argv)
+{
+	struct worker *worker = NULL;
+	pthread_attr_t thread_attr;
+	struct perf_cpu_map *cpu;
+	struct sigaction act;
+	unsigned long total = 0;
+	double secs, avg;
+	cpu_set_t cpuset;
+	unsigned int i;
+	int ret = 0;
+
+	argc = parse_options(argc, argv, options, bench_getrandom_usage, 0);
+	if (argc || !nbytes) {
+		usage_with_options(bench_getrandom_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	cpu = perf_cpu_map__new(NULL);
+	if (!cpu)
+		goto errmem;
+
+	memset(&act, 0, sizeof(act));
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nthreads) /* default to the number of CPUs */
+		nthreads = cpu->nr;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		goto errmem;
+
+	printf("Run summary [PID %d]: %d threads, getrandom(%u bytes%s) for %d secs.\n\n",
+	       getpid(), nthreads, nbytes, insecure ? ", GRND_INSECURE" : "",
+	       nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+		worker[i].cpu = cpu->map[i % cpu->nr];
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(worker[i].cpu, &cpuset);
+
+		ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+		ret = pthread_create(&worker[i].thread, &thread_attr, workerfn,
+				     (void *)(struct worker *) &worker[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	secs = runtime.tv_sec + runtime.tv_usec / 1e6;
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = secs > 0 ? worker[i].ops / secs : 0;
+
+		update_stats(&throughput_stats, t);
+		total += worker[i].ops;
+		if (!silent)
+			printf("[thread %3d] cpu %3d: %'14lu calls/sec\n",
+			       worker[i].tid, worker[i].cpu, t);
+	}
+
+	avg = avg_stats(&throughput_stats);
+	printf("%s %'14.0f calls/sec total\n", !silent ? "\n" : "",
+	       secs > 0 ? total / secs : 0);
+	printf(" %'14.0f calls/sec per thread (+- %.2f%%)\n", avg,
+	       rel_stddev_stats(stddev_stats(&throughput_stats), avg));
+	printf(" %'14.1f MB/sec per thread\n", avg * nbytes / 1e6);
+
+	free(worker);
+	free(cpu);
+	return ret;
+errmem:
+	err(EXIT_FAILURE, "calloc");
+}
@@ -10,6 +10,9 @@
 #include "debug.h"
 #include "../perf-sys.h"
 #include <subcmd/parse-options.h>
+#include <api/fs/fs.h>
+#include <perf/cpumap.h>
+#include <internal/cpumap.h>
 #include "../util/header.h"
 #include "../util/cloexec.h"
 #include "../util/string2.h"
@@ -21,6 +24,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <errno.h>
 #include <linux/time64.h>
@@ -33,6 +39,9 @@ static const char	*function_str	= "all";
 static int		nr_loops	= 1;
 static bool		use_cycles;
 static int		cycles_fd;
+static const char	*scope_str	= "cpu";
+static unsigned int	nr_groups;
+static unsigned int	threads_per_group = 1;
 
 static const struct option options[] = {
 	OPT_STRING('s', "size", &size_str, "1MB",
@@ -48,6 +57,15 @@ static const struct option options[] = {
 	OPT_BOOLEAN('c', "cycles", &use_cycles,
 		    "Use a cycles event instead of gettimeofday() to measure performance"),
 
+	OPT_STRING('S', "scope", &scope_str, "cpu",
+		    "Run concurrently on groups of CPUs: \"cpu\" (single thread), \"llc\" or \"node\""),
+
+	OPT_UINTEGER('G', "nr_groups", &nr_groups,
+		    "Number of LLCs or nodes streaming concurrently (default: all)"),
+
+	OPT_UINTEGER('T', "threads", &threads_per_group,
+		    "Number of threads per LLC or node (default: 1)"),
+
 	OPT_END()
 };
 
@@ -115,15 +133,219 @@ struct bench_mem_info {
 	bool alloc_src;
 };
 
+/*
+ * Multi-threaded mode: threads pinned to CPUs of several LLCs or NUMA nodes
+ * run the same function concurrently on their own, locally allocated
+ * buffers, and the sum of their bandwidths is reported.
+ */
+struct mem_thread {
+	pthread_t		thread;
+	int			cpu;
+	const struct function	*r;
+	struct bench_mem_info	*info;
+	size_t			size;
+	pthread_barrier_t	*barrier;
+	double			result_bps;
+	bool			failed;
+};
+
+static struct perf_cpu_map *read_cpu_list(const char *path, bool sysfs)
+{
+	struct perf_cpu_map *map;
+	size_t len;
+	char *buf;
+	int ret;
+
+	ret = sysfs ? sysfs__read_str(path, &buf, &len) :
+		      filename__read_str(path, &buf, &len);
+	if (ret)
+		return NULL;
+
+	buf[strcspn(buf, "\n")] = '\0';
+	map = buf[0] ? perf_cpu_map__new(buf) : NULL;
+	free(buf);
+
+	return map;
+}
+
+/* Returns the number of groups stored in @groups */
+static int mem_find_groups(struct perf_cpu_map **groups, int max)
+{
+	struct perf_cpu_map *online = perf_cpu_map__new(NULL);
+	char path[PATH_MAX];
+	int nr = 0, i, j;
+
+	if (!online)
+		return 0;
+
+	if (!strcmp(scope_str, "node")) {
+		struct dirent *ent;
+		DIR *dir = opendir("/sys/devices/system/node");
+
+		while (dir && (ent = readdir(dir)) && nr < max) {
+			int node;
+
+			if (sscanf(ent->d_name, "node%d", &node) != 1)
+				continue;
+
+			snprintf(path, sizeof(path),
+				 "devices/system/node/node%d/cpulist", node);
+			groups[nr] = read_cpu_list(path, true);
+			if (groups[nr])
+				nr++;
+		}
+		if (dir)
+			closedir(dir);
+	} else {
+		for (i = 0; i < perf_cpu_map__nr(online) && nr < max; i++) {
+			int cpu = perf_cpu_map__cpu(online, i);
+			bool seen = false;
+
+			for (j = 0; j < nr; j++) {
+				if (perf_cpu_map__idx(groups[j], cpu) >= 0)
+					seen = true;
+			}
+			if (seen)
+				continue;
+
+			snprintf(path, sizeof(path),
+				 "devices/system/cpu/cpu%d/cache/index3/shared_cpu_list",
+				 cpu);
+			groups[nr] = read_cpu_list(path, true);
+			if (groups[nr])
+				nr++;
+		}
+	}
+
+	perf_cpu_map__put(online);
+
+	return nr;
+}
+
+static void *mem_thread_fn(void *arg)
+{
+	struct mem_thread *t = arg;
+	void *src = NULL, *dst;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		t->failed = true;
+
+	/* Allocate after pinning, so that first touch places the buffers locally */
+	dst = zalloc(t->size);
+	if (t->info->alloc_src)
+		src = zalloc(t->size);
+	if (!dst || (t->info->alloc_src && !src))
+		t->failed = true;
+
+	if (!t->failed) {
+		memset(dst, 0, t->size);
+		if (src)
+			memset(src, 0, t->size);
+	}
+
+	/* Start streaming only once every thread has faulted in its buffers */
+	pthread_barrier_wait(t->barrier);
+	if (!t->failed)
+		t->result_bps = t->info->do_gettimeofday(t->r, t->size, src, dst);
+
+	free(src);
+	free(dst);
+	return NULL;
+}
+
+static double __bench_mem_function_mt(struct bench_mem_info *info,
+				      const struct function *r, size_t size,
+				      int *nr_threads_ret, int *nr_groups_ret)
+{
+	struct perf_cpu_map *groups[1024];
+	struct mem_thread *threads;
+	pthread_barrier_t barrier;
+	int nr_avail, nr_used, nr_threads = 0, g, i;
+	double result_bps = 0.0;
+	bool failed = false;
+
+	nr_avail = mem_find_groups(groups, ARRAY_SIZE(groups));
+	nr_used = nr_groups && (int)nr_groups < nr_avail ? (int)nr_groups : nr_avail;
+
+	threads = calloc((size_t)nr_used * threads_per_group, sizeof(*threads));
+	BUG_ON(!threads);
+
+	for (g = 0; g < nr_used; g++) {
+		for (i = 0; i < perf_cpu_map__nr(groups[g]) &&
+			    i < (int)threads_per_group; i++) {
+			struct mem_thread *t = &threads[nr_threads++];
+
+			t->cpu = perf_cpu_map__cpu(groups[g], i);
+			t->r = r;
+			t->info = info;
+			t->size = size;
+			t->barrier = &barrier;
+		}
+	}
+
+	if (!nr_threads)
+		failed = true;
+	else
+		BUG_ON(pthread_barrier_init(&barrier, NULL, nr_threads));
+
+	for (i = 0; i < nr_threads; i++)
+		BUG_ON(pthread_create(&threads[i].thread, NULL, mem_thread_fn,
+				      &threads[i]));
+
+	/* All threads stream concurrently, so their bandwidths add up */
+	for (i = 0; i < nr_threads; i++) {
+		BUG_ON(pthread_join(threads[i].thread, NULL));
+		failed |= threads[i].failed;
+		result_bps += threads[i].result_bps;
+	}
+
+	for (g = 0; g < nr_avail; g++)
+		perf_cpu_map__put(groups[g]);
+	if (nr_threads)
+		pthread_barrier_destroy(&barrier);
+	free(threads);
+
+	*nr_threads_ret = nr_threads;
+	*nr_groups_ret = nr_used;
+
+	return failed ? -1.0 : result_bps;
+}
+
 static void __bench_mem_function(struct bench_mem_info *info, int r_idx, size_t size, double size_total)
 {
 	const struct function *r = &info->functions[r_idx];
 	double result_bps = 0.0;
 	u64 result_cycles = 0;
-	void *src = NULL, *dst = zalloc(size);
+	void *src = NULL, *dst;
 
 	printf("# function '%s' (%s)\n", r->name, r->desc);
 
+	if (strcmp(scope_str, "cpu")) {
+		int nr_threads, nr_used;
+
+		result_bps = __bench_mem_function_mt(info, r, size, &nr_threads,
+						     &nr_used);
+		if (result_bps < 0) {
+			printf("# Failed to run on %s groups - maybe size (%s) is too large?\n",
+			       scope_str, size_str);
+			return;
+		}
+
+		if (bench_format == BENCH_FORMAT_DEFAULT) {
+			printf("# %d threads on %d %s groups, %s bytes each ...\n\n",
+			       nr_threads, nr_used, scope_str, size_str);
+			print_bps(result_bps);
+		} else {
+			printf("%lf\n", result_bps);
+		}
+		return;
+	}
+
+	dst = zalloc(size);
+
 	if (dst == NULL)
 		goto out_alloc_failed;
 
@@ -181,6 +403,18 @@ static int bench_mem_common(int argc, const char **argv, struct bench_mem_info *
 
 	argc = parse_options(argc, argv, options, info->usage, 0);
 
+	if (strcmp(scope_str, "cpu") && strcmp(scope_str, "llc") &&
+	    strcmp(scope_str, "node")) {
+		fprintf(stderr, "Invalid scope:%s\n", scope_str);
+		return 1;
+	}
+
+	if (strcmp(scope_str, "cpu") && (use_cycles || !threads_per_group)) {
+		fprintf(stderr, "--scope %s needs gettimeofday() timing and at least one thread\n",
+			scope_str);
+		return 1;
+	}
+
 	if (use_cycles) {
 		i = init_cycles();
 		if (i < 0) {
@@ -223,6 +457,56 @@ static int bench_mem_common(int argc, const char **argv, struct bench_mem_info *
 	return 0;
 }
 
+#ifdef HAVE_ARCH_X86_64_SUPPORT
+/*
+ * Non-temporal variants, modelled on __copy_user_nocache() and
+ * clear_page_nocache(): movnti stores bypass the cache hierarchy, so large
+ * copies and clears don't evict the working set of the other cores sharing
+ * the LLC.  The tail that doesn't fill a quadword is done with plain stores.
+ */
+static void *memcpy_movnti(void *dst, const void *src, size_t size)
+{
+	size_t words = size / 8;
+	unsigned long *d = dst;
+	const unsigned long *s = src;
+
+	asm volatile("	test %[cnt], %[cnt]\n"
+		     "	jz 2f\n"
+		     "1:	mov (%[src]), %%rax\n"
+		     "	movnti %%rax, (%[dst])\n"
+		     "	add $8, %[src]\n"
+		     "	add $8, %[dst]\n"
+		     "	dec %[cnt]\n"
+		     "	jnz 1b\n"
+		     "2:	sfence\n"
+		     : [dst] "+r" (d), [src] "+r" (s), [cnt] "+r" (words)
+		     : : "rax", "memory", "cc");
+
+	memcpy(d, s, size % 8);
+	return dst;
+}
+
+static void *memset_movnti(void *dst, int c, size_t size)
+{
+	unsigned long val = 0x0101010101010101UL * (unsigned char)c;
+	size_t words = size / 8;
+	unsigned long *d = dst;
+
+	asm volatile("	test %[cnt], %[cnt]\n"
+		     "	jz 2f\n"
+		     "1:	movnti %[val], (%[dst])\n"
+		     "	add $8, %[dst]\n"
+		     "	dec %[cnt]\n"
+		     "	jnz 1b\n"
+		     "2:	sfence\n"
+		     : [dst] "+r" (d), [cnt] "+r" (words)
+		     : [val] "r" (val) : "memory", "cc");
+
+	memset(d, c, size % 8);
+	return dst;
+}
+#endif
+
 static void memcpy_prefault(memcpy_t fn, size_t size, void *src, void *dst)
 {
 	/* Make sure to always prefault zero pages even if MMAP_THRESH is crossed: */
@@ -278,6 +562,10 @@ struct function memcpy_functions[] = {
 # define MEMCPY_FN(_fn, _name, _desc) {.name = _name, .desc = _desc, .fn.memcpy = _fn},
 # include "mem-memcpy-x86-64-asm-def.h"
 # undef MEMCPY_FN
+
+	{ .name		= "x86-64-movnti",
+	  .desc		= "non-temporal movnti-based memcpy(), as in __copy_user_nocache()",
+	  .fn.memcpy	= memcpy_movnti },
 #endif
 
 	{ .name = NULL, }
@@ -357,6 +645,10 @@ static const struct function memset_functions[] = {
 # define MEMSET_FN(_fn, _name, _desc) { .name = _name, .desc = _desc, .fn.memset = _fn },
 # include "mem-memset-x86-64-asm-def.h"
 # undef MEMSET_FN
+
+	{ .name		= "x86-64-movnti",
+	  .desc		= "non-temporal movnti-based memset(), as in clear_page_nocache()",
+	  .fn.memset	= memset_movnti },
 #endif
 
 	{ .name = NULL, }
@@ -10,6 +10,8 @@
  * Ported to perf by Hitoshi Mitake <mitake@dcl.info.waseda.ac.jp>
  */
 #include <subcmd/parse-options.h>
+#include "../perf-sys.h"
+#include "../util/cloexec.h"
 #include "bench.h"
 
 #include <unistd.h>
@@ -24,6 +26,7 @@
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <linux/time64.h>
+#include <linux/perf_event.h>
 
 #include <pthread.h>
 
@@ -40,9 +43,13 @@ static	int			loops = LOOPS_DEFAULT;
 /* Use processes by default: */
 static bool			threaded;
 
+/* Per-task counting events attached to each side of the pipe */
+static int			nr_events;
+
 static const struct option options[] = {
 	OPT_INTEGER('l', "loop",	&loops,		"Specify number of loops"),
 	OPT_BOOLEAN('T', "threaded",	&threaded,	"Specify threads/process based task setup"),
+	OPT_INTEGER('e', "events",	&nr_events,	"Attach N per-task counting events to each task"),
 	OPT_END()
 };
 
@@ -51,12 +58,47 @@ static const char * const bench_sched_pipe_usage[] = {
 	NULL
 };
 
+/*
+ * Open @nr_events counters on the calling task only, so that every context
+ * switch between the two workers has to switch a perf context as well.
+ * This measures what per-task profiling (perf record -p) adds to the cost
+ * of a context switch.
+ */
+static void open_task_events(void)
+{
+	struct perf_event_attr attr = {
+		.size		= sizeof(attr),
+		.type		= PERF_TYPE_HARDWARE,
+		.config		= PERF_COUNT_HW_INSTRUCTIONS,
+	};
+	int i, fd;
+
+	for (i = 0; i < nr_events; i++) {
+		fd = sys_perf_event_open(&attr, 0, -1, -1,
+					 perf_event_open_cloexec_flag());
+		if (fd < 0 && attr.type == PERF_TYPE_HARDWARE) {
+			/* No PMU (e.g. in a guest), use a software event */
+			attr.type = PERF_TYPE_SOFTWARE;
+			attr.config = PERF_COUNT_SW_TASK_CLOCK;
+			fd = sys_perf_event_open(&attr, 0, -1, -1,
+						 perf_event_open_cloexec_flag());
+		}
+		if (fd < 0) {
+			fprintf(stderr, "Failed to open event %d: %s\n",
+				i, strerror(errno));
+			exit(1);
+		}
+	}
+}
+
 static void *worker_thread(void *__tdata)
 {
 	struct thread_data *td = __tdata;
 	int m = 0, i;
 	int ret;
 
+	open_task_events();
+
 	for (i = 0; i < loops; i++) {
 		if (!td->nr) {
 			ret = read(td->pipe_read, &m, sizeof(int));
@@ -149,8 +191,11 @@ int bench_sched_pipe(int argc, const char **argv)
 
 	switch (bench_format) {
 	case BENCH_FORMAT_DEFAULT:
-		printf("# Executed %d pipe operations between two %s\n\n",
+		printf("# Executed %d pipe operations between two %s\n",
 			loops, threaded ? "threads" : "processes");
+		if (nr_events)
+			printf("# with %d per-task events on each\n", nr_events);
+		printf("\n");
 
 		result_usec = diff.tv_sec * USEC_PER_SEC;
 		result_usec += diff.tv_usec;
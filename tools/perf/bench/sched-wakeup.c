@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *
+ * sched-wakeup.c
+ *
+ * wakeup: Benchmark for the latency of waking a sleeping task
+ *
+ * A number of waker/wakee thread pairs ping-pong over pipes, like
+ * 'perf bench sched pipe'. The waker stamps each message with the time
+ * it was sent, the wakee measures how long it took to be woken up and
+ * run, and the distribution is reported as a log2 histogram. The threads
+ * are not bound, so each wakeup goes through the scheduler's idle CPU
+ * selection; the waker can burn some time between messages to keep
+ * cores partially busy.
+ */
+#include <subcmd/parse-options.h>
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <linux/time64.h>
+
+#include <pthread.h>
+
+/* Bucket i holds latencies in [2^(i-1), 2^i) usecs; bucket 0 is < 1 usec */
+#define NR_BUCKETS	24
+
+struct pair_data {
+	int			nr;
+	int			to_wakee[2];
+	int			to_waker[2];
+	pthread_t		waker;
+	pthread_t		wakee;
+	unsigned long long	hist[NR_BUCKETS];
+	unsigned long long	max_nsec;
+	unsigned long long	sum_nsec;
+};
+
+#define LOOPS_DEFAULT 100000
+static	int			loops = LOOPS_DEFAULT;
+static	unsigned int		nr_pairs = 1;
+static	unsigned int		work_usecs;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop",	&loops,		"Specify number of loops"),
+	OPT_UINTEGER('p', "pairs",	&nr_pairs,	"Specify number of waker/wakee pairs"),
+	OPT_UINTEGER('w', "work",	&work_usecs,	"Busy loop for <n> usecs between wakeups"),
+	OPT_END()
+};
+
+static const char * const bench_sched_wakeup_usage[] = {
+	"perf bench sched wakeup <options>",
+	NULL
+};
+
+static unsigned long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void burn(unsigned int usecs)
+{
+	unsigned long long end;
+
+	if (!usecs)
+		return;
+
+	end = now_nsec() + usecs * NSEC_PER_USEC;
+	while (now_nsec() < end)
+		;
+}
+
+static void *waker_thread(void *__pd)
+{
+	struct pair_data *pd = __pd;
+	unsigned long long stamp;
+	int __maybe_unused ret;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		burn(work_usecs);
+
+		stamp = now_nsec();
+		ret = write(pd->to_wakee[1], &stamp, sizeof(stamp));
+		BUG_ON(ret != sizeof(stamp));
+		ret = read(pd->to_waker[0], &stamp, sizeof(stamp));
+		BUG_ON(ret != sizeof(stamp));
+	}
+
+	return NULL;
+}
+
+static void *wakee_thread(void *__pd)
+{
+	struct pair_data *pd = __pd;
+	unsigned long long stamp, delta, usecs;
+	int __maybe_unused ret;
+	int i, b;
+
+	for (i = 0; i < loops; i++) {
+		ret = read(pd->to_wakee[0], &stamp, sizeof(stamp));
+		BUG_ON(ret != sizeof(stamp));
+
+		delta = now_nsec() - stamp;
+		usecs = delta / NSEC_PER_USEC;
+		for (b = 0; usecs && b < NR_BUCKETS - 1; b++)
+			usecs >>= 1;
+
+		pd->hist[b]++;
+		pd->sum_nsec += delta;
+		if (delta > pd->max_nsec)
+			pd->max_nsec = delta;
+
+		ret = write(pd->to_waker[1], &stamp, sizeof(stamp));
+		BUG_ON(ret != sizeof(stamp));
+	}
+
+	return NULL;
+}
+
+static unsigned long long percentile(unsigned long long *hist,
+				     unsigned long long total, unsigned int pct)
+{
+	unsigned long long seen = 0, want = (total * pct + 99) / 100;
+	int b;
+
+	for (b = 0; b < NR_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= want)
+			break;
+	}
+
+	/* Upper bound of the bucket, in usecs */
+	return b ? 1ULL << b : 1;
+}
+
+int bench_sched_wakeup(int argc, const char **argv)
+{
+	unsigned long long hist[NR_BUCKETS] = { 0 };
+	unsigned long long total, sum_nsec = 0, max_nsec = 0;
+	struct pair_data *pairs, *pd;
+	struct timeval start, stop, diff;
+	unsigned int p;
+	int b, ret;
+
+	argc = parse_options(argc, argv, options, bench_sched_wakeup_usage, 0);
+
+	if (!nr_pairs || loops <= 0)
+		usage_with_options(bench_sched_wakeup_usage, options);
+
+	pairs = calloc(nr_pairs, sizeof(*pairs));
+	BUG_ON(!pairs);
+
+	for (p = 0; p < nr_pairs; p++) {
+		pd = pairs + p;
+		pd->nr = p;
+		BUG_ON(pipe(pd->to_wakee));
+		BUG_ON(pipe(pd->to_waker));
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (p = 0; p < nr_pairs; p++) {
+		pd = pairs + p;
+
+		ret = pthread_create(&pd->wakee, NULL, wakee_thread, pd);
+		BUG_ON(ret);
+		ret = pthread_create(&pd->waker, NULL, waker_thread, pd);
+		BUG_ON(ret);
+	}
+
+	for (p = 0; p < nr_pairs; p++) {
+		pd = pairs + p;
+
+		ret = pthread_join(pd->waker, NULL);
+		BUG_ON(ret);
+		ret = pthread_join(pd->wakee, NULL);
+		BUG_ON(ret);
+
+		for (b = 0; b < NR_BUCKETS; b++)
+			hist[b] += pd->hist[b];
+		sum_nsec += pd->sum_nsec;
+		if (pd->max_nsec > max_nsec)
+			max_nsec = pd->max_nsec;
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	total = (unsigned long long)loops * nr_pairs;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %llu wakeups over %u waker/wakee pairs\n\n",
+		       total, nr_pairs);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / USEC_PER_MSEC));
+
+		printf(" %14s: %.3lf [usec]\n", "Average",
+		       (double)sum_nsec / total / NSEC_PER_USEC);
+		printf(" %14s: %.3lf [usec]\n", "Max",
+		       (double)max_nsec / NSEC_PER_USEC);
+		printf(" %14s: <= %llu [usec]\n", "50th", percentile(hist, total, 50));
+		printf(" %14s: <= %llu [usec]\n", "90th", percentile(hist, total, 90));
+		printf(" %14s: <= %llu [usec]\n\n", "99th", percentile(hist, total, 99));
+
+		printf(" %20s %12s %8s\n", "usecs", "count", "percent");
+		for (b = 0; b < NR_BUCKETS; b++) {
+			if (!hist[b])
+				continue;
+			printf(" %9llu -> %-8llu %12llu %7.2lf%%\n",
+			       b ? 1ULL << (b - 1) : 0ULL, 1ULL << b,
+			       hist[b], 100.0 * hist[b] / total);
+		}
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3lf %llu\n",
+		       (double)sum_nsec / total / NSEC_PER_USEC,
+		       percentile(hist, total, 99));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(pairs);
+
+	return 0;
+}
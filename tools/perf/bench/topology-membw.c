@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *
+ * topology-membw.c
+ *
+ * membw: memory read bandwidth between every pair of NUMA nodes
+ *
+ * For each pair of nodes, one thread per CPU of the first node streams
+ * through a buffer allocated on the second node.  The resulting node x node
+ * matrix shows the local and cross-die/cross-socket bandwidth, which on
+ * EPYC depends on the data fabric and on the NPS setting of the BIOS.
+ */
+#include <subcmd/parse-options.h>
+#include "bench.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <linux/time64.h>
+
+#include <numa.h>
+
+struct membw_thread {
+	pthread_t		thread;
+	int			cpu;
+	const unsigned long	*buf;
+	size_t			words;
+	pthread_barrier_t	*barrier;
+	unsigned long		sum;
+};
+
+static	unsigned int		size_mb = 256;
+static	unsigned int		nr_passes = 4;
+static	unsigned int		nr_threads;
+
+static const struct option options[] = {
+	OPT_UINTEGER('s', "size",	&size_mb,	"Size of the buffer per thread in MB"),
+	OPT_UINTEGER('p', "passes",	&nr_passes,	"Number of passes over each buffer"),
+	OPT_UINTEGER('t', "threads",	&nr_threads,	"Threads per node (default: one per CPU)"),
+	OPT_END()
+};
+
+static const char * const bench_topology_membw_usage[] = {
+	"perf bench topology membw <options>",
+	NULL
+};
+
+static unsigned long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void *membw_thread(void *__arg)
+{
+	struct membw_thread *t = __arg;
+	unsigned long sum = 0;
+	unsigned int pass;
+	size_t i;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	BUG_ON(sched_setaffinity(0, sizeof(set), &set));
+
+	pthread_barrier_wait(t->barrier);
+
+	for (pass = 0; pass < nr_passes; pass++) {
+		for (i = 0; i < t->words; i += 8)
+			sum += t->buf[i] + t->buf[i + 1] + t->buf[i + 2] +
+			       t->buf[i + 3] + t->buf[i + 4] + t->buf[i + 5] +
+			       t->buf[i + 6] + t->buf[i + 7];
+	}
+
+	/* Keep the loads from being optimized away */
+	t->sum = sum;
+
+	return NULL;
+}
+
+/* Returns the bandwidth in MB/s seen by @cpus reading memory of @mem_node */
+static double membw_measure(int mem_node, int *cpus, int nr_cpus)
+{
+	size_t size = (size_t)size_mb << 20;
+	struct membw_thread *threads;
+	pthread_barrier_t barrier;
+	unsigned long long start, elapsed;
+	int i, nr = nr_cpus;
+
+	if (nr_threads && nr_threads < (unsigned int)nr)
+		nr = nr_threads;
+
+	threads = calloc(nr, sizeof(*threads));
+	BUG_ON(!threads);
+	BUG_ON(pthread_barrier_init(&barrier, NULL, nr + 1));
+
+	for (i = 0; i < nr; i++) {
+		unsigned long *buf = numa_alloc_onnode(size, mem_node);
+
+		BUG_ON(!buf);
+		memset(buf, i, size);
+
+		threads[i].cpu = cpus[i];
+		threads[i].buf = buf;
+		threads[i].words = size / sizeof(*buf);
+		threads[i].barrier = &barrier;
+		BUG_ON(pthread_create(&threads[i].thread, NULL, membw_thread,
+				      &threads[i]));
+	}
+
+	pthread_barrier_wait(&barrier);
+	start = now_nsec();
+
+	for (i = 0; i < nr; i++)
+		BUG_ON(pthread_join(threads[i].thread, NULL));
+
+	elapsed = now_nsec() - start;
+
+	for (i = 0; i < nr; i++)
+		numa_free((void *)threads[i].buf, size);
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+
+	return (double)size * nr * nr_passes / (1 << 20) /
+	       ((double)elapsed / NSEC_PER_SEC);
+}
+
+int bench_topology_membw(int argc, const char **argv)
+{
+	struct bitmask *cpumask;
+	int nr_nodes, node, mem_node, cpu, nr_cpus;
+	double *matrix;
+	int *cpus;
+
+	argc = parse_options(argc, argv, options, bench_topology_membw_usage, 0);
+	if (!size_mb || !nr_passes)
+		usage_with_options(bench_topology_membw_usage, options);
+
+	if (numa_available() < 0) {
+		fprintf(stderr, "NUMA is not available\n");
+		return -1;
+	}
+
+	nr_nodes = numa_max_node() + 1;
+	matrix = calloc((size_t)nr_nodes * nr_nodes, sizeof(*matrix));
+	cpus = calloc(numa_num_possible_cpus(), sizeof(*cpus));
+	cpumask = numa_allocate_cpumask();
+	BUG_ON(!matrix || !cpus || !cpumask);
+
+	for (node = 0; node < nr_nodes; node++) {
+		if (numa_node_to_cpus(node, cpumask))
+			continue;
+
+		nr_cpus = 0;
+		for (cpu = 0; cpu < numa_num_possible_cpus(); cpu++) {
+			if (numa_bitmask_isbitset(cpumask, cpu))
+				cpus[nr_cpus++] = cpu;
+		}
+		if (!nr_cpus)
+			continue;
+
+		for (mem_node = 0; mem_node < nr_nodes; mem_node++) {
+			if (!numa_bitmask_isbitset(numa_nodes_ptr, mem_node))
+				continue;
+
+			matrix[node * nr_nodes + mem_node] =
+				membw_measure(mem_node, cpus, nr_cpus);
+		}
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Read bandwidth in MB/s, CPU node (rows) x memory node (columns)\n\n");
+
+		printf("%6s", "");
+		for (mem_node = 0; mem_node < nr_nodes; mem_node++)
+			printf(" %10d", mem_node);
+		printf("\n");
+
+		for (node = 0; node < nr_nodes; node++) {
+			printf("%6d", node);
+			for (mem_node = 0; mem_node < nr_nodes; mem_node++)
+				printf(" %10.0lf", matrix[node * nr_nodes + mem_node]);
+			printf("\n");
+		}
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		for (node = 0; node < nr_nodes; node++) {
+			for (mem_node = 0; mem_node < nr_nodes; mem_node++)
+				printf("%d %d %.0lf\n", node, mem_node,
+				       matrix[node * nr_nodes + mem_node]);
+		}
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	numa_free_cpumask(cpumask);
+	free(cpus);
+	free(matrix);
+
+	return 0;
+}
@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *
+ * topology.c
+ *
+ * c2c: cache-line transfer latency between every pair of CPUs
+ * ipi: cross-CPU wakeup (IPI) latency between every pair of CPUs
+ *
+ * Both benchmarks pin one thread on each CPU of a pair and bounce between
+ * them.  For c2c the threads spin on a shared cache line, so each round
+ * trip moves the line twice between the two cores.  For ipi both threads
+ * block on futexes, so each wakeup of the idle remote CPU is delivered by
+ * an IPI.  The results are printed as a CPU x CPU matrix, followed by
+ * averages for each level of the CPU topology (SMT siblings, same LLC,
+ * same package, cross package), which on Zen maps to same core, same CCX,
+ * same socket and cross socket.
+ */
+#include <subcmd/parse-options.h>
+#include <api/fs/fs.h>
+#include <perf/cpumap.h>
+#include "bench.h"
+#include "futex.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <linux/time64.h>
+
+#define CACHELINE_SIZE	64
+
+enum topo_level {
+	TOPO_SMT,
+	TOPO_LLC,
+	TOPO_PACKAGE,
+	TOPO_REMOTE,
+	TOPO_MAX,
+};
+
+static const char * const topo_level_names[TOPO_MAX] = {
+	[TOPO_SMT]	= "SMT sibling",
+	[TOPO_LLC]	= "same LLC",
+	[TOPO_PACKAGE]	= "same package",
+	[TOPO_REMOTE]	= "cross package",
+};
+
+struct cpu_topo {
+	int			core_id;	/* first SMT sibling */
+	int			llc_id;		/* first CPU sharing the LLC */
+	int			package_id;
+};
+
+struct pair_arg {
+	int			cpu;
+	u_int32_t		*ping;
+	u_int32_t		*pong;
+	unsigned long long	stamp;
+	unsigned long long	sum_nsec;
+};
+
+static	int			loops = 1000;
+static	const char		*cpu_list;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop",	&loops,		"Specify number of round trips per CPU pair"),
+	OPT_STRING('C', "cpu",		&cpu_list,	"cpu",	"List of CPUs to measure (default: all online)"),
+	OPT_END()
+};
+
+static const char * const bench_topology_c2c_usage[] = {
+	"perf bench topology c2c <options>",
+	NULL
+};
+
+static const char * const bench_topology_ipi_usage[] = {
+	"perf bench topology ipi <options>",
+	NULL
+};
+
+static unsigned long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	BUG_ON(sched_setaffinity(0, sizeof(set), &set));
+}
+
+static int sysfs_first_cpu(int cpu, const char *attr, int def)
+{
+	struct perf_cpu_map *map;
+	char path[PATH_MAX];
+	char *buf;
+	size_t size;
+	int first;
+
+	snprintf(path, sizeof(path), "devices/system/cpu/cpu%d/%s", cpu, attr);
+	if (sysfs__read_str(path, &buf, &size))
+		return def;
+
+	buf[strcspn(buf, "\n")] = '\0';
+	map = perf_cpu_map__new(buf);
+	free(buf);
+	if (!map)
+		return def;
+
+	first = perf_cpu_map__cpu(map, 0);
+	perf_cpu_map__put(map);
+
+	return first;
+}
+
+static void read_cpu_topo(int cpu, struct cpu_topo *topo)
+{
+	char path[PATH_MAX];
+
+	topo->core_id = sysfs_first_cpu(cpu, "topology/thread_siblings_list", cpu);
+	topo->llc_id = sysfs_first_cpu(cpu, "cache/index3/shared_cpu_list", -1);
+
+	snprintf(path, sizeof(path),
+		 "devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+	if (sysfs__read_int(path, &topo->package_id))
+		topo->package_id = 0;
+}
+
+static enum topo_level topo_level(struct cpu_topo *a, struct cpu_topo *b)
+{
+	if (a->core_id == b->core_id)
+		return TOPO_SMT;
+	if (a->llc_id >= 0 && a->llc_id == b->llc_id)
+		return TOPO_LLC;
+	if (a->package_id == b->package_id)
+		return TOPO_PACKAGE;
+	return TOPO_REMOTE;
+}
+
+/* c2c: the pong side waits for each odd value and answers with the next one */
+static void *c2c_pong_thread(void *__arg)
+{
+	struct pair_arg *arg = __arg;
+	u_int32_t *line = arg->ping;
+	u_int32_t i;
+
+	pin_to_cpu(arg->cpu);
+
+	for (i = 0; i < 2 * (u_int32_t)loops; i += 2) {
+		while (__atomic_load_n(line, __ATOMIC_ACQUIRE) != i + 1)
+			;
+		__atomic_store_n(line, i + 2, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static unsigned long long c2c_measure(int cpu_a, int cpu_b, u_int32_t *line)
+{
+	struct pair_arg arg = { .cpu = cpu_b, .ping = line };
+	unsigned long long start;
+	pthread_t pong;
+	u_int32_t i;
+
+	*line = 0;
+	pin_to_cpu(cpu_a);
+	BUG_ON(pthread_create(&pong, NULL, c2c_pong_thread, &arg));
+
+	start = now_nsec();
+	for (i = 0; i < 2 * (u_int32_t)loops; i += 2) {
+		__atomic_store_n(line, i + 1, __ATOMIC_RELEASE);
+		while (__atomic_load_n(line, __ATOMIC_ACQUIRE) != i + 2)
+			;
+	}
+	arg.sum_nsec = now_nsec() - start;
+
+	BUG_ON(pthread_join(pong, NULL));
+
+	/* One-way transfer latency */
+	return arg.sum_nsec / loops / 2;
+}
+
+/*
+ * ipi: both sides sleep in FUTEX_WAIT, so every handoff wakes a task on an
+ * idle CPU.  The pong side measures the latency from the wakeup request.
+ */
+static void *ipi_pong_thread(void *__arg)
+{
+	struct pair_arg *arg = __arg;
+	int i;
+
+	pin_to_cpu(arg->cpu);
+
+	for (i = 0; i < loops; i++) {
+		while (!__atomic_load_n(arg->ping, __ATOMIC_ACQUIRE))
+			futex_wait(arg->ping, 0, NULL, FUTEX_PRIVATE_FLAG);
+
+		arg->sum_nsec += now_nsec() - __atomic_load_n(&arg->stamp, __ATOMIC_ACQUIRE);
+		__atomic_store_n(arg->ping, 0, __ATOMIC_RELEASE);
+
+		__atomic_store_n(arg->pong, 1, __ATOMIC_RELEASE);
+		futex_wake(arg->pong, 1, FUTEX_PRIVATE_FLAG);
+	}
+
+	return NULL;
+}
+
+static unsigned long long ipi_measure(int cpu_a, int cpu_b, u_int32_t *words)
+{
+	struct pair_arg arg = {
+		.cpu = cpu_b,
+		.ping = &words[0],
+		.pong = &words[CACHELINE_SIZE / sizeof(u_int32_t)],
+	};
+	pthread_t pong;
+	int i;
+
+	*arg.ping = 0;
+	*arg.pong = 0;
+	pin_to_cpu(cpu_a);
+	BUG_ON(pthread_create(&pong, NULL, ipi_pong_thread, &arg));
+
+	for (i = 0; i < loops; i++) {
+		__atomic_store_n(&arg.stamp, now_nsec(), __ATOMIC_RELEASE);
+		__atomic_store_n(arg.ping, 1, __ATOMIC_RELEASE);
+		futex_wake(arg.ping, 1, FUTEX_PRIVATE_FLAG);
+
+		while (!__atomic_load_n(arg.pong, __ATOMIC_ACQUIRE))
+			futex_wait(arg.pong, 0, NULL, FUTEX_PRIVATE_FLAG);
+		__atomic_store_n(arg.pong, 0, __ATOMIC_RELEASE);
+	}
+
+	BUG_ON(pthread_join(pong, NULL));
+
+	return arg.sum_nsec / loops;
+}
+
+static int bench_topology_matrix(int argc, const char **argv,
+				 const char * const *usage, const char *what,
+				 unsigned long long (*measure)(int, int, u_int32_t *))
+{
+	unsigned long long level_sum[TOPO_MAX] = { 0 };
+	unsigned long long level_nr[TOPO_MAX] = { 0 };
+	unsigned long long *matrix;
+	struct perf_cpu_map *cpus;
+	struct cpu_topo *topo;
+	u_int32_t *line;
+	int nr, i, j;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (loops <= 0)
+		usage_with_options(usage, options);
+
+	cpus = perf_cpu_map__new(cpu_list);
+	if (!cpus || perf_cpu_map__nr(cpus) < 2) {
+		fprintf(stderr, "Need at least two CPUs to measure\n");
+		return -1;
+	}
+	nr = perf_cpu_map__nr(cpus);
+
+	matrix = calloc((size_t)nr * nr, sizeof(*matrix));
+	topo = calloc(nr, sizeof(*topo));
+	BUG_ON(!matrix || !topo);
+	BUG_ON(posix_memalign((void **)&line, CACHELINE_SIZE, 2 * CACHELINE_SIZE));
+
+	for (i = 0; i < nr; i++)
+		read_cpu_topo(perf_cpu_map__cpu(cpus, i), &topo[i]);
+
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < nr; j++) {
+			enum topo_level level;
+
+			if (i == j)
+				continue;
+
+			matrix[i * nr + j] = measure(perf_cpu_map__cpu(cpus, i),
+						     perf_cpu_map__cpu(cpus, j),
+						     line);
+
+			level = topo_level(&topo[i], &topo[j]);
+			level_sum[level] += matrix[i * nr + j];
+			level_nr[level]++;
+		}
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s latency in nsecs, %d round trips per CPU pair\n\n",
+		       what, loops);
+
+		printf("%6s", "");
+		for (j = 0; j < nr; j++)
+			printf(" %6d", perf_cpu_map__cpu(cpus, j));
+		printf("\n");
+
+		for (i = 0; i < nr; i++) {
+			printf("%6d", perf_cpu_map__cpu(cpus, i));
+			for (j = 0; j < nr; j++) {
+				if (i == j)
+					printf(" %6s", "-");
+				else
+					printf(" %6llu", matrix[i * nr + j]);
+			}
+			printf("\n");
+		}
+
+		printf("\n");
+		for (i = 0; i < TOPO_MAX; i++) {
+			if (!level_nr[i])
+				continue;
+			printf(" %14s: %llu [nsec] over %llu pairs\n",
+			       topo_level_names[i], level_sum[i] / level_nr[i],
+			       level_nr[i]);
+		}
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		for (i = 0; i < nr; i++) {
+			for (j = 0; j < nr; j++) {
+				if (i != j)
+					printf("%d %d %llu\n",
+					       perf_cpu_map__cpu(cpus, i),
+					       perf_cpu_map__cpu(cpus, j),
+					       matrix[i * nr + j]);
+			}
+		}
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(line);
+	free(topo);
+	free(matrix);
+	perf_cpu_map__put(cpus);
+
+	return 0;
+}
+
+int bench_topology_c2c(int argc, const char **argv)
+{
+	return bench_topology_matrix(argc, argv, bench_topology_c2c_usage,
+				     "Cache-line transfer", c2c_measure);
+}
+
+int bench_topology_ipi(int argc, const char **argv)
+{
+	return bench_topology_matrix(argc, argv, bench_topology_ipi_usage,
+				     "Cross-CPU wakeup", ipi_measure);
+}
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * cstate_latency -- measure timer wakeup latency out of each cpuidle state.
+ *
+ * For every idle state of the target CPU, all of the other states are
+ * disabled through sysfs, and a thread pinned to that CPU repeatedly sleeps
+ * until an absolute deadline with clock_nanosleep().  The difference between
+ * the deadline and the time the thread actually runs again is the wakeup
+ * latency, which includes the exit latency of the idle state in use.
+ *
+ * The original "disable" settings of all states are restored on exit.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_STATES	10
+#define NSEC_PER_SEC	1000000000LL
+
+static int cpu;
+static int loops = 1000;
+static long interval_us = 1000;
+static int nr_states;
+static int saved_disable[MAX_STATES];
+static char state_name[MAX_STATES][32];
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"Usage: %s [-c cpu] [-l loops] [-i interval_us]\n"
+		"  -c, --cpu       CPU to measure (default 0)\n"
+		"  -l, --loops     wakeups per idle state (default 1000)\n"
+		"  -i, --interval  sleep interval in microseconds (default 1000)\n",
+		progname);
+	exit(1);
+}
+
+static char *state_path(int state, const char *attr)
+{
+	static char path[PATH_MAX];
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/%s",
+		 cpu, state, attr);
+	return path;
+}
+
+static int read_state_attr(int state, const char *attr, char *buf, int len)
+{
+	FILE *fp = fopen(state_path(state, attr), "r");
+
+	if (!fp)
+		return -errno;
+
+	if (!fgets(buf, len, fp)) {
+		fclose(fp);
+		return -EIO;
+	}
+	fclose(fp);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static unsigned long long read_state_ull(int state, const char *attr)
+{
+	char buf[32];
+
+	if (read_state_attr(state, attr, buf, sizeof(buf)))
+		return 0;
+
+	return strtoull(buf, NULL, 10);
+}
+
+static void write_state_disable(int state, int disable)
+{
+	FILE *fp = fopen(state_path(state, "disable"), "w");
+
+	if (!fp)
+		err(1, "%s", state_path(state, "disable"));
+
+	fprintf(fp, "%d\n", disable);
+	if (fclose(fp))
+		err(1, "%s", state_path(state, "disable"));
+}
+
+static void restore_states(void)
+{
+	int i;
+
+	for (i = 0; i < nr_states; i++)
+		write_state_disable(i, saved_disable[i]);
+}
+
+static void signal_handler(int sig)
+{
+	restore_states();
+	_exit(1);
+}
+
+static void probe_states(void)
+{
+	char buf[32];
+
+	for (nr_states = 0; nr_states < MAX_STATES; nr_states++) {
+		if (read_state_attr(nr_states, "name", state_name[nr_states],
+				    sizeof(state_name[0])))
+			break;
+
+		if (read_state_attr(nr_states, "disable", buf, sizeof(buf)))
+			break;
+
+		saved_disable[nr_states] = atoi(buf);
+	}
+
+	if (!nr_states)
+		errx(1, "no cpuidle states found for CPU %d", cpu);
+}
+
+static long long timespec_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static void measure_state(int state)
+{
+	unsigned long long usage_before, usage_after;
+	long long min = LLONG_MAX, max = 0, sum = 0;
+	struct timespec next, now;
+	long long lat;
+	int i;
+
+	for (i = 0; i < nr_states; i++)
+		write_state_disable(i, i != state);
+
+	usage_before = read_state_ull(state, "usage");
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (i = 0; i < loops; i++) {
+		next.tv_nsec += interval_us * 1000;
+		while (next.tv_nsec >= NSEC_PER_SEC) {
+			next.tv_nsec -= NSEC_PER_SEC;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		lat = timespec_ns(&now) - timespec_ns(&next);
+		if (lat < min)
+			min = lat;
+		if (lat > max)
+			max = lat;
+		sum += lat;
+	}
+
+	usage_after = read_state_ull(state, "usage");
+
+	printf("state%d %-10s %10lld %10lld %10lld %10llu\n", state,
+	       state_name[state], min / 1000, sum / loops / 1000, max / 1000,
+	       usage_after - usage_before);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{ "cpu",	required_argument,	0, 'c' },
+		{ "loops",	required_argument,	0, 'l' },
+		{ "interval",	required_argument,	0, 'i' },
+		{ "help",	no_argument,		0, 'h' },
+		{ 0,		0,			0, 0 }
+	};
+	struct sched_param param = { .sched_priority = 1 };
+	cpu_set_t set;
+	int opt, i;
+
+	while ((opt = getopt_long(argc, argv, "c:l:i:h", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'i':
+			interval_us = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (loops <= 0 || interval_us <= 0)
+		usage(argv[0]);
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		err(1, "sched_setaffinity CPU %d", cpu);
+
+	/* Run at RT priority so that the wakeup is not delayed by other tasks. */
+	if (sched_setscheduler(0, SCHED_FIFO, &param))
+		warn("sched_setscheduler, latencies may include scheduling delays");
+
+	probe_states();
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	printf("CPU %d, %d wakeups every %ld us per state, latencies in us\n",
+	       cpu, loops, interval_us);
+	printf("%-17s %10s %10s %10s %10s\n", "state", "min", "avg", "max",
+	       "usage");
+
+	for (i = 0; i < nr_states; i++)
+		measure_state(i);
+
+	restore_states();
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Create or remove the null_blk device used by run.sh.
+
+CFG=/sys/kernel/config/nullb/perf
+
+profile()
+{
+	case "$1" in
+	nvme-tlc)
+		echo "latency_model=1 completion_nsec=80000 latency_sigma=300"
+		echo "latency_tail_nsec=2000000 latency_tail_ppm=200 mbps=3000"
+		;;
+	nvme-slc)
+		echo "latency_model=1 completion_nsec=20000 latency_sigma=200"
+		echo "latency_tail_nsec=500000 latency_tail_ppm=50"
+		;;
+	fixed)
+		echo "latency_model=0 completion_nsec=10000"
+		;;
+	*)
+		echo "unknown profile $1" >&2
+		exit 1
+		;;
+	esac
+}
+
+up()
+{
+	local attrs sq
+
+	attrs=$(profile "${1:-nvme-tlc}") || exit 1
+
+	# leave room for the two poll queues
+	sq=$(nproc)
+	[ "$sq" -gt 2 ] && sq=$((sq - 2))
+
+	modprobe null_blk nr_devices=0 || exit 1
+	mkdir "$CFG" || exit 1
+
+	for a in irqmode=2 queue_mode=2 blocksize=4096 size=16384 \
+		 hw_queue_depth=1023 submit_queues=$sq poll_queues=2 \
+		 $attrs; do
+		echo "${a#*=}" > "$CFG/${a%%=*}" || exit 1
+	done
+	echo 1 > "$CFG/power" || exit 1
+
+	echo "/dev/nullb$(cat $CFG/index)"
+}
+
+down()
+{
+	[ -d "$CFG" ] || return 0
+	echo 0 > "$CFG/power"
+	rmdir "$CFG"
+}
+
+case "$1" in
+up)	up "$2" ;;
+down)	down ;;
+*)	echo "usage: $0 up [nvme-tlc|nvme-slc|fixed] | down" >&2; exit 1 ;;
+esac
@@ -0,0 +1,21 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Run every job in jobs/ against an NVMe namespace and save the json output.
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <device> [result dir]" >&2
+	exit 1
+fi
+
+dir=$(dirname "$0")
+out=${2:-results-$(uname -r)-$(date +%Y%m%d-%H%M%S)}
+mkdir -p "$out" || exit 1
+
+for job in "$dir"/jobs/*.fio; do
+	name=$(basename "$job" .fio)
+	echo "$name"
+	DEV="$1" NJOBS=${NJOBS:-$(nproc)} \
+		fio --output-format=json --output="$out/$name.json" "$job" ||
+		echo "$name failed" >&2
+done
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure how long a CPU takes to ramp up to its full frequency when it
+ * goes from idle to busy, under the current cpufreq driver and governor.
+ *
+ * The effective frequency is derived from APERF/MPERF, read through
+ * /dev/cpu/N/msr. Run it once with amd-pstate and once with acpi-cpufreq,
+ * using the same governor, to compare the two drivers.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MSR_IA32_MPERF		0xe7
+#define MSR_IA32_APERF		0xe8
+
+#define SAMPLE_NS		100000ULL	/* APERF/MPERF window */
+#define RAMP_TIMEOUT_NS		500000000ULL
+
+static int msr_fd;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rdmsr(uint32_t msr)
+{
+	uint64_t val;
+
+	if (pread(msr_fd, &val, sizeof(val), msr) != sizeof(val)) {
+		perror("pread msr");
+		exit(1);
+	}
+
+	return val;
+}
+
+/* APERF/MPERF ratio, in percent of the P0 frequency, over one window */
+static unsigned int sample_ratio(void)
+{
+	uint64_t aperf, mperf, start = now_ns();
+
+	aperf = rdmsr(MSR_IA32_APERF);
+	mperf = rdmsr(MSR_IA32_MPERF);
+
+	while (now_ns() - start < SAMPLE_NS)
+		;
+
+	aperf = rdmsr(MSR_IA32_APERF) - aperf;
+	mperf = rdmsr(MSR_IA32_MPERF) - mperf;
+
+	return mperf ? aperf * 100 / mperf : 0;
+}
+
+static void read_sysfs(int cpu, const char *name, char *buf, size_t len)
+{
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/%s", cpu, name);
+	f = fopen(path, "r");
+	if (!f || !fgets(buf, len, f))
+		snprintf(buf, len, "unknown\n");
+	if (f)
+		fclose(f);
+	buf[strcspn(buf, "\n")] = 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c cpu] [-n iterations] [-i idle_ms] [-t threshold_pct]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 20, idle_ms = 200, threshold = 90;
+	unsigned int steady = 0, ratio, i, done = 0;
+	char path[64], driver[64], governor[64];
+	uint64_t *lat, start;
+	cpu_set_t set;
+	int cpu = 1, opt;
+
+	while ((opt = getopt(argc, argv, "c:n:i:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'i':
+			idle_ms = atoi(optarg);
+			break;
+		case 't':
+			threshold = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!iterations || !threshold || threshold > 100)
+		usage(argv[0]);
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+	msr_fd = open(path, O_RDONLY);
+	if (msr_fd < 0) {
+		fprintf(stderr, "%s: %s (is the msr module loaded?)\n",
+			path, strerror(errno));
+		return 1;
+	}
+
+	lat = calloc(iterations, sizeof(*lat));
+	if (!lat)
+		return 1;
+
+	read_sysfs(cpu, "scaling_driver", driver, sizeof(driver));
+	read_sysfs(cpu, "scaling_governor", governor, sizeof(governor));
+
+	/* The steady state ratio is the target of every ramp */
+	start = now_ns();
+	while (now_ns() - start < 1000000000ULL) {
+		ratio = sample_ratio();
+		if (ratio > steady)
+			steady = ratio;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		usleep(idle_ms * 1000);
+
+		start = now_ns();
+		do {
+			ratio = sample_ratio();
+		} while (ratio * 100 < steady * threshold &&
+			 now_ns() - start < RAMP_TIMEOUT_NS);
+
+		if (ratio * 100 >= steady * threshold)
+			lat[done++] = now_ns() - start;
+	}
+
+	printf("driver %s governor %s cpu %d steady %u%% of P0\n",
+	       driver, governor, cpu, steady);
+
+	if (!done) {
+		printf("never reached %u%% of the steady frequency\n", threshold);
+		return 1;
+	}
+
+	qsort(lat, done, sizeof(*lat), cmp_u64);
+	printf("ramp to %u%%: min %llu us median %llu us max %llu us (%u/%u)\n",
+	       threshold, (unsigned long long)lat[0] / 1000,
+	       (unsigned long long)lat[done / 2] / 1000,
+	       (unsigned long long)lat[done - 1] / 1000, done, iterations);
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Frequency ramp latency of the current cpufreq driver, for each governor
+# that is available. Compare the output under amd-pstate and acpi-cpufreq.
+
+CPU=${CPU:-1}
+SYSFS=/sys/devices/system/cpu/cpu$CPU/cpufreq
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+if [ $UID != 0 ]; then
+	echo "Must be run as root"
+	exit $ksft_skip
+fi
+
+if [ ! -d $SYSFS ]; then
+	echo "No cpufreq policy for CPU$CPU"
+	exit $ksft_skip
+fi
+
+modprobe -q msr
+
+old_gov=$(cat $SYSFS/scaling_governor)
+ret=0
+
+for gov in schedutil ondemand; do
+	grep -qw $gov $SYSFS/scaling_available_governors || continue
+	echo $gov > $SYSFS/scaling_governor || continue
+	./ramp -c $CPU || ret=1
+done
+
+echo $old_gov > $SYSFS/scaling_governor
+
+exit $ret
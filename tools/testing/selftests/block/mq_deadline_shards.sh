@@ -0,0 +1,84 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# IOPS of a multi-queue null_blk device with no scheduler, with mq-deadline
+# and with mq-deadline in sharded mode, one fio job per CPU doing 4k random
+# reads.  Sharded mode must end up with one shard per hardware queue.
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NULLB=/sys/kernel/config/nullb
+DD_PARAM=/sys/module/mq_deadline/parameters/sharded
+NR_CPUS=$(nproc)
+RUNTIME=${RUNTIME:-10}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+if [ "$(id -u)" -ne 0 ]; then
+	skip "must be run as root"
+fi
+
+command -v fio >/dev/null || skip "fio not installed"
+modprobe null_blk nr_devices=0 >/dev/null 2>&1
+modprobe mq-deadline >/dev/null 2>&1
+[ -d "$NULLB" ] || skip "null_blk configfs interface not available"
+[ -w "$DD_PARAM" ] || skip "mq-deadline sharded mode not supported"
+
+dir=$NULLB/dd_shards
+cleanup()
+{
+	echo 0 > "$DD_PARAM"
+	[ -d "$dir" ] || return
+	echo 0 > "$dir/power"
+	rmdir "$dir"
+}
+trap cleanup EXIT
+
+mkdir "$dir" || skip "cannot create null_blk device"
+echo 1024 > "$dir/size"
+echo 0 > "$dir/irqmode"
+echo "$NR_CPUS" > "$dir/submit_queues"
+echo 1 > "$dir/power" || skip "cannot power on null_blk device"
+dev=nullb$(cat "$dir/index")
+queue=/sys/block/$dev/queue
+
+# run <scheduler> <sharded>: prints the IOPS reached
+run()
+{
+	echo "$2" > "$DD_PARAM"
+	echo none > "$queue/scheduler"
+	echo "$1" > "$queue/scheduler"
+	fio --name=randread --filename="/dev/$dev" --rw=randread --bs=4k \
+	    --direct=1 --ioengine=libaio --iodepth=32 --numjobs="$NR_CPUS" \
+	    --time_based --runtime="$RUNTIME" --group_reporting \
+	    --output-format=terse --terse-version=3 | cut -d ';' -f 8
+}
+
+none=$(run none 0)
+dd=$(run mq-deadline 0)
+dd_shards=$(run mq-deadline 1)
+shards=$(cat "$queue/iosched/nr_shards")
+nr_hw_queues=$(ls -d /sys/block/"$dev"/mq/* | wc -l)
+
+echo "hardware queues:           $nr_hw_queues"
+echo "none:                      $none IOPS"
+echo "mq-deadline:               $dd IOPS"
+echo "mq-deadline, $shards shards: $dd_shards IOPS"
+
+if [ -z "$none" ] || [ -z "$dd" ] || [ -z "$dd_shards" ]; then
+	echo "FAIL: fio did not report IOPS"
+	exit 1
+fi
+
+if [ "$nr_hw_queues" -gt 1 ] && [ "$shards" -ne "$nr_hw_queues" ]; then
+	echo "FAIL: expected one shard per hardware queue"
+	exit 1
+fi
+
+echo "PASS"
+exit 0
@@ -5,10 +5,12 @@
 #include <linux/ring_buffer.h>
 #include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <argp.h>
 #include <stdlib.h>
 #include "bench.h"
 #include "ringbuf_bench.skel.h"
+#include "ringbuf_shard_bench.skel.h"
 #include "perfbuf_bench.skel.h"
 
 static struct {
@@ -18,6 +20,8 @@ static struct {
 	int sample_rate;
 	int ringbuf_sz; /* per-ringbuf, in bytes */
 	bool ringbuf_use_output; /* use slower output API */
+	int ringbuf_shards; /* sub-rings per NUMA node */
+	int reserve_batch; /* records per bpf_ringbuf_reserve() */
 	int perfbuf_sz; /* per-CPU size, in pages */
 } args = {
 	.back2back = false,
@@ -26,6 +30,8 @@ static struct {
 	.sample_rate = 500,
 	.ringbuf_sz = 512 * 1024,
 	.ringbuf_use_output = false,
+	.ringbuf_shards = 1,
+	.reserve_batch = 1,
 	.perfbuf_sz = 128,
 };
 
@@ -35,6 +41,8 @@ enum {
 	ARG_RB_BATCH_CNT = 2002,
 	ARG_RB_SAMPLED = 2003,
 	ARG_RB_SAMPLE_RATE = 2004,
+	ARG_RB_SHARDS = 2005,
+	ARG_RB_RESERVE_BATCH = 2006,
 };
 
 static const struct argp_option opts[] = {
@@ -43,6 +51,8 @@ static const struct argp_option opts[] = {
 	{ "rb-batch-cnt", ARG_RB_BATCH_CNT, "CNT", 0, "Set BPF-side record batch count"},
 	{ "rb-sampled", ARG_RB_SAMPLED, NULL, 0, "Notification sampling"},
 	{ "rb-sample-rate", ARG_RB_SAMPLE_RATE, "RATE", 0, "Notification sample rate"},
+	{ "rb-shards", ARG_RB_SHARDS, "CNT", 0, "Sub-rings per NUMA node (rb-sharded, 0 for a single ring)"},
+	{ "rb-reserve-batch", ARG_RB_RESERVE_BATCH, "CNT", 0, "Records per reservation (rb-sharded)"},
 	{},
 };
 
@@ -72,6 +82,20 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 			argp_usage(state);
 		}
 		break;
+	case ARG_RB_SHARDS:
+		args.ringbuf_shards = strtol(arg, NULL, 10);
+		if (args.ringbuf_shards < 0) {
+			fprintf(stderr, "Invalid sub-ring count.");
+			argp_usage(state);
+		}
+		break;
+	case ARG_RB_RESERVE_BATCH:
+		args.reserve_batch = strtol(arg, NULL, 10);
+		if (args.reserve_batch < 1 || args.reserve_batch > 255) {
+			fprintf(stderr, "Invalid reservation batch.");
+			argp_usage(state);
+		}
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -338,6 +362,151 @@ static void *ringbuf_custom_consumer(void *input)
 	return 0;
 }
 
+/* RINGBUF-SHARDED benchmark */
+static struct ringbuf_shard_ctx {
+	struct ringbuf_shard_bench *skel;
+	struct ringbuf_custom *rings;
+	int nr_rings;
+	int epoll_fd;
+	struct epoll_event event;
+} ringbuf_shard_ctx;
+
+static void ringbuf_shard_measure(struct bench_res *res)
+{
+	struct ringbuf_shard_ctx *ctx = &ringbuf_shard_ctx;
+
+	res->hits = atomic_swap(&buf_hits.value, 0);
+	res->drops = atomic_swap(&ctx->skel->bss->dropped, 0);
+}
+
+static int ringbuf_shard_create_map(void)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_RINGBUF;
+	attr.max_entries = args.ringbuf_sz;
+	attr.map_extra = args.ringbuf_shards;
+
+	return syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+}
+
+/* Sub-ring i is at page offset i * ring_pages, map them until the kernel
+ * says there are no more.
+ */
+static void ringbuf_shard_map_rings(int map_fd)
+{
+	struct ringbuf_shard_ctx *ctx = &ringbuf_shard_ctx;
+	const size_t page_size = getpagesize();
+	size_t ring_sz = 2 * page_size + 2 * args.ringbuf_sz;
+	struct ringbuf_custom *r;
+	void *tmp;
+
+	while (true) {
+		tmp = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   map_fd, ctx->nr_rings * ring_sz);
+		if (tmp == MAP_FAILED) {
+			if (errno == EINVAL && ctx->nr_rings)
+				break;
+			fprintf(stderr, "failed to mmap consumer page: %d\n", -errno);
+			exit(1);
+		}
+
+		ctx->rings = realloc(ctx->rings,
+				     (ctx->nr_rings + 1) * sizeof(*ctx->rings));
+		if (!ctx->rings) {
+			fprintf(stderr, "failed to allocate rings\n");
+			exit(1);
+		}
+		r = &ctx->rings[ctx->nr_rings];
+		r->map_fd = map_fd;
+		r->mask = args.ringbuf_sz - 1;
+		r->consumer_pos = tmp;
+
+		tmp = mmap(NULL, page_size + 2 * args.ringbuf_sz, PROT_READ,
+			   MAP_SHARED, map_fd, ctx->nr_rings * ring_sz + page_size);
+		if (tmp == MAP_FAILED) {
+			fprintf(stderr, "failed to mmap data pages: %d\n", -errno);
+			exit(1);
+		}
+		r->producer_pos = tmp;
+		r->data = tmp + page_size;
+		ctx->nr_rings++;
+	}
+}
+
+static void ringbuf_shard_setup()
+{
+	struct ringbuf_shard_ctx *ctx = &ringbuf_shard_ctx;
+	struct bpf_link *link;
+	int map_fd, err;
+
+	setup_libbpf();
+
+	ctx->skel = ringbuf_shard_bench__open();
+	if (!ctx->skel) {
+		fprintf(stderr, "failed to open skeleton\n");
+		exit(1);
+	}
+
+	ctx->skel->rodata->batch_cnt = args.batch_cnt;
+	ctx->skel->rodata->reserve_batch = args.reserve_batch;
+
+	map_fd = ringbuf_shard_create_map();
+	if (map_fd < 0) {
+		fprintf(stderr, "failed to create ringbuf: %d\n", -errno);
+		exit(1);
+	}
+	if (bpf_map__reuse_fd(ctx->skel->maps.ringbuf, map_fd)) {
+		fprintf(stderr, "failed to reuse ringbuf fd\n");
+		exit(1);
+	}
+
+	if (ringbuf_shard_bench__load(ctx->skel)) {
+		fprintf(stderr, "failed to load skeleton\n");
+		exit(1);
+	}
+
+	ringbuf_shard_map_rings(map_fd);
+
+	/* a single epoll entry covers all the sub-rings */
+	ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->epoll_fd < 0) {
+		fprintf(stderr, "failed to create epoll fd: %d\n", -errno);
+		exit(1);
+	}
+	ctx->event.events = EPOLLIN;
+	err = epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, map_fd, &ctx->event);
+	if (err < 0) {
+		fprintf(stderr, "failed to epoll add ringbuf: %d\n", -errno);
+		exit(1);
+	}
+
+	link = bpf_program__attach(ctx->skel->progs.bench_ringbuf);
+	if (IS_ERR(link)) {
+		fprintf(stderr, "failed to attach program\n");
+		exit(1);
+	}
+}
+
+static void *ringbuf_shard_consumer(void *input)
+{
+	struct ringbuf_shard_ctx *ctx = &ringbuf_shard_ctx;
+	int i, cnt;
+
+	do {
+		if (args.back2back)
+			bufs_trigger_batch();
+		cnt = epoll_wait(ctx->epoll_fd, &ctx->event, 1, -1);
+		if (cnt <= 0)
+			continue;
+		for (i = 0; i < ctx->nr_rings; i++)
+			ringbuf_custom_process_ring(&ctx->rings[i]);
+	} while (cnt >= 0);
+	fprintf(stderr, "ringbuf polling failed!\n");
+	return 0;
+}
+
 /* PERFBUF-LIBBPF benchmark */
 static struct perfbuf_libbpf_ctx {
 	struct perfbuf_bench *skel;
@@ -542,6 +711,17 @@ const struct bench bench_rb_custom = {
 	.report_final = hits_drops_report_final,
 };
 
+const struct bench bench_rb_sharded = {
+	.name = "rb-sharded",
+	.validate = bufs_validate,
+	.setup = ringbuf_shard_setup,
+	.producer_thread = bufs_sample_producer,
+	.consumer_thread = ringbuf_shard_consumer,
+	.measure = ringbuf_shard_measure,
+	.report_progress = hits_drops_report_progress,
+	.report_final = hits_drops_report_final,
+};
+
 const struct bench bench_pb_libbpf = {
 	.name = "pb-libbpf",
 	.validate = bufs_validate,
@@ -73,3 +73,15 @@ for b in 1 2 3 4 8 12 16 20 24 28 32 36 40 44 48 52; do
 	summarize "rb-libbpf nr_prod $b" "$($RUN_BENCH -p$b --rb-batch-cnt 50 rb-libbpf)"
 done
 
+
+header "Ringbuf, multi-producer contention, records per reservation"
+for b in 1 2 4 8 16 32; do
+	summarize "rb-sharded batch $b" "$($RUN_BENCH -p16 --rb-batch-cnt 64 --rb-shards 0 --rb-reserve-batch $b rb-sharded)"
+done
+
+header "Ringbuf, multi-producer contention, sub-rings per NUMA node"
+for s in 0 1 2 4 8; do
+	for b in 1 2 4 8 12 16 20 24 28 32 36 40 44 48 52; do
+		summarize "rb-sharded shards $s nr_prod $b" "$($RUN_BENCH -p$b --rb-batch-cnt 50 --rb-shards $s rb-sharded)"
+	done
+done
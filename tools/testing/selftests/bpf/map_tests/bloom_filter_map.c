@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF_MAP_TYPE_BLOOM_FILTER: no false negatives, a false positive rate close
+ * to 2^-nr_hashes at max_entries values, and the rate of pushes and peeks
+ * through the syscall.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include <test_maps.h>
+
+#define NR_VALUES	100000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bloom_create(__u32 value_size, __u32 max_entries, __u64 map_extra)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_BLOOM_FILTER;
+	attr.value_size = value_size;
+	attr.max_entries = max_entries;
+	attr.map_extra = map_extra;
+
+	return syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+}
+
+static void test_bloom_bad_attr(void)
+{
+	int fd;
+
+	fd = bloom_create(sizeof(__u64), 0, 0);
+	CHECK(fd >= 0, "bloom_create", "max_entries 0 accepted\n");
+	fd = bloom_create(sizeof(__u64), 1, 0x100);
+	CHECK(fd >= 0, "bloom_create", "unknown map_extra bits accepted\n");
+	fd = bloom_create(sizeof(__u64), 1,
+			  3ULL << BPF_BLOOM_HASH_FN_SHIFT);
+	CHECK(fd >= 0, "bloom_create", "unknown hash function accepted\n");
+}
+
+static void test_bloom_fp_rate(const char *name, __u64 map_extra,
+			       double max_rate)
+{
+	__u64 *values, val;
+	double t, push_time, peek_time;
+	int fd, i, err, fp = 0;
+
+	values = malloc(NR_VALUES * sizeof(*values));
+	CHECK(!values, "malloc", "error: %s\n", strerror(errno));
+	for (i = 0; i < NR_VALUES; i++)
+		values[i] = ((__u64)rand() << 32) ^ rand();
+
+	fd = bloom_create(sizeof(__u64), NR_VALUES, map_extra);
+	CHECK(fd < 0, "bloom_create", "%s: error: %s\n", name, strerror(errno));
+
+	t = now();
+	for (i = 0; i < NR_VALUES; i++) {
+		err = bpf_map_update_elem(fd, NULL, &values[i], BPF_ANY);
+		CHECK(err, "bloom push", "%s: error: %s\n", name,
+		      strerror(errno));
+	}
+	push_time = now() - t;
+
+	t = now();
+	for (i = 0; i < NR_VALUES; i++) {
+		err = bpf_map_lookup_elem(fd, NULL, &values[i]);
+		CHECK(err, "bloom peek", "%s: false negative for %llx\n", name,
+		      (unsigned long long)values[i]);
+	}
+	peek_time = now() - t;
+
+	/* Values that were not pushed, barring a 2^-64 collision */
+	for (i = 0; i < NR_VALUES; i++) {
+		val = ~values[i];
+		if (!bpf_map_lookup_elem(fd, NULL, &val))
+			fp++;
+		else
+			CHECK(errno != ENOENT, "bloom peek", "%s: error: %s\n",
+			      name, strerror(errno));
+	}
+
+	printf("%s: false positive rate %.3f%%, %.0f pushes/s, %.0f peeks/s\n",
+	       name, 100.0 * fp / NR_VALUES, NR_VALUES / push_time,
+	       NR_VALUES / peek_time);
+	CHECK((double)fp / NR_VALUES > max_rate, "bloom fp rate",
+	      "%s: %d false positives out of %d\n", name, fp, NR_VALUES);
+
+	close(fd);
+	free(values);
+}
+
+void test_bloom_filter_map(void)
+{
+	srand(time(NULL));
+
+	test_bloom_bad_attr();
+	/* 2^-5 = 3.1% expected */
+	test_bloom_fp_rate("jhash, 5 hashes", 0, 0.05);
+	test_bloom_fp_rate("xxhash, 5 hashes",
+			   (__u64)BPF_BLOOM_HASH_XXHASH << BPF_BLOOM_HASH_FN_SHIFT,
+			   0.05);
+	/* 2^-10 = 0.1% expected */
+	test_bloom_fp_rate("jhash, 10 hashes", 10, 0.005);
+
+	printf("%s:PASS\n", __func__);
+}
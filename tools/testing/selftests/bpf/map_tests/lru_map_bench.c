@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Rate of concurrent updates to a common LRU and to a BPF_F_NO_COMMON_LRU
+ * map, whose per CPU lists are never rebalanced between CPUs.  Each thread
+ * is pinned to a CPU and updates its own range of keys, the way RSS steers
+ * a flow to one CPU, in a map twice too small for all of them.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include <test_maps.h>
+
+#define KEYS_PER_CPU	4096
+#define UPDATES		200000
+
+struct lru_worker {
+	pthread_t thread;
+	int map_fd;
+	int cpu;
+};
+
+static void *lru_worker_fn(void *arg)
+{
+	struct lru_worker *w = arg;
+	__u64 key, val = 0;
+	cpu_set_t cpus;
+	int i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(w->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	for (i = 0; i < UPDATES; i++) {
+		key = (__u64)w->cpu * KEYS_PER_CPU + i % KEYS_PER_CPU;
+		/* -ENOMEM is fine, the map is meant to be too small */
+		bpf_map_update_elem(w->map_fd, &key, &val, BPF_ANY);
+	}
+	return NULL;
+}
+
+static void lru_bench(const char *name, __u32 map_flags, int nr_cpus)
+{
+	struct lru_worker *workers;
+	struct timespec start, end;
+	double secs;
+	int fd, i;
+
+	fd = bpf_create_map(BPF_MAP_TYPE_LRU_HASH, sizeof(__u64),
+			    sizeof(__u64), nr_cpus * KEYS_PER_CPU / 2,
+			    map_flags);
+	CHECK(fd < 0, "bpf_create_map", "%s: error: %s\n", name,
+	      strerror(errno));
+
+	workers = calloc(nr_cpus, sizeof(*workers));
+	CHECK(!workers, "calloc", "error: %s\n", strerror(errno));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_cpus; i++) {
+		workers[i].map_fd = fd;
+		workers[i].cpu = i;
+		pthread_create(&workers[i].thread, NULL, lru_worker_fn,
+			       &workers[i]);
+	}
+	for (i = 0; i < nr_cpus; i++)
+		pthread_join(workers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%s: %d cpus, %.0f updates/s\n", name, nr_cpus,
+	       (double)nr_cpus * UPDATES / secs);
+
+	free(workers);
+	close(fd);
+}
+
+void test_lru_map_bench(void)
+{
+	int nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	lru_bench("common lru", 0, nr_cpus);
+	lru_bench("per cpu lru", BPF_F_NO_COMMON_LRU, nr_cpus);
+
+	printf("%s:PASS\n", __func__);
+}
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <linux/bpf.h>
+#include <stdint.h>
+#include <bpf/bpf_helpers.h>
+
+char _license[] SEC("license") = "GPL";
+
+/* created by the benchmark, to pass map_extra */
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+} ringbuf SEC(".maps");
+
+const volatile int batch_cnt = 0;
+/* records per bpf_ringbuf_reserve() */
+const volatile int reserve_batch = 1;
+
+/* 8 byte sample + 8 byte record header */
+#define SAMPLE_STRIDE 16
+
+long sample_val = 42;
+long dropped __attribute__((aligned(128))) = 0;
+
+SEC("fentry/__x64_sys_getpgid")
+int bench_ringbuf(void *ctx)
+{
+	long *sample;
+	int i, j;
+
+	for (i = 0; i < batch_cnt; i += reserve_batch) {
+		sample = bpf_ringbuf_reserve(&ringbuf,
+					     reserve_batch * SAMPLE_STRIDE -
+					     BPF_RINGBUF_HDR_SZ,
+					     BPF_RB_BATCH(reserve_batch));
+		if (!sample) {
+			__sync_add_and_fetch(&dropped, reserve_batch);
+			continue;
+		}
+
+		for (j = 0; j < reserve_batch; j++)
+			sample[j * SAMPLE_STRIDE / sizeof(*sample)] = sample_val;
+		bpf_ringbuf_submit(sample, 0);
+	}
+
+	return 0;
+}
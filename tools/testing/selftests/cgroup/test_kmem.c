@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -13,6 +14,7 @@
 #include <errno.h>
 #include <sys/sysinfo.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "../kselftest.h"
 #include "cgroup_util.h"
@@ -20,11 +22,12 @@
 
 /*
  * Memory cgroup charging and vmstat data aggregation is performed using
- * percpu batches 32 pages big (look at MEMCG_CHARGE_BATCH). So the maximum
- * discrepancy between charge and vmstat entries is number of cpus multiplied
- * by 32 pages multiplied by 2.
+ * percpu batches 32 pages big (look at MEMCG_CHARGE_BATCH). The charge
+ * stock caches a batch for each of up to 7 cgroups (NR_MEMCG_STOCK), so
+ * the maximum discrepancy between charge and vmstat entries is number of
+ * cpus multiplied by 32 pages multiplied by 8.
  */
-#define MAX_VMSTAT_ERROR (4096 * 32 * 2 * get_nprocs())
+#define MAX_VMSTAT_ERROR (4096 * 32 * 8 * get_nprocs())
 
 
 static int alloc_dcache(const char *cgroup, void *arg)
@@ -207,6 +210,131 @@ cleanup:
 	return ret;
 }
 
+#define MANY_CGROUPS_LOOPS 100000
+
+static int alloc_small_objects(const char *cgroup, void *arg)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long i;
+	struct stat st;
+	char buf[128];
+	char *p;
+
+	for (i = 0; i < MANY_CGROUPS_LOOPS; i++) {
+		p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return -1;
+		*p = 1;
+		munmap(p, page_size);
+
+		snprintf(buf, sizeof(buf), "/something-non-existent-%lu-%d",
+			 i, getpid());
+		stat(buf, &st);
+	}
+
+	return 0;
+}
+
+/*
+ * The test charges and uncharges single pages and small slab objects at
+ * a high rate from many cgroups at once, more cgroups than there are cpus,
+ * so that each cpu's charge stock serves several of them. It reports the
+ * time per operation and checks the sanity of numbers on the parent level
+ * like test_kmem_memcg_deletion does.
+ */
+static int test_kmem_many_cgroups(const char *root)
+{
+	long current, slab, anon, file, kernel_stack, percpu, sum;
+	int nr_cgroups = 4 * get_nprocs();
+	struct timespec start, end;
+	int ret = KSFT_FAIL;
+	char *parent, *child;
+	int i, status, nr_running = 0;
+	long long nsec;
+
+	parent = cg_name(root, "kmem_many_cgroups_test");
+	if (!parent)
+		goto cleanup;
+
+	if (cg_create(parent))
+		goto cleanup;
+
+	if (cg_write(parent, "cgroup.subtree_control", "+memory"))
+		goto cleanup;
+
+	for (i = 0; i < nr_cgroups; i++) {
+		child = cg_name_indexed(parent, "child", i);
+		if (!child)
+			goto cleanup;
+		if (cg_create(child)) {
+			free(child);
+			goto cleanup;
+		}
+		free(child);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_cgroups; i++) {
+		child = cg_name_indexed(parent, "child", i);
+		if (!child)
+			break;
+		if (cg_run_nowait(child, alloc_small_objects, NULL) > 0)
+			nr_running++;
+		free(child);
+	}
+
+	while (nr_running) {
+		if (wait(&status) < 0)
+			break;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			goto cleanup;
+		nr_running--;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (nr_running || i < nr_cgroups)
+		goto cleanup;
+
+	nsec = (end.tv_sec - start.tv_sec) * 1000000000LL +
+	       (end.tv_nsec - start.tv_nsec);
+	ksft_print_msg("%d cgroups: %lld cpu-ns per page + dentry\n", nr_cgroups,
+		       nsec / ((long long)MANY_CGROUPS_LOOPS * nr_cgroups /
+			       get_nprocs()));
+
+	current = cg_read_long(parent, "memory.current");
+	slab = cg_read_key_long(parent, "memory.stat", "slab ");
+	anon = cg_read_key_long(parent, "memory.stat", "anon ");
+	file = cg_read_key_long(parent, "memory.stat", "file ");
+	kernel_stack = cg_read_key_long(parent, "memory.stat", "kernel_stack ");
+	percpu = cg_read_key_long(parent, "memory.stat", "percpu ");
+	if (current < 0 || slab < 0 || anon < 0 || file < 0 ||
+	    kernel_stack < 0 || percpu < 0)
+		goto cleanup;
+
+	sum = slab + anon + file + kernel_stack + percpu;
+	if (abs(sum - current) < MAX_VMSTAT_ERROR) {
+		ret = KSFT_PASS;
+	} else {
+		printf("memory.current = %ld\n", current);
+		printf("slab + anon + file + kernel_stack + percpu = %ld\n",
+		       sum);
+	}
+
+cleanup:
+	for (i = 0; parent && i < nr_cgroups; i++) {
+		child = cg_name_indexed(parent, "child", i);
+		if (!child)
+			break;
+		cg_destroy(child);
+		free(child);
+	}
+	cg_destroy(parent);
+	free(parent);
+
+	return ret;
+}
+
 /*
  * The test reads the entire /proc/kpagecgroup. If the operation went
  * successfully (and the kernel didn't panic), the test is treated as passed.
@@ -405,6 +533,7 @@ struct kmem_test {
 } tests[] = {
 	T(test_kmem_basic),
 	T(test_kmem_memcg_deletion),
+	T(test_kmem_many_cgroups),
 	T(test_kmem_proc_kpagecgroup),
 	T(test_kmem_kernel_stacks),
 	T(test_kmem_dead_cgroups),
@@ -0,0 +1,510 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KVM dirty logging performance test
+ *
+ * Based on demand_paging_test.c
+ *
+ * Each vCPU touches every page of its own slice of a test memslot, once to
+ * populate it and then once per iteration with dirty logging enabled.  The
+ * host measures how long the vCPUs take for each pass and how long it takes
+ * to enable dirty logging, to collect the log with KVM_GET_DIRTY_LOG, to
+ * clear it with KVM_CLEAR_DIRTY_LOG and to disable dirty logging again.
+ */
+
+#define _GNU_SOURCE /* for program_invocation_name */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+
+#include "test_util.h"
+#include "kvm_util.h"
+#include "processor.h"
+
+/* The memory slot index to track dirty pages */
+#define TEST_MEM_SLOT_INDEX		1
+
+/* Default guest test virtual memory offset */
+#define DEFAULT_GUEST_TEST_MEM		0xc0000000
+
+#define DEFAULT_GUEST_TEST_MEM_SIZE	(1 << 30) /* 1G */
+
+#define DEFAULT_ITERATIONS		3
+
+/* Pages skipped between two accesses with the strided pattern */
+#define ACCESS_STRIDE_PAGES		67
+
+#define MAX_VCPUS			512
+
+enum access_pattern {
+	ACCESS_SEQUENTIAL,
+	ACCESS_RANDOM,
+	ACCESS_STRIDED,
+	NR_ACCESS_PATTERNS,
+};
+
+static const char * const access_pattern_name[NR_ACCESS_PATTERNS] = {
+	[ACCESS_SEQUENTIAL]	= "seq",
+	[ACCESS_RANDOM]		= "random",
+	[ACCESS_STRIDED]	= "stride",
+};
+
+/*
+ * Guest/Host shared variables. Ensure addr_gva2hva() and/or
+ * sync_global_to/from_guest() are used when accessing from
+ * the host. READ/WRITE_ONCE() should also be used with anything
+ * that may change.
+ */
+static uint64_t guest_page_size;
+static uint64_t access_pattern;
+static uint64_t write_percent = 100;
+
+/* Current pass as seen by the guest, 0 is the populate pass */
+static int iteration;
+
+/* Pass the vCPU threads should run next, only used by the host */
+static int host_iteration = -1;
+static bool host_quit;
+
+struct vcpu_args {
+	uint64_t gva;
+	uint64_t pages;
+
+	/* Only used by the host userspace part of the vCPU thread */
+	int vcpu_id;
+	struct kvm_vm *vm;
+	int last_iteration;
+	uint64_t pass_ns;
+};
+
+static struct vcpu_args vcpu_args[MAX_VCPUS];
+
+static uint64_t guest_rand(uint64_t *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void guest_code(uint32_t vcpu_id)
+{
+	struct vcpu_args *args = &vcpu_args[vcpu_id];
+	uint64_t rand_state = vcpu_id + 1;
+	uint64_t gva, pages, page, i;
+	bool write;
+
+	/* Make sure vCPU args data structure is not corrupt. */
+	GUEST_ASSERT(args->vcpu_id == vcpu_id);
+
+	gva = args->gva;
+	pages = args->pages;
+
+	for (;;) {
+		for (i = 0, page = 0; i < pages; i++) {
+			switch (access_pattern) {
+			case ACCESS_RANDOM:
+				page = guest_rand(&rand_state) % pages;
+				break;
+			case ACCESS_STRIDED:
+				page = (page + ACCESS_STRIDE_PAGES) % pages;
+				break;
+			default:
+				page = i;
+				break;
+			}
+
+			/* The populate pass always writes */
+			write = !READ_ONCE(iteration) ||
+				guest_rand(&rand_state) % 100 < write_percent;
+
+			if (write)
+				*(uint64_t *)(gva + page * guest_page_size) = i;
+			else
+				READ_ONCE(*(uint64_t *)(gva + page * guest_page_size));
+		}
+
+		GUEST_SYNC(1);
+	}
+}
+
+static void *vcpu_worker(void *data)
+{
+	struct vcpu_args *args = (struct vcpu_args *)data;
+	struct kvm_vm *vm = args->vm;
+	int vcpu_id = args->vcpu_id;
+	struct timespec start, end;
+	struct kvm_run *run;
+	int ret, current;
+
+	vcpu_args_set(vm, vcpu_id, 1, vcpu_id);
+	run = vcpu_state(vm, vcpu_id);
+
+	while (!READ_ONCE(host_quit)) {
+		current = READ_ONCE(host_iteration);
+		if (current == args->last_iteration) {
+			sched_yield();
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = _vcpu_run(vm, vcpu_id);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		TEST_ASSERT(ret == 0, "vcpu_run failed: %d\n", ret);
+		TEST_ASSERT(get_ucall(vm, vcpu_id, NULL) == UCALL_SYNC,
+			    "Invalid guest sync status: exit_reason=%s\n",
+			    exit_reason_str(run->exit_reason));
+
+		args->pass_ns = timespec_to_ns(timespec_sub(end, start));
+		WRITE_ONCE(args->last_iteration, current);
+	}
+
+	return NULL;
+}
+
+static struct kvm_vm *create_vm(enum vm_guest_mode mode, int vcpus,
+				uint64_t vcpu_memory_bytes)
+{
+	uint64_t pages = DEFAULT_GUEST_PHY_PAGES;
+	struct kvm_vm *vm;
+
+	/* Account for a few pages per-vCPU for stacks */
+	pages += DEFAULT_STACK_PGS * vcpus;
+
+	/*
+	 * Reserve twice the amount of memory needed to map the test region
+	 * and the page table / stacks region, at 4k, for page tables.
+	 */
+	pages += (2 * pages) / 512;
+	pages += ((2 * vcpus * vcpu_memory_bytes) >> 12) / 512;
+	pages = vm_adjust_num_guest_pages(mode, pages);
+
+	pr_info("Testing guest mode: %s\n", vm_guest_mode_string(mode));
+
+	vm = _vm_create(mode, pages, O_RDWR);
+	kvm_vm_elf_load(vm, program_invocation_name, 0, 0);
+#ifdef __x86_64__
+	vm_create_irqchip(vm);
+#endif
+	return vm;
+}
+
+/* Let the vCPUs run pass @i and return the slowest vCPU's time in ns */
+static uint64_t run_pass(int vcpus, int i)
+{
+	uint64_t max_ns = 0;
+	int vcpu_id;
+
+	iteration = i;
+	sync_global_to_guest(vcpu_args[0].vm, iteration);
+	WRITE_ONCE(host_iteration, i);
+
+	for (vcpu_id = 0; vcpu_id < vcpus; vcpu_id++) {
+		while (READ_ONCE(vcpu_args[vcpu_id].last_iteration) != i)
+			sched_yield();
+		max_ns = max(max_ns, vcpu_args[vcpu_id].pass_ns);
+	}
+
+	return max_ns;
+}
+
+static double pages_per_sec(uint64_t pages, uint64_t ns)
+{
+	return ns ? pages * 1000000000.0 / ns : 0;
+}
+
+static void run_test(enum vm_guest_mode mode, int vcpus,
+		     uint64_t vcpu_memory_bytes, int iterations,
+		     bool manual_protect)
+{
+	uint64_t guest_num_pages, guest_test_phys_mem, host_num_pages;
+	uint64_t pass_ns, get_ns = 0, clear_ns = 0, dirty_ns = 0;
+	struct timespec start, end, ts_diff;
+	pthread_t *vcpu_threads;
+	unsigned long *bmap;
+	struct kvm_vm *vm;
+	int vcpu_id, i;
+
+	vm = create_vm(mode, vcpus, vcpu_memory_bytes);
+
+	guest_page_size = vm_get_page_size(vm);
+	TEST_ASSERT(vcpu_memory_bytes % guest_page_size == 0,
+		    "Guest memory size is not guest page size aligned.");
+	TEST_ASSERT(vcpu_memory_bytes % getpagesize() == 0,
+		    "Guest memory size is not host page size aligned.");
+
+	guest_num_pages = (vcpus * vcpu_memory_bytes) / guest_page_size;
+	guest_num_pages = vm_adjust_num_guest_pages(mode, guest_num_pages);
+	host_num_pages = vm_num_host_pages(mode, guest_num_pages);
+
+	TEST_ASSERT(guest_num_pages < vm_get_max_gfn(vm),
+		    "Requested more guest memory than address space allows.\n"
+		    "    guest pages: %lx max gfn: %x vcpus: %d wss: %lx]\n",
+		    guest_num_pages, vm_get_max_gfn(vm), vcpus,
+		    vcpu_memory_bytes);
+
+	guest_test_phys_mem = (vm_get_max_gfn(vm) - guest_num_pages) *
+			      guest_page_size;
+	guest_test_phys_mem &= ~(getpagesize() - 1);
+#ifdef __s390x__
+	/* Align to 1M (segment size) */
+	guest_test_phys_mem &= ~((1 << 20) - 1);
+#endif
+
+	if (manual_protect) {
+		struct kvm_enable_cap cap = {};
+
+		cap.cap = KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2;
+		cap.args[0] = 1;
+		vm_enable_cap(vm, &cap);
+	}
+
+	vm_userspace_mem_region_add(vm, VM_MEM_SRC_ANONYMOUS,
+				    guest_test_phys_mem, TEST_MEM_SLOT_INDEX,
+				    guest_num_pages, 0);
+	virt_map(vm, DEFAULT_GUEST_TEST_MEM, guest_test_phys_mem,
+		 guest_num_pages, 0);
+
+	ucall_init(vm, NULL);
+
+	bmap = bitmap_alloc(host_num_pages);
+	TEST_ASSERT(bmap, "Failed to allocate dirty bitmap");
+
+	vcpu_threads = malloc(vcpus * sizeof(*vcpu_threads));
+	TEST_ASSERT(vcpu_threads, "Memory allocation failed");
+
+	for (vcpu_id = 0; vcpu_id < vcpus; vcpu_id++) {
+		vm_vcpu_add_default(vm, vcpu_id, guest_code);
+#ifdef __x86_64__
+		vcpu_set_cpuid(vm, vcpu_id, kvm_get_supported_cpuid());
+#endif
+
+		vcpu_args[vcpu_id].vm = vm;
+		vcpu_args[vcpu_id].vcpu_id = vcpu_id;
+		vcpu_args[vcpu_id].gva = DEFAULT_GUEST_TEST_MEM +
+					 (vcpu_id * vcpu_memory_bytes);
+		vcpu_args[vcpu_id].pages = vcpu_memory_bytes / guest_page_size;
+		vcpu_args[vcpu_id].last_iteration = -1;
+	}
+
+	/* Export the shared variables to the guest */
+	sync_global_to_guest(vm, guest_page_size);
+	sync_global_to_guest(vm, access_pattern);
+	sync_global_to_guest(vm, write_percent);
+	sync_global_to_guest(vm, vcpu_args);
+
+	/* The vCPUs wait until the host asks for the populate pass */
+	host_iteration = -1;
+	host_quit = false;
+	for (vcpu_id = 0; vcpu_id < vcpus; vcpu_id++) {
+		pthread_create(&vcpu_threads[vcpu_id], NULL, vcpu_worker,
+			       &vcpu_args[vcpu_id]);
+	}
+
+	pr_info("%d vCPUs, %lu MiB each, %s access, %lu%% writes\n", vcpus,
+		vcpu_memory_bytes >> 20, access_pattern_name[access_pattern],
+		write_percent);
+
+	pass_ns = run_pass(vcpus, 0);
+	pr_info("Populate memory: %lu.%.9lus\n", pass_ns / 1000000000,
+		pass_ns % 1000000000);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	vm_mem_region_set_flags(vm, TEST_MEM_SLOT_INDEX,
+				KVM_MEM_LOG_DIRTY_PAGES);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ts_diff = timespec_sub(end, start);
+	pr_info("Enable dirty logging: %ld.%.9lds\n",
+		ts_diff.tv_sec, ts_diff.tv_nsec);
+
+	for (i = 1; i <= iterations; i++) {
+		pass_ns = run_pass(vcpus, i);
+		dirty_ns += pass_ns;
+		pr_info("Iteration %d dirty memory: %lu.%.9lus (%.0f pgs/sec)\n",
+			i, pass_ns / 1000000000, pass_ns % 1000000000,
+			pages_per_sec(guest_num_pages, pass_ns));
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		kvm_vm_get_dirty_log(vm, TEST_MEM_SLOT_INDEX, bmap);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ts_diff = timespec_sub(end, start);
+		get_ns += timespec_to_ns(ts_diff);
+		pr_info("Iteration %d get dirty log: %ld.%.9lds\n",
+			i, ts_diff.tv_sec, ts_diff.tv_nsec);
+
+		if (manual_protect) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			kvm_vm_clear_dirty_log(vm, TEST_MEM_SLOT_INDEX, bmap,
+					       0, host_num_pages);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			ts_diff = timespec_sub(end, start);
+			clear_ns += timespec_to_ns(ts_diff);
+			pr_info("Iteration %d clear dirty log: %ld.%.9lds\n",
+				i, ts_diff.tv_sec, ts_diff.tv_nsec);
+		}
+	}
+
+	/* Stop the vCPU threads */
+	WRITE_ONCE(host_quit, true);
+	for (vcpu_id = 0; vcpu_id < vcpus; vcpu_id++)
+		pthread_join(vcpu_threads[vcpu_id], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	vm_mem_region_set_flags(vm, TEST_MEM_SLOT_INDEX, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ts_diff = timespec_sub(end, start);
+	pr_info("Disable dirty logging: %ld.%.9lds\n",
+		ts_diff.tv_sec, ts_diff.tv_nsec);
+
+	pr_info("Average over %d iterations: dirty memory %.0f pgs/sec, "
+		"get dirty log %lu ns", iterations,
+		pages_per_sec(guest_num_pages * iterations, dirty_ns),
+		get_ns / iterations);
+	if (manual_protect)
+		pr_info(", clear dirty log %lu ns", clear_ns / iterations);
+	pr_info("\n");
+
+	free(bmap);
+	free(vcpu_threads);
+	ucall_uninit(vm);
+	kvm_vm_free(vm);
+}
+
+struct guest_mode {
+	bool supported;
+	bool enabled;
+};
+static struct guest_mode guest_modes[NUM_VM_MODES];
+
+#define guest_mode_init(mode, supported, enabled) ({ \
+	guest_modes[mode] = (struct guest_mode){ supported, enabled }; \
+})
+
+static void help(char *name)
+{
+	int i;
+
+	puts("");
+	printf("usage: %s [-h] [-m mode] [-b memory] [-v vcpus] [-i iterations]\n"
+	       "          [-p seq|random|stride] [-w write_percent] [-c]\n", name);
+	printf(" -m: specify the guest mode ID to test\n"
+	       "     (default: test all supported modes)\n"
+	       "     This option may be used multiple times.\n"
+	       "     Guest mode IDs:\n");
+	for (i = 0; i < NUM_VM_MODES; ++i) {
+		printf("         %d:    %s%s\n", i, vm_guest_mode_string(i),
+		       guest_modes[i].supported ? " (supported)" : "");
+	}
+	printf(" -b: specify the size of the memory region which should be\n"
+	       "     dirtied by each vCPU. e.g. 10M or 3G.\n"
+	       "     Default: 1G\n");
+	printf(" -v: specify the number of vCPUs to run.\n");
+	printf(" -i: specify the number of dirty logging iterations.\n"
+	       "     Default: %d\n", DEFAULT_ITERATIONS);
+	printf(" -p: specify the order in which each vCPU touches its pages.\n"
+	       "     Default: seq\n");
+	printf(" -w: specify the percentage of accesses which are writes.\n"
+	       "     Default: 100\n");
+	printf(" -c: use KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2 and time\n"
+	       "     KVM_CLEAR_DIRTY_LOG as well.\n");
+	puts("");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t vcpu_memory_bytes = DEFAULT_GUEST_TEST_MEM_SIZE;
+	int iterations = DEFAULT_ITERATIONS;
+	bool manual_protect = false;
+	bool mode_selected = false;
+	unsigned int mode;
+	int vcpus = 1;
+	int opt, i;
+
+#ifdef __x86_64__
+	guest_mode_init(VM_MODE_PXXV48_4K, true, true);
+#endif
+#ifdef __aarch64__
+	guest_mode_init(VM_MODE_P40V48_4K, true, true);
+	guest_mode_init(VM_MODE_P40V48_64K, true, true);
+#endif
+#ifdef __s390x__
+	guest_mode_init(VM_MODE_P40V48_4K, true, true);
+#endif
+
+	while ((opt = getopt(argc, argv, "hm:b:v:i:p:w:c")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!mode_selected) {
+				for (i = 0; i < NUM_VM_MODES; ++i)
+					guest_modes[i].enabled = false;
+				mode_selected = true;
+			}
+			mode = strtoul(optarg, NULL, 10);
+			TEST_ASSERT(mode < NUM_VM_MODES,
+				    "Guest mode ID %d too big", mode);
+			guest_modes[mode].enabled = true;
+			break;
+		case 'b':
+			vcpu_memory_bytes = parse_size(optarg);
+			break;
+		case 'v':
+			vcpus = atoi(optarg);
+			TEST_ASSERT(vcpus > 0 && vcpus <= MAX_VCPUS,
+				    "Invalid number of vCPUs, must be between 1 and %d",
+				    MAX_VCPUS);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			TEST_ASSERT(iterations > 0,
+				    "Need at least one iteration");
+			break;
+		case 'p':
+			for (i = 0; i < NR_ACCESS_PATTERNS; i++) {
+				if (!strcmp(optarg, access_pattern_name[i]))
+					break;
+			}
+			TEST_ASSERT(i < NR_ACCESS_PATTERNS,
+				    "Unknown access pattern %s", optarg);
+			access_pattern = i;
+			break;
+		case 'w':
+			write_percent = strtoul(optarg, NULL, 10);
+			TEST_ASSERT(write_percent <= 100,
+				    "Write percentage must be between 0 and 100");
+			break;
+		case 'c':
+			manual_protect = true;
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			break;
+		}
+	}
+
+	if (manual_protect &&
+	    !kvm_check_cap(KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2)) {
+		print_skip("KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2 not supported");
+		return KSFT_SKIP;
+	}
+
+	for (i = 0; i < NUM_VM_MODES; ++i) {
+		if (!guest_modes[i].enabled)
+			continue;
+		TEST_ASSERT(guest_modes[i].supported,
+			    "Guest mode ID %d (%s) not supported.",
+			    i, vm_guest_mode_string(i));
+		run_test(i, vcpus, vcpu_memory_bytes, iterations,
+			 manual_protect);
+	}
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <linux/bitmap.h>
 #include <linux/bitops.h>
 
@@ -36,6 +37,9 @@
 /* Interval for each host loop (ms) */
 #define TEST_HOST_LOOP_INTERVAL		10UL
 
+/* Entries of the dirty ring of the vcpu, small enough to fill up often */
+#define TEST_DIRTY_RING_COUNT		4096U
+
 /* Dirty bitmaps are always little endian, so we need to swap on big endian */
 #if defined(__s390x__)
 # define BITOP_LE_SWIZZLE	((BITS_PER_LONG-1) & ~0x7)
@@ -137,6 +141,66 @@ static uint64_t host_track_next_count;
  */
 static unsigned long *host_bmap_track;
 
+#ifdef USE_DIRTY_RING
+/*
+ * The vcpu is parked while the ring is collected and reset, so that a
+ * write between the two can't go unreported.  That makes collection
+ * plus reset as atomic, from the guest point of view, as
+ * KVM_GET_DIRTY_LOG is.
+ */
+static bool vcpu_stop_requested;
+static sem_t sem_vcpu_stopped;
+static sem_t sem_vcpu_cont;
+static uint32_t dirty_ring_fetch_index;
+
+static void dirty_ring_vcpu_stop_point(bool full)
+{
+	if (!READ_ONCE(vcpu_stop_requested)) {
+		/* Nothing to do but wait for the host to collect */
+		if (full)
+			usleep(100);
+		return;
+	}
+	sem_post(&sem_vcpu_stopped);
+	sem_wait(&sem_vcpu_cont);
+}
+
+static void dirty_ring_collect(struct kvm_vm *vm, unsigned long *bmap)
+{
+	struct kvm_dirty_gfn *gfns = vcpu_map_dirty_ring(vm, VCPU_ID);
+	struct kvm_dirty_gfn *cur;
+	uint32_t count = 0, cleared;
+
+	WRITE_ONCE(vcpu_stop_requested, true);
+	sem_wait(&sem_vcpu_stopped);
+	WRITE_ONCE(vcpu_stop_requested, false);
+
+	bitmap_zero(bmap, host_num_pages);
+	while (true) {
+		cur = &gfns[dirty_ring_fetch_index % TEST_DIRTY_RING_COUNT];
+		if (!(__atomic_load_n(&cur->flags, __ATOMIC_ACQUIRE) &
+		      KVM_DIRTY_GFN_F_DIRTY))
+			break;
+		TEST_ASSERT(cur->slot == TEST_MEM_SLOT_INDEX,
+			    "Dirty GFN in unexpected slot %u", cur->slot);
+		TEST_ASSERT(cur->offset < host_num_pages,
+			    "Dirty GFN offset %"PRIu64" out of the slot",
+			    (uint64_t)cur->offset);
+		set_bit_le(cur->offset, bmap);
+		__atomic_store_n(&cur->flags, KVM_DIRTY_GFN_F_RESET,
+				 __ATOMIC_RELEASE);
+		dirty_ring_fetch_index++;
+		count++;
+	}
+
+	cleared = kvm_vm_reset_dirty_ring(vm);
+	TEST_ASSERT(cleared == count, "Reset %u dirty GFNs, %u collected",
+		    cleared, count);
+
+	sem_post(&sem_vcpu_cont);
+}
+#endif
+
 static void generate_random_array(uint64_t *guest_array, uint64_t size)
 {
 	uint64_t i;
@@ -162,6 +226,12 @@ static void *vcpu_worker(void *data)
 		/* Let the guest dirty the random pages */
 		ret = _vcpu_run(vm, VCPU_ID);
 		TEST_ASSERT(ret == 0, "vcpu_run failed: %d\n", ret);
+#ifdef USE_DIRTY_RING
+		if (run->exit_reason == KVM_EXIT_DIRTY_RING_FULL) {
+			dirty_ring_vcpu_stop_point(true);
+			continue;
+		}
+#endif
 		if (get_ucall(vm, VCPU_ID, NULL) == UCALL_SYNC) {
 			pages_count += TEST_PAGES_PER_LOOP;
 			generate_random_array(guest_array, TEST_PAGES_PER_LOOP);
@@ -170,6 +240,9 @@ static void *vcpu_worker(void *data)
 				  "exit_reason=%s\n",
 				  exit_reason_str(run->exit_reason));
 		}
+#ifdef USE_DIRTY_RING
+		dirty_ring_vcpu_stop_point(false);
+#endif
 	}
 
 	pr_info("Dirtied %"PRIu64" pages\n", pages_count);
@@ -256,6 +329,11 @@ static struct kvm_vm *create_vm(enum vm_guest_mode mode, uint32_t vcpuid,
 	kvm_vm_elf_load(vm, program_invocation_name, 0, 0);
 #ifdef __x86_64__
 	vm_create_irqchip(vm);
+#endif
+#ifdef USE_DIRTY_RING
+	/* The ring size can't change once the vcpu exists */
+	vm_enable_dirty_ring(vm, TEST_DIRTY_RING_COUNT *
+			     sizeof(struct kvm_dirty_gfn));
 #endif
 	vm_vcpu_add_default(vm, vcpuid, guest_code);
 	return vm;
@@ -356,13 +434,23 @@ static void run_test(enum vm_guest_mode mode, unsigned long iterations,
 	host_dirty_count = 0;
 	host_clear_count = 0;
 	host_track_next_count = 0;
+#ifdef USE_DIRTY_RING
+	vcpu_stop_requested = false;
+	dirty_ring_fetch_index = 0;
+	sem_init(&sem_vcpu_stopped, 0, 0);
+	sem_init(&sem_vcpu_cont, 0, 0);
+#endif
 
 	pthread_create(&vcpu_thread, NULL, vcpu_worker, vm);
 
 	while (iteration < iterations) {
 		/* Give the vcpu thread some time to dirty some pages */
 		usleep(interval * 1000);
+#ifdef USE_DIRTY_RING
+		dirty_ring_collect(vm, bmap);
+#else
 		kvm_vm_get_dirty_log(vm, TEST_MEM_SLOT_INDEX, bmap);
+#endif
 #ifdef USE_CLEAR_DIRTY_LOG
 		kvm_vm_clear_dirty_log(vm, TEST_MEM_SLOT_INDEX, bmap, 0,
 				       host_num_pages);
@@ -442,6 +530,14 @@ int main(int argc, char *argv[])
 				  KVM_DIRTY_LOG_INITIALLY_SET);
 #endif
 
+#ifdef USE_DIRTY_RING
+	if (kvm_check_cap(KVM_CAP_DIRTY_LOG_RING) <
+	    TEST_DIRTY_RING_COUNT * sizeof(struct kvm_dirty_gfn)) {
+		print_skip("KVM_CAP_DIRTY_LOG_RING not available");
+		exit(KSFT_SKIP);
+	}
+#endif
+
 #ifdef __x86_64__
 	guest_mode_init(VM_MODE_PXXV48_4K, true, true);
 #endif
@@ -0,0 +1,2 @@
+#define USE_DIRTY_RING
+#include "dirty_log_test.c"
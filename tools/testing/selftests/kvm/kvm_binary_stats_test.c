@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * kvm_binary_stats_test
+ *
+ * Test for KVM_CAP_BINARY_STATS_FD.
+ *
+ * Reads the statistics fd of a VM and of its vCPUs and checks that the
+ * header, the descriptors and the data block are consistent with each
+ * other, and that a single pread() returns the whole file.
+ */
+
+#define _GNU_SOURCE /* for program_invocation_short_name */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "test_util.h"
+
+#include "kvm_util.h"
+#include "asm/kvm.h"
+#include "linux/kvm.h"
+
+#define NR_VCPUS	4
+
+static void stats_test(int stats_fd, const char *kind)
+{
+	struct kvm_stats_header header;
+	struct kvm_stats_desc *desc;
+	size_t desc_size, data_size = 0, size;
+	char *buf, *id;
+	__u64 *data;
+	int i, j;
+	ssize_t ret;
+
+	ret = pread(stats_fd, &header, sizeof(header), 0);
+	TEST_ASSERT(ret == sizeof(header), "Reading %s stats header failed", kind);
+	TEST_ASSERT(header.name_size > 0 && header.num_desc > 0,
+		    "Bad %s stats header: name_size %u, num_desc %u", kind,
+		    header.name_size, header.num_desc);
+	TEST_ASSERT(header.id_offset >= sizeof(header) &&
+		    header.desc_offset >= header.id_offset + header.name_size,
+		    "Overlapping %s stats id and descriptors", kind);
+
+	desc_size = sizeof(*desc) + header.name_size;
+	TEST_ASSERT(header.data_offset >=
+		    header.desc_offset + header.num_desc * desc_size,
+		    "Overlapping %s stats descriptors and data", kind);
+
+	/* The descriptors say how large the data block is */
+	buf = malloc(header.data_offset);
+	TEST_ASSERT(buf, "Allocating %s stats descriptors failed", kind);
+	ret = pread(stats_fd, buf, header.data_offset, 0);
+	TEST_ASSERT(ret == header.data_offset,
+		    "Reading %s stats descriptors failed", kind);
+
+	id = buf + header.id_offset;
+	TEST_ASSERT(strnlen(id, header.name_size) < header.name_size &&
+		    !strncmp(id, "kvm-", 4), "Bad %s stats id", kind);
+
+	for (i = 0; i < header.num_desc; i++) {
+		desc = (void *)buf + header.desc_offset + i * desc_size;
+
+		TEST_ASSERT(strnlen(desc->name, header.name_size) > 0 &&
+			    strnlen(desc->name, header.name_size) < header.name_size,
+			    "Bad name of %s stat %d", kind, i);
+		TEST_ASSERT((desc->flags & KVM_STATS_TYPE_MASK) <= KVM_STATS_TYPE_MAX,
+			    "Bad type of %s stat %s", kind, desc->name);
+		TEST_ASSERT((desc->flags & KVM_STATS_UNIT_MASK) <= KVM_STATS_UNIT_MAX,
+			    "Bad unit of %s stat %s", kind, desc->name);
+		TEST_ASSERT((desc->flags & KVM_STATS_BASE_MASK) <= KVM_STATS_BASE_MAX,
+			    "Bad base of %s stat %s", kind, desc->name);
+		TEST_ASSERT(desc->size > 0, "Empty %s stat %s", kind, desc->name);
+		if ((desc->flags & KVM_STATS_TYPE_MASK) == KVM_STATS_TYPE_LOG_HIST ||
+		    (desc->flags & KVM_STATS_TYPE_MASK) == KVM_STATS_TYPE_LINEAR_HIST)
+			TEST_ASSERT(desc->bucket_size > 0,
+				    "No bucket size for %s histogram %s",
+				    kind, desc->name);
+		else
+			TEST_ASSERT(desc->size == 1, "Bad size of %s stat %s",
+				    kind, desc->name);
+
+		for (j = 0; j < i; j++) {
+			struct kvm_stats_desc *other;
+
+			other = (void *)buf + header.desc_offset + j * desc_size;
+			TEST_ASSERT(strcmp(desc->name, other->name),
+				    "Duplicate %s stat %s", kind, desc->name);
+		}
+
+		size = desc->offset + desc->size * sizeof(*data);
+		if (size > data_size)
+			data_size = size;
+	}
+
+	/* One pread of the whole file, twice, to check it is a snapshot */
+	for (i = 0; i < 2; i++) {
+		free(buf);
+		buf = malloc(header.data_offset + data_size + 1);
+		TEST_ASSERT(buf, "Allocating %s stats failed", kind);
+		ret = pread(stats_fd, buf, header.data_offset + data_size + 1, 0);
+		TEST_ASSERT(ret == header.data_offset + data_size,
+			    "Reading %s stats returned %zd, expected %zu",
+			    kind, ret, header.data_offset + data_size);
+		TEST_ASSERT(!memcmp(buf, &header, sizeof(header)),
+			    "%s stats header changed", kind);
+	}
+
+	/* The data block alone can be read from its offset */
+	data = malloc(data_size);
+	TEST_ASSERT(data, "Allocating %s stats data failed", kind);
+	ret = pread(stats_fd, data, data_size, header.data_offset);
+	TEST_ASSERT(ret == data_size, "Reading %s stats data failed", kind);
+
+	pr_info("%s: %s, %u stats, %zu bytes of data\n", kind, id,
+		header.num_desc, data_size);
+
+	free(data);
+	free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	struct kvm_vm *vm;
+	int i, fd;
+
+	if (!kvm_check_cap(KVM_CAP_BINARY_STATS_FD)) {
+		print_skip("KVM_CAP_BINARY_STATS_FD not available");
+		exit(KSFT_SKIP);
+	}
+
+	vm = vm_create(VM_MODE_DEFAULT, DEFAULT_GUEST_PHY_PAGES, O_RDWR);
+	for (i = 0; i < NR_VCPUS; i++)
+		vm_vcpu_add(vm, i);
+
+	fd = ioctl(vm_get_fd(vm), KVM_GET_STATS_FD, NULL);
+	TEST_ASSERT(fd >= 0, "KVM_GET_STATS_FD on the VM failed, errno: %d",
+		    errno);
+	stats_test(fd, "VM");
+	close(fd);
+
+	for (i = 0; i < NR_VCPUS; i++) {
+		fd = _vcpu_ioctl(vm, i, KVM_GET_STATS_FD, NULL);
+		TEST_ASSERT(fd >= 0,
+			    "KVM_GET_STATS_FD on vcpu %d failed, errno: %d",
+			    i, errno);
+		stats_test(fd, "vCPU");
+		close(fd);
+	}
+
+	/* The stats fd holds a reference to the VM */
+	fd = ioctl(vm_get_fd(vm), KVM_GET_STATS_FD, NULL);
+	TEST_ASSERT(fd >= 0, "KVM_GET_STATS_FD on the VM failed, errno: %d",
+		    errno);
+	kvm_vm_free(vm);
+	stats_test(fd, "VM");
+	close(fd);
+
+	return 0;
+}
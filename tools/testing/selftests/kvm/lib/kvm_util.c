@@ -85,6 +85,29 @@ int vm_enable_cap(struct kvm_vm *vm, struct kvm_enable_cap *cap)
 	return ret;
 }
 
+/* VM Enable Dirty Ring
+ *
+ * Input Args:
+ *   vm - Virtual Machine
+ *   ring_size - Size of the ring of each vcpu, in bytes
+ *
+ * Output Args: None
+ *
+ * Return: None
+ *
+ * Enables KVM_CAP_DIRTY_LOG_RING on the VM, must be called before any
+ * vcpu is added.
+ */
+void vm_enable_dirty_ring(struct kvm_vm *vm, uint32_t ring_size)
+{
+	struct kvm_enable_cap cap = { 0 };
+
+	cap.cap = KVM_CAP_DIRTY_LOG_RING;
+	cap.args[0] = ring_size;
+	vm_enable_cap(vm, &cap);
+	vm->dirty_ring_size = ring_size;
+}
+
 static void vm_open(struct kvm_vm *vm, int perm)
 {
 	vm->kvm_fd = open(KVM_DEV_PATH, perm);
@@ -304,6 +327,17 @@ void kvm_vm_clear_dirty_log(struct kvm_vm *vm, int slot, void *log,
 		    __func__, strerror(-ret));
 }
 
+uint32_t kvm_vm_reset_dirty_ring(struct kvm_vm *vm)
+{
+	int ret;
+
+	ret = ioctl(vm->fd, KVM_RESET_DIRTY_RINGS, NULL);
+	TEST_ASSERT(ret >= 0, "%s: KVM_RESET_DIRTY_RINGS failed: %s",
+		    __func__, strerror(errno));
+
+	return ret;
+}
+
 /*
  * Userspace Memory Region Find
  *
@@ -400,6 +434,7 @@ struct vcpu *vcpu_find(struct kvm_vm *vm, uint32_t vcpuid)
  * VM VCPU Remove
  *
  * Input Args:
+ *   vm - Virtual Machine
  *   vcpu - VCPU to remove
  *
  * Output Args: None
@@ -408,10 +443,17 @@ struct vcpu *vcpu_find(struct kvm_vm *vm, uint32_t vcpuid)
  *
  * Removes a vCPU from a VM and frees its resources.
  */
-static void vm_vcpu_rm(struct vcpu *vcpu)
+static void vm_vcpu_rm(struct kvm_vm *vm, struct vcpu *vcpu)
 {
 	int ret;
 
+	if (vcpu->dirty_gfns) {
+		ret = munmap(vcpu->dirty_gfns, vm->dirty_ring_size);
+		TEST_ASSERT(ret == 0, "munmap of dirty ring failed, rc: %i "
+			    "errno: %i", ret, errno);
+		vcpu->dirty_gfns = NULL;
+	}
+
 	ret = munmap(vcpu->state, sizeof(*vcpu->state));
 	TEST_ASSERT(ret == 0, "munmap of VCPU fd failed, rc: %i "
 		"errno: %i", ret, errno);
@@ -429,7 +471,7 @@ void kvm_vm_release(struct kvm_vm *vmp)
 	int ret;
 
 	list_for_each_entry_safe(vcpu, tmp, &vmp->vcpus, list)
-		vm_vcpu_rm(vcpu);
+		vm_vcpu_rm(vmp, vcpu);
 
 	ret = close(vmp->fd);
 	TEST_ASSERT(ret == 0, "Close of vm fd failed,\n"
@@ -1165,6 +1207,40 @@ struct kvm_run *vcpu_state(struct kvm_vm *vm, uint32_t vcpuid)
 	return vcpu->state;
 }
 
+/*
+ * VM VCPU Dirty Ring
+ *
+ * Input Args:
+ *   vm - Virtual Machine
+ *   vcpuid - VCPU ID
+ *
+ * Output Args: None
+ *
+ * Return:
+ *   Pointer to the array of struct kvm_dirty_gfn of the VCPU.
+ *
+ * Maps the dirty ring of the VCPU the first time it is called.
+ */
+void *vcpu_map_dirty_ring(struct kvm_vm *vm, uint32_t vcpuid)
+{
+	struct vcpu *vcpu = vcpu_find(vm, vcpuid);
+	uint32_t size = vm->dirty_ring_size;
+	void *addr;
+
+	TEST_ASSERT(vcpu != NULL, "vcpu not found, vcpuid: %u", vcpuid);
+	TEST_ASSERT(size, "dirty ring not enabled");
+
+	if (!vcpu->dirty_gfns) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    vcpu->fd, getpagesize() * KVM_DIRTY_LOG_PAGE_OFFSET);
+		TEST_ASSERT(addr != MAP_FAILED, "mmap dirty ring failed, "
+			    "errno: %i", errno);
+		vcpu->dirty_gfns = addr;
+	}
+
+	return vcpu->dirty_gfns;
+}
+
 /*
  * VM VCPU Run
  *
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * sev_launch_perf_test
+ *
+ * Time taken by each step of an SEV guest launch, per GiB of guest memory
+ *
+ * For each requested size a VM is created with a memslot of that size, the
+ * memory is touched from userspace and then registered and encrypted the
+ * way a VMM does it at launch.  LAUNCH_UPDATE_DATA dominates, optionally
+ * the pipelined variant is used instead, which also reports how the time
+ * splits between pinning, cache flushing and the PSP.
+ */
+
+#define _GNU_SOURCE /* for program_invocation_name */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "test_util.h"
+#include "kvm_util.h"
+#include "processor.h"
+
+#define SEV_DEV_PATH		"/dev/sev"
+
+#define TEST_MEM_SLOT_INDEX	1
+#define TEST_MEM_GPA		(1ULL << 32)
+
+/* LAUNCH_UPDATE_DATA takes a 32-bit length */
+#define UPDATE_DATA_MAX_LEN	(1UL << 30)
+
+enum launch_step {
+	STEP_REG_REGION,
+	STEP_LAUNCH_START,
+	STEP_UPDATE_DATA,
+	STEP_MEASURE,
+	STEP_FINISH,
+	NR_LAUNCH_STEPS,
+};
+
+static const char * const step_name[NR_LAUNCH_STEPS] = {
+	[STEP_REG_REGION]	= "REG_REGION",
+	[STEP_LAUNCH_START]	= "LAUNCH_START",
+	[STEP_UPDATE_DATA]	= "LAUNCH_UPDATE_DATA",
+	[STEP_MEASURE]		= "LAUNCH_MEASURE",
+	[STEP_FINISH]		= "LAUNCH_FINISH",
+};
+
+static int sev_fd;
+static bool pipelined;
+static uint32_t chunk_size;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_ns(ts);
+}
+
+static void sev_ioctl(struct kvm_vm *vm, uint32_t id, void *data)
+{
+	struct kvm_sev_cmd cmd = {
+		.id = id,
+		.data = (uint64_t)data,
+		.sev_fd = sev_fd,
+	};
+	int ret;
+
+	ret = ioctl(vm_get_fd(vm), KVM_MEMORY_ENCRYPT_OP, &cmd);
+	TEST_ASSERT(ret == 0,
+		    "SEV command %u failed, rc: %i errno: %i fw error: %u",
+		    id, ret, errno, cmd.error);
+}
+
+static void update_data(struct kvm_vm *vm, void *hva, uint64_t size)
+{
+	struct kvm_sev_launch_update_data_pipelined p = {
+		.uaddr = (uint64_t)hva,
+		.len = size,
+		.chunk_size = chunk_size,
+	};
+	struct kvm_sev_launch_update_data u;
+	uint64_t off, len;
+
+	if (pipelined) {
+		sev_ioctl(vm, KVM_SEV_LAUNCH_UPDATE_DATA_PIPELINED, &p);
+		pr_info("    pipelined: %u chunks, %u PSP commands, pin %lu ms, "
+			"flush %lu ms, psp %lu ms, wait %lu ms\n",
+			p.nr_chunks, p.nr_cmds, (uint64_t)p.pin_ns / 1000000,
+			(uint64_t)p.flush_ns / 1000000,
+			(uint64_t)p.psp_ns / 1000000,
+			(uint64_t)p.wait_ns / 1000000);
+		return;
+	}
+
+	for (off = 0; off < size; off += len) {
+		len = min(size - off, (uint64_t)UPDATE_DATA_MAX_LEN);
+		u.uaddr = (uint64_t)hva + off;
+		u.len = len;
+		sev_ioctl(vm, KVM_SEV_LAUNCH_UPDATE_DATA, &u);
+	}
+}
+
+static void run_test(uint64_t size)
+{
+	struct kvm_sev_launch_measure measure = { 0 };
+	struct kvm_sev_launch_start start = { 0 };
+	uint64_t ns[NR_LAUNCH_STEPS], t;
+	struct kvm_enc_region region;
+	struct kvm_vm *vm;
+	void *hva;
+	int i, ret;
+
+	vm = vm_create(VM_MODE_DEFAULT, DEFAULT_GUEST_PHY_PAGES, O_RDWR);
+	sev_ioctl(vm, KVM_SEV_INIT, NULL);
+
+	vm_userspace_mem_region_add(vm, VM_MEM_SRC_ANONYMOUS, TEST_MEM_GPA,
+				    TEST_MEM_SLOT_INDEX,
+				    size / vm_get_page_size(vm), 0);
+	hva = addr_gpa2hva(vm, TEST_MEM_GPA);
+
+	/* Fault everything in, as the VMM would when loading the image */
+	memset(hva, 0x5a, size);
+
+	region.addr = (uint64_t)hva;
+	region.size = size;
+	t = now_ns();
+	ret = ioctl(vm_get_fd(vm), KVM_MEMORY_ENCRYPT_REG_REGION, &region);
+	TEST_ASSERT(ret == 0, "KVM_MEMORY_ENCRYPT_REG_REGION failed, errno: %i",
+		    errno);
+	ns[STEP_REG_REGION] = now_ns() - t;
+
+	t = now_ns();
+	sev_ioctl(vm, KVM_SEV_LAUNCH_START, &start);
+	ns[STEP_LAUNCH_START] = now_ns() - t;
+
+	t = now_ns();
+	update_data(vm, hva, size);
+	ns[STEP_UPDATE_DATA] = now_ns() - t;
+
+	/* Query the length first, then get the measurement */
+	t = now_ns();
+	ioctl(vm_get_fd(vm), KVM_MEMORY_ENCRYPT_OP,
+	      &(struct kvm_sev_cmd){ .id = KVM_SEV_LAUNCH_MEASURE,
+				     .data = (uint64_t)&measure,
+				     .sev_fd = sev_fd });
+	TEST_ASSERT(measure.len, "LAUNCH_MEASURE did not return a length");
+	measure.uaddr = (uint64_t)malloc(measure.len);
+	TEST_ASSERT(measure.uaddr, "Failed to allocate measurement buffer");
+	sev_ioctl(vm, KVM_SEV_LAUNCH_MEASURE, &measure);
+	ns[STEP_MEASURE] = now_ns() - t;
+
+	t = now_ns();
+	sev_ioctl(vm, KVM_SEV_LAUNCH_FINISH, NULL);
+	ns[STEP_FINISH] = now_ns() - t;
+
+	pr_info("%lu MiB:\n", size >> 20);
+	for (i = 0; i < NR_LAUNCH_STEPS; i++)
+		pr_info("    %-20s %8lu ms %10.1f ms/GiB\n", step_name[i],
+			ns[i] / 1000000,
+			(double)ns[i] / 1000000 / ((double)size / (1 << 30)));
+
+	free((void *)measure.uaddr);
+	kvm_vm_free(vm);
+}
+
+static void help(char *name)
+{
+	puts("");
+	printf("usage: %s [-h] [-s size] [-p] [-c chunk_size]\n", name);
+	printf(" -s: guest memory size to launch, e.g. 512M or 4G.\n"
+	       "     This option may be used multiple times. Default: 1G\n");
+	printf(" -p: use KVM_SEV_LAUNCH_UPDATE_DATA_PIPELINED\n");
+	printf(" -c: chunk size for -p, e.g. 2M. Default: chosen by KVM\n");
+	puts("");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t sizes[16];
+	int nr_sizes = 0;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "hs:pc:")) != -1) {
+		switch (opt) {
+		case 's':
+			TEST_ASSERT(nr_sizes < ARRAY_SIZE(sizes),
+				    "Too many sizes, at most %zu",
+				    ARRAY_SIZE(sizes));
+			sizes[nr_sizes] = parse_size(optarg);
+			TEST_ASSERT(sizes[nr_sizes] &&
+				    !(sizes[nr_sizes] & (getpagesize() - 1)),
+				    "Size must be a non-zero multiple of the page size");
+			nr_sizes++;
+			break;
+		case 'p':
+			pipelined = true;
+			break;
+		case 'c':
+			chunk_size = parse_size(optarg);
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			break;
+		}
+	}
+
+	if (!nr_sizes)
+		sizes[nr_sizes++] = 1UL << 30;
+
+	sev_fd = open(SEV_DEV_PATH, O_RDWR);
+	if (sev_fd < 0) {
+		print_skip("%s not available, is SEV enabled?", SEV_DEV_PATH);
+		exit(KSFT_SKIP);
+	}
+
+	for (i = 0; i < nr_sizes; i++)
+		run_test(sizes[i]);
+
+	close(sev_fd);
+	return 0;
+}
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * svm_exit_latency_test
+ *
+ * Round trip latency of the common #VMEXIT types
+ *
+ * The guest triggers each exit type in a loop and times the loop with
+ * RDTSC.  CPUID, RDMSR, VMMCALL and nested VMRUN are handled inside KVM,
+ * port I/O, MMIO and HLT go all the way out to userspace, which resumes the
+ * vCPU right away.  The VM has no in-kernel irqchip so that HLT exits to
+ * userspace instead of blocking.  The nested VMRUN round trip is only
+ * measured if KVM exposes SVM to the guest.
+ */
+
+#define _GNU_SOURCE /* for program_invocation_name */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test_util.h"
+#include "kvm_util.h"
+#include "processor.h"
+#include "svm_util.h"
+
+#define VCPU_ID			0
+
+#define DEFAULT_ROUND_TRIPS	10000
+
+#define EXIT_IO_PORT		0x80
+#define EXIT_MMIO_GVA		0xc0000000UL
+#define EXIT_MMIO_GPA		0xc0000000UL
+/* MSR_IA32_MISC_ENABLE, not passed through to the guest */
+#define EXIT_MSR		0x1a0
+/* Not a valid hypercall, KVM returns -KVM_ENOSYS */
+#define EXIT_HYPERCALL_NR	0xffff
+
+#define CPUID_SVM_FN		0x80000001
+#define CPUID_SVM_ECX		(1u << 2)
+
+enum exit_type {
+	EXIT_CPUID,
+	EXIT_RDMSR,
+	EXIT_VMMCALL,
+	EXIT_IO,
+	EXIT_MMIO,
+	EXIT_HLT,
+	EXIT_NESTED_VMRUN,
+	NR_EXIT_TYPES,
+};
+
+static const char * const exit_name[NR_EXIT_TYPES] = {
+	[EXIT_CPUID]		= "CPUID",
+	[EXIT_RDMSR]		= "RDMSR",
+	[EXIT_VMMCALL]		= "VMMCALL",
+	[EXIT_IO]		= "OUT (userspace)",
+	[EXIT_MMIO]		= "MMIO write (userspace)",
+	[EXIT_HLT]		= "HLT (userspace)",
+	[EXIT_NESTED_VMRUN]	= "nested VMRUN/#VMEXIT",
+};
+
+static uint64_t nr_round_trips = DEFAULT_ROUND_TRIPS;
+
+static void guest_exit(enum exit_type type)
+{
+	uint32_t eax = 0, ebx, ecx = 0, edx;
+	uint64_t rax = EXIT_HYPERCALL_NR;
+
+	switch (type) {
+	case EXIT_CPUID:
+		__asm__ __volatile__("cpuid"
+				     : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+		break;
+	case EXIT_RDMSR:
+		rdmsr(EXIT_MSR);
+		break;
+	case EXIT_VMMCALL:
+		__asm__ __volatile__("vmmcall" : "+a"(rax) : : "memory");
+		break;
+	case EXIT_IO:
+		__asm__ __volatile__("outb %%al, %%dx"
+				     : : "a"(0), "d"(EXIT_IO_PORT));
+		break;
+	case EXIT_MMIO:
+		*(volatile uint32_t *)EXIT_MMIO_GVA = 0;
+		break;
+	case EXIT_HLT:
+		__asm__ __volatile__("hlt");
+		break;
+	default:
+		break;
+	}
+}
+
+static void l2_guest_code(struct svm_test_data *svm)
+{
+	for (;;)
+		__asm__ __volatile__("vmmcall");
+}
+
+static uint64_t l1_nested_round_trips(struct svm_test_data *svm)
+{
+	#define L2_GUEST_STACK_SIZE 64
+	unsigned long l2_guest_stack[L2_GUEST_STACK_SIZE];
+	struct vmcb *vmcb = svm->vmcb;
+	uint64_t start, i;
+
+	generic_svm_setup(svm, l2_guest_code,
+			  &l2_guest_stack[L2_GUEST_STACK_SIZE]);
+
+	start = rdtsc();
+	for (i = 0; i < nr_round_trips; i++) {
+		run_guest(vmcb, svm->vmcb_gpa);
+		GUEST_ASSERT(vmcb->control.exit_code == SVM_EXIT_VMMCALL);
+		vmcb->save.rip += 3;
+	}
+	return rdtsc() - start;
+}
+
+static void guest_code(struct svm_test_data *svm)
+{
+	uint64_t start, cycles, i;
+	int type;
+
+	for (type = 0; type < NR_EXIT_TYPES; type++) {
+		if (type == EXIT_NESTED_VMRUN) {
+			if (!svm)
+				continue;
+			cycles = l1_nested_round_trips(svm);
+		} else {
+			start = rdtsc();
+			for (i = 0; i < nr_round_trips; i++)
+				guest_exit(type);
+			cycles = rdtsc() - start;
+		}
+
+		GUEST_SYNC_ARGS(type, cycles / nr_round_trips, 0, 0, 0);
+	}
+
+	GUEST_DONE();
+}
+
+static bool nested_svm_supported(void)
+{
+	struct kvm_cpuid_entry2 *entry =
+		kvm_get_supported_cpuid_entry(CPUID_SVM_FN);
+
+	return entry->ecx & CPUID_SVM_ECX;
+}
+
+static void help(char *name)
+{
+	puts("");
+	printf("usage: %s [-h] [-n round_trips]\n", name);
+	printf(" -n: number of round trips per exit type (default: %d)\n",
+	       DEFAULT_ROUND_TRIPS);
+	puts("");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t results[NR_EXIT_TYPES] = { 0 };
+	vm_vaddr_t svm_gva = 0;
+	struct kvm_vm *vm;
+	bool done = false;
+	int tsc_khz, opt, i;
+
+	while ((opt = getopt(argc, argv, "hn:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_round_trips = strtoull(optarg, NULL, 0);
+			TEST_ASSERT(nr_round_trips > 0,
+				    "Need at least one round trip");
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			break;
+		}
+	}
+
+	/* No in-kernel irqchip, so that HLT exits to userspace */
+	vm = vm_create(VM_MODE_DEFAULT, DEFAULT_GUEST_PHY_PAGES, O_RDWR);
+	kvm_vm_elf_load(vm, program_invocation_name, 0, 0);
+	vm_vcpu_add_default(vm, VCPU_ID, guest_code);
+	vcpu_set_cpuid(vm, VCPU_ID, kvm_get_supported_cpuid());
+
+	/* Map a GPA outside of any memslot for the MMIO exits */
+	virt_pg_map(vm, EXIT_MMIO_GVA, EXIT_MMIO_GPA, 0);
+
+	if (nested_svm_supported())
+		vcpu_alloc_svm(vm, &svm_gva);
+	else
+		print_skip("nested SVM not enabled, skipping nested VMRUN");
+	vcpu_args_set(vm, VCPU_ID, 1, svm_gva);
+
+	sync_global_to_guest(vm, nr_round_trips);
+
+	tsc_khz = _vcpu_ioctl(vm, VCPU_ID, KVM_GET_TSC_KHZ, NULL);
+	TEST_ASSERT(tsc_khz > 0, "KVM_GET_TSC_KHZ failed: %d", tsc_khz);
+
+	while (!done) {
+		volatile struct kvm_run *run = vcpu_state(vm, VCPU_ID);
+		struct ucall uc;
+
+		vcpu_run(vm, VCPU_ID);
+
+		switch (run->exit_reason) {
+		case KVM_EXIT_IO:
+			if (run->io.port == EXIT_IO_PORT)
+				continue;
+			break;
+		case KVM_EXIT_MMIO:
+			if (run->mmio.phys_addr == EXIT_MMIO_GPA)
+				continue;
+			break;
+		case KVM_EXIT_HLT:
+			continue;
+		}
+
+		TEST_ASSERT(run->exit_reason == KVM_EXIT_IO,
+			    "Unexpected exit_reason: %u (%s)\n",
+			    run->exit_reason,
+			    exit_reason_str(run->exit_reason));
+
+		switch (get_ucall(vm, VCPU_ID, &uc)) {
+		case UCALL_ABORT:
+			TEST_FAIL("%s at %s:%ld", (const char *)uc.args[0],
+				  __FILE__, uc.args[1]);
+			/* NOT REACHED */
+		case UCALL_SYNC:
+			TEST_ASSERT(uc.args[1] < NR_EXIT_TYPES,
+				    "Bad exit type %lu", uc.args[1]);
+			results[uc.args[1]] = uc.args[2];
+			break;
+		case UCALL_DONE:
+			done = true;
+			break;
+		default:
+			TEST_FAIL("Unknown ucall 0x%lx.", uc.cmd);
+		}
+	}
+
+	printf("%-24s %12s %12s\n", "exit", "cycles", "ns");
+	for (i = 0; i < NR_EXIT_TYPES; i++) {
+		if (!results[i])
+			continue;
+		printf("%-24s %12lu %12lu\n", exit_name[i], results[i],
+		       results[i] * 1000000 / tsc_khz);
+	}
+
+	kvm_vm_free(vm);
+	return 0;
+}
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * svm_nested_exit_test
+ *
+ * Nested SVM testing: round trip cost of nested #VMEXITs
+ *
+ * L2 executes VMMCALL in a loop and L1 resumes it after every exit,
+ * timing the round trip with and without a TLB flush requested in
+ * tlb_ctl, and with L1 switching the ASID of L2 at every VMRUN.
+ */
+
+#include "test_util.h"
+#include "kvm_util.h"
+#include "processor.h"
+#include "svm_util.h"
+
+#define VCPU_ID		5
+#define NR_ROUND_TRIPS	10000
+
+#ifndef TLB_CONTROL_DO_NOTHING
+#define TLB_CONTROL_DO_NOTHING	0
+#define TLB_CONTROL_FLUSH_ASID	3
+#endif
+
+enum {
+	PASS_NO_FLUSH,
+	PASS_FLUSH_ASID,
+	PASS_SWITCH_ASID,
+	NR_PASSES,
+};
+
+static const char * const pass_name[NR_PASSES] = {
+	[PASS_NO_FLUSH]		= "no flush",
+	[PASS_FLUSH_ASID]	= "tlb_ctl flush ASID",
+	[PASS_SWITCH_ASID]	= "ASID switch",
+};
+
+static volatile uint64_t l2_vmmcalls;
+
+static void l2_guest_code(struct svm_test_data *svm)
+{
+	for (;;) {
+		l2_vmmcalls++;
+		__asm__ __volatile__("vmmcall");
+	}
+}
+
+static void l1_guest_code(struct svm_test_data *svm)
+{
+	#define L2_GUEST_STACK_SIZE 64
+	unsigned long l2_guest_stack[L2_GUEST_STACK_SIZE];
+	struct vmcb *vmcb = svm->vmcb;
+	uint64_t start, cycles;
+	int i, pass;
+
+	/* Prepare for L2 execution. */
+	generic_svm_setup(svm, l2_guest_code,
+			  &l2_guest_stack[L2_GUEST_STACK_SIZE]);
+
+	for (pass = 0; pass < NR_PASSES; pass++) {
+		start = rdtsc();
+		for (i = 0; i < NR_ROUND_TRIPS; i++) {
+			vmcb->control.tlb_ctl = pass == PASS_FLUSH_ASID ?
+				TLB_CONTROL_FLUSH_ASID : TLB_CONTROL_DO_NOTHING;
+			if (pass == PASS_SWITCH_ASID)
+				vmcb->control.asid = 1 + (i & 1);
+
+			run_guest(vmcb, svm->vmcb_gpa);
+
+			GUEST_ASSERT(vmcb->control.exit_code == SVM_EXIT_VMMCALL);
+			vmcb->save.rip += 3;
+		}
+		cycles = rdtsc() - start;
+
+		/* Every VMRUN must have resumed L2 where it left off */
+		GUEST_ASSERT(l2_vmmcalls == (pass + 1) * NR_ROUND_TRIPS);
+		GUEST_SYNC_ARGS(pass, cycles / NR_ROUND_TRIPS, 0, 0, 0);
+	}
+
+	GUEST_DONE();
+}
+
+int main(int argc, char *argv[])
+{
+	vm_vaddr_t svm_gva;
+	struct kvm_vm *vm;
+
+	nested_svm_check_supported();
+
+	vm = vm_create_default(VCPU_ID, 0, (void *) l1_guest_code);
+	vcpu_set_cpuid(vm, VCPU_ID, kvm_get_supported_cpuid());
+
+	vcpu_alloc_svm(vm, &svm_gva);
+	vcpu_args_set(vm, VCPU_ID, 1, svm_gva);
+
+	for (;;) {
+		volatile struct kvm_run *run = vcpu_state(vm, VCPU_ID);
+		struct ucall uc;
+
+		vcpu_run(vm, VCPU_ID);
+		TEST_ASSERT(run->exit_reason == KVM_EXIT_IO,
+			    "Got exit_reason other than KVM_EXIT_IO: %u (%s)\n",
+			    run->exit_reason,
+			    exit_reason_str(run->exit_reason));
+
+		switch (get_ucall(vm, VCPU_ID, &uc)) {
+		case UCALL_ABORT:
+			TEST_FAIL("%s at %s:%ld", (const char *)uc.args[0],
+				  __FILE__, uc.args[1]);
+			/* NOT REACHED */
+		case UCALL_SYNC:
+			pr_info("%-20s %lu TSC cycles per nested exit\n",
+				pass_name[uc.args[1]], uc.args[2]);
+			break;
+		case UCALL_DONE:
+			goto done;
+		default:
+			TEST_FAIL("Unknown ucall 0x%lx.", uc.cmd);
+		}
+	}
+done:
+	kvm_vm_free(vm);
+	return 0;
+}
@@ -17,7 +17,8 @@ KSELFTEST_SKIP=4
 # - correctness: check that packets match given entries, and only those
 # - concurrency: attempt races between insertion, deletion and lookup
 # - timeout: check that packets match entries until they expire
-# - performance: estimate matching rate, compare with rbtree and hash baselines
+# - performance: estimate matching rate, compare with rbtree and hash baselines,
+#   and generic with AVX2 lookup routines where both are available
 TESTS="reported_issues correctness concurrency timeout"
 [ "${quicktest}" != "1" ] && TESTS="${TESTS} performance"
 
@@ -1439,6 +1440,17 @@ test_performance() {
 	pps="$(printf %10s $(($(count_perf_packets) / perf_duration)))"
 	p5="$(printf %5s "${perf_entries}")"
 	info "    set with ${p5} full, ranged entries:         ${pps}pps"
+
+	# Same set again, with AVX2 lookups switched to the generic routine
+	avx2_param=/sys/module/nf_tables/parameters/pipapo_avx2
+	if [ -w "${avx2_param}" ] && grep -q avx2 /proc/cpuinfo; then
+		echo N > "${avx2_param}"
+		nft reset counter netdev perf test >/dev/null 2>&1
+		sleep "${perf_duration}"
+		pps="$(printf %10s $(($(count_perf_packets) / perf_duration)))"
+		info "    same set, generic (non-AVX2) lookup:         ${pps}pps"
+		echo Y > "${avx2_param}"
+	fi
 	kill "${perf_pid}"
 }
 
@@ -15,6 +15,10 @@
 #define MADV_PAGEOUT 21
 #endif
 
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
 #define BASE_ADDR ((void *)(1UL << 30))
 static unsigned long hpage_pmd_size;
 static unsigned long page_size;
@@ -79,7 +83,9 @@ struct khugepaged_settings {
 	unsigned int max_ptes_none;
 	unsigned int max_ptes_swap;
 	unsigned int max_ptes_shared;
+	unsigned int min_ptes_young;
 	unsigned long pages_to_scan;
+	unsigned long pages_to_scan_per_mm;
 };
 
 struct settings {
@@ -279,7 +285,10 @@ static void write_settings(struct settings *settings)
 	write_num("khugepaged/max_ptes_none", khugepaged->max_ptes_none);
 	write_num("khugepaged/max_ptes_swap", khugepaged->max_ptes_swap);
 	write_num("khugepaged/max_ptes_shared", khugepaged->max_ptes_shared);
+	write_num("khugepaged/min_ptes_young", khugepaged->min_ptes_young);
 	write_num("khugepaged/pages_to_scan", khugepaged->pages_to_scan);
+	write_num("khugepaged/pages_to_scan_per_mm",
+			khugepaged->pages_to_scan_per_mm);
 }
 
 static void restore_settings(int sig)
@@ -316,7 +325,10 @@ static void save_settings(void)
 		.max_ptes_none = read_num("khugepaged/max_ptes_none"),
 		.max_ptes_swap = read_num("khugepaged/max_ptes_swap"),
 		.max_ptes_shared = read_num("khugepaged/max_ptes_shared"),
+		.min_ptes_young = read_num("khugepaged/min_ptes_young"),
 		.pages_to_scan = read_num("khugepaged/pages_to_scan"),
+		.pages_to_scan_per_mm =
+			read_num("khugepaged/pages_to_scan_per_mm"),
 	};
 	success("OK");
 
@@ -548,6 +560,27 @@ static void collapse_full(void)
 	munmap(p, hpage_pmd_size);
 }
 
+static void collapse_madvise(void)
+{
+	void *p;
+
+	p = alloc_mapping();
+	fill_memory(p, 0, hpage_pmd_size);
+	madvise(p, hpage_pmd_size, MADV_HUGEPAGE);
+
+	printf("Collapse fully populated PTE table with MADV_COLLAPSE...");
+	if (madvise(p, hpage_pmd_size, MADV_COLLAPSE))
+		fail("Fail");
+	else if (check_huge(p))
+		success("OK");
+	else
+		fail("Fail");
+
+	madvise(p, hpage_pmd_size, MADV_NOHUGEPAGE);
+	validate_memory(p, 0, hpage_pmd_size);
+	munmap(p, hpage_pmd_size);
+}
+
 static void collapse_empty(void)
 {
 	void *p;
@@ -1012,6 +1045,7 @@ int main(void)
 	default_settings.khugepaged.max_ptes_none = hpage_pmd_nr - 1;
 	default_settings.khugepaged.max_ptes_swap = hpage_pmd_nr / 8;
 	default_settings.khugepaged.max_ptes_shared = hpage_pmd_nr / 2;
+	default_settings.khugepaged.min_ptes_young = 1;
 	default_settings.khugepaged.pages_to_scan = hpage_pmd_nr * 8;
 
 	save_settings();
@@ -1019,6 +1053,7 @@ int main(void)
 
 	alloc_at_fault();
 	collapse_full();
+	collapse_madvise();
 	collapse_empty();
 	collapse_single_pte_entry();
 	collapse_max_ptes_none();
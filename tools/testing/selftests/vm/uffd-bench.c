@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure how many userfaultfd faults per second a monitor can resolve.
+ *
+ * The main thread touches every page of a registered area in order while
+ * a handler thread reads the fault events and resolves them, the way a
+ * postcopy live migration destination does:
+ *
+ *   copy	UFFDIO_COPY of <batch> pages starting at the faulting page
+ *   vec	UFFDIO_COPY_VEC with <batch> single page entries
+ *   continue	UFFDIO_CONTINUE of <batch> pages of a shmem area whose page
+ *		cache was populated through a second mapping (minor faults)
+ *
+ * Usage: ./uffd-bench <copy|vec|continue> [size MiB] [batch]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/userfaultfd.h>
+
+#include "../kselftest.h"
+
+#ifdef __NR_userfaultfd
+
+#define MODE_COPY	0
+#define MODE_VEC	1
+#define MODE_CONTINUE	2
+
+static int mode;
+static unsigned long page_size, nr_pages, batch = 1;
+static char *area_dst, *area_src;
+static int uffd;
+static unsigned long nr_faults;
+
+#define err(fmt, ...)							\
+	do {								\
+		fprintf(stderr, fmt "\n", ##__VA_ARGS__);		\
+		exit(1);						\
+	} while (0)
+
+static unsigned long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void resolve_copy(unsigned long offset, unsigned long len)
+{
+	struct uffdio_copy copy = {
+		.dst = (unsigned long)area_dst + offset,
+		.src = (unsigned long)area_src + offset,
+		.len = len,
+	};
+
+	if (ioctl(uffd, UFFDIO_COPY, &copy) && errno != EEXIST)
+		err("UFFDIO_COPY failed: %s", strerror(errno));
+}
+
+static void resolve_vec(unsigned long offset, unsigned long len)
+{
+	struct uffdio_copy_iov iov[len / page_size];
+	struct uffdio_copy_vec vec = {
+		.iov = (unsigned long)iov,
+		.nr = len / page_size,
+	};
+	unsigned long i;
+
+	for (i = 0; i < vec.nr; i++) {
+		iov[i].dst = (unsigned long)area_dst + offset + i * page_size;
+		iov[i].src = (unsigned long)area_src + offset + i * page_size;
+		iov[i].len = page_size;
+	}
+
+	if (ioctl(uffd, UFFDIO_COPY_VEC, &vec) && errno != EEXIST)
+		err("UFFDIO_COPY_VEC failed: %s", strerror(errno));
+}
+
+static void resolve_continue(unsigned long offset, unsigned long len)
+{
+	struct uffdio_continue cont = {
+		.range.start = (unsigned long)area_dst + offset,
+		.range.len = len,
+	};
+
+	if (ioctl(uffd, UFFDIO_CONTINUE, &cont) && errno != EEXIST)
+		err("UFFDIO_CONTINUE failed: %s", strerror(errno));
+}
+
+static void *handler_thread(void *arg)
+{
+	unsigned long offset, len, size = nr_pages * page_size;
+	struct pollfd pollfd = { .fd = uffd, .events = POLLIN };
+	struct uffd_msg msg;
+
+	for (;;) {
+		if (poll(&pollfd, 1, -1) < 0)
+			err("poll failed: %s", strerror(errno));
+
+		if (read(uffd, &msg, sizeof(msg)) != sizeof(msg)) {
+			if (errno == EAGAIN)
+				continue;
+			err("reading uffd message failed: %s", strerror(errno));
+		}
+		if (msg.event != UFFD_EVENT_PAGEFAULT)
+			err("unexpected uffd event %u", msg.event);
+
+		offset = (msg.arg.pagefault.address - (unsigned long)area_dst) &
+			 ~(page_size - 1);
+		len = batch * page_size;
+		if (len > size - offset)
+			len = size - offset;
+
+		/* Count before waking the toucher so the total is stable */
+		nr_faults++;
+		switch (mode) {
+		case MODE_COPY:
+			resolve_copy(offset, len);
+			break;
+		case MODE_VEC:
+			resolve_vec(offset, len);
+			break;
+		case MODE_CONTINUE:
+			resolve_continue(offset, len);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void setup_areas(void)
+{
+	unsigned long size = nr_pages * page_size;
+	int fd;
+
+	if (mode != MODE_CONTINUE) {
+		area_dst = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		area_src = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area_dst == MAP_FAILED || area_src == MAP_FAILED)
+			err("mmap failed: %s", strerror(errno));
+		memset(area_src, 0x5a, size);
+		return;
+	}
+
+	/* The alias mapping fills the page cache, area_dst takes minor faults */
+	fd = memfd_create("uffd-bench", 0);
+	if (fd < 0 || ftruncate(fd, size))
+		err("memfd setup failed: %s", strerror(errno));
+	area_dst = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	area_src = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (area_dst == MAP_FAILED || area_src == MAP_FAILED)
+		err("mmap failed: %s", strerror(errno));
+	memset(area_src, 0x5a, size);
+	close(fd);
+}
+
+static int setup_uffd(void)
+{
+	struct uffdio_api api = { .api = UFFD_API };
+	struct uffdio_register reg = {
+		.range.start = (unsigned long)area_dst,
+		.range.len = nr_pages * page_size,
+		.mode = UFFDIO_REGISTER_MODE_MISSING,
+	};
+	__u64 ioctl_bit = 1ULL << _UFFDIO_COPY;
+
+	if (mode == MODE_VEC)
+		ioctl_bit = 1ULL << _UFFDIO_COPY_VEC;
+	if (mode == MODE_CONTINUE) {
+		api.features = UFFD_FEATURE_MINOR_SHMEM;
+		reg.mode = UFFDIO_REGISTER_MODE_MINOR;
+		ioctl_bit = 1ULL << _UFFDIO_CONTINUE;
+	}
+
+	uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	if (uffd < 0) {
+		printf("userfaultfd not available: %s\n", strerror(errno));
+		return KSFT_SKIP;
+	}
+	if (ioctl(uffd, UFFDIO_API, &api)) {
+		printf("UFFDIO_API failed: %s\n", strerror(errno));
+		return KSFT_SKIP;
+	}
+	if (ioctl(uffd, UFFDIO_REGISTER, &reg)) {
+		printf("UFFDIO_REGISTER failed: %s\n", strerror(errno));
+		return KSFT_SKIP;
+	}
+	if (!(reg.ioctls & ioctl_bit)) {
+		printf("resolving ioctl not supported on this range\n");
+		return KSFT_SKIP;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const modes[] = { "copy", "vec", "continue" };
+	unsigned long long start, time;
+	unsigned long i, sum = 0;
+	pthread_t handler;
+	int ret;
+
+	if (argc < 2)
+		err("Usage: %s <copy|vec|continue> [size MiB] [batch]", argv[0]);
+
+	for (mode = 0; mode < 3; mode++)
+		if (!strcmp(argv[1], modes[mode]))
+			break;
+	if (mode == 3)
+		err("unknown mode %s", argv[1]);
+
+	page_size = sysconf(_SC_PAGE_SIZE);
+	nr_pages = (argc > 2 ? atol(argv[2]) : 256) * (1UL << 20) / page_size;
+	if (argc > 3)
+		batch = atol(argv[3]);
+	if (!nr_pages || !batch)
+		err("invalid size or batch");
+
+	setup_areas();
+	ret = setup_uffd();
+	if (ret)
+		return ret;
+
+	if (pthread_create(&handler, NULL, handler_thread, NULL))
+		err("pthread_create failed");
+
+	start = now_nsec();
+	for (i = 0; i < nr_pages; i++)
+		sum += *(volatile char *)(area_dst + i * page_size);
+	time = now_nsec() - start;
+
+	if (sum != nr_pages * 0x5a)
+		err("unexpected contents in the resolved area");
+
+	printf("%s: %lu pages, batch %lu: %lu faults in %llu us, %llu faults/sec, %llu pages/sec\n",
+	       modes[mode], nr_pages, batch, nr_faults, time / 1000,
+	       nr_faults * 1000000000ULL / time,
+	       nr_pages * 1000000000ULL / time);
+
+	return 0;
+}
+
+#else /* __NR_userfaultfd */
+
+#warning "missing __NR_userfaultfd definition"
+
+int main(void)
+{
+	printf("skip: Skipping uffd-bench test (missing __NR_userfaultfd)\n");
+	return KSFT_SKIP;
+}
+
+#endif /* __NR_userfaultfd */
@@ -94,6 +94,7 @@ struct uffd_stats {
 	int cpu;
 	unsigned long missing_faults;
 	unsigned long wp_faults;
+	unsigned long minor_faults;
 };
 
 /* pthread_mutex_t starts at page offset 0 */
@@ -144,17 +145,19 @@ static void uffd_stats_reset(struct uffd_stats *uffd_stats,
 		uffd_stats[i].cpu = i;
 		uffd_stats[i].missing_faults = 0;
 		uffd_stats[i].wp_faults = 0;
+		uffd_stats[i].minor_faults = 0;
 	}
 }
 
 static void uffd_stats_report(struct uffd_stats *stats, int n_cpus)
 {
 	int i;
-	unsigned long long miss_total = 0, wp_total = 0;
+	unsigned long long miss_total = 0, wp_total = 0, minor_total = 0;
 
 	for (i = 0; i < n_cpus; i++) {
 		miss_total += stats[i].missing_faults;
 		wp_total += stats[i].wp_faults;
+		minor_total += stats[i].minor_faults;
 	}
 
 	printf("userfaults: %llu missing (", miss_total);
@@ -163,6 +166,9 @@ static void uffd_stats_report(struct uffd_stats *stats, int n_cpus)
 	printf("\b), %llu wp (", wp_total);
 	for (i = 0; i < n_cpus; i++)
 		printf("%lu+", stats[i].wp_faults);
+	printf("\b), %llu minor (", minor_total);
+	for (i = 0; i < n_cpus; i++)
+		printf("%lu+", stats[i].minor_faults);
 	printf("\b)\n");
 }
 
@@ -342,6 +348,24 @@ static void wp_range(int ufd, __u64 start, __u64 len, bool wp)
 			start), exit(1);
 }
 
+static void continue_range(int ufd, __u64 start, __u64 len)
+{
+	struct uffdio_continue req;
+
+	req.range.start = start;
+	req.range.len = len;
+	req.mode = 0;
+
+	if (ioctl(ufd, UFFDIO_CONTINUE, &req))
+		fprintf(stderr, "UFFDIO_CONTINUE failed for address 0x%Lx\n",
+			start), exit(1);
+
+	/* "mapped" is written by the kernel, check it the way copy is */
+	if (req.mapped != len)
+		fprintf(stderr, "UFFDIO_CONTINUE unexpected mapped %Ld\n",
+			req.mapped), exit(1);
+}
+
 static void *locking_thread(void *arg)
 {
 	unsigned long cpu = (unsigned long) arg;
@@ -543,6 +567,11 @@ static void uffd_handle_page_fault(struct uffd_msg *msg,
 	if (msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {
 		wp_range(uffd, msg->arg.pagefault.address, page_size, false);
 		stats->wp_faults++;
+	} else if (msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_MINOR) {
+		/* The page is in the page cache already, just map it */
+		continue_range(uffd, msg->arg.pagefault.address & ~(page_size-1),
+			       page_size);
+		stats->minor_faults++;
 	} else {
 		/* Missing page faults */
 		if (bounces & BOUNCE_VERIFY &&
@@ -1153,6 +1182,77 @@ static int userfaultfd_sig_test(void)
 	return userfaults != 0;
 }
 
+/*
+ * Populate the page cache of area_dst through a second mapping, then read
+ * every page through area_dst registered in minor mode. Each read must be
+ * reported as its own minor fault: fault-around mapping the neighbouring
+ * pages, which are in the page cache too, would bypass the registration.
+ */
+static int userfaultfd_minor_test(void)
+{
+	struct uffdio_register uffdio_register;
+	unsigned long nr;
+	pthread_t uffd_mon;
+	char *area_alias;
+	char c;
+	struct uffd_stats stats = { 0 };
+
+	if (test_type != TEST_SHMEM)
+		return 0;
+
+	printf("testing minor faults: ");
+	fflush(stdout);
+
+	if (uffd_test_ops->release_pages(area_dst))
+		return 1;
+
+	/* mremap() of a shared mapping with old_size 0 creates an alias */
+	area_alias = mremap(area_dst, 0, nr_pages * page_size, MREMAP_MAYMOVE);
+	if (area_alias == MAP_FAILED)
+		perror("mremap"), exit(1);
+
+	for (nr = 0; nr < nr_pages; nr++)
+		memset(area_alias + nr * page_size, 'a' + nr % 26, page_size);
+
+	if (userfaultfd_open(UFFD_FEATURE_MINOR_SHMEM))
+		return 1;
+
+	uffdio_register.range.start = (unsigned long) area_dst;
+	uffdio_register.range.len = nr_pages * page_size;
+	uffdio_register.mode = UFFDIO_REGISTER_MODE_MINOR;
+	if (ioctl(uffd, UFFDIO_REGISTER, &uffdio_register))
+		fprintf(stderr, "register failure\n"), exit(1);
+
+	if (!(uffdio_register.ioctls & (1 << _UFFDIO_CONTINUE)))
+		fprintf(stderr,
+			"unexpected missing ioctl for minor faults\n"),
+			exit(1);
+
+	if (pthread_create(&uffd_mon, &attr, uffd_poll_thread, &stats))
+		perror("uffd_poll_thread create"), exit(1);
+
+	for (nr = 0; nr < nr_pages; nr++) {
+		char *page = area_dst + nr * page_size;
+
+		if (page[0] != 'a' + nr % 26 ||
+		    page[page_size - 1] != 'a' + nr % 26)
+			fprintf(stderr, "nr %lu wrong content\n", nr), exit(1);
+	}
+
+	if (write(pipefd[1], &c, sizeof(c)) != sizeof(c))
+		perror("pipe write"), exit(1);
+	if (pthread_join(uffd_mon, NULL))
+		return 1;
+
+	close(uffd);
+	if (munmap(area_alias, nr_pages * page_size))
+		perror("munmap"), exit(1);
+
+	uffd_stats_report(&stats, 1);
+
+	return stats.minor_faults != nr_pages;
+}
+
 static int userfaultfd_stress(void)
 {
 	void *area;
@@ -1349,7 +1449,7 @@ static int userfaultfd_stress(void)
 
 	close(uffd);
 	return userfaultfd_zeropage_test() || userfaultfd_sig_test()
-		|| userfaultfd_events_test();
+		|| userfaultfd_events_test() || userfaultfd_minor_test();
 }
 
 /*
@@ -0,0 +1,132 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Latency based dirty throttling with a fast and a slow null_blk device.
+#
+# A buffered writer to the slow device fills the page cache while the time
+# taken by a writer to the fast device is measured: once with the default
+# dirty limit throttling and once with a write latency target set on both
+# queues.  With the targets set the slow writer must be throttled by the
+# latency of its own device, and the fast writer must not be slowed down by
+# the dirty pages of the slow one.
+
+# Kselftest framework requirement - SKIP code is 4.
+ksft_skip=4
+
+NULLB=/sys/kernel/config/nullb
+TRACING=/sys/kernel/debug/tracing
+FAST_MB=${FAST_MB:-256}
+SLOW_MB=${SLOW_MB:-4096}
+FAST_LAT_US=${FAST_LAT_US:-2000}
+SLOW_LAT_US=${SLOW_LAT_US:-5000}
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $ksft_skip
+}
+
+if [ "$(id -u)" -ne 0 ]; then
+	skip "must be run as root"
+fi
+
+modprobe null_blk nr_devices=0 >/dev/null 2>&1
+[ -d "$NULLB" ] || skip "null_blk configfs interface not available"
+[ -d "$TRACING" ] || mount -t debugfs none /sys/kernel/debug >/dev/null 2>&1
+[ -e "$TRACING/events/writeback/balance_dirty_pages_latency" ] ||
+	skip "balance_dirty_pages_latency tracepoint not available"
+
+# make_dev <name> <completion_nsec> <queue_depth>
+make_dev()
+{
+	local dir=$NULLB/$1
+
+	mkdir "$dir" || return 1
+	echo 2048 > "$dir/size"
+	echo 2 > "$dir/irqmode"
+	echo "$2" > "$dir/completion_nsec"
+	echo "$3" > "$dir/hw_queue_depth"
+	echo 1 > "$dir/power" || return 1
+	echo "nullb$(cat "$dir/index")"
+}
+
+remove_dev()
+{
+	[ -d "$NULLB/$1" ] || return
+	echo 0 > "$NULLB/$1/power"
+	rmdir "$NULLB/$1"
+}
+
+cleanup()
+{
+	[ -n "$slow_pid" ] && kill "$slow_pid" 2>/dev/null
+	wait 2>/dev/null
+	echo 0 > "$TRACING/events/writeback/balance_dirty_pages_latency/enable"
+	sync
+	remove_dev dirty_lat_fast
+	remove_dev dirty_lat_slow
+}
+trap cleanup EXIT
+
+fast=$(make_dev dirty_lat_fast 10000 64) || skip "cannot create null_blk devices"
+slow=$(make_dev dirty_lat_slow 20000000 2) || skip "cannot create null_blk devices"
+[ -e "/sys/block/$fast/queue/dirty_lat_usec" ] ||
+	skip "dirty_lat_usec not supported"
+
+# fast_write: prints the msecs taken to buffer FAST_MB into the fast device
+fast_write()
+{
+	local start end
+
+	start=$(date +%s%N)
+	dd if=/dev/zero of="/dev/$fast" bs=1M count="$FAST_MB" 2>/dev/null
+	end=$(date +%s%N)
+	echo $(( (end - start) / 1000000 ))
+}
+
+# run <fast target us> <slow target us>
+run()
+{
+	echo "$1" > "/sys/block/$fast/queue/dirty_lat_usec"
+	echo "$2" > "/sys/block/$slow/queue/dirty_lat_usec"
+
+	dd if=/dev/zero of="/dev/$slow" bs=1M count="$SLOW_MB" 2>/dev/null &
+	slow_pid=$!
+	sleep 5
+	fast_write
+	kill "$slow_pid" 2>/dev/null
+	wait "$slow_pid" 2>/dev/null
+	slow_pid=
+	sync
+}
+
+alone=$(fast_write)
+sync
+ratio=$(run 0 0)
+
+echo > "$TRACING/trace"
+echo 1 > "$TRACING/events/writeback/balance_dirty_pages_latency/enable"
+latency=$(run "$FAST_LAT_US" "$SLOW_LAT_US")
+echo 0 > "$TRACING/events/writeback/balance_dirty_pages_latency/enable"
+
+slow_bdi=$(cat "/sys/block/$slow/dev")
+pauses=$(grep -c "bdi $slow_bdi: .* pause=[1-9]" "$TRACING/trace")
+
+echo "fast writer alone:                ${alone} ms"
+echo "fast writer, dirty limits:        ${ratio} ms"
+echo "fast writer, latency targets:     ${latency} ms"
+echo "latency pauses of the slow writer: ${pauses}"
+
+if [ "$pauses" -eq 0 ]; then
+	echo "FAIL: the slow writer was not throttled by latency"
+	exit 1
+fi
+
+# Allow for noise, but not for stalling behind the slow device
+if [ "$latency" -gt $(( alone * 2 + 1000 )) ]; then
+	echo "FAIL: the fast writer stalled behind the slow device"
+	exit 1
+fi
+
+echo "PASS"
+exit 0
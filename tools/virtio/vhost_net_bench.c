@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * TX packet rate of vhost-net into a tap device.
+ *
+ * Acts as the guest driver of a vhost-net device whose TX backend is a tap
+ * device, and measures how fast packets of a given size are transmitted and
+ * completed. The frames are addressed to nobody, so the host stack drops
+ * them as soon as they are received and the cost measured is the vhost-net
+ * one. Load vhost_net with experimental_zcopytx=1 (and optionally
+ * zcopytx_pin_pages=N) to measure zerocopy TX.
+ *
+ * Needs CAP_NET_ADMIN to create the tap device.
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <linux/virtio_types.h>
+#include <linux/vhost.h>
+#include <linux/virtio.h>
+#include <linux/virtio_ring.h>
+
+/* struct virtio_net_hdr_mrg_rxbuf, used with VIRTIO_F_VERSION_1 */
+#define VNET_HDR_LEN	12
+#define TX_VQ		1
+#define RING_NUM	256
+
+/* Unused */
+void *__kmalloc_fake, *__kfree_ignore_start, *__kfree_ignore_end;
+
+struct bench {
+	struct virtio_device vdev;
+	int control;
+	int tap;
+	int kick;
+	int call;
+	void *ring;
+	struct vring vring;
+	struct virtqueue *vq;
+	void *buf;
+	size_t slot_size;
+	struct vhost_memory *mem;
+};
+
+bool vq_notify(struct virtqueue *vq)
+{
+	struct bench *b = vq->priv;
+	unsigned long long v = 1;
+	int r;
+
+	r = write(b->kick, &v, sizeof v);
+	assert(r == sizeof v);
+	return true;
+}
+
+void vq_callback(struct virtqueue *vq)
+{
+}
+
+static void tap_open(struct bench *b, const char *name)
+{
+	struct ifreq ifr = {
+		.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR,
+	};
+	int hdr_len = VNET_HDR_LEN;
+	int r, s;
+
+	b->tap = open("/dev/net/tun", O_RDWR);
+	assert(b->tap >= 0);
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	r = ioctl(b->tap, TUNSETIFF, &ifr);
+	assert(r >= 0);
+	r = ioctl(b->tap, TUNSETVNETHDRSZ, &hdr_len);
+	assert(r >= 0);
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	assert(s >= 0);
+	r = ioctl(s, SIOCGIFFLAGS, &ifr);
+	assert(r >= 0);
+	ifr.ifr_flags |= IFF_UP;
+	r = ioctl(s, SIOCSIFFLAGS, &ifr);
+	assert(r >= 0);
+	close(s);
+}
+
+static void bench_init(struct bench *b, size_t len, const char *name)
+{
+	unsigned long long features = (1ULL << VIRTIO_F_VERSION_1) |
+				      (1ULL << VIRTIO_RING_F_EVENT_IDX);
+	struct vhost_vring_file file = { .index = TX_VQ };
+	struct vhost_vring_state state = { .index = TX_VQ };
+	struct vhost_vring_addr addr = { .index = TX_VQ };
+	size_t buf_size;
+	int i, r;
+
+	memset(b, 0, sizeof *b);
+	b->vdev.features = features;
+	INIT_LIST_HEAD(&b->vdev.vqs);
+
+	/* A page per buffer, so the packets in flight cover RING_NUM pages */
+	b->slot_size = (VNET_HDR_LEN + len + 4095) & ~4095UL;
+	buf_size = b->slot_size * RING_NUM;
+	r = posix_memalign(&b->buf, 4096, buf_size);
+	assert(!r);
+	memset(b->buf, 0, buf_size);
+	for (i = 0; i < RING_NUM; i++) {
+		unsigned char *eth = b->buf + i * b->slot_size + VNET_HDR_LEN;
+
+		/* Locally administered unicast destination nobody owns */
+		memcpy(eth, "\x02\x00\x00\x00\x00\x01\x02\x00\x00\x00\x00\x02"
+			    "\x08\x00", 14);
+	}
+
+	tap_open(b, name);
+
+	b->control = open("/dev/vhost-net", O_RDWR);
+	assert(b->control >= 0);
+	r = ioctl(b->control, VHOST_SET_OWNER, NULL);
+	assert(r >= 0);
+	r = ioctl(b->control, VHOST_SET_FEATURES, &features);
+	assert(r >= 0);
+
+	b->mem = calloc(1, offsetof(struct vhost_memory, regions) +
+			   sizeof b->mem->regions[0]);
+	assert(b->mem);
+	b->mem->nregions = 1;
+	b->mem->regions[0].guest_phys_addr = (long)b->buf;
+	b->mem->regions[0].userspace_addr = (long)b->buf;
+	b->mem->regions[0].memory_size = buf_size;
+	r = ioctl(b->control, VHOST_SET_MEM_TABLE, b->mem);
+	assert(r >= 0);
+
+	r = posix_memalign(&b->ring, 4096, vring_size(RING_NUM, 4096));
+	assert(!r);
+	memset(b->ring, 0, vring_size(RING_NUM, 4096));
+	vring_init(&b->vring, RING_NUM, b->ring, 4096);
+	b->vq = __vring_new_virtqueue(TX_VQ, b->vring, &b->vdev, true, false,
+				      vq_notify, vq_callback, "tx");
+	assert(b->vq);
+	b->vq->priv = b;
+
+	state.num = RING_NUM;
+	r = ioctl(b->control, VHOST_SET_VRING_NUM, &state);
+	assert(r >= 0);
+	state.num = 0;
+	r = ioctl(b->control, VHOST_SET_VRING_BASE, &state);
+	assert(r >= 0);
+	addr.desc_user_addr = (uint64_t)(unsigned long)b->vring.desc;
+	addr.avail_user_addr = (uint64_t)(unsigned long)b->vring.avail;
+	addr.used_user_addr = (uint64_t)(unsigned long)b->vring.used;
+	r = ioctl(b->control, VHOST_SET_VRING_ADDR, &addr);
+	assert(r >= 0);
+
+	b->kick = eventfd(0, EFD_NONBLOCK);
+	b->call = eventfd(0, EFD_NONBLOCK);
+	assert(b->kick >= 0 && b->call >= 0);
+	file.fd = b->kick;
+	r = ioctl(b->control, VHOST_SET_VRING_KICK, &file);
+	assert(r >= 0);
+	file.fd = b->call;
+	r = ioctl(b->control, VHOST_SET_VRING_CALL, &file);
+	assert(r >= 0);
+	file.fd = b->tap;
+	r = ioctl(b->control, VHOST_NET_SET_BACKEND, &file);
+	assert(r >= 0);
+}
+
+static void wait_for_interrupt(struct bench *b)
+{
+	struct pollfd fd = { .fd = b->call, .events = POLLIN };
+	unsigned long long val;
+
+	poll(&fd, 1, -1);
+	if (fd.revents & POLLIN)
+		read(b->call, &val, sizeof val);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(struct bench *b, size_t len, long packets, int batch)
+{
+	long started = 0, completed = 0;
+	struct scatterlist sl;
+	bool progress;
+	double time;
+	unsigned int blen;
+	void *slot;
+	int r;
+
+	time = now();
+	while (completed < packets) {
+		virtqueue_disable_cb(b->vq);
+		do {
+			progress = false;
+			while (started < packets &&
+			       started - completed < batch) {
+				slot = b->buf + (started % RING_NUM) *
+					b->slot_size;
+				sg_init_one(&sl, slot, VNET_HDR_LEN + len);
+				r = virtqueue_add_outbuf(b->vq, &sl, 1, slot,
+							 GFP_ATOMIC);
+				if (r)
+					break;
+				++started;
+				progress = true;
+			}
+			if (progress)
+				virtqueue_kick(b->vq);
+
+			while (virtqueue_get_buf(b->vq, &blen)) {
+				++completed;
+				progress = true;
+			}
+		} while (progress && completed < packets);
+
+		if (completed < packets && virtqueue_enable_cb(b->vq))
+			wait_for_interrupt(b);
+	}
+	time = now() - time;
+
+	printf("%zu byte packets: %ld in %.3f s, %.0f pps, %.3f Gbit/s\n",
+	       len, packets, time, packets / time,
+	       packets * len * 8 / time / 1e9);
+}
+
+static const struct option longopts[] = {
+	{ .name = "help", .val = 'h' },
+	{ .name = "size", .val = 's', .has_arg = required_argument },
+	{ .name = "packets", .val = 'n', .has_arg = required_argument },
+	{ .name = "batch", .val = 'b', .has_arg = required_argument },
+	{ .name = "tap", .val = 't', .has_arg = required_argument },
+	{ }
+};
+
+static void help(void)
+{
+	fprintf(stderr, "Usage: vhost_net_bench [--help]"
+		" [--size=bytes]"
+		" [--packets=N]"
+		" [--batch=N]"
+		" [--tap=name]"
+		"\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = "vhnbench0";
+	long packets = 1000000;
+	struct bench b;
+	size_t len = 64;
+	int batch = 64;
+	int o;
+
+	for (;;) {
+		o = getopt_long(argc, argv, "h", longopts, NULL);
+		switch (o) {
+		case -1:
+			goto done;
+		case 'h':
+			help();
+			exit(0);
+		case 's':
+			len = strtoul(optarg, NULL, 10);
+			assert(len >= 14 && len <= 65535);
+			break;
+		case 'n':
+			packets = strtol(optarg, NULL, 10);
+			assert(packets > 0);
+			break;
+		case 'b':
+			batch = strtol(optarg, NULL, 10);
+			assert(batch > 0 && batch <= RING_NUM);
+			break;
+		case 't':
+			name = optarg;
+			break;
+		default:
+			help();
+			exit(2);
+		}
+	}
+
+done:
+	bench_init(&b, len, name);
+	run(&b, len, packets, batch);
+	return 0;
+}
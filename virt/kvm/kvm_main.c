@@ -59,6 +59,7 @@
 #include "coalesced_mmio.h"
 #include "async_pf.h"
 #include "vfio.h"
+#include "mmu_lock.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/kvm.h>
@@ -89,6 +90,14 @@ unsigned int halt_poll_ns_shrink;
 module_param(halt_poll_ns_shrink, uint, 0644);
 EXPORT_SYMBOL_GPL(halt_poll_ns_shrink);
 
+/*
+ * If non-zero, size the per-vcpu halt_poll_ns from the histogram of its
+ * recent halts so that the poll catches this percentage of the wakeups,
+ * and do not poll if that takes longer than the maximum.
+ */
+static unsigned int halt_poll_adaptive_pct;
+module_param(halt_poll_adaptive_pct, uint, 0644);
+
 /*
  * Ordering of locks:
  *
@@ -114,6 +123,8 @@ EXPORT_SYMBOL_GPL(kvm_debugfs_dir);
 static int kvm_debugfs_num_entries;
 static const struct file_operations stat_fops_per_vm;
 
+static int kvm_get_stats_fd(struct kvm *kvm, struct kvm_vcpu *vcpu);
+
 static long kvm_vcpu_ioctl(struct file *file, unsigned int ioctl,
 			   unsigned long arg);
 #ifdef CONFIG_KVM_COMPAT
@@ -143,7 +154,9 @@ static void hardware_disable_all(void);
 
 static void kvm_io_bus_destroy(struct kvm_io_bus *bus);
 
-static void mark_page_dirty_in_slot(struct kvm_memory_slot *memslot, gfn_t gfn);
+static void mark_page_dirty_in_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot,
+				    gfn_t gfn);
 
 __visible bool kvm_rebooting;
 EXPORT_SYMBOL_GPL(kvm_rebooting);
@@ -417,6 +430,7 @@ static void kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 
 void kvm_vcpu_destroy(struct kvm_vcpu *vcpu)
 {
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 	kvm_arch_vcpu_destroy(vcpu);
 
 	/*
@@ -458,13 +472,13 @@ static void kvm_mmu_notifier_change_pte(struct mmu_notifier *mn,
 	int idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	kvm->mmu_notifier_seq++;
 
 	if (kvm_set_spte_hva(kvm, address, pte))
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
 
@@ -475,7 +489,7 @@ static int kvm_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
 	int need_tlb_flush = 0, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * The count increase must become visible at unlock time as no
 	 * spte can be established without taking the mmu_lock and
@@ -489,7 +503,7 @@ static int kvm_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
 	if (need_tlb_flush)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return 0;
@@ -500,7 +514,7 @@ static void kvm_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
 {
 	struct kvm *kvm = mmu_notifier_to_kvm(mn);
 
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * This sequence increase will notify the kvm page fault that
 	 * the page that is going to be mapped in the spte could have
@@ -514,7 +528,7 @@ static void kvm_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
 	 * in conjunction with the smp_rmb in mmu_notifier_retry().
 	 */
 	kvm->mmu_notifier_count--;
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 
 	BUG_ON(kvm->mmu_notifier_count < 0);
 }
@@ -528,13 +542,13 @@ static int kvm_mmu_notifier_clear_flush_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 
 	young = kvm_age_hva(kvm, start, end);
 	if (young)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -549,7 +563,7 @@ static int kvm_mmu_notifier_clear_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * Even though we do not flush TLB, this will still adversely
 	 * affect performance on pre-Haswell Intel EPT, where there is
@@ -564,7 +578,7 @@ static int kvm_mmu_notifier_clear_young(struct mmu_notifier *mn,
 	 * more sophisticated heuristic later.
 	 */
 	young = kvm_age_hva(kvm, start, end);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -578,9 +592,9 @@ static int kvm_mmu_notifier_test_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	young = kvm_test_age_hva(kvm, address);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -745,7 +759,7 @@ static struct kvm *kvm_create_vm(unsigned long type)
 	if (!kvm)
 		return ERR_PTR(-ENOMEM);
 
-	spin_lock_init(&kvm->mmu_lock);
+	KVM_MMU_LOCK_INIT(kvm);
 	mmgrab(current->mm);
 	kvm->mm = current->mm;
 	kvm_eventfd_init(kvm);
@@ -780,6 +794,7 @@ static struct kvm *kvm_create_vm(unsigned long type)
 	}
 
 	kvm->max_halt_poll_ns = halt_poll_ns;
+	kvm->halt_poll_adaptive_pct = min(READ_ONCE(halt_poll_adaptive_pct), 100U);
 
 	r = kvm_arch_init_vm(kvm, type);
 	if (r)
@@ -1314,6 +1329,7 @@ int __kvm_set_memory_region(struct kvm *kvm,
 		return kvm_delete_memslot(kvm, mem, &old, as_id);
 
 	new.id = id;
+	new.as_id = as_id;
 	new.base_gfn = mem->guest_phys_addr >> PAGE_SHIFT;
 	new.npages = mem->memory_size >> PAGE_SHIFT;
 	new.flags = mem->flags;
@@ -1510,7 +1526,7 @@ static int kvm_get_dirty_log_protect(struct kvm *kvm, struct kvm_dirty_log *log)
 		dirty_bitmap_buffer = kvm_second_dirty_bitmap(memslot);
 		memset(dirty_bitmap_buffer, 0, n);
 
-		spin_lock(&kvm->mmu_lock);
+		KVM_MMU_LOCK(kvm);
 		for (i = 0; i < n / sizeof(long); i++) {
 			unsigned long mask;
 			gfn_t offset;
@@ -1526,7 +1542,7 @@ static int kvm_get_dirty_log_protect(struct kvm *kvm, struct kvm_dirty_log *log)
 			kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot,
 								offset, mask);
 		}
-		spin_unlock(&kvm->mmu_lock);
+		KVM_MMU_UNLOCK(kvm);
 	}
 
 	if (flush)
@@ -1617,7 +1633,7 @@ static int kvm_clear_dirty_log_protect(struct kvm *kvm,
 	if (copy_from_user(dirty_bitmap_buffer, log->dirty_bitmap, n))
 		return -EFAULT;
 
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	for (offset = log->first_page, i = offset / BITS_PER_LONG,
 		 n = DIV_ROUND_UP(log->num_pages, BITS_PER_LONG); n--;
 	     i++, offset += BITS_PER_LONG) {
@@ -1640,7 +1656,7 @@ static int kvm_clear_dirty_log_protect(struct kvm *kvm,
 								offset, mask);
 		}
 	}
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 
 	if (flush)
 		kvm_arch_flush_remote_tlbs_memslot(kvm, memslot);
@@ -2192,7 +2208,8 @@ int kvm_vcpu_map(struct kvm_vcpu *vcpu, gfn_t gfn, struct kvm_host_map *map)
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_map);
 
-static void __kvm_unmap_gfn(struct kvm_memory_slot *memslot,
+static void __kvm_unmap_gfn(struct kvm *kvm,
+			struct kvm_memory_slot *memslot,
 			struct kvm_host_map *map,
 			struct gfn_to_pfn_cache *cache,
 			bool dirty, bool atomic)
@@ -2217,7 +2234,7 @@ static void __kvm_unmap_gfn(struct kvm_memory_slot *memslot,
 #endif
 
 	if (dirty)
-		mark_page_dirty_in_slot(memslot, map->gfn);
+		mark_page_dirty_in_slot(kvm, memslot, map->gfn);
 
 	if (cache)
 		cache->dirty |= dirty;
@@ -2231,7 +2248,7 @@ static void __kvm_unmap_gfn(struct kvm_memory_slot *memslot,
 int kvm_unmap_gfn(struct kvm_vcpu *vcpu, struct kvm_host_map *map, 
 		  struct gfn_to_pfn_cache *cache, bool dirty, bool atomic)
 {
-	__kvm_unmap_gfn(gfn_to_memslot(vcpu->kvm, map->gfn), map,
+	__kvm_unmap_gfn(vcpu->kvm, gfn_to_memslot(vcpu->kvm, map->gfn), map,
 			cache, dirty, atomic);
 	return 0;
 }
@@ -2239,7 +2256,8 @@ EXPORT_SYMBOL_GPL(kvm_unmap_gfn);
 
 void kvm_vcpu_unmap(struct kvm_vcpu *vcpu, struct kvm_host_map *map, bool dirty)
 {
-	__kvm_unmap_gfn(kvm_vcpu_gfn_to_memslot(vcpu, map->gfn), map, NULL,
+	__kvm_unmap_gfn(vcpu->kvm, kvm_vcpu_gfn_to_memslot(vcpu, map->gfn),
+			map, NULL,
 			dirty, false);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_unmap);
@@ -2414,7 +2432,8 @@ int kvm_vcpu_read_guest_atomic(struct kvm_vcpu *vcpu, gpa_t gpa,
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_read_guest_atomic);
 
-static int __kvm_write_guest_page(struct kvm_memory_slot *memslot, gfn_t gfn,
+static int __kvm_write_guest_page(struct kvm *kvm,
+				  struct kvm_memory_slot *memslot, gfn_t gfn,
 			          const void *data, int offset, int len)
 {
 	int r;
@@ -2426,7 +2445,7 @@ static int __kvm_write_guest_page(struct kvm_memory_slot *memslot, gfn_t gfn,
 	r = __copy_to_user((void __user *)addr + offset, data, len);
 	if (r)
 		return -EFAULT;
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(kvm, memslot, gfn);
 	return 0;
 }
 
@@ -2435,7 +2454,7 @@ int kvm_write_guest_page(struct kvm *kvm, gfn_t gfn,
 {
 	struct kvm_memory_slot *slot = gfn_to_memslot(kvm, gfn);
 
-	return __kvm_write_guest_page(slot, gfn, data, offset, len);
+	return __kvm_write_guest_page(kvm, slot, gfn, data, offset, len);
 }
 EXPORT_SYMBOL_GPL(kvm_write_guest_page);
 
@@ -2444,7 +2463,7 @@ int kvm_vcpu_write_guest_page(struct kvm_vcpu *vcpu, gfn_t gfn,
 {
 	struct kvm_memory_slot *slot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
 
-	return __kvm_write_guest_page(slot, gfn, data, offset, len);
+	return __kvm_write_guest_page(vcpu->kvm, slot, gfn, data, offset, len);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_write_guest_page);
 
@@ -2563,7 +2582,7 @@ int kvm_write_guest_offset_cached(struct kvm *kvm, struct gfn_to_hva_cache *ghc,
 	r = __copy_to_user((void __user *)ghc->hva + offset, data, len);
 	if (r)
 		return -EFAULT;
-	mark_page_dirty_in_slot(ghc->memslot, gpa >> PAGE_SHIFT);
+	mark_page_dirty_in_slot(kvm, ghc->memslot, gpa >> PAGE_SHIFT);
 
 	return 0;
 }
@@ -2639,12 +2658,28 @@ int kvm_clear_guest(struct kvm *kvm, gpa_t gpa, unsigned long len)
 }
 EXPORT_SYMBOL_GPL(kvm_clear_guest);
 
-static void mark_page_dirty_in_slot(struct kvm_memory_slot *memslot,
+/*
+ * With the dirty ring enabled the page goes to the ring of the running
+ * vcpu.  Pages dirtied outside of vcpu context, or while the ring is
+ * full, still land in the dirty bitmap and are returned by
+ * KVM_GET_DIRTY_LOG.
+ */
+static void mark_page_dirty_in_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot,
 				    gfn_t gfn)
 {
 	if (memslot && memslot->dirty_bitmap) {
 		unsigned long rel_gfn = gfn - memslot->base_gfn;
-
+		u32 slot = (memslot->as_id << 16) | memslot->id;
+		struct kvm_vcpu *vcpu;
+
+		if (kvm->dirty_ring_size) {
+			vcpu = kvm_get_running_vcpu();
+			if (vcpu && vcpu->kvm == kvm &&
+			    kvm_dirty_ring_push(&vcpu->dirty_ring, slot,
+						rel_gfn))
+				return;
+		}
 		set_bit_le(rel_gfn, memslot->dirty_bitmap);
 	}
 }
@@ -2654,7 +2689,7 @@ void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 	struct kvm_memory_slot *memslot;
 
 	memslot = gfn_to_memslot(kvm, gfn);
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(kvm, memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(mark_page_dirty);
 
@@ -2663,7 +2698,7 @@ void kvm_vcpu_mark_page_dirty(struct kvm_vcpu *vcpu, gfn_t gfn)
 	struct kvm_memory_slot *memslot;
 
 	memslot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(vcpu->kvm, memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_mark_page_dirty);
 
@@ -2727,6 +2762,70 @@ static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu)
 	trace_kvm_halt_poll_ns_shrink(vcpu->vcpu_id, val, old);
 }
 
+static void halt_poll_hist_add(struct kvm_vcpu *vcpu, u64 block_ns,
+			       bool polled, bool contended)
+{
+	struct kvm_halt_poll_hist *hist = &vcpu->halt_poll_hist;
+	int i, bucket = 0;
+
+	if (block_ns >= KVM_HALT_POLL_HIST_MIN_NS)
+		bucket = min_t(int, ilog2(block_ns) + 1 -
+			       KVM_HALT_POLL_HIST_MIN_SHIFT,
+			       KVM_HALT_POLL_HIST_BUCKETS - 1);
+
+	hist->count[bucket]++;
+	hist->polls += polled;
+	hist->contended += contended;
+
+	if (++hist->samples < KVM_HALT_POLL_HIST_WINDOW)
+		return;
+
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++)
+		hist->count[i] /= 2;
+	hist->samples /= 2;
+	hist->polls /= 2;
+	hist->contended /= 2;
+}
+
+/*
+ * Poll for the shortest time that would have caught the requested share of
+ * the recent wakeups, if that fits within the maximum.  The maximum shrinks
+ * with the share of polls that other runnable tasks have cut short, so that
+ * vCPUs poll less when the host CPUs are contended.
+ */
+static void adapt_halt_poll_ns(struct kvm_vcpu *vcpu)
+{
+	struct kvm_halt_poll_hist *hist = &vcpu->halt_poll_hist;
+	unsigned int max = vcpu->kvm->max_halt_poll_ns;
+	unsigned int pct = vcpu->kvm->halt_poll_adaptive_pct;
+	unsigned int old = vcpu->halt_poll_ns, val = 0;
+	unsigned int needed, seen = 0;
+	int i;
+
+	if (hist->polls)
+		max -= (u64)max * hist->contended / hist->polls;
+
+	needed = DIV_ROUND_UP(hist->samples * pct, 100);
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS - 1; i++) {
+		unsigned int limit = KVM_HALT_POLL_HIST_MIN_NS << i;
+
+		if (limit > max)
+			break;
+
+		seen += hist->count[i];
+		if (seen && seen >= needed) {
+			val = limit;
+			break;
+		}
+	}
+
+	vcpu->halt_poll_ns = val;
+	if (val > old)
+		trace_kvm_halt_poll_ns_grow(vcpu->vcpu_id, val, old);
+	else if (val < old)
+		trace_kvm_halt_poll_ns_shrink(vcpu->vcpu_id, val, old);
+}
+
 static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
 {
 	int ret = -EINTR;
@@ -2762,7 +2861,7 @@ update_halt_poll_stats(struct kvm_vcpu *vcpu, u64 poll_ns, bool waited)
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
 	ktime_t start, cur, poll_end;
-	bool waited = false;
+	bool waited = false, polled = false, contended = false;
 	u64 block_ns;
 
 	kvm_arch_vcpu_blocking(vcpu);
@@ -2772,6 +2871,7 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 		ktime_t stop = ktime_add_ns(ktime_get(), vcpu->halt_poll_ns);
 
 		++vcpu->stat.halt_attempted_poll;
+		polled = true;
 		do {
 			/*
 			 * This sets KVM_REQ_UNHALT if an interrupt
@@ -2784,7 +2884,11 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 				goto out;
 			}
 			poll_end = cur = ktime_get();
-		} while (single_task_running() && ktime_before(cur, stop));
+			if (!single_task_running()) {
+				contended = ktime_before(cur, stop);
+				break;
+			}
+		} while (ktime_before(cur, stop));
 	}
 
 	prepare_to_rcuwait(&vcpu->wait);
@@ -2807,7 +2911,12 @@ out:
 		vcpu, ktime_to_ns(ktime_sub(poll_end, start)), waited);
 
 	if (!kvm_arch_no_poll(vcpu)) {
-		if (!vcpu_valid_wakeup(vcpu)) {
+		if (vcpu->kvm->halt_poll_adaptive_pct) {
+			/* Polling does not help if the vCPU stays halted. */
+			halt_poll_hist_add(vcpu, vcpu_valid_wakeup(vcpu) ?
+					   block_ns : U64_MAX, polled, contended);
+			adapt_halt_poll_ns(vcpu);
+		} else if (!vcpu_valid_wakeup(vcpu)) {
 			shrink_halt_poll_ns(vcpu);
 		} else if (vcpu->kvm->max_halt_poll_ns) {
 			if (block_ns <= vcpu->halt_poll_ns)
@@ -3004,6 +3113,17 @@ void kvm_vcpu_on_spin(struct kvm_vcpu *me, bool yield_to_kernel_mode)
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_on_spin);
 
+static bool kvm_page_in_dirty_ring(struct kvm *kvm, unsigned long pgoff)
+{
+#if KVM_DIRTY_LOG_PAGE_OFFSET > 0
+	return (pgoff >= KVM_DIRTY_LOG_PAGE_OFFSET) &&
+	    (pgoff < KVM_DIRTY_LOG_PAGE_OFFSET +
+	     kvm->dirty_ring_size / PAGE_SIZE);
+#else
+	return false;
+#endif
+}
+
 static vm_fault_t kvm_vcpu_fault(struct vm_fault *vmf)
 {
 	struct kvm_vcpu *vcpu = vmf->vma->vm_file->private_data;
@@ -3019,6 +3139,10 @@ static vm_fault_t kvm_vcpu_fault(struct vm_fault *vmf)
 	else if (vmf->pgoff == KVM_COALESCED_MMIO_PAGE_OFFSET)
 		page = virt_to_page(vcpu->kvm->coalesced_mmio_ring);
 #endif
+	else if (kvm_page_in_dirty_ring(vcpu->kvm, vmf->pgoff))
+		page = kvm_dirty_ring_get_page(
+		    &vcpu->dirty_ring,
+		    vmf->pgoff - KVM_DIRTY_LOG_PAGE_OFFSET);
 	else
 		return kvm_arch_vcpu_fault(vcpu, vmf);
 	get_page(page);
@@ -3032,6 +3156,15 @@ static const struct vm_operations_struct kvm_vcpu_vm_ops = {
 
 static int kvm_vcpu_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct kvm_vcpu *vcpu = file->private_data;
+	unsigned long pages = vma_pages(vma);
+
+	/* The ring is only ever shared with userspace, never executed */
+	if ((kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff) ||
+	     kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff + pages - 1)) &&
+	    ((vma->vm_flags & VM_EXEC) || !(vma->vm_flags & VM_SHARED)))
+		return -EINVAL;
+
 	vma->vm_ops = &kvm_vcpu_vm_ops;
 	return 0;
 }
@@ -3063,9 +3196,26 @@ static int create_vcpu_fd(struct kvm_vcpu *vcpu)
 	return anon_inode_getfd(name, &kvm_vcpu_fops, vcpu, O_RDWR | O_CLOEXEC);
 }
 
+static int halt_poll_hist_show(struct seq_file *m, void *v)
+{
+	struct kvm_vcpu *vcpu = m->private;
+	struct kvm_halt_poll_hist *hist = &vcpu->halt_poll_hist;
+	int i;
+
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS - 1; i++)
+		seq_printf(m, "<%u ns: %u\n", KVM_HALT_POLL_HIST_MIN_NS << i,
+			   READ_ONCE(hist->count[i]));
+	seq_printf(m, ">=%u ns: %u\n", KVM_HALT_POLL_HIST_MIN_NS << (i - 1),
+		   READ_ONCE(hist->count[i]));
+	seq_printf(m, "polls: %u\ncontended: %u\nhalt_poll_ns: %u\n",
+		   READ_ONCE(hist->polls), READ_ONCE(hist->contended),
+		   READ_ONCE(vcpu->halt_poll_ns));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(halt_poll_hist);
+
 static void kvm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 {
-#ifdef __KVM_HAVE_ARCH_VCPU_DEBUGFS
 	struct dentry *debugfs_dentry;
 	char dir_name[ITOA_MAX_LEN * 2];
 
@@ -3076,6 +3226,10 @@ static void kvm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 	debugfs_dentry = debugfs_create_dir(dir_name,
 					    vcpu->kvm->debugfs_dentry);
 
+	debugfs_create_file("halt_poll_histogram", 0444, debugfs_dentry, vcpu,
+			    &halt_poll_hist_fops);
+
+#ifdef __KVM_HAVE_ARCH_VCPU_DEBUGFS
 	kvm_arch_create_vcpu_debugfs(vcpu, debugfs_dentry);
 #endif
 }
@@ -3125,6 +3279,13 @@ static int kvm_vm_ioctl_create_vcpu(struct kvm *kvm, u32 id)
 	if (r)
 		goto vcpu_free_run_page;
 
+	if (kvm->dirty_ring_size) {
+		r = kvm_dirty_ring_alloc(&vcpu->dirty_ring,
+					 id, kvm->dirty_ring_size);
+		if (r)
+			goto arch_vcpu_destroy;
+	}
+
 	mutex_lock(&kvm->lock);
 	if (kvm_get_vcpu_by_id(kvm, id)) {
 		r = -EEXIST;
@@ -3158,6 +3319,8 @@ static int kvm_vm_ioctl_create_vcpu(struct kvm *kvm, u32 id)
 
 unlock_vcpu_destroy:
 	mutex_unlock(&kvm->lock);
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
+arch_vcpu_destroy:
 	kvm_arch_vcpu_destroy(vcpu);
 vcpu_free_run_page:
 	free_page((unsigned long)vcpu->run);
@@ -3378,6 +3541,9 @@ out_free1:
 		r = kvm_arch_vcpu_ioctl_set_fpu(vcpu, fpu);
 		break;
 	}
+	case KVM_GET_STATS_FD:
+		r = kvm_get_stats_fd(vcpu->kvm, vcpu);
+		break;
 	default:
 		r = kvm_arch_vcpu_ioctl(filp, ioctl, arg);
 	}
@@ -3609,6 +3775,8 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 	case KVM_CAP_CHECK_EXTENSION_VM:
 	case KVM_CAP_ENABLE_CAP_VM:
 	case KVM_CAP_HALT_POLL:
+	case KVM_CAP_HALT_POLL_ADAPTIVE:
+	case KVM_CAP_BINARY_STATS_FD:
 		return 1;
 #ifdef CONFIG_KVM_MMIO
 	case KVM_CAP_COALESCED_MMIO:
@@ -3630,12 +3798,78 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 #endif
 	case KVM_CAP_NR_MEMSLOTS:
 		return KVM_USER_MEM_SLOTS;
+	case KVM_CAP_DIRTY_LOG_RING:
+#if defined(CONFIG_HAVE_KVM_DIRTY_RING) && KVM_DIRTY_LOG_PAGE_OFFSET > 0
+		return KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn);
+#else
+		return 0;
+#endif
 	default:
 		break;
 	}
 	return kvm_vm_ioctl_check_extension(kvm, arg);
 }
 
+static int kvm_vm_ioctl_enable_dirty_log_ring(struct kvm *kvm, u32 size)
+{
+	int r;
+
+	if (!KVM_DIRTY_LOG_PAGE_OFFSET)
+		return -EINVAL;
+
+	/* the size should be power of 2 */
+	if (!size || (size & (size - 1)))
+		return -EINVAL;
+
+	/* Should be bigger to keep the reserved entries, or a page */
+	if (size < kvm_dirty_ring_get_rsvd_entries() *
+	    sizeof(struct kvm_dirty_gfn) || size < PAGE_SIZE)
+		return -EINVAL;
+
+	if (size > KVM_DIRTY_RING_MAX_ENTRIES *
+	    sizeof(struct kvm_dirty_gfn))
+		return -E2BIG;
+
+	/* We only allow it to set once */
+	if (kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->lock);
+
+	if (kvm->created_vcpus) {
+		/* We don't allow to change this value after vcpu created */
+		r = -EINVAL;
+	} else {
+		kvm->dirty_ring_size = size;
+		r = 0;
+	}
+
+	mutex_unlock(&kvm->lock);
+	return r;
+}
+
+static int kvm_vm_ioctl_reset_dirty_pages(struct kvm *kvm)
+{
+	int i;
+	struct kvm_vcpu *vcpu;
+	int cleared = 0;
+
+	if (!kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->slots_lock);
+
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		cleared += kvm_dirty_ring_reset(vcpu->kvm, &vcpu->dirty_ring);
+
+	mutex_unlock(&kvm->slots_lock);
+
+	if (cleared)
+		kvm_flush_remote_tlbs(kvm);
+
+	return cleared;
+}
+
 int __attribute__((weak)) kvm_vm_ioctl_enable_cap(struct kvm *kvm,
 						  struct kvm_enable_cap *cap)
 {
@@ -3666,6 +3900,15 @@ static int kvm_vm_ioctl_enable_cap_generic(struct kvm *kvm,
 		kvm->max_halt_poll_ns = cap->args[0];
 		return 0;
 	}
+	case KVM_CAP_HALT_POLL_ADAPTIVE: {
+		if (cap->flags || cap->args[0] > 100)
+			return -EINVAL;
+
+		kvm->halt_poll_adaptive_pct = cap->args[0];
+		return 0;
+	}
+	case KVM_CAP_DIRTY_LOG_RING:
+		return kvm_vm_ioctl_enable_dirty_log_ring(kvm, cap->args[0]);
 	default:
 		return kvm_vm_ioctl_enable_cap(kvm, cap);
 	}
@@ -3693,6 +3936,12 @@ static long kvm_vm_ioctl(struct file *filp,
 		r = kvm_vm_ioctl_enable_cap_generic(kvm, &cap);
 		break;
 	}
+	case KVM_RESET_DIRTY_RINGS:
+		r = kvm_vm_ioctl_reset_dirty_pages(kvm);
+		break;
+	case KVM_GET_STATS_FD:
+		r = kvm_get_stats_fd(kvm, NULL);
+		break;
 	case KVM_SET_USER_MEMORY_REGION: {
 		struct kvm_userspace_memory_region kvm_userspace_mem;
 
@@ -4524,6 +4773,206 @@ static const struct file_operations stat_fops_per_vm = {
 	.llseek = no_llseek,
 };
 
+/*
+ * Binary statistics fd.  The descriptors are those of debugfs_entries of
+ * the fd's kind, plus the halt polling histogram for a vcpu; they are laid
+ * out with the header and id once, when the fd is created, and only the
+ * values are gathered again on every read.
+ */
+#define KVM_STATS_NAME_SIZE	48
+#define KVM_STATS_DESC_SIZE	(sizeof(struct kvm_stats_desc) + KVM_STATS_NAME_SIZE)
+
+struct kvm_stats_fd {
+	struct kvm *kvm;
+	struct kvm_vcpu *vcpu;		/* NULL for the VM statistics */
+	size_t data_size;
+	size_t blob_size;
+	char blob[];			/* header, id, descriptors */
+};
+
+static void kvm_stats_init_desc(struct kvm_stats_desc *desc, const char *name,
+				u32 flags, s16 exponent, u16 size,
+				u32 *offset)
+{
+	desc->flags = flags;
+	desc->exponent = exponent;
+	desc->size = size;
+	desc->offset = *offset;
+	strscpy(desc->name, name, KVM_STATS_NAME_SIZE);
+	*offset += size * sizeof(u64);
+}
+
+static struct kvm_stats_fd *kvm_stats_fd_alloc(struct kvm *kvm,
+					       struct kvm_vcpu *vcpu)
+{
+	enum kvm_stat_kind kind = vcpu ? KVM_STAT_VCPU : KVM_STAT_VM;
+	struct kvm_stats_debugfs_item *p;
+	struct kvm_stats_header *header;
+	struct kvm_stats_desc *desc;
+	struct kvm_stats_fd *sfd;
+	u32 num_desc = 0, offset = 0;
+	size_t blob_size;
+
+	for (p = debugfs_entries; p->name; p++)
+		if (p->kind == kind)
+			num_desc++;
+	if (vcpu)
+		num_desc++;
+
+	blob_size = sizeof(*header) + KVM_STATS_NAME_SIZE +
+		    num_desc * KVM_STATS_DESC_SIZE;
+	sfd = kzalloc(sizeof(*sfd) + blob_size, GFP_KERNEL_ACCOUNT);
+	if (!sfd)
+		return NULL;
+
+	sfd->kvm = kvm;
+	sfd->vcpu = vcpu;
+	sfd->blob_size = blob_size;
+
+	header = (struct kvm_stats_header *)sfd->blob;
+	header->name_size = KVM_STATS_NAME_SIZE;
+	header->num_desc = num_desc;
+	header->id_offset = sizeof(*header);
+	header->desc_offset = header->id_offset + KVM_STATS_NAME_SIZE;
+	header->data_offset = blob_size;
+
+	if (vcpu)
+		snprintf(sfd->blob + header->id_offset, KVM_STATS_NAME_SIZE,
+			 "kvm-%d/vcpu-%d", task_pid_nr(current), vcpu->vcpu_id);
+	else
+		snprintf(sfd->blob + header->id_offset, KVM_STATS_NAME_SIZE,
+			 "kvm-%d", task_pid_nr(current));
+
+	desc = (void *)sfd->blob + header->desc_offset;
+	for (p = debugfs_entries; p->name; p++) {
+		if (p->kind != kind)
+			continue;
+		kvm_stats_init_desc(desc, p->name, p->stats_flags,
+				    p->stats_exponent, 1, &offset);
+		desc = (void *)desc + KVM_STATS_DESC_SIZE;
+	}
+	if (vcpu) {
+		kvm_stats_init_desc(desc, "halt_poll_hist",
+				    KVM_STATS_TYPE_LOG_HIST |
+				    KVM_STATS_UNIT_SECONDS,
+				    -9, KVM_HALT_POLL_HIST_BUCKETS, &offset);
+		desc->bucket_size = KVM_HALT_POLL_HIST_MIN_NS;
+	}
+
+	sfd->data_size = offset;
+	return sfd;
+}
+
+static void kvm_stats_fill(struct kvm_stats_fd *sfd, u64 *data)
+{
+	enum kvm_stat_kind kind = sfd->vcpu ? KVM_STAT_VCPU : KVM_STAT_VM;
+	struct kvm_stats_debugfs_item *p;
+	int i;
+
+	for (p = debugfs_entries; p->name; p++) {
+		if (p->kind != kind)
+			continue;
+		if (sfd->vcpu)
+			*data++ = READ_ONCE(*(u64 *)((void *)sfd->vcpu + p->offset));
+		else
+			*data++ = READ_ONCE(*(ulong *)((void *)sfd->kvm + p->offset));
+	}
+	if (sfd->vcpu)
+		for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++)
+			*data++ = READ_ONCE(sfd->vcpu->halt_poll_hist.count[i]);
+}
+
+static ssize_t kvm_stats_read(struct file *file, char __user *buf,
+			      size_t size, loff_t *ppos)
+{
+	struct kvm_stats_fd *sfd = file->private_data;
+	size_t total = sfd->blob_size + sfd->data_size;
+	size_t copied = 0, len;
+	loff_t pos = *ppos;
+	void *data;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= total)
+		return 0;
+	size = min_t(size_t, size, total - pos);
+
+	if (pos < sfd->blob_size) {
+		len = min_t(size_t, size, sfd->blob_size - pos);
+		if (copy_to_user(buf, sfd->blob + pos, len))
+			return -EFAULT;
+		copied = len;
+		pos += len;
+	}
+
+	if (copied < size) {
+		data = kmalloc(sfd->data_size, GFP_KERNEL_ACCOUNT);
+		if (!data)
+			return -ENOMEM;
+		kvm_stats_fill(sfd, data);
+		len = size - copied;
+		if (copy_to_user(buf + copied, data + pos - sfd->blob_size,
+				 len)) {
+			kfree(data);
+			return -EFAULT;
+		}
+		kfree(data);
+		copied += len;
+		pos += len;
+	}
+
+	*ppos = pos;
+	return copied;
+}
+
+static int kvm_stats_release(struct inode *inode, struct file *file)
+{
+	struct kvm_stats_fd *sfd = file->private_data;
+
+	kvm_put_kvm(sfd->kvm);
+	kfree(sfd);
+	return 0;
+}
+
+static const struct file_operations kvm_stats_fops = {
+	.owner = THIS_MODULE,
+	.read = kvm_stats_read,
+	.release = kvm_stats_release,
+	.llseek = noop_llseek,
+};
+
+static int kvm_get_stats_fd(struct kvm *kvm, struct kvm_vcpu *vcpu)
+{
+	struct kvm_stats_fd *sfd;
+	struct file *file;
+	int fd;
+
+	sfd = kvm_stats_fd_alloc(kvm, vcpu);
+	if (!sfd)
+		return -ENOMEM;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		goto out_free;
+
+	file = anon_inode_getfile("kvm-stats", &kvm_stats_fops, sfd, O_RDONLY);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		fd = PTR_ERR(file);
+		goto out_free;
+	}
+	/* A single pread() returns the whole file */
+	file->f_mode |= FMODE_PREAD;
+
+	kvm_get_kvm(kvm);
+	fd_install(fd, file);
+	return fd;
+
+out_free:
+	kfree(sfd);
+	return fd;
+}
+
 static int vm_stat_get(void *_offset, u64 *val)
 {
 	unsigned offset = (long)_offset;